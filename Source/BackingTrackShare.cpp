@@ -0,0 +1,489 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#include "BackingTrackShare.h"
+
+#define TRK_HEADER_TAG "SBTRK1 "
+#define TRK_CHUNK_SIZE 65536
+#define TRK_CONNECT_TIMEOUT_MS 5000
+// for all of the header
+#define TRK_HEADER_TIMEOUT_MS 5000
+// for every chunk
+#define TRK_IO_TIMEOUT_MS 30000
+// how often the server checks if it should stop while waiting for connections
+#define TRK_POLL_MS 250
+// no more than that in one file
+#define TRK_MAX_FILE_BYTES ((int64) 2 << 30)
+
+namespace SonoAudio {
+
+using SocketTransfer::readLine;
+using SocketTransfer::writeString;
+
+String BackingTrackShare::computeId(const File & file)
+{
+    FileInputStream in (file);
+    if (!in.openedOk()) return {};
+
+    uint64 hash = 14695981039346656037ULL;
+    HeapBlock<uint8> buf (TRK_CHUNK_SIZE);
+    int64 size = 0;
+
+    for (int num; (num = in.read(buf, TRK_CHUNK_SIZE)) > 0; ) {
+        for (int i = 0; i < num; ++i) {
+            hash = (hash ^ buf[i]) * 1099511628211ULL;
+        }
+        size += num;
+    }
+
+    return String::toHexString(size) + "-" + String::toHexString((int64) hash);
+}
+
+bool BackingTrackShare::isValidId(const String & id)
+{
+    // two 64 bit numbers in hex, as toHexString() writes them
+    const auto isHexPart = [] (const String & part) {
+        return part.isNotEmpty() && part.length() <= 16 && part.containsOnly("0123456789abcdef");
+    };
+    return id.containsChar('-')
+        && isHexPart(id.upToFirstOccurrenceOf("-", false, false))
+        && isHexPart(id.fromFirstOccurrenceOf("-", false, false));
+}
+
+BackingTrackServer::BackingTrackServer()
+: Thread("BackingTrackServer"),
+  connections(MaxConnections, [this] (StreamingSocket & connection, TransferPool::Job & job) { serve(connection, job); })
+{
+}
+
+BackingTrackServer::~BackingTrackServer()
+{
+    stop();
+}
+
+bool BackingTrackServer::start()
+{
+    stop();
+
+    if (!listener.createListener(BackingTrackShare::DefaultPort) && !listener.createListener(0)) {
+        DBG("Error listening for backing track fetches");
+        return false;
+    }
+
+    port = listener.getBoundPort();
+    // below the audio and network threads, it's in no hurry
+    startThread(2);
+
+    DBG("Offering backing tracks on port " << port);
+    return true;
+}
+
+void BackingTrackServer::stop()
+{
+    if (isThreadRunning()) {
+        signalThreadShouldExit();
+        stopThread(TRK_IO_TIMEOUT_MS);
+    }
+    connections.stopAll(TRK_IO_TIMEOUT_MS);
+    listener.close();
+    port = 0;
+}
+
+void BackingTrackServer::setOffer(const File & file)
+{
+    const ScopedLock sl (offerLock);
+    if (file == offerFile) return;
+
+    offerFile = file;
+    offerId.clear();
+    offerChanged = true;
+}
+
+File BackingTrackServer::getOfferFile() const
+{
+    const ScopedLock sl (offerLock);
+    return offerFile;
+}
+
+String BackingTrackServer::getOfferId() const
+{
+    const ScopedLock sl (offerLock);
+    return offerId;
+}
+
+void BackingTrackServer::run()
+{
+    while (!threadShouldExit()) {
+        File file;
+        {
+            const ScopedLock sl (offerLock);
+            if (offerChanged) {
+                file = offerFile;
+                offerChanged = false;
+            }
+        }
+        if (file != File()) {
+            const String id = BackingTrackShare::computeId(file);
+            const ScopedLock sl (offerLock);
+            // unless it changed again in the meantime
+            if (file == offerFile && !offerChanged) {
+                offerId = id;
+            }
+        }
+
+        const int ready = listener.waitUntilReady(true, TRK_POLL_MS);
+        if (ready < 0) {
+            wait(TRK_POLL_MS);
+            continue;
+        }
+        if (ready == 0) continue;
+
+        std::unique_ptr<StreamingSocket> connection (listener.waitForNextConnection());
+        if (connection) {
+            connections.add(std::move(connection));
+        }
+    }
+}
+
+void BackingTrackServer::serve(StreamingSocket & connection, TransferPool::Job & job)
+{
+    const String host = connection.getHostName();
+    if (isAllowed && !isAllowed(host)) {
+        DBG("Refused backing track fetch from " << host);
+        return;
+    }
+
+    String line;
+    if (!readLine(connection, line, 256, TRK_HEADER_TIMEOUT_MS) || !line.startsWith(TRK_HEADER_TAG)) return;
+
+    const String id = line.substring((int) strlen(TRK_HEADER_TAG)).trim();
+    File file;
+    {
+        const ScopedLock sl (offerLock);
+        if (id.isNotEmpty() && id == offerId) {
+            file = offerFile;
+        }
+    }
+
+    FileInputStream in (file);
+    if (file == File() || !in.openedOk()) {
+        writeString(connection, "ERR\n");
+        return;
+    }
+
+    const int64 size = in.getTotalLength();
+    if (!writeString(connection, "OK " + String(size) + "\n")) return;
+
+    HeapBlock<char> buf (TRK_CHUNK_SIZE);
+    int64 sent = 0;
+
+    while (sent < size) {
+        if (job.shouldExit()) return;
+
+        const int num = in.read(buf, (int) jmin((int64) TRK_CHUNK_SIZE, size - sent));
+        if (num <= 0 || connection.write(buf, num) != num) return;
+        sent += num;
+
+        // with all the other fetches going
+        if (!job.waitUntil(pacer.sent(num))) return;
+    }
+
+    DBG("Backing track " << id << " went to " << host);
+}
+
+BackingTrackFetcher::BackingTrackFetcher(const File & dir)
+: Thread("BackingTrackFetch"), cacheDir(dir)
+{
+}
+
+BackingTrackFetcher::~BackingTrackFetcher()
+{
+    signalThreadShouldExit();
+    notify();
+    {
+        const ScopedLock sl (socketLock);
+        if (currentSocket) {
+            currentSocket->close();
+        }
+    }
+    stopThread(TRK_CONNECT_TIMEOUT_MS);
+}
+
+void BackingTrackFetcher::addFetch(const Job & job)
+{
+    if (!BackingTrackShare::isValidId(job.id) || job.port <= 0 || getCachedFile(job.id) != File()) return;
+
+    {
+        const ScopedLock sl (jobsLock);
+        if (pendingIds.contains(job.id)) return;
+        jobs.push_back(job);
+        pendingIds.add(job.id);
+    }
+
+    if (!isThreadRunning()) {
+        startThread(2);
+    }
+    notify();
+}
+
+File BackingTrackFetcher::getCachedFile(const String & id) const
+{
+    if (!BackingTrackShare::isValidId(id)) return {};
+
+    const ScopedLock sl (jobsLock);
+
+    auto iter = known.find(id);
+    if (iter != known.end()) {
+        if (iter->second.existsAsFile()) return iter->second;
+        known.erase(iter);
+    }
+
+    // named by the id, with the extension of the original
+    const Array<File> found = cacheDir.findChildFiles(File::findFiles, false, id + ".*");
+    for (auto & file : found) {
+        if (file.getFileExtension() != ".part") {
+            known[id] = file;
+            return file;
+        }
+    }
+    return {};
+}
+
+bool BackingTrackFetcher::isPending(const String & id) const
+{
+    const ScopedLock sl (jobsLock);
+    return pendingIds.contains(id);
+}
+
+void BackingTrackFetcher::run()
+{
+    while (!threadShouldExit()) {
+        Job job;
+        {
+            const ScopedLock sl (jobsLock);
+            if (!jobs.empty()) {
+                job = jobs.front();
+                jobs.pop_front();
+            }
+        }
+
+        if (job.port <= 0) {
+            wait(-1);
+            continue;
+        }
+
+        if (fetch(job)) {
+            const ScopedLock sl (jobsLock);
+            pendingIds.removeString(job.id);
+            continue;
+        }
+
+        if (threadShouldExit()) break;
+
+        if (++job.attempts >= MaxAttempts) {
+            DBG("Giving up on fetching backing track " << job.id << " from " << job.host);
+            const ScopedLock sl (jobsLock);
+            pendingIds.removeString(job.id);
+            continue;
+        }
+
+        {
+            const ScopedLock sl (jobsLock);
+            jobs.push_back(job);
+        }
+        wait(RetryDelayMs);
+    }
+}
+
+bool BackingTrackFetcher::fetch(const Job & job)
+{
+    if (!cacheDir.createDirectory()) {
+        DBG("Error creating backing track cache " << cacheDir.getFullPathName());
+        return false;
+    }
+
+    StreamingSocket socket;
+    {
+        const ScopedLock sl (socketLock);
+        if (threadShouldExit()) return false;
+        currentSocket = &socket;
+    }
+
+    struct Forget {
+        ~Forget() {
+            const ScopedLock sl (owner.socketLock);
+            owner.currentSocket = nullptr;
+        }
+        BackingTrackFetcher & owner;
+    } forget { *this };
+
+    if (!socket.connect(job.host, job.port, TRK_CONNECT_TIMEOUT_MS)) return false;
+    if (!writeString(socket, TRK_HEADER_TAG + job.id + "\n")) return false;
+
+    String line;
+    if (!readLine(socket, line, 64, TRK_IO_TIMEOUT_MS) || !line.startsWith("OK ")) return false;
+
+    const int64 size = line.substring(3).trim().getLargeIntValue();
+    if (size <= 0 || size > TRK_MAX_FILE_BYTES) return false;
+
+    // the format goes by the extension
+    const String ext = job.name.containsChar('.') ? File::createLegalFileName(job.name.fromLastOccurrenceOf(".", true, false)) : String(".audio");
+    const File dest = cacheDir.getChildFile(job.id + ext);
+    const File partial = dest.getSiblingFile(dest.getFileName() + ".part");
+
+    {
+        std::unique_ptr<FileOutputStream> out (partial.createOutputStream());
+        if (!out || out->failedToOpen()) return false;
+        out->setPosition(0);
+        out->truncate();
+
+        HeapBlock<char> buf (TRK_CHUNK_SIZE);
+        for (int64 remaining = size; remaining > 0; ) {
+            if (threadShouldExit() || socket.waitUntilReady(true, TRK_IO_TIMEOUT_MS) <= 0) {
+                out.reset();
+                partial.deleteFile();
+                return false;
+            }
+            const int num = socket.read(buf, (int) jmin((int64) TRK_CHUNK_SIZE, remaining), false);
+            if (num <= 0 || !out->write(buf, (size_t) num)) {
+                out.reset();
+                partial.deleteFile();
+                return false;
+            }
+            remaining -= num;
+        }
+    }
+
+    if (BackingTrackShare::computeId(partial) != job.id || !partial.moveFileTo(dest)) {
+        DBG("Backing track " << job.id << " didn't come through intact");
+        partial.deleteFile();
+        return false;
+    }
+
+    {
+        const ScopedLock sl (jobsLock);
+        known[job.id] = dest;
+    }
+
+    DBG("Fetched backing track " << job.id << " from " << job.host << " into " << dest.getFullPathName());
+    if (onFetched) {
+        onFetched(job.id, dest);
+    }
+    return true;
+}
+
+BackingTrackPlayer::BackingTrackPlayer(TimeSliceThread & readAheadThread)
+: thread(readAheadThread)
+{
+}
+
+BackingTrackPlayer::~BackingTrackPlayer()
+{
+    unload();
+}
+
+void BackingTrackPlayer::prepare(double sampleRate, int blockSize)
+{
+    transport.prepareToPlay(blockSize, sampleRate);
+    deviceRate = sampleRate;
+    scratch.setSize(2, jmax(1, blockSize));
+    scratch.clear();
+}
+
+bool BackingTrackPlayer::load(const File & newfile, AudioFormatManager & formats)
+{
+    if (newfile == file && source) return true;
+
+    std::unique_ptr<AudioFormatReader> reader (formats.createReaderFor(newfile));
+    if (!reader) {
+        DBG("Could not read backing track " << newfile.getFullPathName());
+        return false;
+    }
+
+    {
+        const SpinLock::ScopedLockType sl (stateLock);
+        loaded = false;
+    }
+
+    const double rate = reader->sampleRate;
+    const int chans = (int) reader->numChannels;
+    auto newsource = std::make_unique<AudioFormatReaderSource>(reader.release(), true);
+
+    // takes the audio thread's lock while it swaps them
+    transport.setSource(newsource.get(), 65536, &thread, rate, 2);
+    source = std::move(newsource);
+    file = newfile;
+    // it stays going, the audio thread keeps it where it has to be
+    transport.start();
+
+    const SpinLock::ScopedLockType sl (stateLock);
+    sourceChannels = chans;
+    loaded = true;
+    return true;
+}
+
+void BackingTrackPlayer::unload()
+{
+    {
+        const SpinLock::ScopedLockType sl (stateLock);
+        loaded = false;
+    }
+    transport.stop();
+    transport.setSource(nullptr);
+    source.reset();
+    file = File();
+}
+
+File BackingTrackPlayer::getFile() const
+{
+    return file;
+}
+
+void BackingTrackPlayer::follow(bool isplaying, double pos, uint64 ntptime)
+{
+    const SpinLock::ScopedLockType sl (stateLock);
+    playing = isplaying;
+    position = pos;
+    time = ntptime;
+}
+
+void BackingTrackPlayer::addTo(AudioBuffer<float> & dest, int numChannels, int numSamples, uint64 now)
+{
+    const SpinLock::ScopedTryLockType sl (stateLock);
+    if (!sl.isLocked() || !loaded || !playing || numChannels <= 0) return;
+
+    const double samplerate = deviceRate;
+    if (samplerate <= 0.0) return;
+
+    // NTP times, 32 bits of fraction
+    double want = position + (double) (int64) (now - time) / 4294967296.0;
+    const double blocksecs = numSamples / samplerate;
+    if (want + blocksecs <= 0.0 || want >= transport.getLengthInSeconds()) return;
+
+    // when it starts in the middle of this block
+    int offset = 0;
+    if (want < 0.0) {
+        offset = jmin(numSamples, (int) (-want * samplerate));
+        want = 0.0;
+    }
+
+    if (std::abs(transport.getCurrentPosition() - want) > MaxOffsetSeconds) {
+        transport.setPosition(want);
+    }
+
+    for (int done = offset; done < numSamples; ) {
+        const int num = jmin(numSamples - done, scratch.getNumSamples());
+        AudioSourceChannelInfo info (&scratch, 0, num);
+        transport.getNextAudioBlock(info);
+
+        for (int ch = 0; ch < numChannels && ch < dest.getNumChannels(); ++ch) {
+            // a mono one goes to all of them
+            const int srcch = sourceChannels == 1 ? 0 : ch;
+            if (srcch >= scratch.getNumChannels() || srcch >= sourceChannels) break;
+            dest.addFrom(ch, done, scratch, srcch, 0, num);
+        }
+        done += num;
+    }
+}
+
+}
@@ -0,0 +1,174 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+#include "SocketTransfer.h"
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <map>
+
+namespace SonoAudio {
+
+// Shares a backing track as a file instead of as audio. The one playing it
+// offers the file, every peer fetches it once in the background (throttled on
+// the offering side, so it doesn't get in the way of the audio streams) and
+// plays its own copy, lined up by the clock shared with the peers. During the
+// performance that costs a message every now and then instead of a stream.
+//
+// What goes over the connection: "SBTRK1 " and the id of the file on one line,
+// the answer is "OK " and its size on one line and then the file, or "ERR".
+namespace BackingTrackShare {
+    // the one the server tries first, so it can be forwarded, any other if that's taken
+    static constexpr int DefaultPort = 11477;
+
+    // what a file is known by: its size and a 64 bit FNV-1a hash of it, in hex.
+    // Reads all of it, not for the message thread
+    String computeId(const File & file);
+
+    // whether it's of the form computeId() makes, what comes from a peer
+    // goes into file names and wildcards, so it must not be anything else
+    bool isValidId(const String & id);
+}
+
+// Hands out the file we offer, to whoever asks for it by its id. Each fetch is
+// served on a thread of its own, up to MaxConnections at once
+class BackingTrackServer : private Thread
+{
+public:
+    static constexpr int MaxConnections = 8;
+
+    // called on the threads serving the fetches, set it before start()
+    std::function<bool(const String & host)> isAllowed;
+
+    BackingTrackServer();
+    ~BackingTrackServer() override;
+
+    bool start();
+    void stop();
+
+    bool isRunning() const { return isThreadRunning(); }
+    int getPort() const { return port; }
+
+    // the id gets worked out on the server's thread, until then the offer is
+    // out of reach and getOfferId() is empty
+    void setOffer(const File & file);
+    File getOfferFile() const;
+    String getOfferId() const;
+
+    // bytes per second for all the fetches together, 0 for as fast as it goes
+    void setRateLimit(int bytesPerSecond) { pacer.setRate(bytesPerSecond); }
+
+private:
+    void run() override;
+    void serve(StreamingSocket & connection, TransferPool::Job & job);
+
+    StreamingSocket listener;
+    int port = 0;
+
+    CriticalSection offerLock;
+    File offerFile;
+    String offerId;
+    bool offerChanged = false;
+
+    TransferPacer pacer;
+    TransferPool connections;
+
+    JUCE_DECLARE_NON_COPYABLE (BackingTrackServer)
+};
+
+// Fetches offered files into the cache, one at a time
+class BackingTrackFetcher : private Thread
+{
+public:
+    struct Job {
+        String host;
+        int port = 0;
+        String id;
+        String name; // only for its extension
+        int attempts = 0;
+    };
+
+    // called on the fetcher's thread once a file is complete
+    std::function<void(const String & id, const File & file)> onFetched;
+
+    explicit BackingTrackFetcher(const File & cacheDir);
+    // gives up on what's left
+    ~BackingTrackFetcher() override;
+
+    // nothing happens if it's in the cache, or already on its way
+    void addFetch(const Job & job);
+
+    // File() if it hasn't been fetched
+    File getCachedFile(const String & id) const;
+    bool isPending(const String & id) const;
+
+private:
+    static constexpr int MaxAttempts = 3;
+    static constexpr int RetryDelayMs = 10000;
+
+    void run() override;
+    bool fetch(const Job & job);
+
+    const File cacheDir;
+
+    CriticalSection jobsLock;
+    std::deque<Job> jobs;
+    StringArray pendingIds;
+    // what was found in the cache so far, so it's only looked for once
+    mutable std::map<String, File> known;
+
+    // the connection of the fetch going, closed from outside to stop it
+    CriticalSection socketLock;
+    StreamingSocket * currentSocket = nullptr;
+
+    JUCE_DECLARE_NON_COPYABLE (BackingTrackFetcher)
+};
+
+// Plays a backing track that came from a peer, where their playback of it is.
+// The event thread says where that is (the position at a time in our clock), the
+// audio thread works out from it where each block has to come from and only
+// moves the playback when it's more than MaxOffsetSeconds off, so a clock
+// estimate that wobbles a bit doesn't make it skip.
+class BackingTrackPlayer
+{
+public:
+    static constexpr double MaxOffsetSeconds = 0.015;
+
+    explicit BackingTrackPlayer(TimeSliceThread & readAheadThread);
+    ~BackingTrackPlayer();
+
+    // not on the audio thread, any of these
+    void prepare(double sampleRate, int blockSize);
+    bool load(const File & file, AudioFormatManager & formats);
+    void unload();
+    File getFile() const;
+
+    // at position seconds at our NTP time, or not playing
+    void follow(bool playing, double position, uint64 time);
+
+    // audio thread: adds the block heard at our NTP time to the first numChannels of dest
+    void addTo(AudioBuffer<float> & dest, int numChannels, int numSamples, uint64 time);
+
+private:
+    TimeSliceThread & thread;
+    AudioTransportSource transport;
+    std::unique_ptr<AudioFormatReaderSource> source;
+    File file;
+    int sourceChannels = 0;
+    double deviceRate = 0.0;
+    AudioBuffer<float> scratch;
+
+    SpinLock stateLock; // try-locked on the audio thread
+    bool loaded = false;
+    bool playing = false;
+    double position = 0.0;
+    uint64 time = 0;
+
+    JUCE_DECLARE_NON_COPYABLE (BackingTrackPlayer)
+};
+
+}
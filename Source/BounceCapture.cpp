@@ -0,0 +1,217 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#include "BounceCapture.h"
+
+namespace SonoAudio {
+
+namespace {
+    // in front of every block in the ring, the channels follow one after the other
+    struct RecordHeader
+    {
+        int64 position;
+        int32 numSamples;
+        int32 numChannels;
+    };
+}
+
+BounceCapture::BounceCapture(double samplerate, int numchannels)
+: Thread("BounceCapture"), sampleRate(samplerate), numChannels(jmax(1, numchannels))
+{
+    static_assert(sizeof(RecordHeader) == RecordHeaderSize, "bad record header");
+
+    // room for a couple of seconds, even in small blocks
+    const int ringbytes = (int) (RingSeconds * sampleRate) * numChannels * (int) sizeof(float) + 1024 * RecordHeaderSize;
+    ring.setSize((size_t) ringbytes);
+    fifo.setTotalSize(ringbytes);
+
+    frames.allocate((size_t) (PageFrames * numChannels), true);
+
+    startThread(4);
+}
+
+BounceCapture::~BounceCapture()
+{
+    signalThreadShouldExit();
+    notify();
+    stopThread(2000);
+
+    output.reset();
+    input.reset();
+    if (file != File()) {
+        file.deleteFile();
+    }
+}
+
+bool BounceCapture::write(int64 position, const AudioBuffer<float> & src, int numSamples)
+{
+    if (numSamples <= 0 || position < 0) return true;
+
+    const int chans = jmin(numChannels, src.getNumChannels());
+    const int total = RecordHeaderSize + numSamples * chans * (int) sizeof(float);
+
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite(total, start1, size1, start2, size2);
+    if (size1 + size2 < total) {
+        droppedSamples.fetch_add(numSamples, std::memory_order_relaxed);
+        return false;
+    }
+
+    // the whole record goes in at once, the thread never sees half of one
+    char * dest = static_cast<char *>(ring.getData());
+    int offset = 0;
+    auto put = [&] (const void * data, int size) {
+        auto * bytes = static_cast<const char *>(data);
+        const int first = jlimit(0, size, size1 - offset);
+        if (first > 0) memcpy(dest + start1 + offset, bytes, (size_t) first);
+        if (size > first) memcpy(dest + start2 + (offset + first - size1), bytes + first, (size_t) (size - first));
+        offset += size;
+    };
+
+    const RecordHeader head { position, numSamples, chans };
+    put(&head, RecordHeaderSize);
+    for (int ch = 0; ch < chans; ++ch) {
+        put(src.getReadPointer(ch), numSamples * (int) sizeof(float));
+    }
+
+    fifo.finishedWrite(total);
+    return true;
+}
+
+void BounceCapture::addTo(int64 position, AudioBuffer<float> & dest, int numSamples)
+{
+    const ScopedLock sl (fileLock);
+
+    // what is still on its way to the file belongs to it already
+    writePendingData();
+
+    if (!output || position < 0 || numSamples <= 0) return;
+
+    if (!input) {
+        input = file.createInputStream();
+        if (!input) return;
+    }
+
+    const int chans = jmin(numChannels, dest.getNumChannels());
+
+    for (int done = 0; done < numSamples; ) {
+        const int64 frame = position + done;
+        const int inpage = (int) (frame % PageFrames);
+        const int num = jmin(numSamples - done, PageFrames - inpage);
+
+        auto page = pages.find(frame / PageFrames);
+        if (page != pages.end()) {
+            const int bytes = num * numChannels * (int) sizeof(float);
+            input->setPosition(page->second + (int64) inpage * numChannels * (int64) sizeof(float));
+            if (input->read(frames.get(), bytes) == bytes) {
+                for (int ch = 0; ch < chans; ++ch) {
+                    float * out = dest.getWritePointer(ch, done);
+                    const float * in = frames.get() + ch;
+                    for (int i = 0; i < num; ++i) {
+                        out[i] += in[(size_t) (i * numChannels)];
+                    }
+                }
+            }
+        }
+        done += num;
+    }
+}
+
+void BounceCapture::run()
+{
+    while (!threadShouldExit()) {
+        int written = 0;
+        {
+            const ScopedLock sl (fileLock);
+            written = writePendingData();
+        }
+        if (written == 0) {
+            wait(20);
+        }
+    }
+}
+
+int BounceCapture::writePendingData()
+{
+    int written = 0;
+
+    while (fifo.getNumReady() >= RecordHeaderSize) {
+        RecordHeader head;
+        popBytes(&head, RecordHeaderSize);
+
+        const int bytes = head.numSamples * head.numChannels * (int) sizeof(float);
+        record.ensureSize((size_t) bytes);
+        popBytes(record.getData(), bytes);
+
+        if (openFile()) {
+            writeFrames(head.position, static_cast<const float *>(record.getData()), head.numChannels, head.numSamples);
+        }
+        written += RecordHeaderSize + bytes;
+    }
+
+    if (written > 0 && output) {
+        output->flush();
+    }
+    return written;
+}
+
+bool BounceCapture::openFile()
+{
+    if (output) return true;
+    if (file != File()) return false; // couldn't, don't keep trying
+
+    file = File::getSpecialLocation(File::tempDirectory).getNonexistentChildFile("SonoBus-bounce", ".tmp", false);
+    output = file.createOutputStream();
+    if (output && output->failedToOpen()) {
+        output.reset();
+    }
+    if (!output) {
+        DBG("Could not create the bounce capture file " << file.getFullPathName());
+        return false;
+    }
+    return true;
+}
+
+void BounceCapture::writeFrames(int64 position, const float * planar, int chans, int numSamples)
+{
+    const int64 pagebytes = (int64) PageFrames * numChannels * (int64) sizeof(float);
+
+    for (int done = 0; done < numSamples; ) {
+        const int64 frame = position + done;
+        const int inpage = (int) (frame % PageFrames);
+        const int num = jmin(numSamples - done, PageFrames - inpage);
+
+        auto page = pages.find(frame / PageFrames);
+        if (page == pages.end()) {
+            // a new page starts out silent
+            page = pages.emplace(frame / PageFrames, fileSize).first;
+            frames.clear((size_t) (PageFrames * numChannels));
+            output->setPosition(fileSize);
+            output->write(frames.get(), (size_t) pagebytes);
+            fileSize += pagebytes;
+        }
+
+        for (int i = 0; i < num; ++i) {
+            float * out = frames.get() + (size_t) (i * numChannels);
+            for (int ch = 0; ch < numChannels; ++ch) {
+                out[ch] = ch < chans ? planar[(size_t) (ch * numSamples + done + i)] : 0.0f;
+            }
+        }
+
+        output->setPosition(page->second + (int64) inpage * numChannels * (int64) sizeof(float));
+        output->write(frames.get(), (size_t) (num * numChannels) * sizeof(float));
+        done += num;
+    }
+}
+
+void BounceCapture::popBytes(void * dest, int size)
+{
+    int start1, size1, start2, size2;
+    fifo.prepareToRead(size, start1, size1, start2, size2);
+    auto * bytes = static_cast<char *>(dest);
+    memcpy(bytes, static_cast<const char *>(ring.getData()) + start1, (size_t) size1);
+    if (size2 > 0) memcpy(bytes + size1, static_cast<const char *>(ring.getData()) + start2, (size_t) size2);
+    fifo.finishedRead(size1 + size2);
+}
+
+}
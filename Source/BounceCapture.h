@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include <atomic>
+#include <map>
+
+namespace SonoAudio {
+
+// Keeps what the other users sounded like against the host timeline, so an
+// offline bounce can put it back where it was heard instead of running the
+// sinks (which underrun when processBlock goes faster than real time).
+// While the host plays in real time the audio thread pushes the peer mix
+// into a single producer, single consumer ring, a thread of its own writes it
+// to a temporary file. Whatever plays the same part of the timeline again
+// replaces it, so the last take counts.
+//
+// The file is made of pages of PageFrames interleaved frames, allocated as the
+// timeline gets covered, so only the parts actually played take up space.
+// Where nothing was captured the bounce gets silence.
+class BounceCapture : private Thread
+{
+public:
+    BounceCapture(double sampleRate, int numChannels);
+    ~BounceCapture() override;
+
+    double getSampleRate() const { return sampleRate; }
+    int getNumChannels() const { return numChannels; }
+
+    // audio thread, real time: the first numChannels of src are what was heard for
+    // the host samples from position on. Returns false if they had to be dropped
+    bool write(int64 position, const AudioBuffer<float> & src, int numSamples);
+
+    // audio thread, offline: adds what was captured for the host samples from
+    // position on into dest. This waits on the disk, which is fine when bouncing
+    void addTo(int64 position, AudioBuffer<float> & dest, int numSamples);
+
+    int64 getDroppedSamples() const { return droppedSamples.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr int PageFrames = 16384;
+    static constexpr double RingSeconds = 2.0;
+    static constexpr int RecordHeaderSize = 16;
+
+    void run() override;
+
+    // under fileLock
+    int writePendingData();
+    bool openFile();
+    void writeFrames(int64 position, const float * planar, int chans, int numSamples);
+    void popBytes(void * dest, int size);
+
+    const double sampleRate;
+    const int numChannels;
+
+    AbstractFifo fifo { 1 };
+    MemoryBlock ring;
+    std::atomic<int64> droppedSamples { 0 };
+
+    CriticalSection fileLock;
+    File file;
+    std::unique_ptr<FileOutputStream> output;
+    std::unique_ptr<FileInputStream> input;
+    // page of the timeline -> its offset in the file
+    std::map<int64, int64> pages;
+    int64 fileSize = 0;
+    MemoryBlock record;
+    HeapBlock<float> frames;
+
+    JUCE_DECLARE_NON_COPYABLE (BounceCapture)
+};
+
+}
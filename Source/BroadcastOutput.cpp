@@ -0,0 +1,294 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#include "BroadcastOutput.h"
+
+namespace SonoAudio {
+
+// what the encoder writes into, straight out the socket. Once a send fails
+// everything after it is thrown away, the encoder thread notices and reconnects
+class BroadcastOutput::SocketStream : public OutputStream
+{
+public:
+    SocketStream(StreamingSocket & sock, std::atomic<int64> & sent)
+    : socket(sock), bytesSent(sent) {}
+
+    bool write(const void * data, size_t numBytes) override
+    {
+        const char * bytes = static_cast<const char*>(data);
+        while (numBytes > 0 && !failed) {
+            if (socket.waitUntilReady(false, SendTimeoutMs) <= 0) {
+                failed = true;
+                break;
+            }
+            const int num = socket.write(bytes, (int) jmin(numBytes, (size_t) 65536));
+            if (num <= 0) {
+                failed = true;
+                break;
+            }
+            bytes += num;
+            numBytes -= (size_t) num;
+            position += num;
+            bytesSent.fetch_add(num, std::memory_order_relaxed);
+        }
+        return !failed;
+    }
+
+    void flush() override {}
+    bool setPosition(int64) override { return false; }
+    int64 getPosition() override { return position; }
+
+    bool hasFailed() const { return failed; }
+
+private:
+    StreamingSocket & socket;
+    std::atomic<int64> & bytesSent;
+    int64 position = 0;
+    bool failed = false;
+};
+
+BroadcastOutput::BroadcastOutput()
+: Thread("BroadcastOutput")
+{
+}
+
+BroadcastOutput::~BroadcastOutput()
+{
+    stop();
+}
+
+bool BroadcastOutput::parseUrl(const String & url, String & outHost, int & outPort, String & outMount, String & outUser, String & outPassword)
+{
+    String rest = url.trim();
+    if (rest.containsIgnoreCase("://")) {
+        const String scheme = rest.upToFirstOccurrenceOf("://", false, true).toLowerCase();
+        if (scheme != "icecast" && scheme != "http") return false;
+        rest = rest.fromFirstOccurrenceOf("://", false, true);
+    }
+
+    String hostport = rest.upToFirstOccurrenceOf("/", false, false);
+    outMount = rest.fromFirstOccurrenceOf("/", true, false);
+
+    outUser = "source";
+    outPassword.clear();
+    if (hostport.containsChar('@')) {
+        const String userinfo = URL::removeEscapeChars(hostport.upToLastOccurrenceOf("@", false, false));
+        hostport = hostport.fromLastOccurrenceOf("@", false, false);
+        if (userinfo.containsChar(':')) {
+            if (userinfo.upToFirstOccurrenceOf(":", false, false).isNotEmpty()) {
+                outUser = userinfo.upToFirstOccurrenceOf(":", false, false);
+            }
+            outPassword = userinfo.fromFirstOccurrenceOf(":", false, false);
+        } else {
+            outPassword = userinfo;
+        }
+    }
+
+    outPort = 8000;
+    outHost = hostport;
+    if (hostport.containsChar(':')) {
+        outHost = hostport.upToLastOccurrenceOf(":", false, false);
+        outPort = hostport.fromLastOccurrenceOf(":", false, false).getIntValue();
+    }
+
+    return outHost.isNotEmpty() && outPort > 0 && outPort < 65536 && outMount.length() > 1;
+}
+
+bool BroadcastOutput::start(const String & url, double samplerate, int numChannels, int qualityIndex)
+{
+    stop();
+
+    if (!parseUrl(url, host, port, mount, user, password)) {
+        setError(TRANS("Invalid broadcast URL"));
+        return false;
+    }
+    if (samplerate <= 0.0 || numChannels < 1 || numChannels > 2) {
+        setError(TRANS("The broadcast needs a mono or stereo mix"));
+        return false;
+    }
+
+    sampleRate = samplerate;
+    quality = jlimit(0, OggVorbisAudioFormat().getQualityOptions().size() - 1, qualityIndex);
+
+    const int ringsize = (int) (RingSeconds * sampleRate);
+    ring.setSize(numChannels, ringsize, false, false, true);
+    ring.clear();
+    fifo.setTotalSize(ringsize);
+    fifo.reset();
+
+    droppedSamples = 0;
+    bytesSent = 0;
+    setError({});
+    state = StateConnecting;
+
+    // above the upload threads, below audio and network, it has to keep up
+    startThread(5);
+
+    DBG("Broadcasting to " << host << ":" << port << mount);
+    return true;
+}
+
+void BroadcastOutput::stop()
+{
+    if (isThreadRunning()) {
+        signalThreadShouldExit();
+        notify();
+        stopThread(ConnectTimeoutMs + SendTimeoutMs);
+    }
+    disconnect();
+    state = StateIdle;
+}
+
+bool BroadcastOutput::write(const float * const * data, int numChannels, int numSamples)
+{
+    if (state.load() == StateIdle) return false;
+
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite(numSamples, start1, size1, start2, size2);
+
+    if (size1 + size2 < numSamples) {
+        droppedSamples.fetch_add(numSamples, std::memory_order_relaxed);
+        return false;
+    }
+
+    for (int ch = 0; ch < ring.getNumChannels(); ++ch) {
+        // a mono mix goes to both sides
+        const float * src = data[jmin(ch, numChannels - 1)];
+        if (size1 > 0) ring.copyFrom(ch, start1, src, size1);
+        if (size2 > 0) ring.copyFrom(ch, start2, src + size1, size2);
+    }
+    fifo.finishedWrite(size1 + size2);
+    return true;
+}
+
+String BroadcastOutput::getLastError() const
+{
+    const ScopedLock sl (errorLock);
+    return lastError;
+}
+
+void BroadcastOutput::setError(const String & err)
+{
+    const ScopedLock sl (errorLock);
+    lastError = err;
+}
+
+bool BroadcastOutput::connect()
+{
+    if (!socket.connect(host, port, ConnectTimeoutMs)) {
+        setError(TRANS("Could not connect to ") + host + ":" + String(port));
+        return false;
+    }
+
+    // the PUT from Icecast 2.4 on, no chunked encoding, it just keeps going
+    String request;
+    request << "PUT " << mount << " HTTP/1.1\r\n"
+            << "Host: " << host << ":" << port << "\r\n"
+            << "Authorization: Basic " << Base64::toBase64(user + ":" + password) << "\r\n"
+            << "User-Agent: SonoBus/" << ProjectInfo::versionString << "\r\n"
+            << "Content-Type: application/ogg\r\n"
+            << "Ice-Public: 0\r\n"
+            << "Ice-Name: SonoBus\r\n"
+            << "Expect: 100-continue\r\n"
+            << "\r\n";
+
+    const int len = (int) request.getNumBytesAsUTF8();
+    if (socket.write(request.toRawUTF8(), len) != len) {
+        setError(TRANS("Could not connect to ") + host + ":" + String(port));
+        socket.close();
+        return false;
+    }
+
+    // just the status line matters, the rest of the headers are read off and ignored
+    MemoryOutputStream response;
+    char c = 0;
+    while (response.getDataSize() < 4096) {
+        if (socket.waitUntilReady(true, ConnectTimeoutMs) <= 0 || socket.read(&c, 1, false) != 1) break;
+        response.writeByte(c);
+        const auto size = response.getDataSize();
+        if (size >= 4 && memcmp(static_cast<const char*>(response.getData()) + size - 4, "\r\n\r\n", 4) == 0) break;
+    }
+
+    const String status = response.toUTF8().upToFirstOccurrenceOf("\r\n", false, false);
+    const int code = status.fromFirstOccurrenceOf(" ", false, false).getIntValue();
+    if (code != 100 && code != 200) {
+        setError(TRANS("The server refused the broadcast: ") + (status.isNotEmpty() ? status : TRANS("no answer")));
+        socket.close();
+        return false;
+    }
+
+    stream = new SocketStream(socket, bytesSent);
+    writer.reset(OggVorbisAudioFormat().createWriterFor(stream, sampleRate, (unsigned int) ring.getNumChannels(), 32, {}, quality));
+    if (!writer) {
+        // it didn't take the stream then
+        delete stream;
+        stream = nullptr;
+        setError(TRANS("Error creating the broadcast encoder"));
+        socket.close();
+        return false;
+    }
+
+    setError({});
+    return true;
+}
+
+void BroadcastOutput::disconnect()
+{
+    // the encoder finishes into the socket if it still can
+    writer.reset();
+    stream = nullptr;
+    socket.close();
+}
+
+void BroadcastOutput::run()
+{
+    int retryMs = RetryMinMs;
+
+    while (!threadShouldExit()) {
+        if (!writer) {
+            state = StateConnecting;
+            if (!connect()) {
+                state = StateRetrying;
+                DBG("Broadcast: " << getLastError() << ", trying again in " << retryMs << " ms");
+
+                // whatever comes in meanwhile is gone, the broadcast picks up live
+                const double until = Time::getMillisecondCounterHiRes() + retryMs;
+                while (!threadShouldExit() && Time::getMillisecondCounterHiRes() < until) {
+                    fifo.finishedRead(fifo.getNumReady());
+                    wait(50);
+                }
+                retryMs = jmin(retryMs * 2, RetryMaxMs);
+                continue;
+            }
+
+            // skip the backlog from while we were connecting
+            fifo.finishedRead(fifo.getNumReady());
+            state = StateStreaming;
+        }
+
+        int start1, size1, start2, size2;
+        fifo.prepareToRead(jmin(fifo.getNumReady(), MaxChunk), start1, size1, start2, size2);
+
+        if (size1 + size2 == 0) {
+            wait(5);
+            continue;
+        }
+
+        if (size1 > 0) writer->writeFromAudioSampleBuffer(ring, start1, size1);
+        if (size2 > 0) writer->writeFromAudioSampleBuffer(ring, start2, size2);
+        fifo.finishedRead(size1 + size2);
+
+        if (stream->hasFailed()) {
+            setError(TRANS("Lost the connection to ") + host + ":" + String(port));
+            DBG("Broadcast: " << getLastError());
+            disconnect();
+            state = StateRetrying;
+        } else {
+            retryMs = RetryMinMs;
+        }
+    }
+
+    disconnect();
+}
+
+}
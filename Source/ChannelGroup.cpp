@@ -42,23 +42,255 @@ static String numChanGroupsKey("numChanGroups");
 static String layoutGroupsKey("Layout");
 
 
-#define MAX_DELAY_SAMPLES 240000 // 5 seconds at 48k
+
+#if JUCE_INTEL
+ #include <immintrin.h>
+ #if defined(_MSC_VER) && !defined(__clang__)
+  #define SONO_AVX2_TARGET
+ #else
+  #define SONO_AVX2_TARGET __attribute__((target("avx2,fma")))
+ #endif
+#elif JUCE_ARM && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+ #include <arm_neon.h>
+ #define SONO_USE_NEON 1
+#endif
+
+
+// Ramped multiply-add kernels for the pan, monitor and reverb send mixing.
+// Gain goes linearly from startgain to endgain over numSamples, same as
+// AudioBuffer::addFromWithRamp (which is a plain scalar loop). The two destination
+// version reads the source only once for both sides of a stereo pan.
+// On x86 the AVX2 versions are selected at runtime, SSE is the baseline.
+
+#if JUCE_INTEL
+
+SONO_AVX2_TARGET
+static void addWithRampAvx2 (float * dest, const float * src, int numSamples, float startgain, float inc)
+{
+    int i = 0;
+    __m256 gain = _mm256_add_ps(_mm256_set1_ps(startgain), _mm256_mul_ps(_mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_ps(inc)));
+    const __m256 step = _mm256_set1_ps(inc * 8.0f);
+
+    for (; i + 8 <= numSamples; i += 8) {
+        _mm256_storeu_ps(dest + i, _mm256_fmadd_ps(_mm256_loadu_ps(src + i), gain, _mm256_loadu_ps(dest + i)));
+        gain = _mm256_add_ps(gain, step);
+    }
+    for (; i < numSamples; ++i) {
+        dest[i] += src[i] * (startgain + inc * i);
+    }
+}
+
+SONO_AVX2_TARGET
+static void addWithRamp2Avx2 (float * dest1, float * dest2, const float * src, int numSamples, float startgain1, float inc1, float startgain2, float inc2)
+{
+    int i = 0;
+    const __m256 idx = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256 gain1 = _mm256_add_ps(_mm256_set1_ps(startgain1), _mm256_mul_ps(idx, _mm256_set1_ps(inc1)));
+    __m256 gain2 = _mm256_add_ps(_mm256_set1_ps(startgain2), _mm256_mul_ps(idx, _mm256_set1_ps(inc2)));
+    const __m256 step1 = _mm256_set1_ps(inc1 * 8.0f);
+    const __m256 step2 = _mm256_set1_ps(inc2 * 8.0f);
+
+    for (; i + 8 <= numSamples; i += 8) {
+        const __m256 x = _mm256_loadu_ps(src + i);
+        _mm256_storeu_ps(dest1 + i, _mm256_fmadd_ps(x, gain1, _mm256_loadu_ps(dest1 + i)));
+        _mm256_storeu_ps(dest2 + i, _mm256_fmadd_ps(x, gain2, _mm256_loadu_ps(dest2 + i)));
+        gain1 = _mm256_add_ps(gain1, step1);
+        gain2 = _mm256_add_ps(gain2, step2);
+    }
+    for (; i < numSamples; ++i) {
+        dest1[i] += src[i] * (startgain1 + inc1 * i);
+        dest2[i] += src[i] * (startgain2 + inc2 * i);
+    }
+}
+
+static void addWithRampSse (float * dest, const float * src, int numSamples, float startgain, float inc)
+{
+    int i = 0;
+    __m128 gain = _mm_add_ps(_mm_set1_ps(startgain), _mm_mul_ps(_mm_setr_ps(0, 1, 2, 3), _mm_set1_ps(inc)));
+    const __m128 step = _mm_set1_ps(inc * 4.0f);
+
+    for (; i + 4 <= numSamples; i += 4) {
+        _mm_storeu_ps(dest + i, _mm_add_ps(_mm_loadu_ps(dest + i), _mm_mul_ps(_mm_loadu_ps(src + i), gain)));
+        gain = _mm_add_ps(gain, step);
+    }
+    for (; i < numSamples; ++i) {
+        dest[i] += src[i] * (startgain + inc * i);
+    }
+}
+
+static void addWithRamp2Sse (float * dest1, float * dest2, const float * src, int numSamples, float startgain1, float inc1, float startgain2, float inc2)
+{
+    int i = 0;
+    const __m128 idx = _mm_setr_ps(0, 1, 2, 3);
+    __m128 gain1 = _mm_add_ps(_mm_set1_ps(startgain1), _mm_mul_ps(idx, _mm_set1_ps(inc1)));
+    __m128 gain2 = _mm_add_ps(_mm_set1_ps(startgain2), _mm_mul_ps(idx, _mm_set1_ps(inc2)));
+    const __m128 step1 = _mm_set1_ps(inc1 * 4.0f);
+    const __m128 step2 = _mm_set1_ps(inc2 * 4.0f);
+
+    for (; i + 4 <= numSamples; i += 4) {
+        const __m128 x = _mm_loadu_ps(src + i);
+        _mm_storeu_ps(dest1 + i, _mm_add_ps(_mm_loadu_ps(dest1 + i), _mm_mul_ps(x, gain1)));
+        _mm_storeu_ps(dest2 + i, _mm_add_ps(_mm_loadu_ps(dest2 + i), _mm_mul_ps(x, gain2)));
+        gain1 = _mm_add_ps(gain1, step1);
+        gain2 = _mm_add_ps(gain2, step2);
+    }
+    for (; i < numSamples; ++i) {
+        dest1[i] += src[i] * (startgain1 + inc1 * i);
+        dest2[i] += src[i] * (startgain2 + inc2 * i);
+    }
+}
+
+static const bool useAvx2Kernels = SystemStats::hasAVX2() && SystemStats::hasFMA3();
+
+#elif SONO_USE_NEON
+
+static void addWithRampNeon (float * dest, const float * src, int numSamples, float startgain, float inc)
+{
+    int i = 0;
+    const float idxarr[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+    float32x4_t gain = vmlaq_n_f32(vdupq_n_f32(startgain), vld1q_f32(idxarr), inc);
+    const float32x4_t step = vdupq_n_f32(inc * 4.0f);
+
+    for (; i + 4 <= numSamples; i += 4) {
+        vst1q_f32(dest + i, vmlaq_f32(vld1q_f32(dest + i), vld1q_f32(src + i), gain));
+        gain = vaddq_f32(gain, step);
+    }
+    for (; i < numSamples; ++i) {
+        dest[i] += src[i] * (startgain + inc * i);
+    }
+}
+
+static void addWithRamp2Neon (float * dest1, float * dest2, const float * src, int numSamples, float startgain1, float inc1, float startgain2, float inc2)
+{
+    int i = 0;
+    const float idxarr[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+    const float32x4_t idx = vld1q_f32(idxarr);
+    float32x4_t gain1 = vmlaq_n_f32(vdupq_n_f32(startgain1), idx, inc1);
+    float32x4_t gain2 = vmlaq_n_f32(vdupq_n_f32(startgain2), idx, inc2);
+    const float32x4_t step1 = vdupq_n_f32(inc1 * 4.0f);
+    const float32x4_t step2 = vdupq_n_f32(inc2 * 4.0f);
+
+    for (; i + 4 <= numSamples; i += 4) {
+        const float32x4_t x = vld1q_f32(src + i);
+        vst1q_f32(dest1 + i, vmlaq_f32(vld1q_f32(dest1 + i), x, gain1));
+        vst1q_f32(dest2 + i, vmlaq_f32(vld1q_f32(dest2 + i), x, gain2));
+        gain1 = vaddq_f32(gain1, step1);
+        gain2 = vaddq_f32(gain2, step2);
+    }
+    for (; i < numSamples; ++i) {
+        dest1[i] += src[i] * (startgain1 + inc1 * i);
+        dest2[i] += src[i] * (startgain2 + inc2 * i);
+    }
+}
+
+#endif
+
+static void addWithRamp (float * dest, const float * src, int numSamples, float startgain, float endgain)
+{
+    if (numSamples <= 0 || (startgain == 0.0f && endgain == 0.0f)) return;
+
+    const float inc = (endgain - startgain) / (float) numSamples;
+
+#if JUCE_INTEL
+    if (useAvx2Kernels) addWithRampAvx2(dest, src, numSamples, startgain, inc);
+    else addWithRampSse(dest, src, numSamples, startgain, inc);
+#elif SONO_USE_NEON
+    addWithRampNeon(dest, src, numSamples, startgain, inc);
+#else
+    for (int i = 0; i < numSamples; ++i) {
+        dest[i] += src[i] * (startgain + inc * i);
+    }
+#endif
+}
+
+static void addWithRamp2 (float * dest1, float * dest2, const float * src, int numSamples,
+                          float startgain1, float endgain1, float startgain2, float endgain2)
+{
+    if (numSamples <= 0 || (startgain1 == 0.0f && endgain1 == 0.0f && startgain2 == 0.0f && endgain2 == 0.0f)) return;
+
+    const float inc1 = (endgain1 - startgain1) / (float) numSamples;
+    const float inc2 = (endgain2 - startgain2) / (float) numSamples;
+
+#if JUCE_INTEL
+    if (useAvx2Kernels) addWithRamp2Avx2(dest1, dest2, src, numSamples, startgain1, inc1, startgain2, inc2);
+    else addWithRamp2Sse(dest1, dest2, src, numSamples, startgain1, inc1, startgain2, inc2);
+#elif SONO_USE_NEON
+    addWithRamp2Neon(dest1, dest2, src, numSamples, startgain1, inc1, startgain2, inc2);
+#else
+    for (int i = 0; i < numSamples; ++i) {
+        dest1[i] += src[i] * (startgain1 + inc1 * i);
+        dest2[i] += src[i] * (startgain2 + inc2 * i);
+    }
+#endif
+}
+
+// -1 is left, 1 is right, with the center pan law applied
+static inline float panGainFor (float pan, bool left, float centerPanLaw)
+{
+    float pgain = left ? (pan >= 0.0f ? (1.0f - pan) : 1.0f) : (pan >= 0.0f ? 1.0f : (1.0f+pan));
+    return pgain * (centerPanLaw + (fabsf(pan) * (1.0f - centerPanLaw)));
+}
+
+// mix one source channel panned into a stereo destination pair, either side may be missing
+static void addPannedToStereo (AudioBuffer<float>& tobuffer, int destStartChan, const float * src, int numSamples,
+                               float pan, float lastpan, float centerPanLaw, float gain, float lastgain, bool ramp)
+{
+    const int toNumChan = tobuffer.getNumChannels();
+    const bool hasleft = destStartChan < toNumChan;
+    const bool hasright = destStartChan + 1 < toNumChan;
+
+    const float lgain = panGainFor(pan, true, centerPanLaw) * gain;
+    const float rgain = panGainFor(pan, false, centerPanLaw) * gain;
+    const float lastlgain = ramp ? panGainFor(lastpan, true, centerPanLaw) * lastgain : lgain;
+    const float lastrgain = ramp ? panGainFor(lastpan, false, centerPanLaw) * lastgain : rgain;
+
+    if (hasleft && hasright) {
+        addWithRamp2(tobuffer.getWritePointer(destStartChan), tobuffer.getWritePointer(destStartChan+1), src, numSamples,
+                     lastlgain, lgain, lastrgain, rgain);
+    }
+    else if (hasleft) {
+        addWithRamp(tobuffer.getWritePointer(destStartChan), src, numSamples, lastlgain, lgain);
+    }
+}
+
 
 using namespace SonoAudio;
 
+// reads the pans once for the block, so that what gets rendered is also what
+// the next block ramps from, however they're being changed in the meantime
+static int snapshotPans (const ChannelGroupParams & params, float * pans, float * stereopans)
+{
+    const int count = jlimit(0, MAX_CHANNELS, params.numChannels);
+    for (int i=0; i < count; ++i) {
+        pans[i] = params.pan[i];
+    }
+    stereopans[0] = params.panStereo[0];
+    stereopans[1] = params.panStereo[1];
+    return count;
+}
+
+
 ChannelGroup::ChannelGroup()
 {
 }
 
+ChannelGroup::~ChannelGroup()
+{
+    const int lines = _monitorDelayLines.load();
+    if (monitorDelayArena && lines >= 0) {
+        monitorDelayArena->releaseLines(lines & 0xff, lines >> 8);
+    }
+}
+
 // copy assignment
 void ChannelGroup::copyParametersFrom(const ChannelGroup& other)
 {
     params = other.params;
 
-    compressorParamsChanged = true;
-    expanderParamsChanged = true;
-    eqParamsChanged = true;
-    limiterParamsChanged = true;
+    commitCompressorParams();
+    commitExpanderParams();
+    commitEqParams();
+    commitLimiterParams();
     monitorDelayParamsChanged = true;
 
 }
@@ -91,11 +323,13 @@ void ChannelGroup::init(double sampRate)
     sampleRate = sampRate;
     
     if (!compressor) {
-        compressor = std::make_unique<faustCompressor>();
+        compressor = std::make_unique<MultiChannelDynamics>(MultiChannelDynamics::Compressor);
         compressorControl = std::make_unique<MapUI>();
     }
     compressor->init(sampleRate);
     compressor->buildUserInterface(compressorControl.get());
+    compressorZones.resolve(*compressorControl, "/compressor/");
+    compressorOutputLevel = compressorZones.gain;
 
     //DBG("Compressor Params:");
     //for(int i=0; i < mInputCompressorControl.getParamsCount(); i++){
@@ -103,26 +337,27 @@ void ChannelGroup::init(double sampRate)
     //}
 
     if (!expander) {
-        expander = std::make_unique<faustExpander>();
+        expander = std::make_unique<MultiChannelDynamics>(MultiChannelDynamics::Expander);
         expanderControl = std::make_unique<MapUI>();
     }
 
     expander->init(sampleRate);
     expander->buildUserInterface(expanderControl.get());
+    expanderZones.resolve(*expanderControl, "/expander/");
+    expanderOutputGain = expanderZones.gain;
 
     //DBG("Expander Params:");
     //for(int i=0; i < mInputExpanderControl.getParamsCount(); i++){
     //    DBG(mInputExpanderControl.getParamAddress(i));
     //}
 
-    for (int j=0; j < 2; ++j) {
-        if (!eq[j]) {
-            eq[j] = std::make_unique<faustParametricEQ>();
-            eqControl[j] = std::make_unique<MapUI>();
-        }
-        eq[j]->init(sampleRate);
-        eq[j]->buildUserInterface(eqControl[j].get());
+    if (!eq) {
+        eq = std::make_unique<MultiChannelParametricEQ>();
+        eqControl = std::make_unique<MapUI>();
     }
+    eq->init(sampleRate);
+    eq->buildUserInterface(eqControl.get());
+    eqZones.resolve(*eqControl);
 
     //DBG("EQ Params:");
     //for(int i=0; i < mInputEqControl[0].getParamsCount(); i++){
@@ -130,56 +365,75 @@ void ChannelGroup::init(double sampRate)
     //}
 
     if (!limiter) {
-        limiter = std::make_unique<faustCompressor>();
+        limiter = std::make_unique<MultiChannelDynamics>(MultiChannelDynamics::Compressor);
         limiterControl = std::make_unique<MapUI>();
     }
 
     limiter->init(sampleRate);
     limiter->buildUserInterface(limiterControl.get());
+    limiterZones.resolve(*limiterControl, "/compressor/");
 
     //DBG("Limiter Params:");
     //for(int i=0; i < mInputLimiterControl.getParamsCount(); i++){
     //    DBG(mInputLimiterControl.getParamAddress(i));
     //}
 
-    commitCompressorParams();
-    commitExpanderParams();
-    commitEqParams();
-    commitLimiterParams();
+    monitorDelayTap.reset();
+
+    // anything still pending is older than params, drop it and apply directly
+    compressorMailbox.fetch(activeCompressorParams);
+    expanderMailbox.fetch(activeExpanderParams);
+    eqMailbox.fetch(activeEqParams);
+    limiterMailbox.fetch(activeLimiterParams);
+
+    activeCompressorParams = params.compressorParams;
+    activeExpanderParams = params.expanderParams;
+    activeEqParams = params.eqParams;
+    activeLimiterParams = params.limiterParams;
+
+    applyCompressorParams(activeCompressorParams);
+    applyExpanderParams(activeExpanderParams);
+    applyEqParams(activeEqParams);
+    applyLimiterParams(activeLimiterParams);
     commitMonitorDelayParams();
 
 }
 
+void ChannelGroup::release()
+{
+    compressorZones = DynamicsZones();
+    expanderZones = DynamicsZones();
+    limiterZones = DynamicsZones();
+    eqZones = EqZones();
+    compressorOutputLevel = nullptr;
+    expanderOutputGain = nullptr;
+
+    compressor.reset();
+    compressorControl.reset();
+    expander.reset();
+    expanderControl.reset();
+    eq.reset();
+    eqControl.reset();
+    limiter.reset();
+    limiterControl.reset();
+}
+
 void ChannelGroup::setMonitoringDelayEnabled(bool enabled, int numchans)
 {
     if (enabled) {
-        if (!monitorDelayLine) {
-            const ScopedLock lock(_monitorDelayLock);
-            // need to initialize it
-            monitorDelayLine = std::make_unique<juce::dsp::DelayLine<float,juce::dsp::DelayLineInterpolationTypes::None> >(MAX_DELAY_SAMPLES);
-            monitorDelayLine->setDelay(_monitorDelayTimeSamples);
-
-            juce::dsp::ProcessSpec delayspec = { sampleRate, 4096, (juce::uint32) numchans };
-            monitorDelayLine->prepare(delayspec);
-
-            _monitorDelayChans = numchans;
-            delayWorkBuffer.setSize(numchans, 4096, false, false, true);
-        }
-        else if (_monitorDelayChans != numchans) {
-            //
-            const ScopedLock lock(_monitorDelayLock);
-
-            juce::dsp::ProcessSpec delayspec = { sampleRate, 4096, (juce::uint32) numchans };
-            monitorDelayLine->prepare(delayspec);
-            monitorDelayLine->reset();
-            _monitorDelayChans = numchans;
-            delayWorkBuffer.setSize(numchans, 4096, false, false, true);
+        const int lines = _monitorDelayLines.load();
+        if (monitorDelayArena && (lines < 0 || (lines >> 8) != numchans)) {
+            // the lines are kept while disabled, only a channel count change trades them in
+            if (lines >= 0) {
+                monitorDelayArena->releaseLines(lines & 0xff, lines >> 8);
+            }
+            const int first = monitorDelayArena->acquireLines(numchans);
+            if (first < 0) {
+                DBG("No room left for a monitoring delay of " << numchans << " channels");
+            }
+            _monitorDelayLines = first >= 0 ? first | (numchans << 8) : -1;
         }
 
-        
-
-
-        // if monitorDelayActive is ever true, it means it has already been initialized
         params.monitorDelayParams.enabled = true;
         _monitorDelayActive = true;
     }
@@ -192,130 +446,210 @@ void ChannelGroup::setMonitoringDelayEnabled(bool enabled, int numchans)
 void ChannelGroup::setMonitoringDelayTimeMs(double delayms)
 {
     params.monitorDelayParams.delayTimeMs = delayms;
-    auto newsamps = 1e-3 * delayms * sampleRate;
-    if ( fabs(_monitorDelayTimeSamples - newsamps) > 1) {
-        _monitorDelayTimeSamples = jmin(newsamps, (double)MAX_DELAY_SAMPLES);
-        _monitorDelayTimeChanged = true;
-    }
+    monitorDelayTap.setDelaySamples(roundToInt(1e-3 * delayms * sampleRate));
 }
 
-
-void ChannelGroup::processBlock (AudioBuffer<float>& frombuffer,
-                                 AudioBuffer<float>& tobuffer, int destStartChan, int destNumChans,
-                                 AudioBuffer<float>& silentBuffer,
-                                 int numSamples, float gainfactor, ProcessState * oprocstate,
-                                 AudioBuffer<float> * reverbbuffer, int revStartChan, int revNumChans, bool revEnabled, float revgainfactor, ProcessState * orevprocstate)
+float ChannelGroup::smoothLevel(float lastlevel, float targlevel, int numSamples) const
 {
-    // called from audio thread context
-
-    auto & procstate = oprocstate != nullptr ? *oprocstate : mainProcState;
-    auto & revprocstate = orevprocstate != nullptr ? *orevprocstate : inRevProcState;
-
-    int chstart = params.chanStartIndex;
-    int numchan = params.numChannels;
-    const int frombufNumChan = frombuffer.getNumChannels();
-    const int tobufNumChan = tobuffer.getNumChannels();
-    // apply input gain
-
+    // one-pole from block to block, the ramp within each block does the rest
+    const float coef = 1.0f - std::exp(-numSamples / (levelSmoothingTimeSec * (float) sampleRate));
+    const float level = lastlevel + (targlevel - lastlevel) * coef;
+    return fabsf(targlevel - level) < 1e-4f ? targlevel : level;
+}
 
-    float dogain = (params.muted ? 0.0f : params.gain) * gainfactor;
-    //dogain = 0.0f;
 
-    dogain *= params.invertPolarity ? -1.0f : 1.0f;
+template <int NumChans, bool WithFx>
+bool ChannelGroup::processBlockVariant (const BlockSetup & setup)
+{
+    auto & frombuffer = *setup.frombuffer;
+    auto & tobuffer = *setup.tobuffer;
+    const int numSamples = setup.numSamples;
+    const int chstart = params.chanStartIndex;
+    const bool inplace = &frombuffer == &tobuffer;
 
-    if (&frombuffer == &tobuffer) {
-        // inplace, just apply gain, ignore destchans
-        for (int i = chstart; i < chstart+numchan && i < frombufNumChan ; ++i) {
-            tobuffer.applyGainRamp(i, 0, numSamples, procstate.lastlevel, dogain);
+    // apply input gain
+    if constexpr (NumChans > 0) {
+        // the dispatch made sure all the channels are there, on both sides
+        if (inplace) {
+            if (setup.muted && !setup.inputSilent) {
+                for (int c = 0; c < NumChans; ++c) {
+                    tobuffer.clear(chstart + c, 0, numSamples);
+                }
+            }
+            else if (!setup.inputSilent) {
+                for (int c = 0; c < NumChans; ++c) {
+                    tobuffer.applyGainRamp(chstart + c, 0, numSamples, setup.lastlevel, setup.gain);
+                }
+            }
+        }
+        else if (!setup.inputSilent && !setup.muted) {
+            for (int c = 0; c < NumChans; ++c) {
+                tobuffer.addFromWithRamp(setup.destStartChan + c, 0, frombuffer.getReadPointer(chstart + c), numSamples, setup.lastlevel, setup.gain);
+            }
         }
     }
     else {
-        for (int i = chstart, desti=destStartChan; i < chstart+numchan && i < frombufNumChan && desti < destStartChan+destNumChans && desti < tobufNumChan; ++i, ++desti) {
-            tobuffer.addFromWithRamp(desti, 0, frombuffer.getReadPointer(i), numSamples, procstate.lastlevel, dogain);
+        const int numchan = params.numChannels;
+        const int destStartChan = setup.destStartChan;
+        const int frombufNumChan = frombuffer.getNumChannels();
+        const int tobufNumChan = tobuffer.getNumChannels();
+
+        if (inplace) {
+            // inplace, just apply gain, ignore destchans
+            if (setup.muted && !setup.inputSilent) {
+                for (int i = chstart; i < chstart+numchan && i < frombufNumChan ; ++i) {
+                    tobuffer.clear(i, 0, numSamples);
+                }
+            }
+            else if (!setup.inputSilent) {
+                for (int i = chstart; i < chstart+numchan && i < frombufNumChan ; ++i) {
+                    tobuffer.applyGainRamp(i, 0, numSamples, setup.lastlevel, setup.gain);
+                }
+            }
+        }
+        else if (!setup.inputSilent && !setup.muted) {
+            for (int i = chstart, desti=destStartChan; i < chstart+numchan && i < frombufNumChan && desti < destStartChan+setup.destNumChans && desti < tobufNumChan; ++i, ++desti) {
+                tobuffer.addFromWithRamp(desti, 0, frombuffer.getReadPointer(i), numSamples, setup.lastlevel, setup.gain);
+            }
         }
     }
 
+    bool outputSilent = setup.inputSilent || setup.muted;
 
-    procstate.lastlevel = dogain;
+    if constexpr (WithFx) {
+        // these operate on all channels of the group at once
+        const int fxNumChans = NumChans > 0 ? NumChans : setup.fxNumChans;
 
-    // these all operate ONLY when the channel group has 1 or 2 channels (and when the effects have been initialized)
-    if (params.numChannels > 0 && params.numChannels <= 2 && compressor)
-    {
-        // apply input expander
-        if (expanderParamsChanged) {
-            commitExpanderParams();
-            expanderParamsChanged = false;
-        }
-        if (_lastExpanderEnabled || params.expanderParams.enabled) {
-            if (tobufNumChan - destStartChan > 1 && numchan == 2 && destNumChans >= 2) {
-                float *bufs[2] = { tobuffer.getWritePointer(destStartChan), tobuffer.getWritePointer(destStartChan+1)};
-                expander->compute(numSamples, bufs, bufs);
-            } else if (destStartChan < tobufNumChan) {
-                float *bufs[2] = { tobuffer.getWritePointer(destStartChan), silentBuffer.getWritePointer(0) }; // just a silent dummy buffer
-                expander->compute(numSamples, bufs, bufs);
-            }
+        float * bufs[NumChans > 0 ? NumChans : MAX_CHANNELS];
+        for (int i=0; i < fxNumChans; ++i) {
+            bufs[i] = tobuffer.getWritePointer(setup.destStartChan + i);
         }
-        _lastExpanderEnabled = params.expanderParams.enabled;
 
+        // none of them changes silence into something else, so the check holds for the whole chain
+        const bool silent = outputSilent || MultiChannelDetail::isSilent(bufs, fxNumChans, numSamples);
 
-        // apply input compressor
-        if (compressorParamsChanged) {
-            commitCompressorParams();
-            compressorParamsChanged = false;
-        }
-        if (_lastCompressorEnabled || params.compressorParams.enabled) {
-            if (tobufNumChan - destStartChan > 1 && numchan == 2 && destNumChans >= 2) {
-                float *bufs[2] = { tobuffer.getWritePointer(destStartChan), tobuffer.getWritePointer(destStartChan+1)};
-                compressor->compute(numSamples, bufs, bufs);
-            } else if (destStartChan < tobufNumChan) {
-                float *bufs[2] = { tobuffer.getWritePointer(destStartChan), silentBuffer.getWritePointer(0) }; // just a silent dummy buffer
-                compressor->compute(numSamples, bufs, bufs);
-            }
+        // apply input expander
+        if (activeExpanderParams.enabled) {
+            if (!_lastExpanderEnabled) expander->clear();
+            if (silent) expander->skipSilence(fxNumChans, numSamples);
+            else expander->process(bufs, fxNumChans, numSamples);
         }
-        _lastCompressorEnabled = params.compressorParams.enabled;
-
 
-        // apply input EQ
-        if (eqParamsChanged) {
-            commitEqParams();
-            eqParamsChanged = false;
+        // apply input compressor
+        if (activeCompressorParams.enabled) {
+            if (!_lastCompressorEnabled) compressor->clear();
+            if (silent) compressor->skipSilence(fxNumChans, numSamples);
+            else compressor->process(bufs, fxNumChans, numSamples);
         }
-        if (_lastEqEnabled || params.eqParams.enabled) {
-            if (tobufNumChan - destStartChan > 1 && numchan == 2 && destNumChans >= 2) {
-                // only 2 channels support for now... TODO
-                float *bufs[2] = { tobuffer.getWritePointer(destStartChan), tobuffer.getWritePointer(destStartChan+1)};
-                eq[0]->compute(numSamples, &bufs[0], &bufs[0]);
-                eq[1]->compute(numSamples, &bufs[1], &bufs[1]);
-            } else if (destStartChan < tobufNumChan) {
-                float *inbuf = tobuffer.getWritePointer(destStartChan);
-                float *outbuf = tobuffer.getWritePointer(destStartChan);
-                eq[0]->compute(numSamples, &inbuf, &outbuf);
+
+        // apply input EQ, it has to ring out before it can be skipped
+        if (activeEqParams.enabled) {
+            if (!_lastEqEnabled) eq->clear();
+            if (silent && eq->isSettled(fxNumChans)) eq->skipSilence(fxNumChans, numSamples);
+            else {
+                eq->process(bufs, fxNumChans, numSamples);
+                // still ringing
+                outputSilent = false;
             }
         }
-        _lastEqEnabled = params.eqParams.enabled;
-
 
         // apply input limiter
-        if (limiterParamsChanged) {
-            commitLimiterParams();
-            limiterParamsChanged = false;
-        }
-        if (_lastLimiterEnabled || params.limiterParams.enabled) {
-            if (tobufNumChan - destStartChan > 1 && numchan == 2 && destNumChans >= 2) {
-                float *bufs[2] = { tobuffer.getWritePointer(destStartChan), tobuffer.getWritePointer(destStartChan+1)};
-                limiter->compute(numSamples, bufs, bufs);
-            } else if (destStartChan < tobufNumChan) {
-                float *bufs[2] = { tobuffer.getWritePointer(destStartChan), silentBuffer.getWritePointer(0) }; // just a silent dummy buffer
-                limiter->compute(numSamples, bufs, bufs);
-            }
+        if (activeLimiterParams.enabled) {
+            if (!_lastLimiterEnabled) limiter->clear();
+            if (silent) limiter->skipSilence(fxNumChans, numSamples);
+            else limiter->process(bufs, fxNumChans, numSamples);
         }
-        _lastLimiterEnabled = params.limiterParams.enabled;
     }
+
+    return outputSilent;
+}
+
+// indexed by the channel layout (any, mono, stereo) and whether the effects run
+const ChannelGroup::BlockVariant ChannelGroup::blockVariants[3][2] = {
+    { &ChannelGroup::processBlockVariant<0, false>, &ChannelGroup::processBlockVariant<0, true> },
+    { &ChannelGroup::processBlockVariant<1, false>, &ChannelGroup::processBlockVariant<1, true> },
+    { &ChannelGroup::processBlockVariant<2, false>, &ChannelGroup::processBlockVariant<2, true> }
+};
+
+bool ChannelGroup::processBlock (AudioBuffer<float>& frombuffer,
+                                 AudioBuffer<float>& tobuffer, int destStartChan, int destNumChans,
+                                 AudioBuffer<float>& silentBuffer,
+                                 int numSamples, float gainfactor, bool inputSilent, ProcessState * oprocstate,
+                                 AudioBuffer<float> * reverbbuffer, int revStartChan, int revNumChans, bool revEnabled, float revgainfactor, ProcessState * orevprocstate)
+{
+    // called from audio thread context
+
+    auto & procstate = oprocstate != nullptr ? *oprocstate : mainProcState;
+    auto & revprocstate = orevprocstate != nullptr ? *orevprocstate : inRevProcState;
+
+    const int chstart = params.chanStartIndex;
+    const int numchan = params.numChannels;
+    const int frombufNumChan = frombuffer.getNumChannels();
+    const int tobufNumChan = tobuffer.getNumChannels();
+
+    float dogain = (params.muted ? 0.0f : params.gain.get()) * gainfactor;
+    //dogain = 0.0f;
+
+    dogain *= params.invertPolarity ? -1.0f : 1.0f;
+    dogain = smoothLevel(procstate.lastlevel, dogain, numSamples);
+
+    // fully muted counts as silent too, from here on there is nothing to do for it
+    const bool muted = dogain == 0.0f && procstate.lastlevel == 0.0f;
+
+    // these operate on all channels of the group at once (when the effects have been initialized)
+    const int fxNumChans = jmin(numchan, destNumChans, tobufNumChan - destStartChan, (int) MAX_CHANNELS);
+
+    if (compressorMailbox.fetch(activeCompressorParams)) {
+        applyCompressorParams(activeCompressorParams);
+    }
+    if (expanderMailbox.fetch(activeExpanderParams)) {
+        applyExpanderParams(activeExpanderParams);
+    }
+    if (eqMailbox.fetch(activeEqParams)) {
+        applyEqParams(activeEqParams);
+    }
+    if (limiterMailbox.fetch(activeLimiterParams)) {
+        applyLimiterParams(activeLimiterParams);
+    }
+
+    const bool anyFxEnabled = !bypassFx && (activeExpanderParams.enabled || activeCompressorParams.enabled
+                                            || activeEqParams.enabled || activeLimiterParams.enabled);
+
+    // mono and stereo groups with all their channels in both buffers take the
+    // variants with the channel count built in, everything else the general one
+    int layout = 0;
+    if ((numchan == 1 || numchan == 2) && fxNumChans == numchan && chstart + numchan <= frombufNumChan) {
+        layout = numchan;
+    }
+    const bool withFx = fxNumChans > 0 && compressor && anyFxEnabled;
+
+    BlockSetup setup;
+    setup.frombuffer = &frombuffer;
+    setup.tobuffer = &tobuffer;
+    setup.destStartChan = destStartChan;
+    setup.destNumChans = destNumChans;
+    setup.fxNumChans = fxNumChans;
+    setup.numSamples = numSamples;
+    setup.lastlevel = procstate.lastlevel;
+    setup.gain = dogain;
+    setup.inputSilent = inputSilent;
+    setup.muted = muted;
+
+    const bool outputSilent = (this->*blockVariants[layout][withFx ? 1 : 0])(setup);
+
+    procstate.lastlevel = dogain;
+
+    _lastExpanderEnabled = anyFxEnabled && activeExpanderParams.enabled;
+    _lastCompressorEnabled = anyFxEnabled && activeCompressorParams.enabled;
+    _lastEqEnabled = anyFxEnabled && activeEqParams.enabled;
+    _lastLimiterEnabled = anyFxEnabled && activeLimiterParams.enabled;
     
     // apply to reverb buffer
-    if (reverbbuffer) {
+    if (reverbbuffer && !outputSilent) {
         processReverbSend(tobuffer, destStartChan, jmin(params.numChannels, destNumChans), *reverbbuffer, revStartChan, revNumChans, numSamples, revEnabled, true, revgainfactor, &revprocstate);
     }
+
+    return !outputSilent;
 }
 
 void ChannelGroup::processPan (AudioBuffer<float>& frombuffer, int fromStartChan,
@@ -329,33 +663,20 @@ void ChannelGroup::processPan (AudioBuffer<float>& frombuffer, int fromStartChan
 
     auto & procstate = oprocstate != nullptr ? *oprocstate : mainProcState;
 
+    float pans[MAX_CHANNELS];
+    float stereopans[2];
+    const int numpans = snapshotPans(params, pans, stereopans);
 
     if (destNumChans == 2) {
         //tobuffer.clear(0, numSamples);
 
-        for (int channel = destStartChan; channel < destStartChan + destNumChans && channel < toNumChan; ++channel) {
-            int pani = 0;
-            for (int i=fromStartChan; i < fromStartChan + params.numChannels && i < fromNumChan; ++i, ++pani) {
-                const float upan = (params.numChannels != 2 ? params.pan[pani] : i==fromStartChan ? params.panStereo[0] : params.panStereo[1]);
-                const float lastpan = (params.numChannels != 2 ? procstate.lastpan[pani] : i==fromStartChan ? procstate.laststereopan[0] : procstate.laststereopan[1]);
-
-                // -1 is left, 1 is right
-                float pgain = channel == destStartChan ? (upan >= 0.0f ? (1.0f - upan) : 1.0f) : (upan >= 0.0f ? 1.0f : (1.0f+upan)) ;
-
-                // apply pan law
-                pgain *= params.centerPanLaw + (fabsf(upan) * (1.0f - params.centerPanLaw));
-                pgain *= gainfactor;
-
-                if (fabsf(upan - lastpan) > 0.00001f) {
-                    float plastgain = channel == destStartChan ? (lastpan >= 0.0f ? (1.0f - lastpan) : 1.0f) : (lastpan >= 0.0f ? 1.0f : (1.0f+lastpan));
-                    plastgain *= params.centerPanLaw + (fabsf(lastpan) * (1.0f - params.centerPanLaw));
-                    plastgain *= gainfactor;
+        int pani = 0;
+        for (int i=fromStartChan; i < fromStartChan + numpans && i < fromNumChan; ++i, ++pani) {
+            const float upan = (params.numChannels != 2 ? pans[pani] : i==fromStartChan ? stereopans[0] : stereopans[1]);
+            const float lastpan = (params.numChannels != 2 ? procstate.lastpan[pani] : i==fromStartChan ? procstate.laststereopan[0] : procstate.laststereopan[1]);
 
-                    tobuffer.addFromWithRamp(channel, 0, frombuffer.getReadPointer(i), numSamples, plastgain, pgain);
-                } else {
-                    tobuffer.addFrom (channel, 0, frombuffer, i, 0, numSamples, pgain);
-                }
-            }
+            addPannedToStereo(tobuffer, destStartChan, frombuffer.getReadPointer(i), numSamples,
+                              upan, lastpan, params.centerPanLaw, gainfactor, gainfactor, fabsf(upan - lastpan) > 0.00001f);
         }
     }
     else if (destNumChans == 1){
@@ -378,10 +699,10 @@ void ChannelGroup::processPan (AudioBuffer<float>& frombuffer, int fromStartChan
     }
     
 
-    procstate.laststereopan[0] = params.panStereo[0];
-    procstate.laststereopan[1] = params.panStereo[1];
-    for (int pani=0; pani < params.numChannels; ++pani) {
-        procstate.lastpan[pani] = params.pan[pani];
+    procstate.laststereopan[0] = stereopans[0];
+    procstate.laststereopan[1] = stereopans[1];
+    for (int pani=0; pani < numpans; ++pani) {
+        procstate.lastpan[pani] = pans[pani];
     }
 }
 
@@ -391,16 +712,19 @@ void ChannelGroup::processMonitor (AudioBuffer<float>& frombuffer, int fromStart
                                    AudioBuffer<float> * reverbbuffer, int revStartChan, int revNumChans, bool revEnabled, float revgainfactor, ProcessState * orevprocstate)
 {
 
-    // apply monitor level
-
-    float targmon = params.monitor * gainfactor;
-
     int fromNumChan = frombuffer.getNumChannels();
     int toNumChan = tobuffer.getNumChannels();
 
     auto & procstate = oprocstate != nullptr ? *oprocstate : monProcState;
     auto & revprocstate = orevprocstate != nullptr ? *orevprocstate : revProcState;
 
+    // apply monitor level
+    const float targmon = smoothLevel(procstate.lastlevel, params.monitor * gainfactor, numSamples);
+
+    float pans[MAX_CHANNELS];
+    float stereopans[2];
+    const int numpans = snapshotPans(params, pans, stereopans);
+
 
     if (monitorDelayParamsChanged) {
         commitMonitorDelayParams();
@@ -415,98 +739,53 @@ void ChannelGroup::processMonitor (AudioBuffer<float>& frombuffer, int fromStart
     auto useFromNumChan = fromNumChan;
 
     if (domondelay || _monitorDelayLastActive != domondelay) {
-        const ScopedTryLock lock(_monitorDelayLock);
-        if (lock.isLocked()) {
-
-            // transition between delayed and not
-            if (_monitorDelayLastActive != domondelay) {
-                if (domondelay) {
-                    monitorDelayLine->reset();
-                    mondelayfade = 1; // fade in
-                }
-                else {
-                    mondelayfade = -1; // fade out
-                }
-            }
+        const int lines = _monitorDelayLines.load();
 
+        // transition between delayed and not, or onto other lines
+        if (_monitorDelayLastActive != domondelay || lines != _monitorDelayLastLines) {
             if (domondelay) {
-                if (_monitorDelayTimeChanged.load() && !_monitorDelayTimeChanging) {
-                    _monitorDelayTimeChanged = false;
-                    mondelayfade = -1.0f; // fade out
-                    _monitorDelayTimeChanging = true;
-                }
-                else if (_monitorDelayTimeChanging) {
-                    // already faded out, now apply new delay time
-                    _monitorDelayTimeChanging = false;
-                    monitorDelayLine->setDelay(_monitorDelayTimeSamples);
-                    mondelayfade = 1; // fade in
-                }
+                monitorDelayTap.reset();
+                mondelayfade = 1; // fade in
+            }
+            else {
+                mondelayfade = -1; // fade out
             }
+        }
+
+        // should match our num channels, but we need to make sure of it
+        const int numchans = jmin(params.numChannels, fromNumChan - fromStartChan);
+        if (lines >= 0 && (lines >> 8) == params.numChannels && numchans > 0) {
+            auto & workbuf = monitorDelayArena->getWorkBuffer(numSamples);
 
-            if ((domondelay || mondelayfade != 0)) {
-                // should match dest num channels, but we need to make sure of it
-                if (params.numChannels == _monitorDelayChans) {
-                    auto delayinoutBlock = dsp::AudioBlock<float>(delayWorkBuffer).getSubsetChannelBlock(0, (size_t)params.numChannels).getSubBlock(0, numSamples);
-
-                    // apply it going in
-                    for (int srcchan = fromStartChan, chan = 0; chan < delayWorkBuffer.getNumChannels() && srcchan < fromStartChan + params.numChannels && srcchan < fromNumChan; ++srcchan, ++chan) {
-                        if (mondelayfade != 0) {
-                            delayWorkBuffer.copyFromWithRamp(chan, 0, frombuffer.getReadPointer(srcchan), numSamples,
-                                mondelayfade > 0 ? 0.0f : 1.0f, mondelayfade > 0 ? 1.0f : 0.0f);
-                            //tobuffer.applyGainRamp(0, numSamples, mondelayfade > 0 ? 0.0f : 1.0f, mondelayfade > 0 ? 1.0f : 0.0f);
-                        }
-                        else {
-                            delayWorkBuffer.copyFrom(chan, 0, frombuffer.getReadPointer(srcchan), numSamples);
-                        }
-                    }
-
-                    monitorDelayLine->process(dsp::ProcessContextReplacing<float>(delayinoutBlock));
-
-                    // apply it coming out
-                    for (int chan = 0; chan < params.numChannels && chan < delayWorkBuffer.getNumChannels(); ++chan) {
-                        if (mondelayfade != 0) {
-                            delayWorkBuffer.applyGainRamp(chan, 0, numSamples, mondelayfade > 0 ? 0.0f : 1.0f, mondelayfade > 0 ? 1.0f : 0.0f);
-                        }
-                    }
-
-                    usefrombuffer = &delayWorkBuffer;
-                    useFromStartChan = 0;
-                    useFromNumChan = jmin(params.numChannels, delayWorkBuffer.getNumChannels());
+            monitorDelayTap.process(*monitorDelayArena, lines & 0xff, frombuffer.getArrayOfReadPointers() + fromStartChan,
+                                    workbuf.getArrayOfWritePointers(), numchans, numSamples);
+
+            if (mondelayfade != 0) {
+                for (int chan = 0; chan < numchans; ++chan) {
+                    workbuf.applyGainRamp(chan, 0, numSamples, mondelayfade > 0 ? 0.0f : 1.0f, mondelayfade > 0 ? 1.0f : 0.0f);
                 }
             }
 
-            _monitorDelayLastActive = domondelay;
-
-            
+            usefrombuffer = &workbuf;
+            useFromStartChan = 0;
+            useFromNumChan = numchans;
         }
+
+        _monitorDelayLastActive = domondelay;
+        _monitorDelayLastLines = lines;
     }
 
     if (useFromNumChan > 0 && destNumChans == 2) {
         //tobuffer.clear(0, numSamples);
 
-        for (int channel = destStartChan; channel < destStartChan + destNumChans && channel < toNumChan; ++channel) {
-            int pani = 0;
-            for (int i=useFromStartChan; i < useFromStartChan + params.numChannels && i < useFromNumChan; ++i, ++pani) {
-                const float upan = (params.numChannels != 2 ? params.pan[pani] : i==useFromStartChan ? params.panStereo[0] : params.panStereo[1]);
-                const float lastpan = (params.numChannels != 2 ? procstate.lastpan[pani] : i==useFromStartChan ? procstate.laststereopan[0] : procstate.laststereopan[1]);
-
-                // -1 is left, 1 is right
-                float pgain = channel == destStartChan ? (upan >= 0.0f ? (1.0f - upan) : 1.0f) : (upan >= 0.0f ? 1.0f : (1.0f+upan)) ;
-
-                // apply pan law
-                pgain *= params.centerPanLaw + (fabsf(upan) * (1.0f - params.centerPanLaw));
-                pgain *= targmon;
+        const bool levelchanged = fabsf(procstate.lastlevel - targmon) > 0.00001f;
+        int pani = 0;
+        for (int i=useFromStartChan; i < useFromStartChan + numpans && i < useFromNumChan; ++i, ++pani) {
+            const float upan = (params.numChannels != 2 ? pans[pani] : i==useFromStartChan ? stereopans[0] : stereopans[1]);
+            const float lastpan = (params.numChannels != 2 ? procstate.lastpan[pani] : i==useFromStartChan ? procstate.laststereopan[0] : procstate.laststereopan[1]);
 
-                if (fabsf(upan - lastpan) > 0.00001f || fabsf(procstate.lastlevel - targmon) > 0.00001f) {
-                    float plastgain = channel == destStartChan ? (lastpan >= 0.0f ? (1.0f - lastpan) : 1.0f) : (lastpan >= 0.0f ? 1.0f : (1.0f+lastpan));
-                    plastgain *= params.centerPanLaw + (fabsf(lastpan) * (1.0f - params.centerPanLaw));
-                    plastgain *= procstate.lastlevel;
-
-                    tobuffer.addFromWithRamp(channel, 0, usefrombuffer->getReadPointer(i), numSamples, plastgain, pgain);
-                } else {
-                    tobuffer.addFrom (channel, 0, *usefrombuffer, i, 0, numSamples, pgain);
-                }
-            }
+            addPannedToStereo(tobuffer, destStartChan, usefrombuffer->getReadPointer(i), numSamples,
+                              upan, lastpan, params.centerPanLaw, targmon, procstate.lastlevel, levelchanged || fabsf(upan - lastpan) > 0.00001f);
         }
     }
     else if (useFromNumChan > 0 && destNumChans == 1){
@@ -514,7 +793,7 @@ void ChannelGroup::processMonitor (AudioBuffer<float>& frombuffer, int fromStart
         int channel = destStartChan;
         for (int srcchan = useFromStartChan; srcchan < useFromStartChan + params.numChannels && srcchan < useFromNumChan && channel < toNumChan; ++srcchan) {
 
-            tobuffer.addFromWithRamp(channel, 0, usefrombuffer->getReadPointer(srcchan), numSamples, procstate.lastlevel, targmon);
+            addWithRamp(tobuffer.getWritePointer(channel), usefrombuffer->getReadPointer(srcchan), numSamples, procstate.lastlevel, targmon);
 
         }
     }
@@ -526,7 +805,7 @@ void ChannelGroup::processMonitor (AudioBuffer<float>& frombuffer, int fromStart
             //int srcchan = channel < mainBusInputChannels ? channel : mainBusInputChannels - 1;
             //int srcchan = chanStartIndex  channel < mainBusInputChannels ? channel : mainBusInputChannels - 1;
 
-            tobuffer.addFromWithRamp(channel, 0, usefrombuffer->getReadPointer(srcchan), numSamples, procstate.lastlevel, targmon);
+            addWithRamp(tobuffer.getWritePointer(channel), usefrombuffer->getReadPointer(srcchan), numSamples, procstate.lastlevel, targmon);
         }
     }
 
@@ -535,10 +814,10 @@ void ChannelGroup::processMonitor (AudioBuffer<float>& frombuffer, int fromStart
         processReverbSend(*usefrombuffer, useFromStartChan, jmin(params.numChannels, useFromNumChan), *reverbbuffer, revStartChan, revNumChans, numSamples, revEnabled, false, targmon * revgainfactor, &revprocstate);
     }
 
-    procstate.laststereopan[0] = params.panStereo[0];
-    procstate.laststereopan[1] = params.panStereo[1];
-    for (int pani=0; pani < params.numChannels; ++pani) {
-        procstate.lastpan[pani] = params.pan[pani];
+    procstate.laststereopan[0] = stereopans[0];
+    procstate.laststereopan[1] = stereopans[1];
+    for (int pani=0; pani < numpans; ++pani) {
+        procstate.lastpan[pani] = pans[pani];
     }
 
     procstate.lastlevel = targmon;
@@ -554,47 +833,39 @@ void ChannelGroup::processReverbSend (AudioBuffer<float>& frombuffer, int fromSt
 
     auto & procstate = oprocstate != nullptr ? *oprocstate : revProcState;
 
-    const float targrevgain = gainfactor * (inSend ? params.inReverbSend : params.monReverbSend) * (revEnabled ? 1.0f : 0.0f);
     const float lastrevgain = procstate.lastlevel;
+    const float targrevgain = smoothLevel(lastrevgain, gainfactor * (inSend ? params.inReverbSend : params.monReverbSend) * (revEnabled ? 1.0f : 0.0f), numSamples);
 
-    if (fromNumChans > 0 && destNumChans == 2) {
-        //tobuffer.clear(0, numSamples);
-
-        for (int channel = destStartChan; channel < destStartChan + destNumChans && channel < destMaxChans; ++channel) {
-            int pani = 0;
-            for (int i=fromStartChan; i < fromStartChan + fromNumChans && i < fromMaxChans; ++i, ++pani) {
-                const float upan = (fromNumChans != 2 ? params.pan[pani] : i==fromStartChan ? params.panStereo[0] : params.panStereo[1]);
-                const float lastpan = (params.numChannels != 2 ? procstate.lastpan[pani] : i==fromStartChan ? procstate.laststereopan[0] : procstate.laststereopan[1]);
+    float pans[MAX_CHANNELS];
+    float stereopans[2];
+    const int numpans = snapshotPans(params, pans, stereopans);
 
-                // -1 is left, 1 is right
-                float pgain = channel == destStartChan ? (upan >= 0.0f ? (1.0f - upan) : 1.0f) : (upan >= 0.0f ? 1.0f : (1.0f+upan)) ;
+    // nothing to send, and nothing to ramp down from either
+    const bool sending = targrevgain != 0.0f || lastrevgain != 0.0f;
 
-                // apply pan law
-                pgain *= params.centerPanLaw + (fabsf(upan) * (1.0f - params.centerPanLaw));
-                pgain *= targrevgain;
+    if (sending && fromNumChans > 0 && destNumChans == 2) {
+        //tobuffer.clear(0, numSamples);
 
-                if (fabsf(upan - lastpan) > 0.00001f || fabsf(lastrevgain - targrevgain) > 0.00001f) {
-                    float plastgain = channel == destStartChan ? (lastpan >= 0.0f ? (1.0f - lastpan) : 1.0f) : (lastpan >= 0.0f ? 1.0f : (1.0f+lastpan));
-                    plastgain *= params.centerPanLaw + (fabsf(lastpan) * (1.0f - params.centerPanLaw));
-                    plastgain *= lastrevgain;
+        const bool levelchanged = fabsf(lastrevgain - targrevgain) > 0.00001f;
+        int pani = 0;
+        for (int i=fromStartChan; i < fromStartChan + fromNumChans && i < fromMaxChans; ++i, ++pani) {
+            const float upan = (fromNumChans != 2 ? (pani < numpans ? pans[pani] : 0.0f) : i==fromStartChan ? stereopans[0] : stereopans[1]);
+            const float lastpan = (params.numChannels != 2 ? procstate.lastpan[pani] : i==fromStartChan ? procstate.laststereopan[0] : procstate.laststereopan[1]);
 
-                    tobuffer.addFromWithRamp(channel, 0, frombuffer.getReadPointer(i), numSamples, plastgain, pgain);
-                } else {
-                    tobuffer.addFrom (channel, 0, frombuffer, i, 0, numSamples, pgain);
-                }
-            }
+            addPannedToStereo(tobuffer, destStartChan, frombuffer.getReadPointer(i), numSamples,
+                              upan, lastpan, params.centerPanLaw, targrevgain, lastrevgain, levelchanged || fabsf(upan - lastpan) > 0.00001f);
         }
     }
-    else if (fromNumChans > 0 && destNumChans == 1){
+    else if (sending && fromNumChans > 0 && destNumChans == 1){
         // sum all into destChan
         int channel = destStartChan;
         for (int srcchan = fromStartChan; srcchan < fromStartChan + fromNumChans && srcchan < fromMaxChans && channel < destMaxChans; ++srcchan) {
 
-            tobuffer.addFromWithRamp(channel, 0, frombuffer.getReadPointer(srcchan), numSamples, lastrevgain, targrevgain);
+            addWithRamp(tobuffer.getWritePointer(channel), frombuffer.getReadPointer(srcchan), numSamples, lastrevgain, targrevgain);
 
         }
     }
-    else if (fromNumChans > 0){
+    else if (sending && fromNumChans > 0){
         // straight thru to dests - no panning
         int srcchan = fromStartChan;
         for (int channel = destStartChan; srcchan < fromStartChan + fromNumChans && srcchan < fromMaxChans && channel < destMaxChans; ++channel, ++srcchan) {
@@ -602,14 +873,14 @@ void ChannelGroup::processReverbSend (AudioBuffer<float>& frombuffer, int fromSt
             //int srcchan = channel < mainBusInputChannels ? channel : mainBusInputChannels - 1;
             //int srcchan = chanStartIndex  channel < mainBusInputChannels ? channel : mainBusInputChannels - 1;
 
-            tobuffer.addFromWithRamp(channel, 0, frombuffer.getReadPointer(srcchan), numSamples, lastrevgain, targrevgain);
+            addWithRamp(tobuffer.getWritePointer(channel), frombuffer.getReadPointer(srcchan), numSamples, lastrevgain, targrevgain);
         }
     }
 
-    procstate.laststereopan[0] = params.panStereo[0];
-    procstate.laststereopan[1] = params.panStereo[1];
-    for (int pani=0; pani < params.numChannels; ++pani) {
-        procstate.lastpan[pani] = params.pan[pani];
+    procstate.laststereopan[0] = stereopans[0];
+    procstate.laststereopan[1] = stereopans[1];
+    for (int pani=0; pani < numpans; ++pani) {
+        procstate.lastpan[pani] = pans[pani];
     }
 
     procstate.lastlevel = targrevgain;
@@ -626,15 +897,15 @@ ValueTree ChannelGroupParams::getValueTree() const
 {
     ValueTree channelGroupTree(channelGroupStateKey);
 
-    channelGroupTree.setProperty(gainKey, gain, nullptr);
+    channelGroupTree.setProperty(gainKey, gain.get(), nullptr);
     channelGroupTree.setProperty(channelStartIndexKey, chanStartIndex, nullptr);
     channelGroupTree.setProperty(numChannelsKey, numChannels, nullptr);
 
-    channelGroupTree.setProperty(peerPan1Key, panStereo[0], nullptr);
-    channelGroupTree.setProperty(peerPan2Key, panStereo[1], nullptr);
-    channelGroupTree.setProperty(monReverbSendKey, monReverbSend, nullptr);
-    channelGroupTree.setProperty(inReverbSendKey, inReverbSend, nullptr);
-    channelGroupTree.setProperty(monitorLevelKey, monitor, nullptr);
+    channelGroupTree.setProperty(peerPan1Key, panStereo[0].get(), nullptr);
+    channelGroupTree.setProperty(peerPan2Key, panStereo[1].get(), nullptr);
+    channelGroupTree.setProperty(monReverbSendKey, monReverbSend.get(), nullptr);
+    channelGroupTree.setProperty(inReverbSendKey, inReverbSend.get(), nullptr);
+    channelGroupTree.setProperty(monitorLevelKey, monitor.get(), nullptr);
 
     channelGroupTree.setProperty(monDestStartKey, monDestStartIndex, nullptr);
     channelGroupTree.setProperty(monDestChannelsKey, monDestChannels, nullptr);
@@ -650,7 +921,7 @@ ValueTree ChannelGroupParams::getValueTree() const
     ValueTree panListTree(stereoPanListKey);
     for (int i=0; i < numChannels && i < MAX_CHANNELS; ++i) {
         ValueTree panner(panStateKey);
-        panner.setProperty(panAttrKey, pan[i], nullptr);
+        panner.setProperty(panAttrKey, pan[i].get(), nullptr);
         panListTree.appendChild(panner, nullptr);
     }
 
@@ -668,15 +939,15 @@ ValueTree ChannelGroupParams::getValueTree() const
 
 void ChannelGroupParams::setFromValueTree(const ValueTree & channelGroupTree)
 {
-    gain = channelGroupTree.getProperty(gainKey, gain);
+    gain = channelGroupTree.getProperty(gainKey, gain.get());
     chanStartIndex = channelGroupTree.getProperty(channelStartIndexKey, chanStartIndex);
     numChannels = channelGroupTree.getProperty(numChannelsKey, numChannels);
     //pan = channelGroupTree.getProperty(peerMonoPanKey, pan);
-    panStereo[0] = channelGroupTree.getProperty(peerPan1Key, panStereo[0]);
-    panStereo[1] = channelGroupTree.getProperty(peerPan2Key, panStereo[1]);
-    monReverbSend = channelGroupTree.getProperty(monReverbSendKey, monReverbSend);
-    inReverbSend = channelGroupTree.getProperty(inReverbSendKey, inReverbSend);
-    monitor = channelGroupTree.getProperty(monitorLevelKey, monitor);
+    panStereo[0] = channelGroupTree.getProperty(peerPan1Key, panStereo[0].get());
+    panStereo[1] = channelGroupTree.getProperty(peerPan2Key, panStereo[1].get());
+    monReverbSend = channelGroupTree.getProperty(monReverbSendKey, monReverbSend.get());
+    inReverbSend = channelGroupTree.getProperty(inReverbSendKey, inReverbSend.get());
+    monitor = channelGroupTree.getProperty(monitorLevelKey, monitor.get());
 
     panDestStartIndex = channelGroupTree.getProperty(panDestStartKey, panDestStartIndex);
     panDestChannels = channelGroupTree.getProperty(panDestChannelsKey, panDestChannels);
@@ -695,7 +966,7 @@ void ChannelGroupParams::setFromValueTree(const ValueTree & channelGroupTree)
         int i=0;
         for (auto panner : panListTree) {
             if (panner.isValid() && i < MAX_CHANNELS) {
-                pan[i] = panner.getProperty(panAttrKey, pan[i]);
+                pan[i] = panner.getProperty(panAttrKey, pan[i].get());
             }
 
             ++i;
@@ -731,13 +1002,13 @@ ValueTree ChannelGroupParams::getChannelLayoutValueTree()
     channelGroupTree.setProperty(channelStartIndexKey, chanStartIndex, nullptr);
     channelGroupTree.setProperty(numChannelsKey, numChannels, nullptr);
     channelGroupTree.setProperty(nameKey, name, nullptr);
-    channelGroupTree.setProperty(peerPan1Key, panStereo[0], nullptr);
-    channelGroupTree.setProperty(peerPan2Key, panStereo[1], nullptr);
+    channelGroupTree.setProperty(peerPan1Key, panStereo[0].get(), nullptr);
+    channelGroupTree.setProperty(peerPan2Key, panStereo[1].get(), nullptr);
 
     ValueTree panListTree(stereoPanListKey);
     for (int i=0; i < numChannels && i < MAX_CHANNELS; ++i) {
         ValueTree panner(panStateKey);
-        panner.setProperty(panAttrKey, pan[i], nullptr);
+        panner.setProperty(panAttrKey, pan[i].get(), nullptr);
         panListTree.appendChild(panner, nullptr);
     }
     channelGroupTree.appendChild(panListTree, nullptr);
@@ -750,15 +1021,15 @@ void ChannelGroupParams::setFromChannelLayoutValueTree(const ValueTree & layoutv
     chanStartIndex = layoutval.getProperty(channelStartIndexKey, chanStartIndex);
     numChannels = layoutval.getProperty(numChannelsKey, numChannels);
     name = layoutval.getProperty(nameKey, name);
-    panStereo[0] = layoutval.getProperty(peerPan1Key, panStereo[0]);
-    panStereo[1] = layoutval.getProperty(peerPan2Key, panStereo[1]);
+    panStereo[0] = layoutval.getProperty(peerPan1Key, panStereo[0].get());
+    panStereo[1] = layoutval.getProperty(peerPan2Key, panStereo[1].get());
 
     ValueTree panListTree = layoutval.getChildWithName(stereoPanListKey);
     if (panListTree.isValid()) {
         int i=0;
         for (auto panner : panListTree) {
             if (panner.isValid() && i < MAX_CHANNELS) {
-                pan[i] = panner.getProperty(panAttrKey, pan[i]);
+                pan[i] = panner.getProperty(panAttrKey, pan[i].get());
             }
             ++i;
         }
@@ -777,69 +1048,95 @@ void ChannelGroup::commitAllParams()
 }
 
 
-void ChannelGroup::commitCompressorParams()
+void ChannelGroup::DynamicsZones::resolve(MapUI & control, const std::string & prefix)
 {
-    if (!compressorControl) return;
-    compressorControl->setParamValue("/compressor/Bypass", params.compressorParams.enabled ? 0.0f : 1.0f);
-    compressorControl->setParamValue("/compressor/knee", 2.0f);
-    compressorControl->setParamValue("/compressor/threshold", params.compressorParams.thresholdDb);
-    compressorControl->setParamValue("/compressor/ratio", params.compressorParams.ratio);
-    compressorControl->setParamValue("/compressor/attack", params.compressorParams.attackMs * 1e-3);
-    compressorControl->setParamValue("/compressor/release", params.compressorParams.releaseMs * 1e-3);
-    compressorControl->setParamValue("/compressor/makeup_gain", params.compressorParams.makeupGainDb);
-
-    float * tmp = compressorControl->getParamZone("/compressor/outgain");
-    if (tmp != compressorOutputLevel) {
-        compressorOutputLevel = tmp; // pointer
-    }
+    threshold = control.getParamZone(prefix + "threshold");
+    ratio = control.getParamZone(prefix + "ratio");
+    attack = control.getParamZone(prefix + "attack");
+    release = control.getParamZone(prefix + "release");
+    knee = control.getParamZone(prefix + "knee");
+    makeupGain = control.getParamZone(prefix + "makeup_gain");
+    gain = control.getParamZone(prefix + (prefix == "/expander/" ? "gain" : "outgain"));
 }
 
+void ChannelGroup::EqZones::resolve(MapUI & control)
+{
+    lowShelfGain = control.getParamZone("/parametric_eq/low_shelf/gain");
+    lowShelfFreq = control.getParamZone("/parametric_eq/low_shelf/transition_freq");
+    para1Gain = control.getParamZone("/parametric_eq/para1/peak_gain");
+    para1Freq = control.getParamZone("/parametric_eq/para1/peak_frequency");
+    para1Q = control.getParamZone("/parametric_eq/para1/peak_q");
+    para2Gain = control.getParamZone("/parametric_eq/para2/peak_gain");
+    para2Freq = control.getParamZone("/parametric_eq/para2/peak_frequency");
+    para2Q = control.getParamZone("/parametric_eq/para2/peak_q");
+    highShelfGain = control.getParamZone("/parametric_eq/high_shelf/gain");
+    highShelfFreq = control.getParamZone("/parametric_eq/high_shelf/transition_freq");
+}
 
-void ChannelGroup::commitExpanderParams()
+static inline void setZone(float * zone, float value)
 {
-    if (!expanderControl) return;
-    //mInputCompressorControl.setParamValue("/compressor/Bypass", mInputCompressorParams.enabled ? 0.0f : 1.0f);
-    expanderControl->setParamValue("/expander/knee", 3.0f);
-    expanderControl->setParamValue("/expander/threshold", params.expanderParams.thresholdDb);
-    expanderControl->setParamValue("/expander/ratio", params.expanderParams.ratio);
-    expanderControl->setParamValue("/expander/attack", params.expanderParams.attackMs * 1e-3);
-    expanderControl->setParamValue("/expander/release", params.expanderParams.releaseMs * 1e-3);
+    if (zone) *zone = value;
+}
 
-    float * tmp = expanderControl->getParamZone("/expander/outgain");
+void ChannelGroup::commitCompressorParams()
+{
+    compressorMailbox.post(params.compressorParams);
+}
 
-    if (tmp != expanderOutputGain) {
-        expanderOutputGain = tmp; // pointer
-    }
+void ChannelGroup::commitExpanderParams()
+{
+    expanderMailbox.post(params.expanderParams);
 }
 
 void ChannelGroup::commitLimiterParams()
 {
-    if (!limiterControl) return;
+    limiterMailbox.post(params.limiterParams);
+}
 
-    limiterControl->setParamValue("/compressor/Bypass", params.limiterParams.enabled ? 0.0f : 1.0f);
-    limiterControl->setParamValue("/compressor/threshold", params.limiterParams.thresholdDb);
-    limiterControl->setParamValue("/compressor/ratio", params.limiterParams.ratio);
-    limiterControl->setParamValue("/compressor/attack", params.limiterParams.attackMs * 1e-3);
-    limiterControl->setParamValue("/compressor/release", params.limiterParams.releaseMs * 1e-3);
+void ChannelGroup::commitEqParams()
+{
+    eqMailbox.post(params.eqParams);
 }
 
+void ChannelGroup::applyCompressorParams(const CompressorParams & cparams)
+{
+    setZone(compressorZones.knee, 2.0f);
+    setZone(compressorZones.threshold, cparams.thresholdDb);
+    setZone(compressorZones.ratio, cparams.ratio);
+    setZone(compressorZones.attack, cparams.attackMs * 1e-3);
+    setZone(compressorZones.release, cparams.releaseMs * 1e-3);
+    setZone(compressorZones.makeupGain, cparams.makeupGainDb);
+}
 
-void ChannelGroup::commitEqParams()
+void ChannelGroup::applyExpanderParams(const CompressorParams & cparams)
 {
-    if (!eqControl[0]) return;
+    setZone(expanderZones.knee, 3.0f);
+    setZone(expanderZones.threshold, cparams.thresholdDb);
+    setZone(expanderZones.ratio, cparams.ratio);
+    setZone(expanderZones.attack, cparams.attackMs * 1e-3);
+    setZone(expanderZones.release, cparams.releaseMs * 1e-3);
+}
 
-    for (int i=0; i < 2; ++i) {
-        eqControl[i]->setParamValue("/parametric_eq/low_shelf/gain", params.eqParams.lowShelfGain);
-        eqControl[i]->setParamValue("/parametric_eq/low_shelf/transition_freq", params.eqParams.lowShelfFreq);
-        eqControl[i]->setParamValue("/parametric_eq/para1/peak_gain", params.eqParams.para1Gain);
-        eqControl[i]->setParamValue("/parametric_eq/para1/peak_frequency", params.eqParams.para1Freq);
-        eqControl[i]->setParamValue("/parametric_eq/para1/peak_q", params.eqParams.para1Q);
-        eqControl[i]->setParamValue("/parametric_eq/para2/peak_gain", params.eqParams.para2Gain);
-        eqControl[i]->setParamValue("/parametric_eq/para2/peak_frequency", params.eqParams.para2Freq);
-        eqControl[i]->setParamValue("/parametric_eq/para2/peak_q", params.eqParams.para2Q);
-        eqControl[i]->setParamValue("/parametric_eq/high_shelf/gain", params.eqParams.highShelfGain);
-        eqControl[i]->setParamValue("/parametric_eq/high_shelf/transition_freq", params.eqParams.highShelfFreq);
-    }
+void ChannelGroup::applyLimiterParams(const CompressorParams & cparams)
+{
+    setZone(limiterZones.threshold, cparams.thresholdDb);
+    setZone(limiterZones.ratio, cparams.ratio);
+    setZone(limiterZones.attack, cparams.attackMs * 1e-3);
+    setZone(limiterZones.release, cparams.releaseMs * 1e-3);
+}
+
+void ChannelGroup::applyEqParams(const ParametricEqParams & eqparams)
+{
+    setZone(eqZones.lowShelfGain, eqparams.lowShelfGain);
+    setZone(eqZones.lowShelfFreq, eqparams.lowShelfFreq);
+    setZone(eqZones.para1Gain, eqparams.para1Gain);
+    setZone(eqZones.para1Freq, eqparams.para1Freq);
+    setZone(eqZones.para1Q, eqparams.para1Q);
+    setZone(eqZones.para2Gain, eqparams.para2Gain);
+    setZone(eqZones.para2Freq, eqparams.para2Freq);
+    setZone(eqZones.para2Q, eqparams.para2Q);
+    setZone(eqZones.highShelfGain, eqparams.highShelfGain);
+    setZone(eqZones.highShelfFreq, eqparams.highShelfFreq);
 }
 
 void ChannelGroup::commitMonitorDelayParams()
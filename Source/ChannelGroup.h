@@ -9,6 +9,8 @@
 #include "faustExpander.h"
 #include "faustParametricEQ.h"
 #include "faustLimiter.h"
+#include "MultiChannelEffects.h"
+#include "MonitorDelayArena.h"
 
 #include "EffectParams.h"
 
@@ -18,6 +20,30 @@ namespace SonoAudio {
 #define MAX_CHANNELS 64
 #endif
 
+// a mix value set from non-realtime threads and read by the audio thread, as it
+// goes (faders, pans, mutes). Each access is one relaxed atomic load or store, so
+// neither side ever waits or sees a half written value, while it still copies
+// and converts like the plain T it replaces.
+template <typename T>
+class RelaxedAtomic
+{
+public:
+    RelaxedAtomic(T initialValue = T()) noexcept : value(initialValue) {}
+    RelaxedAtomic(const RelaxedAtomic & other) noexcept : value(other.get()) {}
+
+    RelaxedAtomic & operator= (const RelaxedAtomic & other) noexcept { set(other.get()); return *this; }
+    RelaxedAtomic & operator= (T newValue) noexcept { set(newValue); return *this; }
+
+    operator T() const noexcept { return get(); }
+
+    T get() const noexcept { return value.load(std::memory_order_relaxed); }
+    void set(T newValue) noexcept { value.store(newValue, std::memory_order_relaxed); }
+
+private:
+    std::atomic<T> value;
+};
+
+
 // used to encapsulate audio processing for grouped set of audio
 // is used for both local or remote audio input
 
@@ -39,17 +65,17 @@ struct ChannelGroupParams
     int chanStartIndex = 0; // source channel
     int numChannels = 1;
 
-    bool muted = false;
-    bool soloed = false;
+    RelaxedAtomic<bool> muted = false;
+    RelaxedAtomic<bool> soloed = false;
 
     // input gain
-    float gain = 1.0f;
+    RelaxedAtomic<float> gain = 1.0f;
 
     // panning (0.0 is centered, -1 is left, 1 is right)
     // used when numChannels != 2
-    float pan[MAX_CHANNELS] = { 0.0f };
+    RelaxedAtomic<float> pan[MAX_CHANNELS];
     // used when numChannels == 2
-    float panStereo[2] = {-1.0f, 1.0f }; // only use 2
+    RelaxedAtomic<float> panStereo[2] = {-1.0f, 1.0f }; // only use 2
     float centerPanLaw = 0.596f; // center pan attentuation (default -4.5dB)
 
     int panDestStartIndex = 0; // destination channel index
@@ -57,13 +83,13 @@ struct ChannelGroupParams
 
     bool sendMainMix = true; // used for remote peers
 
-    // compressor (only used for 1 or 2 channel groups)
+    // compressor
     CompressorParams compressorParams;
 
     // gate/expander
     CompressorParams expanderParams;
 
-    // EQ (stereo only)
+    // EQ
     ParametricEqParams eqParams;
 
     // limiter
@@ -74,11 +100,11 @@ struct ChannelGroupParams
     bool invertPolarity = false;
 
     // reverb send
-    float inReverbSend = 0.0f;
-    float monReverbSend = 0.0f;
+    RelaxedAtomic<float> inReverbSend = 0.0f;
+    RelaxedAtomic<float> monReverbSend = 0.0f;
 
     // monitoring level
-    float monitor = 1.0f;
+    RelaxedAtomic<float> monitor = 1.0f;
     int monDestStartIndex = 0; // destination channel index
     int monDestChannels = 2; // destination number of channels
 
@@ -89,15 +115,55 @@ struct ChannelGroupParams
 };
 
 
+// hands the latest value of T from non-realtime threads to the audio thread
+// (a triple buffer), fetching never blocks. Writers are serialized by a spin
+// lock among themselves, T must be cheap to copy.
+template <typename T>
+class ParamsMailbox
+{
+public:
+    void post(const T & value)
+    {
+        const SpinLock::ScopedLockType sl (writeLock);
+        slots[writeIndex] = value;
+        // publish it and take back the slot that was waiting
+        writeIndex = pending.exchange(writeIndex | NewValueBit, std::memory_order_acq_rel) & IndexMask;
+    }
+
+    // audio thread only, returns false if nothing new was posted since the last fetch
+    bool fetch(T & value)
+    {
+        if ((pending.load(std::memory_order_relaxed) & NewValueBit) == 0) return false;
+        readIndex = pending.exchange(readIndex, std::memory_order_acq_rel) & IndexMask;
+        value = slots[readIndex];
+        return true;
+    }
+
+private:
+    enum { IndexMask = 3, NewValueBit = 4 };
+
+    T slots[3];
+    int writeIndex = 0;
+    int readIndex = 1;
+    std::atomic<int> pending { 2 };
+    SpinLock writeLock;
+};
+
+
 class ChannelGroup
 {
 public:
 
     ChannelGroup();
+    ~ChannelGroup();
 
 
     void init(double sampleRate);
 
+    // frees the effects, for a group nobody renders anymore. processBlock() runs
+    // without them until the next init().
+    void release();
+
     struct ProcessState
     {
         float lastlevel = 0.0f;
@@ -106,7 +172,10 @@ public:
     };
 
 
-    void processBlock (AudioBuffer<float>& frombuffer, AudioBuffer<float>& tobuffer,  int destStartChan, int destNumChans, AudioBuffer<float>& silentBuffer, int numSamples, float gainfactor, ProcessState * procstate=nullptr, AudioBuffer<float> * reverbbuffer=nullptr, int revStartChan=0, int revNumChans=2, bool revEnabled=false, float revgainfactor=1.0f, ProcessState * revprocstate=nullptr);
+    // inputSilent says the source channels are known to be all zero (in place, they
+    // have to be). Returns false if the output is silent, which it can also be when
+    // the group is muted, the caller can skip panning and metering it then.
+    bool processBlock (AudioBuffer<float>& frombuffer, AudioBuffer<float>& tobuffer,  int destStartChan, int destNumChans, AudioBuffer<float>& silentBuffer, int numSamples, float gainfactor, bool inputSilent, ProcessState * procstate=nullptr, AudioBuffer<float> * reverbbuffer=nullptr, int revStartChan=0, int revNumChans=2, bool revEnabled=false, float revgainfactor=1.0f, ProcessState * revprocstate=nullptr);
 
     void processPan (AudioBuffer<float>& frombuffer, int fromStartChan, AudioBuffer<float>& tobuffer, int destStartChan, int destNumChans, int numSamples, float gainfactor, ProcessState * procstate=nullptr);
 
@@ -115,9 +184,18 @@ public:
 
     void processReverbSend (AudioBuffer<float>& frombuffer, int fromStartChan, int fromNumChans, AudioBuffer<float>& tobuffer, int destStartChan, int destNumChans, int numSamples, bool revEnabled, bool inSend, float gainfactor=1.0f, ProcessState * procstate = nullptr);
 
+    // the level a block ramps to on the way from lastlevel to targlevel. Level
+    // changes are spread over a few ms of blocks, so a fader jumped across its
+    // range doesn't click however small the blocks are.
+    float smoothLevel(float lastlevel, float targlevel, int numSamples) const;
+
+    static constexpr float levelSmoothingTimeSec = 0.01f;
+
     // shallow copy of parameters and state
     void copyParametersFrom(const ChannelGroup& other);
 
+    // these hand the current params over to the audio thread, which applies
+    // them at the start of its next processBlock()
     void commitAllParams();
     
     void commitCompressorParams();
@@ -126,55 +204,128 @@ public:
     void commitEqParams();
     void commitMonitorDelayParams();
 
+    // write the given params into the zones
+    void applyCompressorParams(const CompressorParams & cparams);
+    void applyExpanderParams(const CompressorParams & cparams);
+    void applyLimiterParams(const CompressorParams & cparams);
+    void applyEqParams(const ParametricEqParams & eqparams);
+
     void setMonitoringDelayEnabled(bool enabled, int numchans);
     void setMonitoringDelayTimeMs(double delayms);
 
+    // where the monitoring delay gets its lines from, without one it is never applied
+    void setMonitorDelayArena(MonitorDelayArena * arena) { monitorDelayArena = arena; }
+
     ChannelGroupParams params;
 
+    // audio thread, skips the expander, compressor, EQ and limiter in processBlock()
+    // as if they were off, for shedding load. They start from cleared state again after.
+    bool bypassFx = false;
+
     ProcessState mainProcState;
     ProcessState monProcState;
     ProcessState inRevProcState;
     ProcessState revProcState;
 
-    // compressor (only used for 1 or 2 channel groups)
-    std::unique_ptr<faustCompressor> compressor;
+    // MapUI zones of the effects, looked up once in init() so applying
+    // params on the audio thread is only a few stores
+    struct DynamicsZones
+    {
+        void resolve(MapUI & control, const std::string & prefix);
+
+        float * threshold = nullptr;
+        float * ratio = nullptr;
+        float * attack = nullptr;
+        float * release = nullptr;
+        float * knee = nullptr;
+        float * makeupGain = nullptr;
+        float * gain = nullptr;
+    };
+
+    struct EqZones
+    {
+        void resolve(MapUI & control);
+
+        float * lowShelfGain = nullptr;
+        float * lowShelfFreq = nullptr;
+        float * para1Gain = nullptr;
+        float * para1Freq = nullptr;
+        float * para1Q = nullptr;
+        float * para2Gain = nullptr;
+        float * para2Freq = nullptr;
+        float * para2Q = nullptr;
+        float * highShelfGain = nullptr;
+        float * highShelfFreq = nullptr;
+    };
+
+    // what processBlock() hands to the variant it picked for the block, after
+    // settling the gain and the effect params
+    struct BlockSetup
+    {
+        AudioBuffer<float> * frombuffer = nullptr;
+        AudioBuffer<float> * tobuffer = nullptr;
+        int destStartChan = 0;
+        int destNumChans = 0;
+        int fxNumChans = 0;
+        int numSamples = 0;
+        float lastlevel = 0.0f;
+        float gain = 0.0f;
+        bool inputSilent = false;
+        bool muted = false;
+    };
+
+    // the gain and effects stage, with the channel count (0 for any) and whether
+    // the effects run built in. Returns true if the output is silent
+    template <int NumChans, bool WithFx>
+    bool processBlockVariant (const BlockSetup & setup);
+
+    using BlockVariant = bool (ChannelGroup::*)(const BlockSetup &);
+    static const BlockVariant blockVariants[3][2];
+
+    // compressor, linked across all channels of the group
+    std::unique_ptr<MultiChannelDynamics> compressor;
     std::unique_ptr<MapUI> compressorControl;
+    DynamicsZones compressorZones;
+    ParamsMailbox<CompressorParams> compressorMailbox;
+    CompressorParams activeCompressorParams; // audio thread
     float * compressorOutputLevel = nullptr;
-    bool compressorParamsChanged = false;
     bool _lastCompressorEnabled = false;
 
     // gate/expander
-    std::unique_ptr<faustExpander> expander;
+    std::unique_ptr<MultiChannelDynamics> expander;
     std::unique_ptr<MapUI>  expanderControl;
-    bool expanderParamsChanged = false;
+    DynamicsZones expanderZones;
+    ParamsMailbox<CompressorParams> expanderMailbox;
+    CompressorParams activeExpanderParams; // audio thread
     bool _lastExpanderEnabled = false;
     float * expanderOutputGain = nullptr;
 
-    // EQ (stereo only)
-    std::unique_ptr<faustParametricEQ> eq[2];
-    std::unique_ptr<MapUI>  eqControl[2];
-    bool eqParamsChanged = false;
+    // EQ, the same for all channels of the group
+    std::unique_ptr<MultiChannelParametricEQ> eq;
+    std::unique_ptr<MapUI>  eqControl;
+    EqZones eqZones;
+    ParamsMailbox<ParametricEqParams> eqMailbox;
+    ParametricEqParams activeEqParams; // audio thread
     bool _lastEqEnabled = false;
 
     // limiter
     //faustLimiter mInputLimiter;
-    std::unique_ptr<faustCompressor> limiter;
+    std::unique_ptr<MultiChannelDynamics> limiter;
     std::unique_ptr<MapUI>  limiterControl;
-    bool limiterParamsChanged = false;
+    DynamicsZones limiterZones;
+    ParamsMailbox<CompressorParams> limiterMailbox;
+    CompressorParams activeLimiterParams; // audio thread
     bool _lastLimiterEnabled = false;
 
     // monitoring delay
-    std::unique_ptr<juce::dsp::DelayLine<float,juce::dsp::DelayLineInterpolationTypes::None> > monitorDelayLine;
+    MonitorDelayArena * monitorDelayArena = nullptr;
+    MonitorDelayTap monitorDelayTap;
     bool monitorDelayParamsChanged = false;
-    double _monitorDelayTimeSamples = 0.0;
-    int _monitorDelayChans = 0;
-    std::atomic<bool>  _monitorDelayTimeChanged { false };
-    bool  _monitorDelayTimeChanging = false;
+    // the arena lines held, first line in the low byte and count above it, -1 for none
+    std::atomic<int>  _monitorDelayLines { -1 };
+    int  _monitorDelayLastLines = -1; // audio thread
     std::atomic<bool>  _monitorDelayActive  { false };
     bool   _monitorDelayLastActive = false;
-    CriticalSection _monitorDelayLock;
-
-    AudioBuffer<float> delayWorkBuffer;
 
 
     double sampleRate = 48000.0;
@@ -795,9 +795,15 @@ enum {
 };
 
 enum {
-    FillRatioUpdateTimerId = 0
+    FillRatioUpdateTimerId = 0,
+    EffectsReleaseTimerId
 };
 
+// the effect editors are built when their callout opens, and let go of once
+// it has been closed this long
+static const uint32 effectsReleaseDelayMs = 30000;
+static const int effectsReleaseCheckMs = 5000;
+
 void ChannelGroupView::paint(Graphics& g)
 {
     //g.fillAll (Colour(0xff111111));
@@ -3092,7 +3098,36 @@ void ChannelGroupsView::updatePeerModeChannelViews(int specific)
 
 void ChannelGroupsView::timerCallback(int timerId)
 {
+    if (timerId == EffectsReleaseTimerId) {
+        releaseClosedEffectsViews();
+    }
+}
+
+void ChannelGroupsView::releaseClosedEffectsViews()
+{
+    const auto nowMs = Time::getMillisecondCounter();
+
+    // a closed callout has deleted the viewport the view was in, nothing else holds on to it
+    auto checkRelease = [nowMs] (auto & view, const WeakReference<Component> & callout, uint32 & closedStampMs) {
+        if (!view || callout != nullptr) {
+            closedStampMs = 0;
+        }
+        else if (closedStampMs == 0) {
+            closedStampMs = nowMs;
+        }
+        else if (nowMs - closedStampMs >= effectsReleaseDelayMs) {
+            view.reset();
+            closedStampMs = 0;
+        }
+    };
+
+    checkRelease(mEffectsView, effectsCalloutBox, mEffectsClosedStampMs);
+    checkRelease(mMonEffectsView, monEffectsCalloutBox, mMonEffectsClosedStampMs);
+    checkRelease(mInputReverbView, inReverbCalloutBox, mInputReverbClosedStampMs);
 
+    if (!mEffectsView && !mMonEffectsView && !mInputReverbView) {
+        stopTimer(EffectsReleaseTimerId);
+    }
 }
 
 
@@ -3872,6 +3907,7 @@ void ChannelGroupsView::showEffects(int index, bool flag, Component * fromView)
         if (!mEffectsView) {
             mEffectsView = std::make_unique<ChannelGroupEffectsView>(processor, mPeerMode);
             mEffectsView->addListener(this);
+            startTimer(EffectsReleaseTimerId, effectsReleaseCheckMs);
         }
 
         auto minbounds = mEffectsView->getMinimumContentBounds();
@@ -3943,6 +3979,7 @@ void ChannelGroupsView::showMonitorEffects(int index, bool flag, Component * fro
         if (!mMonEffectsView) {
             mMonEffectsView = std::make_unique<ChannelGroupMonitorEffectsView>(processor, mPeerMode);
             mMonEffectsView->addListener(this);
+            startTimer(EffectsReleaseTimerId, effectsReleaseCheckMs);
         }
 
         mMonEffectsView->peerMode = mPeerMode;
@@ -4024,6 +4061,7 @@ void ChannelGroupsView::showInputReverbView(bool flag, Component * fromView)
         if (!mInputReverbView) {
             mInputReverbView = std::make_unique<ChannelGroupReverbEffectsView>(processor);
             //mInputReverbView->addListener(this);
+            startTimer(EffectsReleaseTimerId, effectsReleaseCheckMs);
         }
 
 
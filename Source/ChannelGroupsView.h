@@ -407,6 +407,7 @@ protected:
     void showEffects(int index, bool flag, Component * fromView=nullptr);
     void showMonitorEffects(int index, bool flag, Component * fromView=nullptr);
     void showInputReverbView(bool flag, Component * fromView=nullptr);
+    void releaseClosedEffectsViews();
 
     int getChanGroupFromIndex(int index);
     juce::Rectangle<int> getBoundsForChanGroup(int chgroup);
@@ -452,6 +453,11 @@ protected:
     WeakReference<Component> monEffectsCalloutBox;
     WeakReference<Component> inReverbCalloutBox;
 
+    // when the callout of each effects view was found closed, 0 while open
+    uint32 mEffectsClosedStampMs = 0;
+    uint32 mMonEffectsClosedStampMs = 0;
+    uint32 mInputReverbClosedStampMs = 0;
+
     FlexBox channelsBox;
     FlexBox addrowBox;
     int channelMinHeight = 60;
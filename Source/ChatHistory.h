@@ -0,0 +1,195 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include <vector>
+
+struct SBChatEvent
+{
+    enum EventType {
+        SelfType=0,
+        UserType,
+        SystemType
+    };
+
+    SBChatEvent() {};
+    SBChatEvent(EventType type_, const String & group_,  const String & from_, const String &targets_, const String & tags_, const String & mesg_) :
+    type(type_), group(group_), from(from_), targets(targets_), tags(tags_), message(mesg_)
+    {}
+
+    EventType type = UserType;
+    String group;
+    String from;
+    String targets;
+    String tags;
+    String message;
+    int64 timestamp = 0; // milliseconds since 1970, set when added to the history
+};
+
+namespace SonoAudio {
+
+// The chat of the session, only the latest so many messages of it, kept in a
+// ring so nothing gets moved when the oldest fall off. Messages are numbered
+// from the first one added since the last clear, so a view can ask for what
+// came after the last one it showed even once older ones are gone. The ones
+// falling off are appended as text to the spill file, if one is set.
+// Any thread.
+class ChatHistory
+{
+public:
+    static constexpr int DefaultMaxEvents = 2000;
+
+    void add(const SBChatEvent & event)
+    {
+        const ScopedLock sl (lock);
+        addLocked(event);
+    }
+
+    void addArray(const Array<SBChatEvent> & events)
+    {
+        const ScopedLock sl (lock);
+        for (auto & event : events) {
+            addLocked(event);
+        }
+    }
+
+    void clear()
+    {
+        const ScopedLock sl (lock);
+        ring.clear();
+        head = count = 0;
+        startIndex = 0;
+    }
+
+    // the number of the oldest one still kept, and one past the newest
+    int64 getStartIndex() const { const ScopedLock sl (lock); return startIndex; }
+    int64 getEndIndex() const { const ScopedLock sl (lock); return startIndex + count; }
+    int size() const { const ScopedLock sl (lock); return count; }
+
+    // copies of those numbered from on, as far as they are still kept
+    Array<SBChatEvent> getEvents(int64 from, int num) const
+    {
+        const ScopedLock sl (lock);
+        Array<SBChatEvent> events;
+
+        const int64 first = jmax(from, startIndex);
+        const int64 last = jmin(from + num, startIndex + count);
+        events.ensureStorageAllocated((int) jmax((int64) 0, last - first));
+
+        for (int64 i = first; i < last; ++i) {
+            events.add(ring[(size_t) ((head + (i - startIndex)) % (int64) ring.size())]);
+        }
+        return events;
+    }
+
+    void setMaxEvents(int num)
+    {
+        const ScopedLock sl (lock);
+        num = jmax(1, num);
+        if (num == maxEvents) return;
+
+        while (count > num) {
+            dropOldest();
+        }
+
+        // straighten it out into the new size, oldest first
+        std::vector<SBChatEvent> resized;
+        resized.reserve((size_t) jmin(num, count + 64));
+        for (int i=0; i < count; ++i) {
+            resized.push_back(std::move(ring[(size_t) ((head + i) % (int) ring.size())]));
+        }
+        ring = std::move(resized);
+        head = 0;
+        maxEvents = num;
+    }
+
+    int getMaxEvents() const { const ScopedLock sl (lock); return maxEvents; }
+
+    // File() for none
+    void setSpillFile(const File & file)
+    {
+        const ScopedLock sl (lock);
+        if (file == spillFile) return;
+
+        spillStream.reset();
+        spillFile = file;
+    }
+
+    File getSpillFile() const { const ScopedLock sl (lock); return spillFile; }
+
+private:
+    void addLocked(const SBChatEvent & event)
+    {
+        if (count == maxEvents) {
+            dropOldest();
+        }
+
+        const int pos = (head + count) % maxEvents;
+        if ((size_t) pos >= ring.size()) {
+            // grows up to the max as needed, it wraps only once full
+            ring.push_back(event);
+        } else {
+            ring[(size_t) pos] = event;
+        }
+
+        auto & added = ring[(size_t) pos];
+        if (added.timestamp == 0) {
+            added.timestamp = Time::currentTimeMillis();
+        }
+        ++count;
+    }
+
+    void dropOldest()
+    {
+        auto & oldest = ring[(size_t) head];
+        if (spillFile != File()) {
+            spill(oldest);
+        }
+        oldest = SBChatEvent();
+
+        head = (head + 1) % (int) ring.size();
+        --count;
+        ++startIndex;
+    }
+
+    void spill(const SBChatEvent & event)
+    {
+        if (!spillStream) {
+            spillFile.getParentDirectory().createDirectory();
+            spillStream = std::make_unique<FileOutputStream>(spillFile);
+            if (spillStream->failedToOpen()) {
+                DBG("Could not open chat spill file: " << spillFile.getFullPathName());
+                spillFile = File();
+                spillStream.reset();
+                return;
+            }
+        }
+
+        String line;
+        line << Time(event.timestamp).formatted("%Y-%m-%d %H:%M:%S") << "  ";
+        if (event.type == SBChatEvent::SystemType) {
+            line << "== " << event.message;
+        } else {
+            line << (event.from.isNotEmpty() ? event.from : String("?")) << ": " << event.message;
+        }
+        line << newLine;
+
+        spillStream->writeText(line, false, false, nullptr);
+        spillStream->flush();
+    }
+
+    CriticalSection lock;
+    std::vector<SBChatEvent> ring;
+    int head = 0; // index of the oldest in the ring
+    int count = 0;
+    int64 startIndex = 0;
+    int maxEvents = DefaultMaxEvents;
+
+    File spillFile;
+    std::unique_ptr<FileOutputStream> spillStream;
+};
+
+} // namespace SonoAudio
@@ -283,7 +283,7 @@ void ChatView::mouseDrag (const MouseEvent& event)
 
 void ChatView::addNewChatMessage(const SBChatEvent & mesg, bool refresh)
 {
-    processor.getAllChatEvents().add(mesg);
+    processor.getChatHistory().add(mesg);
 
     if (refresh) {
         refreshMessages();
@@ -292,7 +292,7 @@ void ChatView::addNewChatMessage(const SBChatEvent & mesg, bool refresh)
 
 void ChatView::addNewChatMessages(const Array<SBChatEvent> & mesgs, bool refresh)
 {
-    processor.getAllChatEvents().addArray(mesgs);
+    processor.getChatHistory().addArray(mesgs);
 
     if (refresh) {
         refreshMessages();
@@ -301,23 +301,33 @@ void ChatView::addNewChatMessages(const Array<SBChatEvent> & mesgs, bool refresh
 
 void ChatView::refreshMessages()
 {
-    // only new ones since last refresh
-    int count = jmin(processor.getAllChatEvents().size(), jmax(0, processor.getAllChatEvents().size() - lastShownCount));
+    auto & history = processor.getChatHistory();
 
-    if (count > 0) {
-        processNewChatMessages(processor.getAllChatEvents().size() - count, count);
+    // what is shown only grows, once what the history dropped is a good part of it
+    // start over with what it still has, so the text doesn't grow without end
+    if (history.getStartIndex() - firstShownIndex > history.getMaxEvents() / 2) {
+        refreshAllMessages();
+        return;
+    }
+
+    // only new ones since last refresh
+    const int64 endindex = history.getEndIndex();
+    if (endindex > lastShownIndex) {
+        processNewChatMessages(jmax(lastShownIndex, history.getStartIndex()), (int) (endindex - lastShownIndex));
     }
 }
 
 void ChatView::refreshAllMessages()
 {
-    // re-render all messages
-    lastShownCount = 0;
+    // re-render all messages still kept
+    auto & history = processor.getChatHistory();
+    firstShownIndex = lastShownIndex = history.getStartIndex();
     mLastChatMessageStamp = 0;
     mLastChatViewStamp = 0;
 
     mChatTextEditor->clear();
-    processNewChatMessages(0, processor.getAllChatEvents().size());
+    mUrlRanges.clear();
+    processNewChatMessages(history.getStartIndex(), history.size());
 }
 
 struct FontSizeItemData : public GenericItemChooserItem::UserData
@@ -408,12 +418,12 @@ void ChatView::showMenu(bool show)
 void ChatView::clearAll()
 {
     mChatTextEditor->clear();
-    processor.getAllChatEvents().clearQuick();
+    processor.getChatHistory().clear();
     mLastChatMessageStamp = 0;
     mLastChatViewStamp = 0;
     mLastChatUserMessageStamp = 0;
     mLastChatEventFrom.clear();
-    lastShownCount = 0;
+    firstShownIndex = lastShownIndex = 0;
     mUrlRanges.clear();
 }
 
@@ -484,7 +494,7 @@ bool ChatView::keyPressed (const KeyPress & key)
     return false;
 }
 
-void ChatView::processNewChatMessages(int index, int count)
+void ChatView::processNewChatMessages(int64 index, int count)
 {
     if (index < 0) return;
 
@@ -511,10 +521,10 @@ void ChatView::processNewChatMessages(int index, int count)
 
     bool fixedwidth = processor.getChatUseFixedWidthFont();
 
-    auto & allChatEvents = processor.getAllChatEvents();
+    // copies, the history can drop them meanwhile
+    const auto events = processor.getChatHistory().getEvents(index, count);
 
-    for (int i=index; i < index+count && i < allChatEvents.size(); ++i) {
-        auto & event = allChatEvents.getReference(i);
+    for (auto & event : events) {
 
         bool showtime = nowtime > mLastChatMessageStamp + 60.0 || nowtime > mLastChatShowTimeStamp + 60.0;
 
@@ -552,7 +562,7 @@ void ChatView::processNewChatMessages(int index, int count)
             mChatTextEditor->insertTextAtCaret(event.message);
 
             mChatTextEditor->insertTextAtCaret("      ");
-            mChatTextEditor->insertTextAtCaret(Time::getCurrentTime().toString(false, true, false));
+            mChatTextEditor->insertTextAtCaret(Time(event.timestamp).toString(false, true, false));
             mLastChatShowTimeStamp = nowtime;
 
             mChatTextEditor->insertTextAtCaret("\n");
@@ -564,7 +574,7 @@ void ChatView::processNewChatMessages(int index, int count)
                 mChatTextEditor->insertTextAtCaret(event.from);
 
                 mChatTextEditor->insertTextAtCaret("      ");
-                mChatTextEditor->insertTextAtCaret(Time::getCurrentTime().toString(false, true, false));
+                mChatTextEditor->insertTextAtCaret(Time(event.timestamp).toString(false, true, false));
 
                 mChatTextEditor->insertTextAtCaret("\n");
                 mLastChatShowTimeStamp = nowtime;
@@ -627,7 +637,7 @@ void ChatView::processNewChatMessages(int index, int count)
         mLastChatViewStamp = mLastChatUserMessageStamp;
     }
 
-    lastShownCount = index + count;
+    lastShownIndex = index + events.size();
 }
 
 void ChatView::visibilityChanged()
@@ -684,8 +694,8 @@ void ChatView::commitChatMessage()
 
     // process self
 
-    processor.getAllChatEvents().add(event);
-    processNewChatMessages(processor.getAllChatEvents().size()-1, 1);
+    processor.getChatHistory().add(event);
+    refreshMessages();
 
     mChatSendTextEditor->clear();
     mChatSendTextEditor->repaint();
@@ -53,7 +53,7 @@ public:
 
 protected:
 
-    void processNewChatMessages(int index, int count);
+    void processNewChatMessages(int64 index, int count);
     void commitChatMessage();
 
     void showMenu(bool show);
@@ -87,7 +87,9 @@ protected:
     MouseCursor mHandCursor = { MouseCursor::PointingHandCursor };
     MouseCursor mTextCursor = { MouseCursor::IBeamCursor };
 
-    int lastShownCount = 0;
+    // numbers in the processor's chat history, see ChatHistory
+    int64 firstShownIndex = 0;
+    int64 lastShownIndex = 0; // one past
 
     std::unique_ptr<Component> mChatContainer;
     std::unique_ptr<TextEditor> mChatTextEditor;
@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include "aoo/aoo.h"
+
+namespace SonoAudio {
+
+// How far a peer's system clock is ahead of ours, from the NTP time tags of the
+// ping exchange, so that times they send can be turned into our own. Every ping
+// gives a guess assuming the way there took as long as the way back. Of the last
+// few the one with the quickest round trip is the least disturbed by queueing on
+// the way, so that is the one used. Pings are added and offsets read on any thread.
+class ClockOffsetEstimator
+{
+public:
+    // tt1 and tt3 are our send and receive times, tt2 theirs in between
+    void addPing(uint64_t tt1, uint64_t tt2, uint64_t tt3)
+    {
+        const double rtt = aoo_osctime_duration(tt1, tt3);
+        if (rtt < 0.0 || rtt > MaxRoundTripSecs) return;
+
+        // their time minus the middle of ours, wraps around like the time tags do
+        const int64_t offset = (int64_t) (tt2 - (tt1 + (tt3 - tt1) / 2));
+
+        const SpinLock::ScopedLockType sl (lock);
+        samples[next] = { rtt, offset };
+        next = (next + 1) % NumSamples;
+        count = jmin(count + 1, NumSamples);
+    }
+
+    bool isValid() const
+    {
+        const SpinLock::ScopedLockType sl (lock);
+        return count > 0;
+    }
+
+    // their clock minus ours, in NTP units, 0 until a ping came back
+    int64_t getOffset() const
+    {
+        const SpinLock::ScopedLockType sl (lock);
+        if (count == 0) return 0;
+
+        int best = 0;
+        for (int i=1; i < count; ++i) {
+            if (samples[i].rtt < samples[best].rtt) best = i;
+        }
+        return samples[best].offset;
+    }
+
+    uint64_t toLocalTime(uint64_t theirTime) const { return theirTime - (uint64_t) getOffset(); }
+    uint64_t toRemoteTime(uint64_t ourTime) const { return ourTime + (uint64_t) getOffset(); }
+
+    void reset()
+    {
+        const SpinLock::ScopedLockType sl (lock);
+        count = next = 0;
+    }
+
+private:
+    static constexpr int NumSamples = 8;
+    static constexpr double MaxRoundTripSecs = 2.0;
+
+    struct Sample {
+        double rtt = 0.0;
+        int64_t offset = 0;
+    };
+
+    mutable SpinLock lock;
+    Sample samples[NumSamples];
+    int count = 0;
+    int next = 0;
+};
+
+} // namespace SonoAudio
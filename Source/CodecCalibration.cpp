@@ -0,0 +1,135 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#include "CodecCalibration.h"
+
+#include <cmath>
+#include <vector>
+
+namespace SonoAudio {
+namespace CodecCalibration {
+
+namespace {
+    // rounds of this many blocks between the checks of the time
+    constexpr int RoundBlocks = 16;
+
+    // a bit of everything, so the codecs have something to work on
+    std::vector<aoo_sample> makeSignal(int numFrames, int numChannels, double sampleRate)
+    {
+        std::vector<aoo_sample> signal ((size_t) (numFrames * numChannels));
+        uint32 noise = 12345;
+        for (int i = 0; i < numFrames; ++i) {
+            for (int ch = 0; ch < numChannels; ++ch) {
+                noise = noise * 1664525 + 1013904223;
+                const double n = ((noise >> 8) / (double) (1 << 24)) * 2.0 - 1.0;
+                signal[(size_t) (i * numChannels + ch)] = (aoo_sample) (0.5 * std::sin(MathConstants<double>::twoPi * 440.0 * (ch + 1) * i / sampleRate) + 0.05 * n);
+            }
+        }
+        return signal;
+    }
+}
+
+Cost measure(const aoo_format_storage & format, double maxSeconds, std::function<bool()> shouldCancel)
+{
+    Cost cost;
+
+    const aoo_codec * codec = aoo_find_codec(format.header.codec);
+    if (!codec) return cost;
+
+    aoo_format_storage fmt = format;
+    void * encoder = codec->encoder_new();
+    void * decoder = codec->decoder_new();
+
+    // the decoder gets what the encoder made of the format
+    if (encoder && decoder && codec->encoder_setformat(encoder, &fmt.header) > 0 && codec->decoder_setformat(decoder, &fmt.header) > 0
+        && fmt.header.blocksize > 0 && fmt.header.nchannels > 0 && fmt.header.samplerate > 0)
+    {
+        const int numchans = fmt.header.nchannels;
+        const int blocksize = fmt.header.blocksize;
+        const int n = numchans * blocksize;
+        // a second of signal, so the encoder doesn't just see the same block again
+        const int numblocks = jmax(1, fmt.header.samplerate / blocksize);
+        const auto signal = makeSignal(numblocks * blocksize, numchans, fmt.header.samplerate);
+
+        const int maxencoded = (int) sizeof(double) * n;
+        HeapBlock<char> encoded ((size_t) (maxencoded * numblocks));
+        Array<int> sizes;
+        sizes.insertMultiple(0, 0, numblocks);
+        HeapBlock<aoo_sample> decoded ((size_t) n);
+
+        const int64 limit = Time::secondsToHighResolutionTicks(maxSeconds * 0.5);
+        bool ok = true;
+
+        // encode first, which also leaves the packets for the decoder
+        int64 ticks = 0;
+        int64 blocks = 0;
+        while (ok && (blocks < numblocks || ticks < limit)) {
+            if (shouldCancel && shouldCancel()) return Cost();
+            const int64 start = Time::getHighResolutionTicks();
+            for (int r = 0; r < RoundBlocks; ++r, ++blocks) {
+                const int b = (int) (blocks % numblocks);
+                const int size = codec->encoder_encode(encoder, signal.data() + (size_t) (b * n), n, encoded + (size_t) (b * maxencoded), maxencoded);
+                if (size <= 0) {
+                    ok = false;
+                    break;
+                }
+                sizes.set(b, size);
+            }
+            ticks += Time::getHighResolutionTicks() - start;
+        }
+        const double audioseconds = (double) blocks * blocksize / fmt.header.samplerate;
+        if (ok && audioseconds > 0.0) {
+            cost.encode = (float) (Time::highResolutionTicksToSeconds(ticks) / audioseconds / numchans);
+        }
+
+        ticks = 0;
+        blocks = 0;
+        while (ok && (blocks < numblocks || ticks < limit)) {
+            if (shouldCancel && shouldCancel()) return Cost();
+            const int64 start = Time::getHighResolutionTicks();
+            for (int r = 0; r < RoundBlocks; ++r, ++blocks) {
+                const int b = (int) (blocks % numblocks);
+                if (codec->decoder_decode(decoder, encoded + (size_t) (b * maxencoded), sizes[b], decoded, n) <= 0) {
+                    ok = false;
+                    break;
+                }
+            }
+            ticks += Time::getHighResolutionTicks() - start;
+        }
+        const double decodedseconds = (double) blocks * blocksize / fmt.header.samplerate;
+        if (ok && decodedseconds > 0.0) {
+            cost.decode = (float) (Time::highResolutionTicksToSeconds(ticks) / decodedseconds / numchans);
+        }
+        if (!ok) {
+            cost = Cost();
+        }
+    }
+
+    if (encoder) codec->encoder_free(encoder);
+    if (decoder) codec->decoder_free(decoder);
+    return cost;
+}
+
+String toString(const Array<Cost> & costs)
+{
+    StringArray items;
+    for (const auto & cost : costs) {
+        items.add(String(cost.encode, 6) + ":" + String(cost.decode, 6));
+    }
+    return items.joinIntoString(",");
+}
+
+Array<Cost> fromString(const String & str)
+{
+    Array<Cost> costs;
+    for (const auto & item : StringArray::fromTokens(str, ",", "")) {
+        Cost cost;
+        cost.encode = item.upToFirstOccurrenceOf(":", false, false).getFloatValue();
+        cost.decode = item.fromFirstOccurrenceOf(":", false, false).getFloatValue();
+        costs.add(cost);
+    }
+    return costs;
+}
+
+}
+}
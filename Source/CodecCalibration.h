@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include "aoo/aoo.h"
+
+#include <functional>
+
+namespace SonoAudio {
+
+// What the codecs cost on this machine, measured once like the micro benchmarks
+// in bench/aoo_bench.cpp do it: a bit of tone and noise encoded and decoded over
+// and over, timed with the high resolution clock. What comes out is the share
+// of real time it takes per channel, so 0.01 means one channel of it in each
+// direction uses up 1% of a core. Takes a while, not for the audio or message thread.
+namespace CodecCalibration {
+
+    struct Cost {
+        float encode = 0.0f;
+        float decode = 0.0f;
+
+        bool isValid() const { return encode > 0.0f && decode > 0.0f; }
+    };
+
+    // runs the codec of the format for about maxSeconds of our time, or
+    // until shouldCancel says so. An invalid cost if it couldn't
+    Cost measure(const aoo_format_storage & format, double maxSeconds, std::function<bool()> shouldCancel = nullptr);
+
+    // "encode:decode" per format, comma separated, for the settings
+    String toString(const Array<Cost> & costs);
+    Array<Cost> fromString(const String & str);
+}
+
+}
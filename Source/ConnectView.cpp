@@ -450,7 +450,12 @@ void ConnectView::configEditor(TextEditor *editor, bool passwd)
 void ConnectView::updateState()
 {
     String locstr;
-    locstr << processor.getLocalIPAddress().toString() << ":" << processor.getUdpLocalPort();
+    if (processor.isLocalAddressKnown()) {
+        locstr << processor.getLocalIPAddress().toString() << ":" << processor.getUdpLocalPort();
+    } else {
+        // still being looked up
+        locstr << "...:" << processor.getUdpLocalPort();
+    }
     mLocalAddressLabel->setText(locstr, dontSendNotification);
 
     resetPrivateGroupLabels();
@@ -1220,6 +1225,16 @@ void ConnectView::connectWithInfo(const AooServerConnectionInfo & info, bool all
 
         Timer::callAfterDelay(100, [this] {
             processor.connectToServer(currConnectionInfo.serverHost, currConnectionInfo.serverPort, currConnectionInfo.userName, currConnectionInfo.userPassword);
+
+            // the client sends these along with the login, so the group is
+            // joined in the same round trip
+            if (currConnectionInfo.groupName.isNotEmpty()) {
+                processor.setWatchPublicGroups(false);
+                processor.joinServerGroup(currConnectionInfo.groupName, currConnectionInfo.groupPassword, currConnectionInfo.groupIsPublic);
+            }
+            else {
+                processor.setWatchPublicGroups(true);
+            }
            // updateState();
             listeners.call(&ConnectView::Listener::connectionsChanged, this);
 
@@ -1263,6 +1278,36 @@ void ConnectView::updatePublicGroups()
     mPublicGroupsListBox->deselectAllRows();
 }
 
+void ConnectView::updatePublicGroup(const String & group)
+{
+    const int selrow = mPublicGroupsListBox->getSelectedRow();
+    const String selgroup = mPublicGroupsListBox->getModel()->getNameForRow(selrow);
+    const int prevcount = publicGroupsListModel.getNumRows();
+
+    const int row = publicGroupsListModel.updateGroup(group);
+
+    if (prevcount == publicGroupsListModel.getNumRows()) {
+        // only its count changed, if anything
+        if (row >= 0) {
+            mPublicGroupsListBox->repaintRow(row);
+        }
+        return;
+    }
+
+    mPublicGroupsListBox->updateContent();
+    mPublicGroupsListBox->repaint();
+
+    // the rows after it moved
+    if (selrow >= 0) {
+        const int newselrow = publicGroupsListModel.indexOfGroup(selgroup);
+        if (newselrow >= 0) {
+            mPublicGroupsListBox->selectRow(newselrow, true, true);
+        } else {
+            mPublicGroupsListBox->deselectAllRows();
+        }
+    }
+}
+
 void ConnectView::resetPrivateGroupLabels()
 {
     if (!mServerInfoLabel) return;
@@ -1604,6 +1649,38 @@ void ConnectView::PublicGroupsListModel::updateState()
     parent->processor.getPublicGroupInfos(groups);
 }
 
+int ConnectView::PublicGroupsListModel::indexOfGroup(const String & group) const
+{
+    for (int i=0; i < groups.size(); ++i) {
+        if (groups.getReference(i).groupName == group) return i;
+    }
+    return -1;
+}
+
+int ConnectView::PublicGroupsListModel::updateGroup(const String & group)
+{
+    int index = indexOfGroup(group);
+
+    AooPublicGroupInfo info;
+    if (!parent->processor.getPublicGroupInfo(group, info)) {
+        groups.remove(index);
+        return -1;
+    }
+
+    if (index >= 0) {
+        groups.setUnchecked(index, info);
+        return index;
+    }
+
+    // in the same order as getPublicGroupInfos() has them
+    index = 0;
+    while (index < groups.size() && groups.getReference(index).groupName < group) {
+        ++index;
+    }
+    groups.insert(index, info);
+    return index;
+}
+
 int ConnectView::PublicGroupsListModel::getNumRows()
 {
     return groups.size();
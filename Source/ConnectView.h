@@ -82,6 +82,8 @@ public:
     void updateServerFieldsFromConnectionInfo();
 
     void updatePublicGroups();
+    // just the row of this one, which keeps the selection
+    void updatePublicGroup(const String & group);
     void resetPrivateGroupLabels();
     void groupJoinFailed();
 
@@ -217,6 +219,9 @@ protected:
         void returnKeyPressed (int) override;
 
         void updateState();
+        // returns the row it's in now, -1 if it's gone
+        int updateGroup(const String & group);
+        int indexOfGroup(const String & group) const;
 
     protected:
         ConnectView * parent;
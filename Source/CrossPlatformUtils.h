@@ -6,9 +6,64 @@
 
 void getSafeAreaInsets(void * component, float & top, float & bottom, float & left, float & right);
 
+// puts the calling thread in (or takes it out of) the platform's real-time class for
+// latency critical non-audio work: SCHED_FIFO, MMCSS "Pro Audio", or QoS user-interactive.
+// returns false if it couldn't be changed (lack of permissions, etc)
+bool setCurrentThreadRealtime(bool realtime);
+
+// for the threads doing work the audio callback waits on, so they get scheduled
+// like it instead of ending up on the efficiency cores: the audio device's workgroup
+// on macOS 11 and up (which needs the name of the device, the standalone app passes
+// it when the device starts and nullptr when it stops), no power throttling on Windows.
+// joinAudioWorkgroup() is cheap once joined and follows a change of the device, call it
+// as the thread goes. Returns false if there's nothing to join
+void setAudioWorkgroupDevice(const char * deviceName);
+bool joinAudioWorkgroup();
+void leaveAudioWorkgroup();
+
+// how hot the device is running, as the platform reports it
+enum ThermalState {
+    ThermalUnknown = -1,
+    ThermalNominal = 0,
+    ThermalFair,     // a bit warm, no throttling yet
+    ThermalSerious,  // being throttled, or about to
+    ThermalCritical  // about to shut things down
+};
+
+// one of ThermalState, can take a little while (reads sysfs on Linux), don't call it often
+int getThermalState();
+
 
 #if JUCE_MAC
 
 void disableAppNap();
 
 #endif
+
+#if JUCE_WINDOWS
+
+#include <cstdint>
+
+// Windows ignores IP_TOS, traffic marking goes through qWAVE instead (loaded lazily,
+// so we don't need to link against it). An unconnected UDP socket needs a flow for
+// every destination.
+class SocketQosFlows
+{
+public:
+    ~SocketQosFlows() { close(); }
+
+    // dscp is the code point to ask for (46 is EF), returns false if qWAVE isn't available
+    bool open(uintptr_t socket, int dscp);
+    void close();
+    bool isOpen() const { return handle != nullptr; }
+
+    // returns the flow id, 0 on failure
+    uint32_t addDestination(const void * sockaddr);
+
+private:
+    void * handle = nullptr;
+    uintptr_t socket = 0;
+    int dscp = 0;
+};
+
+#endif
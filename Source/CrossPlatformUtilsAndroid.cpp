@@ -7,6 +7,12 @@
 
 #include "CrossPlatformUtils.h"
 
+#include "JuceHeader.h"
+#include "juce_core/native/juce_android_JNIHelpers.h"
+
+#include <sys/resource.h>
+#include <unistd.h>
+
 //#include "../JuceLibraryCode/JuceHeader.h"
 
 //#include "DebugLogC.h"
@@ -16,4 +22,50 @@ void getSafeAreaInsets(void * component, float & top, float & bottom, float & le
     top = bottom = left = right = 0;
 }
 
+bool setCurrentThreadRealtime(bool realtime)
+{
+    // SCHED_FIFO is not allowed for normal apps, use the nice level the
+    // audio framework uses for its own threads instead (ANDROID_PRIORITY_AUDIO)
+    return setpriority(PRIO_PROCESS, (id_t) gettid(), realtime ? -16 : 0) == 0;
+}
+
+#define JNI_CLASS_MEMBERS(METHOD, STATICMETHOD, FIELD, STATICFIELD, CALLBACK) \
+    METHOD (getCurrentThermalStatus, "getCurrentThermalStatus", "()I")
+
+DECLARE_JNI_CLASS_WITH_MIN_SDK (AndroidPowerManager, "android/os/PowerManager", 29)
+#undef JNI_CLASS_MEMBERS
+
+void setAudioWorkgroupDevice(const char * deviceName)
+{
+}
+
+bool joinAudioWorkgroup()
+{
+    // no such thing for apps, the nice level is all there is
+    return false;
+}
+
+void leaveAudioWorkgroup()
+{
+}
+
+int getThermalState()
+{
+    if (getAndroidSDKVersion() < 29) return ThermalUnknown;
+
+    auto * env = getEnv();
+    LocalRef<jobject> context (getAppContext());
+    if (context == nullptr) return ThermalUnknown;
+
+    LocalRef<jobject> powermanager (env->CallObjectMethod (context.get(), AndroidContext.getSystemService, javaString ("power").get()));
+    if (powermanager == nullptr) return ThermalUnknown;
+
+    // PowerManager.THERMAL_STATUS_NONE, LIGHT, MODERATE, SEVERE, CRITICAL, EMERGENCY, SHUTDOWN
+    const int status = env->CallIntMethod (powermanager.get(), AndroidPowerManager.getCurrentThermalStatus);
+    if (status <= 0) return ThermalNominal;
+    if (status == 1) return ThermalFair;
+    if (status <= 3) return ThermalSerious;
+    return ThermalCritical;
+}
+
 #endif
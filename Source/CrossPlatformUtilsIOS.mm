@@ -17,6 +17,8 @@
 
 #import <UIKit/UIView.h>
 
+#include <pthread.h>
+
 
 
 //#include "../JuceLibraryCode/JuceHeader.h"
@@ -46,4 +48,34 @@ void getSafeAreaInsets(void * component, float & top, float & bottom, float & le
     }
 }
 
+bool setCurrentThreadRealtime(bool realtime)
+{
+    return pthread_set_qos_class_self_np(realtime ? QOS_CLASS_USER_INTERACTIVE : QOS_CLASS_DEFAULT, 0) == 0;
+}
+
+void setAudioWorkgroupDevice(const char * deviceName)
+{
+}
+
+bool joinAudioWorkgroup()
+{
+    // the workgroup belongs to the remote io unit, which juce keeps to itself
+    return false;
+}
+
+void leaveAudioWorkgroup()
+{
+}
+
+int getThermalState()
+{
+    switch ([[NSProcessInfo processInfo] thermalState]) {
+        case NSProcessInfoThermalStateNominal: return ThermalNominal;
+        case NSProcessInfoThermalStateFair: return ThermalFair;
+        case NSProcessInfoThermalStateSerious: return ThermalSerious;
+        case NSProcessInfoThermalStateCritical: return ThermalCritical;
+        default: return ThermalUnknown;
+    }
+}
+
 #endif
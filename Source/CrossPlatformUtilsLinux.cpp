@@ -8,10 +8,86 @@
 
 #if JUCE_LINUX
 
+#include <pthread.h>
+#include <sched.h>
+
+#include <limits>
+
 
 void getSafeAreaInsets(void * component, float & top, float & bottom, float & left, float & right)
 {
     top = bottom = left = right = 0;
 }
 
+
+bool setCurrentThreadRealtime(bool realtime)
+{
+    struct sched_param param;
+    int policy = SCHED_OTHER;
+    param.sched_priority = 0;
+
+    if (realtime) {
+        // a middling real-time priority, audio threads should still win over us
+        policy = SCHED_FIFO;
+        param.sched_priority = (sched_get_priority_min(SCHED_FIFO) + sched_get_priority_max(SCHED_FIFO)) / 2;
+    }
+
+    return pthread_setschedparam(pthread_self(), policy, &param) == 0;
+}
+
+void setAudioWorkgroupDevice(const char * deviceName)
+{
+}
+
+bool joinAudioWorkgroup()
+{
+    // no such thing, the scheduler class is all there is
+    return false;
+}
+
+void leaveAudioWorkgroup()
+{
+}
+
+int getThermalState()
+{
+    // the hottest of the thermal zones against their own trip points, the passive
+    // one is where the kernel starts throttling
+    int state = ThermalUnknown;
+
+    for (int zone = 0; zone < 64; ++zone) {
+        File zonedir ("/sys/class/thermal/thermal_zone" + String(zone));
+        if (!zonedir.isDirectory()) break;
+
+        auto tempstr = zonedir.getChildFile("temp").loadFileAsString().trim();
+        if (tempstr.isEmpty()) continue;
+        const int temp = tempstr.getIntValue(); // millidegrees
+
+        int passive = std::numeric_limits<int>::max();
+        int hot = std::numeric_limits<int>::max();
+        for (int trip = 0; trip < 16; ++trip) {
+            auto typefile = zonedir.getChildFile("trip_point_" + String(trip) + "_type");
+            if (!typefile.existsAsFile()) break;
+            const auto type = typefile.loadFileAsString().trim();
+            const int triptemp = zonedir.getChildFile("trip_point_" + String(trip) + "_temp").loadFileAsString().trim().getIntValue();
+            if (triptemp <= 0) continue;
+            if (type == "passive") passive = jmin(passive, triptemp);
+            else if (type == "hot" || type == "critical") hot = jmin(hot, triptemp);
+        }
+        if (passive == std::numeric_limits<int>::max()) {
+            // the pi has none, it throttles at 80
+            passive = hot != std::numeric_limits<int>::max() ? hot - 15000 : 80000;
+        }
+
+        int zonestate = ThermalNominal;
+        if (temp >= hot) zonestate = ThermalCritical;
+        else if (temp >= passive) zonestate = ThermalSerious;
+        else if (temp >= passive - 10000) zonestate = ThermalFair;
+
+        state = jmax(state, zonestate);
+    }
+
+    return state;
+}
+
 #endif
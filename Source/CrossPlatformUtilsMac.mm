@@ -13,6 +13,22 @@
 
 #import <Cocoa/Cocoa.h>
 
+#include <CoreAudio/CoreAudio.h>
+
+#include <pthread.h>
+
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#if __has_include(<os/workgroup.h>)
+#include <os/workgroup.h>
+#define SONOBUS_AUDIO_WORKGROUP 1
+#else
+#define SONOBUS_AUDIO_WORKGROUP 0
+#endif
+
 
 void getSafeAreaInsets(void * component, float & top, float & bottom, float & left, float & right)
 {
@@ -38,4 +54,155 @@ void disableAppNap() {
     }
 }
 
+bool setCurrentThreadRealtime(bool realtime)
+{
+    return pthread_set_qos_class_self_np(realtime ? QOS_CLASS_USER_INTERACTIVE : QOS_CLASS_DEFAULT, 0) == 0;
+}
+
+#if SONOBUS_AUDIO_WORKGROUP
+
+namespace {
+
+// the workgroup of the device we play through (retained), and how many there were,
+// so the joined threads can tell they have to move
+std::mutex workgroupLock;
+os_workgroup_t deviceWorkgroup = nullptr;
+std::atomic<int> workgroupSerial { 0 };
+
+constexpr auto audioObjectPropertyElementMain =
+   #if defined (MAC_OS_VERSION_12_0)
+    kAudioObjectPropertyElementMain;
+   #else
+    kAudioObjectPropertyElementMaster;
+   #endif
+
+API_AVAILABLE(macos(11.0))
+os_workgroup_t findDeviceWorkgroup(const char * deviceName)
+{
+    // the device by the name juce knows it by
+    AudioObjectPropertyAddress pa;
+    pa.mSelector = kAudioHardwarePropertyDevices;
+    pa.mScope = kAudioObjectPropertyScopeGlobal;
+    pa.mElement = audioObjectPropertyElementMain;
+
+    UInt32 size = 0;
+    if (AudioObjectGetPropertyDataSize(kAudioObjectSystemObject, &pa, 0, nullptr, &size) != noErr || size == 0) return nullptr;
+
+    std::vector<AudioDeviceID> devices (size / sizeof(AudioDeviceID));
+    if (AudioObjectGetPropertyData(kAudioObjectSystemObject, &pa, 0, nullptr, &size, devices.data()) != noErr) return nullptr;
+
+    for (auto device : devices) {
+        char name[1024];
+        size = sizeof(name);
+        pa.mSelector = kAudioDevicePropertyDeviceName;
+        if (AudioObjectGetPropertyData(device, &pa, 0, nullptr, &size, name) != noErr || std::strcmp(name, deviceName) != 0) continue;
+
+        // comes retained
+        os_workgroup_t workgroup = nullptr;
+        size = sizeof(workgroup);
+        pa.mSelector = kAudioDevicePropertyIOThreadOSWorkgroup;
+        if (AudioObjectGetPropertyData(device, &pa, 0, nullptr, &size, &workgroup) == noErr) {
+            return workgroup;
+        }
+        break;
+    }
+    return nullptr;
+}
+
+struct JoinedWorkgroup
+{
+    // the thread leaves it when it ends
+    ~JoinedWorkgroup() { leave(); }
+
+    void leave()
+    {
+        if (workgroup) {
+            if (@available(macOS 11.0, *)) {
+                os_workgroup_leave(workgroup, &token);
+                os_release(workgroup);
+            }
+            workgroup = nullptr;
+        }
+    }
+
+    os_workgroup_t workgroup = nullptr;
+    os_workgroup_join_token_s token;
+    int serial = -1;
+};
+
+thread_local JoinedWorkgroup joinedWorkgroup;
+
+}
+
+#endif
+
+void setAudioWorkgroupDevice(const char * deviceName)
+{
+#if SONOBUS_AUDIO_WORKGROUP
+    if (@available(macOS 11.0, *)) {
+        os_workgroup_t workgroup = (deviceName && *deviceName) ? findDeviceWorkgroup(deviceName) : nullptr;
+        {
+            std::lock_guard<std::mutex> lock (workgroupLock);
+            std::swap(deviceWorkgroup, workgroup);
+            ++workgroupSerial;
+        }
+        // the joined threads keep theirs until they move
+        if (workgroup) os_release(workgroup);
+    }
+#endif
+}
+
+bool joinAudioWorkgroup()
+{
+#if SONOBUS_AUDIO_WORKGROUP
+    auto & joined = joinedWorkgroup;
+    const int serial = workgroupSerial.load();
+    if (serial == joined.serial) return joined.workgroup != nullptr;
+
+    joined.leave();
+    joined.serial = serial;
+
+    if (@available(macOS 11.0, *)) {
+        os_workgroup_t workgroup = nullptr;
+        {
+            std::lock_guard<std::mutex> lock (workgroupLock);
+            workgroup = deviceWorkgroup;
+            if (workgroup) os_retain(workgroup);
+        }
+        if (!workgroup) return false;
+
+        // fails if the device stopped in the meantime, the next one brings a new serial
+        if (os_workgroup_join(workgroup, &joined.token) != 0) {
+            os_release(workgroup);
+            return false;
+        }
+        joined.workgroup = workgroup;
+        return true;
+    }
+#endif
+    return false;
+}
+
+void leaveAudioWorkgroup()
+{
+#if SONOBUS_AUDIO_WORKGROUP
+    joinedWorkgroup.leave();
+    joinedWorkgroup.serial = -1;
+#endif
+}
+
+int getThermalState()
+{
+    if (@available(macOS 10.10.3, *)) {
+        switch ([[NSProcessInfo processInfo] thermalState]) {
+            case NSProcessInfoThermalStateNominal: return ThermalNominal;
+            case NSProcessInfoThermalStateFair: return ThermalFair;
+            case NSProcessInfoThermalStateSerious: return ThermalSerious;
+            case NSProcessInfoThermalStateCritical: return ThermalCritical;
+            default: break;
+        }
+    }
+    return ThermalUnknown;
+}
+
 #endif
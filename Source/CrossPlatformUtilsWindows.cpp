@@ -11,9 +11,192 @@
 
 #include "DebugLogC.h"
 
+#include <winsock2.h>
+#include <windows.h>
+#include <qos2.h>
+
 void getSafeAreaInsets(void * component, float & top, float & bottom, float & left, float & right)
 {
     top = bottom = left = right = 0;
 }
 
+bool setCurrentThreadRealtime(bool realtime)
+{
+    // avrt is loaded lazily, so we don't need to link against it
+    typedef HANDLE (WINAPI *AvSetMmThreadCharacteristicsFunc) (LPCWSTR, LPDWORD);
+    typedef BOOL (WINAPI *AvRevertMmThreadCharacteristicsFunc) (HANDLE);
+
+    static HMODULE avrt = LoadLibraryA("avrt.dll");
+    static auto avSetMm = avrt ? (AvSetMmThreadCharacteristicsFunc) GetProcAddress(avrt, "AvSetMmThreadCharacteristicsW") : nullptr;
+    static auto avRevertMm = avrt ? (AvRevertMmThreadCharacteristicsFunc) GetProcAddress(avrt, "AvRevertMmThreadCharacteristics") : nullptr;
+
+    static thread_local HANDLE mmcssHandle = 0;
+
+    if (!realtime) {
+        if (mmcssHandle && avRevertMm) {
+            avRevertMm(mmcssHandle);
+        }
+        mmcssHandle = 0;
+        return SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_NORMAL) != 0;
+    }
+
+    if (!mmcssHandle && avSetMm) {
+        DWORD taskIndex = 0;
+        mmcssHandle = avSetMm(L"Pro Audio", &taskIndex);
+    }
+
+    if (mmcssHandle) {
+        return true;
+    }
+
+    // no MMCSS, the best we can do
+    return SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != 0;
+}
+
+namespace {
+
+// THREAD_POWER_THROTTLING_STATE and ThreadPowerThrottling, which older SDKs don't have
+struct PowerThrottlingState
+{
+    ULONG Version;
+    ULONG ControlMask;
+    ULONG StateMask;
+};
+
+typedef BOOL (WINAPI *SetThreadInformationFunc) (HANDLE, int, LPVOID, DWORD);
+
+bool setCurrentThreadPowerThrottling(bool throttled)
+{
+    // windows 8 and up, the execution speed part (EcoQoS) since windows 11
+    static auto setThreadInfo = (SetThreadInformationFunc) GetProcAddress(GetModuleHandleA("kernel32.dll"), "SetThreadInformation");
+    if (!setThreadInfo) return false;
+
+    PowerThrottlingState state;
+    state.Version = 1; // THREAD_POWER_THROTTLING_CURRENT_VERSION
+    // leaving the execution speed out of the control mask hands it back to the system
+    state.ControlMask = throttled ? 0 : 0x1; // THREAD_POWER_THROTTLING_EXECUTION_SPEED
+    state.StateMask = 0;
+    return setThreadInfo(GetCurrentThread(), 4 /* ThreadPowerThrottling */, &state, sizeof(state)) != 0;
+}
+
+thread_local bool unthrottled = false;
+
+}
+
+void setAudioWorkgroupDevice(const char * deviceName)
+{
+    // there is no workgroup to find, the threads only opt out of power throttling
+}
+
+bool joinAudioWorkgroup()
+{
+    if (!unthrottled) {
+        unthrottled = setCurrentThreadPowerThrottling(false);
+    }
+    return unthrottled;
+}
+
+void leaveAudioWorkgroup()
+{
+    if (unthrottled) {
+        setCurrentThreadPowerThrottling(true);
+        unthrottled = false;
+    }
+}
+
+int getThermalState()
+{
+    // nothing an app without admin rights can ask for
+    return ThermalUnknown;
+}
+
+namespace {
+
+typedef BOOL (WINAPI *QOSCreateHandleFunc) (PQOS_VERSION, PHANDLE);
+typedef BOOL (WINAPI *QOSCloseHandleFunc) (HANDLE);
+typedef BOOL (WINAPI *QOSAddSocketToFlowFunc) (HANDLE, SOCKET, PSOCKADDR, QOS_TRAFFIC_TYPE, DWORD, PQOS_FLOWID);
+typedef BOOL (WINAPI *QOSSetFlowFunc) (HANDLE, QOS_FLOWID, QOS_SET_FLOW, ULONG, PVOID, DWORD, LPOVERLAPPED);
+
+struct QosApi
+{
+    QosApi()
+    {
+        if (auto qwave = LoadLibraryA("qwave.dll")) {
+            createHandle = (QOSCreateHandleFunc) GetProcAddress(qwave, "QOSCreateHandle");
+            closeHandle = (QOSCloseHandleFunc) GetProcAddress(qwave, "QOSCloseHandle");
+            addSocketToFlow = (QOSAddSocketToFlowFunc) GetProcAddress(qwave, "QOSAddSocketToFlow");
+            setFlow = (QOSSetFlowFunc) GetProcAddress(qwave, "QOSSetFlow");
+        }
+    }
+
+    bool isValid() const { return createHandle && closeHandle && addSocketToFlow; }
+
+    QOSCreateHandleFunc createHandle = nullptr;
+    QOSCloseHandleFunc closeHandle = nullptr;
+    QOSAddSocketToFlowFunc addSocketToFlow = nullptr;
+    QOSSetFlowFunc setFlow = nullptr;
+};
+
+const QosApi & getQosApi()
+{
+    static QosApi api;
+    return api;
+}
+
+}
+
+bool SocketQosFlows::open(uintptr_t socket_, int dscp_)
+{
+    close();
+
+    auto & api = getQosApi();
+    if (!api.isValid() || dscp_ <= 0) return false;
+
+    QOS_VERSION version;
+    version.MajorVersion = 1;
+    version.MinorVersion = 0;
+
+    HANDLE h = 0;
+    if (!api.createHandle(&version, &h)) {
+        DebugLogC("QOSCreateHandle failed: %d", (int) GetLastError());
+        return false;
+    }
+
+    handle = h;
+    socket = socket_;
+    dscp = dscp_;
+    return true;
+}
+
+void SocketQosFlows::close()
+{
+    // closing the handle removes all its flows
+    if (handle) {
+        getQosApi().closeHandle((HANDLE) handle);
+        handle = nullptr;
+    }
+}
+
+uint32_t SocketQosFlows::addDestination(const void * sockaddr)
+{
+    auto & api = getQosApi();
+    if (!handle || !sockaddr) return 0;
+
+    QOS_FLOWID flowid = 0;
+    // the voice traffic type maps to EF by default
+    if (!api.addSocketToFlow((HANDLE) handle, (SOCKET) socket, (PSOCKADDR) sockaddr,
+                             QOSTrafficTypeVoice, QOS_NON_ADAPTIVE_FLOW, &flowid)) {
+        DebugLogC("QOSAddSocketToFlow failed: %d", (int) GetLastError());
+        return 0;
+    }
+
+    if (api.setFlow) {
+        // an explicit code point needs admin rights, the traffic type default is fine otherwise
+        DWORD value = (DWORD) dscp;
+        api.setFlow((HANDLE) handle, flowid, QOSSetOutgoingDSCPValue, sizeof(value), &value, 0, nullptr);
+    }
+
+    return (uint32_t) flowid;
+}
+
 #endif
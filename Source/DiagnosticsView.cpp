@@ -0,0 +1,338 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+
+
+#include "DiagnosticsView.h"
+
+using namespace SonoAudio;
+
+static var stageStatsToVar(const ProcessTimingTracker::StageStats & st)
+{
+    DynamicObject::Ptr obj = new DynamicObject();
+    obj->setProperty("minMs", st.minMs);
+    obj->setProperty("avgMs", st.avgMs);
+    obj->setProperty("p99Ms", st.p99Ms);
+    obj->setProperty("maxMs", st.maxMs);
+    return var(obj.get());
+}
+
+DiagnosticsView::DiagnosticsView(SonobusAudioProcessor& proc) : processor(proc)
+{
+    mTitleLabel = std::make_unique<Label>("title", TRANS("Diagnostics"));
+    mTitleLabel->setJustificationType(Justification::centred);
+    mTitleLabel->setFont(Font(16, Font::bold));
+    mTitleLabel->setColour(Label::textColourId, Colour(0xeeffffff));
+
+    mCloseButton = std::make_unique<SonoDrawableButton>("x", DrawableButton::ButtonStyle::ImageFitted);
+    std::unique_ptr<Drawable> ximg(Drawable::createFromImageData(BinaryData::x_icon_svg, BinaryData::x_icon_svgSize));
+    mCloseButton->setImages(ximg.get());
+    mCloseButton->setColour(DrawableButton::backgroundColourId, Colours::transparentBlack);
+    mCloseButton->onClick = [this]() {
+        if (CallOutBox* const cb = findParentComponentOfClass<CallOutBox>()) {
+            cb->dismiss();
+        } else {
+            setVisible(false);
+        }
+    };
+
+    mExportButton = std::make_unique<TextButton>("export");
+    mExportButton->setButtonText(TRANS("Export..."));
+    mExportButton->onClick = [this]() { exportReport(); };
+
+    mReportText = std::make_unique<TextEditor>("report");
+    mReportText->setMultiLine(true);
+    mReportText->setReadOnly(true);
+    mReportText->setCaretVisible(false);
+    mReportText->setScrollbarsShown(true);
+    mReportText->setFont(Font(Font::getDefaultMonospacedFontName(), 12.0f, Font::plain));
+    mReportText->setColour(TextEditor::backgroundColourId, Colour(0xff050505));
+
+    addAndMakeVisible(mTitleLabel.get());
+    addAndMakeVisible(mCloseButton.get());
+    addAndMakeVisible(mExportButton.get());
+    addAndMakeVisible(mReportText.get());
+
+    int menubuttw = 36;
+    int minitemheight = 36;
+    int titleheight = 32;
+    int minButtonWidth = 90;
+#if JUCE_IOS || JUCE_ANDROID
+    // make the button heights a bit more for touchscreen purposes
+    minitemheight = 44;
+    menubuttw = 40;
+    titleheight = 40;
+#endif
+
+    titleBox.items.clear();
+    titleBox.flexDirection = FlexBox::Direction::row;
+    titleBox.items.add(FlexItem(4, 4).withMargin(0).withFlex(0));
+    titleBox.items.add(FlexItem(menubuttw, 4, *mCloseButton).withMargin(0).withFlex(0));
+    titleBox.items.add(FlexItem(minButtonWidth, 4, *mTitleLabel).withMargin(0).withFlex(1));
+    titleBox.items.add(FlexItem(menubuttw, 4).withMargin(0).withFlex(0));
+    titleBox.items.add(FlexItem(4, 4).withMargin(0).withFlex(0));
+
+    buttonBox.items.clear();
+    buttonBox.flexDirection = FlexBox::Direction::row;
+    buttonBox.items.add(FlexItem(4, 4).withMargin(0).withFlex(1));
+    buttonBox.items.add(FlexItem(minButtonWidth, 4, *mExportButton).withMargin(0).withFlex(1));
+    buttonBox.items.add(FlexItem(4, 4).withMargin(0).withFlex(1));
+
+    mainBox.items.clear();
+    mainBox.flexDirection = FlexBox::Direction::column;
+    mainBox.items.add(FlexItem(minButtonWidth, titleheight, titleBox).withMargin(0).withFlex(0));
+    mainBox.items.add(FlexItem(minButtonWidth, 100, *mReportText).withMargin(2).withFlex(1));
+    mainBox.items.add(FlexItem(4, 4).withMargin(0).withFlex(0));
+    mainBox.items.add(FlexItem(minButtonWidth, minitemheight, buttonBox).withMargin(0).withFlex(0));
+}
+
+DiagnosticsView::~DiagnosticsView()
+{
+    stopTimer();
+}
+
+void DiagnosticsView::paint (Graphics& g)
+{
+}
+
+void DiagnosticsView::resized()
+{
+    mainBox.performLayout(getLocalBounds().reduced(2));
+}
+
+void DiagnosticsView::visibilityChanged()
+{
+    updateSampling();
+}
+
+void DiagnosticsView::parentHierarchyChanged()
+{
+    // the callout it was in went away
+    updateSampling();
+}
+
+void DiagnosticsView::updateSampling()
+{
+    if (isShowing()) {
+        if (!isTimerRunning()) {
+            updateReport();
+            startTimer(1000);
+        }
+    } else {
+        stopTimer();
+    }
+}
+
+void DiagnosticsView::timerCallback()
+{
+    updateReport();
+}
+
+void DiagnosticsView::updateReport()
+{
+    mLastReport = sampleReport();
+
+    // keep the scroll position while it updates
+    Viewport * viewport = nullptr;
+    for (auto * child : mReportText->getChildren()) {
+        if ((viewport = dynamic_cast<Viewport*>(child)) != nullptr) break;
+    }
+    const auto scrollpos = viewport ? viewport->getViewPosition() : Point<int>();
+    mReportText->setText(formatReport(mLastReport), dontSendNotification);
+    if (viewport) {
+        viewport->setViewPosition(scrollpos);
+    }
+}
+
+var DiagnosticsView::sampleReport()
+{
+    const double nowms = Time::getMillisecondCounterHiRes();
+    const double intervalsec = mLastSampleMs > 0.0 ? (nowms - mLastSampleMs) * 1e-3 : 0.0;
+    auto rate = [intervalsec] (double now, double last) { return intervalsec > 0.0 ? jmax(0.0, now - last) / intervalsec : 0.0; };
+
+    DynamicObject::Ptr report = new DynamicObject();
+    report->setProperty("version", ProjectInfo::versionString);
+    report->setProperty("time", Time::getCurrentTime().toISO8601(true));
+    report->setProperty("sampleRate", processor.getSampleRate());
+    report->setProperty("blockSize", processor.getCurrSamplesPerBlock());
+    report->setProperty("intervalSec", intervalsec);
+
+    // processBlock
+    ProcessTimingTracker::Stats timing;
+    processor.getProcessTimingStats(timing);
+
+    DynamicObject::Ptr process = new DynamicObject();
+    process->setProperty("blocks", timing.numBlocks);
+    process->setProperty("overruns", (int64) timing.overruns);
+    process->setProperty("loadShedLevel", LoadGovernor::getLevelName(processor.getLoadSheddingLevel()));
+    static const char * thermalNames[] = { "unknown", "nominal", "fair", "serious", "critical" };
+    process->setProperty("thermalState", thermalNames[jlimit(0, 4, processor.getThermalState() + 1)]);
+    process->setProperty("total", stageStatsToVar(timing.total));
+    DynamicObject::Ptr stages = new DynamicObject();
+    for (int i=0; i < ProcessTimingTracker::NumStages; ++i) {
+        stages->setProperty(ProcessTimingTracker::getStageName(i), stageStatsToVar(timing.stages[i]));
+    }
+    process->setProperty("stages", var(stages.get()));
+    report->setProperty("process", var(process.get()));
+
+    // network threads
+    const auto wakeups = processor.getNetworkThreadWakeups();
+
+    DynamicObject::Ptr network = new DynamicObject();
+    network->setProperty("socketReceiveDrops", processor.getSocketReceiveDrops());
+    network->setProperty("sendWakeupsPerSec", rate(wakeups.send, mLastWakeups.send));
+    network->setProperty("recvWakeupsPerSec", rate(wakeups.recv, mLastWakeups.recv));
+    network->setProperty("eventWakeupsPerSec", rate(wakeups.event, mLastWakeups.event));
+    report->setProperty("network", var(network.get()));
+
+    // jitter buffer blocks, for all the instances
+    const auto jbmem = SonobusAudioProcessor::getJitterBufferMemory();
+
+    DynamicObject::Ptr memory = new DynamicObject();
+    memory->setProperty("jitterBufferUsedBytes", jbmem.used);
+    memory->setProperty("jitterBufferHeldBytes", jbmem.held);
+    memory->setProperty("jitterBufferPeakUsedBytes", jbmem.peakUsed);
+    memory->setProperty("jitterBufferPeakHeldBytes", jbmem.peakHeld);
+    report->setProperty("memory", var(memory.get()));
+
+    // peers
+    std::vector<SonobusAudioProcessor::PeerDiagnostics> peers ((size_t) processor.getNumberRemotePeers());
+    Array<var> peerlist;
+
+    for (int i=0; i < (int) peers.size(); ++i) {
+        auto & diag = peers[(size_t) i];
+        if (!processor.getRemotePeerDiagnostics(i, diag)) continue;
+
+        // only rates against the same peer, the list may have changed in between
+        SonobusAudioProcessor::PeerDiagnostics last;
+        if (i < (int) mLastPeers.size() && mLastPeers[(size_t) i].userName == diag.userName) {
+            last = mLastPeers[(size_t) i];
+        } else {
+            last = diag;
+        }
+
+        DynamicObject::Ptr peer = new DynamicObject();
+        peer->setProperty("name", diag.userName);
+        peer->setProperty("sendFormat", diag.sendFormat);
+        peer->setProperty("recvFormat", diag.recvFormat);
+        peer->setProperty("packetsSentPerSec", rate(diag.packetsSent, last.packetsSent));
+        peer->setProperty("packetsRecvPerSec", rate(diag.packetsReceived, last.packetsReceived));
+        peer->setProperty("kbitsSentPerSec", rate(diag.bytesSent, last.bytesSent) * 8e-3);
+        peer->setProperty("kbitsRecvPerSec", rate(diag.bytesReceived, last.bytesReceived) * 8e-3);
+        peer->setProperty("packetsSent", (int64) diag.packetsSent);
+        peer->setProperty("packetsReceived", (int64) diag.packetsReceived);
+        peer->setProperty("lost", (int64) diag.packetsDropped);
+        peer->setProperty("reordered", (int64) diag.packetsReordered);
+        peer->setProperty("resent", (int64) diag.packetsResent);
+        peer->setProperty("gaps", (int64) diag.blockGaps);
+        peer->setProperty("pingMs", diag.pingMs);
+        peer->setProperty("arrivalJitterMs", diag.arrivalJitterMs);
+        peer->setProperty("jitterDelayMs", diag.jitterDelayMs);
+        peer->setProperty("bufferMs", diag.bufferTimeMs);
+        peer->setProperty("bufferFillRatio", diag.fillRatio);
+        peer->setProperty("bufferFillStdDev", diag.fillRatioStdDev);
+        peer->setProperty("bufferFillLowMs", diag.bufferFillQuantileMs);
+        // ms of codec time per second
+        peer->setProperty("encodeMsPerSec", rate(diag.encodeMs, last.encodeMs));
+        peer->setProperty("decodeMsPerSec", rate(diag.decodeMs, last.decodeMs));
+        peerlist.add(var(peer.get()));
+    }
+    report->setProperty("peers", peerlist);
+
+    mLastSampleMs = nowms;
+    mLastPeers = std::move(peers);
+    mLastWakeups = wakeups;
+
+    return var(report.get());
+}
+
+String DiagnosticsView::formatReport(const var & report)
+{
+    String text;
+    auto num = [] (const var & v, int decimals = 1) { return String((double) v, decimals); };
+
+    text << "SonoBus " << report["version"].toString() << "   " << num(report["sampleRate"], 0) << " Hz, "
+         << report["blockSize"].toString() << " samples" << newLine << newLine;
+
+    const auto & process = report["process"];
+    text << "processBlock over the last " << process["blocks"].toString() << " blocks, "
+         << process["overruns"].toString() << " overruns, load shedding: " << process["loadShedLevel"].toString()
+         << ", thermal state: " << process["thermalState"].toString() << newLine;
+    text << String("stage").paddedRight(' ', 16) << String("min").paddedLeft(' ', 8) << String("avg").paddedLeft(' ', 8)
+         << String("p99").paddedLeft(' ', 8) << String("max").paddedLeft(' ', 8) << "  ms" << newLine;
+
+    auto stageline = [&] (const String & name, const var & st) {
+        text << name.paddedRight(' ', 16) << num(st["minMs"], 3).paddedLeft(' ', 8) << num(st["avgMs"], 3).paddedLeft(' ', 8)
+             << num(st["p99Ms"], 3).paddedLeft(' ', 8) << num(st["maxMs"], 3).paddedLeft(' ', 8) << newLine;
+    };
+    if (auto * stages = process["stages"].getDynamicObject()) {
+        for (auto & prop : stages->getProperties()) {
+            stageline(prop.name.toString(), prop.value);
+        }
+    }
+    stageline("Total", process["total"]);
+    text << newLine;
+
+    const auto & network = report["network"];
+    const int64 drops = network["socketReceiveDrops"];
+    text << "Network thread wakeups/s: send " << num(network["sendWakeupsPerSec"]) << ", recv " << num(network["recvWakeupsPerSec"])
+         << ", event " << num(network["eventWakeupsPerSec"]) << newLine;
+    text << "Socket receive drops: " << (drops < 0 ? String("n/a") : String(drops)) << newLine;
+
+    const auto & memory = report["memory"];
+    auto kb = [] (const var & v) { return String((double) (int64) v / 1024.0, 1); };
+    text << "Jitter buffer memory: " << kb(memory["jitterBufferUsedBytes"]) << " kB used (peak " << kb(memory["jitterBufferPeakUsedBytes"])
+         << "), " << kb(memory["jitterBufferHeldBytes"]) << " kB held (peak " << kb(memory["jitterBufferPeakHeldBytes"]) << ")" << newLine;
+
+    if (auto * peers = report["peers"].getArray()) {
+        for (auto & peer : *peers) {
+            text << newLine << peer["name"].toString() << newLine;
+            text << "  send " << peer["sendFormat"].toString() << ", recv " << peer["recvFormat"].toString() << newLine;
+            text << "  packets/s  out " << num(peer["packetsSentPerSec"]) << "  in " << num(peer["packetsRecvPerSec"])
+                 << "   kbit/s  out " << num(peer["kbitsSentPerSec"]) << "  in " << num(peer["kbitsRecvPerSec"]) << newLine;
+            text << "  lost " << peer["lost"].toString() << "  reordered " << peer["reordered"].toString()
+                 << "  resent " << peer["resent"].toString() << "  gaps " << peer["gaps"].toString() << newLine;
+            text << "  ping " << num(peer["pingMs"]) << " ms  arrival jitter " << num(peer["arrivalJitterMs"])
+                 << " ms  jitter delay " << num(peer["jitterDelayMs"]) << " ms" << newLine;
+            text << "  buffer " << num(peer["bufferMs"]) << " ms  fill " << num(peer["bufferFillRatio"], 2)
+                 << " +/- " << num(peer["bufferFillStdDev"], 3) << "  low fill " << num(peer["bufferFillLowMs"]) << " ms" << newLine;
+            text << "  codec ms/s  encode " << num(peer["encodeMsPerSec"], 2) << "  decode " << num(peer["decodeMsPerSec"], 2) << newLine;
+        }
+    }
+
+    return text;
+}
+
+void DiagnosticsView::exportReport()
+{
+    const auto json = JSON::toString(mLastReport, false, 6);
+    const auto defname = "SonoBus Diagnostics " + Time::getCurrentTime().formatted("%Y-%m-%d %H%M%S") + ".json";
+    const auto defdir = File::getSpecialLocation(File::userDocumentsDirectory);
+
+    mFileChooser.reset(new FileChooser(TRANS("Choose where to save the diagnostics"),
+                                       defdir.getChildFile(defname),
+                                       "*.json",
+                                       true, false, getTopLevelComponent()));
+
+    SafePointer<DiagnosticsView> safeThis (this);
+
+    mFileChooser->launchAsync (FileBrowserComponent::saveMode | FileBrowserComponent::warnAboutOverwriting,
+                               [safeThis, json] (const FileChooser& chooser) mutable
+                               {
+        auto results = chooser.getURLResults();
+        if (safeThis != nullptr && results.size() > 0)
+        {
+            auto url = results.getReference (0);
+            if (url.isLocalFile()) {
+                File lfile = url.getLocalFile();
+                if (!lfile.replaceWithText(json)) {
+                    DBG("Error writing diagnostics to " << lfile.getFullPathName());
+                }
+            }
+        }
+
+        if (safeThis) {
+            safeThis->mFileChooser.reset();
+        }
+    }, nullptr);
+}
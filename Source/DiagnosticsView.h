@@ -0,0 +1,64 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#include "SonobusPluginProcessor.h"
+#include "SonoDrawableButton.h"
+
+#include <vector>
+
+// Live network and DSP counters, for looking into problems and for users to
+// send along with a report: per peer packet rates and loss, jitter and buffer
+// fill, codec time, the processBlock stage timings, network thread wakeups and
+// kernel socket drops. It can all be exported as a JSON file.
+class DiagnosticsView : public Component, public Timer
+{
+public:
+    DiagnosticsView(SonobusAudioProcessor& proc);
+    ~DiagnosticsView();
+
+    void paint (Graphics&) override;
+    void resized() override;
+    void visibilityChanged() override;
+    void parentHierarchyChanged() override;
+
+    void timerCallback() override;
+
+    // takes a new sample of the counters and shows it
+    void updateReport();
+
+protected:
+    // everything shown, the rates are since the previous call
+    var sampleReport();
+    static String formatReport(const var & report);
+
+    void exportReport();
+
+    // only samples while it's on screen
+    void updateSampling();
+
+    SonobusAudioProcessor& processor;
+
+    std::unique_ptr<Label> mTitleLabel;
+    std::unique_ptr<SonoDrawableButton> mCloseButton;
+    std::unique_ptr<TextButton> mExportButton;
+    std::unique_ptr<TextEditor> mReportText;
+    std::unique_ptr<FileChooser> mFileChooser;
+
+    FlexBox mainBox;
+    FlexBox titleBox;
+    FlexBox buttonBox;
+
+    // of the previous sample, for the rates
+    double mLastSampleMs = 0.0;
+    std::vector<SonobusAudioProcessor::PeerDiagnostics> mLastPeers;
+    SonobusAudioProcessor::NetworkThreadWakeups mLastWakeups;
+
+    var mLastReport;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (DiagnosticsView)
+};
@@ -0,0 +1,349 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#include "DoubleEnderTransfer.h"
+
+#define DUB_HEADER_TAG "SBDUB1 "
+#define DUB_CHUNK_SIZE 65536
+#define DUB_CONNECT_TIMEOUT_MS 5000
+// for all of the header
+#define DUB_HEADER_TIMEOUT_MS 5000
+// for every chunk, and for the answer at the end
+#define DUB_IO_TIMEOUT_MS 30000
+// how often the collector checks if it should stop while waiting for data
+#define DUB_POLL_MS 250
+
+namespace SonoAudio {
+
+using SocketTransfer::readLine;
+using SocketTransfer::writeString;
+
+bool DoubleEnderTransfer::writeAligned(const File & src, const File & dest, double offsetSeconds, String & errmsg)
+{
+    AudioFormatManager formats;
+    formats.registerBasicFormats();
+
+    std::unique_ptr<AudioFormatReader> reader (formats.createReaderFor(src));
+    if (!reader) {
+        errmsg = TRANS("Could not read ") + src.getFullPathName();
+        return false;
+    }
+
+    auto * format = formats.findFormatForFileExtension(dest.getFileExtension());
+    if (!format) {
+        errmsg = TRANS("Could not find format for filename");
+        return false;
+    }
+
+    dest.deleteFile();
+    std::unique_ptr<FileOutputStream> stream (dest.createOutputStream());
+    if (!stream) {
+        errmsg = TRANS("Error creating output file: ") + dest.getFullPathName();
+        return false;
+    }
+
+    const int numchans = (int) reader->numChannels;
+    std::unique_ptr<AudioFormatWriter> writer (format->createWriterFor(stream.get(), reader->sampleRate, (unsigned int) numchans, (int) reader->bitsPerSample, {}, 0));
+    if (!writer) {
+        // not every format takes every depth
+        writer.reset(format->createWriterFor(stream.get(), reader->sampleRate, (unsigned int) numchans, 24, {}, 0));
+    }
+    if (!writer) {
+        errmsg = TRANS("Error creating writer for ") + dest.getFullPathName();
+        return false;
+    }
+    stream.release(); // the writer has it now
+
+    const int64 offset = (int64) std::llround(offsetSeconds * reader->sampleRate);
+    AudioBuffer<float> buf (numchans, DUB_CHUNK_SIZE / 4);
+    buf.clear();
+
+    for (int64 pad = offset; pad > 0; ) {
+        const int num = (int) jmin((int64) buf.getNumSamples(), pad);
+        writer->writeFromAudioSampleBuffer(buf, 0, num);
+        pad -= num;
+    }
+
+    for (int64 pos = jmax((int64) 0, -offset); pos < reader->lengthInSamples; ) {
+        const int num = (int) jmin((int64) buf.getNumSamples(), reader->lengthInSamples - pos);
+        reader->read(&buf, 0, num, pos, true, true);
+        writer->writeFromAudioSampleBuffer(buf, 0, num);
+        pos += num;
+    }
+
+    return true;
+}
+
+DoubleEnderUploader::DoubleEnderUploader()
+: Thread("DoubleEnderUpload")
+{
+}
+
+DoubleEnderUploader::~DoubleEnderUploader()
+{
+    signalThreadShouldExit();
+    notify();
+    {
+        const ScopedLock sl (socketLock);
+        if (currentSocket) {
+            currentSocket->close();
+        }
+    }
+    stopThread(DUB_CONNECT_TIMEOUT_MS);
+}
+
+void DoubleEnderUploader::addUpload(const Job & job)
+{
+    {
+        const ScopedLock sl (jobsLock);
+        jobs.push_back(job);
+        ++numPending;
+    }
+
+    if (!isThreadRunning()) {
+        // below the audio and network threads, it's in no hurry
+        startThread(2);
+    }
+    notify();
+}
+
+int DoubleEnderUploader::getNumPending() const
+{
+    return numPending.load();
+}
+
+void DoubleEnderUploader::run()
+{
+    while (!threadShouldExit()) {
+        Job job;
+        {
+            const ScopedLock sl (jobsLock);
+            if (jobs.empty()) {
+                job.port = 0;
+            } else {
+                job = jobs.front();
+                jobs.pop_front();
+            }
+        }
+
+        if (job.port <= 0) {
+            wait(-1);
+            continue;
+        }
+
+        if (upload(job)) {
+            DBG("Uploaded " << job.file.getFullPathName() << " to " << job.host << ":" << job.port);
+            --numPending;
+            continue;
+        }
+
+        if (threadShouldExit()) break;
+
+        if (++job.attempts >= MaxAttempts || !job.file.existsAsFile()) {
+            DBG("Giving up on uploading " << job.file.getFullPathName() << ", it stays here");
+            --numPending;
+            continue;
+        }
+
+        DBG("Upload of " << job.file.getFullPathName() << " failed, trying again later");
+        {
+            const ScopedLock sl (jobsLock);
+            jobs.push_back(job);
+        }
+        wait(RetryDelayMs);
+    }
+}
+
+bool DoubleEnderUploader::upload(const Job & job)
+{
+    FileInputStream in (job.file);
+    if (!in.openedOk()) return false;
+    const int64 size = in.getTotalLength();
+
+    StreamingSocket socket;
+    {
+        const ScopedLock sl (socketLock);
+        if (threadShouldExit()) return false;
+        currentSocket = &socket;
+    }
+
+    struct Forget {
+        ~Forget() {
+            const ScopedLock sl (owner.socketLock);
+            owner.currentSocket = nullptr;
+        }
+        DoubleEnderUploader & owner;
+    } forget { *this };
+
+    if (!socket.connect(job.host, job.port, DUB_CONNECT_TIMEOUT_MS)) return false;
+
+    DynamicObject::Ptr header = new DynamicObject();
+    header->setProperty("user", job.userName);
+    header->setProperty("name", job.file.getFileName());
+    header->setProperty("size", String(size));
+    // as hex, JSON numbers don't go up to 64 bits
+    header->setProperty("start", String::toHexString((int64) job.startTime));
+
+    if (!writeString(socket, DUB_HEADER_TAG + JSON::toString(var(header.get()), true) + "\n")) return false;
+
+    HeapBlock<char> buf (DUB_CHUNK_SIZE);
+    int64 sent = 0;
+
+    while (sent < size) {
+        if (threadShouldExit()) return false;
+
+        const int num = in.read(buf, (int) jmin((int64) DUB_CHUNK_SIZE, size - sent));
+        if (num <= 0 || socket.write(buf, num) != num) return false;
+        sent += num;
+
+        const double due = pacer.sent(num);
+        const double now = Time::getMillisecondCounterHiRes();
+        if (due > now) {
+            wait((int) (due - now));
+        }
+    }
+
+    String reply;
+    return readLine(socket, reply, 64, DUB_IO_TIMEOUT_MS) && reply == "OK";
+}
+
+DoubleEnderCollector::DoubleEnderCollector()
+: Thread("DoubleEnderCollect"),
+  connections(MaxConnections, [this] (StreamingSocket & connection, TransferPool::Job & job) { receive(connection, job); })
+{
+}
+
+DoubleEnderCollector::~DoubleEnderCollector()
+{
+    stop();
+}
+
+bool DoubleEnderCollector::start(const File & dir)
+{
+    stop();
+
+    if (!dir.createDirectory()) {
+        DBG("Error creating double-ender upload directory " << dir.getFullPathName());
+        return false;
+    }
+
+    if (!listener.createListener(DoubleEnderTransfer::DefaultPort) && !listener.createListener(0)) {
+        DBG("Error listening for double-ender uploads");
+        return false;
+    }
+
+    destDir = dir;
+    port = listener.getBoundPort();
+    startThread(2);
+
+    DBG("Taking double-ender uploads on port " << port << " into " << dir.getFullPathName());
+    return true;
+}
+
+void DoubleEnderCollector::stop()
+{
+    if (isThreadRunning()) {
+        signalThreadShouldExit();
+        stopThread(DUB_POLL_MS * 4);
+    }
+    connections.stopAll(DUB_HEADER_TIMEOUT_MS + DUB_POLL_MS * 4);
+    listener.close();
+    port = 0;
+}
+
+void DoubleEnderCollector::run()
+{
+    while (!threadShouldExit()) {
+        const int ready = listener.waitUntilReady(true, DUB_POLL_MS);
+        if (ready < 0) {
+            wait(DUB_POLL_MS);
+            continue;
+        }
+        if (ready == 0) continue;
+
+        std::unique_ptr<StreamingSocket> connection (listener.waitForNextConnection());
+        if (connection) {
+            connections.add(std::move(connection));
+        }
+    }
+}
+
+void DoubleEnderCollector::receive(StreamingSocket & connection, TransferPool::Job & job)
+{
+    const String host = connection.getHostName();
+    if (isAllowed && !isAllowed(host)) {
+        DBG("Refused double-ender upload from " << host);
+        return;
+    }
+
+    String line;
+    if (!readLine(connection, line, 4096, DUB_HEADER_TIMEOUT_MS) || !line.startsWith(DUB_HEADER_TAG)) return;
+
+    const var header = JSON::parse(line.substring((int) strlen(DUB_HEADER_TAG)));
+    const String user = header.getProperty("user", "").toString();
+    const String name = header.getProperty("name", "").toString();
+    const int64 size = header.getProperty("size", "").toString().getLargeIntValue();
+    const uint64 starttime = (uint64) header.getProperty("start", "").toString().getHexValue64();
+
+    if (name.isEmpty() || size <= 0 || size > MaxUploadBytes) {
+        writeString(connection, "ERR\n");
+        return;
+    }
+
+    const File wanted = destDir.getChildFile(File::createLegalFileName(user + "-" + name));
+    const auto partialOf = [] (const File & file) { return file.getSiblingFile(file.getFileName() + ".part"); };
+    File dest = wanted;
+    std::unique_ptr<FileOutputStream> out;
+    {
+        // the name is taken once its partial is there, so two uploads of the same
+        // name going at once don't end up in the same file
+        const ScopedLock sl (destLock);
+        for (int num = 2; dest.exists() || partialOf(dest).exists(); ++num) {
+            dest = wanted.getSiblingFile(wanted.getFileNameWithoutExtension() + " (" + String(num) + ")" + wanted.getFileExtension());
+        }
+        out = partialOf(dest).createOutputStream();
+    }
+    const File partial = partialOf(dest);
+
+    if (!out) {
+        writeString(connection, "ERR\n");
+        return;
+    }
+
+    HeapBlock<char> buf (DUB_CHUNK_SIZE);
+    for (int64 remaining = size; remaining > 0; ) {
+        int ready = 0;
+        for (int waited = 0; waited < DUB_IO_TIMEOUT_MS && !job.shouldExit(); waited += DUB_POLL_MS) {
+            if ((ready = connection.waitUntilReady(true, DUB_POLL_MS)) != 0) break;
+        }
+        if (ready <= 0) {
+            out.reset();
+            partial.deleteFile();
+            return;
+        }
+        const int num = connection.read(buf, (int) jmin((int64) DUB_CHUNK_SIZE, remaining), false);
+        if (num <= 0 || !out->write(buf, (size_t) num)) {
+            out.reset();
+            partial.deleteFile();
+            return;
+        }
+        remaining -= num;
+    }
+    out->flush();
+    // closed before it moves
+    out.reset();
+
+    if (!partial.moveFileTo(dest)) {
+        writeString(connection, "ERR\n");
+        return;
+    }
+    writeString(connection, "OK\n");
+
+    DBG("Got double-ender upload " << dest.getFullPathName() << " from " << user << " at " << host);
+
+    if (onReceived) {
+        onReceived({ dest, user, host, starttime });
+    }
+}
+
+}
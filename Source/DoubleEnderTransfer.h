@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+#include "SocketTransfer.h"
+
+#include <atomic>
+#include <deque>
+#include <functional>
+
+namespace SonoAudio {
+
+// Moves the double-ender recordings (everybody's own input, recorded losslessly
+// on their side while streaming) to the session host once they're done. Over a
+// TCP connection of their own, so the audio streams never have to make room
+// for them, and throttled so the upload doesn't get in the way of the next
+// session either. Every file goes with the time its first sample was recorded,
+// in the host's clock, which is all the host needs to line it up.
+//
+// What goes over the connection: one header line, "SBDUB1 " and a JSON object
+// with the user, the file name, its size and the start time, then the file
+// itself. The host answers "OK" once it has all of it.
+namespace DoubleEnderTransfer {
+    // the one the host tries first, so it can be forwarded, any other if that's taken
+    static constexpr int DefaultPort = 11476;
+
+    // src to dest (the same format) with offsetSeconds of silence in front, or that
+    // much cut off the start if negative
+    bool writeAligned(const File & src, const File & dest, double offsetSeconds, String & errmsg);
+}
+
+class DoubleEnderUploader : private Thread
+{
+public:
+    struct Job {
+        File file;
+        String host;
+        int port = 0;
+        String userName;
+        uint64 startTime = 0; // NTP, in the host's clock
+        int attempts = 0;
+    };
+
+    DoubleEnderUploader();
+    // gives up on what's left, the files stay where they are
+    ~DoubleEnderUploader() override;
+
+    void addUpload(const Job & job);
+
+    // bytes per second, 0 for as fast as it goes
+    void setRateLimit(int bytesPerSecond) { pacer.setRate(bytesPerSecond); }
+    int getRateLimit() const { return pacer.getRate(); }
+
+    // including the one going
+    int getNumPending() const;
+
+private:
+    static constexpr int MaxAttempts = 5;
+    static constexpr int RetryDelayMs = 10000;
+
+    void run() override;
+    bool upload(const Job & job);
+
+    CriticalSection jobsLock;
+    std::deque<Job> jobs;
+    std::atomic<int> numPending { 0 };
+    TransferPacer pacer;
+
+    // the connection of the upload going, closed from outside to stop it
+    CriticalSection socketLock;
+    StreamingSocket * currentSocket = nullptr;
+
+    JUCE_DECLARE_NON_COPYABLE (DoubleEnderUploader)
+};
+
+// Takes the uploads, each on a thread of its own, up to MaxConnections at once
+class DoubleEnderCollector : private Thread
+{
+public:
+    static constexpr int MaxConnections = 8;
+
+    struct Upload {
+        File file;
+        String userName;
+        String host;
+        uint64 startTime = 0; // NTP, in our clock
+    };
+
+    // called on the threads taking the uploads, set them before start()
+    std::function<bool(const String & host)> isAllowed;
+    std::function<void(const Upload & upload)> onReceived;
+
+    DoubleEnderCollector();
+    ~DoubleEnderCollector() override;
+
+    // the uploads go into destDir
+    bool start(const File & destDir);
+    void stop();
+
+    bool isRunning() const { return isThreadRunning(); }
+    int getPort() const { return port; }
+
+private:
+    // no more than that in one upload
+    static constexpr int64 MaxUploadBytes = (int64) 16 << 30;
+
+    void run() override;
+    void receive(StreamingSocket & connection, TransferPool::Job & job);
+
+    StreamingSocket listener;
+    File destDir;
+    int port = 0;
+
+    CriticalSection destLock;
+    TransferPool connections;
+
+    JUCE_DECLARE_NON_COPYABLE (DoubleEnderCollector)
+};
+
+}
@@ -0,0 +1,147 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include "aoo/aoo.h"
+
+#include <functional>
+#include <memory>
+
+namespace SonoAudio {
+
+// A whole file encoded once, block by block, in an AOO format, so playing it
+// to the peers doesn't need the file audio mixed into everyone's send and
+// encoded again for each of them. The blocks are handed to a source as they
+// are with process_encoded(), one whenever the play position reaches it.
+// Made off the audio thread, read only afterwards.
+class EncodedFileStream
+{
+public:
+    // any thread, the reader is read from start to end, null if it failed or shouldCancel said so
+    static std::unique_ptr<EncodedFileStream> encode(AudioFormatReader & reader, const aoo_format_storage & format, std::function<bool()> shouldCancel)
+    {
+        const aoo_codec * codec = aoo_find_codec(format.header.codec);
+        if (!codec || reader.lengthInSamples <= 0 || reader.sampleRate <= 0.0) return nullptr;
+
+        auto stream = std::unique_ptr<EncodedFileStream>(new EncodedFileStream());
+        stream->format = format;
+
+        void * encoder = codec->encoder_new();
+        if (!encoder) return nullptr;
+        if (codec->encoder_setformat(encoder, &stream->format.header) <= 0) {
+            codec->encoder_free(encoder);
+            return nullptr;
+        }
+
+        const int numchans = stream->format.header.nchannels;
+        const int blocksize = stream->format.header.blocksize;
+        const double ratio = reader.sampleRate / stream->format.header.samplerate;
+        const int64 numblocks = (int64) std::ceil(reader.lengthInSamples / ratio / blocksize);
+
+        // the source never takes a block larger than this, see aoo::source::update()
+        HeapBlock<char> encoded ((size_t) sizeof(double) * (size_t) (numchans * blocksize));
+        const int maxencoded = (int) sizeof(double) * numchans * blocksize;
+
+        const int needed = (int) std::ceil(blocksize * ratio) + 8;
+        AudioBuffer<float> input (numchans, needed * 2);
+        AudioBuffer<float> output (numchans, blocksize);
+        HeapBlock<aoo_sample> interleaved ((size_t) (numchans * blocksize));
+        std::vector<LagrangeInterpolator> interpolators ((size_t) numchans);
+        int inputavail = 0;
+        int64 readpos = 0;
+
+        MemoryOutputStream blocks;
+        stream->offsets.ensureStorageAllocated((int) numblocks + 1);
+        stream->offsets.add(0);
+
+        bool ok = true;
+        for (int64 block = 0; block < numblocks; ++block) {
+            if (shouldCancel && shouldCancel()) {
+                ok = false;
+                break;
+            }
+
+            // the tail gets padded with silence
+            const int toread = (int) jmin((int64) (needed - inputavail), reader.lengthInSamples - readpos);
+            if (toread > 0) {
+                reader.read(&input, inputavail, toread, readpos, true, numchans > 1);
+                readpos += toread;
+                inputavail += toread;
+            }
+            if (inputavail < needed) {
+                input.clear(inputavail, needed - inputavail);
+            }
+
+            int used = blocksize;
+            for (int ch=0; ch < numchans; ++ch) {
+                if (ratio == 1.0) {
+                    output.copyFrom(ch, 0, input, ch, 0, blocksize);
+                } else {
+                    used = interpolators[(size_t) ch].process(ratio, input.getReadPointer(ch), output.getWritePointer(ch), blocksize);
+                }
+            }
+
+            for (int ch=0; ch < numchans; ++ch) {
+                const float * src = output.getReadPointer(ch);
+                for (int i=0; i < blocksize; ++i) {
+                    interleaved[i * numchans + ch] = (aoo_sample) src[i];
+                }
+            }
+
+            const int size = codec->encoder_encode(encoder, interleaved, numchans * blocksize, encoded, maxencoded);
+            if (size <= 0) {
+                ok = false;
+                break;
+            }
+            blocks.write(encoded, (size_t) size);
+            stream->offsets.add((int64) blocks.getDataSize());
+
+            // keep what wasn't used up for the next block
+            used = jmin(used, inputavail);
+            for (int ch=0; ch < numchans; ++ch) {
+                auto * samples = input.getWritePointer(ch);
+                memmove(samples, samples + used, sizeof(float) * (size_t) (needed - used));
+            }
+            inputavail = jmax(0, inputavail - used);
+        }
+
+        codec->encoder_free(encoder);
+        if (!ok) return nullptr;
+
+        stream->data = blocks.getMemoryBlock();
+        return stream;
+    }
+
+    const aoo_format_storage & getFormat() const { return format; }
+    int getNumChannels() const { return format.header.nchannels; }
+
+    int64 getNumBlocks() const { return offsets.size() - 1; }
+
+    // the block playing at the given time into the file
+    int64 getBlockForTime(double seconds) const
+    {
+        return (int64) (seconds * format.header.samplerate / format.header.blocksize);
+    }
+
+    // audio thread safe
+    bool getBlock(int64 index, const char *& blockData, int32_t & size) const
+    {
+        if (index < 0 || index >= getNumBlocks()) return false;
+        const auto start = offsets.getUnchecked((int) index);
+        blockData = static_cast<const char *>(data.getData()) + start;
+        size = (int32_t) (offsets.getUnchecked((int) index + 1) - start);
+        return true;
+    }
+
+private:
+    EncodedFileStream() = default;
+
+    aoo_format_storage format;
+    MemoryBlock data;
+    Array<int64> offsets;
+};
+
+} // namespace SonoAudio
@@ -0,0 +1,280 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+namespace SonoAudio {
+
+// Stereo feedback delay network reverb, always full wet and in place.
+// The 16 delay lines are kept interleaved, so one row of the ring holds the
+// current sample of every line and a SIMD register covers Width (four with SSE
+// and NEON) of them. Everything except reading the delayed samples (a gather,
+// each line has its own length) works on whole registers: the damping, the
+// decay gains, the output taps and the feedback matrix. That matrix is a
+// Hadamard across the registers, the mixing across the lanes comes from reading
+// the lines back transposed, so after two round trips every line feeds every
+// other one. Both are orthogonal, the decay is set by the per line gains only.
+// The delay lengths are prime and tuned per sample rate at compile time for
+// 44.1, 48 and 96 kHz, other rates get the nearest table scaled at runtime.
+class FdnReverb
+{
+public:
+    static constexpr int NumLines = 16;
+
+    // allocates, call it from prepareToPlay
+    void setSampleRate(double sampleRate)
+    {
+        sampleRate = jlimit(8000.0, 384000.0, sampleRate);
+        sr = sampleRate;
+
+        if (sampleRate == 44100.0) table = Table44k;
+        else if (sampleRate == 48000.0) table = Table48k;
+        else if (sampleRate == 96000.0) table = Table96k;
+        else {
+            table = TableScaled;
+            // scale the table of the closest rate, rounding to odd lengths keeps them apart
+            const int * base = sampleRate < 46050.0 ? Delays44k::lengths : sampleRate < 72000.0 ? Delays48k::lengths : Delays96k::lengths;
+            const double baserate = sampleRate < 46050.0 ? 44100.0 : sampleRate < 72000.0 ? 48000.0 : 96000.0;
+            for (int i=0; i < NumLines; ++i) {
+                scaledLengths[i] = jmax(3, (int) (base[i] * sampleRate / baserate) | 1);
+            }
+        }
+
+        int maxlen = 0;
+        for (int i=0; i < NumLines; ++i) {
+            maxlen = jmax(maxlen, lineLength(i));
+        }
+        ringRows = nextPowerOfTwo(maxlen + 1);
+        ring.assign((size_t) (ringRows * NumVecs), Vec::expand(0.0f));
+
+        preDelayLength = nextPowerOfTwo((int) (MaxPreDelayMs * 1e-3 * sampleRate) + 1);
+        preDelayLeft.assign((size_t) preDelayLength, 0.0f);
+        preDelayRight.assign((size_t) preDelayLength, 0.0f);
+
+        reset();
+        paramsChanged = true;
+    }
+
+    void reset()
+    {
+        std::fill(ring.begin(), ring.end(), Vec::expand(0.0f));
+        std::fill(preDelayLeft.begin(), preDelayLeft.end(), 0.0f);
+        std::fill(preDelayRight.begin(), preDelayRight.end(), 0.0f);
+        for (auto & lp : lowpass) {
+            lp = Vec::expand(0.0f);
+        }
+        writeRow = 0;
+        preDelayPos = 0;
+    }
+
+    // 0 to 1, the decay time
+    void setSize(float newSize) { size = jlimit(0.0f, 1.0f, newSize); paramsChanged = true; }
+    // 0 to 1, how quickly the highs die away
+    void setDamping(float newDamping) { damping = jlimit(0.0f, 1.0f, newDamping); paramsChanged = true; }
+    // output gain
+    void setLevel(float newLevel) { level = jmax(0.0f, newLevel); paramsChanged = true; }
+    void setPreDelayMs(float ms) { preDelayMs = jlimit(0.0f, MaxPreDelayMs, ms); paramsChanged = true; }
+
+    // in place, right may be null for mono
+    void process(float * left, float * right, int numSamples)
+    {
+        if (ring.empty() || left == nullptr) return;
+
+        if (paramsChanged.exchange(false)) {
+            updateCoefs();
+        }
+
+        switch (table) {
+            case Table44k: processLines(Delays44k(), left, right, numSamples); break;
+            case Table48k: processLines(Delays48k(), left, right, numSamples); break;
+            case Table96k: processLines(Delays96k(), left, right, numSamples); break;
+            default: processLines(ScaledDelays { scaledLengths }, left, right, numSamples); break;
+        }
+    }
+
+private:
+    using Vec = juce::dsp::SIMDRegister<float>;
+
+    static constexpr int Width = (int) Vec::SIMDNumElements;
+    static constexpr int NumVecs = NumLines / Width;
+    static_assert(NumLines % Width == 0 && (NumVecs & (NumVecs - 1)) == 0, "lines have to fill whole registers");
+
+    static constexpr float MaxPreDelayMs = 200.0f;
+
+    // 23 to 92 ms, exponentially spaced primes
+    struct Delays44k {
+        static constexpr int lengths[NumLines] = { 1013, 1117, 1223, 1327, 1471, 1609, 1759, 1933,
+                                                   2129, 2333, 2557, 2803, 3079, 3373, 3701, 4057 };
+        constexpr int operator[](int line) const { return lengths[line]; }
+    };
+    struct Delays48k {
+        static constexpr int lengths[NumLines] = { 1103, 1213, 1327, 1459, 1597, 1753, 1931, 2111,
+                                                   2311, 2539, 2777, 3049, 3347, 3671, 4027, 4421 };
+        constexpr int operator[](int line) const { return lengths[line]; }
+    };
+    struct Delays96k {
+        static constexpr int lengths[NumLines] = { 2207, 2423, 2657, 2917, 3191, 3511, 3847, 4217,
+                                                   4621, 5077, 5563, 6101, 6691, 7349, 8053, 8831 };
+        constexpr int operator[](int line) const { return lengths[line]; }
+    };
+    struct ScaledDelays {
+        const int * lengths;
+        int operator[](int line) const { return lengths[line]; }
+    };
+
+    enum TableId {
+        Table44k = 0,
+        Table48k,
+        Table96k,
+        TableScaled
+    };
+
+    // lane l of register v is fed by line l * NumVecs + v (the transpose)
+    static constexpr int readLine(int slot) { return (slot % Width) * NumVecs + slot / Width; }
+
+    int lineLength(int line) const
+    {
+        switch (table) {
+            case Table44k: return Delays44k()[line];
+            case Table48k: return Delays48k()[line];
+            case Table96k: return Delays96k()[line];
+            default: return scaledLengths[line];
+        }
+    }
+
+    // on the audio thread, from the values the setters left
+    void updateCoefs()
+    {
+        const float rt60 = jmap(size.load(), 0.3f, 5.0f);
+        const float cutoff = jmin(jmap(damping.load(), 18000.0f, 1500.0f), 0.45f * (float) sr);
+        dampCoef = Vec::expand(1.0f - std::exp(-MathConstants<float>::twoPi * cutoff / (float) sr));
+
+        alignas(Vec::SIMDRegisterSize) float gains[NumLines];
+        alignas(Vec::SIMDRegisterSize) float tapsLeft[NumLines];
+        alignas(Vec::SIMDRegisterSize) float tapsRight[NumLines];
+        alignas(Vec::SIMDRegisterSize) float injectLeft[NumLines];
+        alignas(Vec::SIMDRegisterSize) float injectRight[NumLines];
+
+        // about as loud as MVerb for the same level
+        const float outscale = level.load() * 1.8f / std::sqrt((float) NumLines);
+        const float inscale = 1.0f / std::sqrt((float) NumLines * 0.5f);
+
+        for (int slot=0; slot < NumLines; ++slot) {
+            // the decay of the line this slot reads
+            gains[slot] = std::pow(10.0f, -3.0f * lineLength(readLine(slot)) / (rt60 * (float) sr));
+            tapsLeft[slot] = (slot & 1) ? -outscale : outscale;
+            tapsRight[slot] = (slot & 2) ? -outscale : outscale;
+            // written lines are in order, the left input feeds the even ones
+            injectLeft[slot] = (slot & 1) ? 0.0f : ((slot & 4) ? -inscale : inscale);
+            injectRight[slot] = (slot & 1) ? ((slot & 8) ? -inscale : inscale) : 0.0f;
+        }
+
+        for (int v=0; v < NumVecs; ++v) {
+            decayGain[v] = Vec::fromRawArray(gains + v * Width);
+            tapLeft[v] = Vec::fromRawArray(tapsLeft + v * Width);
+            tapRight[v] = Vec::fromRawArray(tapsRight + v * Width);
+            injLeft[v] = Vec::fromRawArray(injectLeft + v * Width);
+            injRight[v] = Vec::fromRawArray(injectRight + v * Width);
+        }
+
+        preDelaySamples = jlimit(0, preDelayLength - 1, (int) (preDelayMs.load() * 1e-3f * (float) sr));
+    }
+
+    template<typename Delays>
+    void processLines(const Delays delays, float * left, float * right, int numSamples)
+    {
+        const int rowmask = ringRows - 1;
+        const int predmask = preDelayLength - 1;
+        const Vec norm = Vec::expand(1.0f / std::sqrt((float) NumVecs));
+
+        for (int i=0; i < numSamples; ++i) {
+            // pre-delay
+            preDelayLeft[(size_t) preDelayPos] = left[i];
+            preDelayRight[(size_t) preDelayPos] = right ? right[i] : left[i];
+            const int predpos = (preDelayPos - preDelaySamples) & predmask;
+            const Vec inl = Vec::expand(preDelayLeft[(size_t) predpos]);
+            const Vec inr = Vec::expand(preDelayRight[(size_t) predpos]);
+            preDelayPos = (preDelayPos + 1) & predmask;
+
+            // gather the delayed samples, transposed
+            alignas(Vec::SIMDRegisterSize) float delayed[NumLines];
+            for (int slot=0; slot < NumLines; ++slot) {
+                const int line = readLine(slot);
+                const int row = (writeRow - delays[line]) & rowmask;
+                delayed[slot] = ring[(size_t) (row * NumVecs + line / Width)].get((size_t) (line % Width));
+            }
+
+            Vec x[NumVecs];
+            Vec outl = Vec::expand(0.0f);
+            Vec outr = Vec::expand(0.0f);
+            for (int v=0; v < NumVecs; ++v) {
+                const Vec y = Vec::fromRawArray(delayed + v * Width);
+                outl += y * tapLeft[v];
+                outr += y * tapRight[v];
+                lowpass[v] += dampCoef * (y - lowpass[v]);
+                x[v] = lowpass[v] * decayGain[v];
+            }
+
+            // Hadamard across the registers
+            for (int span=1; span < NumVecs; span <<= 1) {
+                for (int v=0; v < NumVecs; v += span << 1) {
+                    for (int k=v; k < v + span; ++k) {
+                        const Vec a = x[k];
+                        const Vec b = x[k + span];
+                        x[k] = a + b;
+                        x[k + span] = a - b;
+                    }
+                }
+            }
+
+            Vec * dest = &ring[(size_t) (writeRow * NumVecs)];
+            for (int v=0; v < NumVecs; ++v) {
+                dest[v] = x[v] * norm + inl * injLeft[v] + inr * injRight[v];
+            }
+            writeRow = (writeRow + 1) & rowmask;
+
+            if (right) {
+                left[i] = outl.sum();
+                right[i] = outr.sum();
+            } else {
+                left[i] = 0.5f * (outl.sum() + outr.sum());
+            }
+        }
+    }
+
+    double sr = 48000.0;
+    TableId table = Table48k;
+    int scaledLengths[NumLines] = {};
+
+    std::vector<Vec> ring;
+    int ringRows = 0;
+    int writeRow = 0;
+
+    std::vector<float> preDelayLeft;
+    std::vector<float> preDelayRight;
+    int preDelayLength = 0;
+    int preDelayPos = 0;
+    int preDelaySamples = 0;
+
+    std::atomic<float> size { 0.5f };
+    std::atomic<float> damping { 0.5f };
+    std::atomic<float> level { 1.0f };
+    std::atomic<float> preDelayMs { 0.0f };
+    std::atomic<bool> paramsChanged { true };
+
+    Vec dampCoef = Vec::expand(1.0f);
+    Vec lowpass[NumVecs];
+    Vec decayGain[NumVecs];
+    Vec tapLeft[NumVecs];
+    Vec tapRight[NumVecs];
+    Vec injLeft[NumVecs];
+    Vec injRight[NumVecs];
+};
+
+} // namespace SonoAudio
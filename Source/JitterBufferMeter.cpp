@@ -27,13 +27,58 @@ void JitterBufferMeter::setRecvMode(bool recvmode)
 
 void JitterBufferMeter::setFillRatio (float ratio, float stdev)
 {
-    if (fabsf(ratio - _ratio) > 0.005f || fabsf(stdev - _stdev) > 0.001f) {
-        _ratio = ratio;
-        _stdev = stdev;
-        repaint();
+    if (fabsf(ratio - _ratio) <= 0.005f && fabsf(stdev - _stdev) <= 0.001f) {
+        return;
+    }
+
+    // only the columns from where the edge starts to where the bar ends
+    // differ between the old and new values, nothing at all if they are
+    // on the same pixels
+    const auto oldcols = getBarColumns(_ratio, _stdev);
+    const auto newcols = getBarColumns(ratio, stdev);
+
+    _ratio = ratio;
+    _stdev = stdev;
+
+    if (oldcols == newcols) {
+        return;
+    }
+
+    const int startx = jmin(oldcols.getStart(), newcols.getStart());
+    const int endx = jmax(oldcols.getEnd(), newcols.getEnd());
+    repaint(startx, 0, endx - startx, getHeight());
+}
+
+void JitterBufferMeter::getBars (float ratio, float stdev, Rectangle<float> & fillbox, Rectangle<float> & edgebox) const
+{
+    const float width = (float) getWidth();
+    const float height = (float) getHeight();
+
+    float fwidth = width * ratio;
+    float edgewidth = jmax(2.0f, width * 2.0f * stdev);
+    fillbox = Rectangle<float>(0.0f, 0.0f, fwidth, height);
+    fillbox.reduce(1.0f, 1.0f);
+    // edge whose thickness uses the std deviation
+    edgebox = Rectangle<float>(fwidth - edgewidth, 0.0f, edgewidth, height);
+    edgebox.reduce(0.0f, 1.0f);
+
+    if (edgebox.getRight() >= width) {
+        edgebox.translate(width - edgebox.getRight(), 0.0f);
+    } else if (edgebox.getX() <= 0) {
+        edgebox.translate(-edgebox.getX(), 0.0f);
     }
 }
 
+Range<int> JitterBufferMeter::getBarColumns (float ratio, float stdev) const
+{
+    Rectangle<float> fillbox, edgebox;
+    getBars(ratio, stdev, fillbox, edgebox);
+
+    // fillbox is empty at the left end when the ratio is close to 0
+    const float right = jmax(fillbox.getRight(), edgebox.getRight());
+    return Range<int>((int) std::floor(edgebox.getX()), (int) std::ceil(right)).getIntersectionWith(Range<int>(0, getWidth()));
+}
+
 
 void JitterBufferMeter::paint (Graphics& g)
 {
@@ -48,19 +93,8 @@ void JitterBufferMeter::paint (Graphics& g)
     
     //g.fillAll(Colours::black);
 
-    float fwidth = (float)width * _ratio;
-    float edgewidth = jmax(2.0f, width * 2.0f * _stdev);
-    Rectangle<float> fillbox(0.0f, 0.0f, fwidth, height);
-    fillbox.reduce(1.0f, 1.0f);
-    // edge whose thickness uses the std deviation
-    Rectangle<float> edgebox(fwidth - edgewidth, 0.0f, edgewidth, height);
-    edgebox.reduce(0.0f, 1.0f);
-    
-    if (edgebox.getRight() >= width) {
-        edgebox.translate(width - edgebox.getRight(), 0.0f);
-    } else if (edgebox.getX() <= 0) {
-        edgebox.translate(-edgebox.getX(), 0.0f);
-    }
+    Rectangle<float> fillbox, edgebox;
+    getBars(_ratio, _stdev, fillbox, edgebox);
     
     float goodness = _recvmode ? _ratio : (1.0f - _ratio);
     
@@ -20,6 +20,12 @@ public:
     
 private:
 
+    // the fill bar and the stdev edge at the end of it, for the given values
+    void getBars (float ratio, float stdev, Rectangle<float> & fillbox, Rectangle<float> & edgebox) const;
+
+    // the span of pixel columns the bars cover, which is all that changes between values
+    Range<int> getBarColumns (float ratio, float stdev) const;
+
     bool  _recvmode = true;
     float _ratio = 0.0f;
     float _stdev = 0.0f;
@@ -0,0 +1,500 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#include "LanDiscovery.h"
+
+#if JUCE_WINDOWS
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+
+#define MDNS_ADDRESS "224.0.0.251"
+#define MDNS_PORT 5353
+#define MDNS_MAX_PACKET 1500
+
+// the host and SRV records go stale sooner than the rest, see RFC 6762 section 10
+#define MDNS_HOST_TTL 120
+#define MDNS_SERVICE_TTL 4500
+// announced twice on start, then again well before the host records run out
+#define MDNS_ANNOUNCE_REPEAT_MS 1000.0
+#define MDNS_REANNOUNCE_MS 60000.0
+// queries start once a second and back off to this
+#define MDNS_QUERY_INTERVAL_MIN_MS 1000.0
+#define MDNS_QUERY_INTERVAL_MAX_MS 60000.0
+// a flood of queries only gets this many answers
+#define MDNS_RESPONSE_MIN_INTERVAL_MS 250.0
+
+#define DNS_TYPE_A 1
+#define DNS_TYPE_PTR 12
+#define DNS_TYPE_TXT 16
+#define DNS_TYPE_SRV 33
+#define DNS_TYPE_ANY 255
+#define DNS_CLASS_IN 1
+// set on the records only we have, the others replace what they had for them
+#define DNS_CLASS_CACHE_FLUSH 0x8000
+
+namespace SonoAudio {
+
+namespace {
+
+const StringArray & getServiceName()
+{
+    static const StringArray name { "_sonobus", "_udp", "local" };
+    return name;
+}
+
+bool sameName(const StringArray & a, const StringArray & b, int aoffset = 0)
+{
+    if (a.size() - aoffset != b.size()) return false;
+    for (int i = 0; i < b.size(); ++i) {
+        if (!a[aoffset + i].equalsIgnoreCase(b[i])) return false;
+    }
+    return true;
+}
+
+// a service instance is one label in front of the service name
+bool isServiceInstance(const StringArray & name)
+{
+    return name.size() == getServiceName().size() + 1 && sameName(name, getServiceName(), 1);
+}
+
+// cut back to at most maxBytes of UTF-8, without splitting a character
+String truncateUtf8(String str, int maxBytes)
+{
+    while ((int) str.getNumBytesAsUTF8() > maxBytes) {
+        str = str.dropLastCharacters(1);
+    }
+    return str;
+}
+
+// follows the compression pointers, pos ends up after the name where it started
+bool readName(const uint8 * msg, int size, int & pos, StringArray & labels)
+{
+    labels.clear();
+    int p = pos;
+    bool jumped = false;
+
+    for (int jumps = 0; ; ) {
+        if (p >= size) return false;
+        const int len = msg[p];
+
+        if ((len & 0xc0) == 0xc0) {
+            if (p + 1 >= size || ++jumps > 16) return false;
+            if (!jumped) pos = p + 2;
+            jumped = true;
+            p = ((len & 0x3f) << 8) | msg[p + 1];
+            continue;
+        }
+        if ((len & 0xc0) != 0) return false;
+
+        if (len == 0) {
+            if (!jumped) pos = p + 1;
+            return true;
+        }
+        if (p + 1 + len > size) return false;
+        labels.add(String::fromUTF8((const char *) msg + p + 1, len));
+        p += 1 + len;
+    }
+}
+
+struct DnsWriter
+{
+    void put8(int value)
+    {
+        if (size >= MDNS_MAX_PACKET) {
+            failed = true;
+            return;
+        }
+        data[size++] = (uint8) value;
+    }
+
+    void put16(int value)
+    {
+        put8((value >> 8) & 0xff);
+        put8(value & 0xff);
+    }
+
+    void put32(uint32 value)
+    {
+        put16((int) (value >> 16));
+        put16((int) (value & 0xffff));
+    }
+
+    void putBytes(const void * bytes, int num)
+    {
+        for (int i = 0; i < num; ++i) {
+            put8(((const uint8 *) bytes)[i]);
+        }
+    }
+
+    // no compression, the packets are small enough
+    void putName(const StringArray & labels)
+    {
+        for (auto & label : labels) {
+            const int len = jmin(63, (int) label.getNumBytesAsUTF8());
+            put8(len);
+            putBytes(label.toRawUTF8(), len);
+        }
+        put8(0);
+    }
+
+    // writes a record up to its data, returns where endRecord() puts its length
+    int beginRecord(const StringArray & name, int type, int dnsclass, uint32 ttl)
+    {
+        putName(name);
+        put16(type);
+        put16(dnsclass);
+        put32(ttl);
+        const int lengthpos = size;
+        put16(0);
+        return lengthpos;
+    }
+
+    void endRecord(int lengthpos)
+    {
+        if (failed) return;
+        const int len = size - lengthpos - 2;
+        data[lengthpos] = (uint8) (len >> 8);
+        data[lengthpos + 1] = (uint8) (len & 0xff);
+    }
+
+    void putTxtString(const String & str)
+    {
+        const int len = jmin(255, (int) str.getNumBytesAsUTF8());
+        put8(len);
+        putBytes(str.toRawUTF8(), len);
+    }
+
+    uint8 data[MDNS_MAX_PACKET];
+    int size = 0;
+    bool failed = false;
+};
+
+}
+
+LanDiscovery::LanDiscovery()
+{
+}
+
+LanDiscovery::~LanDiscovery()
+{
+    stop();
+}
+
+bool LanDiscovery::start(const String & user, const String & group, int udpport)
+{
+    stop();
+
+    auto sock = std::make_unique<DatagramSocket>(false);
+    // shared with the system's own responder, if there is one
+    sock->setEnablePortReuse(true);
+
+    if (!sock->bindToPort(MDNS_PORT) || !sock->joinMulticast(MDNS_ADDRESS)) {
+        DBG("Error joining the mDNS group for LAN discovery");
+        return false;
+    }
+
+    // link local, but mDNS receivers drop anything that didn't come with a TTL of 255
+#if JUCE_MAC || JUCE_IOS
+    const unsigned char ttl = 255;
+#else
+    const int ttl = 255;
+#endif
+    setsockopt(sock->getRawSocketHandle(), IPPROTO_IP, IP_MULTICAST_TTL, (const char *) &ttl, sizeof(ttl));
+
+    socket = std::move(sock);
+    userName = user;
+    groupName = group;
+    port = udpport;
+
+    const String suffix = String::toHexString((int) (Random::getSystemRandom().nextInt() & 0x7fffffff));
+    instanceLabel = truncateUtf8(user.isNotEmpty() ? user : String("SonoBus"), 48) + " [" + suffix + "]";
+    hostLabel = "sonobus-" + suffix;
+
+    nextQueryMs = 0;
+    queryIntervalMs = MDNS_QUERY_INTERVAL_MIN_MS;
+    nextAnnounceMs = 0;
+    announcementsSent = 0;
+    responsePending = false;
+    lastResponseMs = -MDNS_RESPONSE_MIN_INTERVAL_MS;
+
+    DBG("LAN discovery started for group " << group << " as " << instanceLabel);
+    return true;
+}
+
+void LanDiscovery::stop()
+{
+    if (!socket) return;
+
+    // goodbye, the same records with a TTL of 0
+    sendResponse(0);
+
+    socket.reset();
+    peers.clear();
+    DBG("LAN discovery stopped");
+}
+
+void LanDiscovery::service(double nowMs, Array<Peer> & found, Array<Peer> & lost)
+{
+    if (!socket) return;
+
+    uint8 buf[MDNS_MAX_PACKET];
+    String sender;
+    int senderport = 0;
+
+    for (;;) {
+        const int nbytes = socket->read(buf, sizeof(buf), false, sender, senderport);
+        if (nbytes <= 0) break;
+        handlePacket(buf, nbytes, sender, nowMs, found, lost);
+    }
+
+    for (auto it = peers.begin(); it != peers.end(); ) {
+        if (nowMs > it->second.expiresMs) {
+            DBG("LAN peer " << it->first << " timed out");
+            lost.add(it->second.peer);
+            it = peers.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    if (nowMs >= nextAnnounceMs) {
+        responsePending = true;
+        ++announcementsSent;
+        nextAnnounceMs = nowMs + (announcementsSent < 2 ? MDNS_ANNOUNCE_REPEAT_MS : MDNS_REANNOUNCE_MS);
+    }
+
+    if (responsePending && nowMs >= lastResponseMs + MDNS_RESPONSE_MIN_INTERVAL_MS) {
+        sendResponse(MDNS_SERVICE_TTL);
+        responsePending = false;
+        lastResponseMs = nowMs;
+    }
+
+    if (nowMs >= nextQueryMs) {
+        sendQuery();
+        nextQueryMs = nowMs + queryIntervalMs;
+        queryIntervalMs = jmin(queryIntervalMs * 2.0, MDNS_QUERY_INTERVAL_MAX_MS);
+    }
+}
+
+void LanDiscovery::handlePacket(const uint8 * msg, int size, const String & sender, double nowMs,
+                                Array<Peer> & found, Array<Peer> & lost)
+{
+    if (size < 12) return;
+
+    auto get16 = [msg] (int p) { return (msg[p] << 8) | msg[p + 1]; };
+
+    const int flags = get16(2);
+    const int numquestions = get16(4);
+    const int numrecords = get16(6) + get16(8) + get16(10);
+    int pos = 12;
+    StringArray name;
+
+    const StringArray instancename { instanceLabel, "_sonobus", "_udp", "local" };
+    const StringArray hostname { hostLabel, "local" };
+
+    if ((flags & 0x8000) == 0) {
+        // a query, only the standard kind
+        if ((flags & 0x7800) != 0) return;
+
+        for (int q = 0; q < numquestions; ++q) {
+            if (!readName(msg, size, pos, name) || pos + 4 > size) return;
+            const int type = get16(pos);
+            pos += 4;
+
+            if (((type == DNS_TYPE_PTR || type == DNS_TYPE_ANY) && sameName(name, getServiceName()))
+                || ((type == DNS_TYPE_SRV || type == DNS_TYPE_TXT || type == DNS_TYPE_ANY) && sameName(name, instancename))
+                || ((type == DNS_TYPE_A || type == DNS_TYPE_ANY) && sameName(name, hostname))) {
+                responsePending = true;
+            }
+        }
+        return;
+    }
+
+    // a response, the questions in it (if any) don't matter
+    for (int q = 0; q < numquestions; ++q) {
+        if (!readName(msg, size, pos, name) || pos + 4 > size) return;
+        pos += 4;
+    }
+
+    struct Instance {
+        bool announced = false;
+        uint32 ttl = 0;
+        int port = 0;
+        uint32 srvttl = 0;
+        bool hasTxt = false;
+        String user;
+        String group;
+    };
+    std::map<String, Instance> instances;
+
+    for (int r = 0; r < numrecords; ++r) {
+        if (!readName(msg, size, pos, name) || pos + 10 > size) return;
+        const int type = get16(pos);
+        const uint32 ttl = ((uint32) get16(pos + 4) << 16) | (uint32) get16(pos + 6);
+        const int rdlength = get16(pos + 8);
+        pos += 10;
+        if (pos + rdlength > size) return;
+        const int rdata = pos;
+        pos += rdlength;
+
+        if (type == DNS_TYPE_PTR && sameName(name, getServiceName())) {
+            int p = rdata;
+            StringArray target;
+            if (readName(msg, size, p, target) && isServiceInstance(target)) {
+                auto & inst = instances[target[0]];
+                inst.announced = true;
+                inst.ttl = ttl;
+            }
+        }
+        else if (type == DNS_TYPE_SRV && isServiceInstance(name) && rdlength >= 7) {
+            auto & inst = instances[name[0]];
+            inst.port = get16(rdata + 4);
+            inst.srvttl = ttl;
+        }
+        else if (type == DNS_TYPE_TXT && isServiceInstance(name)) {
+            auto & inst = instances[name[0]];
+            inst.hasTxt = true;
+            for (int p = rdata; p < rdata + rdlength; ) {
+                const int len = msg[p];
+                if (p + 1 + len > rdata + rdlength) break;
+                const String entry = String::fromUTF8((const char *) msg + p + 1, len);
+                if (entry.startsWith("u=")) {
+                    inst.user = entry.substring(2);
+                }
+                else if (entry.startsWith("g=")) {
+                    inst.group = entry.substring(2);
+                }
+                p += 1 + len;
+            }
+        }
+    }
+
+    for (auto & item : instances) {
+        const String & instance = item.first;
+        const Instance & inst = item.second;
+        if (!inst.announced || instance == instanceLabel) continue;
+
+        auto cached = peers.find(instance);
+
+        if (inst.ttl == 0) {
+            if (cached != peers.end()) {
+                DBG("LAN peer " << instance << " said goodbye");
+                lost.add(cached->second.peer);
+                peers.erase(cached);
+            }
+            continue;
+        }
+
+        // we send them all together, no need to go asking for the rest
+        if (inst.port <= 0 || !inst.hasTxt) continue;
+
+        Peer peer;
+        peer.instance = instance;
+        peer.userName = inst.user;
+        peer.groupName = inst.group;
+        peer.host = sender;
+        peer.port = inst.port;
+
+        const double expires = nowMs + 1e3 * jmin(inst.ttl, inst.srvttl > 0 ? inst.srvttl : (uint32) MDNS_HOST_TTL);
+
+        if (cached != peers.end()) {
+            auto & known = cached->second.peer;
+            cached->second.expiresMs = expires;
+            if (known.host == peer.host && known.port == peer.port
+                && known.userName == peer.userName && known.groupName == peer.groupName) {
+                continue;
+            }
+            if (known.host != peer.host || known.port != peer.port) {
+                // gone from where it was
+                lost.add(known);
+            }
+            known = peer;
+        }
+        else {
+            peers[instance] = { peer, expires };
+        }
+
+        DBG("LAN peer " << instance << " in group " << peer.groupName << " at " << peer.host << ":" << peer.port);
+        found.add(peer);
+    }
+}
+
+void LanDiscovery::sendQuery()
+{
+    DnsWriter w;
+    w.put16(0); // id
+    w.put16(0); // flags, a standard query
+    w.put16(1);
+    w.put16(0);
+    w.put16(0);
+    w.put16(0);
+
+    w.putName(getServiceName());
+    w.put16(DNS_TYPE_PTR);
+    w.put16(DNS_CLASS_IN);
+
+    socket->write(MDNS_ADDRESS, MDNS_PORT, w.data, w.size);
+}
+
+void LanDiscovery::sendResponse(uint32 ttl)
+{
+    // a goodbye has everything at 0
+    const uint32 hostttl = ttl > 0 ? (uint32) MDNS_HOST_TTL : 0;
+
+    Array<IPAddress> addresses;
+    for (auto & addr : IPAddress::getAllAddresses(false)) {
+        if (addr.address[0] != 127 && !addr.isNull() && addresses.size() < 8) {
+            addresses.add(addr);
+        }
+    }
+
+    const StringArray instancename { instanceLabel, "_sonobus", "_udp", "local" };
+    const StringArray hostname { hostLabel, "local" };
+    const int cacheflush = DNS_CLASS_IN | DNS_CLASS_CACHE_FLUSH;
+
+    DnsWriter w;
+    w.put16(0); // id
+    w.put16(0x8400); // an authoritative response
+    w.put16(0);
+    w.put16(3 + addresses.size());
+    w.put16(0);
+    w.put16(0);
+
+    int len = w.beginRecord(getServiceName(), DNS_TYPE_PTR, DNS_CLASS_IN, ttl);
+    w.putName(instancename);
+    w.endRecord(len);
+
+    len = w.beginRecord(instancename, DNS_TYPE_SRV, cacheflush, hostttl);
+    w.put16(0); // priority
+    w.put16(0); // weight
+    w.put16(port);
+    w.putName(hostname);
+    w.endRecord(len);
+
+    len = w.beginRecord(instancename, DNS_TYPE_TXT, cacheflush, ttl);
+    w.putTxtString("txtvers=1");
+    w.putTxtString("u=" + userName);
+    w.putTxtString("g=" + groupName);
+    w.endRecord(len);
+
+    for (auto & addr : addresses) {
+        len = w.beginRecord(hostname, DNS_TYPE_A, cacheflush, hostttl);
+        w.putBytes(addr.address, 4);
+        w.endRecord(len);
+    }
+
+    if (w.failed) {
+        DBG("LAN discovery response too large");
+        return;
+    }
+
+    socket->write(MDNS_ADDRESS, MDNS_PORT, w.data, w.size);
+}
+
+}
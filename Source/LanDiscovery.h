@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include <map>
+
+namespace SonoAudio {
+
+// Finds the other users on the local network without a connection server, with
+// multicast DNS service discovery (RFC 6762, 6763). Everyone advertises a
+// _sonobus._udp service with their user and group name in its TXT record, and
+// browses for everyone else's. Only as much of mDNS as that needs, over IPv4.
+// There is no probing for name conflicts, the instance and host names get a
+// random suffix instead.
+//
+// Not thread safe, it's meant to be serviced from one thread (the event thread).
+class LanDiscovery
+{
+public:
+    struct Peer {
+        String instance; // service instance name, unique per advertising user
+        String userName;
+        String groupName;
+        String host; // the IPv4 address it announced itself from
+        int port = 0;
+    };
+
+    LanDiscovery();
+    // says goodbye, if it was running
+    ~LanDiscovery();
+
+    // advertises the UDP port we take peers on, and starts browsing
+    bool start(const String & userName, const String & groupName, int port);
+    // the others drop us from their caches right away
+    void stop();
+
+    bool isRunning() const { return socket != nullptr; }
+    const String & getGroupName() const { return groupName; }
+    const String & getUserName() const { return userName; }
+    int getPort() const { return port; }
+
+    // answers queries and sends what's due, without blocking. Found gets the peers
+    // which showed up or changed since the last call, lost the ones which said
+    // goodbye, moved away from their old address (found again at the new one), or
+    // haven't been heard from for as long as their records last
+    void service(double nowMs, Array<Peer> & found, Array<Peer> & lost);
+
+private:
+    struct CachedPeer {
+        Peer peer;
+        double expiresMs = 0;
+    };
+
+    void handlePacket(const uint8 * data, int size, const String & sender, double nowMs,
+                      Array<Peer> & found, Array<Peer> & lost);
+    void sendQuery();
+    void sendResponse(uint32 ttl);
+
+    std::unique_ptr<DatagramSocket> socket;
+    String userName;
+    String groupName;
+    int port = 0;
+    String instanceLabel;
+    String hostLabel;
+
+    double nextQueryMs = 0;
+    double queryIntervalMs = 0;
+    double nextAnnounceMs = 0;
+    int announcementsSent = 0;
+    bool responsePending = false;
+    double lastResponseMs = 0;
+
+    std::map<String, CachedPeer> peers; // by instance
+
+    JUCE_DECLARE_NON_COPYABLE (LanDiscovery)
+};
+
+}
@@ -174,10 +174,10 @@ void LatencyMatchView::timerCallback(int timerid)
         startTimer(2, 3000);
     }
     else if (timerid == 2) {
-        // request the data again
+        // request what changed since
         updatePeerSliders();
 
-        processor.beginLatencyMatchProcedure();
+        processor.refreshLatencyMatchProcedure();
 
     }
 
@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+#include "CrossPlatformUtils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+namespace SonoAudio {
+
+// Watches how much of the block period the audio callback takes, and when it
+// stays too close to the deadline steps through shedding levels, each giving
+// up a bit more work than the one before. When there is headroom again for a
+// while it steps back down, one level at a time. The up and down thresholds and
+// hold times are far enough apart that it doesn't flap around the boundary.
+//
+// The audio thread calls update() once per block and reads getLevel(), what
+// each level actually sheds is up to the processor.
+//
+// The device's thermal state sets a floor under the level, so a phone that is
+// getting hot gives up the cheap quality first, before it gets throttled and
+// the load goes over the edge anyway.
+class LoadGovernor
+{
+public:
+    enum Level {
+        LevelNone = 0,
+        LevelCodecComplexity, // encoder complexity
+        LevelPeerFx,          // effects of the lowest priority peers
+        LevelReverbModel,     // the cheapest main reverb model
+        LevelReverb,          // main and input reverb
+        LevelMeters,          // metering
+        LevelResampler,       // sink resampler quality
+        LevelCodecMinimal,    // the lowest encoder complexity
+        NumLevels
+    };
+
+    static const char * getLevelName(int level)
+    {
+        static const char * names[NumLevels] = {
+            "None", "Codec Complexity", "Peer Effects", "Reverb Model", "Reverb", "Meters", "Resampler Quality", "Minimal Codec"
+        };
+        return (level >= 0 && level < NumLevels) ? names[level] : "";
+    }
+
+    // fraction of the block period
+    static constexpr float overloadThreshold = 0.85f;
+    static constexpr float headroomThreshold = 0.6f;
+
+    static constexpr double overloadHoldSec = 0.5;
+    static constexpr double headroomHoldSec = 3.0;
+
+    // of the load average
+    static constexpr double loadTimeConstantSec = 0.2;
+
+    // -- audio thread --
+
+    // load is the callback time over the block period
+    void update(float load, double periodSec) noexcept
+    {
+        if (periodSec <= 0.0) return;
+
+        const float alpha = (float) (1.0 - std::exp(-periodSec / loadTimeConstantSec));
+        averageLoad += alpha * (load - averageLoad);
+
+        int level = currentLevel.load(std::memory_order_relaxed);
+
+        if (averageLoad > overloadThreshold && level < NumLevels - 1) {
+            headroomTime = 0.0;
+            overloadTime += periodSec;
+            if (overloadTime >= overloadHoldSec) {
+                overloadTime = 0.0;
+                currentLevel.store(level + 1, std::memory_order_relaxed);
+            }
+        }
+        else if (averageLoad < headroomThreshold && level > LevelNone) {
+            overloadTime = 0.0;
+            headroomTime += periodSec;
+            if (headroomTime >= headroomHoldSec) {
+                headroomTime = 0.0;
+                currentLevel.store(level - 1, std::memory_order_relaxed);
+            }
+        }
+        else {
+            overloadTime = 0.0;
+            headroomTime = 0.0;
+        }
+    }
+
+    // brings everything back right away, when it gets switched off
+    void reset() noexcept
+    {
+        currentLevel.store(LevelNone, std::memory_order_relaxed);
+        averageLoad = 0.0f;
+        overloadTime = 0.0;
+        headroomTime = 0.0;
+    }
+
+    // -- any thread --
+
+    int getLevel() const noexcept
+    {
+        return std::max(currentLevel.load(std::memory_order_relaxed), thermalLevel.load(std::memory_order_relaxed));
+    }
+
+    // one of ThermalState (CrossPlatformUtils.h)
+    void setThermalState(int state) noexcept
+    {
+        thermalLevel.store(getThermalLevel(state), std::memory_order_relaxed);
+    }
+
+    static int getThermalLevel(int state) noexcept
+    {
+        switch (state) {
+            case ThermalFair: return LevelCodecComplexity;
+            case ThermalSerious: return LevelReverbModel;
+            case ThermalCritical: return NumLevels - 1;
+            default: return LevelNone;
+        }
+    }
+
+private:
+    std::atomic<int> currentLevel { LevelNone };
+    std::atomic<int> thermalLevel { LevelNone };
+
+    // audio thread only
+    float averageLoad = 0.0f;
+    double overloadTime = 0.0;
+    double headroomTime = 0.0;
+};
+
+}
@@ -0,0 +1,199 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include <atomic>
+#include <memory>
+
+namespace SonoAudio {
+
+// Delay memory shared by all the monitoring delays of the processor.
+// It is a pool of mono lines, every channel group with its monitoring delay
+// enabled holds a run of them, one per channel. Lines are handed out and taken
+// back on the message thread, and their memory is only ever allocated there
+// or in prepare(), and never freed while audio is running. So the audio thread
+// doesn't need any lock to use them, it only sees the range its group holds.
+class MonitorDelayArena
+{
+public:
+    static constexpr int MaxLines = 80;
+    static constexpr double MaxDelaySeconds = 5.0;
+    static constexpr double CrossfadeSeconds = 0.02;
+
+    // no audio may be running, lines already handed out are kept but lose their contents
+    void prepare(double sampRate, int maxBlockSize)
+    {
+        const ScopedLock sl (lock);
+
+        sampleRate = sampRate;
+        const int newlength = nextPowerOfTwo(getMaxDelaySamples() + jmax(4096, maxBlockSize));
+        if (newlength != lineLength) {
+            lineLength = newlength;
+            for (auto & line : lines) {
+                if (line) {
+                    line.reset(new float[(size_t) lineLength]);
+                }
+            }
+        }
+
+        workBuffer.setSize(MaxLines, jmax(4096, maxBlockSize), false, false, true);
+    }
+
+    // message thread, returns the first of count adjacent lines or -1 if there is no room left
+    int acquireLines(int count)
+    {
+        const ScopedLock sl (lock);
+
+        for (int first=0; first + count <= MaxLines; ++first) {
+            int len = 0;
+            while (len < count && !lineUsed[first + len]) ++len;
+            if (len == count) {
+                for (int i=first; i < first + count; ++i) {
+                    if (!lines[i]) {
+                        lines[i].reset(new float[(size_t) lineLength]);
+                    }
+                    lineUsed[i] = true;
+                }
+                return first;
+            }
+            first += len;
+        }
+        return -1;
+    }
+
+    // message thread, the previous holder must not use them after this
+    void releaseLines(int first, int count)
+    {
+        const ScopedLock sl (lock);
+
+        for (int i=jmax(0, first); i < first + count && i < MaxLines; ++i) {
+            lineUsed[i] = false;
+        }
+    }
+
+    int getMaxDelaySamples() const { return (int) (MaxDelaySeconds * sampleRate); }
+    int getCrossfadeSamples() const { return jmax(1, (int) (CrossfadeSeconds * sampleRate)); }
+    int getLineLength() const { return lineLength; }
+
+    float * getLine(int index) const { return lines[index].get(); }
+
+    // audio thread, scratch space for the delayed output, only valid until the next user
+    AudioBuffer<float> & getWorkBuffer(int numSamples)
+    {
+        if (workBuffer.getNumSamples() < numSamples) {
+            workBuffer.setSize(MaxLines, numSamples, false, false, true);
+        }
+        return workBuffer;
+    }
+
+private:
+    double sampleRate = 48000.0;
+    int lineLength = nextPowerOfTwo(240000 + 4096);
+
+    std::unique_ptr<float[]> lines[MaxLines];
+    bool lineUsed[MaxLines] = {};
+    CriticalSection lock;
+
+    AudioBuffer<float> workBuffer;
+};
+
+
+// The delay of one channel group, reading from lines of the arena. The write
+// position is shared by all its channels. Changing the delay doesn't need a
+// gap, both taps are in the line already, so it crossfades from the old one to
+// the new one. Samples not written since the last reset() read back as silence,
+// lines coming from another group are never cleared.
+class MonitorDelayTap
+{
+public:
+    // any thread
+    void setDelaySamples(int samples) { targetDelay.store(jmax(0, samples), std::memory_order_relaxed); }
+
+    // audio thread (or while it isn't running)
+    void reset()
+    {
+        writePos = 0;
+        filled = 0;
+        delay = -1; // picked up again by the next process()
+        fadePos = fadeLength = 0;
+    }
+
+    // audio thread, delays numChans channels of src into dest, through the lines starting at firstLine
+    void process(const MonitorDelayArena & arena, int firstLine, const float * const * src, float * const * dest, int numChans, int numSamples)
+    {
+        const int length = arena.getLineLength();
+        const int mask = length - 1;
+        writePos &= mask;
+
+        if (fadePos >= fadeLength) {
+            const int target = jmin(targetDelay.load(std::memory_order_relaxed), arena.getMaxDelaySamples());
+            if (target != delay) {
+                prevDelay = delay;
+                delay = target;
+                fadePos = 0;
+                // nothing to fade from yet
+                fadeLength = filled > 0 ? arena.getCrossfadeSamples() : 0;
+            }
+        }
+
+        // the block being written can't overwrite what it still has to read
+        const int usedelay = jmin(delay, length - numSamples);
+        const int useprev = jmin(prevDelay, length - numSamples);
+        const int fadecount = jmin(numSamples, fadeLength - fadePos);
+
+        for (int ch=0; ch < numChans; ++ch) {
+            float * line = arena.getLine(firstLine + ch);
+
+            const int first = jmin(numSamples, length - writePos);
+            FloatVectorOperations::copy(line + writePos, src[ch], first);
+            FloatVectorOperations::copy(line, src[ch] + first, numSamples - first);
+
+            float * out = dest[ch];
+            int k = 0;
+            if (fadecount > 0) {
+                const float step = 1.0f / (float) fadeLength;
+                float g = (float) fadePos * step;
+                for ( ; k < fadecount; ++k) {
+                    g += step;
+                    out[k] = g * tapSample(line, mask, k, usedelay) + (1.0f - g) * tapSample(line, mask, k, useprev);
+                }
+            }
+
+            // silence until the line holds enough history
+            const int zeros = jlimit(0, numSamples - k, usedelay - filled - k);
+            FloatVectorOperations::clear(out + k, zeros);
+            k += zeros;
+
+            const int readpos = (writePos + k - usedelay) & mask;
+            const int count = numSamples - k;
+            const int part = jmin(count, length - readpos);
+            FloatVectorOperations::copy(out + k, line + readpos, part);
+            FloatVectorOperations::copy(out + k + part, line, count - part);
+        }
+
+        writePos = (writePos + numSamples) & mask;
+        filled = jmin(filled + numSamples, length);
+        fadePos += jmax(0, fadecount);
+    }
+
+private:
+    // sample k of the current block delayed by d, the block is already written
+    float tapSample(const float * line, int mask, int k, int d) const
+    {
+        return k - d >= -filled ? line[(writePos + k - d) & mask] : 0.0f;
+    }
+
+    std::atomic<int> targetDelay { 0 };
+
+    int delay = -1;
+    int prevDelay = 0;
+    int fadePos = 0;
+    int fadeLength = 0;
+    int writePos = 0;
+    int filled = 0;
+};
+
+} // namespace SonoAudio
@@ -0,0 +1,682 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+// for the Faust UI and MapUI classes
+#include "faustCompressor.h"
+
+#include <cmath>
+
+namespace SonoAudio {
+
+// N channel versions of the Faust compressor, expander and parametric EQ, with
+// the same algorithms and the same UI paths, so they are driven through a MapUI
+// just like the generated ones.
+// Everything that doesn't depend on the audio (the gain computer of the dynamics,
+// the filter coefficients of the EQ) is computed once per sample for all channels,
+// which is most of the work. The per channel state is kept in SIMD registers with
+// one channel per lane, so a group of channels gets filtered at the cost of one.
+// Processing is in place, in chunks of up to ChunkSize samples.
+// With silent input they can skip the work altogether (see skipSilence()), the
+// dynamics right away, the EQ once its filters have rung out.
+
+namespace MultiChannelDetail {
+
+    using Vec = juce::dsp::SIMDRegister<float>;
+
+    static constexpr int Width = (int) Vec::SIMDNumElements;
+    static constexpr int MaxChannels = 64;
+    static constexpr int MaxGroups = (MaxChannels + Width - 1) / Width;
+    static constexpr int ChunkSize = 64;
+
+    // the channels [chan, chan + Width) of the chunk, interleaved one sample per register
+    struct LaneBuffer
+    {
+        void gather(float * const * chans, int numChans, int chan, int offset, int count)
+        {
+            const int used = jmin(Width, numChans - chan);
+            for (int lane=0; lane < Width; ++lane) {
+                if (lane < used) {
+                    const float * src = chans[chan + lane] + offset;
+                    for (int i=0; i < count; ++i) {
+                        data[i * Width + lane] = src[i];
+                    }
+                } else {
+                    for (int i=0; i < count; ++i) {
+                        data[i * Width + lane] = 0.0f;
+                    }
+                }
+            }
+        }
+
+        void scatter(float * const * chans, int numChans, int chan, int offset, int count) const
+        {
+            const int used = jmin(Width, numChans - chan);
+            for (int lane=0; lane < used; ++lane) {
+                float * dest = chans[chan + lane] + offset;
+                for (int i=0; i < count; ++i) {
+                    dest[i] = data[i * Width + lane];
+                }
+            }
+        }
+
+        Vec get(int i) const { return Vec::fromRawArray(data + i * Width); }
+        void set(int i, Vec v) { v.copyToRawArray(data + i * Width); }
+
+        alignas(Vec::SIMDRegisterSize) float data[ChunkSize * Width];
+    };
+
+    inline float horizontalMax(const float * lanes)
+    {
+        float m = lanes[0];
+        for (int lane=1; lane < Width; ++lane) {
+            m = jmax(m, lanes[lane]);
+        }
+        return m;
+    }
+
+    inline float smoothingCoef(float timeConst, float samplePeriod)
+    {
+        const float t = jmax(samplePeriod, timeConst);
+        return std::fabs(t) < 1.1920929e-07f ? 0.0f : std::exp(-(samplePeriod / t));
+    }
+
+    // about -140 dB, nothing below this is audible even with a lot of makeup gain
+    static constexpr float SilenceLevel = 1e-7f;
+
+    inline bool isSilent(const float * const * chans, int numChans, int count)
+    {
+        for (int chan=0; chan < numChans; ++chan) {
+            const auto range = FloatVectorOperations::findMinAndMax(chans[chan], count);
+            if (range.getStart() < -SilenceLevel || range.getEnd() > SilenceLevel) return false;
+        }
+        return true;
+    }
+
+    inline float horizontalMax(Vec v)
+    {
+        float m = v.get(0);
+        for (size_t lane=1; lane < (size_t) Width; ++lane) {
+            m = jmax(m, v.get(lane));
+        }
+        return m;
+    }
+
+    // where a one pole smoother x = target + coef * (x - target) ends up after count samples
+    inline float advanceSmoother(float x, float target, float coef, int count)
+    {
+        return target + (x - target) * std::pow(coef, (float) count);
+    }
+}
+
+// linked compressor or expander (the same as faustCompressor and faustExpander
+// for one or two channels): every channel has its own peak envelope follower,
+// the loudest one drives the gain of all of them
+class MultiChannelDynamics
+{
+public:
+    enum Mode {
+        Compressor = 0,
+        Expander
+    };
+
+    MultiChannelDynamics(Mode mode_ = Compressor) : mode(mode_) {}
+
+    void init(int sampleRate)
+    {
+        samplePeriod = 1.0f / jlimit(1.0f, 192000.0f, (float) sampleRate);
+
+        if (mode == Compressor) {
+            attack = 0.002f;
+            knee = 3.0f;
+            makeupGain = 0.0f;
+            ratio = 2.0f;
+            release = 0.5f;
+            threshold = -20.0f;
+        } else {
+            attack = 0.001f;
+            knee = 3.0f;
+            ratio = 2.0f;
+            release = 0.1f;
+            threshold = -40.0f;
+        }
+        gainBargraph = 0.0f;
+
+        clear();
+    }
+
+    void clear()
+    {
+        for (auto & env : envelopes) {
+            env = MultiChannelDetail::Vec::expand(0.0f);
+        }
+        smoothMakeup = 0.0f;
+    }
+
+    void buildUserInterface(UI * ui)
+    {
+        if (mode == Compressor) {
+            ui->openVerticalBox("compressor");
+            ui->addHorizontalSlider("attack", &attack, 0.002f, 0.0f, 1.0f, 0.001f);
+            ui->addHorizontalSlider("knee", &knee, 3.0f, 0.0f, 20.0f, 0.1f);
+            ui->addHorizontalSlider("makeup gain", &makeupGain, 0.0f, -96.0f, 96.0f, 0.1f);
+            ui->addHorizontalBargraph("outgain", &gainBargraph, -96.0f, 0.0f);
+            ui->addHorizontalSlider("ratio", &ratio, 2.0f, 1.0f, 20.0f, 0.1f);
+            ui->addHorizontalSlider("release", &release, 0.5f, 0.0f, 10.0f, 0.01f);
+            ui->addHorizontalSlider("threshold", &threshold, -20.0f, -96.0f, 10.0f, 0.1f);
+        } else {
+            ui->openVerticalBox("expander");
+            ui->addHorizontalSlider("attack", &attack, 0.001f, 0.0f, 1.0f, 0.001f);
+            ui->addHorizontalBargraph("gain", &gainBargraph, -96.0f, 0.0f);
+            ui->addHorizontalSlider("knee", &knee, 3.0f, 0.0f, 20.0f, 0.1f);
+            ui->addHorizontalSlider("ratio", &ratio, 2.0f, 1.0f, 20.0f, 0.1f);
+            ui->addHorizontalSlider("release", &release, 0.1f, 0.0f, 10.0f, 0.01f);
+            ui->addHorizontalSlider("threshold", &threshold, -40.0f, -96.0f, 10.0f, 0.1f);
+        }
+        ui->closeBox();
+    }
+
+    // in place on up to MultiChannelDetail::MaxChannels channels
+    void process(float * const * chans, int numChans, int count)
+    {
+        using namespace MultiChannelDetail;
+
+        numChans = jmin(numChans, MaxChannels);
+        if (numChans <= 0) return;
+
+        const float attackCoef = smoothingCoef(attack, samplePeriod);
+        const float releaseCoef = smoothingCoef(release, samplePeriod);
+        const Vec vattack = Vec::expand(attackCoef);
+        const Vec vdiff = Vec::expand(releaseCoef - attackCoef);
+        const float slope = 1.0f - ratio;
+        const float invKnee = 1.0f / (knee + 0.001f);
+        const float makeupTarget = 0.001f * makeupGain;
+
+        for (int offset=0; offset < count; offset += ChunkSize) {
+            const int num = jmin(ChunkSize, count - offset);
+
+            // peak envelopes, the maximum over all channels ends up in levels
+            for (int chan=0, group=0; chan < numChans; chan += Width, ++group) {
+                lanes.gather(chans, numChans, chan, offset, num);
+                Vec env = envelopes[group];
+
+                for (int i=0; i < num; ++i) {
+                    const Vec absval = Vec::abs(lanes.get(i));
+                    // release while falling, attack while rising
+                    const Vec coef = vattack + (vdiff & Vec::greaterThan(env, absval));
+                    env = absval + coef * (env - absval);
+                    levels.set(i, group == 0 ? env : Vec::max(levels.get(i), env));
+                }
+
+                envelopes[group] = env;
+            }
+
+            // the gain computer, once per sample for all channels
+            for (int i=0; i < num; ++i) {
+                const float leveldb = 20.0f * std::log10(horizontalMax(levels.data + i * Width));
+                const float reduction = gainReduction(leveldb, slope, invKnee);
+
+                if (mode == Compressor) {
+                    smoothMakeup = makeupTarget + 0.999f * smoothMakeup;
+                    gains[i] = std::pow(10.0f, 0.05f * (smoothMakeup + reduction));
+                } else {
+                    gains[i] = std::pow(10.0f, 0.05f * reduction);
+                }
+                gainBargraph = reduction;
+            }
+
+            for (int chan=0; chan < numChans; ++chan) {
+                FloatVectorOperations::multiply(chans[chan] + offset, gains, num);
+            }
+        }
+    }
+
+    // instead of process() for a block of silent input, which is left as it is: the
+    // envelopes just release and the makeup gain keeps moving, so we only move them
+    // along to where processing the block would have left them
+    void skipSilence(int numChans, int count)
+    {
+        using namespace MultiChannelDetail;
+
+        numChans = jmin(numChans, MaxChannels);
+        if (numChans <= 0) return;
+
+        const Vec decay = Vec::expand(std::pow(smoothingCoef(release, samplePeriod), (float) count));
+        float level = 0.0f;
+        for (int chan=0, group=0; chan < numChans; chan += Width, ++group) {
+            envelopes[group] = envelopes[group] * decay;
+            level = jmax(level, horizontalMax(envelopes[group]));
+        }
+
+        if (mode == Compressor) {
+            smoothMakeup = advanceSmoother(smoothMakeup, makeupGain, 0.999f, count);
+        }
+        gainBargraph = gainReduction(20.0f * std::log10(level), 1.0f - ratio, 1.0f / (knee + 0.001f));
+    }
+
+private:
+    float gainReduction(float leveldb, float slope, float invKnee) const
+    {
+        if (mode == Compressor) {
+            const float over = jmax(0.0f, knee + leveldb - threshold);
+            const float kneepos = jlimit(0.0f, 1.0f, invKnee * over);
+            return slope * ((over * kneepos) / (1.0f - slope * kneepos));
+        }
+        const float under = jmax(0.0f, (threshold + knee) - leveldb);
+        return slope * (under * jlimit(0.0f, 1.0f, invKnee * under));
+    }
+
+    const Mode mode;
+    float samplePeriod = 1.0f / 48000.0f;
+
+    // UI zones
+    float attack = 0.0f;
+    float knee = 0.0f;
+    float makeupGain = 0.0f;
+    float ratio = 1.0f;
+    float release = 0.0f;
+    float threshold = 0.0f;
+    float gainBargraph = 0.0f;
+
+    float smoothMakeup = 0.0f;
+    MultiChannelDetail::Vec envelopes[MultiChannelDetail::MaxGroups];
+    MultiChannelDetail::LaneBuffer lanes;
+    MultiChannelDetail::LaneBuffer levels;
+    float gains[MultiChannelDetail::ChunkSize];
+};
+
+
+// the Faust parametric EQ (low shelf, two peaking sections, high shelf) for
+// all channels at once, with the same parameter smoothing as faustParametricEQ
+class MultiChannelParametricEQ
+{
+public:
+    void init(int sampleRate)
+    {
+        const float sr = jlimit(1.0f, 192000.0f, (float) sampleRate);
+        piOverSr = 3.14159274f / sr;
+        twoPiOverSr = 6.28318548f / sr;
+
+        lowShelfFreq = 200.0f;
+        lowShelfGain = 0.0f;
+        para1Freq = 400.0f;
+        para1Gain = 0.0f;
+        para1Q = 40.0f;
+        para2Freq = 800.0f;
+        para2Gain = 0.0f;
+        para2Q = 40.0f;
+        highShelfFreq = 8000.0f;
+        highShelfGain = 0.0f;
+
+        clear();
+    }
+
+    void clear()
+    {
+        for (auto & state : states) {
+            state.clear();
+        }
+        for (auto & s : smoothed) {
+            s = 0.0f;
+        }
+        haveCoefs = false;
+    }
+
+    void buildUserInterface(UI * ui)
+    {
+        ui->openHorizontalBox("parametric eq");
+        ui->openVerticalBox("low shelf");
+        ui->addHorizontalSlider("gain", &lowShelfGain, 0.0f, -40.0f, 40.0f, 0.1f);
+        ui->addHorizontalSlider("transition freq", &lowShelfFreq, 200.0f, 1.0f, 5000.0f, 1.0f);
+        ui->closeBox();
+        ui->openVerticalBox("para1");
+        ui->addHorizontalSlider("peak gain", &para1Gain, 0.0f, -40.0f, 40.0f, 0.1f);
+        ui->addHorizontalSlider("peak frequency", &para1Freq, 400.0f, 40.0f, 10000.0f, 1.0f);
+        ui->addHorizontalSlider("peak q", &para1Q, 40.0f, 1.0f, 1000.0f, 0.1f);
+        ui->closeBox();
+        ui->openVerticalBox("para2");
+        ui->addHorizontalSlider("peak gain", &para2Gain, 0.0f, -40.0f, 40.0f, 0.1f);
+        ui->addHorizontalSlider("peak frequency", &para2Freq, 800.0f, 40.0f, 10000.0f, 1.0f);
+        ui->addHorizontalSlider("peak q", &para2Q, 40.0f, 1.0f, 1000.0f, 0.1f);
+        ui->closeBox();
+        ui->openVerticalBox("high shelf");
+        ui->addHorizontalSlider("gain", &highShelfGain, 0.0f, -40.0f, 40.0f, 0.1f);
+        ui->addHorizontalSlider("transition freq", &highShelfFreq, 8000.0f, 20.0f, 10000.0f, 1.0f);
+        ui->closeBox();
+        ui->closeBox();
+    }
+
+    // in place on up to MultiChannelDetail::MaxChannels channels
+    void process(float * const * chans, int numChans, int count)
+    {
+        using namespace MultiChannelDetail;
+
+        numChans = jmin(numChans, MaxChannels);
+        if (numChans <= 0) return;
+
+        for (int offset=0; offset < count; offset += ChunkSize) {
+            const int num = jmin(ChunkSize, count - offset);
+
+            for (int i=0; i < num; ++i) {
+                updateCoefs(coefs[i]);
+            }
+
+            for (int chan=0, group=0; chan < numChans; chan += Width, ++group) {
+                lanes.gather(chans, numChans, chan, offset, num);
+                filterLanes(states[group], num);
+                lanes.scatter(chans, numChans, chan, offset, num);
+            }
+        }
+    }
+
+    // true when the filters of the first numChans channels have rung out
+    bool isSettled(int numChans) const
+    {
+        using namespace MultiChannelDetail;
+
+        numChans = jmin(numChans, MaxChannels);
+        for (int chan=0, group=0; chan < numChans; chan += Width, ++group) {
+            if (!states[group].isSilent()) return false;
+        }
+        return true;
+    }
+
+    // instead of process() for a block of silent input once isSettled(), the input is
+    // left as it is and only the parameter smoothing moves on
+    void skipSilence(int numChans, int count)
+    {
+        using namespace MultiChannelDetail;
+
+        numChans = jmin(numChans, MaxChannels);
+        for (int chan=0, group=0; chan < numChans; chan += Width, ++group) {
+            states[group].clear();
+        }
+
+        // sample by sample, so it ends up exactly where process() would have left it
+        float targets[NumSmoothed];
+        getTargets(targets);
+        for (int i=0; i < count; ++i) {
+            bool changed = false;
+            for (int k=0; k < NumSmoothed; ++k) {
+                const float s = 0.001f * targets[k] + 0.999f * smoothed[k];
+                changed = changed || s != smoothed[k];
+                smoothed[k] = s;
+            }
+            if (!changed) break;
+            haveCoefs = false;
+        }
+    }
+
+private:
+    using Vec = MultiChannelDetail::Vec;
+
+    // per sample, shared by all channels
+    struct Coefs {
+        // low shelf
+        float lsK0, lsInvT1, lsInvT3, lsT4, lsT5, ls2T7, lsInvT8, lsInvT6, lsGain;
+        // peaking sections
+        float p1K16, p1A17, p1InvT17, p1B1, p1B2;
+        float p2K26, p2A27, p2InvT27, p2C1, p2C2;
+        // high shelf
+        float hsK0, hsInvT31, hsInvT33, hsT34, hsT35, hs2T37, hsInvT38, hsInvT36, hsGain;
+    };
+
+    // one lane per channel, names follow the generated code
+    struct State {
+        void clear() {
+            for (auto * v : { &vec0, &rec5, &rec4a, &rec4b, &rec8, &rec7a, &rec7b, &rec3a, &rec3b,
+                              &rec2a, &rec2b, &vec1, &rec1, &rec0a, &rec0b, &rec18, &rec17a, &rec17b }) {
+                *v = Vec::expand(0.0f);
+            }
+        }
+        bool isSilent() const {
+            for (auto v : { vec0, rec5, rec4a, rec4b, rec8, rec7a, rec7b, rec3a, rec3b,
+                            rec2a, rec2b, vec1, rec1, rec0a, rec0b, rec18, rec17a, rec17b }) {
+                if (MultiChannelDetail::horizontalMax(Vec::abs(v)) > MultiChannelDetail::SilenceLevel) return false;
+            }
+            return true;
+        }
+        // a: one sample ago, b: two samples ago
+        Vec vec0, rec5, rec4a, rec4b, rec8, rec7a, rec7b, rec3a, rec3b;
+        Vec rec2a, rec2b, vec1, rec1, rec0a, rec0b, rec18, rec17a, rec17b;
+    };
+
+    enum {
+        SmoothLowShelfFreq = 0,
+        SmoothLowShelfGain,
+        SmoothPara1Freq,
+        SmoothPara1Gain,
+        SmoothPara2Freq,
+        SmoothPara2Gain,
+        SmoothPara2Q,
+        SmoothHighShelfFreq,
+        SmoothHighShelfGain,
+        NumSmoothed
+    };
+
+    void getTargets(float * targets) const
+    {
+        const float t[NumSmoothed] = { lowShelfFreq, lowShelfGain, para1Freq, para1Gain,
+                                       para2Freq, para2Gain, para2Q, highShelfFreq, highShelfGain };
+        std::copy(t, t + NumSmoothed, targets);
+    }
+
+    void updateCoefs(Coefs & c)
+    {
+        float targets[NumSmoothed];
+        getTargets(targets);
+        bool changed = !haveCoefs || para1Q != lastPara1Q;
+        for (int k=0; k < NumSmoothed; ++k) {
+            const float s = 0.001f * targets[k] + 0.999f * smoothed[k];
+            changed = changed || s != smoothed[k];
+            smoothed[k] = s;
+        }
+
+        if (!changed) {
+            // settled, the trigonometry would give the same again
+            c = lastCoefs;
+            return;
+        }
+
+        const float lsfreq = smoothed[SmoothLowShelfFreq];
+        const float p1freq = smoothed[SmoothPara1Freq];
+        const float p1gain = smoothed[SmoothPara1Gain];
+        const float p2freq = smoothed[SmoothPara2Freq];
+        const float p2gain = smoothed[SmoothPara2Gain];
+        const float hsfreq = smoothed[SmoothHighShelfFreq];
+
+        // low shelf
+        {
+            const float t1 = std::tan(piOverSr * lsfreq);
+            const float t2 = 1.0f / t1;
+            const float t3 = t2 + 1.0f;
+            const float t6 = t1 * t1;
+            c.lsK0 = -(1.0f / (t1 * t3));
+            c.lsInvT1 = t2;
+            c.lsInvT3 = 1.0f / t3;
+            c.lsT4 = 1.0f - t2;
+            c.lsT5 = ((t2 - 1.0f) / t1) + 1.0f;
+            c.ls2T7 = 2.0f * (1.0f - (1.0f / t6));
+            c.lsInvT8 = 1.0f / (((t2 + 1.0f) / t1) + 1.0f);
+            c.lsInvT6 = 1.0f / t6;
+            c.lsGain = std::pow(10.0f, 0.05f * smoothed[SmoothLowShelfGain]);
+        }
+
+        // first peaking section, unsmoothed Q
+        {
+            const float t9 = std::tan(piOverSr * p1freq);
+            const float t10 = 1.0f / t9;
+            const float t12 = std::sin(twoPiOverSr * p1freq);
+            const float qscale = piOverSr / para1Q;
+            const float t13 = qscale * ((p1freq * std::pow(10.0f, 0.05f * std::fabs(p1gain))) / t12);
+            const float t14 = qscale * (p1freq / t12);
+            const bool boost = p1gain > 0.0f;
+            const float t15 = boost ? t14 : t13;
+            const float t18 = boost ? t13 : t14;
+            c.p1K16 = 2.0f * (1.0f - (1.0f / (t9 * t9)));
+            c.p1A17 = ((t10 - t15) / t9) + 1.0f;
+            c.p1InvT17 = 1.0f / (((t10 + t15) / t9) + 1.0f);
+            c.p1B1 = ((t10 + t18) / t9) + 1.0f;
+            c.p1B2 = ((t10 - t18) / t9) + 1.0f;
+        }
+
+        // second peaking section
+        {
+            const float t19 = std::tan(piOverSr * p2freq);
+            const float t20 = 1.0f / t19;
+            const float t22 = smoothed[SmoothPara2Q] * std::sin(twoPiOverSr * p2freq);
+            const float t23 = piOverSr * ((p2freq * std::pow(10.0f, 0.05f * std::fabs(p2gain))) / t22);
+            const float t24 = piOverSr * (p2freq / t22);
+            const bool boost = p2gain > 0.0f;
+            const float t25 = boost ? t24 : t23;
+            const float t28 = boost ? t23 : t24;
+            c.p2K26 = 2.0f * (1.0f - (1.0f / (t19 * t19)));
+            c.p2A27 = ((t20 - t25) / t19) + 1.0f;
+            c.p2InvT27 = 1.0f / (((t20 + t25) / t19) + 1.0f);
+            c.p2C1 = ((t20 + t28) / t19) + 1.0f;
+            c.p2C2 = ((t20 - t28) / t19) + 1.0f;
+        }
+
+        // high shelf
+        {
+            const float t31 = std::tan(piOverSr * hsfreq);
+            const float t32 = 1.0f / t31;
+            const float t33 = t32 + 1.0f;
+            const float t36 = t31 * t31;
+            c.hsK0 = -(1.0f / (t31 * t33));
+            c.hsInvT31 = t32;
+            c.hsInvT33 = 1.0f / t33;
+            c.hsT34 = 1.0f - t32;
+            c.hsT35 = ((t32 - 1.0f) / t31) + 1.0f;
+            c.hs2T37 = 2.0f * (1.0f - (1.0f / t36));
+            c.hsInvT38 = 1.0f / (((t32 + 1.0f) / t31) + 1.0f);
+            c.hsInvT36 = 1.0f / t36;
+            c.hsGain = std::pow(10.0f, 0.05f * smoothed[SmoothHighShelfGain]);
+        }
+
+        lastCoefs = c;
+        lastPara1Q = para1Q;
+        haveCoefs = true;
+    }
+
+    void filterLanes(State & s, int num)
+    {
+        const Vec two = Vec::expand(2.0f);
+
+        for (int i=0; i < num; ++i) {
+            const Coefs & c = coefs[i];
+            const Vec x = lanes.get(i);
+
+            // low shelf, as the sum of a low and high passed branch
+            const Vec lsT4 = Vec::expand(c.lsT4);
+            const Vec lsT5 = Vec::expand(c.lsT5);
+            const Vec ls2T7 = Vec::expand(c.ls2T7);
+            const Vec lsInvT3 = Vec::expand(c.lsInvT3);
+            const Vec lsInvT8 = Vec::expand(c.lsInvT8);
+
+            const Vec rec5 = s.vec0 * Vec::expand(c.lsK0) - (s.rec5 * lsT4 - x * Vec::expand(c.lsInvT1)) * lsInvT3;
+            const Vec rec4 = rec5 - (s.rec4b * lsT5 + s.rec4a * ls2T7) * lsInvT8;
+            const Vec rec8 = (x + s.vec0 - s.rec8 * lsT4) * lsInvT3;
+            const Vec rec7 = rec8 - (s.rec7b * lsT5 + s.rec7a * ls2T7) * lsInvT8;
+            const Vec lsout = ((rec4 + s.rec4b - s.rec4a * two) * Vec::expand(c.lsInvT6)
+                               + (rec7 + s.rec7b + s.rec7a * two) * Vec::expand(c.lsGain)) * lsInvT8;
+
+            // peaking sections
+            const Vec p1InvT17 = Vec::expand(c.p1InvT17);
+            const Vec p2InvT27 = Vec::expand(c.p2InvT27);
+
+            const Vec t16 = s.rec3a * Vec::expand(c.p1K16);
+            const Vec rec3 = lsout - (s.rec3b * Vec::expand(c.p1A17) + t16) * p1InvT17;
+            const Vec t26 = s.rec2a * Vec::expand(c.p2K26);
+            const Vec rec2 = (t16 + rec3 * Vec::expand(c.p1B1) + s.rec3b * Vec::expand(c.p1B2)) * p1InvT17
+                             - (s.rec2b * Vec::expand(c.p2A27) + t26) * p2InvT27;
+            const Vec t30 = (t26 + rec2 * Vec::expand(c.p2C1) + s.rec2b * Vec::expand(c.p2C2)) * p2InvT27;
+
+            // high shelf
+            const Vec hsT34 = Vec::expand(c.hsT34);
+            const Vec hsT35 = Vec::expand(c.hsT35);
+            const Vec hs2T37 = Vec::expand(c.hs2T37);
+            const Vec hsInvT33 = Vec::expand(c.hsInvT33);
+            const Vec hsInvT38 = Vec::expand(c.hsInvT38);
+
+            const Vec rec1 = s.vec1 * Vec::expand(c.hsK0) + (t30 * Vec::expand(c.hsInvT31) - s.rec1 * hsT34) * hsInvT33;
+            const Vec rec0 = rec1 - (s.rec0b * hsT35 + s.rec0a * hs2T37) * hsInvT38;
+            const Vec rec18 = (t30 + s.vec1 - s.rec18 * hsT34) * hsInvT33;
+            const Vec rec17 = rec18 - (s.rec17b * hsT35 + s.rec17a * hs2T37) * hsInvT38;
+
+            lanes.set(i, ((rec0 + s.rec0b - s.rec0a * two) * Vec::expand(c.hsInvT36) * Vec::expand(c.hsGain)
+                          + (rec17 + s.rec17b + s.rec17a * two)) * hsInvT38);
+
+            s.vec0 = x;
+            s.rec5 = rec5;
+            s.rec4b = s.rec4a; s.rec4a = rec4;
+            s.rec8 = rec8;
+            s.rec7b = s.rec7a; s.rec7a = rec7;
+            s.rec3b = s.rec3a; s.rec3a = rec3;
+            s.rec2b = s.rec2a; s.rec2a = rec2;
+            s.vec1 = t30;
+            s.rec1 = rec1;
+            s.rec0b = s.rec0a; s.rec0a = rec0;
+            s.rec18 = rec18;
+            s.rec17b = s.rec17a; s.rec17a = rec17;
+        }
+    }
+
+    float piOverSr = 0.0f;
+    float twoPiOverSr = 0.0f;
+
+    // UI zones
+    float lowShelfFreq = 200.0f;
+    float lowShelfGain = 0.0f;
+    float para1Freq = 400.0f;
+    float para1Gain = 0.0f;
+    float para1Q = 40.0f;
+    float para2Freq = 800.0f;
+    float para2Gain = 0.0f;
+    float para2Q = 40.0f;
+    float highShelfFreq = 8000.0f;
+    float highShelfGain = 0.0f;
+
+    float smoothed[NumSmoothed] = {};
+    float lastPara1Q = 0.0f;
+    bool haveCoefs = false;
+    Coefs lastCoefs;
+    Coefs coefs[MultiChannelDetail::ChunkSize];
+
+    State states[MultiChannelDetail::MaxGroups];
+    MultiChannelDetail::LaneBuffer lanes;
+};
+
+
+// tells when an effect with a long tail (the reverbs) can be left alone: once its
+// input is silent and its output has stayed silent for longer than any of its
+// internal delays, running it would only produce more silence
+class EffectTailGate
+{
+public:
+    void prepare(double sampleRate, double holdSeconds)
+    {
+        holdSamples = jmax(1, (int) (sampleRate * holdSeconds));
+        reset();
+    }
+
+    void reset() { quietSamples = 0; }
+
+    // whether the effect has to run for a block with this input
+    bool isNeeded(bool inputSilent) const { return !inputSilent || quietSamples < holdSamples; }
+
+    // after running it, outputSilent only counts if the input was silent as well
+    void update(int numSamples, bool outputSilent)
+    {
+        quietSamples = outputSilent ? jmin(holdSamples, quietSamples + numSamples) : 0;
+    }
+
+private:
+    int holdSamples = 1;
+    int quietSamples = 0;
+};
+
+} // namespace SonoAudio
@@ -165,6 +165,14 @@ OptionsView::OptionsView(SonobusAudioProcessor& proc, std::function<AudioDeviceM
     mOptionsRecFinishOpenButton = std::make_unique<ToggleButton>(TRANS("Open finished recording for playback"));
     mOptionsRecFinishOpenButton->addListener(this);
 
+    mOptionsDoubleEnderRecordButton = std::make_unique<ToggleButton>(TRANS("Double-ender: record yourself for the session host"));
+    mOptionsDoubleEnderRecordButton->addListener(this);
+    mOptionsDoubleEnderRecordButton->setTooltip(TRANS("While a connected session host that collects double-ender recordings is recording, your own input is recorded here losslessly as well, into the Double-Ender folder of the record location. Once they stop it is uploaded to them in the background, so their final multitrack doesn't depend on what the live stream got through."));
+
+    mOptionsDoubleEnderCollectButton = std::make_unique<ToggleButton>(TRANS("Double-ender: collect the recordings of others"));
+    mOptionsDoubleEnderCollectButton->addListener(this);
+    mOptionsDoubleEnderCollectButton->setTooltip(TRANS("As the session host, the others with double-ender recording enabled record themselves while you record, and upload it to you afterwards. The uploads go into the Double-Ender folder of the record location, along with a copy of each lined up with the start of your recording. Needs TCP port 11476 to be reachable for those not on your local network."));
+
 
     mOptionsRecFilesStaticLabel = std::make_unique<Label>("", TRANS("Record feature creates the following files:"));
     configLabel(mOptionsRecFilesStaticLabel.get(), false);
@@ -236,6 +244,11 @@ OptionsView::OptionsView(SonobusAudioProcessor& proc, std::function<AudioDeviceM
     mOptionsDisableShortcutButton = std::make_unique<ToggleButton>(TRANS("Disable keyboard shortcuts"));
     mOptionsDisableShortcutButton->addListener(this);
 
+#if JUCE_OPENGL && !JUCE_ANDROID
+    mOptionsUseOpenGLButton = std::make_unique<ToggleButton>(TRANS("Draw with OpenGL (less CPU for meters)"));
+    mOptionsUseOpenGLButton->addListener(this);
+#endif
+
 #if JUCE_IOS
     if (JUCEApplicationBase::isStandaloneApp()) {
         mOptionsAllowBluetoothInput = std::make_unique<ToggleButton>(TRANS("Allow Bluetooth Input"));
@@ -246,6 +259,90 @@ OptionsView::OptionsView(SonobusAudioProcessor& proc, std::function<AudioDeviceM
     mOptionsInputLimiterButton = std::make_unique<ToggleButton>(TRANS("Use Input FX Limiter"));
     mOptionsInputLimiterButton->addListener(this);
 
+    mOptionsRealtimeNetThreadsButton = std::make_unique<ToggleButton>(TRANS("Real-time network threads"));
+    mOptionsRealtimeNetThreadsButton->addListener(this);
+    mOptionsRealtimeNetThreadsButton->setTooltip(TRANS("Runs the network send and receive threads at real-time priority, so they don't get delayed behind other work on a busy machine. On Linux this requires permission to use real-time scheduling. The cores field optionally pins those threads to specific CPU cores, for example 2,3 or 2-3. Leave it empty to use any core."));
+
+    mOptionsInlineSendButton = std::make_unique<ToggleButton>(TRANS("Send directly from the audio thread"));
+    mOptionsInlineSendButton->addListener(this);
+    mOptionsInlineSendButton->setTooltip(TRANS("Sends the audio as soon as it is encoded, instead of handing it to the network send thread first, which saves a little latency on every packet. Only for PCM and Opus, and Opus is encoded at a lower complexity while this is on. It adds to the audio processing load, so it is best for fast machines on a LAN."));
+
+    mOptionsEnsembleAlignButton = std::make_unique<ToggleButton>(TRANS("Align everyone to a common latency"));
+    mOptionsEnsembleAlignButton->addListener(this);
+    mOptionsEnsembleAlignButton->setTooltip(TRANS("Pads the jitter buffers so that everyone in the group who has this on hears everyone else with the same delay, the lowest one that works for the slowest connection. Only that connection keeps trimming its buffer, and everyone follows it down."));
+
+    mOptionsSessionRateButton = std::make_unique<ToggleButton>(TRANS("Send at the group's most common sample rate"));
+    mOptionsSessionRateButton->addListener(this);
+    mOptionsSessionRateButton->setTooltip(TRANS("When the audio devices in the group run at different sample rates, everyone sends at the rate most of them use. A different rate is then converted once before sending, instead of separately for every stream at each receiving end."));
+
+    mOptionsShareBackingTrackButton = std::make_unique<ToggleButton>(TRANS("Share backing tracks as files"));
+    mOptionsShareBackingTrackButton->addListener(this);
+    mOptionsShareBackingTrackButton->setTooltip(TRANS("A file you send as playback audio goes to the others in the background, once, and each of them plays their own copy in time with yours instead of getting it streamed. While someone doesn't have it yet, it is streamed as before. Also lets you play the ones the others share, they are kept in the \"Backing Tracks\" folder next to your recordings."));
+
+    mOptionsCodecCpuBudgetButton = std::make_unique<ToggleButton>(TRANS("Keep codecs within the CPU budget"));
+    mOptionsCodecCpuBudgetButton->addListener(this);
+    mOptionsCodecCpuBudgetButton->setTooltip(TRANS("What each send quality costs on this device is measured once. With this on, the quality sent to peers is lowered when encoding and decoding for everyone would take too much of the CPU, and raised again when there is room."));
+
+    mOptionsBounceCaptureButton = std::make_unique<ToggleButton>(TRANS("Offline bounces use what was heard"));
+    mOptionsBounceCaptureButton->addListener(this);
+    mOptionsBounceCaptureButton->setTooltip(TRANS("Keeps what the other users sounded like while the host played, in a temporary file. An offline bounce plays them back from there instead of from the network, so it comes out like the take without dropouts. Nothing is sent to the others during the bounce."));
+
+    mOptionsReverbRateLabel = std::make_unique<Label>("", TRANS("Reverb sample rate:"));
+    configLabel(mOptionsReverbRateLabel.get(), false);
+    mOptionsReverbRateLabel->setJustificationType(Justification::centredLeft);
+    mOptionsReverbRateLabel->setAccessible(false);
+
+    mOptionsReverbRateChoice = std::make_unique<SonoChoiceButton>();
+    mOptionsReverbRateChoice->setTitle(TRANS("Reverb sample rate:"));
+    mOptionsReverbRateChoice->addChoiceListener(this);
+    mOptionsReverbRateChoice->addItem(TRANS("Full"), SonobusAudioProcessor::ReverbRateFull);
+    mOptionsReverbRateChoice->addItem(TRANS("Half"), SonobusAudioProcessor::ReverbRateHalf);
+    mOptionsReverbRateChoice->addItem(TRANS("Quarter"), SonobusAudioProcessor::ReverbRateQuarter);
+    mOptionsReverbRateChoice->setTooltip(TRANS("Runs the main and input reverbs at a half or a quarter of the audio device sample rate (but never below 22 kHz), the dry sound isn't touched. At 88.2 kHz and up this takes more than half of the work out of the reverbs, with the tail only losing what is too high to matter."));
+
+    mOptionsPowerSavingButton = std::make_unique<ToggleButton>(TRANS("Save battery while idle"));
+    mOptionsPowerSavingButton->addListener(this);
+    mOptionsPowerSavingButton->setTooltip(TRANS("While no audio is being sent or received, the network threads wake up less often and the other users are pinged less frequently, all at once, so the device can sleep in between. Reconnections and status updates can take a little longer to show up."));
+
+    mOptionsPeerTelemetryButton = std::make_unique<ToggleButton>(TRANS("Record network telemetry"));
+    mOptionsPeerTelemetryButton->addListener(this);
+    mOptionsPeerTelemetryButton->setTooltip(TRANS("Logs the arrival time of every packet from each user, the resends and the dropouts, to a file per user in the Telemetry folder of the recording location. Meant for troubleshooting, it is not remembered the next time."));
+
+    mOptionsTimelineTraceButton = std::make_unique<ToggleButton>(TRANS("Record timeline trace"));
+    mOptionsTimelineTraceButton->addListener(this);
+    mOptionsTimelineTraceButton->setTooltip(TRANS("Records what the audio and network threads are doing, and the path of every received packet through them. Turning it off saves the last several seconds as a trace file in the Telemetry folder of the recording location, which can be opened in ui.perfetto.dev. Meant for troubleshooting, it is not remembered the next time."));
+
+    mOptionsNetThreadCoresEditor = std::make_unique<TextEditor>("netcores");
+    mOptionsNetThreadCoresEditor->addListener(this);
+    mOptionsNetThreadCoresEditor->setFont(Font(16));
+    mOptionsNetThreadCoresEditor->setInputRestrictions(32, "0123456789,-");
+    mOptionsNetThreadCoresEditor->setTextToShowWhenEmpty(TRANS("any cores"), Colour(0x44ffffff));
+    mOptionsNetThreadCoresEditor->setTitle(TRANS("Network thread cores"));
+
+    configEditor(mOptionsNetThreadCoresEditor.get());
+
+    mOptionsRecvPollLabel = std::make_unique<Label>("", TRANS("Network receive:"));
+    configLabel(mOptionsRecvPollLabel.get(), false);
+    mOptionsRecvPollLabel->setJustificationType(Justification::centredLeft);
+    mOptionsRecvPollLabel->setAccessible(false);
+
+    mOptionsRecvPollChoice = std::make_unique<SonoChoiceButton>();
+    mOptionsRecvPollChoice->setTitle(TRANS("Network receive:"));
+    mOptionsRecvPollChoice->addChoiceListener(this);
+    mOptionsRecvPollChoice->addItem(TRANS("Blocking"), SonobusAudioProcessor::ReceivePollBlocking);
+    mOptionsRecvPollChoice->addItem(TRANS("Hybrid"), SonobusAudioProcessor::ReceivePollHybrid);
+    mOptionsRecvPollChoice->addItem(TRANS("Busy poll"), SonobusAudioProcessor::ReceivePollBusy);
+    mOptionsRecvPollChoice->setTooltip(TRANS("How the network receive thread waits for packets. Blocking lets it sleep until one arrives, which is right for almost everyone. Busy poll never lets it sleep, so packets are picked up without the wakeup delay, at the cost of keeping a whole CPU core busy. Only use it on a dedicated machine, ideally with the core field set to a core that nothing else runs on (e.g. isolated with isolcpus on Linux). Hybrid keeps polling for a couple of milliseconds after each packet and sleeps when it gets quiet."));
+
+    mOptionsRecvCoreEditor = std::make_unique<TextEditor>("recvcore");
+    mOptionsRecvCoreEditor->addListener(this);
+    mOptionsRecvCoreEditor->setFont(Font(16));
+    mOptionsRecvCoreEditor->setInputRestrictions(2, "0123456789");
+    mOptionsRecvCoreEditor->setTextToShowWhenEmpty(TRANS("any core"), Colour(0x44ffffff));
+    mOptionsRecvCoreEditor->setTitle(TRANS("Receive thread core"));
+
+    configEditor(mOptionsRecvCoreEditor.get());
+
     mOptionsChangeAllFormatButton = std::make_unique<ToggleButton>(TRANS("Change all connected"));
     mOptionsChangeAllFormatButton->addListener(this);
     mOptionsChangeAllFormatButton->setLookAndFeel(&smallLNF);
@@ -330,6 +427,24 @@ OptionsView::OptionsView(SonobusAudioProcessor& proc, std::function<AudioDeviceM
     mOptionsComponent->addAndMakeVisible(mOptionsDynamicResamplingButton.get());
     mOptionsComponent->addAndMakeVisible(mOptionsAutoReconnectButton.get());
     mOptionsComponent->addAndMakeVisible(mOptionsInputLimiterButton.get());
+    mOptionsComponent->addAndMakeVisible(mOptionsRealtimeNetThreadsButton.get());
+    mOptionsComponent->addAndMakeVisible(mOptionsPowerSavingButton.get());
+    mOptionsComponent->addAndMakeVisible(mOptionsInlineSendButton.get());
+    mOptionsComponent->addAndMakeVisible(mOptionsEnsembleAlignButton.get());
+    mOptionsComponent->addAndMakeVisible(mOptionsSessionRateButton.get());
+    mOptionsComponent->addAndMakeVisible(mOptionsShareBackingTrackButton.get());
+    mOptionsComponent->addAndMakeVisible(mOptionsCodecCpuBudgetButton.get());
+    if (!JUCEApplicationBase::isStandaloneApp()) {
+        mOptionsComponent->addAndMakeVisible(mOptionsBounceCaptureButton.get());
+    }
+    mOptionsComponent->addAndMakeVisible(mOptionsNetThreadCoresEditor.get());
+    mOptionsComponent->addAndMakeVisible(mOptionsRecvPollLabel.get());
+    mOptionsComponent->addAndMakeVisible(mOptionsRecvPollChoice.get());
+    mOptionsComponent->addAndMakeVisible(mOptionsRecvCoreEditor.get());
+    mOptionsComponent->addAndMakeVisible(mOptionsReverbRateLabel.get());
+    mOptionsComponent->addAndMakeVisible(mOptionsReverbRateChoice.get());
+    mOptionsComponent->addAndMakeVisible(mOptionsPeerTelemetryButton.get());
+    mOptionsComponent->addAndMakeVisible(mOptionsTimelineTraceButton.get());
     mOptionsComponent->addAndMakeVisible(mOptionsDefaultLevelSlider.get());
     mOptionsComponent->addAndMakeVisible(mOptionsDefaultLevelSliderLabel.get());
     mOptionsComponent->addAndMakeVisible(mOptionsChangeAllFormatButton.get());
@@ -349,11 +464,16 @@ OptionsView::OptionsView(SonobusAudioProcessor& proc, std::function<AudioDeviceM
     }
     mOptionsComponent->addAndMakeVisible(mOptionsSliderSnapToMouseButton.get());
     mOptionsComponent->addAndMakeVisible(mOptionsDisableShortcutButton.get());
+    if (mOptionsUseOpenGLButton) {
+        mOptionsComponent->addAndMakeVisible(mOptionsUseOpenGLButton.get());
+    }
 
 
 
     mRecOptionsComponent->addAndMakeVisible(mOptionsMetRecordedButton.get());
     mRecOptionsComponent->addAndMakeVisible(mOptionsRecFinishOpenButton.get());
+    mRecOptionsComponent->addAndMakeVisible(mOptionsDoubleEnderRecordButton.get());
+    mRecOptionsComponent->addAndMakeVisible(mOptionsDoubleEnderCollectButton.get());
     mRecOptionsComponent->addAndMakeVisible(mOptionsRecFilesStaticLabel.get());
     mRecOptionsComponent->addAndMakeVisible(mOptionsRecMixButton.get());
     mRecOptionsComponent->addAndMakeVisible(mOptionsRecSelfButton.get());
@@ -589,6 +709,29 @@ void OptionsView::updateState(bool ignorecheck)
 
     mOptionsSliderSnapToMouseButton->setToggleState(processor.getSlidersSnapToMousePosition(), dontSendNotification);
     mOptionsDisableShortcutButton->setToggleState(processor.getDisableKeyboardShortcuts(), dontSendNotification);
+    if (mOptionsUseOpenGLButton) {
+        mOptionsUseOpenGLButton->setToggleState(processor.getUseOpenGLRendering(), dontSendNotification);
+    }
+
+    mOptionsRealtimeNetThreadsButton->setToggleState(processor.getRealtimeNetworkThreads(), dontSendNotification);
+    mOptionsPowerSavingButton->setToggleState(processor.getPowerSaving(), dontSendNotification);
+    mOptionsInlineSendButton->setToggleState(processor.getInlineSend(), dontSendNotification);
+    mOptionsEnsembleAlignButton->setToggleState(processor.getEnsembleAlignment(), dontSendNotification);
+    mOptionsSessionRateButton->setToggleState(processor.getSessionRateNegotiation(), dontSendNotification);
+    mOptionsShareBackingTrackButton->setToggleState(processor.getShareBackingTrack(), dontSendNotification);
+    mOptionsCodecCpuBudgetButton->setToggleState(processor.getCodecCpuBudget(), dontSendNotification);
+    mOptionsBounceCaptureButton->setToggleState(processor.getOfflineBounceCapture(), dontSendNotification);
+    mOptionsPeerTelemetryButton->setToggleState(processor.getPeerTelemetryEnabled(), dontSendNotification);
+    mOptionsTimelineTraceButton->setToggleState(processor.getTimelineTracing(), dontSendNotification);
+    if (!mOptionsNetThreadCoresEditor->hasKeyboardFocus(false)) {
+        mOptionsNetThreadCoresEditor->setText(SonobusAudioProcessor::cpuCoreListToString(processor.getNetworkThreadAffinity()), dontSendNotification);
+    }
+    mOptionsRecvPollChoice->setSelectedId((int)processor.getReceivePollMode(), dontSendNotification);
+    mOptionsReverbRateChoice->setSelectedId((int)processor.getReverbRateReduction(), dontSendNotification);
+    if (!mOptionsRecvCoreEditor->hasKeyboardFocus(false)) {
+        const int core = processor.getReceiveThreadCore();
+        mOptionsRecvCoreEditor->setText(core >= 0 ? String(core) : String(), dontSendNotification);
+    }
 
     uint32 recmask = processor.getDefaultRecordingOptions();
 
@@ -600,6 +743,8 @@ void OptionsView::updateState(bool ignorecheck)
     mOptionsRecSelfPostFxButton->setToggleState(!processor.getSelfRecordingPreFX(), dontSendNotification);
 
     mOptionsRecFinishOpenButton->setToggleState(processor.getRecordFinishOpens(), dontSendNotification);
+    mOptionsDoubleEnderRecordButton->setToggleState(processor.getDoubleEnderRecording(), dontSendNotification);
+    mOptionsDoubleEnderCollectButton->setToggleState(processor.getDoubleEnderCollecting(), dontSendNotification);
 
     mRecFormatChoice->setSelectedId((int)processor.getDefaultRecordingFormat(), dontSendNotification);
     mRecBitsChoice->setSelectedId((int)processor.getDefaultRecordingBitsPerSample(), dontSendNotification);
@@ -698,6 +843,67 @@ void OptionsView::updateLayout()
     optionsUdpBox.items.add(FlexItem(minButtonWidth, minitemheight, *mOptionsUseSpecificUdpPortButton).withMargin(0).withFlex(1));
     optionsUdpBox.items.add(FlexItem(90, minitemheight, *mOptionsUdpPortEditor).withMargin(0).withFlex(0));
 
+    optionsNetThreadsBox.items.clear();
+    optionsNetThreadsBox.flexDirection = FlexBox::Direction::row;
+    optionsNetThreadsBox.items.add(FlexItem(10, 12));
+    optionsNetThreadsBox.items.add(FlexItem(minButtonWidth, minitemheight, *mOptionsRealtimeNetThreadsButton).withMargin(0).withFlex(1));
+    optionsNetThreadsBox.items.add(FlexItem(90, minitemheight, *mOptionsNetThreadCoresEditor).withMargin(0).withFlex(0));
+
+    optionsRecvPollBox.items.clear();
+    optionsRecvPollBox.flexDirection = FlexBox::Direction::row;
+    optionsRecvPollBox.items.add(FlexItem(10, 12));
+    optionsRecvPollBox.items.add(FlexItem(minButtonWidth, minitemheight, *mOptionsRecvPollLabel).withMargin(0).withFlex(1));
+    optionsRecvPollBox.items.add(FlexItem(100, minitemheight, *mOptionsRecvPollChoice).withMargin(0).withFlex(0));
+    optionsRecvPollBox.items.add(FlexItem(4, 12));
+    optionsRecvPollBox.items.add(FlexItem(90, minitemheight, *mOptionsRecvCoreEditor).withMargin(0).withFlex(0));
+
+    optionsReverbRateBox.items.clear();
+    optionsReverbRateBox.flexDirection = FlexBox::Direction::row;
+    optionsReverbRateBox.items.add(FlexItem(10, 12));
+    optionsReverbRateBox.items.add(FlexItem(minButtonWidth, minitemheight, *mOptionsReverbRateLabel).withMargin(0).withFlex(1));
+    optionsReverbRateBox.items.add(FlexItem(100, minitemheight, *mOptionsReverbRateChoice).withMargin(0).withFlex(0));
+
+    optionsInlineSendBox.items.clear();
+    optionsInlineSendBox.flexDirection = FlexBox::Direction::row;
+    optionsInlineSendBox.items.add(FlexItem(10, 12).withFlex(0));
+    optionsInlineSendBox.items.add(FlexItem(180, minpassheight, *mOptionsInlineSendButton).withMargin(0).withFlex(1));
+
+    optionsEnsembleAlignBox.items.clear();
+    optionsEnsembleAlignBox.flexDirection = FlexBox::Direction::row;
+    optionsEnsembleAlignBox.items.add(FlexItem(10, 12).withFlex(0));
+    optionsEnsembleAlignBox.items.add(FlexItem(180, minpassheight, *mOptionsEnsembleAlignButton).withMargin(0).withFlex(1));
+
+    optionsSessionRateBox.items.clear();
+    optionsSessionRateBox.flexDirection = FlexBox::Direction::row;
+    optionsSessionRateBox.items.add(FlexItem(10, 12).withFlex(0));
+    optionsSessionRateBox.items.add(FlexItem(180, minpassheight, *mOptionsSessionRateButton).withMargin(0).withFlex(1));
+
+    optionsShareBackingTrackBox.items.clear();
+    optionsShareBackingTrackBox.flexDirection = FlexBox::Direction::row;
+    optionsShareBackingTrackBox.items.add(FlexItem(10, 12).withFlex(0));
+    optionsShareBackingTrackBox.items.add(FlexItem(180, minpassheight, *mOptionsShareBackingTrackButton).withMargin(0).withFlex(1));
+
+    optionsCodecCpuBudgetBox.items.clear();
+    optionsCodecCpuBudgetBox.flexDirection = FlexBox::Direction::row;
+    optionsCodecCpuBudgetBox.items.add(FlexItem(10, 12).withFlex(0));
+    optionsCodecCpuBudgetBox.items.add(FlexItem(180, minpassheight, *mOptionsCodecCpuBudgetButton).withMargin(0).withFlex(1));
+
+    optionsBounceCaptureBox.items.clear();
+    optionsBounceCaptureBox.flexDirection = FlexBox::Direction::row;
+    optionsBounceCaptureBox.items.add(FlexItem(10, 12).withFlex(0));
+    optionsBounceCaptureBox.items.add(FlexItem(180, minpassheight, *mOptionsBounceCaptureButton).withMargin(0).withFlex(1));
+
+    optionsPowerSavingBox.items.clear();
+    optionsPowerSavingBox.flexDirection = FlexBox::Direction::row;
+    optionsPowerSavingBox.items.add(FlexItem(10, 12).withFlex(0));
+    optionsPowerSavingBox.items.add(FlexItem(180, minpassheight, *mOptionsPowerSavingButton).withMargin(0).withFlex(1));
+
+    optionsPeerTelemetryBox.items.clear();
+    optionsPeerTelemetryBox.flexDirection = FlexBox::Direction::row;
+    optionsPeerTelemetryBox.items.add(FlexItem(10, 12).withFlex(0));
+    optionsPeerTelemetryBox.items.add(FlexItem(180, minpassheight, *mOptionsPeerTelemetryButton).withMargin(0).withFlex(1));
+    optionsPeerTelemetryBox.items.add(FlexItem(180, minpassheight, *mOptionsTimelineTraceButton).withMargin(0).withFlex(1));
+
     optionsDynResampleBox.items.clear();
     optionsDynResampleBox.flexDirection = FlexBox::Direction::row;
     optionsDynResampleBox.items.add(FlexItem(10, 12).withFlex(0));
@@ -738,6 +944,13 @@ void OptionsView::updateLayout()
     optionsDisableShortcutsBox.items.add(FlexItem(10, 12).withFlex(0));
     optionsDisableShortcutsBox.items.add(FlexItem(180, minpassheight, *mOptionsDisableShortcutButton).withMargin(0).withFlex(1));
 
+    optionsUseOpenGLBox.items.clear();
+    optionsUseOpenGLBox.flexDirection = FlexBox::Direction::row;
+    if (mOptionsUseOpenGLButton) {
+        optionsUseOpenGLBox.items.add(FlexItem(10, 12).withFlex(0));
+        optionsUseOpenGLBox.items.add(FlexItem(180, minpassheight, *mOptionsUseOpenGLButton).withMargin(0).withFlex(1));
+    }
+
 
     optionsAllowBluetoothBox.items.clear();
     optionsAllowBluetoothBox.flexDirection = FlexBox::Direction::row;
@@ -768,6 +981,19 @@ void OptionsView::updateLayout()
     optionsBox.items.add(FlexItem(100, minpassheight, optionsSnapToMouseBox).withMargin(2).withFlex(0));
     optionsBox.items.add(FlexItem(100, minpassheight, optionsAutoReconnectBox).withMargin(2).withFlex(0));
     optionsBox.items.add(FlexItem(100, minitemheight, optionsUdpBox).withMargin(2).withFlex(0));
+    optionsBox.items.add(FlexItem(100, minitemheight, optionsNetThreadsBox).withMargin(2).withFlex(0));
+    optionsBox.items.add(FlexItem(100, minitemheight, optionsRecvPollBox).withMargin(2).withFlex(0));
+    optionsBox.items.add(FlexItem(100, minpassheight, optionsInlineSendBox).withMargin(2).withFlex(0));
+    optionsBox.items.add(FlexItem(100, minpassheight, optionsEnsembleAlignBox).withMargin(2).withFlex(0));
+    optionsBox.items.add(FlexItem(100, minpassheight, optionsSessionRateBox).withMargin(2).withFlex(0));
+    optionsBox.items.add(FlexItem(100, minpassheight, optionsShareBackingTrackBox).withMargin(2).withFlex(0));
+    optionsBox.items.add(FlexItem(100, minpassheight, optionsCodecCpuBudgetBox).withMargin(2).withFlex(0));
+    if (!JUCEApplicationBase::isStandaloneApp()) {
+        optionsBox.items.add(FlexItem(100, minpassheight, optionsBounceCaptureBox).withMargin(2).withFlex(0));
+    }
+    optionsBox.items.add(FlexItem(100, minitemheight, optionsReverbRateBox).withMargin(2).withFlex(0));
+    optionsBox.items.add(FlexItem(100, minpassheight, optionsPowerSavingBox).withMargin(2).withFlex(0));
+    optionsBox.items.add(FlexItem(100, minpassheight, optionsPeerTelemetryBox).withMargin(2).withFlex(0));
     if (JUCEApplicationBase::isStandaloneApp()) {
         optionsBox.items.add(FlexItem(100, minpassheight, optionsOverrideSamplerateBox).withMargin(2).withFlex(0));
         if (mOptionsAllowBluetoothInput) {
@@ -776,6 +1002,9 @@ void OptionsView::updateLayout()
         optionsBox.items.add(FlexItem(100, minpassheight, optionsCheckForUpdateBox).withMargin(2).withFlex(0));
     }
     optionsBox.items.add(FlexItem(100, minpassheight, optionsDisableShortcutsBox).withMargin(2).withFlex(0));
+    if (mOptionsUseOpenGLButton) {
+        optionsBox.items.add(FlexItem(100, minpassheight, optionsUseOpenGLBox).withMargin(2).withFlex(0));
+    }
     optionsBox.items.add(FlexItem(100, minpassheight, optionsDynResampleBox).withMargin(2).withFlex(0));
 
     minOptionsHeight = 0;
@@ -835,6 +1064,16 @@ void OptionsView::updateLayout()
     optionsRecordFinishBox.items.add(FlexItem(10, 12));
     optionsRecordFinishBox.items.add(FlexItem(minButtonWidth, minpassheight, *mOptionsRecFinishOpenButton).withMargin(0).withFlex(1));
 
+    optionsDoubleEnderRecordBox.items.clear();
+    optionsDoubleEnderRecordBox.flexDirection = FlexBox::Direction::row;
+    optionsDoubleEnderRecordBox.items.add(FlexItem(10, 12));
+    optionsDoubleEnderRecordBox.items.add(FlexItem(minButtonWidth, minpassheight, *mOptionsDoubleEnderRecordButton).withMargin(0).withFlex(1));
+
+    optionsDoubleEnderCollectBox.items.clear();
+    optionsDoubleEnderCollectBox.flexDirection = FlexBox::Direction::row;
+    optionsDoubleEnderCollectBox.items.add(FlexItem(10, 12));
+    optionsDoubleEnderCollectBox.items.add(FlexItem(minButtonWidth, minpassheight, *mOptionsDoubleEnderCollectButton).withMargin(0).withFlex(1));
+
 
     recOptionsBox.items.clear();
     recOptionsBox.flexDirection = FlexBox::Direction::column;
@@ -853,6 +1092,9 @@ void OptionsView::updateLayout()
     recOptionsBox.items.add(FlexItem(100, minpassheight, optionsMetRecordBox).withMargin(2).withFlex(0));
     recOptionsBox.items.add(FlexItem(100, minpassheight, optionsRecordSelfPostFxBox).withMargin(2).withFlex(0));
     recOptionsBox.items.add(FlexItem(100, minpassheight, optionsRecordFinishBox).withMargin(2).withFlex(0));
+    recOptionsBox.items.add(FlexItem(4, 4));
+    recOptionsBox.items.add(FlexItem(100, minpassheight, optionsDoubleEnderRecordBox).withMargin(2).withFlex(0));
+    recOptionsBox.items.add(FlexItem(100, minpassheight, optionsDoubleEnderCollectBox).withMargin(2).withFlex(0));
     minRecOptionsHeight = 0;
     for (auto & item : recOptionsBox.items) {
         minRecOptionsHeight += item.minHeight + item.margin.top + item.margin.bottom;
@@ -940,6 +1182,12 @@ void OptionsView::textEditorReturnKeyPressed (TextEditor& ed)
         int port = mOptionsUdpPortEditor->getText().getIntValue();
         changeUdpPort(port);
     }
+    else if (&ed == mOptionsNetThreadCoresEditor.get()) {
+        changeNetworkThreadCores(ed.getText());
+    }
+    else if (&ed == mOptionsRecvCoreEditor.get()) {
+        changeReceiveThreadCore(ed.getText());
+    }
 }
 
 void OptionsView::textEditorEscapeKeyPressed (TextEditor& ed)
@@ -960,6 +1208,12 @@ void OptionsView::textEditorFocusLost (TextEditor& ed)
         int port = mOptionsUdpPortEditor->getText().getIntValue();
         changeUdpPort(port);
     }
+    else if (&ed == mOptionsNetThreadCoresEditor.get()) {
+        changeNetworkThreadCores(ed.getText());
+    }
+    else if (&ed == mOptionsRecvCoreEditor.get()) {
+        changeReceiveThreadCore(ed.getText());
+    }
 }
 
 void OptionsView::changeUdpPort(int port)
@@ -974,6 +1228,22 @@ void OptionsView::changeUdpPort(int port)
 
 }
 
+void OptionsView::changeNetworkThreadCores(const String & corelist)
+{
+    processor.setNetworkThreadAffinity(SonobusAudioProcessor::parseCpuCoreList(corelist));
+
+    // show it normalized
+    mOptionsNetThreadCoresEditor->setText(SonobusAudioProcessor::cpuCoreListToString(processor.getNetworkThreadAffinity()), dontSendNotification);
+}
+
+void OptionsView::changeReceiveThreadCore(const String & core)
+{
+    processor.setReceiveThreadCore(core.trim().isEmpty() ? -1 : core.getIntValue());
+
+    const int applied = processor.getReceiveThreadCore();
+    mOptionsRecvCoreEditor->setText(applied >= 0 ? String(applied) : String(), dontSendNotification);
+}
+
 void OptionsView::buttonClicked (Button* buttonThatWasClicked)
 {
     if (buttonThatWasClicked == mRecLocationButton.get()) {
@@ -1029,6 +1299,12 @@ void OptionsView::buttonClicked (Button* buttonThatWasClicked)
     else if (buttonThatWasClicked == mOptionsRecFinishOpenButton.get()) {
         processor.setRecordFinishOpens(mOptionsRecFinishOpenButton->getToggleState());
     }
+    else if (buttonThatWasClicked == mOptionsDoubleEnderRecordButton.get()) {
+        processor.setDoubleEnderRecording(mOptionsDoubleEnderRecordButton->getToggleState());
+    }
+    else if (buttonThatWasClicked == mOptionsDoubleEnderCollectButton.get()) {
+        processor.setDoubleEnderCollecting(mOptionsDoubleEnderCollectButton->getToggleState());
+    }
     else if (buttonThatWasClicked == mOptionsUseSpecificUdpPortButton.get()) {
         if (!mOptionsUseSpecificUdpPortButton->getToggleState()) {
             // toggled off, change back to use system chosen port
@@ -1085,6 +1361,42 @@ void OptionsView::buttonClicked (Button* buttonThatWasClicked)
             updateKeybindings();
         }
     }
+    else if (mOptionsUseOpenGLButton && buttonThatWasClicked == mOptionsUseOpenGLButton.get()) {
+        processor.setUseOpenGLRendering(mOptionsUseOpenGLButton->getToggleState());
+        if (updateOpenGLRendering) {
+            updateOpenGLRendering();
+        }
+    }
+    else if (buttonThatWasClicked == mOptionsRealtimeNetThreadsButton.get()) {
+        processor.setRealtimeNetworkThreads(mOptionsRealtimeNetThreadsButton->getToggleState());
+    }
+    else if (buttonThatWasClicked == mOptionsInlineSendButton.get()) {
+        processor.setInlineSend(mOptionsInlineSendButton->getToggleState());
+    }
+    else if (buttonThatWasClicked == mOptionsEnsembleAlignButton.get()) {
+        processor.setEnsembleAlignment(mOptionsEnsembleAlignButton->getToggleState());
+    }
+    else if (buttonThatWasClicked == mOptionsSessionRateButton.get()) {
+        processor.setSessionRateNegotiation(mOptionsSessionRateButton->getToggleState());
+    }
+    else if (buttonThatWasClicked == mOptionsShareBackingTrackButton.get()) {
+        processor.setShareBackingTrack(mOptionsShareBackingTrackButton->getToggleState());
+    }
+    else if (buttonThatWasClicked == mOptionsCodecCpuBudgetButton.get()) {
+        processor.setCodecCpuBudget(mOptionsCodecCpuBudgetButton->getToggleState());
+    }
+    else if (buttonThatWasClicked == mOptionsBounceCaptureButton.get()) {
+        processor.setOfflineBounceCapture(mOptionsBounceCaptureButton->getToggleState());
+    }
+    else if (buttonThatWasClicked == mOptionsPowerSavingButton.get()) {
+        processor.setPowerSaving(mOptionsPowerSavingButton->getToggleState());
+    }
+    else if (buttonThatWasClicked == mOptionsPeerTelemetryButton.get()) {
+        processor.setPeerTelemetryEnabled(mOptionsPeerTelemetryButton->getToggleState());
+    }
+    else if (buttonThatWasClicked == mOptionsTimelineTraceButton.get()) {
+        processor.setTimelineTracing(mOptionsTimelineTraceButton->getToggleState());
+    }
 }
 
 
@@ -1096,6 +1408,12 @@ void OptionsView::choiceButtonSelected(SonoChoiceButton *comp, int index, int id
     else if (comp == mOptionsAutosizeDefaultChoice.get()) {
         processor.setDefaultAutoresizeBufferMode((SonobusAudioProcessor::AutoNetBufferMode) ident);
     }
+    else if (comp == mOptionsRecvPollChoice.get()) {
+        processor.setReceivePollMode((SonobusAudioProcessor::ReceivePollMode) ident);
+    }
+    else if (comp == mOptionsReverbRateChoice.get()) {
+        processor.setReverbRateReduction((SonobusAudioProcessor::ReverbRateReduction) ident);
+    }
     else if (comp == mRecFormatChoice.get()) {
         processor.setDefaultRecordingFormat((SonobusAudioProcessor::RecordFileFormat) ident);
     }
@@ -75,6 +75,7 @@ public:
     std::function<Value*()> getAllowBluetoothInputValue; // = []() { return 0; };
     std::function<void()> updateSliderSnap; // = []() { return 0; };
     std::function<void()> updateKeybindings; // = []() { return 0; };
+    std::function<void()> updateOpenGLRendering; // = []() { return 0; };
     std::function<bool(const String &)> setupLocalisation; // = []() { return 0; };
     std::function<void()> saveSettingsIfNeeded; // = []() { return 0; };
 
@@ -88,6 +89,8 @@ protected:
     void configLevelSlider(Slider *);
 
     void changeUdpPort(int port);
+    void changeNetworkThreadCores(const String & corelist);
+    void changeReceiveThreadCore(const String & core);
     void chooseRecDirBrowser();
 
 
@@ -136,6 +139,23 @@ protected:
     std::unique_ptr<ToggleButton> mOptionsSliderSnapToMouseButton;
     std::unique_ptr<ToggleButton> mOptionsAllowBluetoothInput;
     std::unique_ptr<ToggleButton> mOptionsDisableShortcutButton;
+    std::unique_ptr<ToggleButton> mOptionsUseOpenGLButton;
+    std::unique_ptr<ToggleButton> mOptionsRealtimeNetThreadsButton;
+    std::unique_ptr<TextEditor>  mOptionsNetThreadCoresEditor;
+    std::unique_ptr<Label> mOptionsRecvPollLabel;
+    std::unique_ptr<SonoChoiceButton> mOptionsRecvPollChoice;
+    std::unique_ptr<TextEditor>  mOptionsRecvCoreEditor;
+    std::unique_ptr<Label> mOptionsReverbRateLabel;
+    std::unique_ptr<SonoChoiceButton> mOptionsReverbRateChoice;
+    std::unique_ptr<ToggleButton> mOptionsPowerSavingButton;
+    std::unique_ptr<ToggleButton> mOptionsInlineSendButton;
+    std::unique_ptr<ToggleButton> mOptionsEnsembleAlignButton;
+    std::unique_ptr<ToggleButton> mOptionsSessionRateButton;
+    std::unique_ptr<ToggleButton> mOptionsShareBackingTrackButton;
+    std::unique_ptr<ToggleButton> mOptionsCodecCpuBudgetButton;
+    std::unique_ptr<ToggleButton> mOptionsBounceCaptureButton;
+    std::unique_ptr<ToggleButton> mOptionsPeerTelemetryButton;
+    std::unique_ptr<ToggleButton> mOptionsTimelineTraceButton;
 
     std::unique_ptr<ToggleButton> mOptionsInputLimiterButton;
     std::unique_ptr<Label> mOptionsDefaultLevelSliderLabel;
@@ -160,6 +180,8 @@ protected:
     std::unique_ptr<Label> mRecLocationStaticLabel;
     std::unique_ptr<TextButton> mRecLocationButton;
     std::unique_ptr<ToggleButton> mOptionsRecFinishOpenButton;
+    std::unique_ptr<ToggleButton> mOptionsDoubleEnderRecordButton;
+    std::unique_ptr<ToggleButton> mOptionsDoubleEnderCollectButton;
 
 
     FlexBox mainBox;
@@ -177,10 +199,22 @@ protected:
     FlexBox optionsAutoReconnectBox;
     FlexBox optionsSnapToMouseBox;
     FlexBox optionsDisableShortcutsBox;
+    FlexBox optionsUseOpenGLBox;
     FlexBox optionsDefaultLevelBox;
     FlexBox optionsLanguageBox;
     FlexBox optionsAllowBluetoothBox;
     FlexBox optionsAutoDropThreshBox;
+    FlexBox optionsNetThreadsBox;
+    FlexBox optionsRecvPollBox;
+    FlexBox optionsReverbRateBox;
+    FlexBox optionsPowerSavingBox;
+    FlexBox optionsInlineSendBox;
+    FlexBox optionsEnsembleAlignBox;
+    FlexBox optionsSessionRateBox;
+    FlexBox optionsShareBackingTrackBox;
+    FlexBox optionsCodecCpuBudgetBox;
+    FlexBox optionsBounceCaptureBox;
+    FlexBox optionsPeerTelemetryBox;
 
     FlexBox recOptionsBox;
     FlexBox optionsRecordFormatBox;
@@ -192,6 +226,8 @@ protected:
     FlexBox optionsRecordDirBox;
     FlexBox optionsRecordSelfPostFxBox;
     FlexBox optionsRecordFinishBox;
+    FlexBox optionsDoubleEnderRecordBox;
+    FlexBox optionsDoubleEnderCollectBox;
 
 
     std::unique_ptr<TabbedComponent> mSettingsTab;
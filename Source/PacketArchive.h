@@ -0,0 +1,459 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include "aoo/aoo.h"
+
+#include "RecordingEngine.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace SonoAudio {
+
+// Recording of the encoded streams of a peer as they came in, without decoding
+// and encoding them again. The file is a header and a sequence of records:
+// the stream format (codec, settings) whenever it changes, and every complete
+// block with its sequence number, the real samplerate of the source and its
+// arrival time since the start of the recording session. All the archives of
+// a session share that start, which lines them up for rendering a mix later.
+// render() decodes the archives offline into a standard file, a stem for one
+// archive or a mix of several, concealing lost blocks like the sink does.
+class PacketArchive
+{
+public:
+    static constexpr const char * FileExtension = ".sbpkt";
+
+    // writes one archive, fed from the packet tap of a sink (the network thread),
+    // written to disk from one of the recording engine threads
+    class Writer : public TimeSliceClient
+    {
+    public:
+        // message thread, sessionStartTicks is the high resolution start shared by the session
+        Writer(RecordingEngine & engine, const File & destFile, int64 sessionStartTicks, int ringBytes)
+        : file(destFile), sessionStart(sessionStartTicks), fifo(ringBytes), ring((size_t) ringBytes)
+        {
+            destFile.deleteFile();
+            output = destFile.createOutputStream();
+            if (output) {
+                output->write(Magic, 4);
+                output->writeInt(Version);
+                output->writeInt64(Time::currentTimeMillis());
+            }
+            scratch.ensureSize(4096);
+
+            thread = &engine.chooseThread();
+            thread->addTimeSliceClient(this);
+        }
+
+        ~Writer() override
+        {
+            thread->removeTimeSliceClient(this);
+            while (writePendingData() > 0) {}
+        }
+
+        bool isOpen() const { return output != nullptr; }
+        int64 getDroppedPackets() const { return droppedPackets.load(std::memory_order_relaxed); }
+
+        // network thread (or one at a time), returns false if the block had to be dropped
+        bool addPacket(const aoo_packet_tap_info & info)
+        {
+            if (info.salt != lastSalt || !haveFormat) {
+                // the format goes first, even if the block then doesn't fit
+                MemoryOutputStream mo (scratch, false);
+                mo.writeInt(info.salt);
+                mo.writeString(info.format->codec);
+                mo.writeInt(info.format->nchannels);
+                mo.writeInt(info.format->samplerate);
+                mo.writeInt(info.format->blocksize);
+                mo.writeInt(info.settingssize);
+                mo.write(info.settings, (size_t) info.settingssize);
+                if (!pushRecord(RecordFormat, mo.getData(), (int) mo.getDataSize())) {
+                    droppedPackets.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                lastSalt = info.salt;
+                haveFormat = true;
+            }
+
+            const int64 arrival = (int64) ((Time::getHighResolutionTicks() - sessionStart) * 1e6 / Time::getHighResolutionTicksPerSecond());
+
+            MemoryOutputStream mo (scratch, false);
+            mo.writeInt(info.salt);
+            mo.writeInt(info.sequence);
+            mo.writeDouble(info.samplerate);
+            mo.writeInt(info.channel);
+            mo.writeInt64(arrival);
+            mo.writeInt(info.size);
+            mo.write(info.data, (size_t) info.size);
+            if (!pushRecord(RecordPacket, mo.getData(), (int) mo.getDataSize())) {
+                droppedPackets.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            return true;
+        }
+
+        int useTimeSlice() override
+        {
+            return writePendingData() > 0 ? 0 : 10;
+        }
+
+    private:
+        bool pushRecord(int type, const void * payload, int size)
+        {
+            const int total = 8 + size;
+            if (fifo.getFreeSpace() < total) return false;
+
+            uint32 head[2] = { ByteOrder::swapIfBigEndian((uint32) type), ByteOrder::swapIfBigEndian((uint32) size) };
+            pushBytes(head, 8);
+            pushBytes(payload, size);
+            return true;
+        }
+
+        void pushBytes(const void * src, int size)
+        {
+            int start1, size1, start2, size2;
+            fifo.prepareToWrite(size, start1, size1, start2, size2);
+            auto * bytes = static_cast<const char *>(src);
+            memcpy(static_cast<char *>(ring.getData()) + start1, bytes, (size_t) size1);
+            if (size2 > 0) memcpy(static_cast<char *>(ring.getData()) + start2, bytes + size1, (size_t) size2);
+            fifo.finishedWrite(size1 + size2);
+        }
+
+        int writePendingData()
+        {
+            const int numready = fifo.getNumReady();
+            if (numready <= 0) return 0;
+
+            int start1, size1, start2, size2;
+            fifo.prepareToRead(numready, start1, size1, start2, size2);
+            if (output) {
+                output->write(static_cast<const char *>(ring.getData()) + start1, (size_t) size1);
+                if (size2 > 0) output->write(static_cast<const char *>(ring.getData()) + start2, (size_t) size2);
+            }
+            fifo.finishedRead(size1 + size2);
+            return size1 + size2;
+        }
+
+        File file;
+        const int64 sessionStart;
+        std::unique_ptr<FileOutputStream> output;
+        TimeSliceThread * thread = nullptr;
+
+        AbstractFifo fifo;
+        MemoryBlock ring;
+        MemoryBlock scratch;
+        int32 lastSalt = 0;
+        bool haveFormat = false;
+        std::atomic<int64> droppedPackets { 0 };
+    };
+
+    // decodes archives into destFile (a stem for one, a mix of all otherwise), any thread
+    static bool render(const Array<File> & archives, const File & destFile, AudioFormat & format, int bitsPerSample, int qualityIndex, String & errorMessage)
+    {
+        OwnedArray<StreamDecoder> decoders;
+        int numchans = 0;
+        double samplerate = 0.0;
+        int64 sessionstart = std::numeric_limits<int64>::max();
+
+        for (auto & archive : archives) {
+            auto * dec = decoders.add(new StreamDecoder());
+            if (!dec->open(archive, errorMessage)) {
+                return false;
+            }
+            numchans = jmax(numchans, dec->getNumChannels());
+            if (samplerate <= 0.0) samplerate = dec->getSampleRate();
+            sessionstart = jmin(sessionstart, dec->getStartMicros());
+        }
+
+        if (decoders.isEmpty() || numchans <= 0 || samplerate <= 0.0) {
+            errorMessage = TRANS("Nothing to render");
+            return false;
+        }
+
+        std::unique_ptr<AudioFormatWriter> writer;
+        destFile.deleteFile();
+        if (auto stream = std::unique_ptr<FileOutputStream> (destFile.createOutputStream())) {
+            writer.reset(format.createWriterFor(stream.get(), samplerate, (unsigned int) numchans, bitsPerSample, {}, qualityIndex));
+            if (writer) {
+                stream.release();
+            }
+        }
+        if (!writer) {
+            errorMessage = TRANS("Error creating writer for ") + destFile.getFullPathName();
+            return false;
+        }
+
+        // line them up by the arrival of their first blocks
+        for (auto * dec : decoders) {
+            dec->setLeadingSilence((int64) ((dec->getStartMicros() - sessionstart) * 1e-6 * samplerate));
+        }
+
+        const int blocksize = 4096;
+        AudioBuffer<float> mix (numchans, blocksize);
+
+        for (;;) {
+            mix.clear();
+            int numsamples = 0;
+            for (auto * dec : decoders) {
+                numsamples = jmax(numsamples, dec->addTo(mix, blocksize));
+            }
+            if (numsamples == 0) break;
+
+            if (!writer->writeFromAudioSampleBuffer(mix, 0, numsamples)) {
+                errorMessage = TRANS("Error writing ") + destFile.getFullPathName();
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+private:
+    static constexpr const char * Magic = "SBPA";
+    static constexpr int Version = 1;
+    static constexpr int RecordFormat = 1;
+    static constexpr int RecordPacket = 2;
+    // longer gaps are filled with silence instead of concealing every block
+    static constexpr double MaxConcealSeconds = 1.0;
+
+    // plays back one archive
+    class StreamDecoder
+    {
+    public:
+        ~StreamDecoder() { closeDecoder(); }
+
+        bool open(const File & archive, String & errorMessage)
+        {
+            input = archive.createInputStream();
+            char magic[4];
+            if (!input || input->read(magic, 4) != 4 || memcmp(magic, Magic, 4) != 0 || input->readInt() != Version) {
+                errorMessage = TRANS("Not a packet archive: ") + archive.getFullPathName();
+                return false;
+            }
+            input->readInt64();
+
+            // index it, the blocks themselves are only read when decoding
+            while (!input->isExhausted()) {
+                const int type = input->readInt();
+                const int size = input->readInt();
+                const int64 start = input->getPosition();
+                if (size < 0 || start + size > input->getTotalLength()) break; // cut short
+
+                if (type == RecordFormat) {
+                    Segment seg;
+                    seg.salt = input->readInt();
+                    seg.codec = input->readString();
+                    seg.nchannels = input->readInt();
+                    seg.samplerate = input->readInt();
+                    seg.blocksize = input->readInt();
+                    const int setsize = jlimit(0, size, input->readInt());
+                    seg.settings.setSize((size_t) setsize);
+                    input->read(seg.settings.getData(), setsize);
+                    segments.push_back(std::move(seg));
+                }
+                else if (type == RecordPacket && !segments.empty()) {
+                    Packet pkt;
+                    const int salt = input->readInt();
+                    pkt.segment = (int) segments.size() - 1;
+                    if (segments.back().salt != salt) {
+                        input->setPosition(start + size);
+                        continue;
+                    }
+                    pkt.sequence = input->readInt();
+                    input->readDouble();
+                    input->readInt();
+                    pkt.arrival = input->readInt64();
+                    pkt.size = input->readInt();
+                    pkt.offset = input->getPosition();
+                    packets.push_back(pkt);
+                }
+                input->setPosition(start + size);
+            }
+
+            // in sequence within each format, only the first copy of a block
+            std::stable_sort(packets.begin(), packets.end(), [] (const Packet & a, const Packet & b) {
+                return a.segment != b.segment ? a.segment < b.segment : a.sequence < b.sequence;
+            });
+            packets.erase(std::unique(packets.begin(), packets.end(), [] (const Packet & a, const Packet & b) {
+                return a.segment == b.segment && a.sequence == b.sequence;
+            }), packets.end());
+
+            for (auto & seg : segments) {
+                numChannels = jmax(numChannels, seg.nchannels);
+                if (sampleRate <= 0.0 && seg.samplerate > 0) sampleRate = seg.samplerate;
+            }
+            startMicros = packets.empty() ? 0 : packets.front().arrival;
+            return true;
+        }
+
+        int getNumChannels() const { return numChannels; }
+        double getSampleRate() const { return sampleRate; }
+        int64 getStartMicros() const { return startMicros; }
+        void setLeadingSilence(int64 samples) { leading = pendingSilence = jmax((int64) 0, samples); }
+
+        // mixes the next numSamples into dest, returns how many it had, less than asked once it is done
+        int addTo(AudioBuffer<float> & dest, int numSamples)
+        {
+            int pos = 0;
+            while (pos < numSamples) {
+                if (pendingSilence > 0) {
+                    const int n = (int) jmin((int64) (numSamples - pos), pendingSilence);
+                    pendingSilence -= n;
+                    produced += n;
+                    pos += n;
+                    continue;
+                }
+                if (blockPos >= blockFrames && !nextBlock()) {
+                    return pos;
+                }
+                if (blockPos >= blockFrames) continue; // silence got queued
+
+                const int n = jmin(numSamples - pos, blockFrames - blockPos);
+                const int chans = jmin(blockChannels, dest.getNumChannels());
+                for (int ch=0; ch < chans; ++ch) {
+                    float * out = dest.getWritePointer(ch, pos);
+                    const aoo_sample * src = decoded.data() + (size_t) (blockPos * blockChannels + ch);
+                    for (int i=0; i < n; ++i) {
+                        out[i] += (float) src[(size_t) (i * blockChannels)];
+                    }
+                }
+                blockPos += n;
+                produced += n;
+                pos += n;
+            }
+            return pos;
+        }
+
+    private:
+        struct Segment {
+            int salt = 0;
+            String codec;
+            int nchannels = 0;
+            int samplerate = 0;
+            int blocksize = 0;
+            MemoryBlock settings;
+        };
+
+        struct Packet {
+            int segment = 0;
+            int sequence = 0;
+            int64 arrival = 0;
+            int64 offset = 0;
+            int size = 0;
+        };
+
+        bool nextBlock()
+        {
+            if (nextPacket >= packets.size()) return false;
+
+            const Packet & pkt = packets[nextPacket];
+            if (pkt.segment != currentSegment) {
+                if (!openSegment(pkt.segment)) {
+                    // can't decode this one, skip its blocks
+                    while (nextPacket < packets.size() && packets[nextPacket].segment == pkt.segment) ++nextPacket;
+                    return nextPacket < packets.size();
+                }
+                expectedSequence = pkt.sequence;
+                // the stream stopped in between, keep the gap
+                const int64 due = leading + (int64) ((pkt.arrival - startMicros) * 1e-6 * sampleRate);
+                if (due > produced + segmentBlocksize) {
+                    pendingSilence = due - produced;
+                    return true;
+                }
+            }
+
+            blockPos = 0;
+            blockFrames = segmentBlocksize;
+            const int nsamples = segmentBlocksize * blockChannels;
+
+            if (pkt.sequence == expectedSequence) {
+                packetData.setSize((size_t) jmax(0, pkt.size));
+                input->setPosition(pkt.offset);
+                input->read(packetData.getData(), pkt.size);
+                codec->decoder_decode(decoder, static_cast<const char *>(packetData.getData()), pkt.size, decoded.data(), nsamples);
+                ++nextPacket;
+            }
+            else if ((pkt.sequence - expectedSequence) * (double) segmentBlocksize < MaxConcealSeconds * sampleRate) {
+                // lost, let the codec conceal it
+                codec->decoder_decode(decoder, nullptr, 0, decoded.data(), nsamples);
+            }
+            else {
+                // a long hole, just silence
+                pendingSilence = (int64) (pkt.sequence - expectedSequence) * segmentBlocksize;
+                expectedSequence = pkt.sequence;
+                blockFrames = 0;
+                return true;
+            }
+
+            ++expectedSequence;
+            return true;
+        }
+
+        bool openSegment(int index)
+        {
+            closeDecoder();
+            currentSegment = index;
+
+            const Segment & seg = segments[(size_t) index];
+            codec = aoo_find_codec(seg.codec.toRawUTF8());
+            if (!codec || seg.nchannels <= 0 || seg.blocksize <= 0) return false;
+
+            decoder = codec->decoder_new();
+            if (!decoder) return false;
+
+            // the codec fills in the rest of its format after the header
+            aoo_format_storage fmt;
+            fmt.header.codec = seg.codec.toRawUTF8();
+            fmt.header.nchannels = seg.nchannels;
+            fmt.header.samplerate = seg.samplerate;
+            fmt.header.blocksize = seg.blocksize;
+            if (codec->decoder_readformat(decoder, &fmt.header, static_cast<const char *>(seg.settings.getData()), (int32_t) seg.settings.getSize()) < 0) {
+                closeDecoder();
+                return false;
+            }
+
+            blockChannels = fmt.header.nchannels;
+            segmentBlocksize = fmt.header.blocksize;
+            decoded.assign((size_t) (segmentBlocksize * blockChannels), 0);
+            return true;
+        }
+
+        void closeDecoder()
+        {
+            if (codec && decoder) {
+                codec->decoder_free(decoder);
+            }
+            decoder = nullptr;
+        }
+
+        std::unique_ptr<FileInputStream> input;
+        std::vector<Segment> segments;
+        std::vector<Packet> packets;
+        size_t nextPacket = 0;
+
+        int numChannels = 0;
+        double sampleRate = 0.0;
+        int64 startMicros = 0;
+
+        const aoo_codec * codec = nullptr;
+        void * decoder = nullptr;
+        int currentSegment = -1;
+        int expectedSequence = 0;
+        int segmentBlocksize = 0;
+        int blockChannels = 0;
+
+        std::vector<aoo_sample> decoded;
+        MemoryBlock packetData;
+        int blockPos = 0;
+        int blockFrames = 0;
+        int64 pendingSilence = 0;
+        int64 leading = 0;
+        int64 produced = 0;
+    };
+};
+
+} // namespace SonoAudio
@@ -0,0 +1,590 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#include "PacketCipher.h"
+
+#if JUCE_WINDOWS
+ #include <windows.h>
+#elif JUCE_LINUX
+ #include <sys/random.h>
+#elif JUCE_ANDROID
+ #include <stdio.h>
+#else
+ #include <stdlib.h>
+#endif
+
+// the same for everyone, the passphrase is all that makes the key
+#define CIPHER_KDF_SALT "SonoBus packet key 1"
+#define CIPHER_KDF_ITERATIONS 20000
+
+namespace SonoAudio {
+
+namespace {
+
+// the last byte is the version of the format, 'd' since there's a sender id
+const uint8 sealMarker[4] = { 0xae, 'S', 'B', 'd' };
+
+inline uint32 load32(const uint8 * p)
+{
+    return (uint32) p[0] | ((uint32) p[1] << 8) | ((uint32) p[2] << 16) | ((uint32) p[3] << 24);
+}
+
+inline void store32(uint8 * p, uint32 v)
+{
+    p[0] = (uint8) v; p[1] = (uint8) (v >> 8); p[2] = (uint8) (v >> 16); p[3] = (uint8) (v >> 24);
+}
+
+inline void store64(uint8 * p, uint64 v)
+{
+    store32(p, (uint32) v);
+    store32(p + 4, (uint32) (v >> 32));
+}
+
+inline uint64 load64(const uint8 * p)
+{
+    return (uint64) load32(p) | ((uint64) load32(p + 4) << 32);
+}
+
+// from the system's secure random source, juce's Random is far from good enough
+// for nonces that everyone with the passphrase shares
+void fillSecureRandom(void * dest, size_t size)
+{
+#if JUCE_WINDOWS
+    // bcrypt is loaded lazily, so we don't need to link against it
+    typedef LONG (WINAPI *BCryptGenRandomFunc) (void *, PUCHAR, ULONG, ULONG);
+    static HMODULE bcrypt = LoadLibraryA("bcrypt.dll");
+    static auto genRandom = bcrypt ? (BCryptGenRandomFunc) GetProcAddress(bcrypt, "BCryptGenRandom") : nullptr;
+    // BCRYPT_USE_SYSTEM_PREFERRED_RNG
+    if (genRandom && genRandom(nullptr, (PUCHAR) dest, (ULONG) size, 0x00000002) == 0) return;
+#elif JUCE_LINUX
+    auto * bytes = static_cast<char*>(dest);
+    size_t remaining = size;
+    while (remaining > 0) {
+        const auto num = getrandom(bytes, remaining, 0);
+        if (num <= 0) break;
+        bytes += num;
+        remaining -= (size_t) num;
+    }
+    if (remaining == 0) return;
+#elif JUCE_ANDROID
+    // getrandom() only comes with API level 28
+    if (FILE * urandom = fopen("/dev/urandom", "rb")) {
+        const size_t num = fread(dest, 1, size, urandom);
+        fclose(urandom);
+        if (num == size) return;
+    }
+#endif
+#if JUCE_WINDOWS || JUCE_LINUX || JUCE_ANDROID
+    jassertfalse; // no secure random source, the nonces aren't safe
+    Random random;
+    for (size_t i = 0; i < size; ++i) {
+        static_cast<uint8*>(dest)[i] = (uint8) random.nextInt(256);
+    }
+#else
+    arc4random_buf(dest, size);
+#endif
+}
+
+inline uint32 rotl(uint32 v, int n)
+{
+    return (v << n) | (v >> (32 - n));
+}
+
+//==============================================================================
+#define CHACHA_QR(a, b, c, d) \
+    a += b; d = rotl(d ^ a, 16); \
+    c += d; b = rotl(b ^ c, 12); \
+    a += b; d = rotl(d ^ a, 8);  \
+    c += d; b = rotl(b ^ c, 7);
+
+void chachaBlock(const uint32 key[8], uint32 counter, const uint32 nonce[3], uint8 out[64])
+{
+    uint32 in[16] = {
+        0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+        key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+        counter, nonce[0], nonce[1], nonce[2]
+    };
+    uint32 x[16];
+    memcpy(x, in, sizeof(x));
+
+    for (int i=0; i < 10; ++i) {
+        CHACHA_QR(x[0], x[4], x[8],  x[12])
+        CHACHA_QR(x[1], x[5], x[9],  x[13])
+        CHACHA_QR(x[2], x[6], x[10], x[14])
+        CHACHA_QR(x[3], x[7], x[11], x[15])
+        CHACHA_QR(x[0], x[5], x[10], x[15])
+        CHACHA_QR(x[1], x[6], x[11], x[12])
+        CHACHA_QR(x[2], x[7], x[8],  x[13])
+        CHACHA_QR(x[3], x[4], x[9],  x[14])
+    }
+
+    for (int i=0; i < 16; ++i) {
+        store32(out + 4*i, x[i] + in[i]);
+    }
+}
+
+#undef CHACHA_QR
+
+// src to dst, which may be the same or lower in memory than src (see PacketCipher::open())
+void chachaXor(const uint32 key[8], const uint32 nonce[3], const uint8 * src, uint8 * dst, int size)
+{
+    uint8 stream[64];
+    for (uint32 counter = 1; size > 0; ++counter) {
+        chachaBlock(key, counter, nonce, stream);
+        const int num = jmin(size, 64);
+        for (int i=0; i < num; ++i) {
+            dst[i] = src[i] ^ stream[i];
+        }
+        src += num;
+        dst += num;
+        size -= num;
+    }
+}
+
+//==============================================================================
+// 26 bit limbs, after poly1305-donna. Only ever fed whole blocks, the AEAD pads
+// everything to 16 bytes anyway
+struct Poly1305
+{
+    explicit Poly1305(const uint8 otk[32])
+    {
+        r[0] = (load32(otk +  0)     ) & 0x3ffffff;
+        r[1] = (load32(otk +  3) >> 2) & 0x3ffff03;
+        r[2] = (load32(otk +  6) >> 4) & 0x3ffc0ff;
+        r[3] = (load32(otk +  9) >> 6) & 0x3f03fff;
+        r[4] = (load32(otk + 12) >> 8) & 0x00fffff;
+        for (int i=0; i < 4; ++i) {
+            pad[i] = load32(otk + 16 + 4*i);
+        }
+    }
+
+    void block(const uint8 m[16])
+    {
+        const uint32 s1 = r[1] * 5, s2 = r[2] * 5, s3 = r[3] * 5, s4 = r[4] * 5;
+
+        h[0] += (load32(m +  0)     ) & 0x3ffffff;
+        h[1] += (load32(m +  3) >> 2) & 0x3ffffff;
+        h[2] += (load32(m +  6) >> 4) & 0x3ffffff;
+        h[3] += (load32(m +  9) >> 6) & 0x3ffffff;
+        h[4] += (load32(m + 12) >> 8) | (1u << 24);
+
+        const uint64 d0 = (uint64) h[0]*r[0] + (uint64) h[1]*s4 + (uint64) h[2]*s3 + (uint64) h[3]*s2 + (uint64) h[4]*s1;
+        uint64 d1 = (uint64) h[0]*r[1] + (uint64) h[1]*r[0] + (uint64) h[2]*s4 + (uint64) h[3]*s3 + (uint64) h[4]*s2;
+        uint64 d2 = (uint64) h[0]*r[2] + (uint64) h[1]*r[1] + (uint64) h[2]*r[0] + (uint64) h[3]*s4 + (uint64) h[4]*s3;
+        uint64 d3 = (uint64) h[0]*r[3] + (uint64) h[1]*r[2] + (uint64) h[2]*r[1] + (uint64) h[3]*r[0] + (uint64) h[4]*s4;
+        uint64 d4 = (uint64) h[0]*r[4] + (uint64) h[1]*r[3] + (uint64) h[2]*r[2] + (uint64) h[3]*r[1] + (uint64) h[4]*r[0];
+
+        uint32 c = (uint32) (d0 >> 26); h[0] = (uint32) d0 & 0x3ffffff;
+        d1 += c; c = (uint32) (d1 >> 26); h[1] = (uint32) d1 & 0x3ffffff;
+        d2 += c; c = (uint32) (d2 >> 26); h[2] = (uint32) d2 & 0x3ffffff;
+        d3 += c; c = (uint32) (d3 >> 26); h[3] = (uint32) d3 & 0x3ffffff;
+        d4 += c; c = (uint32) (d4 >> 26); h[4] = (uint32) d4 & 0x3ffffff;
+        h[0] += c * 5; c = h[0] >> 26; h[0] &= 0x3ffffff;
+        h[1] += c;
+    }
+
+    // the data, and zeros up to the next block
+    void padded(const uint8 * data, int size)
+    {
+        for (; size >= 16; data += 16, size -= 16) {
+            block(data);
+        }
+        if (size > 0) {
+            uint8 last[16] = {};
+            memcpy(last, data, (size_t) size);
+            block(last);
+        }
+    }
+
+    void finish(uint8 tag[16])
+    {
+        uint32 c = h[1] >> 26; h[1] &= 0x3ffffff;
+        h[2] += c; c = h[2] >> 26; h[2] &= 0x3ffffff;
+        h[3] += c; c = h[3] >> 26; h[3] &= 0x3ffffff;
+        h[4] += c; c = h[4] >> 26; h[4] &= 0x3ffffff;
+        h[0] += c * 5; c = h[0] >> 26; h[0] &= 0x3ffffff;
+        h[1] += c;
+
+        // h - p, if that doesn't go below 0
+        uint32 g[5];
+        g[0] = h[0] + 5; c = g[0] >> 26; g[0] &= 0x3ffffff;
+        g[1] = h[1] + c; c = g[1] >> 26; g[1] &= 0x3ffffff;
+        g[2] = h[2] + c; c = g[2] >> 26; g[2] &= 0x3ffffff;
+        g[3] = h[3] + c; c = g[3] >> 26; g[3] &= 0x3ffffff;
+        g[4] = h[4] + c - (1u << 26);
+
+        uint32 mask = (g[4] >> 31) - 1;
+        for (int i=0; i < 5; ++i) {
+            h[i] = (h[i] & ~mask) | (g[i] & mask);
+        }
+
+        const uint32 w0 = h[0] | (h[1] << 26);
+        const uint32 w1 = (h[1] >> 6) | (h[2] << 20);
+        const uint32 w2 = (h[2] >> 12) | (h[3] << 14);
+        const uint32 w3 = (h[3] >> 18) | (h[4] << 8);
+
+        uint64 f = (uint64) w0 + pad[0];              store32(tag +  0, (uint32) f);
+        f = (uint64) w1 + pad[1] + (f >> 32);         store32(tag +  4, (uint32) f);
+        f = (uint64) w2 + pad[2] + (f >> 32);         store32(tag +  8, (uint32) f);
+        f = (uint64) w3 + pad[3] + (f >> 32);         store32(tag + 12, (uint32) f);
+    }
+
+    uint32 r[5];
+    uint32 h[5] = {};
+    uint32 pad[4];
+};
+
+// over the ciphertext, there's no additional data
+void computeTag(const uint32 key[8], const uint32 nonce[3], const uint8 * ciphertext, int size, uint8 tag[16])
+{
+    uint8 otk[64];
+    chachaBlock(key, 0, nonce, otk);
+
+    Poly1305 mac (otk);
+    mac.padded(ciphertext, size);
+
+    uint8 lengths[16];
+    store64(lengths, 0);
+    store64(lengths + 8, (uint64) size);
+    mac.block(lengths);
+    mac.finish(tag);
+}
+
+void nonceWords(const uint8 * wire, uint32 nonce[3])
+{
+    // the sender id, then the counter
+    nonce[0] = load32(wire);
+    nonce[1] = load32(wire + 4);
+    nonce[2] = load32(wire + 8);
+}
+
+//==============================================================================
+struct Sha256
+{
+    Sha256()
+    {
+        static const uint32 init[8] = {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+        };
+        memcpy(state, init, sizeof(state));
+    }
+
+    void update(const uint8 * data, size_t size)
+    {
+        total += size;
+        while (size > 0) {
+            const size_t num = jmin(size, (size_t) 64 - used);
+            memcpy(buffer + used, data, num);
+            used += num;
+            data += num;
+            size -= num;
+            if (used == 64) {
+                transform();
+                used = 0;
+            }
+        }
+    }
+
+    void finish(uint8 out[32])
+    {
+        const uint64 bits = (uint64) total * 8;
+        const uint8 one = 0x80, zero = 0;
+        update(&one, 1);
+        while (used != 56) {
+            update(&zero, 1);
+        }
+        uint8 len[8];
+        for (int i=0; i < 8; ++i) {
+            len[i] = (uint8) (bits >> (56 - 8*i));
+        }
+        update(len, 8);
+        for (int i=0; i < 8; ++i) {
+            for (int j=0; j < 4; ++j) {
+                out[4*i + j] = (uint8) (state[i] >> (24 - 8*j));
+            }
+        }
+    }
+
+private:
+    static uint32 rotr(uint32 v, int n) { return (v >> n) | (v << (32 - n)); }
+
+    void transform()
+    {
+        static const uint32 k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+        };
+
+        uint32 w[64];
+        for (int i=0; i < 16; ++i) {
+            w[i] = ((uint32) buffer[4*i] << 24) | ((uint32) buffer[4*i+1] << 16) | ((uint32) buffer[4*i+2] << 8) | buffer[4*i+3];
+        }
+        for (int i=16; i < 64; ++i) {
+            const uint32 s0 = rotr(w[i-15], 7) ^ rotr(w[i-15], 18) ^ (w[i-15] >> 3);
+            const uint32 s1 = rotr(w[i-2], 17) ^ rotr(w[i-2], 19) ^ (w[i-2] >> 10);
+            w[i] = w[i-16] + s0 + w[i-7] + s1;
+        }
+
+        uint32 a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32 e = state[4], f = state[5], g = state[6], h = state[7];
+
+        for (int i=0; i < 64; ++i) {
+            const uint32 t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            const uint32 t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+
+    uint32 state[8];
+    uint8 buffer[64];
+    size_t used = 0;
+    uint64 total = 0;
+};
+
+void hmacSha256(const uint8 * key, size_t keysize, const uint8 * data, size_t size, uint8 out[32])
+{
+    uint8 block[64] = {};
+    if (keysize > 64) {
+        Sha256 hash;
+        hash.update(key, keysize);
+        hash.finish(block);
+    } else {
+        memcpy(block, key, keysize);
+    }
+
+    uint8 pad[64];
+    for (int i=0; i < 64; ++i) pad[i] = block[i] ^ 0x36;
+    Sha256 inner;
+    inner.update(pad, 64);
+    inner.update(data, size);
+    uint8 innerhash[32];
+    inner.finish(innerhash);
+
+    for (int i=0; i < 64; ++i) pad[i] = block[i] ^ 0x5c;
+    Sha256 outer;
+    outer.update(pad, 64);
+    outer.update(innerhash, 32);
+    outer.finish(out);
+}
+
+// one block is all a 256 bit key needs
+void pbkdf2Sha256(const MemoryBlock & password, const uint8 * salt, size_t saltsize, int iterations, uint8 out[32])
+{
+    const auto * pw = static_cast<const uint8*>(password.getData());
+    const size_t pwsize = password.getSize();
+
+    HeapBlock<uint8> first (saltsize + 4);
+    memcpy(first, salt, saltsize);
+    first[saltsize] = 0; first[saltsize+1] = 0; first[saltsize+2] = 0; first[saltsize+3] = 1;
+
+    uint8 u[32];
+    hmacSha256(pw, pwsize, first, saltsize + 4, u);
+    memcpy(out, u, 32);
+
+    for (int i=1; i < iterations; ++i) {
+        hmacSha256(pw, pwsize, u, 32, u);
+        for (int j=0; j < 32; ++j) {
+            out[j] ^= u[j];
+        }
+    }
+}
+
+}
+
+//==============================================================================
+PacketCipher::PacketCipher(const String & passphrase)
+{
+    const MemoryBlock password (passphrase.toRawUTF8(), passphrase.getNumBytesAsUTF8());
+    uint8 derived[32];
+    pbkdf2Sha256(password, (const uint8 *) CIPHER_KDF_SALT, strlen(CIPHER_KDF_SALT), CIPHER_KDF_ITERATIONS, derived);
+    for (int i=0; i < 8; ++i) {
+        key[i] = load32(derived + 4*i);
+    }
+    zerostruct(derived);
+
+    fillSecureRandom(&senderId, sizeof(senderId));
+    nextNonce = (uint64) Time::currentTimeMillis() * 1000;
+}
+
+bool PacketCipher::isSealed(const char * data, int size)
+{
+    return size >= Overhead && memcmp(data, sealMarker, sizeof(sealMarker)) == 0;
+}
+
+int PacketCipher::seal(const char * data, int size, char * dest)
+{
+    auto * out = reinterpret_cast<uint8*>(dest);
+    memcpy(out, sealMarker, sizeof(sealMarker));
+    store32(out + 4, senderId);
+    store64(out + 8, nextNonce.fetch_add(1, std::memory_order_relaxed));
+
+    uint32 nonce[3];
+    nonceWords(out + 4, nonce);
+
+    chachaXor(key, nonce, reinterpret_cast<const uint8*>(data), out + HeaderSize, size);
+    computeTag(key, nonce, out + HeaderSize, size, out + HeaderSize + size);
+
+    return size + Overhead;
+}
+
+int PacketCipher::open(char * data, int size) const
+{
+    if (!isSealed(data, size)) return -1;
+
+    auto * bytes = reinterpret_cast<uint8*>(data);
+    const int datasize = size - Overhead;
+
+    uint32 nonce[3];
+    nonceWords(bytes + 4, nonce);
+
+    uint8 tag[TagSize];
+    computeTag(key, nonce, bytes + HeaderSize, datasize, tag);
+
+    // in constant time, so it gives nothing away about the right one
+    uint8 diff = 0;
+    for (int i=0; i < TagSize; ++i) {
+        diff |= (uint8) (tag[i] ^ bytes[HeaderSize + datasize + i]);
+    }
+    if (diff != 0) return -1;
+
+    // only once it's known to be genuine, or anyone could move the windows on
+    if (!replays.accept(load32(bytes + 4), load64(bytes + 8))) return -1;
+
+    // decrypted down over the header, every byte is read before it's overwritten
+    chachaXor(key, nonce, bytes + HeaderSize, bytes, datasize);
+    return datasize;
+}
+
+//==============================================================================
+bool ReplayWindow::accept(uint64 counter)
+{
+    const auto bit = [] (uint64 n) { return (uint64) 1 << (n % 64); };
+    const auto word = [] (uint64 n) { return (int) ((n / 64) % (Size / 64)); };
+
+    if (!started || counter > newest) {
+        // what the window moves past is free for the counters coming up
+        if (!started || counter - newest >= (uint64) Size) {
+            zerostruct(seen);
+        }
+        else {
+            for (uint64 n = newest + 1; n != counter; ++n) {
+                seen[word(n)] &= ~bit(n);
+            }
+        }
+        started = true;
+        newest = counter;
+        seen[word(counter)] |= bit(counter);
+        return true;
+    }
+
+    if (newest - counter >= (uint64) Size || (seen[word(counter)] & bit(counter)) != 0) {
+        return false;
+    }
+    seen[word(counter)] |= bit(counter);
+    return true;
+}
+
+bool ReplayGuard::accept(uint32 senderId, uint64 counter)
+{
+    const ScopedLock sl (lock);
+
+    auto iter = senders.find(senderId);
+    if (iter == senders.end()) {
+        if ((int) senders.size() >= MaxSenders) {
+            auto oldest = senders.begin();
+            for (auto it = senders.begin(); it != senders.end(); ++it) {
+                if (it->second.lastUse < oldest->second.lastUse) oldest = it;
+            }
+            senders.erase(oldest);
+        }
+        iter = senders.emplace(senderId, Sender()).first;
+    }
+
+    iter->second.lastUse = ++uses;
+    return iter->second.window.accept(counter);
+}
+
+
+#if JUCE_UNIT_TESTS
+
+class PacketCipherTests : public UnitTest
+{
+public:
+    PacketCipherTests() : UnitTest ("PacketCipher", "SonoBus") {}
+
+    void runTest() override
+    {
+        PacketCipher sender ("passphrase");
+        PacketCipher receiver ("passphrase");
+
+        const char packet[] = "/AoO/sink/1/data\0\0\0\0";
+        const int packetSize = (int) sizeof(packet);
+        HeapBlock<char> sealed (packetSize + PacketCipher::Overhead);
+        HeapBlock<char> copy (packetSize + PacketCipher::Overhead);
+
+        beginTest ("opens what was sealed");
+        {
+            const int sealedSize = sender.seal(packet, packetSize, sealed);
+            expectEquals (sealedSize, packetSize + PacketCipher::Overhead);
+            expect (PacketCipher::isSealed(sealed, sealedSize));
+
+            memcpy(copy, sealed, (size_t) sealedSize);
+            expectEquals (receiver.open(copy, sealedSize), packetSize);
+            expect (memcmp(copy, packet, (size_t) packetSize) == 0);
+        }
+
+        beginTest ("turns away a packet played back from another endpoint");
+        {
+            const int sealedSize = sender.seal(packet, packetSize, sealed);
+
+            // the cipher knows nothing of where a packet came from, each copy stands
+            // for the same packet arriving at a different EndpointState
+            memcpy(copy, sealed, (size_t) sealedSize);
+            expectEquals (receiver.open(copy, sealedSize), packetSize);
+            memcpy(copy, sealed, (size_t) sealedSize);
+            expectEquals (receiver.open(copy, sealedSize), -1);
+
+            // and the next one still gets through
+            const int nextSize = sender.seal(packet, packetSize, sealed);
+            expectEquals (receiver.open(sealed, nextSize), packetSize);
+        }
+
+        beginTest ("keeps the senders apart");
+        {
+            PacketCipher other ("passphrase");
+            const int sealedSize = other.seal(packet, packetSize, sealed);
+            expectEquals (receiver.open(sealed, sealedSize), packetSize);
+        }
+
+        beginTest ("turns away a tampered packet and another key");
+        {
+            const int sealedSize = sender.seal(packet, packetSize, sealed);
+            memcpy(copy, sealed, (size_t) sealedSize);
+            copy[PacketCipher::HeaderSize] ^= 1;
+            expectEquals (receiver.open(copy, sealedSize), -1);
+
+            PacketCipher stranger ("another passphrase");
+            memcpy(copy, sealed, (size_t) sealedSize);
+            expectEquals (stranger.open(copy, sealedSize), -1);
+
+            // the tampered one didn't use up the counter
+            expectEquals (receiver.open(sealed, sealedSize), packetSize);
+        }
+    }
+};
+
+static PacketCipherTests packetCipherTests;
+
+#endif
+
+}
@@ -0,0 +1,98 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include <atomic>
+#include <unordered_map>
+
+namespace SonoAudio {
+
+// The nonce counters of what was opened from one sender, so none of their packets can
+// be played back: one seen before, or older than the Size packets before the newest,
+// is turned away. Big enough for the reordering over a few paths of a sender that
+// seals for many peers. Not thread safe.
+class ReplayWindow
+{
+public:
+    static constexpr int Size = 4096;
+
+    // whether the counter is new, it's seen from then on
+    bool accept(uint64 counter);
+
+private:
+    bool started = false;
+    uint64 newest = 0;
+    uint64 seen[Size / 64] = {};
+};
+
+// The ReplayWindows of the senders, by the id in their nonces and whatever address
+// the packets come from, so a packet sent again from anywhere else is still known.
+// Up to MaxSenders of them, the one heard from longest ago makes room for a new one.
+// Only genuine packets get this far, so only those who have the key take up room.
+// Thread safe.
+class ReplayGuard
+{
+public:
+    static constexpr int MaxSenders = 1024;
+
+    // whether the counter is new for the sender, it's seen from then on
+    bool accept(uint32 senderId, uint64 counter);
+
+private:
+    struct Sender {
+        ReplayWindow window;
+        uint64 lastUse = 0;
+    };
+
+    CriticalSection lock;
+    std::unordered_map<uint32, Sender> senders;
+    uint64 uses = 0;
+};
+
+// Encrypts and authenticates the UDP packets between peers, with ChaCha20-Poly1305
+// (RFC 8439). Everyone with the same passphrase has the same key, the connection
+// server never gets it, so it can pass on and forward the packets but can't read them.
+//
+// A sealed packet is a 4 byte marker (no OSC packet starts like that), the 12 byte
+// nonce, the encrypted packet and the 16 byte tag. That keeps an OSC packet at a
+// multiple of 4 bytes, which the relay needs. The nonce is a random id of the sender
+// (from the system's secure random source), so the senders sharing the key don't run
+// into each other's nonces, and a counter, which starts at the time in microseconds,
+// so it's still ahead of what they sent before they restarted.
+//
+// Sealing and opening are thread safe. What was opened is remembered by its sender
+// and turned away if it comes again, see ReplayGuard.
+class PacketCipher
+{
+public:
+    static constexpr int HeaderSize = 16;
+    static constexpr int TagSize = 16;
+    static constexpr int Overhead = HeaderSize + TagSize;
+
+    // the key comes from the passphrase, with PBKDF2-HMAC-SHA256
+    explicit PacketCipher(const String & passphrase);
+
+    // data (size bytes) encrypted into dest, which has room for size + Overhead.
+    // They mustn't overlap. Returns the size of the sealed packet
+    int seal(const char * data, int size, char * dest);
+
+    // checks and decrypts a sealed packet where it is, the packet moves to the start of
+    // data. Returns its size, or -1 if it isn't one of ours or was opened before (it's
+    // left alone then)
+    int open(char * data, int size) const;
+
+    static bool isSealed(const char * data, int size);
+
+private:
+    uint32 key[8];
+    uint32 senderId;
+    std::atomic<uint64> nextNonce;
+    mutable ReplayGuard replays;
+
+    JUCE_DECLARE_NON_COPYABLE (PacketCipher)
+};
+
+}
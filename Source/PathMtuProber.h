@@ -0,0 +1,138 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include "aoo/aoo_types.h"
+
+#include <atomic>
+
+namespace SonoAudio {
+
+// Packetization layer path MTU discovery for one peer, loosely after RFC 8899.
+// Probes of growing size go out with the don't fragment bit set and the peer
+// acknowledges each one it got, so the largest acknowledged one is what fits
+// through the path without fragments. When a probe gets lost three times we
+// stay where we are and check again every so often, in case the path changed
+// (a VPN coming up, moving to another network). If even the size we settled on
+// gets lost, the size is unknown again and the search starts over.
+// All sizes are UDP payload bytes. nextProbe() and takeChange() belong to one
+// thread, probeArrived() may be called from any.
+class PathMtuProber
+{
+public:
+    void reset()
+    {
+        confirmed = 0;
+        probing = 0;
+        tries = 0;
+        sentMs = 0.0;
+        nextCheckMs = 0.0;
+        changed = true;
+        acked = 0;
+    }
+
+    // the size of the probe to send now, 0 for none
+    int nextProbe(double nowMs)
+    {
+        if (probing > 0) {
+            if (acked.load(std::memory_order_acquire) >= probing) {
+                changed = changed || probing != confirmed;
+                confirmed = probing;
+                // keep on going up
+                return startProbe(sizeAbove(confirmed), nowMs);
+            }
+            if (nowMs - sentMs < ProbeTimeoutMs) {
+                return 0;
+            }
+            if (++tries < MaxTries) {
+                sentMs = nowMs;
+                return probing;
+            }
+            // lost for good
+            const int lost = probing;
+            probing = 0;
+            if (lost <= confirmed) {
+                // not even what worked before, start over from the bottom
+                confirmed = 0;
+                changed = true;
+                if (lost > Sizes[0]) {
+                    return startProbe(Sizes[0], nowMs);
+                }
+            }
+            nextCheckMs = nowMs + RecheckIntervalMs;
+            return 0;
+        }
+
+        if (nowMs < nextCheckMs) {
+            return 0;
+        }
+        // check that the current size still works, then try to go up from there
+        return startProbe(confirmed > 0 ? confirmed : Sizes[0], nowMs);
+    }
+
+    // the peer got a probe of this size
+    void probeArrived(int size)
+    {
+        int prev = acked.load(std::memory_order_relaxed);
+        while (size > prev && !acked.compare_exchange_weak(prev, size, std::memory_order_acq_rel)) {}
+    }
+
+    // the largest size known to get through, 0 if unknown
+    int getSafeSize() const { return confirmed; }
+
+    // true once after the safe size changed
+    bool takeChange(int & safeSize)
+    {
+        if (!changed) return false;
+        changed = false;
+        safeSize = confirmed;
+        return true;
+    }
+
+    static constexpr double ProbeTimeoutMs = 500.0;
+    static constexpr double RecheckIntervalMs = 60000.0;
+    static constexpr int MaxTries = 3;
+
+private:
+    // the minimum of IPv6 with room for the headers of tunnels, 1420 byte
+    // VPN MTUs (WireGuard), 1500 byte ethernet over IPv6 and IPv4, and jumbo
+    // frames up to the largest packet we handle
+    static constexpr int NumSizes = 5;
+    static constexpr int Sizes[NumSizes] = { 1200, 1372, 1452, 1472, AOO_MAXPACKETSIZE };
+
+    static int sizeAbove(int size)
+    {
+        for (int i = 0; i < NumSizes; ++i) {
+            if (Sizes[i] > size && Sizes[i] <= AOO_MAXPACKETSIZE) return Sizes[i];
+        }
+        return 0;
+    }
+
+    int startProbe(int size, double nowMs)
+    {
+        if (size <= 0) {
+            // at the top
+            probing = 0;
+            nextCheckMs = nowMs + RecheckIntervalMs;
+            return 0;
+        }
+        probing = size;
+        tries = 0;
+        sentMs = nowMs;
+        acked.store(0, std::memory_order_release);
+        return size;
+    }
+
+    int confirmed = 0;
+    int probing = 0;
+    int tries = 0;
+    double sentMs = 0.0;
+    double nextCheckMs = 0.0;
+    bool changed = false;
+    std::atomic<int> acked { 0 };
+};
+
+} // namespace SonoAudio
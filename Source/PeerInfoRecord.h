@@ -0,0 +1,156 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include <cstring>
+
+namespace SonoAudio {
+
+// What we tell each peer about ourselves, so it can estimate the latency to us
+// and knows what we accept. On the wire it's a small versioned binary record,
+// which after a full one to start with only carries the fields that changed:
+//
+//   u8 format version, u8 flags, u16 sequence, u16 field mask,
+//   then the fields in the mask, in bit order, little endian
+//
+// The sequence goes up by one with every record to the same peer, so the
+// receiver notices when one got lost and can ask for a full one again.
+struct PeerInfoRecord
+{
+    enum Field {
+        FieldInLatency     = 1 << 0, // f32 ms
+        FieldOutLatency    = 1 << 1, // f32 ms
+        FieldJitterBuffer  = 1 << 2, // f32 ms
+        FieldStatus        = 1 << 3, // u8 status bits
+        FieldLanMulticast  = 1 << 4, // u8, we can be reached on the LAN multicast group
+        FieldSampleRate    = 1 << 5, // u32 Hz, of our audio device
+        AllFields          = (1 << 6) - 1
+    };
+
+    enum Status {
+        StatusRecording   = 1 << 0,
+        StatusFileStream  = 1 << 1, // takes pre-encoded file playback on a source of its own
+        StatusListener    = 1 << 2  // only listens, sends nothing back
+    };
+
+    static constexpr uint8 formatVersion = 1;
+    static constexpr uint8 flagFull = 1 << 0;
+    static constexpr int headerSize = 6;
+    static constexpr int maxSize = headerSize + 4 * 4 + 2;
+
+    float inLatencyMs = 0.0f;
+    float outLatencyMs = 0.0f;
+    float jitterBufferMs = 0.0f;
+    uint8 status = 0;
+    bool lanMulticast = false;
+    uint32 sampleRate = 0;
+
+    // the fields that differ from other
+    uint16 changedFrom(const PeerInfoRecord & other) const
+    {
+        uint16 mask = 0;
+        if (inLatencyMs != other.inLatencyMs) mask |= FieldInLatency;
+        if (outLatencyMs != other.outLatencyMs) mask |= FieldOutLatency;
+        if (jitterBufferMs != other.jitterBufferMs) mask |= FieldJitterBuffer;
+        if (status != other.status) mask |= FieldStatus;
+        if (lanMulticast != other.lanMulticast) mask |= FieldLanMulticast;
+        if (sampleRate != other.sampleRate) mask |= FieldSampleRate;
+        return mask;
+    }
+
+    // writes the fields in mask into buf, which needs room for maxSize bytes, returns the size
+    int encode(uint8 * buf, uint16 mask, uint16 sequence, bool full) const
+    {
+        if (full) mask = AllFields;
+
+        buf[0] = formatVersion;
+        buf[1] = full ? flagFull : 0;
+        writeU16(buf + 2, sequence);
+        writeU16(buf + 4, mask);
+
+        int pos = headerSize;
+        if (mask & FieldInLatency) pos += writeFloat(buf + pos, inLatencyMs);
+        if (mask & FieldOutLatency) pos += writeFloat(buf + pos, outLatencyMs);
+        if (mask & FieldJitterBuffer) pos += writeFloat(buf + pos, jitterBufferMs);
+        if (mask & FieldStatus) buf[pos++] = status;
+        if (mask & FieldLanMulticast) buf[pos++] = lanMulticast ? 1 : 0;
+        if (mask & FieldSampleRate) pos += writeU32(buf + pos, sampleRate);
+        return pos;
+    }
+
+    // reads the fields that are there into this, returns false if it can't be parsed.
+    // Fields of a newer format version we don't know about are skipped, they come last.
+    bool decode(const uint8 * buf, int size, uint16 & retmask, uint16 & retsequence, bool & retfull)
+    {
+        if (size < headerSize || buf[0] == 0) return false;
+
+        retfull = (buf[1] & flagFull) != 0;
+        retsequence = readU16(buf + 2);
+        const uint16 mask = readU16(buf + 4);
+
+        int pos = headerSize;
+        auto need = [&] (int n) { return pos + n <= size; };
+
+        if (mask & FieldInLatency) { if (!need(4)) return false; inLatencyMs = readFloat(buf + pos); pos += 4; }
+        if (mask & FieldOutLatency) { if (!need(4)) return false; outLatencyMs = readFloat(buf + pos); pos += 4; }
+        if (mask & FieldJitterBuffer) { if (!need(4)) return false; jitterBufferMs = readFloat(buf + pos); pos += 4; }
+        if (mask & FieldStatus) { if (!need(1)) return false; status = buf[pos++]; }
+        if (mask & FieldLanMulticast) { if (!need(1)) return false; lanMulticast = buf[pos++] != 0; }
+        if (mask & FieldSampleRate) { if (!need(4)) return false; sampleRate = readU32(buf + pos); pos += 4; }
+
+        retmask = (uint16) (mask & AllFields);
+        return true;
+    }
+
+private:
+    static void writeU16(uint8 * dst, uint16 value)
+    {
+        value = ByteOrder::swapIfBigEndian(value);
+        std::memcpy(dst, &value, sizeof(value));
+    }
+
+    static uint16 readU16(const uint8 * src)
+    {
+        uint16 value;
+        std::memcpy(&value, src, sizeof(value));
+        return ByteOrder::swapIfBigEndian(value);
+    }
+
+    static int writeU32(uint8 * dst, uint32 value)
+    {
+        value = ByteOrder::swapIfBigEndian(value);
+        std::memcpy(dst, &value, sizeof(value));
+        return (int) sizeof(value);
+    }
+
+    static uint32 readU32(const uint8 * src)
+    {
+        uint32 value;
+        std::memcpy(&value, src, sizeof(value));
+        return ByteOrder::swapIfBigEndian(value);
+    }
+
+    static int writeFloat(uint8 * dst, float value)
+    {
+        uint32 bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        bits = ByteOrder::swapIfBigEndian(bits);
+        std::memcpy(dst, &bits, sizeof(bits));
+        return (int) sizeof(bits);
+    }
+
+    static float readFloat(const uint8 * src)
+    {
+        uint32 bits;
+        std::memcpy(&bits, src, sizeof(bits));
+        bits = ByteOrder::swapIfBigEndian(bits);
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+};
+
+}
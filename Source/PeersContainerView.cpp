@@ -5,6 +5,9 @@
 #include "JitterBufferMeter.h"
 #include <set>
 
+// how many views of departed peers are kept around for the next ones to join
+#define MAX_POOLED_PEER_VIEWS 16
+
 using namespace SonoAudio;
 
 PeerViewInfo::PeerViewInfo() : smallLnf(12), medLnf(14), sonoSliderLNF(12), panSliderLNF(12)
@@ -33,7 +36,8 @@ enum {
 };
 
 enum {
-    FillRatioUpdateTimerId = 0
+    FillRatioUpdateTimerId = 0,
+    OnScreenRefreshTimerId
 };
 
 void PeerViewInfo::paint(Graphics& g) 
@@ -223,6 +227,13 @@ PeersContainerView::PeersContainerView(SonobusAudioProcessor& proc)
     rebuildPeerViews();
 }
 
+PeersContainerView::~PeersContainerView()
+{
+    if (mScrolledComponent) {
+        mScrolledComponent->removeComponentListener(this);
+    }
+}
+
 void PeersContainerView::configLevelSlider(Slider * slider)
 {
     //slider->setTextValueSuffix(" dB");
@@ -308,11 +319,17 @@ void PeersContainerView::resized()
 
     peersBox.performLayout(bounds);
 
+    updateOnScreenPeerViews();
+
     mPeerViewBounds.clearQuick();
 
     for (int i=0; i < mPeerViews.size(); ++i) {
         PeerViewInfo * pvf = mPeerViews.getUnchecked(i);
-        pvf->resized();
+        if (pvf->onScreen) {
+            pvf->resized();
+        } else {
+            pvf->needsResize = true;
+        }
 
         mPeerViewBounds.add(pvf->getBounds());
     }
@@ -345,6 +362,63 @@ void PeersContainerView::resized()
 
 }
 
+void PeersContainerView::parentHierarchyChanged()
+{
+    Component * scrolled = nullptr;
+    if (auto * viewport = findParentComponentOfClass<Viewport>()) {
+        scrolled = viewport->getViewedComponent();
+    }
+
+    if (scrolled != mScrolledComponent.get()) {
+        if (mScrolledComponent) {
+            mScrolledComponent->removeComponentListener(this);
+        }
+        mScrolledComponent = scrolled;
+        if (scrolled) {
+            scrolled->addComponentListener(this);
+        }
+    }
+
+    updateOnScreenPeerViews();
+}
+
+void PeersContainerView::componentMovedOrResized (Component& component, bool wasMoved, bool wasResized)
+{
+    // scrolling moves what the viewport holds
+    if (&component == mScrolledComponent.get()) {
+        updateOnScreenPeerViews();
+    }
+}
+
+void PeersContainerView::updateOnScreenPeerViews()
+{
+    auto area = getLocalBounds();
+    if (auto * viewport = findParentComponentOfClass<Viewport>()) {
+        // a little beyond what shows, so a short scroll doesn't bring in stale ones
+        area = getLocalArea(viewport, viewport->getLocalBounds()).expanded(0, 100);
+    }
+
+    for (int di=0; di < mPeerViews.size(); ++di) {
+        PeerViewInfo * pvf = mPeerViews.getUnchecked(di);
+        const bool onscreen = pvf->getBounds().intersects(area);
+        if (onscreen == pvf->onScreen) continue;
+
+        pvf->onScreen = onscreen;
+        pvf->channelGroups->setMetersActive(onscreen);
+
+        if (!onscreen) continue;
+
+        if (pvf->needsResize) {
+            pvf->needsResize = false;
+            pvf->resized();
+        }
+        if (pvf->needsRefresh) {
+            // not from in here, this can be in the middle of a layout
+            startTimer(OnScreenRefreshTimerId, 20);
+        }
+    }
+}
+
 void PeersContainerView::showPopTip(const String & message, int timeoutMs, Component * target, int maxwidth)
 {
     popTip.reset(new BubbleMessageComponent());
@@ -748,11 +822,30 @@ void PeersContainerView::rebuildPeerViews()
     showSendOptions(0, false);
     showRecvOptions(0, false);
     
+    // building a peer view is the slow part, so the ones of peers that left get reused
     while (mPeerViews.size() < numpeers) {
-        mPeerViews.add(createPeerViewInfo());
+        if (mPeerViewPool.size() > 0) {
+            PeerViewInfo * pvf = mPeerViewPool.removeAndReturn(mPeerViewPool.size() - 1);
+            pvf->lastBytesRecv = 0;
+            pvf->lastBytesSent = 0;
+            pvf->lastFillStatusVersion = 0;
+            pvf->lastDropped = 0;
+            pvf->lastDroppedChangedTimestampMs = 0;
+            pvf->stopLatencyTestTimestampMs = 0;
+            pvf->fullMode = peerModeFull;
+            mPeerViews.add(pvf);
+        } else {
+            mPeerViews.add(createPeerViewInfo());
+        }
     }
     while (mPeerViews.size() > numpeers) {
-        mPeerViews.removeLast();
+        PeerViewInfo * pvf = mPeerViews.removeAndReturn(mPeerViews.size() - 1);
+        removeChildComponent(pvf);
+        if (mPeerViewPool.size() < MAX_POOLED_PEER_VIEWS) {
+            mPeerViewPool.add(pvf);
+        } else {
+            delete pvf;
+        }
     }
 
     bool anyfull = false;
@@ -1518,6 +1611,11 @@ void PeersContainerView::updatePeerViews(int specific)
     uint32 nowstampms = Time::getMillisecondCounter();
     bool needsUpdateLayout = false;
 
+    // the periodic updates go by what the processor last published, without locking it,
+    // a specific one is after a change of ours and has to be current
+    processor.updatePublishedPeerStatus();
+    const auto & published = processor.getPublishedPeerStatus();
+
 
     //    for (int i=0; i < mPeerViews.size(); ++i) {
     for (int di=0; di < mPeerUpdateOrdering.size(); ++di) {
@@ -1532,7 +1630,14 @@ void PeersContainerView::updatePeerViews(int specific)
 
         pvf->channelGroups->setPeerMode(true, i);
 
-        bool connected = processor.getRemotePeerConnected(i);
+        SonobusAudioProcessor::PeerStatus status;
+        if (specific < 0 && i < (int) published.size()) {
+            status = published[(size_t) i];
+        } else {
+            processor.getRemotePeerStatus(i, status);
+        }
+
+        bool connected = status.connected;
         auto fullmode = pvf->fullMode;
 
         String hostname;
@@ -1560,23 +1665,23 @@ void PeersContainerView::updatePeerViews(int specific)
 #endif
 
         String sendtext;
-        bool sendactive = processor.getRemotePeerSendActive(i);
-        bool sendallow = processor.getRemotePeerSendAllow(i);
+        bool sendactive = status.sendActive;
+        bool sendallow = status.sendAllow;
 
-        bool recvactive = processor.getRemotePeerRecvActive(i);
-        bool recvallow = processor.getRemotePeerRecvAllow(i);
-        bool latactive = processor.isRemotePeerLatencyTestActive(i);
-        bool safetymuted = processor.getRemotePeerSafetyMuted(i);
+        bool recvactive = status.recvActive;
+        bool recvallow = status.recvAllow;
+        bool latactive = status.latencyTestActive;
+        bool safetymuted = status.safetyMuted;
 
-        const int chcnt = processor.getRemotePeerRecvChannelCount(i);
+        const int chcnt = status.recvChannels;
 
         double sendrate = 0.0;
         double recvrate = 0.0;
         
         if (lastUpdateTimestampMs > 0) {
             double timedelta = (nowstampms - lastUpdateTimestampMs) * 1e-3;
-            int64_t nbs = processor.getRemotePeerBytesSent(i);
-            int64_t nbr = processor.getRemotePeerBytesReceived(i);
+            int64_t nbs = status.bytesSent;
+            int64_t nbr = status.bytesReceived;
             
             sendrate = (nbs - pvf->lastBytesSent) / timedelta;
             recvrate = (nbr - pvf->lastBytesRecv) / timedelta;
@@ -1584,6 +1689,16 @@ void PeersContainerView::updatePeerViews(int specific)
             pvf->lastBytesRecv = nbr;
             pvf->lastBytesSent = nbs;
         }
+
+        if (specific < 0 && !pvf->onScreen) {
+            // only what changes its size, the rest catches up once it's scrolled to
+            if (chcnt != pvf->channelGroups->getGroupViewsCount()) {
+                pvf->channelGroups->rebuildChannelViews();
+                needsUpdateLayout = true;
+            }
+            pvf->needsRefresh = true;
+            continue;
+        }
                 
         if (sendactive) {
             //sendtext += String::formatted("%Ld sent", processor.getRemotePeerPacketsSent(i) );
@@ -1610,7 +1725,7 @@ void PeersContainerView::updatePeerViews(int specific)
             << recvfinfo.name
             << String::formatted(" | %d kb/s", lrintf(recvrate * 8 * 1e-3));
 
-            int64_t dropped = processor.getRemotePeerPacketsDropped(i);
+            int64_t dropped = status.packetsDropped;
             if (dropped > 0) {
                 recvtext += String::formatted(" | %d drop", dropped);
             }
@@ -1620,7 +1735,7 @@ void PeersContainerView::updatePeerViews(int specific)
                 pvf->lastDroppedChangedTimestampMs = nowstampms;
             }
 
-            int64_t resent = processor.getRemotePeerPacketsResent(i);
+            int64_t resent = status.packetsResent;
             if (resent > 0) {
                 recvtext += String::formatted(" | %d resent", resent);
             }
@@ -1649,8 +1764,7 @@ void PeersContainerView::updatePeerViews(int specific)
         pvf->sendActualBitrateLabel->setText(sendtext, dontSendNotification);
         pvf->recvActualBitrateLabel->setText(recvtext, dontSendNotification);
 
-        SonobusAudioProcessor::LatencyInfo latinfo;
-        processor.getRemotePeerLatencyInfo(i, latinfo);
+        const SonobusAudioProcessor::LatencyInfo & latinfo = status.latency;
         
         //pvf->pingLabel->setText(String::formatted("%d ms", (int)latinfo.pingMs ), dontSendNotification);
         pvf->pingLabel->setText(String::formatted("%d", (int)lrintf(latinfo.pingMs) ), dontSendNotification);
@@ -1677,9 +1791,9 @@ void PeersContainerView::updatePeerViews(int specific)
         pvf->latActiveButton->setToggleState(latactive, dontSendNotification);
 
 
-        bool initCompleted = false;
-        int autobufmode = (int)processor.getRemotePeerAutoresizeBufferMode(i, initCompleted);
-        float buftimeMs = processor.getRemotePeerBufferTime(i);
+        bool initCompleted = status.autoBufferInitCompleted;
+        int autobufmode = status.autoBufferMode;
+        float buftimeMs = status.bufferTimeMs;
         
         pvf->autosizeButton->setSelectedId(autobufmode, dontSendNotification);
         String buflab = (autobufmode == SonobusAudioProcessor::AutoNetBufferModeOff ? "" :
@@ -1821,13 +1935,30 @@ String PeersContainerView::generateLatencyMessage(const SonobusAudioProcessor::L
 void PeersContainerView::timerCallback(int timerId)
 {
     if (timerId == FillRatioUpdateTimerId) {
-        for (int di=0; di < mPeerViews.size(); ++di) {
+        // only the peers whose published status changed get touched
+        processor.updatePublishedPeerStatus();
+        const auto & published = processor.getPublishedPeerStatus();
+
+        for (int di=0; di < mPeerViews.size() && di < mPeerUpdateOrdering.size(); ++di) {
             PeerViewInfo * pvf = mPeerViews.getUnchecked(di);
             int i = mPeerUpdateOrdering[di];
+            if (i < 0 || i >= (int) published.size()) continue;
+
+            const auto & status = published[(size_t) i];
+            if (!pvf->onScreen || status.version == pvf->lastFillStatusVersion) continue;
+            pvf->lastFillStatusVersion = status.version;
+
+            pvf->jitterBufferMeter->setFillRatio(status.fillRatio, status.fillRatioStdDev);
+        }
+    }
+    else if (timerId == OnScreenRefreshTimerId) {
+        stopTimer(OnScreenRefreshTimerId);
 
-            float ratio, stdev;
-            if (processor.getRemotePeerReceiveBufferFillRatio(i, ratio, stdev) > 0) {
-                pvf->jitterBufferMeter->setFillRatio(ratio, stdev);
+        for (int di=0; di < mPeerViews.size() && di < mPeerUpdateOrdering.size(); ++di) {
+            PeerViewInfo * pvf = mPeerViews.getUnchecked(di);
+            if (pvf->onScreen && pvf->needsRefresh) {
+                pvf->needsRefresh = false;
+                updatePeerViews(mPeerUpdateOrdering[di]);
             }
         }
     }
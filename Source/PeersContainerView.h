@@ -132,6 +132,7 @@ public:
     
     int64_t lastBytesRecv = 0;
     int64_t lastBytesSent = 0;
+    uint32 lastFillStatusVersion = 0; // of the published peer status the meter shows
 
     int64_t lastDropped = 0;
     uint32 lastDroppedChangedTimestampMs = 0;
@@ -143,6 +144,11 @@ public:
     bool singlePanner = true;
     bool isNarrow = false;
     bool fullMode = true;
+
+    // scrolled out of view, its text and meters aren't kept up to date until it comes back
+    bool onScreen = true;
+    bool needsRefresh = false;
+    bool needsResize = false;
     
     Colour bgColor;
     Colour borderColor;
@@ -175,10 +181,12 @@ public Slider::Listener,
 public SonoChoiceButton::Listener,
 public GenericItemChooser::Listener,
 public ChannelGroupsView::Listener,
+public ComponentListener,
 public MultiTimer
 {
 public:
     PeersContainerView(SonobusAudioProcessor&);
+    virtual ~PeersContainerView();
 
     class Listener {
     public:
@@ -191,6 +199,9 @@ public:
     void paint(Graphics & g) override;
     
     void resized() override;
+
+    void parentHierarchyChanged() override;
+    void componentMovedOrResized (Component& component, bool wasMoved, bool wasResized) override;
     
     void buttonClicked (Button* buttonThatWasClicked) override;        
     void sliderValueChanged (Slider* slider) override;
@@ -261,6 +272,7 @@ protected:
     void showRecvOptions(int index, bool flag, Component * fromView=nullptr);
 
     void updatePeerOrdering();
+    void updateOnScreenPeerViews();
     int getPeerFromIndex(int index);
     juce::Rectangle<int> getBoundsForPeer(int chgroup);
     int getPeerForPoint(Point<int> pos, bool inbetween);
@@ -268,6 +280,8 @@ protected:
     ListenerList<Listener> listeners;
 
     OwnedArray<PeerViewInfo> mPeerViews;
+    // views of peers that left, given to the next ones joining instead of building new ones
+    OwnedArray<PeerViewInfo> mPeerViewPool;
     SonobusAudioProcessor& processor;
 
     // key is username, value is priority (lower is first)
@@ -299,6 +313,9 @@ protected:
     WeakReference<Component> sendOptionsCalloutBox;
     WeakReference<Component> effectsCalloutBox;
 
+    // what the viewport we're in scrolls, to know which peer views are on screen
+    WeakReference<Component> mScrolledComponent;
+
     FlexBox peersBox;
     int peersMinHeight = 120;
     int peersMinWidth = 400;
@@ -0,0 +1,240 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include <atomic>
+#include <functional>
+
+namespace SonoAudio {
+
+// Keeps the pages of a memory mapped file playback warm, so the audio thread
+// can read straight from the mapping without ever waiting on the disk. The
+// region ahead of the play position always goes first, a seek or loop moves
+// it, after that the rest of the file gets touched too (if it isn't too big)
+// so that the next seek lands on memory already. Runs on the disk thread.
+class MappedPlaybackPrefetcher : public TimeSliceClient
+{
+public:
+    MappedPlaybackPrefetcher(const MemoryMappedAudioFormatReader & mappedReader, const PositionableAudioSource & playSource)
+    : reader(mappedReader), source(playSource)
+    {
+        const int64 framebytes = jmax((int64) 1, (int64) reader.numChannels * reader.bitsPerSample / 8);
+        pageFrames = jmax((int64) 1, 4096 / framebytes);
+        aheadFrames = (int64) (AheadSeconds * reader.sampleRate);
+        warmWholeFile = reader.lengthInSamples * framebytes <= MaxWholeFileBytes;
+    }
+
+    int useTimeSlice() override
+    {
+        const int64 pos = jlimit((int64) 0, reader.lengthInSamples, source.getNextReadPosition());
+
+        // a seek, start over from there
+        if (pos < aheadStart || pos > aheadEnd) {
+            aheadStart = aheadEnd = pos;
+        }
+
+        const int64 target = jmin(reader.lengthInSamples, pos + aheadFrames);
+        if (aheadEnd < target) {
+            aheadEnd = touch(aheadEnd, jmin(target, aheadEnd + ChunkFrames));
+            return 0;
+        }
+        aheadStart = pos;
+
+        if (warmWholeFile && wholeFilePos < reader.lengthInSamples) {
+            wholeFilePos = touch(wholeFilePos, jmin(reader.lengthInSamples, wholeFilePos + ChunkFrames));
+            return 1;
+        }
+
+        return 20;
+    }
+
+private:
+    static constexpr double AheadSeconds = 10.0;
+    static constexpr int64 ChunkFrames = 65536;
+    static constexpr int64 MaxWholeFileBytes = (int64) 1 << 30;
+
+    int64 touch(int64 start, int64 end) const
+    {
+        for (int64 s = start; s < end; s += pageFrames) {
+            reader.touchSample(s);
+        }
+        return end;
+    }
+
+    const MemoryMappedAudioFormatReader & reader;
+    const PositionableAudioSource & source;
+
+    int64 pageFrames = 1024;
+    int64 aheadFrames = 0;
+    int64 aheadStart = 0;
+    int64 aheadEnd = 0;
+    int64 wholeFilePos = 0;
+    bool warmWholeFile = false;
+};
+
+
+// Float WAV copies of compressed files, so they can be played memory mapped
+// too, instead of being decoded on demand. The decoding happens once, in the
+// background, the first time a file gets loaded. The cache lives in the temp
+// directory and is kept under MaxCacheBytes, least recently used files go
+// first. All the calls are on the message thread, onCacheReady as well.
+class PlaybackFileCache : private AsyncUpdater
+{
+public:
+    explicit PlaybackFileCache(AudioFormatManager & manager) : formatManager(manager) {}
+
+    ~PlaybackFileCache() override
+    {
+        pool.removeAllJobs(true, 10000);
+        cancelPendingUpdate();
+    }
+
+    // called with the original and its cached copy once a decode finished
+    std::function<void(const File & original, const File & cached)> onCacheReady;
+
+    static bool isMappableFormat(const File & file)
+    {
+        return file.hasFileExtension("wav;bwf;aif;aiff");
+    }
+
+    // the file to memory map for playing file, itself, its cached copy, or none yet
+    File getMappableFile(const File & file) const
+    {
+        if (isMappableFormat(file)) return file;
+
+        File cached = getCacheFile(file);
+        if (cached.existsAsFile()) {
+            cached.setLastAccessTime(Time::getCurrentTime());
+            return cached;
+        }
+        return {};
+    }
+
+    // decodes file into the cache in the background, unless it's there or on its way already
+    void requestDecode(const File & file)
+    {
+        if (isMappableFormat(file) || getCacheFile(file).existsAsFile() || pending.contains(file)) return;
+
+        pending.add(file);
+        const File cachefile = getCacheFile(file);
+
+        pool.addJob([this, file, cachefile] {
+            const bool ok = decode(file, cachefile);
+            const ScopedLock sl (doneLock);
+            done.add({ file, ok ? cachefile : File() });
+            triggerAsyncUpdate();
+        });
+    }
+
+private:
+    static constexpr int64 MaxCacheBytes = (int64) 4 << 30;
+    static constexpr int64 MaxFileBytes = (int64) 2 << 30;
+
+    struct Result {
+        File original;
+        File cached;
+    };
+
+    static File getCacheDirectory()
+    {
+        return File::getSpecialLocation(File::tempDirectory).getChildFile("SonoBusPlaybackCache");
+    }
+
+    // a changed file gets a new name
+    static File getCacheFile(const File & file)
+    {
+        const String key = file.getFullPathName() + "|" + String(file.getSize()) + "|" + String(file.getLastModificationTime().toMilliseconds());
+        return getCacheDirectory().getChildFile(String::toHexString(key.hashCode64()) + ".wav");
+    }
+
+    // any thread
+    bool decode(const File & file, const File & cachefile)
+    {
+        std::unique_ptr<AudioFormatReader> reader (formatManager.createReaderFor(file));
+        if (!reader || reader->lengthInSamples <= 0
+            || reader->lengthInSamples * reader->numChannels * 4 > MaxFileBytes) {
+            return false;
+        }
+
+        getCacheDirectory().createDirectory();
+        trimCache(reader->lengthInSamples * reader->numChannels * 4);
+
+        // only ever visible complete
+        const File tempfile = cachefile.getSiblingFile(cachefile.getFileNameWithoutExtension() + ".partial");
+        tempfile.deleteFile();
+
+        {
+            WavAudioFormat wav;
+            std::unique_ptr<AudioFormatWriter> writer;
+            if (auto stream = std::unique_ptr<FileOutputStream> (tempfile.createOutputStream())) {
+                writer.reset(wav.createWriterFor(stream.get(), reader->sampleRate, reader->numChannels, 32, {}, 0));
+                if (writer) stream.release();
+            }
+            if (!writer) return false;
+
+            const int chunk = 65536;
+            AudioBuffer<float> buffer ((int) reader->numChannels, chunk);
+            for (int64 pos = 0; pos < reader->lengthInSamples; pos += chunk) {
+                if (ThreadPoolJob::getCurrentThreadPoolJob() && ThreadPoolJob::getCurrentThreadPoolJob()->shouldExit()) {
+                    writer.reset();
+                    tempfile.deleteFile();
+                    return false;
+                }
+                const int num = (int) jmin((int64) chunk, reader->lengthInSamples - pos);
+                reader->read(&buffer, 0, num, pos, true, true);
+                if (!writer->writeFromAudioSampleBuffer(buffer, 0, num)) {
+                    writer.reset();
+                    tempfile.deleteFile();
+                    return false;
+                }
+            }
+        }
+
+        return tempfile.moveFileTo(cachefile);
+    }
+
+    // makes room for needed more bytes, dropping the least recently used
+    static void trimCache(int64 needed)
+    {
+        Array<File> files = getCacheDirectory().findChildFiles(File::findFiles, false, "*.wav");
+        std::sort(files.begin(), files.end(), [] (const File & a, const File & b) {
+            return a.getLastAccessTime() < b.getLastAccessTime();
+        });
+
+        int64 total = needed;
+        for (auto & f : files) total += f.getSize();
+
+        for (auto & f : files) {
+            if (total <= MaxCacheBytes) break;
+            total -= f.getSize();
+            f.deleteFile();
+        }
+    }
+
+    void handleAsyncUpdate() override
+    {
+        Array<Result> results;
+        {
+            const ScopedLock sl (doneLock);
+            results.swapWith(done);
+        }
+
+        for (auto & res : results) {
+            pending.removeFirstMatchingValue(res.original);
+            if (res.cached != File() && onCacheReady) {
+                onCacheReady(res.original, res.cached);
+            }
+        }
+    }
+
+    AudioFormatManager & formatManager;
+    ThreadPool pool { 1 };
+    Array<File> pending;
+    CriticalSection doneLock;
+    Array<Result> done;
+};
+
+} // namespace SonoAudio
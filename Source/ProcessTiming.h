@@ -0,0 +1,206 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+namespace SonoAudio {
+
+// Cheap per-stage timing of the audio callback. The audio thread marks off
+// stages as it goes and pushes one record per block into a lock-free SPSC ring,
+// a reader thread drains it and keeps rolling statistics over recent blocks.
+// Ticks come from Time::getHighResolutionTicks(), which is the TSC backed
+// clock source on all the platforms we care about.
+class ProcessTimingTracker
+{
+public:
+    enum Stage {
+        StageSetup = 0,
+        StageInputFx,
+        StageFilePlayback,
+        StageMetronome,
+        StagePeerRender,   // wall time of all peer sink/fx/pan
+        StageSinkProcess,  // summed over peers, may run on worker threads
+        StagePeerFx,       // summed over peers, may run on worker threads
+        StagePeerSend,
+        StageReverb,
+        StageMainMix,
+        StageRecording,
+        StageMeters,
+        NumStages
+    };
+
+    static const char * getStageName(int stage)
+    {
+        static const char * names[NumStages] = {
+            "Setup", "Input FX", "File Playback", "Metronome", "Peer Render", "Sink Process",
+            "Peer FX", "Peer Send", "Reverb", "Main Mix", "Recording", "Meters"
+        };
+        return (stage >= 0 && stage < NumStages) ? names[stage] : "";
+    }
+
+    static inline int64 now() noexcept { return Time::getHighResolutionTicks(); }
+
+    ProcessTimingTracker() : fifo(RingSize)
+    {
+        history.resize(HistorySize);
+    }
+
+    // -- audio thread --
+
+    void beginBlock() noexcept
+    {
+        current = Record();
+        blockStart = lastMark = now();
+    }
+
+    // charge the time since the last mark to this stage
+    void lap(Stage stage) noexcept
+    {
+        const int64 tnow = now();
+        current.ticks[stage] += (uint32) (tnow - lastMark);
+        lastMark = tnow;
+    }
+
+    void addTicks(Stage stage, int64 ticks) noexcept
+    {
+        current.ticks[stage] += (uint32) ticks;
+    }
+
+    void endBlock(int numSamples, double sampleRate) noexcept
+    {
+        current.total = (uint32) (now() - blockStart);
+
+        if (sampleRate > 0.0) {
+            const double deadline = numSamples / sampleRate;
+            const double elapsed = Time::highResolutionTicksToSeconds(current.total);
+            if (elapsed > deadline) {
+                ++overruns;
+            }
+            lastLoad = deadline > 0.0 ? (float) (elapsed / deadline) : 0.0f;
+        }
+
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite(1, start1, size1, start2, size2);
+        if (size1 > 0) {
+            ring[(size_t)start1] = current;
+            fifo.finishedWrite(1);
+        }
+        // else the reader isn't keeping up, just drop it
+    }
+
+    // the last block's time over its deadline, audio thread only
+    float getLastBlockLoad() const noexcept { return lastLoad; }
+
+    // -- reader side, any single non-audio thread at a time --
+
+    struct StageStats {
+        double minMs = 0.0;
+        double avgMs = 0.0;
+        double p99Ms = 0.0;
+        double maxMs = 0.0;
+    };
+
+    struct Stats {
+        StageStats stages[NumStages];
+        StageStats total;
+        int numBlocks = 0;
+        uint32 overruns = 0;
+    };
+
+    // rolling stats over the most recent blocks
+    void getStats(Stats & retstats)
+    {
+        const ScopedLock sl (readLock);
+
+        drain();
+
+        retstats = Stats();
+        retstats.numBlocks = historyCount;
+        retstats.overruns = overruns.load();
+
+        if (historyCount == 0) return;
+
+        std::vector<uint32> values ((size_t) historyCount);
+
+        for (int stage = 0; stage <= NumStages; ++stage) {
+            for (int i = 0; i < historyCount; ++i) {
+                const auto & rec = history[(size_t)i];
+                values[(size_t)i] = stage < NumStages ? rec.ticks[stage] : rec.total;
+            }
+
+            auto & st = stage < NumStages ? retstats.stages[stage] : retstats.total;
+            computeStats(values, st);
+        }
+    }
+
+    uint32 getOverrunCount() const noexcept { return overruns.load(); }
+
+    void resetOverrunCount() noexcept { overruns = 0; }
+
+private:
+    static constexpr int RingSize = 1024;
+    static constexpr int HistorySize = 2048;
+
+    struct Record {
+        uint32 ticks[NumStages] = {};
+        uint32 total = 0;
+    };
+
+    void drain()
+    {
+        int start1, size1, start2, size2;
+        fifo.prepareToRead(fifo.getNumReady(), start1, size1, start2, size2);
+
+        for (int i = 0; i < size1; ++i) addToHistory(ring[(size_t)(start1 + i)]);
+        for (int i = 0; i < size2; ++i) addToHistory(ring[(size_t)(start2 + i)]);
+
+        fifo.finishedRead(size1 + size2);
+    }
+
+    void addToHistory(const Record & rec)
+    {
+        history[(size_t)historyPos] = rec;
+        historyPos = (historyPos + 1) % HistorySize;
+        historyCount = jmin(historyCount + 1, HistorySize);
+    }
+
+    static void computeStats(std::vector<uint32> & values, StageStats & st)
+    {
+        double sum = 0.0;
+        for (auto v : values) sum += v;
+
+        const size_t p99index = (size_t) ((values.size() - 1) * 99 / 100);
+        std::nth_element(values.begin(), values.begin() + (ptrdiff_t)p99index, values.end());
+        const auto minmax = std::minmax_element(values.begin(), values.end());
+
+        st.minMs = Time::highResolutionTicksToSeconds(*minmax.first) * 1e3;
+        st.maxMs = Time::highResolutionTicksToSeconds(*minmax.second) * 1e3;
+        st.p99Ms = Time::highResolutionTicksToSeconds(values[p99index]) * 1e3;
+        st.avgMs = Time::highResolutionTicksToSeconds((int64) (sum / values.size())) * 1e3;
+    }
+
+    AbstractFifo fifo;
+    Record ring[RingSize];
+
+    // audio thread only
+    Record current;
+    int64 blockStart = 0;
+    int64 lastMark = 0;
+    float lastLoad = 0.0f;
+
+    std::atomic<uint32> overruns { 0 };
+
+    // reader only
+    CriticalSection readLock;
+    std::vector<Record> history;
+    int historyPos = 0;
+    int historyCount = 0;
+};
+
+}
@@ -0,0 +1,633 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+// the libc hooks below can't be defined next to the fortified inline wrappers
+#undef _FORTIFY_SOURCE
+
+#include "RealtimeSafetyChecker.h"
+
+namespace SonoAudio {
+
+const char * RealtimeSafetyChecker::getKindName(int kind)
+{
+    static const char * names[NumKinds] = {
+        "allocation",
+        "free",
+        "lock",
+        "lock wait",
+        "syscall"
+    };
+
+    return kind >= 0 && kind < NumKinds ? names[kind] : "";
+}
+
+}
+
+#if SONOBUS_RT_CHECK
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#if (JUCE_LINUX || JUCE_MAC) && ! JUCE_ANDROID
+ #include <cxxabi.h>
+ #include <execinfo.h>
+ #define SONOBUS_RT_CHECK_BACKTRACE 1
+#else
+ #define SONOBUS_RT_CHECK_BACKTRACE 0
+#endif
+
+#if JUCE_LINUX && defined(__GLIBC__)
+ #include <dlfcn.h>
+ #include <poll.h>
+ #include <pthread.h>
+ #include <semaphore.h>
+ #include <sys/select.h>
+ #include <sys/socket.h>
+ #include <time.h>
+ #include <unistd.h>
+ #define SONOBUS_RT_CHECK_INTERPOSE_LIBC 1
+#else
+ #define SONOBUS_RT_CHECK_INTERPOSE_LIBC 0
+#endif
+
+namespace SonoAudio {
+
+namespace {
+
+// plain data only, so that touching it from inside malloc never allocates
+struct ThreadState
+{
+    int depth;
+    bool inHook;
+    const char * allowance;
+};
+
+thread_local ThreadState tlsState = { 0, false, nullptr };
+
+constexpr int MaxSites = 256;
+constexpr int MaxFrames = 24;
+constexpr int SkipFrames = 2; // record() and the hook itself
+
+struct Site
+{
+    uint64_t hash;
+    int kind;
+    const char * what;
+    const char * allowance;
+    int numFrames;
+    void * frames[MaxFrames];
+    std::atomic<int64_t> count;
+};
+
+Site sites[MaxSites];
+std::atomic<int> numSites { 0 };
+std::atomic<bool> sitesLock { false };
+std::atomic<int64_t> kindCounts[RealtimeSafetyChecker::NumKinds];
+std::atomic<int64_t> droppedCount { 0 };
+
+const bool abortOnViolation = [] {
+    auto * env = ::getenv("SONOBUS_RT_CHECK_ABORT");
+    return env != nullptr && env[0] != '\0' && env[0] != '0';
+}();
+
+#if SONOBUS_RT_CHECK_BACKTRACE
+// the first backtrace() loads the unwinder, get that out of the way before any
+// realtime section can exist
+const int backtraceWarmup = [] {
+    void * frames[2];
+    return ::backtrace(frames, 2);
+}();
+#endif
+
+struct ScopedSitesLock
+{
+    ScopedSitesLock() { while (sitesLock.exchange(true, std::memory_order_acquire)) {} }
+    ~ScopedSitesLock() { sitesLock.store(false, std::memory_order_release); }
+};
+
+uint64_t hashSite(int kind, const char * what, void * const * frames, int numFrames)
+{
+    // FNV-1a over the kind, the call name and the return addresses
+    uint64_t hash = 14695981039346656037ULL;
+    auto mix = [&hash] (uint64_t value) {
+        hash ^= value;
+        hash *= 1099511628211ULL;
+    };
+
+    mix((uint64_t) kind);
+    mix((uint64_t) (uintptr_t) what);
+    for (int i = 0; i < numFrames; ++i) {
+        mix((uint64_t) (uintptr_t) frames[i]);
+    }
+    return hash;
+}
+
+void writeStderr(const char * text)
+{
+    // goes through the interposed write(), which lets it by while inHook is set
+    auto ret = ::fwrite(text, 1, ::strlen(text), stderr);
+    ignoreUnused(ret);
+}
+
+String demangleLine(const char * line)
+{
+    String result(line);
+
+#if SONOBUS_RT_CHECK_BACKTRACE
+    // both the glibc and the darwin formats have the symbol as the first
+    // token starting with _Z, ended by '+', ' ' or ')'
+    const char * start = ::strstr(line, "_Z");
+    if (start == nullptr) return result;
+
+    const char * end = start;
+    while (*end != '\0' && *end != '+' && *end != ' ' && *end != ')') ++end;
+
+    std::string mangled(start, end);
+    int status = 0;
+    char * demangled = abi::__cxa_demangle(mangled.c_str(), nullptr, nullptr, &status);
+    if (status == 0 && demangled != nullptr) {
+        result = String(line, (size_t) (start - line)) + String(demangled) + String(end);
+    }
+    ::free(demangled);
+#endif
+
+    return result;
+}
+
+}
+
+bool RealtimeSafetyChecker::isInRealtimeSection()
+{
+    return tlsState.depth > 0;
+}
+
+void RealtimeSafetyChecker::enterSection()
+{
+    ++tlsState.depth;
+}
+
+void RealtimeSafetyChecker::leaveSection()
+{
+    --tlsState.depth;
+}
+
+const char * RealtimeSafetyChecker::pushAllowance(const char * reason)
+{
+    auto * previous = tlsState.allowance;
+    tlsState.allowance = reason;
+    return previous;
+}
+
+void RealtimeSafetyChecker::popAllowance(const char * previous)
+{
+    tlsState.allowance = previous;
+}
+
+void RealtimeSafetyChecker::record(Kind kind, const char * what)
+{
+    auto & state = tlsState;
+    if (state.depth <= 0 || state.inHook) return;
+
+    // anything the recording itself does passes straight through
+    state.inHook = true;
+
+    void * frames[MaxFrames + SkipFrames];
+    int numFrames = 0;
+#if SONOBUS_RT_CHECK_BACKTRACE
+    numFrames = ::backtrace(frames, MaxFrames + SkipFrames);
+#endif
+    const int skip = jmin(SkipFrames, numFrames);
+    void * const * siteFrames = frames + skip;
+    numFrames -= skip;
+
+    const uint64_t hash = hashSite(kind, what, siteFrames, numFrames);
+
+    kindCounts[kind].fetch_add(1, std::memory_order_relaxed);
+
+    {
+        ScopedSitesLock lock;
+
+        const int count = numSites.load(std::memory_order_relaxed);
+        int found = -1;
+        for (int i = 0; i < count; ++i) {
+            if (sites[i].hash == hash) {
+                found = i;
+                break;
+            }
+        }
+
+        if (found >= 0) {
+            sites[found].count.fetch_add(1, std::memory_order_relaxed);
+        }
+        else if (count < MaxSites) {
+            auto & site = sites[count];
+            site.hash = hash;
+            site.kind = kind;
+            site.what = what;
+            site.allowance = state.allowance;
+            site.numFrames = numFrames;
+            ::memcpy(site.frames, siteFrames, sizeof(void*) * (size_t) numFrames);
+            site.count.store(1, std::memory_order_relaxed);
+            numSites.store(count + 1, std::memory_order_release);
+        }
+        else {
+            droppedCount.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    if (abortOnViolation && state.allowance == nullptr) {
+        char header[160];
+        ::snprintf(header, sizeof(header), "SonoBus realtime check: %s (%s) in a realtime section, aborting\n",
+                   getKindName(kind), what);
+        writeStderr(header);
+#if SONOBUS_RT_CHECK_BACKTRACE
+        ::backtrace_symbols_fd(siteFrames, numFrames, 2);
+#endif
+        ::abort();
+    }
+
+    state.inHook = false;
+}
+
+int64 RealtimeSafetyChecker::getTotalCount()
+{
+    int64 total = 0;
+    for (auto & count : kindCounts) {
+        total += count.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+String RealtimeSafetyChecker::getReport(int maxSites)
+{
+    struct Entry {
+        int index;
+        int64 count;
+    };
+
+    std::vector<Entry> entries;
+    {
+        ScopedSitesLock lock;
+        const int count = numSites.load(std::memory_order_acquire);
+        for (int i = 0; i < count; ++i) {
+            entries.push_back({ i, (int64) sites[i].count.load(std::memory_order_relaxed) });
+        }
+    }
+
+    std::sort(entries.begin(), entries.end(), [] (const Entry & a, const Entry & b) { return a.count > b.count; });
+
+    String report;
+    report << "SonoBus realtime safety report: " << String(getTotalCount()) << " violations at "
+           << String((int) entries.size()) << " sites\n";
+    for (int kind = 0; kind < NumKinds; ++kind) {
+        report << "  " << getKindName(kind) << ": " << String((int64) kindCounts[kind].load(std::memory_order_relaxed)) << "\n";
+    }
+    if (auto dropped = droppedCount.load(std::memory_order_relaxed)) {
+        report << "  (" << String((int64) dropped) << " more at sites past the first " << String(MaxSites) << ")\n";
+    }
+
+    int shown = 0;
+    for (auto & entry : entries) {
+        if (shown++ >= maxSites) {
+            report << "\n... " << String((int) entries.size() - maxSites) << " more sites\n";
+            break;
+        }
+
+        // the site contents are immutable once published
+        const auto & site = sites[entry.index];
+        report << "\n" << String(entry.count) << " x " << getKindName(site.kind) << " (" << site.what << ")";
+        if (site.allowance != nullptr) {
+            report << " [allowed: " << site.allowance << "]";
+        }
+        report << "\n";
+
+#if SONOBUS_RT_CHECK_BACKTRACE
+        if (char ** symbols = ::backtrace_symbols(site.frames, site.numFrames)) {
+            for (int i = 0; i < site.numFrames; ++i) {
+                report << "    " << demangleLine(symbols[i]) << "\n";
+            }
+            ::free(symbols);
+        }
+#else
+        report << "    (no stack capture on this platform)\n";
+#endif
+    }
+
+    return report;
+}
+
+void RealtimeSafetyChecker::reset()
+{
+    ScopedSitesLock lock;
+    numSites.store(0, std::memory_order_release);
+    for (auto & count : kindCounts) {
+        count.store(0, std::memory_order_relaxed);
+    }
+    droppedCount.store(0, std::memory_order_relaxed);
+}
+
+void RealtimeSafetyChecker::logReport()
+{
+    auto report = getReport();
+    Logger::writeToLog(report);
+
+    if (auto * path = ::getenv("SONOBUS_RT_CHECK_REPORT")) {
+        File(String(CharPointer_UTF8(path))).replaceWithText(report);
+    }
+}
+
+}
+
+//==============================================================================
+// the hooks
+
+using SonoAudio::RealtimeSafetyChecker;
+
+#if SONOBUS_RT_CHECK_INTERPOSE_LIBC
+
+extern "C" {
+
+void * __libc_malloc(size_t size);
+void * __libc_calloc(size_t count, size_t size);
+void * __libc_realloc(void * ptr, size_t size);
+void * __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void * ptr);
+
+}
+
+namespace {
+
+// resolved lazily without a function local static, whose guard could take the
+// very mutex we're in the middle of interposing
+template <typename Fn>
+Fn resolveNext(std::atomic<void*> & slot, const char * name, const char * version = nullptr)
+{
+    void * fn = slot.load(std::memory_order_acquire);
+    if (fn == nullptr) {
+        // the pthread_cond ones have an old compat version that plain dlsym can return
+        if (version != nullptr) fn = ::dlvsym(RTLD_NEXT, name, version);
+        if (fn == nullptr) fn = ::dlsym(RTLD_NEXT, name);
+        slot.store(fn, std::memory_order_release);
+    }
+    return reinterpret_cast<Fn>(fn);
+}
+
+#define SONOBUS_RT_NEXT(name, ...) \
+    static std::atomic<void*> next_##name { nullptr }; \
+    auto real_##name = resolveNext<decltype(&::name)>(next_##name, #name, ##__VA_ARGS__)
+
+inline void recordCall(RealtimeSafetyChecker::Kind kind, const char * what)
+{
+    if (RealtimeSafetyChecker::isInRealtimeSection()) {
+        RealtimeSafetyChecker::record(kind, what);
+    }
+}
+
+}
+
+extern "C" {
+
+void * malloc(size_t size) __THROW
+{
+    recordCall(RealtimeSafetyChecker::KindAlloc, "malloc");
+    return __libc_malloc(size);
+}
+
+void * calloc(size_t count, size_t size) __THROW
+{
+    recordCall(RealtimeSafetyChecker::KindAlloc, "calloc");
+    return __libc_calloc(count, size);
+}
+
+void * realloc(void * ptr, size_t size) __THROW
+{
+    recordCall(RealtimeSafetyChecker::KindAlloc, "realloc");
+    return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void ** result, size_t alignment, size_t size) __THROW
+{
+    if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    recordCall(RealtimeSafetyChecker::KindAlloc, "posix_memalign");
+    void * ptr = __libc_memalign(alignment, size);
+    if (ptr == nullptr) return ENOMEM;
+    *result = ptr;
+    return 0;
+}
+
+void * aligned_alloc(size_t alignment, size_t size) __THROW
+{
+    recordCall(RealtimeSafetyChecker::KindAlloc, "aligned_alloc");
+    return __libc_memalign(alignment, size);
+}
+
+void free(void * ptr) __THROW
+{
+    if (ptr != nullptr) {
+        recordCall(RealtimeSafetyChecker::KindFree, "free");
+    }
+    __libc_free(ptr);
+}
+
+int pthread_mutex_lock(pthread_mutex_t * mutex) __THROW
+{
+    SONOBUS_RT_NEXT(pthread_mutex_lock);
+    if (RealtimeSafetyChecker::isInRealtimeSection()) {
+        SONOBUS_RT_NEXT(pthread_mutex_trylock);
+        if (real_pthread_mutex_trylock(mutex) == 0) {
+            RealtimeSafetyChecker::record(RealtimeSafetyChecker::KindLock, "pthread_mutex_lock");
+            return 0;
+        }
+        RealtimeSafetyChecker::record(RealtimeSafetyChecker::KindLockWait, "pthread_mutex_lock");
+    }
+    return real_pthread_mutex_lock(mutex);
+}
+
+int pthread_rwlock_rdlock(pthread_rwlock_t * rwlock) __THROW
+{
+    SONOBUS_RT_NEXT(pthread_rwlock_rdlock);
+    if (RealtimeSafetyChecker::isInRealtimeSection()) {
+        SONOBUS_RT_NEXT(pthread_rwlock_tryrdlock);
+        if (real_pthread_rwlock_tryrdlock(rwlock) == 0) {
+            RealtimeSafetyChecker::record(RealtimeSafetyChecker::KindLock, "pthread_rwlock_rdlock");
+            return 0;
+        }
+        RealtimeSafetyChecker::record(RealtimeSafetyChecker::KindLockWait, "pthread_rwlock_rdlock");
+    }
+    return real_pthread_rwlock_rdlock(rwlock);
+}
+
+int pthread_rwlock_wrlock(pthread_rwlock_t * rwlock) __THROW
+{
+    SONOBUS_RT_NEXT(pthread_rwlock_wrlock);
+    if (RealtimeSafetyChecker::isInRealtimeSection()) {
+        SONOBUS_RT_NEXT(pthread_rwlock_trywrlock);
+        if (real_pthread_rwlock_trywrlock(rwlock) == 0) {
+            RealtimeSafetyChecker::record(RealtimeSafetyChecker::KindLock, "pthread_rwlock_wrlock");
+            return 0;
+        }
+        RealtimeSafetyChecker::record(RealtimeSafetyChecker::KindLockWait, "pthread_rwlock_wrlock");
+    }
+    return real_pthread_rwlock_wrlock(rwlock);
+}
+
+int pthread_cond_wait(pthread_cond_t * cond, pthread_mutex_t * mutex)
+{
+    SONOBUS_RT_NEXT(pthread_cond_wait, "GLIBC_2.3.2");
+    recordCall(RealtimeSafetyChecker::KindLockWait, "pthread_cond_wait");
+    return real_pthread_cond_wait(cond, mutex);
+}
+
+int pthread_cond_timedwait(pthread_cond_t * cond, pthread_mutex_t * mutex, const struct timespec * abstime)
+{
+    SONOBUS_RT_NEXT(pthread_cond_timedwait, "GLIBC_2.3.2");
+    recordCall(RealtimeSafetyChecker::KindLockWait, "pthread_cond_timedwait");
+    return real_pthread_cond_timedwait(cond, mutex, abstime);
+}
+
+int sem_wait(sem_t * sem)
+{
+    SONOBUS_RT_NEXT(sem_wait);
+    recordCall(RealtimeSafetyChecker::KindLockWait, "sem_wait");
+    return real_sem_wait(sem);
+}
+
+ssize_t read(int fd, void * buf, size_t count)
+{
+    SONOBUS_RT_NEXT(read);
+    recordCall(RealtimeSafetyChecker::KindSyscall, "read");
+    return real_read(fd, buf, count);
+}
+
+ssize_t write(int fd, const void * buf, size_t count)
+{
+    SONOBUS_RT_NEXT(write);
+    recordCall(RealtimeSafetyChecker::KindSyscall, "write");
+    return real_write(fd, buf, count);
+}
+
+ssize_t sendto(int fd, const void * buf, size_t len, int flags, const struct sockaddr * addr, socklen_t addrlen)
+{
+    SONOBUS_RT_NEXT(sendto);
+    recordCall(RealtimeSafetyChecker::KindSyscall, "sendto");
+    return real_sendto(fd, buf, len, flags, addr, addrlen);
+}
+
+ssize_t sendmsg(int fd, const struct msghdr * msg, int flags)
+{
+    SONOBUS_RT_NEXT(sendmsg);
+    recordCall(RealtimeSafetyChecker::KindSyscall, "sendmsg");
+    return real_sendmsg(fd, msg, flags);
+}
+
+ssize_t recvfrom(int fd, void * buf, size_t len, int flags, struct sockaddr * addr, socklen_t * addrlen)
+{
+    SONOBUS_RT_NEXT(recvfrom);
+    recordCall(RealtimeSafetyChecker::KindSyscall, "recvfrom");
+    return real_recvfrom(fd, buf, len, flags, addr, addrlen);
+}
+
+int poll(struct pollfd * fds, nfds_t nfds, int timeout)
+{
+    SONOBUS_RT_NEXT(poll);
+    recordCall(RealtimeSafetyChecker::KindSyscall, "poll");
+    return real_poll(fds, nfds, timeout);
+}
+
+int select(int nfds, fd_set * readfds, fd_set * writefds, fd_set * exceptfds, struct timeval * timeout)
+{
+    SONOBUS_RT_NEXT(select);
+    recordCall(RealtimeSafetyChecker::KindSyscall, "select");
+    return real_select(nfds, readfds, writefds, exceptfds, timeout);
+}
+
+int nanosleep(const struct timespec * req, struct timespec * rem)
+{
+    SONOBUS_RT_NEXT(nanosleep);
+    recordCall(RealtimeSafetyChecker::KindSyscall, "nanosleep");
+    return real_nanosleep(req, rem);
+}
+
+int usleep(useconds_t usec)
+{
+    SONOBUS_RT_NEXT(usleep);
+    recordCall(RealtimeSafetyChecker::KindSyscall, "usleep");
+    return real_usleep(usec);
+}
+
+int fsync(int fd)
+{
+    SONOBUS_RT_NEXT(fsync);
+    recordCall(RealtimeSafetyChecker::KindSyscall, "fsync");
+    return real_fsync(fd);
+}
+
+}
+
+#undef SONOBUS_RT_NEXT
+
+#else
+
+// no libc interposition here, catch at least what goes through new and delete
+
+void * operator new (size_t size)
+{
+    if (RealtimeSafetyChecker::isInRealtimeSection()) {
+        RealtimeSafetyChecker::record(RealtimeSafetyChecker::KindAlloc, "operator new");
+    }
+    if (void * ptr = std::malloc(size == 0 ? 1 : size)) return ptr;
+    throw std::bad_alloc();
+}
+
+void * operator new[] (size_t size)
+{
+    if (RealtimeSafetyChecker::isInRealtimeSection()) {
+        RealtimeSafetyChecker::record(RealtimeSafetyChecker::KindAlloc, "operator new[]");
+    }
+    if (void * ptr = std::malloc(size == 0 ? 1 : size)) return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete (void * ptr) noexcept
+{
+    if (ptr != nullptr && RealtimeSafetyChecker::isInRealtimeSection()) {
+        RealtimeSafetyChecker::record(RealtimeSafetyChecker::KindFree, "operator delete");
+    }
+    std::free(ptr);
+}
+
+void operator delete[] (void * ptr) noexcept
+{
+    if (ptr != nullptr && RealtimeSafetyChecker::isInRealtimeSection()) {
+        RealtimeSafetyChecker::record(RealtimeSafetyChecker::KindFree, "operator delete[]");
+    }
+    std::free(ptr);
+}
+
+void operator delete (void * ptr, size_t) noexcept { operator delete (ptr); }
+void operator delete[] (void * ptr, size_t) noexcept { operator delete[] (ptr); }
+
+#endif
+
+#else // SONOBUS_RT_CHECK
+
+namespace SonoAudio {
+
+bool RealtimeSafetyChecker::isInRealtimeSection() { return false; }
+void RealtimeSafetyChecker::record(Kind, const char *) {}
+int64 RealtimeSafetyChecker::getTotalCount() { return 0; }
+String RealtimeSafetyChecker::getReport(int) { return "SonoBus realtime safety checking is not built in (SONOBUS_RT_CHECK)\n"; }
+void RealtimeSafetyChecker::reset() {}
+void RealtimeSafetyChecker::logReport() {}
+
+}
+
+#endif
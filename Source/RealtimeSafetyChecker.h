@@ -0,0 +1,118 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#ifndef SONOBUS_RT_CHECK
+ #define SONOBUS_RT_CHECK 0
+#endif
+
+namespace SonoAudio {
+
+// Debug and profiling aid for finding what isn't realtime safe on the audio
+// thread, built in with the SONOBUS_RT_CHECK cmake option and a no-op otherwise.
+// Code that has to be realtime safe runs inside a ScopedRealtimeSection, and
+// while a thread is inside one every heap allocation and free, mutex lock and
+// blocking system call it makes gets recorded along with its call stack.
+// Identical stacks fold into one site with a count.
+//
+// On Linux (glibc) malloc, the pthread locks and waits and the usual blocking
+// syscalls are interposed. That only takes for executables, i.e. the standalone
+// app and sonobus-loadtest, a plugin loaded by a host keeps getting the host's
+// libc. Everywhere else only C++ new and delete are caught.
+//
+// Setting SONOBUS_RT_CHECK_ABORT=1 in the environment aborts on the first
+// violation outside of a ScopedAllowance, with its stack on stderr, which is
+// what automated runs want. SONOBUS_RT_CHECK_REPORT=<path> has logReport()
+// also write the summary to that file.
+class RealtimeSafetyChecker
+{
+public:
+    enum Kind {
+        KindAlloc = 0,
+        KindFree,
+        KindLock,      // uncontended, could have waited though
+        KindLockWait,  // contended, or a condition/semaphore wait
+        KindSyscall,
+        NumKinds
+    };
+
+    static const char * getKindName(int kind);
+
+    static constexpr bool isBuiltIn() { return SONOBUS_RT_CHECK != 0; }
+
+    // marks the calling thread as realtime until it goes out of scope, nests
+    class ScopedRealtimeSection
+    {
+    public:
+        ScopedRealtimeSection()
+        {
+#if SONOBUS_RT_CHECK
+            enterSection();
+#endif
+        }
+
+        ~ScopedRealtimeSection()
+        {
+#if SONOBUS_RT_CHECK
+            leaveSection();
+#endif
+        }
+
+        JUCE_DECLARE_NON_COPYABLE (ScopedRealtimeSection)
+    };
+
+    // for the known offenders inside a realtime section, what happens in here
+    // is still reported but tagged with the reason, and is never fatal
+    class ScopedAllowance
+    {
+    public:
+        explicit ScopedAllowance(const char * reason)
+        {
+#if SONOBUS_RT_CHECK
+            previous = pushAllowance(reason);
+#else
+            ignoreUnused(reason);
+#endif
+        }
+
+        ~ScopedAllowance()
+        {
+#if SONOBUS_RT_CHECK
+            popAllowance(previous);
+#endif
+        }
+
+        JUCE_DECLARE_NON_COPYABLE (ScopedAllowance)
+
+    private:
+#if SONOBUS_RT_CHECK
+        const char * previous = nullptr;
+#endif
+    };
+
+    static bool isInRealtimeSection();
+
+    // called from the hooks, what is a static string naming the call
+    static void record(Kind kind, const char * what);
+
+    static int64 getTotalCount();
+
+    // symbolizes the recorded stacks, don't call from a realtime section
+    static String getReport(int maxSites = 32);
+
+    static void reset();
+
+    // writes the report to the juce Logger, and the SONOBUS_RT_CHECK_REPORT file if set
+    static void logReport();
+
+private:
+    static void enterSection();
+    static void leaveSection();
+    static const char * pushAllowance(const char * reason);
+    static void popAllowance(const char * previous);
+};
+
+}
@@ -0,0 +1,311 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include "WaveformPeakCache.h"
+
+#include <atomic>
+#include <memory>
+
+#if JUCE_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace SonoAudio {
+
+class RecordingEngine;
+
+// One file being recorded. The audio thread pushes into a single producer,
+// single consumer ring, one of the engine threads pulls from it and does the
+// encoding and the disk writes. When the ring is full the whole block is
+// dropped and counted, nothing ever waits on the audio thread.
+// On Linux the file space is reserved ahead of the writes (without changing
+// the file size), so long recordings of many tracks don't end up fragmented,
+// what is left unused gets released again when the track is closed.
+// The waveform peaks of the file are built along the way and saved next to it
+// when the track is closed, so the recording opens without being scanned.
+class RecordingTrack : public TimeSliceClient
+{
+public:
+    // takes ownership of the writer, bytesPerSecond is the estimated file growth (0 for no reservation),
+    // peaksFile is the audio file the peaks get saved for (none for no peaks), pending if it isn't destFile
+    RecordingTrack(RecordingEngine & owner, AudioFormatWriter * newWriter, int ringSamples, const File & destFile, int64 bytesPerSecond, const File & peaksFile);
+
+    ~RecordingTrack() override;
+
+    // audio thread, returns false if the data had to be dropped
+    bool write(const float * const * data, int numSamples)
+    {
+        if (numSamples <= 0) return true;
+
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite(numSamples, start1, size1, start2, size2);
+
+        if (size1 + size2 < numSamples) {
+            droppedSamples.fetch_add(numSamples, std::memory_order_relaxed);
+            noteDropped(numSamples);
+            return false;
+        }
+
+        for (int ch=0; ch < ring.getNumChannels(); ++ch) {
+            if (data[ch] == nullptr) {
+                ring.clear(ch, start1, size1);
+                if (size2 > 0) ring.clear(ch, start2, size2);
+            }
+            else {
+                ring.copyFrom(ch, start1, data[ch], size1);
+                if (size2 > 0) ring.copyFrom(ch, start2, data[ch] + size1, size2);
+            }
+        }
+
+        fifo.finishedWrite(size1 + size2);
+        return true;
+    }
+
+    int getNumChannels() const { return ring.getNumChannels(); }
+    int64 getDroppedSamples() const { return droppedSamples.load(std::memory_order_relaxed); }
+
+    int useTimeSlice() override
+    {
+        // plenty of room left, let it fill up a bit to write bigger chunks
+        if (writePendingData() == 0) {
+            return 10;
+        }
+        reserveDiskSpace();
+        return 0;
+    }
+
+private:
+    static constexpr int MaxChunk = 8192;
+    static constexpr double ReserveSeconds = 60.0;
+    static constexpr int PeakSamples = 512;
+
+    void noteDropped(int numSamples);
+
+    // returns the number of samples written
+    int writePendingData()
+    {
+        const int numready = fifo.getNumReady();
+        if (numready <= 0) return 0;
+
+        int start1, size1, start2, size2;
+        fifo.prepareToRead(jmin(numready, MaxChunk), start1, size1, start2, size2);
+
+        if (size1 > 0) writer->writeFromAudioSampleBuffer(ring, start1, size1);
+        if (size2 > 0) writer->writeFromAudioSampleBuffer(ring, start2, size2);
+
+        addPeaks(start1, size1);
+        addPeaks(start2, size2);
+
+        fifo.finishedRead(size1 + size2);
+        samplesWritten += size1 + size2;
+        return size1 + size2;
+    }
+
+    // the thumbnail only gets whole peak blocks, a partial one would be overwritten by the next
+    void addPeaks(int start, int num)
+    {
+        if (!peaks || num <= 0) return;
+
+        if (peakStageFill == 0 && num >= PeakSamples) {
+            const int whole = num - num % PeakSamples;
+            peaks->addBlock(peakSamples, ring, start, whole);
+            peakSamples += whole;
+            start += whole;
+            num -= whole;
+        }
+
+        while (num > 0) {
+            const int n = jmin(num, PeakSamples - peakStageFill);
+            for (int ch=0; ch < ring.getNumChannels(); ++ch) {
+                peakStage.copyFrom(ch, peakStageFill, ring, ch, start, n);
+            }
+            peakStageFill += n;
+            start += n;
+            num -= n;
+
+            if (peakStageFill == PeakSamples) {
+                peaks->addBlock(peakSamples, peakStage, 0, PeakSamples);
+                peakSamples += PeakSamples;
+                peakStageFill = 0;
+            }
+        }
+    }
+
+    void reserveDiskSpace()
+    {
+#if JUCE_LINUX
+        if (reserveFd < 0) return;
+
+        const int64 estimated = (int64) (samplesWritten * bytesPerSample);
+        if (estimated + reserveChunk / 2 < reservedBytes) return;
+
+        // keeps the file size, so the writer still appends where it left off
+        if (::fallocate(reserveFd, FALLOC_FL_KEEP_SIZE, (off_t) reservedBytes, (off_t) reserveChunk) == 0) {
+            reservedBytes += reserveChunk;
+        }
+        else {
+            // not supported here, or no space, either way stop trying
+            ::close(reserveFd);
+            reserveFd = -1;
+        }
+#endif
+    }
+
+    RecordingEngine & engine;
+    TimeSliceThread * thread = nullptr;
+    std::unique_ptr<AudioFormatWriter> writer;
+
+    AbstractFifo fifo;
+    AudioBuffer<float> ring;
+    std::atomic<int64> droppedSamples { 0 };
+
+    File file;
+    int64 samplesWritten = 0;
+    double bytesPerSample = 0.0;
+    int64 reserveChunk = 0;
+    int64 reservedBytes = 0;
+    int reserveFd = -1;
+
+    std::unique_ptr<AudioThumbnail> peaks;
+    AudioBuffer<float> peakStage;
+    int peakStageFill = 0;
+    int64 peakSamples = 0;
+    File peaksFor;
+};
+
+
+// The threads doing the encoding for all the recorded tracks. FLAC and Ogg
+// encoding isn't cheap, so with many tracks a single thread can't keep up, the
+// tracks get spread over a few threads instead, each new one going to the
+// thread with the fewest. Tracks and the engine are made and deleted on the
+// message thread, the engine has to outlive its tracks.
+class RecordingEngine
+{
+public:
+    RecordingEngine()
+    : maxThreads(jlimit(1, MaxThreads, SystemStats::getNumCpus() - 1))
+    {
+    }
+
+    ~RecordingEngine()
+    {
+        for (auto * thread : threads) {
+            thread->stopThread(2000);
+        }
+    }
+
+    // seconds of audio the ring of a track holds, the encoders get more slack
+    static double getRingSeconds(bool compressed) { return compressed ? 4.0 : 2.0; }
+
+    // message thread
+    std::unique_ptr<RecordingTrack> createTrack(AudioFormatWriter * writer, const File & destFile, bool compressed, int64 bytesPerSecond, const File & peaksFile = {})
+    {
+        const int ringsamples = jmax(32768, (int) (writer->getSampleRate() * getRingSeconds(compressed)));
+        return std::make_unique<RecordingTrack>(*this, writer, ringsamples, destFile, bytesPerSecond, peaksFile);
+    }
+
+    // dropped samples over all the tracks since the last resetDroppedSamples()
+    int64 getDroppedSamples() const { return droppedSamples.load(std::memory_order_relaxed); }
+    void resetDroppedSamples() { droppedSamples.store(0, std::memory_order_relaxed); }
+
+    // message thread, the thread a new client writing a recording should go on
+    TimeSliceThread & chooseThread()
+    {
+        TimeSliceThread * best = nullptr;
+        for (auto * thread : threads) {
+            if (!best || thread->getNumClients() < best->getNumClients()) {
+                best = thread;
+            }
+        }
+
+        if (!best || (best->getNumClients() > 0 && threads.size() < maxThreads)) {
+            best = threads.add(new TimeSliceThread("Recording Thread " + String(threads.size() + 1)));
+            best->startThread();
+        }
+        return *best;
+    }
+
+private:
+    friend class RecordingTrack;
+
+    static constexpr int MaxThreads = 4;
+
+    // the thumbnails of the tracks need these, but never read a file with them
+    AudioThumbnailCache & getPeakCache()
+    {
+        if (!peakCache) peakCache = std::make_unique<AudioThumbnailCache>(1);
+        return *peakCache;
+    }
+
+    const int maxThreads;
+    OwnedArray<TimeSliceThread> threads;
+    AudioFormatManager peakFormats;
+    std::unique_ptr<AudioThumbnailCache> peakCache;
+    std::atomic<int64> droppedSamples { 0 };
+};
+
+
+inline RecordingTrack::RecordingTrack(RecordingEngine & owner, AudioFormatWriter * newWriter, int ringSamples, const File & destFile, int64 bytesPerSecond, const File & peaksFile)
+: engine(owner), writer(newWriter), fifo(ringSamples), ring((int) newWriter->getNumChannels(), ringSamples), file(destFile), peaksFor(peaksFile)
+{
+    ring.clear();
+
+    if (peaksFor != File()) {
+        peaks = std::make_unique<AudioThumbnail>(PeakSamples, engine.peakFormats, engine.getPeakCache());
+        peaks->reset(ring.getNumChannels(), writer->getSampleRate(), 0);
+        peakStage.setSize(ring.getNumChannels(), PeakSamples);
+    }
+
+#if JUCE_LINUX
+    if (bytesPerSecond > 0) {
+        bytesPerSample = bytesPerSecond / jmax(1.0, writer->getSampleRate());
+        reserveChunk = (int64) (bytesPerSecond * ReserveSeconds);
+        reserveFd = ::open(file.getFullPathName().toRawUTF8(), O_WRONLY | O_CLOEXEC);
+        reserveDiskSpace();
+    }
+#else
+    ignoreUnused(bytesPerSecond);
+#endif
+
+    thread = &engine.chooseThread();
+    thread->addTimeSliceClient(this);
+}
+
+inline RecordingTrack::~RecordingTrack()
+{
+    thread->removeTimeSliceClient(this);
+
+    // flush what's left
+    while (writePendingData() > 0) {}
+
+    // closes the file
+    writer.reset();
+
+#if JUCE_LINUX
+    if (reserveFd >= 0) {
+        // give back the reservation past the end
+        ignoreUnused(::ftruncate(reserveFd, (off_t) file.getSize()));
+        ::close(reserveFd);
+    }
+#endif
+
+    if (peaks && samplesWritten > 0) {
+        if (peakStageFill > 0) {
+            peaks->addBlock(peakSamples, peakStage, 0, peakStageFill);
+        }
+        // after the file is closed, its time is part of the key
+        WaveformPeakCache::savePeaks(*peaks, peaksFor, samplesWritten, peaksFor != file);
+    }
+}
+
+inline void RecordingTrack::noteDropped(int numSamples)
+{
+    engine.droppedSamples.fetch_add(numSamples, std::memory_order_relaxed);
+}
+
+} // namespace SonoAudio
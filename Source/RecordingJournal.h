@@ -0,0 +1,242 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+namespace SonoAudio {
+
+// Crash safe recording. Instead of the final file, a journal is written next
+// to it (the same name plus JournalExtension). The journal is a small header
+// followed by chunks of interleaved raw floats, each with its own length and
+// checksum. Every SyncSeconds the data is fsynced and the header gets the
+// position up to which everything is known to be on disk, which doubles as
+// the index for finalizing. A journal cut short by a crash is still good up
+// to its last complete chunk. finalize() turns it into the standard file its
+// name asks for (WAV, FLAC or Ogg) and deletes it, that is done off the
+// audio and message threads once the recording stops, or for journals left
+// over from a crash the next time something is recorded there.
+class RecordingJournal
+{
+public:
+    static constexpr const char * JournalExtension = ".sbrec";
+
+    static File getJournalFile(const File & finalFile) { return finalFile.getSiblingFile(finalFile.getFileName() + JournalExtension); }
+    static File getFinalFile(const File & journalFile) { return journalFile.getSiblingFile(journalFile.getFileNameWithoutExtension()); }
+
+    // writes the journal, to be used like any other writer (the RecordingTrack calls it on its thread)
+    class Writer : public AudioFormatWriter
+    {
+    public:
+        // takes ownership of the stream, bits and quality are what the final file will use
+        Writer(FileOutputStream * stream, double sampRate, int numChans, int finalBits, int finalQuality)
+        : AudioFormatWriter(stream, "SonoBus Journal", sampRate, (unsigned int) numChans, 32)
+        {
+            usesFloatingPointData = true;
+
+            output->write(Magic, 4);
+            output->writeInt(Version);
+            output->writeInt64(0); // synced frames
+            output->writeInt64(HeaderSize); // synced bytes
+            output->writeDouble(sampRate);
+            output->writeInt(numChans);
+            output->writeInt(finalBits);
+            output->writeInt(finalQuality);
+            output->writeInt(0); // reserved
+
+            syncInterval = (int64) (SyncSeconds * sampRate);
+            sync();
+        }
+
+        ~Writer() override
+        {
+            sync();
+        }
+
+        bool write(const int ** samplesToWrite, int numSamples) override
+        {
+            const int numchans = (int) numChannels;
+            interleaved.ensureSize((size_t) (numSamples * numchans) * sizeof(float));
+            auto * dest = static_cast<float *>(interleaved.getData());
+
+            for (int ch=0; ch < numchans; ++ch) {
+                const float * src = reinterpret_cast<const float *>(samplesToWrite[ch]);
+                for (int i=0; i < numSamples; ++i) {
+                    dest[i * numchans + ch] = src ? src[i] : 0.0f;
+                }
+            }
+
+            const size_t numbytes = (size_t) (numSamples * numchans) * sizeof(float);
+            output->write(ChunkMagic, 4);
+            output->writeInt(numSamples);
+            output->writeInt((int) checksum(dest, numbytes));
+            if (!output->write(dest, numbytes)) {
+                return false;
+            }
+
+            framesWritten += numSamples;
+            if (framesWritten - framesSynced >= syncInterval) {
+                sync();
+            }
+            return true;
+        }
+
+    private:
+        static constexpr double SyncSeconds = 1.0;
+
+        void sync()
+        {
+            // the data first, then the header saying it's there
+            auto * stream = static_cast<FileOutputStream *>(output);
+            stream->flush();
+
+            const int64 end = stream->getPosition();
+            stream->setPosition(SyncedFramesOffset);
+            stream->writeInt64(framesWritten);
+            stream->writeInt64(end);
+            stream->flush();
+            stream->setPosition(end);
+
+            framesSynced = framesWritten;
+        }
+
+        MemoryBlock interleaved;
+        int64 framesWritten = 0;
+        int64 framesSynced = 0;
+        int64 syncInterval = 48000;
+    };
+
+    // turns the journal into its final file and deletes it, returns false and leaves it if that fails,
+    // finalFileOut gets the file written (not the usual name if that was taken)
+    static bool finalize(const File & journalFile, String & errorMessage, File * finalFileOut = nullptr)
+    {
+        FileInputStream input (journalFile);
+        if (input.failedToOpen()) {
+            errorMessage = TRANS("Could not open recording journal: ") + journalFile.getFullPathName();
+            return false;
+        }
+
+        char magic[4];
+        if (input.read(magic, 4) != 4 || memcmp(magic, Magic, 4) != 0 || input.readInt() != Version) {
+            errorMessage = TRANS("Not a recording journal: ") + journalFile.getFullPathName();
+            return false;
+        }
+
+        const int64 syncedframes = input.readInt64();
+        const int64 syncedbytes = input.readInt64();
+        const double samplerate = input.readDouble();
+        const int numchans = input.readInt();
+        const int bits = input.readInt();
+        const int quality = input.readInt();
+        input.readInt();
+
+        if (samplerate <= 0.0 || numchans <= 0 || numchans > 1024) {
+            errorMessage = TRANS("Damaged recording journal: ") + journalFile.getFullPathName();
+            return false;
+        }
+
+        File finalfile = getFinalFile(journalFile);
+        std::unique_ptr<AudioFormat> format;
+        if (finalfile.hasFileExtension(".flac")) format = std::make_unique<FlacAudioFormat>();
+        else if (finalfile.hasFileExtension(".ogg")) format = std::make_unique<OggVorbisAudioFormat>();
+        else format = std::make_unique<WavAudioFormat>();
+
+        if (finalfile.exists()) {
+            finalfile = finalfile.getNonexistentSibling();
+        }
+
+        std::unique_ptr<AudioFormatWriter> writer;
+        if (auto stream = std::unique_ptr<FileOutputStream> (finalfile.createOutputStream())) {
+            writer.reset(format->createWriterFor(stream.get(), samplerate, (unsigned int) numchans, bits, {}, quality));
+            if (writer) {
+                stream.release();
+            }
+        }
+        if (!writer) {
+            errorMessage = TRANS("Error creating writer for ") + finalfile.getFullPathName();
+            return false;
+        }
+
+        AudioBuffer<float> buffer;
+        MemoryBlock chunk;
+        int64 frames = 0;
+
+        while (!input.isExhausted()) {
+            // everything before the synced position is known to be complete, only the tail gets checked
+            const bool verify = input.getPosition() >= syncedbytes;
+
+            char chunkmagic[4];
+            if (input.read(chunkmagic, 4) != 4 || memcmp(chunkmagic, ChunkMagic, 4) != 0) break;
+            const int numframes = input.readInt();
+            const uint32 sum = (uint32) input.readInt();
+            if (numframes <= 0 || numframes > MaxChunkFrames) break;
+
+            const size_t numbytes = (size_t) (numframes * numchans) * sizeof(float);
+            chunk.ensureSize(numbytes);
+            if ((size_t) input.read(chunk.getData(), (int) numbytes) != numbytes) break;
+
+            const auto * src = static_cast<const float *>(chunk.getData());
+            if (verify && checksum(src, numbytes) != sum) break;
+
+            buffer.setSize(numchans, numframes, false, false, true);
+            for (int ch=0; ch < numchans; ++ch) {
+                float * dest = buffer.getWritePointer(ch);
+                for (int i=0; i < numframes; ++i) {
+                    dest[i] = src[i * numchans + ch];
+                }
+            }
+
+            if (!writer->writeFromAudioSampleBuffer(buffer, 0, numframes)) {
+                errorMessage = TRANS("Error writing ") + finalfile.getFullPathName();
+                return false;
+            }
+            frames += numframes;
+        }
+
+        writer.reset();
+
+        if (frames < syncedframes) {
+            // the disk lost what it said it had, keep the journal around
+            errorMessage = TRANS("Recording journal is damaged, recovered what was left: ") + journalFile.getFullPathName();
+            return false;
+        }
+
+        journalFile.deleteFile();
+        if (finalFileOut) *finalFileOut = finalfile;
+        return true;
+    }
+
+    // the journals in dir and its immediate subdirectories (where recordings go)
+    static Array<File> findJournals(const File & dir)
+    {
+        Array<File> journals;
+        const String pattern = String("*") + JournalExtension;
+        journals.addArray(dir.findChildFiles(File::findFiles, false, pattern));
+        for (auto & sub : dir.findChildFiles(File::findDirectories, false)) {
+            journals.addArray(sub.findChildFiles(File::findFiles, false, pattern));
+        }
+        return journals;
+    }
+
+private:
+    static constexpr const char * Magic = "SBRJ";
+    static constexpr const char * ChunkMagic = "SBJC";
+    static constexpr int Version = 1;
+    static constexpr int64 SyncedFramesOffset = 8;
+    static constexpr int64 HeaderSize = 48;
+    static constexpr int MaxChunkFrames = 1 << 20;
+
+    // FNV-1a
+    static uint32 checksum(const void * data, size_t numBytes)
+    {
+        auto * bytes = static_cast<const uint8 *>(data);
+        uint32 hash = 2166136261u;
+        for (size_t i=0; i < numBytes; ++i) {
+            hash = (hash ^ bytes[i]) * 16777619u;
+        }
+        return hash;
+    }
+};
+
+} // namespace SonoAudio
@@ -0,0 +1,313 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+
+#include "RemoteControl.h"
+
+#include "oscpack/osc/OscOutboundPacketStream.h"
+#include "oscpack/osc/OscReceivedElements.h"
+
+using namespace SonoAudio;
+
+#define REMOTE_CONTROL_MAX_PACKET 4096
+
+RemoteControl::RemoteControl(SonobusAudioProcessor & proc)
+: Thread("SonoRemoteControl"), processor(proc)
+{
+    selfRef = this;
+}
+
+RemoteControl::~RemoteControl()
+{
+    stop();
+}
+
+bool RemoteControl::start(int port, const String & bindAddress)
+{
+    stop();
+
+    socket = std::make_unique<DatagramSocket>();
+    if (!socket->bindToPort(port, bindAddress)) {
+        DBG("Remote control could not bind to " << bindAddress << ":" << port);
+        socket.reset();
+        return false;
+    }
+
+    processor.addClientListener(this);
+    startThread();
+    return true;
+}
+
+void RemoteControl::stop()
+{
+    if (!socket) return;
+
+    processor.removeClientListener(this);
+
+    signalThreadShouldExit();
+    socket->shutdown();
+    stopThread(1000);
+    socket.reset();
+}
+
+void RemoteControl::run()
+{
+    HeapBlock<char> buf (REMOTE_CONTROL_MAX_PACKET);
+
+    while (!threadShouldExit()) {
+        if (socket->waitUntilReady(true, 100) <= 0) continue;
+
+        String host;
+        int port = 0;
+        const int n = socket->read(buf, REMOTE_CONTROL_MAX_PACKET, false, host, port);
+        if (n <= 0) continue;
+
+        MemoryBlock data (buf, (size_t) n);
+        auto self = selfRef;
+        MessageManager::callAsync([self, data, host, port]() {
+            if (auto * rc = self.get()) {
+                rc->handlePacket(data, host, port);
+            }
+        });
+    }
+}
+
+void RemoteControl::handlePacket(const MemoryBlock & data, const String & fromHost, int fromPort)
+{
+    String address;
+    Array<var> args;
+
+    try {
+        osc::ReceivedPacket packet(static_cast<const char *>(data.getData()), (osc::osc_bundle_element_size_t) data.getSize());
+        if (packet.IsBundle()) {
+            sendReply(fromHost, fromPort, "", false, "bundles are not supported");
+            return;
+        }
+
+        osc::ReceivedMessage message(packet);
+        address = CharPointer_UTF8(message.AddressPattern());
+
+        for (auto it = message.ArgumentsBegin(); it != message.ArgumentsEnd(); ++it) {
+            if (it->IsString())       args.add(String(CharPointer_UTF8(it->AsString())));
+            else if (it->IsInt32())   args.add((int) it->AsInt32());
+            else if (it->IsInt64())   args.add((int64) it->AsInt64());
+            else if (it->IsFloat())   args.add((double) it->AsFloat());
+            else if (it->IsDouble())  args.add(it->AsDouble());
+            else if (it->IsBool())    args.add(it->AsBool());
+            else                      args.add(var());
+        }
+    }
+    catch (const osc::Exception & e) {
+        DBG("Remote control got a bad message: " << e.what());
+        return;
+    }
+
+    String error;
+    const bool ok = handleCommand(address, args, fromHost, fromPort, error);
+    sendReply(fromHost, fromPort, address, ok, error);
+}
+
+bool RemoteControl::handleCommand(const String & address, const Array<var> & args, const String & fromHost, int fromPort, String & error)
+{
+    auto needArgs = [&](int count) {
+        if (args.size() >= count) return true;
+        error = "missing arguments";
+        return false;
+    };
+
+    if (address == "/sonobus/connect") {
+        if (!needArgs(1)) return false;
+
+        const String host = args[0].toString();
+        const int port = args.size() > 1 && (int) args[1] > 0 ? (int) args[1] : DEFAULT_SERVER_PORT;
+        const String user = args.size() > 2 ? args[2].toString() : processor.getCurrentUsername();
+        const String pass = args.size() > 3 ? args[3].toString() : String();
+
+        if (user.isEmpty()) {
+            error = "no username";
+            return false;
+        }
+        if (processor.isConnectedToServer()) {
+            processor.disconnectFromServer();
+        }
+        if (!processor.connectToServer(host, port, user, pass)) {
+            error = "could not connect";
+            return false;
+        }
+        processor.setWatchPublicGroups(false);
+        if (pendingGroup.isNotEmpty()) {
+            // goes along with the login
+            processor.joinServerGroup(pendingGroup, pendingGroupPassword, pendingGroupPublic);
+            pendingGroup.clear();
+        }
+        return true;
+    }
+    else if (address == "/sonobus/disconnect") {
+        pendingGroup.clear();
+        processor.disconnectFromServer();
+        return true;
+    }
+    else if (address == "/sonobus/join") {
+        if (!needArgs(1)) return false;
+
+        const String group = args[0].toString();
+        const String pass = args.size() > 1 ? args[1].toString() : String();
+        const bool ispublic = args.size() > 2 && (bool) args[2];
+
+        if (!processor.isConnectedToServer() && !processor.isConnectingToServer()) {
+            // done once the connection is up
+            pendingGroup = group;
+            pendingGroupPassword = pass;
+            pendingGroupPublic = ispublic;
+            return true;
+        }
+
+        pendingGroup.clear();
+        if (!processor.joinServerGroup(group, pass, ispublic)) {
+            error = "could not join";
+            return false;
+        }
+        return true;
+    }
+    else if (address == "/sonobus/leave") {
+        pendingGroup.clear();
+        const String group = processor.getCurrentJoinedGroup();
+        if (group.isEmpty()) {
+            error = "not in a group";
+            return false;
+        }
+        return processor.leaveServerGroup(group);
+    }
+    else if (address == "/sonobus/status") {
+        sendStatus(fromHost, fromPort);
+        return true;
+    }
+    else if (address.startsWith("/sonobus/peer/")) {
+        if (!needArgs(2)) return false;
+
+        const int index = findPeer(args[0]);
+        if (index < 0) {
+            error = "no such peer";
+            return false;
+        }
+
+        const String what = address.fromLastOccurrenceOf("/", false, false);
+        if (what == "gain") {
+            processor.setRemotePeerLevelGain(index, jlimit(0.0f, 4.0f, (float) (double) args[1]));
+        }
+        else if (what == "buffer") {
+            processor.setRemotePeerBufferTime(index, jmax(0.0f, (float) (double) args[1]));
+        }
+        else if (what == "autobuffer") {
+            const int mode = (int) args[1];
+            if (mode < SonobusAudioProcessor::AutoNetBufferModeOff || mode > SonobusAudioProcessor::AutoNetBufferModeInitAuto) {
+                error = "bad mode";
+                return false;
+            }
+            processor.setRemotePeerAutoresizeBufferMode(index, (SonobusAudioProcessor::AutoNetBufferMode) mode);
+        }
+        else {
+            error = "unknown command";
+            return false;
+        }
+        return true;
+    }
+
+    error = "unknown command";
+    return false;
+}
+
+int RemoteControl::findPeer(const var & which) const
+{
+    const int numpeers = processor.getNumberRemotePeers();
+
+    if (which.isString()) {
+        const String name = which.toString();
+        for (int i=0; i < numpeers; ++i) {
+            if (processor.getRemotePeerUserName(i) == name) return i;
+        }
+        return -1;
+    }
+
+    const int index = (int) which;
+    return index >= 0 && index < numpeers ? index : -1;
+}
+
+void RemoteControl::sendStatus(const String & toHost, int toPort)
+{
+    char buf[REMOTE_CONTROL_MAX_PACKET];
+    const int numpeers = processor.getNumberRemotePeers();
+
+    try {
+        osc::OutboundPacketStream msg(buf, sizeof(buf));
+        msg << osc::BeginMessage("/sonobus/status")
+        << (int32_t) processor.isConnectedToServer()
+        << processor.getCurrentJoinedGroup().toRawUTF8()
+        << (int32_t) numpeers
+        << osc::EndMessage;
+        sendPacket(toHost, toPort, msg.Data(), (int) msg.Size());
+
+        for (int i=0; i < numpeers; ++i) {
+            bool initcompleted = false;
+            SonobusAudioProcessor::LatencyInfo latinfo;
+            processor.getRemotePeerLatencyInfo(i, latinfo);
+
+            osc::OutboundPacketStream peermsg(buf, sizeof(buf));
+            peermsg << osc::BeginMessage("/sonobus/peer")
+            << (int32_t) i
+            << processor.getRemotePeerUserName(i).toRawUTF8()
+            << (int32_t) processor.getRemotePeerConnected(i)
+            << processor.getRemotePeerLevelGain(i)
+            << processor.getRemotePeerBufferTime(i)
+            << (int32_t) processor.getRemotePeerAutoresizeBufferMode(i, initcompleted)
+            << latinfo.totalRoundtripMs
+            << osc::EndMessage;
+            sendPacket(toHost, toPort, peermsg.Data(), (int) peermsg.Size());
+        }
+    }
+    catch (const osc::Exception & e) {
+        DBG("exception in remote status message construction: " << e.what());
+    }
+}
+
+void RemoteControl::sendReply(const String & toHost, int toPort, const String & command, bool ok, const String & error)
+{
+    char buf[REMOTE_CONTROL_MAX_PACKET];
+
+    try {
+        osc::OutboundPacketStream msg(buf, sizeof(buf));
+        msg << osc::BeginMessage("/sonobus/reply")
+        << command.toRawUTF8()
+        << (int32_t) ok;
+        if (error.isNotEmpty()) {
+            msg << error.toRawUTF8();
+        }
+        msg << osc::EndMessage;
+        sendPacket(toHost, toPort, msg.Data(), (int) msg.Size());
+    }
+    catch (const osc::Exception & e) {
+        DBG("exception in remote reply message construction: " << e.what());
+    }
+}
+
+void RemoteControl::sendPacket(const String & toHost, int toPort, const char * data, int size)
+{
+    if (socket && toPort > 0) {
+        socket->write(toHost, toPort, data, size);
+    }
+}
+
+void RemoteControl::aooClientConnected(SonobusAudioProcessor *comp, bool success, const String & errmesg)
+{
+    // not on the message thread
+    auto self = selfRef;
+    MessageManager::callAsync([self, success]() {
+        auto * rc = self.get();
+        if (!rc || rc->pendingGroup.isEmpty()) return;
+
+        if (success) {
+            rc->processor.joinServerGroup(rc->pendingGroup, rc->pendingGroupPassword, rc->pendingGroupPublic);
+        }
+        rc->pendingGroup.clear();
+    });
+}
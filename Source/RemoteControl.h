@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include "SonobusPluginProcessor.h"
+
+namespace SonoAudio {
+
+// Lets an instance be driven without a GUI, by OSC messages over UDP, see the
+// --control-port option of the standalone app. It only listens on the loopback
+// address unless given another. Commands are carried out on the message thread
+// and each one gets a /sonobus/reply s:command i:ok [s:error] back to its sender.
+//
+//   /sonobus/connect     s:host [i:port] [s:username] [s:password]
+//   /sonobus/disconnect
+//   /sonobus/join        s:group [s:password] [i:public]   (waits for the connection if needed)
+//   /sonobus/leave
+//   /sonobus/status      replies /sonobus/status i:connected s:group i:numpeers,
+//                        then /sonobus/peer i:index s:name i:connected f:gain f:bufferms i:automode f:latencyms for each
+//   /sonobus/peer/gain        <peer> f:gain (linear, 1 is unity)
+//   /sonobus/peer/buffer      <peer> f:milliseconds
+//   /sonobus/peer/autobuffer  <peer> i:mode (0 off, 1 auto increase only, 2 auto, 3 initial auto)
+//
+// where <peer> is either i:index or s:username
+class RemoteControl : private Thread,
+                      private SonobusAudioProcessor::ClientListener
+{
+public:
+    explicit RemoteControl(SonobusAudioProcessor & processor);
+    ~RemoteControl() override;
+
+    bool start(int port, const String & bindAddress = "127.0.0.1");
+    void stop();
+
+    bool isRunning() const { return isThreadRunning(); }
+    int getPort() const { return socket ? socket->getBoundPort() : -1; }
+
+private:
+    void run() override;
+
+    // message thread
+    void handlePacket(const MemoryBlock & data, const String & fromHost, int fromPort);
+    bool handleCommand(const String & address, const Array<var> & args, const String & fromHost, int fromPort, String & error);
+    void sendStatus(const String & toHost, int toPort);
+    void sendReply(const String & toHost, int toPort, const String & command, bool ok, const String & error);
+    void sendPacket(const String & toHost, int toPort, const char * data, int size);
+
+    int findPeer(const var & which) const;
+
+    void aooClientConnected(SonobusAudioProcessor *comp, bool success, const String & errmesg) override;
+
+    SonobusAudioProcessor & processor;
+    std::unique_ptr<DatagramSocket> socket;
+    WeakReference<RemoteControl> selfRef; // handed to what runs later on the message thread
+
+    // a join asked for before the connection was up
+    String pendingGroup;
+    String pendingGroupPassword;
+    bool pendingGroupPublic = false;
+
+    JUCE_DECLARE_WEAK_REFERENCEABLE (RemoteControl)
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (RemoteControl)
+};
+
+} // namespace SonoAudio
@@ -0,0 +1,251 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include <algorithm>
+
+namespace SonoAudio {
+
+// Runs a reverb at a half or a quarter of the device samplerate. A reverb tail
+// has nothing worth keeping up where 96 kHz reaches, but every model costs per
+// sample, so at high rates most of the work went into content nobody hears.
+// The wet buffer goes down through one or two halfband stages, the reverb runs
+// on that, and the result comes back up through the same stages. The dry path
+// never comes near it.
+//
+// The halfband is a 47 tap FIR (passband to 0.19, more than 80 dB down from
+// 0.31 of its input rate). Every other tap of it is zero, so going down only
+// the output samples get computed and going up only the input ones, at 12
+// multiplies a sample per stage.
+//
+// Blocks don't need to be a multiple of the factor: what doesn't make up a
+// whole reduced sample waits for the next block, and the output is held back
+// by factor - 1 samples to always have enough.
+class ReverbDecimator
+{
+public:
+    static constexpr int MaxChannels = 2;
+
+    // allocates, call it from prepareToPlay. The factor is 1, 2 or 4, where 1
+    // just hands the buffer to the reverb as it is
+    void prepare(double sampleRate, int maxBlockSize, int factor)
+    {
+        factor = factor >= 4 ? 4 : factor >= 2 ? 2 : 1;
+        stages = factor == 4 ? 2 : factor == 2 ? 1 : 0;
+        fullRate = sampleRate;
+        maxBlock = jmax(1, maxBlockSize);
+
+        lowBuffer.setSize(MaxChannels, maxBlock / 2 + 2);
+        midBuffer.setSize(MaxChannels, maxBlock / 2 + 2);
+        outBuffer.setSize(MaxChannels, maxBlock + 2 * factor);
+        reset();
+    }
+
+    void reset()
+    {
+        for (auto & chan : down) for (auto & stage : chan) stage.reset();
+        for (auto & chan : up) for (auto & stage : chan) stage.reset();
+        for (auto & p : pendingCount) p = 0;
+        lowBuffer.clear();
+        midBuffer.clear();
+        outBuffer.clear();
+        outCount = getFactor() - 1;
+    }
+
+    int getFactor() const noexcept { return 1 << stages; }
+
+    // what the reverb has to be set up for
+    double getReverbSampleRate() const noexcept { return fullRate / getFactor(); }
+
+    // fn(float ** channels, int numSamples) processes the reverb in
+    // place, it gets called with the reduced buffer (or io itself at factor 1)
+    template <typename ProcessFn>
+    void process(float ** io, int numChannels, int numSamples, ProcessFn && fn)
+    {
+        if (stages == 0) {
+            fn(io, numSamples);
+            return;
+        }
+
+        numChannels = jlimit(1, MaxChannels, numChannels);
+        float * chans[MaxChannels];
+
+        for (int done = 0; done < numSamples; ) {
+            const int num = jmin(maxBlock, numSamples - done);
+
+            for (int ch = 0; ch < numChannels; ++ch) {
+                chans[ch] = io[ch] + done;
+            }
+
+            const int lownum = reduce(chans, numChannels, num);
+
+            float * low[MaxChannels] = { lowBuffer.getWritePointer(0), lowBuffer.getWritePointer(1) };
+            if (lownum > 0) {
+                fn(low, lownum);
+            }
+
+            expand(chans, numChannels, lownum, num);
+            done += num;
+        }
+    }
+
+private:
+    static constexpr int HalfTaps = 12; // nonzero taps on one side of the center
+    static constexpr int Taps = 4 * HalfTaps - 1;
+    static constexpr int Center = Taps / 2;
+
+    static const float * coefficients()
+    {
+        static const float c[HalfTaps] = {
+            0.315910947f, -0.0991085643f, 0.0526047853f, -0.0311561484f,
+            0.0187468791f, -0.0109930481f, 0.0061100471f, -0.00313483817f,
+            0.00143506769f, -0.000554071018f, 0.000159201231f, -2.02577681e-05f
+        };
+        return c;
+    }
+
+    // takes two samples, gives back one
+    struct Decimator
+    {
+        void reset() { std::fill(std::begin(hist), std::end(hist), 0.0f); pos = 0; }
+
+        float process(float a, float b)
+        {
+            push(a);
+            push(b);
+            // the newest sample is at x[0], the oldest at x[Taps - 1]
+            const float * x = hist + pos;
+            const float * c = coefficients();
+            float sum = 0.5f * x[Center];
+            for (int k = 0; k < HalfTaps; ++k) {
+                sum += c[k] * (x[Center - 1 - 2 * k] + x[Center + 1 + 2 * k]);
+            }
+            return sum;
+        }
+
+        void push(float v)
+        {
+            pos = pos == 0 ? Taps - 1 : pos - 1;
+            // kept twice, so the taps can always be read in one piece
+            hist[pos] = hist[pos + Taps] = v;
+        }
+
+        float hist[2 * Taps] = {};
+        int pos = 0;
+    };
+
+    // takes one sample, gives back two
+    struct Interpolator
+    {
+        static constexpr int Len = 2 * HalfTaps;
+
+        void reset() { std::fill(std::begin(hist), std::end(hist), 0.0f); pos = 0; }
+
+        void process(float in, float & a, float & b)
+        {
+            pos = pos == 0 ? Len - 1 : pos - 1;
+            hist[pos] = hist[pos + Len] = in;
+            const float * x = hist + pos;
+            const float * c = coefficients();
+            float sum = 0.0f;
+            for (int k = 0; k < HalfTaps; ++k) {
+                sum += c[k] * (x[HalfTaps - 1 - k] + x[HalfTaps + k]);
+            }
+            a = 2.0f * sum;
+            b = x[HalfTaps - 1];
+        }
+
+        float hist[2 * Len] = {};
+        int pos = 0;
+    };
+
+    // full rate in, into lowBuffer, returns how many came out
+    int reduce(float * const * in, int numChannels, int num)
+    {
+        int count = 0;
+        for (int stage = 0; stage < stages; ++stage) {
+            const bool last = stage == stages - 1;
+            AudioBuffer<float> & dest = last ? lowBuffer : midBuffer;
+            const int pending = pendingCount[stage];
+            count = 0;
+
+            for (int ch = 0; ch < numChannels; ++ch) {
+                const float * src = stage == 0 ? in[ch] : midBuffer.getReadPointer(ch);
+                float * out = dest.getWritePointer(ch);
+                auto & dec = down[ch][stage];
+                int i = 0;
+                count = 0;
+                if (pending > 0 && num > 0) {
+                    out[count++] = dec.process(pendingValue[ch][stage], src[i++]);
+                }
+                for (; i + 1 < num; i += 2) {
+                    out[count++] = dec.process(src[i], src[i + 1]);
+                }
+                if (i < num) {
+                    pendingValue[ch][stage] = src[i];
+                }
+            }
+            pendingCount[stage] = (pending + num) & 1;
+            num = count;
+        }
+        return count;
+    }
+
+    // lownum processed samples from lowBuffer back up, onto the num samples of out
+    void expand(float * const * out, int numChannels, int lownum, int num)
+    {
+        const int factor = getFactor();
+
+        for (int ch = 0; ch < numChannels; ++ch) {
+            float * dest = outBuffer.getWritePointer(ch) + outCount;
+            const float * low = lowBuffer.getReadPointer(ch);
+            if (stages == 1) {
+                for (int i = 0; i < lownum; ++i) {
+                    up[ch][0].process(low[i], dest[2 * i], dest[2 * i + 1]);
+                }
+            }
+            else {
+                float mid[2];
+                for (int i = 0; i < lownum; ++i) {
+                    up[ch][1].process(low[i], mid[0], mid[1]);
+                    up[ch][0].process(mid[0], dest[4 * i], dest[4 * i + 1]);
+                    up[ch][0].process(mid[1], dest[4 * i + 2], dest[4 * i + 3]);
+                }
+            }
+        }
+
+        const int avail = outCount + lownum * factor;
+        const int take = jmin(num, avail);
+        for (int ch = 0; ch < numChannels; ++ch) {
+            float * buf = outBuffer.getWritePointer(ch);
+            FloatVectorOperations::copy(out[ch], buf, take);
+            if (take < num) {
+                // can't happen with the hold back, but never leave garbage
+                FloatVectorOperations::clear(out[ch] + take, num - take);
+            }
+            for (int i = take; i < avail; ++i) {
+                buf[i - take] = buf[i];
+            }
+        }
+        outCount = avail - take;
+    }
+
+    double fullRate = 48000.0;
+    int maxBlock = 1;
+    int stages = 0;
+
+    Decimator down[MaxChannels][2];
+    Interpolator up[MaxChannels][2];
+    int pendingCount[2] = { 0, 0 };
+    float pendingValue[MaxChannels][2] = {};
+
+    AudioBuffer<float> lowBuffer;
+    AudioBuffer<float> midBuffer;
+    AudioBuffer<float> outBuffer;
+    int outCount = 0;
+};
+
+}
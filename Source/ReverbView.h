@@ -26,6 +26,7 @@ public:
         modelChoice.addItem(TRANS("Freeverb"), SonobusAudioProcessor::ReverbModelFreeverb);
         modelChoice.addItem(TRANS("MVerb"), SonobusAudioProcessor::ReverbModelMVerb);
         modelChoice.addItem(TRANS("Zita"), SonobusAudioProcessor::ReverbModelZita);
+        modelChoice.addItem(TRANS("FDN"), SonobusAudioProcessor::ReverbModelFdn);
 
         auto sizename = TRANS("Size");
         sizeSlider.setName("revsize");
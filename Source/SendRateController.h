@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include <cmath>
+
+namespace SonoAudio {
+
+// Delay and loss based send rate control for one peer, loosely after GCC/BBR.
+// It gets fed with the feedback of the remote sink (the round trip time and the
+// packet loss of every ping interval). A round trip time rising above its
+// recent minimum means a queue is building up somewhere on the path, so we
+// back off before it overflows, heavy loss makes us back off as well. Otherwise
+// the rate probes slowly back up to the ceiling, which is the bitrate of the
+// format the user chose. All rates are in bits/s per channel.
+// Not thread safe, the owner has to serialize the calls.
+class SendRateController
+{
+public:
+    enum State {
+        StateIncrease = 0,
+        StateHold,
+        StateDecrease
+    };
+
+    void reset(int ceilingBitrate, int floorBitrate)
+    {
+        ceiling = jmax(1, ceilingBitrate);
+        floor = jlimit(1, ceiling, floorBitrate);
+        target = ceiling;
+        state = StateIncrease;
+        smoothRttMs = -1.0;
+        minRttMs = -1.0;
+        minRttTimeMs = 0.0;
+        lastUpdateMs = 0.0;
+        lastDecreaseMs = 0.0;
+        stuckCount = 0;
+        clearSinceMs = 0.0;
+    }
+
+    // one feedback report, returns true if the target rate changed
+    bool update(double nowMs, float rttMs, float lossPercent)
+    {
+        if (rttMs < 0.0f || rttMs > MaxRttMs) return false;
+
+        smoothRttMs = smoothRttMs < 0.0 ? rttMs : 0.7 * smoothRttMs + 0.3 * rttMs;
+
+        // the baseline is the minimum over a window, so it can follow route changes
+        if (minRttMs < 0.0 || rttMs <= minRttMs || nowMs - minRttTimeMs > MinRttWindowMs) {
+            minRttMs = jmin((double) rttMs, smoothRttMs);
+            minRttTimeMs = nowMs;
+        }
+
+        const double queueDelayMs = smoothRttMs - minRttMs;
+        const double decreaseDelayMs = jmax(30.0, 0.5 * minRttMs);
+        const double holdDelayMs = 0.5 * decreaseDelayMs;
+        const double dtMs = lastUpdateMs > 0.0 ? jlimit(0.0, 5000.0, nowMs - lastUpdateMs) : 0.0;
+        lastUpdateMs = nowMs;
+
+        const int prevtarget = target;
+
+        if (lossPercent > 10.0f || queueDelayMs > decreaseDelayMs) {
+            state = StateDecrease;
+            // the loss based decrease of GCC, at least the delay based one
+            const double factor = jmin(0.85, 1.0 - 0.005 * lossPercent);
+            target = jmax(floor, (int) (target * factor));
+            lastDecreaseMs = nowMs;
+            clearSinceMs = 0.0;
+        }
+        else if (lossPercent > 2.0f || queueDelayMs > holdDelayMs || nowMs - lastDecreaseMs < HoldAfterDecreaseMs) {
+            state = StateHold;
+            clearSinceMs = 0.0;
+        }
+        else {
+            state = StateIncrease;
+            // about 8% per second
+            target = jmin(ceiling, (int) std::ceil(target * std::pow(1.08, dtMs * 1e-3)));
+            if (clearSinceMs <= 0.0) clearSinceMs = nowMs;
+        }
+
+        // pinned at the floor and still not keeping up
+        stuckCount = (state == StateDecrease && prevtarget == floor) ? stuckCount + 1 : 0;
+
+        return target != prevtarget;
+    }
+
+    int getTargetBitrate() const { return target; }
+    int getCeilingBitrate() const { return ceiling; }
+    State getState() const { return state; }
+    float getQueueDelayMs() const { return minRttMs < 0.0 ? 0.0f : (float) (smoothRttMs - minRttMs); }
+
+    // the link can't even carry the floor rate, time for a cheaper format
+    bool isOverloaded() const { return stuckCount >= OverloadReports; }
+
+    // how long the link has been clear at the ceiling rate
+    double getClearTimeMs(double nowMs) const
+    {
+        return (clearSinceMs > 0.0 && target == ceiling) ? nowMs - clearSinceMs : 0.0;
+    }
+
+private:
+    static constexpr float MaxRttMs = 2000.0f;
+    static constexpr double MinRttWindowMs = 30000.0;
+    static constexpr double HoldAfterDecreaseMs = 4000.0;
+    static constexpr int OverloadReports = 3;
+
+    int ceiling = 1;
+    int floor = 1;
+    int target = 1;
+    State state = StateIncrease;
+    double smoothRttMs = -1.0;
+    double minRttMs = -1.0;
+    double minRttTimeMs = 0.0;
+    double lastUpdateMs = 0.0;
+    double lastDecreaseMs = 0.0;
+    int stuckCount = 0;
+    double clearSinceMs = 0.0;
+};
+
+} // namespace SonoAudio
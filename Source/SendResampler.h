@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include <vector>
+
+namespace SonoAudio {
+
+// Converts a send mix from the device samplerate to the samplerate of an
+// encoder, once for all the peer sources which encode the same mix at that
+// rate, which then take it with aoo_source_process_resampled() instead of
+// each running their own resampler over it.
+//
+// A couple of input samples are kept back every block, so the interpolators
+// never need more than what's there, and the number of output samples goes
+// back and forth by one from block to block.
+class SendResampler
+{
+public:
+    SendResampler(int numChannels, double inputRate, double outputRate, int maxBlockSize)
+        : channels(numChannels), fromRate(inputRate), toRate(outputRate),
+          maxInput(maxBlockSize), ratio(inputRate / outputRate),
+          pending(numChannels, maxBlockSize + keepBack + (int) std::ceil(ratio) + 2),
+          output(numChannels, (int) std::ceil(pending.getNumSamples() / ratio) + 2),
+          interpolators((size_t) numChannels)
+    {
+        pending.clear();
+        output.clear();
+        outputPointers.resize((size_t) numChannels);
+        for (int ch=0; ch < numChannels; ++ch) {
+            outputPointers[(size_t) ch] = output.getReadPointer(ch);
+        }
+    }
+
+    int getNumChannels() const noexcept { return channels; }
+    double getInputRate() const noexcept { return fromRate; }
+    double getOutputRate() const noexcept { return toRate; }
+    int getMaxBlockSize() const noexcept { return maxInput; }
+
+    // -- audio thread --
+
+    // resamples the first numChannels of input, the ones past numInputChannels
+    // are silent. False if the block is larger than it was made for.
+    bool process(const float * const * input, int numInputChannels, int numSamples) noexcept
+    {
+        numOutput = 0;
+        ready = numSamples <= maxInput && numPending + numSamples <= pending.getNumSamples();
+        if (!ready) return false;
+
+        for (int ch=0; ch < channels; ++ch) {
+            if (ch < numInputChannels) {
+                pending.copyFrom(ch, numPending, input[ch], numSamples);
+            } else {
+                pending.clear(ch, numPending, numSamples);
+            }
+        }
+        numPending += numSamples;
+
+        const int produce = jmax(0, (int) ((numPending - keepBack) / ratio));
+        int used = 0;
+        for (int ch=0; ch < channels; ++ch) {
+            used = interpolators[(size_t) ch].process(ratio, pending.getReadPointer(ch), output.getWritePointer(ch),
+                                                      produce, numPending, 0);
+        }
+        used = jmin(used, numPending);
+
+        // keep what wasn't used up for the next block
+        const int left = numPending - used;
+        for (int ch=0; ch < channels && left > 0; ++ch) {
+            auto * samples = pending.getWritePointer(ch);
+            memmove(samples, samples + used, sizeof(float) * (size_t) left);
+        }
+        numPending = left;
+        numOutput = produce;
+        return true;
+    }
+
+    // of the last process(), if it went through
+    bool isReady() const noexcept { return ready; }
+    const float ** getOutput() noexcept { return outputPointers.data(); }
+    int getNumOutput() const noexcept { return numOutput; }
+
+private:
+    static constexpr int keepBack = 2;
+
+    const int channels;
+    const double fromRate;
+    const double toRate;
+    const int maxInput;
+    const double ratio; // input samples per output sample
+
+    AudioBuffer<float> pending;
+    int numPending = 0;
+    AudioBuffer<float> output;
+    int numOutput = 0;
+    bool ready = false;
+    std::vector<const float *> outputPointers;
+    std::vector<LagrangeInterpolator> interpolators;
+
+    JUCE_DECLARE_NON_COPYABLE (SendResampler)
+};
+
+}
@@ -0,0 +1,107 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#include "SocketTransfer.h"
+
+// how long the pacing lets the transfers fall behind before it stops making up for it,
+// so the sleeps running over don't slow them down, but a pause isn't followed by a burst
+#define XFER_PACE_SLACK_MS 250.0
+// how often a waiting connection checks if it should stop
+#define XFER_POLL_MS 50
+
+namespace SonoAudio {
+
+bool SocketTransfer::readLine(StreamingSocket & socket, String & line, int maxLength, int timeoutMs)
+{
+    const double deadline = Time::getMillisecondCounterHiRes() + timeoutMs;
+    MemoryOutputStream bytes;
+    char c = 0;
+
+    while ((int) bytes.getDataSize() < maxLength) {
+        const int remaining = (int) (deadline - Time::getMillisecondCounterHiRes());
+        if (remaining <= 0 || socket.waitUntilReady(true, remaining) <= 0) return false;
+        if (socket.read(&c, 1, false) != 1) return false;
+        if (c == '\n') {
+            line = bytes.toUTF8();
+            return true;
+        }
+        bytes.writeByte(c);
+    }
+    return false;
+}
+
+bool SocketTransfer::writeString(StreamingSocket & socket, const String & str)
+{
+    const int len = (int) str.getNumBytesAsUTF8();
+    return socket.write(str.toRawUTF8(), len) == len;
+}
+
+double TransferPacer::sent(int numBytes)
+{
+    const int bytesPerSecond = rate.load();
+    if (bytesPerSecond <= 0) return 0.0;
+
+    const double now = Time::getMillisecondCounterHiRes();
+    const SpinLock::ScopedLockType sl (lock);
+    nextDue = jmax(nextDue, now - XFER_PACE_SLACK_MS) + 1e3 * (double) numBytes / bytesPerSecond;
+    return nextDue;
+}
+
+TransferPool::TransferPool(int maxConnections_, Handler handler_)
+: maxConnections(maxConnections_), handler(std::move(handler_)), pool(maxConnections_)
+{
+    // below the audio and network threads, they're in no hurry
+    pool.setThreadPriorities(2);
+}
+
+void TransferPool::add(std::unique_ptr<StreamingSocket> connection)
+{
+    // only ever called from the one thread, the number only goes down meanwhile
+    if (pool.getNumJobs() >= maxConnections) {
+        DBG("Too many transfers going, turned away " << connection->getHostName());
+        connection->close();
+        return;
+    }
+
+    pool.addJob(new Job(*this, std::move(connection)), true);
+}
+
+void TransferPool::stopAll(int timeoutMs)
+{
+    pool.removeAllJobs(true, timeoutMs);
+}
+
+TransferPool::Job::Job(TransferPool & owner_, std::unique_ptr<StreamingSocket> connection_)
+: ThreadPoolJob("TransferConnection"), owner(owner_), connection(std::move(connection_))
+{
+}
+
+bool TransferPool::Job::wait(int ms)
+{
+    return waitUntil(Time::getMillisecondCounterHiRes() + ms);
+}
+
+bool TransferPool::Job::waitUntil(double time)
+{
+    for (double now = Time::getMillisecondCounterHiRes(); now < time; now = Time::getMillisecondCounterHiRes()) {
+        if (shouldExit()) return false;
+        Thread::sleep(jmin(XFER_POLL_MS, (int) (time - now) + 1));
+    }
+    return !shouldExit();
+}
+
+ThreadPoolJob::JobStatus TransferPool::Job::runJob()
+{
+    owner.handler(*connection, *this);
+    connection->close();
+    return jobHasFinished;
+}
+
+void TransferPool::Job::signalJobShouldExit()
+{
+    ThreadPoolJob::signalJobShouldExit();
+    // so it doesn't sit in a write that isn't getting anywhere
+    connection->close();
+}
+
+}
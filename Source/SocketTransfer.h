@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+
+namespace SonoAudio {
+
+// What the file transfers over TCP have in common (the backing track shares and the
+// double-ender uploads): the header lines, the pacing and serving the connections.
+namespace SocketTransfer {
+    // up to the newline, which isn't included. All of it has to be there within
+    // timeoutMs, however slowly it trickles in
+    bool readLine(StreamingSocket & socket, String & line, int maxLength, int timeoutMs);
+
+    bool writeString(StreamingSocket & socket, const String & str);
+}
+
+// Keeps the transfers that share it under one rate between them, however many are
+// going at once. Thread safe
+class TransferPacer
+{
+public:
+    // bytes per second, 0 for as fast as it goes
+    void setRate(int bytesPerSecond) { rate = bytesPerSecond; }
+    int getRate() const { return rate.load(); }
+
+    // numBytes just went, the time (getMillisecondCounterHiRes()) the one who sent
+    // them has to wait for before sending more, 0 if there's no limit
+    double sent(int numBytes);
+
+private:
+    std::atomic<int> rate { 0 };
+
+    SpinLock lock;
+    double nextDue = 0.0;
+};
+
+// Serves each connection on a thread of its own, so a slow or stalled one doesn't
+// hold up the others. Up to maxConnections at once, what comes in past that is
+// turned away (the other side tries again later)
+class TransferPool
+{
+public:
+    class Job;
+    // what serves a connection, on the connection's thread
+    using Handler = std::function<void(StreamingSocket & connection, Job & job)>;
+
+    TransferPool(int maxConnections, Handler handler);
+
+    // takes it and gives it a thread, or closes it if there are too many already
+    void add(std::unique_ptr<StreamingSocket> connection);
+    // stops what's going, its connections are closed
+    void stopAll(int timeoutMs);
+
+    class Job : public ThreadPoolJob
+    {
+    public:
+        Job(TransferPool & owner, std::unique_ptr<StreamingSocket> connection);
+
+        // up to ms, false if it has to stop (then sooner)
+        bool wait(int ms);
+        // until the time (getMillisecondCounterHiRes()), false if it has to stop
+        bool waitUntil(double time);
+
+        JobStatus runJob() override;
+        void signalJobShouldExit() override;
+
+    private:
+        TransferPool & owner;
+        std::unique_ptr<StreamingSocket> connection;
+    };
+
+private:
+    const int maxConnections;
+    const Handler handler;
+    ThreadPool pool;
+
+    JUCE_DECLARE_NON_COPYABLE (TransferPool)
+};
+
+}
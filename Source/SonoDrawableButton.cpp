@@ -7,6 +7,11 @@
 SonoDrawableButton::SonoDrawableButton (const String& buttonName, ButtonStyle buttonStyle)
 : DrawableButton(buttonName, buttonStyle)
 {
+    // the SVG images and the background only change with the button state, size,
+    // look and feel or display scale. Everything else (the meters and rows around
+    // it repainting) only needs a blit of the cached image, which JUCE renders at
+    // the physical pixel scale and invalidates whenever the button repaints.
+    setBufferedToImage(true);
 }
 
 
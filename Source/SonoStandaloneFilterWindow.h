@@ -662,6 +662,14 @@ private:
 
         player.audioDeviceAboutToStart (device);
         player.setMidiOutput (deviceManager.getDefaultMidiOutput());
+
+        // the threads the callback waits on join the device's workgroup, it's
+        // known by the name of the device it plays through
+        {
+            const auto setup = deviceManager.getAudioDeviceSetup();
+            const auto name = setup.outputDeviceName.isNotEmpty() ? setup.outputDeviceName : setup.inputDeviceName;
+            setAudioWorkgroupDevice (device->getTypeName() == "CoreAudio" ? name.toRawUTF8() : nullptr);
+        }
         
 #if JUCE_IOS
         if (auto iosdevice = dynamic_cast<iOSAudioIODevice*> (deviceManager.getCurrentAudioDevice())) {
@@ -679,6 +687,7 @@ private:
     {
         player.setMidiOutput (nullptr);
         player.audioDeviceStopped();
+        setAudioWorkgroupDevice (nullptr);
         emptyBuffer.setSize (0, 0);
     }
 
@@ -18,6 +18,7 @@
 #include "ChatView.h"
 #include "AutoUpdater.h"
 #include "LatencyMatchView.h"
+#include "DiagnosticsView.h"
 
 #include <sstream>
 
@@ -904,6 +905,7 @@ SonobusAudioProcessorEditor::SonobusAudioProcessorEditor (SonobusAudioProcessor&
     mReverbModelChoice->addItem(TRANS("Freeverb"), SonobusAudioProcessor::ReverbModelFreeverb);
     mReverbModelChoice->addItem(TRANS("MVerb"), SonobusAudioProcessor::ReverbModelMVerb);
     mReverbModelChoice->addItem(TRANS("Zita"), SonobusAudioProcessor::ReverbModelZita);
+    mReverbModelChoice->addItem(TRANS("FDN"), SonobusAudioProcessor::ReverbModelFdn);
 
     
     mReverbSizeSlider     = std::make_unique<Slider>(Slider::RotaryHorizontalVerticalDrag,  Slider::NoTextBox);
@@ -1281,6 +1283,8 @@ SonobusAudioProcessorEditor::SonobusAudioProcessorEditor (SonobusAudioProcessor&
     commandManager.commandStatusChanged();
     
     setWantsKeyboardFocus(true);
+
+    updateOpenGLRendering();
     
     startTimer(PeriodicUpdateTimerId, 1000);
 
@@ -1312,6 +1316,15 @@ SonobusAudioProcessorEditor::SonobusAudioProcessorEditor (SonobusAudioProcessor&
 
 SonobusAudioProcessorEditor::~SonobusAudioProcessorEditor()
 {
+    processor.setMetersActive(false);
+
+#if JUCE_OPENGL
+    // before any of what it draws goes away
+    if (mOpenGLContext) {
+        mOpenGLContext->detach();
+    }
+#endif
+
     if (menuBarModel) {
         menuBarModel->setApplicationCommandManagerToWatch(nullptr);
 #if JUCE_MAC
@@ -1653,6 +1666,16 @@ void SonobusAudioProcessorEditor::peerRequestedLatencyMatch(SonobusAudioProcesso
     triggerAsyncUpdate();
 }
 
+void SonobusAudioProcessorEditor::loadSheddingChanged(SonobusAudioProcessor *comp, int level, int prevlevel)
+{
+    {
+        const ScopedLock sl (clientStateLock);
+        clientEvents.add(ClientEvent(ClientEvent::LoadSheddingEvent, level > prevlevel, SonoAudio::LoadGovernor::getLevelName(level > prevlevel ? level : prevlevel)));
+    }
+
+    triggerAsyncUpdate();
+}
+
 
 //////////////////////////
 
@@ -1806,25 +1829,28 @@ void SonobusAudioProcessorEditor::timerCallback(int timerid)
 
         mChatButton->setToggleState(mChatView->haveNewSinceLastView(), dontSendNotification);
 
-        auto anyrec = processor.isAnyRemotePeerRecording() || processor.isRecordingToFile();
+        // the peers' part from the published status, no need to lock the processor for it
+        processor.updatePublishedPeerStatus();
+        const auto & peerstatus = processor.getPublishedPeerStatus();
+        auto anyrec = processor.isRecordingToFile() || std::any_of(peerstatus.begin(), peerstatus.end(),
+                                                                   [] (const SonobusAudioProcessor::PeerStatus & st) { return st.recording; });
         if (mPeerRecImage->isVisible() != anyrec) {
             mPeerRecImage->setVisible(anyrec);
             mPeerRecImage->repaint();
             resized();
         }
 
-#if 0
-        if (JUCEApplicationBase::isStandaloneApp() && getAudioDeviceManager())
+        if (JUCEApplicationBase::isStandaloneApp() && getAudioDeviceManager && getAudioDeviceManager())
         {
             if (auto * ad = getAudioDeviceManager()->getCurrentAudioDevice()) {
-                int inlat = ad->getInputLatencyInSamples();
-                int outlat = ad->getOutputLatencyInSamples();
-                int bufsize = ad->getCurrentBufferSizeSamples();
-                
-                DBG("InLat: " << inlat << "  OutLat: " << outlat << "  bufsize: " << bufsize);
+                const double srate = ad->getCurrentSampleRate();
+                if (srate > 0.0) {
+                    // goes into the latency estimates, only does something when it changed
+                    processor.setAudioDeviceLatency((float) (1e3 * ad->getInputLatencyInSamples() / srate),
+                                                    (float) (1e3 * ad->getOutputLatencyInSamples() / srate));
+                }
             }
         }
-#endif
         
 #if JUCE_IOS
         if (JUCEApplicationBase::isStandaloneApp()) {
@@ -2061,9 +2087,7 @@ void SonobusAudioProcessorEditor::buttonClicked (Button* buttonThatWasClicked)
 
             if (processor.getRecordFinishOpens()) {
                 // load up recording
-                loadAudioFromURL(URL(lastRecordedFile));
-                updateLayout();
-                resized();
+                loadRecordingWhenFinalized(URL(lastRecordedFile));
             }
             
         } else {
@@ -2544,6 +2568,24 @@ bool SonobusAudioProcessorEditor::saveSettingsToFile(const File & file)
 
 
 
+void SonobusAudioProcessorEditor::updateOpenGLRendering()
+{
+#if JUCE_OPENGL && !JUCE_ANDROID
+    // the android app already has one on its whole window
+    if (processor.getUseOpenGLRendering()) {
+        if (!mOpenGLContext) {
+            mOpenGLContext = std::make_unique<OpenGLContext>();
+            mOpenGLContext->setContinuousRepainting(false);
+            mOpenGLContext->attachTo(*this);
+        }
+    }
+    else if (mOpenGLContext) {
+        mOpenGLContext->detach();
+        mOpenGLContext.reset();
+    }
+#endif
+}
+
 void SonobusAudioProcessorEditor::updateSliderSnap()
 {
     // set level slider snap to mouse property based on processor state and size of slider
@@ -2584,6 +2626,22 @@ void SonobusAudioProcessorEditor::handleURL(const String & urlstr)
     }
 }
 
+void SonobusAudioProcessorEditor::loadRecordingWhenFinalized(const URL & fileurl)
+{
+    if (processor.isFinalizingRecording()) {
+        // crash safe recordings only show up once their journals are finalized
+        SafePointer<SonobusAudioProcessorEditor> safeThis (this);
+        Timer::callAfterDelay(250, [safeThis, fileurl] {
+            if (safeThis) safeThis->loadRecordingWhenFinalized(fileurl);
+        });
+        return;
+    }
+
+    loadAudioFromURL(fileurl);
+    updateLayout();
+    resized();
+}
+
 bool SonobusAudioProcessorEditor::loadAudioFromURL(const URL & fileurl)
 {
     bool ret = false;
@@ -2824,6 +2882,48 @@ void SonobusAudioProcessorEditor::showLatencyMatchView(bool show)
     }
 }
 
+void SonobusAudioProcessorEditor::showDiagnosticsView(bool show)
+{
+    if (show && diagnosticsCalloutBox == nullptr) {
+
+        auto wrap = std::make_unique<Viewport>();
+
+        Component* dw = this;
+
+#if JUCE_IOS || JUCE_ANDROID
+        const int defWidth = 340;
+        const int defHeight = 400;
+#else
+        const int defWidth = 440;
+        const int defHeight = 560;
+#endif
+
+        if (!mDiagnosticsView) {
+            mDiagnosticsView = std::make_unique<DiagnosticsView>(processor);
+        }
+
+        wrap->setSize(jmin(defWidth, dw->getWidth() - 20), jmin(defHeight, dw->getHeight() - 24));
+
+        mDiagnosticsView->setBounds(Rectangle<int>(0,0,defWidth,defHeight));
+
+        wrap->setViewedComponent(mDiagnosticsView.get(), false);
+        mDiagnosticsView->setVisible(true);
+
+        Rectangle<int> bounds =  dw->getLocalArea(nullptr, mSettingsButton->getScreenBounds());
+        diagnosticsCalloutBox = & CallOutBox::launchAsynchronously (std::move(wrap), bounds , dw, false);
+        if (CallOutBox * box = dynamic_cast<CallOutBox*>(diagnosticsCalloutBox.get())) {
+            box->setDismissalMouseClicksAreAlwaysConsumed(true);
+        }
+    }
+    else {
+        // dismiss it
+        if (CallOutBox * box = dynamic_cast<CallOutBox*>(diagnosticsCalloutBox.get())) {
+            box->dismiss();
+            diagnosticsCalloutBox = nullptr;
+        }
+    }
+}
+
 
 void SonobusAudioProcessorEditor::showConnectPopup(bool flag)
 {
@@ -3069,6 +3169,7 @@ void SonobusAudioProcessorEditor::showSettings(bool flag)
             mOptionsView->setupLocalisation = [this](const String & lang) {  return setupLocalisation(lang);  };
             mOptionsView->saveSettingsIfNeeded = [this]() {  if (saveSettingsIfNeeded) saveSettingsIfNeeded();  };
             mOptionsView->updateKeybindings = [this]() {  updateUseKeybindings();  };
+            mOptionsView->updateOpenGLRendering = [this]() {  updateOpenGLRendering();  };
 
             mOptionsView->addComponentListener(this);
             firsttime = true;
@@ -3502,18 +3603,26 @@ void SonobusAudioProcessorEditor::handleAsyncUpdate()
             // now attempt to join group
             if (ev.success) {
 
-                if (currConnectionInfo.groupName.isNotEmpty()) {
+                if (processor.isServerSessionResumed()) {
+                    // reconnected on its own, and the server put us back in our groups
+                }
+                else if (currConnectionInfo.groupName.isNotEmpty()) {
 
                     currConnectionInfo.timestamp = Time::getCurrentTime().toMilliseconds();
                     processor.addRecentServerConnectionInfo(currConnectionInfo);
 
-                    processor.setWatchPublicGroups(false);
+                    // usually the join went along with the login already
+                    if (!processor.wereServerRequestsPipelined()) {
+                        processor.setWatchPublicGroups(false);
 
-                    processor.joinServerGroup(currConnectionInfo.groupName, currConnectionInfo.groupPassword, currConnectionInfo.groupIsPublic);
+                        processor.joinServerGroup(currConnectionInfo.groupName, currConnectionInfo.groupPassword, currConnectionInfo.groupIsPublic);
+                    }
                 }
                 else {
                     // we've connected but have not specified group, assume we want to see public groups
-                    processor.setWatchPublicGroups(true);
+                    if (!processor.wereServerRequestsPipelined()) {
+                        processor.setWatchPublicGroups(true);
+                    }
                     mConnectView->updatePublicGroups();
                 }
 
@@ -3604,10 +3713,10 @@ void SonobusAudioProcessorEditor::handleAsyncUpdate()
             resized();
         }
         else if (ev.type == ClientEvent::PublicGroupModifiedEvent) {
-            mConnectView->updatePublicGroups();
+            mConnectView->updatePublicGroup(ev.group);
         }
         else if (ev.type == ClientEvent::PublicGroupDeletedEvent) {
-            mConnectView->updatePublicGroups();
+            mConnectView->updatePublicGroup(ev.group);
         }
         else if (ev.type == ClientEvent::PeerJoinEvent) {
             DBG("Peer " << ev.user << "joined doing full update");
@@ -3644,6 +3753,16 @@ void SonobusAudioProcessorEditor::handleAsyncUpdate()
 
             showLatencyMatchPrompt(ev.message, ev.floatVal);
         }
+        else if (ev.type == ClientEvent::LoadSheddingEvent) {
+            // success means it got worse, the message names what was shed or restored
+            String mesg;
+            if (ev.success) {
+                mesg << TRANS("Audio processing overloaded, reducing: ") << TRANS(ev.message);
+            } else {
+                mesg << TRANS("Audio processing recovered, restoring: ") << TRANS(ev.message);
+            }
+            mChatView->addNewChatMessage(SBChatEvent(SBChatEvent::SystemType, currGroup, "", "", "", mesg));
+        }
     }
 
     if (haveNewChatEvents.compareAndSetBool(false, true))
@@ -4938,6 +5057,12 @@ void SonobusAudioProcessorEditor::getCommandInfo (CommandID cmdID, ApplicationCo
                 info.addDefaultKeypress('i', ModifierKeys::commandModifier);
             }
             break;
+        case SonobusCommands::ShowDiagnostics:
+            info.setInfo(TRANS("Show Diagnostics"),
+                TRANS("Show Diagnostics"),
+                TRANS("Popup"), 0);
+            info.setActive(true);
+            break;
         case SonobusCommands::ShowFileMenu:
             info.setInfo(TRANS("Show File Menu"),
                 TRANS("Show File Menu"),
@@ -5001,6 +5126,7 @@ void SonobusAudioProcessorEditor::getAllCommands (Array<CommandID>& cmds) {
     cmds.add(SonobusCommands::ShowViewMenu);
     cmds.add(SonobusCommands::ShowConnectMenu);
     cmds.add(SonobusCommands::ToggleFullInfoView);
+    cmds.add(SonobusCommands::ShowDiagnostics);
 
 }
 
@@ -5030,6 +5156,9 @@ bool SonobusAudioProcessorEditor::perform (const InvocationInfo& info) {
         case SonobusCommands::SkipBack:
             buttonClicked(mSkipBackButton.get());
             break;
+        case SonobusCommands::ShowDiagnostics:
+            showDiagnosticsView(true);
+            break;
         case SonobusCommands::ShowFileMenu:
             if (mMenuBar) {
                 mMenuBar->showMenu(MenuFileIndex);
@@ -5231,6 +5360,8 @@ PopupMenu SonobusAudioProcessorEditor::SonobusMenuBarModel::getMenuForIndex (int
         case MenuViewIndex:
             retval.addCommandItem (&parent.commandManager, SonobusCommands::ChatToggle);
             retval.addCommandItem (&parent.commandManager, SonobusCommands::ToggleFullInfoView);
+            retval.addSeparator();
+            retval.addCommandItem (&parent.commandManager, SonobusCommands::ShowDiagnostics);
             break;
 
         case MenuHelpIndex:
@@ -32,6 +32,7 @@ class ChannelGroupsView;
 class MonitorDelayView;
 class ChatView;
 class LatencyMatchView;
+class DiagnosticsView;
 
 //==============================================================================
 /**
@@ -142,6 +143,7 @@ public:
     void aooClientPeerChangedState(SonobusAudioProcessor *comp, const String & mesg) override;
     void sbChatEventReceived(SonobusAudioProcessor *comp, const SBChatEvent & mesg) override;
     void peerRequestedLatencyMatch(SonobusAudioProcessor *comp, const String & username, float latency) override;
+    void loadSheddingChanged(SonobusAudioProcessor *comp, int level, int prevlevel) override;
 
     std::function<AudioDeviceManager*()> getAudioDeviceManager; // = []() { return 0; };
     std::function<bool()> isInterAppAudioConnected; // = []() { return 0; };
@@ -215,6 +217,7 @@ private:
 
     bool loadAudioFromURL(const URL & fileurl);
     bool updateTransportWithURL(const URL & fileurl);
+    void loadRecordingWhenFinalized(const URL & fileurl);
 
     class TrimFileJob;
 
@@ -227,8 +230,10 @@ private:
 
     void showLatencyMatchPrompt(const String & name, float latencyms);
     void showLatencyMatchView(bool show);
+    void showDiagnosticsView(bool show);
 
     void updateSliderSnap();
+    void updateOpenGLRendering();
 
 
     void showSaveSettingsPreset();
@@ -321,6 +326,10 @@ private:
 
     std::unique_ptr<OptionsView> mOptionsView;
 
+#if JUCE_OPENGL
+    std::unique_ptr<OpenGLContext> mOpenGLContext;
+#endif
+
     //std::unique_ptr<TabbedComponent> mSettingsTab;
 
     uint32 settingsClosedTimestamp = 0;
@@ -379,6 +388,8 @@ private:
     std::unique_ptr<TextButton> mApproveLatMatchButton;
     std::unique_ptr<LatencyMatchView> mLatMatchView;
 
+    std::unique_ptr<DiagnosticsView> mDiagnosticsView;
+
 
     std::unique_ptr<FileChooser> mFileChooser;
     File  mCurrOpenDir;
@@ -406,6 +417,7 @@ private:
     WeakReference<Component> monDelayCalloutBox;
 
     WeakReference<Component> latmatchCalloutBox;
+    WeakReference<Component> diagnosticsCalloutBox;
     WeakReference<Component> latmatchViewCalloutBox;
 
 
@@ -438,6 +450,7 @@ private:
             PublicGroupModifiedEvent,
             PublicGroupDeletedEvent,
             PeerRequestedLatencyMatchEvent,
+            LoadSheddingEvent,
             Error
         };
         
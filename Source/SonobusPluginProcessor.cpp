@@ -11,7 +11,9 @@
 
 #include "aoo/aoo_net.h"
 #include "aoo/aoo_pcm.h"
+#include "aoo/aoo_lossless.h"
 #include "aoo/aoo_opus.h"
+#include "aoo/aoo_uring.hpp"
 
 #include "oscpack/osc/OscOutboundPacketStream.h"
 #include "oscpack/osc/OscReceivedElements.h"
@@ -19,9 +21,32 @@
 #include "mtdm.h"
 
 #include <algorithm>
+#include <chrono>
+#include <thread>
 
 #include "LatencyMeasurer.h"
+#include "SendRateController.h"
+#include "SendResampler.h"
+#include "PathMtuProber.h"
+#include "LanDiscovery.h"
+#include "DoubleEnderTransfer.h"
+#include "BroadcastOutput.h"
+#include "BackingTrackShare.h"
+#include "CodecCalibration.h"
+#include "BounceCapture.h"
+#include "PacketCipher.h"
+#include "RecordingEngine.h"
+#include "RecordingJournal.h"
+#include "PacketArchive.h"
+#include "TelemetryLog.h"
+#include "TraceRecorder.h"
+#include "PlaybackFileCache.h"
+#include "EncodedFileStream.h"
+#include "ClockOffsetEstimator.h"
+#include "WaveformPeakCache.h"
 #include "Metronome.h"
+#include "CrossPlatformUtils.h"
+#include "RealtimeSafetyChecker.h"
 
 using namespace SonoAudio;
 
@@ -35,11 +60,77 @@ typedef int socklen_t;
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <unistd.h>
+#include <poll.h>
+#endif
+
+#if JUCE_LINUX
+#include <netinet/udp.h>
+#include <sys/eventfd.h>
 #endif
 
 #define MAX_DELAY_SAMPLES 192000
 #define SENDBUFSIZE_SCALAR 2.0f
 #define PEER_PING_INTERVAL_MS 2000.0
+#define SOURCE_PING_INTERVAL_MS 2000
+#define SINK_SOURCE_TIMEOUT_MS 60000
+#define SEND_PACK_LIMIT 4
+#define SEND_REDUNDANCY_MAX 3
+#define FILESTREAM_SEND_BUFFER_MS 200.0f
+#define FILESTREAM_MAX_BLOCKS_PER_TICK 8
+#define MET_SESSION_TIE_SECS 0.005
+#define LATENCY_TEST_RELEASE_IDLE_MS 10000.0
+#define MAX_PEER_STATE_CACHE 1000
+// an endpoint nothing came from or went to for ENDPOINT_IDLE_MS (well past the sinks
+// forgetting a silent source, which is what holds on to its endpoint) and that no peer
+// uses is dropped, they're checked every ENDPOINT_COLLECT_INTERVAL_MS. It gets deleted
+// ENDPOINT_RETIRE_GRACE_MS later, when no packet or event in flight can still have it
+#define ENDPOINT_IDLE_MS (2.0 * SINK_SOURCE_TIMEOUT_MS)
+#define ENDPOINT_COLLECT_INTERVAL_MS 10000.0
+#define ENDPOINT_RETIRE_GRACE_MS 10000.0
+#define PEER_STATUS_PUBLISH_MS 100.0
+// while power saving and nothing streams
+#define POWER_SAVING_SEND_WAIT_MS 250
+#define POWER_SAVING_RECV_POLL_MS 250
+#define POWER_SAVING_EVENT_WAIT_MS 500
+#define POWER_SAVING_PING_BACKOFF 4.0
+// how long the hybrid receive mode keeps spinning after the last packet
+#define RECV_HYBRID_SPIN_MS 2.0
+// SO_BUSY_POLL while spinning
+#define RECV_BUSY_POLL_US 50
+#define PEER_INFO_DEBOUNCE_MS 50.0
+#define LATINFO_CHANGE_THRESHOLD_MS 0.5f
+#define SENDRATE_STEPUP_WAIT_MS 30000.0
+#define SENDRATE_STEPUP_WAIT_MAX_MS 600000.0
+#define SENDFRAME_LATENCY_FRACTION 0.1
+#define SENDFRAME_HOLD_MS 20000.0
+#define LAN_MULTICAST_PORT 11475
+#define LAN_MULTICAST_PROBE_INTERVAL_MS 1000.0
+#define LAN_MULTICAST_TIMEOUT_MS 3500.0
+// when the mDNS port couldn't be had
+#define LAN_DISCOVERY_RETRY_MS 10000.0
+
+// a double-ender host tells its peers this often if it's recording, and after
+// DOUBLE_ENDER_HOST_TIMEOUT_MS without hearing from it they stop
+#define DOUBLE_ENDER_ANNOUNCE_MS 1000.0
+#define DOUBLE_ENDER_HOST_TIMEOUT_MS 5000.0
+#define DOUBLE_ENDER_RETRY_MS 10000.0
+
+// a backing track is offered this often, where it's at goes out this often while it
+// plays (and whenever it moves by more than BACKING_TRACK_SEEK_SECONDS otherwise), and
+// a peer whose position we haven't heard for BACKING_TRACK_TIMEOUT_MS isn't followed
+#define BACKING_TRACK_ANNOUNCE_MS 1000.0
+#define BACKING_TRACK_SYNC_MS 1000.0
+#define BACKING_TRACK_SEEK_SECONDS 0.25
+#define BACKING_TRACK_TIMEOUT_MS 5000.0
+#define BACKING_TRACK_RETRY_MS 10000.0
+// what each fetch of ours gets, in kB/s
+#define BACKING_TRACK_RATE_KBPS 256
+
+// in ensemble alignment everyone says what their links need this often, and
+// what we haven't heard again for ENSEMBLE_ALIGN_TIMEOUT_MS doesn't count
+#define ENSEMBLE_ALIGN_INTERVAL_MS 1000.0
+#define ENSEMBLE_ALIGN_TIMEOUT_MS 5000.0
 
 String SonobusAudioProcessor::paramInGain     ("ingain");
 String SonobusAudioProcessor::paramDry     ("dry");
@@ -91,9 +182,55 @@ static String defRecordFormatKey("DefaultRecordingFormat");
 static String defRecordBitsKey("DefaultRecordingBitsPerSample");
 static String recordSelfPreFxKey("RecordSelfPreFx");
 static String recordFinishOpenKey("RecordFinishOpen");
+static String crashSafeRecordingKey("CrashSafeRecording");
 static String defRecordDirKey("DefaultRecordDir");
 static String sliderSnapKey("SliderSnapToMouse");
 static String disableShortcutsKey("DisableKeyShortcuts");
+static String useOpenGLKey("UseOpenGL");
+static String chatHistoryLimitKey("ChatHistoryLimit");
+static String chatSpillToDiskKey("ChatSpillToDisk");
+static String parallelPeerRenderKey("ParallelPeerRender");
+static String resampleQualityKey("ResampleQuality");
+static String timeStretchKey("TimeStretch");
+static String loadSheddingKey("LoadShedding");
+static String processQuantumKey("ProcessQuantum");
+static String parallelPeerSendKey("ParallelPeerSend");
+static String autoPacketSizeKey("AutoPacketSize");
+static String sendPacingKey("SendPacing");
+static String realtimeNetworkThreadsKey("RealtimeNetworkThreads");
+static String powerSavingKey("PowerSaving");
+static String networkThreadCoresKey("NetworkThreadCores");
+static String receivePollModeKey("ReceivePollMode");
+static String receiveThreadCoreKey("ReceiveThreadCore");
+static String inlineSendKey("InlineSend");
+static String sharedSendEncodingKey("SharedSendEncoding");
+static String simulcastSendingKey("SimulcastSending");
+static String serverForwardingKey("ServerForwarding");
+static String lanMulticastKey("LanMulticast");
+static String lanDiscoveryKey("LanDiscovery");
+static String lanDiscoveryGroupKey("LanDiscoveryGroup");
+static String packetEncryptionKey("PacketEncryption");
+static String doubleEnderRecordingKey("DoubleEnderRecording");
+static String doubleEnderCollectingKey("DoubleEnderCollecting");
+static String doubleEnderUploadRateKey("DoubleEnderUploadRate");
+static String broadcastUrlKey("BroadcastUrl");
+static String broadcastQualityKey("BroadcastQuality");
+static String ensembleAlignmentKey("EnsembleAlignment");
+static String sessionRateNegotiationKey("SessionRateNegotiation");
+static String offlineBounceCaptureKey("OfflineBounceCapture");
+static String reverbRateReductionKey("ReverbRateReduction");
+static String shareBackingTrackKey("ShareBackingTrack");
+static String codecCpuBudgetKey("CodecCpuBudget");
+static String codecCostsKey("CodecCosts");
+static String mixNodeModeKey("MixNodeMode");
+static String listenerRoleKey("ListenerRole");
+static String adaptiveSendBitrateKey("AdaptiveSendBitrate");
+static String adaptiveFrameSizeKey("AdaptiveFrameSize");
+static String networkDscpKey("NetworkDscp");
+static String multipathModeKey("MultipathMode");
+static String multipathLocalAddressKey("MultipathLocalAddress");
+static String streamPlaybackDirectKey("StreamPlaybackDirect");
+static String syncMetToSessionKey("SyncMetToSession");
 static String peerDisplayModeKey("PeerDisplayMode");
 static String lastChatWidthKey("lastChatWidth");
 static String lastChatShownKey("lastChatShown");
@@ -104,6 +241,7 @@ static String langOverrideCodeKey("langOverrideCode");
 static String lastWindowWidthKey("lastWindowWidth");
 static String lastWindowHeightKey("lastWindowHeight");
 static String autoresizeDropRateThreshKey("autoDropRateThresh");
+static String autoresizeBufferQuantileKey("autoBufferQuantile");
 
 static String compressorStateKey("CompressorState");
 static String expanderStateKey("ExpanderState");
@@ -128,6 +266,7 @@ static String channelLayoutsKey("ChannelLayouts");
 
 static String peerStateCacheMapKey("PeerStateCacheMap");
 static String peerStateCacheKey("PeerStateCache");
+static String peerStateCacheDataKey("PeerStateCacheData");
 static String peerNameKey("name");
 static String peerLevelKey("level");
 static String peerMonoPanKey("pan");
@@ -137,6 +276,7 @@ static String peerNetbufKey("netbuf");
 static String peerNetbufAutoKey("netbufauto");
 static String peerSendFormatKey("sendformat");
 static String peerOrderPriorityKey("orderpriority");
+static String peerLastUsedKey("lastused");
 
 
 
@@ -148,6 +288,91 @@ static String peerOrderPriorityKey("orderpriority");
 
 #define UDP_OVERHEAD_BYTES 0 // 28
 
+// max number of datagrams read per receive thread wakeup
+#define RECV_BATCH_SIZE 32
+
+// ancillary data per datagram, for the SO_RXQ_OVFL drop counter
+#define RECV_CONTROL_SIZE 64
+
+// limits of the UDP socket buffers, which are sized for the expected traffic
+#define SOCKET_BUFFER_MIN_SIZE 1048576
+#define SOCKET_BUFFER_MAX_SIZE 16777216
+// what the kernel needs per datagram on top of the payload
+#define SOCKET_DATAGRAM_OVERHEAD 1024
+// shortest burst of incoming audio we want to keep, and how much we queue for sending
+#define SOCKET_RECV_WINDOW_MS 200.0
+#define SOCKET_SEND_WINDOW_MS 100.0
+#define SOCKET_BUFFER_UPDATE_INTERVAL_MS 2000.0
+
+// how long a server host name looked up ahead of time is trusted for connecting
+#define RESOLVED_HOST_MAX_AGE_MS 600000.0
+
+// max number of datagrams queued by the send thread before a flush
+#define SEND_BATCH_SIZE 64
+
+// datagrams per destination that may go out back to back, any more are paced
+#define SEND_PACING_BURST_PACKETS 2
+
+// the queued lanes of sendPeerMessage(): bulk gets this many bytes per second, in
+// bursts of up to this many, and nothing waits longer than this or past this many
+#define SEND_LANE_BULK_RATE 32768.0
+#define SEND_LANE_BULK_BURST 8192.0
+#define SEND_LANE_MAX_AGE_MS 10000.0
+#define SEND_LANE_MAX_QUEUED 256
+
+// upper limit of worker threads for the parallel peer render
+#define MAX_PEER_RENDER_WORKERS 8
+
+// upper limit of worker threads for the parallel peer send
+#define MAX_PEER_SEND_WORKERS 4
+
+// how often the shared send groups are re-checked, even without a known change
+#define SHARED_SEND_REGROUP_INTERVAL_MS 500
+#define THERMAL_CHECK_INTERVAL_MS 5000.0
+// encoder complexity at LevelCodecComplexity, Opus goes 0-10
+#define LOAD_SHED_COMPLEXITY 5
+
+// what all the encoding and decoding together may take of a core, see setCodecCpuBudget()
+#define CODEC_BUDGET_SHARE 0.5f
+// of the block period the audio callback should keep free
+#define CODEC_BUDGET_HEADROOM 0.25f
+#define CODEC_BUDGET_INTERVAL_MS 2000.0
+// the calibration waits for things to settle after the start, then takes this long per format
+#define CODEC_CALIBRATION_DELAY_MS 5000.0
+#define CODEC_CALIBRATION_SECONDS 0.15
+// a session the default format has to fit on the first run: peers with this many channels each way
+#define CODEC_CALIBRATION_PEERS 8
+#define CODEC_CALIBRATION_CHANNELS 2
+// what initFormats() starts with, 96kbps/ch Opus
+#define DEFAULT_AUDIO_FORMAT_INDEX 4
+
+#if JUCE_LINUX
+#define SEND_BATCHING_ENABLED 1
+#else
+#define SEND_BATCHING_ENABLED 0
+#endif
+
+// Opus encoder complexity while the audio callback sends itself, see sendInline()
+#define INLINE_SEND_OPUS_COMPLEXITY 3
+#ifdef MSG_DONTWAIT
+#define INLINE_SEND_FLAGS MSG_DONTWAIT
+#else
+#define INLINE_SEND_FLAGS 0
+#endif
+
+// io_uring for the network threads, where the kernel headers have it.
+// Whether the running kernel allows it is only found out at runtime
+#if JUCE_LINUX && AOO_HAVE_URING
+#define URING_ENABLED 1
+#else
+#define URING_ENABLED 0
+#endif
+// slots of the receive ring, and its provided buffers (a power of 2)
+#define RECV_URING_ENTRIES 64
+#define RECV_URING_BUFFERS 256
+// how long removing a socket waits for the receive thread to let go of it
+#define RECV_URING_RELEASE_WAIT_MS 500
+
 // get sockaddr, IPv4 or IPv6:
 static void *get_in_addr(struct sockaddr *sa)
 {
@@ -164,6 +389,48 @@ static int get_in_port(struct sockaddr *sa)
     return (((struct sockaddr_in6*)sa)->sin6_port);
 }
 
+// IPv4-mapped IPv6 addresses from the dual-stack socket are handled as plain
+// IPv4 everywhere, like the AOO library does, and only mapped again for sendto()
+static void unmapAddress (struct sockaddr_storage & addr)
+{
+    if (addr.ss_family == AF_INET6) {
+        auto sin6 = (const struct sockaddr_in6 *) &addr;
+        if (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)) {
+            struct sockaddr_in sin;
+            zerostruct(sin);
+            sin.sin_family = AF_INET;
+            sin.sin_port = sin6->sin6_port;
+            memcpy(&sin.sin_addr, &sin6->sin6_addr.s6_addr[12], 4);
+            memcpy(&addr, &sin, sizeof(sin));
+        }
+    }
+}
+
+static socklen_t toSocketAddress (const struct sockaddr * sa, bool dualStack, struct sockaddr_storage & result)
+{
+    if (sa->sa_family == AF_INET6) {
+        memcpy(&result, sa, sizeof(struct sockaddr_in6));
+        return sizeof(struct sockaddr_in6);
+    }
+    else if (sa->sa_family == AF_INET) {
+        if (dualStack) {
+            auto sin = (const struct sockaddr_in *) sa;
+            struct sockaddr_in6 sin6;
+            zerostruct(sin6);
+            sin6.sin6_family = AF_INET6;
+            sin6.sin6_port = sin->sin_port;
+            sin6.sin6_addr.s6_addr[10] = 0xff;
+            sin6.sin6_addr.s6_addr[11] = 0xff;
+            memcpy(&sin6.sin6_addr.s6_addr[12], &sin->sin_addr, 4);
+            memcpy(&result, &sin6, sizeof(sin6));
+            return sizeof(sin6);
+        }
+        memcpy(&result, sa, sizeof(struct sockaddr_in));
+        return sizeof(struct sockaddr_in);
+    }
+    return 0;
+}
+
 static addrinfo* getAddressInfo (bool isDatagram, const String& hostName, int portNumber)
 {
     struct addrinfo hints;
@@ -181,47 +448,177 @@ static addrinfo* getAddressInfo (bool isDatagram, const String& hostName, int po
     return nullptr;
 }
 
+// raw IPv4/IPv6 address + port, used as the endpoint hash table key
+struct SonobusAudioProcessor::EndpointAddrKey {
+    EndpointAddrKey() { zerostruct(*this); }
+
+    bool setFromSockaddr(const struct sockaddr * sa) {
+        zerostruct(*this);
+        if (sa->sa_family == AF_INET) {
+            auto sin = (const struct sockaddr_in *) sa;
+            family = AF_INET;
+            port = sin->sin_port;
+            memcpy(addr, &sin->sin_addr, sizeof(sin->sin_addr));
+            return true;
+        }
+        else if (sa->sa_family == AF_INET6) {
+            auto sin6 = (const struct sockaddr_in6 *) sa;
+            family = AF_INET6;
+            port = sin6->sin6_port;
+            memcpy(addr, &sin6->sin6_addr, sizeof(sin6->sin6_addr));
+            return true;
+        }
+        return false;
+    }
+
+    uint32 hash() const {
+        // FNV-1a
+        uint32 h = 2166136261u;
+        auto bytes = (const uint8 *) this;
+        for (size_t i=0; i < sizeof(*this); ++i) {
+            h = (h ^ bytes[i]) * 16777619u;
+        }
+        return h;
+    }
+
+    bool operator== (const EndpointAddrKey & other) const {
+        return memcmp(this, &other, sizeof(*this)) == 0;
+    }
+
+    uint16 family;
+    uint16 port;
+    uint8 addr[16];
+};
+
 struct SonobusAudioProcessor::EndpointState {
     EndpointState(String ipaddr_="", int port_=0) : ipaddr(ipaddr_), port(port_) {
-        rawaddr.sa_family = AF_UNSPEC;
+        zerostruct(rawaddr);
+        rawaddr.ss_family = AF_UNSPEC;
     }
     
 
     DatagramSocket *owner;
     //struct sockaddr_storage addr;
     //socklen_t addrlen;
-    std::unique_ptr<DatagramSocket::RemoteAddrInfo> peer;
     String ipaddr;
     int port = 0;
     
     
     struct sockaddr * getRawAddr() {
-        if (rawaddr.sa_family == AF_UNSPEC) {
+        if (rawaddr.ss_family == AF_UNSPEC) {
             struct addrinfo * info = getAddressInfo(true, ipaddr, port);
             if (info) {
-                memcpy(&rawaddr, info->ai_addr, info->ai_addrlen);
+                // host names: prefer IPv4, the server relay can't do IPv6
+                auto best = info;
+                for (auto ai = info; ai; ai = ai->ai_next) {
+                    if (ai->ai_family == AF_INET) {
+                        best = ai;
+                        break;
+                    }
+                }
+                if (best->ai_addrlen <= sizeof(rawaddr)) {
+                    memcpy(&rawaddr, best->ai_addr, best->ai_addrlen);
+                    unmapAddress(rawaddr);
+                    sendaddrlen = toSocketAddress((struct sockaddr *) &rawaddr, owner && owner->isDualStack(), sendaddr);
+                }
 
                 freeaddrinfo(info);
             }
         }
-        return &rawaddr;
+        return (struct sockaddr *) &rawaddr;
+    }
+
+    // the address to use with sendto() on the owner socket
+    const struct sockaddr * getSendAddr(socklen_t & len) {
+        getRawAddr();
+        len = sendaddrlen;
+        return (const struct sockaddr *) &sendaddr;
+    }
+
+    // after changing ipaddr or port
+    void resetAddress() {
+        rawaddr.ss_family = AF_UNSPEC;
+        sendaddrlen = 0;
     }
     
     
     // runtime state
     int64_t sentBytes = 0;
     int64_t recvBytes = 0;
+
+    // set if the peer can only be reached through the server relay
+    std::atomic<EndpointState*> relay { nullptr };
+    // the peer was introduced by the connection server (as a group member)
+    std::atomic<bool> serverPeer { false };
+    // the same address, reached through the multi-path socket
+    EndpointState * pathEndpoint = nullptr;
+    // last time something of theirs came in on our LAN multicast socket
+    std::atomic<double> lanMulticastRecvMs { 0.0 };
+    // they told us they get what we send to the LAN multicast group
+    std::atomic<bool> lanMulticastListener { false };
+    // what everything sent to them is sealed with, if encrypting (see setPacketEncryption())
+    std::atomic<SonoAudio::PacketCipher*> cipher { nullptr };
+
+    // key in the endpoint table
+    EndpointAddrKey addrKey;
+    bool hasAddrKey = false;
+
+    // never the same for two of them, unlike their addresses in memory
+    const uint32 serial = nextSerial();
+
+    // for collectIdleEndpoints(), with mEndpointsLock held
+    uint32 seenEpoch = 0; // of the last lookup
+    int64_t collectSentBytes = 0;
+    double idleSinceMs = 0.0; // or when it was retired
     
 private:
-    struct sockaddr rawaddr;
+    static uint32 nextSerial() {
+        static std::atomic<uint32> counter { 0 };
+        return ++counter;
+    }
+
+    struct sockaddr_storage rawaddr;
+    struct sockaddr_storage sendaddr;
+    socklen_t sendaddrlen = 0;
     
 };
 
 
 
 
+// preallocated packet ring for the receive thread
+struct SonobusAudioProcessor::ReceiveBatch {
+    ReceiveBatch() {
+        packets.calloc(RECV_BATCH_SIZE);
+#if JUCE_LINUX
+        msgs.calloc(RECV_BATCH_SIZE);
+        iovecs.calloc(RECV_BATCH_SIZE);
+        controls.calloc(RECV_BATCH_SIZE * RECV_CONTROL_SIZE);
+#endif
+    }
+
+    struct Packet {
+        char data[AOO_MAXPACKETSIZE + AOONET_RELAY_HEADER_SIZE];
+        struct sockaddr_storage addr;
+        int size = 0;
+        EndpointState * endpoint = nullptr;
+        bool handled = false;
+    };
+
+    HeapBlock<Packet> packets;
+#if JUCE_LINUX
+    HeapBlock<struct mmsghdr> msgs;
+    HeapBlock<struct iovec> iovecs;
+    HeapBlock<char> controls;
+#endif
+};
+
+
 #define LATENCY_ID_OFFSET 20000
 #define ECHO_ID_OFFSET    40000
+#define FILESTREAM_ID_OFFSET 60000
+// new peers kept ready while connected to a server, a group join takes them all at once
+#define REMOTE_PEER_POOL_SIZE 8
 
 enum {
     RemoteNetTypeUnknown = 0,
@@ -231,6 +628,26 @@ enum {
 };
 
 
+// Collects the identical (compact) data packets a shared source sends to its
+// sinks, so they can go to the server once and be forwarded to all of them,
+// or be sent once to the LAN multicast group for the ones listening there.
+// Owned by the leading peer and only used by the thread currently sending for it.
+struct ForwardBatch
+{
+    bool add(SonobusAudioProcessor::EndpointState * endpoint, const char * data, int32_t size);
+    void flush();
+
+    aoo::net::iclient * client = nullptr;
+    SonobusAudioProcessor::EndpointState * server = nullptr;
+    SonobusAudioProcessor::EndpointState * multicast = nullptr;
+    int32_t route = 0;
+
+    std::vector<char> packet; // pending packet
+    std::vector<SonobusAudioProcessor::EndpointState*> dests;
+    std::vector<SonobusAudioProcessor::EndpointState*> routePeers; // as last set up on the server
+    std::vector<uint32> routeSerials; // of those, an endpoint deleted since could be at the same address
+};
+
 struct SonobusAudioProcessor::RemotePeer {
     RemotePeer(EndpointState * ep = 0, int id_=0, aoo::isink::pointer oursink_ = 0, aoo::isource::pointer oursource_ = 0) : endpoint(ep), 
         ourId(id_), 
@@ -247,29 +664,86 @@ struct SonobusAudioProcessor::RemotePeer {
             oursink.reset(aoo::isink::create(ourId));
             oursource.reset(aoo::isource::create(ourId));
             
-            // create latency sink/sources
-            latencysink.reset(aoo::isink::create(ourId + LATENCY_ID_OFFSET));
-            latencysource.reset(aoo::isource::create(ourId + LATENCY_ID_OFFSET));
-            echosink.reset(aoo::isink::create(ourId + ECHO_ID_OFFSET));
-            echosource.reset(aoo::isource::create(ourId + ECHO_ID_OFFSET));               
+            // the latency and echo sinks/sources only get made for a test, see ensureLatencyTestObjects()
+
+            // pre-encoded file playback goes to their main sink from this one
+            filestreamsource.reset(aoo::isource::create(ourId + FILESTREAM_ID_OFFSET));
+        }
+
+    ~RemotePeer() {
+        // a network thread may still be in the telemetry tap
+        if (oursink) {
+            oursink->set_telemetry_tap(nullptr, nullptr);
+        }
+        std::unique_ptr<SonoAudio::TelemetryLog::Writer> log;
+        {
+            const SpinLock::ScopedLockType sl (telemetryLock);
+            log = std::move(telemetryLog);
         }
+    }
 
     EndpointState * endpoint = 0;
     int32_t ourId = AOO_ID_NONE;
     int32_t remoteSinkId = AOO_ID_NONE;
+    int32_t remoteSinkFlags = 0; // protocol flags of their sink
     int32_t remoteSourceId = AOO_ID_NONE;
     aoo::isink::pointer oursink;
     aoo::isource::pointer oursource;
-
+    // if set, our audio for this peer is encoded and sent by that peer's source
+    // (with our id as alias) and our own source is idle
+    std::atomic<RemotePeer*> sendLeader { nullptr };
+    std::atomic<int> sendFollowers { 0 }; // peers using our source, changed with mSharedSendLock held
+    ForwardBatch forwardBatch; // when our shared source goes through the server or LAN multicast
+    std::atomic<bool> inlineSendable { false }; // cheap enough to encode in the audio callback, see sendInline()
+    bool lanMulticastReachable = false; // what we last told them about getting their LAN multicast
+    Array<SonobusAudioProcessor::LatInfo> reportedLatInfo; // recv thread, what our latinfo replies told them so far
+    // our info for them, sent by flushPeerInfoUpdates() on the send thread
+    std::atomic<bool> infoUpdatePending { false };
+    std::atomic<bool> remoteTakesInfoRecord { false }; // else it goes as JSON
+    std::atomic<bool> infoRecordFullNeeded { true };
+    uint16 infoRecordSendSequence = 0;
+    SonoAudio::PeerInfoRecord lastSentInfo;
+    // their info records
+    SonoAudio::PeerInfoRecord recvdInfo;
+    uint16 infoRecordRecvSequence = 0;
+    bool hasInfoRecordBaseline = false;
+    EventNotifyTarget eventNotify; // shared by all our sinks and sources
+
+    // only there (and set up) while latencyTestReady is set, see releaseIdleLatencyTestObjects()
     aoo::isink::pointer latencysink;
     aoo::isource::pointer latencysource;
     aoo::isink::pointer echosink;
     aoo::isource::pointer echosource;
+    std::atomic<bool> latencyTestReady { false };
+    std::atomic<double> latencyTestLastUseMs { 0.0 }; // last test traffic, or start/stop
+    aoo::isource::pointer filestreamsource;
+    int fileStreamGeneration = -1; // of the stream filestreamsource is set up for
+    int32_t fileStreamSinkId = AOO_ID_NONE; // their sink filestreamsource has been added to
+    bool remoteAcceptsFileStream = false; // their sink sorts out our file stream source
+    SonoAudio::ClockOffsetEstimator clockOffset; // their system clock against ours, from our pings
+    // what they told us last as a double-ender host, port 0 if they aren't one
+    std::atomic<int> dubHostPort { 0 };
+    std::atomic<bool> dubHostRecording { false };
+    std::atomic<double> dubHostSeenMs { 0.0 };
+    // the backing track they offer and where they are in it (in their clock), under backingTrackLock
+    SpinLock backingTrackLock;
+    String backingTrackId;
+    String backingTrackName;
+    int backingTrackPort = 0;
+    bool backingTrackPlaying = false;
+    double backingTrackPosition = 0.0;
+    uint64 backingTrackTime = 0;
+    double backingTrackSeenMs = 0.0;
+    String backingTrackHaveId; // which of ours they have, also under backingTrackLock
+    std::atomic<bool> backingTrackReplyDue { false }; // they offered again, tell them if we have it
+    // what their links need in ensemble alignment, see updateEnsembleAlignment()
+    std::atomic<float> alignFloorMs { 0.0f };
+    std::atomic<double> alignFloorSeenMs { 0.0 };
     bool activeLatencyTest = false;
     std::unique_ptr<MTDM> latencyProcessor;
     std::unique_ptr<LatencyMeasurer> latencyMeasurer;
 
-    float gain = 1.0f;
+    SonoAudio::RelaxedAtomic<float> gain = 1.0f;
 
     float buffertimeMs = 0.0f;
     float padBufferTimeMs = 0.0f;
@@ -283,12 +757,45 @@ struct SonobusAudioProcessor::RemotePeer {
     bool soloed = false;
     bool invitedPeer = false;
     int  formatIndex = -1; // default
+    // congestion control of what we send them
+    SonoAudio::SendRateController sendRate;
+    int adaptedFormatIndex = -1; // stepped down by the send rate control, -1 is formatIndex
+    bool budgetLimited = false; // adaptedFormatIndex is there for the codec CPU budget, not the link
+    int appliedSendBitrate = 0; // bitrate override of oursource, 0 is the format bitrate
+    double formatStepUpWaitMs = SENDRATE_STEPUP_WAIT_MS; // doubles after every failed step up
+    double lastFormatStepUpMs = 0;
+    // longer Opus frames for far away peers, 0 is the frame size of the format, see updateSendFrameSize()
+    float adaptedFrameMs = 0.0f;
+    float pendingFrameMs = 0.0f; // what the link asks for, applied once it has held for a while
+    double pendingFrameSinceMs = 0;
+    int32_t sendCoupledChannels = 0; // Opus stereo pairs of oursource, see getSendCoupledChannels()
     AudioCodecFormatInfo recvFormat;
     int reqRemoteSendFormatIndex = -1; // no pref
     int packetsize = 600;
+    // the largest size the path MTU discovery found, 0 if unknown, see sendPacketsize()
+    std::atomic<int> autoPacketsize { 0 };
+    SonoAudio::PathMtuProber pathMtu; // send thread
+    // less what sealing the packets adds, if encrypting
+    int sendPacketsize() const {
+        const int overhead = endpoint && endpoint->cipher.load() ? SonoAudio::PacketCipher::Overhead : 0;
+        return jmax(packetsize, autoPacketsize.load(std::memory_order_relaxed)) - overhead;
+    }
     int sendChannels = 1; // actual current send channel count
     int nominalSendChannels = 1; // 0 matches input, 1 is 1, 2 is 2
+    int slot = -1; // for the routing, stays the same while mRemotePeers changes
     int sendChannelsOverride = -1; // -1 don't override
+    // the part of the send channels the remote renders (see AOO_SUBSCRIBE_EVENT),
+    // only that is encoded and it lands at its onset on their end
+    int subscribedOnset = 0;
+    int subscribedChannels = -1; // -1 all of them
+    bool hasSendSubscription() const { return subscribedChannels > 0 && subscribedChannels < sendChannels && subscribedOnset >= 0 && subscribedOnset + subscribedChannels <= sendChannels; }
+    int encodeSendOnset() const { return hasSendSubscription() ? subscribedOnset : 0; }
+    int encodeSendChannels() const { return hasSendSubscription() ? subscribedChannels : sendChannels; }
+    // the first channel the audio thread passes to oursource, see setupRemotePeerOurSource()
+    std::atomic<int> sendEncodeOnset { 0 };
+    // what we asked their source for, see updateRemotePeerSubscription()
+    int recvSubscribedOnset = 0;
+    int recvSubscribedChannels = -1;
     int recvChannels = 0;
     float recvPan[MAX_PANNERS];
     float recvStereoPan[MAX_PANNERS]; // only use 2
@@ -301,6 +808,11 @@ struct SonobusAudioProcessor::RemotePeer {
     int64_t dataPacketsSent = 0;
     int64_t dataPacketsDropped = 0;
     int64_t dataPacketsResent = 0;
+    int64_t dataPacketsReordered = 0;
+    int64_t dataBlockGaps = 0;
+    // time spent in oursource->send() and oursink->handle_message(), for the diagnostics
+    std::atomic<int64> encodeTicks { 0 };
+    std::atomic<int64> decodeTicks { 0 };
     double lastDroptime = 0;
     double resetDroptime = 0;
     int64_t lastDropCount = 0;
@@ -311,7 +823,8 @@ struct SonobusAudioProcessor::RemotePeer {
     bool resetSafetyMuted = true;
     float pingTime = 0.0f; // ms
     double lastSendPingTimeMs = -1;
-    bool   gotNewStylePing = false;
+    double lastRttTimeMs = 0; // last round trip measurement by any ping
+    int64_t lastTrafficPacketsSent = 0;
     bool   haveSentFirstPeerInfo = false;
     stats::RunCumulantor1D  smoothPingTime; // ms
     stats::RunCumulantor1D  fillRatio;
@@ -348,2898 +861,8614 @@ struct SonobusAudioProcessor::RemotePeer {
     float remoteOutLatMs = 0.0f;
     int remoteNetType = RemoteNetTypeUnknown;
     bool remoteIsRecording = false;
+    // they only listen, so there is no sink side or effects to run for them, see applyRemotePeerListener()
+    std::atomic<bool> remoteListener { false };
+    // of their audio device, 0 until they tell us, see updateSessionStreamRate()
+    std::atomic<int> remoteSampleRate { 0 };
     bool hasRemoteInfo = false;
 
-    std::unique_ptr<AudioFormatWriter::ThreadedWriter> fileWriter;
+    std::unique_ptr<SonoAudio::RecordingTrack> fileWriter;
+    // raw received blocks, fed by the packet tap of oursink
+    std::unique_ptr<SonoAudio::PacketArchive::Writer> packetArchive;
+    SpinLock packetArchiveLock;
+    // arrivals, resends and drops of oursink, fed by its telemetry tap
+    std::unique_ptr<SonoAudio::TelemetryLog::Writer> telemetryLog;
+    SpinLock telemetryLock;
 
-    ReadWriteLock    sinkLock;
-};
+    // salt of the compact data stream last accepted by oursink, for direct dispatch
+    int32_t compactDataSalt = 0;
+    bool hasCompactDataSalt = false;
 
+    ReadWriteLock    sinkLock;
 
+    // time spent in the last render, for the process timing stats
+    int64 renderSinkTicks = 0;
+    int64 renderFxTicks = 0;
+    // low enough in the order for its effects to go first under load, see updateLoadShedding()
+    std::atomic<bool> loadShedFx { false };
+};
 
-static int32_t endpoint_send(void *e, const char *data, int32_t size)
+// packet tap of oursink, on the network receive thread
+static void peerPacketTap(void * user, const aoo_packet_tap_info * info)
 {
-    SonobusAudioProcessor::EndpointState * endpoint = static_cast<SonobusAudioProcessor::EndpointState*>(e);
-    int result = -1;
-    if (endpoint->peer) {
-        result = endpoint->owner->write(*(endpoint->peer), data, size);
-    } else {
-        result = endpoint->owner->write(endpoint->ipaddr, endpoint->port, data, size);
-    }
-    
-    if (result > 0) {
-        // include UDP overhead
-        endpoint->sentBytes += result + UDP_OVERHEAD_BYTES;
-    }
-    else if (result < 0) {
-        DBG("Error sending bytes to endpoint " << endpoint->ipaddr);
+    auto * remote = static_cast<SonobusAudioProcessor::RemotePeer *>(user);
+    const SpinLock::ScopedLockType sl (remote->packetArchiveLock);
+    if (remote->packetArchive) {
+        remote->packetArchive->addPacket(*info);
     }
-    return result;
 }
 
-static int32_t client_send(void *e, const char *data, int32_t size, void *raddr)
+// trace tap of oursink, on the receive thread and the audio thread. Each block is a flow
+// from its first frame arriving to its playout, the salt tells the streams apart
+static void peerTraceTap(void * /*user*/, const aoo_trace_info * info)
 {
-    SonobusAudioProcessor::EndpointState * endpoint = static_cast<SonobusAudioProcessor::EndpointState*>(e);
-    int result = -1;
+    const uint64 flowid = ((uint64) (uint32) info->salt << 32) | (uint32) info->sequence;
 
-    const struct sockaddr *addr = (struct sockaddr *)raddr;
-    
-    if (addr->sa_family == AF_INET){
-        result = (int) ::sendto(endpoint->owner->getRawSocketHandle(), data, (size_t)size, 0, addr, sizeof(struct sockaddr_in));
+    switch (info->stage) {
+        case AOO_TRACE_RECEIVED:
+            TraceRecorder::instant("frame received");
+            TraceRecorder::flow("block", flowid, info->framenum <= 0 ? TraceRecorder::FlowStart : TraceRecorder::FlowStep);
+            break;
+        case AOO_TRACE_QUEUED:
+            TraceRecorder::instant("block complete");
+            TraceRecorder::flow("block", flowid, TraceRecorder::FlowStep);
+            break;
+        case AOO_TRACE_DECODED:
+            TraceRecorder::instant("block decoded");
+            TraceRecorder::flow("block", flowid, TraceRecorder::FlowStep);
+            break;
+        case AOO_TRACE_PLAYED:
+            TraceRecorder::flow("block", flowid, TraceRecorder::FlowEnd);
+            break;
+        default:
+            break;
     }
-    
-    if (result > 0) {
-        endpoint->sentBytes += result + UDP_OVERHEAD_BYTES;
+}
+
+// telemetry tap of oursink, on the network threads
+static void peerTelemetryTap(void * user, const aoo_telemetry_info * info)
+{
+    auto * remote = static_cast<SonobusAudioProcessor::RemotePeer *>(user);
+    const SpinLock::ScopedLockType sl (remote->telemetryLock);
+    if (remote->telemetryLog) {
+        remote->telemetryLog->add(*info);
     }
-    
-    return result;
 }
 
+// immutable copy of mRemotePeers, read by processBlock without taking mCoreLock
+struct SonobusAudioProcessor::PeerSnapshot {
+    Array<RemotePeer*> peers;
+    // per peer, the indexes of the peers routed to it
+    std::vector<Array<int>> sendSources;
+    // Mix-minus: the peers routed anywhere are summed once, and a peer's send mix
+    // is that total minus the ones not routed to it. Only set for the peers where
+    // this takes fewer buffer additions than summing sendSources.
+    Array<int> routedSources;
+    std::vector<Array<int>> sendExclusions;
+    std::vector<bool> sendMixMinus;
+    // Peers which get nothing routed to them and encode at the same other
+    // samplerate share one resampler of the send mix, index per peer or -1.
+    // A resampler outlives the snapshot as long as it is still needed.
+    std::vector<std::shared_ptr<SonoAudio::SendResampler>> sendResamplers;
+    std::vector<int> sendResampler;
+};
 
+// the buses a thread of the parallel peer render mixes the peers it takes into,
+// one per thread instead of one per peer, so the callback only has to sum those
+struct SonobusAudioProcessor::PeerRenderScratch {
+    AudioBuffer<float> mixBuffer;
+    AudioBuffer<float> fxBuffer;
+    AudioBuffer<float> silentBuffer; // some effects scribble on it
+    // the channels of mixBuffer in use this block, they get cleared as the range grows
+    int mixStart = 0;
+    int mixEnd = 0;
+    bool mixUsed = false;
+    bool fxUsed = false;
+
+    void reserve(int numChannels, int numSamples)
+    {
+        mixBuffer.setSize(jmax(2, numChannels), numSamples, false, false, true);
+        fxBuffer.setSize(jmax(2, numChannels), numSamples, false, false, true);
+        silentBuffer.setSize(1, numSamples, false, false, true);
+    }
 
-class SonobusAudioProcessor::SendThread : public juce::Thread
-{
-public:
-    SendThread(SonobusAudioProcessor & processor) : Thread("SonoBusSendThread") , _processor(processor) 
-    {}
-    
-    void run() override {
-        
-        bool shouldwait = false;
+    // -- audio threads --
 
-        while (!threadShouldExit()) {
-            // don't overcall it, but make sure it runs consistently
-            // if we are notified to send, the wait will return sooner than the timeout
+    void reset() noexcept
+    {
+        mixUsed = false;
+        fxUsed = false;
+    }
 
-            if (shouldwait) {
-                _processor.mSendWaitable.wait(50);
-            }
+    void useMix(int start, int end, int numChannels, int numSamples)
+    {
+        if (mixBuffer.getNumSamples() < numSamples || mixBuffer.getNumChannels() < numChannels) {
+            // should be exceedingly rare, reserve() has the room already
+            mixBuffer.setSize(jmax(2, numChannels), numSamples, true, true, true);
+        }
+        if (start >= end) return;
 
-            auto sentinel = _processor.mNeedSendSentinel.get();
+        if (!mixUsed) {
+            for (int ch = start; ch < end; ++ch) {
+                mixBuffer.clear(ch, 0, numSamples);
+            }
+            mixStart = start;
+            mixEnd = end;
+            mixUsed = true;
+            return;
+        }
 
-            _processor.doSendData();
+        for (int ch = start; ch < mixStart; ++ch) {
+            mixBuffer.clear(ch, 0, numSamples);
+        }
+        for (int ch = jmax(start, mixEnd); ch < end; ++ch) {
+            mixBuffer.clear(ch, 0, numSamples);
+        }
+        mixStart = jmin(mixStart, start);
+        mixEnd = jmax(mixEnd, end);
+    }
 
-            shouldwait = (sentinel == _processor.mNeedSendSentinel.get());
+    void useFx(int numChannels, int numSamples)
+    {
+        if (fxBuffer.getNumSamples() < numSamples || fxBuffer.getNumChannels() < numChannels) {
+            fxBuffer.setSize(numChannels, numSamples, true, true, true);
+        }
+        if (!fxUsed) {
+            fxBuffer.clear(0, numSamples);
+            fxUsed = true;
+        }
+    }
 
+    AudioBuffer<float> & getSilentBuffer(int numSamples)
+    {
+        if (silentBuffer.getNumSamples() < numSamples) {
+            silentBuffer.setSize(1, numSamples, false, false, true);
         }
-        DBG("Send thread finishing");
+        silentBuffer.clear(0, numSamples);
+        return silentBuffer;
     }
-    
-    SonobusAudioProcessor & _processor;
-    
 };
 
-class SonobusAudioProcessor::RecvThread : public juce::Thread
+// everything renderRemotePeer needs from processBlock
+struct SonobusAudioProcessor::PeerRenderContext {
+    // the channels of the processBlock buffer, for the per-user buses. Taken on the
+    // callback thread, the buffer itself isn't for the workers (its isClear flag)
+    float * const * outChannels = nullptr;
+    int numOutChannels = 0;
+    AudioBuffer<float> * mixBuffer = nullptr; // unused with a scratch
+    AudioBuffer<float> * fxBuffer = nullptr;
+    PeerRenderScratch * scratch = nullptr; // of the thread rendering on the pool, mixes into that instead
+    uint64_t t = 0;
+    int numSamples = 0;
+    int mainBusOutputChannels = 0;
+    int totalOutputChannels = 0;
+    int fxchannels = 0;
+    bool anysoloed = false;
+    bool doreverb = false;
+    bool mainReverbEnabled = false;
+    bool recordPeers = false; // writerLock is held by the audio callback
+    bool shedPeerFx = false;
+    bool shedMeters = false;
+};
+
+
+// fixed pool of audio worker threads that render peers in parallel with the
+// audio callback. Work is handed out through a shared atomic cursor, so whichever
+// thread is free (the callback included) takes the next peer; each thread mixes
+// its peers into its own scratch, summing those is left to the callback.
+// The input groups go through it the same way, see run().
+class SonobusAudioProcessor::PeerRenderPool
 {
 public:
-    RecvThread(SonobusAudioProcessor & processor) : Thread("SonoBusRecvThread") , _processor(processor) 
-    {}
-    
-    void run() override {
+    PeerRenderPool(SonobusAudioProcessor & processor, int numWorkers) : _processor(processor)
+    {
+        // the first one is the callback's
+        for (int i=0; i <= numWorkers; ++i) {
+            _scratch.add(new PeerRenderScratch());
+        }
+        for (int i=0; i < numWorkers; ++i) {
+            auto * worker = _workers.add(new Worker(*this, i));
+#if JUCE_ANDROID
+            worker->startThread(9);
+#else
+            worker->startThread(Thread::realtimeAudioPriority);
+#endif
+        }
+    }
 
-        while (!threadShouldExit()) {
-         
-            if (_processor.mUdpSocket->waitUntilReady(true, 20) == 1) {
-                _processor.doReceiveData();
-            }
+    ~PeerRenderPool()
+    {
+        for (auto * worker : _workers) {
+            worker->signalThreadShouldExit();
+            worker->wakeup.signal();
+        }
+        for (auto * worker : _workers) {
+            worker->stopThread(400);
         }
+    }
+
+    int getNumWorkers() const { return _workers.size(); }
 
-        DBG("Recv thread finishing");        
+    // not while rendering
+    void reserve(int numChannels, int numSamples)
+    {
+        for (auto * scratch : _scratch) {
+            scratch->reserve(numChannels, numSamples);
+        }
     }
-    
-    SonobusAudioProcessor & _processor;
-    
-};
 
-class SonobusAudioProcessor::EventThread : public juce::Thread
-{
-public:
-    EventThread(SonobusAudioProcessor & processor) : Thread("SonoBusEventThread") , _processor(processor) 
-    {}
-    
-    void run() override {
+    // called from the audio callback, returns once all peers are rendered
+    void render(RemotePeer * const * peers, int count, const PeerRenderContext & ctx)
+    {
+        _task = nullptr;
+        _peers = peers;
+        _context = &ctx;
 
-        while (!threadShouldExit()) {
-         
-            Thread::sleep(20);
-            
-            _processor.handleEvents();                       
+        for (auto * scratch : _scratch) {
+            scratch->reset();
         }
-        
-        DBG("Event thread finishing");
+
+        dispatch(count);
     }
-    
-    SonobusAudioProcessor & _processor;
-    
-};
 
-class SonobusAudioProcessor::ServerThread : public juce::Thread
-{
-public:
-    ServerThread(SonobusAudioProcessor & processor) : Thread("SonoBusServerThread") , _processor(processor) 
-    {}
-    
-    void run() override {
+    // called from the audio callback, fn(arg, index) for every index below count,
+    // spread over the threads like the peers are. Returns once all are done.
+    // Nothing goes through the scratches, fn has to keep the indices apart itself
+    using TaskFn = void (*)(void * arg, int index);
+    void run(int count, TaskFn fn, void * arg)
+    {
+        _task = fn;
+        _taskArg = arg;
 
-        if (_processor.mAooServer) {
-            _processor.mAooServer->run();
+        dispatch(count);
+
+        _task = nullptr;
+    }
+
+    // what the threads mixed after render(), those that didn't get anything aren't used
+    int getNumScratch() const { return _scratch.size(); }
+    const PeerRenderScratch & getScratch(int index) const { return *_scratch.getUnchecked(index); }
+
+private:
+    void dispatch(int count)
+    {
+        _done.store(0, std::memory_order_relaxed);
+
+        // count in the upper half, next index in the lower, so a late worker
+        // from the previous block can never pick up a stale index
+        _cursor.store((uint64_t) count << 32, std::memory_order_release);
+
+        for (auto * worker : _workers) {
+            worker->wakeup.signal();
+        }
+
+        while (runNext(*_scratch.getUnchecked(0))) {}
+
+        while (_done.load(std::memory_order_acquire) < count) {
+            // the remaining ones are in progress on workers
         }
-        
-        DBG("Server thread finishing");        
     }
-    
-    SonobusAudioProcessor & _processor;
-    
-};
 
-class SonobusAudioProcessor::ClientThread : public juce::Thread
-{
-public:
-    ClientThread(SonobusAudioProcessor & processor) : Thread("SonoBusClientThread") , _processor(processor) 
-    {}
-    
-    void run() override {
+    bool runNext(PeerRenderScratch & scratch)
+    {
+        const uint64_t state = _cursor.fetch_add(1, std::memory_order_acq_rel);
+        const int index = (int) (state & 0xffffffff);
+        const int count = (int) (state >> 32);
 
-        if (_processor.mAooClient) {
-            _processor.mAooClient->run();
+        if (index >= count) return false;
+
+        if (_task) {
+            _task(_taskArg, index);
         }
-        
-        DBG("Client thread finishing");        
+        else {
+            PeerRenderContext ctx = *_context;
+            ctx.scratch = &scratch;
+            _processor.renderRemotePeer(_peers[index], index, ctx);
+        }
+
+        _done.fetch_add(1, std::memory_order_release);
+        return true;
     }
-    
-    SonobusAudioProcessor & _processor;
-    
-};
 
+    class Worker : public juce::Thread
+    {
+    public:
+        Worker(PeerRenderPool & pool, int index) : Thread("SonoBusPeerRender" + String(index)), _pool(pool), _index(index)
+        {}
+
+        void run() override {
+            auto & scratch = *_pool._scratch.getUnchecked(_index + 1);
 
-enum {
-    OutMixBusIndex = 0,
-    OutSelfBusIndex,
-    OutUserBaseBusIndex,
-    OutUserLastBusIndex = 9
+            while (!threadShouldExit()) {
+                // signalled for every render, and to exit
+                wakeup.wait();
+                if (threadShouldExit()) break;
+
+                // the callback waits on us, so we go where it goes
+                joinAudioWorkgroup();
+
+                ScopedNoDenormals noDenormals;
+                RealtimeSafetyChecker::ScopedRealtimeSection realtimeSection;
+                TraceRecorder::Scope trace ("renderPeers");
+                while (_pool.runNext(scratch)) {}
+            }
+        }
+
+        WaitableEvent wakeup;
+        PeerRenderPool & _pool;
+        const int _index;
+    };
+
+    SonobusAudioProcessor & _processor;
+    OwnedArray<Worker> _workers;
+    OwnedArray<PeerRenderScratch> _scratch;
+
+    std::atomic<uint64_t> _cursor { 0 };
+    std::atomic<int> _done { 0 };
+    RemotePeer * const * _peers = nullptr;
+    const PeerRenderContext * _context = nullptr;
+    TaskFn _task = nullptr;
+    void * _taskArg = nullptr;
 };
 
-#if JUCE_IOS
-#define ALTBUS_ACTIVE true
-#else
-#define ALTBUS_ACTIVE false
-#endif
 
 
-SonobusAudioProcessor::BusesProperties SonobusAudioProcessor::getDefaultLayout()
+#if SEND_BATCHING_ENABLED
+
+// outgoing packet queue, filled by endpoint_send() while the send thread
+// is inside doSendData(), then flushed with as few syscalls as possible.
+// Consecutive equal sized packets to the same endpoint are coalesced into
+// one UDP GSO send when the kernel supports it.
+struct UdpSendBatch
 {
-    auto props = SonobusAudioProcessor::BusesProperties();
-    auto plugtype = PluginHostType::getPluginLoadedAs();
+    UdpSendBatch() {
+        packets.calloc(SEND_BATCH_SIZE);
+        msgs.calloc(SEND_BATCH_SIZE);
+        iovecs.calloc(SEND_BATCH_SIZE);
+        msgPacketCounts.calloc(SEND_BATCH_SIZE);
+        msgFirstPackets.calloc(SEND_BATCH_SIZE);
+        msgFds.calloc(SEND_BATCH_SIZE);
+        controlBufs.calloc(SEND_BATCH_SIZE * CMSG_SPACE(sizeof(uint16_t)));
+        order.calloc(SEND_BATCH_SIZE);
+        dests.calloc(SEND_BATCH_SIZE);
+        destCounts.calloc(SEND_BATCH_SIZE);
+    }
 
-    // common to all
-    props = props.withInput  ("Main In",  AudioChannelSet::stereo(), true)
-    .withOutput ("Mix Out", AudioChannelSet::stereo(), true);
+    // sealed with cipher straight into the batch, if there is one
+    bool add(SonobusAudioProcessor::EndpointState * endpoint, const char * data, int32_t size, SonoAudio::PacketCipher * cipher = nullptr)
+    {
+        const int32_t sendsize = cipher ? size + SonoAudio::PacketCipher::Overhead : size;
+        if (size <= 0 || sendsize > AOO_MAXPACKETSIZE + AOONET_RELAY_HEADER_SIZE) return false;
 
+        if (count == SEND_BATCH_SIZE) {
+            // still inside doSendData() with the core lock held, no time for pacing
+            flush();
+            if (count == SEND_BATCH_SIZE) return false;
+        }
 
-    // extra inputs
-    if (plugtype == AudioProcessor::wrapperType_AAX) {
-        // only one sidechain mono allowed, doesn't even work anyway
-        props = props.withInput ("Aux 1 In", AudioChannelSet::mono(), ALTBUS_ACTIVE);
-    }
-    else if (plugtype == AudioProcessor::wrapperType_VST) {
-        // no multi-bus outputs for now for VST2, so it works in OBS
-    }
-    else {
-        // throw in some input sidechains
-        props = props.withInput  ("Aux 1 In",  AudioChannelSet::stereo(), ALTBUS_ACTIVE)
-        .withInput  ("Aux 2 In",  AudioChannelSet::stereo(), ALTBUS_ACTIVE)
-        .withInput  ("Aux 3 In",  AudioChannelSet::stereo(), ALTBUS_ACTIVE)
-        .withInput  ("Aux 4 In",  AudioChannelSet::stereo(), ALTBUS_ACTIVE)
-        .withInput  ("Aux 5 In",  AudioChannelSet::stereo(), ALTBUS_ACTIVE)
-        .withInput  ("Aux 6 In",  AudioChannelSet::stereo(), ALTBUS_ACTIVE)
-        .withInput  ("Aux 7 In",  AudioChannelSet::stereo(), ALTBUS_ACTIVE)
-        .withInput  ("Aux 8 In",  AudioChannelSet::stereo(), ALTBUS_ACTIVE);
+        auto & packet = packets[count++];
+        if (cipher) {
+            packet.size = cipher->seal(data, size, packet.data);
+        } else {
+            memcpy(packet.data, data, (size_t) size);
+            packet.size = size;
+        }
+        packet.endpoint = endpoint;
+        packet.fd = endpoint->owner->getRawSocketHandle();
+        return true;
     }
 
-    // outputs
-    if (plugtype == AudioProcessor::wrapperType_VST) {
-        // no multi-bus outputs for now for VST2, so it works in OBS
-    }
-    else {
-        props = props.withOutput ("Aux 1 Out", AudioChannelSet::stereo(), ALTBUS_ACTIVE)
-        .withOutput ("Aux 2 Out", AudioChannelSet::stereo(), ALTBUS_ACTIVE)
-        .withOutput ("Aux 3 Out", AudioChannelSet::stereo(), ALTBUS_ACTIVE)
-        .withOutput ("Aux 4 Out", AudioChannelSet::stereo(), ALTBUS_ACTIVE)
-        .withOutput ("Aux 5 Out", AudioChannelSet::stereo(), ALTBUS_ACTIVE)
-        .withOutput ("Aux 6 Out", AudioChannelSet::stereo(), ALTBUS_ACTIVE)
-        .withOutput ("Aux 7 Out", AudioChannelSet::stereo(), ALTBUS_ACTIVE)
-        .withOutput ("Aux 8 Out", AudioChannelSet::stereo(), ALTBUS_ACTIVE);
-    }
+    // sends everything queued. With a pacing interval, a backlog of more than
+    // SEND_PACING_BURST_PACKETS datagrams for one destination (after a scheduling
+    // hiccup, say) is spread evenly over that interval: round r holds the r'th
+    // datagram of every destination, and the rounds go out one gap apart.
+    // When nonBlocking, what doesn't fit into the socket's buffer stays queued
+    void flush(double pacingIntervalMs = 0.0)
+    {
+        if (count == 0) return;
 
+        const int rounds = pacingIntervalMs > 0.0 ? assignRounds() : 1;
 
-    return props;
-}
+        if (rounds <= SEND_PACING_BURST_PACKETS) {
+            for (int i=0; i < count; ++i) {
+                order[i] = i;
+            }
+            const int done = sendPackets(order, count);
+            if (done < count) {
+                keepUnsent(done);
+                return;
+            }
+        }
+        else {
+            // stable counting sort by round, keeps the order per destination
+            int pos = 0;
+            for (int r=0; r < rounds; ++r) {
+                for (int i=0; i < count; ++i) {
+                    if (packets[i].round == r) order[pos++] = i;
+                }
+            }
 
+            const auto start = std::chrono::steady_clock::now();
+            const auto gap = std::chrono::duration<double, std::milli>(pacingIntervalMs / rounds);
+            int begin = 0;
 
-//==============================================================================
-SonobusAudioProcessor::SonobusAudioProcessor()
-     : AudioProcessor ( getDefaultLayout() ),
-mState (*this, &mUndoManager, "SonoBusAoO",
-{
-    std::make_unique<AudioParameterFloat>(paramInGain,     TRANS ("In Gain"),    NormalisableRange<float>(0.0, 4.0, 0.0, 0.33), mInGain.get(), "", AudioProcessorParameter::genericParameter,
-                                          [](float v, int maxlen) -> String { return Decibels::toString(Decibels::gainToDecibels(v), 1); }, 
-                                          [](const String& s) -> float { return Decibels::decibelsToGain(s.getFloatValue()); }),
+            for (int r=0; r < rounds; ++r) {
+                int end = begin;
+                while (end < count && packets[order[end]].round == r) ++end;
 
-    std::make_unique<AudioParameterFloat>(paramInMonitorMonoPan,     TRANS ("In Pan"),    NormalisableRange<float>(-1.0, 1.0, 0.0), mInMonMonoPan.get(), "", AudioProcessorParameter::genericParameter, 
-                                          [](float v, int maxlen) -> String { if (fabs(v) < 0.01) return TRANS("C"); return String((int)rint(abs(v*100.0f))) + ((v > 0 ? "% R" : "% L")) ; },
-                                          [](const String& s) -> float { return s.getFloatValue()*1e-2f; }),
+                if (r > 0) {
+                    std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(gap * r));
+                }
+                sendPackets(order + begin, end - begin);
+                begin = end;
+            }
+        }
 
-    std::make_unique<AudioParameterFloat>(paramInMonitorPan1,     TRANS ("In Pan 1"),    NormalisableRange<float>(-1.0, 1.0, 0.0), mInMonPan1.get(), "", AudioProcessorParameter::genericParameter, 
-                                          [](float v, int maxlen) -> String { if (fabs(v) < 0.01) return TRANS("C"); return String((int)rint(abs(v*100.0f))) + ((v > 0 ? "% R" : "% L")) ; },
-                                          [](const String& s) -> float { return s.getFloatValue()*1e-2f; }),
+        count = 0;
+    }
+
+    struct Packet {
+        char data[AOO_MAXPACKETSIZE + AOONET_RELAY_HEADER_SIZE];
+        int size = 0;
+        int round = 0;
+        int fd = -1;
+        SonobusAudioProcessor::EndpointState * endpoint = nullptr;
+    };
+
+    HeapBlock<Packet> packets;
+    HeapBlock<struct mmsghdr> msgs;
+    HeapBlock<struct iovec> iovecs;
+    HeapBlock<int> msgPacketCounts;
+    HeapBlock<int> msgFirstPackets;
+    HeapBlock<int> msgFds;
+    HeapBlock<char> controlBufs;
+    HeapBlock<int> order;
+    HeapBlock<SonobusAudioProcessor::EndpointState*> dests;
+    HeapBlock<int> destCounts;
+    int count = 0;
+    bool useGso = true;
+    // set while the audio callback sends, see SonobusAudioProcessor::sendInline()
+    bool nonBlocking = false;
+#if URING_ENABLED
+    // set up on the first flush, it belongs to the thread that makes it
+    aoo::uring ring;
+    bool ringChecked = false;
+#endif
 
-    std::make_unique<AudioParameterFloat>(paramInMonitorPan2,     TRANS ("In Pan 2"),    NormalisableRange<float>(-1.0, 1.0, 0.0), mInMonPan2.get(), "", AudioProcessorParameter::genericParameter, 
-                                          [](float v, int maxlen) -> String { if (fabs(v) < 0.01) return TRANS("C"); return String((int)rint(abs(v*100.0f))) + ((v > 0 ? "% R" : "% L")) ; },
-                                          [](const String& s) -> float { return s.getFloatValue()*1e-2f; }),
+private:
+    // numbers the datagrams of each destination, returns the most any destination has
+    int assignRounds()
+    {
+        int ndests = 0;
+        int maxcount = 0;
+
+        for (int i=0; i < count; ++i) {
+            auto & packet = packets[i];
+            int d = 0;
+            while (d < ndests && dests[d] != packet.endpoint) ++d;
+            if (d == ndests) {
+                dests[ndests] = packet.endpoint;
+                destCounts[ndests++] = 0;
+            }
+            packet.round = destCounts[d]++;
+            maxcount = jmax(maxcount, destCounts[d]);
+        }
 
-    std::make_unique<AudioParameterFloat>(paramDry,     TRANS ("Dry Level"),    NormalisableRange<float>(0.0,    1.0, 0.0, 0.5), JUCEApplicationBase::isStandaloneApp() ? mDry.get() : 1.0f, "", AudioProcessorParameter::genericParameter,
-                                          [](float v, int maxlen) -> String { return Decibels::toString(Decibels::gainToDecibels(v), 1); }, 
-                                          [](const String& s) -> float { return Decibels::decibelsToGain(s.getFloatValue()); }),
+        return maxcount;
+    }
 
-    std::make_unique<AudioParameterFloat>(paramWet,     TRANS ("Output Level"),    NormalisableRange<float>(0.0, 2.0, 0.0, 0.5), mWet.get(), "", AudioProcessorParameter::genericParameter,
-                                          [](float v, int maxlen) -> String { return Decibels::toString(Decibels::gainToDecibels(v), 1); }, 
-                                          [](const String& s) -> float { return Decibels::decibelsToGain(s.getFloatValue()); }),
+    // moves the packets after the first 'done' to the front, for the next flush
+    void keepUnsent(int done)
+    {
+        for (int i = done; i < count; ++i) {
+            auto & packet = packets[i - done];
+            const auto & unsent = packets[i];
+            memcpy(packet.data, unsent.data, (size_t) unsent.size);
+            packet.size = unsent.size;
+            packet.fd = unsent.fd;
+            packet.endpoint = unsent.endpoint;
+        }
+        count -= done;
+    }
 
-    std::make_unique<AudioParameterFloat>(paramDefaultNetbufMs,     TRANS ("Default Jitter Buffer Time"),    NormalisableRange<float>(0.0, mMaxBufferTime.get(), 0.001, 0.5), mBufferTime.get(), "", AudioProcessorParameter::genericParameter,
-                                          [](float v, int maxlen) -> String { return String(v*1000.0) + " ms"; }, 
-                                          [](const String& s) -> float { return s.getFloatValue()*1e-3f; }),
-    std::make_unique<AudioParameterChoice>(paramSendChannels, TRANS ("Send Channels"), StringArray({ "Match # Inputs", "Send Mono", "Send Stereo"}), JUCEApplicationBase::isStandaloneApp() ? mSendChannels.get() : 0),
+    // sends the packets at the given indices, in that order. Returns how many of
+    // them are done with, fewer than num only when a nonBlocking send found the
+    // socket's buffer full
+    int sendPackets(const int * indices, int num)
+    {
+        const int cmsgspace = (int) CMSG_SPACE(sizeof(uint16_t));
+        int nmsgs = 0;
+
+        for (int i=0; i < num; ) {
+            auto & first = packets[indices[i]];
+            int run = 1;
+#ifdef UDP_SEGMENT
+            if (useGso) {
+                while (i + run < num && run < 64
+                       && packets[indices[i+run]].endpoint == first.endpoint
+                       && packets[indices[i+run]].fd == first.fd
+                       && packets[indices[i+run]].size == first.size
+                       && (run + 1) * first.size < 65000) {
+                    ++run;
+                }
+            }
+#endif
+            auto & msg = msgs[nmsgs];
+            zerostruct(msg);
 
-    std::make_unique<AudioParameterBool>(paramMetEnabled, TRANS ("Metronome Enabled"), mMetEnabled.get()),
-    std::make_unique<AudioParameterBool>(paramSendMetAudio, TRANS ("Send Metronome Audio"), mSendMet.get()),
-    std::make_unique<AudioParameterFloat>(paramMetGain,     TRANS ("Metronome Gain"),    NormalisableRange<float>(0.0, 1.0, 0.0, 0.5), mMetGain.get(), "", AudioProcessorParameter::genericParameter,
-                                          [](float v, int maxlen) -> String { return Decibels::toString(Decibels::gainToDecibels(v), 1); },
-                                          [](const String& s) -> float { return Decibels::decibelsToGain(s.getFloatValue()); }),
+            for (int j=0; j < run; ++j) {
+                iovecs[i+j].iov_base = packets[indices[i+j]].data;
+                iovecs[i+j].iov_len = (size_t) packets[indices[i+j]].size;
+            }
+            msg.msg_hdr.msg_iov = &iovecs[i];
+            msg.msg_hdr.msg_iovlen = (size_t) run;
+            socklen_t namelen = 0;
+            msg.msg_hdr.msg_name = (void *) first.endpoint->getSendAddr(namelen);
+            msg.msg_hdr.msg_namelen = namelen;
+
+#ifdef UDP_SEGMENT
+            if (run > 1) {
+                msg.msg_hdr.msg_control = controlBufs + nmsgs * cmsgspace;
+                msg.msg_hdr.msg_controllen = (size_t) cmsgspace;
+                auto cm = CMSG_FIRSTHDR(&msg.msg_hdr);
+                cm->cmsg_level = SOL_UDP;
+                cm->cmsg_type = UDP_SEGMENT;
+                cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t segsize = (uint16_t) first.size;
+                memcpy(CMSG_DATA(cm), &segsize, sizeof(segsize));
+            }
+#endif
+            msgPacketCounts[nmsgs] = run;
+            msgFirstPackets[nmsgs] = i;
+            msgFds[nmsgs] = first.fd;
+            i += run;
+            ++nmsgs;
+        }
 
-    std::make_unique<AudioParameterFloat>(paramMetTempo,     TRANS ("Metronome Tempo"),    NormalisableRange<float>(10.0, 400.0, 1, 0.5), mMetTempo.get(), "", AudioProcessorParameter::genericParameter,
-                                          [](float v, int maxlen) -> String { return String(v) + " bpm"; },
-                                          [](const String& s) -> float { return s.getFloatValue(); }),
+#if URING_ENABLED
+        // the ring waits for its completions
+        if (!nonBlocking && sendWithUring(indices, nmsgs)) return num;
+#endif
 
-    std::make_unique<AudioParameterBool>(paramSendFileAudio, TRANS ("Send Playback Audio"), mSendPlaybackAudio.get()),
-    std::make_unique<AudioParameterBool>(paramHearLatencyTest, TRANS ("Hear Latency Test"), mHearLatencyTest.get()),
-    std::make_unique<AudioParameterBool>(paramMetIsRecorded, TRANS ("Record Metronome to File"), mMetIsRecorded.get()),
-    std::make_unique<AudioParameterBool>(paramMainReverbEnabled, TRANS ("Main Reverb Enabled"), mMainReverbEnabled.get()),
-    std::make_unique<AudioParameterFloat>(paramMainReverbLevel,     TRANS ("Main Reverb Level"),    NormalisableRange<float>(0.0,    1.0, 0.0, 0.4), mMainReverbLevel.get(), "", AudioProcessorParameter::genericParameter, 
-                                          [](float v, int maxlen) -> String { return Decibels::toString(Decibels::gainToDecibels(v), 1); }, 
-                                          [](const String& s) -> float { return Decibels::decibelsToGain(s.getFloatValue()); }),
-    std::make_unique<AudioParameterFloat>(paramMainReverbSize,     TRANS ("Main Reverb Size"),    NormalisableRange<float>(0.0, 1.0, 0.0), mMainReverbSize.get(), "", AudioProcessorParameter::genericParameter,
-                                          [](float v, int maxlen) -> String { return String((int)(v*100)) + " %"; },
-                                          [](const String& s) -> float { return s.getFloatValue()*0.01f; }),
-    std::make_unique<AudioParameterFloat>(paramMainReverbDamping,     TRANS ("Main Reverb Damping"),    NormalisableRange<float>(0.0, 1.0, 0.0), mMainReverbDamping.get(), "", AudioProcessorParameter::genericParameter,
-                                          [](float v, int maxlen) -> String { return String((int)(v*100)) + " %"; },
-                                          [](const String& s) -> float { return s.getFloatValue()*0.01f; }),
-    std::make_unique<AudioParameterFloat>(paramMainReverbPreDelay,     TRANS ("Pre-Delay Time"),    NormalisableRange<float>(0.0, 100.0, 1.0, 1.0), mMainReverbPreDelay.get(), "", AudioProcessorParameter::genericParameter,
-                                          [](float v, int maxlen) -> String { return String(v, 0) + " ms"; }, 
-                                          [](const String& s) -> float { return s.getFloatValue(); }),
+        const int flags = nonBlocking ? MSG_DONTWAIT : 0;
+        int sent = 0;
+        int packetindex = 0;
 
-    std::make_unique<AudioParameterChoice>(paramMainReverbModel, TRANS ("Main Reverb Model"), StringArray({ "Freeverb", "MVerb", "Zita"}), mMainReverbModel.get()),
+        while (sent < nmsgs) {
+            // one call per run of messages for the same socket
+            int nrun = 1;
+            while (sent + nrun < nmsgs && msgFds[sent + nrun] == msgFds[sent]) ++nrun;
 
-    std::make_unique<AudioParameterBool>(paramMainSendMute, TRANS ("Main Send Mute"), mMainSendMute.get()),
-    std::make_unique<AudioParameterBool>(paramMainRecvMute, TRANS ("Main Receive Mute"), mMainRecvMute.get()),
-    std::make_unique<AudioParameterBool>(paramMainInMute, TRANS ("Main In Mute"), mMainInMute.get()),
-    std::make_unique<AudioParameterBool>(paramMainMonitorSolo, TRANS ("Main Monitor Solo"), mMainMonitorSolo.get()),
+            int result = ::sendmmsg(msgFds[sent], msgs + sent, (unsigned int) nrun, flags);
 
-    std::make_unique<AudioParameterChoice>(paramDefaultAutoNetbuf, TRANS ("Def Auto Net Buffer Mode"), StringArray({ "Off", "Auto-Increase", "Auto-Full", "Initial-Auto"}), defaultAutoNetbufMode),
+            if (result < 0) {
+                if (errno == EINTR) continue;
+                if (nonBlocking && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    return packetindex;
+                }
 
-    std::make_unique<AudioParameterInt>(paramDefaultSendQual, TRANS ("Def Send Format"), 0, 14, mDefaultAudioFormatIndex),
-    std::make_unique<AudioParameterBool>(paramDynamicResampling, TRANS ("Dynamic Resampling"), mDynamicResampling.get()),
-    std::make_unique<AudioParameterBool>(paramAutoReconnectLast, TRANS ("Reconnect Last"), mAutoReconnectLast.get()),
-    std::make_unique<AudioParameterFloat>(paramDefaultPeerLevel,     TRANS ("Default User Level"),    NormalisableRange<float>(0.0,    1.0, 0.0, 0.5), mDefUserLevel.get(), "", AudioProcessorParameter::genericParameter,
-                                          [](float v, int maxlen) -> String { return Decibels::toString(Decibels::gainToDecibels(v), 1); },
-                                          [](const String& s) -> float { return Decibels::decibelsToGain(s.getFloatValue()); }),
-    std::make_unique<AudioParameterBool>(paramSyncMetToHost, TRANS ("Sync to Host"), JUCEApplicationBase::isStandaloneApp() ? false : true),
-    std::make_unique<AudioParameterFloat>(paramInputReverbLevel,     TRANS ("Input Reverb Level"),    NormalisableRange<float>(0.0,    1.0, 0.0, 0.4), mInputReverbLevel.get(), "", AudioProcessorParameter::genericParameter,
-                                          [](float v, int maxlen) -> String { return Decibels::toString(Decibels::gainToDecibels(v), 1); },
-                                          [](const String& s) -> float { return Decibels::decibelsToGain(s.getFloatValue()); }),
-    std::make_unique<AudioParameterFloat>(paramInputReverbSize,     TRANS ("Input Reverb Size"),    NormalisableRange<float>(0.0, 1.0, 0.0), mInputReverbSize.get(), "", AudioProcessorParameter::genericParameter,
-                                          [](float v, int maxlen) -> String { return String((int)(v*100)) + " %"; },
-                                          [](const String& s) -> float { return s.getFloatValue()*0.01f; }),
-    std::make_unique<AudioParameterFloat>(paramInputReverbDamping,     TRANS ("Input Reverb Damping"),    NormalisableRange<float>(0.0, 1.0, 0.0), mInputReverbDamping.get(), "", AudioProcessorParameter::genericParameter,
-                                          [](float v, int maxlen) -> String { return String((int)(v*100)) + " %"; },
-                                          [](const String& s) -> float { return s.getFloatValue()*0.01f; }),
-    std::make_unique<AudioParameterFloat>(paramInputReverbPreDelay,     TRANS ("Input Reverb Pre-Delay Time"),    NormalisableRange<float>(0.0, 100.0, 1.0, 1.0), mInputReverbPreDelay.get(), "", AudioProcessorParameter::genericParameter,
-                                          [](float v, int maxlen) -> String { return String(v, 0) + " ms"; },
-                                          [](const String& s) -> float { return s.getFloatValue(); }),
-    std::make_unique<AudioParameterBool>(paramSyncMetToFilePlayback, TRANS ("Sync Met to File Playback"), false),
+                if (useGso && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT)) {
+                    // no GSO support (or no offload for this device), don't try again
+                    DBG("UDP GSO unavailable, falling back to single sends");
+                    useGso = false;
+                }
+                else {
+                    DBG("Error sending UDP batch: " << errno);
+                }
 
-})
-{
-    mState.addParameterListener (paramInGain, this);
-    mState.addParameterListener (paramDry, this);
-    mState.addParameterListener (paramWet, this);
-    mState.addParameterListener (paramInMonitorMonoPan, this);
-    mState.addParameterListener (paramInMonitorPan1, this);
-    mState.addParameterListener (paramInMonitorPan2, this);
-    mState.addParameterListener (paramDefaultAutoNetbuf, this);
-    mState.addParameterListener (paramDefaultNetbufMs, this);
-    mState.addParameterListener (paramDefaultSendQual, this);
-    mState.addParameterListener (paramMainSendMute, this);
-    mState.addParameterListener (paramMainRecvMute, this);
-    mState.addParameterListener (paramMetEnabled, this);
-    mState.addParameterListener (paramMetGain, this);
-    mState.addParameterListener (paramMetTempo, this);
-    mState.addParameterListener (paramSendMetAudio, this);
-    mState.addParameterListener (paramSendFileAudio, this);
-    mState.addParameterListener (paramHearLatencyTest, this);
-    mState.addParameterListener (paramMetIsRecorded, this);
-    mState.addParameterListener (paramMainReverbEnabled, this);
-    mState.addParameterListener (paramMainReverbSize, this);
-    mState.addParameterListener (paramMainReverbLevel, this);
-    mState.addParameterListener (paramMainReverbDamping, this);
-    mState.addParameterListener (paramMainReverbPreDelay, this);
-    mState.addParameterListener (paramMainReverbModel, this);
-    mState.addParameterListener (paramSendChannels, this);
-    mState.addParameterListener (paramDynamicResampling, this);
-    mState.addParameterListener (paramAutoReconnectLast, this);
-    mState.addParameterListener (paramMainInMute, this);
-    mState.addParameterListener (paramMainMonitorSolo, this);
-    mState.addParameterListener (paramDefaultPeerLevel, this);
-    mState.addParameterListener (paramSyncMetToHost, this);
-    mState.addParameterListener (paramSyncMetToFilePlayback, this);
-    mState.addParameterListener (paramInputReverbSize, this);
-    mState.addParameterListener (paramInputReverbLevel, this);
-    mState.addParameterListener (paramInputReverbDamping, this);
-    mState.addParameterListener (paramInputReverbPreDelay, this);
+                // send the rest one by one
+                return packetindex + sendSingly(indices + packetindex, num - packetindex);
+            }
 
-    for (int i=0; i < MAX_PEERS; ++i) {
-        for (int j=0; j < MAX_PEERS; ++j) {
-            mRemoteSendMatrix[i][j] = false;
+            for (int m = sent; m < sent + result; ++m) {
+                for (int j=0; j < msgPacketCounts[m]; ++j) {
+                    auto & packet = packets[indices[packetindex++]];
+                    packet.endpoint->sentBytes += packet.size + UDP_OVERHEAD_BYTES;
+                }
+            }
+            sent += result;
         }
-    }
-
-#if (JUCE_IOS)
-    mDefaultRecordDir = File::getSpecialLocation (File::userDocumentsDirectory).getFullPathName();
-#elif (JUCE_ANDROID)
-    auto parentDir = File::getSpecialLocation (File::userApplicationDataDirectory);
-    parentDir = parentDir.getChildFile("Recordings");
-    mDefaultRecordDir = parentDir.getFullPathName();
-#else
-    auto parentDir = File::getSpecialLocation (File::userMusicDirectory);
-    parentDir = parentDir.getChildFile("SonoBus");
-    mDefaultRecordDir = parentDir.getFullPathName();
-#endif
-
 
-    initFormats();
-    
-    mDefaultAutoNetbufModeParam = mState.getParameter(paramDefaultAutoNetbuf);
-    mDefaultAudioFormatParam = mState.getParameter(paramDefaultSendQual);
+        return num;
+    }
 
-    const bool isplugin = !JUCEApplicationBase::isStandaloneApp();
-    if (isplugin) {
-        // default dry to 1.0 if plugin
-        mDry = 1.0;
-        mSendChannels = 0; // match inputs default for plugin
-    } else {
-        mDry = 0.0;
+    int sendSingly(const int * indices, int num)
+    {
+        const int flags = nonBlocking ? MSG_DONTWAIT : 0;
+
+        for (int i=0; i < num; ++i) {
+            auto & packet = packets[indices[i]];
+            socklen_t namelen = 0;
+            auto addr = packet.endpoint->getSendAddr(namelen);
+            auto nbytes = ::sendto(packet.fd, packet.data, (size_t) packet.size, flags, addr, namelen);
+            if (nbytes > 0) {
+                packet.endpoint->sentBytes += nbytes + UDP_OVERHEAD_BYTES;
+            }
+            else if (nonBlocking && nbytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return i;
+            }
+        }
+        return num;
     }
 
-    mState.getParameter(paramDry)->setValue(mDry.get());
-    mState.getParameter(paramSendChannels)->setValue(mState.getParameter(paramSendChannels)->convertTo0to1(mSendChannels.get()));
+#if URING_ENABLED
+    // every message in one submission, whatever socket it goes out on.
+    // false if there is no ring, and nothing was sent
+    bool sendWithUring(const int * indices, int nmsgs)
+    {
+        if (!ringChecked) {
+            ringChecked = true;
+            if (!ring.init(SEND_BATCH_SIZE)) {
+                DBG("io_uring unavailable, sending with sendmmsg");
+            }
+        }
+        if (!ring.valid() || nmsgs == 0) return false;
 
-    mTempoParameter = mState.getParameter(paramMetTempo);
-    
-    mMetronome = std::make_unique<SonoAudio::Metronome>();
-    
-    mMetronome->loadBarSoundFromBinaryData(BinaryData::bar_click_wav, BinaryData::bar_click_wavSize);
-    mMetronome->loadBeatSoundFromBinaryData(BinaryData::beat_click_wav, BinaryData::beat_click_wavSize);
-    mMetronome->setTempo(100.0);
-    
-    mMainReverb = std::make_unique<Reverb>();
-    mMainReverbParams.dryLevel = 0.0f;
-    mMainReverbParams.wetLevel = mMainReverbLevel.get() * 0.5f;
-    mMainReverbParams.damping = mMainReverbDamping.get();
-    mMainReverbParams.roomSize = jmap(mMainReverbSize.get(), 0.55f, 1.0f);
-    mMainReverb->setParameters(mMainReverbParams);
+        // the ring has room for a whole batch, and nothing else is in it
+        for (int m=0; m < nmsgs; ++m) {
+            auto * sqe = ring.get_sqe();
+            jassert (sqe != nullptr);
+            ring.prep_sendmsg(sqe, msgFds[m], &msgs[m].msg_hdr, (uint64_t) m);
+        }
 
+        int done = 0;
+        for (unsigned waitnr = (unsigned) nmsgs; done < nmsgs; ) {
+            const int result = ring.submit(waitnr);
+            if (result < 0 && result != -EINTR) {
+                // not knowing what went out, all of it goes again with sendmmsg,
+                // a datagram that arrives twice is dropped by the receiver
+                DBG("io_uring send failed: " << -result << ", sending with sendmmsg");
+                ring.close();
+                return false;
+            }
 
-    for (int i=0; i < MAX_CHANGROUPS; ++i) {
+            while (auto * cqe = ring.peek()) {
+                const int m = (int) cqe->user_data;
+                const int res = cqe->res;
+                ring.seen();
+                ++done;
+
+                const int * msgindices = indices + msgFirstPackets[m];
+                if (res >= 0) {
+                    for (int j=0; j < msgPacketCounts[m]; ++j) {
+                        auto & packet = packets[msgindices[j]];
+                        packet.endpoint->sentBytes += packet.size + UDP_OVERHEAD_BYTES;
+                    }
+                    continue;
+                }
 
-        // default to all independent
-        mInputChannelGroups[i].params.chanStartIndex = i;
-        mInputChannelGroups[i].params.numChannels = 1;
+                if (useGso && (res == -EIO || res == -EINVAL || res == -ENOPROTOOPT)) {
+                    DBG("UDP GSO unavailable, falling back to single sends");
+                    useGso = false;
+                }
+                else {
+                    DBG("Error sending UDP batch: " << -res);
+                }
+                sendSingly(msgindices, msgPacketCounts[m]);
+            }
+            waitnr = (unsigned) (nmsgs - done);
+        }
 
-        mInputChannelGroups[i].params.setToDefaults(isplugin);
+        return true;
     }
+#endif
+};
 
-    mMetChannelGroup.params.name = TRANS("Metronome");
-    mMetChannelGroup.params.numChannels = 1;
+// only set on the send thread while it is inside doSendData(), and in sendInline()
+static thread_local UdpSendBatch * currentSendBatch = nullptr;
 
-    mRecMetChannelGroup.params.name = TRANS("Metronome");
-    mRecMetChannelGroup.params.numChannels = 1;
+#endif
 
-    mFilePlaybackChannelGroup.params.name = TRANS("File Playback");
-    mFilePlaybackChannelGroup.params.numChannels = 2;
+// only set while a shared source sends through the server
+static thread_local ForwardBatch * currentForwardBatch = nullptr;
 
-    mRecFilePlaybackChannelGroup.params.name = TRANS("File Playback");
-    mRecFilePlaybackChannelGroup.params.numChannels = 2;
+// only set while the audio callback sends, which mustn't wait for the socket
+static thread_local bool currentlySendingInline = false;
 
+// sends the packet on its way to the endpoint, sealed with cipher on the way if
+// there is one. Whatever goes to the server itself (relayed or forwarded) is never
+// sealed again, only the packet inside is
+static int32_t endpoint_send_packet(SonobusAudioProcessor::EndpointState * endpoint, const char *data, int32_t size, SonoAudio::PacketCipher * cipher)
+{
+    int result = -1;
 
-    mTransportSource.addChangeListener(this);
-    
-    // audio setup
-    mFormatManager.registerBasicFormats();    
-    
-    initializeAoo();
-}
+    if (auto relay = endpoint->relay.load()) {
+        // wrap it up for the server, which passes it on to the peer
+        char buf[AOO_MAXPACKETSIZE + AOONET_RELAY_HEADER_SIZE + SonoAudio::PacketCipher::Overhead];
+        const int32_t wrapsize = cipher ? size + SonoAudio::PacketCipher::Overhead : size;
+        if (size > AOO_MAXPACKETSIZE
+            || aoonet_write_relay_header(buf, endpoint->getRawAddr(), wrapsize) <= 0) {
+            return -1;
+        }
+        if (cipher) {
+            cipher->seal(data, size, buf + AOONET_RELAY_HEADER_SIZE);
+        } else {
+            memcpy(buf + AOONET_RELAY_HEADER_SIZE, data, (size_t) size);
+        }
 
+        result = endpoint_send_packet(relay, buf, wrapsize + AOONET_RELAY_HEADER_SIZE, nullptr);
+        if (result > 0) {
+            endpoint->sentBytes += result + UDP_OVERHEAD_BYTES;
+            result = size;
+        }
+        return result;
+    }
 
+#if SEND_BATCHING_ENABLED
+    if (currentSendBatch && currentSendBatch->add(endpoint, data, size, cipher)) {
+        return size;
+    }
+#endif
 
-SonobusAudioProcessor::~SonobusAudioProcessor()
-{
-    mTransportSource.setSource(nullptr);
-    mTransportSource.removeChangeListener(this);
+    char sealed[AOO_MAXPACKETSIZE + SonoAudio::PacketCipher::Overhead];
+    int32_t sendsize = size;
+    if (cipher) {
+        if (size > AOO_MAXPACKETSIZE) return -1;
+        sendsize = cipher->seal(data, size, sealed);
+        data = sealed;
+    }
 
-    cleanupAoo();
+    socklen_t addrlen = 0;
+    auto addr = endpoint->getSendAddr(addrlen);
+    if (addrlen > 0) {
+        result = (int) ::sendto(endpoint->owner->getRawSocketHandle(), data, (size_t) sendsize,
+                                currentlySendingInline ? INLINE_SEND_FLAGS : 0, addr, addrlen);
+    }
+    
+    if (result > 0) {
+        // include UDP overhead
+        endpoint->sentBytes += result + UDP_OVERHEAD_BYTES;
+        result = size;
+    }
+    else if (result < 0) {
+        DBG("Error sending bytes to endpoint " << endpoint->ipaddr);
+    }
+    return result;
 }
 
-void SonobusAudioProcessor::setUseSpecificUdpPort(int port)
+static int32_t endpoint_send(void *e, const char *data, int32_t size)
 {
-    mUseSpecificUdpPort = port;
-    
-    if (port != 0) {
-        if (port != mUdpLocalPort) {
-            cleanupAoo();
-            initializeAoo(port);
-        }
+    SonobusAudioProcessor::EndpointState * endpoint = static_cast<SonobusAudioProcessor::EndpointState*>(e);
+
+    if (currentForwardBatch && currentForwardBatch->add(endpoint, data, size)) {
+        return size;
     }
+
+    return endpoint_send_packet(endpoint, data, size, endpoint->cipher.load());
 }
 
-void SonobusAudioProcessor::initializeAoo(int udpPort)
+bool ForwardBatch::add(SonobusAudioProcessor::EndpointState * endpoint, const char * data, int32_t size)
 {
-    int udpport = udpPort; // defaults to letting system choose it  // DEFAULT_UDP_PORT;
-    
-    // we have both an AOO source and sink
-        
-    aoo_initialize();
-    
+    // only the audio data is the same for every sink, and the server
+    // can only pass it on to members of our group
+    const bool viaserver = server && endpoint->serverPeer.load();
+    const bool viamulticast = multicast && endpoint->lanMulticastListener.load();
+    int32_t salt = 0;
+    if (!(viaserver || viamulticast) || size > AOO_MAXPACKETSIZE
+        || !aoo_parse_compact_data_salt(data, size, &salt)) {
+        return false;
+    }
 
-    const ScopedWriteLock sl (mCoreLock);        
+    if (!dests.empty() && (size != (int32_t) packet.size() || memcmp(packet.data(), data, (size_t) size) != 0
+                           || dests.front()->cipher.load() != endpoint->cipher.load())) {
+        flush();
+    }
+    if (dests.empty()) {
+        packet.assign(data, data + size);
+    }
+    dests.push_back(endpoint);
+    return true;
+}
 
-    //mAooSink.reset(aoo::isink::create(1));
+void ForwardBatch::flush()
+{
+    if (dests.empty()) return;
 
-    mAooDummySource.reset(aoo::isource::create(0));
+    // the sends below must not end up here again
+    auto * saved = currentForwardBatch;
+    currentForwardBatch = nullptr;
 
+    // sealed once for all of them, they share the key
+    char sealed[AOO_MAXPACKETSIZE + SonoAudio::PacketCipher::Overhead];
+    const char * data = packet.data();
+    int32_t size = (int32_t) packet.size();
+    if (auto * cipher = dests.front()->cipher.load()) {
+        size = cipher->seal(data, size, sealed);
+        data = sealed;
+    }
+    bool forwarded = false;
 
+    auto isListener = [] (SonobusAudioProcessor::EndpointState * ep) { return ep->lanMulticastListener.load(); };
 
-    
-    //mAooSink->set_buffersize(mBufferTime.get()); // ms
-    //mAooSource->set_buffersize(mBufferTime.get()); // ms
-    
-    //mAooSink->set_packetsize(1024);
-    //mAooSource->set_packetsize(1024);
-    
+    if (multicast && std::count_if(dests.begin(), dests.end(), isListener) > 1
+        && endpoint_send_packet(multicast, data, size, nullptr) > 0) {
+        // everybody on the LAN got it with that one, still count it as traffic for each
+        for (auto * ep : dests) {
+            if (isListener(ep)) {
+                ep->sentBytes += size + UDP_OVERHEAD_BYTES;
+            }
+        }
+        dests.erase(std::remove_if(dests.begin(), dests.end(), isListener), dests.end());
+        forwarded = dests.empty();
+    }
 
-    
-    mUdpSocket = std::make_unique<DatagramSocket>();
-    mUdpSocket->setSendBufferSize(1048576);
-    mUdpSocket->setReceiveBufferSize(1048576);
+    auto isServerPeer = [] (SonobusAudioProcessor::EndpointState * ep) { return ep->serverPeer.load(); };
 
-    /*
-    int tos_local = 0x38; // QOS realtime DSCP
-    int opterr = setsockopt(mUdpSocket->getRawSocketHandle(), IPPROTO_IP, IP_TOS,  &tos_local, sizeof(tos_local));
-    if (opterr != 0) {
-        DBG("Error setting QOS on socket: " << opterr);
-    }
-     */
+    if (dests.size() > 1 && client && server && std::all_of(dests.begin(), dests.end(), isServerPeer)) {
+        auto sameEndpoints = [this] () {
+            for (size_t i = 0; i < dests.size(); ++i) {
+                if (dests[i]->serial != routeSerials[i]) return false;
+            }
+            return true;
+        };
 
-    if (udpport > 0) {
-        int attempts = 100;
-        while (attempts > 0) {
-            if (mUdpSocket->bindToPort(udpport)) {
-                udpport = mUdpSocket->getBoundPort();
-                DBG("Bound udp port to " << udpport);
-                break;
+        if (dests != routePeers || !sameEndpoints()) {
+            // (re)register the route, until the server accepts it we send directly
+            std::vector<const void*> addrs;
+            addrs.reserve(dests.size());
+            for (auto * ep : dests) {
+                addrs.push_back(ep->getRawAddr());
+            }
+            client->set_forward_route(route, addrs.data(), (int32_t) addrs.size());
+            routePeers = dests;
+            routeSerials.clear();
+            for (auto * ep : dests) {
+                routeSerials.push_back(ep->serial);
             }
-            ++udpport;
-            --attempts;
         }
-
-        if (attempts <= 0) {
-            DBG("COULD NOT BIND TO PORT!");
-            udpport = 0;
+        else if (client->forward_route_state(route) > 0) {
+            char buf[AOO_MAXPACKETSIZE + AOONET_FORWARD_HEADER_SIZE + SonoAudio::PacketCipher::Overhead];
+            if (aoonet_write_forward_header(buf, route, size) > 0) {
+                memcpy(buf + AOONET_FORWARD_HEADER_SIZE, data, (size_t) size);
+                if (endpoint_send_packet(server, buf, size + AOONET_FORWARD_HEADER_SIZE, nullptr) > 0) {
+                    forwarded = true;
+                    // still count it as traffic for each peer
+                    for (auto * ep : dests) {
+                        ep->sentBytes += size + UDP_OVERHEAD_BYTES;
+                    }
+                }
+            }
         }
     }
-    else {
-        // system assigned
-        if (!mUdpSocket->bindToPort(0)) {
-            DBG("Error binding to any udp port!");
-        }
-        else {
-            udpport = mUdpSocket->getBoundPort();
-            DBG("Bound system chosen udp port to " << udpport);
+
+    if (!forwarded) {
+        for (auto * ep : dests) {
+            endpoint_send_packet(ep, data, size, nullptr);
         }
     }
-    
-    
-    mUdpLocalPort = udpport;
 
-    //mLocalIPAddress = IPAddress::getLocalAddress();
+    dests.clear();
+    currentForwardBatch = saved;
+}
 
-#if JUCE_IOS    
-    auto addresses = IPAddress::getAllInterfaceAddresses (false);
-    for (auto& a : addresses) {
-        // look for local wifi interface address first
-        if (a.first != IPAddress::local(false) && ( a.second == "en0" || a.second == "en1")) {
-            mLocalIPAddress = a.first;
-            break;
-        }        
-    }
-    if (mLocalIPAddress.isNull()) {
-        // now accept anything
-        for (auto& a : addresses) {
-            // look for local wifi interface address first
-            if (a.first != IPAddress::local(false)) {
-                mLocalIPAddress = a.first;
-                break;
-            }
-        }        
-    }
-#else
-    auto addresses = IPAddress::getAllAddresses (false);
-    for (auto& a : addresses) {
-        if (a != IPAddress::local(false)) {
-            mLocalIPAddress = a;
-            break;
-        }
-    }
-#endif
-    
-    mServerEndpoint = std::make_unique<EndpointState>();
-    mServerEndpoint->owner = mUdpSocket.get();
-    
-    if (mUdpLocalPort > 0) {
-        mAooClient.reset(aoo::net::iclient::create(mServerEndpoint.get(), client_send, mUdpLocalPort));
-    }
+static int32_t client_send(void *e, const char *data, int32_t size, void *raddr)
+{
+    SonobusAudioProcessor::EndpointState * endpoint = static_cast<SonobusAudioProcessor::EndpointState*>(e);
+    int result = -1;
 
-    
-    mSendThread = std::make_unique<SendThread>(*this);
-    mSendThread->setPriority(9);
-    mRecvThread = std::make_unique<RecvThread>(*this);
-    mRecvThread->setPriority(9);
-    mEventThread = std::make_unique<EventThread>(*this);
+    struct sockaddr_storage addr;
+    auto addrlen = toSocketAddress((const struct sockaddr *)raddr, endpoint->owner->isDualStack(), addr);
 
-    if (mAooClient) {
-        mClientThread = std::make_unique<ClientThread>(*this);
+    if (addrlen > 0){
+        result = (int) ::sendto(endpoint->owner->getRawSocketHandle(), data, (size_t)size, 0, (const struct sockaddr *)&addr, addrlen);
     }
     
-    mSendThread->startThread();
-    mRecvThread->startThread();
-    mEventThread->startThread();
-
-    if (mAooClient) {
-        mClientThread->startThread();
+    if (result > 0) {
+        endpoint->sentBytes += result + UDP_OVERHEAD_BYTES;
     }
     
+    return result;
 }
 
-void SonobusAudioProcessor::cleanupAoo()
+
+
+// fixed pool of send workers for doSendData(). Peers are sharded by index and the
+// send thread itself takes shard 0, so within a round every peer is serviced by
+// exactly one thread and its packets keep their order. A round only finishes when
+// all workers are done (and have flushed their own send batch).
+class SonobusAudioProcessor::PeerSendPool
 {
-    disconnectFromServer();
-    
-    DBG("waiting on recv thread to die");
-    mRecvThread->stopThread(400);
-    DBG("waiting on send thread to die");
-    mSendThread->stopThread(400);
-    DBG("waiting on event thread to die");
-    mEventThread->stopThread(400);
+public:
+    PeerSendPool(SonobusAudioProcessor & processor, int numWorkers) : _processor(processor)
+    {
+        for (int i=0; i < numWorkers; ++i) {
+            auto * worker = _workers.add(new Worker(*this, i + 1));
+            worker->startThread(9);
+        }
+    }
 
-    if (mAooClient) {
-        mAooClient->disconnect();
-        mAooClient->quit();
-        mClientThread->stopThread(400);        
+    ~PeerSendPool()
+    {
+        for (auto * worker : _workers) {
+            worker->signalThreadShouldExit();
+            worker->wakeup.signal();
+        }
+        for (auto * worker : _workers) {
+            worker->stopThread(400);
+        }
     }
 
-    
+    int getNumShards() const { return _workers.size() + 1; }
+
+    // called from the send thread with the core lock held, returns once all peers are serviced
+    int32_t send(RemotePeer * const * peers, int count)
     {
-        const ScopedWriteLock sl (mCoreLock);        
+        _peers = peers;
+        _count = count;
+        _didsomething.store(0, std::memory_order_relaxed);
+        _pending.store(_workers.size(), std::memory_order_release);
 
-        mAooClient.reset();
+        for (auto * worker : _workers) {
+            worker->wakeup.signal();
+        }
 
-        mUdpSocket.reset();
-        
-        mAooDummySource.reset();
-        
-        mRemotePeers.clear();
-        
-        mEndpoints.clear();
-    }
+        int32_t didsomething = _processor.sendRemotePeers(peers, count, 0, getNumShards());
 
-    stopAooServer();    
-}
+        while (_pending.load(std::memory_order_acquire) > 0) {
+            _finished.wait(1);
+        }
 
-void SonobusAudioProcessor::startAooServer()
-{
-    stopAooServer();
-    
+        return didsomething | _didsomething.load(std::memory_order_relaxed);
+    }
+
+private:
+    void runShard(int shard)
     {
-        const ScopedWriteLock sl (mCoreLock);
-        int32_t err;
-        mAooServer.reset(aoo::net::iserver::create(10999, &err));
-        
-        if (err != 0) {
-            DBG("Error creating Aoo Server: " << err);
+        const int32_t did = _processor.sendRemotePeers(_peers, _count, shard, getNumShards());
+        if (did) {
+            _didsomething.store(1, std::memory_order_relaxed);
         }
-    }
-    
-    if (mAooServer) {
-        mServerThread = std::make_unique<ServerThread>(*this);    
-        mServerThread->startThread();
-    }
-}
-    
-void SonobusAudioProcessor::stopAooServer()
-{
-    if (mAooServer) {
-        DBG("waiting on recv thread to die");
-        mAooServer->quit();
-        mServerThread->stopThread(400);    
 
-        const ScopedWriteLock sl (mCoreLock);
-        mAooServer.reset();
+        if (_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            _finished.signal();
+        }
     }
-}
 
-bool SonobusAudioProcessor::setCurrentUsername(const String & name)
-{
-    if (mIsConnectedToServer) return false;
+    class Worker : public juce::Thread
+    {
+    public:
+        Worker(PeerSendPool & pool, int shard) : Thread("SonoBusPeerSend" + String(shard)), _pool(pool), _shard(shard)
+        {}
 
-    mCurrentUsername = name;
-    return true;
-}
+        void run() override {
+            int configserial = -1;
 
+            while (!threadShouldExit()) {
+                _pool._processor.applyNetworkThreadConfig(configserial);
 
-bool SonobusAudioProcessor::connectToServer(const String & host, int port, const String & username, const String & passwd)
-{
-    if (!mAooClient) return false;
-    
-    // disconnect from everything else!
-    removeAllRemotePeers();
-    
-    mServerEndpoint->ipaddr = host;
-    mServerEndpoint->port = port;
-    mServerEndpoint->peer.reset();
+                // signalled for every send round, and to exit
+                wakeup.wait();
+                if (threadShouldExit()) break;
 
-    mCurrentUsername = username;
+                TraceRecorder::Scope trace ("sendPeers");
+#if SEND_BATCHING_ENABLED
+                currentSendBatch = &_batch;
+                _pool.runShard(_shard);
+                currentSendBatch = nullptr;
 
-    int32_t retval = mAooClient->connect(host.toRawUTF8(), port, username.toRawUTF8(), passwd.toRawUTF8());
-    
-    if (retval < 0) {
-        DBG("Error connecting to server: " << retval);
-    }
-    
-    return retval >= 0;
-}
+                _batch.flush(_pool._processor.getSendPacingIntervalMs());
+#else
+                _pool.runShard(_shard);
+#endif
+            }
+        }
 
-bool SonobusAudioProcessor::isConnectedToServer() const
-{
-    if (!mAooClient) return false;
+        WaitableEvent wakeup;
+        PeerSendPool & _pool;
+        const int _shard;
+#if SEND_BATCHING_ENABLED
+        UdpSendBatch _batch;
+#endif
+    };
 
-    return mIsConnectedToServer;    
-}
+    SonobusAudioProcessor & _processor;
+    OwnedArray<Worker> _workers;
 
-bool SonobusAudioProcessor::disconnectFromServer()
-{
-    if (!mAooClient) return false;
- 
-    mAooClient->disconnect();
-    
-    // disconnect from everything else!
-    removeAllRemotePeers();
+    std::atomic<int> _pending { 0 };
+    std::atomic<int32_t> _didsomething { 0 };
+    WaitableEvent _finished;
+    RemotePeer * const * _peers = nullptr;
+    int _count = 0;
+};
+
+#if JUCE_WINDOWS
+using SocketPollFd = WSAPOLLFD;
+static int pollSockets(SocketPollFd * fds, size_t count, int timeoutMs) { return WSAPoll(fds, (ULONG) count, timeoutMs); }
+#else
+using SocketPollFd = struct pollfd;
+static int pollSockets(SocketPollFd * fds, size_t count, int timeoutMs) { return ::poll(fds, (nfds_t) count, timeoutMs); }
+#endif
 
+// One set of network threads for every processor in the process. A DAW session
+// with several instances would otherwise run a send, a receive and an event thread
+// for each of them, all waking up on their own timers. The instances keep their
+// own sockets and aoo client: peers and the connection server know each of them by
+// its own address, and aoo ids are only unique within an instance. So the receive
+// thread polls all the registered sockets at once and hands each one's packets to
+// the instance that owns it. Every processor holds it through a SharedResourcePointer,
+// it lives as long as any of them does.
+//
+// The network thread settings (realtime, affinity) of the first registered
+// instance are the ones applied to the shared threads.
+class SonobusAudioProcessor::NetworkEngine
+{
+public:
+    NetworkEngine()
     {
-        const ScopedLock sl (mClientLock);
+#if URING_ENABLED
+        recvWakeFd = ::eventfd(0, EFD_CLOEXEC);
+        inlineBatch.ringChecked = true;
+#endif
+        sendThread.startThread(9);
+        recvThread.startThread(9);
+        eventThread.startThread();
+    }
 
-        mIsConnectedToServer = false;
-        mSessionConnectionStamp = 0.0;
+    ~NetworkEngine()
+    {
+        sendThread.signalThreadShouldExit();
+        sendWaitable.signal();
+        recvThread.signalThreadShouldExit();
+        wakeRecvThread();
+        eventThread.signalThreadShouldExit();
+        eventWaitable.signal();
+
+        recvThread.stopThread(400);
+        sendThread.stopThread(400);
+        eventThread.stopThread(400);
+
+#if URING_ENABLED
+        if (recvWakeFd >= 0) {
+            ::close(recvWakeFd);
+        }
+#endif
+    }
 
-        mCurrentJoinedGroup.clear();
+    void addProcessor(SonobusAudioProcessor & processor)
+    {
+        {
+            const ScopedLock sl (sendLock);
+            sendClients.addIfNotAlreadyThere(&processor);
+        }
+        {
+            const ScopedLock sl (eventLock);
+            eventClients.addIfNotAlreadyThere(&processor);
+        }
+        signalSend();
+        signalEvent();
     }
 
+    // once this returns none of the threads is in the processor, nor gets into it again
+    void removeProcessor(SonobusAudioProcessor & processor)
     {
-        const ScopedLock sl (mPublicGroupsLock);
+        int serial;
+        {
+            const ScopedLock sl (recvLock);
+            for (int i = recvSockets.size(); --i >= 0; ) {
+                if (recvSockets.getUnchecked(i)->processor == &processor) {
+                    recvSockets.remove(i);
+                }
+            }
+            serial = ++recvSocketsSerial;
+        }
+        waitForRecvRelease(serial);
+        {
+            const ScopedLock sl (sendLock);
+            sendClients.removeFirstMatchingValue(&processor);
+#if SEND_BATCHING_ENABLED
+            // what its audio callback left over still points at its endpoints
+            inlineBatch.flush();
+#endif
+        }
+        {
+            const ScopedLock sl (eventLock);
+            eventClients.removeFirstMatchingValue(&processor);
+        }
+    }
 
-        mPublicGroupInfos.clear();
+    void addSocket(SonobusAudioProcessor & processor, DatagramSocket & socket, bool lanMulticast = false)
+    {
+        const ScopedLock sl (recvLock);
+        recvSockets.add(new RecvSocket(processor, socket, lanMulticast));
+        ++recvSocketsSerial;
+        wakeRecvThread();
     }
 
+    // the socket isn't read from anymore once this returns, it can be deleted
+    void removeSocket(DatagramSocket & socket)
+    {
+        int serial;
+        {
+            const ScopedLock sl (recvLock);
+            for (int i = recvSockets.size(); --i >= 0; ) {
+                if (&recvSockets.getUnchecked(i)->socket == &socket) {
+                    recvSockets.remove(i);
+                }
+            }
+            serial = ++recvSocketsSerial;
+        }
+        waitForRecvRelease(serial);
+    }
 
+    void signalSend() { sendWaitable.signal(); }
 
-    return true;
-}
+    // runs the audio callback's sending, see SonobusAudioProcessor::sendInline(),
+    // unless the send thread (or anything else) has the send lock. It doesn't wait
+    template <typename Callback>
+    bool trySendInline(SonobusAudioProcessor & processor, Callback && callback)
+    {
+        const ScopedTryLock sl (sendLock);
+        if (!sl.isLocked() || !sendClients.contains(&processor)) return false;
 
-void SonobusAudioProcessor::addRecentServerConnectionInfo(const AooServerConnectionInfo & cinfo)
-{
-    const ScopedLock sl (mRecentsLock);
+#if SEND_BATCHING_ENABLED
+        currentSendBatch = &inlineBatch;
+        inlineBatch.nonBlocking = true;
+#endif
+        currentlySendingInline = true;
 
-    // look for existing match, and update only timestamp if found, otherwise add to end
-    int index = mRecentConnectionInfos.indexOf(cinfo);
-    if (index >= 0) {
-        // already there
-        mRecentConnectionInfos.getReference(index).timestamp = cinfo.timestamp;
-    } else {
-        // add it
-        mRecentConnectionInfos.add(cinfo);
-    }
-    // resort
-    mRecentConnectionInfos.sort();
-    
-    // limit to 10
-    if (mRecentConnectionInfos.size() > 10) {
-        mRecentConnectionInfos.removeRange(10, mRecentConnectionInfos.size() - 10);
+        callback();
+
+        currentlySendingInline = false;
+#if SEND_BATCHING_ENABLED
+        inlineBatch.flush();
+        inlineBatch.nonBlocking = false;
+        currentSendBatch = nullptr;
+#endif
+        return true;
     }
-}
 
-int SonobusAudioProcessor::getRecentServerConnectionInfos(Array<AooServerConnectionInfo> & retarray)
-{
-    const ScopedLock sl (mRecentsLock);
-    retarray = mRecentConnectionInfos;
-    return retarray.size();
-}
+    NetworkThreadWakeups getWakeups() const
+    {
+        NetworkThreadWakeups wakeups;
+        wakeups.send = sendWakeups.load(std::memory_order_relaxed);
+        wakeups.recv = recvWakeups.load(std::memory_order_relaxed);
+        wakeups.event = eventWakeups.load(std::memory_order_relaxed);
+        return wakeups;
+    }
 
-void SonobusAudioProcessor::clearRecentServerConnectionInfos()
-{
-    const ScopedLock sl (mRecentsLock);
-    mRecentConnectionInfos.clear();
-}
+    void signalEvent()
+    {
+        // may be called from the audio thread, only signal once per wakeup
+        if (!eventSignalled.exchange(true)) {
+            eventWaitable.signal();
+        }
+    }
 
-void SonobusAudioProcessor::removeRecentServerConnectionInfo(int index)
-{
-    const ScopedLock sl (mRecentsLock);
-    if (index < mRecentConnectionInfos.size()) {
-        mRecentConnectionInfos.remove(index);
+private:
+    void wakeRecvThread()
+    {
+        recvWaitable.signal();
+#if URING_ENABLED
+        if (recvWakeFd >= 0) {
+            const uint64_t one = 1;
+            ignoreUnused (::write(recvWakeFd, &one, sizeof(one)));
+        }
+#endif
     }
-}
 
-int SonobusAudioProcessor::getPublicGroupInfos(Array<AooPublicGroupInfo> & retarray)
-{
-    retarray.clearQuick();
+    // the receive ring holds on to the sockets it was armed with until it has
+    // cancelled them, which keeps their ports bound. Waits for that to happen
+    void waitForRecvRelease(int serial)
+    {
+#if URING_ENABLED
+        if (!recvUringActive.load() || Thread::getCurrentThread() == &recvThread) return;
+
+        wakeRecvThread();
+        const auto deadline = Time::getMillisecondCounter() + RECV_URING_RELEASE_WAIT_MS;
+        while (recvReleasedSerial.load() < serial && recvUringActive.load()
+               && Time::getMillisecondCounter() < deadline) {
+            recvReleased.wait(10);
+        }
+#else
+        ignoreUnused(serial);
+#endif
+    }
 
-    const ScopedLock sl (mPublicGroupsLock);
-    for (auto & item : mPublicGroupInfos) {
-        retarray.add(item.second);
+    // every one of them is power saving and has nothing streaming
+    template <typename Clients, typename GetProcessor>
+    static bool canSleepLonger(const Clients & clients, GetProcessor getProcessor)
+    {
+        if (clients.isEmpty()) return false;
+        for (auto * client : clients) {
+            auto * processor = getProcessor(client);
+            if (!processor->getPowerSaving() || !processor->isNetworkIdle()) return false;
+        }
+        return true;
     }
-    return retarray.size();
-}
 
+    static SonobusAudioProcessor * asProcessor(SonobusAudioProcessor * processor) { return processor; }
 
+    static void applyThreadConfig(SonobusAudioProcessor * first, SonobusAudioProcessor *& appliedFrom, int & appliedSerial, bool receiveThread = false)
+    {
+        if (first != appliedFrom) {
+            appliedFrom = first;
+            appliedSerial = -1;
+        }
+        if (first) {
+            first->applyNetworkThreadConfig(appliedSerial, receiveThread);
+        }
+    }
 
-void SonobusAudioProcessor::setAutoconnectToGroupPeers(bool flag)
-{
-    mAutoconnectGroupPeers = flag;
-}
+    struct RecvSocket
+    {
+        RecvSocket(SonobusAudioProcessor & processor_, DatagramSocket & socket_, bool lanMulticast_)
+        : processor(&processor_), socket(socket_), lanMulticast(lanMulticast_) {}
 
+        SonobusAudioProcessor * processor;
+        DatagramSocket & socket;
+        bool lanMulticast;
+        ReceiveBatch batch;
+    };
 
-bool SonobusAudioProcessor::setWatchPublicGroups(bool flag)
-{
-    if (!mAooClient) return false;
+    class SendThread : public juce::Thread
+    {
+    public:
+        SendThread(NetworkEngine & engine) : Thread("SonoBusSendThread"), _engine(engine)
+        {}
 
-    mWatchPublicGroups = flag;
+        void run() override {
 
-    int32_t retval = mAooClient->group_watch_public(flag);
+            bool shouldwait = false;
+            bool sleeplonger = false;
+            int configserial = -1;
+            SonobusAudioProcessor * configfrom = nullptr;
 
-    const ScopedLock sl (mPublicGroupsLock);
+            while (!threadShouldExit()) {
 
-    mPublicGroupInfos.clear();
+                // don't overcall it, but make sure it runs consistently
+                // if we are notified to send, the wait will return sooner than the timeout.
+                // The audio notifies it every block, so the longer one only applies while
+                // idle, when it bunches the pings and keepalives into fewer wakeups
 
+                if (shouldwait) {
+                    _engine.sendWaitable.wait(sleeplonger ? POWER_SAVING_SEND_WAIT_MS : 50);
+                }
+                _engine.sendWakeups.fetch_add(1, std::memory_order_relaxed);
 
-    if (retval < 0) {
-        DBG("Error watching public groups: " << retval);
-    }
+                bool morepending = false;
 
-    return retval >= 0;
+                TraceRecorder::Scope trace ("send");
+                const ScopedLock sl (_engine.sendLock);
+                applyThreadConfig(_engine.sendClients.getFirst(), configfrom, configserial);
 
-}
+#if SEND_BATCHING_ENABLED
+                // what the audio callbacks couldn't send without waiting
+                _engine.inlineBatch.flush();
+#endif
 
+                for (int i=0; i < _engine.sendClients.size(); ++i) {
+                    auto * processor = _engine.sendClients.getUnchecked(i);
+                    auto sentinel = processor->mNeedSendSentinel.get();
 
-bool SonobusAudioProcessor::joinServerGroup(const String & group, const String & groupsecret, bool isPublic)
-{
-    if (!mAooClient) return false;
+#if SEND_BATCHING_ENABLED
+                    currentSendBatch = &_batch;
+                    processor->doSendData();
+                    currentSendBatch = nullptr;
 
-    int32_t retval = mAooClient->group_join(group.toRawUTF8(), groupsecret.toRawUTF8(), isPublic);
-    
-    if (retval < 0) {
-        DBG("Error joining group " << group << " : " << retval);
-    }
-    
-    return retval >= 0;
-}
+                    _batch.flush(processor->getSendPacingIntervalMs());
+#else
+                    processor->doSendData();
+#endif
 
-bool SonobusAudioProcessor::leaveServerGroup(const String & group)
-{
-    if (!mAooClient) return false;
+                    morepending = morepending || sentinel != processor->mNeedSendSentinel.get();
+                }
 
-    int32_t retval = mAooClient->group_leave(group.toRawUTF8());
-    
-    if (retval < 0) {
-        DBG("Error leaving group " << group << " : " << retval);
-    }
+                shouldwait = !morepending;
+                sleeplonger = canSleepLonger(_engine.sendClients, asProcessor);
+            }
+            DBG("Send thread finishing");
+        }
 
-    const ScopedLock sl (mClientLock);        
-    
-    if (mCurrentJoinedGroup == group) {
-        mCurrentJoinedGroup.clear();
-    }
-    
-    return retval >= 0;
-}
+        NetworkEngine & _engine;
+#if SEND_BATCHING_ENABLED
+        UdpSendBatch _batch;
+#endif
+    };
 
-String SonobusAudioProcessor::getCurrentJoinedGroup() const { 
-    const ScopedLock sl (mClientLock);        
-    return mCurrentJoinedGroup;     
-}
+    class RecvThread : public juce::Thread
+    {
+    public:
+        RecvThread(NetworkEngine & engine) : Thread("SonoBusRecvThread"), _engine(engine)
+        {}
+
+        void run() override {
+            int configserial = -1;
+            SonobusAudioProcessor * configfrom = nullptr;
+            bool uringusable = URING_ENABLED;
+
+            while (!threadShouldExit()) {
+#if URING_ENABLED
+                // the ring only blocks, spinning is done on the sockets themselves
+                if (uringusable && getPollMode() == SonobusAudioProcessor::ReceivePollBlocking) {
+                    if (!runUring(configserial, configfrom)) {
+                        DBG("io_uring unavailable, receiving with poll");
+                        uringusable = false;
+                    }
+                    continue;
+                }
+#endif
+                runPolling(configserial, configfrom, uringusable);
+            }
 
-void SonobusAudioProcessor::AudioCodecFormatInfo::computeName()
-{
-    if (codec == SonobusAudioProcessor::CodecOpus) {
-        name = String::formatted("%d kbps/ch", bitrate/1000);
-    }
-    else {
-        if (bitdepth == 2) {
-            name = "PCM 16 bit";
+            DBG("Recv thread finishing");
         }
-        else if (bitdepth == 3) {
-            name = "PCM 24 bit";
+
+    private:
+        // of the first processor, like the thread config. call with the recvLock held
+        SonobusAudioProcessor::ReceivePollMode getPollModeLocked() const
+        {
+            return _engine.recvSockets.isEmpty() ? SonobusAudioProcessor::ReceivePollBlocking
+                                                 : _engine.recvSockets.getFirst()->processor->getReceivePollMode();
         }
-        else if (bitdepth == 4) {
-            name = "PCM 32 bit float";
+
+        SonobusAudioProcessor::ReceivePollMode getPollMode() const
+        {
+            const ScopedLock sl (_engine.recvLock);
+            return getPollModeLocked();
         }
-        else if (bitdepth == 8) {
-            name = "PCM 64 bit float";
+
+        static void setBusyPoll(const std::vector<SocketPollFd> & fds, bool enable)
+        {
+#if JUCE_LINUX && defined(SO_BUSY_POLL)
+            // the driver's queue is polled right from the receive calls, raising it
+            // above net.core.busy_read needs CAP_NET_ADMIN, it's only a bonus anyway
+            const int usecs = enable ? RECV_BUSY_POLL_US : 0;
+            for (auto & pfd : fds) {
+                if (::setsockopt(pfd.fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) != 0 && enable) {
+                    DBG("Could not set SO_BUSY_POLL: " << errno);
+                }
+            }
+#else
+            ignoreUnused(fds, enable);
+#endif
         }
-    }
-}
 
-void SonobusAudioProcessor::initFormats()
-{
-    mAudioFormats.clear();
-    
-    // low bandwidth to high
-    //mAudioFormats.add(AudioCodecFormatInfo(8000, 10, OPUS_SIGNAL_MUSIC, 960));
-    mAudioFormats.add(AudioCodecFormatInfo(16000, 10, OPUS_SIGNAL_MUSIC, 960));
-    mAudioFormats.add(AudioCodecFormatInfo(24000, 10, OPUS_SIGNAL_MUSIC, 480));
-    mAudioFormats.add(AudioCodecFormatInfo(48000, 10, OPUS_SIGNAL_MUSIC, 240));
-    mAudioFormats.add(AudioCodecFormatInfo(64000, 10, OPUS_SIGNAL_MUSIC, 240));
-    mAudioFormats.add(AudioCodecFormatInfo(96000, 10, OPUS_SIGNAL_MUSIC, 120));
-    mAudioFormats.add(AudioCodecFormatInfo(128000, 10, OPUS_SIGNAL_MUSIC, 120));
-    mAudioFormats.add(AudioCodecFormatInfo(160000, 10, OPUS_SIGNAL_MUSIC, 120));
-    mAudioFormats.add(AudioCodecFormatInfo(256000, 10, OPUS_SIGNAL_MUSIC, 120));
-    
-    mAudioFormats.add(AudioCodecFormatInfo(2));
-    mAudioFormats.add(AudioCodecFormatInfo(3));
-    mAudioFormats.add(AudioCodecFormatInfo(4));
-    //mAudioFormats.add(AudioCodecFormatInfo(CodecPCM, 8)); // insanity!
+        // poll() on all the sockets, or spinning on them with a zero timeout while the
+        // poll mode says so. returns when the thread should exit, or to go back to the
+        // ring if 'leaveForBlocking' and the poll mode changes to blocking
+        void runPolling(int & configserial, SonobusAudioProcessor *& configfrom, bool leaveForBlocking)
+        {
+            std::vector<SocketPollFd> fds;
+            int fdsserial = -1;
+            int polltimeout = 20;
+            auto mode = SonobusAudioProcessor::ReceivePollBlocking;
+            bool busypolling = false;
+            double spinuntil = 0.0;
+
+            while (!threadShouldExit()) {
+                {
+                    const ScopedLock sl (_engine.recvLock);
+                    mode = getPollModeLocked();
+                    if (leaveForBlocking && mode == SonobusAudioProcessor::ReceivePollBlocking) break;
+
+                    if (fdsserial != _engine.recvSocketsSerial) {
+                        fds.clear();
+                        for (auto * entry : _engine.recvSockets) {
+                            SocketPollFd pfd = {};
+                            pfd.fd = (decltype(pfd.fd)) entry->socket.getRawSocketHandle();
+                            pfd.events = POLLIN;
+                            fds.push_back(pfd);
+                        }
+                        fdsserial = _engine.recvSocketsSerial;
+                        busypolling = false;
+                    }
+                    if (busypolling != (mode != SonobusAudioProcessor::ReceivePollBlocking)) {
+                        busypolling = !busypolling;
+                        setBusyPoll(fds, busypolling);
+                    }
+                    applyThreadConfig(_engine.recvSockets.isEmpty() ? nullptr : _engine.recvSockets.getFirst()->processor, configfrom, configserial, true);
 
-    mDefaultAudioFormatIndex = 4; // 96kpbs/ch Opus
-}
+                    // the timeout is only for noticing sockets that were added, and exiting
+                    polltimeout = canSleepLonger(_engine.recvSockets, [] (RecvSocket * entry) { return entry->processor; }) ? POWER_SAVING_RECV_POLL_MS : 20;
+                }
 
-int SonobusAudioProcessor::findFormatIndex(SonobusAudioProcessor::AudioCodecFormatCodec codec, int bitrate, int bitdepth)
-{
-    for (int i=0; i < mAudioFormats.size(); ++i) {
-        const auto & format = mAudioFormats.getReference(i);
-        if (format.codec == codec) {
-            if (format.codec == CodecOpus) {
-                if (format.bitrate == bitrate) {
-                    return i;
+                if (fds.empty()) {
+                    // until a socket is added
+                    _engine.recvWaitable.wait();
+                    continue;
+                }
+
+                const bool spinning = mode == SonobusAudioProcessor::ReceivePollBusy
+                    || (mode == SonobusAudioProcessor::ReceivePollHybrid && Time::getMillisecondCounterHiRes() < spinuntil);
+
+                const int polled = pollSockets(fds.data(), fds.size(), spinning ? 0 : polltimeout);
+                if (!spinning || polled > 0) {
+                    _engine.recvWakeups.fetch_add(1, std::memory_order_relaxed);
+                }
+                if (polled <= 0) continue;
+
+                bool received = false;
+                {
+                    TraceRecorder::Scope trace ("receive");
+                    const ScopedLock sl (_engine.recvLock);
+                    // what was polled may have gone away in the meantime, poll again
+                    if (fdsserial != _engine.recvSocketsSerial) continue;
+
+                    for (size_t i=0; i < fds.size(); ++i) {
+                        if ((fds[i].revents & POLLIN) == 0) continue;
+                        auto * entry = _engine.recvSockets.getUnchecked((int) i);
+                        entry->processor->doReceiveData(entry->batch, entry->socket, entry->lanMulticast);
+                        received = true;
+                    }
+                }
+
+                if (received) {
+                    spinuntil = Time::getMillisecondCounterHiRes() + RECV_HYBRID_SPIN_MS;
+                }
+                else {
+                    // only errors were reported, don't spin on them
+                    Thread::sleep(1);
                 }
             }
-            else if (bitdepth == format.bitdepth){
-                return i;
+
+            if (busypolling) {
+                const ScopedLock sl (_engine.recvLock);
+                if (fdsserial == _engine.recvSocketsSerial) {
+                    setBusyPoll(fds, false);
+                }
             }
         }
-    }
-    
-    return -1;
-}
 
+#if URING_ENABLED
+        // a multishot receive per socket, picking from the provided buffers of
+        // one ring, so a wakeup doesn't cost a syscall per socket and datagram.
+        // false if the kernel (or a seccomp filter) doesn't allow it, which is
+        // found out before anything was received
+        bool runUring(int & configserial, SonobusAudioProcessor *& configfrom)
+        {
+            const auto buffersize = (unsigned) (sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_storage)
+                                                + RECV_CONTROL_SIZE + sizeof(ReceiveBatch::Packet::data));
 
-String SonobusAudioProcessor::getAudioCodeFormatName(int formatIndex) const
-{
-    if (formatIndex >= mAudioFormats.size() || formatIndex < 0) return "";
-    
-    const AudioCodecFormatInfo & info = mAudioFormats.getReference(formatIndex);
-    return info.name;    
-}
-
-bool SonobusAudioProcessor::getAudioCodeFormatInfo(int formatIndex, AudioCodecFormatInfo & retinfo) const
-{
-    if (formatIndex >= mAudioFormats.size() || formatIndex < 0) return false;
-    retinfo = mAudioFormats.getReference(formatIndex);
-    return true;    
-}
+            aoo::uring ring;
+            if (_engine.recvWakeFd < 0 || !ring.init(RECV_URING_ENTRIES, RECV_URING_BUFFERS * 2)
+                || !ring.setup_buffers(0, RECV_URING_BUFFERS, buffersize)) {
+                return false;
+            }
 
+            const uint64_t wakeTag = ~(uint64_t) 0;
+            const uint64_t cancelTag = wakeTag - 1;
+
+            // what the receives of each socket were armed with, the kernel keeps to the sizes
+            std::vector<struct msghdr> templates;
+            std::vector<int> pending;
+            uint32_t generation = 0;
+            int armedserial = -1;
+            int outstanding = 0;
+            bool cancelling = false;
+            bool wakearmed = false;
+            bool received = false;
+            bool failed = false;
+            uint64_t wakevalue = 0;
+
+            auto getSqe = [&] () {
+                auto * sqe = ring.get_sqe();
+                if (!sqe) {
+                    ring.submit();
+                    sqe = ring.get_sqe();
+                }
+                return sqe;
+            };
+
+            auto arm = [&] (int index) {
+                if (auto * sqe = getSqe()) {
+                    const int fd = _engine.recvSockets.getUnchecked(index)->socket.getRawSocketHandle();
+                    ring.prep_recvmsg_multishot(sqe, fd, &templates[(size_t) index], 0, ((uint64_t) generation << 32) | (uint32_t) index);
+                    ++outstanding;
+                }
+            };
+
+            auto take = [&] (int index, char * buf, int32_t size) {
+                auto * entry = _engine.recvSockets.getUnchecked(index);
+                struct sockaddr * name; socklen_t namelen;
+                char * control; size_t controllen;
+                char * payload; int32_t payloadlen;
+                if (!aoo::uring::parse_recvmsg(buf, size, templates[(size_t) index], name, namelen,
+                                               control, controllen, payload, payloadlen)) {
+                    return;
+                }
 
-void SonobusAudioProcessor::setDefaultAudioCodecFormat(int formatIndex)
-{
-    if (formatIndex < mAudioFormats.size() && formatIndex >= 0) {
-        mDefaultAudioFormatIndex = formatIndex;
-        mDefaultAudioFormatParam->setValueNotifyingHost(mDefaultAudioFormatParam->convertTo0to1(mDefaultAudioFormatIndex));
-    }
-    
-}
+                auto & packet = entry->batch.packets[pending[(size_t) index]];
+                memcpy(packet.data, payload, (size_t) payloadlen);
+                packet.size = payloadlen;
+                zerostruct(packet.addr);
+                memcpy(&packet.addr, name, jmin((size_t) namelen, sizeof(packet.addr)));
+                unmapAddress(packet.addr);
+
+                struct msghdr hdr = {};
+                hdr.msg_control = control;
+                hdr.msg_controllen = controllen;
+                entry->processor->updateReceiveDrops(entry->socket, &hdr);
+
+                if (++pending[(size_t) index] == RECV_BATCH_SIZE) {
+                    entry->processor->handleReceivedPackets(entry->batch, RECV_BATCH_SIZE, entry->lanMulticast);
+                    pending[(size_t) index] = 0;
+                }
+            };
 
+            // completions that leave the socket receives alone, returns true for an unsupported one
+            auto reap = [&] (bool current) {
+                bool unsupported = false;
 
-void SonobusAudioProcessor::setDefaultAutoresizeBufferMode(AutoNetBufferMode flag)
-{
-    defaultAutoNetbufMode = flag;
-    mDefaultAutoNetbufModeParam->setValueNotifyingHost(mDefaultAutoNetbufModeParam->convertTo0to1(defaultAutoNetbufMode));
+                while (auto * cqe = ring.peek()) {
+                    const auto userdata = cqe->user_data;
+                    const int result = cqe->res;
+                    const auto flags = cqe->flags;
+                    ring.seen();
 
-}
+                    if (userdata == wakeTag) {
+                        wakearmed = false;
+                        continue;
+                    }
+                    if (userdata == cancelTag) continue;
+
+                    const int index = (int) (uint32_t) userdata;
+                    if (flags & IORING_CQE_F_BUFFER) {
+                        const auto bufid = flags >> IORING_CQE_BUFFER_SHIFT;
+                        if (current && result > 0) {
+                            take(index, ring.buffer(bufid), result);
+                            received = true;
+                        }
+                        ring.recycle_buffer(bufid);
+                    }
 
+                    if (flags & IORING_CQE_F_MORE) continue;
 
-void SonobusAudioProcessor::setRemotePeerAudioCodecFormat(int index, int formatIndex)
-{
-    if (formatIndex >= mAudioFormats.size() || index >= mRemotePeers.size()) return;
-    
-    const AudioCodecFormatInfo & info = mAudioFormats.getReference(formatIndex);
+                    // this receive is over: cancelled, out of buffers or failed
+                    --outstanding;
+                    if (!received && (result == -EINVAL || result == -EOPNOTSUPP)) {
+                        unsupported = true;
+                    }
+                    else if (current && !cancelling && result != -ECANCELED) {
+                        if (result < 0 && result != -ENOBUFS) {
+                            DBG("io_uring receive error: " << -result);
+                            failed = true;
+                        }
+                        arm(index);
+                    }
+                }
+                return unsupported;
+            };
 
-    const ScopedReadLock sl (mCoreLock);        
- 
-    auto remote = mRemotePeers.getUnchecked(index);
-    remote->formatIndex = formatIndex;
-    
-    if (remote->oursource) {
-        setupSourceFormat(remote, remote->oursource.get());
-        remote->oursource->setup(getSampleRate(), currSamplesPerBlock, remote->sendChannels);
-        //remote->oursource->setup(getSampleRate(), remote->packetsize    , getTotalNumOutputChannels());        
-        
-        setupSourceFormat(remote, remote->latencysource.get(), true);
-        remote->latencysource->setup(getSampleRate(), currSamplesPerBlock, 1);
-        setupSourceFormat(remote, remote->echosource.get(), true);
-        remote->echosource->setup(getSampleRate(), currSamplesPerBlock, 1);
-        
-        remote->latencyDirty = true;
-    }
-}
+            // no request may be left in the kernel, it writes into buffers we own
+            auto drain = [&] () {
+                if (auto * sqe = getSqe()) {
+                    ring.prep_cancel_all(sqe, cancelTag);
+                }
+                cancelling = true;
+                for (int tries = 0; (outstanding > 0 || wakearmed) && tries < 50; ++tries) {
+                    ring.submit(1, 20);
+                    reap(false);
+                }
+                _engine.recvUringActive = false;
+            };
 
-int SonobusAudioProcessor::getRemotePeerAudioCodecFormat(int index) const
-{
-    if (index >= mRemotePeers.size()) return -1;
-    
-    const ScopedReadLock sl (mCoreLock);        
-    auto remote = mRemotePeers.getUnchecked(index);
-    return remote->formatIndex;
-}
+            _engine.recvUringActive = true;
+            int polltimeout = 20;
 
-bool SonobusAudioProcessor::getRemotePeerReceiveAudioCodecFormat(int index, AudioCodecFormatInfo & retinfo) const
-{
-    if (index >= mRemotePeers.size()) return false;
-    
-    const ScopedReadLock sl (mCoreLock);
-    auto remote = mRemotePeers.getUnchecked(index);
-    retinfo = remote->recvFormat;
-    return true;
-}
+            while (!threadShouldExit()) {
+                {
+                    const ScopedLock sl (_engine.recvLock);
+                    // spinning is up to runPolling()
+                    if (getPollModeLocked() != SonobusAudioProcessor::ReceivePollBlocking) break;
+
+                    applyThreadConfig(_engine.recvSockets.isEmpty() ? nullptr : _engine.recvSockets.getFirst()->processor, configfrom, configserial, true);
+
+                    // the timeout is only for exiting, the wake fd is written when the sockets change
+                    polltimeout = canSleepLonger(_engine.recvSockets, [] (RecvSocket * entry) { return entry->processor; }) ? POWER_SAVING_RECV_POLL_MS : 20;
+
+                    if (armedserial != _engine.recvSocketsSerial) {
+                        if (outstanding > 0) {
+                            // the old ones have to be over before the indices mean something else
+                            if (!cancelling) {
+                                if (auto * sqe = getSqe()) {
+                                    ring.prep_cancel_all(sqe, cancelTag);
+                                    cancelling = true;
+                                }
+                            }
+                        }
+                        else {
+                            cancelling = false;
+                            ++generation;
+                            const auto numsockets = (size_t) _engine.recvSockets.size();
+                            templates.assign(numsockets, msghdr());
+                            pending.assign(numsockets, 0);
+                            for (size_t i=0; i < numsockets; ++i) {
+                                templates[i].msg_namelen = sizeof(struct sockaddr_storage);
+                                templates[i].msg_controllen = RECV_CONTROL_SIZE;
+                                arm((int) i);
+                            }
+                            armedserial = _engine.recvSocketsSerial;
+                            _engine.recvReleasedSerial = armedserial;
+                            _engine.recvReleased.signal();
+                        }
+                    }
+                }
 
-bool SonobusAudioProcessor::setRequestRemotePeerSendAudioCodecFormat(int index, int formatIndex)
-{
-    if (formatIndex >= mAudioFormats.size() || index >= mRemotePeers.size()) return false;
-    
+                if (!wakearmed) {
+                    if (auto * sqe = getSqe()) {
+                        ring.prep_read(sqe, _engine.recvWakeFd, &wakevalue, sizeof(wakevalue), wakeTag);
+                        wakearmed = true;
+                    }
+                }
 
-    const ScopedReadLock sl (mCoreLock);
-    auto remote = mRemotePeers.getUnchecked(index);
+                const int result = ring.submit(1, polltimeout);
+                _engine.recvWakeups.fetch_add(1, std::memory_order_relaxed);
+                if (result < 0 && result != -ETIME && result != -EINTR && result != -EAGAIN && result != -EBUSY) {
+                    DBG("io_uring wait failed: " << -result);
+                    Thread::sleep(1);
+                }
+                if (ring.ready() == 0) continue;
 
-    aoo_format_storage fmt;
-    
-    
-    if (formatIndex >= 0) {
-        const AudioCodecFormatInfo & info = mAudioFormats.getReference(formatIndex);
+                bool unsupported;
+                {
+                    TraceRecorder::Scope trace ("receive");
+                    const ScopedLock sl (_engine.recvLock);
+                    // whatever comes in for sockets that have gone away is dropped
+                    const bool current = armedserial == _engine.recvSocketsSerial;
+                    unsupported = reap(current);
+
+                    if (current) {
+                        for (size_t i=0; i < pending.size(); ++i) {
+                            if (pending[i] == 0) continue;
+                            auto * entry = _engine.recvSockets.getUnchecked((int) i);
+                            entry->processor->handleReceivedPackets(entry->batch, pending[i], entry->lanMulticast);
+                            pending[i] = 0;
+                        }
+                    }
+                }
 
-        if (formatInfoToAooFormat(info, remote->recvChannels, fmt)) {
-            remote->oursink->request_source_codec_change(remote->endpoint, remote->remoteSourceId, fmt.header);
+                if (unsupported) {
+                    drain();
+                    return false;
+                }
+                if (failed) {
+                    // don't spin on a socket that keeps failing
+                    failed = false;
+                    Thread::sleep(1);
+                }
+            }
 
-            remote->reqRemoteSendFormatIndex = formatIndex; 
+            drain();
             return true;
         }
-        else {
-            return false;
+#endif
+
+        NetworkEngine & _engine;
+    };
+
+    class EventThread : public juce::Thread
+    {
+    public:
+        EventThread(NetworkEngine & engine) : Thread("SonoBusEventThread"), _engine(engine)
+        {}
+
+        void run() override {
+
+            bool sleeplonger = false;
+
+            while (!threadShouldExit()) {
+
+                // woken up by the aoo objects as events are queued, the timeout
+                // is a backstop, and keeps the peer status published for the UI
+                _engine.eventWaitable.wait(sleeplonger ? POWER_SAVING_EVENT_WAIT_MS : (int) PEER_STATUS_PUBLISH_MS);
+                _engine.eventSignalled = false;
+                _engine.eventWakeups.fetch_add(1, std::memory_order_relaxed);
+
+                const ScopedLock sl (_engine.eventLock);
+                TraceRecorder::Scope trace ("events");
+                for (int i=0; i < _engine.eventClients.size(); ++i) {
+                    auto * processor = _engine.eventClients.getUnchecked(i);
+
+                    processor->handleEvents();
+                    if (processor->mLanMulticastUpdatePending.exchange(false)) {
+                        processor->updateLanMulticast();
+                    }
+                    processor->updateLanDiscovery();
+                    processor->updateDoubleEnder();
+                    processor->updateBackingTrackShare();
+                    processor->updateEnsembleAlignment();
+                    processor->updateSessionStreamRate();
+                    processor->releaseIdleLatencyTestObjects();
+                    processor->collectIdleEndpoints();
+                    processor->refillRemotePeerPool();
+                    processor->updateLoadShedding();
+                    processor->updateCodecBudget();
+                    processor->publishPeerStatus();
+                }
+                sleeplonger = canSleepLonger(_engine.eventClients, asProcessor);
+
+                // then the slow ones, a round at a time, and back to the rest as soon
+                // as there is anything new
+                for (bool more = true; more && !_engine.eventSignalled && !threadShouldExit(); ) {
+                    more = false;
+                    for (int i=0; i < _engine.eventClients.size(); ++i) {
+                        if (_engine.eventClients.getUnchecked(i)->handleDeferredEvent()) {
+                            more = true;
+                        }
+                    }
+                }
+            }
+
+            DBG("Event thread finishing");
         }
-    } else {
-        remote->reqRemoteSendFormatIndex = -1; // no preference
-        return true;
-    }
-}
 
-int SonobusAudioProcessor::getRequestRemotePeerSendAudioCodecFormat(int index) const
-{
-    if (index >= mRemotePeers.size()) return -1;
-    
-    const ScopedReadLock sl (mCoreLock);
-    auto remote = mRemotePeers.getUnchecked(index);
+        NetworkEngine & _engine;
+    };
 
-    return remote->reqRemoteSendFormatIndex;    
-}
+    CriticalSection sendLock;
+    Array<SonobusAudioProcessor*> sendClients;
+    WaitableEvent sendWaitable;
+#if SEND_BATCHING_ENABLED
+    // for the audio callbacks sending themselves, with sendLock held. The
+    // ring isn't used, it's the send thread's
+    UdpSendBatch inlineBatch;
+#endif
 
-int SonobusAudioProcessor::getRemotePeerOrderPriority(int index) const
+    CriticalSection recvLock;
+    OwnedArray<RecvSocket> recvSockets;
+    int recvSocketsSerial = 0;
+    WaitableEvent recvWaitable;
+#if URING_ENABLED
+    // wakes the receive thread out of the ring
+    int recvWakeFd = -1;
+    std::atomic<bool> recvUringActive { false };
+    // the sockets of older serials are all cancelled
+    std::atomic<int> recvReleasedSerial { -1 };
+    WaitableEvent recvReleased;
+#endif
+
+    CriticalSection eventLock;
+    Array<SonobusAudioProcessor*> eventClients;
+    WaitableEvent eventWaitable;
+    std::atomic<bool> eventSignalled { false };
+
+    std::atomic<uint32> sendWakeups { 0 };
+    std::atomic<uint32> recvWakeups { 0 };
+    std::atomic<uint32> eventWakeups { 0 };
+
+    // last, they use all of the above
+    SendThread sendThread { *this };
+    RecvThread recvThread { *this };
+    EventThread eventThread { *this };
+};
+
+void SonobusAudioProcessor::notifySendThread()
 {
-    if (index >= mRemotePeers.size()) return -1;
-    const ScopedReadLock sl (mCoreLock);
-    auto remote = mRemotePeers.getUnchecked(index);
-    return remote->orderPriority;
+    mNeedSendSentinel += 1;
+    mNetworkEngine->signalSend();
 }
 
-void SonobusAudioProcessor::setRemotePeerOrderPriority(int index, int priority)
+void SonobusAudioProcessor::notifyEventThread()
 {
-    if (index >= mRemotePeers.size()) return;
-
-    const ScopedReadLock sl (mCoreLock);
-
-    auto remote = mRemotePeers.getUnchecked(index);
-    remote->orderPriority = priority;
+    mNetworkEngine->signalEvent();
 }
 
+SonobusAudioProcessor::NetworkThreadWakeups SonobusAudioProcessor::getNetworkThreadWakeups() const
+{
+    return mNetworkEngine->getWakeups();
+}
 
-int SonobusAudioProcessor::getRemotePeerSendPacketsize(int index) const
+SonobusAudioProcessor::JitterBufferMemory SonobusAudioProcessor::getJitterBufferMemory()
 {
-    if (index >= mRemotePeers.size()) return -1;
-    const ScopedReadLock sl (mCoreLock);        
-    auto remote = mRemotePeers.getUnchecked(index);
-    return remote->packetsize;
+    aoo_block_pool_stats stats;
+    aoo_get_block_pool_stats(&stats);
+
+    JitterBufferMemory mem;
+    mem.used = stats.used;
+    mem.held = stats.held;
+    mem.peakUsed = stats.peak_used;
+    mem.peakHeld = stats.peak_held;
+    return mem;
 }
 
-void SonobusAudioProcessor::setRemotePeerSendPacketsize(int index, int psize)
+class SonobusAudioProcessor::ServerThread : public juce::Thread
 {
-    if (index >= mRemotePeers.size()) return;
+public:
+    ServerThread(SonobusAudioProcessor & processor) : Thread("SonoBusServerThread") , _processor(processor) 
+    {}
     
-    const ScopedReadLock sl (mCoreLock);        
+    void run() override {
 
-    DBG("Setting packet size to " << psize);
+        if (_processor.mAooServer) {
+            _processor.mAooServer->run();
+        }
+        
+        DBG("Server thread finishing");        
+    }
     
-    auto remote = mRemotePeers.getUnchecked(index);
-    remote->packetsize = psize;
+    SonobusAudioProcessor & _processor;
     
-    if (remote->oursource) {
-        //setupSourceFormat(remote, remote->oursource.get());
+};
 
-        //remote->oursource->setup(getSampleRate(), remote->packetsize, getTotalNumInputChannels());
+class SonobusAudioProcessor::ClientThread : public juce::Thread
+{
+public:
+    ClientThread(SonobusAudioProcessor & processor) : Thread("SonoBusClientThread") , _processor(processor) 
+    {}
+    
+    void run() override {
 
-        remote->oursource->set_packetsize(remote->packetsize);
+        if (_processor.mAooClient) {
+            _processor.mAooClient->run();
+        }
+        
+        DBG("Client thread finishing");        
     }
     
-}
+    SonobusAudioProcessor & _processor;
+    
+};
 
-void SonobusAudioProcessor::setRemotePeerCompressorParams(int index, int changroup, CompressorParams & params)
+// the slow lookups at startup, interface addresses and server host names,
+// which can take seconds on some systems and are better not done on the message thread
+class SonobusAudioProcessor::LookupThread : public juce::Thread
 {
-    if (index >= mRemotePeers.size()) return;
-    
-    const ScopedReadLock sl (mCoreLock);        
+public:
+    LookupThread(SonobusAudioProcessor & processor) : Thread("SonoBusLookupThread") , _processor(processor)
+    {}
 
-    auto remote = mRemotePeers.getUnchecked(index);
+    void run() override {
 
-    // sanity check and compute automakeupgain if necessary    
-    params.ratio = jlimit(1.0f, 120.0f, params.ratio);
-    if (params.automakeupGain) {
-        // makeupgain = (-thresh -  abs(thresh/ratio))/2
-        params.makeupGainDb = (-params.thresholdDb - abs(params.thresholdDb/params.ratio)) * 0.5f;
-    }
+        _processor.lookupLocalAddress();
 
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        remote->chanGroups[changroup].params.compressorParams = params;
-        remote->chanGroups[changroup].compressorParamsChanged = true;
-    }
-}
+        while (!threadShouldExit()) {
+            String host;
+            if (!_processor.popHostToResolve(host)) {
+                wait(-1); // until notified of more
+                continue;
+            }
 
-bool SonobusAudioProcessor::getRemotePeerCompressorParams(int index, int changroup, CompressorParams & retparams)
-{
-    if (index >= mRemotePeers.size()) return false;
-    const ScopedReadLock sl (mCoreLock);        
-    auto remote = mRemotePeers.getUnchecked(index);
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        retparams = remote->chanGroups[changroup].params.compressorParams;
-        return true;
-    }
-    return false;
+            _processor.resolveServerHost(host);
+        }
 
-}
+        DBG("Lookup thread finishing");
+    }
 
-void SonobusAudioProcessor::setRemotePeerExpanderParams(int index, int changroup, SonoAudio::CompressorParams & params)
-{
-    if (index >= mRemotePeers.size()) return;
+    SonobusAudioProcessor & _processor;
 
-    const ScopedReadLock sl (mCoreLock);
+};
 
-    auto remote = mRemotePeers.getUnchecked(index);
 
-    // sanity check and compute automakeupgain if necessary
-    params.ratio = jlimit(1.0f, 120.0f, params.ratio);
+enum {
+    OutMixBusIndex = 0,
+    OutSelfBusIndex,
+    OutUserBaseBusIndex,
+    OutUserLastBusIndex = 9
+};
 
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        remote->chanGroups[changroup].params.expanderParams = params;
-        remote->chanGroups[changroup].expanderParamsChanged = true;
-    }
-}
+#if JUCE_IOS
+#define ALTBUS_ACTIVE true
+#else
+#define ALTBUS_ACTIVE false
+#endif
 
-bool SonobusAudioProcessor::getRemotePeerExpanderParams(int index, int changroup, SonoAudio::CompressorParams & retparams)\
-{
-    if (index >= mRemotePeers.size()) return false;
-    const ScopedReadLock sl (mCoreLock);
-    auto remote = mRemotePeers.getUnchecked(index);
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        retparams = remote->chanGroups[changroup].params.expanderParams;
-        return true;
-    }
-    return false;
-}
 
-void SonobusAudioProcessor::setRemotePeerEqParams(int index, int changroup, SonoAudio::ParametricEqParams & params)
+SonobusAudioProcessor::BusesProperties SonobusAudioProcessor::getDefaultLayout()
 {
-    if (index >= mRemotePeers.size()) return;
+    auto props = SonobusAudioProcessor::BusesProperties();
+    auto plugtype = PluginHostType::getPluginLoadedAs();
 
-    const ScopedReadLock sl (mCoreLock);
+    // common to all
+    props = props.withInput  ("Main In",  AudioChannelSet::stereo(), true)
+    .withOutput ("Mix Out", AudioChannelSet::stereo(), true);
 
-    auto remote = mRemotePeers.getUnchecked(index);
 
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        remote->chanGroups[changroup].params.eqParams = params;
-        remote->chanGroups[changroup].eqParamsChanged = true;
+    // extra inputs
+    if (plugtype == AudioProcessor::wrapperType_AAX) {
+        // only one sidechain mono allowed, doesn't even work anyway
+        props = props.withInput ("Aux 1 In", AudioChannelSet::mono(), ALTBUS_ACTIVE);
     }
-}
-
-bool SonobusAudioProcessor::getRemotePeerEqParams(int index, int changroup, SonoAudio::ParametricEqParams & retparams)
-{
-    if (index >= mRemotePeers.size()) return false;
-    const ScopedReadLock sl (mCoreLock);
-    auto remote = mRemotePeers.getUnchecked(index);
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        retparams = remote->chanGroups[changroup].params.eqParams;
-        return true;
+    else if (plugtype == AudioProcessor::wrapperType_VST) {
+        // no multi-bus outputs for now for VST2, so it works in OBS
+    }
+    else {
+        // throw in some input sidechains
+        props = props.withInput  ("Aux 1 In",  AudioChannelSet::stereo(), ALTBUS_ACTIVE)
+        .withInput  ("Aux 2 In",  AudioChannelSet::stereo(), ALTBUS_ACTIVE)
+        .withInput  ("Aux 3 In",  AudioChannelSet::stereo(), ALTBUS_ACTIVE)
+        .withInput  ("Aux 4 In",  AudioChannelSet::stereo(), ALTBUS_ACTIVE)
+        .withInput  ("Aux 5 In",  AudioChannelSet::stereo(), ALTBUS_ACTIVE)
+        .withInput  ("Aux 6 In",  AudioChannelSet::stereo(), ALTBUS_ACTIVE)
+        .withInput  ("Aux 7 In",  AudioChannelSet::stereo(), ALTBUS_ACTIVE)
+        .withInput  ("Aux 8 In",  AudioChannelSet::stereo(), ALTBUS_ACTIVE);
     }
-    return false;
-}
 
-bool SonobusAudioProcessor::getRemotePeerEffectsActive(int index, int changroup)
-{
-    if (index >= mRemotePeers.size()) return false;
-    const ScopedReadLock sl (mCoreLock);
-    auto remote = mRemotePeers.getUnchecked(index);
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        return remote->chanGroups[changroup].params.compressorParams.enabled || remote->chanGroups[changroup].params.expanderParams.enabled || remote->chanGroups[changroup].params.eqParams.enabled || remote->chanGroups[changroup].params.invertPolarity;
+    // outputs
+    if (plugtype == AudioProcessor::wrapperType_VST) {
+        // no multi-bus outputs for now for VST2, so it works in OBS
+    }
+    else {
+        props = props.withOutput ("Aux 1 Out", AudioChannelSet::stereo(), ALTBUS_ACTIVE)
+        .withOutput ("Aux 2 Out", AudioChannelSet::stereo(), ALTBUS_ACTIVE)
+        .withOutput ("Aux 3 Out", AudioChannelSet::stereo(), ALTBUS_ACTIVE)
+        .withOutput ("Aux 4 Out", AudioChannelSet::stereo(), ALTBUS_ACTIVE)
+        .withOutput ("Aux 5 Out", AudioChannelSet::stereo(), ALTBUS_ACTIVE)
+        .withOutput ("Aux 6 Out", AudioChannelSet::stereo(), ALTBUS_ACTIVE)
+        .withOutput ("Aux 7 Out", AudioChannelSet::stereo(), ALTBUS_ACTIVE)
+        .withOutput ("Aux 8 Out", AudioChannelSet::stereo(), ALTBUS_ACTIVE);
     }
-    return false;
 
 
+    return props;
 }
 
 
-void SonobusAudioProcessor::setMetronomeMonitorDelayParams(SonoAudio::DelayParams & params)
+//==============================================================================
+SonobusAudioProcessor::SonobusAudioProcessor()
+     : AudioProcessor ( getDefaultLayout() ),
+mState (*this, &mUndoManager, "SonoBusAoO",
 {
-    mMetChannelGroup.params.monitorDelayParams = params;
-    //mInputChannelGroups[changroup].monitorDelayParamsChanged = true;
-    // commit them now
-    mMetChannelGroup.commitMonitorDelayParams();
-
-    mRecMetChannelGroup.params.monitorDelayParams = params;
-    mRecMetChannelGroup.commitMonitorDelayParams();
-}
+    std::make_unique<AudioParameterFloat>(paramInGain,     TRANS ("In Gain"),    NormalisableRange<float>(0.0, 4.0, 0.0, 0.33), mInGain.get(), "", AudioProcessorParameter::genericParameter,
+                                          [](float v, int maxlen) -> String { return Decibels::toString(Decibels::gainToDecibels(v), 1); }, 
+                                          [](const String& s) -> float { return Decibels::decibelsToGain(s.getFloatValue()); }),
 
-bool SonobusAudioProcessor::getMetronomeMonitorDelayParams(SonoAudio::DelayParams & retparams)
-{
-    retparams = mMetChannelGroup.params.monitorDelayParams;
-    return true;
-}
+    std::make_unique<AudioParameterFloat>(paramInMonitorMonoPan,     TRANS ("In Pan"),    NormalisableRange<float>(-1.0, 1.0, 0.0), mInMonMonoPan.get(), "", AudioProcessorParameter::genericParameter, 
+                                          [](float v, int maxlen) -> String { if (fabs(v) < 0.01) return TRANS("C"); return String((int)rint(abs(v*100.0f))) + ((v > 0 ? "% R" : "% L")) ; },
+                                          [](const String& s) -> float { return s.getFloatValue()*1e-2f; }),
 
-void SonobusAudioProcessor::setMetronomeChannelDestStartAndCount(int start, int count)
-{
-    mMetChannelGroup.params.monDestStartIndex = start;
-    mMetChannelGroup.params.monDestChannels = std::max(1, std::min(count, MAX_CHANNELS));
-    mMetChannelGroup.commitMonitorDelayParams(); // need to do this too
+    std::make_unique<AudioParameterFloat>(paramInMonitorPan1,     TRANS ("In Pan 1"),    NormalisableRange<float>(-1.0, 1.0, 0.0), mInMonPan1.get(), "", AudioProcessorParameter::genericParameter, 
+                                          [](float v, int maxlen) -> String { if (fabs(v) < 0.01) return TRANS("C"); return String((int)rint(abs(v*100.0f))) + ((v > 0 ? "% R" : "% L")) ; },
+                                          [](const String& s) -> float { return s.getFloatValue()*1e-2f; }),
 
-    mRecMetChannelGroup.params.monDestStartIndex = start;
-    mRecMetChannelGroup.params.monDestChannels = std::max(1, std::min(count, MAX_CHANNELS));
-    mRecMetChannelGroup.commitMonitorDelayParams(); // need to do this too
-}
+    std::make_unique<AudioParameterFloat>(paramInMonitorPan2,     TRANS ("In Pan 2"),    NormalisableRange<float>(-1.0, 1.0, 0.0), mInMonPan2.get(), "", AudioProcessorParameter::genericParameter, 
+                                          [](float v, int maxlen) -> String { if (fabs(v) < 0.01) return TRANS("C"); return String((int)rint(abs(v*100.0f))) + ((v > 0 ? "% R" : "% L")) ; },
+                                          [](const String& s) -> float { return s.getFloatValue()*1e-2f; }),
 
-bool SonobusAudioProcessor::getMetronomeChannelDestStartAndCount(int & retstart, int & retcount)
-{
-    retstart = mMetChannelGroup.params.monDestStartIndex;
-    retcount = mMetChannelGroup.params.monDestChannels;
-    return true;
-}
+    std::make_unique<AudioParameterFloat>(paramDry,     TRANS ("Dry Level"),    NormalisableRange<float>(0.0,    1.0, 0.0, 0.5), JUCEApplicationBase::isStandaloneApp() ? mDry.get() : 1.0f, "", AudioProcessorParameter::genericParameter,
+                                          [](float v, int maxlen) -> String { return Decibels::toString(Decibels::gainToDecibels(v), 1); }, 
+                                          [](const String& s) -> float { return Decibels::decibelsToGain(s.getFloatValue()); }),
 
+    std::make_unique<AudioParameterFloat>(paramWet,     TRANS ("Output Level"),    NormalisableRange<float>(0.0, 2.0, 0.0, 0.5), mWet.get(), "", AudioProcessorParameter::genericParameter,
+                                          [](float v, int maxlen) -> String { return Decibels::toString(Decibels::gainToDecibels(v), 1); }, 
+                                          [](const String& s) -> float { return Decibels::decibelsToGain(s.getFloatValue()); }),
 
-void SonobusAudioProcessor::setMetronomePan(float pan)
-{
-    mMetChannelGroup.params.pan[0] = pan;
-    mRecMetChannelGroup.params.pan[0] = pan;
-}
+    std::make_unique<AudioParameterFloat>(paramDefaultNetbufMs,     TRANS ("Default Jitter Buffer Time"),    NormalisableRange<float>(0.0, mMaxBufferTime.get(), 0.001, 0.5), mBufferTime.get(), "", AudioProcessorParameter::genericParameter,
+                                          [](float v, int maxlen) -> String { return String(v*1000.0) + " ms"; }, 
+                                          [](const String& s) -> float { return s.getFloatValue()*1e-3f; }),
+    std::make_unique<AudioParameterChoice>(paramSendChannels, TRANS ("Send Channels"), StringArray({ "Match # Inputs", "Send Mono", "Send Stereo"}), JUCEApplicationBase::isStandaloneApp() ? mSendChannels.get() : 0),
 
-float SonobusAudioProcessor::getMetronomePan() const
-{
-    return mMetChannelGroup.params.pan[0];
-}
+    std::make_unique<AudioParameterBool>(paramMetEnabled, TRANS ("Metronome Enabled"), mMetEnabled.get()),
+    std::make_unique<AudioParameterBool>(paramSendMetAudio, TRANS ("Send Metronome Audio"), mSendMet.get()),
+    std::make_unique<AudioParameterFloat>(paramMetGain,     TRANS ("Metronome Gain"),    NormalisableRange<float>(0.0, 1.0, 0.0, 0.5), mMetGain.get(), "", AudioProcessorParameter::genericParameter,
+                                          [](float v, int maxlen) -> String { return Decibels::toString(Decibels::gainToDecibels(v), 1); },
+                                          [](const String& s) -> float { return Decibels::decibelsToGain(s.getFloatValue()); }),
 
-void SonobusAudioProcessor::setMetronomeGain(float gain)
-{
-    mState.getParameter(paramMetGain)->setValueNotifyingHost(mState.getParameter(paramMetGain)->convertTo0to1(gain));
-}
+    std::make_unique<AudioParameterFloat>(paramMetTempo,     TRANS ("Metronome Tempo"),    NormalisableRange<float>(10.0, 400.0, 1, 0.5), mMetTempo.get(), "", AudioProcessorParameter::genericParameter,
+                                          [](float v, int maxlen) -> String { return String(v) + " bpm"; },
+                                          [](const String& s) -> float { return s.getFloatValue(); }),
 
-float SonobusAudioProcessor::getMetronomeGain() const
-{
-    return mMetGain.get();
-}
+    std::make_unique<AudioParameterBool>(paramSendFileAudio, TRANS ("Send Playback Audio"), mSendPlaybackAudio.get()),
+    std::make_unique<AudioParameterBool>(paramHearLatencyTest, TRANS ("Hear Latency Test"), mHearLatencyTest.get()),
+    std::make_unique<AudioParameterBool>(paramMetIsRecorded, TRANS ("Record Metronome to File"), mMetIsRecorded.get()),
+    std::make_unique<AudioParameterBool>(paramMainReverbEnabled, TRANS ("Main Reverb Enabled"), mMainReverbEnabled.get()),
+    std::make_unique<AudioParameterFloat>(paramMainReverbLevel,     TRANS ("Main Reverb Level"),    NormalisableRange<float>(0.0,    1.0, 0.0, 0.4), mMainReverbLevel.get(), "", AudioProcessorParameter::genericParameter, 
+                                          [](float v, int maxlen) -> String { return Decibels::toString(Decibels::gainToDecibels(v), 1); }, 
+                                          [](const String& s) -> float { return Decibels::decibelsToGain(s.getFloatValue()); }),
+    std::make_unique<AudioParameterFloat>(paramMainReverbSize,     TRANS ("Main Reverb Size"),    NormalisableRange<float>(0.0, 1.0, 0.0), mMainReverbSize.get(), "", AudioProcessorParameter::genericParameter,
+                                          [](float v, int maxlen) -> String { return String((int)(v*100)) + " %"; },
+                                          [](const String& s) -> float { return s.getFloatValue()*0.01f; }),
+    std::make_unique<AudioParameterFloat>(paramMainReverbDamping,     TRANS ("Main Reverb Damping"),    NormalisableRange<float>(0.0, 1.0, 0.0), mMainReverbDamping.get(), "", AudioProcessorParameter::genericParameter,
+                                          [](float v, int maxlen) -> String { return String((int)(v*100)) + " %"; },
+                                          [](const String& s) -> float { return s.getFloatValue()*0.01f; }),
+    std::make_unique<AudioParameterFloat>(paramMainReverbPreDelay,     TRANS ("Pre-Delay Time"),    NormalisableRange<float>(0.0, 100.0, 1.0, 1.0), mMainReverbPreDelay.get(), "", AudioProcessorParameter::genericParameter,
+                                          [](float v, int maxlen) -> String { return String(v, 0) + " ms"; }, 
+                                          [](const String& s) -> float { return s.getFloatValue(); }),
 
-void SonobusAudioProcessor::setMetronomeMonitor(float mgain)
-{
-    mMetChannelGroup.params.monitor = mgain;
-}
+    std::make_unique<AudioParameterChoice>(paramMainReverbModel, TRANS ("Main Reverb Model"), StringArray({ "Freeverb", "MVerb", "Zita", "FDN"}), mMainReverbModel.get()),
 
-float SonobusAudioProcessor::getMetronomeMonitor() const
-{
-    return mMetChannelGroup.params.monitor;
-}
+    std::make_unique<AudioParameterBool>(paramMainSendMute, TRANS ("Main Send Mute"), mMainSendMute.get()),
+    std::make_unique<AudioParameterBool>(paramMainRecvMute, TRANS ("Main Receive Mute"), mMainRecvMute.get()),
+    std::make_unique<AudioParameterBool>(paramMainInMute, TRANS ("Main In Mute"), mMainInMute.get()),
+    std::make_unique<AudioParameterBool>(paramMainMonitorSolo, TRANS ("Main Monitor Solo"), mMainMonitorSolo.get()),
 
+    std::make_unique<AudioParameterChoice>(paramDefaultAutoNetbuf, TRANS ("Def Auto Net Buffer Mode"), StringArray({ "Off", "Auto-Increase", "Auto-Full", "Initial-Auto"}), defaultAutoNetbufMode),
 
+    std::make_unique<AudioParameterInt>(paramDefaultSendQual, TRANS ("Def Send Format"), 0, 14, mDefaultAudioFormatIndex),
+    std::make_unique<AudioParameterBool>(paramDynamicResampling, TRANS ("Dynamic Resampling"), mDynamicResampling.get()),
+    std::make_unique<AudioParameterBool>(paramAutoReconnectLast, TRANS ("Reconnect Last"), mAutoReconnectLast.get()),
+    std::make_unique<AudioParameterFloat>(paramDefaultPeerLevel,     TRANS ("Default User Level"),    NormalisableRange<float>(0.0,    1.0, 0.0, 0.5), mDefUserLevel.get(), "", AudioProcessorParameter::genericParameter,
+                                          [](float v, int maxlen) -> String { return Decibels::toString(Decibels::gainToDecibels(v), 1); },
+                                          [](const String& s) -> float { return Decibels::decibelsToGain(s.getFloatValue()); }),
+    std::make_unique<AudioParameterBool>(paramSyncMetToHost, TRANS ("Sync to Host"), JUCEApplicationBase::isStandaloneApp() ? false : true),
+    std::make_unique<AudioParameterFloat>(paramInputReverbLevel,     TRANS ("Input Reverb Level"),    NormalisableRange<float>(0.0,    1.0, 0.0, 0.4), mInputReverbLevel.get(), "", AudioProcessorParameter::genericParameter,
+                                          [](float v, int maxlen) -> String { return Decibels::toString(Decibels::gainToDecibels(v), 1); },
+                                          [](const String& s) -> float { return Decibels::decibelsToGain(s.getFloatValue()); }),
+    std::make_unique<AudioParameterFloat>(paramInputReverbSize,     TRANS ("Input Reverb Size"),    NormalisableRange<float>(0.0, 1.0, 0.0), mInputReverbSize.get(), "", AudioProcessorParameter::genericParameter,
+                                          [](float v, int maxlen) -> String { return String((int)(v*100)) + " %"; },
+                                          [](const String& s) -> float { return s.getFloatValue()*0.01f; }),
+    std::make_unique<AudioParameterFloat>(paramInputReverbDamping,     TRANS ("Input Reverb Damping"),    NormalisableRange<float>(0.0, 1.0, 0.0), mInputReverbDamping.get(), "", AudioProcessorParameter::genericParameter,
+                                          [](float v, int maxlen) -> String { return String((int)(v*100)) + " %"; },
+                                          [](const String& s) -> float { return s.getFloatValue()*0.01f; }),
+    std::make_unique<AudioParameterFloat>(paramInputReverbPreDelay,     TRANS ("Input Reverb Pre-Delay Time"),    NormalisableRange<float>(0.0, 100.0, 1.0, 1.0), mInputReverbPreDelay.get(), "", AudioProcessorParameter::genericParameter,
+                                          [](float v, int maxlen) -> String { return String(v, 0) + " ms"; },
+                                          [](const String& s) -> float { return s.getFloatValue(); }),
+    std::make_unique<AudioParameterBool>(paramSyncMetToFilePlayback, TRANS ("Sync Met to File Playback"), false),
 
-void SonobusAudioProcessor::setFilePlaybackMonitorDelayParams(SonoAudio::DelayParams & params)
+})
 {
-    mFilePlaybackChannelGroup.params.monitorDelayParams = params;
-    //mInputChannelGroups[changroup].monitorDelayParamsChanged = true;
-    // commit them now
-    mFilePlaybackChannelGroup.commitMonitorDelayParams();
+    mState.addParameterListener (paramInGain, this);
+    mState.addParameterListener (paramDry, this);
+    mState.addParameterListener (paramWet, this);
+    mState.addParameterListener (paramInMonitorMonoPan, this);
+    mState.addParameterListener (paramInMonitorPan1, this);
+    mState.addParameterListener (paramInMonitorPan2, this);
+    mState.addParameterListener (paramDefaultAutoNetbuf, this);
+    mState.addParameterListener (paramDefaultNetbufMs, this);
+    mState.addParameterListener (paramDefaultSendQual, this);
+    mState.addParameterListener (paramMainSendMute, this);
+    mState.addParameterListener (paramMainRecvMute, this);
+    mState.addParameterListener (paramMetEnabled, this);
+    mState.addParameterListener (paramMetGain, this);
+    mState.addParameterListener (paramMetTempo, this);
+    mState.addParameterListener (paramSendMetAudio, this);
+    mState.addParameterListener (paramSendFileAudio, this);
+    mState.addParameterListener (paramHearLatencyTest, this);
+    mState.addParameterListener (paramMetIsRecorded, this);
+    mState.addParameterListener (paramMainReverbEnabled, this);
+    mState.addParameterListener (paramMainReverbSize, this);
+    mState.addParameterListener (paramMainReverbLevel, this);
+    mState.addParameterListener (paramMainReverbDamping, this);
+    mState.addParameterListener (paramMainReverbPreDelay, this);
+    mState.addParameterListener (paramMainReverbModel, this);
+    mState.addParameterListener (paramSendChannels, this);
+    mState.addParameterListener (paramDynamicResampling, this);
+    mState.addParameterListener (paramAutoReconnectLast, this);
+    mState.addParameterListener (paramMainInMute, this);
+    mState.addParameterListener (paramMainMonitorSolo, this);
+    mState.addParameterListener (paramDefaultPeerLevel, this);
+    mState.addParameterListener (paramSyncMetToHost, this);
+    mState.addParameterListener (paramSyncMetToFilePlayback, this);
+    mState.addParameterListener (paramInputReverbSize, this);
+    mState.addParameterListener (paramInputReverbLevel, this);
+    mState.addParameterListener (paramInputReverbDamping, this);
+    mState.addParameterListener (paramInputReverbPreDelay, this);
 
-    mRecFilePlaybackChannelGroup.params.monitorDelayParams = params;
-    mRecFilePlaybackChannelGroup.commitMonitorDelayParams();
+#if (JUCE_IOS)
+    mDefaultRecordDir = File::getSpecialLocation (File::userDocumentsDirectory).getFullPathName();
+#elif (JUCE_ANDROID)
+    auto parentDir = File::getSpecialLocation (File::userApplicationDataDirectory);
+    parentDir = parentDir.getChildFile("Recordings");
+    mDefaultRecordDir = parentDir.getFullPathName();
+#else
+    auto parentDir = File::getSpecialLocation (File::userMusicDirectory);
+    parentDir = parentDir.getChildFile("SonoBus");
+    mDefaultRecordDir = parentDir.getFullPathName();
+#endif
 
-}
 
-bool SonobusAudioProcessor::getFilePlaybackMonitorDelayParams(SonoAudio::DelayParams & retparams)
-{
-    retparams = mFilePlaybackChannelGroup.params.monitorDelayParams;
-    return true;
-}
+    initFormats();
+    
+    mDefaultAutoNetbufModeParam = mState.getParameter(paramDefaultAutoNetbuf);
+    mDefaultAudioFormatParam = mState.getParameter(paramDefaultSendQual);
 
-void SonobusAudioProcessor::setFilePlaybackDestStartAndCount(int start, int count)
-{
-    mFilePlaybackChannelGroup.params.monDestStartIndex = start;
-    mFilePlaybackChannelGroup.params.monDestChannels = std::max(1, std::min(count, MAX_CHANNELS));
-    mFilePlaybackChannelGroup.commitMonitorDelayParams(); // need to do this too
+    const bool isplugin = !JUCEApplicationBase::isStandaloneApp();
+    if (isplugin) {
+        // default dry to 1.0 if plugin
+        mDry = 1.0;
+        mSendChannels = 0; // match inputs default for plugin
+    } else {
+        mDry = 0.0;
+    }
 
-    mRecFilePlaybackChannelGroup.params.monDestStartIndex = start;
-    mRecFilePlaybackChannelGroup.params.monDestChannels = std::max(1, std::min(count, MAX_CHANNELS));
-    mRecFilePlaybackChannelGroup.commitMonitorDelayParams(); // need to do this too
-}
+    mState.getParameter(paramDry)->setValue(mDry.get());
+    mState.getParameter(paramSendChannels)->setValue(mState.getParameter(paramSendChannels)->convertTo0to1(mSendChannels.get()));
 
-bool SonobusAudioProcessor::getFilePlaybackDestStartAndCount(int & retstart, int & retcount)
-{
-    retstart = mFilePlaybackChannelGroup.params.monDestStartIndex;
-    retcount = mFilePlaybackChannelGroup.params.monDestChannels;
-    return true;
-}
+    mTempoParameter = mState.getParameter(paramMetTempo);
+    
+    mMetronome = std::make_unique<SonoAudio::Metronome>();
+    
+    mMetronome->loadBarSoundFromBinaryData(BinaryData::bar_click_wav, BinaryData::bar_click_wavSize);
+    mMetronome->loadBeatSoundFromBinaryData(BinaryData::beat_click_wav, BinaryData::beat_click_wavSize);
+    mMetronome->setTempo(100.0);
+    
+    mMainReverb = std::make_unique<Reverb>();
+    mMainReverbParams.dryLevel = 0.0f;
+    mMainReverbParams.wetLevel = mMainReverbLevel.get() * 0.5f;
+    mMainReverbParams.damping = mMainReverbDamping.get();
+    mMainReverbParams.roomSize = jmap(mMainReverbSize.get(), 0.55f, 1.0f);
+    mMainReverb->setParameters(mMainReverbParams);
 
-void SonobusAudioProcessor::setFilePlaybackGain(float gain)
-{
-    mFilePlaybackChannelGroup.params.gain = gain;
-    mRecFilePlaybackChannelGroup.params.gain = gain;
-    //mTransportSource.setGain(gain);
-}
 
-float SonobusAudioProcessor::getFilePlaybackGain() const
-{
-    return mFilePlaybackChannelGroup.params.gain;
-    //return mTransportSource.getGain();
-}
+    for (int i=0; i < MAX_CHANGROUPS; ++i) {
 
-void SonobusAudioProcessor::setFilePlaybackMonitor(float mgain)
-{
-    mFilePlaybackChannelGroup.params.monitor = mgain;
-    mRecFilePlaybackChannelGroup.params.monitor = mgain;
-}
+        // default to all independent
+        mInputChannelGroups[i].params.chanStartIndex = i;
+        mInputChannelGroups[i].params.numChannels = 1;
 
-float SonobusAudioProcessor::getFilePlaybackMonitor() const
-{
-    return mFilePlaybackChannelGroup.params.monitor;
+        mInputChannelGroups[i].params.setToDefaults(isplugin);
+        mInputChannelGroups[i].setMonitorDelayArena(&mMonitorDelayArena);
+    }
+
+    mMetChannelGroup.setMonitorDelayArena(&mMonitorDelayArena);
+    mFilePlaybackChannelGroup.setMonitorDelayArena(&mMonitorDelayArena);
+    mRecMetChannelGroup.setMonitorDelayArena(&mMonitorDelayArena);
+    mRecFilePlaybackChannelGroup.setMonitorDelayArena(&mMonitorDelayArena);
+
+    mMetChannelGroup.params.name = TRANS("Metronome");
+    mMetChannelGroup.params.numChannels = 1;
+
+    mRecMetChannelGroup.params.name = TRANS("Metronome");
+    mRecMetChannelGroup.params.numChannels = 1;
+
+    mFilePlaybackChannelGroup.params.name = TRANS("File Playback");
+    mFilePlaybackChannelGroup.params.numChannels = 2;
+
+    mRecFilePlaybackChannelGroup.params.name = TRANS("File Playback");
+    mRecFilePlaybackChannelGroup.params.numChannels = 2;
+
+
+    mTransportSource.addChangeListener(this);
+    mBackingTrackPlayer = std::make_unique<SonoAudio::BackingTrackPlayer>(mDiskThread);
+    
+    // audio setup
+    mFormatManager.registerBasicFormats();    
+    
+    mPeerSnapshot = new PeerSnapshot();
+
+    // until an editor shows up
+    setMetersActive(false);
+
+    initializeAoo();
+
+    // the rest of the network setup that can be slow runs alongside the window coming up
+    mLookupThread = std::make_unique<LookupThread>(*this);
+    mLookupThread->startThread(3);
+    preResolveServerHost(DEFAULT_SERVER_HOST);
 }
 
 
-void SonobusAudioProcessor::setInputCompressorParams(int changroup, CompressorParams & params)
+
+SonobusAudioProcessor::~SonobusAudioProcessor()
 {
-    // sanity check and compute automakeupgain if necessary    
-    params.ratio = jlimit(1.0f, 120.0f, params.ratio);
-    if (params.automakeupGain) {
-        // makeupgain = (-thresh -  abs(thresh/ratio))/2
-        params.makeupGainDb = (-params.thresholdDb - abs(params.thresholdDb/params.ratio)) * 0.5f;
+    mTransportSource.setSource(nullptr);
+    if (mPlaybackPrefetcher) {
+        mDiskThread.removeTimeSliceClient(mPlaybackPrefetcher.get());
     }
+    mPlaybackFileCache.reset();
+    mFileStreamEncodePool.reset();
+    mStateRestorePool.reset();
+    mCodecCalibrationPool.reset();
+    mTransportSource.removeChangeListener(this);
 
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        mInputChannelGroups[changroup].params.compressorParams = params;
-        mInputChannelGroups[changroup].compressorParamsChanged = true;
+    mPeerRenderPool.reset();
+
+    if (RealtimeSafetyChecker::isBuiltIn()) {
+        RealtimeSafetyChecker::logReport();
     }
-}
 
-bool SonobusAudioProcessor::getInputCompressorParams(int changroup, CompressorParams & retparams)
-{
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        retparams = mInputChannelGroups[changroup].params.compressorParams;
-        return true;
+    mLookupThread->signalThreadShouldExit();
+    mLookupThread->notify();
+    mLookupThread->stopThread(2000);
+
+    // the peers outlive the recording engine, their tracks have to go first
+    for (auto & remote : mRemotePeers) {
+        if (remote->oursink) {
+            remote->oursink->set_packet_tap(nullptr, nullptr);
+            remote->oursink->set_telemetry_tap(nullptr, nullptr);
+        }
+        remote->fileWriter.reset();
+        {
+            const SpinLock::ScopedLockType sl (remote->packetArchiveLock);
+            remote->packetArchive.reset();
+        }
+        const SpinLock::ScopedLockType sl (remote->telemetryLock);
+        remote->telemetryLog.reset();
     }
-    return false;
-}
 
-void SonobusAudioProcessor::setInputLimiterParams(int changroup, CompressorParams & params)
-{
-    // sanity check and compute automakeupgain if necessary    
-    params.ratio = jlimit(1.0f, 120.0f, params.ratio);
+    cleanupAoo();
 
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        mInputChannelGroups[changroup].params.limiterParams = params;
-        mInputChannelGroups[changroup].limiterParamsChanged = true;
+    // the event thread is done with these now, a take that was still going stays here
+    mDoubleEnderCollector.reset();
+    {
+        const ScopedLock sl (mDoubleEnderWriterLock);
+        activeDoubleEnderWriter = nullptr;
     }
+    mDoubleEnderTrack.reset();
+    mDoubleEnderUploader.reset();
+
+    mBackingTrackServer.reset();
+    mBackingTrackFetcher.reset();
+    mBackingTrackPlayer.reset();
+
+    stopBroadcast();
+
+    delete mPeerSnapshot.exchange(nullptr);
 }
 
-bool SonobusAudioProcessor::getInputLimiterParams(int changroup, CompressorParams & retparams)
+void SonobusAudioProcessor::setParallelPeerRender(bool flag)
 {
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        retparams = mInputChannelGroups[changroup].params.limiterParams;
-        return true;
+    if (flag && !mPeerRenderPool) {
+        // leave a core for the callback itself and the network threads
+        int numworkers = jlimit(1, MAX_PEER_RENDER_WORKERS, SystemStats::getNumCpus() - 2);
+        auto pool = std::make_unique<PeerRenderPool>(*this, numworkers);
+        pool->reserve(jmax(2, jmax(getTotalNumOutputChannels(), getTotalNumInputChannels())), jmax(1024, currSamplesPerBlock));
+        mPeerRenderPool = std::move(pool);
+        DBG("Started peer render pool with " << numworkers << " workers");
     }
-    return false;
+
+    // the pool stays around once created, the audio thread only looks at this flag
+    mParallelPeerRender = flag;
 }
 
-void SonobusAudioProcessor::setInputMonitorDelayParams(int changroup, SonoAudio::DelayParams & params)
+void SonobusAudioProcessor::setParallelPeerSend(bool flag)
 {
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        mInputChannelGroups[changroup].params.monitorDelayParams = params;
-        //mInputChannelGroups[changroup].monitorDelayParamsChanged = true;
-        // commit them now
-        mInputChannelGroups[changroup].commitMonitorDelayParams();
+    if (flag && !mPeerSendPool) {
+        int numworkers = jlimit(1, MAX_PEER_SEND_WORKERS, SystemStats::getNumCpus() / 2);
+        mPeerSendPool = std::make_unique<PeerSendPool>(*this, numworkers);
+        DBG("Started peer send pool with " << numworkers << " workers");
     }
+
+    // like the render pool, only the flag is looked at by the send thread
+    mParallelPeerSend = flag;
 }
 
-bool SonobusAudioProcessor::getInputMonitorDelayParams(int changroup, SonoAudio::DelayParams & retparams)
+void SonobusAudioProcessor::setRealtimeNetworkThreads(bool flag)
 {
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        retparams = mInputChannelGroups[changroup].params.monitorDelayParams;
-        return true;
-    }
-    return false;
+    mRealtimeNetworkThreads = flag;
+    ++mNetworkThreadConfigSerial;
 }
 
+void SonobusAudioProcessor::setPowerSaving(bool flag)
+{
+    mPowerSaving = flag;
+    // so the threads go back to their short waits right away
+    notifySendThread();
+}
 
-void SonobusAudioProcessor::setInputExpanderParams(int changroup, CompressorParams & params)
+void SonobusAudioProcessor::setInlineSend(bool flag)
 {
-    // sanity check and compute automakeupgain if necessary    
-    params.ratio = jlimit(1.0f, 120.0f, params.ratio);
+    mInlineSend = flag;
+    // the Opus complexity follows on the event thread, see updateLoadShedding()
+    notifyEventThread();
+}
 
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        mInputChannelGroups[changroup].params.expanderParams = params;
-        mInputChannelGroups[changroup].expanderParamsChanged = true;
-    }
+void SonobusAudioProcessor::setNetworkThreadAffinity(uint32 mask)
+{
+    mNetworkThreadAffinity = mask;
+    ++mNetworkThreadConfigSerial;
 }
 
-bool SonobusAudioProcessor::getInputExpanderParams(int changroup, CompressorParams & retparams)
+void SonobusAudioProcessor::setReceivePollMode(ReceivePollMode mode)
 {
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        retparams = mInputChannelGroups[changroup].params.expanderParams;
-        return true;
-    }
-    return false;
+    // the receive thread looks at it every time it wakes up
+    mReceivePollMode = jlimit(ReceivePollBlocking, ReceivePollBusy, mode);
 }
 
-void SonobusAudioProcessor::setInputEqParams(int changroup, ParametricEqParams & params)
+void SonobusAudioProcessor::setReceiveThreadCore(int core)
 {
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        mInputChannelGroups[changroup].params.eqParams = params;
-        mInputChannelGroups[changroup].eqParamsChanged = true;
-    }
+    mReceiveThreadCore = jlimit(-1, 31, core);
+    ++mNetworkThreadConfigSerial;
 }
 
-bool SonobusAudioProcessor::getInputEqParams(int changroup, ParametricEqParams & retparams)
+void SonobusAudioProcessor::applyNetworkThreadConfig(int & appliedSerial, bool receiveThread)
 {
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        retparams = mInputChannelGroups[changroup].params.eqParams;
-        return true;
+    // the audio device can change without the config changing
+    if (mRealtimeNetworkThreads.load()) {
+        joinAudioWorkgroup();
     }
-    return false;
-}
 
+    const int serial = mNetworkThreadConfigSerial.load();
+    if (serial == appliedSerial) return;
+    appliedSerial = serial;
 
-void SonobusAudioProcessor::setInputGroupCount(int count)
-{
-    int newcnt = std::max(0, std::min(count, MAX_CHANGROUPS-1));
+    if (mRealtimeNetworkThreads.load()) {
+        if (!setCurrentThreadRealtime(true)) {
+            DBG("Could not make " << Thread::getCurrentThread()->getThreadName() << " realtime, probably lacking permission");
+        }
+    }
+    else if (appliedSerial > 0) {
+        // only undo what we might have done before
+        setCurrentThreadRealtime(false);
+        Thread::setCurrentThreadPriority(9);
+        leaveAudioWorkgroup();
+    }
+
+    // no pinning means all of them (mac ignores affinity anyway)
+    const int numcpus = SystemStats::getNumCpus();
+    const uint32 allmask = numcpus >= 32 ? 0xffffffff : ((1U << numcpus) - 1);
+    uint32 mask = mNetworkThreadAffinity.load() & allmask;
+
+    // the receive thread gets its core to itself, as far as our threads go
+    const int recvcore = mReceiveThreadCore.load();
+    if (recvcore >= 0 && recvcore < jmin(32, numcpus)) {
+        const uint32 recvmask = 1U << recvcore;
+        const uint32 others = (mask != 0 ? mask : allmask) & ~recvmask;
+        if (receiveThread) {
+            mask = recvmask;
+        }
+        else if (others != 0) {
+            mask = others;
+        }
+    }
 
-    mInputChannelGroupCount = newcnt;
+    Thread::setCurrentThreadAffinityMask(mask != 0 ? mask : allmask);
 }
 
-void SonobusAudioProcessor::setInputGroupChannelStartAndCount(int changroup, int start, int count)
+uint32 SonobusAudioProcessor::parseCpuCoreList(const String & corelist)
 {
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        mInputChannelGroups[changroup].params.chanStartIndex = start;
-        mInputChannelGroups[changroup].params.numChannels = std::max(1, std::min(count, MAX_CHANNELS));
-        mInputChannelGroups[changroup].commitMonitorDelayParams();
+    uint32 mask = 0;
+    auto items = StringArray::fromTokens(corelist, ", ", "");
+
+    for (auto & item : items) {
+        if (item.isEmpty()) continue;
+
+        int first = item.upToFirstOccurrenceOf("-", false, false).getIntValue();
+        int last = item.contains("-") ? item.fromFirstOccurrenceOf("-", false, false).getIntValue() : first;
+
+        for (int core = jmax(0, first); core <= jmin(31, last); ++core) {
+            mask |= (1U << core);
+        }
     }
+
+    return mask;
 }
 
-bool SonobusAudioProcessor::getInputGroupChannelStartAndCount(int changroup, int & retstart, int & retcount)
+String SonobusAudioProcessor::cpuCoreListToString(uint32 mask)
 {
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        retstart = mInputChannelGroups[changroup].params.chanStartIndex;
-        retcount = mInputChannelGroups[changroup].params.numChannels;
-        return true;
+    StringArray cores;
+    for (int core = 0; core < 32; ++core) {
+        if (mask & (1U << core)) {
+            cores.add(String(core));
+        }
     }
-    return false;
+    return cores.joinIntoString(",");
 }
 
-void SonobusAudioProcessor::setInputGroupChannelDestStartAndCount(int changroup, int start, int count)
+void SonobusAudioProcessor::getProcessTimingStats(ProcessTimingTracker::Stats & retstats)
 {
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        mInputChannelGroups[changroup].params.monDestStartIndex = start;
-        mInputChannelGroups[changroup].params.monDestChannels = std::max(1, std::min(count, MAX_CHANNELS));
-    }
+    mProcessTiming.getStats(retstats);
 }
 
-bool SonobusAudioProcessor::getInputGroupChannelDestStartAndCount(int changroup, int & retstart, int & retcount)
+void SonobusAudioProcessor::setUseSpecificUdpPort(int port)
 {
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        retstart = mInputChannelGroups[changroup].params.monDestStartIndex;
-        retcount = mInputChannelGroups[changroup].params.monDestChannels;
-        return true;
+    mUseSpecificUdpPort = port;
+    
+    if (port != 0) {
+        if (port != mUdpLocalPort) {
+            cleanupAoo();
+            initializeAoo(port);
+        }
     }
-    return false;
 }
 
-
-bool SonobusAudioProcessor::insertInputChannelGroup(int atgroup, int chstart, int chcount)
+void SonobusAudioProcessor::initializeAoo(int udpPort)
 {
-    if (atgroup >= 0 && atgroup < MAX_CHANGROUPS) {
-        // push any existing ones down
+    int udpport = udpPort; // defaults to letting system choose it  // DEFAULT_UDP_PORT;
+    
+    // we have both an AOO source and sink
+        
+    aoo_initialize();
+    
 
-        for (auto i = MAX_CHANGROUPS-1; i > atgroup; --i) {
-            mInputChannelGroups[i].copyParametersFrom(mInputChannelGroups[i-1]);
-            //mInputChannelGroups[i].chanStartIndex += chcount;
-            //mInputChannelGroups[i-1].numChannels = std::max(1, std::min(count, MAX_CHANNELS));
-        }
-        mInputChannelGroups[atgroup].params.chanStartIndex = chstart;
-        mInputChannelGroups[atgroup].params.numChannels = std::max(1, std::min(chcount, MAX_CHANNELS));
-        mInputChannelGroups[atgroup].params.monDestStartIndex = jmax(0, jmin(2 * (chstart / 2), getTotalNumOutputChannels()-1));
-        mInputChannelGroups[atgroup].params.monDestChannels = std::max(1, std::min(2, getTotalNumOutputChannels() - mInputChannelGroups[atgroup].params.monDestStartIndex));
+    const ScopedWriteLock sl (mCoreLock);        
 
-        // todo some defaults
-        mInputChannelGroups[atgroup].commitMonitorDelayParams(); // need to do this too
+    //mAooSink.reset(aoo::isink::create(1));
 
-        return true;
+    if (!mAooClock) {
+        mAooClock.reset(aoo::iclock::create());
     }
-    return false;
-}
 
-bool SonobusAudioProcessor::removeInputChannelGroup(int atgroup)
-{
-    if (atgroup >= 0 && atgroup < MAX_CHANGROUPS) {
-        // move any existing ones after up
+    mAooDummySource.reset(aoo::isource::create(0));
+    mAooDummySource->set_clock(mAooClock.get());
+    mDummySourceEventNotify.processor = this;
+    mAooDummySource->set_event_notify(eventNotifyCallback, &mDummySourceEventNotify);
 
-        for (auto i = atgroup + 1; i < MAX_CHANGROUPS; ++i) {
-            mInputChannelGroups[i-1].copyParametersFrom(mInputChannelGroups[i]);
-            //mInputChannelGroups[i].chanStartIndex += chcount;
-            //mInputChannelGroups[i-1].numChannels = std::max(1, std::min(count, MAX_CHANNELS));
+
+
+    
+    //mAooSink->set_buffersize(mBufferTime.get()); // ms
+    //mAooSource->set_buffersize(mBufferTime.get()); // ms
+    
+    //mAooSink->set_packetsize(1024);
+    //mAooSource->set_packetsize(1024);
+    
+
+    
+    // dual-stack, so that peers and servers can be reached over IPv6 too
+    mUdpSocket = std::make_unique<DatagramSocket>(false, true);
+    // grown with the traffic later, see updateSocketBufferSizes()
+    mSocketSendBufferSize = mSocketRecvBufferSize = SOCKET_BUFFER_MIN_SIZE;
+    mUdpSocket->setSendBufferSize(mSocketSendBufferSize);
+    mUdpSocket->setReceiveBufferSize(mSocketRecvBufferSize);
+
+#ifdef SO_RXQ_OVFL
+    {
+        // have the kernel tell us about datagrams dropped for lack of buffer space
+        int one = 1;
+        if (setsockopt(mUdpSocket->getRawSocketHandle(), SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)) == 0) {
+            mSocketReceiveDrops = 0;
         }
-        return true;
     }
-    return false;
-}
+#endif
 
-bool SonobusAudioProcessor::moveInputChannelGroupTo(int atgroup, int togroup)
-{
-    if (atgroup == togroup || atgroup < 0 || atgroup >= MAX_CHANGROUPS || togroup < 0 || togroup >= MAX_CHANGROUPS) {
-        return false;
+    if (udpport > 0) {
+        int attempts = 100;
+        while (attempts > 0) {
+            if (mUdpSocket->bindToPort(udpport)) {
+                udpport = mUdpSocket->getBoundPort();
+                DBG("Bound udp port to " << udpport);
+                break;
+            }
+            ++udpport;
+            --attempts;
+        }
+
+        if (attempts <= 0) {
+            DBG("COULD NOT BIND TO PORT!");
+            udpport = 0;
+        }
+    }
+    else {
+        // system assigned
+        if (!mUdpSocket->bindToPort(0)) {
+            DBG("Error binding to any udp port!");
+        }
+        else {
+            udpport = mUdpSocket->getBoundPort();
+            DBG("Bound system chosen udp port to " << udpport);
+        }
     }
+    
+    
+    mUdpLocalPort = udpport;
 
-    // takes group atgroup and rearranges settings
-    insertInputChannelGroup(togroup, mInputChannelGroups[atgroup].params.chanStartIndex, mInputChannelGroups[atgroup].params.numChannels);
-    int origgroup = atgroup < togroup ? atgroup : atgroup+1;
-    // copy from origgroup to new atgroup
-    mInputChannelGroups[togroup].copyParametersFrom(mInputChannelGroups[origgroup]);
+    applySocketQos();
 
-    // remove origgroup
-    removeInputChannelGroup(origgroup);
+    // the local address is looked up on the lookup thread, see lookupLocalAddress()
+    
+    mServerEndpoint = std::make_unique<EndpointState>();
+    mServerEndpoint->owner = mUdpSocket.get();
+    
+    if (mUdpLocalPort > 0) {
+        mAooClient.reset(aoo::net::iclient::create(mServerEndpoint.get(), client_send, mUdpLocalPort));
+    }
 
-    return true;
-}
+    if (mAooClient) {
+        mClientEventNotify.processor = this;
+        mAooClient->set_event_notify(eventNotifyCallback, &mClientEventNotify);
+    }
 
+    
+    if (mAooClient) {
+        mClientThread = std::make_unique<ClientThread>(*this);
+    }
+    
+    if (mParallelPeerSend.load()) {
+        setParallelPeerSend(true);
+    }
 
+    mNetworkEngine->addProcessor(*this);
+    mNetworkEngine->addSocket(*this, *mUdpSocket);
 
-void SonobusAudioProcessor::setInputGroupName(int changroup, const String & name)
-{
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        mInputChannelGroups[changroup].params.name = name;
+    if (mAooClient) {
+        mClientThread->startThread();
     }
-}
 
-String SonobusAudioProcessor::getInputGroupName(int changroup)
-{
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        return mInputChannelGroups[changroup].params.name;
+    if (mMultipathMode.load() != MultipathOff) {
+        openPathSocket();
     }
-    return "";
-}
 
-void SonobusAudioProcessor::setInputChannelPan(int changroup, int chan, float pan)
-{
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        if (chan >= 0 && chan < MAX_CHANNELS) {
-            if (mInputChannelGroups[changroup].params.numChannels == 2 && chan < 2) {
-                mInputChannelGroups[changroup].params.panStereo[chan] = pan;
-            } else {
-                mInputChannelGroups[changroup].params.pan[chan] = pan;
-            }
-        }
-    }
+    mLanMulticastUpdatePending = true;
+    notifyEventThread();
 }
 
-float SonobusAudioProcessor::getInputChannelPan(int changroup, int chan)
+void SonobusAudioProcessor::lookupLocalAddress()
 {
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        if (chan >= 0 && chan < MAX_CHANNELS) {
-            if (mInputChannelGroups[changroup].params.numChannels == 2 && chan < 2) {
-                return mInputChannelGroups[changroup].params.panStereo[chan];
-            } else {
-                return mInputChannelGroups[changroup].params.pan[chan];
+    // lookup thread
+    IPAddress found;
+
+#if JUCE_IOS    
+    auto addresses = IPAddress::getAllInterfaceAddresses (false);
+    for (auto& a : addresses) {
+        // look for local wifi interface address first
+        if (a.first != IPAddress::local(false) && ( a.second == "en0" || a.second == "en1")) {
+            found = a.first;
+            break;
+        }        
+    }
+    if (found.isNull()) {
+        // now accept anything
+        for (auto& a : addresses) {
+            // look for local wifi interface address first
+            if (a.first != IPAddress::local(false)) {
+                found = a.first;
+                break;
             }
+        }        
+    }
+#else
+    auto addresses = IPAddress::getAllAddresses (false);
+    for (auto& a : addresses) {
+        if (a != IPAddress::local(false)) {
+            found = a;
+            break;
         }
     }
+#endif
 
-    return 0.0f;
+    const ScopedLock sl (mLookupLock);
+    mLocalIPAddress = found;
+    mLocalAddressKnown = true;
 }
 
-void SonobusAudioProcessor::setInputGroupGain(int changroup, float gain)
+IPAddress SonobusAudioProcessor::getLocalIPAddress() const
 {
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        mInputChannelGroups[changroup].params.gain = gain;
-    }
+    const ScopedLock sl (mLookupLock);
+    return mLocalIPAddress;
 }
 
-float SonobusAudioProcessor::getInputGroupGain(int changroup)
+bool SonobusAudioProcessor::isLocalAddressKnown() const
 {
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        return mInputChannelGroups[changroup].params.gain;
-    }
-    return 0.0f;
+    const ScopedLock sl (mLookupLock);
+    return mLocalAddressKnown;
 }
 
-void SonobusAudioProcessor::setInputMonitor(int changroup, float mgain)
+void SonobusAudioProcessor::preResolveServerHost(const String & host)
 {
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        mInputChannelGroups[changroup].params.monitor = mgain;
-    }
-}
+    if (host.isEmpty() || !mLookupThread) return;
 
-float SonobusAudioProcessor::getInputMonitor(int changroup)
-{
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        return mInputChannelGroups[changroup].params.monitor;
+    {
+        const ScopedLock sl (mLookupLock);
+        mHostsToResolve.addIfNotAlreadyThere(host);
     }
-    return 0.0f;
+    mLookupThread->notify();
 }
 
-void SonobusAudioProcessor::setInputGroupMuted(int changroup, bool muted)
+bool SonobusAudioProcessor::popHostToResolve(String & rethost)
 {
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        mInputChannelGroups[changroup].params.muted = muted;
-    }
-}
+    const ScopedLock sl (mLookupLock);
+    if (mHostsToResolve.isEmpty()) return false;
 
-bool SonobusAudioProcessor::getInputGroupMuted(int changroup)
-{
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        return mInputChannelGroups[changroup].params.muted;
-    }
-    return false;
+    rethost = mHostsToResolve[0];
+    mHostsToResolve.remove(0);
+    return true;
 }
 
-void SonobusAudioProcessor::setInputGroupSoloed(int changroup, bool soloed)
+void SonobusAudioProcessor::resolveServerHost(const String & host)
 {
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        mInputChannelGroups[changroup].params.soloed = soloed;
-    }
-}
+    // lookup thread
+    IPAddress numeric (host);
+    if (numeric.toString() == host) return; // already an address
 
-bool SonobusAudioProcessor::getInputGroupSoloed(int changroup)
-{
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        return mInputChannelGroups[changroup].params.soloed;
+    String address;
+    if (auto * info = getAddressInfo(true, host, DEFAULT_SERVER_PORT)) {
+        // prefer IPv4 like the server endpoint does, the relay can't do IPv6
+        auto best = info;
+        for (auto ai = info; ai; ai = ai->ai_next) {
+            if (ai->ai_family == AF_INET) {
+                best = ai;
+                break;
+            }
+        }
+
+        char buf[INET6_ADDRSTRLEN] = {0};
+        if (getnameinfo(best->ai_addr, (socklen_t) best->ai_addrlen, buf, sizeof(buf), nullptr, 0, NI_NUMERICHOST) == 0) {
+            address = String(buf);
+        }
+        freeaddrinfo(info);
     }
-    return false;
-}
 
+    if (address.isEmpty()) {
+        DBG("Could not look up " << host << " ahead of time");
+        return;
+    }
 
+    DBG("Looked up " << host << " as " << address);
 
-void SonobusAudioProcessor::setInputReverbSend(int changroup, float rgain, bool input)
-{
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        if (input) {
-            mInputChannelGroups[changroup].params.inReverbSend = rgain;
-        } else {
-            mInputChannelGroups[changroup].params.monReverbSend = rgain;
+    const ScopedLock sl (mLookupLock);
+    for (auto & resolved : mResolvedHosts) {
+        if (resolved.host == host) {
+            resolved.address = address;
+            resolved.stamp = Time::getMillisecondCounterHiRes();
+            return;
         }
     }
+    mResolvedHosts.add({ host, address, Time::getMillisecondCounterHiRes() });
 }
 
-float SonobusAudioProcessor::getInputReverbSend(int changroup, bool input)
+String SonobusAudioProcessor::getResolvedServerHost(const String & host) const
 {
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        if (input) {
-            return mInputChannelGroups[changroup].params.inReverbSend;
-        } else {
-            return mInputChannelGroups[changroup].params.monReverbSend;
+    const ScopedLock sl (mLookupLock);
+    const double now = Time::getMillisecondCounterHiRes();
+    for (auto & resolved : mResolvedHosts) {
+        if (resolved.host == host && now - resolved.stamp < RESOLVED_HOST_MAX_AGE_MS) {
+            return resolved.address;
         }
     }
-    return 0.0f;
+    return host;
 }
 
-void SonobusAudioProcessor::setInputPolarityInvert(int changroup, bool invert)
+void SonobusAudioProcessor::cleanupAoo()
 {
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        mInputChannelGroups[changroup].params.invertPolarity = invert;
+    disconnectFromServer();
+    
+    // the shared network threads are out of here once this returns
+    mNetworkEngine->removeProcessor(*this);
+    mPeerSendPool.reset();
+
+    {
+        // they point at the endpoints
+        const ScopedLock sl (mDeferredEventsLock);
+        mDeferredEvents.clear();
     }
-}
 
-bool SonobusAudioProcessor::getInputPolarityInvert(int changroup)
-{
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        return mInputChannelGroups[changroup].params.invertPolarity;
+    if (mAooClient) {
+        mAooClient->disconnect();
+        mAooClient->quit();
+        mClientThread->stopThread(400);        
     }
-    return false;
-}
 
+    
+    {
+        const ScopedWriteLock sl (mCoreLock);        
 
+        mAooClient.reset();
 
-void SonobusAudioProcessor::commitCompressorParams(RemotePeer * peer, int changroup)
-{   
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        peer->chanGroups[changroup].commitCompressorParams();
+#if JUCE_WINDOWS
+        {
+            const ScopedLock el (mEndpointsLock);
+            mSocketQos.reset();
+        }
+#endif
+        mUdpSocket.reset();
+        mPathUdpSocket.reset();
+        mLanMulticastDest = nullptr;
+        mLanMulticastSocket.reset();
+        
+        mAooDummySource.reset();
+        
+        {
+            // pull them out of the snapshot before they get deleted
+            OwnedArray<RemotePeer> removed;
+            removed.swapWith(mRemotePeers);
+            publishPeerSnapshot();
+        }
+        
+        {
+            const ScopedLock el (mEndpointsLock);
+            mEndpointTable.clear();
+            mEndpointTableCount = 0;
+            mEndpoints.clear();
+            mPathEndpoints.clear();
+            mRetiredEndpoints.clear();
+            mLanMulticastEndpoints.clear();
+        }
     }
+
+    mLanMulticastAddress.clear();
+
+    stopAooServer();    
 }
 
-void SonobusAudioProcessor::commitInputCompressorParams(int changroup)
-{   
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        mInputChannelGroups[changroup].commitCompressorParams();
+void SonobusAudioProcessor::startAooServer()
+{
+    stopAooServer();
+    
+    {
+        const ScopedWriteLock sl (mCoreLock);
+        int32_t err;
+        mAooServer.reset(aoo::net::iserver::create(10999, &err));
+        
+        if (err != 0) {
+            DBG("Error creating Aoo Server: " << err);
+        }
+        else if (mAooServer) {
+            mServerEventNotify.processor = this;
+            mAooServer->set_event_notify(eventNotifyCallback, &mServerEventNotify);
+            // relay for peers which can't reach each other directly
+            mAooServer->set_relay(true, 0);
+        }
+    }
+    
+    if (mAooServer) {
+        mServerThread = std::make_unique<ServerThread>(*this);    
+        mServerThread->startThread();
     }
 }
-
-void SonobusAudioProcessor::commitInputExpanderParams(int changroup)
+    
+void SonobusAudioProcessor::stopAooServer()
 {
-   
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        //mInputCompressorControl.setParamValue("/compressor/Bypass", mInputCompressorParams.enabled ? 0.0f : 1.0f);
-        mInputChannelGroups[changroup].commitExpanderParams();
-    }
+    if (mAooServer) {
+        DBG("waiting on recv thread to die");
+        mAooServer->quit();
+        mServerThread->stopThread(400);    
 
+        const ScopedWriteLock sl (mCoreLock);
+        mAooServer.reset();
+    }
 }
 
-void SonobusAudioProcessor::commitInputLimiterParams(int changroup)
-{   
-    //mInputLimiterControl.setParamValue("/limiter/Bypass", mInputLimiterParams.enabled ? 0.0f : 1.0f);
-    //mInputLimiterControl.setParamValue("/limiter/threshold", mInputLimiterParams.thresholdDb);
-    //mInputLimiterControl.setParamValue("/limiter/ratio", mInputLimiterParams.ratio);
-    //mInputLimiterControl.setParamValue("/limiter/attack", mInputLimiterParams.attackMs * 1e-3);
-    //mInputLimiterControl.setParamValue("/limiter/release", mInputLimiterParams.releaseMs * 1e-3);
-
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        mInputChannelGroups[changroup].commitLimiterParams();
-    }
+bool SonobusAudioProcessor::setCurrentUsername(const String & name)
+{
+    if (mIsConnectedToServer) return false;
 
+    mCurrentUsername = name;
+    return true;
 }
 
 
-void SonobusAudioProcessor::commitInputEqParams(int changroup)
+bool SonobusAudioProcessor::connectToServer(const String & host, int port, const String & username, const String & passwd)
 {
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        mInputChannelGroups[changroup].commitEqParams();
+    if (!mAooClient) return false;
+    
+    // disconnect from everything else!
+    removeAllRemotePeers();
+    
+    // if the name was looked up already the client thread doesn't have to wait for it again
+    const String address = getResolvedServerHost(host);
+
+    mServerEndpoint->ipaddr = address;
+    mServerEndpoint->port = port;
+    mServerEndpoint->resetAddress();
+
+    mCurrentUsername = username;
+
+    mServerRequestsPending = false;
+
+    int32_t retval = mAooClient->connect(address.toRawUTF8(), port, username.toRawUTF8(), passwd.toRawUTF8());
+    
+    if (retval < 0) {
+        DBG("Error connecting to server: " << retval);
+    }
+    else {
+        // joins and watches from now until the login come along with it
+        mServerConnecting = true;
     }
+    
+    return retval >= 0;
 }
 
-void SonobusAudioProcessor::commitInputMonitoringParams(int changroup)
+bool SonobusAudioProcessor::isConnectedToServer() const
 {
-    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        mInputChannelGroups[changroup].commitMonitorDelayParams();
-    }
+    if (!mAooClient) return false;
+
+    return mIsConnectedToServer;    
 }
 
+bool SonobusAudioProcessor::disconnectFromServer()
+{
+    if (!mAooClient) return false;
+ 
+    mAooClient->disconnect();
+    
+    // disconnect from everything else!
+    removeAllRemotePeers();
 
+    mServerConnecting = false;
+    mServerRequestsPending = false;
 
-// should use shared pointer
-foleys::LevelMeterSource * SonobusAudioProcessor::getRemotePeerRecvMeterSource(int index)
-{
-    if (index >= mRemotePeers.size()) return nullptr;
-    const ScopedReadLock sl (mCoreLock);        
-    auto remote = mRemotePeers.getUnchecked(index);
-    return &(remote->recvMeterSource);
+    {
+        const ScopedLock sl (mClientLock);
+
+        mIsConnectedToServer = false;
+        mSessionConnectionStamp = 0.0;
+
+        mCurrentJoinedGroup.clear();
+    }
+
+    mLanMulticastUpdatePending = true;
+    notifyEventThread();
+
+    {
+        const ScopedLock sl (mPublicGroupsLock);
+
+        mPublicGroupInfos.clear();
+    }
+
+
+
+    return true;
 }
 
-foleys::LevelMeterSource * SonobusAudioProcessor::getRemotePeerSendMeterSource(int index)
+void SonobusAudioProcessor::addRecentServerConnectionInfo(const AooServerConnectionInfo & cinfo)
 {
-    if (index >= mRemotePeers.size()) return nullptr;
-    const ScopedReadLock sl (mCoreLock);        
-    auto remote = mRemotePeers.getUnchecked(index);
-    return &(remote->sendMeterSource);
+    finishStateRestore();
+    const ScopedLock sl (mRecentsLock);
+
+    // look for existing match, and update only timestamp if found, otherwise add to end
+    int index = mRecentConnectionInfos.indexOf(cinfo);
+    if (index >= 0) {
+        // already there
+        mRecentConnectionInfos.getReference(index).timestamp = cinfo.timestamp;
+    } else {
+        // add it
+        mRecentConnectionInfos.add(cinfo);
+    }
+    // resort
+    mRecentConnectionInfos.sort();
+    
+    // limit to 10
+    if (mRecentConnectionInfos.size() > 10) {
+        mRecentConnectionInfos.removeRange(10, mRecentConnectionInfos.size() - 10);
+    }
 }
 
+int SonobusAudioProcessor::getRecentServerConnectionInfos(Array<AooServerConnectionInfo> & retarray)
+{
+    finishStateRestore();
+    const ScopedLock sl (mRecentsLock);
+    retarray = mRecentConnectionInfos;
+    return retarray.size();
+}
 
+void SonobusAudioProcessor::clearRecentServerConnectionInfos()
+{
+    finishStateRestore();
+    const ScopedLock sl (mRecentsLock);
+    mRecentConnectionInfos.clear();
+}
 
+void SonobusAudioProcessor::removeRecentServerConnectionInfo(int index)
+{
+    finishStateRestore();
+    const ScopedLock sl (mRecentsLock);
+    if (index < mRecentConnectionInfos.size()) {
+        mRecentConnectionInfos.remove(index);
+    }
+}
 
-SonobusAudioProcessor::EndpointState * SonobusAudioProcessor::findOrAddRawEndpoint(void * rawaddr)
+int SonobusAudioProcessor::getPublicGroupInfos(Array<AooPublicGroupInfo> & retarray)
 {
-    String ipaddr;
-    int port = 0 ;
+    retarray.clearQuick();
 
-    char hostip[INET6_ADDRSTRLEN];
-    if (inet_ntop(AF_INET, get_in_addr((struct sockaddr *)rawaddr), hostip, sizeof(hostip)) == nullptr) {
-        DBG("Error converting raw addr to IP");
-        return nullptr;
-    } else {
-        ipaddr = hostip;
-        port = ntohs(get_in_port((struct sockaddr *)rawaddr));        
-        return findOrAddEndpoint(ipaddr, port);    
-    }    
+    const ScopedLock sl (mPublicGroupsLock);
+    for (auto & item : mPublicGroupInfos) {
+        retarray.add(item.second);
+    }
+    return retarray.size();
 }
 
-SonobusAudioProcessor::EndpointState * SonobusAudioProcessor::findOrAddEndpoint(const String & host, int port)
+bool SonobusAudioProcessor::getPublicGroupInfo(const String & group, AooPublicGroupInfo & retinfo)
 {
-    const ScopedLock sl (mEndpointsLock);        
-    
-    EndpointState * endpoint = 0;
-    
-    for (auto ep : mEndpoints) {
-        if (ep->ipaddr == host && ep->port == port) {
-            endpoint = ep;
-            break;
-        }
-    }
-    
-    if (!endpoint) {
-        // add it as new
-        endpoint = mEndpoints.add(new EndpointState(host, port));
-        endpoint->owner = mUdpSocket.get();
-        endpoint->peer = std::make_unique<DatagramSocket::RemoteAddrInfo>(host, port);
-        DBG("Added new endpoint for " << host << ":" << port);
+    const ScopedLock sl (mPublicGroupsLock);
+    auto found = mPublicGroupInfos.find(group);
+    if (found == mPublicGroupInfos.end()) {
+        return false;
     }
-    return endpoint;
+    retinfo = found->second;
+    return true;
 }
 
-void SonobusAudioProcessor::updateSafetyMuting(RemotePeer * peer)
+
+
+void SonobusAudioProcessor::setAutoconnectToGroupPeers(bool flag)
 {
-    // assumed corelock already held
-    //const float droprate =  (peer->dataPacketsDropped) / ((nowtime - peer->resetDroptime)*1e-3);
-    const float droprate = peer->fastDropRate.xbar;
-    const float safetyunmutethreshrate = 2.0f;
-    const float safetyunmutethreshmintime = 0.5f;
-    const float safetyunmutethreshtime = 0.75f;
-    const float jitterbufthresh = 15.0f;
+    mAutoconnectGroupPeers = flag;
+}
 
-    double nowtime = Time::getMillisecondCounterHiRes();
-    double timesincereset = (nowtime - peer->resetDroptime) * 1e-3;
-    double deltadroptime = peer->lastDroptime > 0 ? (nowtime - peer->lastDroptime) * 1e-3 : timesincereset;
 
+bool SonobusAudioProcessor::setWatchPublicGroups(bool flag)
+{
+    if (!mAooClient) return false;
 
-    if ((timesincereset > safetyunmutethreshmintime)
-        && ((droprate > 0.0f && droprate < safetyunmutethreshrate)
-            || (droprate == 0.0f && deltadroptime > safetyunmutethreshtime)
-            || (peer->buffertimeMs > jitterbufthresh))) {
-        DBG("Droprate: " << droprate << "  deltatime: " << deltadroptime << " buftimems: " << peer->buffertimeMs);
-        DBG("Unmuting after reset drop");
-        peer->resetSafetyMuted = false;
+    mWatchPublicGroups = flag;
+
+    if (mServerConnecting) {
+        mServerRequestsPending = true;
     }
 
-    peer->fastDropRate.Z *= 0.965;
+    int32_t retval = mAooClient->group_watch_public(flag);
 
-    float realdroprate =  (peer->dataPacketsDropped - peer->lastDropCount) / deltadroptime;
-    peer->fastDropRate.push(realdroprate);
+    const ScopedLock sl (mPublicGroupsLock);
+
+    mPublicGroupInfos.clear();
+
+
+    if (retval < 0) {
+        DBG("Error watching public groups: " << retval);
+    }
+
+    return retval >= 0;
 
 }
 
-void SonobusAudioProcessor::doReceiveData()
+
+bool SonobusAudioProcessor::joinServerGroup(const String & group, const String & groupsecret, bool isPublic)
 {
-    // receive from udp port, and parse packet
-    char buf[AOO_MAXPACKETSIZE];
-    String senderIP;
-    int senderPort;
-    
-    int nbytes = mUdpSocket->read(buf, AOO_MAXPACKETSIZE, false, senderIP, senderPort);
+    if (!mAooClient) return false;
 
-    if (nbytes == 0) return;
-    else if (nbytes < 0) {
-        DBG("Error receiving UDP");
-        return;
+    if (mServerConnecting) {
+        mServerRequestsPending = true;
     }
+
+    int32_t retval = mAooClient->group_join(group.toRawUTF8(), groupsecret.toRawUTF8(), isPublic);
     
-    // find endpoint from sender info
-    EndpointState * endpoint = findOrAddEndpoint(senderIP, senderPort);
+    if (retval < 0) {
+        DBG("Error joining group " << group << " : " << retval);
+    }
     
-    endpoint->recvBytes += nbytes + UDP_OVERHEAD_BYTES;
+    return retval >= 0;
+}
+
+bool SonobusAudioProcessor::leaveServerGroup(const String & group)
+{
+    if (!mAooClient) return false;
+
+    int32_t retval = mAooClient->group_leave(group.toRawUTF8());
     
-    // parse packet for AOO events
+    if (retval < 0) {
+        DBG("Error leaving group " << group << " : " << retval);
+    }
+
+    const ScopedLock sl (mClientLock);        
     
-    int32_t type, id, dummyid;
-    if ((aoo_parse_pattern(buf, nbytes, &type, &id) > 0)
-        || (aoonet_parse_pattern(buf, nbytes, &type) > 0))
-    {
-        {
-            
-            if (type == AOO_TYPE_SINK){
-                // forward OSC packet to matching sink(s)
-                const ScopedReadLock sl (mCoreLock);        
-                
-                for (auto & remote : mRemotePeers) {
-                    if (!remote->oursink) continue;
-                    
-                    if (id == AOO_ID_NONE) {
-                        // this is a compact data message, try them all
-                        if (remote->oursink->handle_message(buf, nbytes, endpoint, endpoint_send)) {
-                            remote->dataPacketsReceived += 1;
-                            if (remote->recvAllow && !remote->recvActive) {
-                                remote->recvActive = true;
-                            }
-                            if (remote->resetSafetyMuted) {
-                                updateSafetyMuting(remote);
-                            }
-                            break;
-                        }
-                    }
-                    
-                    if (id == AOO_ID_WILDCARD || (remote->oursink->get_id(dummyid) && id == dummyid) ) {
-                        if (remote->oursink->handle_message(buf, nbytes, endpoint, endpoint_send)) {
-                            remote->dataPacketsReceived += 1;
-                            if (remote->recvAllow && !remote->recvActive) {
-                                remote->recvActive = true;
-                            }
-                            if (remote->resetSafetyMuted) {
-                                updateSafetyMuting(remote);
-                            }
-                        }
-                        
-                        if (id != AOO_ID_WILDCARD) break;
-                    }
-                    
-                    if (remote->echosink->get_id(dummyid) && id == dummyid) {
-                        remote->echosink->handle_message(buf, nbytes, endpoint, endpoint_send);
-                        break;
-                    }
-                    else if (remote->latencysink->get_id(dummyid) && id == dummyid) {
-                        remote->latencysink->handle_message(buf, nbytes, endpoint, endpoint_send);
-                        break;
-                    }
-                    
-                }
-                
-            } else if (type == AOO_TYPE_SOURCE){
-                // forward OSC packet to matching sources(s)
-                const ScopedReadLock sl (mCoreLock);        
+    if (mCurrentJoinedGroup == group) {
+        mCurrentJoinedGroup.clear();
+        mLanMulticastUpdatePending = true;
+        notifyEventThread();
+    }
+    
+    return retval >= 0;
+}
 
-                
-                if (mAooDummySource->get_id(dummyid) && id == dummyid) {
-                    // this is the special one that can accept blind invites
-                    mAooDummySource->handle_message(buf, nbytes, endpoint, endpoint_send);
-                }
-                else {
-                    for (auto & remote : mRemotePeers) {
-                        if (!remote->oursource) continue;
-                        if (id == AOO_ID_WILDCARD || (remote->oursource->get_id(dummyid) && id == dummyid)) {
-                            remote->oursource->handle_message(buf, nbytes, endpoint, endpoint_send);
-                            if (id != AOO_ID_WILDCARD) break;
-                        }
-                        
-                        if (remote->echosource->get_id(dummyid) && id == dummyid) {
-                            remote->echosource->handle_message(buf, nbytes, endpoint, endpoint_send);
-                            break;
-                        }
-                        else if (remote->latencysource->get_id(dummyid) && id == dummyid) {
-                            remote->latencysource->handle_message(buf, nbytes, endpoint, endpoint_send);
-                            break;
-                        }
-                    }
-                }
+String SonobusAudioProcessor::getCurrentJoinedGroup() const { 
+    const ScopedLock sl (mClientLock);        
+    return mCurrentJoinedGroup;     
+}
 
-                
-            } else if (type == AOO_TYPE_CLIENT || type == AOO_TYPE_PEER){
-                // forward OSC packet to matching client
+void SonobusAudioProcessor::AudioCodecFormatInfo::computeName()
+{
+    if (codec == SonobusAudioProcessor::CodecOpus) {
+        name = String::formatted("%d kbps/ch", bitrate/1000);
+    }
+    else if (codec == SonobusAudioProcessor::CodecLossless) {
+        name = String::formatted("Lossless %d bit", bitdepth * 8);
+    }
+    else {
+        if (bitdepth == 2) {
+            name = "PCM 16 bit";
+        }
+        else if (bitdepth == 3) {
+            name = "PCM 24 bit";
+        }
+        else if (bitdepth == 4) {
+            name = "PCM 32 bit float";
+        }
+        else if (bitdepth == 8) {
+            name = "PCM 64 bit float";
+        }
+    }
+}
 
-                //DBG("Got AOO_CLIENT or PEER data");
+void SonobusAudioProcessor::initFormats()
+{
+    mAudioFormats.clear();
+    
+    // low bandwidth to high
+    //mAudioFormats.add(AudioCodecFormatInfo(8000, 10, OPUS_SIGNAL_MUSIC, 960));
+    mAudioFormats.add(AudioCodecFormatInfo(16000, 10, OPUS_SIGNAL_MUSIC, 960));
+    mAudioFormats.add(AudioCodecFormatInfo(24000, 10, OPUS_SIGNAL_MUSIC, 480));
+    mAudioFormats.add(AudioCodecFormatInfo(48000, 10, OPUS_SIGNAL_MUSIC, 240));
+    mAudioFormats.add(AudioCodecFormatInfo(64000, 10, OPUS_SIGNAL_MUSIC, 240));
+    mAudioFormats.add(AudioCodecFormatInfo(96000, 10, OPUS_SIGNAL_MUSIC, 120));
+    mAudioFormats.add(AudioCodecFormatInfo(128000, 10, OPUS_SIGNAL_MUSIC, 120));
+    mAudioFormats.add(AudioCodecFormatInfo(160000, 10, OPUS_SIGNAL_MUSIC, 120));
+    mAudioFormats.add(AudioCodecFormatInfo(256000, 10, OPUS_SIGNAL_MUSIC, 120));
+    
+    mAudioFormats.add(AudioCodecFormatInfo(2));
+    mAudioFormats.add(AudioCodecFormatInfo(3));
+    mAudioFormats.add(AudioCodecFormatInfo(4));
+    //mAudioFormats.add(AudioCodecFormatInfo(CodecPCM, 8)); // insanity!
 
-                if (mAooClient) {
-                    mAooClient->handle_message(buf, nbytes, endpoint->getRawAddr());
-                }
-                
-                /*
-                 for (int i = 0; i < x->x_numclients; ++i){
-                 if (pd_class(x->x_clients[i].c_obj) == aoo_client_class)
-                 {
-                 t_aoo_client *c = (t_aoo_client *)x->x_clients[i].c_obj;
-                 aoo_client_handle_message(c, buf, nbytes,
-                 ep, (aoo_replyfn)endpoint_send);
-                 break;
-                 }
-                 }
-                 */
-            } else if (type == AOO_TYPE_SERVER){
-                // ignore
-                DBG("Got AOO_SERVER data");
+    // added later, so the indices of the ones above stay what they were in saved settings
+    mAudioFormats.add(AudioCodecFormatInfo(CodecLossless, 2));
+    mAudioFormats.add(AudioCodecFormatInfo(CodecLossless, 3));
+
+    mDefaultAudioFormatIndex = DEFAULT_AUDIO_FORMAT_INDEX; // 96kpbs/ch Opus
+    mSimulcastLowFormatIndex = 2; // 48kbps/ch Opus
+}
 
-                if (mAooServer) {
-                    // mAooServer->handle_message(buf, nbytes, endpoint);
+int SonobusAudioProcessor::findFormatIndex(SonobusAudioProcessor::AudioCodecFormatCodec codec, int bitrate, int bitdepth) const
+{
+    for (int i=0; i < mAudioFormats.size(); ++i) {
+        const auto & format = mAudioFormats.getReference(i);
+        if (format.codec == codec) {
+            if (format.codec == CodecOpus) {
+                if (format.bitrate == bitrate) {
+                    return i;
                 }
-                
-            } else {
-                DBG("SonoBus bug: unknown aoo type: " << type);
+            }
+            else if (bitdepth == format.bitdepth){
+                return i;
             }
         }
+    }
+    
+    return -1;
+}
 
-        // notify send thread
-        notifySendThread();
 
-    }
-    else if (handleOtherMessage(endpoint, buf, nbytes)) {
+String SonobusAudioProcessor::getAudioCodeFormatName(int formatIndex) const
+{
+    if (formatIndex >= mAudioFormats.size() || formatIndex < 0) return "";
+    
+    const AudioCodecFormatInfo & info = mAudioFormats.getReference(formatIndex);
+    return info.name;    
+}
 
-    }
-    else {
-        // not a valid AoO OSC message
-        DBG("SonoBus: not a valid AOO message!");
-    }
-        
+bool SonobusAudioProcessor::getAudioCodeFormatInfo(int formatIndex, AudioCodecFormatInfo & retinfo) const
+{
+    if (formatIndex >= mAudioFormats.size() || formatIndex < 0) return false;
+    retinfo = mAudioFormats.getReference(formatIndex);
+    return true;    
 }
 
-// XXX
-// all of this should be refactored into its own class
 
-#define SONOBUS_MSG_DOMAIN "/sb"
-#define SONOBUS_MSG_DOMAIN_LEN 3
+void SonobusAudioProcessor::setDefaultAudioCodecFormat(int formatIndex)
+{
+    if (formatIndex < mAudioFormats.size() && formatIndex >= 0) {
+        mDefaultAudioFormatIndex = formatIndex;
+        mDefaultAudioFormatParam->setValueNotifyingHost(mDefaultAudioFormatParam->convertTo0to1(mDefaultAudioFormatIndex));
+    }
+    
+}
 
-#define SONOBUS_MSG_PEERINFO "/pinfo"
-#define SONOBUS_MSG_PEERINFO_LEN 6
-#define SONOBUS_FULLMSG_PEERINFO SONOBUS_MSG_DOMAIN SONOBUS_MSG_PEERINFO
 
-#define SONOBUS_MSG_LAYOUTINFO "/clayinfo"
-#define SONOBUS_MSG_LAYOUTINFO_LEN 9
-#define SONOBUS_FULLMSG_LAYOUTINFO SONOBUS_MSG_DOMAIN SONOBUS_MSG_LAYOUTINFO
+void SonobusAudioProcessor::setDefaultAutoresizeBufferMode(AutoNetBufferMode flag)
+{
+    defaultAutoNetbufMode = flag;
+    mDefaultAutoNetbufModeParam->setValueNotifyingHost(mDefaultAutoNetbufModeParam->convertTo0to1(defaultAutoNetbufMode));
 
-#define SONOBUS_MSG_CHAT "/chat"
-#define SONOBUS_MSG_CHAT_LEN 5
-#define SONOBUS_FULLMSG_CHAT SONOBUS_MSG_DOMAIN SONOBUS_MSG_CHAT
+}
 
-#define SONOBUS_MSG_PING "/ping"
-#define SONOBUS_MSG_PING_LEN 5
-#define SONOBUS_FULLMSG_PING SONOBUS_MSG_DOMAIN SONOBUS_MSG_PING
 
-#define SONOBUS_MSG_PINGACK "/pngack"
-#define SONOBUS_MSG_PINGACK_LEN 7
-#define SONOBUS_FULLMSG_PINGACK SONOBUS_MSG_DOMAIN SONOBUS_MSG_PINGACK
+void SonobusAudioProcessor::setRemotePeerAudioCodecFormat(int index, int formatIndex)
+{
+    if (formatIndex >= mAudioFormats.size() || index >= mRemotePeers.size()) return;
+    
+    const AudioCodecFormatInfo & info = mAudioFormats.getReference(formatIndex);
 
-#define SONOBUS_MSG_REQLATINFO "/reqlatinfo"
-#define SONOBUS_MSG_REQLATINFO_LEN 12
-#define SONOBUS_FULLMSG_REQLATINFO SONOBUS_MSG_DOMAIN SONOBUS_MSG_REQLATINFO
+    const ScopedReadLock sl (mCoreLock);        
+ 
+    auto remote = mRemotePeers.getUnchecked(index);
+    remote->formatIndex = formatIndex;
+    // the send rate control starts over from the new choice
+    remote->adaptedFormatIndex = -1;
+    remote->budgetLimited = false;
+    remote->formatStepUpWaitMs = SENDRATE_STEPUP_WAIT_MS;
 
-#define SONOBUS_MSG_LATINFO "/latinfo"
-#define SONOBUS_MSG_LATINFO_LEN 8
-#define SONOBUS_FULLMSG_LATINFO SONOBUS_MSG_DOMAIN SONOBUS_MSG_LATINFO
+    applyRemotePeerSendFormat(remote);
+}
 
-#define SONOBUS_MSG_SUGGESTLAT "/suggestlat"
-#define SONOBUS_MSG_SUGGESTLAT_LEN 11
-#define SONOBUS_FULLMSG_SUGGESTLAT SONOBUS_MSG_DOMAIN SONOBUS_MSG_SUGGESTLAT
+void SonobusAudioProcessor::applyRemotePeerSendFormat(RemotePeer * remote)
+{
+    // assumed corelock already held
+    ungroupSharedSend(remote);
+    
+    if (remote->oursource) {
+        setupRemotePeerOurSource(remote);
+        //remote->oursource->setup(getSampleRate(), remote->packetsize    , getTotalNumOutputChannels());        
+        
+        if (remote->latencyTestReady) {
+            setupSourceFormat(remote, remote->latencysource.get(), true);
+            remote->latencysource->setup(getSampleRate(), currSamplesPerBlock, 1);
+            setupSourceFormat(remote, remote->echosource.get(), true);
+            remote->echosource->setup(getSampleRate(), currSamplesPerBlock, 1);
+        }
+        
+        remote->latencyDirty = true;
+    }
+}
 
+void SonobusAudioProcessor::setupRemotePeerOurSource(RemotePeer * remote)
+{
+    // assumed corelock already held, and the peer not sharing a source
+    // the audio thread looks at the channels from the first one on while the source changes
+    remote->sendEncodeOnset = 0;
 
-enum {
-    SONOBUS_MSGTYPE_UNKNOWN = 0,
-    SONOBUS_MSGTYPE_PEERINFO,
-    SONOBUS_MSGTYPE_LAYOUTINFO,
-    SONOBUS_MSGTYPE_CHAT,
-    SONOBUS_MSGTYPE_PING,
-    SONOBUS_MSGTYPE_PINGACK,
-    SONOBUS_MSGTYPE_REQLATINFO,
-    SONOBUS_MSGTYPE_LATINFO,
-    SONOBUS_MSGTYPE_SUGGESTLAT
-};
+    setupSourceFormat(remote, remote->oursource.get());
+    remote->oursource->setup(getSampleRate(), currSamplesPerBlock, remote->encodeSendChannels());
 
-static int32_t sonobusOscParsePattern(const char *msg, int32_t n, int32_t & rettype)
+    const int onset = remote->encodeSendOnset();
+    if (remote->remoteSinkId != AOO_ID_NONE) {
+        remote->oursource->set_sink_channelonset(remote->endpoint, remote->remoteSinkId, onset);
+    }
+    remote->sendEncodeOnset.store(onset, std::memory_order_release);
+}
+
+void SonobusAudioProcessor::resetRemotePeerSendSubscription(RemotePeer * remote)
 {
-    int32_t offset = 0;
-    if (n >= SONOBUS_MSG_DOMAIN_LEN
-        && !memcmp(msg, SONOBUS_MSG_DOMAIN, SONOBUS_MSG_DOMAIN_LEN))
-    {
-        offset += SONOBUS_MSG_DOMAIN_LEN;
+    // assumed corelock already held
+    const bool hadone = remote->hasSendSubscription();
+    remote->subscribedOnset = 0;
+    remote->subscribedChannels = -1;
 
-        if (n >= (offset + SONOBUS_MSG_PING_LEN)
-            && !memcmp(msg + offset, SONOBUS_MSG_PING, SONOBUS_MSG_PING_LEN))
-        {
-            rettype = SONOBUS_MSGTYPE_PING;
-            offset += SONOBUS_MSG_PING_LEN;
-            return offset;
-        }
-        else if (n >= (offset + SONOBUS_MSG_PINGACK_LEN)
-            && !memcmp(msg + offset, SONOBUS_MSG_PINGACK, SONOBUS_MSG_PINGACK_LEN))
-        {
-            rettype = SONOBUS_MSGTYPE_PINGACK;
-            offset += SONOBUS_MSG_PINGACK_LEN;
-            return offset;
+    if (hadone) {
+        ungroupSharedSend(remote);
+        setupRemotePeerOurSource(remote);
+    }
+    else if (remote->remoteSinkId != AOO_ID_NONE) {
+        remote->oursource->set_sink_channelonset(remote->endpoint, remote->remoteSinkId, 0);
+    }
+}
+
+void SonobusAudioProcessor::updateRemotePeerSubscription(RemotePeer * remote)
+{
+    // assumed corelock already held
+    // the span of the channel groups we don't have muted, all of them if that's everything.
+    // Individual tracks and packet archives record the muted ones too.
+    int onset = 0;
+    int count = -1;
+
+    if (remote->recvChannels > 2 && remote->numChanGroups > 1
+        && !userWritingPossible.load() && !mPacketArchiving.load()) {
+        int first = remote->recvChannels;
+        int last = 0;
+        for (int i=0; i < remote->numChanGroups && i < MAX_CHANGROUPS; ++i) {
+            const auto & params = remote->chanGroups[i].params;
+            if (params.muted) continue;
+            first = jmin(first, params.chanStartIndex);
+            last = jmax(last, params.chanStartIndex + params.numChannels);
         }
-        else if (n >= (offset + SONOBUS_MSG_PEERINFO_LEN)
-            && !memcmp(msg + offset, SONOBUS_MSG_PEERINFO, SONOBUS_MSG_PEERINFO_LEN))
-        {
-            rettype = SONOBUS_MSGTYPE_PEERINFO;
-            offset += SONOBUS_MSG_PEERINFO_LEN;
-            return offset;
+        last = jmin(last, remote->recvChannels);
+
+        if (last <= first) {
+            // all muted, a single channel keeps the stream going
+            count = 1;
         }
-        else if (n >= (offset + SONOBUS_MSG_LAYOUTINFO_LEN)
-            && !memcmp(msg + offset, SONOBUS_MSG_LAYOUTINFO, SONOBUS_MSG_LAYOUTINFO_LEN))
-        {
-            rettype = SONOBUS_MSGTYPE_LAYOUTINFO;
-            offset += SONOBUS_MSG_LAYOUTINFO_LEN;
-            return offset;
-        }
-        else if (n >= (offset + SONOBUS_MSG_CHAT_LEN)
-            && !memcmp(msg + offset, SONOBUS_MSG_CHAT, SONOBUS_MSG_CHAT_LEN))
-        {
-            rettype = SONOBUS_MSGTYPE_CHAT;
-            offset += SONOBUS_MSG_CHAT_LEN;
-            return offset;
-        }
-        else if (n >= (offset + SONOBUS_MSG_REQLATINFO_LEN)
-            && !memcmp(msg + offset, SONOBUS_MSG_REQLATINFO, SONOBUS_MSG_REQLATINFO_LEN))
-        {
-            rettype = SONOBUS_MSGTYPE_REQLATINFO;
-            offset += SONOBUS_MSG_REQLATINFO_LEN;
-            return offset;
-        }
-        else if (n >= (offset + SONOBUS_MSG_LATINFO_LEN)
-            && !memcmp(msg + offset, SONOBUS_MSG_LATINFO, SONOBUS_MSG_LATINFO_LEN))
-        {
-            rettype = SONOBUS_MSGTYPE_LATINFO;
-            offset += SONOBUS_MSG_LATINFO_LEN;
-            return offset;
-        }
-        else if (n >= (offset + SONOBUS_MSG_SUGGESTLAT_LEN)
-            && !memcmp(msg + offset, SONOBUS_MSG_SUGGESTLAT, SONOBUS_MSG_SUGGESTLAT_LEN))
-        {
-            rettype = SONOBUS_MSGTYPE_SUGGESTLAT;
-            offset += SONOBUS_MSG_SUGGESTLAT_LEN;
-            return offset;
-        }
-        else {
-            return 0;
+        else if (first > 0 || last < remote->recvChannels) {
+            onset = first;
+            count = last - first;
         }
     }
-    return 0;
-}
 
-bool SonobusAudioProcessor::handleOtherMessage(EndpointState * endpoint, const char *msg, int32_t n)
-{
-    // try to parse it as an OSC /sb  message
-    int32_t type = SONOBUS_MSGTYPE_UNKNOWN;
-    int32_t onset = 0;
+    if (onset == remote->recvSubscribedOnset && count == remote->recvSubscribedChannels) return;
 
-    if (! (onset = sonobusOscParsePattern(msg, n, type))) {
-        return false;
+    if (remote->oursink && remote->remoteSourceId != AOO_ID_NONE
+        && remote->oursink->request_source_subscription(remote->endpoint, remote->remoteSourceId, onset, count) > 0) {
+        DBG("Subscribing to " << count << " channels at " << onset << " of peer " << remote->ourId);
+        remote->recvSubscribedOnset = onset;
+        remote->recvSubscribedChannels = count;
     }
+}
 
-    try {
-        osc::ReceivedPacket packet(msg, n);
-        osc::ReceivedMessage message(packet);
-
-        if (type == SONOBUS_MSGTYPE_PING) {
-            // received from the other side
-            // args: t:origtime
-
-            auto it = message.ArgumentsBegin();
-            auto tt = (it++)->AsTimeTag();
+void SonobusAudioProcessor::updateRemotePeerSubscriptions()
+{
+    const ScopedReadLock sl (mCoreLock);
+    for (auto * remote : mRemotePeers) {
+        updateRemotePeerSubscription(remote);
+    }
+}
 
-            // now prepare and send ack immediately
-            auto tt2 = aoo_osctime_get(); // use real system time
+static double getFormatBytesPerSecond(const SonobusAudioProcessor::AudioCodecFormatInfo & info, int channels, double samplerate)
+{
+    if (info.codec == SonobusAudioProcessor::CodecOpus) {
+        return info.bitrate * channels / 8.0;
+    }
+    if (info.codec == SonobusAudioProcessor::CodecLossless) {
+        // what music typically compresses to in short blocks, the low bits of 24 bit are mostly noise
+        return samplerate * channels * info.bitdepth * (info.bitdepth > 2 ? 0.75 : 0.65);
+    }
+    return samplerate * channels * info.bitdepth;
+}
 
-            char buf[AOO_MAXPACKETSIZE];
-            osc::OutboundPacketStream outmsg(buf, sizeof(buf));
+// only for comparing formats
+static double getFormatRate(const SonobusAudioProcessor::AudioCodecFormatInfo & info)
+{
+    return getFormatBytesPerSecond(info, 1, 48000.0);
+}
 
-            try {
-                outmsg << osc::BeginMessage(SONOBUS_FULLMSG_PINGACK)
-                << osc::TimeTag(tt) << osc::TimeTag(tt2)
-                << osc::EndMessage;
-            }
-            catch (const osc::Exception& e){
-                DBG("exception in pingack message constructions: " << e.what());
-                return false;
+// The formats aren't sorted by their bandwidth (the lossless ones came last),
+// so the send rate control steps to the next cheaper or dearer one instead of
+// the neighbour in the list. Going up stops at the user's choice.
+static int getNextFormatIndex(const Array<SonobusAudioProcessor::AudioCodecFormatInfo> & formats, int current, int userindex, bool up)
+{
+    auto rate = [&formats] (int i) { return getFormatRate(formats.getReference(i)); };
+    const double currate = rate(current);
+    const double maxrate = rate(userindex);
+    int next = -1;
+    for (int i = 0; i < formats.size(); ++i) {
+        const double r = rate(i);
+        if (up) {
+            if (r > currate && r <= maxrate
+                && (next < 0 || r < rate(next) || (r == rate(next) && i == userindex))) {
+                next = i;
             }
-
-            endpoint_send(endpoint, outmsg.Data(), (int) outmsg.Size());
-
-            DBG("Received ping from " << endpoint->ipaddr << ":" << endpoint->port << "  stamp: " << tt);
-
         }
-        else if (type == SONOBUS_MSGTYPE_PINGACK) {
-            // received from the other side
-            // args: t:origtime t:theirtime
-
-            auto it = message.ArgumentsBegin();
-            auto tt = (it++)->AsTimeTag();
-            auto tt2 = (it++)->AsTimeTag();
-            auto tt3 = aoo_osctime_get(); // use real system time
-
-            handlePingEvent(endpoint, tt, tt2, tt3); // jlc
-
+        else if (r < currate && (next < 0 || r > rate(next))) {
+            next = i;
         }
-        else if (type == SONOBUS_MSGTYPE_PEERINFO) {
-            // peerinfo message arguments:
-            // blob containing JSON
-            auto it = message.ArgumentsBegin();
-
-            const void *infojson;
-            osc::osc_bundle_element_size_t size;
+    }
+    return next;
+}
 
-            (it++)->AsBlob(infojson, size);
+int SonobusAudioProcessor::getEffectiveSendFormatIndex(const RemotePeer * peer) const
+{
+    int formatIndex = (!peer || peer->formatIndex < 0) ? mDefaultAudioFormatIndex : peer->formatIndex;
+    if (peer && isPositiveAndBelow(peer->adaptedFormatIndex, mAudioFormats.size()) && isPositiveAndBelow(formatIndex, mAudioFormats.size())
+        && getFormatRate(mAudioFormats.getReference(peer->adaptedFormatIndex)) < getFormatRate(mAudioFormats.getReference(formatIndex))) {
+        formatIndex = peer->adaptedFormatIndex;
+        if (mSimulcastSending.load() && getFormatRate(mAudioFormats.getReference(mSimulcastLowFormatIndex)) < getFormatRate(mAudioFormats.getReference(formatIndex))) {
+            // stepped down peers all get the one low tier, so they can share its encode
+            formatIndex = mSimulcastLowFormatIndex;
+        }
+    }
+    if (formatIndex < 0 || formatIndex >= mAudioFormats.size()) formatIndex = 4; //emergency default
+    return formatIndex;
+}
 
-            String jsonstr = String::createStringFromData(infojson, size);
+void SonobusAudioProcessor::setAdaptiveSendBitrate(bool flag)
+{
+    mAdaptiveSendBitrate = flag;
 
-            juce::var infodata;
-            auto result = juce::JSON::parse(jsonstr, infodata);
-            if (result.failed()) {
-                DBG("Peerinfo Json parsing failed: " << result.getErrorMessage());
-                return false;
+    if (!flag) {
+        // back to what the user chose
+        const ScopedReadLock sl (mCoreLock);
+        for (auto * remote : mRemotePeers) {
+            if (remote->adaptedFormatIndex >= 0) {
+                remote->adaptedFormatIndex = -1;
+                applyRemotePeerSendFormat(remote);
             }
-
-            {
-                const ScopedReadLock sl (mCoreLock);
-
-                // find remote peer
-                RemotePeer * peer = findRemotePeer(endpoint, -1);
-                if (!peer) {
-                    DBG("Could not find peer for endpoint");
-                    return false;
-                }
-
-                handleRemotePeerInfoUpdate(peer, infodata);
+            else {
+                resetSendRateControl(remote);
             }
-
         }
-        else if (type == SONOBUS_MSGTYPE_LAYOUTINFO) {
-            // layout info message arguments:
-            // i:sourceid  b:<blob containing valuetree in binary form>
-            auto it = message.ArgumentsBegin();
-            auto sourceid = (it++)->AsInt32();
+    }
+}
 
-            const void *info;
-            osc::osc_bundle_element_size_t size;
+void SonobusAudioProcessor::setAdaptiveFrameSize(bool flag)
+{
+    mAdaptiveFrameSize = flag;
 
-            (it++)->AsBlob(info, size);
-            // jlc
+    if (!flag) {
+        // back to the frame size of the format
+        const ScopedReadLock sl (mCoreLock);
+        for (auto * remote : mRemotePeers) {
+            remote->pendingFrameMs = 0.0f;
+            if (remote->adaptedFrameMs > 0.0f) {
+                remote->adaptedFrameMs = 0.0f;
+                applyRemotePeerSendFormat(remote);
+            }
+        }
+    }
+}
 
-            ValueTree tree = ValueTree::readFromData (info, size);
+float SonobusAudioProcessor::chooseSendFrameMs(const RemotePeer * peer, const AudioCodecFormatInfo & info) const
+{
+    const double samplerate = getSampleRate();
+    if (samplerate <= 0.0) return 0.0f;
 
-            if (!tree.isValid()) {
-                DBG("layoutinfo parsing failed ");
-                return false;
-            }
-            else {
-                DBG("Got layoutinfo");
-            }
+    // what the format gets anyway, Opus rounds it down to 2.5 ms times a power of two
+    const int blocksize = jmax(currSamplesPerBlock, info.min_preferred_blocksize);
+    double basems = 2.5;
+    while (basems * 2.0 * samplerate * 1e-3 <= blocksize && basems < 20.0) {
+        basems *= 2.0;
+    }
 
-            bool changed = false;
+    // what they hear of us anyway is half the round trip plus their jitter buffer,
+    // the longer frames may add a small part of that
+    const double latencyms = peer->smoothPingTime.xbar * 0.5 + peer->remoteJitterBufMs;
+    const double allowedms = SENDFRAME_LATENCY_FRACTION * latencyms;
 
-            {
-                const ScopedReadLock sl (mCoreLock);
+    double framems = basems;
+    while (framems < 20.0 && framems * 2.0 - basems <= allowedms) {
+        framems *= 2.0;
+    }
+    return framems > basems ? (float) framems : 0.0f;
+}
 
-                // find remote peer
-                RemotePeer * peer = findRemotePeer(endpoint, sourceid);
-                if (!peer) {
-                    DBG("Could not find peer for endpoint: " << endpoint->ipaddr << "src: " <<  sourceid);
-                }
-                else {
-                    peer->recvdChanLayout = true;
-                    applyLayoutFormatToPeer(peer, tree);
-                    changed = true;
-                }
-            }
+// called with every ping reply of the sink we send to, like updateSendRateControl()
+void SonobusAudioProcessor::updateSendFrameSize(RemotePeer * peer)
+{
+    // assumed corelock (read) already held
+    if (!mAdaptiveFrameSize.load() || !peer->sendActive || !peer->hasRemoteInfo || !peer->oursource) return;
 
-            if (changed) {
-                clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientPeerChangedState, this, "format");
-            }
+    const AudioCodecFormatInfo & info = mAudioFormats.getReference(getEffectiveSendFormatIndex(peer));
+    const float target = info.codec == CodecOpus ? chooseSendFrameMs(peer, info) : 0.0f;
 
+    if (target == peer->adaptedFrameMs) {
+        peer->pendingFrameMs = target;
+        return;
+    }
 
-        }
-        else if (type == SONOBUS_MSGTYPE_CHAT) {
-            // layout info message arguments:
-            // s:groupname s:from s:targets s:tags s:message
-            auto it = message.ArgumentsBegin();
+    const double nowms = Time::getMillisecondCounterHiRes();
+    if (target != peer->pendingFrameMs) {
+        peer->pendingFrameMs = target;
+        peer->pendingFrameSinceMs = nowms;
+        return;
+    }
 
-            String group (CharPointer_UTF8((it++)->AsString()));
-            String from (CharPointer_UTF8((it++)->AsString()));
-            String targets (CharPointer_UTF8((it++)->AsString()));
-            String tags (CharPointer_UTF8((it++)->AsString()));
-            String message (CharPointer_UTF8((it++)->AsString()));
+    // a new frame size means a new format for their sink, so only for a lasting change
+    if (nowms - peer->pendingFrameSinceMs < SENDFRAME_HOLD_MS) return;
 
-            SBChatEvent chatevent(SBChatEvent::UserType, group, from, targets, tags, message);
-            mAllChatEvents.add(chatevent);
-            clientListeners.call(&SonobusAudioProcessor::ClientListener::sbChatEventReceived, this, chatevent);
+    DBG("Send frame size: peer " << peer->ourId << " from " << peer->adaptedFrameMs << " to " << target << " ms");
+    peer->adaptedFrameMs = target;
+    applyRemotePeerSendFormat(peer);
+}
 
+void SonobusAudioProcessor::resetSendRateControl(RemotePeer * peer)
+{
+    const AudioCodecFormatInfo & info = mAudioFormats.getReference(getEffectiveSendFormatIndex(peer));
 
+    if (info.codec == CodecOpus) {
+        // the live bitrate can go down to the cheapest Opus format
+        int floorrate = info.bitrate;
+        for (const auto & format : mAudioFormats) {
+            if (format.codec == CodecOpus) floorrate = jmin(floorrate, format.bitrate);
         }
-        else if (type == SONOBUS_MSGTYPE_REQLATINFO) {
-            // received from the other side
-            // args: none
+        peer->sendRate.reset(info.bitrate, floorrate);
+    }
+    else {
+        // no control over the bitrate, only stepping down the format helps
+        const int pcmrate = (int) (getSampleRate() * info.bitdepth * 8);
+        peer->sendRate.reset(pcmrate, pcmrate);
+    }
 
-            auto latinfo = getAllLatInfo();
+    peer->appliedSendBitrate = 0;
+    if (peer->oursource) {
+        peer->oursource->set_bitrate(0);
+    }
+}
 
-            char buf[AOO_MAXPACKETSIZE];
-            osc::OutboundPacketStream outmsg(buf, sizeof(buf));
+// called with every ping reply of the sink we send to (or of the
+// sink of a follower, if we are sharing a source).
+void SonobusAudioProcessor::updateSendRateControl(RemotePeer * peer, float rttMs, int32_t lostBlocks)
+{
+    // assumed corelock (read) already held
+    if (!mAdaptiveSendBitrate.load() || !peer->sendActive) return;
 
-            String jsonstr = JSON::toString(latinfo, true, 6);
+    const double nowms = Time::getMillisecondCounterHiRes();
+    const int current = getEffectiveSendFormatIndex(peer);
+    const AudioCodecFormatInfo & info = mAudioFormats.getReference(current);
 
-            if (jsonstr.getNumBytesAsUTF8() > AOO_MAXPACKETSIZE - 100) {
-                DBG("Info too big for packet!");
-                return false;
-            }
+    // the sink reports the lost blocks of the last ping interval
+    const int blocksize = jmax(currSamplesPerBlock, info.min_preferred_blocksize);
+    const double nblocks = blocksize > 0 ? SOURCE_PING_INTERVAL_MS * 1e-3 * getSampleRate() / blocksize : 0.0;
+    const float loss = nblocks > 0.0 ? (float) jmin(100.0, 100.0 * lostBlocks / nblocks) : 0.0f;
 
+    peer->sendRate.update(nowms, rttMs, loss);
 
-            try {
-                outmsg << osc::BeginMessage(SONOBUS_FULLMSG_LATINFO)
-                << osc::Blob(jsonstr.toRawUTF8(), (int) jsonstr.getNumBytesAsUTF8())
-                << osc::EndMessage;
-            }
-            catch (const osc::Exception& e){
-                DBG("exception in reqlat message constructions: " << e.what());
-                return false;
-            }
+    const int userindex = (peer->formatIndex < 0) ? mDefaultAudioFormatIndex : peer->formatIndex;
+    int newindex = current;
 
-            endpoint_send(endpoint, outmsg.Data(), (int) outmsg.Size());
+    int cheaper = getNextFormatIndex(mAudioFormats, current, userindex, false);
+    int dearer = current != userindex ? getNextFormatIndex(mAudioFormats, current, userindex, true) : -1;
 
-            DBG("Received REQLAT from " << endpoint->ipaddr << ":" << endpoint->port);
+    if (mSimulcastSending.load()) {
+        // only two tiers, below the low one the live Opus bitrate has to do
+        const bool lowcheaper = getFormatRate(mAudioFormats.getReference(mSimulcastLowFormatIndex)) < getFormatRate(mAudioFormats.getReference(current));
+        cheaper = current == userindex && lowcheaper ? mSimulcastLowFormatIndex : -1;
+        dearer = current != userindex ? userindex : -1;
+    }
 
+    if (peer->sendRate.isOverloaded() && cheaper >= 0) {
+        newindex = cheaper;
+        if (nowms - peer->lastFormatStepUpMs < 2.0 * peer->formatStepUpWaitMs) {
+            // the last step up was too much, wait longer next time
+            peer->formatStepUpWaitMs = jmin(SENDRATE_STEPUP_WAIT_MAX_MS, 2.0 * peer->formatStepUpWaitMs);
         }
-        else if (type == SONOBUS_MSGTYPE_LATINFO) {
-            // peerinfo message arguments:
-            // blob containing JSON
-            auto it = message.ArgumentsBegin();
-
-            const void *infojson;
-            osc::osc_bundle_element_size_t size;
+    }
+    else if (dearer >= 0 && peer->sendRate.getClearTimeMs(nowms) > peer->formatStepUpWaitMs
+             && !peer->budgetLimited && fitsCodecBudget(peer, current, dearer)) {
+        newindex = dearer;
+        peer->lastFormatStepUpMs = nowms;
+    }
 
-            (it++)->AsBlob(infojson, size);
+    if (newindex != current) {
+        DBG("Send rate control: peer " << peer->ourId << " steps from format " << current << " to " << newindex);
+        peer->adaptedFormatIndex = newindex != userindex ? newindex : -1;
+        // the link has it now
+        peer->budgetLimited = false;
+        // also resets the rate control for the new format
+        applyRemotePeerSendFormat(peer);
+        return;
+    }
 
-            String jsonstr = String::createStringFromData(infojson, size);
+    auto * owner = peer->sendLeader.load();
+    applySendBitrate(owner ? owner : peer);
+}
 
-            juce::var infodata;
-            auto result = juce::JSON::parse(jsonstr, infodata);
-            if (result.failed()) {
-                DBG("Peerinfo Json parsing failed: " << result.getErrorMessage());
-                return false;
-            }
+void SonobusAudioProcessor::applySendBitrate(RemotePeer * owner)
+{
+    // assumed corelock (read) already held
+    if (!owner->oursource) return;
 
-            handleLatInfo(infodata);
+    const AudioCodecFormatInfo & info = mAudioFormats.getReference(getEffectiveSendFormatIndex(owner));
+    if (info.codec != CodecOpus) return;
 
+    // a shared source has to fit the worst link among its sinks
+    int target = owner->sendRate.getTargetBitrate();
+    if (owner->sendFollowers > 0) {
+        for (auto * remote : mRemotePeers) {
+            if (remote->sendLeader.load() == owner) {
+                target = jmin(target, remote->sendRate.getTargetBitrate());
+            }
         }
-        else if (type == SONOBUS_MSGTYPE_SUGGESTLAT) {
-            // received from the other side
-            // args: s:username  f:latency
-
-            auto it = message.ArgumentsBegin();
-            auto username = (it++)->AsString();
-            auto latency = (it++)->AsFloat();
+    }
 
-            clientListeners.call(&SonobusAudioProcessor::ClientListener::peerRequestedLatencyMatch, this, username, latency);
-        }
-        return true;
-    } catch (const osc::Exception& e){
-        DBG("exception in handleOtherMessage: " << e.what());
+    const int bitrate = target >= info.bitrate ? 0 : target * jmax(1, owner->encodeSendChannels());
+    // don't bother the encoder with tiny changes
+    if (bitrate != owner->appliedSendBitrate
+        && (bitrate == 0 || owner->appliedSendBitrate == 0 || std::abs(bitrate - owner->appliedSendBitrate) * 20 > owner->appliedSendBitrate)) {
+        DBG("Send rate control: peer " << owner->ourId << " bitrate " << bitrate);
+        owner->oursource->set_bitrate(bitrate);
+        owner->appliedSendBitrate = bitrate;
     }
-    return false;
 }
 
+int SonobusAudioProcessor::getRemotePeerAudioCodecFormat(int index) const
+{
+    if (index >= mRemotePeers.size()) return -1;
+    
+    const ScopedReadLock sl (mCoreLock);        
+    auto remote = mRemotePeers.getUnchecked(index);
+    return remote->formatIndex;
+}
 
-bool SonobusAudioProcessor::sendChatEvent(const SBChatEvent & event)
+bool SonobusAudioProcessor::getRemotePeerReceiveAudioCodecFormat(int index, AudioCodecFormatInfo & retinfo) const
 {
-    // /sb/chat s:groupname s:from s:targets s:tags s:message
+    if (index >= mRemotePeers.size()) return false;
+    
+    const ScopedReadLock sl (mCoreLock);
+    auto remote = mRemotePeers.getUnchecked(index);
+    retinfo = remote->recvFormat;
+    return true;
+}
 
-    // if peerindex < 0 - send to all peers
-    char buf[AOO_MAXPACKETSIZE];
-    osc::OutboundPacketStream msg(buf, sizeof(buf));
+bool SonobusAudioProcessor::setRequestRemotePeerSendAudioCodecFormat(int index, int formatIndex)
+{
+    if (formatIndex >= mAudioFormats.size() || index >= mRemotePeers.size()) return false;
+    
 
-    try {
+    const ScopedReadLock sl (mCoreLock);
+    auto remote = mRemotePeers.getUnchecked(index);
 
-        msg << osc::BeginMessage(SONOBUS_FULLMSG_CHAT)
-        << event.group.toRawUTF8()
-        << event.from.toRawUTF8()
-        << event.targets.toRawUTF8()
-        << event.tags.toRawUTF8()
-        << event.message.toRawUTF8()
-        << osc::EndMessage;
+    aoo_format_storage fmt;
+    
+    
+    if (formatIndex >= 0) {
+        const AudioCodecFormatInfo & info = mAudioFormats.getReference(formatIndex);
 
+        if (formatInfoToAooFormat(info, remote->recvChannels, fmt)) {
+            remote->oursink->request_source_codec_change(remote->endpoint, remote->remoteSourceId, fmt.header);
+
+            remote->reqRemoteSendFormatIndex = formatIndex; 
+            return true;
+        }
+        else {
+            return false;
+        }
+    } else {
+        remote->reqRemoteSendFormatIndex = -1; // no preference
+        return true;
     }
-    catch (const osc::Exception& e){
-        DBG("exception in chat message constructions: " << e.what());
-        return false;
-    }
+}
 
-    StringArray targetnames = StringArray::fromTokens(event.targets, "|", "");
+int SonobusAudioProcessor::getRequestRemotePeerSendAudioCodecFormat(int index) const
+{
+    if (index >= mRemotePeers.size()) return -1;
+    
+    const ScopedReadLock sl (mCoreLock);
+    auto remote = mRemotePeers.getUnchecked(index);
 
+    return remote->reqRemoteSendFormatIndex;    
+}
 
+int SonobusAudioProcessor::getRemotePeerOrderPriority(int index) const
+{
+    if (index >= mRemotePeers.size()) return -1;
     const ScopedReadLock sl (mCoreLock);
-    for (int i=0;  i < mRemotePeers.size(); ++i) {
-        auto * peer = mRemotePeers.getUnchecked(i);
-
-        if (!targetnames.isEmpty() && !targetnames.contains(peer->userName))
-            continue;
+    auto remote = mRemotePeers.getUnchecked(index);
+    return remote->orderPriority;
+}
 
-        DBG("Sending chat message to " << i);
-        this->sendPeerMessage(peer, msg.Data(), (int32_t) msg.Size());
+void SonobusAudioProcessor::setRemotePeerOrderPriority(int index, int priority)
+{
+    if (index >= mRemotePeers.size()) return;
 
-    }
+    const ScopedReadLock sl (mCoreLock);
 
-    return true;
+    auto remote = mRemotePeers.getUnchecked(index);
+    remote->orderPriority = priority;
 }
 
-void SonobusAudioProcessor::handleLatInfo(const juce::var & infolist)
-{
-    const ScopedLock sl (mLatInfoLock);
-
-    // received a latinfo list from elsewhere, add it to our list
-    // todo remove any duplicates
 
-    if (!infolist.isArray()) return;
+int SonobusAudioProcessor::getRemotePeerSendPacketsize(int index) const
+{
+    if (index >= mRemotePeers.size()) return -1;
+    const ScopedReadLock sl (mCoreLock);        
+    auto remote = mRemotePeers.getUnchecked(index);
+    return remote->packetsize;
+}
 
-    for (int i=0; i < infolist.size(); ++i) {
-        auto infodata = infolist[i];
+void SonobusAudioProcessor::setRemotePeerSendPacketsize(int index, int psize)
+{
+    if (index >= mRemotePeers.size()) return;
+    
+    const ScopedReadLock sl (mCoreLock);        
 
-        LatInfo latinfo;
-        latinfo.sourceName = infodata.getProperty("srcname", "");
-        latinfo.destName = infodata.getProperty("destname", "");
-        latinfo.latencyMs = infodata.getProperty("latms", 0.0f);
+    DBG("Setting packet size to " << psize);
+    
+    auto remote = mRemotePeers.getUnchecked(index);
+    remote->packetsize = psize;
+    ungroupSharedSend(remote);
+    
+    if (remote->oursource) {
+        //setupSourceFormat(remote, remote->oursource.get());
 
-        if (latinfo.sourceName.isNotEmpty() && latinfo.destName.isNotEmpty()) {
-            mLatInfoList.add(latinfo);
-        }
+        //remote->oursource->setup(getSampleRate(), remote->packetsize, getTotalNumInputChannels());
 
-        DBG("latinfo: srcname: " << latinfo.sourceName << "  dest: " << latinfo.destName << "  latms: " << latinfo.latencyMs);
+        remote->oursource->set_packetsize(remote->sendPacketsize());
+        remote->filestreamsource->set_packetsize(remote->sendPacketsize());
     }
+    
 }
 
-juce::var SonobusAudioProcessor::getAllLatInfo()
+void SonobusAudioProcessor::setRemotePeerCompressorParams(int index, int changroup, CompressorParams & params)
 {
-    juce::var infolist;
+    if (index >= mRemotePeers.size()) return;
+    
+    const ScopedReadLock sl (mCoreLock);        
 
-    const ScopedReadLock sl (mCoreLock);
+    auto remote = mRemotePeers.getUnchecked(index);
 
-    for (int i=0;  i < mRemotePeers.size(); ++i) {
-        auto * peer = mRemotePeers.getUnchecked(i);
-        if (!peer) continue;
-        DynamicObject::Ptr item = new DynamicObject(); // this will delete itself
-        LatencyInfo latinfo;
-        getRemotePeerLatencyInfo(i, latinfo);
+    // sanity check and compute automakeupgain if necessary    
+    params.ratio = jlimit(1.0f, 120.0f, params.ratio);
+    if (params.automakeupGain) {
+        // makeupgain = (-thresh -  abs(thresh/ratio))/2
+        params.makeupGainDb = (-params.thresholdDb - abs(params.thresholdDb/params.ratio)) * 0.5f;
+    }
 
-        item->setProperty("srcname", peer->userName);
-        item->setProperty("destname", mCurrentUsername);
-        item->setProperty("latms", latinfo.incomingMs);
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        remote->chanGroups[changroup].params.compressorParams = params;
+        remote->chanGroups[changroup].commitCompressorParams();
+    }
+}
 
-        infolist.append(item.get());
+bool SonobusAudioProcessor::getRemotePeerCompressorParams(int index, int changroup, CompressorParams & retparams)
+{
+    if (index >= mRemotePeers.size()) return false;
+    const ScopedReadLock sl (mCoreLock);        
+    auto remote = mRemotePeers.getUnchecked(index);
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        retparams = remote->chanGroups[changroup].params.compressorParams;
+        return true;
     }
+    return false;
 
-    return infolist;
 }
 
-void SonobusAudioProcessor::sendReqLatInfoToAll()
+void SonobusAudioProcessor::setRemotePeerExpanderParams(int index, int changroup, SonoAudio::CompressorParams & params)
 {
-    char buf[AOO_MAXPACKETSIZE];
-    osc::OutboundPacketStream msg(buf, sizeof(buf));
+    if (index >= mRemotePeers.size()) return;
 
-    try {
+    const ScopedReadLock sl (mCoreLock);
 
-        msg << osc::BeginMessage(SONOBUS_FULLMSG_REQLATINFO)
-        << osc::EndMessage;
+    auto remote = mRemotePeers.getUnchecked(index);
 
+    // sanity check and compute automakeupgain if necessary
+    params.ratio = jlimit(1.0f, 120.0f, params.ratio);
+
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        remote->chanGroups[changroup].params.expanderParams = params;
+        remote->chanGroups[changroup].commitExpanderParams();
     }
-    catch (const osc::Exception& e){
-        DBG("exception in reqlat message constructions: " << e.what());
-        return;
-    }
+}
 
+bool SonobusAudioProcessor::getRemotePeerExpanderParams(int index, int changroup, SonoAudio::CompressorParams & retparams)\
+{
+    if (index >= mRemotePeers.size()) return false;
     const ScopedReadLock sl (mCoreLock);
-    for (int i=0;  i < mRemotePeers.size(); ++i) {
-        auto * peer = mRemotePeers.getUnchecked(i);
-
-        DBG("Sending reqlat message to " << i);
-        this->sendPeerMessage(peer, msg.Data(), (int32_t) msg.Size());
+    auto remote = mRemotePeers.getUnchecked(index);
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        retparams = remote->chanGroups[changroup].params.expanderParams;
+        return true;
     }
+    return false;
 }
 
-void SonobusAudioProcessor::sendLatencyMatchToAll(float latency)
+void SonobusAudioProcessor::setRemotePeerEqParams(int index, int changroup, SonoAudio::ParametricEqParams & params)
 {
-    // suggest to all that they should adjust all receiving latencies to be this value
-
-    char buf[AOO_MAXPACKETSIZE];
-    osc::OutboundPacketStream msg(buf, sizeof(buf));
+    if (index >= mRemotePeers.size()) return;
 
-    try {
+    const ScopedReadLock sl (mCoreLock);
 
-        msg << osc::BeginMessage(SONOBUS_FULLMSG_SUGGESTLAT)
-        << mCurrentUsername.toRawUTF8()
-        << latency
-        << osc::EndMessage;
+    auto remote = mRemotePeers.getUnchecked(index);
 
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        remote->chanGroups[changroup].params.eqParams = params;
+        remote->chanGroups[changroup].commitEqParams();
     }
-    catch (const osc::Exception& e){
-        DBG("exception in suggestlat message constructions: " << e.what());
-        return;
-    }
+}
 
+bool SonobusAudioProcessor::getRemotePeerEqParams(int index, int changroup, SonoAudio::ParametricEqParams & retparams)
+{
+    if (index >= mRemotePeers.size()) return false;
     const ScopedReadLock sl (mCoreLock);
-    for (int i=0;  i < mRemotePeers.size(); ++i) {
-        auto * peer = mRemotePeers.getUnchecked(i);
+    auto remote = mRemotePeers.getUnchecked(index);
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        retparams = remote->chanGroups[changroup].params.eqParams;
+        return true;
+    }
+    return false;
+}
 
-        DBG("Sending suggestlat: " << latency << " message to " << i);
-        this->sendPeerMessage(peer, msg.Data(), (int32_t) msg.Size());
+bool SonobusAudioProcessor::getRemotePeerEffectsActive(int index, int changroup)
+{
+    if (index >= mRemotePeers.size()) return false;
+    const ScopedReadLock sl (mCoreLock);
+    auto remote = mRemotePeers.getUnchecked(index);
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        return remote->chanGroups[changroup].params.compressorParams.enabled || remote->chanGroups[changroup].params.expanderParams.enabled || remote->chanGroups[changroup].params.eqParams.enabled || remote->chanGroups[changroup].params.invertPolarity;
     }
+    return false;
+
 
 }
 
 
-void SonobusAudioProcessor::beginLatencyMatchProcedure()
+void SonobusAudioProcessor::setMetronomeMonitorDelayParams(SonoAudio::DelayParams & params)
 {
-    {
-        const ScopedLock sl (mLatInfoLock);
-        mLatInfoList.clearQuick();
+    mMetChannelGroup.params.monitorDelayParams = params;
+    //mInputChannelGroups[changroup].monitorDelayParamsChanged = true;
+    // commit them now
+    mMetChannelGroup.commitMonitorDelayParams();
 
-        // add our own info
-        handleLatInfo(getAllLatInfo());
-    }
+    mRecMetChannelGroup.params.monitorDelayParams = params;
+    mRecMetChannelGroup.commitMonitorDelayParams();
+}
 
-    sendReqLatInfoToAll();
+bool SonobusAudioProcessor::getMetronomeMonitorDelayParams(SonoAudio::DelayParams & retparams)
+{
+    retparams = mMetChannelGroup.params.monitorDelayParams;
+    return true;
 }
 
-bool SonobusAudioProcessor::isLatencyMatchProcedureReady()
+void SonobusAudioProcessor::setMetronomeChannelDestStartAndCount(int start, int count)
 {
-    // we expect an entry for every directional path in the mesh
-    const ScopedLock sl (mLatInfoLock);
-    int totpeers = mRemotePeers.size() + 1;
-    int predictedSize =  (totpeers*(totpeers - 1));
+    mMetChannelGroup.params.monDestStartIndex = start;
+    mMetChannelGroup.params.monDestChannels = std::max(1, std::min(count, MAX_CHANNELS));
+    mMetChannelGroup.commitMonitorDelayParams(); // need to do this too
 
-    return mLatInfoList.size() >= predictedSize;
+    mRecMetChannelGroup.params.monDestStartIndex = start;
+    mRecMetChannelGroup.params.monDestChannels = std::max(1, std::min(count, MAX_CHANNELS));
+    mRecMetChannelGroup.commitMonitorDelayParams(); // need to do this too
 }
 
-void SonobusAudioProcessor::getLatencyInfoList(Array<LatInfo> & retlist)
+bool SonobusAudioProcessor::getMetronomeChannelDestStartAndCount(int & retstart, int & retcount)
 {
-    const ScopedLock sl (mLatInfoLock);
-    retlist.addArray(mLatInfoList);
+    retstart = mMetChannelGroup.params.monDestStartIndex;
+    retcount = mMetChannelGroup.params.monDestChannels;
+    return true;
 }
 
-void SonobusAudioProcessor::commitLatencyMatch(float latency)
-{
-    // Adjust the jitter buffer for each peer with extra values to pad up to the requested latency
 
-    const ScopedReadLock sl (mCoreLock);
-    for (int i=0;  i < mRemotePeers.size(); ++i) {
-        auto * peer = mRemotePeers.getUnchecked(i);
+void SonobusAudioProcessor::setMetronomePan(float pan)
+{
+    mMetChannelGroup.params.pan[0] = pan;
+    mRecMetChannelGroup.params.pan[0] = pan;
+}
 
-        float pingms= peer->smoothPingTime.xbar;
-        const auto absizeMs = 1e3*currSamplesPerBlock/getSampleRate();
-        float basebuftimeMs = jmax((double) (peer->netBufAutoBaseline > 0.0 ? peer->netBufAutoBaseline : peer->buffertimeMs), absizeMs);
-        auto halfping = pingms*0.5f;
-        auto recvcodecLat = peer->recvFormat.codec == CodecOpus ? 2.5f : 0.0f; // Opus adds codec latency
+float SonobusAudioProcessor::getMetronomePan() const
+{
+    return mMetChannelGroup.params.pan[0];
+}
 
-        auto baseline = /*absizeMs + */ recvcodecLat +  peer->remoteInLatMs + halfping + basebuftimeMs;
+void SonobusAudioProcessor::setMetronomeGain(float gain)
+{
+    mState.getParameter(paramMetGain)->setValueNotifyingHost(mState.getParameter(paramMetGain)->convertTo0to1(gain));
+}
 
-        if (baseline < latency) {
-            // we can add some padding
-            auto padms =  (latency - baseline);
-            auto newbuftime = basebuftimeMs + padms;
-            DBG("Adding " << padms << " ms of padding for peer: " << i);
-            setRemotePeerBufferTime(i, newbuftime);
-            // now set the auto baseline
-        }
-        peer->latencyMatched = true;
-
-    }
+float SonobusAudioProcessor::getMetronomeGain() const
+{
+    return mMetGain.get();
 }
 
-
-
-void SonobusAudioProcessor::handleRemotePeerInfoUpdate(RemotePeer * peer, const juce::var & infodata)
+void SonobusAudioProcessor::setMetronomeMonitor(float mgain)
 {
-    // core read lock already held
-
-    // infodata should contain useful info
-
-    DBG("peerinfo: Handle remote peerinfo update ");
-
-    if (infodata.hasProperty("jitbuf")) {
-        float jitbufms = infodata.getProperty("jitbuf", 0.0f);
-        DBG("peerinfo: Got remote jitter buffer: " << jitbufms);
-        peer->remoteJitterBufMs = jitbufms;
-    }
-    if (infodata.hasProperty("inlat")) {
-        float latms = infodata.getProperty("inlat", 0.0f);
-        DBG("peerinfo: Got remote input latency: " << latms);
-        peer->remoteInLatMs = latms;
-    }
-    if (infodata.hasProperty("outlat")) {
-        float latms = infodata.getProperty("outlat", 0.0f);
-        DBG("peerinfo: Got remote input latency: " << latms);
-        peer->remoteOutLatMs = latms;
-    }
-    if (infodata.hasProperty("nettype")) {
-        int nettype = infodata.getProperty("nettype", (int) RemoteNetTypeUnknown);
-        DBG("peerinfo: Got remote net type: " << nettype);
-        peer->remoteNetType = nettype;
-    }
-    if (infodata.hasProperty("rec")) {
-        bool isrec = infodata.getProperty("rec", false);
-        DBG("peerinfo: Got remote recording: " << (int)isrec);
-        peer->remoteIsRecording = isrec;
-    }
-
-    peer->hasRemoteInfo = true;
-
+    mMetChannelGroup.params.monitor = mgain;
 }
 
-void SonobusAudioProcessor::sendRemotePeerInfoUpdate(int index, RemotePeer * topeer)
+float SonobusAudioProcessor::getMetronomeMonitor() const
 {
-    // send our info to this remote peer
-    DynamicObject::Ptr info = new DynamicObject(); // this will delete itself
-
-    // not great, better than nothing - TODO make this accurate
-    info->setProperty("inlat", 1e3 * currSamplesPerBlock / getSampleRate());
-    info->setProperty("outlat", 1e3 * currSamplesPerBlock / getSampleRate());
-    info->setProperty("rec", isRecordingToFile());
-
-    // nettype TODO
-
-    char buf[AOO_MAXPACKETSIZE];
-
-    const ScopedReadLock sl (mCoreLock);
-    for (int i=0;  i < mRemotePeers.size(); ++i) {
-        auto * peer = mRemotePeers.getUnchecked(i);
-        if (topeer && topeer != peer) continue;
-        if (index >= 0 && index != i) continue;
+    return mMetChannelGroup.params.monitor;
+}
 
-        osc::OutboundPacketStream msg(buf, sizeof(buf));
 
-        auto buftimeMs = jmax((double)peer->buffertimeMs, 1e3 * currSamplesPerBlock / getSampleRate());
-        info->setProperty("jitbuf", buftimeMs);
 
-        String jsonstr = JSON::toString(info.get(), true, 6);
+void SonobusAudioProcessor::setFilePlaybackMonitorDelayParams(SonoAudio::DelayParams & params)
+{
+    mFilePlaybackChannelGroup.params.monitorDelayParams = params;
+    //mInputChannelGroups[changroup].monitorDelayParamsChanged = true;
+    // commit them now
+    mFilePlaybackChannelGroup.commitMonitorDelayParams();
 
-        if (jsonstr.getNumBytesAsUTF8() > AOO_MAXPACKETSIZE - 100) {
-            DBG("Info too big for packet!");
-            return;
-        }
+    mRecFilePlaybackChannelGroup.params.monitorDelayParams = params;
+    mRecFilePlaybackChannelGroup.commitMonitorDelayParams();
 
-        try {
-            msg << osc::BeginMessage(SONOBUS_FULLMSG_PEERINFO)
-            << osc::Blob(jsonstr.toRawUTF8(), (int) jsonstr.getNumBytesAsUTF8())
-            << osc::EndMessage;
-        }
-        catch (const osc::Exception& e){
-            DBG("exception in PEERINFO message constructions: " << e.what());
-            continue;
-        }
+}
 
-        DBG("Sending peerinfo message to " << i);
-        this->sendPeerMessage(peer, msg.Data(), (int32_t) msg.Size());
+bool SonobusAudioProcessor::getFilePlaybackMonitorDelayParams(SonoAudio::DelayParams & retparams)
+{
+    retparams = mFilePlaybackChannelGroup.params.monitorDelayParams;
+    return true;
+}
 
-        if (index == i || topeer == peer) break;
-    }
+void SonobusAudioProcessor::setFilePlaybackDestStartAndCount(int start, int count)
+{
+    mFilePlaybackChannelGroup.params.monDestStartIndex = start;
+    mFilePlaybackChannelGroup.params.monDestChannels = std::max(1, std::min(count, MAX_CHANNELS));
+    mFilePlaybackChannelGroup.commitMonitorDelayParams(); // need to do this too
 
+    mRecFilePlaybackChannelGroup.params.monDestStartIndex = start;
+    mRecFilePlaybackChannelGroup.params.monDestChannels = std::max(1, std::min(count, MAX_CHANNELS));
+    mRecFilePlaybackChannelGroup.commitMonitorDelayParams(); // need to do this too
 }
 
-
-int32_t SonobusAudioProcessor::sendPeerMessage(RemotePeer * peer, const char *msg, int32_t n)
+bool SonobusAudioProcessor::getFilePlaybackDestStartAndCount(int & retstart, int & retcount)
 {
-    return endpoint_send(peer->endpoint, msg, n);
+    retstart = mFilePlaybackChannelGroup.params.monDestStartIndex;
+    retcount = mFilePlaybackChannelGroup.params.monDestChannels;
+    return true;
 }
 
-
-void SonobusAudioProcessor::doSendData()
+void SonobusAudioProcessor::setFilePlaybackGain(float gain)
 {
-    // just try to send for everybody
-    const ScopedReadLock sl (mCoreLock);        
+    mFilePlaybackChannelGroup.params.gain = gain;
+    mRecFilePlaybackChannelGroup.params.gain = gain;
+    //mTransportSource.setGain(gain);
+}
 
-    // send stuff until there is nothing left to send
-    
-    int32_t didsomething = 1;
+float SonobusAudioProcessor::getFilePlaybackGain() const
+{
+    return mFilePlaybackChannelGroup.params.gain;
+    //return mTransportSource.getGain();
+}
 
-    auto nowtimems = Time::getMillisecondCounterHiRes();
+void SonobusAudioProcessor::setFilePlaybackMonitor(float mgain)
+{
+    mFilePlaybackChannelGroup.params.monitor = mgain;
+    mRecFilePlaybackChannelGroup.params.monitor = mgain;
+}
 
-    while (didsomething) {
-        //mAooSource->send();
-        didsomething = 0;
-        
-        didsomething |= mAooDummySource->send();
-        
-        if (mAooClient) {
-            mAooClient->send();
-        }
-        
-        for (auto & remote : mRemotePeers) {
-            if (remote->oursource) {
-                didsomething |= remote->oursource->send();
-                
-                if (didsomething) {
-                    remote->dataPacketsSent += 1;
-                }
-            }
-            if (remote->oursink) {
-                didsomething |= remote->oursink->send();
-            }
+float SonobusAudioProcessor::getFilePlaybackMonitor() const
+{
+    return mFilePlaybackChannelGroup.params.monitor;
+}
 
-            if (remote->latencysource) {
-                didsomething |= remote->latencysource->send();
-                didsomething |= remote->latencysink->send();
-                didsomething |= remote->echosource->send();
-                didsomething |= remote->echosink->send();
-            }
 
-            if ( nowtimems > (remote->lastSendPingTimeMs + PEER_PING_INTERVAL_MS) ) {
-                sendPingEvent(remote);
-                remote->lastSendPingTimeMs = nowtimems;
-                if (!remote->haveSentFirstPeerInfo) {
-                    sendRemotePeerInfoUpdate(-1, remote);
-                    remote->haveSentFirstPeerInfo = true;
-                }
-            }
-        }
+void SonobusAudioProcessor::setInputCompressorParams(int changroup, CompressorParams & params)
+{
+    // sanity check and compute automakeupgain if necessary    
+    params.ratio = jlimit(1.0f, 120.0f, params.ratio);
+    if (params.automakeupGain) {
+        // makeupgain = (-thresh -  abs(thresh/ratio))/2
+        params.makeupGainDb = (-params.thresholdDb - abs(params.thresholdDb/params.ratio)) * 0.5f;
     }
 
-    if (mPendingUnmute.get() && mPendingUnmuteAtStamp < Time::getMillisecondCounter() ) {
-        DBG("UNMUTING ALL");
-        mState.getParameter(paramMainRecvMute)->setValueNotifyingHost(0.0f);
-
-        mPendingUnmute = false;
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        mInputChannelGroups[changroup].params.compressorParams = params;
+        mInputChannelGroups[changroup].commitCompressorParams();
     }
+}
 
-    if (mNeedsSampleSetup.get()) {
-        DBG("Doing sample setup for all");
-        setupSourceFormatsForAll();
-        mNeedsSampleSetup = false;
-
-        // reset all incoming by toggling muting
-        if (!mMainRecvMute.get()) {
-            DBG("Toggling main recv mute");
-            mState.getParameter(paramMainRecvMute)->setValueNotifyingHost(1.0f);
-            mPendingUnmuteAtStamp = Time::getMillisecondCounter() + 250;
-            mPendingUnmute = true;
-        }
-
-        sendRemotePeerInfoUpdate(-1); // send to all
-
+bool SonobusAudioProcessor::getInputCompressorParams(int changroup, CompressorParams & retparams)
+{
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        retparams = mInputChannelGroups[changroup].params.compressorParams;
+        return true;
     }
-
-
+    return false;
 }
 
-struct ProcessorIdPair
+void SonobusAudioProcessor::setInputLimiterParams(int changroup, CompressorParams & params)
 {
-    ProcessorIdPair(SonobusAudioProcessor *proc, int32_t id_) : processor(proc), id(id_) {}
-    SonobusAudioProcessor * processor;
-    int32_t id;
-};
+    // sanity check and compute automakeupgain if necessary    
+    params.ratio = jlimit(1.0f, 120.0f, params.ratio);
 
-static int32_t gHandleSourceEvents(void * user, const aoo_event ** events, int32_t n)
-{
-    ProcessorIdPair * pp = static_cast<ProcessorIdPair*> (user);
-    return pp->processor->handleSourceEvents(events, n, pp->id);    
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        mInputChannelGroups[changroup].params.limiterParams = params;
+        mInputChannelGroups[changroup].commitLimiterParams();
+    }
 }
 
-static int32_t gHandleSinkEvents(void * user, const aoo_event ** events, int32_t n)
+bool SonobusAudioProcessor::getInputLimiterParams(int changroup, CompressorParams & retparams)
 {
-    ProcessorIdPair * pp = static_cast<ProcessorIdPair*> (user);
-    return pp->processor->handleSinkEvents(events, n, pp->id);
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        retparams = mInputChannelGroups[changroup].params.limiterParams;
+        return true;
+    }
+    return false;
 }
 
-static int32_t gHandleServerEvents(void * user, const aoo_event ** events, int32_t n)
+void SonobusAudioProcessor::setInputMonitorDelayParams(int changroup, SonoAudio::DelayParams & params)
 {
-    ProcessorIdPair * pp = static_cast<ProcessorIdPair*> (user);
-    return pp->processor->handleServerEvents(events, n);
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        mInputChannelGroups[changroup].params.monitorDelayParams = params;
+        //mInputChannelGroups[changroup].monitorDelayParamsChanged = true;
+        // commit them now
+        mInputChannelGroups[changroup].commitMonitorDelayParams();
+    }
 }
 
-static int32_t gHandleClientEvents(void * user, const aoo_event ** events, int32_t n)
+bool SonobusAudioProcessor::getInputMonitorDelayParams(int changroup, SonoAudio::DelayParams & retparams)
 {
-    ProcessorIdPair * pp = static_cast<ProcessorIdPair*> (user);
-    return pp->processor->handleClientEvents(events, n);
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        retparams = mInputChannelGroups[changroup].params.monitorDelayParams;
+        return true;
+    }
+    return false;
 }
 
 
-void SonobusAudioProcessor::handleEvents()
+void SonobusAudioProcessor::setInputExpanderParams(int changroup, CompressorParams & params)
 {
-    const ScopedReadLock sl (mCoreLock);        
-    int32_t dummy = 0;
-    
-    if (mAooServer /*&& mAooServer->events_available()*/) {
-        ProcessorIdPair pp(this, dummy);
-        mAooServer->handle_events(gHandleServerEvents, &pp);
+    // sanity check and compute automakeupgain if necessary    
+    params.ratio = jlimit(1.0f, 120.0f, params.ratio);
+
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        mInputChannelGroups[changroup].params.expanderParams = params;
+        mInputChannelGroups[changroup].commitExpanderParams();
     }
+}
 
-    if (mAooClient && mAooClient->events_available()) {
-        ProcessorIdPair pp(this, dummy);
-        mAooClient->handle_events(gHandleClientEvents, &pp);
+bool SonobusAudioProcessor::getInputExpanderParams(int changroup, CompressorParams & retparams)
+{
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        retparams = mInputChannelGroups[changroup].params.expanderParams;
+        return true;
     }
+    return false;
+}
 
-    
-    if (mAooDummySource->events_available() > 0) {
-        mAooDummySource->get_id(dummy);
-        ProcessorIdPair pp(this, dummy);
-        mAooDummySource->handle_events(gHandleSourceEvents, &pp);
+void SonobusAudioProcessor::setInputEqParams(int changroup, ParametricEqParams & params)
+{
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        mInputChannelGroups[changroup].params.eqParams = params;
+        mInputChannelGroups[changroup].commitEqParams();
     }
+}
 
-    for (auto & remote : mRemotePeers) {
-        if (remote->oursource) {
-            remote->oursource->get_id(dummy);
-            ProcessorIdPair pp(this, dummy);
-            remote->oursource->handle_events(gHandleSourceEvents, &pp);
-        }
-        if (remote->oursink) {
-            remote->oursink->get_id(dummy);
-            ProcessorIdPair pp(this, dummy);
-            remote->oursink->handle_events(gHandleSinkEvents, &pp);
-        }
-
-        
-        if (remote->latencysink) {
-            remote->latencysink->get_id(dummy);
-            ProcessorIdPair pp(this, dummy);
-            remote->latencysink->handle_events(gHandleSinkEvents, &pp);
-        }
-        if (remote->echosink) {
-            remote->echosink->get_id(dummy);
-            ProcessorIdPair pp(this, dummy);
-            remote->echosink->handle_events(gHandleSinkEvents, &pp);
-        }
-         
-        if (remote->latencysource) {
-            remote->latencysource->get_id(dummy);
-            ProcessorIdPair pp(this, dummy);
-            remote->latencysource->handle_events(gHandleSourceEvents, &pp);
-        }
-        if (remote->echosource) {
-            remote->echosource->get_id(dummy);
-            ProcessorIdPair pp(this, dummy);
-            remote->echosource->handle_events(gHandleSourceEvents, &pp);
-        }
-        
+bool SonobusAudioProcessor::getInputEqParams(int changroup, ParametricEqParams & retparams)
+{
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        retparams = mInputChannelGroups[changroup].params.eqParams;
+        return true;
     }
-
+    return false;
 }
 
-void SonobusAudioProcessor::sendPingEvent(RemotePeer * peer)
-{
 
-    auto tt = aoo_osctime_get();
+void SonobusAudioProcessor::setInputGroupCount(int count)
+{
+    int newcnt = std::max(0, std::min(count, MAX_CHANGROUPS-1));
 
-    char buf[AOO_MAXPACKETSIZE];
-    osc::OutboundPacketStream outmsg(buf, sizeof(buf));
+    mInputChannelGroupCount = newcnt;
+}
 
-    try {
-        outmsg << osc::BeginMessage(SONOBUS_FULLMSG_PING)
-        << osc::TimeTag(tt)
-        << osc::EndMessage;
+void SonobusAudioProcessor::setInputGroupChannelStartAndCount(int changroup, int start, int count)
+{
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        mInputChannelGroups[changroup].params.chanStartIndex = start;
+        mInputChannelGroups[changroup].params.numChannels = std::max(1, std::min(count, MAX_CHANNELS));
+        mInputChannelGroups[changroup].commitMonitorDelayParams();
     }
-    catch (const osc::Exception& e){
-        DBG("exception in ping message construction: " << e.what());
-        return;
+}
+
+bool SonobusAudioProcessor::getInputGroupChannelStartAndCount(int changroup, int & retstart, int & retcount)
+{
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        retstart = mInputChannelGroups[changroup].params.chanStartIndex;
+        retcount = mInputChannelGroups[changroup].params.numChannels;
+        return true;
     }
+    return false;
+}
 
-    sendPeerMessage(peer, outmsg.Data(), (int32_t) outmsg.Size());
+void SonobusAudioProcessor::setInputGroupChannelDestStartAndCount(int changroup, int start, int count)
+{
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        mInputChannelGroups[changroup].params.monDestStartIndex = start;
+        mInputChannelGroups[changroup].params.monDestChannels = std::max(1, std::min(count, MAX_CHANNELS));
+    }
+}
 
-    DBG("Sent ping to peer: " << peer->endpoint->ipaddr);
+bool SonobusAudioProcessor::getInputGroupChannelDestStartAndCount(int changroup, int & retstart, int & retcount)
+{
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        retstart = mInputChannelGroups[changroup].params.monDestStartIndex;
+        retcount = mInputChannelGroups[changroup].params.monDestChannels;
+        return true;
+    }
+    return false;
 }
 
 
-void SonobusAudioProcessor::handlePingEvent(EndpointState * endpoint, uint64_t tt1, uint64_t tt2, uint64_t tt3)
+bool SonobusAudioProcessor::insertInputChannelGroup(int atgroup, int chstart, int chcount)
 {
-    double diff1 = aoo_osctime_duration(tt1, tt2) * 1000.0;
-    double diff2 = aoo_osctime_duration(tt2, tt3) * 1000.0;
-    double rtt = aoo_osctime_duration(tt1, tt3) * 1000.0;
+    if (atgroup >= 0 && atgroup < MAX_CHANGROUPS) {
+        // push any existing ones down
 
-    const ScopedReadLock sl (mCoreLock);
+        for (auto i = MAX_CHANGROUPS-1; i > atgroup; --i) {
+            mInputChannelGroups[i].copyParametersFrom(mInputChannelGroups[i-1]);
+            //mInputChannelGroups[i].chanStartIndex += chcount;
+            //mInputChannelGroups[i-1].numChannels = std::max(1, std::min(count, MAX_CHANNELS));
+        }
+        mInputChannelGroups[atgroup].params.chanStartIndex = chstart;
+        mInputChannelGroups[atgroup].params.numChannels = std::max(1, std::min(chcount, MAX_CHANNELS));
+        mInputChannelGroups[atgroup].params.monDestStartIndex = jmax(0, jmin(2 * (chstart / 2), getTotalNumOutputChannels()-1));
+        mInputChannelGroups[atgroup].params.monDestChannels = std::max(1, std::min(2, getTotalNumOutputChannels() - mInputChannelGroups[atgroup].params.monDestStartIndex));
 
-    auto * peer = findRemotePeer(endpoint, -1);
-    if (!peer) return;
+        // todo some defaults
+        mInputChannelGroups[atgroup].commitMonitorDelayParams(); // need to do this too
 
-    // smooth it
-    peer->pingTime = rtt; // * 0.5;
-    if (rtt < 600.0 ) {
-        peer->smoothPingTime.Z *= 0.5f;
-        peer->smoothPingTime.push(peer->pingTime);
+        return true;
     }
+    return false;
+}
 
-    DBG("ping recvd from " << peer->endpoint->ipaddr << ":" << peer->endpoint->port << " -- " << diff1 << " " << diff2 << " " <<  rtt << " smooth: " << peer->smoothPingTime.xbar << " stdev: " <<peer->smoothPingTime.s2xx);
+bool SonobusAudioProcessor::removeInputChannelGroup(int atgroup)
+{
+    if (atgroup >= 0 && atgroup < MAX_CHANGROUPS) {
+        // move any existing ones after up
 
+        for (auto i = atgroup + 1; i < MAX_CHANGROUPS; ++i) {
+            mInputChannelGroups[i-1].copyParametersFrom(mInputChannelGroups[i]);
+            //mInputChannelGroups[i].chanStartIndex += chcount;
+            //mInputChannelGroups[i-1].numChannels = std::max(1, std::min(count, MAX_CHANNELS));
+        }
+        return true;
+    }
+    return false;
+}
 
-    if (!peer->hasRealLatency) {
-        peer->totalEstLatency =  peer->smoothPingTime.xbar + 2*peer->buffertimeMs + (1e3*currSamplesPerBlock/getSampleRate());
+bool SonobusAudioProcessor::moveInputChannelGroupTo(int atgroup, int togroup)
+{
+    if (atgroup == togroup || atgroup < 0 || atgroup >= MAX_CHANGROUPS || togroup < 0 || togroup >= MAX_CHANGROUPS) {
+        return false;
     }
 
-    peer->gotNewStylePing = true;
+    // takes group atgroup and rearranges settings
+    insertInputChannelGroup(togroup, mInputChannelGroups[atgroup].params.chanStartIndex, mInputChannelGroups[atgroup].params.numChannels);
+    int origgroup = atgroup < togroup ? atgroup : atgroup+1;
+    // copy from origgroup to new atgroup
+    mInputChannelGroups[togroup].copyParametersFrom(mInputChannelGroups[origgroup]);
+
+    // remove origgroup
+    removeInputChannelGroup(origgroup);
+
+    return true;
 }
 
 
-int32_t SonobusAudioProcessor::handleSourceEvents(const aoo_event ** events, int32_t n, int32_t sourceId)
-{
-    for (int i = 0; i < n; ++i){
-        switch (events[i]->type){
-        case AOO_PING_EVENT:
-        {
-            aoo_ping_event *e = (aoo_ping_event *)events[i];
-            double diff1 = aoo_osctime_duration(e->tt1, e->tt2) * 1000.0;
-            double diff2 = aoo_osctime_duration(e->tt2, e->tt3) * 1000.0;
-            double rtt = aoo_osctime_duration(e->tt1, e->tt3) * 1000.0;
 
-            EndpointState * es = (EndpointState *)e->endpoint;
-            
-            RemotePeer * peer = findRemotePeer(es, sourceId);
-            if (peer && !peer->gotNewStylePing) {
-                const ScopedReadLock sl (mCoreLock);        
+void SonobusAudioProcessor::setInputGroupName(int changroup, const String & name)
+{
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        mInputChannelGroups[changroup].params.name = name;
+    }
+}
 
-                // smooth it
-                peer->pingTime = rtt; // * 0.5;
-                if (rtt < 600.0 ) {
-                    peer->smoothPingTime.Z *= 0.5f;
-                    peer->smoothPingTime.push(peer->pingTime);
-                }
+String SonobusAudioProcessor::getInputGroupName(int changroup)
+{
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        return mInputChannelGroups[changroup].params.name;
+    }
+    return "";
+}
 
-                DBG("ping to source " << sourceId << " recvd from " <<  es->ipaddr << ":" << es->port << " -- " << diff1 << " " << diff2 << " " <<  rtt << " smooth: " << peer->smoothPingTime.xbar << " stdev: " <<peer->smoothPingTime.s2xx);
-                
-                
-                if (!peer->hasRealLatency) {
-                    peer->totalEstLatency =  peer->smoothPingTime.xbar + 2*peer->buffertimeMs + (1e3*currSamplesPerBlock/getSampleRate());
-                }
+void SonobusAudioProcessor::setInputChannelPan(int changroup, int chan, float pan)
+{
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        if (chan >= 0 && chan < MAX_CHANNELS) {
+            if (mInputChannelGroups[changroup].params.numChannels == 2 && chan < 2) {
+                mInputChannelGroups[changroup].params.panStereo[chan] = pan;
+            } else {
+                mInputChannelGroups[changroup].params.pan[chan] = pan;
             }
-            break;
         }
-        case AOO_INVITE_EVENT:
-        {
-            aoo_sink_event *e = (aoo_sink_event *)events[i];
+    }
+}
 
-            // accepts invites
-            if (true){
-                EndpointState * es = (EndpointState *)e->endpoint;
-                // handle dummy source specially
-                
-                int32_t dummyid;
-                
-                if (mAooDummySource->get_id(dummyid) && dummyid == sourceId) {
-                    // dummy source is special, and creates a remote peer
+float SonobusAudioProcessor::getInputChannelPan(int changroup, int chan)
+{
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        if (chan >= 0 && chan < MAX_CHANNELS) {
+            if (mInputChannelGroups[changroup].params.numChannels == 2 && chan < 2) {
+                return mInputChannelGroups[changroup].params.panStereo[chan];
+            } else {
+                return mInputChannelGroups[changroup].params.pan[chan];
+            }
+        }
+    }
 
-                    RemotePeer * peer = findRemotePeerByRemoteSinkId(es, e->id);
-                    if (peer) {
-                        // we already have a peer for this, interesting
-                        DBG("Already had remote peer for " <<   es->ipaddr << ":" << es->port << "  ourId: " << peer->ourId);
-                    } else if (!mIsConnectedToServer) {
-                        peer = doAddRemotePeerIfNecessary(es);
-                    }
-                    else {
-                        // connected to server, don't just respond to anyone
-                        peer = findRemotePeer(es, -1);
-                        if (!peer) {
-                            DBG("Not reacting to invite from a peer not known in the group");
-                            break;
-                        }
+    return 0.0f;
+}
 
-                        DBG("Got invite from peer in the group");
-                    }
+void SonobusAudioProcessor::setInputGroupGain(int changroup, float gain)
+{
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        mInputChannelGroups[changroup].params.gain = gain;
+    }
+}
 
-                    const ScopedReadLock sl (mCoreLock);        
+float SonobusAudioProcessor::getInputGroupGain(int changroup)
+{
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        return mInputChannelGroups[changroup].params.gain;
+    }
+    return 0.0f;
+}
 
-                    peer->remoteSinkId = e->id;
+void SonobusAudioProcessor::setInputMonitor(int changroup, float mgain)
+{
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        mInputChannelGroups[changroup].params.monitor = mgain;
+    }
+}
 
-                    // add their sink
+float SonobusAudioProcessor::getInputMonitor(int changroup)
+{
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        return mInputChannelGroups[changroup].params.monitor;
+    }
+    return 0.0f;
+}
+
+void SonobusAudioProcessor::setInputGroupMuted(int changroup, bool muted)
+{
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        mInputChannelGroups[changroup].params.muted = muted;
+    }
+}
+
+bool SonobusAudioProcessor::getInputGroupMuted(int changroup)
+{
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        return mInputChannelGroups[changroup].params.muted;
+    }
+    return false;
+}
+
+void SonobusAudioProcessor::setInputGroupSoloed(int changroup, bool soloed)
+{
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        mInputChannelGroups[changroup].params.soloed = soloed;
+    }
+}
+
+bool SonobusAudioProcessor::getInputGroupSoloed(int changroup)
+{
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        return mInputChannelGroups[changroup].params.soloed;
+    }
+    return false;
+}
+
+
+
+void SonobusAudioProcessor::setInputReverbSend(int changroup, float rgain, bool input)
+{
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        if (input) {
+            mInputChannelGroups[changroup].params.inReverbSend = rgain;
+        } else {
+            mInputChannelGroups[changroup].params.monReverbSend = rgain;
+        }
+    }
+}
+
+float SonobusAudioProcessor::getInputReverbSend(int changroup, bool input)
+{
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        if (input) {
+            return mInputChannelGroups[changroup].params.inReverbSend;
+        } else {
+            return mInputChannelGroups[changroup].params.monReverbSend;
+        }
+    }
+    return 0.0f;
+}
+
+void SonobusAudioProcessor::setInputPolarityInvert(int changroup, bool invert)
+{
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        mInputChannelGroups[changroup].params.invertPolarity = invert;
+    }
+}
+
+bool SonobusAudioProcessor::getInputPolarityInvert(int changroup)
+{
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        return mInputChannelGroups[changroup].params.invertPolarity;
+    }
+    return false;
+}
+
+
+
+void SonobusAudioProcessor::commitCompressorParams(RemotePeer * peer, int changroup)
+{   
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        peer->chanGroups[changroup].commitCompressorParams();
+    }
+}
+
+void SonobusAudioProcessor::commitInputCompressorParams(int changroup)
+{   
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        mInputChannelGroups[changroup].commitCompressorParams();
+    }
+}
+
+void SonobusAudioProcessor::commitInputExpanderParams(int changroup)
+{
+   
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        //mInputCompressorControl.setParamValue("/compressor/Bypass", mInputCompressorParams.enabled ? 0.0f : 1.0f);
+        mInputChannelGroups[changroup].commitExpanderParams();
+    }
+
+}
+
+void SonobusAudioProcessor::commitInputLimiterParams(int changroup)
+{   
+    //mInputLimiterControl.setParamValue("/limiter/Bypass", mInputLimiterParams.enabled ? 0.0f : 1.0f);
+    //mInputLimiterControl.setParamValue("/limiter/threshold", mInputLimiterParams.thresholdDb);
+    //mInputLimiterControl.setParamValue("/limiter/ratio", mInputLimiterParams.ratio);
+    //mInputLimiterControl.setParamValue("/limiter/attack", mInputLimiterParams.attackMs * 1e-3);
+    //mInputLimiterControl.setParamValue("/limiter/release", mInputLimiterParams.releaseMs * 1e-3);
+
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        mInputChannelGroups[changroup].commitLimiterParams();
+    }
+
+}
+
+
+void SonobusAudioProcessor::commitInputEqParams(int changroup)
+{
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        mInputChannelGroups[changroup].commitEqParams();
+    }
+}
+
+void SonobusAudioProcessor::commitInputMonitoringParams(int changroup)
+{
+    if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
+        mInputChannelGroups[changroup].commitMonitorDelayParams();
+    }
+}
+
+
+
+// should use shared pointer
+foleys::LevelMeterSource * SonobusAudioProcessor::getRemotePeerRecvMeterSource(int index)
+{
+    if (index >= mRemotePeers.size()) return nullptr;
+    const ScopedReadLock sl (mCoreLock);        
+    auto remote = mRemotePeers.getUnchecked(index);
+    return &(remote->recvMeterSource);
+}
+
+foleys::LevelMeterSource * SonobusAudioProcessor::getRemotePeerSendMeterSource(int index)
+{
+    if (index >= mRemotePeers.size()) return nullptr;
+    const ScopedReadLock sl (mCoreLock);        
+    auto remote = mRemotePeers.getUnchecked(index);
+    return &(remote->sendMeterSource);
+}
+
+
+
+
+SonobusAudioProcessor::EndpointState * SonobusAudioProcessor::findOrAddRawEndpoint(void * rawaddr)
+{
+    EndpointAddrKey key;
+    if (!key.setFromSockaddr((const struct sockaddr *)rawaddr)) {
+        DBG("Unsupported raw addr family");
+        return nullptr;
+    }
+
+    {
+        // fast path, no allocation
+        const ScopedLock sl (mEndpointsLock);
+        if (auto endpoint = findEndpointInTable(key)) {
+            return endpoint;
+        }
+    }
+
+    String ipaddr;
+    int port = 0 ;
+
+    char hostip[INET6_ADDRSTRLEN];
+    if (inet_ntop(((struct sockaddr *)rawaddr)->sa_family, get_in_addr((struct sockaddr *)rawaddr), hostip, sizeof(hostip)) == nullptr) {
+        DBG("Error converting raw addr to IP");
+        return nullptr;
+    } else {
+        ipaddr = hostip;
+        port = ntohs(get_in_port((struct sockaddr *)rawaddr));        
+        auto endpoint = findOrAddEndpoint(ipaddr, port);
+
+        const ScopedLock sl (mEndpointsLock);
+        if (!endpoint->hasAddrKey) {
+            addEndpointToTable(endpoint, key);
+        }
+        return endpoint;
+    }    
+}
+
+SonobusAudioProcessor::EndpointState * SonobusAudioProcessor::findOrAddEndpoint(const String & host, int port)
+{
+    const ScopedLock sl (mEndpointsLock);        
+    
+    EndpointState * endpoint = 0;
+    
+    for (auto ep : mEndpoints) {
+        if (ep->ipaddr == host && ep->port == port) {
+            endpoint = ep;
+            break;
+        }
+    }
+    
+    if (!endpoint) {
+        // add it as new
+        endpoint = mEndpoints.add(new EndpointState(host, port));
+        endpoint->owner = mUdpSocket.get();
+        endpoint->cipher = mPacketCipher.load();
+        endpoint->seenEpoch = mEndpointEpoch;
+        DBG("Added new endpoint for " << host << ":" << port);
+
+#if JUCE_WINDOWS
+        if (mSocketQos && mSocketQos->isOpen()) {
+            socklen_t addrlen;
+            mSocketQos->addDestination(endpoint->getSendAddr(addrlen));
+        }
+#endif
+
+        // make it findable by its raw address too
+        EndpointAddrKey key;
+        if (key.setFromSockaddr(endpoint->getRawAddr()) && !findEndpointInTable(key)) {
+            addEndpointToTable(endpoint, key);
+        }
+    }
+    return endpoint;
+}
+
+SonobusAudioProcessor::EndpointState * SonobusAudioProcessor::findEndpointInTable(const EndpointAddrKey & key)
+{
+    // assumed mEndpointsLock already held
+    if (mEndpointTable.empty()) return nullptr;
+
+    const uint32 mask = (uint32) mEndpointTable.size() - 1;
+    auto index = key.hash() & mask;
+
+    // terminate on empty bucket
+    while (auto endpoint = mEndpointTable[index]) {
+        if (endpoint->addrKey == key) {
+            // still wanted, see collectIdleEndpoints()
+            endpoint->seenEpoch = mEndpointEpoch;
+            return endpoint;
+        }
+        index = (index + 1) & mask;
+    }
+    return nullptr;
+}
+
+void SonobusAudioProcessor::addEndpointToTable(EndpointState * endpoint, const EndpointAddrKey & key)
+{
+    // assumed mEndpointsLock already held
+
+    // grow if the table would be more than 50% full
+    if ((mEndpointTableCount + 1) * 2 > (int) mEndpointTable.size()) {
+        std::vector<EndpointState*> oldtable;
+        oldtable.swap(mEndpointTable);
+        mEndpointTable.assign(jmax((size_t) 16, oldtable.size() * 2), nullptr);
+
+        const uint32 mask = (uint32) mEndpointTable.size() - 1;
+        for (auto ep : oldtable) {
+            if (!ep) continue;
+            auto index = ep->addrKey.hash() & mask;
+            while (mEndpointTable[index]) {
+                index = (index + 1) & mask;
+            }
+            mEndpointTable[index] = ep;
+        }
+    }
+
+    endpoint->addrKey = key;
+    endpoint->hasAddrKey = true;
+
+    const uint32 mask = (uint32) mEndpointTable.size() - 1;
+    auto index = key.hash() & mask;
+    while (mEndpointTable[index]) {
+        index = (index + 1) & mask;
+    }
+    mEndpointTable[index] = endpoint;
+    ++mEndpointTableCount;
+}
+
+void SonobusAudioProcessor::rebuildEndpointTable()
+{
+    // assumed mEndpointsLock already held
+    // open addressing can't just empty a bucket, the ones after it would get lost
+    mEndpointTable.clear();
+    mEndpointTableCount = 0;
+
+    for (auto * ep : mEndpoints) {
+        if (ep->hasAddrKey) {
+            addEndpointToTable(ep, ep->addrKey);
+        }
+    }
+}
+
+// forgets the endpoints that went idle and that nothing refers to anymore: scanners,
+// stale NAT mappings, peers that left. Otherwise they pile up in a long running
+// instance, and every lookup gets slower. called on the event thread
+void SonobusAudioProcessor::collectIdleEndpoints()
+{
+    const double nowms = Time::getMillisecondCounterHiRes();
+    if (nowms - mLastEndpointCollectMs < ENDPOINT_COLLECT_INTERVAL_MS) return;
+    mLastEndpointCollectMs = nowms;
+
+    // the peers can't change while we look, and nobody can look one up
+    const ScopedReadLock sl (mCoreLock);
+    const ScopedLock el (mEndpointsLock);
+
+    for (int i = mRetiredEndpoints.size(); --i >= 0; ) {
+        if (nowms - mRetiredEndpoints.getUnchecked(i)->idleSinceMs > ENDPOINT_RETIRE_GRACE_MS) {
+            mRetiredEndpoints.remove(i);
+        }
+    }
+
+    SortedSet<EndpointState*> inuse;
+    inuse.add(mRelayEndpoint.load());
+    for (auto * remote : mRemotePeers) {
+        inuse.add(remote->endpoint);
+    }
+    for (auto * ep : mEndpoints) {
+        inuse.add(ep->relay.load());
+    }
+
+    // the lookups from here on count for the next round
+    const uint32 epoch = mEndpointEpoch++;
+    int numretired = 0;
+
+    for (int i = mEndpoints.size(); --i >= 0; ) {
+        auto * ep = mEndpoints.getUnchecked(i);
+
+        const bool active = ep->seenEpoch == epoch || ep->sentBytes != ep->collectSentBytes || inuse.contains(ep);
+        ep->collectSentBytes = ep->sentBytes;
+
+        if (active) {
+            ep->idleSinceMs = nowms;
+            continue;
+        }
+        if (nowms - ep->idleSinceMs < ENDPOINT_IDLE_MS) continue;
+
+        DBG("Retiring idle endpoint " << ep->ipaddr << ":" << ep->port);
+
+        if (auto * path = ep->pathEndpoint) {
+            mPathEndpoints.removeObject(path, false);
+            path->idleSinceMs = nowms;
+            mRetiredEndpoints.add(path);
+        }
+        ep->idleSinceMs = nowms;
+        mRetiredEndpoints.add(mEndpoints.removeAndReturn(i));
+        ++numretired;
+    }
+
+    if (numretired > 0) {
+        rebuildEndpointTable();
+    }
+}
+
+float SonobusAudioProcessor::getAutoNetBufferDecrease(RemotePeer * peer, float blockms)
+{
+    // assumed corelock already held
+    // the buffer can shrink by what stayed in it nearly all the time (at the autoresize quantile),
+    // but not below what the packet arrival jitter at that quantile needs, keeping a block spare
+    float fillms = 0.0f;
+    float jitterdelayms = 0.0f;
+    if (!peer->oursink
+        || peer->oursink->get_source_buffer_fill_quantile(peer->endpoint, peer->remoteSourceId, fillms) <= 0
+        || peer->oursink->get_source_jitter_delay(peer->endpoint, peer->remoteSourceId, jitterdelayms) <= 0
+        || fillms <= 0.0f) {
+        // not enough known yet, a block at a time
+        return blockms;
+    }
+
+    const float slackms = fillms - blockms;
+    const float roomms = (float) peer->buffertimeMs - (jitterdelayms + blockms);
+    const float decrms = std::floor(jmin(slackms, roomms) / blockms) * blockms;
+
+    if (decrms > blockms) {
+        DBG("Buffer fill low quantile " << fillms << " ms, jitter delay " << jitterdelayms << " ms, can decrease by " << decrms);
+    }
+    return jmax(blockms, decrms);
+}
+
+void SonobusAudioProcessor::updateSafetyMuting(RemotePeer * peer)
+{
+    // assumed corelock already held
+    //const float droprate =  (peer->dataPacketsDropped) / ((nowtime - peer->resetDroptime)*1e-3);
+    const float droprate = peer->fastDropRate.xbar;
+    const float safetyunmutethreshrate = 2.0f;
+    const float safetyunmutethreshmintime = 0.5f;
+    const float safetyunmutethreshtime = 0.75f;
+    const float jitterbufthresh = 15.0f;
+
+    double nowtime = Time::getMillisecondCounterHiRes();
+    double timesincereset = (nowtime - peer->resetDroptime) * 1e-3;
+    double deltadroptime = peer->lastDroptime > 0 ? (nowtime - peer->lastDroptime) * 1e-3 : timesincereset;
+
+
+    if ((timesincereset > safetyunmutethreshmintime)
+        && ((droprate > 0.0f && droprate < safetyunmutethreshrate)
+            || (droprate == 0.0f && deltadroptime > safetyunmutethreshtime)
+            || (peer->buffertimeMs > jitterbufthresh))) {
+        DBG("Droprate: " << droprate << "  deltatime: " << deltadroptime << " buftimems: " << peer->buffertimeMs);
+        DBG("Unmuting after reset drop");
+        peer->resetSafetyMuted = false;
+    }
+
+    peer->fastDropRate.Z *= 0.965;
+
+    float realdroprate =  (peer->dataPacketsDropped - peer->lastDropCount) / deltadroptime;
+    peer->fastDropRate.push(realdroprate);
+
+}
+
+// invitations and codec changes are between us and one peer, so they always go
+// to the peer's own source, even while it is sending through a shared one
+static bool isSourceSessionMessage(const char * data, int32_t nbytes)
+{
+    int32_t type, id;
+    auto onset = aoo_parse_pattern(data, nbytes, &type, &id);
+    if (onset <= 0) return false;
+
+    const char * pattern = data + onset;
+    return !strcmp(pattern, AOO_MSG_INVITE) || !strcmp(pattern, AOO_MSG_UNINVITE)
+        || !strcmp(pattern, AOO_MSG_CODEC_CHANGE);
+}
+
+// the sink events from a peer's file stream source (see FILESTREAM_ID_OFFSET),
+// all sink events start with the endpoint and the source id
+static bool isFileStreamSourceEvent(const aoo_event * event)
+{
+    return ((const aoo_source_event *) event)->id >= FILESTREAM_ID_OFFSET;
+}
+
+// hands a packet to the peer's sink, which decodes it, and counts the time for the diagnostics
+static int32_t handlePeerSinkMessage(SonobusAudioProcessor::RemotePeer * remote, const char * data, int nbytes, void * endpoint, aoo_replyfn fn)
+{
+    const auto start = SonoAudio::ProcessTimingTracker::now();
+    const auto ret = remote->oursink->handle_message(data, nbytes, endpoint, fn);
+    remote->decodeTicks.fetch_add(SonoAudio::ProcessTimingTracker::now() - start, std::memory_order_relaxed);
+    return ret;
+}
+
+bool SonobusAudioProcessor::dispatchAooMessage(EndpointState * endpoint, const char * data, int nbytes)
+{
+    // assumed corelock (read) already held
+
+    int32_t type, id, dummyid;
+
+    struct sockaddr_in relayaddr;
+    int32_t relaysize = 0;
+    if (aoonet_parse_relay(data, nbytes, &relayaddr, &relaysize) > 0) {
+        // a relayed peer message, which the client unwraps itself
+        if (mAooClient) {
+            mAooClient->handle_message(data, nbytes, endpoint->getRawAddr());
+        }
+        return true;
+    }
+    if (!(aoo_parse_pattern(data, nbytes, &type, &id) > 0)
+        && !(aoonet_parse_pattern(data, nbytes, &type) > 0))
+    {
+        return false;
+    }
+
+    if (type == AOO_TYPE_SINK){
+        // forward OSC packet to matching sink(s)
+
+        int32_t salt = 0;
+        if (id == AOO_ID_NONE && aoo_parse_compact_data_salt(data, nbytes, &salt)) {
+            // compact data message, go directly to the peer that last accepted this salt
+            for (auto & remote : mRemotePeers) {
+                if (remote->hasCompactDataSalt && remote->compactDataSalt == salt && remote->endpoint == endpoint && remote->oursink) {
+                    if (handlePeerSinkMessage(remote, data, nbytes, endpoint, endpoint_send)) {
+                        remote->dataPacketsReceived += 1;
+                        if (remote->recvAllow && !remote->recvActive) {
+                            remote->recvActive = true;
+                        }
+                        if (remote->resetSafetyMuted) {
+                            updateSafetyMuting(remote);
+                        }
+                        return true;
+                    }
+                    // the salt must have changed
+                    remote->hasCompactDataSalt = false;
+                    break;
+                }
+            }
+        }
+
+        for (auto & remote : mRemotePeers) {
+            if (!remote->oursink) continue;
+            
+            if (id == AOO_ID_NONE) {
+                // this is a compact data message with an unknown salt, try them all
+                if (handlePeerSinkMessage(remote, data, nbytes, endpoint, endpoint_send)) {
+                    // remember for the next one
+                    remote->compactDataSalt = salt;
+                    remote->hasCompactDataSalt = true;
+                    remote->dataPacketsReceived += 1;
+                    if (remote->recvAllow && !remote->recvActive) {
+                        remote->recvActive = true;
+                    }
+                    if (remote->resetSafetyMuted) {
+                        updateSafetyMuting(remote);
+                    }
+                    break;
+                }
+            }
+            
+            if (id == AOO_ID_WILDCARD || (remote->oursink->get_id(dummyid) && id == dummyid) ) {
+                if (handlePeerSinkMessage(remote, data, nbytes, endpoint, endpoint_send)) {
+                    remote->dataPacketsReceived += 1;
+                    if (remote->recvAllow && !remote->recvActive) {
+                        remote->recvActive = true;
+                    }
+                    if (remote->resetSafetyMuted) {
+                        updateSafetyMuting(remote);
+                    }
+                }
+                
+                if (id != AOO_ID_WILDCARD) break;
+            }
+            
+            if (id == remote->ourId + ECHO_ID_OFFSET || id == remote->ourId + LATENCY_ID_OFFSET) {
+                // their test reaching us makes the echo ones, the latency ones are only for our own.
+                // Listeners don't get them, they have no way to hear the result.
+                const bool echo = id == remote->ourId + ECHO_ID_OFFSET;
+                if (echo ? !remote->remoteListener.load() && ensureLatencyTestObjects(remote) : remote->latencyTestReady.load()) {
+                    remote->latencyTestLastUseMs = Time::getMillisecondCounterHiRes();
+                    (echo ? remote->echosink : remote->latencysink)->handle_message(data, nbytes, endpoint, endpoint_send);
+                }
+                break;
+            }
+            
+        }
+        
+    } else if (type == AOO_TYPE_SOURCE){
+        // forward OSC packet to matching sources(s)
+
+        
+        if (mAooDummySource->get_id(dummyid) && id == dummyid) {
+            // this is the special one that can accept blind invites
+            mAooDummySource->handle_message(data, nbytes, endpoint, endpoint_send);
+        }
+        else {
+            for (auto & remote : mRemotePeers) {
+                if (!remote->oursource) continue;
+                if (id == AOO_ID_WILDCARD || (remote->oursource->get_id(dummyid) && id == dummyid)) {
+                    if (isSourceSessionMessage(data, nbytes)) {
+                        // these belong to the peer's own source
+                        ungroupSharedSend(remote);
+                        remote->oursource->handle_message(data, nbytes, endpoint, endpoint_send);
+                    }
+                    else if (auto * leader = remote->sendLeader.load()) {
+                        // format/data requests and pings for the shared stream
+                        leader->oursource->handle_message(data, nbytes, endpoint, endpoint_send);
+                    }
+                    else {
+                        remote->oursource->handle_message(data, nbytes, endpoint, endpoint_send);
+                    }
+                    if (id != AOO_ID_WILDCARD) break;
+                }
+                
+                if (id == remote->ourId + ECHO_ID_OFFSET || id == remote->ourId + LATENCY_ID_OFFSET) {
+                    const bool echo = id == remote->ourId + ECHO_ID_OFFSET;
+                    if (echo ? !remote->remoteListener.load() && ensureLatencyTestObjects(remote) : remote->latencyTestReady.load()) {
+                        remote->latencyTestLastUseMs = Time::getMillisecondCounterHiRes();
+                        (echo ? remote->echosource : remote->latencysource)->handle_message(data, nbytes, endpoint, endpoint_send);
+                    }
+                    break;
+                }
+                else if (remote->filestreamsource->get_id(dummyid) && id == dummyid) {
+                    remote->filestreamsource->handle_message(data, nbytes, endpoint, endpoint_send);
+                    break;
+                }
+            }
+        }
+
+        
+    } else if (type == AOO_TYPE_CLIENT || type == AOO_TYPE_PEER){
+        // forward OSC packet to matching client
+
+        //DBG("Got AOO_CLIENT or PEER data");
+
+        if (mAooClient) {
+            mAooClient->handle_message(data, nbytes, endpoint->getRawAddr());
+        }
+        
+        /*
+         for (int i = 0; i < x->x_numclients; ++i){
+         if (pd_class(x->x_clients[i].c_obj) == aoo_client_class)
+         {
+         t_aoo_client *c = (t_aoo_client *)x->x_clients[i].c_obj;
+         aoo_client_handle_message(c, buf, nbytes,
+         ep, (aoo_replyfn)endpoint_send);
+         break;
+         }
+         }
+         */
+    } else if (type == AOO_TYPE_SERVER){
+        // ignore
+        DBG("Got AOO_SERVER data");
+
+        if (mAooServer) {
+            // mAooServer->handle_message(data, nbytes, endpoint);
+        }
+        
+    } else {
+        DBG("SonoBus bug: unknown aoo type: " << type);
+    }
+
+    return true;
+}
+
+int SonobusAudioProcessor::receivePacketBatch(ReceiveBatch & batch, DatagramSocket & socket)
+{
+    const int fd = socket.getRawSocketHandle();
+    int count = 0;
+
+#if JUCE_LINUX
+    // pull everything that is pending in a single syscall
+    for (int i=0; i < RECV_BATCH_SIZE; ++i) {
+        auto & msg = batch.msgs[i];
+        batch.iovecs[i].iov_base = batch.packets[i].data;
+        batch.iovecs[i].iov_len = sizeof(batch.packets[i].data);
+        zerostruct(msg);
+        msg.msg_hdr.msg_iov = &batch.iovecs[i];
+        msg.msg_hdr.msg_iovlen = 1;
+        msg.msg_hdr.msg_name = &batch.packets[i].addr;
+        msg.msg_hdr.msg_namelen = sizeof(batch.packets[i].addr);
+        msg.msg_hdr.msg_control = batch.controls + i * RECV_CONTROL_SIZE;
+        msg.msg_hdr.msg_controllen = RECV_CONTROL_SIZE;
+    }
+
+    int nmsgs = ::recvmmsg(fd, batch.msgs, RECV_BATCH_SIZE, MSG_DONTWAIT, nullptr);
+    if (nmsgs < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            DBG("Error receiving UDP batch: " << errno);
+        }
+        return 0;
+    }
+
+    for (int i=0; i < nmsgs; ++i) {
+        batch.packets[i].size = (int) batch.msgs[i].msg_len;
+        unmapAddress(batch.packets[i].addr);
+    }
+    count = nmsgs;
+
+    if (nmsgs > 0) {
+        // every datagram carries the total drop count, the last one is the most recent
+        updateReceiveDrops(socket, &batch.msgs[nmsgs - 1].msg_hdr);
+    }
+#else
+    // no recvmmsg here, read until the socket would block
+    for (int i=0; i < RECV_BATCH_SIZE; ++i) {
+        if (i > 0 && socket.waitUntilReady(true, 0) != 1) {
+            break;
+        }
+
+        auto & packet = batch.packets[count];
+        socklen_t addrlen = sizeof(packet.addr);
+        auto nbytes = (int) ::recvfrom(fd, packet.data, (int) sizeof(packet.data), 0, (struct sockaddr *) &packet.addr, &addrlen);
+
+        if (nbytes < 0) {
+            DBG("Error receiving UDP");
+            break;
+        }
+        else if (nbytes > 0) {
+            packet.size = nbytes;
+            unmapAddress(packet.addr);
+            ++count;
+        }
+    }
+#endif
+
+    return count;
+}
+
+#if JUCE_LINUX
+void SonobusAudioProcessor::updateReceiveDrops(DatagramSocket & socket, struct msghdr * hdr)
+{
+#ifdef SO_RXQ_OVFL
+    if (&socket != mUdpSocket.get()) return;
+
+    for (auto cmsg = CMSG_FIRSTHDR(hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+            uint32_t drops;
+            memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+            if ((int64) drops != mSocketReceiveDrops.load()) {
+                DBG("Socket receive buffer overflowed, " << (int64) drops << " datagrams dropped so far");
+                mSocketReceiveDrops = (int64) drops;
+            }
+        }
+    }
+#else
+    ignoreUnused(socket, hdr);
+#endif
+}
+#endif
+
+void SonobusAudioProcessor::unwrapRelayedPacket(ReceiveBatch & batch, int index)
+{
+    auto & packet = batch.packets[index];
+    struct sockaddr_storage addr;
+    int32_t size = 0;
+    int32_t onset = aoonet_parse_relay(packet.data, packet.size, &addr, &size);
+    if (onset <= 0) return;
+
+    // peer messages are left to the client, it has to know they came through the relay
+    int32_t type;
+    if (aoonet_parse_pattern(packet.data + onset, size, &type) > 0) return;
+
+    auto endpoint = findOrAddRawEndpoint(&addr);
+    if (!endpoint) return;
+
+    endpoint->relay = packet.endpoint;
+    endpoint->recvBytes += size + UDP_OVERHEAD_BYTES;
+
+    memmove(packet.data, packet.data + onset, (size_t) size);
+    packet.size = size;
+    packet.endpoint = endpoint;
+}
+
+bool SonobusAudioProcessor::openReceivedPacket(ReceiveBatch & batch, int index)
+{
+    auto & packet = batch.packets[index];
+    auto * cipher = mPacketCipher.load();
+
+    if (SonoAudio::PacketCipher::isSealed(packet.data, packet.size)) {
+        // not our key, not from who it says, or played back
+        if (!cipher) return false;
+        const int size = cipher->open(packet.data, packet.size);
+        if (size < 0) return false;
+        packet.size = size;
+        return true;
+    }
+
+    if (!cipher) return true;
+
+    // while encrypting, only the connection server's messages and the peer messages
+    // for the client (relayed or not) may come in the clear, they're none of the audio
+    int32_t type;
+    struct sockaddr_in relayaddr;
+    int32_t relaysize = 0;
+    return aoonet_parse_pattern(packet.data, packet.size, &type) > 0
+        || aoonet_parse_relay(packet.data, packet.size, &relayaddr, &relaysize) > 0;
+}
+
+void SonobusAudioProcessor::doReceiveData(ReceiveBatch & batch, DatagramSocket & socket, bool lanMulticast)
+{
+    // receive as many datagrams as are ready (up to the batch size).
+    // what arrives on the multi-path or LAN multicast socket is handled like
+    // the rest, the aoo objects know the peers by their address anyway
+    handleReceivedPackets(batch, receivePacketBatch(batch, socket), lanMulticast);
+}
+
+void SonobusAudioProcessor::handleReceivedPackets(ReceiveBatch & batch, int count, bool lanMulticast)
+{
+    if (count <= 0) return;
+
+    const double nowms = lanMulticast ? Time::getMillisecondCounterHiRes() : 0.0;
+
+    // find endpoints from sender info
+    for (int i=0; i < count; ++i) {
+        auto & packet = batch.packets[i];
+        if (lanMulticast) {
+            // anybody on the LAN can send to the group, only listen to the peers we know
+            EndpointAddrKey key;
+            const ScopedLock el (mEndpointsLock);
+            packet.endpoint = packet.size > 0 && key.setFromSockaddr((const struct sockaddr *) &packet.addr) ? findEndpointInTable(key) : nullptr;
+            if (packet.endpoint) {
+                packet.endpoint->lanMulticastRecvMs = nowms;
+            }
+        }
+        else {
+            packet.endpoint = packet.size > 0 ? findOrAddRawEndpoint(&packet.addr) : nullptr;
+        }
+        packet.handled = false;
+
+        if (packet.endpoint) {
+            packet.endpoint->recvBytes += packet.size + UDP_OVERHEAD_BYTES;
+        }
+
+        if (packet.endpoint && packet.endpoint == mRelayEndpoint.load()) {
+            unwrapRelayedPacket(batch, i);
+        }
+
+        if (packet.endpoint && !openReceivedPacket(batch, i)) {
+            packet.endpoint = nullptr;
+        }
+    }
+
+    // dispatch the whole batch of AOO packets under a single read lock
+    bool gotaoo = false;
+    {
+        const ScopedReadLock sl (mCoreLock);
+
+        for (int i=0; i < count; ++i) {
+            auto & packet = batch.packets[i];
+            if (!packet.endpoint) continue;
+
+            packet.handled = dispatchAooMessage(packet.endpoint, packet.data, packet.size);
+            gotaoo = gotaoo || packet.handled;
+        }
+    }
+
+    // anything else is handled without the corelock, it might call out to listeners
+    for (int i=0; i < count; ++i) {
+        auto & packet = batch.packets[i];
+        if (!packet.endpoint || packet.handled) continue;
+
+        if (!handleOtherMessage(packet.endpoint, packet.data, packet.size)) {
+            // not a valid AoO OSC message
+            DBG("SonoBus: not a valid AOO message!");
+        }
+    }
+
+    if (gotaoo) {
+        // notify send thread
+        notifySendThread();
+    }
+}
+
+// XXX
+// all of this should be refactored into its own class
+
+#define SONOBUS_MSG_DOMAIN "/sb"
+#define SONOBUS_MSG_DOMAIN_LEN 3
+
+#define SONOBUS_MSG_PEERINFO "/pinfo"
+#define SONOBUS_MSG_PEERINFO_LEN 6
+#define SONOBUS_FULLMSG_PEERINFO SONOBUS_MSG_DOMAIN SONOBUS_MSG_PEERINFO
+
+#define SONOBUS_MSG_PEERINFOREC "/pirec"
+#define SONOBUS_MSG_PEERINFOREC_LEN 6
+#define SONOBUS_FULLMSG_PEERINFOREC SONOBUS_MSG_DOMAIN SONOBUS_MSG_PEERINFOREC
+
+#define SONOBUS_MSG_PEERINFOREQ "/pireq"
+#define SONOBUS_MSG_PEERINFOREQ_LEN 6
+#define SONOBUS_FULLMSG_PEERINFOREQ SONOBUS_MSG_DOMAIN SONOBUS_MSG_PEERINFOREQ
+
+#define SONOBUS_MSG_LAYOUTINFO "/clayinfo"
+#define SONOBUS_MSG_LAYOUTINFO_LEN 9
+#define SONOBUS_FULLMSG_LAYOUTINFO SONOBUS_MSG_DOMAIN SONOBUS_MSG_LAYOUTINFO
+
+#define SONOBUS_MSG_CHAT "/chat"
+#define SONOBUS_MSG_CHAT_LEN 5
+#define SONOBUS_FULLMSG_CHAT SONOBUS_MSG_DOMAIN SONOBUS_MSG_CHAT
+
+#define SONOBUS_MSG_PING "/ping"
+#define SONOBUS_MSG_PING_LEN 5
+#define SONOBUS_FULLMSG_PING SONOBUS_MSG_DOMAIN SONOBUS_MSG_PING
+
+#define SONOBUS_MSG_PINGACK "/pngack"
+#define SONOBUS_MSG_PINGACK_LEN 7
+#define SONOBUS_FULLMSG_PINGACK SONOBUS_MSG_DOMAIN SONOBUS_MSG_PINGACK
+
+#define SONOBUS_MSG_REQLATINFO "/reqlatinfo"
+#define SONOBUS_MSG_REQLATINFO_LEN 12
+#define SONOBUS_FULLMSG_REQLATINFO SONOBUS_MSG_DOMAIN SONOBUS_MSG_REQLATINFO
+
+#define SONOBUS_MSG_LATINFO "/latinfo"
+#define SONOBUS_MSG_LATINFO_LEN 8
+#define SONOBUS_FULLMSG_LATINFO SONOBUS_MSG_DOMAIN SONOBUS_MSG_LATINFO
+
+#define SONOBUS_MSG_SUGGESTLAT "/suggestlat"
+#define SONOBUS_MSG_SUGGESTLAT_LEN 11
+#define SONOBUS_FULLMSG_SUGGESTLAT SONOBUS_MSG_DOMAIN SONOBUS_MSG_SUGGESTLAT
+
+#define SONOBUS_MSG_METSYNC "/metsync"
+#define SONOBUS_MSG_METSYNC_LEN 8
+#define SONOBUS_FULLMSG_METSYNC SONOBUS_MSG_DOMAIN SONOBUS_MSG_METSYNC
+
+#define SONOBUS_MSG_MTUPROBE "/mtuprobe"
+#define SONOBUS_MSG_MTUPROBE_LEN 9
+#define SONOBUS_FULLMSG_MTUPROBE SONOBUS_MSG_DOMAIN SONOBUS_MSG_MTUPROBE
+
+#define SONOBUS_MSG_MTUACK "/mtuack"
+#define SONOBUS_MSG_MTUACK_LEN 7
+#define SONOBUS_FULLMSG_MTUACK SONOBUS_MSG_DOMAIN SONOBUS_MSG_MTUACK
+
+#define SONOBUS_MSG_LANPROBE "/lanprobe"
+#define SONOBUS_MSG_LANPROBE_LEN 9
+#define SONOBUS_FULLMSG_LANPROBE SONOBUS_MSG_DOMAIN SONOBUS_MSG_LANPROBE
+
+#define SONOBUS_MSG_DUBHOST "/dubhost"
+#define SONOBUS_MSG_DUBHOST_LEN 8
+#define SONOBUS_FULLMSG_DUBHOST SONOBUS_MSG_DOMAIN SONOBUS_MSG_DUBHOST
+
+#define SONOBUS_MSG_ALIGN "/align"
+#define SONOBUS_MSG_ALIGN_LEN 6
+#define SONOBUS_FULLMSG_ALIGN SONOBUS_MSG_DOMAIN SONOBUS_MSG_ALIGN
+
+#define SONOBUS_MSG_BTOFFER "/btoffer"
+#define SONOBUS_MSG_BTOFFER_LEN 8
+#define SONOBUS_FULLMSG_BTOFFER SONOBUS_MSG_DOMAIN SONOBUS_MSG_BTOFFER
+
+#define SONOBUS_MSG_BTHAVE "/bthave"
+#define SONOBUS_MSG_BTHAVE_LEN 7
+#define SONOBUS_FULLMSG_BTHAVE SONOBUS_MSG_DOMAIN SONOBUS_MSG_BTHAVE
+
+#define SONOBUS_MSG_BTPLAY "/btplay"
+#define SONOBUS_MSG_BTPLAY_LEN 7
+#define SONOBUS_FULLMSG_BTPLAY SONOBUS_MSG_DOMAIN SONOBUS_MSG_BTPLAY
+
+
+enum {
+    SONOBUS_MSGTYPE_UNKNOWN = 0,
+    SONOBUS_MSGTYPE_PEERINFO,
+    SONOBUS_MSGTYPE_LAYOUTINFO,
+    SONOBUS_MSGTYPE_CHAT,
+    SONOBUS_MSGTYPE_PING,
+    SONOBUS_MSGTYPE_PINGACK,
+    SONOBUS_MSGTYPE_REQLATINFO,
+    SONOBUS_MSGTYPE_LATINFO,
+    SONOBUS_MSGTYPE_SUGGESTLAT,
+    SONOBUS_MSGTYPE_METSYNC,
+    SONOBUS_MSGTYPE_MTUPROBE,
+    SONOBUS_MSGTYPE_MTUACK,
+    SONOBUS_MSGTYPE_LANPROBE,
+    SONOBUS_MSGTYPE_PEERINFOREC,
+    SONOBUS_MSGTYPE_PEERINFOREQ,
+    SONOBUS_MSGTYPE_DUBHOST,
+    SONOBUS_MSGTYPE_ALIGN,
+    SONOBUS_MSGTYPE_BTOFFER,
+    SONOBUS_MSGTYPE_BTHAVE,
+    SONOBUS_MSGTYPE_BTPLAY
+};
+
+static int32_t sonobusOscParsePattern(const char *msg, int32_t n, int32_t & rettype)
+{
+    int32_t offset = 0;
+    if (n >= SONOBUS_MSG_DOMAIN_LEN
+        && !memcmp(msg, SONOBUS_MSG_DOMAIN, SONOBUS_MSG_DOMAIN_LEN))
+    {
+        offset += SONOBUS_MSG_DOMAIN_LEN;
+
+        if (n >= (offset + SONOBUS_MSG_PING_LEN)
+            && !memcmp(msg + offset, SONOBUS_MSG_PING, SONOBUS_MSG_PING_LEN))
+        {
+            rettype = SONOBUS_MSGTYPE_PING;
+            offset += SONOBUS_MSG_PING_LEN;
+            return offset;
+        }
+        else if (n >= (offset + SONOBUS_MSG_PINGACK_LEN)
+            && !memcmp(msg + offset, SONOBUS_MSG_PINGACK, SONOBUS_MSG_PINGACK_LEN))
+        {
+            rettype = SONOBUS_MSGTYPE_PINGACK;
+            offset += SONOBUS_MSG_PINGACK_LEN;
+            return offset;
+        }
+        else if (n >= (offset + SONOBUS_MSG_PEERINFO_LEN)
+            && !memcmp(msg + offset, SONOBUS_MSG_PEERINFO, SONOBUS_MSG_PEERINFO_LEN))
+        {
+            rettype = SONOBUS_MSGTYPE_PEERINFO;
+            offset += SONOBUS_MSG_PEERINFO_LEN;
+            return offset;
+        }
+        else if (n >= (offset + SONOBUS_MSG_LAYOUTINFO_LEN)
+            && !memcmp(msg + offset, SONOBUS_MSG_LAYOUTINFO, SONOBUS_MSG_LAYOUTINFO_LEN))
+        {
+            rettype = SONOBUS_MSGTYPE_LAYOUTINFO;
+            offset += SONOBUS_MSG_LAYOUTINFO_LEN;
+            return offset;
+        }
+        else if (n >= (offset + SONOBUS_MSG_CHAT_LEN)
+            && !memcmp(msg + offset, SONOBUS_MSG_CHAT, SONOBUS_MSG_CHAT_LEN))
+        {
+            rettype = SONOBUS_MSGTYPE_CHAT;
+            offset += SONOBUS_MSG_CHAT_LEN;
+            return offset;
+        }
+        else if (n >= (offset + SONOBUS_MSG_REQLATINFO_LEN)
+            && !memcmp(msg + offset, SONOBUS_MSG_REQLATINFO, SONOBUS_MSG_REQLATINFO_LEN))
+        {
+            rettype = SONOBUS_MSGTYPE_REQLATINFO;
+            offset += SONOBUS_MSG_REQLATINFO_LEN;
+            return offset;
+        }
+        else if (n >= (offset + SONOBUS_MSG_LATINFO_LEN)
+            && !memcmp(msg + offset, SONOBUS_MSG_LATINFO, SONOBUS_MSG_LATINFO_LEN))
+        {
+            rettype = SONOBUS_MSGTYPE_LATINFO;
+            offset += SONOBUS_MSG_LATINFO_LEN;
+            return offset;
+        }
+        else if (n >= (offset + SONOBUS_MSG_SUGGESTLAT_LEN)
+            && !memcmp(msg + offset, SONOBUS_MSG_SUGGESTLAT, SONOBUS_MSG_SUGGESTLAT_LEN))
+        {
+            rettype = SONOBUS_MSGTYPE_SUGGESTLAT;
+            offset += SONOBUS_MSG_SUGGESTLAT_LEN;
+            return offset;
+        }
+        else if (n >= (offset + SONOBUS_MSG_METSYNC_LEN)
+            && !memcmp(msg + offset, SONOBUS_MSG_METSYNC, SONOBUS_MSG_METSYNC_LEN))
+        {
+            rettype = SONOBUS_MSGTYPE_METSYNC;
+            offset += SONOBUS_MSG_METSYNC_LEN;
+            return offset;
+        }
+        else if (n >= (offset + SONOBUS_MSG_MTUPROBE_LEN)
+            && !memcmp(msg + offset, SONOBUS_MSG_MTUPROBE, SONOBUS_MSG_MTUPROBE_LEN))
+        {
+            rettype = SONOBUS_MSGTYPE_MTUPROBE;
+            offset += SONOBUS_MSG_MTUPROBE_LEN;
+            return offset;
+        }
+        else if (n >= (offset + SONOBUS_MSG_MTUACK_LEN)
+            && !memcmp(msg + offset, SONOBUS_MSG_MTUACK, SONOBUS_MSG_MTUACK_LEN))
+        {
+            rettype = SONOBUS_MSGTYPE_MTUACK;
+            offset += SONOBUS_MSG_MTUACK_LEN;
+            return offset;
+        }
+        else if (n >= (offset + SONOBUS_MSG_LANPROBE_LEN)
+            && !memcmp(msg + offset, SONOBUS_MSG_LANPROBE, SONOBUS_MSG_LANPROBE_LEN))
+        {
+            rettype = SONOBUS_MSGTYPE_LANPROBE;
+            offset += SONOBUS_MSG_LANPROBE_LEN;
+            return offset;
+        }
+        else if (n >= (offset + SONOBUS_MSG_PEERINFOREC_LEN)
+            && !memcmp(msg + offset, SONOBUS_MSG_PEERINFOREC, SONOBUS_MSG_PEERINFOREC_LEN))
+        {
+            rettype = SONOBUS_MSGTYPE_PEERINFOREC;
+            offset += SONOBUS_MSG_PEERINFOREC_LEN;
+            return offset;
+        }
+        else if (n >= (offset + SONOBUS_MSG_PEERINFOREQ_LEN)
+            && !memcmp(msg + offset, SONOBUS_MSG_PEERINFOREQ, SONOBUS_MSG_PEERINFOREQ_LEN))
+        {
+            rettype = SONOBUS_MSGTYPE_PEERINFOREQ;
+            offset += SONOBUS_MSG_PEERINFOREQ_LEN;
+            return offset;
+        }
+        else if (n >= (offset + SONOBUS_MSG_DUBHOST_LEN)
+            && !memcmp(msg + offset, SONOBUS_MSG_DUBHOST, SONOBUS_MSG_DUBHOST_LEN))
+        {
+            rettype = SONOBUS_MSGTYPE_DUBHOST;
+            offset += SONOBUS_MSG_DUBHOST_LEN;
+            return offset;
+        }
+        else if (n >= (offset + SONOBUS_MSG_ALIGN_LEN)
+            && !memcmp(msg + offset, SONOBUS_MSG_ALIGN, SONOBUS_MSG_ALIGN_LEN))
+        {
+            rettype = SONOBUS_MSGTYPE_ALIGN;
+            offset += SONOBUS_MSG_ALIGN_LEN;
+            return offset;
+        }
+        else if (n >= (offset + SONOBUS_MSG_BTOFFER_LEN)
+            && !memcmp(msg + offset, SONOBUS_MSG_BTOFFER, SONOBUS_MSG_BTOFFER_LEN))
+        {
+            rettype = SONOBUS_MSGTYPE_BTOFFER;
+            offset += SONOBUS_MSG_BTOFFER_LEN;
+            return offset;
+        }
+        else if (n >= (offset + SONOBUS_MSG_BTHAVE_LEN)
+            && !memcmp(msg + offset, SONOBUS_MSG_BTHAVE, SONOBUS_MSG_BTHAVE_LEN))
+        {
+            rettype = SONOBUS_MSGTYPE_BTHAVE;
+            offset += SONOBUS_MSG_BTHAVE_LEN;
+            return offset;
+        }
+        else if (n >= (offset + SONOBUS_MSG_BTPLAY_LEN)
+            && !memcmp(msg + offset, SONOBUS_MSG_BTPLAY, SONOBUS_MSG_BTPLAY_LEN))
+        {
+            rettype = SONOBUS_MSGTYPE_BTPLAY;
+            offset += SONOBUS_MSG_BTPLAY_LEN;
+            return offset;
+        }
+        else {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+bool SonobusAudioProcessor::handleOtherMessage(EndpointState * endpoint, const char *msg, int32_t n)
+{
+    // try to parse it as an OSC /sb  message
+    int32_t type = SONOBUS_MSGTYPE_UNKNOWN;
+    int32_t onset = 0;
+
+    if (! (onset = sonobusOscParsePattern(msg, n, type))) {
+        return false;
+    }
+
+    try {
+        osc::ReceivedPacket packet(msg, n);
+        osc::ReceivedMessage message(packet);
+
+        if (type == SONOBUS_MSGTYPE_PING) {
+            // received from the other side
+            // args: t:origtime
+
+            auto it = message.ArgumentsBegin();
+            auto tt = (it++)->AsTimeTag();
+
+            // now prepare and send ack immediately
+            auto tt2 = aoo_osctime_get(); // use real system time
+
+            char buf[AOO_MAXPACKETSIZE];
+            osc::OutboundPacketStream outmsg(buf, sizeof(buf));
+
+            try {
+                outmsg << osc::BeginMessage(SONOBUS_FULLMSG_PINGACK)
+                << osc::TimeTag(tt) << osc::TimeTag(tt2)
+                << osc::EndMessage;
+            }
+            catch (const osc::Exception& e){
+                DBG("exception in pingack message constructions: " << e.what());
+                return false;
+            }
+
+            endpoint_send(endpoint, outmsg.Data(), (int) outmsg.Size());
+
+            DBG("Received ping from " << endpoint->ipaddr << ":" << endpoint->port << "  stamp: " << tt);
+
+        }
+        else if (type == SONOBUS_MSGTYPE_PINGACK) {
+            // received from the other side
+            // args: t:origtime t:theirtime
+
+            auto it = message.ArgumentsBegin();
+            auto tt = (it++)->AsTimeTag();
+            auto tt2 = (it++)->AsTimeTag();
+            auto tt3 = aoo_osctime_get(); // use real system time
+
+            handlePingEvent(endpoint, tt, tt2, tt3); // jlc
+
+        }
+        else if (type == SONOBUS_MSGTYPE_PEERINFO) {
+            // peerinfo message arguments:
+            // blob containing JSON
+            auto it = message.ArgumentsBegin();
+
+            const void *infojson;
+            osc::osc_bundle_element_size_t size;
+
+            (it++)->AsBlob(infojson, size);
+
+            // parsed and applied later, see handlePeerInfoMessage()
+            DeferredEvent ev;
+            ev.kind = DeferredEvent::PeerInfoMessage;
+            ev.endpoint = endpoint;
+            ev.data.append(infojson, (size_t) size);
+            queueDeferredEvent(std::move(ev));
+        }
+        else if (type == SONOBUS_MSGTYPE_LAYOUTINFO) {
+            // layout info message arguments:
+            // i:sourceid  b:<blob containing valuetree in binary form>
+            auto it = message.ArgumentsBegin();
+            auto sourceid = (it++)->AsInt32();
+
+            const void *info;
+            osc::osc_bundle_element_size_t size;
+
+            (it++)->AsBlob(info, size);
+
+            // parsed and applied later, see handleLayoutInfoMessage()
+            DeferredEvent ev;
+            ev.kind = DeferredEvent::LayoutInfoMessage;
+            ev.objectId = sourceid;
+            ev.endpoint = endpoint;
+            ev.data.append(info, (size_t) size);
+            queueDeferredEvent(std::move(ev));
+        }
+        else if (type == SONOBUS_MSGTYPE_CHAT) {
+            // layout info message arguments:
+            // s:groupname s:from s:targets s:tags s:message
+            auto it = message.ArgumentsBegin();
+
+            String group (CharPointer_UTF8((it++)->AsString()));
+            String from (CharPointer_UTF8((it++)->AsString()));
+            String targets (CharPointer_UTF8((it++)->AsString()));
+            String tags (CharPointer_UTF8((it++)->AsString()));
+            String message (CharPointer_UTF8((it++)->AsString()));
+
+            SBChatEvent chatevent(SBChatEvent::UserType, group, from, targets, tags, message);
+            if (mKeepChatHistory) {
+                mChatHistory.add(chatevent);
+            }
+            clientListeners.call(&SonobusAudioProcessor::ClientListener::sbChatEventReceived, this, chatevent);
+
+
+        }
+        else if (type == SONOBUS_MSGTYPE_REQLATINFO) {
+            // received from the other side
+            // args: [i:full]  older versions send none, which means full
+
+            bool full = true;
+            if (message.ArgumentCount() > 0) {
+                auto it = message.ArgumentsBegin();
+                full = (it++)->AsInt32() != 0;
+            }
+
+            sendLatInfoReply(endpoint, full);
+
+            DBG("Received REQLAT from " << endpoint->ipaddr << ":" << endpoint->port << "  full: " << (int)full);
+
+        }
+        else if (type == SONOBUS_MSGTYPE_LATINFO) {
+            // peerinfo message arguments:
+            // blob containing JSON
+            auto it = message.ArgumentsBegin();
+
+            const void *infojson;
+            osc::osc_bundle_element_size_t size;
+
+            (it++)->AsBlob(infojson, size);
+
+            String jsonstr = String::createStringFromData(infojson, size);
+
+            juce::var infodata;
+            auto result = juce::JSON::parse(jsonstr, infodata);
+            if (result.failed()) {
+                DBG("Peerinfo Json parsing failed: " << result.getErrorMessage());
+                return false;
+            }
+
+            handleLatInfo(infodata);
+
+        }
+        else if (type == SONOBUS_MSGTYPE_SUGGESTLAT) {
+            // received from the other side
+            // args: s:username  f:latency
+
+            auto it = message.ArgumentsBegin();
+            auto username = (it++)->AsString();
+            auto latency = (it++)->AsFloat();
+
+            clientListeners.call(&SonobusAudioProcessor::ClientListener::peerRequestedLatencyMatch, this, username, latency);
+        }
+        else if (type == SONOBUS_MSGTYPE_METSYNC) {
+            // received from the other side, times in their clock
+            // args: h:sessionid d:tempo t:epoch t:changetime T/F:owner
+
+            auto it = message.ArgumentsBegin();
+            auto sessionid = (it++)->AsInt64();
+            auto tempo = (it++)->AsDouble();
+            auto epoch = (it++)->AsTimeTag();
+            auto changetime = (it++)->AsTimeTag();
+            auto owner = (it++)->AsBool();
+
+            handleMetSessionSync(endpoint, sessionid, tempo, epoch, changetime, owner);
+        }
+        else if (type == SONOBUS_MSGTYPE_MTUPROBE) {
+            // received from the other side, padded to the size being probed
+            // args: b:padding
+            // tell them how much of it got here, it fit through the path unfragmented
+
+            char buf[64];
+            osc::OutboundPacketStream outmsg(buf, sizeof(buf));
+
+            try {
+                outmsg << osc::BeginMessage(SONOBUS_FULLMSG_MTUACK)
+                << (int32_t) n
+                << osc::EndMessage;
+            }
+            catch (const osc::Exception& e){
+                DBG("exception in mtuack message construction: " << e.what());
+                return false;
+            }
+
+            endpoint_send(endpoint, outmsg.Data(), (int) outmsg.Size());
+        }
+        else if (type == SONOBUS_MSGTYPE_MTUACK) {
+            // received from the other side
+            // args: i:probesize
+
+            auto it = message.ArgumentsBegin();
+            auto size = (it++)->AsInt32();
+
+            const ScopedReadLock sl (mCoreLock);
+
+            if (auto * peer = findRemotePeer(endpoint, -1)) {
+                // they only saw what was inside, the probe was the sealed packet
+                if (endpoint->cipher.load()) {
+                    size += SonoAudio::PacketCipher::Overhead;
+                }
+                peer->pathMtu.probeArrived(size);
+            }
+        }
+        else if (type == SONOBUS_MSGTYPE_LANPROBE) {
+            // received on our LAN multicast socket, no args
+            // its arrival was already noted in doReceiveData()
+        }
+        else if (type == SONOBUS_MSGTYPE_PEERINFOREC) {
+            // peerinfo record message arguments:
+            // b:<blob containing a PeerInfoRecord>
+            auto it = message.ArgumentsBegin();
+
+            const void *info;
+            osc::osc_bundle_element_size_t size;
+
+            (it++)->AsBlob(info, size);
+
+            // applied later, see handlePeerInfoRecordMessage()
+            DeferredEvent ev;
+            ev.kind = DeferredEvent::PeerInfoRecordMessage;
+            ev.endpoint = endpoint;
+            ev.data.append(info, (size_t) size);
+            queueDeferredEvent(std::move(ev));
+        }
+        else if (type == SONOBUS_MSGTYPE_PEERINFOREQ) {
+            // they lost track of our records, no args
+            const ScopedReadLock sl (mCoreLock);
+
+            if (auto * peer = findRemotePeer(endpoint, -1)) {
+                peer->infoRecordFullNeeded = true;
+                sendRemotePeerInfoUpdate(-1, peer);
+            }
+        }
+        else if (type == SONOBUS_MSGTYPE_DUBHOST) {
+            // received from a double-ender host, repeated while it collects
+            // args: i:uploadport T/F:recording
+
+            auto it = message.ArgumentsBegin();
+            auto port = (it++)->AsInt32();
+            auto recording = (it++)->AsBool();
+
+            {
+                const ScopedReadLock sl (mCoreLock);
+
+                if (auto * peer = findRemotePeer(endpoint, -1)) {
+                    peer->dubHostPort = port;
+                    peer->dubHostRecording = recording && port > 0;
+                    peer->dubHostSeenMs = Time::getMillisecondCounterHiRes();
+                }
+            }
+            // it gets going (or stops) there
+            notifyEventThread();
+        }
+        else if (type == SONOBUS_MSGTYPE_ALIGN) {
+            // from a peer in ensemble alignment, repeated while it is
+            // args: f:floorms (what its own links need, 0 when it stops)
+
+            auto it = message.ArgumentsBegin();
+            auto floorms = (it++)->AsFloat();
+
+            const ScopedReadLock sl (mCoreLock);
+
+            if (auto * peer = findRemotePeer(endpoint, -1)) {
+                peer->alignFloorMs = floorms;
+                peer->alignFloorSeenMs = Time::getMillisecondCounterHiRes();
+            }
+        }
+        else if (type == SONOBUS_MSGTYPE_BTOFFER) {
+            // from a peer sharing a backing track, repeated while it does
+            // args: i:port s:id s:name (an empty id when it stops)
+
+            auto it = message.ArgumentsBegin();
+            auto port = (it++)->AsInt32();
+            String id (CharPointer_UTF8((it++)->AsString()));
+            String name (CharPointer_UTF8((it++)->AsString()));
+
+            // the id ends up in the name of the cached file
+            if (id.isNotEmpty() && !BackingTrackShare::isValidId(id)) {
+                DBG("Ignoring backing track offer with a malformed id");
+                return true;
+            }
+
+            {
+                const ScopedReadLock sl (mCoreLock);
+
+                if (auto * peer = findRemotePeer(endpoint, -1)) {
+                    const SpinLock::ScopedLockType bl (peer->backingTrackLock);
+                    if (id != peer->backingTrackId) {
+                        peer->backingTrackPlaying = false;
+                    }
+                    peer->backingTrackId = id;
+                    peer->backingTrackName = name;
+                    peer->backingTrackPort = port;
+                    peer->backingTrackReplyDue = true;
+                }
+            }
+            // the fetch and the answer happen there
+            notifyEventThread();
+        }
+        else if (type == SONOBUS_MSGTYPE_BTHAVE) {
+            // the answer to our offer
+            // args: s:id (of the one they have, empty if they don't)
+
+            auto it = message.ArgumentsBegin();
+            String id (CharPointer_UTF8((it++)->AsString()));
+
+            const ScopedReadLock sl (mCoreLock);
+
+            if (auto * peer = findRemotePeer(endpoint, -1)) {
+                const SpinLock::ScopedLockType bl (peer->backingTrackLock);
+                peer->backingTrackHaveId = id;
+            }
+        }
+        else if (type == SONOBUS_MSGTYPE_BTPLAY) {
+            // from a peer sharing a backing track, on every change and repeated while it plays
+            // args: s:id T/F:playing d:position t:time (in their clock, when it was at position)
+
+            auto it = message.ArgumentsBegin();
+            String id (CharPointer_UTF8((it++)->AsString()));
+            auto playing = (it++)->AsBool();
+            auto position = (it++)->AsDouble();
+            auto time = (it++)->AsTimeTag();
+
+            {
+                const ScopedReadLock sl (mCoreLock);
+
+                if (auto * peer = findRemotePeer(endpoint, -1)) {
+                    const SpinLock::ScopedLockType bl (peer->backingTrackLock);
+                    // the offer comes first, for anything else we can't have the file
+                    peer->backingTrackPlaying = playing && id.isNotEmpty() && id == peer->backingTrackId;
+                    peer->backingTrackPosition = position;
+                    peer->backingTrackTime = time;
+                    peer->backingTrackSeenMs = Time::getMillisecondCounterHiRes();
+                }
+            }
+            notifyEventThread();
+        }
+        return true;
+    } catch (const osc::Exception& e){
+        DBG("exception in handleOtherMessage: " << e.what());
+    }
+    return false;
+}
+
+
+bool SonobusAudioProcessor::sendChatEvent(const SBChatEvent & event)
+{
+    // /sb/chat s:groupname s:from s:targets s:tags s:message
+
+    // if peerindex < 0 - send to all peers
+    char buf[AOO_MAXPACKETSIZE];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+
+    try {
+
+        msg << osc::BeginMessage(SONOBUS_FULLMSG_CHAT)
+        << event.group.toRawUTF8()
+        << event.from.toRawUTF8()
+        << event.targets.toRawUTF8()
+        << event.tags.toRawUTF8()
+        << event.message.toRawUTF8()
+        << osc::EndMessage;
+
+    }
+    catch (const osc::Exception& e){
+        DBG("exception in chat message constructions: " << e.what());
+        return false;
+    }
+
+    StringArray targetnames = StringArray::fromTokens(event.targets, "|", "");
+
+
+    const ScopedReadLock sl (mCoreLock);
+    for (int i=0;  i < mRemotePeers.size(); ++i) {
+        auto * peer = mRemotePeers.getUnchecked(i);
+
+        if (!targetnames.isEmpty() && !targetnames.contains(peer->userName))
+            continue;
+
+        DBG("Sending chat message to " << i);
+        this->sendPeerMessage(peer, msg.Data(), (int32_t) msg.Size(), SendLaneBulk);
+
+    }
+
+    return true;
+}
+
+void SonobusAudioProcessor::handleLatInfo(const juce::var & infolist)
+{
+    const ScopedLock sl (mLatInfoLock);
+
+    // received a latinfo list from elsewhere, merge it into our list
+
+    if (!infolist.isArray()) return;
+
+    for (int i=0; i < infolist.size(); ++i) {
+        auto infodata = infolist[i];
+
+        LatInfo latinfo;
+        latinfo.sourceName = infodata.getProperty("srcname", "");
+        latinfo.destName = infodata.getProperty("destname", "");
+        latinfo.latencyMs = infodata.getProperty("latms", 0.0f);
+
+        if (latinfo.sourceName.isNotEmpty() && latinfo.destName.isNotEmpty()) {
+            mergeLatInfo(latinfo);
+        }
+
+        DBG("latinfo: srcname: " << latinfo.sourceName << "  dest: " << latinfo.destName << "  latms: " << latinfo.latencyMs);
+    }
+}
+
+void SonobusAudioProcessor::mergeLatInfo(const LatInfo & latinfo)
+{
+    // latinfo lock already held
+    // the same path compares equal, whatever its latency
+    const int index = mLatInfoList.indexOf(latinfo);
+    if (index >= 0) {
+        mLatInfoList.getReference(index).latencyMs = latinfo.latencyMs;
+    } else {
+        mLatInfoList.add(latinfo);
+    }
+}
+
+Array<SonobusAudioProcessor::LatInfo> SonobusAudioProcessor::getAllLatInfo()
+{
+    Array<LatInfo> infolist;
+
+    const ScopedReadLock sl (mCoreLock);
+
+    for (int i=0;  i < mRemotePeers.size(); ++i) {
+        auto * peer = mRemotePeers.getUnchecked(i);
+        if (!peer || peer->userName.isEmpty()) continue;
+        LatencyInfo latinfo;
+        getRemotePeerLatencyInfo(i, latinfo);
+
+        LatInfo item;
+        item.sourceName = peer->userName;
+        item.destName = mCurrentUsername;
+        item.latencyMs = latinfo.incomingMs;
+
+        infolist.add(item);
+    }
+
+    return infolist;
+}
+
+void SonobusAudioProcessor::sendLatInfoReply(EndpointState * endpoint, bool full)
+{
+    // recv thread
+    auto latinfo = getAllLatInfo();
+
+    const ScopedReadLock sl (mCoreLock);
+
+    RemotePeer * peer = findRemotePeer(endpoint, -1);
+    if (!peer) {
+        DBG("Could not find peer for endpoint");
+        return;
+    }
+
+    auto & reported = peer->reportedLatInfo;
+    if (full) {
+        reported.clearQuick();
+    }
+
+    // with a big group the whole list doesn't fit in one packet, so it goes in as many as it takes
+    char buf[AOO_MAXPACKETSIZE];
+    juce::var infolist = juce::var(Array<var>());
+    String jsonstr;
+
+    auto sendList = [&] (const String & json) {
+        osc::OutboundPacketStream outmsg(buf, sizeof(buf));
+
+        try {
+            outmsg << osc::BeginMessage(SONOBUS_FULLMSG_LATINFO)
+            << osc::Blob(json.toRawUTF8(), (int) json.getNumBytesAsUTF8())
+            << osc::EndMessage;
+        }
+        catch (const osc::Exception& e){
+            DBG("exception in latinfo message constructions: " << e.what());
+            return;
+        }
+
+        endpoint_send(endpoint, outmsg.Data(), (int) outmsg.Size());
+    };
+
+    for (auto & item : latinfo) {
+        const int index = reported.indexOf(item);
+        if (index >= 0 && std::abs(reported.getReference(index).latencyMs - item.latencyMs) < LATINFO_CHANGE_THRESHOLD_MS) {
+            // they already have it
+            continue;
+        }
+
+        DynamicObject::Ptr obj = new DynamicObject(); // this will delete itself
+        obj->setProperty("srcname", item.sourceName);
+        obj->setProperty("destname", item.destName);
+        obj->setProperty("latms", item.latencyMs);
+
+        infolist.append(obj.get());
+        String newjson = JSON::toString(infolist, true, 6);
+
+        if (newjson.getNumBytesAsUTF8() > AOO_MAXPACKETSIZE - 100) {
+            if (infolist.size() == 1) {
+                DBG("Info too big for packet!");
+                infolist.resize(0);
+                continue;
+            }
+            // send what fit, this one starts the next
+            sendList(jsonstr);
+            infolist.resize(0);
+            infolist.append(obj.get());
+            newjson = JSON::toString(infolist, true, 6);
+        }
+        jsonstr = newjson;
+
+        if (index >= 0) {
+            reported.getReference(index).latencyMs = item.latencyMs;
+        } else {
+            reported.add(item);
+        }
+    }
+
+    if (infolist.size() > 0) {
+        sendList(jsonstr);
+    }
+}
+
+void SonobusAudioProcessor::sendReqLatInfoToAll(bool full)
+{
+    char buf[AOO_MAXPACKETSIZE];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+
+    try {
+
+        msg << osc::BeginMessage(SONOBUS_FULLMSG_REQLATINFO)
+        << (int32_t) (full ? 1 : 0)
+        << osc::EndMessage;
+
+    }
+    catch (const osc::Exception& e){
+        DBG("exception in reqlat message constructions: " << e.what());
+        return;
+    }
+
+    const ScopedReadLock sl (mCoreLock);
+    for (int i=0;  i < mRemotePeers.size(); ++i) {
+        auto * peer = mRemotePeers.getUnchecked(i);
+
+        DBG("Sending reqlat message to " << i);
+        this->sendPeerMessage(peer, msg.Data(), (int32_t) msg.Size(), SendLaneControl);
+    }
+}
+
+void SonobusAudioProcessor::sendLatencyMatchToAll(float latency)
+{
+    // suggest to all that they should adjust all receiving latencies to be this value
+
+    char buf[AOO_MAXPACKETSIZE];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+
+    try {
+
+        msg << osc::BeginMessage(SONOBUS_FULLMSG_SUGGESTLAT)
+        << mCurrentUsername.toRawUTF8()
+        << latency
+        << osc::EndMessage;
+
+    }
+    catch (const osc::Exception& e){
+        DBG("exception in suggestlat message constructions: " << e.what());
+        return;
+    }
+
+    const ScopedReadLock sl (mCoreLock);
+    for (int i=0;  i < mRemotePeers.size(); ++i) {
+        auto * peer = mRemotePeers.getUnchecked(i);
+
+        DBG("Sending suggestlat: " << latency << " message to " << i);
+        this->sendPeerMessage(peer, msg.Data(), (int32_t) msg.Size(), SendLaneControl);
+    }
+
+}
+
+static uint64_t ntpDuration(double seconds)
+{
+    return (uint64_t) (seconds * 4294967296.0);
+}
+
+void SonobusAudioProcessor::setSyncMetToSession(bool flag)
+{
+    mSyncMetToSession = flag;
+    if (!flag) return;
+
+    {
+        const SpinLock::ScopedLockType sl (mMetSessionLock);
+        if (mMetSessionId == 0 || std::abs(mMetSessionTempo - mMetTempo.get()) > 0.001) {
+            // one of our own, until we hear of another one (see handleMetSessionSync())
+            mMetSessionId = Random::getSystemRandom().nextInt64() | 1;
+            mMetSessionEpoch = aoo_osctime_get();
+            mMetSessionTempo = mMetTempo.get();
+            mMetSessionChangeTime = 0;
+            mMetSessionOwned = true;
+        }
+    }
+
+    mMetSessionSendPending = true;
+}
+
+void SonobusAudioProcessor::updateMetSessionTempo(double tempo)
+{
+    // any thread, the host changes the tempo from the audio thread
+    if (!mSyncMetToSession.load() || tempo <= 0.0) return;
+
+    {
+        const SpinLock::ScopedLockType sl (mMetSessionLock);
+
+        // a session tempo we took on comes back here through the parameter, rounded
+        const double current = mTempoParameter->convertFrom0to1(mTempoParameter->convertTo0to1((float) mMetSessionTempo));
+        if (mMetSessionId == 0 || std::abs(tempo - current) < 0.001) return;
+
+        // a new session, carrying on from the beat we are at
+        const uint64_t now = aoo_osctime_get();
+        const double beats = aoo_osctime_duration(mMetSessionEpoch, now) * mMetSessionTempo / 60.0;
+        mMetSessionId = Random::getSystemRandom().nextInt64() | 1;
+        mMetSessionEpoch = now - ntpDuration(beats * 60.0 / tempo);
+        mMetSessionTempo = tempo;
+        mMetSessionChangeTime = now;
+        mMetSessionOwned = true;
+    }
+
+    mMetSessionSendPending = true;
+}
+
+void SonobusAudioProcessor::sendMetSessionSync()
+{
+    // /sb/metsync h:sessionid d:tempo t:epoch t:changetime T/F:owner
+
+    int64 sessionid;
+    double tempo;
+    uint64_t epoch, changetime;
+    bool owned;
+    {
+        const SpinLock::ScopedLockType sl (mMetSessionLock);
+        if (mMetSessionId == 0) return;
+        sessionid = mMetSessionId;
+        tempo = mMetSessionTempo;
+        epoch = mMetSessionEpoch;
+        changetime = mMetSessionChangeTime;
+        owned = mMetSessionOwned;
+    }
+
+    char buf[AOO_MAXPACKETSIZE];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+
+    try {
+        msg << osc::BeginMessage(SONOBUS_FULLMSG_METSYNC)
+        << (osc::int64) sessionid
+        << tempo
+        << osc::TimeTag(epoch)
+        << osc::TimeTag(changetime)
+        << owned
+        << osc::EndMessage;
+    }
+    catch (const osc::Exception& e){
+        DBG("exception in metsync message construction: " << e.what());
+        return;
+    }
+
+    const ScopedReadLock sl (mCoreLock);
+    for (auto * peer : mRemotePeers) {
+        this->sendPeerMessage(peer, msg.Data(), (int32_t) msg.Size());
+    }
+}
+
+void SonobusAudioProcessor::handleMetSessionSync(EndpointState * endpoint, int64 sessionId, double tempo, uint64_t epoch, uint64_t changeTime, bool fromOwner)
+{
+    if (!mSyncMetToSession.load() || sessionId == 0 || tempo <= 0.0) return;
+
+    uint64_t localepoch, localchange;
+    {
+        const ScopedReadLock sl (mCoreLock);
+        auto * peer = findRemotePeer(endpoint, -1);
+
+        // their times are no use before we know their clock, they'll send again
+        if (!peer || !peer->clockOffset.isValid()) return;
+
+        localepoch = peer->clockOffset.toLocalTime(epoch);
+        localchange = changeTime != 0 ? peer->clockOffset.toLocalTime(changeTime) : 0;
+    }
+
+    {
+        const SpinLock::ScopedLockType sl (mMetSessionLock);
+
+        if (sessionId == mMetSessionId) {
+            // the one we're on, the clocks drift apart a bit so keep following the owner's
+            if (fromOwner && !mMetSessionOwned) {
+                mMetSessionEpoch = localepoch;
+            }
+            return;
+        }
+
+        // the latest tempo change wins, a session that only got enabled loses to any of those.
+        // otherwise the lower id, just so that it's the same one for everybody
+        int later = 0;
+        if (localchange != 0 && mMetSessionChangeTime == 0) {
+            later = 1;
+        }
+        else if (localchange == 0 && mMetSessionChangeTime != 0) {
+            later = -1;
+        }
+        else if (localchange != 0) {
+            const double diff = aoo_osctime_duration(mMetSessionChangeTime, localchange);
+            later = diff > MET_SESSION_TIE_SECS ? 1 : diff < -MET_SESSION_TIE_SECS ? -1 : 0;
+        }
+
+        if (later < 0 || (later == 0 && sessionId > mMetSessionId)) {
+            // ours stands, they'll take it on when it comes round to them
+            return;
+        }
+
+        DBG("Joining metronome session " << sessionId << " at tempo " << tempo);
+        mMetSessionId = sessionId;
+        mMetSessionEpoch = localepoch;
+        mMetSessionTempo = tempo;
+        mMetSessionChangeTime = localchange;
+        mMetSessionOwned = false;
+    }
+
+    // doesn't count as a change of ours, see updateMetSessionTempo()
+    mMetTempo = tempo;
+    mTempoParameter->setValueNotifyingHost(mTempoParameter->convertTo0to1((float) tempo));
+}
+
+
+void SonobusAudioProcessor::beginLatencyMatchProcedure()
+{
+    {
+        const ScopedLock sl (mLatInfoLock);
+        mLatInfoList.clearQuick();
+
+        // add our own info
+        for (auto & latinfo : getAllLatInfo()) {
+            mergeLatInfo(latinfo);
+        }
+    }
+
+    sendReqLatInfoToAll(true);
+}
+
+void SonobusAudioProcessor::refreshLatencyMatchProcedure()
+{
+    {
+        StringArray names;
+        names.add(mCurrentUsername);
+        {
+            const ScopedReadLock sl (mCoreLock);
+            for (auto * peer : mRemotePeers) {
+                names.add(peer->userName);
+            }
+        }
+
+        const ScopedLock sl (mLatInfoLock);
+
+        // drop the paths of whoever left since
+        for (int i = mLatInfoList.size() - 1; i >= 0; --i) {
+            const auto & latinfo = mLatInfoList.getReference(i);
+            if (!names.contains(latinfo.sourceName) || !names.contains(latinfo.destName)) {
+                mLatInfoList.remove(i);
+            }
+        }
+
+        for (auto & latinfo : getAllLatInfo()) {
+            mergeLatInfo(latinfo);
+        }
+    }
+
+    // they only answer with what moved since their last reply
+    sendReqLatInfoToAll(false);
+}
+
+bool SonobusAudioProcessor::isLatencyMatchProcedureReady()
+{
+    // we expect an entry for every directional path in the mesh
+    const ScopedLock sl (mLatInfoLock);
+    int totpeers = mRemotePeers.size() + 1;
+    int predictedSize =  (totpeers*(totpeers - 1));
+
+    return mLatInfoList.size() >= predictedSize;
+}
+
+void SonobusAudioProcessor::getLatencyInfoList(Array<LatInfo> & retlist)
+{
+    const ScopedLock sl (mLatInfoLock);
+    retlist.addArray(mLatInfoList);
+}
+
+void SonobusAudioProcessor::commitLatencyMatch(float latency)
+{
+    // Adjust the jitter buffer for each peer with extra values to pad up to the requested latency
+
+    const ScopedReadLock sl (mCoreLock);
+    for (int i=0;  i < mRemotePeers.size(); ++i) {
+        auto * peer = mRemotePeers.getUnchecked(i);
+
+        const auto absizeMs = 1e3*currSamplesPerBlock/getSampleRate();
+        float basebuftimeMs = jmax((double) (peer->netBufAutoBaseline > 0.0 ? peer->netBufAutoBaseline : peer->buffertimeMs), absizeMs);
+
+        auto baseline = getRemotePeerIncomingLatency(peer, basebuftimeMs);
+
+        if (baseline < latency) {
+            // we can add some padding
+            auto padms =  (latency - baseline);
+            auto newbuftime = basebuftimeMs + padms;
+            DBG("Adding " << padms << " ms of padding for peer: " << i);
+            setRemotePeerBufferTime(i, newbuftime);
+            // now set the auto baseline
+        }
+        peer->latencyMatched = true;
+
+    }
+}
+
+
+
+void SonobusAudioProcessor::handlePeerInfoMessage(EndpointState * endpoint, const MemoryBlock & data)
+{
+    juce::var infodata;
+    auto result = juce::JSON::parse(data.toString(), infodata);
+    if (result.failed()) {
+        DBG("Peerinfo Json parsing failed: " << result.getErrorMessage());
+        return;
+    }
+
+    const ScopedReadLock sl (mCoreLock);
+
+    // find remote peer
+    RemotePeer * peer = findRemotePeer(endpoint, -1);
+    if (!peer) {
+        DBG("Could not find peer for endpoint");
+        return;
+    }
+
+    handleRemotePeerInfoUpdate(peer, infodata);
+}
+
+void SonobusAudioProcessor::handlePeerInfoRecordMessage(EndpointState * endpoint, const MemoryBlock & data)
+{
+    const ScopedReadLock sl (mCoreLock);
+
+    RemotePeer * peer = findRemotePeer(endpoint, -1);
+    if (!peer) {
+        DBG("Could not find peer for endpoint");
+        return;
+    }
+
+    // a delta only fills in what changed, the rest stays what we had
+    SonoAudio::PeerInfoRecord info = peer->recvdInfo;
+    uint16 fields = 0;
+    uint16 sequence = 0;
+    bool full = false;
+
+    if (!info.decode((const uint8 *) data.getData(), (int) data.getSize(), fields, sequence, full)) {
+        DBG("Peerinfo record parsing failed");
+        return;
+    }
+
+    if (!full) {
+        const int16 ahead = (int16) (uint16) (sequence - peer->infoRecordRecvSequence);
+        if (peer->hasInfoRecordBaseline && ahead <= 0) {
+            // older than what we have already
+            return;
+        }
+        if (!peer->hasInfoRecordBaseline || ahead > 1) {
+            // missed one, what's in this one is still current though
+            peer->hasInfoRecordBaseline = false;
+            sendPeerInfoRequest(peer);
+        }
+    }
+    else {
+        peer->hasInfoRecordBaseline = true;
+    }
+
+    peer->recvdInfo = info;
+    peer->infoRecordRecvSequence = sequence;
+    // they only send these if they take them too
+    peer->remoteTakesInfoRecord = true;
+
+    applyRemotePeerInfo(peer, info, fields);
+}
+
+void SonobusAudioProcessor::handleLayoutInfoMessage(EndpointState * endpoint, int32_t sourceId, const MemoryBlock & data)
+{
+    ValueTree tree = ValueTree::readFromData (data.getData(), data.getSize());
+
+    if (!tree.isValid()) {
+        DBG("layoutinfo parsing failed ");
+        return;
+    }
+    else {
+        DBG("Got layoutinfo");
+    }
+
+    bool changed = false;
+
+    {
+        const ScopedReadLock sl (mCoreLock);
+
+        // find remote peer
+        RemotePeer * peer = findRemotePeer(endpoint, sourceId);
+        if (!peer) {
+            DBG("Could not find peer for endpoint: " << endpoint->ipaddr << "src: " <<  sourceId);
+        }
+        else {
+            peer->recvdChanLayout = true;
+            applyLayoutFormatToPeer(peer, tree);
+            updateRemotePeerSubscription(peer);
+            changed = true;
+        }
+    }
+
+    if (changed) {
+        clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientPeerChangedState, this, "format");
+    }
+}
+
+void SonobusAudioProcessor::handleRemotePeerInfoUpdate(RemotePeer * peer, const juce::var & infodata)
+{
+    // core read lock already held
+
+    // infodata should contain useful info
+
+    DBG("peerinfo: Handle remote peerinfo update ");
+
+    SonoAudio::PeerInfoRecord info;
+    uint16 fields = 0;
+
+    if (infodata.hasProperty("jitbuf")) {
+        info.jitterBufferMs = infodata.getProperty("jitbuf", 0.0f);
+        fields |= SonoAudio::PeerInfoRecord::FieldJitterBuffer;
+    }
+    if (infodata.hasProperty("inlat")) {
+        info.inLatencyMs = infodata.getProperty("inlat", 0.0f);
+        fields |= SonoAudio::PeerInfoRecord::FieldInLatency;
+    }
+    if (infodata.hasProperty("outlat")) {
+        info.outLatencyMs = infodata.getProperty("outlat", 0.0f);
+        fields |= SonoAudio::PeerInfoRecord::FieldOutLatency;
+    }
+    if (infodata.hasProperty("nettype")) {
+        int nettype = infodata.getProperty("nettype", (int) RemoteNetTypeUnknown);
+        DBG("peerinfo: Got remote net type: " << nettype);
+        peer->remoteNetType = nettype;
+    }
+    if (infodata.hasProperty("rec") || infodata.hasProperty("filestream") || infodata.hasProperty("listener")) {
+        // whatever isn't in there stays as it was
+        const bool isrec = infodata.getProperty("rec", (bool) peer->remoteIsRecording);
+        const bool accepts = infodata.getProperty("filestream", (bool) peer->remoteAcceptsFileStream);
+        const bool listener = infodata.getProperty("listener", peer->remoteListener.load());
+        info.status = (isrec ? SonoAudio::PeerInfoRecord::StatusRecording : 0)
+                    | (accepts ? SonoAudio::PeerInfoRecord::StatusFileStream : 0)
+                    | (listener ? SonoAudio::PeerInfoRecord::StatusListener : 0);
+        fields |= SonoAudio::PeerInfoRecord::FieldStatus;
+    }
+    if (infodata.hasProperty("lanmcast")) {
+        info.lanMulticast = infodata.getProperty("lanmcast", false);
+        fields |= SonoAudio::PeerInfoRecord::FieldLanMulticast;
+    }
+    if (infodata.hasProperty("srate")) {
+        info.sampleRate = (uint32) jmax(0, (int) infodata.getProperty("srate", 0));
+        fields |= SonoAudio::PeerInfoRecord::FieldSampleRate;
+    }
+    if (infodata.getProperty("pirec", false)) {
+        // from now on they get the binary records
+        peer->remoteTakesInfoRecord = true;
+    }
+
+    applyRemotePeerInfo(peer, info, fields);
+}
+
+void SonobusAudioProcessor::applyRemotePeerInfo(RemotePeer * peer, const SonoAudio::PeerInfoRecord & info, uint16 fields)
+{
+    // core read lock already held
+
+    if (fields & SonoAudio::PeerInfoRecord::FieldJitterBuffer) {
+        DBG("peerinfo: Got remote jitter buffer: " << info.jitterBufferMs);
+        peer->remoteJitterBufMs = info.jitterBufferMs;
+        applyRemotePeerResendDeadline(peer);
+    }
+    if (fields & SonoAudio::PeerInfoRecord::FieldInLatency) {
+        DBG("peerinfo: Got remote input latency: " << info.inLatencyMs);
+        peer->remoteInLatMs = info.inLatencyMs;
+    }
+    if (fields & SonoAudio::PeerInfoRecord::FieldOutLatency) {
+        DBG("peerinfo: Got remote output latency: " << info.outLatencyMs);
+        peer->remoteOutLatMs = info.outLatencyMs;
+    }
+    if (fields & SonoAudio::PeerInfoRecord::FieldStatus) {
+        const bool isrec = (info.status & SonoAudio::PeerInfoRecord::StatusRecording) != 0;
+        DBG("peerinfo: Got remote recording: " << (int)isrec);
+        peer->remoteIsRecording = isrec;
+
+        const bool accepts = (info.status & SonoAudio::PeerInfoRecord::StatusFileStream) != 0;
+        if (accepts != peer->remoteAcceptsFileStream) {
+            peer->remoteAcceptsFileStream = accepts;
+            // reconsider the direct file streaming on the message thread
+            mTransportSource.sendChangeMessage();
+        }
+
+        const bool listener = (info.status & SonoAudio::PeerInfoRecord::StatusListener) != 0;
+        if (listener != peer->remoteListener.load()) {
+            DBG("peerinfo: Got remote listener: " << (int)listener);
+            applyRemotePeerListener(peer, listener);
+        }
+    }
+    if (fields & SonoAudio::PeerInfoRecord::FieldLanMulticast) {
+        DBG("peerinfo: Got remote LAN multicast: " << (int)info.lanMulticast);
+        peer->endpoint->lanMulticastListener = info.lanMulticast;
+    }
+    if (fields & SonoAudio::PeerInfoRecord::FieldSampleRate) {
+        DBG("peerinfo: Got remote sample rate: " << (int) info.sampleRate);
+        // the session rate follows on the event thread
+        peer->remoteSampleRate = (int) info.sampleRate;
+    }
+
+    peer->hasRemoteInfo = true;
+
+    updateRemotePeerEstLatency(peer);
+}
+
+void SonobusAudioProcessor::applyRemotePeerListener(RemotePeer * peer, bool listener)
+{
+    // core read lock already held
+    const ScopedLock fl (mPeerFxLock);
+
+    if (listener) {
+        // once the snapshot is out no processBlock renders them or mixes them into
+        // a send anymore, then their effects can go
+        peer->remoteListener = true;
+        publishPeerSnapshot();
+        for (auto & chgroup : peer->chanGroups) {
+            chgroup.release();
+        }
+    }
+    else {
+        for (auto & chgroup : peer->chanGroups) {
+            chgroup.init(getSampleRate());
+        }
+        peer->remoteListener = false;
+        publishPeerSnapshot();
+    }
+
+    // listeners share a source with each other
+    mNeedsSendRegroup = true;
+    notifySendThread();
+}
+
+void SonobusAudioProcessor::sendRemotePeerInfoUpdate(int index, RemotePeer * topeer)
+{
+    bool marked = false;
+
+    {
+        const ScopedReadLock sl (mCoreLock);
+        for (int i=0;  i < mRemotePeers.size(); ++i) {
+            auto * peer = mRemotePeers.getUnchecked(i);
+            if (topeer && topeer != peer) continue;
+            if (index >= 0 && index != i) continue;
+
+            peer->infoUpdatePending = true;
+            marked = true;
+
+            if (index == i || topeer == peer) break;
+        }
+    }
+
+    if (marked && !mPeerInfoUpdatePending.load()) {
+        // the first one of a burst starts the clock
+        mPeerInfoUpdateDueMs = Time::getMillisecondCounterHiRes() + PEER_INFO_DEBOUNCE_MS;
+        mPeerInfoUpdatePending = true;
+        notifySendThread();
+    }
+}
+
+void SonobusAudioProcessor::flushPeerInfoUpdates(double nowMs)
+{
+    // core read lock already held
+
+    if (!mPeerInfoUpdatePending.load() || nowMs < mPeerInfoUpdateDueMs.load()) return;
+    mPeerInfoUpdatePending = false;
+
+    // a block of ours plus what the audio device reports, if we know it
+    const double blockms = 1e3 * currSamplesPerBlock / getSampleRate();
+
+    SonoAudio::PeerInfoRecord info;
+    info.inLatencyMs = (float) (blockms + mDeviceInputLatencyMs.load());
+    info.outLatencyMs = (float) (blockms + mDeviceOutputLatencyMs.load());
+    info.status = (isRecordingToFile() ? SonoAudio::PeerInfoRecord::StatusRecording : 0)
+                | SonoAudio::PeerInfoRecord::StatusFileStream // we take pre-encoded file playback on a source of its own
+                | (mListenerRole.load() ? SonoAudio::PeerInfoRecord::StatusListener : 0);
+    info.sampleRate = (uint32) jmax(0, (int) getSampleRate());
+
+    for (auto * peer : mRemotePeers) {
+        if (!peer->infoUpdatePending.exchange(false)) continue;
+
+        info.jitterBufferMs = (float) jmax((double)peer->buffertimeMs, blockms);
+        // if they can send to us through the LAN multicast group
+        info.lanMulticast = peer->lanMulticastReachable;
+
+        if (peer->remoteTakesInfoRecord.load()) {
+            sendPeerInfoRecord(peer, info);
+        } else {
+            sendPeerInfoJson(peer, info);
+        }
+    }
+}
+
+void SonobusAudioProcessor::sendPeerInfoJson(RemotePeer * peer, const SonoAudio::PeerInfoRecord & info)
+{
+    // for peers that haven't told us they take the records yet
+    DynamicObject::Ptr obj = new DynamicObject(); // this will delete itself
+
+    obj->setProperty("inlat", info.inLatencyMs);
+    obj->setProperty("outlat", info.outLatencyMs);
+    obj->setProperty("rec", (info.status & SonoAudio::PeerInfoRecord::StatusRecording) != 0);
+    obj->setProperty("filestream", (info.status & SonoAudio::PeerInfoRecord::StatusFileStream) != 0);
+    obj->setProperty("listener", (info.status & SonoAudio::PeerInfoRecord::StatusListener) != 0);
+    obj->setProperty("jitbuf", info.jitterBufferMs);
+    obj->setProperty("lanmcast", info.lanMulticast);
+    obj->setProperty("srate", (int) info.sampleRate);
+    obj->setProperty("pirec", SonoAudio::PeerInfoRecord::formatVersion); // we take the records
+
+    // nettype TODO
+
+    String jsonstr = JSON::toString(obj.get(), true, 6);
+
+    if (jsonstr.getNumBytesAsUTF8() > AOO_MAXPACKETSIZE - 100) {
+        DBG("Info too big for packet!");
+        return;
+    }
+
+    char buf[AOO_MAXPACKETSIZE];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+
+    try {
+        msg << osc::BeginMessage(SONOBUS_FULLMSG_PEERINFO)
+        << osc::Blob(jsonstr.toRawUTF8(), (int) jsonstr.getNumBytesAsUTF8())
+        << osc::EndMessage;
+    }
+    catch (const osc::Exception& e){
+        DBG("exception in PEERINFO message constructions: " << e.what());
+        return;
+    }
+
+    DBG("Sending peerinfo message to " << peer->endpoint->ipaddr);
+    this->sendPeerMessage(peer, msg.Data(), (int32_t) msg.Size(), SendLaneBulk);
+}
+
+void SonobusAudioProcessor::sendPeerInfoRecord(RemotePeer * peer, const SonoAudio::PeerInfoRecord & info)
+{
+    // /sb/pirec b:record
+
+    const bool full = peer->infoRecordFullNeeded.exchange(false);
+    const uint16 fields = full ? (uint16) SonoAudio::PeerInfoRecord::AllFields : info.changedFrom(peer->lastSentInfo);
+
+    if (fields == 0) return; // nothing they don't already know
+
+    uint8 record[SonoAudio::PeerInfoRecord::maxSize];
+    const int recsize = info.encode(record, fields, peer->infoRecordSendSequence, full);
+
+    char buf[128];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+
+    try {
+        msg << osc::BeginMessage(SONOBUS_FULLMSG_PEERINFOREC)
+        << osc::Blob(record, recsize)
+        << osc::EndMessage;
+    }
+    catch (const osc::Exception& e){
+        DBG("exception in PEERINFOREC message constructions: " << e.what());
+        if (full) peer->infoRecordFullNeeded = true;
+        return;
+    }
+
+    this->sendPeerMessage(peer, msg.Data(), (int32_t) msg.Size(), SendLaneBulk);
+
+    peer->lastSentInfo = info;
+    ++peer->infoRecordSendSequence;
+}
+
+void SonobusAudioProcessor::sendPeerInfoRequest(RemotePeer * peer)
+{
+    // /sb/pireq  no args, asks them for a full record
+
+    char buf[64];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+
+    try {
+        msg << osc::BeginMessage(SONOBUS_FULLMSG_PEERINFOREQ)
+        << osc::EndMessage;
+    }
+    catch (const osc::Exception& e){
+        DBG("exception in PEERINFOREQ message constructions: " << e.what());
+        return;
+    }
+
+    DBG("Asking for a full peerinfo record from " << peer->endpoint->ipaddr);
+    this->sendPeerMessage(peer, msg.Data(), (int32_t) msg.Size(), SendLaneControl);
+}
+
+
+int32_t SonobusAudioProcessor::sendPeerMessage(RemotePeer * peer, const char *msg, int32_t n, SendLane lane)
+{
+    if (lane == SendLaneRealtime || !peer->endpoint || n <= 0) {
+        return endpoint_send(peer->endpoint, msg, n);
+    }
+
+    // goes out after the media of the next send round, see flushSendLanes()
+    {
+        const ScopedLock sl (mSendLanesLock);
+        auto & queue = mSendLanes[lane];
+        if (queue.size() >= SEND_LANE_MAX_QUEUED) {
+            queue.pop_front();
+        }
+        queue.push_back({ peer->endpoint, Time::getMillisecondCounterHiRes(), MemoryBlock(msg, (size_t) n) });
+    }
+    notifySendThread();
+    return n;
+}
+
+void SonobusAudioProcessor::flushSendLanes(double nowms)
+{
+    // send thread, once the media and the pings of the round are out
+    const ScopedLock sl (mSendLanesLock);
+
+    mBulkSendTokens = jmin(SEND_LANE_BULK_BURST, mBulkSendTokens + jmax(0.0, nowms - mBulkSendLastMs) * 1e-3 * SEND_LANE_BULK_RATE);
+    mBulkSendLastMs = nowms;
+
+    for (int lane = SendLaneControl; lane < SendLaneCount; ++lane) {
+        auto & queue = mSendLanes[lane];
+        while (!queue.empty()) {
+            const auto & msg = queue.front();
+            // the endpoint may not be around anymore
+            if (nowms - msg.queuedMs > SEND_LANE_MAX_AGE_MS) {
+                queue.pop_front();
+                continue;
+            }
+            const double size = (double) msg.data.getSize();
+            if (lane == SendLaneBulk) {
+                // one bigger than the burst still goes once it's full
+                if (mBulkSendTokens < jmin(size, SEND_LANE_BULK_BURST)) {
+                    // the rest waits for the next round
+                    notifySendThread();
+                    break;
+                }
+                mBulkSendTokens -= size;
+            }
+            endpoint_send(msg.endpoint, (const char *) msg.data.getData(), (int32_t) msg.data.getSize());
+            queue.pop_front();
+        }
+    }
+}
+
+
+void SonobusAudioProcessor::doSendData()
+{
+    // just try to send for everybody
+    const ScopedReadLock sl (mCoreLock);        
+
+    // send stuff until there is nothing left to send
+    
+    int32_t didsomething = 1;
+
+    auto nowtimems = Time::getMillisecondCounterHiRes();
+
+    while (didsomething) {
+        //mAooSource->send();
+        didsomething = 0;
+        
+        didsomething |= mAooDummySource->send();
+        
+        if (mAooClient) {
+            mAooClient->send();
+        }
+    }
+
+    if (nowtimems > mLastSocketBufferUpdateMs + SOCKET_BUFFER_UPDATE_INTERVAL_MS) {
+        updateSocketBufferSizes();
+        mLastSocketBufferUpdateMs = nowtimems;
+    }
+
+    if (mNeedsSendRegroup.exchange(false) || nowtimems > mLastSendRegroupTimeMs + SHARED_SEND_REGROUP_INTERVAL_MS) {
+        if (mMixNodeMode.load()) {
+            updateMixNodeRouting();
+        }
+        updateSharedSendGroups();
+        // a format change can make peers need another resampler
+        if (needsSendResamplingUpdate()) {
+            publishPeerSnapshot();
+        }
+        mLastSendRegroupTimeMs = nowtimems;
+    }
+
+    // encoding happens in the sources' send(), so spread the peers over the send workers
+    if (mParallelPeerSend.load() && mPeerSendPool && mRemotePeers.size() > 1) {
+        mPeerSendPool->send(mRemotePeers.getRawDataPointer(), mRemotePeers.size());
+    }
+    else {
+        sendRemotePeers(mRemotePeers.getRawDataPointer(), mRemotePeers.size(), 0, 1);
+    }
+
+    bool idle = true;
+    for (auto & remote : mRemotePeers) {
+        if (remote->sendActive || remote->recvActive) {
+            idle = false;
+            break;
+        }
+    }
+    mNetworkIdle = idle;
+
+    // while power saving in an idle session the peers are pinged less often, and all
+    // in the same round when the first one is due, so the radio can doze in between
+    const bool backoff = idle && mPowerSaving.load();
+    const double pinginterval = backoff ? PEER_PING_INTERVAL_MS * POWER_SAVING_PING_BACKOFF : PEER_PING_INTERVAL_MS;
+    double pingdue = nowtimems;
+    if (backoff) {
+        for (auto & remote : mRemotePeers) {
+            if (nowtimems > remote->lastSendPingTimeMs + pinginterval) {
+                pingdue = nowtimems + 0.5 * pinginterval;
+                break;
+            }
+        }
+    }
+
+    for (auto & remote : mRemotePeers) {
+        if (mAutoPacketSize.load() || remote->autoPacketsize.load() > 0) {
+            updatePathMtu(remote, nowtimems);
+        }
+
+        if ( pingdue > (remote->lastSendPingTimeMs + pinginterval) ) {
+            // while we stream to them the AOO ping carried by our audio data measures
+            // the round trip already, so only send our own ping if that has gone quiet.
+            // the session metronome needs ours though, for the clock offset
+            if (mSyncMetToSession.load() || nowtimems > remote->lastRttTimeMs + 1.5 * pinginterval) {
+                sendPingEvent(remote);
+            }
+            remote->lastSendPingTimeMs = nowtimems;
+
+            // the stream keeps the path open, so the client can skip its keepalive ping
+            if (mAooClient && remote->dataPacketsSent != remote->lastTrafficPacketsSent) {
+                mAooClient->peer_traffic(remote->endpoint->getRawAddr());
+                remote->lastTrafficPacketsSent = remote->dataPacketsSent;
+            }
+            if (!remote->haveSentFirstPeerInfo) {
+                sendRemotePeerInfoUpdate(-1, remote);
+                remote->haveSentFirstPeerInfo = true;
+            }
+
+            // tell them when we start or stop getting their probes on the LAN multicast group
+            const bool reachable = nowtimems < remote->endpoint->lanMulticastRecvMs.load() + LAN_MULTICAST_TIMEOUT_MS;
+            if (reachable != remote->lanMulticastReachable) {
+                remote->lanMulticastReachable = reachable;
+                sendRemotePeerInfoUpdate(-1, remote);
+            }
+        }
+    }
+
+    if (auto * multicast = mLanMulticastDest.load()) {
+        if (mRemotePeers.size() > 0 && nowtimems > mLastLanMulticastProbeMs + LAN_MULTICAST_PROBE_INTERVAL_MS) {
+            sendLanMulticastProbe(multicast);
+            mLastLanMulticastProbeMs = nowtimems;
+        }
+    }
+
+    // the session metronome goes round regularly, that's how everyone ends up on the same one
+    if (mSyncMetToSession.load() && (mMetSessionSendPending.exchange(false) || nowtimems > mLastMetSessionSendMs + PEER_PING_INTERVAL_MS)) {
+        sendMetSessionSync();
+        mLastMetSessionSendMs = nowtimems;
+    }
+
+    if (mPendingUnmute.get() && mPendingUnmuteAtStamp < Time::getMillisecondCounter() ) {
+        DBG("UNMUTING ALL");
+        mState.getParameter(paramMainRecvMute)->setValueNotifyingHost(0.0f);
+
+        mPendingUnmute = false;
+    }
+
+    if (mNeedsSampleSetup.get()) {
+        DBG("Doing sample setup for all");
+        setupSourceFormatsForAll();
+        mNeedsSampleSetup = false;
+
+        // reset all incoming by toggling muting
+        if (!mMainRecvMute.get()) {
+            DBG("Toggling main recv mute");
+            mState.getParameter(paramMainRecvMute)->setValueNotifyingHost(1.0f);
+            mPendingUnmuteAtStamp = Time::getMillisecondCounter() + 250;
+            mPendingUnmute = true;
+        }
+
+        sendRemotePeerInfoUpdate(-1); // send to all
+
+    }
+
+    flushPeerInfoUpdates(Time::getMillisecondCounterHiRes());
+
+    flushSendLanes(Time::getMillisecondCounterHiRes());
+}
+
+// the time one block of audio takes, which is what a backlog gets spread over
+double SonobusAudioProcessor::getSendPacingIntervalMs() const
+{
+    if (!mSendPacing.load() || getSampleRate() <= 0.0) return 0.0;
+    return 1e3 * currSamplesPerBlock / getSampleRate();
+}
+
+// audio thread, sends the audio data the sources of the peers have ready right away,
+// instead of waiting for the send thread to wake up for it. Everything else is left
+// to the send thread (woken at the end of the block anyway), and so is all of it
+// while the send thread is busy, and a source whose locks are taken (try_send()
+// returns -1): the audio thread never waits for a lock, nor for the socket
+void SonobusAudioProcessor::sendInline(RemotePeer * const * peers, int count)
+{
+    TraceRecorder::Scope trace ("inline send");
+
+    if (!mCoreLock.tryEnterRead()) return;
+
+    mNetworkEngine->trySendInline(*this, [&] {
+        for (int i = 0; i < count; ++i) {
+            auto * remote = peers[i];
+
+            // a shared source has its followers to see to, which the send thread does
+            if (!remote->oursource || !remote->inlineSendable.load(std::memory_order_relaxed)
+                || remote->sendFollowers.load() > 0 || remote->sendLeader.load() != nullptr) {
+                continue;
+            }
+
+            const auto sendstart = SonoAudio::ProcessTimingTracker::now();
+            while (remote->oursource->try_send() > 0) {
+                remote->dataPacketsSent += 1;
+            }
+            remote->encodeTicks.fetch_add(SonoAudio::ProcessTimingTracker::now() - sendstart, std::memory_order_relaxed);
+        }
+    });
+
+    mCoreLock.exitRead();
+}
+
+// sends everything pending for every numShards'th peer, starting at shard.
+// Called with the core lock held, either from the send thread or a send worker.
+int32_t SonobusAudioProcessor::sendRemotePeers(RemotePeer * const * peers, int count, int shard, int numShards)
+{
+    int32_t didany = 0;
+    int32_t didsomething = 1;
+
+    while (didsomething) {
+        didsomething = 0;
+
+        for (int i = shard; i < count; i += numShards) {
+            auto * remote = peers[i];
+
+            if (remote->oursource) {
+                // with server forwarding the data shared with our followers is only uploaded once
+                ForwardBatch * forward = nullptr;
+                if (remote->sendFollowers.load() > 0) {
+                    auto * server = mServerForwarding.load() && mAooClient ? mRelayEndpoint.load() : nullptr;
+                    auto * multicast = mLanMulticastDest.load();
+                    if (server || multicast) {
+                        forward = &remote->forwardBatch;
+                        forward->client = mAooClient.get();
+                        forward->server = server;
+                        forward->multicast = multicast;
+                        forward->route = remote->ourId;
+                        currentForwardBatch = forward;
+                    }
+                }
+
+                const auto sendstart = SonoAudio::ProcessTimingTracker::now();
+                auto sent = remote->oursource->send();
+                remote->encodeTicks.fetch_add(SonoAudio::ProcessTimingTracker::now() - sendstart, std::memory_order_relaxed);
+
+                if (forward) {
+                    currentForwardBatch = nullptr;
+                    forward->flush();
+                }
+                if (sent) {
+                    remote->dataPacketsSent += 1;
+                }
+                didsomething |= sent;
+            }
+            if (remote->oursink) {
+                didsomething |= remote->oursink->send();
+            }
+
+            if (remote->latencyTestReady) {
+                didsomething |= remote->latencysource->send();
+                didsomething |= remote->latencysink->send();
+                didsomething |= remote->echosource->send();
+                didsomething |= remote->echosink->send();
+                didsomething |= remote->filestreamsource->send();
+            }
+        }
+
+        didany |= didsomething;
+    }
+
+    return didany;
+}
+
+#if ! JUCE_WINDOWS
+// marks both the IPv4 and IPv6 traffic of the dual-stack socket
+static bool setSocketTrafficClass(int fd, int dscp)
+{
+    const int tos = (dscp & 0x3f) << 2;
+    bool ok = setsockopt(fd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)) == 0;
+#ifdef IPV6_TCLASS
+    ok = (setsockopt(fd, IPPROTO_IPV6, IPV6_TCLASS, &tos, sizeof(tos)) == 0) || ok;
+#endif
+#if JUCE_LINUX || JUCE_ANDROID
+    // also gets it ahead in the local queues (and the wifi voice access category)
+    const int priority = dscp >= 40 ? 6 : 0; // TC_PRIO_INTERACTIVE
+    setsockopt(fd, SOL_SOCKET, SO_PRIORITY, &priority, sizeof(priority));
+#endif
+    return ok;
+}
+#endif
+
+void SonobusAudioProcessor::applySocketQos()
+{
+    if (!mUdpSocket) return;
+
+    const int dscp = mNetworkDscp.load();
+
+#if JUCE_WINDOWS
+    const ScopedLock el (mEndpointsLock);
+    if (!mSocketQos) {
+        mSocketQos = std::make_unique<SocketQosFlows>();
+    }
+    if (mSocketQos->open((uintptr_t) mUdpSocket->getRawSocketHandle(), dscp)) {
+        for (auto * endpoint : mEndpoints) {
+            socklen_t addrlen;
+            mSocketQos->addDestination(endpoint->getSendAddr(addrlen));
+        }
+    }
+#else
+    if (!setSocketTrafficClass(mUdpSocket->getRawSocketHandle(), dscp)) {
+        DBG("Error setting traffic class on socket: " << errno);
+    }
+    if (mPathUdpSocket) {
+        setSocketTrafficClass(mPathUdpSocket->getRawSocketHandle(), dscp);
+    }
+#endif
+}
+
+void SonobusAudioProcessor::setNetworkDscp(int dscp)
+{
+    mNetworkDscp = jlimit(0, 63, dscp);
+
+    const ScopedReadLock sl (mCoreLock);
+    applySocketQos();
+}
+
+// the IPv4 address of an interface other than the one the default route goes out of
+static String findSecondaryLocalAddress()
+{
+    String primary;
+
+    // connecting a UDP socket sends nothing, it only makes the system pick the route
+    auto fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd >= 0) {
+        struct sockaddr_in probe;
+        zerostruct(probe);
+        probe.sin_family = AF_INET;
+        probe.sin_port = htons(9);
+        inet_pton(AF_INET, "192.0.2.1", &probe.sin_addr); // TEST-NET-1
+
+        if (::connect(fd, (const struct sockaddr *) &probe, sizeof(probe)) == 0) {
+            struct sockaddr_in local;
+            socklen_t len = sizeof(local);
+            char buf[INET_ADDRSTRLEN];
+            if (getsockname(fd, (struct sockaddr *) &local, &len) == 0
+                && inet_ntop(AF_INET, &local.sin_addr, buf, sizeof(buf))) {
+                primary = buf;
+            }
+        }
+#if JUCE_WINDOWS
+        closesocket(fd);
+#else
+        ::close(fd);
+#endif
+    }
+
+    for (auto & addr : IPAddress::getAllAddresses(false)) {
+        auto straddr = addr.toString();
+        if (addr != IPAddress::local(false) && straddr != primary && !straddr.startsWith("169.254.")) {
+            return straddr;
+        }
+    }
+    return {};
+}
+
+bool SonobusAudioProcessor::openPathSocket()
+{
+    if (mPathUdpSocket || !mUdpSocket) return mPathUdpSocket != nullptr;
+
+    String localaddr = getMultipathLocalAddress();
+    if (localaddr.isEmpty()) {
+        localaddr = findSecondaryLocalAddress();
+    }
+    if (localaddr.isEmpty()) {
+        DBG("No second interface for multi-path sending");
+        return false;
+    }
+
+    // IPv4 only, bound to the interface address so the system routes it out that interface
+    auto socket = std::make_unique<DatagramSocket>(false, false);
+    socket->setSendBufferSize(SOCKET_BUFFER_MIN_SIZE);
+    socket->setReceiveBufferSize(SOCKET_BUFFER_MIN_SIZE);
+
+    if (!socket->bindToPort(0, localaddr)) {
+        DBG("Error binding multi-path socket to " << localaddr);
+        return false;
+    }
+
+    DBG("Multi-path socket bound to " << localaddr << ":" << socket->getBoundPort());
+
+    {
+        const ScopedWriteLock sl (mCoreLock);
+        mPathUdpSocket = std::move(socket);
+#if ! JUCE_WINDOWS
+        setSocketTrafficClass(mPathUdpSocket->getRawSocketHandle(), mNetworkDscp.load());
+#endif
+    }
+
+    mNetworkEngine->addSocket(*this, *mPathUdpSocket);
+    return true;
+}
+
+// everybody in a server group ends up on the same multicast group, the sinks
+// sort out the streams by the sender's address, the same as for unicast
+static String getLanMulticastAddress(const String & group)
+{
+    const auto hash = (uint32) group.hashCode();
+    return "239.255." + String((hash >> 8) & 0xff) + "." + String(jmax((uint32) 1, hash & 0xff));
+}
+
+// follows the option and the joined group, called on the event thread
+void SonobusAudioProcessor::updateLanMulticast()
+{
+    const String group = mLanMulticast.load() && mUdpSocket ? getCurrentJoinedGroup() : String();
+    const String address = group.isNotEmpty() ? getLanMulticastAddress(group) : String();
+    if (address == mLanMulticastAddress) return;
+
+    // stop listening to the old group first
+    if (mLanMulticastSocket) {
+        mNetworkEngine->removeSocket(*mLanMulticastSocket);
+    }
+    {
+        const ScopedWriteLock sl (mCoreLock);
+        mLanMulticastDest = nullptr;
+        mLanMulticastSocket.reset();
+    }
+    mLanMulticastAddress = address;
+
+    if (address.isEmpty()) return;
+
+    // all of the group listen on the same port
+    auto socket = std::make_unique<DatagramSocket>(false, false);
+    socket->setEnablePortReuse(true);
+    socket->setReceiveBufferSize(SOCKET_BUFFER_MIN_SIZE);
+
+    if (!socket->bindToPort(LAN_MULTICAST_PORT) || !socket->joinMulticast(address)) {
+        DBG("Error joining LAN multicast group " << address);
+        return;
+    }
+
+    DBG("Listening to LAN multicast group " << address << ":" << LAN_MULTICAST_PORT);
+
+    {
+        const ScopedWriteLock sl (mCoreLock);
+        mLanMulticastSocket = std::move(socket);
+
+        // we send to it from our main socket, so the peers know where it's from
+        const ScopedLock el (mEndpointsLock);
+        EndpointState * dest = nullptr;
+        for (auto * ep : mLanMulticastEndpoints) {
+            if (ep->ipaddr == address) {
+                dest = ep;
+                break;
+            }
+        }
+        if (!dest) {
+            dest = mLanMulticastEndpoints.add(new EndpointState(address, LAN_MULTICAST_PORT));
+            dest->owner = mUdpSocket.get();
+            dest->cipher = mPacketCipher.load();
+        }
+        mLanMulticastDest = dest;
+    }
+
+    mNetworkEngine->addSocket(*this, *mLanMulticastSocket, true);
+}
+
+// follows the options, the user name and our port, and connects to the peers in
+// the same LAN group as they show up, called on the event thread
+void SonobusAudioProcessor::updateLanDiscovery()
+{
+    const double nowtimems = Time::getMillisecondCounterHiRes();
+    const bool enabled = mLanDiscoveryEnabled.load() && mUdpSocket;
+    const String group = enabled ? getLanDiscoveryGroup() : String();
+    const String username = enabled ? getCurrentUsername() : String();
+    const int port = mUdpLocalPort;
+
+    const bool changed = !mLanDiscovery || !mLanDiscovery->isRunning() || mLanDiscovery->getGroupName() != group
+                          || mLanDiscovery->getUserName() != username || mLanDiscovery->getPort() != port;
+
+    if (!enabled || changed) {
+        if (mLanDiscovery && mLanDiscovery->isRunning()) {
+            mLanDiscovery->stop();
+
+            // the ones we found that way go with it (they're already gone with the socket)
+            if (mUdpSocket) {
+                for (auto & item : mLanDiscoveryPeers) {
+                    removeAllRemotePeersWithEndpoint(findOrAddEndpoint(item.second.first, item.second.second));
+                }
+            }
+            mLanDiscoveryPeers.clear();
+        }
+
+        if (!enabled || nowtimems < mLanDiscoveryRetryMs) return;
+
+        if (!mLanDiscovery) {
+            mLanDiscovery = std::make_unique<SonoAudio::LanDiscovery>();
+        }
+        if (!mLanDiscovery->start(username, group, port)) {
+            mLanDiscoveryRetryMs = nowtimems + LAN_DISCOVERY_RETRY_MS;
+            return;
+        }
+    }
+
+    Array<SonoAudio::LanDiscovery::Peer> found, lost;
+    mLanDiscovery->service(nowtimems, found, lost);
+
+    for (auto & peer : lost) {
+        auto it = mLanDiscoveryPeers.find(peer.instance);
+        if (it == mLanDiscoveryPeers.end()) continue;
+
+        DBG("LAN peer " << peer.userName << " left, at " << peer.host << ":" << peer.port);
+        removeAllRemotePeersWithEndpoint(findOrAddEndpoint(it->second.first, it->second.second));
+        mLanDiscoveryPeers.erase(it);
+    }
+
+    for (auto & peer : found) {
+        if (peer.groupName != group || mLanDiscoveryPeers.count(peer.instance) > 0) continue;
+
+        // already connected some other way, through a server group most likely
+        bool known = false;
+        {
+            const ScopedReadLock sl (mCoreLock);
+            for (auto * remote : mRemotePeers) {
+                if (remote->userName == peer.userName && peer.userName.isNotEmpty()) {
+                    known = true;
+                    break;
+                }
+            }
+        }
+        if (known) continue;
+
+        DBG("Connecting to LAN peer " << peer.userName << " at " << peer.host << ":" << peer.port);
+        mLanDiscoveryPeers[peer.instance] = { peer.host, peer.port };
+        connectRemotePeer(peer.host, peer.port, peer.userName, peer.groupName, true);
+    }
+}
+
+void SonobusAudioProcessor::setDoubleEnderRecording(bool flag)
+{
+    mDoubleEnderRecording = flag;
+    notifyEventThread();
+}
+
+void SonobusAudioProcessor::setDoubleEnderCollecting(bool flag)
+{
+    mDoubleEnderCollecting = flag;
+    notifyEventThread();
+}
+
+File SonobusAudioProcessor::getDoubleEnderDirectory() const
+{
+    return File(mDefaultRecordDir).getChildFile("Double-Ender");
+}
+
+// as the host, collects the uploads and tells the peers whether we're recording.
+// as a peer, records our own input while a host does and uploads it once they
+// stop. called on the event thread
+void SonobusAudioProcessor::updateDoubleEnder()
+{
+    const double nowtimems = Time::getMillisecondCounterHiRes();
+
+    const bool collecting = mDoubleEnderCollecting.load() && mUdpSocket;
+
+    if (collecting && !mDoubleEnderCollector && nowtimems >= mDoubleEnderCollectRetryMs) {
+        auto collector = std::make_unique<SonoAudio::DoubleEnderCollector>();
+        collector->isAllowed = [this] (const String & host) { return isDoubleEnderUploadAllowed(host); };
+        collector->onReceived = [this] (const SonoAudio::DoubleEnderCollector::Upload & upload) {
+            alignDoubleEnderUpload(upload.file, upload.startTime);
+        };
+
+        if (collector->start(getDoubleEnderDirectory())) {
+            mDoubleEnderCollector = std::move(collector);
+            mDoubleEnderAnnounceNow = true;
+        } else {
+            mDoubleEnderCollectRetryMs = nowtimems + DOUBLE_ENDER_RETRY_MS;
+        }
+    }
+    else if (!collecting && mDoubleEnderCollector) {
+        // an upload coming in right now is dropped, it gets tried again
+        mDoubleEnderCollector.reset();
+        if (mUdpSocket) {
+            sendDoubleEnderHost(0, false);
+        }
+    }
+
+    if (mDoubleEnderCollector && (mDoubleEnderAnnounceNow.exchange(false) || nowtimems > mLastDoubleEnderAnnounceMs + DOUBLE_ENDER_ANNOUNCE_MS)) {
+        sendDoubleEnderHost(mDoubleEnderCollector->getPort(), writingPossible.load() || userWritingPossible.load());
+        mLastDoubleEnderAnnounceMs = nowtimems;
+    }
+
+    const bool recording = mDoubleEnderRecording.load() && mUdpSocket;
+
+    if (mDoubleEnderTrack) {
+        // keep going while our host records, and is still around
+        bool hostrecording = false;
+        {
+            const ScopedReadLock sl (mCoreLock);
+            for (auto * remote : mRemotePeers) {
+                if (!remote->endpoint || remote->endpoint->ipaddr != mDoubleEnderHostAddress || remote->endpoint->port != mDoubleEnderHostUdpPort) continue;
+
+                hostrecording = remote->dubHostRecording.load() && nowtimems < remote->dubHostSeenMs.load() + DOUBLE_ENDER_HOST_TIMEOUT_MS;
+                if (remote->dubHostPort.load() > 0) {
+                    mDoubleEnderUploadPort = remote->dubHostPort.load();
+                }
+                if (remote->clockOffset.isValid()) {
+                    mDoubleEnderClockOffset = remote->clockOffset.getOffset();
+                    mDoubleEnderClockKnown = true;
+                }
+                break;
+            }
+        }
+
+        if (!hostrecording || !recording) {
+            stopDoubleEnderRecording();
+        }
+    }
+    else if (recording && nowtimems >= mDoubleEnderRecordRetryMs) {
+        String hostaddr;
+        int hostport = 0;
+        int uploadport = 0;
+        {
+            const ScopedReadLock sl (mCoreLock);
+            for (auto * remote : mRemotePeers) {
+                if (remote->endpoint && remote->dubHostRecording.load() && remote->dubHostPort.load() > 0
+                    && nowtimems < remote->dubHostSeenMs.load() + DOUBLE_ENDER_HOST_TIMEOUT_MS) {
+                    hostaddr = remote->endpoint->ipaddr;
+                    hostport = remote->endpoint->port;
+                    uploadport = remote->dubHostPort.load();
+                    break;
+                }
+            }
+        }
+
+        if (hostaddr.isNotEmpty()) {
+            if (startDoubleEnderRecording()) {
+                mDoubleEnderHostAddress = hostaddr;
+                mDoubleEnderHostUdpPort = hostport;
+                mDoubleEnderUploadPort = uploadport;
+                mDoubleEnderClockKnown = false;
+                mDoubleEnderClockOffset = 0;
+            } else {
+                mDoubleEnderRecordRetryMs = nowtimems + DOUBLE_ENDER_RETRY_MS;
+            }
+        }
+    }
+
+    if (mDoubleEnderUploader) {
+        mDoubleEnderUploader->setRateLimit(mDoubleEnderUploadRate.load() * 1024);
+        mDoubleEnderPendingUploads = mDoubleEnderUploader->getNumPending();
+    }
+}
+
+void SonobusAudioProcessor::sendDoubleEnderHost(int port, bool recording)
+{
+    char buf[64];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+
+    try {
+        msg << osc::BeginMessage(SONOBUS_FULLMSG_DUBHOST)
+        << (int32_t) port << recording
+        << osc::EndMessage;
+    }
+    catch (const osc::Exception& e){
+        DBG("exception in dubhost message construction: " << e.what());
+        return;
+    }
+
+    const ScopedReadLock sl (mCoreLock);
+    for (auto * peer : mRemotePeers) {
+        this->sendPeerMessage(peer, msg.Data(), (int32_t) msg.Size(), SendLaneControl);
+    }
+}
+
+void SonobusAudioProcessor::setShareBackingTrack(bool flag)
+{
+    mShareBackingTrack = flag;
+    notifyEventThread();
+}
+
+File SonobusAudioProcessor::getBackingTrackDirectory() const
+{
+    return File(mDefaultRecordDir).getChildFile("Backing Tracks");
+}
+
+// as the one sending a backing track, offers the file and, once everyone has it,
+// stops streaming it and tells them where we are in it instead. as a peer, fetches
+// what's offered and plays along with whoever plays theirs. called on the event thread
+void SonobusAudioProcessor::updateBackingTrackShare()
+{
+    const double nowtimems = Time::getMillisecondCounterHiRes();
+    const bool sharing = mShareBackingTrack.load() && mUdpSocket;
+
+    File offerfile;
+    if (sharing && mSendPlaybackAudio.get()) {
+        const ScopedLock sl (mBackingTrackOfferLock);
+        offerfile = mBackingTrackOfferFile;
+    }
+
+    if (offerfile != File() && !mBackingTrackServer && nowtimems >= mBackingTrackServerRetryMs) {
+        auto server = std::make_unique<SonoAudio::BackingTrackServer>();
+        // the same ones a double-ender upload can come from
+        server->isAllowed = [this] (const String & host) { return isDoubleEnderUploadAllowed(host); };
+
+        if (server->start()) {
+            mBackingTrackServer = std::move(server);
+            mLastBackingTrackOfferMs = 0.0;
+        } else {
+            mBackingTrackServerRetryMs = nowtimems + BACKING_TRACK_RETRY_MS;
+        }
+    }
+    else if (offerfile == File() && mBackingTrackServer) {
+        mBackingTrackServer.reset();
+        if (mUdpSocket) {
+            sendBackingTrackOffer(0, String(), String());
+        }
+    }
+
+    String offerid;
+    bool shared = false;
+
+    if (mBackingTrackServer) {
+        mBackingTrackServer->setOffer(offerfile);
+        mBackingTrackServer->setRateLimit(BACKING_TRACK_RATE_KBPS * 1024);
+        offerid = mBackingTrackServer->getOfferId();
+
+        if (offerid.isNotEmpty() && nowtimems > mLastBackingTrackOfferMs + BACKING_TRACK_ANNOUNCE_MS) {
+            sendBackingTrackOffer(mBackingTrackServer->getPort(), offerid, offerfile.getFileName());
+            mLastBackingTrackOfferMs = nowtimems;
+        }
+
+        // everyone we send to has to have it, or they wouldn't hear it at all
+        int numhave = 0;
+        shared = offerid.isNotEmpty();
+
+        const ScopedReadLock sl (mCoreLock);
+        for (auto * remote : mRemotePeers) {
+            if (!remote->sendActive) continue;
+
+            const SpinLock::ScopedLockType bl (remote->backingTrackLock);
+            if (remote->backingTrackHaveId != offerid) {
+                shared = false;
+                break;
+            }
+            ++numhave;
+        }
+        shared = shared && numhave > 0;
+    }
+
+    const bool wasshared = mBackingTrackShared.exchange(shared);
+
+    if (offerid.isNotEmpty()) {
+        // where we are in it, for the ones playing their own copy
+        const bool playing = shared && mTransportSource.isPlaying();
+        const double position = mTransportSource.getCurrentPosition();
+        const double expected = mBackingTrackSentPosition + (mBackingTrackSentPlaying ? 1e-3 * (nowtimems - mLastBackingTrackSyncMs) : 0.0);
+
+        if (mBackingTrackSyncNow.exchange(false) || wasshared != shared || playing != mBackingTrackSentPlaying
+            || (playing && (nowtimems > mLastBackingTrackSyncMs + BACKING_TRACK_SYNC_MS || std::abs(position - expected) > BACKING_TRACK_SEEK_SECONDS))) {
+            sendBackingTrackPlay(offerid, playing, position, aoo_osctime_get());
+            mBackingTrackSentPlaying = playing;
+            mBackingTrackSentPosition = position;
+            mLastBackingTrackSyncMs = nowtimems;
+        }
+    }
+    else {
+        mBackingTrackSentPlaying = false;
+    }
+
+    // and the ones offered to us
+    if (sharing && !mBackingTrackFetcher) {
+        mBackingTrackFetcher = std::make_unique<SonoAudio::BackingTrackFetcher>(getBackingTrackDirectory());
+        mBackingTrackFetcher->onFetched = [this] (const String &, const File &) { notifyEventThread(); };
+    }
+    else if (!sharing && mBackingTrackFetcher) {
+        mBackingTrackFetcher.reset();
+    }
+
+    File playfile;
+    double playposition = 0.0;
+    uint64 playtime = 0;
+
+    if (mBackingTrackFetcher) {
+        const ScopedReadLock sl (mCoreLock);
+        for (auto * remote : mRemotePeers) {
+            if (!remote->endpoint) continue;
+
+            String id, name;
+            int port = 0;
+            bool playing = false;
+            double position = 0.0;
+            uint64 time = 0;
+            double seenms = 0.0;
+            {
+                const SpinLock::ScopedLockType bl (remote->backingTrackLock);
+                id = remote->backingTrackId;
+                name = remote->backingTrackName;
+                port = remote->backingTrackPort;
+                playing = remote->backingTrackPlaying;
+                position = remote->backingTrackPosition;
+                time = remote->backingTrackTime;
+                seenms = remote->backingTrackSeenMs;
+            }
+            if (id.isEmpty()) continue;
+
+            if (remote->backingTrackReplyDue.exchange(false)) {
+                const File cached = mBackingTrackFetcher->getCachedFile(id);
+                if (cached == File()) {
+                    SonoAudio::BackingTrackFetcher::Job job;
+                    job.host = remote->endpoint->ipaddr;
+                    job.port = port;
+                    job.id = id;
+                    job.name = name;
+                    mBackingTrackFetcher->addFetch(job);
+                }
+                sendBackingTrackHave(remote, cached != File() ? id : String());
+            }
+
+            // the first one playing theirs, if we know their clock
+            if (playfile == File() && playing && nowtimems < seenms + BACKING_TRACK_TIMEOUT_MS && remote->clockOffset.isValid()) {
+                playfile = mBackingTrackFetcher->getCachedFile(id);
+                playposition = position;
+                playtime = remote->clockOffset.toLocalTime(time);
+            }
+        }
+    }
+
+    if (playfile != File() && mBackingTrackPlayer->getFile() != playfile) {
+        if (!mDiskThread.isThreadRunning()) {
+            mDiskThread.startThread (3);
+        }
+        if (!mBackingTrackPlayer->load(playfile, mFormatManager)) {
+            playfile = File();
+        }
+    }
+
+    if (playfile != File()) {
+        mBackingTrackPlayer->follow(true, playposition, playtime);
+    } else {
+        mBackingTrackPlayer->follow(false, 0.0, 0);
+        if (!sharing && mBackingTrackPlayer->getFile() != File()) {
+            mBackingTrackPlayer->unload();
+        }
+    }
+}
+
+void SonobusAudioProcessor::sendBackingTrackOffer(int port, const String & id, const String & name)
+{
+    char buf[512];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+
+    try {
+        msg << osc::BeginMessage(SONOBUS_FULLMSG_BTOFFER)
+        << (int32_t) port << id.toRawUTF8() << name.substring(0, 200).toRawUTF8()
+        << osc::EndMessage;
+    }
+    catch (const osc::Exception& e){
+        DBG("exception in btoffer message construction: " << e.what());
+        return;
+    }
+
+    const ScopedReadLock sl (mCoreLock);
+    for (auto * peer : mRemotePeers) {
+        this->sendPeerMessage(peer, msg.Data(), (int32_t) msg.Size(), SendLaneControl);
+    }
+}
+
+void SonobusAudioProcessor::sendBackingTrackPlay(const String & id, bool playing, double position, uint64 time)
+{
+    char buf[128];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+
+    try {
+        msg << osc::BeginMessage(SONOBUS_FULLMSG_BTPLAY)
+        << id.toRawUTF8() << playing << position << osc::TimeTag(time)
+        << osc::EndMessage;
+    }
+    catch (const osc::Exception& e){
+        DBG("exception in btplay message construction: " << e.what());
+        return;
+    }
+
+    const ScopedReadLock sl (mCoreLock);
+    for (auto * peer : mRemotePeers) {
+        this->sendPeerMessage(peer, msg.Data(), (int32_t) msg.Size());
+    }
+}
+
+// under the read lock of mCoreLock
+void SonobusAudioProcessor::sendBackingTrackHave(RemotePeer * peer, const String & id)
+{
+    char buf[128];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+
+    try {
+        msg << osc::BeginMessage(SONOBUS_FULLMSG_BTHAVE)
+        << id.toRawUTF8()
+        << osc::EndMessage;
+    }
+    catch (const osc::Exception& e){
+        DBG("exception in bthave message construction: " << e.what());
+        return;
+    }
+
+    this->sendPeerMessage(peer, msg.Data(), (int32_t) msg.Size(), SendLaneControl);
+}
+
+void SonobusAudioProcessor::setEnsembleAlignment(bool flag)
+{
+    mEnsembleAlignment = flag;
+    notifyEventThread();
+}
+
+void SonobusAudioProcessor::setSessionRateNegotiation(bool flag)
+{
+    mSessionRateNegotiation = flag;
+    notifyEventThread();
+}
+
+int SonobusAudioProcessor::getSessionStreamRate() const
+{
+    const int rate = mSessionStreamRate.load();
+    return rate > 0 ? rate : (int) getSampleRate();
+}
+
+void SonobusAudioProcessor::updateSessionStreamRate()
+{
+    const int devrate = (int) getSampleRate();
+    if (devrate <= 0) return;
+
+    if (devrate != mAnnouncedSampleRate) {
+        // everyone else needs ours for their choice
+        mAnnouncedSampleRate = devrate;
+        sendRemotePeerInfoUpdate(-1);
+    }
+
+    int rate = 0;
+
+    {
+        const ScopedReadLock sl (mCoreLock);
+
+        if (mSessionRateNegotiation.load() && mRemotePeers.size() > 0) {
+            // the rate most devices run at (the higher one on a tie), so the most
+            // sinks take the streams without resampling. Everyone who knows the same
+            // peers ends up with the same one. Those that don't say send at their own
+            std::map<int,int> votes;
+            ++votes[devrate];
+            for (auto * peer : mRemotePeers) {
+                const int remoterate = peer->remoteSampleRate.load();
+                if (remoterate > 0) {
+                    ++votes[remoterate];
+                }
+            }
+
+            int most = 0;
+            for (const auto & vote : votes) {
+                if (vote.second >= most) {
+                    most = vote.second;
+                    rate = vote.first;
+                }
+            }
+        }
+
+        if (rate == devrate) rate = 0;
+        if (rate == mSessionStreamRate.load()) return;
+
+        DBG("Session stream rate now " << (rate > 0 ? rate : devrate));
+        mSessionStreamRate = rate;
+
+        for (auto * peer : mRemotePeers) {
+            applyRemotePeerSendFormat(peer);
+        }
+    }
+}
+
+void SonobusAudioProcessor::updateEnsembleAlignment()
+{
+    const bool aligning = mEnsembleAlignment.load() && mUdpSocket;
+
+    if (!aligning) {
+        if (mEnsembleAlignLatencyMs.load() > 0.0f) {
+            // back to every link on its own
+            {
+                const ScopedReadLock sl (mCoreLock);
+                for (auto * peer : mRemotePeers) {
+                    setRemotePeerAlignPadding(peer, 0.0f);
+                }
+            }
+            sendEnsembleAlignFloor(0.0f);
+            mEnsembleAlignLatencyMs = 0.0f;
+        }
+        return;
+    }
+
+    const double nowtimems = Time::getMillisecondCounterHiRes();
+    if (nowtimems < mLastEnsembleAlignMs + ENSEMBLE_ALIGN_INTERVAL_MS) return;
+    mLastEnsembleAlignMs = nowtimems;
+
+    // our floor is the slowest stream we hear as it would be on its own. The common
+    // latency is the highest floor in the group, everyone pads the rest up to it.
+    // With no padding the slowest link still trims its buffer when it can, which
+    // brings the floor (and everyone with it) down
+    float floorMs = 0.0f;
+    float targetMs = 0.0f;
+    {
+        const ScopedReadLock sl (mCoreLock);
+
+        for (auto * peer : mRemotePeers) {
+            if (!peer->recvActive || !peer->hasRemoteInfo) continue;
+            floorMs = jmax(floorMs, getRemotePeerIncomingLatency(peer, peer->buffertimeMs - peer->padBufferTimeMs));
+        }
+
+        targetMs = floorMs;
+        for (auto * peer : mRemotePeers) {
+            if (nowtimems < peer->alignFloorSeenMs.load() + ENSEMBLE_ALIGN_TIMEOUT_MS) {
+                targetMs = jmax(targetMs, peer->alignFloorMs.load());
+            }
+        }
+
+        for (auto * peer : mRemotePeers) {
+            float padms = 0.0f;
+            if (peer->recvActive && peer->hasRemoteInfo) {
+                padms = jmax(0.0f, targetMs - getRemotePeerIncomingLatency(peer, peer->buffertimeMs - peer->padBufferTimeMs));
+            }
+            setRemotePeerAlignPadding(peer, padms);
+        }
+    }
+
+    mEnsembleAlignLatencyMs = targetMs;
+    sendEnsembleAlignFloor(floorMs);
+}
+
+void SonobusAudioProcessor::setRemotePeerAlignPadding(RemotePeer * peer, float padMs)
+{
+    // less than half a block would only keep the buffer moving
+    const float absizeMs = 1e3f * currSamplesPerBlock / getSampleRate();
+    const bool removing = padMs <= 0.0f && peer->padBufferTimeMs > 0.0f;
+    if (!removing && std::abs(padMs - peer->padBufferTimeMs) < 0.5f * absizeMs) return;
+
+    peer->buffertimeMs = jmax(0.0f, peer->buffertimeMs - peer->padBufferTimeMs) + padMs;
+    peer->padBufferTimeMs = padMs;
+
+    updateRemotePeerEstLatency(peer);
+    peer->oursink->set_buffersize(peer->buffertimeMs);
+    if (peer->latencyTestReady) {
+        peer->echosink->set_buffersize(peer->buffertimeMs);
+        peer->latencysink->set_buffersize(peer->buffertimeMs);
+    }
+    peer->latencyDirty = true;
+
+    peer->fillRatioSlow.reset();
+    peer->fillRatio.reset();
+
+    DBG("Ensemble alignment padding peer " << peer->ourId << " by " << padMs << " ms to " << (int) peer->buffertimeMs);
+
+    sendRemotePeerInfoUpdate(-1, peer); // send to this peer
+}
+
+void SonobusAudioProcessor::sendEnsembleAlignFloor(float floorMs)
+{
+    char buf[64];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+
+    try {
+        msg << osc::BeginMessage(SONOBUS_FULLMSG_ALIGN)
+        << floorMs
+        << osc::EndMessage;
+    }
+    catch (const osc::Exception& e){
+        DBG("exception in align message construction: " << e.what());
+        return;
+    }
+
+    const ScopedReadLock sl (mCoreLock);
+    for (auto * peer : mRemotePeers) {
+        this->sendPeerMessage(peer, msg.Data(), (int32_t) msg.Size(), SendLaneControl);
+    }
+}
+
+bool SonobusAudioProcessor::startDoubleEnderRecording()
+{
+    const double samplerate = getSampleRate();
+    const int chans = jmin(mActiveInputChannels, MAX_PANNERS);
+    if (samplerate <= 0 || chans <= 0) return false;
+
+    const File dir = getDoubleEnderDirectory();
+    if (!dir.createDirectory()) {
+        DBG("Error creating directory for double-ender recording: " << dir.getFullPathName());
+        return false;
+    }
+
+    // lossless, flac doesn't support > 8 channels
+    const bool useflac = chans <= 8;
+    std::unique_ptr<AudioFormat> format;
+    if (useflac) {
+        format = std::make_unique<FlacAudioFormat>();
+    } else {
+        format = std::make_unique<WavAudioFormat>();
+    }
+
+    const String username = getCurrentUsername();
+    String filename = Time::getCurrentTime().formatted("%Y-%m-%d_%H.%M.%S") + "-" + (username.isNotEmpty() ? username : String("SELF")) + "-DUB" + (useflac ? ".flac" : ".wav");
+    File thefile = dir.getChildFile(File::createLegalFileName(filename)).getNonexistentSibling();
+
+    std::unique_ptr<FileOutputStream> fileStream (thefile.createOutputStream());
+    if (!fileStream) {
+        DBG("Error creating double-ender output file: " << thefile.getFullPathName());
+        return false;
+    }
+
+    auto * writer = format->createWriterFor(fileStream.get(), samplerate, (unsigned int) chans, 24, {}, 0);
+    if (!writer) {
+        DBG("Error creating double-ender writer for " << thefile.getFullPathName());
+        return false;
+    }
+    fileStream.release(); // (passes responsibility for deleting the stream to the writer object that is now using it)
+
+    if (!mDoubleEnderEngine) {
+        mDoubleEnderEngine = std::make_unique<SonoAudio::RecordingEngine>();
+    }
+    mDoubleEnderTrack = mDoubleEnderEngine->createTrack(writer, thefile, useflac, (int64) samplerate * chans * 2);
+    mDoubleEnderFile = thefile;
+
+    {
+        const ScopedLock sl (mDoubleEnderWriterLock);
+        mDoubleEnderChannels = chans;
+        mDoubleEnderStartTime = 0;
+        activeDoubleEnderWriter = mDoubleEnderTrack.get();
+    }
+
+    DBG("Started double-ender recording " << thefile.getFullPathName());
+    return true;
+}
+
+void SonobusAudioProcessor::stopDoubleEnderRecording()
+{
+    {
+        const ScopedLock sl (mDoubleEnderWriterLock);
+        activeDoubleEnderWriter = nullptr;
+    }
+    // writes out the rest and closes the file
+    mDoubleEnderTrack.reset();
+
+    const uint64 starttime = mDoubleEnderStartTime.load();
+    if (starttime == 0) {
+        DBG("Nothing got recorded for the double-ender");
+        mDoubleEnderFile.deleteFile();
+        return;
+    }
+
+    if (!mDoubleEnderClockKnown) {
+        DBG("Don't know the double-ender host's clock, its start time is in ours");
+    }
+
+    SonoAudio::DoubleEnderUploader::Job job;
+    job.file = mDoubleEnderFile;
+    job.host = mDoubleEnderHostAddress;
+    job.port = mDoubleEnderUploadPort;
+    job.userName = getCurrentUsername();
+    job.startTime = starttime + (uint64) mDoubleEnderClockOffset;
+
+    if (!mDoubleEnderUploader) {
+        mDoubleEnderUploader = std::make_unique<SonoAudio::DoubleEnderUploader>();
+    }
+    mDoubleEnderUploader->setRateLimit(mDoubleEnderUploadRate.load() * 1024);
+    mDoubleEnderUploader->addUpload(job);
+    mDoubleEnderPendingUploads = mDoubleEnderUploader->getNumPending();
+
+    DBG("Finished double-ender recording " << mDoubleEnderFile.getFullPathName() << ", uploading to " << job.host << ":" << job.port);
+}
+
+// only from the peers we're connected with
+bool SonobusAudioProcessor::isDoubleEnderUploadAllowed(const String & host)
+{
+    auto plain = [] (const String & addr) { return addr.startsWithIgnoreCase("::ffff:") ? addr.substring(7) : addr; };
+    const String addr = plain(host);
+
+    const ScopedReadLock sl (mCoreLock);
+    for (auto * remote : mRemotePeers) {
+        if (remote->endpoint && plain(remote->endpoint->ipaddr) == addr) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void SonobusAudioProcessor::alignDoubleEnderUpload(const File & file, uint64 startTime)
+{
+    const uint64 recstart = mRecordStartTime.load();
+    if (recstart == 0 || startTime == 0) {
+        DBG("No recording of ours to line up " << file.getFullPathName() << " with");
+        return;
+    }
+
+    // how much later than ours it started, in our clock
+    const double offset = aoo_osctime_duration(recstart, startTime);
+    const File dest = file.getSiblingFile(file.getFileNameWithoutExtension() + "-ALIGNED" + file.getFileExtension()).getNonexistentSibling();
+
+    String err;
+    if (SonoAudio::DoubleEnderTransfer::writeAligned(file, dest, offset, err)) {
+        DBG("Lined up double-ender upload " << dest.getFullPathName() << " by " << offset << " s");
+    } else {
+        DBG("Error lining up double-ender upload: " << err);
+    }
+}
+
+void SonobusAudioProcessor::sendLanMulticastProbe(EndpointState * multicast)
+{
+    char buf[64];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+
+    try {
+        msg << osc::BeginMessage(SONOBUS_FULLMSG_LANPROBE)
+        << osc::EndMessage;
+    }
+    catch (const osc::Exception& e){
+        DBG("exception in lanprobe message construction: " << e.what());
+        return;
+    }
+
+    endpoint_send(multicast, msg.Data(), (int32_t) msg.Size());
+}
+
+SonobusAudioProcessor::EndpointState * SonobusAudioProcessor::getPathEndpoint(EndpointState * endpoint)
+{
+    // assumed corelock already held
+    if (!mPathUdpSocket) return nullptr;
+
+    const ScopedLock el (mEndpointsLock);
+
+    if (!endpoint->pathEndpoint) {
+        auto * pathendpoint = new EndpointState(endpoint->ipaddr, endpoint->port);
+        pathendpoint->owner = mPathUdpSocket.get();
+        pathendpoint->cipher = mPacketCipher.load();
+        mPathEndpoints.add(pathendpoint);
+        endpoint->pathEndpoint = pathendpoint;
+    }
+    return endpoint->pathEndpoint;
+}
+
+void SonobusAudioProcessor::applyRemotePeerResendDeadline(RemotePeer * remote)
+{
+    // assumed corelock already held
+    auto * es = remote->endpoint;
+    if (!es || remote->remoteSinkId == AOO_ID_NONE) return;
+
+    auto * leader = remote->sendLeader.load();
+    auto * source = leader ? leader->oursource.get() : remote->oursource.get();
+    if (!source) return;
+
+    // what they buffer of our stream, resent blocks older than that come too late
+    source->set_sink_resend_deadline(es, remote->remoteSinkId, roundToInt(remote->remoteJitterBufMs));
+}
+
+void SonobusAudioProcessor::applyRemotePeerSendPath(RemotePeer * remote)
+{
+    // assumed corelock already held
+    auto * es = remote->endpoint;
+    if (!es || remote->remoteSinkId == AOO_ID_NONE) return;
+
+    auto * leader = remote->sendLeader.load();
+    auto * source = leader ? leader->oursource.get() : remote->oursource.get();
+    if (!source) return;
+
+    applyRemotePeerResendDeadline(remote);
+
+    // small blocks to far away peers can go out a few at a time, the source
+    // picks how many from the round trip time and the packet loss
+    source->set_sink_pack_limit(es, remote->remoteSinkId, SEND_PACK_LIMIT);
+
+    // every frame once to a clean link, more times to a lossy one, following
+    // the packet loss the peer reports to the source
+    source->set_sink_redundancy(es, remote->remoteSinkId, SEND_REDUNDANCY_MAX);
+
+    const int mode = mMultipathMode.load();
+
+    // only for direct IPv4 peers, the second socket can't reach anything else
+    const bool usable = mode != MultipathOff && !es->relay.load()
+        && es->getRawAddr()->sa_family == AF_INET;
+
+    if (usable) {
+        if (auto * pathendpoint = getPathEndpoint(es)) {
+            source->add_sink_path(es, remote->remoteSinkId, pathendpoint, endpoint_send);
+            source->set_sink_path_mode(es, remote->remoteSinkId, mode == MultipathSplit ? AOO_PATH_SPLIT : AOO_PATH_DUPLICATE);
+            return;
+        }
+    }
+
+    if (es->pathEndpoint) {
+        source->remove_sink_path(es, remote->remoteSinkId, es->pathEndpoint);
+    }
+}
+
+void SonobusAudioProcessor::setMultipathMode(int mode)
+{
+    mode = jlimit((int) MultipathOff, (int) MultipathSplit, mode);
+    if (mMultipathMode.exchange(mode) == mode) return;
+
+    if (mode != MultipathOff && mUdpSocket) {
+        openPathSocket();
+    }
+
+    const ScopedReadLock sl (mCoreLock);
+    const ScopedLock gl (mSharedSendLock);
+
+    for (auto * remote : mRemotePeers) {
+        applyRemotePeerSendPath(remote);
+    }
+}
+
+String SonobusAudioProcessor::getMultipathLocalAddress() const
+{
+    const ScopedLock el (mEndpointsLock);
+    return mMultipathLocalAddress;
+}
+
+void SonobusAudioProcessor::setMultipathLocalAddress(const String & address)
+{
+    const ScopedLock el (mEndpointsLock);
+    mMultipathLocalAddress = address.trim();
+}
+
+String SonobusAudioProcessor::getMultipathBoundAddress() const
+{
+    const ScopedReadLock sl (mCoreLock);
+    if (!mPathUdpSocket || mPathUdpSocket->getBoundPort() <= 0) return {};
+
+    struct sockaddr_in local;
+    socklen_t len = sizeof(local);
+    char buf[INET_ADDRSTRLEN];
+    if (getsockname(mPathUdpSocket->getRawSocketHandle(), (struct sockaddr *) &local, &len) != 0
+        || !inet_ntop(AF_INET, &local.sin_addr, buf, sizeof(buf))) {
+        return {};
+    }
+    return String(buf) + ":" + String(mPathUdpSocket->getBoundPort());
+}
+
+// Every peer we listen to can deliver a burst of up to its jitter buffer while the
+// receive thread is held up, and the send thread queues all peers at once, so size
+// the socket buffers after the traffic we expect instead of the OS defaults.
+// The kernel charges its bookkeeping per datagram, which dominates for small packets.
+void SonobusAudioProcessor::updateSocketBufferSizes()
+{
+    // assumed corelock (read) already held
+    if (!mUdpSocket) return;
+
+    const double samplerate = getSampleRate() > 0.0 ? getSampleRate() : 48000.0;
+    const double packetrate = samplerate / jmax(1, currSamplesPerBlock);
+    double recvbytes = 0.0;
+    double sendbytes = 0.0;
+
+    for (auto * remote : mRemotePeers) {
+        if (remote->recvActive && remote->recvChannels > 0) {
+            const double rate = getFormatBytesPerSecond(remote->recvFormat, remote->recvChannels, samplerate) + packetrate * SOCKET_DATAGRAM_OVERHEAD;
+            recvbytes += rate * 1e-3 * jmax(SOCKET_RECV_WINDOW_MS, 2.0 * remote->buffertimeMs);
+        }
+        if (remote->sendActive && remote->sendChannels > 0) {
+            const auto & info = mAudioFormats.getReference(getEffectiveSendFormatIndex(remote));
+            const double rate = getFormatBytesPerSecond(info, remote->encodeSendChannels(), samplerate) + packetrate * SOCKET_DATAGRAM_OVERHEAD;
+            sendbytes += rate * 1e-3 * SOCKET_SEND_WINDOW_MS;
+        }
+    }
+
+    const int recvsize = jlimit(SOCKET_BUFFER_MIN_SIZE, SOCKET_BUFFER_MAX_SIZE, (int) recvbytes);
+    const int sendsize = jlimit(SOCKET_BUFFER_MIN_SIZE, SOCKET_BUFFER_MAX_SIZE, (int) sendbytes);
+
+    // only bother the kernel with significant changes
+    if (std::abs(recvsize - mSocketRecvBufferSize) * 4 > mSocketRecvBufferSize) {
+        if (mUdpSocket->setReceiveBufferSize(recvsize)) {
+            DBG("UDP receive buffer size now " << recvsize);
+        }
+        mSocketRecvBufferSize = recvsize;
+    }
+    if (std::abs(sendsize - mSocketSendBufferSize) * 4 > mSocketSendBufferSize) {
+        if (mUdpSocket->setSendBufferSize(sendsize)) {
+            DBG("UDP send buffer size now " << sendsize);
+        }
+        mSocketSendBufferSize = sendsize;
+    }
+}
+
+void SonobusAudioProcessor::setSharedSendEncoding(bool flag)
+{
+    mSharedSendEncoding = flag;
+    mNeedsSendRegroup = true;
+    notifySendThread();
+}
+
+void SonobusAudioProcessor::setSimulcastSending(bool flag)
+{
+    mSimulcastSending = flag;
+
+    {
+        // stepped down peers move to (or off) the low tier
+        const ScopedReadLock sl (mCoreLock);
+        for (auto * remote : mRemotePeers) {
+            if (remote->adaptedFormatIndex >= 0) {
+                applyRemotePeerSendFormat(remote);
+            }
+        }
+    }
+
+    mNeedsSendRegroup = true;
+    notifySendThread();
+}
+
+void SonobusAudioProcessor::setServerForwarding(bool flag)
+{
+    mServerForwarding = flag;
+    notifySendThread();
+}
+
+void SonobusAudioProcessor::setLanMulticast(bool flag)
+{
+    mLanMulticast = flag;
+    mLanMulticastUpdatePending = true;
+    notifyEventThread();
+}
+
+void SonobusAudioProcessor::setLanDiscovery(bool flag)
+{
+    mLanDiscoveryEnabled = flag;
+    notifyEventThread();
+}
+
+String SonobusAudioProcessor::getLanDiscoveryGroup() const
+{
+    const ScopedLock sl (mLanDiscoveryLock);
+    return mLanDiscoveryGroup;
+}
+
+void SonobusAudioProcessor::setLanDiscoveryGroup(const String & group)
+{
+    {
+        const ScopedLock sl (mLanDiscoveryLock);
+        mLanDiscoveryGroup = group;
+    }
+    notifyEventThread();
+}
+
+String SonobusAudioProcessor::getPacketEncryption() const
+{
+    const ScopedLock sl (mPacketCipherLock);
+    return mPacketPassphrase;
+}
+
+void SonobusAudioProcessor::setPacketEncryption(const String & passphrase)
+{
+    SonoAudio::PacketCipher * cipher = nullptr;
+    {
+        const ScopedLock sl (mPacketCipherLock);
+        if (passphrase == mPacketPassphrase) return;
+        mPacketPassphrase = passphrase;
+
+        if (passphrase.isNotEmpty()) {
+            // the network threads might still be sealing with the one before
+            cipher = mPacketCiphers.add(new SonoAudio::PacketCipher(passphrase));
+        }
+        mPacketCipher = cipher;
+    }
+
+    {
+        const ScopedLock el (mEndpointsLock);
+        for (auto * ep : mEndpoints) ep->cipher = cipher;
+        for (auto * ep : mPathEndpoints) ep->cipher = cipher;
+        for (auto * ep : mLanMulticastEndpoints) ep->cipher = cipher;
+    }
+
+    // sealed packets need room for what sealing adds, the sources make them smaller
+    const ScopedReadLock sl (mCoreLock);
+    for (auto * remote : mRemotePeers) {
+        ungroupSharedSend(remote);
+        if (remote->oursource) {
+            remote->oursource->set_packetsize(remote->sendPacketsize());
+            remote->filestreamsource->set_packetsize(remote->sendPacketsize());
+        }
+        if (remote->latencyTestReady) {
+            remote->latencysource->set_packetsize(remote->sendPacketsize());
+            remote->echosource->set_packetsize(remote->sendPacketsize());
+        }
+    }
+    mNeedsSendRegroup = true;
+    notifySendThread();
+
+    DBG("Packet encryption " << (cipher ? "on" : "off"));
+}
+
+void SonobusAudioProcessor::setMixNodeMode(bool flag)
+{
+    mMixNodeMode = flag;
+    if (!flag) {
+        // back to just the patch matrix
+        const ScopedReadLock sl (mCoreLock);
+        clearMixNodeRouting();
+    }
+    mNeedsSendRegroup = true;
+    notifySendThread();
+}
+
+void SonobusAudioProcessor::setListenerRole(bool flag)
+{
+    if (mListenerRole.exchange(flag) == flag) return;
+
+    // a listener doesn't send, muting goes through the usual send mute (and
+    // its cache of who we sent to before)
+    mState.getParameter(paramMainSendMute)->setValueNotifyingHost(flag ? 1.0f : 0.0f);
+
+    // the peers find out with our next peer info
+    sendRemotePeerInfoUpdate();
+}
+
+void SonobusAudioProcessor::updateMixNodeRouting()
+{
+    // assumed corelock (read) already held.
+    // every peer we receive audio from goes into the send mix of all the others, so
+    // all the listeners (who don't send) get the same mix and can share one source
+    Array<int> receiving;
+    for (auto * src : mRemotePeers) {
+        if (src->recvActive && src->recvChannels > 0) {
+            receiving.addUsingDefaultSort(src->slot);
+        }
+    }
+
+    Array<int> changed;
+    {
+        const ScopedLock rl (mRoutingLock);
+        // turned off meanwhile, clearMixNodeRouting() takes care of it
+        if (!mMixNodeMode.load()) return;
+
+        for (int j=0; j < mRemotePeers.size(); ++j) {
+            const int dest = mRemotePeers.getUnchecked(j)->slot;
+            auto sources = receiving;
+            sources.removeFirstMatchingValue(dest);
+            if (mMixNodeSourceSlots[(size_t) dest] != sources) {
+                mMixNodeSourceSlots[(size_t) dest].swapWith(sources);
+                changed.add(j);
+            }
+        }
+    }
+
+    if (changed.isEmpty()) return;
+
+    publishPeerSnapshot();
+
+    for (auto j : changed) {
+        updateRemotePeerSendChannels(j, mRemotePeers.getUnchecked(j));
+    }
+}
+
+void SonobusAudioProcessor::clearMixNodeRouting()
+{
+    // assumed corelock (read) already held.
+    Array<int> changed;
+    {
+        const ScopedLock rl (mRoutingLock);
+
+        for (int j=0; j < mRemotePeers.size(); ++j) {
+            auto & sources = mMixNodeSourceSlots[(size_t) mRemotePeers.getUnchecked(j)->slot];
+            if (!sources.isEmpty()) {
+                sources.clear();
+                changed.add(j);
+            }
+        }
+    }
+
+    if (changed.isEmpty()) return;
+
+    publishPeerSnapshot();
+
+    for (auto j : changed) {
+        updateRemotePeerSendChannels(j, mRemotePeers.getUnchecked(j));
+    }
+}
+
+Array<int> SonobusAudioProcessor::getSendSourceSlots(int slot) const
+{
+    // assumed routinglock already held.
+    // what goes into the peer's send mix: the patch matrix, and what mix node mode adds
+    if (slot < 0 || slot >= (int) mSendSourceSlots.size()) return {};
+
+    auto sources = mSendSourceSlots[(size_t) slot];
+    for (auto srcslot : mMixNodeSourceSlots[(size_t) slot]) {
+        if (!sources.contains(srcslot)) {
+            sources.addUsingDefaultSort(srcslot);
+        }
+    }
+    return sources;
+}
+
+static bool isSameSendFormat(const aoo_format_storage & a, const aoo_format_storage & b)
+{
+    if (strcmp(a.header.codec, b.header.codec) != 0
+        || a.header.nchannels != b.header.nchannels
+        || a.header.samplerate != b.header.samplerate
+        || a.header.blocksize != b.header.blocksize) {
+        return false;
+    }
+
+    if (!strcmp(a.header.codec, AOO_CODEC_OPUS)) {
+        auto * oa = (const aoo_format_opus *)&a;
+        auto * ob = (const aoo_format_opus *)&b;
+        return oa->bitrate == ob->bitrate && oa->complexity == ob->complexity
+            && oa->signal_type == ob->signal_type && oa->application_type == ob->application_type
+            && oa->coupled == ob->coupled;
+    }
+    else if (!strcmp(a.header.codec, AOO_CODEC_PCM)) {
+        return ((const aoo_format_pcm *)&a)->bitdepth == ((const aoo_format_pcm *)&b)->bitdepth;
+    }
+    else if (!strcmp(a.header.codec, AOO_CODEC_LOSSLESS)) {
+        return ((const aoo_format_lossless *)&a)->bitdepth == ((const aoo_format_lossless *)&b)->bitdepth;
+    }
+
+    return false;
+}
+
+// Peers that get the plain send mix with the same format can share one source:
+// the leader's source adds the follower's remote sink (presenting the follower's
+// source id to it), so the audio is only pushed and encoded once.
+// Called from the send thread with the core lock (read) held.
+void SonobusAudioProcessor::updateSharedSendGroups()
+{
+    const ScopedLock gl (mSharedSendLock);
+
+    const int count = mRemotePeers.size();
+    // simulcast relies on the peers of a tier sharing its source, listeners always share with each other
+    const bool shareall = mSharedSendEncoding.load() || mSimulcastSending.load();
+    bool enabled = false;
+    for (int i=0; i < count && !enabled; ++i) {
+        enabled = shareall || mRemotePeers.getUnchecked(i)->remoteListener.load();
+    }
+    enabled = enabled && count > 1;
+
+    std::vector<aoo_format_storage> formats ((size_t) count);
+    std::vector<char> eligible ((size_t) count, 0);
+
+    for (int i=0; i < count && enabled; ++i) {
+        auto * remote = mRemotePeers.getUnchecked(i);
+        eligible[i] = remote->oursource && remote->connected && remote->sendActive
+            && remote->remoteSinkId != AOO_ID_NONE
+            && remote->oursource->get_format(formats[i]) > 0;
+    }
+
+    // peers with other peers routed to them can only share if they get the same mix
+    auto isSameSendMix = [&](int i, int j) {
+        const ScopedLock rl (mRoutingLock);
+        return getSendSourceSlots(mRemotePeers.getUnchecked(i)->slot) == getSendSourceSlots(mRemotePeers.getUnchecked(j)->slot);
+    };
+
+    auto canShare = [&](int i, int j) {
+        auto * a = mRemotePeers.getUnchecked(i);
+        auto * b = mRemotePeers.getUnchecked(j);
+        return eligible[i] && eligible[j]
+            && (shareall || (a->remoteListener.load() && b->remoteListener.load()))
+            && a->sendChannels == b->sendChannels && a->sendPacketsize() == b->sendPacketsize()
+            && a->sendEncodeOnset.load() == b->sendEncodeOnset.load()
+            && isSameSendFormat(formats[i], formats[j])
+            && isSameSendMix(i, j);
+    };
+
+    // first let go of anybody who doesn't fit with their leader anymore
+    for (int i=0; i < count; ++i) {
+        auto * remote = mRemotePeers.getUnchecked(i);
+        if (auto * leader = remote->sendLeader.load()) {
+            const int li = mRemotePeers.indexOf(leader);
+            if (li < 0 || !canShare(i, li)) {
+                leaveSharedSend(remote);
+            }
+        }
+    }
+
+    if (!enabled) return;
+
+    // then join the remaining ones to the first matching leader
+    for (int i=0; i < count; ++i) {
+        auto * remote = mRemotePeers.getUnchecked(i);
+        if (!eligible[i] || remote->sendLeader.load() || remote->sendFollowers > 0) continue;
+
+        for (int j=0; j < i; ++j) {
+            auto * leader = mRemotePeers.getUnchecked(j);
+            if (!leader->sendLeader.load() && canShare(i, j)) {
+                joinSharedSend(remote, leader);
+                break;
+            }
+        }
+    }
+}
+
+void SonobusAudioProcessor::joinSharedSend(RemotePeer * follower, RemotePeer * leader)
+{
+    // assumed mSharedSendLock already held
+    auto * es = follower->endpoint;
+
+    if (leader->oursource->add_sink(es, follower->remoteSinkId, endpoint_send) != 1) {
+        return;
+    }
+    leader->oursource->set_sink_source_alias(es, follower->remoteSinkId, follower->ourId);
+    leader->oursource->set_sinkoption(es, follower->remoteSinkId, aoo_opt_protocol_flags, &follower->remoteSinkFlags, sizeof(int32_t));
+    leader->oursource->set_sink_channelonset(es, follower->remoteSinkId, follower->sendEncodeOnset.load());
+
+    follower->sendLeader = leader;
+    follower->oursource->remove_sink(es, follower->remoteSinkId);
+    ++leader->sendFollowers;
+    applyRemotePeerSendPath(follower);
+
+    DBG("Peer " << follower->ourId << " now shares the source of peer " << leader->ourId);
+}
+
+void SonobusAudioProcessor::leaveSharedSend(RemotePeer * follower)
+{
+    // assumed mSharedSendLock already held
+    auto * leader = follower->sendLeader.load();
+    if (!leader) return;
+
+    auto * es = follower->endpoint;
+
+    leader->oursource->remove_sink(es, follower->remoteSinkId);
+    --leader->sendFollowers;
+
+    follower->oursource->add_sink(es, follower->remoteSinkId, endpoint_send);
+    follower->oursource->set_sinkoption(es, follower->remoteSinkId, aoo_opt_protocol_flags, &follower->remoteSinkFlags, sizeof(int32_t));
+    follower->oursource->set_sink_channelonset(es, follower->remoteSinkId, follower->sendEncodeOnset.load());
+
+    if (follower->sendActive) {
+        // restart our own stream
+        follower->oursource->start();
+    } else {
+        follower->oursource->stop();
+    }
+
+    follower->sendLeader = nullptr;
+    applyRemotePeerSendPath(follower);
+
+    DBG("Peer " << follower->ourId << " left the source of peer " << leader->ourId);
+}
+
+void SonobusAudioProcessor::ungroupSharedSend(RemotePeer * peer)
+{
+    // assumed corelock already held
+    const ScopedLock gl (mSharedSendLock);
+
+    if (peer->sendLeader.load()) {
+        leaveSharedSend(peer);
+    }
+
+    if (peer->sendFollowers > 0) {
+        for (auto * remote : mRemotePeers) {
+            if (remote->sendLeader.load() == peer) {
+                leaveSharedSend(remote);
+            }
+        }
+    }
+
+    mNeedsSendRegroup = true;
+}
+
+struct ProcessorIdPair
+{
+    ProcessorIdPair(SonobusAudioProcessor *proc, int32_t id_) : processor(proc), id(id_) {}
+    SonobusAudioProcessor * processor;
+    int32_t id;
+};
+
+static int32_t gHandleSourceEvents(void * user, const aoo_event ** events, int32_t n)
+{
+    ProcessorIdPair * pp = static_cast<ProcessorIdPair*> (user);
+    return pp->processor->handleSourceEvents(events, n, pp->id);    
+}
+
+static int32_t gHandleSinkEvents(void * user, const aoo_event ** events, int32_t n)
+{
+    ProcessorIdPair * pp = static_cast<ProcessorIdPair*> (user);
+    return pp->processor->handleSinkEvents(events, n, pp->id);
+}
+
+static int32_t gHandleServerEvents(void * user, const aoo_event ** events, int32_t n)
+{
+    ProcessorIdPair * pp = static_cast<ProcessorIdPair*> (user);
+    return pp->processor->handleServerEvents(events, n);
+}
+
+static int32_t gHandleClientEvents(void * user, const aoo_event ** events, int32_t n)
+{
+    ProcessorIdPair * pp = static_cast<ProcessorIdPair*> (user);
+    return pp->processor->handleClientEvents(events, n);
+}
+
+
+void SonobusAudioProcessor::eventNotifyCallback(void * user)
+{
+    auto * target = static_cast<EventNotifyTarget*>(user);
+    target->pending = true;
+    if (target->processor) {
+        target->processor->notifyEventThread();
+    }
+}
+
+void SonobusAudioProcessor::handleEvents()
+{
+    const ScopedReadLock sl (mCoreLock);        
+    int32_t dummy = 0;
+    
+    // only visit the objects that told us they queued something, clear the
+    // flag first so anything pushed while we drain will wake us again
+    if (mAooServer && mServerEventNotify.pending.exchange(false)) {
+        ProcessorIdPair pp(this, dummy);
+        mAooServer->handle_events(gHandleServerEvents, &pp);
+    }
+
+    if (mAooClient && mClientEventNotify.pending.exchange(false)) {
+        ProcessorIdPair pp(this, dummy);
+        mAooClient->handle_events(gHandleClientEvents, &pp);
+    }
+
+    
+    if (mPeerSendUpdatePending.exchange(false)) {
+        for (int i=0; i < mRemotePeers.size(); ++i) {
+            updateRemotePeerSendChannels(i, mRemotePeers.getUnchecked(i));
+        }
+    }
+
+    if (mDummySourceEventNotify.pending.exchange(false)) {
+        mAooDummySource->get_id(dummy);
+        ProcessorIdPair pp(this, dummy);
+        mAooDummySource->handle_events(gHandleSourceEvents, &pp);
+    }
+
+    for (auto & remote : mRemotePeers) {
+        if (!remote->eventNotify.pending.exchange(false)) continue;
+
+        if (remote->oursource) {
+            remote->oursource->get_id(dummy);
+            ProcessorIdPair pp(this, dummy);
+            remote->oursource->handle_events(gHandleSourceEvents, &pp);
+        }
+        if (remote->oursink) {
+            remote->oursink->get_id(dummy);
+            ProcessorIdPair pp(this, dummy);
+            remote->oursink->handle_events(gHandleSinkEvents, &pp);
+        }
+
+        
+        if (remote->latencyTestReady) {
+            {
+                remote->latencysink->get_id(dummy);
+                ProcessorIdPair pp(this, dummy);
+                remote->latencysink->handle_events(gHandleSinkEvents, &pp);
+            }
+            {
+                remote->echosink->get_id(dummy);
+                ProcessorIdPair pp(this, dummy);
+                remote->echosink->handle_events(gHandleSinkEvents, &pp);
+            }
+            {
+                remote->latencysource->get_id(dummy);
+                ProcessorIdPair pp(this, dummy);
+                remote->latencysource->handle_events(gHandleSourceEvents, &pp);
+            }
+            {
+                remote->echosource->get_id(dummy);
+                ProcessorIdPair pp(this, dummy);
+                remote->echosource->handle_events(gHandleSourceEvents, &pp);
+            }
+        }
+        if (remote->filestreamsource) {
+            remote->filestreamsource->get_id(dummy);
+            ProcessorIdPair pp(this, dummy);
+            remote->filestreamsource->handle_events(gHandleSourceEvents, &pp);
+        }
+        
+    }
+
+}
+
+bool SonobusAudioProcessor::deferAooEvent(DeferredEvent::Kind kind, const aoo_event * event, int32_t objectId)
+{
+    // how much of the event there is to copy, none for the ones handled right away
+    size_t size = 0;
+    if (kind == DeferredEvent::SourceEvent) {
+        switch (event->type) {
+            case AOO_INVITE_EVENT:
+            case AOO_UNINVITE_EVENT:
+                size = sizeof(aoo_sink_event);
+                break;
+            case AOO_CHANGECODEC_EVENT:
+                size = sizeof(aoo_source_event);
+                break;
+            case AOO_SUBSCRIBE_EVENT:
+                size = sizeof(aoo_subscribe_event);
+                break;
+            default:
+                break;
+        }
+    }
+    else if (kind == DeferredEvent::SinkEvent && event->type == AOO_SOURCE_FORMAT_EVENT) {
+        size = sizeof(aoo_source_event);
+    }
+
+    if (size == 0) return false;
+
+    DeferredEvent ev;
+    ev.kind = kind;
+    ev.objectId = objectId;
+    memcpy(&ev.event, event, size);
+    queueDeferredEvent(std::move(ev));
+    return true;
+}
+
+void SonobusAudioProcessor::queueDeferredEvent(DeferredEvent && event)
+{
+    {
+        const ScopedLock sl (mDeferredEventsLock);
+        mDeferredEvents.push_back(std::move(event));
+    }
+    notifyEventThread();
+}
+
+bool SonobusAudioProcessor::handleDeferredEvent()
+{
+    // event thread, in the order they came in, which keeps each peer's in order
+    DeferredEvent ev;
+    {
+        const ScopedLock sl (mDeferredEventsLock);
+        if (mDeferredEvents.empty()) return false;
+        ev = std::move(mDeferredEvents.front());
+        mDeferredEvents.pop_front();
+    }
+
+    const aoo_event * event = &ev.event.header;
+
+    switch (ev.kind) {
+        case DeferredEvent::SourceEvent:
+        {
+            const ScopedReadLock sl (mCoreLock);
+            handleSourceEvents(&event, 1, ev.objectId, true);
+            break;
+        }
+        case DeferredEvent::SinkEvent:
+        {
+            const ScopedReadLock sl (mCoreLock);
+            handleSinkEvents(&event, 1, ev.objectId, true);
+            break;
+        }
+        case DeferredEvent::PeerInfoMessage:
+            handlePeerInfoMessage(ev.endpoint, ev.data);
+            break;
+        case DeferredEvent::PeerInfoRecordMessage:
+            handlePeerInfoRecordMessage(ev.endpoint, ev.data);
+            break;
+        case DeferredEvent::LayoutInfoMessage:
+            handleLayoutInfoMessage(ev.endpoint, ev.objectId, ev.data);
+            break;
+    }
+
+    const ScopedLock sl (mDeferredEventsLock);
+    return !mDeferredEvents.empty();
+}
+
+void SonobusAudioProcessor::sendPingEvent(RemotePeer * peer)
+{
+
+    auto tt = aoo_osctime_get();
+
+    char buf[AOO_MAXPACKETSIZE];
+    osc::OutboundPacketStream outmsg(buf, sizeof(buf));
+
+    try {
+        outmsg << osc::BeginMessage(SONOBUS_FULLMSG_PING)
+        << osc::TimeTag(tt)
+        << osc::EndMessage;
+    }
+    catch (const osc::Exception& e){
+        DBG("exception in ping message construction: " << e.what());
+        return;
+    }
+
+    sendPeerMessage(peer, outmsg.Data(), (int32_t) outmsg.Size());
+
+    DBG("Sent ping to peer: " << peer->endpoint->ipaddr);
+}
+
+
+#if JUCE_WINDOWS
+typedef DWORD SocketDontFragmentValue;
+#else
+typedef int SocketDontFragmentValue;
+#endif
+
+// sets the don't fragment bit (and ignores what the system knows of the path MTU)
+// for the traffic of the dual-stack socket, returns the old settings for restoring
+static void setSocketDontFragment(int fd, bool enable, SocketDontFragmentValue * old)
+{
+    struct Option { int level; int name; SocketDontFragmentValue on; SocketDontFragmentValue off; };
+    static const Option options[] = {
+#if defined(IP_MTU_DISCOVER) && defined(IP_PMTUDISC_PROBE)
+        { IPPROTO_IP, IP_MTU_DISCOVER, IP_PMTUDISC_PROBE, IP_PMTUDISC_WANT },
+#elif defined(IP_DONTFRAGMENT)
+        { IPPROTO_IP, IP_DONTFRAGMENT, 1, 0 },
+#elif defined(IP_DONTFRAG)
+        { IPPROTO_IP, IP_DONTFRAG, 1, 0 },
+#endif
+#if defined(IPV6_MTU_DISCOVER) && defined(IPV6_PMTUDISC_PROBE)
+        { IPPROTO_IPV6, IPV6_MTU_DISCOVER, IPV6_PMTUDISC_PROBE, IPV6_PMTUDISC_WANT },
+#elif defined(IPV6_DONTFRAG)
+        { IPPROTO_IPV6, IPV6_DONTFRAG, 1, 0 },
+#endif
+        { 0, 0, 0, 0 } // at most two before this, see sendPathMtuProbe()
+    };
+
+    for (int i = 0; options[i].name != 0; ++i) {
+        SocketDontFragmentValue value = enable ? options[i].on : old[i];
+        if (enable) {
+            socklen_t len = sizeof(old[i]);
+            if (getsockopt(fd, options[i].level, options[i].name, (char *) &old[i], &len) != 0) {
+                old[i] = options[i].off;
+            }
+        }
+        setsockopt(fd, options[i].level, options[i].name, (const char *) &value, sizeof(value));
+    }
+}
+
+void SonobusAudioProcessor::setAutoPacketSize(bool flag)
+{
+    // the send thread does the rest, see updatePathMtu()
+    mAutoPacketSize = flag;
+}
+
+void SonobusAudioProcessor::updatePathMtu(RemotePeer * peer, double nowMs)
+{
+    // a relayed peer is reached through the server, which has a path of its own
+    const bool enabled = mAutoPacketSize.load() && peer->connected && !peer->endpoint->relay.load();
+
+    int safesize = 0;
+    if (enabled) {
+        if (auto probesize = peer->pathMtu.nextProbe(nowMs)) {
+            sendPathMtuProbe(peer, probesize);
+        }
+        if (!peer->pathMtu.takeChange(safesize)) {
+            return;
+        }
+    }
+    else {
+        peer->pathMtu.reset();
+    }
+
+    if (peer->autoPacketsize.exchange(safesize) != safesize) {
+        DBG("Path MTU to " << peer->endpoint->ipaddr << ": " << safesize << " -> packet size " << peer->sendPacketsize());
+        ungroupSharedSend(peer);
+
+        if (peer->oursource) {
+            peer->oursource->set_packetsize(peer->sendPacketsize());
+            peer->filestreamsource->set_packetsize(peer->sendPacketsize());
+        }
+        if (peer->latencyTestReady) {
+            peer->latencysource->set_packetsize(peer->sendPacketsize());
+            peer->echosource->set_packetsize(peer->sendPacketsize());
+        }
+    }
+}
+
+void SonobusAudioProcessor::sendPathMtuProbe(RemotePeer * peer, int size)
+{
+    // padded with a blob, so the whole message is the size to probe. Sealed, it's
+    // the sealed packet that has to be that size
+    char buf[AOO_MAXPACKETSIZE + 64];
+    static const char padding[AOO_MAXPACKETSIZE] = {};
+    if (size > AOO_MAXPACKETSIZE || (size & 3) != 0) return;
+
+    auto * cipher = peer->endpoint->cipher.load();
+    if (cipher) {
+        size -= SonoAudio::PacketCipher::Overhead;
+    }
+
+    osc::OutboundPacketStream outmsg(buf, sizeof(buf));
+
+    try {
+        // the address, type tags and blob size first
+        outmsg << osc::BeginMessage(SONOBUS_FULLMSG_MTUPROBE)
+        << osc::Blob(padding, 0)
+        << osc::EndMessage;
+
+        const int padsize = size - (int) outmsg.Size();
+        if (padsize < 0) return;
+
+        outmsg.Clear();
+        outmsg << osc::BeginMessage(SONOBUS_FULLMSG_MTUPROBE)
+        << osc::Blob(padding, padsize)
+        << osc::EndMessage;
+    }
+    catch (const osc::Exception& e){
+        DBG("exception in mtuprobe message construction: " << e.what());
+        return;
+    }
+    jassert((int) outmsg.Size() == size);
+
+    // straight out, not batched like the rest, with the don't fragment bit set just for it
+    auto endpoint = peer->endpoint;
+    socklen_t addrlen = 0;
+    auto addr = endpoint->getSendAddr(addrlen);
+    if (addrlen <= 0) return;
+
+    const int fd = endpoint->owner->getRawSocketHandle();
+    SocketDontFragmentValue old[2];
+    setSocketDontFragment(fd, true, old);
+    char sealed[AOO_MAXPACKETSIZE + 64 + SonoAudio::PacketCipher::Overhead];
+    const char * data = outmsg.Data();
+    size_t sendsize = outmsg.Size();
+    if (cipher) {
+        sendsize = (size_t) cipher->seal(data, (int) sendsize, sealed);
+        data = sealed;
+    }
+
+    // too big for our own interface fails right here, which makes it a lost probe as well
+    auto result = (int) ::sendto(fd, data, sendsize, 0, addr, addrlen);
+    setSocketDontFragment(fd, false, old);
+
+    if (result > 0) {
+        endpoint->sentBytes += result + UDP_OVERHEAD_BYTES;
+    }
+}
+
+void SonobusAudioProcessor::handlePingEvent(EndpointState * endpoint, uint64_t tt1, uint64_t tt2, uint64_t tt3)
+{
+    double diff1 = aoo_osctime_duration(tt1, tt2) * 1000.0;
+    double diff2 = aoo_osctime_duration(tt2, tt3) * 1000.0;
+    double rtt = aoo_osctime_duration(tt1, tt3) * 1000.0;
+
+    const ScopedReadLock sl (mCoreLock);
+
+    auto * peer = findRemotePeer(endpoint, -1);
+    if (!peer) return;
+
+    // answered right away, unlike the AOO pings, so good for telling their clock from ours
+    peer->clockOffset.addPing(tt1, tt2, tt3);
+
+    // smooth it
+    peer->pingTime = rtt; // * 0.5;
+    if (rtt < 600.0 ) {
+        peer->smoothPingTime.Z *= 0.5f;
+        peer->smoothPingTime.push(peer->pingTime);
+    }
+
+    DBG("ping recvd from " << peer->endpoint->ipaddr << ":" << peer->endpoint->port << " -- " << diff1 << " " << diff2 << " " <<  rtt << " smooth: " << peer->smoothPingTime.xbar << " stdev: " <<peer->smoothPingTime.s2xx);
+
+
+    updateRemotePeerEstLatency(peer);
+
+    peer->lastRttTimeMs = Time::getMillisecondCounterHiRes();
+}
+
+
+int32_t SonobusAudioProcessor::handleSourceEvents(const aoo_event ** events, int32_t n, int32_t sourceId, bool deferred)
+{
+    for (int i = 0; i < n; ++i){
+        if (sourceId >= FILESTREAM_ID_OFFSET) {
+            // our file stream sources only care whether the peer wants it
+            if (events[i]->type == AOO_INVITE_EVENT || events[i]->type == AOO_UNINVITE_EVENT) {
+                aoo_sink_event *e = (aoo_sink_event *)events[i];
+                EndpointState * es = (EndpointState *)e->endpoint;
+
+                const ScopedReadLock sl (mCoreLock);
+                for (auto * remote : mRemotePeers) {
+                    if (remote->endpoint != es || remote->ourId + FILESTREAM_ID_OFFSET != sourceId) continue;
+
+                    if (events[i]->type == AOO_INVITE_EVENT) {
+                        remote->filestreamsource->add_sink(es, e->id, endpoint_send);
+                        remote->filestreamsource->set_sinkoption(es, e->id, aoo_opt_protocol_flags, &remote->remoteSinkFlags, sizeof(int32_t));
+                    } else {
+                        remote->filestreamsource->remove_sink(es, e->id);
+                    }
+                    DBG("File stream " << (events[i]->type == AOO_INVITE_EVENT ? "invited" : "uninvited") << " by " << es->ipaddr << ":" << es->port);
+                    break;
+                }
+            }
+            continue;
+        }
+
+        if (!deferred && deferAooEvent(DeferredEvent::SourceEvent, events[i], sourceId)) {
+            continue;
+        }
+
+        switch (events[i]->type){
+        case AOO_PING_EVENT:
+        {
+            aoo_ping_event *e = (aoo_ping_event *)events[i];
+            double diff1 = aoo_osctime_duration(e->tt1, e->tt2) * 1000.0;
+            double diff2 = aoo_osctime_duration(e->tt2, e->tt3) * 1000.0;
+            double rtt = aoo_osctime_duration(e->tt1, e->tt3) * 1000.0;
+
+            EndpointState * es = (EndpointState *)e->endpoint;
+            
+            RemotePeer * peer = findRemotePeer(es, sourceId);
+            if (!peer) {
+                // we might be sending to them through a shared source
+                peer = findRemotePeerByRemoteSinkId(es, e->id);
+            }
+            // our source stamps its pings with real system time, so this is
+            // as good as our own ping (see sendPingEvent())
+            if (peer) {
+                const ScopedReadLock sl (mCoreLock);        
+
+                // smooth it
+                peer->pingTime = rtt; // * 0.5;
+                if (rtt < 600.0 ) {
+                    peer->smoothPingTime.Z *= 0.5f;
+                    peer->smoothPingTime.push(peer->pingTime);
+                }
+
+                DBG("ping to source " << sourceId << " recvd from " <<  es->ipaddr << ":" << es->port << " -- " << diff1 << " " << diff2 << " " <<  rtt << " smooth: " << peer->smoothPingTime.xbar << " stdev: " <<peer->smoothPingTime.s2xx);
+                
+                
+                updateRemotePeerEstLatency(peer);
+
+                peer->lastRttTimeMs = Time::getMillisecondCounterHiRes();
+
+                updateSendRateControl(peer, rtt, e->lost_blocks);
+                updateSendFrameSize(peer);
+            }
+            break;
+        }
+        case AOO_INVITE_EVENT:
+        {
+            aoo_sink_event *e = (aoo_sink_event *)events[i];
+
+            // accepts invites
+            if (true){
+                EndpointState * es = (EndpointState *)e->endpoint;
+                // handle dummy source specially
+                
+                int32_t dummyid;
+                
+                if (mAooDummySource->get_id(dummyid) && dummyid == sourceId) {
+                    // dummy source is special, and creates a remote peer
+
+                    RemotePeer * peer = findRemotePeerByRemoteSinkId(es, e->id);
+                    if (peer) {
+                        // we already have a peer for this, interesting
+                        DBG("Already had remote peer for " <<   es->ipaddr << ":" << es->port << "  ourId: " << peer->ourId);
+                    } else if (!mIsConnectedToServer) {
+                        peer = doAddRemotePeerIfNecessary(es);
+                    }
+                    else {
+                        // connected to server, don't just respond to anyone
+                        peer = findRemotePeer(es, -1);
+                        if (!peer) {
+                            DBG("Not reacting to invite from a peer not known in the group");
+                            break;
+                        }
+
+                        DBG("Got invite from peer in the group");
+                    }
+
+                    const ScopedReadLock sl (mCoreLock);        
+
+                    peer->remoteSinkId = e->id;
+                    peer->remoteSinkFlags = e->flags;
+
+                    // add their sink
                     peer->oursource->add_sink(es, peer->remoteSinkId, endpoint_send);
                     peer->oursource->set_sinkoption(es, peer->remoteSinkId, aoo_opt_protocol_flags, &e->flags, sizeof(int32_t));
+                    resetRemotePeerSendSubscription(peer);
+                    applyRemotePeerSendPath(peer);
+                    updateSendCoupledChannels(peer);
 
                     if (peer->sendAllow) {
                         peer->oursource->start();
@@ -3270,9 +9499,13 @@ int32_t SonobusAudioProcessor::handleSourceEvents(const aoo_event ** events, int
                     if (peer) {
                         
                         peer->remoteSinkId = e->id;
+                        peer->remoteSinkFlags = e->flags;
 
                         peer->oursource->add_sink(es, peer->remoteSinkId, endpoint_send);
                         peer->oursource->set_sinkoption(es, peer->remoteSinkId, aoo_opt_protocol_flags, &e->flags, sizeof(int32_t));
+                        resetRemotePeerSendSubscription(peer);
+                        applyRemotePeerSendPath(peer);
+                        updateSendCoupledChannels(peer);
                         
                         if (peer->sendAllow) {
                             peer->oursource->start();
@@ -3300,8 +9533,8 @@ int32_t SonobusAudioProcessor::handleSourceEvents(const aoo_event ** events, int
                             DBG("Invite to echo source adding sink " << e->id);
                         }
                         else if (auto * latpeer = findRemotePeerByLatencyId(es, sourceId)) {
-                            echopeer->latencysource->add_sink(es, e->id, endpoint_send);                                                        
-                            echopeer->latencysource->start();
+                            latpeer->latencysource->add_sink(es, e->id, endpoint_send);                                                        
+                            latpeer->latencysource->start();
                             DBG("Invite to our latency source adding sink " << e->id);
                         }
                         else {
@@ -3357,8 +9590,8 @@ int32_t SonobusAudioProcessor::handleSourceEvents(const aoo_event ** events, int
                     DBG("UnInvite to echo source adding sink " << e->id);
                 }
                 else if (auto * latpeer = findRemotePeerByLatencyId(es, sourceId)) {
-                    echopeer->latencysource->remove_sink(es, e->id);
-                    echopeer->latencysource->stop();
+                    latpeer->latencysource->remove_sink(es, e->id);
+                    latpeer->latencysource->stop();
                     DBG("UnInvite to latency source adding sink " << e->id);
                 }
 
@@ -3384,10 +9617,12 @@ int32_t SonobusAudioProcessor::handleSourceEvents(const aoo_event ** events, int
                 // now we need to set our latency and echo source to match our main source's format
                 aoo_format_storage fmt;
                 if (peer->oursource->get_format(fmt) > 0) {
-                    peer->latencysource->set_format(fmt.header);
-                    peer->echosource->set_format(fmt.header);
+                    if (peer->latencyTestReady) {
+                        peer->latencysource->set_format(fmt.header);
+                        peer->echosource->set_format(fmt.header);
+                    }
 
-                    AudioCodecFormatCodec codec = String(fmt.header.codec) == AOO_CODEC_OPUS ? CodecOpus : CodecPCM;
+                    AudioCodecFormatCodec codec = String(fmt.header.codec) == AOO_CODEC_OPUS ? CodecOpus : String(fmt.header.codec) == AOO_CODEC_LOSSLESS ? CodecLossless : CodecPCM;
                     if (codec == CodecOpus) {
                         aoo_format_opus *ofmt = (aoo_format_opus *)&fmt;
                         int retindex = findFormatIndex(codec, ofmt->bitrate / ofmt->header.nchannels, 0);
@@ -3403,10 +9638,43 @@ int32_t SonobusAudioProcessor::handleSourceEvents(const aoo_event ** events, int
                             peer->formatIndex = retindex; // new sending format index
                         }                        
                     }
+                    else if (codec == CodecLossless) {
+                        aoo_format_lossless *lfmt = (aoo_format_lossless *)&fmt;
+                        int retindex = findFormatIndex(codec, 0, lfmt->bitdepth == AOO_LOSSLESS_INT24 ? 3 : 2);
+                        if (retindex >= 0) {
+                            peer->formatIndex = retindex; // new sending format index
+                        }
+                    }
                 }
                 
 
             }
+            break;
+        }
+        case AOO_SUBSCRIBE_EVENT:
+        {
+            aoo_subscribe_event *e = (aoo_subscribe_event *)events[i];
+            DBG("Subscribe received from sink " << e->id << ": " << e->nchannels << " channels at " << e->onset);
+
+            EndpointState * es = (EndpointState *)e->endpoint;
+
+            const ScopedReadLock sl (mCoreLock);
+            RemotePeer * peer = findRemotePeerByRemoteSinkId(es, e->id);
+
+            if (peer && peer->oursource
+                && (peer->subscribedOnset != e->onset || peer->subscribedChannels != e->nchannels)) {
+                const int oldonset = peer->encodeSendOnset();
+                const int oldchans = peer->encodeSendChannels();
+                peer->subscribedOnset = e->onset;
+                peer->subscribedChannels = e->nchannels;
+
+                // only a different span needs a new source setup
+                if (peer->encodeSendOnset() != oldonset || peer->encodeSendChannels() != oldchans) {
+                    ungroupSharedSend(peer);
+                    setupRemotePeerOurSource(peer);
+                }
+            }
+            break;
         }
         default:
             break;
@@ -3416,9 +9684,26 @@ int32_t SonobusAudioProcessor::handleSourceEvents(const aoo_event ** events, int
 
 }
 
-int32_t SonobusAudioProcessor::handleSinkEvents(const aoo_event ** events, int32_t n, int32_t sinkId)
+int32_t SonobusAudioProcessor::handleSinkEvents(const aoo_event ** events, int32_t n, int32_t sinkId, bool deferred)
 {
     for (int i = 0; i < n; ++i){
+        if (isFileStreamSourceEvent(events[i])) {
+            // a peer's pre-encoded file playback, just mixed in by the sink with their other audio
+            if (events[i]->type == AOO_SOURCE_ADD_EVENT) {
+                aoo_source_event *e = (aoo_source_event *)events[i];
+                EndpointState * es = (EndpointState *)e->endpoint;
+                RemotePeer * peer = findRemotePeer(es, sinkId);
+                if (peer && !peer->recvAllow) {
+                    peer->oursink->uninvite_source(es, e->id, endpoint_send);
+                }
+            }
+            continue;
+        }
+
+        if (!deferred && deferAooEvent(DeferredEvent::SinkEvent, events[i], sinkId)) {
+            continue;
+        }
+
         switch (events[i]->type){
         case AOO_SOURCE_ADD_EVENT:
         {
@@ -3479,7 +9764,6 @@ int32_t SonobusAudioProcessor::handleSinkEvents(const aoo_event ** events, int32
                 aoo_format_storage f;
                 if (peer->oursink->get_source_format(e->endpoint, e->id, f) > 0) {
                     DBG("Got source format event from " << es->ipaddr << ":" << es->port << "  " <<  e->id  << "  channels: " << f.header.nchannels);
-                    peer->recvMeterSource.resize(f.header.nchannels, meterRmsWindow);
 
                     // check for layout
                     bool gotuserformat = false;
@@ -3500,12 +9784,22 @@ int32_t SonobusAudioProcessor::handleSinkEvents(const aoo_event ** events, int32
                         DBG("No userformat: " << retsize);
                     }
 
-                    if (peer->recvChannels != f.header.nchannels) {
+                    // with a subscription only that span of the layout comes in, at its onset
+                    int recvchans = f.header.nchannels;
+                    if (gotuserformat && peer->recvSubscribedChannels > 0 && f.header.nchannels == peer->recvSubscribedChannels) {
+                        recvchans = jmax(recvchans, peer->recvSubscribedOnset + peer->recvSubscribedChannels);
+                        for (int cgi=0; cgi < peer->numChanGroups && cgi < MAX_CHANGROUPS; ++cgi) {
+                            recvchans = jmax(recvchans, peer->chanGroups[cgi].params.chanStartIndex + peer->chanGroups[cgi].params.numChannels);
+                        }
+                    }
+                    peer->recvMeterSource.resize(recvchans, meterRmsWindow);
+
+                    if (peer->recvChannels != recvchans) {
 
                         {
                             const ScopedWriteLock sl (peer->sinkLock);
 
-                            peer->recvChannels = std::min(MAX_PANNERS, f.header.nchannels);
+                            peer->recvChannels = std::min(MAX_PANNERS, recvchans);
 
                             // set up this sink with new channel count
 
@@ -3556,1821 +9850,2530 @@ int32_t SonobusAudioProcessor::handleSinkEvents(const aoo_event ** events, int32
                                 peer->recvPan[i] = 0.0f;
                             }
                         }
-                         */
+                         */
+                    }
+
+
+                    
+                    AudioCodecFormatCodec codec = String(f.header.codec) == AOO_CODEC_OPUS ? CodecOpus : String(f.header.codec) == AOO_CODEC_LOSSLESS ? CodecLossless : CodecPCM;
+                    if (codec == CodecOpus) {
+                        aoo_format_opus *fmt = (aoo_format_opus *)&f;
+                        peer->recvFormat = AudioCodecFormatInfo(fmt->bitrate/fmt->header.nchannels, fmt->complexity, fmt->signal_type);
+                        //peer->recvFormatIndex = findFormatIndex(codec, fmt->bitrate / fmt->header.nchannels, 0);
+                    } else if (codec == CodecLossless) {
+                        aoo_format_lossless *fmt = (aoo_format_lossless *)&f;
+                        peer->recvFormat = AudioCodecFormatInfo(CodecLossless, fmt->bitdepth == AOO_LOSSLESS_INT24 ? 3 : 2);
+                    } else {
+                        aoo_format_pcm *fmt = (aoo_format_pcm *)&f;
+                        int bitdepth = fmt->bitdepth == AOO_PCM_INT16 ? 2 : fmt->bitdepth == AOO_PCM_INT24  ? 3  : fmt->bitdepth == AOO_PCM_FLOAT32 ? 4 : fmt->bitdepth == AOO_PCM_FLOAT64  ? 8 : 2;
+                        peer->recvFormat = AudioCodecFormatInfo(bitdepth);
+                        //peer->recvFormatIndex = findFormatIndex(codec, 0, fmt->bitdepth);
+                    }
+
+                    // the layout might have changed
+                    updateRemotePeerSubscription(peer);
+                    
+                    clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientPeerChangedState, this, "format");
+                }                
+            }
+            else { 
+                DBG("format event to unknown " << e->id);
+                
+            }
+            
+            break;
+        }
+        case AOO_SOURCE_STATE_EVENT:
+        {
+            aoo_source_state_event *e = (aoo_source_state_event *)events[i];
+            EndpointState * es = (EndpointState *)e->endpoint;
+
+            DBG("Got source state event from " << es->ipaddr << ":" << es->port << " -- " << e->state);
+
+            const ScopedReadLock sl (mCoreLock);        
+
+            RemotePeer * peer = findRemotePeer(es, sinkId);
+            if (peer) {
+                peer->recvActive = peer->recvAllow && e->state > 0;
+                if (!peer->recvActive && !peer->sendActive) {
+                    peer->connected = false;
+                } else {
+                    peer->connected = true;                    
+                }
+            }
+            
+            //clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientPeerChangedState, this, "state");
+            
+            break;
+        }
+        case AOO_BLOCK_LOST_EVENT:
+        {
+            aoo_block_lost_event *e = (aoo_block_lost_event *)events[i];
+
+            EndpointState * es = (EndpointState *)e->endpoint;
+
+            DBG("Got source block lost event from " << es->ipaddr << ":" << es->port << "   " << e->id << " -- " << e->count);
+
+            const ScopedReadLock sl (mCoreLock);                    
+            RemotePeer * peer = findRemotePeer(es, sinkId);
+            if (peer) {
+                peer->dataPacketsDropped += e->count;
+                
+                if (peer->autosizeBufferMode != AutoNetBufferModeOff) {
+                    // see if our drop rate exceeds threshold, and increase buffersize if so
+                    double nowtime = Time::getMillisecondCounterHiRes();
+                    const float dropratethresh = peer->autosizeBufferMode == AutoNetBufferModeInitAuto ? 1.0f : mAutoresizeDropRateThresh;
+                    const float adjustlimit = 0.5f; // don't adjust more often than once every 0.5 seconds
+
+                    bool autoinitdone = peer->autosizeBufferMode == AutoNetBufferModeInitAuto && peer->autoNetbufInitCompleted;
+                    
+                    if (peer->lastDroptime > 0 && !autoinitdone) {
+                        double deltatime = (nowtime - peer->lastDroptime) * 1e-3;  
+                        if (deltatime > adjustlimit) {
+                            //float droprate =  (peer->dataPacketsDropped - peer->lastDropCount) / deltatime;
+                            float droprate =  1.0f / deltatime; // treat any drops as one instance
+                            if (droprate > dropratethresh) {
+                                float adjms = 1000.0f * currSamplesPerBlock / getSampleRate();
+                                peer->buffertimeMs += adjms;
+                                updateRemotePeerEstLatency(peer);
+                                peer->oursink->set_buffersize(peer->buffertimeMs);
+                                if (peer->latencyTestReady) {
+                                    peer->echosink->set_buffersize(peer->buffertimeMs);
+                                    peer->latencysink->set_buffersize(peer->buffertimeMs);
+                                }
+                                peer->latencyDirty = true;
+                                peer->fillRatioSlow.reset();
+                                peer->fillRatio.reset();
+
+                                DBG("AUTO-Increasing buffer time by " << adjms << " ms to " << (int)peer->buffertimeMs << " droprate: " << droprate);
+
+                                if (peer->autosizeBufferMode == AutoNetBufferModeAutoFull) {
+
+                                    const float timesincedecrthresh = 2.0;
+                                    if (peer->lastNetBufDecrTime > 0 && (nowtime - peer->lastNetBufDecrTime)*1e-3 < timesincedecrthresh ) {
+                                        peer->netBufAutoBaseline = peer->buffertimeMs;
+                                        DBG("Got drop within short time thresh, setting minimum baseline for future decr to " << peer->netBufAutoBaseline);
+                                    }
+                                }
+
+                                sendRemotePeerInfoUpdate(-1, peer); // send to this peer
+
+                            }
+
+                            float realdroprate =  (peer->dataPacketsDropped - peer->lastDropCount) / deltatime;
+                            peer->fastDropRate.push(realdroprate);
+
+                            peer->lastDroptime = nowtime;
+                            peer->lastDropCount = peer->dataPacketsDropped;
+                        }
+                    }
+                    else {
+                        if (peer->lastDroptime > 0) {
+                            double deltatime = (nowtime - peer->lastDroptime) * 1e-3;
+                            float droprate =  (peer->dataPacketsDropped - peer->lastDropCount) / deltatime;
+                            peer->fastDropRate.push(droprate);
+                        }
+
+                        peer->lastDroptime = nowtime;
+                        peer->lastDropCount = peer->dataPacketsDropped;
+                    }
+                    
+
+                    
+                    //peer->lastNetBufDecrTime = 0; // reset auto-decr
+                }
+            }
+            
+            break;
+        }
+        case AOO_BLOCK_REORDERED_EVENT:
+        {
+            aoo_block_reordered_event *e = (aoo_block_reordered_event *)events[i];
+
+            EndpointState * es = (EndpointState *)e->endpoint;
+
+            DBG("Got source block reordered event from " << es->ipaddr << ":" << es->port << "  " << e->id << " -- " << e->count);
+            const ScopedReadLock sl (mCoreLock);
+            RemotePeer * peer = findRemotePeer(es, sinkId);
+            if (peer) {
+                peer->dataPacketsReordered += e->count;
+            }
+
+            break;
+        }
+        case AOO_BLOCK_RESENT_EVENT:
+        {
+            aoo_block_resent_event *e = (aoo_block_resent_event *)events[i];
+            EndpointState * es = (EndpointState *)e->endpoint;
+
+            DBG("Got source block resent event from " << es->ipaddr << ":" << es->port << "  " << e->id << " -- " << e->count);
+            const ScopedReadLock sl (mCoreLock);                    
+            RemotePeer * peer = findRemotePeer(es, sinkId);
+            if (peer) {
+                peer->dataPacketsResent += e->count;
+            }
+
+            break;
+        }
+        case AOO_BLOCK_GAP_EVENT:
+        {
+            aoo_block_gap_event *e = (aoo_block_gap_event *)events[i];
+
+            EndpointState * es = (EndpointState *)e->endpoint;
+
+            DBG("Got source block gap event from " << es->ipaddr << ":" << es->port << "  " << e->id << " -- " << e->count);
+            const ScopedReadLock sl (mCoreLock);
+            RemotePeer * peer = findRemotePeer(es, sinkId);
+            if (peer) {
+                peer->dataBlockGaps += e->count;
+            }
+
+            break;
+        }
+        case AOO_PING_EVENT:
+        {
+            aoo_ping_event *e = (aoo_ping_event *)events[i];
+            EndpointState * es = (EndpointState *)e->endpoint;
+
+
+            double diff = aoo_osctime_duration(e->tt1, e->tt2) * 1000.0;
+            DBG("Got source block ping event from " << es->ipaddr << ":" << es->port << "  " << e->id << " -- " << diff);
+
+
+            RemotePeer * peer = findRemotePeer(es, sinkId);
+            if (peer) {
+                const ScopedReadLock sl (mCoreLock);
+
+                double nowtime = Time::getMillisecondCounterHiRes();
+
+                double deltadroptime = peer->lastDroptime > 0 ? (nowtime - peer->lastDroptime) * 1e-3 : (nowtime - peer->resetDroptime) * 1e-3;
+
+                if (peer->autosizeBufferMode != AutoNetBufferModeOff) {
+                    if (!peer->autoNetbufInitCompleted) {
+                        const float nodropsthresh = 7.0;
+
+                        if (deltadroptime > nodropsthresh) {
+                            peer->autoNetbufInitCompleted = true;
+                            peer->resetSafetyMuted = false;
+                            DBG("Netbuf Initial auto time is done after no drops in " << nodropsthresh);
+
+                            // clear drop count
+                            peer->dataPacketsResent = 0;
+                            peer->dataPacketsDropped = 0;
+                            peer->lastDropCount = 0;
+                            peer->resetDroptime = nowtime;
+                            peer->fastDropRate.resetInitVal(0.0f);
+                            //peer->lastDroptime = 0;
+                        }
+
+                    }
+
+                }
+                else {
+                    // manual mode
+                    peer->resetSafetyMuted = false;
+                }
+
+
+                if (peer->autosizeBufferMode == AutoNetBufferModeAutoFull) {
+                    // possibly adjust net buffer down, if it has been longer than threshold since last drop
+                    double nowtime = Time::getMillisecondCounterHiRes();
+                    const float nodropsthresh = 10.0; // no drops in 10 seconds
+                    const float adjustlimit = 10; // don't adjust more often than once every 10 seconds
+
+                    // a padded one is behind another link anyway, only that one trims itself
+                    if (peer->lastNetBufDecrTime > 0 && peer->buffertimeMs > peer->netBufAutoBaseline && !peer->latencyMatched && peer->padBufferTimeMs <= 0.0f) {
+                        double deltatime = (nowtime - peer->lastNetBufDecrTime) * 1e-3;
+                        double deltadroptime = (nowtime - peer->lastDroptime) * 1e-3;
+                        if (deltatime > adjustlimit) {
+                            //float droprate =  (peer->dataPacketsDropped - peer->lastDropCount) / deltatime;
+                            //if (droprate < dropratethresh) {
+                            if (deltadroptime > nodropsthresh) {
+                                float adjms = 1000.0f * currSamplesPerBlock / getSampleRate();
+                                peer->buffertimeMs -= getAutoNetBufferDecrease(peer, adjms);
+
+                                peer->buffertimeMs = std::max(peer->buffertimeMs, peer->netBufAutoBaseline);
+
+                                updateRemotePeerEstLatency(peer);
+                                peer->oursink->set_buffersize(peer->buffertimeMs);
+                                if (peer->latencyTestReady) {
+                                    peer->echosink->set_buffersize(peer->buffertimeMs);
+                                    peer->latencysink->set_buffersize(peer->buffertimeMs);
+                                }
+                                peer->latencyDirty = true;
+
+                                peer->fillRatioSlow.reset();
+                                peer->fillRatio.reset();
+
+                                DBG("AUTO-Decreasing buffer time by " << adjms << " ms to " << (int) peer->buffertimeMs);
+
+                                peer->lastNetBufDecrTime = nowtime;
+
+                                sendRemotePeerInfoUpdate(-1, peer); // send to this peer
+
+                            }
+
+                            //peer->lastNetBufDropCount = peer->dataPacketsDropped;
+                        }
+                    }
+                    else {
+                        peer->lastNetBufDecrTime = nowtime;
                     }
 
+                }
+            }
 
-                    
-                    AudioCodecFormatCodec codec = String(f.header.codec) == AOO_CODEC_OPUS ? CodecOpus : CodecPCM;
-                    if (codec == CodecOpus) {
-                        aoo_format_opus *fmt = (aoo_format_opus *)&f;
-                        peer->recvFormat = AudioCodecFormatInfo(fmt->bitrate/fmt->header.nchannels, fmt->complexity, fmt->signal_type);
-                        //peer->recvFormatIndex = findFormatIndex(codec, fmt->bitrate / fmt->header.nchannels, 0);
-                    } else {
-                        aoo_format_pcm *fmt = (aoo_format_pcm *)&f;
-                        int bitdepth = fmt->bitdepth == AOO_PCM_INT16 ? 2 : fmt->bitdepth == AOO_PCM_INT24  ? 3  : fmt->bitdepth == AOO_PCM_FLOAT32 ? 4 : fmt->bitdepth == AOO_PCM_FLOAT64  ? 8 : 2;
-                        peer->recvFormat = AudioCodecFormatInfo(bitdepth);
-                        //peer->recvFormatIndex = findFormatIndex(codec, 0, fmt->bitdepth);
-                    }
-                    
-                    clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientPeerChangedState, this, "format");
-                }                
+
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    return 1;
+}
+
+int32_t SonobusAudioProcessor::handleServerEvents(const aoo_event ** events, int32_t n)
+{
+    for (int i = 0; i < n; ++i){
+        switch (events[i]->type){
+            case AOONET_SERVER_USER_JOIN_EVENT:
+            {
+                aoonet_server_user_event *e = (aoonet_server_user_event *)events[i];
+                
+                DBG("Server - User joined: " << e->name);
+                
+                break;
             }
-            else { 
-                DBG("format event to unknown " << e->id);
+            case AOONET_SERVER_USER_LEAVE_EVENT:
+            {
+                aoonet_server_user_event *e = (aoonet_server_user_event *)events[i];
+                
+                DBG("Server - User left: " << e->name);
+                
                 
+                break;
             }
-            
-            break;
+            case AOONET_SERVER_GROUP_JOIN_EVENT:
+            {
+                aoonet_server_group_event *e = (aoonet_server_group_event *)events[i];
+                
+                DBG("Server - Group Joined: " << e->group << "  by user: " << e->user);
+                
+                break;
+            }
+            case AOONET_SERVER_GROUP_LEAVE_EVENT:
+            {
+                aoonet_server_group_event *e = (aoonet_server_group_event *)events[i];
+                
+                DBG("Server - Group Left: " << e->group << "  by user: " << e->user);
+                
+                break;
+            }
+            case AOONET_SERVER_ERROR_EVENT:
+            {
+                aoonet_server_event *e = (aoonet_server_event *)events[i];
+                
+                DBG("Server error: " << String::fromUTF8(e->errormsg));
+                
+                break;
+            }
+            default:
+                DBG("Got unknown server event: " << events[i]->type);
+                break;
         }
-        case AOO_SOURCE_STATE_EVENT:
-        {
-            aoo_source_state_event *e = (aoo_source_state_event *)events[i];
-            EndpointState * es = (EndpointState *)e->endpoint;
+    }
+    return 1;
+}
 
-            DBG("Got source state event from " << es->ipaddr << ":" << es->port << " -- " << e->state);
+int32_t SonobusAudioProcessor::handleClientEvents(const aoo_event ** events, int32_t n)
+{
+    // a group join brings all of its peers in one go, they get to the audio thread together
+    int numjoins = 0;
+    for (int i = 0; i < n; ++i){
+        if (events[i]->type == AOONET_CLIENT_PEER_JOIN_EVENT) ++numjoins;
+    }
+    const bool batchpeers = numjoins > 1;
+    if (batchpeers) {
+        beginPeerAddBatch();
+    }
 
-            const ScopedReadLock sl (mCoreLock);        
+    for (int i = 0; i < n; ++i){
+        switch (events[i]->type){
+        case AOONET_CLIENT_CONNECT_EVENT:
+        {
+            aoonet_client_group_event *e = (aoonet_client_group_event *)events[i];
 
-            RemotePeer * peer = findRemotePeer(es, sinkId);
-            if (peer) {
-                peer->recvActive = peer->recvAllow && e->state > 0;
-                if (!peer->recvActive && !peer->sendActive) {
-                    peer->connected = false;
-                } else {
-                    peer->connected = true;                    
-                }
+            mServerConnecting = false;
+
+            if (e->result > 0){
+                DBG("Connected to server!" << (e->result == 2 ? " (resumed session)" : ""));
+                mIsConnectedToServer = true;
+                mServerSessionResumed = e->result == 2;
+                // only this connection, a reconnect has to join again
+                mServerRequestsPipelined = mServerRequestsPending.exchange(false);
+                mSessionConnectionStamp = Time::getMillisecondCounterHiRes();
+                // relayed and forwarded peer packets come from the server's UDP port
+                mRelayEndpoint = findOrAddEndpoint(mServerEndpoint->ipaddr, mServerEndpoint->port);
+            } else {
+                DBG("Couldn't connect to server - " << String::fromUTF8(e->errormsg));
+                mIsConnectedToServer = false;
+                mServerRequestsPending = false;
+                mServerRequestsPipelined = false;
+                mSessionConnectionStamp = 0.0;
             }
+
+            clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientConnected, this, e->result > 0, String::fromUTF8(e->errormsg));
             
-            //clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientPeerChangedState, this, "state");
+            break;
+        }
+        case AOONET_CLIENT_DISCONNECT_EVENT:
+        {
+            aoonet_client_group_event *e = (aoonet_client_group_event *)events[i];
+            if (e->result == 0){
+                DBG("Disconnected from server - " << String::fromUTF8(e->errormsg));
+            }
+
+            // don't remove all peers?
+            //removeAllRemotePeers();
             
+            mRelayEndpoint = nullptr;
+            mIsConnectedToServer = false;
+            mServerConnecting = false;
+            mSessionConnectionStamp = 0.0;
+
+            clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientDisconnected, this, e->result > 0, String::fromUTF8(e->errormsg));
+
             break;
         }
-        case AOO_BLOCK_LOST_EVENT:
+        case AOONET_CLIENT_GROUP_JOIN_EVENT:
         {
-            aoo_block_lost_event *e = (aoo_block_lost_event *)events[i];
+            aoonet_client_group_event *e = (aoonet_client_group_event *)events[i];
+            if (e->result > 0){
+                DBG("Joined group - " << e->name);
+                const ScopedLock sl (mClientLock);        
+                mCurrentJoinedGroup = CharPointer_UTF8 (e->name);
 
-            EndpointState * es = (EndpointState *)e->endpoint;
+                mSessionConnectionStamp = Time::getMillisecondCounterHiRes();
 
-            DBG("Got source block lost event from " << es->ipaddr << ":" << es->port << "   " << e->id << " -- " << e->count);
+                // handled right after these events, see EventThread
+                mLanMulticastUpdatePending = true;
 
-            const ScopedReadLock sl (mCoreLock);                    
-            RemotePeer * peer = findRemotePeer(es, sinkId);
-            if (peer) {
-                peer->dataPacketsDropped += e->count;
-                
-                if (peer->autosizeBufferMode != AutoNetBufferModeOff) {
-                    // see if our drop rate exceeds threshold, and increase buffersize if so
-                    double nowtime = Time::getMillisecondCounterHiRes();
-                    const float dropratethresh = peer->autosizeBufferMode == AutoNetBufferModeInitAuto ? 1.0f : mAutoresizeDropRateThresh;
-                    const float adjustlimit = 0.5f; // don't adjust more often than once every 0.5 seconds
 
-                    bool autoinitdone = peer->autosizeBufferMode == AutoNetBufferModeInitAuto && peer->autoNetbufInitCompleted;
-                    
-                    if (peer->lastDroptime > 0 && !autoinitdone) {
-                        double deltatime = (nowtime - peer->lastDroptime) * 1e-3;  
-                        if (deltatime > adjustlimit) {
-                            //float droprate =  (peer->dataPacketsDropped - peer->lastDropCount) / deltatime;
-                            float droprate =  1.0f / deltatime; // treat any drops as one instance
-                            if (droprate > dropratethresh) {
-                                float adjms = 1000.0f * currSamplesPerBlock / getSampleRate();
-                                peer->buffertimeMs += adjms;
-                                peer->totalEstLatency = peer->smoothPingTime.xbar + 2*peer->buffertimeMs + (1e3*currSamplesPerBlock/getSampleRate());
-                                peer->oursink->set_buffersize(peer->buffertimeMs);
-                                peer->echosink->set_buffersize(peer->buffertimeMs);
-                                peer->latencysink->set_buffersize(peer->buffertimeMs);
-                                peer->latencyDirty = true;
-                                peer->fillRatioSlow.reset();
-                                peer->fillRatio.reset();
+            } else {
+                DBG("Couldn't join group " << e->name << " - " << String::fromUTF8(e->errormsg));
+            }
+            clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientGroupJoined, this, e->result > 0, CharPointer_UTF8 (e->name), String::fromUTF8(e->errormsg));
+            break;
+        }
+        case AOONET_CLIENT_GROUP_LEAVE_EVENT:
+        {
+            aoonet_client_group_event *e = (aoonet_client_group_event *)events[i];
+            if (e->result > 0){
 
-                                DBG("AUTO-Increasing buffer time by " << adjms << " ms to " << (int)peer->buffertimeMs << " droprate: " << droprate);
+                DBG("Group leave - " << e->name);
 
-                                if (peer->hasRealLatency) {
-                                    peer->totalEstLatency = peer->totalLatency + (peer->buffertimeMs - peer->bufferTimeAtRealLatency);
-                                }
+                const ScopedLock sl (mClientLock);        
+                mCurrentJoinedGroup.clear();
+                mLanMulticastUpdatePending = true;
 
-                                if (peer->autosizeBufferMode == AutoNetBufferModeAutoFull) {
+                // assume they are all part of the group, XXX
+                removeAllRemotePeers();
 
-                                    const float timesincedecrthresh = 2.0;
-                                    if (peer->lastNetBufDecrTime > 0 && (nowtime - peer->lastNetBufDecrTime)*1e-3 < timesincedecrthresh ) {
-                                        peer->netBufAutoBaseline = peer->buffertimeMs;
-                                        DBG("Got drop within short time thresh, setting minimum baseline for future decr to " << peer->netBufAutoBaseline);
-                                    }
-                                }
+                //aoo_node_remove_group(x->x_node, gensym(e->name));
+                
 
-                                sendRemotePeerInfoUpdate(-1, peer); // send to this peer
+            } else {
+                DBG("Couldn't leave group " << e->name << " - " << String::fromUTF8(e->errormsg));
+            }
 
-                            }
+            clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientGroupLeft, this, e->result > 0, CharPointer_UTF8 (e->name), String::fromUTF8(e->errormsg));
 
-                            float realdroprate =  (peer->dataPacketsDropped - peer->lastDropCount) / deltatime;
-                            peer->fastDropRate.push(realdroprate);
+            break;
+        }
+        case AOONET_CLIENT_GROUP_PUBLIC_ADD_EVENT:
+        {
+            aoonet_client_group_event *e = (aoonet_client_group_event *)events[i];
+            DBG("Public group add/changed - " << e->name << " count: " << e->result);
+            {
+                const ScopedLock sl (mPublicGroupsLock);
+                String group = CharPointer_UTF8 (e->name);
+                AooPublicGroupInfo & ginfo = mPublicGroupInfos[group];
+                ginfo.groupName = group;
+                ginfo.activeCount = e->result;
+                ginfo.timestamp = Time::getCurrentTime().toMilliseconds();
+            }
 
-                            peer->lastDroptime = nowtime;
-                            peer->lastDropCount = peer->dataPacketsDropped;
-                        }
-                    }
-                    else {
-                        if (peer->lastDroptime > 0) {
-                            double deltatime = (nowtime - peer->lastDroptime) * 1e-3;
-                            float droprate =  (peer->dataPacketsDropped - peer->lastDropCount) / deltatime;
-                            peer->fastDropRate.push(droprate);
-                        }
+            clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientPublicGroupModified, this, CharPointer_UTF8 (e->name), e->result,  String::fromUTF8(e->errormsg));
+            break;
+        }
+        case AOONET_CLIENT_GROUP_PUBLIC_DEL_EVENT:
+        {
+            aoonet_client_group_event *e = (aoonet_client_group_event *)events[i];
+            DBG("Public group deleted - " << e->name);
+            {
+                const ScopedLock sl (mPublicGroupsLock);
+                String group = CharPointer_UTF8 (e->name);
+                mPublicGroupInfos.erase(group);
+            }
 
-                        peer->lastDroptime = nowtime;
-                        peer->lastDropCount = peer->dataPacketsDropped;
-                    }
-                    
+            clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientPublicGroupDeleted, this, CharPointer_UTF8 (e->name), String::fromUTF8(e->errormsg));
+            break;
+        }
 
-                    
-                    //peer->lastNetBufDecrTime = 0; // reset auto-decr
-                }
+        case AOONET_CLIENT_PEER_PREJOIN_EVENT:
+        {
+            aoonet_client_peer_event *e = (aoonet_client_peer_event *)events[i];
+            
+            if (e->result > 0){
+                DBG("Peer attempting to join group " <<  e->group << " - user " << e->user);
+                
+                clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientPeerPendingJoin, this, CharPointer_UTF8 (e->group), CharPointer_UTF8 (e->user));
+                
+            } else {
+                DBG("bug bad result on join event");
             }
-            
+                        
             break;
         }
-        case AOO_BLOCK_REORDERED_EVENT:
+        case AOONET_CLIENT_PEER_JOIN_EVENT:
         {
-            aoo_block_reordered_event *e = (aoo_block_reordered_event *)events[i];
+            aoonet_client_peer_event *e = (aoonet_client_peer_event *)events[i];
 
-            EndpointState * es = (EndpointState *)e->endpoint;
+            if (e->result > 0){
+                DBG("Peer joined group " <<  e->group << " - user " << e->user);
 
-            DBG("Got source block reordered event from " << es->ipaddr << ":" << es->port << "  " << e->id << " -- " << e->count);
+                // peers that couldn't be reached directly go through the server
+                if (auto endpoint = findOrAddRawEndpoint(e->address)) {
+                    EndpointState * relay = e->relay_address ? findOrAddRawEndpoint(e->relay_address) : nullptr;
+                    if (relay) {
+                        DBG("Peer " << e->user << " is relayed by the server");
+                        mRelayEndpoint = relay;
+                    }
+                    endpoint->relay = relay;
+                    endpoint->serverPeer = true;
+                }
 
-            break;
-        }
-        case AOO_BLOCK_RESENT_EVENT:
-        {
-            aoo_block_resent_event *e = (aoo_block_resent_event *)events[i];
-            EndpointState * es = (EndpointState *)e->endpoint;
+                if (mAutoconnectGroupPeers) {
+                    connectRemotePeerRaw(e->address, CharPointer_UTF8 (e->user), CharPointer_UTF8 (e->group), !mMainRecvMute.get());
+                }
+                
+                //aoo_node_add_peer(x->x_node, gensym(e->group), gensym(e->user),
+                //                  (const struct sockaddr *)e->address, e->length);
 
-            DBG("Got source block resent event from " << es->ipaddr << ":" << es->port << "  " << e->id << " -- " << e->count);
-            const ScopedReadLock sl (mCoreLock);                    
-            RemotePeer * peer = findRemotePeer(es, sinkId);
-            if (peer) {
-                peer->dataPacketsResent += e->count;
+                clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientPeerJoined, this, CharPointer_UTF8 (e->group), CharPointer_UTF8 (e->user));
+                
+            } else {
+                DBG("bug bad result on join event");
             }
+            
 
             break;
         }
-        case AOO_BLOCK_GAP_EVENT:
+        case AOONET_CLIENT_PEER_JOINFAIL_EVENT:
         {
-            aoo_block_gap_event *e = (aoo_block_gap_event *)events[i];
-
-            EndpointState * es = (EndpointState *)e->endpoint;
-
-            DBG("Got source block gap event from " << es->ipaddr << ":" << es->port << "  " << e->id << " -- " << e->count);
-
+            aoonet_client_peer_event *e = (aoonet_client_peer_event *)events[i];
+            
+            if (e->result > 0){
+                DBG("Peer failed to join group " <<  e->group << " - user " << e->user);
+                
+                clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientPeerJoinFailed, this, CharPointer_UTF8 (e->group), CharPointer_UTF8 (e->user));
+                
+            } else {
+                DBG("bug bad result on join event");
+            }
+                        
             break;
         }
-        case AOO_PING_EVENT:
+        case AOONET_CLIENT_PEER_LEAVE_EVENT:
         {
-            aoo_ping_event *e = (aoo_ping_event *)events[i];
-            EndpointState * es = (EndpointState *)e->endpoint;
-
+            aoonet_client_peer_event *e = (aoonet_client_peer_event *)events[i];
 
-            double diff = aoo_osctime_duration(e->tt1, e->tt2) * 1000.0;
-            DBG("Got source block ping event from " << es->ipaddr << ":" << es->port << "  " << e->id << " -- " << diff);
+            if (e->result > 0){
 
+                DBG("Peer leave group " <<  e->group << " - user " << e->user);
 
-            RemotePeer * peer = findRemotePeer(es, sinkId);
-            if (peer) {
-                const ScopedReadLock sl (mCoreLock);
+                EndpointState * endpoint = findOrAddRawEndpoint(e->address);
+                if (endpoint) {
+                    
+                    removeAllRemotePeersWithEndpoint(endpoint);
+                }
+                
+                //aoo_node_remove_peer(x->x_node, gensym(e->group), gensym(e->user));
+                clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientPeerLeft, this, CharPointer_UTF8 (e->group), CharPointer_UTF8 (e->user));
 
-                double nowtime = Time::getMillisecondCounterHiRes();
+            } else {
+                DBG("bug bad result on leave event");
+            }
+            break;
+        }
+        case AOONET_CLIENT_ERROR_EVENT:
+        {
+            aoonet_client_event *e = (aoonet_client_event *)events[i];
+            DBG("client error: " << String::fromUTF8(e->errormsg));
+            clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientError, this, String::fromUTF8(e->errormsg));
+            break;
+        }
+        default:
+            DBG("Got unknown client event: " << events[i]->type);
+            break;
+        }
+    }
 
-                double deltadroptime = peer->lastDroptime > 0 ? (nowtime - peer->lastDroptime) * 1e-3 : (nowtime - peer->resetDroptime) * 1e-3;
+    if (batchpeers) {
+        endPeerAddBatch();
+    }
+    return 1;
+}
 
-                if (peer->autosizeBufferMode != AutoNetBufferModeOff) {
-                    if (!peer->autoNetbufInitCompleted) {
-                        const float nodropsthresh = 7.0;
 
-                        if (deltadroptime > nodropsthresh) {
-                            peer->autoNetbufInitCompleted = true;
-                            peer->resetSafetyMuted = false;
-                            DBG("Netbuf Initial auto time is done after no drops in " << nodropsthresh);
+int SonobusAudioProcessor::connectRemotePeerRaw(void * sockaddr, const String & username, const String & groupname, bool reciprocate)
+{
+    EndpointState * endpoint = findOrAddRawEndpoint(sockaddr);
+    
+    if (!endpoint) {
+        DBG("Error getting endpoint from raw address");
+        return 0;
+    }
+    
+    RemotePeer * remote = doAddRemotePeerIfNecessary(endpoint, AOO_ID_NONE, username, groupname); // get new one
 
-                            // clear drop count
-                            peer->dataPacketsResent = 0;
-                            peer->dataPacketsDropped = 0;
-                            peer->lastDropCount = 0;
-                            peer->resetDroptime = nowtime;
-                            peer->fastDropRate.resetInitVal(0.0f);
-                            //peer->lastDroptime = 0;
-                        }
+    remote->recvAllow = !mMainRecvMute.get();
+    
+    // special - use 0 
+    bool ret = remote->oursink->invite_source(endpoint, 0, endpoint_send) == 1;
+    
+    if (ret) {
+        DBG("Successfully invited remote peer at " << endpoint->ipaddr << ":" << endpoint->port << " - ourId " << remote->ourId);
+        remote->connected = true;
+        remote->invitedPeer = reciprocate;
+        //remote->recvActive = reciprocate;
+        if (!mMainSendMute.get()) {
+            remote->sendActive = true;
+            remote->oursource->start();
+            updateRemotePeerUserFormat(-1, remote);
+            sendRemotePeerInfoUpdate(-1, remote);
+        }
+        else {
+            remote->sendActive = false;
+            remote->oursource->stop();
+        }
+        
+    } else {
+        DBG("Error inviting remote peer at " << endpoint->ipaddr << ":" << endpoint->port << " - ourId " << remote->ourId);
+    }
 
-                    }
+    return ret;    
+}
 
-                }
-                else {
-                    // manual mode
-                    peer->resetSafetyMuted = false;
-                }
+int SonobusAudioProcessor::connectRemotePeer(const String & host, int port, const String & username, const String & groupname, bool reciprocate)
+{
+    EndpointState * endpoint = findOrAddEndpoint(host, port);
 
+    RemotePeer * remote = doAddRemotePeerIfNecessary(endpoint, AOO_ID_NONE, username, groupname); // get new one
 
-                if (peer->autosizeBufferMode == AutoNetBufferModeAutoFull) {
-                    // possibly adjust net buffer down, if it has been longer than threshold since last drop
-                    double nowtime = Time::getMillisecondCounterHiRes();
-                    const float nodropsthresh = 10.0; // no drops in 10 seconds
-                    const float adjustlimit = 10; // don't adjust more often than once every 10 seconds
+    remote->recvAllow = !mMainRecvMute.get();
 
-                    if (peer->lastNetBufDecrTime > 0 && peer->buffertimeMs > peer->netBufAutoBaseline && !peer->latencyMatched) {
-                        double deltatime = (nowtime - peer->lastNetBufDecrTime) * 1e-3;
-                        double deltadroptime = (nowtime - peer->lastDroptime) * 1e-3;
-                        if (deltatime > adjustlimit) {
-                            //float droprate =  (peer->dataPacketsDropped - peer->lastDropCount) / deltatime;
-                            //if (droprate < dropratethresh) {
-                            if (deltadroptime > nodropsthresh) {
-                                float adjms = 1000.0f * currSamplesPerBlock / getSampleRate();
-                                peer->buffertimeMs -= adjms;
+    // special - use 0 
+    bool ret = remote->oursink->invite_source(endpoint, 0, endpoint_send) == 1;
+    
+    if (ret) {
+        DBG("Successfully invited remote peer at " <<  host << ":" << port << " - ourId " << remote->ourId);
+        remote->connected = true;
+        remote->invitedPeer = reciprocate;
+        //remote->recvActive = reciprocate;
+        if (!mMainSendMute.get()) {
+            remote->sendActive = true;
+            remote->oursource->start();
+            updateRemotePeerUserFormat(-1, remote);
+        }
 
-                                peer->buffertimeMs = std::max(peer->buffertimeMs, peer->netBufAutoBaseline);
+        sendRemotePeerInfoUpdate(-1, remote);
 
-                                peer->totalEstLatency = peer->smoothPingTime.xbar + 2*peer->buffertimeMs + (1e3*currSamplesPerBlock/getSampleRate());
-                                peer->oursink->set_buffersize(peer->buffertimeMs);
-                                peer->echosink->set_buffersize(peer->buffertimeMs);
-                                peer->latencysink->set_buffersize(peer->buffertimeMs);
-                                peer->latencyDirty = true;
+    } else {
+        DBG("Error inviting remote peer at " << host << ":" << port << " - ourId " << remote->ourId);
+    }
 
-                                peer->fillRatioSlow.reset();
-                                peer->fillRatio.reset();
+    return ret;
+}
 
-                                if (peer->hasRealLatency) {
-                                    peer->totalEstLatency = peer->totalLatency + (peer->buffertimeMs - peer->bufferTimeAtRealLatency);
-                                }
+bool SonobusAudioProcessor::disconnectRemotePeer(const String & host, int port, int32_t ourId)
+{
+    EndpointState * endpoint = findOrAddEndpoint(host, port);
+    bool ret = false;
 
-                                DBG("AUTO-Decreasing buffer time by " << adjms << " ms to " << (int) peer->buffertimeMs);
+    {
+        const ScopedReadLock sl (mCoreLock);        
+        
+        RemotePeer * remote = findRemotePeer(endpoint, ourId);
+        
+        if (remote) {
+            if (remote->oursink) {
+                DBG("uninviting all remote source " << remote->remoteSourceId);
+                ret = remote->oursink->uninvite_all();
+                //ret = remote->oursink->uninvite_source(endpoint, remote->remoteSourceId, endpoint_send) == 1;
+            }
+         
+            ungroupSharedSend(remote);
 
-                                peer->lastNetBufDecrTime = nowtime;
+            // if we auto-invited the other end's remote source, remove that as a dest sink
+            if (remote->oursource) {
+                DBG("removing all remote sink " << remote->remoteSinkId);
+                remote->oursource->remove_all();
+                //ret |= remote->oursource->remove_sink(endpoint, remote->remoteSinkId) == 1;
+            }
+            
+            remote->connected = false;
+            remote->recvActive = false;
+            remote->sendActive = false;
+        }
+    }
 
-                                sendRemotePeerInfoUpdate(-1, peer); // send to this peer
+    //doRemoveRemotePeerIfNecessary(endpoint, ourId);        
 
-                            }
+    
+    if (ret) {
+        DBG("Successfully disconnected remote peer " << ourId << " at " << host << ":" << port);
+    } else {
+        DBG("Error disconnecting remote peer " << ourId << " at " << host << ":" << port);
+    }
 
-                            //peer->lastNetBufDropCount = peer->dataPacketsDropped;
-                        }
-                    }
-                    else {
-                        peer->lastNetBufDecrTime = nowtime;
-                    }
+    return ret;
+}
 
-                }
+bool SonobusAudioProcessor::disconnectRemotePeer(int index)
+{
+    RemotePeer * remote = 0;
+    bool ret = false;
+    {
+        const ScopedReadLock sl (mCoreLock);
+        
+        if (index < mRemotePeers.size()) {
+            remote = mRemotePeers.getUnchecked(index);
+            if (remote->oursink) {
+                DBG("uninviting all remote source " << remote->remoteSourceId);
+                ret = remote->oursink->uninvite_all();
             }
 
+            ungroupSharedSend(remote);
 
-            break;
-        }
-        default:
-            break;
+            // if we auto-invited the other end's remote source, remove that as a dest sink
+            if (remote->oursource && remote->remoteSinkId >= 0) {
+                DBG("removing all remote sink " << remote->remoteSinkId);
+                remote->oursource->remove_all();
+                //ret |= remote->oursource->remove_sink(remote->endpoint, remote->remoteSinkId) == 1;
+            }
+            
+            remote->connected = false;
+            remote->recvActive = false;
+            remote->sendActive = false;
+            
+            //mRemotePeers.remove(index);
         }
     }
-    return 1;
+    
+    return ret;
 }
 
-int32_t SonobusAudioProcessor::handleServerEvents(const aoo_event ** events, int32_t n)
+bool SonobusAudioProcessor::getPatchMatrixValue(int srcindex, int destindex) const
 {
-    for (int i = 0; i < n; ++i){
-        switch (events[i]->type){
-            case AOONET_SERVER_USER_JOIN_EVENT:
-            {
-                aoonet_server_user_event *e = (aoonet_server_user_event *)events[i];
-                
-                DBG("Server - User joined: " << e->name);
-                
-                break;
-            }
-            case AOONET_SERVER_USER_LEAVE_EVENT:
-            {
-                aoonet_server_user_event *e = (aoonet_server_user_event *)events[i];
-                
-                DBG("Server - User left: " << e->name);
-                
-                
-                break;
-            }
-            case AOONET_SERVER_GROUP_JOIN_EVENT:
-            {
-                aoonet_server_group_event *e = (aoonet_server_group_event *)events[i];
-                
-                DBG("Server - Group Joined: " << e->group << "  by user: " << e->user);
-                
-                break;
-            }
-            case AOONET_SERVER_GROUP_LEAVE_EVENT:
-            {
-                aoonet_server_group_event *e = (aoonet_server_group_event *)events[i];
-                
-                DBG("Server - Group Left: " << e->group << "  by user: " << e->user);
-                
-                break;
-            }
-            case AOONET_SERVER_ERROR_EVENT:
-            {
-                aoonet_server_event *e = (aoonet_server_event *)events[i];
-                
-                DBG("Server error: " << String::fromUTF8(e->errormsg));
-                
-                break;
-            }
-            default:
-                DBG("Got unknown server event: " << events[i]->type);
-                break;
-        }
+    const ScopedReadLock sl (mCoreLock);
+    if (srcindex < 0 || destindex < 0 || srcindex >= mRemotePeers.size() || destindex >= mRemotePeers.size()) {
+        return false;
     }
-    return 1;
+
+    const ScopedLock rl (mRoutingLock);
+    return mSendSourceSlots[(size_t) mRemotePeers.getUnchecked(destindex)->slot].contains(mRemotePeers.getUnchecked(srcindex)->slot);
 }
 
-int32_t SonobusAudioProcessor::handleClientEvents(const aoo_event ** events, int32_t n)
+void SonobusAudioProcessor::setPatchMatrixValue(int srcindex, int destindex, bool value)
 {
-    for (int i = 0; i < n; ++i){
-        switch (events[i]->type){
-        case AOONET_CLIENT_CONNECT_EVENT:
-        {
-            aoonet_client_group_event *e = (aoonet_client_group_event *)events[i];
+    const ScopedReadLock sl (mCoreLock);
+    if (srcindex < 0 || destindex < 0 || srcindex >= mRemotePeers.size() || destindex >= mRemotePeers.size()) {
+        return;
+    }
 
-            if (e->result > 0){
-                DBG("Connected to server!");
-                mIsConnectedToServer = true;
-                mSessionConnectionStamp = Time::getMillisecondCounterHiRes();
-            } else {
-                DBG("Couldn't connect to server - " << String::fromUTF8(e->errormsg));
-                mIsConnectedToServer = false;
-                mSessionConnectionStamp = 0.0;
-            }
+    {
+        const ScopedLock rl (mRoutingLock);
+        auto & sources = mSendSourceSlots[(size_t) mRemotePeers.getUnchecked(destindex)->slot];
+        const int srcslot = mRemotePeers.getUnchecked(srcindex)->slot;
+        if (value == sources.contains(srcslot)) return;
 
-            clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientConnected, this, e->result > 0, String::fromUTF8(e->errormsg));
-            
-            break;
+        if (value) {
+            sources.addUsingDefaultSort(srcslot);
+        } else {
+            sources.removeFirstMatchingValue(srcslot);
         }
-        case AOONET_CLIENT_DISCONNECT_EVENT:
-        {
-            aoonet_client_group_event *e = (aoonet_client_group_event *)events[i];
-            if (e->result == 0){
-                DBG("Disconnected from server - " << String::fromUTF8(e->errormsg));
-            }
-
-            // don't remove all peers?
-            //removeAllRemotePeers();
-            
-            mIsConnectedToServer = false;
-            mSessionConnectionStamp = 0.0;
-
-            clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientDisconnected, this, e->result > 0, String::fromUTF8(e->errormsg));
+    }
 
-            break;
-        }
-        case AOONET_CLIENT_GROUP_JOIN_EVENT:
-        {
-            aoonet_client_group_event *e = (aoonet_client_group_event *)events[i];
-            if (e->result > 0){
-                DBG("Joined group - " << e->name);
-                const ScopedLock sl (mClientLock);        
-                mCurrentJoinedGroup = CharPointer_UTF8 (e->name);
+    mNeedsSendRegroup = true;
+    publishPeerSnapshot();
 
-                mSessionConnectionStamp = Time::getMillisecondCounterHiRes();
+    updateRemotePeerSendChannels(destindex, mRemotePeers.getUnchecked(destindex));
+}
 
+int SonobusAudioProcessor::acquirePeerSlot()
+{
+    const ScopedLock rl (mRoutingLock);
 
-            } else {
-                DBG("Couldn't join group " << e->name << " - " << String::fromUTF8(e->errormsg));
-            }
-            clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientGroupJoined, this, e->result > 0, CharPointer_UTF8 (e->name), String::fromUTF8(e->errormsg));
-            break;
-        }
-        case AOONET_CLIENT_GROUP_LEAVE_EVENT:
-        {
-            aoonet_client_group_event *e = (aoonet_client_group_event *)events[i];
-            if (e->result > 0){
+    auto it = std::find(mPeerSlotUsed.begin(), mPeerSlotUsed.end(), false);
+    const int slot = (int) (it - mPeerSlotUsed.begin());
+    if (it == mPeerSlotUsed.end()) {
+        mPeerSlotUsed.push_back(true);
+        mSendSourceSlots.emplace_back();
+        mMixNodeSourceSlots.emplace_back();
+    } else {
+        *it = true;
+    }
+    return slot;
+}
 
-                DBG("Group leave - " << e->name);
+void SonobusAudioProcessor::releasePeerSlot(int slot)
+{
+    const ScopedLock rl (mRoutingLock);
 
-                const ScopedLock sl (mClientLock);        
-                mCurrentJoinedGroup.clear();
+    if (slot < 0 || slot >= (int) mPeerSlotUsed.size()) return;
 
-                // assume they are all part of the group, XXX
-                removeAllRemotePeers();
+    // nothing may stay routed to or from it, the next peer in this slot starts clean
+    mPeerSlotUsed[(size_t) slot] = false;
+    mSendSourceSlots[(size_t) slot].clear();
+    mMixNodeSourceSlots[(size_t) slot].clear();
+    for (auto & sources : mSendSourceSlots) {
+        sources.removeFirstMatchingValue(slot);
+    }
+    for (auto & sources : mMixNodeSourceSlots) {
+        sources.removeFirstMatchingValue(slot);
+    }
+}
 
-                //aoo_node_remove_group(x->x_node, gensym(e->name));
-                
+bool SonobusAudioProcessor::removeAllRemotePeers()
+{
+    const ScopedReadLock sl (mCoreLock);
 
-            } else {
-                DBG("Couldn't leave group " << e->name << " - " << String::fromUTF8(e->errormsg));
-            }
+    OwnedArray<RemotePeer> removed;
 
-            clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientGroupLeft, this, e->result > 0, CharPointer_UTF8 (e->name), String::fromUTF8(e->errormsg));
+    for (int index = 0; index < mRemotePeers.size(); ++index) {  
+        auto remote = mRemotePeers.getUnchecked(index);
+        
+        commitCacheForPeer(remote);
 
-            break;
+        if (remote->connected) {
+            disconnectRemotePeer(index);
         }
-        case AOONET_CLIENT_GROUP_PUBLIC_ADD_EVENT:
-        {
-            aoonet_client_group_event *e = (aoonet_client_group_event *)events[i];
-            DBG("Public group add/changed - " << e->name << " count: " << e->result);
-            {
-                const ScopedLock sl (mPublicGroupsLock);
-                String group = CharPointer_UTF8 (e->name);
-                AooPublicGroupInfo & ginfo = mPublicGroupInfos[group];
-                ginfo.groupName = group;
-                ginfo.activeCount = e->result;
-                ginfo.timestamp = Time::getCurrentTime().toMilliseconds();
-            }
 
-            clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientPublicGroupModified, this, CharPointer_UTF8 (e->name), e->result,  String::fromUTF8(e->errormsg));
-            break;
-        }
-        case AOONET_CLIENT_GROUP_PUBLIC_DEL_EVENT:
-        {
-            aoonet_client_group_event *e = (aoonet_client_group_event *)events[i];
-            DBG("Public group deleted - " << e->name);
-            {
-                const ScopedLock sl (mPublicGroupsLock);
-                String group = CharPointer_UTF8 (e->name);
-                mPublicGroupInfos.erase(group);
-            }
+        removed.add(remote);
+    }
 
-            clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientPublicGroupDeleted, this, CharPointer_UTF8 (e->name), String::fromUTF8(e->errormsg));
-            break;
-        }
 
-        case AOONET_CLIENT_PEER_PREJOIN_EVENT:
-        {
-            aoonet_client_peer_event *e = (aoonet_client_peer_event *)events[i];
-            
-            if (e->result > 0){
-                DBG("Peer attempting to join group " <<  e->group << " - user " << e->user);
-                
-                clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientPeerPendingJoin, this, CharPointer_UTF8 (e->group), CharPointer_UTF8 (e->user));
-                
-            } else {
-                DBG("bug bad result on join event");
-            }
-                        
-            break;
-        }
-        case AOONET_CLIENT_PEER_JOIN_EVENT:
-        {
-            aoonet_client_peer_event *e = (aoonet_client_peer_event *)events[i];
+    {
+        const ScopedWriteLock slw (mCoreLock);
+        mRemotePeers.clearQuick(false); // not deleting objects here
+        publishPeerSnapshot();
+    }
+    
+    // reset matrix
+    {
+        const ScopedLock rl (mRoutingLock);
+        mSendSourceSlots.clear();
+        mMixNodeSourceSlots.clear();
+        mPeerSlotUsed.clear();
+    }
 
-            if (e->result > 0){
-                DBG("Peer joined group " <<  e->group << " - user " << e->user);
+    // they will be cleaned up when removed list goes out of scope
 
-                if (mAutoconnectGroupPeers) {
-                    connectRemotePeerRaw(e->address, CharPointer_UTF8 (e->user), CharPointer_UTF8 (e->group), !mMainRecvMute.get());
-                }
-                
-                //aoo_node_add_peer(x->x_node, gensym(e->group), gensym(e->user),
-                //                  (const struct sockaddr *)e->address, e->length);
+    return true;
+}
 
-                clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientPeerJoined, this, CharPointer_UTF8 (e->group), CharPointer_UTF8 (e->user));
-                
-            } else {
-                DBG("bug bad result on join event");
-            }
-            
 
-            break;
-        }
-        case AOONET_CLIENT_PEER_JOINFAIL_EVENT:
-        {
-            aoonet_client_peer_event *e = (aoonet_client_peer_event *)events[i];
-            
-            if (e->result > 0){
-                DBG("Peer failed to join group " <<  e->group << " - user " << e->user);
-                
-                clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientPeerJoinFailed, this, CharPointer_UTF8 (e->group), CharPointer_UTF8 (e->user));
-                
-            } else {
-                DBG("bug bad result on join event");
+bool SonobusAudioProcessor::removeRemotePeer(int index)
+{
+    RemotePeer * remote = 0;
+    bool ret = false;
+    {
+        const ScopedReadLock sl (mCoreLock);
+
+        if (index < mRemotePeers.size()) {            
+            remote = mRemotePeers.getUnchecked(index);
+
+            commitCacheForPeer(remote);
+            
+            if (remote->connected) {
+                disconnectRemotePeer(index);
             }
                         
-            break;
+            ungroupSharedSend(remote);
+            
+            std::unique_ptr<RemotePeer> removed(remote);
+
+            {
+                const ScopedWriteLock slw (mCoreLock);
+                mRemotePeers.remove(index, false); // not deleting in scoped write lock
+                publishPeerSnapshot();
+            }
+
+            releasePeerSlot(remote->slot);
+
         }
-        case AOONET_CLIENT_PEER_LEAVE_EVENT:
-        {
-            aoonet_client_peer_event *e = (aoonet_client_peer_event *)events[i];
+    }
+    
+    return ret;
+}
 
-            if (e->result > 0){
 
-                DBG("Peer leave group " <<  e->group << " - user " << e->user);
+int SonobusAudioProcessor::getNumberRemotePeers() const
+{
+    return mRemotePeers.size();
+}
 
-                EndpointState * endpoint = findOrAddRawEndpoint(e->address);
-                if (endpoint) {
-                    
-                    removeAllRemotePeersWithEndpoint(endpoint);
-                }
-                
-                //aoo_node_remove_peer(x->x_node, gensym(e->group), gensym(e->user));
-                clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientPeerLeft, this, CharPointer_UTF8 (e->group), CharPointer_UTF8 (e->user));
+void SonobusAudioProcessor::setRemotePeerLevelGain(int index, float levelgain)
+{
+    const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size()) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        remote->gain = levelgain;
+    }
+}
 
-            } else {
-                DBG("bug bad result on leave event");
-            }
-            break;
-        }
-        case AOONET_CLIENT_ERROR_EVENT:
-        {
-            aoonet_client_event *e = (aoonet_client_event *)events[i];
-            DBG("client error: " << String::fromUTF8(e->errormsg));
-            clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientError, this, String::fromUTF8(e->errormsg));
-            break;
-        }
-        default:
-            DBG("Got unknown client event: " << events[i]->type);
-            break;
-        }
+float SonobusAudioProcessor::getRemotePeerLevelGain(int index) const
+{
+    float levelgain = 0.0f;
+
+    const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size()) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        levelgain = remote->gain;
     }
-    return 1;
+    return levelgain;
 }
 
 
-int SonobusAudioProcessor::connectRemotePeerRaw(void * sockaddr, const String & username, const String & groupname, bool reciprocate)
+void SonobusAudioProcessor::setRemotePeerChannelGain(int index, int changroup, float levelgain)
 {
-    EndpointState * endpoint = findOrAddRawEndpoint(sockaddr);
-    
-    if (!endpoint) {
-        DBG("Error getting endpoint from raw address");
-        return 0;
+    const ScopedReadLock sl (mCoreLock);        
+    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        remote->chanGroups[changroup].params.gain = levelgain;
     }
-    
-    RemotePeer * remote = doAddRemotePeerIfNecessary(endpoint, AOO_ID_NONE, username, groupname); // get new one
+}
 
-    remote->recvAllow = !mMainRecvMute.get();
-    
-    // special - use 0 
-    bool ret = remote->oursink->invite_source(endpoint, 0, endpoint_send) == 1;
+float SonobusAudioProcessor::getRemotePeerChannelGain(int index, int changroup) const
+{
+    float levelgain = 0.0f;
     
-    if (ret) {
-        DBG("Successfully invited remote peer at " << endpoint->ipaddr << ":" << endpoint->port << " - ourId " << remote->ourId);
-        remote->connected = true;
-        remote->invitedPeer = reciprocate;
-        //remote->recvActive = reciprocate;
-        if (!mMainSendMute.get()) {
-            remote->sendActive = true;
-            remote->oursource->start();
-            updateRemotePeerUserFormat(-1, remote);
-            sendRemotePeerInfoUpdate(-1, remote);
-        }
-        else {
-            remote->sendActive = false;
-            remote->oursource->stop();
-        }
-        
-    } else {
-        DBG("Error inviting remote peer at " << endpoint->ipaddr << ":" << endpoint->port << " - ourId " << remote->ourId);
+    const ScopedReadLock sl (mCoreLock);        
+    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        levelgain = remote->chanGroups[changroup].params.gain;
     }
+    return levelgain;
+}
 
-    return ret;    
+void SonobusAudioProcessor::setRemotePeerChannelReverbSend(int index, int changroup, float rgain)
+{
+    const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        remote->chanGroups[changroup].params.monReverbSend = rgain;
+    }
 }
 
-int SonobusAudioProcessor::connectRemotePeer(const String & host, int port, const String & username, const String & groupname, bool reciprocate)
+float SonobusAudioProcessor::getRemotePeerChannelReverbSend(int index, int changroup)
 {
-    EndpointState * endpoint = findOrAddEndpoint(host, port);
+    float revsend = 0.0f;
 
-    RemotePeer * remote = doAddRemotePeerIfNecessary(endpoint, AOO_ID_NONE, username, groupname); // get new one
+    const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        revsend = remote->chanGroups[changroup].params.monReverbSend;
+    }
+    return revsend;
+}
 
-    remote->recvAllow = !mMainRecvMute.get();
+void SonobusAudioProcessor::setRemotePeerPolarityInvert(int index, int changroup, bool invert)
+{
+    const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        remote->chanGroups[changroup].params.invertPolarity = invert;
+    }
+}
 
-    // special - use 0 
-    bool ret = remote->oursink->invite_source(endpoint, 0, endpoint_send) == 1;
-    
-    if (ret) {
-        DBG("Successfully invited remote peer at " <<  host << ":" << port << " - ourId " << remote->ourId);
-        remote->connected = true;
-        remote->invitedPeer = reciprocate;
-        //remote->recvActive = reciprocate;
-        if (!mMainSendMute.get()) {
-            remote->sendActive = true;
-            remote->oursource->start();
-            updateRemotePeerUserFormat(-1, remote);
+bool SonobusAudioProcessor::getRemotePeerPolarityInvert(int index, int changroup)
+{
+    const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        return remote->chanGroups[changroup].params.invertPolarity;
+    }
+    return false;
+}
+
+void SonobusAudioProcessor::setRemotePeerChannelMuted(int index, int changroup, bool muted)
+{
+    const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        remote->chanGroups[changroup].params.muted = muted;
+        updateRemotePeerSubscription(remote);
+    }
+}
+
+bool SonobusAudioProcessor::getRemotePeerChannelMuted(int index, int changroup) const
+{
+    const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        return remote->chanGroups[changroup].params.muted;
+    }
+    return false;
+}
+
+void SonobusAudioProcessor::setRemotePeerChannelSoloed(int index, int changroup, bool soloed)
+{
+    const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        remote->chanGroups[changroup].params.soloed = soloed;
+    }
+}
+
+bool SonobusAudioProcessor::getRemotePeerChannelSoloed(int index, int changroup) const
+{
+    const ScopedReadLock sl (mCoreLock);
+    if (index >= 0 && index < mRemotePeers.size()) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        if (changroup < 0) {
+            // check all groups for any soloed
+            bool anysoloed = false;
+            for (int i=0; i < remote->numChanGroups && i < MAX_CHANGROUPS; ++i) {
+                if (remote->chanGroups[i].params.soloed) {
+                    anysoloed = true;
+                    break;
+                }
+            }
+            return anysoloed;
+        }
+        else if (changroup < MAX_CHANGROUPS) {
+            return remote->chanGroups[changroup].params.soloed;
         }
+    }
+    return false;
+}
 
-        sendRemotePeerInfoUpdate(-1, remote);
 
-    } else {
-        DBG("Error inviting remote peer at " << host << ":" << port << " - ourId " << remote->ourId);
+String SonobusAudioProcessor::getRemotePeerChannelGroupName(int index, int changroup) const
+{
+    const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        return remote->chanGroups[changroup].params.name;
+    }
+    return "";
+}
+
+void SonobusAudioProcessor::setRemotePeerChannelGroupName(int index, int changroup, const String & name)
+{
+    const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        remote->chanGroups[changroup].params.name = name;
+        remote->modifiedChanGroups = true;
+        remote->modifiedMultiChanGroups = true;
+    }
+}
+
+void SonobusAudioProcessor::setRemotePeerChannelGroupCount(int index, int count)
+{
+    const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size()) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        int newcnt = std::max(0, std::min(count, MAX_CHANGROUPS-1));
+        remote->numChanGroups = newcnt;
+        remote->modifiedChanGroups = true;
+        remote->modifiedMultiChanGroups = true;
+    }
+}
+
+
+void SonobusAudioProcessor::setRemotePeerUserName(int index, const String & name)
+{
+    const ScopedReadLock sl (mCoreLock);        
+    if (index < mRemotePeers.size()) {
+        auto * remote = mRemotePeers.getUnchecked(index);
+        remote->userName = name;
     }
-
-    return ret;
 }
 
-bool SonobusAudioProcessor::disconnectRemotePeer(const String & host, int port, int32_t ourId)
+String SonobusAudioProcessor::getRemotePeerUserName(int index) const
 {
-    EndpointState * endpoint = findOrAddEndpoint(host, port);
-    bool ret = false;
+    const ScopedReadLock sl (mCoreLock);        
+    if (index < mRemotePeers.size()) {
+        auto * remote = mRemotePeers.getUnchecked(index);
+        return remote->userName;
+    }
+    return "";
+}
 
-    {
-        const ScopedReadLock sl (mCoreLock);        
-        
-        RemotePeer * remote = findRemotePeer(endpoint, ourId);
-        
-        if (remote) {
-            if (remote->oursink) {
-                DBG("uninviting all remote source " << remote->remoteSourceId);
-                ret = remote->oursink->uninvite_all();
-                //ret = remote->oursink->uninvite_source(endpoint, remote->remoteSourceId, endpoint_send) == 1;
+void SonobusAudioProcessor::setRemotePeerChannelPan(int index, int changroup, int chan, float pan)
+{
+    const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size()) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        if (changroup < MAX_CHANGROUPS) {
+            if (remote->chanGroups[changroup].params.numChannels == 2 && chan < 2) {
+                remote->chanGroups[changroup].params.panStereo[chan] = pan;
             }
-         
-            // if we auto-invited the other end's remote source, remove that as a dest sink
-            if (remote->oursource) {
-                DBG("removing all remote sink " << remote->remoteSinkId);
-                remote->oursource->remove_all();
-                //ret |= remote->oursource->remove_sink(endpoint, remote->remoteSinkId) == 1;
+            else if (chan < MAX_CHANNELS){
+                remote->chanGroups[changroup].params.pan[chan] = pan;
             }
-            
-            remote->connected = false;
-            remote->recvActive = false;
-            remote->sendActive = false;
+            remote->modifiedChanGroups = true;
+            remote->modifiedMultiChanGroups = true;
         }
     }
-
-    //doRemoveRemotePeerIfNecessary(endpoint, ourId);        
-
-    
-    if (ret) {
-        DBG("Successfully disconnected remote peer " << ourId << " at " << host << ":" << port);
-    } else {
-        DBG("Error disconnecting remote peer " << ourId << " at " << host << ":" << port);
-    }
-
-    return ret;
 }
 
-bool SonobusAudioProcessor::disconnectRemotePeer(int index)
+float SonobusAudioProcessor::getRemotePeerChannelPan(int index, int changroup, int chan) const
 {
-    RemotePeer * remote = 0;
-    bool ret = false;
-    {
-        const ScopedReadLock sl (mCoreLock);
-        
-        if (index < mRemotePeers.size()) {
-            remote = mRemotePeers.getUnchecked(index);
-            if (remote->oursink) {
-                DBG("uninviting all remote source " << remote->remoteSourceId);
-                ret = remote->oursink->uninvite_all();
-            }
+    float pan = 0.0f;
+    
+    const ScopedReadLock sl (mCoreLock);        
+    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
 
-            // if we auto-invited the other end's remote source, remove that as a dest sink
-            if (remote->oursource && remote->remoteSinkId >= 0) {
-                DBG("removing all remote sink " << remote->remoteSinkId);
-                remote->oursource->remove_all();
-                //ret |= remote->oursource->remove_sink(remote->endpoint, remote->remoteSinkId) == 1;
+        if (chan >= 0 && chan < MAX_CHANNELS) {
+            if (remote->chanGroups[changroup].params.numChannels == 2 && chan < 2) {
+                pan = remote->chanGroups[changroup].params.panStereo[chan];
+            } else {
+                pan = remote->chanGroups[changroup].params.pan[chan];
             }
-            
-            remote->connected = false;
-            remote->recvActive = false;
-            remote->sendActive = false;
-            
-            //mRemotePeers.remove(index);
         }
     }
-    
-    return ret;
+    return pan;
 }
 
-bool SonobusAudioProcessor::getPatchMatrixValue(int srcindex, int destindex) const
+void SonobusAudioProcessor::setRemotePeerChannelGroupStartAndCount(int index, int changroup, int start, int count)
 {
-    if (srcindex < MAX_PEERS && destindex < MAX_PEERS) {
-        return mRemoteSendMatrix[srcindex][destindex];
+    const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        remote->chanGroups[changroup].params.chanStartIndex = start;
+        remote->chanGroups[changroup].params.numChannels = std::max(1, std::min(count, MAX_CHANNELS));
+        remote->modifiedChanGroups = true;
+        remote->modifiedMultiChanGroups = true;
     }
-    return false;
 }
 
-void SonobusAudioProcessor::setPatchMatrixValue(int srcindex, int destindex, bool value)
+bool SonobusAudioProcessor::getRemotePeerChannelGroupStartAndCount(int index, int changroup, int & retstart, int & retcount)
 {
+    const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
 
-    if (srcindex < MAX_PEERS && destindex < MAX_PEERS) {
-        mRemoteSendMatrix[srcindex][destindex] = value;
-
-        const ScopedReadLock sl (mCoreLock);        
-        if (destindex < mRemotePeers.size() && destindex >= 0) {
-            auto * peer = mRemotePeers.getUnchecked(destindex);
-
-            updateRemotePeerSendChannels(destindex, peer);
-            
-        }
+        retstart = remote->chanGroups[changroup].params.chanStartIndex;
+        retcount = remote->chanGroups[changroup].params.numChannels;
+        return true;
     }
+    return false;
 }
 
+void SonobusAudioProcessor::setRemotePeerChannelGroupDestStartAndCount(int index, int changroup, int start, int count)
+{
+    const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        remote->chanGroups[changroup].params.panDestStartIndex = start;
+        remote->chanGroups[changroup].params.panDestChannels = std::max(1, std::min(count, MAX_CHANNELS));
+        remote->modifiedChanGroups = true;
+        remote->modifiedMultiChanGroups = true;
+    }
+}
 
-void SonobusAudioProcessor::adjustRemoteSendMatrix(int index, bool removed)
+bool SonobusAudioProcessor::getRemotePeerChannelGroupDestStartAndCount(int index, int changroup, int & retstart, int & retcount)
 {
-    if (removed) {
-        // adjust mRemoteSendMatrix
-        // shift rows
-        for (int i=index+1; i < mRemotePeers.size(); ++i) {
-            // shift values up 1 from index+1 on
-            for (int j=0; j < mRemotePeers.size(); ++j) {
-                mRemoteSendMatrix[i-1][j] = mRemoteSendMatrix[i][j];         
-            }                
-        }
-        // shift cols (one less row
-        for (int i=0; i < mRemotePeers.size() - 1; ++i) {
-            // shift values back 1 from index+1 on
-            for (int j=index+1; j < mRemotePeers.size(); ++j) {
-                mRemoteSendMatrix[i][j-1] = mRemoteSendMatrix[i][j];                    
-            }                
-        }
+    const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+
+        retstart = remote->chanGroups[changroup].params.panDestStartIndex;
+        retcount = remote->chanGroups[changroup].params.panDestChannels;
+        return true;
     }
-    else {
-        // adjust mRemoteSendMatrix to insert a new row
-        // shift rows
-        for (int i=mRemotePeers.size(); i > index; --i) {
-            // shift values down 1 from index on
-            for (int j=0; j < mRemotePeers.size(); ++j) {
-                mRemoteSendMatrix[i][j] = mRemoteSendMatrix[i-1][j];         
-            }                
-        }
-        // shift cols (one more row)
-        for (int i=0; i < mRemotePeers.size() + 1; ++i) {
-            // shift values forward 1 from index+1 on
-            for (int j=mRemotePeers.size(); j > index; --j) {
-                mRemoteSendMatrix[i][j] = mRemoteSendMatrix[i][j-1];                    
-            }            
-        }                
-        // now put in default crossroutings
-        for (int i=0; i < mRemotePeers.size() + 1; ++i) {
-            mRemoteSendMatrix[i][index] = false;
-            mRemoteSendMatrix[index][i] = false;
-        }                
+    return false;
+}
 
+void SonobusAudioProcessor::setRemotePeerChannelGroupSendMainMix(int index, int changroup, bool mainmix)
+{
+    const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        remote->chanGroups[changroup].params.sendMainMix = mainmix;
     }
 }
 
-bool SonobusAudioProcessor::removeAllRemotePeers()
+bool SonobusAudioProcessor::getRemotePeerChannelGroupSendMainMix(int index, int changroup)
 {
     const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
 
-    OwnedArray<RemotePeer> removed;
+        return remote->chanGroups[changroup].params.sendMainMix;
+    }
+    return 0;
+}
 
-    for (int index = 0; index < mRemotePeers.size(); ++index) {  
-        auto remote = mRemotePeers.getUnchecked(index);
-        
-        commitCacheForPeer(remote);
 
-        if (remote->connected) {
-            disconnectRemotePeer(index);
+bool SonobusAudioProcessor::insertRemotePeerChannelGroup(int index, int atgroup, int chstart, int chcount)
+{
+    const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size() && atgroup >= 0 && atgroup < MAX_CHANGROUPS) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        // push any existing ones down
+
+        for (auto i = MAX_CHANGROUPS-1; i > atgroup; --i) {
+            remote->chanGroups[i].copyParametersFrom(remote->chanGroups[i-1]);
+            //mInputChannelGroups[i].chanStartIndex += chcount;
+            //mInputChannelGroups[i-1].numChannels = std::max(1, std::min(count, MAX_CHANNELS));
         }
+        remote->chanGroups[atgroup].params.chanStartIndex = chstart;
+        remote->chanGroups[atgroup].params.numChannels = std::max(1, std::min(chcount, MAX_CHANNELS));
+        remote->chanGroups[atgroup].params.panDestStartIndex = 0;
+        remote->chanGroups[atgroup].params.panDestChannels = std::max(1, std::min(2, getTotalNumOutputChannels()));
 
-        removed.add(remote);
+        remote->modifiedChanGroups = true;
+        remote->modifiedMultiChanGroups = true;
+        // todo some defaults
     }
 
+    return false;
+}
 
-    {
-        const ScopedWriteLock slw (mCoreLock);
-        mRemotePeers.clearQuick(false); // not deleting objects here
-    }
-    
-    // reset matrix
-    for (int i=0; i < MAX_PEERS; ++i) {
-        for (int j=0; j < MAX_PEERS; ++j) {
-            mRemoteSendMatrix[i][j] = false;
+bool SonobusAudioProcessor::removeRemotePeerChannelGroup(int index, int atgroup)
+{
+    const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size() && atgroup >= 0 && atgroup < MAX_CHANGROUPS) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        // move any existing ones after up
+
+        for (auto i = atgroup + 1; i < MAX_CHANGROUPS; ++i) {
+            remote->chanGroups[i-1].copyParametersFrom(remote->chanGroups[i]);
+            //mInputChannelGroups[i].chanStartIndex += chcount;
+            //mInputChannelGroups[i-1].numChannels = std::max(1, std::min(count, MAX_CHANNELS));
         }
+        remote->modifiedChanGroups = true;
+        remote->modifiedMultiChanGroups = true;
     }
 
-    // they will be cleaned up when removed list goes out of scope
-
-    return true;
+    return false;
 }
 
-
-bool SonobusAudioProcessor::removeRemotePeer(int index)
+bool SonobusAudioProcessor::copyRemotePeerChannelGroup(int index, int fromgroup, int togroup)
 {
-    RemotePeer * remote = 0;
-    bool ret = false;
-    {
-        const ScopedReadLock sl (mCoreLock);
+    const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size() && fromgroup < MAX_CHANGROUPS && togroup < MAX_CHANGROUPS) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
 
-        if (index < mRemotePeers.size()) {            
-            remote = mRemotePeers.getUnchecked(index);
+        remote->chanGroups[togroup].copyParametersFrom(remote->chanGroups[fromgroup]);
+        remote->modifiedChanGroups = true;
+        remote->modifiedMultiChanGroups = true;
+    }
+    return false;
+}
 
-            commitCacheForPeer(remote);
-            
-            if (remote->connected) {
-                disconnectRemotePeer(index);
-            }
-                        
-            adjustRemoteSendMatrix(index, true);
-            
-            std::unique_ptr<RemotePeer> removed(remote);
 
-            {
-                const ScopedWriteLock slw (mCoreLock);
-                mRemotePeers.remove(index, false); // not deleting in scoped write lock
-            }
+int SonobusAudioProcessor::getRemotePeerRecvChannelCount(int index) const
+{
+    int ret = 0;
+    const ScopedReadLock sl (mCoreLock);        
+    if (index < mRemotePeers.size()) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        ret = remote->recvChannels;
+    }
+    return ret;
+}
 
-        }
+int SonobusAudioProcessor::getRemotePeerChannelGroupCount(int index) const
+{
+    int ret = 0;
+    const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size()) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        ret = remote->numChanGroups;
     }
-    
     return ret;
 }
 
+bool SonobusAudioProcessor::getRemotePeerViewExpanded(int index) const
+{
+    bool ret = false;
+    const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size()) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        ret = remote->viewExpanded;
+    }
+    return ret;
+}
 
-int SonobusAudioProcessor::getNumberRemotePeers() const
+void SonobusAudioProcessor::setRemotePeerViewExpanded(int index, bool expanded)
 {
-    return mRemotePeers.size();
+    const ScopedReadLock sl (mCoreLock);
+    // could be -1 as index meaning all remote peers
+    for (int i=0; i < mRemotePeers.size(); ++i) {
+        if (index < 0 || index == i) {
+            RemotePeer * remote = mRemotePeers.getUnchecked(i);
+            remote->viewExpanded = expanded;
+        }
+    }
 }
 
-void SonobusAudioProcessor::setRemotePeerLevelGain(int index, float levelgain)
+bool SonobusAudioProcessor::getLayoutFormatChangedForRemotePeer(int index) const
 {
+    bool ret = false;
     const ScopedReadLock sl (mCoreLock);
     if (index < mRemotePeers.size()) {
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        remote->gain = levelgain;
+        ret = remote->modifiedChanGroups;
     }
+    return ret;
 }
 
-float SonobusAudioProcessor::getRemotePeerLevelGain(int index) const
+void SonobusAudioProcessor::restoreLayoutFormatForRemotePeer(int index)
 {
-    float levelgain = 0.0f;
-
     const ScopedReadLock sl (mCoreLock);
     if (index < mRemotePeers.size()) {
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        levelgain = remote->gain;
+        restoreLayoutFormatForPeer(remote, true);
     }
-    return levelgain;
 }
 
 
-void SonobusAudioProcessor::setRemotePeerChannelGain(int index, int changroup, float levelgain)
+int SonobusAudioProcessor::getRemotePeerNominalSendChannelCount(int index) const
 {
+    int ret = 0;
     const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
+    if (index < mRemotePeers.size()) {
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        remote->chanGroups[changroup].params.gain = levelgain;
+        ret = remote->nominalSendChannels;
     }
+    return ret;    
 }
 
-float SonobusAudioProcessor::getRemotePeerChannelGain(int index, int changroup) const
+void SonobusAudioProcessor::setRemotePeerNominalSendChannelCount(int index, int numchans)
 {
-    float levelgain = 0.0f;
-    
     const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        levelgain = remote->chanGroups[changroup].params.gain;
+    // could be -1 as index meaning all remote peers
+    for (int i=0; i < mRemotePeers.size(); ++i) {
+        if (index < 0 || index == i) {
+            RemotePeer * remote = mRemotePeers.getUnchecked(i);
+            remote->nominalSendChannels = numchans;
+            updateRemotePeerSendChannels(i, remote);
+        }
     }
-    return levelgain;
 }
 
-void SonobusAudioProcessor::setRemotePeerChannelReverbSend(int index, int changroup, float rgain)
+int SonobusAudioProcessor::getRemotePeerActualSendChannelCount(int index) const
 {
+    int ret = 0;
     const ScopedReadLock sl (mCoreLock);
-    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
+    if (index < mRemotePeers.size()) {
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        remote->chanGroups[changroup].params.monReverbSend = rgain;
+        ret = remote->sendChannels;
     }
+    return ret;
 }
 
-float SonobusAudioProcessor::getRemotePeerChannelReverbSend(int index, int changroup)
-{
-    float revsend = 0.0f;
-
-    const ScopedReadLock sl (mCoreLock);
-    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        revsend = remote->chanGroups[changroup].params.monReverbSend;
-    }
-    return revsend;
-}
 
-void SonobusAudioProcessor::setRemotePeerPolarityInvert(int index, int changroup, bool invert)
+void SonobusAudioProcessor::updateDynamicResampling()
 {
     const ScopedReadLock sl (mCoreLock);
-    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        remote->chanGroups[changroup].params.invertPolarity = invert;
+    bool newval = mDynamicResampling.get();
+    for (int i=0; i < mRemotePeers.size(); ++i) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(i);
+        remote->oursink->set_dynamic_resampling(newval ? 1 : 0);
+        remote->oursource->set_dynamic_resampling(newval ? 1 : 0);
     }
 }
 
-bool SonobusAudioProcessor::getRemotePeerPolarityInvert(int index, int changroup)
+void SonobusAudioProcessor::setResampleQuality(int quality)
 {
+    mResampleQuality = jlimit((int)AOO_RESAMPLE_LINEAR, (int)AOO_RESAMPLE_SINC_HIGH, quality);
+
     const ScopedReadLock sl (mCoreLock);
-    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        return remote->chanGroups[changroup].params.invertPolarity;
+    for (int i=0; i < mRemotePeers.size(); ++i) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(i);
+        remote->oursink->set_resample_quality(mResampleQuality.load());
     }
-    return false;
 }
 
-void SonobusAudioProcessor::setRemotePeerChannelMuted(int index, int changroup, bool muted)
+void SonobusAudioProcessor::setTimeStretch(bool flag)
 {
+    mTimeStretch = flag;
+
     const ScopedReadLock sl (mCoreLock);
-    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        remote->chanGroups[changroup].params.muted = muted;
+    for (auto * remote : mRemotePeers) {
+        remote->oursink->set_time_stretch(flag ? 1 : 0);
     }
 }
 
-bool SonobusAudioProcessor::getRemotePeerChannelMuted(int index, int changroup) const
+void SonobusAudioProcessor::setProcessQuantum(int samples)
 {
-    const ScopedReadLock sl (mCoreLock);
-    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        return remote->chanGroups[changroup].params.muted;
-    }
-    return false;
+    // a power of two, so it divides the usual host block sizes evenly
+    mProcessQuantum = samples <= 0 ? 0 : (int) nextPowerOfTwo(jlimit(16, 2048, samples));
 }
 
-void SonobusAudioProcessor::setRemotePeerChannelSoloed(int index, int changroup, bool soloed)
+
+
+
+int SonobusAudioProcessor::getRemotePeerOverrideSendChannelCount(int index) const
 {
-    const ScopedReadLock sl (mCoreLock);
-    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
+    int ret = 0;
+    const ScopedReadLock sl (mCoreLock);        
+    if (index < mRemotePeers.size()) {
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        remote->chanGroups[changroup].params.soloed = soloed;
+        ret = remote->sendChannelsOverride;
     }
+    return ret;    
 }
 
-bool SonobusAudioProcessor::getRemotePeerChannelSoloed(int index, int changroup) const
+
+
+void SonobusAudioProcessor::setRemotePeerOverrideSendChannelCount(int index, int numchans)
 {
-    const ScopedReadLock sl (mCoreLock);
-    if (index >= 0 && index < mRemotePeers.size()) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        if (changroup < 0) {
-            // check all groups for any soloed
-            bool anysoloed = false;
-            for (int i=0; i < remote->numChanGroups && i < MAX_CHANGROUPS; ++i) {
-                if (remote->chanGroups[i].params.soloed) {
-                    anysoloed = true;
-                    break;
-                }
-            }
-            return anysoloed;
-        }
-        else if (changroup < MAX_CHANGROUPS) {
-            return remote->chanGroups[changroup].params.soloed;
+    const ScopedReadLock sl (mCoreLock);        
+    // could be -1 as index meaning all remote peers
+    for (int i=0; i < mRemotePeers.size(); ++i) {
+        if (index < 0 || index == i) {
+            RemotePeer * remote = mRemotePeers.getUnchecked(i);
+            remote->sendChannelsOverride = numchans;
+            
+            updateRemotePeerSendChannels(i, remote);
+            
         }
     }
-    return false;
 }
 
+void SonobusAudioProcessor::updateRemotePeerSendChannels(int index, RemotePeer * remote) {
+    // this is called while the corereadlock is already held
+    int newchancnt = remote->sendChannels;
 
-String SonobusAudioProcessor::getRemotePeerChannelGroupName(int index, int changroup) const
-{
-    const ScopedReadLock sl (mCoreLock);
-    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        return remote->chanGroups[changroup].params.name;
+    if (remote->sendChannelsOverride < 0) {
+        int totinchans = 0;
+        for (int cgi=0; cgi < mInputChannelGroupCount && cgi < MAX_CHANGROUPS ; ++cgi) {
+            totinchans += mInputChannelGroups[cgi].params.numChannels;
+        }
+        // met and file
+        if (mSendMet.get()) {
+            totinchans += 1;
+        }
+        if (mSendPlaybackAudio.get()) {
+            totinchans += mFilePlaybackChannelGroup.params.numChannels;
+        }
+
+        newchancnt = isAnythingRoutedToPeer(index) ? getMainBusNumOutputChannels() :  remote->nominalSendChannels <= 0 ? totinchans : remote->nominalSendChannels;
     }
-    return "";
-}
+    else {
+        newchancnt = jmin(getMainBusNumOutputChannels(), remote->sendChannelsOverride);
+    }
+    
+    if (remote->sendChannels != newchancnt) {
+        ungroupSharedSend(remote);
+        remote->sendChannels = newchancnt;
+        DBG("Peer " << index << "  has new sendChannel count: " << remote->sendChannels);
+        if (remote->oursource) {
+            // another layout, they subscribe again once they see it
+            remote->subscribedChannels = -1;
+            setupRemotePeerOurSource(remote);
+            //setupSourceUserFormat(remote, remote->oursource.get());
 
-void SonobusAudioProcessor::setRemotePeerChannelGroupName(int index, int changroup, const String & name)
-{
-    const ScopedReadLock sl (mCoreLock);
-    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        remote->chanGroups[changroup].params.name = name;
-        remote->modifiedChanGroups = true;
-        remote->modifiedMultiChanGroups = true;
+            updateRemotePeerUserFormat(index);
+        }
     }
 }
 
-void SonobusAudioProcessor::setRemotePeerChannelGroupCount(int index, int count)
+void SonobusAudioProcessor::changeListenerCallback (ChangeBroadcaster* source)
 {
-    const ScopedReadLock sl (mCoreLock);
-    if (index < mRemotePeers.size()) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        int newcnt = std::max(0, std::min(count, MAX_CHANGROUPS-1));
-        remote->numChanGroups = newcnt;
-        remote->modifiedChanGroups = true;
-        remote->modifiedMultiChanGroups = true;
+    if (source == &mTransportSource) {
+        if (!mTransportSource.isPlaying() && mTransportSource.getCurrentPosition() >= mTransportSource.getLengthInSeconds()) {
+            // at end, return to start
+            mTransportSource.setPosition(0.0);
+        }
+
+        if (mPendingPlaybackCacheSwap && !mTransportSource.isPlaying()) {
+            swapToCachedPlayback();
+        }
+
+        // started, stopped, a stream got ready or a peer's support changed
+        updateFileStreamSending();
+
+        // the ones playing their own copy of it follow right away
+        mBackingTrackSyncNow = true;
+        notifyEventThread();
+
+#if 0
+        if (mSendChannels.get() == 0) {
+            if (mTransportSource.isPlaying() && mSendPlaybackAudio.get()) {
+                // override sending
+                int srcchans = mCurrentAudioFileSource ? mCurrentAudioFileSource->getAudioFormatReader()->numChannels : 2;
+                setRemotePeerOverrideSendChannelCount(-1, jmax(getMainBusNumInputChannels(), srcchans));
+            }
+            else if (!mTransportSource.isPlaying()) {
+                // remove override
+                setRemotePeerOverrideSendChannelCount(-1, -1);
+            }
+        }
+#endif
     }
 }
 
-
-void SonobusAudioProcessor::setRemotePeerUserName(int index, const String & name)
+void SonobusAudioProcessor::setRemotePeerBufferTime(int index, float bufferMs)
 {
     const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size()) {
-        auto * remote = mRemotePeers.getUnchecked(index);
-        remote->userName = name;
+    if (index >= 0 && index < mRemotePeers.size()) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        remote->buffertimeMs = bufferMs;
+        remote->padBufferTimeMs = 0.0f; // all of it theirs now, ensemble alignment pads it again
+        updateRemotePeerEstLatency(remote);
+        remote->oursink->set_buffersize(remote->buffertimeMs); // ms
+        if (remote->latencyTestReady) {
+            remote->echosink->set_buffersize(remote->buffertimeMs);
+            remote->latencysink->set_buffersize(remote->buffertimeMs);
+        }
+        remote->fillRatioSlow.reset();
+        remote->fillRatio.reset();
+        remote->netBufAutoBaseline = (1e3*currSamplesPerBlock/getSampleRate()); // at least a process block
+        remote->latencyDirty = true;
+        remote->autoNetbufInitCompleted = false;
+        remote->lastDroptime = Time::getMillisecondCounterHiRes();
+        remote->resetSafetyMuted = bufferMs == 0.0f;
+        remote->latencyMatched = false;
+
+        //if (remote->autosizeBufferMode == AutoNetBufferModeOff) {
+        // clear drop count
+        remote->dataPacketsResent = 0;
+        remote->dataPacketsDropped = 0;
+        remote->resetDroptime = remote->lastDroptime;
+        remote->fastDropRate.resetInitVal(0.0f);
+        remote->lastDropCount = 0;
+        //}
+
+        sendRemotePeerInfoUpdate(index);
     }
 }
 
-String SonobusAudioProcessor::getRemotePeerUserName(int index) const
+float SonobusAudioProcessor::getRemotePeerBufferTime(int index) const
 {
+    float buftimeMs = 30.0f;
+    
     const ScopedReadLock sl (mCoreLock);        
     if (index < mRemotePeers.size()) {
-        auto * remote = mRemotePeers.getUnchecked(index);
-        return remote->userName;
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        buftimeMs = remote->buffertimeMs;
+        // reflect actual truth
+        buftimeMs = jmax((double)buftimeMs, 1000.0f * currSamplesPerBlock / getSampleRate());
     }
-    return "";
+    return buftimeMs;    
 }
 
-void SonobusAudioProcessor::setRemotePeerChannelPan(int index, int changroup, int chan, float pan)
+void SonobusAudioProcessor::setRemotePeerAutoresizeBufferMode(int index, SonobusAudioProcessor::AutoNetBufferMode flag)
 {
-    const ScopedReadLock sl (mCoreLock);
+    const ScopedReadLock sl (mCoreLock);        
     if (index < mRemotePeers.size()) {
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        if (changroup < MAX_CHANGROUPS) {
-            if (remote->chanGroups[changroup].params.numChannels == 2 && chan < 2) {
-                remote->chanGroups[changroup].params.panStereo[chan] = pan;
-            }
-            else if (chan < MAX_CHANNELS){
-                remote->chanGroups[changroup].params.pan[chan] = pan;
-            }
-            remote->modifiedChanGroups = true;
-            remote->modifiedMultiChanGroups = true;
+        remote->autosizeBufferMode = flag;
+
+        remote->oursink->set_jitter_control(flag == AutoNetBufferModeAutoFull ? 1 : 0);
+        
+        if (flag == AutoNetBufferModeAutoFull) {
+            remote->netBufAutoBaseline = (1e3*currSamplesPerBlock/getSampleRate()); // at least a process block
+        } else if (flag == AutoNetBufferModeInitAuto) {
+            setRemotePeerBufferTime(index, 0.0f); // reset to zero and start it over
         }
+
+        // clear drop count
+        remote->dataPacketsResent = 0;
+        remote->dataPacketsDropped = 0;
+        remote->lastDropCount = 0;
+        remote->resetDroptime = Time::getMillisecondCounterHiRes();
+        remote->fastDropRate.resetInitVal(0.0f);
+
+        //remote->lastDroptime = 0;
     }
 }
 
-float SonobusAudioProcessor::getRemotePeerChannelPan(int index, int changroup, int chan) const
+SonobusAudioProcessor::AutoNetBufferMode SonobusAudioProcessor::getRemotePeerAutoresizeBufferMode(int index, bool & initCompleted) const
 {
-    float pan = 0.0f;
-    
     const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
+    if (index < mRemotePeers.size()) {
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
-
-        if (chan >= 0 && chan < MAX_CHANNELS) {
-            if (remote->chanGroups[changroup].params.numChannels == 2 && chan < 2) {
-                pan = remote->chanGroups[changroup].params.panStereo[chan];
-            } else {
-                pan = remote->chanGroups[changroup].params.pan[chan];
-            }
-        }
+        initCompleted = remote->autoNetbufInitCompleted;
+        return remote->autosizeBufferMode;
     }
-    return pan;
+    return AutoNetBufferModeOff;    
 }
 
-void SonobusAudioProcessor::setRemotePeerChannelGroupStartAndCount(int index, int changroup, int start, int count)
+// acceptable limit for drop rate in dropinstance/second, above which it will adjust the jitter buffer in Auto modes
+void SonobusAudioProcessor::setAutoresizeBufferDropRateThreshold(float thresh)
 {
-    const ScopedReadLock sl (mCoreLock);
-    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        remote->chanGroups[changroup].params.chanStartIndex = start;
-        remote->chanGroups[changroup].params.numChannels = std::max(1, std::min(count, MAX_CHANNELS));
-        remote->modifiedChanGroups = true;
-        remote->modifiedMultiChanGroups = true;
-    }
+    mAutoresizeDropRateThresh = thresh;
 }
 
-bool SonobusAudioProcessor::getRemotePeerChannelGroupStartAndCount(int index, int changroup, int & retstart, int & retcount)
+void SonobusAudioProcessor::setAutoresizeBufferQuantile(float quantile)
 {
-    const ScopedReadLock sl (mCoreLock);
-    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+    mAutoresizeBufferQuantile = jlimit(0.5f, 0.9999f, quantile);
 
-        retstart = remote->chanGroups[changroup].params.chanStartIndex;
-        retcount = remote->chanGroups[changroup].params.numChannels;
-        return true;
+    const ScopedReadLock sl (mCoreLock);
+    for (auto & remote : mRemotePeers) {
+        if (remote->oursink) {
+            remote->oursink->set_jitter_quantile(mAutoresizeBufferQuantile);
+        }
     }
-    return false;
 }
 
-void SonobusAudioProcessor::setRemotePeerChannelGroupDestStartAndCount(int index, int changroup, int start, int count)
+
+
+bool SonobusAudioProcessor::getRemotePeerReceiveBufferFillRatio(int index, float & retratio, float & retstddev) const
 {
+    retratio = 0.0f;
+    retstddev = 0.0f;
     const ScopedReadLock sl (mCoreLock);
-    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
+    if (index < mRemotePeers.size()) {
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        remote->chanGroups[changroup].params.panDestStartIndex = start;
-        remote->chanGroups[changroup].params.panDestChannels = std::max(1, std::min(count, MAX_CHANNELS));
-        remote->modifiedChanGroups = true;
-        remote->modifiedMultiChanGroups = true;
+        retratio = remote->fillRatio.xbar;
+        retstddev = remote->fillRatioSlow.s2xx;
+        return true;
     }
+    return false;
 }
 
-bool SonobusAudioProcessor::getRemotePeerChannelGroupDestStartAndCount(int index, int changroup, int & retstart, int & retcount)
+void SonobusAudioProcessor::setRemotePeerRecvActive(int index, bool active)
 {
-    const ScopedReadLock sl (mCoreLock);
-    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
+    const ScopedReadLock sl (mCoreLock);        
+    if (index < mRemotePeers.size()) {
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
 
-        retstart = remote->chanGroups[changroup].params.panDestStartIndex;
-        retcount = remote->chanGroups[changroup].params.panDestChannels;
-        return true;
+        //remote->recvActive = active;
+
+        if (active) {
+            remote->recvAllow = true;
+            remote->recvAllowCache = true;            
+        }
+        
+        // TODO
+#if 1
+        if (active) {
+            DBG("inviting peer " <<  remote->ourId << " source " << remote->remoteSourceId);
+            remote->oursink->invite_source(remote->endpoint,remote->remoteSourceId, endpoint_send);
+            if (remote->remoteSourceId != AOO_ID_NONE) {
+                remote->oursink->invite_source(remote->endpoint, remote->remoteSourceId + FILESTREAM_ID_OFFSET, endpoint_send);
+            }
+        } else {
+            DBG("uninviting peer " <<  remote->ourId << " source " << remote->remoteSourceId);
+            remote->oursink->uninvite_source(remote->endpoint, remote->remoteSourceId, endpoint_send);
+            if (remote->remoteSourceId != AOO_ID_NONE) {
+                remote->oursink->uninvite_source(remote->endpoint, remote->remoteSourceId + FILESTREAM_ID_OFFSET, endpoint_send);
+            }
+        }
+#endif
     }
-    return false;
 }
 
-void SonobusAudioProcessor::setRemotePeerChannelGroupSendMainMix(int index, int changroup, bool mainmix)
+bool SonobusAudioProcessor::getRemotePeerRecvActive(int index) const
 {
-    const ScopedReadLock sl (mCoreLock);
-    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
+    const ScopedReadLock sl (mCoreLock);        
+    if (index < mRemotePeers.size()) {
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        remote->chanGroups[changroup].params.sendMainMix = mainmix;
+        return remote->recvActive;
     }
+    return false;        
 }
 
-bool SonobusAudioProcessor::getRemotePeerChannelGroupSendMainMix(int index, int changroup)
+void SonobusAudioProcessor::setRemotePeerSendAllow(int index, bool allow, bool cached)
 {
-    const ScopedReadLock sl (mCoreLock);
-    if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
+    const ScopedReadLock sl (mCoreLock);        
+    if (index < mRemotePeers.size() && index >= 0) {
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
-
-        return remote->chanGroups[changroup].params.sendMainMix;
+        if (cached) {
+            remote->sendAllowCache = allow;
+        } else {
+            remote->sendAllow = allow;
+            
+            
+            if (!allow) {
+                //remote->oursource->remove_all();
+                setRemotePeerSendActive(index, allow);
+            }
+        }
     }
-    return 0;
 }
 
-
-bool SonobusAudioProcessor::insertRemotePeerChannelGroup(int index, int atgroup, int chstart, int chcount)
+bool SonobusAudioProcessor::getRemotePeerSendAllow(int index, bool cached) const
 {
-    const ScopedReadLock sl (mCoreLock);
-    if (index < mRemotePeers.size() && atgroup >= 0 && atgroup < MAX_CHANGROUPS) {
+    const ScopedReadLock sl (mCoreLock);        
+    if (index < mRemotePeers.size()) {
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        // push any existing ones down
-
-        for (auto i = MAX_CHANGROUPS-1; i > atgroup; --i) {
-            remote->chanGroups[i].copyParametersFrom(remote->chanGroups[i-1]);
-            //mInputChannelGroups[i].chanStartIndex += chcount;
-            //mInputChannelGroups[i-1].numChannels = std::max(1, std::min(count, MAX_CHANNELS));
-        }
-        remote->chanGroups[atgroup].params.chanStartIndex = chstart;
-        remote->chanGroups[atgroup].params.numChannels = std::max(1, std::min(chcount, MAX_CHANNELS));
-        remote->chanGroups[atgroup].params.panDestStartIndex = 0;
-        remote->chanGroups[atgroup].params.panDestChannels = std::max(1, std::min(2, getTotalNumOutputChannels()));
-
-        remote->modifiedChanGroups = true;
-        remote->modifiedMultiChanGroups = true;
-        // todo some defaults
+        return cached ? remote->sendAllowCache : remote->sendAllow;
     }
-
-    return false;
+    return false;        
 }
 
-bool SonobusAudioProcessor::removeRemotePeerChannelGroup(int index, int atgroup)
+void SonobusAudioProcessor::setRemotePeerRecvAllow(int index, bool allow, bool cached)
 {
-    const ScopedReadLock sl (mCoreLock);
-    if (index < mRemotePeers.size() && atgroup >= 0 && atgroup < MAX_CHANGROUPS) {
+    const ScopedReadLock sl (mCoreLock);        
+    if (index < mRemotePeers.size() && index >= 0) {
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        // move any existing ones after up
 
-        for (auto i = atgroup + 1; i < MAX_CHANGROUPS; ++i) {
-            remote->chanGroups[i-1].copyParametersFrom(remote->chanGroups[i]);
-            //mInputChannelGroups[i].chanStartIndex += chcount;
-            //mInputChannelGroups[i-1].numChannels = std::max(1, std::min(count, MAX_CHANNELS));
+        if (cached) {
+            remote->recvAllowCache = allow;            
+        }
+        else {
+            remote->recvAllow = allow;
+            
+            if (!allow) {
+                setRemotePeerRecvActive(index, allow);
+            }
         }
-        remote->modifiedChanGroups = true;
-        remote->modifiedMultiChanGroups = true;
     }
-
-    return false;
 }
 
-bool SonobusAudioProcessor::copyRemotePeerChannelGroup(int index, int fromgroup, int togroup)
+bool SonobusAudioProcessor::getRemotePeerRecvAllow(int index, bool cached) const
 {
-    const ScopedReadLock sl (mCoreLock);
-    if (index < mRemotePeers.size() && fromgroup < MAX_CHANGROUPS && togroup < MAX_CHANGROUPS) {
+    const ScopedReadLock sl (mCoreLock);        
+    if (index < mRemotePeers.size()) {
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
-
-        remote->chanGroups[togroup].copyParametersFrom(remote->chanGroups[fromgroup]);
-        remote->modifiedChanGroups = true;
-        remote->modifiedMultiChanGroups = true;
+        return cached ? remote->recvAllowCache : remote->recvAllow;
     }
-    return false;
+    return false;        
 }
 
-
-int SonobusAudioProcessor::getRemotePeerRecvChannelCount(int index) const
+void SonobusAudioProcessor::setRemotePeerSoloed(int index, bool soloed)
 {
-    int ret = 0;
     const ScopedReadLock sl (mCoreLock);        
     if (index < mRemotePeers.size()) {
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        ret = remote->recvChannels;
+        
+        remote->soloed = soloed;            
     }
-    return ret;
+    
+    bool anysoloed = mMainMonitorSolo.get();
+    for (auto & remote : mRemotePeers) 
+    {
+        if (remote->soloed) {
+            anysoloed = true;
+            break;
+        }
+    }
+    mAnythingSoloed = anysoloed;
 }
 
-int SonobusAudioProcessor::getRemotePeerChannelGroupCount(int index) const
+bool SonobusAudioProcessor::getRemotePeerSoloed(int index) const
 {
-    int ret = 0;
-    const ScopedReadLock sl (mCoreLock);
+    const ScopedReadLock sl (mCoreLock);        
     if (index < mRemotePeers.size()) {
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        ret = remote->numChanGroups;
+        return  remote->soloed;
     }
-    return ret;
+    return false;            
 }
 
-bool SonobusAudioProcessor::getRemotePeerViewExpanded(int index) const
+
+int64_t SonobusAudioProcessor::getRemotePeerPacketsReceived(int index) const
 {
-    bool ret = false;
-    const ScopedReadLock sl (mCoreLock);
+    const ScopedReadLock sl (mCoreLock);        
     if (index < mRemotePeers.size()) {
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        ret = remote->viewExpanded;
+        return remote->dataPacketsReceived;
     }
-    return ret;
+    return 0;      
 }
 
-void SonobusAudioProcessor::setRemotePeerViewExpanded(int index, bool expanded)
+int64_t SonobusAudioProcessor::getRemotePeerPacketsSent(int index) const
 {
-    const ScopedReadLock sl (mCoreLock);
-    // could be -1 as index meaning all remote peers
-    for (int i=0; i < mRemotePeers.size(); ++i) {
-        if (index < 0 || index == i) {
-            RemotePeer * remote = mRemotePeers.getUnchecked(i);
-            remote->viewExpanded = expanded;
-        }
+    const ScopedReadLock sl (mCoreLock);        
+    if (index < mRemotePeers.size()) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        return remote->dataPacketsSent;
     }
+    return 0;      
 }
 
-bool SonobusAudioProcessor::getLayoutFormatChangedForRemotePeer(int index) const
+int64_t SonobusAudioProcessor::getRemotePeerBytesSent(int index) const
 {
-    bool ret = false;
-    const ScopedReadLock sl (mCoreLock);
+    const ScopedReadLock sl (mCoreLock);        
     if (index < mRemotePeers.size()) {
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        ret = remote->modifiedChanGroups;
+        return remote->endpoint->sentBytes;
     }
-    return ret;
+    return 0;          
 }
 
-void SonobusAudioProcessor::restoreLayoutFormatForRemotePeer(int index)
+int64_t SonobusAudioProcessor::getRemotePeerBytesReceived(int index) const
 {
-    const ScopedReadLock sl (mCoreLock);
+    const ScopedReadLock sl (mCoreLock);        
     if (index < mRemotePeers.size()) {
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        restoreLayoutFormatForPeer(remote, true);
+        return remote->endpoint->recvBytes;
     }
+    return 0;      
 }
 
-
-int SonobusAudioProcessor::getRemotePeerNominalSendChannelCount(int index) const
+int64_t  SonobusAudioProcessor::getRemotePeerPacketsDropped(int index) const
 {
-    int ret = 0;
     const ScopedReadLock sl (mCoreLock);        
     if (index < mRemotePeers.size()) {
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        ret = remote->nominalSendChannels;
+        return remote->dataPacketsDropped;
     }
-    return ret;    
+    return 0;      
 }
 
-void SonobusAudioProcessor::setRemotePeerNominalSendChannelCount(int index, int numchans)
+int64_t  SonobusAudioProcessor::getRemotePeerPacketsResent(int index) const
 {
     const ScopedReadLock sl (mCoreLock);        
-    // could be -1 as index meaning all remote peers
-    for (int i=0; i < mRemotePeers.size(); ++i) {
-        if (index < 0 || index == i) {
-            RemotePeer * remote = mRemotePeers.getUnchecked(i);
-            remote->nominalSendChannels = numchans;
-            updateRemotePeerSendChannels(i, remote);
-        }
+    if (index < mRemotePeers.size()) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        return remote->dataPacketsResent;
     }
+    return 0;      
 }
 
-int SonobusAudioProcessor::getRemotePeerActualSendChannelCount(int index) const
+bool SonobusAudioProcessor::getRemotePeerSafetyMuted(int index) const
 {
-    int ret = 0;
     const ScopedReadLock sl (mCoreLock);
     if (index < mRemotePeers.size()) {
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        ret = remote->sendChannels;
+        return remote->resetSafetyMuted;
     }
-    return ret;
+    return 0;
 }
 
 
-void SonobusAudioProcessor::updateDynamicResampling()
+void  SonobusAudioProcessor::resetRemotePeerPacketStats(int index)
 {
-    const ScopedReadLock sl (mCoreLock);
-    bool newval = mDynamicResampling.get();
-    for (int i=0; i < mRemotePeers.size(); ++i) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(i);
-        remote->oursink->set_dynamic_resampling(newval ? 1 : 0);
-        remote->oursource->set_dynamic_resampling(newval ? 1 : 0);
+    const ScopedReadLock sl (mCoreLock);        
+    if (index < mRemotePeers.size()) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        remote->dataPacketsResent = 0;
+        remote->dataPacketsDropped = 0;
+        remote->dataPacketsReordered = 0;
+        remote->dataBlockGaps = 0;
+        remote->resetDroptime = Time::getMillisecondCounterHiRes();
+        remote->fastDropRate.resetInitVal(0.0f);
     }
 }
 
 
+bool SonobusAudioProcessor::ensureLatencyTestObjects(RemotePeer * peer)
+{
+    // core read lock already held
+    if (peer->latencyTestReady.load(std::memory_order_acquire)) return true;
 
+    const ScopedLock sl (mLatencyTestLock);
+    if (peer->latencyTestReady.load(std::memory_order_acquire)) return true;
 
-int SonobusAudioProcessor::getRemotePeerOverrideSendChannelCount(int index) const
-{
-    int ret = 0;
-    const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size()) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        ret = remote->sendChannelsOverride;
+    peer->latencysink.reset(aoo::isink::create(peer->ourId + LATENCY_ID_OFFSET));
+    peer->latencysource.reset(aoo::isource::create(peer->ourId + LATENCY_ID_OFFSET));
+    peer->echosink.reset(aoo::isink::create(peer->ourId + ECHO_ID_OFFSET));
+    peer->echosource.reset(aoo::isource::create(peer->ourId + ECHO_ID_OFFSET));
+
+    if (!peer->latencysink || !peer->latencysource || !peer->echosink || !peer->echosource) {
+        DBG("Could not create the latency test sinks/sources");
+        return false;
     }
-    return ret;    
-}
 
+    peer->latencysink->set_event_notify(eventNotifyCallback, &peer->eventNotify);
+    peer->latencysource->set_event_notify(eventNotifyCallback, &peer->eventNotify);
+    peer->echosink->set_event_notify(eventNotifyCallback, &peer->eventNotify);
+    peer->echosource->set_event_notify(eventNotifyCallback, &peer->eventNotify);
 
+    peer->latencysink->set_clock(mAooClock.get());
+    peer->latencysource->set_clock(mAooClock.get());
+    peer->echosink->set_clock(mAooClock.get());
+    peer->echosource->set_clock(mAooClock.get());
 
-void SonobusAudioProcessor::setRemotePeerOverrideSendChannelCount(int index, int numchans)
+    setupSourceFormat(peer, peer->latencysource.get(), true);
+    peer->latencysource->setup(getSampleRate(), currSamplesPerBlock, 1);
+    peer->latencysource->set_packetsize(peer->sendPacketsize());
+    setupSourceFormat(peer, peer->echosource.get(), true);
+    peer->echosource->setup(getSampleRate(), currSamplesPerBlock, 1);
+    peer->echosource->set_buffersize(1000.0f * currSamplesPerBlock / getSampleRate());
+    peer->echosource->set_packetsize(peer->sendPacketsize());
+
+    peer->latencysink->setup(getSampleRate(), currSamplesPerBlock, 1);
+    peer->echosink->setup(getSampleRate(), currSamplesPerBlock, 1);
+
+    int32_t flags = AOO_PROTOCOL_FLAG_COMPACT_DATA | AOO_PROTOCOL_FLAG_PING_DATA;
+    peer->latencysink->set_option(aoo_opt_protocol_flags, &flags, sizeof(int32_t));
+    peer->echosink->set_option(aoo_opt_protocol_flags, &flags, sizeof(int32_t));
+
+    peer->latencysink->set_buffersize(peer->buffertimeMs);
+    peer->echosink->set_buffersize(peer->buffertimeMs);
+
+    // never dynamic resampling the latency and echo ones
+    peer->latencysink->set_dynamic_resampling(0);
+    peer->echosink->set_dynamic_resampling(0);
+    peer->latencysource->set_dynamic_resampling(0);
+    peer->echosource->set_dynamic_resampling(0);
+
+    peer->latencysource->set_ping_interval(SOURCE_PING_INTERVAL_MS);
+    peer->echosource->set_ping_interval(SOURCE_PING_INTERVAL_MS);
+
+    peer->latencysource->set_respect_codec_change_requests(1);
+    peer->echosource->set_respect_codec_change_requests(1);
+
+    //peer->latencyProcessor.reset(new MTDM(getSampleRate()));
+    peer->latencyMeasurer.reset(new LatencyMeasurer());
+
+    // now the other threads may use them
+    peer->latencyTestReady.store(true, std::memory_order_release);
+
+    DBG("Made latency test sinks/sources for peer " << peer->ourId);
+    return true;
+}
+
+void SonobusAudioProcessor::releaseIdleLatencyTestObjects()
 {
-    const ScopedReadLock sl (mCoreLock);        
-    // could be -1 as index meaning all remote peers
-    for (int i=0; i < mRemotePeers.size(); ++i) {
-        if (index < 0 || index == i) {
-            RemotePeer * remote = mRemotePeers.getUnchecked(i);
-            remote->sendChannelsOverride = numchans;
-            
-            updateRemotePeerSendChannels(i, remote);
-            
-        }
+    // event thread, no locks held
+    const double nowms = Time::getMillisecondCounterHiRes();
+    if (nowms - mLastLatencyTestReleaseCheckMs < 1000.0) return;
+    mLastLatencyTestReleaseCheckMs = nowms;
+
+    auto isIdle = [nowms] (const RemotePeer * peer) {
+        return peer->latencyTestReady.load() && !peer->activeLatencyTest
+            && nowms - peer->latencyTestLastUseMs.load() > LATENCY_TEST_RELEASE_IDLE_MS;
+    };
+
+    {
+        const ScopedReadLock sl (mCoreLock);
+        if (std::none_of(mRemotePeers.begin(), mRemotePeers.end(), isIdle)) return;
     }
-}
 
-void SonobusAudioProcessor::updateRemotePeerSendChannels(int index, RemotePeer * remote) {
-    // this is called while the corereadlock is already held
-    int newchancnt = remote->sendChannels;
+    // deleted after the lock is let go
+    std::vector<aoo::isink::pointer> oldsinks;
+    std::vector<aoo::isource::pointer> oldsources;
+    std::vector<std::unique_ptr<LatencyMeasurer>> oldmeasurers;
 
-    if (remote->sendChannelsOverride < 0) {
-        int totinchans = 0;
-        for (int cgi=0; cgi < mInputChannelGroupCount && cgi < MAX_CHANGROUPS ; ++cgi) {
-            totinchans += mInputChannelGroups[cgi].params.numChannels;
+    {
+        const ScopedWriteLock sl (mCoreLock);
+
+        bool anyreleased = false;
+        for (auto * peer : mRemotePeers) {
+            if (!isIdle(peer)) continue;
+            peer->latencyTestReady = false;
+            anyreleased = true;
         }
-        // met and file
-        if (mSendMet.get()) {
-            totinchans += 1;
+        if (!anyreleased) return;
+
+        // the audio thread may still be in the middle of using them
+        waitForAudioSnapshotRelease();
+
+        for (auto * peer : mRemotePeers) {
+            if (peer->latencyTestReady || !peer->echosink) continue;
+
+            DBG("Releasing idle latency test sinks/sources for peer " << peer->ourId);
+            oldsinks.push_back(std::move(peer->latencysink));
+            oldsinks.push_back(std::move(peer->echosink));
+            oldsources.push_back(std::move(peer->latencysource));
+            oldsources.push_back(std::move(peer->echosource));
+            oldmeasurers.push_back(std::move(peer->latencyMeasurer));
         }
-        if (mSendPlaybackAudio.get()) {
-            totinchans += mFilePlaybackChannelGroup.params.numChannels;
+    }
+}
+
+void SonobusAudioProcessor::estimateRemotePeerLatency(const RemotePeer * peer, float & incomingMs, float & outgoingMs) const
+{
+    const float absizeMs = 1e3f * currSamplesPerBlock / getSampleRate();
+    const float buftimeMs = jmax(peer->buffertimeMs, absizeMs);
+    const float halfping = peer->smoothPingTime.xbar * 0.5f;
+
+    if (peer->hasRemoteInfo) {
+        int sendformatIndex = peer->formatIndex;
+        if (sendformatIndex < 0 || sendformatIndex >= mAudioFormats.size()) sendformatIndex = 4; //emergency default
+        const AudioCodecFormatInfo & sendformatinfo =  mAudioFormats.getReference(sendformatIndex);
+        auto sendcodecLat = sendformatinfo.codec == CodecOpus ? 2.5f : 0.0f; // Opus adds codec latency
+        if (sendformatinfo.codec == CodecOpus && peer->adaptedFrameMs > 0.0f) {
+            // and a longer frame takes longer to fill
+            sendcodecLat += jmax(0.0f, peer->adaptedFrameMs - absizeMs);
         }
 
-        newchancnt = isAnythingRoutedToPeer(index) ? getMainBusNumOutputChannels() :  remote->nominalSendChannels <= 0 ? totinchans : remote->nominalSendChannels;
+        // their input to our output, and ours to theirs
+        incomingMs = getRemotePeerIncomingLatency(peer, buftimeMs);
+        outgoingMs = /*absizeMs + */ sendcodecLat +  peer->remoteOutLatMs  +  halfping  + peer->remoteJitterBufMs + mDeviceInputLatencyMs.load();
     }
     else {
-        newchancnt = jmin(getMainBusNumOutputChannels(), remote->sendChannelsOverride);
+        // nothing from their side yet, guess it's like ours
+        incomingMs = absizeMs + halfping + buftimeMs + mDeviceOutputLatencyMs.load();
+        outgoingMs = absizeMs + halfping + buftimeMs + mDeviceInputLatencyMs.load();
     }
-    
-    if (remote->sendChannels != newchancnt) {
-        remote->sendChannels = newchancnt;
-        DBG("Peer " << index << "  has new sendChannel count: " << remote->sendChannels);
-        if (remote->oursource) {
-            setupSourceFormat(remote, remote->oursource.get());
-            //setupSourceUserFormat(remote, remote->oursource.get());
+}
 
-            remote->oursource->setup(getSampleRate(), currSamplesPerBlock, remote->sendChannels);
+float SonobusAudioProcessor::getRemotePeerIncomingLatency(const RemotePeer * peer, float buftimeMs) const
+{
+    const float absizeMs = 1e3f * currSamplesPerBlock / getSampleRate();
+    const float halfping = peer->smoothPingTime.xbar * 0.5f;
+    auto recvcodecLat = peer->recvFormat.codec == CodecOpus ? 2.5f : 0.0f; // Opus adds codec latency
 
-            updateRemotePeerUserFormat(index);
-        }
+    return /*absizeMs + */ recvcodecLat +  peer->remoteInLatMs + halfping + jmax(buftimeMs, absizeMs) + mDeviceOutputLatencyMs.load();
+}
+
+void SonobusAudioProcessor::updateRemotePeerEstLatency(RemotePeer * peer)
+{
+    if (peer->hasRealLatency) {
+        // a measured one stays the reference, only the buffering changed since
+        peer->totalEstLatency = peer->totalLatency + (peer->buffertimeMs - peer->bufferTimeAtRealLatency);
+    }
+    else {
+        float incomingMs = 0.0f, outgoingMs = 0.0f;
+        estimateRemotePeerLatency(peer, incomingMs, outgoingMs);
+        peer->totalEstLatency = incomingMs + outgoingMs;
     }
 }
 
-void SonobusAudioProcessor::changeListenerCallback (ChangeBroadcaster* source)
+void SonobusAudioProcessor::setAudioDeviceLatency(float inputMs, float outputMs)
 {
-    if (source == &mTransportSource) {
-        if (!mTransportSource.isPlaying() && mTransportSource.getCurrentPosition() >= mTransportSource.getLengthInSeconds()) {
-            // at end, return to start
-            mTransportSource.setPosition(0.0);
-        }
+    const bool changed = std::abs(inputMs - mDeviceInputLatencyMs.load()) > 0.5f || std::abs(outputMs - mDeviceOutputLatencyMs.load()) > 0.5f;
+    if (!changed) return;
 
-#if 0
-        if (mSendChannels.get() == 0) {
-            if (mTransportSource.isPlaying() && mSendPlaybackAudio.get()) {
-                // override sending
-                int srcchans = mCurrentAudioFileSource ? mCurrentAudioFileSource->getAudioFormatReader()->numChannels : 2;
-                setRemotePeerOverrideSendChannelCount(-1, jmax(getMainBusNumInputChannels(), srcchans));
-            }
-            else if (!mTransportSource.isPlaying()) {
-                // remove override
-                setRemotePeerOverrideSendChannelCount(-1, -1);
-            }
+    mDeviceInputLatencyMs = inputMs;
+    mDeviceOutputLatencyMs = outputMs;
+
+    {
+        const ScopedReadLock sl (mCoreLock);
+        for (auto * peer : mRemotePeers) {
+            updateRemotePeerEstLatency(peer);
         }
-#endif
     }
+
+    // they count ours in their estimates
+    sendRemotePeerInfoUpdate();
 }
 
-void SonobusAudioProcessor::setRemotePeerBufferTime(int index, float bufferMs)
+bool SonobusAudioProcessor::getRemotePeerLatencyInfo(int index, LatencyInfo & retinfo) const
 {
     const ScopedReadLock sl (mCoreLock);        
-    if (index >= 0 && index < mRemotePeers.size()) {
+    if (index < mRemotePeers.size()) {
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        remote->buffertimeMs = bufferMs;
-        remote->totalEstLatency = remote->smoothPingTime.xbar + 2*remote->buffertimeMs + (1e3*currSamplesPerBlock/getSampleRate());
-        remote->oursink->set_buffersize(remote->buffertimeMs); // ms
-        remote->echosink->set_buffersize(remote->buffertimeMs);
-        remote->latencysink->set_buffersize(remote->buffertimeMs);
-        remote->fillRatioSlow.reset();
-        remote->fillRatio.reset();
-        remote->netBufAutoBaseline = (1e3*currSamplesPerBlock/getSampleRate()); // at least a process block
-        remote->latencyDirty = true;
-        remote->autoNetbufInitCompleted = false;
-        remote->lastDroptime = Time::getMillisecondCounterHiRes();
-        remote->resetSafetyMuted = bufferMs == 0.0f;
-        remote->latencyMatched = false;
 
-        //if (remote->autosizeBufferMode == AutoNetBufferModeOff) {
-        // clear drop count
-        remote->dataPacketsResent = 0;
-        remote->dataPacketsDropped = 0;
-        remote->resetDroptime = remote->lastDroptime;
-        remote->fastDropRate.resetInitVal(0.0f);
-        remote->lastDropCount = 0;
-        //}
+#if 1
+        if (remote->activeLatencyTest && remote->latencyMeasurer) {
+            if (remote->latencyMeasurer->state > 1 /*remote->latencyMeasurer->measurementCount */) {
+
+                DBG("Latency calculated: " << remote->latencyMeasurer->latencyMs);
+
+                remote->totalLatency = remote->latencyMeasurer->latencyMs;
+                remote->bufferTimeAtRealLatency = remote->buffertimeMs;
+                remote->hasRealLatency = true;
+                remote->latencyDirty = false;
+                remote->totalEstLatency = remote->totalLatency;
+            }
+            else {
+                DBG("Latency not calculated yet...");
+
+            }
+        }
+#else
+        if (remote->activeLatencyTest && remote->latencyProcessor) {
+            if (remote->latencyProcessor->resolve() < 0) {
+                DBG("Latency Signal below threshold...");
+
+            }
+            else 
+            {
+                const bool excludeBuffer = false;
+
+                double         d, dcapt, dplay, t;
+                bool inv = false;
+                bool quest = false;
+                t = 1000.0 / getSampleRate();
+                dcapt = currSamplesPerBlock;
+                dplay = currSamplesPerBlock;
+                
+                if (remote->latencyProcessor->err () > 0.35f) 
+                {
+                    remote->latencyProcessor->invert ();
+                    remote->latencyProcessor->resolve ();
+                }
+
+                d = remote->latencyProcessor->del ();
+
+                if (excludeBuffer) {
+                    d -= dcapt + dplay;   
+                }
+                if (remote->latencyProcessor->err () > 0.30f) {
+                    //printf ("???  ");   
+                    quest = true;
+                }
+                else if (remote->latencyProcessor->inv ()) {
+                    inv = true;
+                }
+
+                DBG("Peer " << index << ":  " << d << " frames " << d*t << " ms   - " << (quest ? "???" : (inv ? "Inv" : "")));
 
-        if (remote->hasRealLatency) {
-            remote->totalEstLatency = remote->totalLatency + (remote->buffertimeMs - remote->bufferTimeAtRealLatency);
+                remote->totalLatency = d*t;
+                remote->hasRealLatency = true;
+                remote->latencyDirty = false;
+                estimated = false;
+                return remote->totalLatency;
+            }
         }
+#endif
 
-        sendRemotePeerInfoUpdate(index);
-    }
-}
+        retinfo.pingMs = remote->smoothPingTime.xbar;
 
-float SonobusAudioProcessor::getRemotePeerBufferTime(int index) const
-{
-    float buftimeMs = 30.0f;
-    
-    const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size()) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        buftimeMs = remote->buffertimeMs;
-        // reflect actual truth
-        buftimeMs = jmax((double)buftimeMs, 1000.0f * currSamplesPerBlock / getSampleRate());
-    }
-    return buftimeMs;    
-}
+        float buftimeMs = jmax((double)remote->buffertimeMs, 1000.0f * currSamplesPerBlock / getSampleRate());
+        float arrivaljitter = 0.0f;
+        if (remote->oursink && remote->oursink->get_source_arrival_jitter(remote->endpoint, remote->remoteSourceId, arrivaljitter) > 0 && arrivaljitter > 0.0f) {
+            // how late packets arrive at the autoresize quantile
+            retinfo.jitterMs = arrivaljitter;
+        } else {
+            // until enough are ranked
+            retinfo.jitterMs =  2 * remote->fillRatioSlow.s2xx * buftimeMs;
+        }
 
-void SonobusAudioProcessor::setRemotePeerAutoresizeBufferMode(int index, SonobusAudioProcessor::AutoNetBufferMode flag)
-{
-    const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size()) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        remote->autosizeBufferMode = flag;
-        
-        if (flag == AutoNetBufferModeAutoFull) {
-            remote->netBufAutoBaseline = (1e3*currSamplesPerBlock/getSampleRate()); // at least a process block
-        } else if (flag == AutoNetBufferModeInitAuto) {
-            setRemotePeerBufferTime(index, 0.0f); // reset to zero and start it over
+        if (remote->hasRemoteInfo || !remote->hasRealLatency) {
+            // the continuous estimate, good once their side of it is known
+            estimateRemotePeerLatency(remote, retinfo.incomingMs, retinfo.outgoingMs);
+
+            retinfo.isreal = remote->hasRemoteInfo;
+            retinfo.estimated = !remote->hasRemoteInfo;
+            retinfo.legacy = !remote->hasRemoteInfo;
+            retinfo.totalRoundtripMs =  retinfo.incomingMs + retinfo.outgoingMs;
         }
+        else {
+            // OLD LEGACY TEST MODE, a peer without the info but with a measured roundtrip
+            retinfo.estimated = remote->latencyDirty;
+            retinfo.isreal = true;
+            if (remote->latencyDirty) {
+                // is a good estimate
+                retinfo.totalRoundtripMs = remote->totalEstLatency;
+            }
+            else {
+                retinfo.totalRoundtripMs = remote->totalLatency;
+            }
 
-        // clear drop count
-        remote->dataPacketsResent = 0;
-        remote->dataPacketsDropped = 0;
-        remote->lastDropCount = 0;
-        remote->resetDroptime = Time::getMillisecondCounterHiRes();
-        remote->fastDropRate.resetInitVal(0.0f);
+            // given a roundtrip, a ping time, and our known internal buffering latency
+            // we can get decent estimates for the each-direction latencies
+            // outgoing = internal_input_latency + 0.5*pingtime + ??? remote buffering + ??? remote_output_latency
+            // incoming = internal_output_latency + 0.5*pingtime + receivejitterbuffer + ??? remote_input_latency
+            // roundtrip = incoming + outgoing
+            // reflect actual truth
+            retinfo.incomingMs = 2e3*currSamplesPerBlock/getSampleRate() + retinfo.pingMs*0.5f + buftimeMs;
+            retinfo.outgoingMs = /* unknwon_remote_output_latency + */  retinfo.totalRoundtripMs - retinfo.incomingMs;
+            retinfo.legacy = true;
+        }
 
-        //remote->lastDroptime = 0;
+        return true;
     }
+    return false;          
 }
 
-SonobusAudioProcessor::AutoNetBufferMode SonobusAudioProcessor::getRemotePeerAutoresizeBufferMode(int index, bool & initCompleted) const
+bool SonobusAudioProcessor::PeerStatus::sameAs(const PeerStatus & other) const
 {
-    const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size()) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        initCompleted = remote->autoNetbufInitCompleted;
-        return remote->autosizeBufferMode;
-    }
-    return AutoNetBufferModeOff;    
+    return connected == other.connected && sendActive == other.sendActive && sendAllow == other.sendAllow
+        && recvActive == other.recvActive && recvAllow == other.recvAllow && latencyTestActive == other.latencyTestActive
+        && safetyMuted == other.safetyMuted && recording == other.recording && recvChannels == other.recvChannels
+        && bytesSent == other.bytesSent && bytesReceived == other.bytesReceived
+        && packetsDropped == other.packetsDropped && packetsResent == other.packetsResent
+        && fillRatio == other.fillRatio && fillRatioStdDev == other.fillRatioStdDev
+        && bufferTimeMs == other.bufferTimeMs && autoBufferMode == other.autoBufferMode
+        && autoBufferInitCompleted == other.autoBufferInitCompleted
+        && latency.pingMs == other.latency.pingMs && latency.totalRoundtripMs == other.latency.totalRoundtripMs
+        && latency.outgoingMs == other.latency.outgoingMs && latency.incomingMs == other.latency.incomingMs
+        && latency.jitterMs == other.latency.jitterMs && latency.isreal == other.latency.isreal
+        && latency.estimated == other.latency.estimated && latency.legacy == other.latency.legacy;
 }
 
-// acceptable limit for drop rate in dropinstance/second, above which it will adjust the jitter buffer in Auto modes
-void SonobusAudioProcessor::setAutoresizeBufferDropRateThreshold(float thresh)
+bool SonobusAudioProcessor::getRemotePeerStatus(int index, PeerStatus & retstatus) const
 {
-    mAutoresizeDropRateThresh = thresh;
+    const ScopedReadLock sl (mCoreLock);
+    if (index < 0 || index >= mRemotePeers.size()) return false;
+
+    RemotePeer * remote = mRemotePeers.getUnchecked(index);
+    retstatus.connected = remote->connected;
+    retstatus.sendActive = remote->sendActive;
+    retstatus.sendAllow = remote->sendAllow;
+    retstatus.recvActive = remote->recvActive;
+    retstatus.recvAllow = remote->recvAllow;
+    retstatus.latencyTestActive = remote->activeLatencyTest;
+    retstatus.safetyMuted = remote->resetSafetyMuted;
+    retstatus.recording = remote->remoteIsRecording;
+    retstatus.recvChannels = remote->recvChannels;
+    retstatus.bytesSent = remote->endpoint->sentBytes;
+    retstatus.bytesReceived = remote->endpoint->recvBytes;
+    retstatus.packetsDropped = remote->dataPacketsDropped;
+    retstatus.packetsResent = remote->dataPacketsResent;
+    retstatus.fillRatio = remote->fillRatio.xbar;
+    retstatus.fillRatioStdDev = remote->fillRatioSlow.s2xx;
+    retstatus.bufferTimeMs = remote->buffertimeMs;
+    retstatus.autoBufferMode = remote->autosizeBufferMode;
+    retstatus.autoBufferInitCompleted = remote->autoNetbufInitCompleted;
+
+    getRemotePeerLatencyInfo(index, retstatus.latency);
+    return true;
 }
 
-
-
-bool SonobusAudioProcessor::getRemotePeerReceiveBufferFillRatio(int index, float & retratio, float & retstddev) const
+bool SonobusAudioProcessor::getRemotePeerDiagnostics(int index, PeerDiagnostics & retdiag) const
 {
-    retratio = 0.0f;
-    retstddev = 0.0f;
     const ScopedReadLock sl (mCoreLock);
-    if (index < mRemotePeers.size()) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        retratio = remote->fillRatio.xbar;
-        retstddev = remote->fillRatioSlow.s2xx;
-        return true;
-    }
-    return false;
+    if (index < 0 || index >= mRemotePeers.size()) return false;
+
+    RemotePeer * remote = mRemotePeers.getUnchecked(index);
+    retdiag = PeerDiagnostics();
+    retdiag.userName = remote->userName;
+    retdiag.sendFormat = getAudioCodeFormatName(getEffectiveSendFormatIndex(remote));
+    retdiag.recvFormat = remote->recvFormat.name;
+    retdiag.packetsSent = remote->dataPacketsSent;
+    retdiag.packetsReceived = remote->dataPacketsReceived;
+    retdiag.bytesSent = remote->endpoint->sentBytes;
+    retdiag.bytesReceived = remote->endpoint->recvBytes;
+    retdiag.packetsDropped = remote->dataPacketsDropped;
+    retdiag.packetsReordered = remote->dataPacketsReordered;
+    retdiag.packetsResent = remote->dataPacketsResent;
+    retdiag.blockGaps = remote->dataBlockGaps;
+    retdiag.fillRatio = remote->fillRatio.xbar;
+    retdiag.fillRatioStdDev = remote->fillRatioSlow.s2xx;
+    retdiag.bufferTimeMs = remote->buffertimeMs;
+    retdiag.pingMs = remote->smoothPingTime.xbar;
+
+    if (remote->oursink) {
+        remote->oursink->get_source_arrival_jitter(remote->endpoint, remote->remoteSourceId, retdiag.arrivalJitterMs);
+        remote->oursink->get_source_jitter_delay(remote->endpoint, remote->remoteSourceId, retdiag.jitterDelayMs);
+        remote->oursink->get_source_buffer_fill_quantile(remote->endpoint, remote->remoteSourceId, retdiag.bufferFillQuantileMs);
+    }
+
+    const double tickstoms = 1e3 / (double) Time::getHighResolutionTicksPerSecond();
+    retdiag.encodeMs = remote->encodeTicks.load(std::memory_order_relaxed) * tickstoms;
+    retdiag.decodeMs = remote->decodeTicks.load(std::memory_order_relaxed) * tickstoms;
+    return true;
 }
 
-void SonobusAudioProcessor::setRemotePeerRecvActive(int index, bool active)
+void SonobusAudioProcessor::publishPeerStatus()
 {
-    const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size()) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-
-        //remote->recvActive = active;
+    // event thread
+    const double nowms = Time::getMillisecondCounterHiRes();
+    if (nowms - mLastPeerStatusPublishMs < PEER_STATUS_PUBLISH_MS) return;
+    mLastPeerStatusPublishMs = nowms;
 
-        if (active) {
-            remote->recvAllow = true;
-            remote->recvAllowCache = true;            
-        }
-        
-        // TODO
-#if 1
-        if (active) {
-            DBG("inviting peer " <<  remote->ourId << " source " << remote->remoteSourceId);
-            remote->oursink->invite_source(remote->endpoint,remote->remoteSourceId, endpoint_send);
-        } else {
-            DBG("uninviting peer " <<  remote->ourId << " source " << remote->remoteSourceId);
-            remote->oursink->uninvite_source(remote->endpoint, remote->remoteSourceId, endpoint_send);
+    auto & statuses = mPeerStatusBuffer.getWriteBuffer();
+    {
+        const ScopedReadLock sl (mCoreLock);
+        statuses.resize((size_t) mRemotePeers.size());
+        for (int i=0; i < mRemotePeers.size(); ++i) {
+            getRemotePeerStatus(i, statuses[(size_t) i]);
         }
-#endif
     }
-}
 
-bool SonobusAudioProcessor::getRemotePeerRecvActive(int index) const
-{
-    const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size()) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        return remote->recvActive;
+    mLastPeerStatus.resize(statuses.size());
+    for (size_t i=0; i < statuses.size(); ++i) {
+        auto & last = mLastPeerStatus[i];
+        statuses[i].version = statuses[i].sameAs(last) ? last.version : last.version + 1;
+        last = statuses[i];
     }
-    return false;        
-}
 
-void SonobusAudioProcessor::setRemotePeerSendAllow(int index, bool allow, bool cached)
-{
-    const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size() && index >= 0) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        if (cached) {
-            remote->sendAllowCache = allow;
-        } else {
-            remote->sendAllow = allow;
-            
-            
-            if (!allow) {
-                //remote->oursource->remove_all();
-                setRemotePeerSendActive(index, allow);
-            }
-        }
-    }
+    mPeerStatusBuffer.publish();
 }
 
-bool SonobusAudioProcessor::getRemotePeerSendAllow(int index, bool cached) const
+void SonobusAudioProcessor::updateLoadShedding()
 {
-    const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size()) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        return cached ? remote->sendAllowCache : remote->sendAllow;
+    // event thread, does the part of the shedding that can't be done on the audio thread
+    const double nowms = Time::getMillisecondCounterHiRes();
+    if (nowms > mLastThermalCheckMs + THERMAL_CHECK_INTERVAL_MS) {
+        const int state = ::getThermalState();
+        if (state != mThermalState.load()) {
+            DBG("Thermal state " << mThermalState.load() << " -> " << state);
+            mThermalState = state;
+        }
+        mLoadGovernor.setThermalState(state);
+        mLastThermalCheckMs = nowms;
     }
-    return false;        
-}
 
-void SonobusAudioProcessor::setRemotePeerRecvAllow(int index, bool allow, bool cached)
-{
-    const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size() && index >= 0) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+    const int level = mLoadShedding.load() ? mLoadGovernor.getLevel() : (int) LoadGovernor::LevelNone;
 
-        if (cached) {
-            remote->recvAllowCache = allow;            
-        }
-        else {
-            remote->recvAllow = allow;
-            
-            if (!allow) {
-                setRemotePeerRecvActive(index, allow);
+    if (level >= LoadGovernor::LevelPeerFx) {
+        // the lower half of the peers in the order go first, the unordered ones
+        // at the very bottom, so at least the top one keeps its effects
+        const ScopedReadLock sl (mCoreLock);
+        const int numpeers = mRemotePeers.size();
+        auto rank = [this] (int i) { const int prio = mRemotePeers.getUnchecked(i)->orderPriority; return prio < 0 ? std::numeric_limits<int>::max() : prio; };
+        for (int i=0; i < numpeers; ++i) {
+            int above = 0;
+            for (int j=0; j < numpeers; ++j) {
+                if (rank(j) < rank(i) || (rank(j) == rank(i) && j < i)) {
+                    ++above;
+                }
             }
+            mRemotePeers.getUnchecked(i)->loadShedFx = above >= (numpeers + 1) / 2;
         }
     }
-}
 
-bool SonobusAudioProcessor::getRemotePeerRecvAllow(int index, bool cached) const
-{
-    const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size()) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        return cached ? remote->recvAllowCache : remote->recvAllow;
+    const bool shedresampler = level >= LoadGovernor::LevelResampler;
+    if (shedresampler || mLoadSheddingResampler) {
+        // reconfigures the sinks, so only while it is changing
+        const ScopedReadLock sl (mCoreLock);
+        for (auto * remote : mRemotePeers) {
+            if (remote->oursink) {
+                remote->oursink->set_resample_quality(shedresampler ? (int) AOO_RESAMPLE_LINEAR : mResampleQuality.load());
+            }
+        }
+        mLoadSheddingResampler = shedresampler;
     }
-    return false;        
-}
 
-void SonobusAudioProcessor::setRemotePeerSoloed(int index, bool soloed)
-{
-    const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size()) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        
-        remote->soloed = soloed;            
+    // only an atomic for the source, so new peers get it on the next round
+    int complexity = level >= LoadGovernor::LevelCodecMinimal ? 0 : level >= LoadGovernor::LevelCodecComplexity ? LOAD_SHED_COMPLEXITY : -1;
+    if (mInlineSend.load()) {
+        // the audio callback does the encoding then
+        complexity = complexity < 0 ? INLINE_SEND_OPUS_COMPLEXITY : jmin(complexity, INLINE_SEND_OPUS_COMPLEXITY);
     }
-    
-    bool anysoloed = mMainMonitorSolo.get();
-    for (auto & remote : mRemotePeers) 
-    {
-        if (remote->soloed) {
-            anysoloed = true;
-            break;
+    if (complexity >= 0 || mLoadSheddingComplexity >= 0) {
+        const ScopedReadLock sl (mCoreLock);
+        for (auto * remote : mRemotePeers) {
+            if (remote->oursource) {
+                remote->oursource->set_complexity(complexity);
+            }
         }
+        mLoadSheddingComplexity = complexity;
     }
-    mAnythingSoloed = anysoloed;
-}
 
-bool SonobusAudioProcessor::getRemotePeerSoloed(int index) const
-{
-    const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size()) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        return  remote->soloed;
+    if (level != mLoadSheddingReportedLevel) {
+        DBG("Load shedding level " << mLoadSheddingReportedLevel << " -> " << level << " (" << LoadGovernor::getLevelName(level) << ")");
+        const int prevlevel = mLoadSheddingReportedLevel;
+        mLoadSheddingReportedLevel = level;
+        clientListeners.call(&SonobusAudioProcessor::ClientListener::loadSheddingChanged, this, level, prevlevel);
     }
-    return false;            
 }
 
-
-int64_t SonobusAudioProcessor::getRemotePeerPacketsReceived(int index) const
+void SonobusAudioProcessor::setLoadShedding(bool flag)
 {
-    const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size()) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        return remote->dataPacketsReceived;
-    }
-    return 0;      
+    mLoadShedding = flag;
+    notifyEventThread();
 }
 
-int64_t SonobusAudioProcessor::getRemotePeerPacketsSent(int index) const
+void SonobusAudioProcessor::setCodecCpuBudget(bool flag)
 {
-    const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size()) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        return remote->dataPacketsSent;
-    }
-    return 0;      
-}
+    mCodecCpuBudget = flag;
 
-int64_t SonobusAudioProcessor::getRemotePeerBytesSent(int index) const
-{
-    const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size()) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        return remote->endpoint->sentBytes;
+    if (!flag) {
+        // back to what the user chose, unless the link says otherwise
+        const ScopedReadLock sl (mCoreLock);
+        for (auto * remote : mRemotePeers) {
+            if (remote->budgetLimited) {
+                remote->budgetLimited = false;
+                remote->adaptedFormatIndex = -1;
+                applyRemotePeerSendFormat(remote);
+            }
+        }
     }
-    return 0;          
 }
 
-int64_t SonobusAudioProcessor::getRemotePeerBytesReceived(int index) const
+bool SonobusAudioProcessor::isCodecCalibrated() const
 {
-    const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size()) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        return remote->endpoint->recvBytes;
-    }
-    return 0;      
+    const ScopedLock sl (mCodecCostsLock);
+    return mCodecCosts.size() == mAudioFormats.size();
 }
 
-int64_t  SonobusAudioProcessor::getRemotePeerPacketsDropped(int index) const
+SonoAudio::CodecCalibration::Cost SonobusAudioProcessor::getFormatCodecCost(int formatIndex) const
 {
-    const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size()) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        return remote->dataPacketsDropped;
-    }
-    return 0;      
-}
+    const ScopedLock sl (mCodecCostsLock);
+    if (!isPositiveAndBelow(formatIndex, mCodecCosts.size())) return {};
 
-int64_t  SonobusAudioProcessor::getRemotePeerPacketsResent(int index) const
-{
-    const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size()) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        return remote->dataPacketsResent;
-    }
-    return 0;      
+    // measured at 48 kHz, the work goes with the samplerate
+    auto cost = mCodecCosts.getUnchecked(formatIndex);
+    const float scale = getSampleRate() > 0.0 ? (float) (getSampleRate() / 48000.0) : 1.0f;
+    cost.encode *= scale;
+    cost.decode *= scale;
+    return cost;
 }
 
-bool SonobusAudioProcessor::getRemotePeerSafetyMuted(int index) const
+float SonobusAudioProcessor::getAudioCodecFormatCost(int formatIndex, int channels) const
 {
-    const ScopedReadLock sl (mCoreLock);
-    if (index < mRemotePeers.size()) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        return remote->resetSafetyMuted;
-    }
-    return 0;
+    const auto cost = getFormatCodecCost(formatIndex);
+    if (!cost.isValid()) return -1.0f;
+    return (cost.encode + cost.decode) * jmax(1, channels);
 }
 
-
-void  SonobusAudioProcessor::resetRemotePeerPacketStats(int index)
+bool SonobusAudioProcessor::isAudioCodecFormatAffordable(int formatIndex, int channels) const
 {
-    const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size()) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        remote->dataPacketsResent = 0;
-        remote->dataPacketsDropped = 0;
-        remote->resetDroptime = Time::getMillisecondCounterHiRes();
-        remote->fastDropRate.resetInitVal(0.0f);
+    const float cost = getAudioCodecFormatCost(formatIndex, channels);
+    if (cost < 0.0f) return true; // don't know
+
+    float load;
+    {
+        const ScopedReadLock sl (mCoreLock);
+        load = estimateCodecLoad();
     }
+    return load + cost <= CODEC_BUDGET_SHARE;
 }
 
-
-bool SonobusAudioProcessor::getRemotePeerLatencyInfo(int index, LatencyInfo & retinfo) const
+float SonobusAudioProcessor::estimateCodecLoad() const
 {
-    const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size()) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+    // assumed corelock (read) already held
+    float load = 0.0f;
+    for (auto * remote : mRemotePeers) {
+        // the followers of a shared send don't encode on their own
+        if (remote->sendActive && remote->oursource && !remote->sendLeader.load()) {
+            load += getFormatCodecCost(getEffectiveSendFormatIndex(remote)).encode * remote->encodeSendChannels();
+        }
+        if (remote->recvActive && remote->recvChannels > 0) {
+            const auto & fmt = remote->recvFormat;
+            const int index = findFormatIndex(fmt.codec, fmt.bitrate, fmt.bitdepth);
+            load += getFormatCodecCost(index).decode * remote->recvChannels;
+        }
+    }
+    return load;
+}
 
-#if 1
-        if (remote->activeLatencyTest && remote->latencyMeasurer) {
-            if (remote->latencyMeasurer->state > 1 /*remote->latencyMeasurer->measurementCount */) {
+bool SonobusAudioProcessor::fitsCodecBudget(const RemotePeer * peer, int fromIndex, int toIndex) const
+{
+    // assumed corelock (read) already held
+    if (!mCodecCpuBudget.load() || !isCodecCalibrated()) return true;
 
-                DBG("Latency calculated: " << remote->latencyMeasurer->latencyMs);
+    const int chans = peer->encodeSendChannels();
+    const float delta = (getFormatCodecCost(toIndex).encode - getFormatCodecCost(fromIndex).encode) * chans;
+    if (delta <= 0.0f) return true;
 
-                remote->totalLatency = remote->latencyMeasurer->latencyMs;
-                remote->bufferTimeAtRealLatency = remote->buffertimeMs;
-                remote->hasRealLatency = true;
-                remote->latencyDirty = false;
-                remote->totalEstLatency = remote->totalLatency;
-            }
-            else {
-                DBG("Latency not calculated yet...");
+    return estimateCodecLoad() + delta <= CODEC_BUDGET_SHARE
+        && mAverageBlockLoad.load() + delta <= 1.0f - CODEC_BUDGET_HEADROOM;
+}
 
-            }
+void SonobusAudioProcessor::startCodecCalibration()
+{
+    // event thread, the measuring goes to a thread of its own
+    Array<aoo_format_storage> formats;
+    for (const auto & info : mAudioFormats) {
+        aoo_format_storage fmt;
+        zerostruct(fmt);
+        if (!formatInfoToAooFormat(info, CODEC_CALIBRATION_CHANNELS, fmt)) {
+            fmt.header.codec = "";
         }
-#else
-        if (remote->activeLatencyTest && remote->latencyProcessor) {
-            if (remote->latencyProcessor->resolve() < 0) {
-                DBG("Latency Signal below threshold...");
-
+        // always the same, so it doesn't depend on the device of the first run
+        fmt.header.samplerate = 48000;
+        fmt.header.blocksize = info.codec == CodecOpus ? info.min_preferred_blocksize : 256;
+        formats.add(fmt);
+    }
+
+    if (!mCodecCalibrationPool) {
+        mCodecCalibrationPool = std::make_unique<ThreadPool>(1);
+    }
+    mCodecCalibrating = true;
+
+    mCodecCalibrationPool->addJob([this, formats] {
+        Array<SonoAudio::CodecCalibration::Cost> costs;
+        auto * job = ThreadPoolJob::getCurrentThreadPoolJob();
+        auto cancelled = [job] { return job && job->shouldExit(); };
+        for (const auto & fmt : formats) {
+            // an unknown codec is still unknown, not free
+            auto cost = SonoAudio::CodecCalibration::measure(fmt, CODEC_CALIBRATION_SECONDS, cancelled);
+            if (cancelled()) return;
+            if (!cost.isValid()) {
+                cost.encode = cost.decode = 1.0f;
             }
-            else 
-            {
-                const bool excludeBuffer = false;
+            costs.add(cost);
+        }
+        {
+            const ScopedLock sl (mCodecCostsLock);
+            mCodecCosts = costs;
+        }
+        mCodecCalibrating = false;
+        mCodecCalibrationDone = true;
+        notifyEventThread();
+    });
+}
 
-                double         d, dcapt, dplay, t;
-                bool inv = false;
-                bool quest = false;
-                t = 1000.0 / getSampleRate();
-                dcapt = currSamplesPerBlock;
-                dplay = currSamplesPerBlock;
-                
-                if (remote->latencyProcessor->err () > 0.35f) 
-                {
-                    remote->latencyProcessor->invert ();
-                    remote->latencyProcessor->resolve ();
-                }
+void SonobusAudioProcessor::updateCodecBudget()
+{
+    // event thread
+    const double nowms = Time::getMillisecondCounterHiRes();
 
-                d = remote->latencyProcessor->del ();
+    if (!isCodecCalibrated()) {
+        if (mCodecCalibrationStartMs == 0.0) {
+            mCodecCalibrationStartMs = nowms + CODEC_CALIBRATION_DELAY_MS;
+        }
+        else if (!mCodecCalibrating.load() && nowms > mCodecCalibrationStartMs) {
+            startCodecCalibration();
+        }
+        return;
+    }
 
-                if (excludeBuffer) {
-                    d -= dcapt + dplay;   
-                }
-                if (remote->latencyProcessor->err () > 0.30f) {
-                    //printf ("???  ");   
-                    quest = true;
-                }
-                else if (remote->latencyProcessor->inv ()) {
-                    inv = true;
+    if (mCodecCalibrationDone.exchange(false) && mDefaultAudioFormatIndex == DEFAULT_AUDIO_FORMAT_INDEX) {
+        // the first run: a default that a modest session already can't afford here gets
+        // swapped for the best one that fits, never for one that sends more
+        const int session = CODEC_CALIBRATION_PEERS * CODEC_CALIBRATION_CHANNELS;
+        auto sessioncost = [this, session] (int i) { return getAudioCodecFormatCost(i, session); };
+        const double maxrate = getFormatRate(mAudioFormats.getReference(mDefaultAudioFormatIndex));
+        if (sessioncost(mDefaultAudioFormatIndex) > CODEC_BUDGET_SHARE) {
+            int best = -1;
+            for (int i = 0; i < mAudioFormats.size(); ++i) {
+                const double rate = getFormatRate(mAudioFormats.getReference(i));
+                if (rate <= maxrate && sessioncost(i) <= CODEC_BUDGET_SHARE
+                    && (best < 0 || rate > getFormatRate(mAudioFormats.getReference(best)))) {
+                    best = i;
                 }
-
-                DBG("Peer " << index << ":  " << d << " frames " << d*t << " ms   - " << (quest ? "???" : (inv ? "Inv" : "")));
-
-                remote->totalLatency = d*t;
-                remote->hasRealLatency = true;
-                remote->latencyDirty = false;
-                estimated = false;
-                return remote->totalLatency;
+            }
+            if (best >= 0) {
+                DBG("Codec calibration: default format " << mDefaultAudioFormatIndex << " -> " << best);
+                setDefaultAudioCodecFormat(best);
             }
         }
-#endif
+    }
 
-        retinfo.pingMs = remote->smoothPingTime.xbar;
+    if (!mCodecCpuBudget.load() || nowms < mLastCodecBudgetMs + CODEC_BUDGET_INTERVAL_MS) return;
+    mLastCodecBudgetMs = nowms;
 
-        if (remote->hasRemoteInfo) {
-            float buftimeMs = jmax((double)remote->buffertimeMs, 1000.0f * currSamplesPerBlock / getSampleRate());
-            auto halfping = retinfo.pingMs*0.5f;
-            auto absizeMs = 1e3*currSamplesPerBlock/getSampleRate();
-            int sendformatIndex = remote->formatIndex;
-            if (sendformatIndex < 0 || sendformatIndex >= mAudioFormats.size()) sendformatIndex = 4; //emergency default
-            const AudioCodecFormatInfo & sendformatinfo =  mAudioFormats.getReference(sendformatIndex);
-            auto sendcodecLat = sendformatinfo.codec == CodecOpus ? 2.5f : 0.0f; // Opus adds codec latency
-            auto recvcodecLat = remote->recvFormat.codec == CodecOpus ? 2.5f : 0.0f; // Opus adds codec latency
-
-            // new style
-            retinfo.incomingMs = /*absizeMs + */ recvcodecLat +  remote->remoteInLatMs + halfping + buftimeMs;
-            retinfo.outgoingMs = /*absizeMs + */ sendcodecLat +  remote->remoteOutLatMs  +  halfping  + remote->remoteJitterBufMs;
-            retinfo.jitterMs =  2 * remote->fillRatioSlow.s2xx * buftimeMs; // can't find a good estimate for this yet
+    const ScopedReadLock sl (mCoreLock);
 
-            retinfo.isreal = true;
-            retinfo.estimated = false;
-            retinfo.legacy = false;
-            retinfo.totalRoundtripMs =  retinfo.incomingMs + retinfo.outgoingMs;
-        }
-        else {
-            // OLD LEGACY TEST MODE
-            if (remote->hasRealLatency) {
-                retinfo.estimated = remote->latencyDirty;
-                retinfo.isreal = true;
-                if (remote->latencyDirty) {
-                    // is a good estimate
-                    retinfo.totalRoundtripMs = remote->totalEstLatency;
-                }
-                else {
-                    retinfo.totalRoundtripMs = remote->totalLatency;
+    const float load = estimateCodecLoad();
+    const float blockload = mAverageBlockLoad.load();
+    const bool over = load > CODEC_BUDGET_SHARE || (blockload > 1.0f - CODEC_BUDGET_HEADROOM && load > 0.0f);
+
+    // one peer a round, the dearest one to encode for first when over
+    RemotePeer * pick = nullptr;
+    int pickindex = -1;
+    float pickcost = 0.0f;
+
+    for (auto * remote : mRemotePeers) {
+        if (!remote->sendActive || !remote->oursource || remote->sendLeader.load()) continue;
+
+        const int userindex = remote->formatIndex < 0 ? mDefaultAudioFormatIndex : remote->formatIndex;
+        const int current = getEffectiveSendFormatIndex(remote);
+        const float cost = getFormatCodecCost(current).encode * remote->encodeSendChannels();
+
+        if (over) {
+            // the best one that is clearly cheaper to encode and doesn't send more than the user's choice
+            const double userrate = getFormatRate(mAudioFormats.getReference(userindex));
+            int cheaper = -1;
+            for (int i = 0; i < mAudioFormats.size(); ++i) {
+                if (getFormatCodecCost(i).encode < 0.8f * getFormatCodecCost(current).encode
+                    && getFormatRate(mAudioFormats.getReference(i)) < userrate
+                    && (cheaper < 0 || getFormatRate(mAudioFormats.getReference(i)) > getFormatRate(mAudioFormats.getReference(cheaper)))) {
+                    cheaper = i;
                 }
-
             }
-            else {
-                retinfo.isreal = false;
-                retinfo.estimated = true;
-                retinfo.totalRoundtripMs = remote->totalEstLatency ;
+            if (cheaper >= 0 && cost > pickcost) {
+                pick = remote;
+                pickindex = cheaper;
+                pickcost = cost;
             }
-
-            // given a roundtrip, a ping time, and our known internal buffering latency
-            // we can get decent estimates for the each-direction latencies
-            // outgoing = internal_input_latency + 0.5*pingtime + ??? remote buffering + ??? remote_output_latency
-            // incoming = internal_output_latency + 0.5*pingtime + receivejitterbuffer + ??? remote_input_latency
-            // roundtrip = incoming + outgoing
-            // reflect actual truth
-            float buftimeMs = jmax((double)remote->buffertimeMs, 1000.0f * currSamplesPerBlock / getSampleRate());
-
-            retinfo.incomingMs = 2e3*currSamplesPerBlock/getSampleRate() + retinfo.pingMs*0.5f + buftimeMs;
-            retinfo.outgoingMs = /* unknwon_remote_output_latency + */  retinfo.totalRoundtripMs - retinfo.incomingMs;
-            retinfo.jitterMs =  2 * remote->fillRatioSlow.s2xx * buftimeMs; // can't find a good estimate for this yet
-            retinfo.legacy = true;
         }
+        else if (remote->budgetLimited && remote->adaptedFormatIndex >= 0 && !pick) {
+            // back to the user's choice when that fits again, with some room to spare
+            const float delta = (getFormatCodecCost(userindex).encode - getFormatCodecCost(current).encode) * remote->encodeSendChannels();
+            if (load + delta <= 0.8f * CODEC_BUDGET_SHARE && blockload + delta <= 0.8f * (1.0f - CODEC_BUDGET_HEADROOM)) {
+                pick = remote;
+                pickindex = -1;
+            }
+        }
+    }
 
-        return true;
+    if (pick) {
+        DBG("Codec budget: peer " << pick->ourId << " to format " << (pickindex >= 0 ? pickindex : (pick->formatIndex < 0 ? mDefaultAudioFormatIndex : pick->formatIndex))
+            << ", codec load " << load << ", block load " << blockload);
+        pick->adaptedFormatIndex = pickindex;
+        pick->budgetLimited = pickindex >= 0;
+        applyRemotePeerSendFormat(pick);
     }
-    return false;          
+}
+
+bool SonobusAudioProcessor::updatePublishedPeerStatus()
+{
+    return mPeerStatusBuffer.update();
 }
 
 bool SonobusAudioProcessor::isRemotePeerLatencyTestActive(int index)
@@ -5411,6 +12414,9 @@ bool SonobusAudioProcessor::startRemotePeerLatencyTest(int index, float duration
     if (index < mRemotePeers.size()) {
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
         if (!remote->activeLatencyTest) {
+            if (!ensureLatencyTestObjects(remote)) return false;
+            remote->latencyTestLastUseMs = Time::getMillisecondCounterHiRes();
+
             // invite remote's echosource to send to our latency sink
 
             remote->latencysink->uninvite_all();
@@ -5444,7 +12450,7 @@ bool SonobusAudioProcessor::stopRemotePeerLatencyTest(int index)
     const ScopedReadLock sl (mCoreLock);        
     if (index < mRemotePeers.size()) {
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        if (remote->activeLatencyTest) {
+        if (remote->activeLatencyTest && remote->latencyTestReady) {
             // uninvite remote's echosource
             remote->latencysink->uninvite_all();
             
@@ -5453,6 +12459,8 @@ bool SonobusAudioProcessor::stopRemotePeerLatencyTest(int index)
             remote->latencysource->stop();
 
             remote->activeLatencyTest = false;            
+            // the objects go once idle for a while, see releaseIdleLatencyTestObjects()
+            remote->latencyTestLastUseMs = Time::getMillisecondCounterHiRes();
         }
         return true;
     }
@@ -5466,6 +12474,7 @@ void SonobusAudioProcessor::setRemotePeerSendActive(int index, bool active)
     const ScopedReadLock sl (mCoreLock);        
     if (index < mRemotePeers.size()) {
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        ungroupSharedSend(remote);
         remote->sendActive = active;
         if (active) {
             remote->sendAllow = true; // implied
@@ -5634,10 +12643,13 @@ SonobusAudioProcessor::RemotePeer * SonobusAudioProcessor::doAddRemotePeerIfNece
             if (safe) hasit = true;
         }
         
-        adjustRemoteSendMatrix(mRemotePeers.size(), false);
-
-        retpeer = new RemotePeer(endpoint, newid);
+        retpeer = takePooledRemotePeer(endpoint, newid);
+        retpeer->slot = acquirePeerSlot();
 
+        retpeer->eventNotify.processor = this;
+        retpeer->oursink->set_event_notify(eventNotifyCallback, &retpeer->eventNotify);
+        retpeer->oursource->set_event_notify(eventNotifyCallback, &retpeer->eventNotify);
+        retpeer->filestreamsource->set_event_notify(eventNotifyCallback, &retpeer->eventNotify);
 
         retpeer->userName = username;
         retpeer->groupName = groupname;
@@ -5664,12 +12676,23 @@ SonobusAudioProcessor::RemotePeer * SonobusAudioProcessor::doAddRemotePeerIfNece
 
         retpeer->resetSafetyMuted = retpeer->buffertimeMs < 3.0f;
 
+        retpeer->oursink->set_clock(mAooClock.get());
+        retpeer->oursource->set_clock(mAooClock.get());
+        retpeer->filestreamsource->set_clock(mAooClock.get());
+
         retpeer->oursink->setup(getSampleRate(), currSamplesPerBlock, getMainBusNumOutputChannels());
         retpeer->oursink->set_buffersize(retpeer->buffertimeMs);
 
-        int32_t flags = AOO_PROTOCOL_FLAG_COMPACT_DATA;
+        // silence suppression only for the audio, the latency and echo tests need their silent blocks
+        int32_t flags = AOO_PROTOCOL_FLAG_COMPACT_DATA | AOO_PROTOCOL_FLAG_PING_DATA | AOO_PROTOCOL_FLAG_SILENCE | AOO_PROTOCOL_FLAG_PACK | AOO_PROTOCOL_FLAG_OPUS_COUPLED;
         retpeer->oursink->set_option(aoo_opt_protocol_flags, &flags, sizeof(int32_t));
 
+        // in full auto mode the sink tracks the jitter and adjusts its delay within the buffer
+        retpeer->oursink->set_jitter_control(retpeer->autosizeBufferMode == AutoNetBufferModeAutoFull ? 1 : 0);
+        retpeer->oursink->set_jitter_quantile(mAutoresizeBufferQuantile);
+        // forget the stale sources of a peer that reconnected or whose file stream ended
+        retpeer->oursink->set_source_timeout(SINK_SOURCE_TIMEOUT_MS);
+
         retpeer->nominalSendChannels = mSendChannels.get();
         retpeer->sendChannels =  mSendChannels.get() <= 0 ?  mActiveSendChannels : mSendChannels.get();
 
@@ -5677,46 +12700,24 @@ SonobusAudioProcessor::RemotePeer * SonobusAudioProcessor::doAddRemotePeerIfNece
         float sendbufsize = jmax(10.0, SENDBUFSIZE_SCALAR * 1000.0f * currSamplesPerBlock / getSampleRate());
         retpeer->oursource->setup(getSampleRate(), currSamplesPerBlock, retpeer->sendChannels);
         retpeer->oursource->set_buffersize(sendbufsize);
-        retpeer->oursource->set_packetsize(retpeer->packetsize);        
+        retpeer->oursource->set_packetsize(retpeer->sendPacketsize());
         //setupSourceUserFormat(retpeer, retpeer->oursource.get());
 
-        setupSourceFormat(retpeer, retpeer->latencysource.get(), true);
-        retpeer->latencysource->setup(getSampleRate(), currSamplesPerBlock, 1);
-        retpeer->latencysource->set_packetsize(retpeer->packetsize);
-        setupSourceFormat(retpeer, retpeer->echosource.get(), true);
-        retpeer->echosource->setup(getSampleRate(), currSamplesPerBlock, 1);
-        retpeer->echosource->set_buffersize(1000.0f * currSamplesPerBlock / getSampleRate());
-        retpeer->echosource->set_packetsize(retpeer->packetsize);
-
-        retpeer->latencysink->setup(getSampleRate(), currSamplesPerBlock, 1);
-        retpeer->echosink->setup(getSampleRate(), currSamplesPerBlock, 1);
-
-        retpeer->latencysink->set_option(aoo_opt_protocol_flags, &flags, sizeof(int32_t));
-        retpeer->echosink->set_option(aoo_opt_protocol_flags, &flags, sizeof(int32_t));
-
-        retpeer->latencysink->set_buffersize(retpeer->buffertimeMs);
-        retpeer->echosink->set_buffersize(retpeer->buffertimeMs);
-
-        // never dynamic resampling the latency and echo ones
-        retpeer->latencysink->set_dynamic_resampling(0);
-        retpeer->echosink->set_dynamic_resampling(0);
-        retpeer->latencysource->set_dynamic_resampling(0);
-        retpeer->echosource->set_dynamic_resampling(0);
+        // set up for the stream format when it starts, see updateFileStreamSending()
+        retpeer->filestreamsource->set_buffersize(FILESTREAM_SEND_BUFFER_MS);
+        retpeer->filestreamsource->set_packetsize(retpeer->sendPacketsize());
+        retpeer->filestreamsource->set_dynamic_resampling(0);
 
         
-        retpeer->oursource->set_ping_interval(2000);
-        retpeer->latencysource->set_ping_interval(2000);
-        retpeer->echosource->set_ping_interval(2000);
+        retpeer->oursource->set_ping_interval(SOURCE_PING_INTERVAL_MS);
+        retpeer->filestreamsource->set_ping_interval(SOURCE_PING_INTERVAL_MS);
 
         retpeer->oursource->set_respect_codec_change_requests(1);
-        retpeer->latencysource->set_respect_codec_change_requests(1);
-        retpeer->echosource->set_respect_codec_change_requests(1);
-        
-        //retpeer->latencyProcessor.reset(new MTDM(getSampleRate()));
-        retpeer->latencyMeasurer.reset(new LatencyMeasurer());
         
         retpeer->oursink->set_dynamic_resampling(mDynamicResampling.get() ? 1 : 0);
         retpeer->oursource->set_dynamic_resampling(mDynamicResampling.get() ? 1 : 0);
+        retpeer->oursink->set_resample_quality(mResampleQuality.load());
+        retpeer->oursink->set_time_stretch(mTimeStretch.load() ? 1 : 0);
 
         
         retpeer->workBuffer.setSize(2, currSamplesPerBlock, false, false, true);
@@ -5725,6 +12726,8 @@ SonobusAudioProcessor::RemotePeer * SonobusAudioProcessor::doAddRemotePeerIfNece
         
         retpeer->recvMeterSource.resize (outchannels, meterRmsWindow);
         retpeer->sendMeterSource.resize (retpeer->sendChannels, meterRmsWindow);
+        retpeer->recvMeterSource.setSuspended (!mMetersActive);
+        retpeer->sendMeterSource.setSuspended (!mMetersActive);
 
         retpeer->sendAllow = !mMainSendMute.get();
         retpeer->sendAllowCache = true; // cache is allowed for new ones, so when it is unmuted it actually does
@@ -5741,10 +12744,22 @@ SonobusAudioProcessor::RemotePeer * SonobusAudioProcessor::doAddRemotePeerIfNece
         };
 
 
+        if (mPeerTelemetry.load()) {
+            startPeerTelemetry(retpeer);
+        }
+        if (TraceRecorder::isActive() && retpeer->oursink) {
+            retpeer->oursink->set_trace_tap(peerTraceTap, nullptr);
+        }
+
         // now add it, once initialized
         {
             const ScopedWriteLock slw (mCoreLock);
             mRemotePeers.add(retpeer);
+            if (mPeerAddBatchDepth.load() > 0) {
+                mPeerSnapshotPending = true;
+            } else {
+                publishPeerSnapshot();
+            }
         }
 
         //updateRemotePeerUserFormat(mRemotePeers.size()-1);
@@ -5760,12 +12775,14 @@ SonobusAudioProcessor::RemotePeer * SonobusAudioProcessor::doAddRemotePeerIfNece
             if (findAndLoadCacheForPeer(retpeer)) {
                 
                 setupSourceFormat(retpeer, retpeer->oursource.get());
-                setupSourceFormat(retpeer, retpeer->latencysource.get(), true);
-                setupSourceFormat(retpeer, retpeer->echosource.get(), true);
-
                 retpeer->oursink->set_buffersize(retpeer->buffertimeMs);
-                retpeer->latencysink->set_buffersize(retpeer->buffertimeMs);
-                retpeer->echosink->set_buffersize(retpeer->buffertimeMs);
+
+                if (retpeer->latencyTestReady) {
+                    setupSourceFormat(retpeer, retpeer->latencysource.get(), true);
+                    setupSourceFormat(retpeer, retpeer->echosource.get(), true);
+                    retpeer->latencysink->set_buffersize(retpeer->buffertimeMs);
+                    retpeer->echosink->set_buffersize(retpeer->buffertimeMs);
+                }
                 
                 for (auto i=0; i < retpeer->numChanGroups && i < MAX_CHANGROUPS; ++i) {
                     retpeer->chanGroups[i].commitCompressorParams();
@@ -5780,6 +12797,58 @@ SonobusAudioProcessor::RemotePeer * SonobusAudioProcessor::doAddRemotePeerIfNece
     return retpeer;    
 }
 
+SonobusAudioProcessor::RemotePeer * SonobusAudioProcessor::takePooledRemotePeer(EndpointState * endpoint, int32_t ourId)
+{
+    std::unique_ptr<RemotePeer> peer;
+    {
+        const ScopedLock sl (mRemotePeerPoolLock);
+        peer.reset(mRemotePeerPool.removeAndReturn(mRemotePeerPool.size() - 1));
+    }
+
+    if (!peer) {
+        return new RemotePeer(endpoint, ourId);
+    }
+
+    peer->endpoint = endpoint;
+    peer->ourId = ourId;
+    peer->oursink->set_id(ourId);
+    peer->oursource->set_id(ourId);
+    peer->filestreamsource->set_id(ourId + FILESTREAM_ID_OFFSET);
+    return peer.release();
+}
+
+void SonobusAudioProcessor::refillRemotePeerPool()
+{
+    // event thread, no locks held. Only while a group join can bring a lot of them
+    if (!mIsConnectedToServer) return;
+
+    for (;;) {
+        {
+            const ScopedLock sl (mRemotePeerPoolLock);
+            if (mRemotePeerPool.size() >= REMOTE_PEER_POOL_SIZE) return;
+        }
+        // get their real ids once taken
+        auto * peer = new RemotePeer(nullptr, 0);
+        const ScopedLock sl (mRemotePeerPoolLock);
+        mRemotePeerPool.add(peer);
+    }
+}
+
+void SonobusAudioProcessor::beginPeerAddBatch()
+{
+    ++mPeerAddBatchDepth;
+}
+
+void SonobusAudioProcessor::endPeerAddBatch()
+{
+    // taking the write lock orders this with the adds, so none gets left out
+    const ScopedWriteLock sl (mCoreLock);
+    if (--mPeerAddBatchDepth == 0 && mPeerSnapshotPending) {
+        mPeerSnapshotPending = false;
+        publishPeerSnapshot();
+    }
+}
+
 void SonobusAudioProcessor::commitCacheForPeer(RemotePeer * retpeer)
 {
     if (retpeer->userName.isEmpty()) {
@@ -5787,6 +12856,8 @@ void SonobusAudioProcessor::commitCacheForPeer(RemotePeer * retpeer)
         return;
     }
 
+    finishStateRestore();
+
     PeerStateCache newcache;
     newcache.netbuf = retpeer->buffertimeMs;
     newcache.netbufauto = retpeer->autosizeBufferMode;
@@ -5805,14 +12876,49 @@ void SonobusAudioProcessor::commitCacheForPeer(RemotePeer * retpeer)
         newcache.channelGroupMultiParams[i] = retpeer->lastMultiChanParams[i];
     }
 
+    const ScopedLock sl (mPeerStateCacheLock);
+
     PeerStateCacheMap::iterator found  = mPeerStateCacheMap.find(retpeer->userName);
     
     if (found != mPeerStateCacheMap.end()) {
+        // it was last used when they joined
+        newcache.lastUsed = found->second.lastUsed;
+        newcache.updateEncoded();
+
+        if (found->second.encoded == newcache.encoded) {
+            // nothing changed, the saved state can stay as it is
+            return;
+        }
         found->second = newcache;
     }
     else {
+        newcache.lastUsed = Time::currentTimeMillis();
+        newcache.updateEncoded();
         mPeerStateCacheMap.insert(PeerStateCacheMap::value_type(retpeer->userName, newcache));
+        trimPeerStateCache();
     }
+    mPeerStateCacheDataValid = false;
+}
+
+void SonobusAudioProcessor::trimPeerStateCache()
+{
+    // mPeerStateCacheLock held. Done in batches, so the sort is rare
+    if ((int) mPeerStateCacheMap.size() <= MAX_PEER_STATE_CACHE + MAX_PEER_STATE_CACHE / 10) return;
+
+    std::vector<std::pair<int64, String>> byuse;
+    byuse.reserve(mPeerStateCacheMap.size());
+    for (auto & info : mPeerStateCacheMap) {
+        byuse.emplace_back(info.second.lastUsed, info.first);
+    }
+    std::sort(byuse.begin(), byuse.end());
+
+    const size_t toremove = mPeerStateCacheMap.size() - MAX_PEER_STATE_CACHE;
+    for (size_t i=0; i < toremove; ++i) {
+        mPeerStateCacheMap.erase(byuse[i].second);
+    }
+
+    DBG("Evicted " << (int) toremove << " least recently used peer cache entries");
+    mPeerStateCacheDataValid = false;
 }
 
 bool SonobusAudioProcessor::findAndLoadCacheForPeer(RemotePeer * retpeer)
@@ -5821,7 +12927,11 @@ bool SonobusAudioProcessor::findAndLoadCacheForPeer(RemotePeer * retpeer)
         DBG("username empty, can't match");
         return false;
     }
-    
+
+    finishStateRestore();
+
+    const ScopedLock sl (mPeerStateCacheLock);
+
     // look for current peer by user name in peer cache and apply settings
     PeerStateCacheMap::iterator found  = mPeerStateCacheMap.find(retpeer->userName);
     if (found == mPeerStateCacheMap.end()) {
@@ -5833,13 +12943,12 @@ bool SonobusAudioProcessor::findAndLoadCacheForPeer(RemotePeer * retpeer)
             namebase = nametoks.joinIntoString(" ").trim();
         }
         
-        for (PeerStateCacheMap::iterator iter = mPeerStateCacheMap.begin(); iter != mPeerStateCacheMap.end(); ++iter) {
-            if (iter->first.startsWith(namebase)) {
-                // close match
-                DBG("Found close peer match: " << namebase << "  with cachename: " << iter->first);
-                found = iter;
-                break;
-            }
+        // the names starting with it sort right from there on, the first of them is the match
+        PeerStateCacheMap::iterator iter = mPeerStateCacheMap.lower_bound(namebase);
+        if (iter != mPeerStateCacheMap.end() && iter->first.startsWith(namebase)) {
+            // close match
+            DBG("Found close peer match: " << namebase << "  with cachename: " << iter->first);
+            found = iter;
         }
     }
     else {
@@ -5847,7 +12956,13 @@ bool SonobusAudioProcessor::findAndLoadCacheForPeer(RemotePeer * retpeer)
     }
     
     if (found != mPeerStateCacheMap.end()) {
-        const PeerStateCache & cache = found->second;
+        PeerStateCache & cache = found->second;
+
+        // keeps it from being evicted
+        cache.lastUsed = Time::currentTimeMillis();
+        cache.updateEncoded();
+        mPeerStateCacheDataValid = false;
+
         retpeer->autosizeBufferMode = (AutoNetBufferMode) cache.netbufauto;
         retpeer->buffertimeMs = cache.netbuf;
         retpeer->formatIndex = cache.sendFormat;
@@ -5891,8 +13006,6 @@ bool SonobusAudioProcessor::removeAllRemotePeersWithEndpoint(EndpointState * end
                 disconnectRemotePeer(i);
             }
             
-            adjustRemoteSendMatrix(i, true);
-
             commitCacheForPeer(s);
 
             didremove = true;
@@ -5901,7 +13014,10 @@ bool SonobusAudioProcessor::removeAllRemotePeersWithEndpoint(EndpointState * end
                 const ScopedWriteLock slw (mCoreLock);
 
                 removed.add(mRemotePeers.removeAndReturn(i));
+                publishPeerSnapshot();
             }
+
+            releasePeerSlot(s->slot);
         }
     }
 
@@ -5923,32 +13039,245 @@ bool SonobusAudioProcessor::doRemoveRemotePeerIfNecessary(EndpointState * endpoi
         if (s->endpoint == endpoint && s->ourId == ourId) {
             didremove = true;
             commitCacheForPeer(s);
+            ungroupSharedSend(s);
 
             {
                 const ScopedWriteLock slw (mCoreLock);
                 removed.add(mRemotePeers.removeAndReturn(i));
+                publishPeerSnapshot();
             }
+
+            releasePeerSlot(s->slot);
             break;
         }
-        ++i;
+        ++i;
+    }
+    
+    return didremove;
+    
+}
+
+void SonobusAudioProcessor::publishPeerSnapshot()
+{
+    // called with the core lock held, write if mRemotePeers changed, read if only
+    // the routing did. The audio thread only ever does one atomic load of the
+    // current snapshot, so swap in a fresh copy and wait out any processBlock
+    // still using the old one before freeing it. Once this returns, peers no
+    // longer in mRemotePeers are safe to delete.
+
+    auto * snapshot = new PeerSnapshot();
+    snapshot->peers.addArray(mRemotePeers.begin(), mRemotePeers.size());
+
+    PeerSnapshot * oldsnapshot = nullptr;
+    {
+        // also keeps concurrent publishers in order
+        const ScopedLock rl (mRoutingLock);
+
+        // resolve the routing from slots to indexes in this snapshot
+        std::vector<int> slotindex (mPeerSlotUsed.size(), -1);
+        for (int i=0; i < snapshot->peers.size(); ++i) {
+            const int slot = snapshot->peers.getUnchecked(i)->slot;
+            if (slot >= 0 && slot < (int) slotindex.size()) {
+                slotindex[(size_t) slot] = i;
+            }
+        }
+
+        snapshot->sendSources.resize((size_t) snapshot->peers.size());
+        for (int i=0; i < snapshot->peers.size(); ++i) {
+            const int slot = snapshot->peers.getUnchecked(i)->slot;
+            for (auto srcslot : getSendSourceSlots(slot)) {
+                // listeners aren't rendered, there's nothing of them to mix in
+                const int srcindex = slotindex[(size_t) srcslot];
+                if (srcindex >= 0 && !snapshot->peers.getUnchecked(srcindex)->remoteListener.load()) {
+                    snapshot->sendSources[(size_t) i].add(srcindex);
+                }
+            }
+        }
+
+        setupSendMixMinus(*snapshot);
+        setupSendResampling(*snapshot, mPeerSnapshot.load());
+
+        oldsnapshot = mPeerSnapshot.exchange(snapshot);
+    }
+
+    waitForAudioSnapshotRelease();
+
+    delete oldsnapshot;
+}
+
+void SonobusAudioProcessor::setupSendMixMinus(PeerSnapshot & snapshot)
+{
+    const auto numpeers = (size_t) snapshot.peers.size();
+
+    std::vector<bool> routed (numpeers, false);
+    for (auto & sources : snapshot.sendSources) {
+        for (auto j : sources) {
+            routed[(size_t) j] = true;
+        }
+    }
+    for (size_t j=0; j < numpeers; ++j) {
+        if (routed[j]) {
+            snapshot.routedSources.add((int) j);
+        }
+    }
+
+    // count buffer additions: the total costs one per routed peer, then each
+    // mix-minus peer one for adding the total and one per exclusion
+    const int numrouted = snapshot.routedSources.size();
+    int directcost = 0;
+    int minuscost = numrouted;
+    snapshot.sendMixMinus.assign(numpeers, false);
+    snapshot.sendExclusions.resize(numpeers);
+    for (size_t i=0; i < numpeers; ++i) {
+        const int direct = snapshot.sendSources[i].size();
+        const int minus = 1 + numrouted - direct;
+        directcost += direct;
+        if (direct > 0 && minus < direct) {
+            snapshot.sendMixMinus[i] = true;
+            minuscost += minus;
+        } else {
+            minuscost += direct;
+        }
+    }
+
+    if (minuscost >= directcost) {
+        // not worth summing the total
+        snapshot.sendMixMinus.assign(numpeers, false);
+        return;
+    }
+
+    for (size_t i=0; i < numpeers; ++i) {
+        if (!snapshot.sendMixMinus[i]) continue;
+        std::vector<bool> included (numpeers, false);
+        for (auto j : snapshot.sendSources[i]) {
+            included[(size_t) j] = true;
+        }
+        for (auto j : snapshot.routedSources) {
+            if (!included[(size_t) j]) {
+                snapshot.sendExclusions[i].add(j);
+            }
+        }
+    }
+}
+
+std::vector<std::pair<int,int>> SonobusAudioProcessor::getSendResampleKeys(const PeerSnapshot & snapshot)
+{
+    // per peer the samplerate and channel count it would take its send mix in
+    // from a shared resampler, or (0, 0) if its source resamples it itself
+    const int numpeers = snapshot.peers.size();
+    std::vector<std::pair<int,int>> keys ((size_t) numpeers, { 0, 0 });
+    const int devrate = (int) getSampleRate();
+    if (devrate <= 0) return keys;
+
+    for (int i=0; i < numpeers; ++i) {
+        auto * remote = snapshot.peers.getUnchecked(i);
+        // only the plain send mix is the same for everybody
+        const bool routed = i < (int) snapshot.sendSources.size() && !snapshot.sendSources[(size_t) i].isEmpty();
+        if (!remote->oursource || remote->sendLeader.load() || routed) continue;
+
+        aoo_format_storage f;
+        if (remote->oursource->get_format(f) <= 0 || f.header.samplerate == devrate) continue;
+
+        keys[(size_t) i] = { f.header.samplerate, remote->sendChannels };
+    }
+
+    // not worth it for a single source
+    std::vector<int> counts ((size_t) numpeers, 0);
+    for (size_t i=0; i < keys.size(); ++i) {
+        counts[i] = (int) std::count(keys.begin(), keys.end(), keys[i]);
+    }
+    for (size_t i=0; i < keys.size(); ++i) {
+        if (counts[i] < 2) keys[i] = { 0, 0 };
+    }
+    return keys;
+}
+
+void SonobusAudioProcessor::setupSendResampling(PeerSnapshot & snapshot, const PeerSnapshot * oldsnapshot)
+{
+    // called with the routing lock held
+    const auto keys = getSendResampleKeys(snapshot);
+    const double devrate = getSampleRate();
+    const int maxblock = currSamplesPerBlock;
+
+    auto matches = [&] (const SonoAudio::SendResampler & resampler, const std::pair<int,int> & key) {
+        return resampler.getOutputRate() == key.first && resampler.getNumChannels() == key.second
+            && resampler.getInputRate() == devrate && resampler.getMaxBlockSize() == maxblock;
+    };
+
+    snapshot.sendResampler.assign(keys.size(), -1);
+
+    for (size_t i=0; i < keys.size(); ++i) {
+        if (keys[i].first <= 0) continue;
+
+        int index = -1;
+        for (size_t k=0; k < snapshot.sendResamplers.size() && index < 0; ++k) {
+            if (matches(*snapshot.sendResamplers[k], keys[i])) index = (int) k;
+        }
+
+        if (index < 0) {
+            // keep going with the one from before, if it's still the same conversion
+            std::shared_ptr<SonoAudio::SendResampler> resampler;
+            if (oldsnapshot) {
+                for (auto & old : oldsnapshot->sendResamplers) {
+                    if (matches(*old, keys[i])) resampler = old;
+                }
+            }
+            if (!resampler) {
+                resampler = std::make_shared<SonoAudio::SendResampler>(keys[i].second, devrate, (double) keys[i].first, maxblock);
+                DBG("Shared send resampler to " << keys[i].first << " Hz for " << keys[i].second << " channels");
+            }
+            snapshot.sendResamplers.push_back(std::move(resampler));
+            index = (int) snapshot.sendResamplers.size() - 1;
+        }
+
+        snapshot.sendResampler[i] = index;
+    }
+}
+
+bool SonobusAudioProcessor::needsSendResamplingUpdate()
+{
+    // called with the core lock held, the routing lock keeps the snapshot from being replaced
+    const ScopedLock rl (mRoutingLock);
+
+    const auto * snapshot = mPeerSnapshot.load();
+    if (!snapshot) return false;
+
+    const auto keys = getSendResampleKeys(*snapshot);
+    const double devrate = getSampleRate();
+
+    for (size_t i=0; i < keys.size(); ++i) {
+        const int index = i < snapshot->sendResampler.size() ? snapshot->sendResampler[i] : -1;
+        if (index < 0) {
+            if (keys[i].first > 0) return true;
+            continue;
+        }
+        const auto & resampler = *snapshot->sendResamplers[(size_t) index];
+        if (resampler.getOutputRate() != keys[i].first || resampler.getNumChannels() != keys[i].second
+            || resampler.getInputRate() != devrate || resampler.getMaxBlockSize() != currSamplesPerBlock) {
+            return true;
+        }
     }
-    
-    return didremove;
-    
+    return false;
 }
 
-bool SonobusAudioProcessor::isAnythingRoutedToPeer(int index) const
+void SonobusAudioProcessor::waitForAudioSnapshotRelease()
 {
-    bool ret = false;
-
-    for (int i=0; i < mRemotePeers.size(); ++i) {
-        if (mRemoteSendMatrix[i][index]) {
-            ret = true;
-            break;
+    // grace period, at most one audio block
+    const uint32_t epoch = mAudioSnapshotEpoch.load();
+    if (epoch & 1) {
+        while (mAudioSnapshotEpoch.load() == epoch) {
+            Thread::yield();
         }
     }
+}
 
-    return ret;
+bool SonobusAudioProcessor::isAnythingRoutedToPeer(int index) const
+{
+    // assumed corelock (read) already held
+    if (index < 0 || index >= mRemotePeers.size()) return false;
+
+    const ScopedLock rl (mRoutingLock);
+    return !getSendSourceSlots(mRemotePeers.getUnchecked(index)->slot).isEmpty();
 }
 
 
@@ -5967,6 +13296,16 @@ bool SonobusAudioProcessor::formatInfoToAooFormat(const AudioCodecFormatInfo & i
 
             return true;
         } 
+        else if (info.codec == CodecLossless) {
+            aoo_format_lossless *fmt = (aoo_format_lossless *)&retformat;
+            fmt->header.codec = AOO_CODEC_LOSSLESS;
+            fmt->header.blocksize = currSamplesPerBlock >= info.min_preferred_blocksize ? currSamplesPerBlock : info.min_preferred_blocksize;
+            fmt->header.samplerate = getSampleRate();
+            fmt->header.nchannels = channels;
+            fmt->bitdepth = info.bitdepth == 3 ? AOO_LOSSLESS_INT24 : AOO_LOSSLESS_INT16;
+
+            return true;
+        }
         else if (info.codec == CodecOpus) {
             aoo_format_opus *fmt = (aoo_format_opus *)&retformat;
             fmt->header.codec = AOO_CODEC_OPUS;
@@ -5978,6 +13317,7 @@ bool SonobusAudioProcessor::formatInfoToAooFormat(const AudioCodecFormatInfo & i
             fmt->signal_type = info.signal_type;
             fmt->application_type = OPUS_APPLICATION_RESTRICTED_LOWDELAY;
             //fmt->application_type = OPUS_APPLICATION_AUDIO;
+            fmt->coupled = 0;
             
             return true;
         }
@@ -5989,16 +13329,76 @@ bool SonobusAudioProcessor::formatInfoToAooFormat(const AudioCodecFormatInfo & i
 void SonobusAudioProcessor::setupSourceFormat(SonobusAudioProcessor::RemotePeer * peer, aoo::isource * source, bool latencymode)
 {
     // have choice and parameters
-    int formatIndex = (!peer || peer->formatIndex < 0) ? mDefaultAudioFormatIndex : peer->formatIndex;
-    if (formatIndex < 0 || formatIndex >= mAudioFormats.size()) formatIndex = 4; //emergency default
+    int formatIndex = getEffectiveSendFormatIndex(peer);
     const AudioCodecFormatInfo & info =  mAudioFormats.getReference(formatIndex);
     
     aoo_format_storage f;
-    int channels = latencymode ? 1  :  peer ? peer->sendChannels : getMainBusNumInputChannels();
+    int channels = latencymode ? 1  :  peer ? (source == peer->oursource.get() ? peer->encodeSendChannels() : peer->sendChannels) : getMainBusNumInputChannels();
     
-    if (formatInfoToAooFormat(info, channels, f)) {        
-        source->set_format(f.header);        
+    if (peer && source == peer->oursource.get()) {
+        peer->sendCoupledChannels = getSendCoupledChannels(peer);
+    }
+
+    if (peer && source == peer->oursource.get()) {
+        peer->inlineSendable = info.codec == CodecPCM || info.codec == CodecOpus;
+    }
+
+    if (formatInfoToAooFormat(info, channels, f)) {
+        if (peer && source == peer->oursource.get()) {
+            // resampled once here if our device isn't at the session rate, see updateSessionStreamRate().
+            // The latency test stays at ours, Opus picks a rate of its own if that isn't one of its
+            f.header.samplerate = getSessionStreamRate();
+        }
+        if (peer && source == peer->oursource.get() && info.codec == CodecOpus) {
+            if (peer->adaptedFrameMs > 0.0f) {
+                // longer frames for a far away peer, see updateSendFrameSize()
+                f.header.blocksize = jmax(f.header.blocksize, roundToInt(peer->adaptedFrameMs * 1e-3 * f.header.samplerate));
+            }
+            ((aoo_format_opus *)&f)->coupled = peer->sendCoupledChannels;
+        }
+        source->set_format(f.header);
+    }
+
+    if (peer && source == peer->oursource.get()) {
+        // starts over at the bitrate of the new format
+        resetSendRateControl(peer);
+    }
+}
+
+int32_t SonobusAudioProcessor::getSendCoupledChannels(RemotePeer * peer)
+{
+    // only if their sink can decode them
+    if (!(peer->remoteSinkFlags & AOO_PROTOCOL_FLAG_OPUS_COUPLED)) {
+        return 0;
+    }
+
+    // every stereo group within what we encode for them
+    const int onset = peer->encodeSendOnset();
+    const int channels = peer->encodeSendChannels();
+    int32_t coupled = 0;
+
+    ValueTree fmttree = getSendUserFormatLayoutTree();
+    for (auto child : fmttree) {
+        ChannelGroupParams grp;
+        grp.setFromChannelLayoutValueTree(child);
+        const int start = grp.chanStartIndex - onset;
+        if (grp.numChannels == 2 && start >= 0 && start + 1 < channels && start < 32) {
+            coupled |= (int32_t) (1u << start);
+        }
+    }
+
+    return coupled;
+}
+
+void SonobusAudioProcessor::updateSendCoupledChannels(RemotePeer * peer)
+{
+    // assumed corelock already held
+    if (!peer->oursource || getSendCoupledChannels(peer) == peer->sendCoupledChannels) {
+        return;
     }
+
+    ungroupSharedSend(peer);
+    setupRemotePeerOurSource(peer);
 }
 
 ValueTree SonobusAudioProcessor::getSendUserFormatLayoutTree()
@@ -6096,7 +13496,10 @@ void SonobusAudioProcessor::updateRemotePeerUserFormat(int index, RemotePeer * o
         }
 
         DBG("Sending channellayout message to " << i);
-        this->sendPeerMessage(peer, msg.Data(), (int32_t) msg.Size());
+        this->sendPeerMessage(peer, msg.Data(), (int32_t) msg.Size(), SendLaneControl);
+
+        // the stereo groups might not be the same anymore
+        updateSendCoupledChannels(peer);
 
         if (onlypeer && onlypeer == peer) break;
         if (index >= 0 && index == i) break;
@@ -6218,6 +13621,7 @@ void SonobusAudioProcessor::parameterChanged (const String &parameterID, float n
     }
     else if (parameterID == paramMetTempo) {
         mMetTempo = newValue;
+        updateMetSessionTempo(newValue);
     }
     else if (parameterID == paramMetEnabled) {
         mMetEnabled = newValue > 0;
@@ -6259,6 +13663,8 @@ void SonobusAudioProcessor::parameterChanged (const String &parameterID, float n
         mZitaControl.setParamValue("/Zita_Rev1/Decay_Times_in_Bands_(see_tooltips)/Low_RT60", jlimit(1.0f, 8.0f, mMainReverbSize.get() * 7.0f + 1.0f));
         mZitaControl.setParamValue("/Zita_Rev1/Decay_Times_in_Bands_(see_tooltips)/Mid_RT60", jlimit(1.0f, 8.0f, mMainReverbSize.get() * 7.0f + 1.0f));
 
+        mFdnReverb.setSize(mMainReverbSize.get());
+
         //mMainReverb->setParameters(mMainReverbParams);
     }
     else if (parameterID == paramMainReverbLevel)
@@ -6270,6 +13676,7 @@ void SonobusAudioProcessor::parameterChanged (const String &parameterID, float n
 
         //mZitaControl.setParamValue("/Zita_Rev1/Output/Level", jlimit(-70.0f, 40.0f, Decibels::gainToDecibels(mMainReverbLevel.get()) + 0.0f));
         mZitaControl.setParamValue("/Zita_Rev1/Output/Level", jlimit(-70.0f, 40.0f, Decibels::gainToDecibels(mMainReverbLevel.get()) + 6.0f));
+        mFdnReverb.setLevel(jmap(mMainReverbLevel.get(), 0.0f, 0.8f));
         //mMainReverb->setParameters(mMainReverbParams);
     }
     else if (parameterID == paramMainReverbDamping)
@@ -6278,8 +13685,9 @@ void SonobusAudioProcessor::parameterChanged (const String &parameterID, float n
         mMainReverbParams.damping = mMainReverbDamping.get();
         mReverbParamsChanged = true;
         mZitaControl.setParamValue("/Zita_Rev1/Decay_Times_in_Bands_(see_tooltips)/HF_Damping",                                    
-                                   jmap(mMainReverbDamping.get(), 23520.0f, 1500.0f));
+                                   getZitaDampingFreq());
         mMReverb.setParameter(MVerbFloat::DAMPINGFREQ, jmap(mMainReverbDamping.get(), 0.0f, 0.85f));                
+        mFdnReverb.setDamping(mMainReverbDamping.get());
 
     }
     else if (parameterID == paramMainReverbPreDelay)
@@ -6288,6 +13696,7 @@ void SonobusAudioProcessor::parameterChanged (const String &parameterID, float n
         mZitaControl.setParamValue("/Zita_Rev1/Input/In_Delay",                                    
                                    jlimit(0.0f, 100.0f, mMainReverbPreDelay.get()));      
         mMReverb.setParameter(MVerbFloat::PREDELAY, jmap(mMainReverbPreDelay.get(), 0.0f, 100.0f, 0.0f, 0.5f)); // takes 0->1  where = 200ms
+        mFdnReverb.setPreDelayMs(mMainReverbPreDelay.get());
 
     }
     else if (parameterID == paramMainReverbEnabled) {
@@ -6324,6 +13733,7 @@ void SonobusAudioProcessor::parameterChanged (const String &parameterID, float n
 
     else if (parameterID == paramSendFileAudio) {
         mSendPlaybackAudio = newValue > 0;
+        mTransportSource.sendChangeMessage(); // direct file streaming follows it
 
 #if 0
         if (mTransportSource.isPlaying() && mSendPlaybackAudio.get()) {
@@ -6536,30 +13946,42 @@ void SonobusAudioProcessor::changeProgramName (int index, const String& newName)
 {
 }
 
-//==============================================================================
-void SonobusAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
+int SonobusAudioProcessor::alignProcessQuantum(int quantum, int blockSize)
 {
-    // Use this method as the place to do any pre-playback
-    // initialisation that you need..
-    bool blocksizechanged = lastSamplesPerBlock != samplesPerBlock;
+    if (quantum <= 0 || blockSize <= 0) return quantum;
+    if (quantum % blockSize == 0 || blockSize % quantum == 0) return quantum;
 
-    int inchannels =  getTotalNumInputChannels(); // getMainBusNumInputChannels();
-    int outchannels = getMainBusNumOutputChannels();
+    // a whole number of device blocks, as many as fit
+    if (blockSize < quantum) {
+        return (quantum / blockSize) * blockSize;
+    }
 
+    // or the largest even split of one that isn't bigger than asked for
+    for (int q = quantum; q >= 16; --q) {
+        if (blockSize % q == 0) return q;
+    }
+    return blockSize;
+}
 
-    lastSamplesPerBlock = currSamplesPerBlock = samplesPerBlock;
+void SonobusAudioProcessor::prepareReverbs(double sampleRate, int samplesPerBlock)
+{
+    // the audio thread skips the reverbs while they are set up
+    const ScopedLock rsl (mReverbRateLock);
 
-    DBG("Prepare to play: SR " <<  sampleRate << "  prevrate: " << mPrevSampleRate <<  "  blocksize: " <<  samplesPerBlock << "  totinch: " << getTotalNumInputChannels() << "  mbinch: " << getMainBusNumInputChannels() << "  outch: " << getMainBusNumOutputChannels());
-    DBG("  numinbuses: " << getBusCount(true) << "  numoutbuses: " << getBusCount(false));
+    // the reverbs themselves run at a lower rate if asked to, see setReverbRateReduction()
+    const int factor = getReverbDecimationFactor(sampleRate);
+    mMainReverbDecimator.prepare(sampleRate, samplesPerBlock, factor);
+    mInputReverbDecimator.prepare(sampleRate, samplesPerBlock, factor);
+    const double revrate = mMainReverbDecimator.getReverbSampleRate();
 
-    const ScopedReadLock sl (mCoreLock);        
-    
-    mMetronome->setSampleRate(sampleRate);
-    mMainReverb->setSampleRate(sampleRate);
-    mMReverb.setSampleRate(sampleRate);
-    mInputReverb.setSampleRate(sampleRate);
+    mMainReverb->setSampleRate(revrate);
+    mMReverb.setSampleRate(revrate);
+    mInputReverb.setSampleRate(revrate);
+    // longer than the pre-delay and the longest delay line of any of the models
+    mMainReverbTail.prepare(sampleRate, 0.5);
+    mInputReverbTail.prepare(sampleRate, 0.5);
 
-    mZitaReverb.init(sampleRate);
+    mZitaReverb.init((int) revrate);
     mZitaReverb.buildUserInterface(&mZitaControl);
 
     //DBG("Zita Reverb Params:");
@@ -6573,14 +13995,14 @@ void SonobusAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBloc
     mZitaControl.setParamValue("/Zita_Rev1/Decay_Times_in_Bands_(see_tooltips)/Mid_RT60", jlimit(1.0f, 8.0f, mMainReverbSize.get() * 7.0f + 1.0f));
     mZitaControl.setParamValue("/Zita_Rev1/Output/Level", jlimit(-70.0f, 40.0f, Decibels::gainToDecibels(mMainReverbLevel.get()) + 6.0f));
     mZitaControl.setParamValue("/Zita_Rev1/Decay_Times_in_Bands_(see_tooltips)/HF_Damping",                                    
-                               jmap(mMainReverbDamping.get(), 23520.0f, 1500.0f));
-
-
-    //
+                               getZitaDampingFreq());
 
+    mFdnReverb.setSampleRate(revrate);
+    mFdnReverb.setSize(mMainReverbSize.get());
+    mFdnReverb.setDamping(mMainReverbDamping.get());
+    mFdnReverb.setLevel(jmap(mMainReverbLevel.get(), 0.0f, 0.8f));
+    mFdnReverb.setPreDelayMs(mMainReverbPreDelay.get());
 
-
-    
     mMReverb.setParameter(MVerbFloat::MIX, 1.0f); // full wet
     mMReverb.setParameter(MVerbFloat::GAIN, jmap(mMainReverbLevel.get(), 0.0f, 0.8f)); 
     mMReverb.setParameter(MVerbFloat::SIZE, jmap(mMainReverbSize.get(), 0.45f, 0.95f)); 
@@ -6607,12 +14029,81 @@ void SonobusAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBloc
     
     mMainReverbParams.roomSize = jmap(mMainReverbSize.get(), 0.55f, 1.0f);
     mMainReverb->setParameters(mMainReverbParams);
+}
+
+int SonobusAudioProcessor::getReverbDecimationFactor(double sampleRate) const
+{
+    int factor = 1;
+    if (mReverbRateReduction.load() == ReverbRateQuarter) factor = 4;
+    else if (mReverbRateReduction.load() == ReverbRateHalf) factor = 2;
+
+    // never below 22 kHz, at 48 kHz a quarter is a half
+    while (factor > 1 && sampleRate / factor < 22000.0) {
+        factor /= 2;
+    }
+    return factor;
+}
+
+float SonobusAudioProcessor::getZitaDampingFreq() const
+{
+    // it goes up to 23.5 kHz, which is past what a reduced rate can hold
+    return jmin(jmap(mMainReverbDamping.get(), 23520.0f, 1500.0f), (float) (0.45 * mMainReverbDecimator.getReverbSampleRate()));
+}
+
+void SonobusAudioProcessor::setReverbRateReduction(ReverbRateReduction mode)
+{
+    mode = jlimit(ReverbRateFull, ReverbRateQuarter, mode);
+    if (mReverbRateReduction.exchange(mode) == mode) return;
+
+    if (getSampleRate() > 0.0) {
+        prepareReverbs(getSampleRate(), currSamplesPerBlock);
+    }
+}
+
+//==============================================================================
+void SonobusAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
+{
+    // Use this method as the place to do any pre-playback
+    // initialisation that you need..
+
+    const int hostSamplesPerBlock = samplesPerBlock;
+    mActiveProcessQuantum = alignProcessQuantum(mProcessQuantum.load(), hostSamplesPerBlock);
+    if (mActiveProcessQuantum > 0) {
+        // everything past the fifo only ever sees the quantum
+        samplesPerBlock = mActiveProcessQuantum;
+        const int fifochans = jmax(getTotalNumInputChannels(), getTotalNumOutputChannels());
+        mQuantumInput.setSize(fifochans, mActiveProcessQuantum);
+        mQuantumOutput.setSize(fifochans, mActiveProcessQuantum);
+        mQuantumInput.clear();
+        mQuantumOutput.clear();
+        mQuantumFill = 0;
+    }
+    setLatencySamples(mActiveProcessQuantum);
+
+    bool blocksizechanged = lastSamplesPerBlock != samplesPerBlock;
+
+    int inchannels =  getTotalNumInputChannels(); // getMainBusNumInputChannels();
+    int outchannels = getMainBusNumOutputChannels();
+
+
+    lastSamplesPerBlock = currSamplesPerBlock = samplesPerBlock;
+
+    DBG("Prepare to play: SR " <<  sampleRate << "  prevrate: " << mPrevSampleRate <<  "  blocksize: " <<  samplesPerBlock << "  hostblocksize: " << hostSamplesPerBlock << "  totinch: " << getTotalNumInputChannels() << "  mbinch: " << getMainBusNumInputChannels() << "  outch: " << getMainBusNumOutputChannels());
+    DBG("  numinbuses: " << getBusCount(true) << "  numoutbuses: " << getBusCount(false));
+
+    const ScopedReadLock sl (mCoreLock);        
+    
+    mMetronome->setSampleRate(sampleRate);
+    prepareReverbs(sampleRate, samplesPerBlock);
 
 
 
     mTransportSource.prepareToPlay(currSamplesPerBlock, getSampleRate());
+    mBackingTrackPlayer->prepare(getSampleRate(), currSamplesPerBlock);
 
     //mAooSource->set_format(fmt->header);
+    mAooClock->setup(sampleRate, samplesPerBlock, AOO_TIMEFILTER_BANDWIDTH);
+
     setupSourceFormat(0, mAooDummySource.get());
     mAooDummySource->setup(sampleRate, samplesPerBlock, getTotalNumInputChannels());
 
@@ -6648,6 +14139,15 @@ void SonobusAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBloc
     mInputChannelGroupCount = jmin(MAX_CHANGROUPS, mInputChannelGroupCount);
 
 
+    mMonitorDelayArena.prepare(sampleRate, samplesPerBlock);
+
+    // hosts prepare again for an offline bounce, what was captured is only
+    // thrown away if it doesn't fit anymore
+    if (!JUCEApplicationBase::isStandaloneApp()
+        && (!mBounceCapture || mBounceCapture->getSampleRate() != sampleRate || mBounceCapture->getNumChannels() != jmax(1, outchannels))) {
+        mBounceCapture = std::make_unique<SonoAudio::BounceCapture>(sampleRate, outchannels);
+    }
+
     for (int i=0; /*i < mInputChannelGroupCount && */ i < MAX_CHANGROUPS; ++i) {
         mInputChannelGroups[i].init(sampleRate);
     }
@@ -6686,6 +14186,7 @@ void SonobusAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBloc
 
     
     ensureBuffers(samplesPerBlock);
+    reserveBuffers(samplesPerBlock);
 
 
     mMetChannelGroup.init(sampleRate);
@@ -6725,6 +14226,11 @@ void SonobusAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBloc
 void SonobusAudioProcessor::setupSourceFormatsForAll()
 {
     const ScopedReadLock sl (mCoreLock);
+
+    // everybody gets set up with their own format, group them again afterwards
+    for (auto * s : mRemotePeers) {
+        ungroupSharedSend(s);
+    }
     //const ScopedLock slformat (mSourceFormatLock);
 
     double sampleRate = getSampleRate();
@@ -6743,10 +14249,9 @@ void SonobusAudioProcessor::setupSourceFormatsForAll()
         }
 
         if (s->oursource) {
-            setupSourceFormat(s, s->oursource.get());
+            setupRemotePeerOurSource(s);  // todo use inchannels maybe?
             //setupSourceUserFormat(s, s->oursource.get());
 
-            s->oursource->setup(sampleRate, currSamplesPerBlock, s->sendChannels);  // todo use inchannels maybe?
             float sendbufsize = jmax(10.0, SENDBUFSIZE_SCALAR * 1000.0f * currSamplesPerBlock / getSampleRate());
             s->oursource->set_buffersize(sendbufsize);
 
@@ -6757,7 +14262,9 @@ void SonobusAudioProcessor::setupSourceFormatsForAll()
             s->oursink->setup(sampleRate, currSamplesPerBlock, sinkchan);
         }
 
-        if (s->latencysource) {
+        s->netBufAutoBaseline = (1e3*currSamplesPerBlock/getSampleRate()); // at least a process block
+
+        if (s->latencyTestReady) {
             setupSourceFormat(s, s->latencysource.get(), true);
             s->latencysource->setup(getSampleRate(), currSamplesPerBlock, 1);
             setupSourceFormat(s, s->echosource.get(), true);
@@ -6765,8 +14272,6 @@ void SonobusAudioProcessor::setupSourceFormatsForAll()
             float sendbufsize = jmax(10.0, SENDBUFSIZE_SCALAR * 1000.0f * currSamplesPerBlock / getSampleRate());
             s->echosource->set_buffersize(sendbufsize);
 
-            s->netBufAutoBaseline = (1e3*currSamplesPerBlock/getSampleRate()); // at least a process block
-
             {
                 const ScopedWriteLock sl (s->sinkLock);
 
@@ -6782,9 +14287,12 @@ void SonobusAudioProcessor::setupSourceFormatsForAll()
         //s->sendMeterSource.resize (s->sendChannels, meterRmsWindow);
 
         // XXX
-        for (auto chgrpi = 0; /*chgrpi < s->numChanGroups && */ chgrpi < MAX_CHANGROUPS; ++chgrpi) {
-            s->chanGroups[chgrpi].init(sampleRate);
-        };
+        {
+            const ScopedLock fl (mPeerFxLock);
+            for (auto chgrpi = 0; /*chgrpi < s->numChanGroups && */ chgrpi < MAX_CHANGROUPS && !s->remoteListener.load(); ++chgrpi) {
+                s->chanGroups[chgrpi].init(sampleRate);
+            };
+        }
 
         // for now the first channel group has them all
         //s->chanGroups[0].init(sampleRate);
@@ -6912,6 +14420,9 @@ void SonobusAudioProcessor::ensureBuffers(int numSamples)
     if (sendWorkBuffer.getNumSamples() < numSamples || sendWorkBuffer.getNumChannels() != maxworkbufchans) {
         sendWorkBuffer.setSize(maxworkbufchans, numSamples, false, false, true);
     }
+    if (sendMixTotalBuffer.getNumSamples() < numSamples || sendMixTotalBuffer.getNumChannels() < workBuffer.getNumChannels()) {
+        sendMixTotalBuffer.setSize(workBuffer.getNumChannels(), numSamples, false, false, true);
+    }
     if (inputPostBuffer.getNumSamples() < numSamples || inputPostBuffer.getNumChannels() != totsendchans) {
         inputPostBuffer.setSize(totsendchans, numSamples, false, false, true);
         inputPreBuffer.setSize(totsendchans, numSamples, false, false, true);
@@ -6928,28 +14439,357 @@ void SonobusAudioProcessor::ensureBuffers(int numSamples)
     if (inputRevBuffer.getNumSamples() < numSamples || inputRevBuffer.getNumChannels() != maxchans) {
         inputRevBuffer.setSize(maxchans, numSamples, false, false, true);
     }
+    if (mPeerRenderPool && (inputGroupRevBuffer.getNumSamples() < numSamples || inputGroupRevBuffer.getNumChannels() != 2 * MAX_CHANGROUPS)) {
+        // only with the pool, where the input groups may run in parallel
+        inputGroupRevBuffer.setSize(2 * MAX_CHANGROUPS, numSamples, false, false, true);
+    }
     if (silentBuffer.getNumSamples() < numSamples) {
         silentBuffer.setSize(1, numSamples, false, false, true);
         silentBuffer.clear();
     }
 
     if (needpeersendupdate) {
-        const ScopedReadLock sl (mCoreLock);
-        // could be -1 as index meaning all remote peers
-        for (int i=0; i < mRemotePeers.size(); ++i) {
-            RemotePeer * remote = mRemotePeers.getUnchecked(i);
-            updateRemotePeerSendChannels(i, remote);
-        }
+        // this may be the audio thread, setting up the sources is left to the event thread
+        mPeerSendUpdatePending = true;
+        notifyEventThread();
     }
 
     mTempBufferSamples = jmax(mTempBufferSamples, numSamples);
     mTempBufferChannels = jmax(maxchans, mTempBufferChannels);
 }
 
+static void reserveBufferSpace(AudioSampleBuffer & buffer, int numChannels, int numSamples)
+{
+    // allocate for the larger size, then go back to the current layout keeping the allocation
+    const int chans = buffer.getNumChannels();
+    const int samps = buffer.getNumSamples();
+    buffer.setSize(jmax(chans, numChannels), jmax(samps, numSamples), false, false, true);
+    buffer.setSize(chans, samps, false, false, true);
+}
+
+void SonobusAudioProcessor::reserveBuffers(int numSamples)
+{
+    // the send side can grow at any time, when input groups, the metronome or
+    // file playback get added. With the room already there, ensureBuffers() on
+    // the audio thread only lays the buffers out again.
+    auto maxchans = jmax(2, jmax(getTotalNumOutputChannels(), getTotalNumInputChannels()));
+    auto maxfilechans = jmax(maxchans, MAX_CHANNELS);
+    auto maxsendchans = jmax(maxchans, jmax(MAX_CHANNELS, getTotalNumInputChannels()) + 1 + MAX_CHANNELS);
+    numSamples = jmax(1024, numSamples);
+
+    for (auto * buffer : { &workBuffer, &sendWorkBuffer, &sendMixTotalBuffer, &inputPostBuffer, &inputPreBuffer }) {
+        reserveBufferSpace(*buffer, maxsendchans, numSamples);
+    }
+    reserveBufferSpace(fileBuffer, maxfilechans, numSamples);
+
+    for (auto * buffer : { &tempBuffer, &mixBuffer, &inputBuffer, &monitorBuffer, &metBuffer, &mainFxBuffer, &inputRevBuffer }) {
+        reserveBufferSpace(*buffer, maxchans, numSamples);
+    }
+    reserveBufferSpace(silentBuffer, 1, numSamples);
+    silentBuffer.clear();
+
+    if (mPeerRenderPool) {
+        mPeerRenderPool->reserve(maxchans, numSamples);
+        reserveBufferSpace(inputGroupRevBuffer, 2 * MAX_CHANGROUPS, numSamples);
+    }
+}
+
+
+void SonobusAudioProcessor::addCrossRoutedSend(AudioSampleBuffer & dest, int sendchans, const RemotePeer * crossremote, int numSamples, float sign)
+{
+    // what a peer routed to another contributes to that one's send mix,
+    // panned if the destination is stereo. A sign of -1 takes it out again.
+    for (int channel = 0; channel < sendchans; ++channel) {
+
+        // now apply panning
+
+        if (crossremote->recvChannels > 0 && sendchans > 1) {
+            for (int ch=0; ch < crossremote->recvChannels; ++ch) {
+                const float pan = crossremote->recvChannels == 2 ? crossremote->recvStereoPan[ch] : crossremote->recvPan[ch];
+                const float lastpan = crossremote->recvPanLast[ch];
+
+                // apply pan law
+                // -1 is left, 1 is right
+                float pgain = channel == 0 ? (pan >= 0.0f ? (1.0f - pan) : 1.0f) : (pan >= 0.0f ? 1.0f : (1.0f+pan)) ;
+
+                if (pan != lastpan) {
+                    float plastgain = channel == 0 ? (lastpan >= 0.0f ? (1.0f - lastpan) : 1.0f) : (lastpan >= 0.0f ? 1.0f : (1.0f+lastpan));
+
+                    dest.addFromWithRamp(channel, 0, crossremote->workBuffer.getReadPointer(ch), numSamples, sign * plastgain, sign * pgain);
+                } else {
+                    dest.addFrom (channel, 0, crossremote->workBuffer, ch, 0, numSamples, sign * pgain);
+                }
+            }
+        } else {
+            dest.addFrom(channel, 0, crossremote->workBuffer, channel, 0, numSamples, sign);
+        }
+    }
+}
+
+void SonobusAudioProcessor::renderRemotePeer(RemotePeer * remote, int rindex, const PeerRenderContext & ctx)
+{
+    // pulls audio from the peer's sink, runs its channel group effects and pans it into
+    // ctx.mixBuffer/fxBuffer. On the peer render pool it goes into the scratch of the
+    // thread running it instead.
+
+    const int numSamples = ctx.numSamples;
+    const int mainBusOutputChannels = ctx.mainBusOutputChannels;
+    const int totalOutputChannels = ctx.totalOutputChannels;
+    auto * scratch = ctx.scratch;
+
+    remote->renderSinkTicks = 0;
+    remote->renderFxTicks = 0;
+
+    if (!remote->oursink || remote->remoteListener.load()) {
+        return;
+    }
+
+    auto starttick = ProcessTimingTracker::now();
+
+    // just in case, should be exceedingly rare this is necessary
+    if (remote->workBuffer.getNumSamples() < currSamplesPerBlock
+        || remote->recvChannels > remote->workBuffer.getNumChannels()
+        || mainBusOutputChannels > remote->workBuffer.getNumChannels()) {
+        remote->workBuffer.setSize(jmax(2, jmax(mainBusOutputChannels, remote->recvChannels)), currSamplesPerBlock, false, false, true);
+    }
+
+    // calculate fill ratio before processing the sink
+    float retratio = 0.0f;
+    if (remote->oursink->get_sourceoption(remote->endpoint, remote->remoteSourceId, aoo_opt_buffer_fill_ratio, &retratio, sizeof(retratio)) > 0) {
+        remote->fillRatio.Z *= 0.95;
+        remote->fillRatio.push(retratio);
+        remote->fillRatioSlow.Z *= 0.99;
+        remote->fillRatioSlow.push(retratio);
+    }
+
+    // with its own output bus (plugin multi-output), the sink writes the channels
+    // the bus takes straight into it, instead of them getting copied over afterwards
+    int userbusindex = 0;
+    int userbuschans = 0;
+    if (remote->recvActive && remote->recvChannels > 0 && remote->workBuffer.getNumChannels() <= MAX_PANNERS) {
+        if (auto userbus = getBus(false, OutUserBaseBusIndex + rindex)) {
+            if (userbus->isEnabled()) {
+                userbusindex = getChannelIndexInProcessBlockBuffer(false, OutUserBaseBusIndex + rindex, 0);
+                userbuschans = jmin(remote->recvChannels, getChannelCountOfBus(false, OutUserBaseBusIndex + rindex),
+                                    jmax(0, ctx.numOutChannels - userbusindex));
+            }
+        }
+    }
+
+    // nothing playing, or only silence, leaves the cleared workbuffer as it is
+    bool sinkSilent = true;
+
+    {
+        // get audio data coming in from outside into tempbuf
+        const ScopedReadLock sl (remote->sinkLock); // not contended, should be able to get rid of
+
+        float * sinkbufs[MAX_PANNERS];
+        float ** sinkdest = remote->workBuffer.getArrayOfWritePointers();
+
+        if (userbuschans > 0) {
+            for (int i=0; i < remote->workBuffer.getNumChannels(); ++i) {
+                sinkbufs[i] = i < userbuschans ? ctx.outChannels[userbusindex + i] : sinkdest[i];
+            }
+            sinkdest = sinkbufs;
+        }
+
+        for (int i=userbuschans; i < remote->workBuffer.getNumChannels(); ++i) {
+            remote->workBuffer.clear(i, 0, numSamples);
+        }
+
+        sinkSilent = remote->oursink->process(sinkdest, numSamples, ctx.t) != 1;
+    }
+
+    // the bus keeps what came in, the effects below work on the workbuffer
+    for (int i=0; i < userbuschans; ++i) {
+        if (sinkSilent) {
+            FloatVectorOperations::clear(ctx.outChannels[userbusindex + i], numSamples);
+            remote->workBuffer.clear(i, 0, numSamples);
+        } else {
+            remote->workBuffer.copyFrom(i, 0, ctx.outChannels[userbusindex + i], numSamples);
+        }
+    }
+
+    auto sinktick = ProcessTimingTracker::now();
+    remote->renderSinkTicks = sinktick - starttick;
+
+    // the shared silent buffer gets scribbled on by some effects, so workers each use their own
+    auto & silentbuf = scratch ? scratch->getSilentBuffer(numSamples) : silentBuffer;
+
+    // record individual tracks pre-compressor/level/pan, ignoring muting/solo, raw material
+
+    if (ctx.recordPeers && remote->fileWriter)
+    {
+        float *tmpbuf[MAX_PANNERS];
+        int numchan = remote->fileWriter->getNumChannels();
+        for (int i = 0; i < numchan && i < MAX_PANNERS; ++i) {
+            if (i < remote->recvChannels) {
+                tmpbuf[i] = remote->workBuffer.getWritePointer(i);
+            }
+            else {
+                tmpbuf[i] = silentbuf.getWritePointer(0);
+            }
+        }
+        remote->fileWriter->write (tmpbuf, numSamples);
+    }
+
+    // apply effects
+
+    float usegain = remote->gain;
+    bool wasSilent = false;
+
+    // we get the stuff, but ignore it (either muted or others soloed)
+    if (!remote->recvActive || (ctx.anysoloed && !remote->soloed) || remote->resetSafetyMuted) {
+
+        usegain = 0.0f;
+
+        if (remote->_lastgain <= 0.0f) {
+            wasSilent = true;
+        }
+    }
+
+    bool anysubsolo = false;
+    for (auto cgi = 0; cgi < remote->numChanGroups; ++cgi) {
+        if (remote->chanGroups[cgi].params.soloed) {
+            anysubsolo = true;
+            break;
+        }
+    }
+
+    const bool bypassfx = ctx.shedPeerFx && remote->loadShedFx.load(std::memory_order_relaxed);
+    for (auto cgi = 0; cgi < remote->numChanGroups; ++cgi) {
+        remote->chanGroups[cgi].bypassFx = bypassfx;
+    }
+
+    // silent or muted groups leave their channels at zero
+    bool audible = false;
+    for (auto cgi = 0; cgi < remote->numChanGroups; ++cgi) {
+        if (remote->chanGroups[cgi].processBlock(remote->workBuffer, remote->workBuffer, remote->chanGroups[cgi].params.chanStartIndex,  remote->chanGroups[cgi].params.numChannels, silentbuf, numSamples, usegain, sinkSilent)) {
+            audible = true;
+        }
+    }
+
+    remote->_lastgain = usegain;
+
+
+    if (ctx.shedMeters) {
+        // leaves them where they were
+    }
+    else if (audible) {
+        remote->recvMeterSource.measureBlock (remote->workBuffer, 0, numSamples);
+    } else {
+        remote->recvMeterSource.measureSilence();
+    }
+
+    for (auto cgi = 0; cgi < remote->numChanGroups && !ctx.shedMeters; ++cgi) {
+        float redlev = 1.0f;
+        if (!bypassfx && remote->chanGroups[cgi].params.compressorParams.enabled && remote->chanGroups[cgi].compressorOutputLevel) {
+            redlev = jlimit(0.0f, 1.0f, Decibels::decibelsToGain(*remote->chanGroups[cgi].compressorOutputLevel));
+        }
+        for (auto j=0; j < remote->chanGroups[cgi].params.numChannels; ++j) {
+            int ch = remote->chanGroups[cgi].params.chanStartIndex + j;
+            remote->recvMeterSource.setReductionLevel(ch, redlev);
+        }
+    }
+
+    if (wasSilent || !audible) {
+        // can skip the rest, already fully muted/absent, or nothing but silence
+        remote->renderFxTicks = ProcessTimingTracker::now() - sinktick;
+        return;
+    }
+
+    float tgain = mainBusOutputChannels == 1 && remote->recvChannels > 0 ? 1.0f/(float)remote->recvChannels : 1.0f;
+    tgain *= usegain; // handles main solo
+
+    if (scratch) {
+        // only the range we pan into needs clearing and summing later
+        int mixstart = totalOutputChannels;
+        int mixend = 0;
+        for (auto i = 0; i < remote->numChanGroups; ++i) {
+            int dstch = remote->chanGroups[i].params.panDestStartIndex;
+            int dstcnt = jmin(totalOutputChannels, remote->chanGroups[i].params.panDestChannels);
+            mixstart = jmin(mixstart, dstch);
+            mixend = jmax(mixend, jmin(totalOutputChannels, dstch + dstcnt));
+        }
+
+        scratch->useMix(mixstart, mixend, totalOutputChannels, numSamples);
+        if (ctx.doreverb) {
+            scratch->useFx(ctx.fxchannels, numSamples);
+        }
+    }
+
+    auto & mixdest = scratch ? scratch->mixBuffer : *ctx.mixBuffer;
+    auto & fxdest = scratch ? scratch->fxBuffer : *ctx.fxBuffer;
+
+    for (auto i = 0; i < remote->numChanGroups; ++i)
+    {
+        // apply solo muting to the gain here
+        float adjgain = anysubsolo && !remote->chanGroups[i].params.soloed ? 0.0f : tgain;
+        // todo change dest ch target
+        int dstch = remote->chanGroups[i].params.panDestStartIndex;
+        int dstcnt = jmin(totalOutputChannels, remote->chanGroups[i].params.panDestChannels);
+        remote->chanGroups[i].processPan(remote->workBuffer, remote->chanGroups[i].params.chanStartIndex, mixdest, dstch, dstcnt, numSamples, adjgain);
+
+        if (ctx.doreverb) {
+            remote->chanGroups[i].processReverbSend(remote->workBuffer, remote->chanGroups[i].params.chanStartIndex, remote->chanGroups[i].params.numChannels, fxdest, 0, ctx.fxchannels, numSamples, ctx.mainReverbEnabled, false, adjgain);
+        }
+    }
+
+    remote->renderFxTicks = ProcessTimingTracker::now() - sinktick;
+}
+
+void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer& midiMessages)
+{
+    RealtimeSafetyChecker::ScopedRealtimeSection realtimeSection;
+    TraceRecorder::setThreadName("Audio");
+    TraceRecorder::Scope trace ("processBlock");
+
+    const int quantum = mActiveProcessQuantum;
+    if (quantum <= 0) {
+        processQuantum(buffer, midiMessages);
+        return;
+    }
+
+    // the host block goes into the input fifo and comes back out of the output
+    // one a quantum later, whenever the input is full a quantum gets processed
+    const int numChans = jmin(buffer.getNumChannels(), mQuantumInput.getNumChannels());
+    const int numSamples = buffer.getNumSamples();
+
+    for (int ch = numChans; ch < buffer.getNumChannels(); ++ch) {
+        buffer.clear(ch, 0, numSamples);
+    }
+
+    for (int done = 0; done < numSamples; ) {
+        const int count = jmin(numSamples - done, quantum - mQuantumFill);
+
+        for (int ch = 0; ch < numChans; ++ch) {
+            mQuantumInput.copyFrom(ch, mQuantumFill, buffer, ch, done, count);
+            buffer.copyFrom(ch, done, mQuantumOutput, ch, mQuantumFill, count);
+        }
+
+        done += count;
+        mQuantumFill += count;
+
+        if (mQuantumFill == quantum) {
+            processQuantum(mQuantumInput, midiMessages);
+            std::swap(mQuantumInput, mQuantumOutput);
+            mQuantumFill = 0;
+        }
+    }
+}
 
-void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer& midiMessages)
+void SonobusAudioProcessor::processQuantum (AudioBuffer<float>& buffer, MidiBuffer& midiMessages)
 {
     ScopedNoDenormals noDenormals;
+    mProcessTiming.beginBlock();
+
+    // what the load governor has us leave out this time around
+    const int shedlevel = mLoadShedding.load() ? mLoadGovernor.getLevel() : (int) LoadGovernor::LevelNone;
+    const bool shedreverb = shedlevel >= LoadGovernor::LevelReverb;
+    // until then the main reverb gets by with freeverb, the cheapest one
+    const int reverbmodel = shedlevel >= LoadGovernor::LevelReverbModel ? (int) ReverbModelFreeverb : mMainReverbModel.get();
+    // all but the output meter, that one is still needed to see clipping
+    const bool shedmeters = shedlevel >= LoadGovernor::LevelMeters;
     auto totalInputChannels  = getTotalNumInputChannels();
     auto mainBusInputChannels  = getMainBusNumInputChannels();
     auto mainBusOutputChannels = getMainBusNumOutputChannels();
@@ -6968,10 +14808,15 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
 
     int sendChans = mSendChannels.get();
     bool sendfileaudio = mSendPlaybackAudio.get();
+    // the peers play their own copy of it, see updateBackingTrackShare()
+    const bool backingtrackshared = sendfileaudio && mBackingTrackShared.load();
     bool sendmet = mSendMet.get();
 
     bool userwritingpossible = userWritingPossible.load();
     bool writingpossible = writingPossible.load();
+    const bool dubwriting = activeDoubleEnderWriter.load() != nullptr;
+    const bool broadcasting = activeBroadcastOutput.load() != nullptr;
+    const bool recordpre = (writingpossible || dubwriting) && mRecordInputPreFX;
 
     inGain = mMainInMute.get() ? 0.0f : inGain;
 
@@ -7018,6 +14863,7 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
     // THIS SHOULDN"T GENERALLY HAPPEN, it should have been taken care of in prepareToPlay, but just in case.
     // I know this isn't RT safe. UGLY... bad... badness.
     if (numSamples > mTempBufferSamples || maxchans > mTempBufferChannels || inputPostBuffer.getNumChannels() != totsendchans || inputPostBuffer.getNumSamples() < numSamples  || sendMeterSource.getNumChannels() < realsendchans) {
+        RealtimeSafetyChecker::ScopedAllowance allowance("ensureBuffers in processBlock");
         ensureBuffers(numSamples);
     }
     
@@ -7037,6 +14883,12 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
         posInfo.bpm = mMetTempo.get();
     }
 
+    // an offline bounce plays the peers back from the capture instead of the network,
+    // see getOfflineBounceCapture()
+    const bool bouncecapture = mBounceCapture && mOfflineBounceCapture.load();
+    const bool offlinebounce = bouncecapture && isNonRealtime();
+    const bool capturebounce = bouncecapture && !offlinebounce && hostPlaying && posInfo.timeInSamples >= 0;
+
     if (syncmethost) {
         if (posValid && fabs(posInfo.bpm - mMetTempo.get()) > 0.001) {
             mMetTempo = posInfo.bpm;
@@ -7070,18 +14922,24 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
 
 
     uint64_t t = aoo_osctime_get();
+    // once for every source and sink processed below
+    mAooClock->update(t);
+
+    mProcessTiming.lap(ProcessTimingTracker::StageSetup);
 
     // meter input pre everything
-    inputMeterSource.measureBlock (buffer, 0, numSamples);
+    if (!shedmeters) {
+        inputMeterSource.measureBlock (buffer, 0, numSamples);
+    }
 
 
     inputPostBuffer.clear(0, numSamples);
-    if (writingpossible && mRecordInputPreFX) {
+    if (recordpre) {
         inputPreBuffer.clear(0, numSamples);
     }
 
     bool inReverbEnabled = false;
-    for (auto i = 0; i < mInputChannelGroupCount && i < MAX_CHANGROUPS; ++i)
+    for (auto i = 0; i < mInputChannelGroupCount && i < MAX_CHANGROUPS && !shedreverb; ++i)
     {
         if (mInputChannelGroups[i].params.inReverbSend > 0.0f) {
             inReverbEnabled = true;
@@ -7098,15 +14956,77 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
 
 
     // Input Gain and FX processing
+    const int numinputgroups = jmin(mInputChannelGroupCount, (int) MAX_CHANGROUPS);
+
+    // with effects on more than one group they go on the render pool. Each group only
+    // writes its own channels, except for the reverb send, which goes into a pair of
+    // channels of its own and gets summed in group order after, so the mix comes out
+    // the same however the groups were spread over the threads
+    int fxinputgroups = 0;
+    for (auto i = 0; i < numinputgroups; ++i) {
+        const auto & params = mInputChannelGroups[i].params;
+        if (mInputChannelGroups[i].bypassFx) continue;
+        if (params.compressorParams.enabled || params.expanderParams.enabled || params.eqParams.enabled || params.limiterParams.enabled) {
+            ++fxinputgroups;
+        }
+    }
+    const bool parallelinput = fxinputgroups > 1 && mParallelPeerRender.load() && mPeerRenderPool
+        && inputGroupRevBuffer.getNumChannels() >= 2 * numinputgroups && inputGroupRevBuffer.getNumSamples() >= numSamples;
+
+    if (parallelinput) {
+        struct InputTask {
+            SonobusAudioProcessor * proc;
+            AudioBuffer<float> * buffer;
+            int numSamples;
+            float gain;
+            bool doreverb;
+            bool reverbEnabled;
+            int revchannels;
+            int destch[MAX_CHANGROUPS];
+            bool sent[MAX_CHANGROUPS];
+        } task { this, &buffer, numSamples, inGain, doinreverb, inReverbEnabled, revfxchannels, {}, {} };
+
+        int dch = 0;
+        for (auto i = 0; i < numinputgroups; ++i) {
+            task.destch[i] = dch;
+            dch += mInputChannelGroups[i].params.numChannels;
+        }
+
+        mPeerRenderPool->run(numinputgroups, [](void * arg, int i) {
+            auto & t = *static_cast<InputTask *>(arg);
+            auto & p = *t.proc;
+            AudioBuffer<float> * revbuf = nullptr;
+            if (t.doreverb) {
+                revbuf = &p.inputGroupRevBuffer;
+                for (int ch = 0; ch < t.revchannels; ++ch) {
+                    revbuf->clear(2 * i + ch, 0, t.numSamples);
+                }
+            }
+            t.sent[i] = p.mInputChannelGroups[i].processBlock(*t.buffer, p.inputPostBuffer, t.destch[i], p.mInputChannelGroups[i].params.numChannels, p.silentBuffer, t.numSamples, t.gain,
+                                                              false, nullptr, revbuf, 2 * i, t.revchannels, t.reverbEnabled);
+        }, &task);
+
+        if (doinreverb) {
+            for (auto i = 0; i < numinputgroups; ++i) {
+                if (!task.sent[i]) continue;
+                for (int ch = 0; ch < revfxchannels; ++ch) {
+                    inputRevBuffer.addFrom(ch, 0, inputGroupRevBuffer, 2 * i + ch, 0, numSamples);
+                }
+            }
+        }
+    }
+
     int destch = 0;
     for (auto i = 0; i < mInputChannelGroupCount && i < MAX_CHANGROUPS; ++i)
     {
-        auto * revbuf = doinreverb ? &inputRevBuffer : nullptr;
+        if (!parallelinput) {
+            auto * revbuf = doinreverb ? &inputRevBuffer : nullptr;
 
-        mInputChannelGroups[i].processBlock(buffer, inputPostBuffer, destch, mInputChannelGroups[i].params.numChannels, silentBuffer, numSamples, inGain,
-                                            nullptr, revbuf, 0, revfxchannels, inReverbEnabled);
+            mInputChannelGroups[i].processBlock(buffer, inputPostBuffer, destch, mInputChannelGroups[i].params.numChannels, silentBuffer, numSamples, inGain,
+                                                false, nullptr, revbuf, 0, revfxchannels, inReverbEnabled);
+        }
 
-        if (writingpossible && mRecordInputPreFX) {
+        if (recordpre) {
             // copy input as-is for later recording
             for (int ch = 0; ch < mInputChannelGroups[i].params.numChannels; ++ch) {
                 int usech = mInputChannelGroups[i].params.chanStartIndex + ch;
@@ -7119,7 +15039,9 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
     }
 
 
-    postinputMeterSource.measureBlock (inputPostBuffer, 0, numSamples);
+    if (!shedmeters) {
+        postinputMeterSource.measureBlock (inputPostBuffer, 0, numSamples);
+    }
 
 
     // compressor makeup meter level per channel
@@ -7168,8 +15090,8 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
         }
     }
 
-    // MAIN EFFECTS BUS
-    bool mainReverbEnabled = mMainReverbEnabled.get();
+    // MAIN EFFECTS BUS, shedding fades it out like switching it off does
+    bool mainReverbEnabled = mMainReverbEnabled.get() && !shedreverb;
     bool doreverb = mainReverbEnabled || mLastMainReverbEnabled;
     bool hasmainfx = doreverb;
     int fxchannels = 2;
@@ -7225,19 +15147,29 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
     }
      */
 
+    mProcessTiming.lap(ProcessTimingTracker::StageInputFx);
     
     // file playback goes to everyone
 
     bool hasfiledata = false;
     double transportPos = mTransportSource.getCurrentPosition();
 
+    // with direct streaming the file goes pre-encoded to the peers, see updateFileStreamSending()
+    const ScopedTryLock fsl (mFileStreamLock);
+    const SonoAudio::EncodedFileStream * filestream = fsl.isLocked() && mFileStreamSending.load() ? mFileStream.get() : nullptr;
+    bool filestreamdirect = false;
+    int64 fileStreamFirstBlock = 0;
+    int numFileStreamBlocks = 0;
+
     if (mTransportSource.getTotalLength() > 0)
     {
         AudioSourceChannelInfo info (&fileBuffer, 0, numSamples);
         mTransportSource.getNextAudioBlock (info);
         hasfiledata = true;
 
-        filePlaybackMeterSource.measureBlock(fileBuffer);
+        if (!shedmeters) {
+            filePlaybackMeterSource.measureBlock(fileBuffer);
+        }
 
         int srcchans = mCurrentAudioFileSource ? mCurrentAudioFileSource->getAudioFormatReader()->numChannels : 2;
         mFilePlaybackChannelGroup.params.numChannels = srcchans;
@@ -7246,7 +15178,34 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
         mRecFilePlaybackChannelGroup.params.numChannels = srcchans;
         mRecFilePlaybackChannelGroup.commitMonitorDelayParams(); // need to do this too
 
-        if (sendfileaudio) {
+        if (filestream && sendfileaudio && !backingtrackshared && mTransportSource.isPlaying()) {
+            // the blocks whose start has been reached go out as they are, none of the file gets
+            // mixed in. unless someone who can't take the stream joined since it was set up
+            filestreamdirect = true;
+            mAudioSnapshotEpoch.fetch_add(1);
+            for (auto * remote : mPeerSnapshot.load()->peers) {
+                if (remote->sendActive && !remote->remoteAcceptsFileStream) {
+                    filestreamdirect = false;
+                    break;
+                }
+            }
+            mAudioSnapshotEpoch.fetch_add(1);
+        }
+        if (!filestreamdirect) {
+            mFileStreamNextBlock = -1;
+        }
+
+        if (filestreamdirect) {
+            const int64 endblock = filestream->getBlockForTime(transportPos + numSamples / getSampleRate()) + 1;
+            if (mFileStreamNextBlock < 0 || mFileStreamNextBlock > endblock || endblock - mFileStreamNextBlock > FILESTREAM_MAX_BLOCKS_PER_TICK) {
+                // started, seeked or looped
+                mFileStreamNextBlock = filestream->getBlockForTime(transportPos);
+            }
+            fileStreamFirstBlock = mFileStreamNextBlock;
+            numFileStreamBlocks = (int) jlimit((int64) 0, (int64) FILESTREAM_MAX_BLOCKS_PER_TICK, endblock - mFileStreamNextBlock);
+            mFileStreamNextBlock += numFileStreamBlocks;
+        }
+        else if (sendfileaudio && !backingtrackshared) {
 
             //add to main buffer for going out, mix as appropriate depending on how many channels being sent
             if (sendPanChannels == 1) {
@@ -7295,13 +15254,29 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
 
 
     
+    mProcessTiming.lap(ProcessTimingTracker::StageFilePlayback);
+
     // process metronome
     bool metenabled = mMetEnabled.get();
     float metgain = mMetGain.get();
     double mettempo = mMetTempo.get();
     bool metrecorded = mMetIsRecorded.get();
     bool dometfilesyncstart = syncmetplayback && mTransportWasPlaying != mTransportSource.isPlaying();
-    bool syncmet = (syncmethost && hostPlaying) || (syncmetplayback && mTransportSource.isPlaying());
+
+    bool syncmetsession = mSyncMetToSession.load();
+    if (syncmetsession) {
+        const SpinLock::ScopedTryLockType sl (mMetSessionLock);
+        if (sl.isLocked()) {
+            mMetSessionEpochAudio = mMetSessionEpoch;
+            mMetSessionTempoAudio = mMetSessionTempo;
+        }
+        syncmetsession = mMetSessionEpochAudio != 0 && mMetSessionTempoAudio > 0.0;
+        if (syncmetsession) {
+            mettempo = mMetSessionTempoAudio;
+        }
+    }
+
+    bool syncmet = (syncmethost && hostPlaying) || (syncmetplayback && mTransportSource.isPlaying()) || syncmetsession;
 
     if (dometfilesyncstart) {
         metenabled = mTransportSource.isPlaying();
@@ -7332,11 +15307,18 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
         else if (syncmetplayback && mTransportSource.isPlaying()) {
             beattime = (mettempo / 60.0) * transportPos;
         }
+        else if (syncmetsession) {
+            // on the shared beat when it comes out of the speakers (roughly a block from now)
+            const double outlatency = currSamplesPerBlock / getSampleRate();
+            beattime = (mettempo / 60.0) * (aoo_osctime_duration(mMetSessionEpochAudio, t) + outlatency);
+        }
         mMetronome->processMix(numSamples, metBuffer.getWritePointer(0), metBuffer.getWritePointer(mainBusOutputChannels > 1 ? 1 : 0), beattime, !syncmet);
 
         //
 
-        metMeterSource.measureBlock(metBuffer);
+        if (!shedmeters) {
+            metMeterSource.measureBlock(metBuffer);
+        }
 
         if (sendmet) {
 
@@ -7363,15 +15345,31 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
     }
     mLastMetEnabled = metenabled;
 
+    mProcessTiming.lap(ProcessTimingTracker::StageMetronome);
 
     // process and mix in input reverb into sendworkbuffer (if sending mono or stereo)
     if (doinreverb) {
 
         if (inReverbEnabled != mLastInputReverbEnabled && inReverbEnabled) {
             mInputReverb.reset();
+            mInputReverbDecimator.reset();
+            mInputReverbTail.reset();
         }
 
-        mInputReverb.process(inputRevBuffer.getArrayOfWritePointers(), inputRevBuffer.getArrayOfWritePointers(), numSamples);
+        const bool insilent = SonoAudio::MultiChannelDetail::isSilent(inputRevBuffer.getArrayOfWritePointers(), jmin(2, inputRevBuffer.getNumChannels()), numSamples);
+        const ScopedTryLock rsl (mReverbRateLock);
+
+        if (!rsl.isLocked()) {
+            // being set up for another rate, this block goes without
+            inputRevBuffer.clear(0, numSamples);
+        }
+        else if (mInputReverbTail.isNeeded(insilent)) {
+            mInputReverbDecimator.process(inputRevBuffer.getArrayOfWritePointers(), jmin(2, inputRevBuffer.getNumChannels()), numSamples, [this] (float ** chans, int num) {
+                mInputReverb.process(chans, chans, num);
+            });
+
+            mInputReverbTail.update(numSamples, insilent && SonoAudio::MultiChannelDetail::isSilent(inputRevBuffer.getArrayOfWritePointers(), jmin(2, inputRevBuffer.getNumChannels()), numSamples));
+        }
 
         if (inReverbEnabled != mLastInputReverbEnabled ) {
             float sgain = inReverbEnabled ? 0.0f : 1.0f;
@@ -7390,9 +15388,14 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
 
     mLastInputReverbEnabled = inReverbEnabled;
 
+    mProcessTiming.lap(ProcessTimingTracker::StageReverb);
 
     // send meter post panning (and post file and met)
-    sendMeterSource.measureBlock (sendWorkBuffer, 0, numSamples);
+    if (!shedmeters) {
+        sendMeterSource.measureBlock (sendWorkBuffer, 0, numSamples);
+    }
+
+    mProcessTiming.lap(ProcessTimingTracker::StageMeters);
 
 
     bool hearlatencytest = mHearLatencyTest.get();
@@ -7402,11 +15405,14 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
 
     // push data for going out
     {
-        const ScopedReadLock sl (mCoreLock);        
+        // odd epoch tells publishPeerSnapshot() we hold a snapshot
+        mAudioSnapshotEpoch.fetch_add(1);
+        const PeerSnapshot & snapshot = *mPeerSnapshot.load();
+        const Array<RemotePeer*> & remotePeers = snapshot.peers;
         
         //mAooSource->process( buffer.getArrayOfReadPointers(), numSamples, t);
         
-        for (auto & remote : mRemotePeers) 
+        for (auto & remote : remotePeers) 
         {
             if (remote->soloed) {
                 anysoloed = true;
@@ -7415,171 +15421,100 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
         }
         
         tempBuffer.clear(0, numSamples);
-        
-        int rindex = 0;
-        
-        for (auto & remote : mRemotePeers) 
-        {
-            
-            if (!remote->oursink) { 
-                ++rindex;
-                continue;                
-            }
 
-            // just in case, should be exceedingly rare this is necessary
-            if (remote->workBuffer.getNumSamples() < currSamplesPerBlock
-                || remote->recvChannels > remote->workBuffer.getNumChannels()
-                || mainBusOutputChannels > remote->workBuffer.getNumChannels()) {
-                remote->workBuffer.setSize(jmax(2, jmax(mainBusOutputChannels, remote->recvChannels)), currSamplesPerBlock, false, false, true);
+        // recording of individual tracks, held for all peers so workers can use it too
+        const ScopedTryLock wl (writerLock, userwritingpossible);
+
+        PeerRenderContext rctx;
+        rctx.outChannels = buffer.getArrayOfWritePointers();
+        rctx.numOutChannels = buffer.getNumChannels();
+        rctx.t = t;
+        rctx.numSamples = numSamples;
+        rctx.mainBusOutputChannels = mainBusOutputChannels;
+        rctx.totalOutputChannels = totalOutputChannels;
+        rctx.fxchannels = fxchannels;
+        rctx.anysoloed = anysoloed;
+        rctx.doreverb = doreverb;
+        rctx.mainReverbEnabled = mainReverbEnabled;
+        rctx.recordPeers = userwritingpossible && wl.isLocked();
+        rctx.shedPeerFx = shedlevel >= LoadGovernor::LevelPeerFx;
+        rctx.shedMeters = shedmeters;
+
+        if (offlinebounce) {
+            // the sinks stay out of it, they can't keep up anyway
+            if (posValid) {
+                RealtimeSafetyChecker::ScopedAllowance allowance("bounce capture playback");
+                mBounceCapture->addTo(posInfo.timeInSamples, tempBuffer, numSamples);
             }
+        }
+        else if (mParallelPeerRender.load() && mPeerRenderPool && remotePeers.size() > 1) {
+            // each thread of the worker pool mixes the peers it takes into its own scratch, then sum those here
+            rctx.mixBuffer = nullptr;
+            rctx.fxBuffer = nullptr;
 
-            remote->workBuffer.clear(0, numSamples);
-
-            // calculate fill ratio before processing the sink
-            float retratio = 0.0f;
-            if (remote->oursink->get_sourceoption(remote->endpoint, remote->remoteSourceId, aoo_opt_buffer_fill_ratio, &retratio, sizeof(retratio)) > 0) {
-                remote->fillRatio.Z *= 0.95;
-                remote->fillRatio.push(retratio);
-                remote->fillRatioSlow.Z *= 0.99;
-                remote->fillRatioSlow.push(retratio);
-            }
+            mPeerRenderPool->render(remotePeers.getRawDataPointer(), remotePeers.size(), rctx);
 
-            
+            for (int i = 0; i < mPeerRenderPool->getNumScratch(); ++i)
             {
-                // get audio data coming in from outside into tempbuf
-                const ScopedReadLock sl (remote->sinkLock); // not contended, should be able to get rid of
-
-                // just in case, should be exceedingly rare this is necessary
-                if (remote->workBuffer.getNumSamples() < currSamplesPerBlock
-                    || remote->recvChannels > remote->workBuffer.getNumChannels()
-                    || mainBusOutputChannels > remote->workBuffer.getNumChannels()) {
-                    remote->workBuffer.setSize(jmax(2, jmax(mainBusOutputChannels, remote->recvChannels)), currSamplesPerBlock, false, false, true);
-                }
-
-                remote->workBuffer.clear(0, numSamples);
-
-                remote->oursink->process(remote->workBuffer.getArrayOfWritePointers(), numSamples, t);
-            }
-
-            
-            // record individual tracks pre-compressor/level/pan, ignoring muting/solo, raw material
+                const auto & scratch = mPeerRenderPool->getScratch(i);
 
-            if (userwritingpossible) {
-                const ScopedTryLock sl (writerLock);
-                if (sl.isLocked() && remote->fileWriter)
-                {
-                    float *tmpbuf[MAX_PANNERS];
-                    int numchan = remote->fileWriter->getWriter()->getNumChannels();
-                    for (int i = 0; i < numchan && i < MAX_PANNERS; ++i) {
-                        if (i < remote->recvChannels) {
-                            tmpbuf[i] = remote->workBuffer.getWritePointer(i);
-                        }
-                        else {
-                            tmpbuf[i] = silentBuffer.getWritePointer(0);
-                        }
+                if (scratch.mixUsed) {
+                    for (int ch = scratch.mixStart; ch < scratch.mixEnd && ch < tempBuffer.getNumChannels(); ++ch) {
+                        tempBuffer.addFrom(ch, 0, scratch.mixBuffer, ch, 0, numSamples);
                     }
-                    remote->fileWriter->write (tmpbuf, numSamples);
                 }
-            }
-
-            // write out per-user output bus
-            if (remote->recvActive && remote->recvChannels > 0) {
-                if (auto userbus = getBus(false, OutUserBaseBusIndex + rindex)) {
-                    if (userbus->isEnabled()) {
-                        int index = getChannelIndexInProcessBlockBuffer(false, OutUserBaseBusIndex + rindex, 0);
-                        int cnt = getChannelCountOfBus(false, OutUserBaseBusIndex + rindex);
-                        for (int i=0; i < cnt; ++i) {
-                            if (i < remote->recvChannels) {
-                                buffer.copyFrom(index+i, 0, remote->workBuffer, i, 0, numSamples);
-                            }
-                            else {
-                                // it should already be clear
-                                //buffer.clear(index+i, 0, numSamples);
-                            }
-                        }
+                if (doreverb && scratch.fxUsed) {
+                    for (int ch = 0; ch < fxchannels && ch < mainFxBuffer.getNumChannels() && ch < scratch.fxBuffer.getNumChannels(); ++ch) {
+                        mainFxBuffer.addFrom(ch, 0, scratch.fxBuffer, ch, 0, numSamples);
                     }
                 }
             }
+        }
+        else {
+            rctx.mixBuffer = &tempBuffer;
+            rctx.fxBuffer = &mainFxBuffer;
 
-            
-            // apply effects
-
-            float usegain = remote->gain;
-            bool wasSilent = false;
-
-            bool forceSilent = false;
-
-            // we get the stuff, but ignore it (either muted or others soloed)
-            if (!remote->recvActive || (anysoloed && !remote->soloed) || remote->resetSafetyMuted) {
-
-                usegain = 0.0f;
-                forceSilent = true;
-
-                if (remote->_lastgain <= 0.0f) {
-                    wasSilent = true;
-                }
-            }
-
-            bool anysubsolo = false;
-            for (auto cgi = 0; cgi < remote->numChanGroups; ++cgi) {
-                if (remote->chanGroups[cgi].params.soloed) {
-                    anysubsolo = true;
-                    break;
-                }
-            }
-
-            for (auto cgi = 0; cgi < remote->numChanGroups; ++cgi) {
-                remote->chanGroups[cgi].processBlock(remote->workBuffer, remote->workBuffer, remote->chanGroups[cgi].params.chanStartIndex,  remote->chanGroups[cgi].params.numChannels, silentBuffer, numSamples, usegain);
-            }
-
-            remote->_lastgain = usegain;
-
-
-            remote->recvMeterSource.measureBlock (remote->workBuffer, 0, numSamples);
-
-            for (auto cgi = 0; cgi < remote->numChanGroups; ++cgi) {
-                float redlev = 1.0f;
-                if (remote->chanGroups[cgi].params.compressorParams.enabled && remote->chanGroups[cgi].compressorOutputLevel) {
-                    redlev = jlimit(0.0f, 1.0f, Decibels::decibelsToGain(*remote->chanGroups[cgi].compressorOutputLevel));
-                }
-                for (auto j=0; j < remote->chanGroups[cgi].params.numChannels; ++j) {
-                    int ch = remote->chanGroups[cgi].params.chanStartIndex + j;
-                    remote->recvMeterSource.setReductionLevel(ch, redlev);
-                }
+            for (int rindex = 0; rindex < remotePeers.size(); ++rindex) {
+                renderRemotePeer(remotePeers.getUnchecked(rindex), rindex, rctx);
             }
+        }
 
-            ++rindex;
-            
-            if (wasSilent) continue; // can skip the rest, already fully muted/absent
-            
-            float tgain = mainBusOutputChannels == 1 && remote->recvChannels > 0 ? 1.0f/(float)remote->recvChannels : 1.0f;
-            tgain *= usegain; // handles main solo
-
-
-            for (auto i = 0; i < remote->numChanGroups; ++i)
-            {
-                // apply solo muting to the gain here
-                float adjgain = anysubsolo && !remote->chanGroups[i].params.soloed ? 0.0f : tgain;
-                // todo change dest ch target
-                int dstch = remote->chanGroups[i].params.panDestStartIndex;
-                int dstcnt = jmin(totalOutputChannels, remote->chanGroups[i].params.panDestChannels);
-                remote->chanGroups[i].processPan(remote->workBuffer, remote->chanGroups[i].params.chanStartIndex, tempBuffer, dstch, dstcnt, numSamples, adjgain);
-
-                if (doreverb) {
-                    remote->chanGroups[i].processReverbSend(remote->workBuffer, remote->chanGroups[i].params.chanStartIndex, remote->chanGroups[i].params.numChannels, mainFxBuffer, 0, fxchannels, numSamples, mainReverbEnabled, false, adjgain);
-                }
+        // a backing track a peer shares with us plays along with them
+        if (!offlinebounce && !mMainRecvMute.get()) {
+            mBackingTrackPlayer->addTo(tempBuffer, jmin(totalOutputChannels, tempBuffer.getNumChannels()), numSamples, t);
+        }
 
-            }
+        if (capturebounce) {
+            mBounceCapture->write(posInfo.timeInSamples, tempBuffer, numSamples);
+        }
 
+        mProcessTiming.lap(ProcessTimingTracker::StagePeerRender);
+        for (int rindex = 0; rindex < remotePeers.size() && !offlinebounce; ++rindex) {
+            auto * remote = remotePeers.getUnchecked(rindex);
+            mProcessTiming.addTicks(ProcessTimingTracker::StageSinkProcess, remote->renderSinkTicks);
+            mProcessTiming.addTicks(ProcessTimingTracker::StagePeerFx, remote->renderFxTicks);
         }
         
         
         
+        // the total for the mix-minus sends, summed for the first one which needs it
+        int sendtotalchans = -1;
+
+        // the send mix for the peers which share a resampler, see PeerSnapshot
+        for (size_t ri = 0; ri < snapshot.sendResamplers.size() && !offlinebounce; ++ri) {
+            auto & resampler = snapshot.sendResamplers[ri];
+            resampler->process(sendWorkBuffer.getArrayOfReadPointers(), sendWorkBuffer.getNumChannels(), numSamples);
+        }
+
         // send out final outputs
         int i=0;
-        for (auto & remote : mRemotePeers) 
+        for (auto & remote : remotePeers) 
         {
-            if (remote->oursource /*&& remote->sendActive */) {
+            // nothing goes out live while bouncing offline, it would come in bursts
+            if (remote->oursource /*&& remote->sendActive */ && !offlinebounce) {
+
+                // a shared source already got the same mix from its leader
+                const bool sharedsend = remote->sendLeader.load(std::memory_order_acquire) != nullptr;
 
                 workBuffer.clear(0, numSamples);
 
@@ -7589,92 +15524,117 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
                     workBuffer.addFrom(channel, 0, sendWorkBuffer, channel, 0, numSamples);
                 }
 
-                // now add any cross-routed input
-                int j=0;
-                for (auto & crossremote : mRemotePeers) 
-                {
-                    if (mRemoteSendMatrix[j][i]) {
-                        for (int channel = 0; channel < remote->sendChannels; ++channel) {
-
-                            // now apply panning
-
-                            if (crossremote->recvChannels > 0 && remote->sendChannels > 1) {
-                                for (int ch=0; ch < crossremote->recvChannels; ++ch) {
-                                    const float pan = crossremote->recvChannels == 2 ? crossremote->recvStereoPan[ch] : crossremote->recvPan[ch];
-                                    const float lastpan = crossremote->recvPanLast[ch];
-                                    
-                                    // apply pan law
-                                    // -1 is left, 1 is right
-                                    float pgain = channel == 0 ? (pan >= 0.0f ? (1.0f - pan) : 1.0f) : (pan >= 0.0f ? 1.0f : (1.0f+pan)) ;
-
-                                    if (pan != lastpan) {
-                                        float plastgain = channel == 0 ? (lastpan >= 0.0f ? (1.0f - lastpan) : 1.0f) : (lastpan >= 0.0f ? 1.0f : (1.0f+lastpan));
-                                        
-                                        workBuffer.addFromWithRamp(channel, 0, crossremote->workBuffer.getReadPointer(ch), numSamples, plastgain, pgain);
-                                    } else {
-                                        workBuffer.addFrom (channel, 0, crossremote->workBuffer, ch, 0, numSamples, pgain);                            
-                                    }
+                // now add any cross-routed input, either only visiting the peers routed here
+                // or taking the ones which aren't out of the total (see PeerSnapshot)
+                const bool mixminus = snapshot.sendMixMinus[(size_t) i]
+                                      && (sendtotalchans < 0 || sendtotalchans == remote->sendChannels);
+                if (sharedsend) {
+                    // nothing to add
+                }
+                else if (mixminus) {
+                    if (sendtotalchans < 0) {
+                        sendMixTotalBuffer.clear(0, numSamples);
+                        for (auto j : snapshot.routedSources) {
+                            addCrossRoutedSend(sendMixTotalBuffer, remote->sendChannels, remotePeers.getUnchecked(j), numSamples, 1.0f);
+                        }
+                        sendtotalchans = remote->sendChannels;
+                    }
 
-                                    //remote->recvPanLast[ch] = pan;
-                                }
-                            } else {
-                                
-                                workBuffer.addFrom(channel, 0, crossremote->workBuffer, channel, 0, numSamples);
-                            }
-                            
-                        }                        
-                    }                    
-                    ++j;
+                    for (int channel = 0; channel < remote->sendChannels && channel < workBuffer.getNumChannels(); ++channel) {
+                        workBuffer.addFrom(channel, 0, sendMixTotalBuffer, channel, 0, numSamples);
+                    }
+                    for (auto j : snapshot.sendExclusions[(size_t) i]) {
+                        addCrossRoutedSend(workBuffer, remote->sendChannels, remotePeers.getUnchecked(j), numSamples, -1.0f);
+                    }
+                }
+                else {
+                    for (auto j : snapshot.sendSources[(size_t) i]) {
+                        addCrossRoutedSend(workBuffer, remote->sendChannels, remotePeers.getUnchecked(j), numSamples, 1.0f);
+                    }
                 }
                 
                 
-                remote->oursource->process(workBuffer.getArrayOfReadPointers(), numSamples, t);      
+                if (!sharedsend) {
+                    // from the first channel the remote subscribed to on
+                    const int onset = remote->sendEncodeOnset.load(std::memory_order_acquire);
+                    const int ri = i < (int) snapshot.sendResampler.size() ? snapshot.sendResampler[(size_t) i] : -1;
+                    auto * resampler = ri >= 0 ? snapshot.sendResamplers[(size_t) ri].get() : nullptr;
+
+                    if (resampler && resampler->isReady() && remote->sendChannels == resampler->getNumChannels()
+                        && onset + remote->encodeSendChannels() <= resampler->getNumChannels()) {
+                        remote->oursource->process_resampled(resampler->getOutput() + onset, resampler->getNumOutput(),
+                                                             (int32_t) resampler->getOutputRate(), t);
+                    }
+                    else {
+                        remote->oursource->process(workBuffer.getArrayOfReadPointers() + onset, numSamples, t);
+                    }
+                }
+
+                // ticks it even without blocks due, so it can time itself and flush once stopped
+                if (numFileStreamBlocks > 0) {
+                    for (int b = 0; b < numFileStreamBlocks; ++b) {
+                        const char * blockdata = nullptr;
+                        int32_t blocksize = 0;
+                        if (filestream->getBlock(fileStreamFirstBlock + b, blockdata, blocksize)) {
+                            remote->filestreamsource->process_encoded(blockdata, blocksize, t);
+                        }
+                    }
+                } else {
+                    remote->filestreamsource->process_encoded(nullptr, 0, t);
+                }
                 
                 //remote->sendMeterSource.measureBlock (workBuffer);
                 
                 
-                // now process echo and latency stuff
-                
-                workBuffer.clear(0, 0, numSamples);
-                if (remote->echosink->process(workBuffer.getArrayOfWritePointers(), numSamples, t)) {
-                    //DBG("received something from our ECHO sink");
-                    remote->echosource->process(workBuffer.getArrayOfReadPointers(), numSamples, t);
-                }
-
+                // now process echo and latency stuff, only there once a test made them
                 
-                if (remote->activeLatencyTest && remote->latencyMeasurer) {
+                if (remote->latencyTestReady.load(std::memory_order_acquire)) {
                     workBuffer.clear(0, 0, numSamples);
-                    if (remote->latencysink->process(workBuffer.getArrayOfWritePointers(), numSamples, t)) {
-                        //DBG("received something from our latency sink");
+                    if (remote->echosink->process(workBuffer.getArrayOfWritePointers(), numSamples, t)) {
+                        //DBG("received something from our ECHO sink");
+                        remote->echosource->process(workBuffer.getArrayOfReadPointers(), numSamples, t);
                     }
 
-                    // hear latency measure stuff (recv into right channel)
-                    if (hearlatencytest) {
-                        tempBuffer.addFrom(mainBusOutputChannels > 1 ? 1 : 0, 0, workBuffer, 0, 0, numSamples);
-                    }
+                
+                    if (remote->activeLatencyTest && remote->latencyMeasurer) {
+                        workBuffer.clear(0, 0, numSamples);
+                        if (remote->latencysink->process(workBuffer.getArrayOfWritePointers(), numSamples, t)) {
+                            //DBG("received something from our latency sink");
+                        }
+
+                        // hear latency measure stuff (recv into right channel)
+                        if (hearlatencytest) {
+                            tempBuffer.addFrom(mainBusOutputChannels > 1 ? 1 : 0, 0, workBuffer, 0, 0, numSamples);
+                        }
 
 #if 1
-                    remote->latencyMeasurer->processInput(workBuffer.getWritePointer(0), (int)lrint(getSampleRate()), numSamples);
-                    remote->latencyMeasurer->processOutput(workBuffer.getWritePointer(0));
+                        remote->latencyMeasurer->processInput(workBuffer.getWritePointer(0), (int)lrint(getSampleRate()), numSamples);
+                        remote->latencyMeasurer->processOutput(workBuffer.getWritePointer(0));
 #else
-                    remote->latencyProcessor->process(numSamples, workBuffer.getWritePointer(0), workBuffer.getWritePointer(0));
+                        remote->latencyProcessor->process(numSamples, workBuffer.getWritePointer(0), workBuffer.getWritePointer(0));
 #endif
 
-                    // hear latency measure stuff (send into left channel)
-                    if (hearlatencytest) {
-                        tempBuffer.addFrom(0, 0, workBuffer, 0, 0, numSamples);
-                    }
+                        // hear latency measure stuff (send into left channel)
+                        if (hearlatencytest) {
+                            tempBuffer.addFrom(0, 0, workBuffer, 0, 0, numSamples);
+                        }
 
                     
-                    remote->latencysource->process(workBuffer.getArrayOfReadPointers(), numSamples, t);                                        
+                        remote->latencysource->process(workBuffer.getArrayOfReadPointers(), numSamples, t);                                        
+                    }
                 }
             }
             
             ++i;
         }
 
+        // straight out, without waiting for the send thread to wake up
+        if (mInlineSend.load(std::memory_order_relaxed) && !offlinebounce) {
+            sendInline(remotePeers.getRawDataPointer(), remotePeers.size());
+        }
+
         // update last state
-        for (auto & remote : mRemotePeers) 
+        for (auto & remote : remotePeers) 
         {
             for (int i=0; i < remote->recvChannels; ++i) {
                 const float pan = remote->recvChannels == 2 ? remote->recvStereoPan[i] : remote->recvPan[i];
@@ -7683,9 +15643,12 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
             }
         }
         
-        // end scoped lock
+        mAudioSnapshotEpoch.fetch_add(1);
+        // end snapshot use
     }
 
+    mProcessTiming.lap(ProcessTimingTracker::StagePeerSend);
+
 
     // BEGIN MAIN OUTPUT BUFFER WRITING
 
@@ -7707,6 +15670,8 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
         }
     }
 
+    mProcessTiming.lap(ProcessTimingTracker::StageMainMix);
+
     // EFFECTS
 
 
@@ -7720,6 +15685,8 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
             mMainReverb->reset();
             mMReverb.reset();
             mZitaReverb.instanceClear();
+            mFdnReverb.reset();
+            mMainReverbDecimator.reset();
         }
 
         /*
@@ -7771,28 +15738,52 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
             mReverbParamsChanged = false;
         }
         
-        if (mLastReverbModel != mMainReverbModel.get()) {
+        if (mLastReverbModel != reverbmodel || !mLastMainReverbEnabled) {
+            mMainReverbTail.reset();
+        }
+
+        if (mLastReverbModel != reverbmodel) {
             mMReverb.reset();
             mMainReverb->reset();
             mZitaReverb.instanceClear();
+            mFdnReverb.reset();
+            mMainReverbDecimator.reset();
         }
-        
-        if (mMainReverbModel.get() == ReverbModelMVerb) {
-            if (mainBusOutputChannels > 1) {            
-                mMReverb.process(mainFxBuffer.getArrayOfWritePointers(), mainFxBuffer.getArrayOfWritePointers(), numSamples);
-            } 
-        }
-        else if (mMainReverbModel.get() == ReverbModelZita) {
-            if (mainBusOutputChannels > 1) {            
-                mZitaReverb.compute(numSamples, mainFxBuffer.getArrayOfWritePointers(), mainFxBuffer.getArrayOfWritePointers()); 
-            }
+
+        const int revchans = jmin(mainBusOutputChannels > 1 ? 2 : 1, mainFxBuffer.getNumChannels());
+        const bool revsilent = SonoAudio::MultiChannelDetail::isSilent(mainFxBuffer.getArrayOfWritePointers(), revchans, numSamples);
+
+        const ScopedTryLock rsl (mReverbRateLock);
+
+        if (!rsl.isLocked()) {
+            // being set up for another rate, this block goes without
+            mainFxBuffer.clear(0, numSamples);
         }
-        else {
-            if (mainBusOutputChannels > 1) {            
-                mMainReverb->processStereo(mainFxBuffer.getWritePointer(0), mainFxBuffer.getWritePointer(1), numSamples);
-            } else {
-                mMainReverb->processMono(mainFxBuffer.getWritePointer(0), numSamples);
-            }            
+        else if (mMainReverbTail.isNeeded(revsilent)) {
+            mMainReverbDecimator.process(mainFxBuffer.getArrayOfWritePointers(), revchans, numSamples, [&] (float ** chans, int num) {
+                if (reverbmodel == ReverbModelMVerb) {
+                    if (mainBusOutputChannels > 1) {
+                        mMReverb.process(chans, chans, num);
+                    }
+                }
+                else if (reverbmodel == ReverbModelZita) {
+                    if (mainBusOutputChannels > 1) {
+                        mZitaReverb.compute(num, chans, chans);
+                    }
+                }
+                else if (reverbmodel == ReverbModelFdn) {
+                    mFdnReverb.process(chans[0], mainBusOutputChannels > 1 ? chans[1] : nullptr, num);
+                }
+                else {
+                    if (mainBusOutputChannels > 1) {
+                        mMainReverb->processStereo(chans[0], chans[1], num);
+                    } else {
+                        mMainReverb->processMono(chans[0], num);
+                    }
+                }
+            });
+
+            mMainReverbTail.update(numSamples, revsilent && SonoAudio::MultiChannelDetail::isSilent(mainFxBuffer.getArrayOfWritePointers(), revchans, numSamples));
         }
     }
 
@@ -7805,7 +15796,9 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
 
     mLastHasMainFx = hasmainfx;
     mLastMainReverbEnabled = mainReverbEnabled;
-    mLastReverbModel = (ReverbModel) mMainReverbModel.get();
+    mLastReverbModel = (ReverbModel) reverbmodel;
+
+    mProcessTiming.lap(ProcessTimingTracker::StageReverb);
     
     // add from main FX
     if (hasmainfx) {
@@ -7868,17 +15861,21 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
         }
     }
 
+    mProcessTiming.lap(ProcessTimingTracker::StageMainMix);
     
     outputMeterSource.measureBlock (buffer, 0, numSamples);
 
-    // output to file writer if necessary
-    if (writingpossible) {
+    mProcessTiming.lap(ProcessTimingTracker::StageMeters);
+
+    // output to file writer (and the broadcast) if necessary
+    if (writingpossible || broadcasting) {
         const ScopedTryLock sl (writerLock);
         if (sl.isLocked())
         {
             if (activeMixWriter.load() != nullptr 
                 || activeMixMinusWriter.load() != nullptr
                 || activeSelfWriters[0].load() != nullptr
+                || activeBroadcastOutput.load() != nullptr
                 )
             {
                 // write the raw (pre or post FX) input
@@ -7982,15 +15979,40 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
                     // write out full mix
                     activeMixWriter.load()->write (workBuffer.getArrayOfReadPointers(), numSamples);
                 }
+
+                if (auto * broadcast = activeBroadcastOutput.load()) {
+                    // the same full mix, encoded and sent on its own thread
+                    broadcast->write (workBuffer.getArrayOfReadPointers(), totalRecordingChannels, numSamples);
+                }
                 
             }
         }
     }
 
+    // our side of a double-ender, see updateDoubleEnder()
+    if (dubwriting) {
+        const ScopedTryLock sl (mDoubleEnderWriterLock);
+        auto * dubwriter = sl.isLocked() ? activeDoubleEnderWriter.load() : nullptr;
+        if (dubwriter) {
+            if (mDoubleEnderStartTime.load() == 0) {
+                mDoubleEnderStartTime = aoo_osctime_get();
+            }
+
+            const auto & inbuf = mRecordInputPreFX ? inputPreBuffer : inputPostBuffer;
+            const float * useinbufs[MAX_PANNERS];
+            for (int j=0; j < mDoubleEnderChannels; ++j) {
+                useinbufs[j] = j < mActiveInputChannels && j < inbuf.getNumChannels() ? inbuf.getReadPointer(j) : silentBuffer.getReadPointer(0);
+            }
+            dubwriter->write (useinbufs, numSamples);
+        }
+    }
+
     if (writingpossible || userwritingpossible) {
         mElapsedRecordSamples += numSamples;
     }
 
+    mProcessTiming.lap(ProcessTimingTracker::StageRecording);
+
 
     lastSamplesPerBlock = numSamples;
 
@@ -8005,6 +16027,20 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
     mAnythingSoloed =  anysoloed;
 
     mTransportWasPlaying = mTransportSource.isPlaying();
+
+    mProcessTiming.endBlock(numSamples, getSampleRate());
+
+    if (getSampleRate() > 0.0) {
+        // for the codec budget, over about a second
+        const float alpha = (float) jmin(1.0, numSamples / getSampleRate());
+        mAverageBlockLoad = mAverageBlockLoad.load(std::memory_order_relaxed) + alpha * (mProcessTiming.getLastBlockLoad() - mAverageBlockLoad.load(std::memory_order_relaxed));
+    }
+
+    if (mLoadShedding.load()) {
+        mLoadGovernor.update(mProcessTiming.getLastBlockLoad(), getSampleRate() > 0.0 ? numSamples / getSampleRate() : 0.0);
+    } else {
+        mLoadGovernor.reset();
+    }
 }
 
 //==============================================================================
@@ -8015,9 +16051,48 @@ bool SonobusAudioProcessor::hasEditor() const
 
 AudioProcessorEditor* SonobusAudioProcessor::createEditor()
 {
+    setMetersActive(true);
     return new SonobusAudioProcessorEditor (*this);
 }
 
+void SonobusAudioProcessor::setKeepChatHistory(bool flag)
+{
+    mKeepChatHistory = flag;
+    if (!flag) {
+        mChatHistory.clear();
+    }
+}
+
+void SonobusAudioProcessor::setChatSpillToDisk(bool flag)
+{
+    if (flag == getChatSpillToDisk()) return;
+
+    File spillfile;
+    if (flag) {
+        // one per session
+        const String name = String("SonoBus Chat ") + Time::getCurrentTime().formatted("%Y-%m-%d_%H.%M.%S") + ".txt";
+        spillfile = File(mDefaultRecordDir).getChildFile(name);
+    }
+    mChatHistory.setSpillFile(spillfile);
+}
+
+void SonobusAudioProcessor::setMetersActive(bool active)
+{
+    mMetersActive = active;
+
+    for (auto * source : { &inputMeterSource, &postinputMeterSource, &sendMeterSource,
+                           &outputMeterSource, &filePlaybackMeterSource, &metMeterSource }) {
+        source->setSuspended(!active);
+    }
+
+    const ScopedReadLock sl (mCoreLock);
+
+    for (auto s : mRemotePeers) {
+        s->recvMeterSource.setSuspended(!active);
+        s->sendMeterSource.setSuspended(!active);
+    }
+}
+
 AudioProcessorValueTreeState& SonobusAudioProcessor::getValueTreeState()
 {
     return mState;
@@ -8063,11 +16138,22 @@ void SonobusAudioProcessor::getStateInformationWithOptions(MemoryBlock& destData
 
     ValueTree recentsTree = tempstate.getOrCreateChildWithName(recentsCollectionKey, nullptr);
 
+    // a restore that is still being parsed goes back out the way it came in
+    auto pendingrestore = includecache ? getPendingStateRestore() : nullptr;
+
     if (includecache) {
         // update state with our recents info
         recentsTree.removeAllChildren(nullptr);
-        for (auto & info : mRecentConnectionInfos) {
-            recentsTree.appendChild(info.getValueTree(), nullptr);
+        if (pendingrestore && pendingrestore->recentsTree.isValid()) {
+            for (auto child : pendingrestore->recentsTree) {
+                recentsTree.appendChild(child.createCopy(), nullptr);
+            }
+        }
+        else {
+            const ScopedLock sl (mRecentsLock);
+            for (auto & info : mRecentConnectionInfos) {
+                recentsTree.appendChild(info.getValueTree(), nullptr);
+            }
         }
     } else {
         tempstate.removeChild(recentsTree, nullptr);
@@ -8084,9 +16170,60 @@ void SonobusAudioProcessor::getStateInformationWithOptions(MemoryBlock& destData
     extraTree.setProperty(defRecordBitsKey, var((int)mDefaultRecordingBitsPerSample), nullptr);
     extraTree.setProperty(recordSelfPreFxKey, mRecordInputPreFX, nullptr);
     extraTree.setProperty(recordFinishOpenKey, mRecordFinishOpens, nullptr);
+    extraTree.setProperty(crashSafeRecordingKey, mCrashSafeRecording.load(), nullptr);
     extraTree.setProperty(defRecordDirKey, mDefaultRecordDir, nullptr);
     extraTree.setProperty(sliderSnapKey, mSliderSnapToMouse, nullptr);
+    extraTree.setProperty(parallelPeerRenderKey, mParallelPeerRender.load(), nullptr);
+    extraTree.setProperty(resampleQualityKey, mResampleQuality.load(), nullptr);
+    extraTree.setProperty(timeStretchKey, mTimeStretch.load(), nullptr);
+    extraTree.setProperty(loadSheddingKey, mLoadShedding.load(), nullptr);
+    extraTree.setProperty(processQuantumKey, mProcessQuantum.load(), nullptr);
+    extraTree.setProperty(parallelPeerSendKey, mParallelPeerSend.load(), nullptr);
+    extraTree.setProperty(autoPacketSizeKey, mAutoPacketSize.load(), nullptr);
+    extraTree.setProperty(sendPacingKey, mSendPacing.load(), nullptr);
+    extraTree.setProperty(realtimeNetworkThreadsKey, mRealtimeNetworkThreads.load(), nullptr);
+    extraTree.setProperty(powerSavingKey, mPowerSaving.load(), nullptr);
+    extraTree.setProperty(networkThreadCoresKey, cpuCoreListToString(mNetworkThreadAffinity.load()), nullptr);
+    extraTree.setProperty(receivePollModeKey, (int) mReceivePollMode.load(), nullptr);
+    extraTree.setProperty(receiveThreadCoreKey, mReceiveThreadCore.load(), nullptr);
+    extraTree.setProperty(inlineSendKey, mInlineSend.load(), nullptr);
+    extraTree.setProperty(sharedSendEncodingKey, mSharedSendEncoding.load(), nullptr);
+    extraTree.setProperty(simulcastSendingKey, mSimulcastSending.load(), nullptr);
+    extraTree.setProperty(serverForwardingKey, mServerForwarding.load(), nullptr);
+    extraTree.setProperty(lanMulticastKey, mLanMulticast.load(), nullptr);
+    extraTree.setProperty(lanDiscoveryKey, mLanDiscoveryEnabled.load(), nullptr);
+    extraTree.setProperty(lanDiscoveryGroupKey, getLanDiscoveryGroup(), nullptr);
+    extraTree.setProperty(packetEncryptionKey, getPacketEncryption(), nullptr);
+    extraTree.setProperty(doubleEnderRecordingKey, mDoubleEnderRecording.load(), nullptr);
+    extraTree.setProperty(doubleEnderCollectingKey, mDoubleEnderCollecting.load(), nullptr);
+    extraTree.setProperty(doubleEnderUploadRateKey, mDoubleEnderUploadRate.load(), nullptr);
+    extraTree.setProperty(broadcastUrlKey, getBroadcastUrl(), nullptr);
+    extraTree.setProperty(broadcastQualityKey, mBroadcastQuality.load(), nullptr);
+    extraTree.setProperty(ensembleAlignmentKey, mEnsembleAlignment.load(), nullptr);
+    extraTree.setProperty(sessionRateNegotiationKey, mSessionRateNegotiation.load(), nullptr);
+    extraTree.setProperty(offlineBounceCaptureKey, mOfflineBounceCapture.load(), nullptr);
+    extraTree.setProperty(reverbRateReductionKey, (int) mReverbRateReduction.load(), nullptr);
+    extraTree.setProperty(shareBackingTrackKey, mShareBackingTrack.load(), nullptr);
+    extraTree.setProperty(codecCpuBudgetKey, mCodecCpuBudget.load(), nullptr);
+    {
+        const ScopedLock sl (mCodecCostsLock);
+        if (!mCodecCosts.isEmpty()) {
+            extraTree.setProperty(codecCostsKey, SonoAudio::CodecCalibration::toString(mCodecCosts), nullptr);
+        }
+    }
+    extraTree.setProperty(mixNodeModeKey, mMixNodeMode.load(), nullptr);
+    extraTree.setProperty(listenerRoleKey, mListenerRole.load(), nullptr);
+    extraTree.setProperty(adaptiveSendBitrateKey, mAdaptiveSendBitrate.load(), nullptr);
+    extraTree.setProperty(adaptiveFrameSizeKey, mAdaptiveFrameSize.load(), nullptr);
+    extraTree.setProperty(networkDscpKey, mNetworkDscp.load(), nullptr);
+    extraTree.setProperty(multipathModeKey, mMultipathMode.load(), nullptr);
+    extraTree.setProperty(multipathLocalAddressKey, getMultipathLocalAddress(), nullptr);
+    extraTree.setProperty(streamPlaybackDirectKey, mStreamPlaybackDirect.load(), nullptr);
+    extraTree.setProperty(syncMetToSessionKey, mSyncMetToSession.load(), nullptr);
     extraTree.setProperty(disableShortcutsKey, mDisableKeyboardShortcuts, nullptr);
+    extraTree.setProperty(useOpenGLKey, mUseOpenGLRendering, nullptr);
+    extraTree.setProperty(chatHistoryLimitKey, getChatHistoryLimit(), nullptr);
+    extraTree.setProperty(chatSpillToDiskKey, getChatSpillToDisk(), nullptr);
     extraTree.setProperty(peerDisplayModeKey, var((int)mPeerDisplayMode), nullptr);
     extraTree.setProperty(lastChatWidthKey, var((int)mLastChatWidth), nullptr);
     extraTree.setProperty(lastChatShownKey, mLastChatShown, nullptr);
@@ -8098,6 +16235,7 @@ void SonobusAudioProcessor::getStateInformationWithOptions(MemoryBlock& destData
     extraTree.setProperty(lastWindowWidthKey, var((int)mPluginWindowWidth), nullptr);
     extraTree.setProperty(lastWindowHeightKey, var((int)mPluginWindowHeight), nullptr);
     extraTree.setProperty(autoresizeDropRateThreshKey, var((float)mAutoresizeDropRateThresh), nullptr);
+    extraTree.setProperty(autoresizeBufferQuantileKey, var((float)mAutoresizeBufferQuantile), nullptr);
 
     ValueTree inputChannelGroupsTree = tempstate.getOrCreateChildWithName(inputChannelGroupsStateKey, nullptr);
     inputChannelGroupsTree.removeAllChildren(nullptr);
@@ -8107,15 +16245,18 @@ void SonobusAudioProcessor::getStateInformationWithOptions(MemoryBlock& destData
         inputChannelGroupsTree.appendChild(mInputChannelGroups[i].params.getValueTree(), nullptr);
     }
 
-    ValueTree peerCacheTree = tempstate.getOrCreateChildWithName(peerStateCacheMapKey, nullptr);
-    if (includecache) {
-        // update state with our recents info
-        peerCacheTree.removeAllChildren(nullptr);
-        for (auto & info : mPeerStateCacheMap) {
-            peerCacheTree.appendChild(info.second.getValueTree(), nullptr);
+    // the peer cache goes in as one binary blob, which is only redone when an entry changed
+    tempstate.removeChild(tempstate.getChildWithName(peerStateCacheMapKey), nullptr);
+    if (includecache && pendingrestore && pendingrestore->peerCacheTree.isValid()) {
+        tempstate.appendChild(pendingrestore->peerCacheTree.createCopy(), nullptr);
+    }
+    else if (includecache) {
+        ValueTree peerCacheTree(peerStateCacheMapKey);
+        {
+            const ScopedLock sl (mPeerStateCacheLock);
+            peerCacheTree.setProperty(peerStateCacheDataKey, var(getPeerStateCacheData()), nullptr);
         }
-    } else {
-        tempstate.removeChild(peerCacheTree, nullptr);
+        tempstate.appendChild(peerCacheTree, nullptr);
     }
 
     if (xmlformat) {
@@ -8155,14 +16296,14 @@ void SonobusAudioProcessor::setStateInformationWithOptions (const void* data, in
         DBG("SETSTATE: " << mState.state.toXmlString());
 
         if (includecache) {
+            // these can be big and nothing needs them yet, they get parsed in the background
             ValueTree recentsTree = mState.state.getChildWithName(recentsCollectionKey);
-            if (recentsTree.isValid()) {
-                mRecentConnectionInfos.clear();
-                for (auto child : recentsTree) {
-                    AooServerConnectionInfo info;
-                    info.setFromValueTree(child);
-                    mRecentConnectionInfos.add(info);
-                }
+            ValueTree peerCacheTree = mState.state.getChildWithName(peerStateCacheMapKey);
+            // the map is what counts from now on, no need to keep copying it around with the state
+            mState.state.removeChild(peerCacheTree, nullptr);
+
+            if (recentsTree.isValid() || peerCacheTree.isValid()) {
+                startStateRestore(recentsTree.createCopy(), peerCacheTree);
             }
         }
 
@@ -8193,13 +16334,66 @@ void SonobusAudioProcessor::setStateInformationWithOptions (const void* data, in
             setSelfRecordingPreFX(prefx);
 
             setRecordFinishOpens(extraTree.getProperty(recordFinishOpenKey, mRecordFinishOpens));
+            setCrashSafeRecording(extraTree.getProperty(crashSafeRecordingKey, mCrashSafeRecording.load()));
 
 
 #if !(JUCE_IOS || JUCE_ANDROID)
             setDefaultRecordingDirectory(extraTree.getProperty(defRecordDirKey, mDefaultRecordDir));
 #endif
             setSlidersSnapToMousePosition(extraTree.getProperty(sliderSnapKey, mSliderSnapToMouse));
+            setParallelPeerRender(extraTree.getProperty(parallelPeerRenderKey, mParallelPeerRender.load()));
+            setResampleQuality(extraTree.getProperty(resampleQualityKey, mResampleQuality.load()));
+            setTimeStretch(extraTree.getProperty(timeStretchKey, mTimeStretch.load()));
+            setLoadShedding(extraTree.getProperty(loadSheddingKey, mLoadShedding.load()));
+            setProcessQuantum(extraTree.getProperty(processQuantumKey, mProcessQuantum.load()));
+            setParallelPeerSend(extraTree.getProperty(parallelPeerSendKey, mParallelPeerSend.load()));
+            setAutoPacketSize(extraTree.getProperty(autoPacketSizeKey, mAutoPacketSize.load()));
+            setSendPacing(extraTree.getProperty(sendPacingKey, mSendPacing.load()));
+            setRealtimeNetworkThreads(extraTree.getProperty(realtimeNetworkThreadsKey, mRealtimeNetworkThreads.load()));
+            setPowerSaving(extraTree.getProperty(powerSavingKey, mPowerSaving.load()));
+            setNetworkThreadAffinity(parseCpuCoreList(extraTree.getProperty(networkThreadCoresKey, cpuCoreListToString(mNetworkThreadAffinity.load())).toString()));
+            setReceivePollMode((ReceivePollMode) (int) extraTree.getProperty(receivePollModeKey, (int) mReceivePollMode.load()));
+            setReceiveThreadCore(extraTree.getProperty(receiveThreadCoreKey, mReceiveThreadCore.load()));
+            setInlineSend(extraTree.getProperty(inlineSendKey, mInlineSend.load()));
+            setSharedSendEncoding(extraTree.getProperty(sharedSendEncodingKey, mSharedSendEncoding.load()));
+            setSimulcastSending(extraTree.getProperty(simulcastSendingKey, mSimulcastSending.load()));
+            setServerForwarding(extraTree.getProperty(serverForwardingKey, mServerForwarding.load()));
+            setLanMulticast(extraTree.getProperty(lanMulticastKey, mLanMulticast.load()));
+            setLanDiscoveryGroup(extraTree.getProperty(lanDiscoveryGroupKey, getLanDiscoveryGroup()));
+            setLanDiscovery(extraTree.getProperty(lanDiscoveryKey, mLanDiscoveryEnabled.load()));
+            setPacketEncryption(extraTree.getProperty(packetEncryptionKey, getPacketEncryption()));
+            setDoubleEnderRecording(extraTree.getProperty(doubleEnderRecordingKey, mDoubleEnderRecording.load()));
+            setDoubleEnderCollecting(extraTree.getProperty(doubleEnderCollectingKey, mDoubleEnderCollecting.load()));
+            setDoubleEnderUploadRate(extraTree.getProperty(doubleEnderUploadRateKey, mDoubleEnderUploadRate.load()));
+            setBroadcastUrl(extraTree.getProperty(broadcastUrlKey, getBroadcastUrl()));
+            setBroadcastQuality(extraTree.getProperty(broadcastQualityKey, mBroadcastQuality.load()));
+            setEnsembleAlignment(extraTree.getProperty(ensembleAlignmentKey, mEnsembleAlignment.load()));
+            setSessionRateNegotiation(extraTree.getProperty(sessionRateNegotiationKey, mSessionRateNegotiation.load()));
+            setOfflineBounceCapture(extraTree.getProperty(offlineBounceCaptureKey, mOfflineBounceCapture.load()));
+            setReverbRateReduction((ReverbRateReduction) (int) extraTree.getProperty(reverbRateReductionKey, (int) mReverbRateReduction.load()));
+            setShareBackingTrack(extraTree.getProperty(shareBackingTrackKey, mShareBackingTrack.load()));
+            setCodecCpuBudget(extraTree.getProperty(codecCpuBudgetKey, mCodecCpuBudget.load()));
+            if (extraTree.hasProperty(codecCostsKey)) {
+                // measured before, unless the formats changed since
+                auto costs = SonoAudio::CodecCalibration::fromString(extraTree.getProperty(codecCostsKey).toString());
+                if (costs.size() == mAudioFormats.size()) {
+                    const ScopedLock sl (mCodecCostsLock);
+                    mCodecCosts = costs;
+                }
+            }
+            setMixNodeMode(extraTree.getProperty(mixNodeModeKey, mMixNodeMode.load()));
+            setListenerRole(extraTree.getProperty(listenerRoleKey, mListenerRole.load()));
+            setAdaptiveSendBitrate(extraTree.getProperty(adaptiveSendBitrateKey, mAdaptiveSendBitrate.load()));
+            setAdaptiveFrameSize(extraTree.getProperty(adaptiveFrameSizeKey, mAdaptiveFrameSize.load()));
+            setNetworkDscp(extraTree.getProperty(networkDscpKey, mNetworkDscp.load()));
+            setMultipathLocalAddress(extraTree.getProperty(multipathLocalAddressKey, getMultipathLocalAddress()));
+            setMultipathMode(extraTree.getProperty(multipathModeKey, mMultipathMode.load()));
+            setStreamPlaybackDirect(extraTree.getProperty(streamPlaybackDirectKey, mStreamPlaybackDirect.load()));
+            setSyncMetToSession(extraTree.getProperty(syncMetToSessionKey, mSyncMetToSession.load()));
             setDisableKeyboardShortcuts(extraTree.getProperty(disableShortcutsKey, mDisableKeyboardShortcuts));
+            setUseOpenGLRendering(extraTree.getProperty(useOpenGLKey, mUseOpenGLRendering));
+            setChatHistoryLimit(extraTree.getProperty(chatHistoryLimitKey, getChatHistoryLimit()));
+            setChatSpillToDisk(extraTree.getProperty(chatSpillToDiskKey, getChatSpillToDisk()));
             setPeerDisplayMode((PeerDisplayMode)(int)extraTree.getProperty(peerDisplayModeKey, (int)mPeerDisplayMode));
             setLastChatWidth((int)extraTree.getProperty(lastChatWidthKey, (int)mLastChatWidth));
             setLastChatShown(extraTree.getProperty(lastChatShownKey, mLastChatShown));
@@ -8212,6 +16406,7 @@ void SonobusAudioProcessor::setStateInformationWithOptions (const void* data, in
                                                      extraTree.getProperty(lastWindowHeightKey, (int)mPluginWindowHeight)));
 
             setAutoresizeBufferDropRateThreshold(extraTree.getProperty(autoresizeDropRateThreshKey, (float)mAutoresizeDropRateThresh));
+            setAutoresizeBufferQuantile(extraTree.getProperty(autoresizeBufferQuantileKey, (float)mAutoresizeBufferQuantile));
         }
 
 
@@ -8232,10 +16427,6 @@ void SonobusAudioProcessor::setStateInformationWithOptions (const void* data, in
 
         }
 
-        if (includecache) {
-            loadPeerCacheFromState();
-        }
-        
         // don't recover the metronome enable state, always default it to off
         mState.getParameter(paramMetEnabled)->setValueNotifyingHost(0.0f);
 
@@ -8276,6 +16467,7 @@ ValueTree SonobusAudioProcessor::PeerStateCache::getValueTree() const
     item.setProperty(numChanGroupsKey, numChanGroups, nullptr);
     item.setProperty(peerLevelKey, mainGain, nullptr);
     item.setProperty(peerOrderPriorityKey, orderPriority, nullptr);
+    item.setProperty(peerLastUsedKey, lastUsed, nullptr);
 
     ValueTree channelGroupsTree(channelGroupsStateKey);
 
@@ -8309,11 +16501,12 @@ void SonobusAudioProcessor::PeerStateCache::setFromValueTree(const ValueTree & i
 
     mainGain = item.getProperty(peerLevelKey, mainGain);
     orderPriority = item.getProperty(peerOrderPriorityKey, orderPriority);
+    lastUsed = item.getProperty(peerLastUsedKey, lastUsed);
 
     // backwards compat
-    channelGroupParams[0].pan[0] = item.getProperty(peerMonoPanKey, channelGroupParams[0].pan[0]);
-    channelGroupParams[0].panStereo[0] = item.getProperty(peerPan1Key, channelGroupParams[0].panStereo[0]);
-    channelGroupParams[0].panStereo[1] = item.getProperty(peerPan2Key, channelGroupParams[0].panStereo[1]);
+    channelGroupParams[0].pan[0] = item.getProperty(peerMonoPanKey, channelGroupParams[0].pan[0].get());
+    channelGroupParams[0].panStereo[0] = item.getProperty(peerPan1Key, channelGroupParams[0].panStereo[0].get());
+    channelGroupParams[0].panStereo[1] = item.getProperty(peerPan2Key, channelGroupParams[0].panStereo[1].get());
 
     ValueTree compressorTree = item.getChildWithName(compressorStateKey);
     if (compressorTree.isValid()) {
@@ -8353,36 +16546,171 @@ void SonobusAudioProcessor::PeerStateCache::setFromValueTree(const ValueTree & i
     }
 }
 
-void SonobusAudioProcessor::loadPeerCacheFromState()
+void SonobusAudioProcessor::PeerStateCache::updateEncoded()
+{
+    encoded.reset();
+    MemoryOutputStream stream (encoded, false);
+    getValueTree().writeToStream(stream);
+}
+
+void SonobusAudioProcessor::startStateRestore(const ValueTree & recentsTree, const ValueTree & peerCacheTree)
+{
+    // one still in the works goes first, this one replaces what it brought
+    finishStateRestore();
+
+    auto pending = std::make_shared<PendingStateRestore>();
+    pending->recentsTree = recentsTree;
+    pending->peerCacheTree = peerCacheTree;
+
+    {
+        const ScopedLock sl (mPendingStateRestoreLock);
+        mPendingStateRestore = pending;
+        mStateRestorePending = true;
+    }
+
+    if (!mStateRestorePool) {
+        mStateRestorePool = std::make_unique<ThreadPool>(1);
+    }
+
+    mStateRestorePool->addJob([this, pending] {
+        for (auto child : pending->recentsTree) {
+            AooServerConnectionInfo info;
+            info.setFromValueTree(child);
+            pending->recents.add(info);
+            preResolveServerHost(info.serverHost);
+        }
+
+        if (pending->peerCacheTree.isValid()) {
+            const var & data = pending->peerCacheTree.getProperty(peerStateCacheDataKey);
+            if (auto * block = data.getBinaryData()) {
+                if (parsePeerStateCacheData(*block, pending->peerCache, pending->peerCacheDataValid)) {
+                    // as read is what we'd write
+                    pending->peerCacheData = *block;
+                }
+                else {
+                    // not taken then, the cache stays as it is
+                    pending->peerCacheTree = ValueTree();
+                }
+            }
+            else {
+                // older states have a child per peer
+                for (auto child : pending->peerCacheTree) {
+                    PeerStateCache info;
+                    info.setFromValueTree(child);
+                    info.updateEncoded();
+                    pending->peerCache.insert(PeerStateCacheMap::value_type(info.name, info));
+                }
+            }
+        }
+
+        pending->done.signal();
+    });
+}
+
+void SonobusAudioProcessor::finishStateRestore()
+{
+    if (!mStateRestorePending.load()) return;
+
+    // held throughout, so nobody goes on with the old recents or cache while they're taken over
+    const ScopedLock sl (mPendingStateRestoreLock);
+    if (!mPendingStateRestore) return;
+
+    auto & pending = *mPendingStateRestore;
+    pending.done.wait(-1);
+
+    if (pending.recentsTree.isValid()) {
+        const ScopedLock rl (mRecentsLock);
+        mRecentConnectionInfos.swapWith(pending.recents);
+    }
+
+    if (pending.peerCacheTree.isValid()) {
+        const ScopedLock cl (mPeerStateCacheLock);
+        mPeerStateCacheMap.swap(pending.peerCache);
+        mPeerStateCacheData = pending.peerCacheData;
+        mPeerStateCacheDataValid = pending.peerCacheDataValid;
+        trimPeerStateCache();
+    }
+
+    mPendingStateRestore.reset();
+    mStateRestorePending = false;
+}
+
+std::shared_ptr<SonobusAudioProcessor::PendingStateRestore> SonobusAudioProcessor::getPendingStateRestore() const
 {
-    ValueTree peerCacheMapTree = mState.state.getChildWithName(peerStateCacheMapKey);
-    if (peerCacheMapTree.isValid()) {
-        mPeerStateCacheMap.clear();
-        for (auto child : peerCacheMapTree) {
-            PeerStateCache info;
-            info.setFromValueTree(child);
-            mPeerStateCacheMap.insert(PeerStateCacheMap::value_type(info.name, info));
-        }
-    }
-    
+    if (!mStateRestorePending.load()) return nullptr;
+
+    const ScopedLock sl (mPendingStateRestoreLock);
+    return mPendingStateRestore;
 }
 
 void SonobusAudioProcessor::storePeerCacheToState()
 {
+    finishStateRestore();
+
     ValueTree peerCacheTree = mState.state.getOrCreateChildWithName(peerStateCacheMapKey, nullptr);
-    // update state with our recents info
     peerCacheTree.removeAllChildren(nullptr);
+
+    const ScopedLock sl (mPeerStateCacheLock);
+    peerCacheTree.setProperty(peerStateCacheDataKey, var(getPeerStateCacheData()), nullptr);
+}
+
+// "SBPC", a version, the entry count, then each entry's size and encoded ValueTree
+static const int peerStateCacheDataMagic = (int) ByteOrder::littleEndianInt("SBPC");
+static const int peerStateCacheDataVersion = 1;
+
+const MemoryBlock & SonobusAudioProcessor::getPeerStateCacheData()
+{
+    if (mPeerStateCacheDataValid) return mPeerStateCacheData;
+
+    mPeerStateCacheData.reset();
+    MemoryOutputStream stream (mPeerStateCacheData, false);
+    stream.writeInt(peerStateCacheDataMagic);
+    stream.writeInt(peerStateCacheDataVersion);
+    stream.writeCompressedInt((int) mPeerStateCacheMap.size());
+
     for (auto & info : mPeerStateCacheMap) {
-        peerCacheTree.appendChild(info.second.getValueTree(), nullptr);        
+        stream.writeCompressedInt((int) info.second.encoded.getSize());
+        stream.write(info.second.encoded.getData(), info.second.encoded.getSize());
+    }
+    stream.flush();
+
+    mPeerStateCacheDataValid = true;
+    return mPeerStateCacheData;
+}
+
+bool SonobusAudioProcessor::parsePeerStateCacheData(const MemoryBlock & data, PeerStateCacheMap & map, bool & complete)
+{
+    MemoryInputStream stream (data, false);
+    if (stream.readInt() != peerStateCacheDataMagic || stream.readInt() > peerStateCacheDataVersion) {
+        DBG("Unrecognized peer state cache data");
+        return false;
+    }
+
+    map.clear();
+
+    const int count = stream.readCompressedInt();
+    for (int i=0; i < count && !stream.isExhausted(); ++i) {
+        const int size = stream.readCompressedInt();
+        if (size <= 0 || size > stream.getNumBytesRemaining()) break;
+
+        PeerStateCache info;
+        stream.readIntoMemoryBlock(info.encoded, size);
+
+        ValueTree item = ValueTree::readFromData(info.encoded.getData(), info.encoded.getSize());
+        if (!item.isValid()) continue;
+
+        info.setFromValueTree(item);
+        map.insert(PeerStateCacheMap::value_type(info.name, info));
     }
 
+    complete = (int) map.size() == count;
+    return true;
 }
 
 bool SonobusAudioProcessor::startRecordingToFile(File & file, uint32 recordOptions, RecordFileFormat fileformat)
 {
-    if (!recordingThread) {
-        recordingThread = std::make_unique<TimeSliceThread>("Recording Thread");
-        recordingThread->startThread();        
+    if (!mRecordingEngine) {
+        mRecordingEngine = std::make_unique<SonoAudio::RecordingEngine>();
     }
     
     stopRecordingToFile();
@@ -8442,23 +16770,63 @@ bool SonobusAudioProcessor::startRecordingToFile(File & file, uint32 recordOptio
         return false;
     }
 
+    // in crash safe mode everything goes to journals, finalized to the real files once we stop
+    const bool crashsafe = mCrashSafeRecording.load();
+
+    if (crashsafe) {
+        // left over from a crash while recording here before
+        finalizeRecordingJournals(SonoAudio::RecordingJournal::findJournals(usefile.getParentDirectory()));
+    }
+
+    auto recordFileFor = [crashsafe] (const File & destfile) {
+        return crashsafe ? SonoAudio::RecordingJournal::getJournalFile(destfile) : destfile;
+    };
+
+    auto createWriter = [this, crashsafe, bitsPerSample, qualindex] (AudioFormat * format, FileOutputStream * stream, int numchans) -> AudioFormatWriter* {
+        if (crashsafe) {
+            return new SonoAudio::RecordingJournal::Writer(stream, getSampleRate(), numchans, bitsPerSample, qualindex);
+        }
+        return format->createWriterFor (stream, getSampleRate(), numchans, bitsPerSample, {}, qualindex);
+    };
+
+    // the tracks get their ring sized and their file space reserved from the expected data rate
+    auto makeTrack = [this, crashsafe, bitsPerSample, &recordFileFor] (AudioFormatWriter * writer, const File & destfile, const AudioFormat * format) {
+        const int numchans = (int) writer->getNumChannels();
+        const File recfile = recordFileFor(destfile);
+        if (crashsafe) {
+            // raw floats, no encoding to do
+            mActiveRecordJournals.add(recfile);
+            return mRecordingEngine->createTrack(writer, recfile, false, (int64) getSampleRate() * numchans * 4, destfile);
+        }
+
+        const bool compressed = dynamic_cast<const WavAudioFormat*>(format) == nullptr;
+        int64 bytespersec = (int64) getSampleRate() * numchans * bitsPerSample / 8;
+        if (dynamic_cast<const OggVorbisAudioFormat*>(format)) {
+            bytespersec = 16000 * numchans; // 256k for stereo
+        } else if (dynamic_cast<const FlacAudioFormat*>(format)) {
+            bytespersec = bytespersec * 2 / 3;
+        }
+        return mRecordingEngine->createTrack(writer, recfile, compressed, bytespersec, destfile);
+    };
+
     bool userwriting = false;
 
     if (recordOptions == RecordMix) {
 
         // Create an OutputStream to write to our destination file...
         usefile.deleteFile();
+        recordFileFor(usefile).deleteFile();
         
-        if (auto fileStream = std::unique_ptr<FileOutputStream> (usefile.createOutputStream()))
+        if (auto fileStream = std::unique_ptr<FileOutputStream> (recordFileFor(usefile).createOutputStream()))
         {
             
-            if (auto writer = audioFormat->createWriterFor (fileStream.get(), getSampleRate(), totalRecordingChannels, bitsPerSample, {}, qualindex))
+            if (auto writer = createWriter(audioFormat.get(), fileStream.get(), totalRecordingChannels))
             {
                 fileStream.release(); // (passes responsibility for deleting the stream to the writer object that is now using it)
                 
                 // Now we'll create one of these helper objects which will act as a FIFO buffer, and will
                 // write the data to disk on our background thread.
-                threadedMixWriter.reset (new AudioFormatWriter::ThreadedWriter (writer, *recordingThread, 32768));
+                threadedMixWriter = makeTrack(writer, usefile, audioFormat.get());
                 
                 DBG("Started recording only mix file " << usefile.getFullPathName());
 
@@ -8492,15 +16860,15 @@ bool SonobusAudioProcessor::startRecordingToFile(File & file, uint32 recordOptio
             String filename = usefile.getFileNameWithoutExtension() + "-MIXMINUS" + usefile.getFileExtension();
             filename = File::createLegalFileName(filename);
             File thefile = recdir.getChildFile(filename).getNonexistentSibling();
-            if (auto fileStream = std::unique_ptr<FileOutputStream> (thefile.createOutputStream()))
+            if (auto fileStream = std::unique_ptr<FileOutputStream> (recordFileFor(thefile).createOutputStream()))
             {                
-                if (auto writer = audioFormat->createWriterFor (fileStream.get(), getSampleRate(), totalRecordingChannels, bitsPerSample, {}, qualindex))
+                if (auto writer = createWriter(audioFormat.get(), fileStream.get(), totalRecordingChannels))
                 {
                     fileStream.release(); // (passes responsibility for deleting the stream to the writer object that is now using it)
                     
                     // Now we'll create one of these helper objects which will act as a FIFO buffer, and will
                     // write the data to disk on our background thread.
-                    threadedMixMinusWriter.reset (new AudioFormatWriter::ThreadedWriter (writer, *recordingThread, 32768));
+                    threadedMixMinusWriter = makeTrack(writer, thefile, audioFormat.get());
 
                     DBG("Created mix minus output file: " << thefile.getFullPathName());
              
@@ -8524,15 +16892,15 @@ bool SonobusAudioProcessor::startRecordingToFile(File & file, uint32 recordOptio
                 String filename = usefile.getFileNameWithoutExtension() + (inname.isEmpty() ? "-SELF" : ("-SELF-" + inname)) + usefile.getFileExtension();
                 filename = File::createLegalFileName(filename);
                 File thefile = recdir.getChildFile(filename).getNonexistentSibling();
-                if (auto fileStream = std::unique_ptr<FileOutputStream> (thefile.createOutputStream()))
+                if (auto fileStream = std::unique_ptr<FileOutputStream> (recordFileFor(thefile).createOutputStream()))
                 {
-                    if (auto writer = audioFormat->createWriterFor (fileStream.get(), getSampleRate(), chans, bitsPerSample, {}, qualindex))
+                    if (auto writer = createWriter(audioFormat.get(), fileStream.get(), chans))
                     {
                         fileStream.release(); // (passes responsibility for deleting the stream to the writer object that is now using it)
 
                         // Now we'll create one of these helper objects which will act as a FIFO buffer, and will
                         // write the data to disk on our background thread.
-                        threadedSelfWriters.add (new AudioFormatWriter::ThreadedWriter (writer, *recordingThread, 32768));
+                        threadedSelfWriters.add (makeTrack(writer, thefile, audioFormat.get()).release());
 
                         DBG("Created self output file: " << thefile.getFullPathName());
 
@@ -8552,15 +16920,15 @@ bool SonobusAudioProcessor::startRecordingToFile(File & file, uint32 recordOptio
             String filename = usefile.getFileNameWithoutExtension() + "-MIX" + usefile.getFileExtension();
             filename = File::createLegalFileName(filename);
             File thefile = recdir.getChildFile(filename).getNonexistentSibling();
-            if (auto fileStream = std::unique_ptr<FileOutputStream> (thefile.createOutputStream()))
+            if (auto fileStream = std::unique_ptr<FileOutputStream> (recordFileFor(thefile).createOutputStream()))
             {                
-                if (auto writer = audioFormat->createWriterFor (fileStream.get(), getSampleRate(), totalRecordingChannels, bitsPerSample, {}, qualindex))
+                if (auto writer = createWriter(audioFormat.get(), fileStream.get(), totalRecordingChannels))
                 {
                     fileStream.release(); // (passes responsibility for deleting the stream to the writer object that is now using it)
                     
                     // Now we'll create one of these helper objects which will act as a FIFO buffer, and will
                     // write the data to disk on our background thread.
-                    threadedMixWriter.reset (new AudioFormatWriter::ThreadedWriter (writer, *recordingThread, 32768));
+                    threadedMixWriter = makeTrack(writer, thefile, audioFormat.get());
 
                     DBG("Created mix output file: " << thefile.getFullPathName());
 
@@ -8602,16 +16970,16 @@ bool SonobusAudioProcessor::startRecordingToFile(File & file, uint32 recordOptio
                 File thefile = recdir.getChildFile(userfilename).getNonexistentSibling();
 
 
-                if (auto fileStream = std::unique_ptr<FileOutputStream> (thefile.createOutputStream()))
+                if (auto fileStream = std::unique_ptr<FileOutputStream> (recordFileFor(thefile).createOutputStream()))
                 {
                     // flac has a max of FLAC__MAX_CHANNELS, if we exceed that, fallback to WAV
-                    if (auto writer = useformat->createWriterFor (fileStream.get(), getSampleRate(), numchan, bitsPerSample, {}, qualindex))
+                    if (auto writer = createWriter(useformat, fileStream.get(), numchan))
                     {
                         fileStream.release(); // (passes responsibility for deleting the stream to the writer object that is now using it)
                         
                         // Now we'll create one of these helper objects which will act as a FIFO buffer, and will
                         // write the data to disk on our background thread.
-                        remote->fileWriter = std::make_unique<AudioFormatWriter::ThreadedWriter>(writer, *recordingThread, 32768);
+                        remote->fileWriter = makeTrack(writer, thefile, useformat);
 
                         DBG("Created user output file: " << thefile.getFullPathName());
                         ret = true;
@@ -8624,12 +16992,47 @@ bool SonobusAudioProcessor::startRecordingToFile(File & file, uint32 recordOptio
                 }
             }
         }
+
+        if (recordOptions & RecordIndividualUserPackets) {
+            const ScopedReadLock sl (mCoreLock);
+            const int64 sessionstart = Time::getHighResolutionTicks();
+
+            mLastPacketArchives.clearQuick();
+
+            for (auto & remote : mRemotePeers) {
+                if (!remote->oursink) continue;
+
+                String userfilename = File::createLegalFileName(usefile.getFileNameWithoutExtension() + "-" + remote->userName + "-PACKETS" + SonoAudio::PacketArchive::FileExtension);
+                File thefile = recdir.getChildFile(userfilename).getNonexistentSibling();
+
+                // a few seconds of the worst case, uncompressed floats
+                const int ringbytes = jmax(1 << 20, (int) (4.0 * getSampleRate() * jmax(2, remote->recvChannels) * sizeof(float)));
+                auto archive = std::make_unique<SonoAudio::PacketArchive::Writer>(*mRecordingEngine, thefile, sessionstart, ringbytes);
+                if (!archive->isOpen()) {
+                    DBG("Error creating user packet archive: " << thefile.getFullPathName());
+                    continue;
+                }
+
+                {
+                    const SpinLock::ScopedLockType al (remote->packetArchiveLock);
+                    remote->packetArchive = std::move(archive);
+                }
+                remote->oursink->set_packet_tap(peerPacketTap, remote);
+
+                mLastPacketArchives.add(thefile);
+                DBG("Created user packet archive: " << thefile.getFullPathName());
+                file = thefile;
+                ret = true;
+                mPacketArchiving = true;
+            }
+        }
     }
     
     if (ret) {
         // And now, swap over our active writer pointers so that the audio callback will start using it..
         const ScopedLock sl (writerLock);
         mElapsedRecordSamples = 0;
+        mRecordingEngine->resetDroppedSamples();
         activeMixWriter = threadedMixWriter.get();
         activeMixMinusWriter = threadedMixMinusWriter.get();
 
@@ -8646,19 +17049,127 @@ bool SonobusAudioProcessor::startRecordingToFile(File & file, uint32 recordOptio
 
         userWritingPossible.store(userwriting);
 
+        // what the double-ender uploads get lined up with
+        mRecordStartTime = aoo_osctime_get();
+        mDoubleEnderAnnounceNow = true;
+        notifyEventThread();
+
         //DBG("Started recording file " << usefile.getFullPathName());
     }
 
     sendRemotePeerInfoUpdate();
+    updateRemotePeerSubscriptions();
 
     return ret;
 }
 
+void SonobusAudioProcessor::setPeerTelemetryEnabled(bool flag)
+{
+    if (mPeerTelemetry.exchange(flag) == flag) return;
+
+    const ScopedReadLock sl (mCoreLock);
+    for (auto & remote : mRemotePeers) {
+        if (flag) {
+            startPeerTelemetry(remote);
+        } else {
+            stopPeerTelemetry(remote);
+        }
+    }
+}
+
+File SonobusAudioProcessor::getPeerTelemetryDirectory() const
+{
+    return File(mDefaultRecordDir).getChildFile("Telemetry");
+}
+
+void SonobusAudioProcessor::setTimelineTracing(bool flag)
+{
+    if (TraceRecorder::isActive() == flag) return;
+
+    if (flag) {
+        TraceRecorder::start();
+    } else {
+        TraceRecorder::stop();
+    }
+
+    {
+        const ScopedReadLock sl (mCoreLock);
+        for (auto & remote : mRemotePeers) {
+            if (remote->oursink) {
+                remote->oursink->set_trace_tap(flag ? peerTraceTap : nullptr, nullptr);
+            }
+        }
+    }
+
+    if (!flag) {
+        auto dir = getPeerTelemetryDirectory();
+        dir.createDirectory();
+        File thefile = dir.getChildFile(Time::getCurrentTime().formatted("%Y-%m-%d_%H.%M.%S") + "-timeline.json").getNonexistentSibling();
+        if (TraceRecorder::writeChromeTrace(thefile)) {
+            DBG("Wrote timeline trace: " << thefile.getFullPathName());
+        } else {
+            DBG("Error writing timeline trace: " << thefile.getFullPathName());
+        }
+    }
+}
+
+bool SonobusAudioProcessor::getTimelineTracing() const
+{
+    return TraceRecorder::isActive();
+}
+
+void SonobusAudioProcessor::startPeerTelemetry(RemotePeer * remote)
+{
+    if (!remote->oursink || remote->telemetryLog) return;
+
+    if (!mDiskThread.isThreadRunning()) {
+        mDiskThread.startThread (3);
+    }
+
+    auto dir = getPeerTelemetryDirectory();
+    dir.createDirectory();
+
+    String peername = remote->userName.isNotEmpty() ? remote->userName : remote->endpoint ? String(remote->endpoint->ipaddr) + ":" + String(remote->endpoint->port) : String("peer");
+    String filename = File::createLegalFileName(Time::getCurrentTime().formatted("%Y-%m-%d_%H.%M.%S") + "-" + peername + SonoAudio::TelemetryLog::FileExtension);
+    File thefile = dir.getChildFile(filename).getNonexistentSibling();
+
+    auto log = std::make_unique<SonoAudio::TelemetryLog::Writer>(mDiskThread, thefile, peername);
+    if (!log->isOpen()) {
+        DBG("Error creating peer telemetry log: " << thefile.getFullPathName());
+        return;
+    }
+
+    {
+        const SpinLock::ScopedLockType tl (remote->telemetryLock);
+        remote->telemetryLog = std::move(log);
+    }
+    remote->oursink->set_telemetry_tap(peerTelemetryTap, remote);
+
+    DBG("Created peer telemetry log: " << thefile.getFullPathName());
+}
+
+void SonobusAudioProcessor::stopPeerTelemetry(RemotePeer * remote)
+{
+    if (remote->oursink) {
+        remote->oursink->set_telemetry_tap(nullptr, nullptr);
+    }
+
+    std::unique_ptr<SonoAudio::TelemetryLog::Writer> log;
+    {
+        // once we have the lock no tap call is using the log anymore
+        const SpinLock::ScopedLockType tl (remote->telemetryLock);
+        log = std::move(remote->telemetryLog);
+    }
+    // flushing the rest happens here, outside the lock
+    log.reset();
+}
+
 bool SonobusAudioProcessor::stopRecordingToFile()
 {
     // First, clear this pointer to stop the audio callback from using our writer object..
 
-    OwnedArray<AudioFormatWriter::ThreadedWriter> userwriters;
+    OwnedArray<SonoAudio::RecordingTrack> userwriters;
+    OwnedArray<SonoAudio::PacketArchive::Writer> packetarchives;
 
     {
         const ScopedReadLock scl (mCoreLock);
@@ -8678,8 +17189,19 @@ bool SonobusAudioProcessor::stopRecordingToFile()
             if (remote->fileWriter) {
                 userwriters.add(std::move(remote->fileWriter));
             }
+
+            // once we have the lock no tap call is using the archive anymore
+            if (remote->oursink) {
+                remote->oursink->set_packet_tap(nullptr, nullptr);
+            }
+            const SpinLock::ScopedLockType al (remote->packetArchiveLock);
+            if (remote->packetArchive) {
+                packetarchives.add(std::move(remote->packetArchive));
+            }
         }
 
+        mPacketArchiving = false;
+
     }
     
     bool didit = false;
@@ -8715,7 +17237,30 @@ bool SonobusAudioProcessor::stopRecordingToFile()
         didit = true;
     }
 
+    if (!packetarchives.isEmpty()) {
+        packetarchives.clear();
+        DBG("Stopped recording user packet archives");
+        didit = true;
+    }
+
+    if (didit && getRecordingDroppedSamples() > 0) {
+        DBG("Recording dropped " << getRecordingDroppedSamples() << " samples");
+    }
+
+    // the journals are complete now, turn them into the real files without holding anyone up
+    if (!mActiveRecordJournals.isEmpty()) {
+        finalizeRecordingJournals(mActiveRecordJournals);
+        mActiveRecordJournals.clearQuick();
+    }
+
+    if (didit) {
+        // our double-ender peers can start their uploads
+        mDoubleEnderAnnounceNow = true;
+        notifyEventThread();
+    }
+
     sendRemotePeerInfoUpdate();
+    updateRemotePeerSubscriptions();
 
     return didit;
 }
@@ -8726,16 +17271,155 @@ bool SonobusAudioProcessor::isRecordingToFile()
             || threadedSelfWriters.size() > 0
             || activeMixMinusWriter.load() != nullptr 
             || userWritingPossible.load()
+            || mPacketArchiving.load()
             );
 }
 
+void SonobusAudioProcessor::finalizeRecordingJournals(const Array<File> & journals)
+{
+    if (journals.isEmpty()) return;
+
+    if (!mRecordingFinishPool) {
+        mRecordingFinishPool = std::make_unique<ThreadPool>(1);
+    }
+
+    for (auto & journal : journals) {
+        ++mPendingJournalFinalizes;
+        mRecordingFinishPool->addJob([this, journal] {
+            String err;
+            File finalfile;
+            if (SonoAudio::RecordingJournal::finalize(journal, err, &finalfile)) {
+                // the peaks recorded along with it are only good for the finished file
+                SonoAudio::WaveformPeakCache::commitPendingPeaks(SonoAudio::RecordingJournal::getFinalFile(journal), finalfile);
+                DBG("Finalized recording " << finalfile.getFullPathName());
+            } else {
+                DBG(err);
+            }
+            --mPendingJournalFinalizes;
+        });
+    }
+}
+
+void SonobusAudioProcessor::renderPacketArchives(const Array<File> & archives, const File & destFile, bool stems, RecordFileFormat fileformat)
+{
+    if (archives.isEmpty()) return;
+
+    if (!mRecordingFinishPool) {
+        mRecordingFinishPool = std::make_unique<ThreadPool>(1);
+    }
+
+    if (fileformat == FileFormatDefault || fileformat == FileFormatAuto) {
+        fileformat = mDefaultRecordingFormat;
+    }
+    const int bits = mDefaultRecordingBitsPerSample;
+
+    mRecordingFinishPool->addJob([archives, destFile, stems, fileformat, bits] {
+        std::unique_ptr<AudioFormat> format;
+        String ext;
+        int qualindex = 0;
+        if (fileformat == FileFormatOGG) { format = std::make_unique<OggVorbisAudioFormat>(); ext = ".ogg"; qualindex = 8; }
+        else if (fileformat == FileFormatWAV) { format = std::make_unique<WavAudioFormat>(); ext = ".wav"; }
+        else { format = std::make_unique<FlacAudioFormat>(); ext = ".flac"; }
+
+        String err;
+        if (stems) {
+            for (auto & archive : archives) {
+                const File dest = destFile.getChildFile(archive.getFileNameWithoutExtension() + ext).getNonexistentSibling();
+                if (!SonoAudio::PacketArchive::render({ archive }, dest, *format, bits, qualindex, err)) {
+                    DBG(err);
+                }
+            }
+        }
+        else if (!SonoAudio::PacketArchive::render(archives, destFile.withFileExtension(ext), *format, bits, qualindex, err)) {
+            DBG(err);
+        }
+    });
+}
+
+int64 SonobusAudioProcessor::getRecordingDroppedSamples() const
+{
+    return mRecordingEngine ? mRecordingEngine->getDroppedSamples() : 0;
+}
+
+bool SonobusAudioProcessor::startBroadcast(const String & url)
+{
+    stopBroadcast();
+
+    const String useurl = url.isNotEmpty() ? url : getBroadcastUrl();
+
+    if (!isRecordingToFile()) {
+        // otherwise the recording already set it, the mix is put together the same way for both
+        totalRecordingChannels = getMainBusNumOutputChannels();
+        if (totalRecordingChannels == 0) {
+            totalRecordingChannels = 2;
+        }
+    }
+
+    auto output = std::make_unique<SonoAudio::BroadcastOutput>();
+    if (!output->start(useurl, getSampleRate(), jmin(2, totalRecordingChannels), mBroadcastQuality.load())) {
+        mLastError = output->getLastError();
+        DBG(mLastError);
+        return false;
+    }
+
+    setBroadcastUrl(useurl);
+    mBroadcastOutput = std::move(output);
+
+    const ScopedLock sl (writerLock);
+    activeBroadcastOutput = mBroadcastOutput.get();
+    return true;
+}
+
+void SonobusAudioProcessor::stopBroadcast()
+{
+    {
+        const ScopedLock sl (writerLock);
+        activeBroadcastOutput = nullptr;
+    }
+    // waits for the encoder to finish what it has
+    mBroadcastOutput.reset();
+}
+
+bool SonobusAudioProcessor::isBroadcastConnected() const
+{
+    return mBroadcastOutput && mBroadcastOutput->getState() == SonoAudio::BroadcastOutput::StateStreaming;
+}
+
+int64 SonobusAudioProcessor::getBroadcastDroppedSamples() const
+{
+    return mBroadcastOutput ? mBroadcastOutput->getDroppedSamples() : 0;
+}
+
+String SonobusAudioProcessor::getBroadcastUrl() const
+{
+    const ScopedLock sl (mBroadcastUrlLock);
+    return mBroadcastUrl;
+}
+
+void SonobusAudioProcessor::setBroadcastUrl(const String & url)
+{
+    const ScopedLock sl (mBroadcastUrlLock);
+    mBroadcastUrl = url.trim();
+}
+
 void SonobusAudioProcessor::clearTransportURL()
 {
     // unload the previous file source and delete it..
     mTransportSource.stop();
     mTransportSource.setSource (nullptr);
+    if (mPlaybackPrefetcher) {
+        mDiskThread.removeTimeSliceClient(mPlaybackPrefetcher.get());
+        mPlaybackPrefetcher.reset();
+    }
     mCurrentAudioFileSource.reset();
     mCurrTransportURL = URL();
+    mPendingPlaybackCacheSwap = false;
+
+    {
+        const ScopedLock sl (mBackingTrackOfferLock);
+        mBackingTrackOfferFile = File();
+    }
+    notifyEventThread();
 }
 
 bool SonobusAudioProcessor::loadURLIntoTransport (const URL& audioURL)
@@ -8744,15 +17428,41 @@ bool SonobusAudioProcessor::loadURLIntoTransport (const URL& audioURL)
         mDiskThread.startThread (3);
     }
 
+    if (!mPlaybackFileCache) {
+        mPlaybackFileCache = std::make_unique<SonoAudio::PlaybackFileCache>(mFormatManager);
+        mPlaybackFileCache->onCacheReady = [this] (const File & original, const File & cached) {
+            playbackCacheReady(original, cached);
+        };
+    }
+
     // unload the previous file source and delete it..
     clearTransportURL();
     
     AudioFormatReader* reader = nullptr;
+    MemoryMappedAudioFormatReader * mappedReader = nullptr;
     
 #if ! JUCE_IOS
     if (audioURL.isLocalFile())
     {
-        reader = mFormatManager.createReaderFor (audioURL.getLocalFile());
+        // played straight from memory if possible, no buffering on the way to the audio thread
+        const File file = audioURL.getLocalFile();
+        const File mappable = mPlaybackFileCache->getMappableFile(file);
+        if (mappable != File()) {
+            if (auto * format = mFormatManager.findFormatForFileExtension(mappable.getFileExtension())) {
+                std::unique_ptr<MemoryMappedAudioFormatReader> mapped (format->createMemoryMappedReader(mappable));
+                if (mapped && mapped->mapEntireFile() && !mapped->getMappedSection().isEmpty()) {
+                    reader = mappedReader = mapped.release();
+                }
+            }
+        }
+
+        if (reader == nullptr) {
+            reader = mFormatManager.createReaderFor (file);
+            if (reader != nullptr) {
+                // next time it'll be mapped
+                mPlaybackFileCache->requestDecode(file);
+            }
+        }
     }
     else
 #endif
@@ -8767,23 +17477,199 @@ bool SonobusAudioProcessor::loadURLIntoTransport (const URL& audioURL)
     {
         mCurrTransportURL = URL(audioURL);
 
+        if (audioURL.isLocalFile()) {
+            // the one we'd offer to the peers, see updateBackingTrackShare()
+            const ScopedLock sl (mBackingTrackOfferLock);
+            mBackingTrackOfferFile = audioURL.getLocalFile();
+        }
+        notifyEventThread();
+
         mCurrentAudioFileSource.reset (new AudioFormatReaderSource (reader, true));
 
         mTransportSource.prepareToPlay(currSamplesPerBlock, getSampleRate());
 
-        // ..and plug it into our transport source
-        mTransportSource.setSource (mCurrentAudioFileSource.get(),
-                                    65536,                   // tells it to buffer this many samples ahead
-                                    &mDiskThread,                 // this is the background thread to use for reading-ahead
-                                    reader->sampleRate,     // allows for sample rate correction
-                                    reader->numChannels);
+        if (mappedReader) {
+            // the disk thread only keeps the pages ahead of the play position resident
+            mTransportSource.setSource (mCurrentAudioFileSource.get(), 0, nullptr, reader->sampleRate, reader->numChannels);
+
+            mPlaybackPrefetcher = std::make_unique<SonoAudio::MappedPlaybackPrefetcher>(*mappedReader, *mCurrentAudioFileSource);
+            mDiskThread.addTimeSliceClient(mPlaybackPrefetcher.get());
+        }
+        else {
+            // ..and plug it into our transport source
+            mTransportSource.setSource (mCurrentAudioFileSource.get(),
+                                        65536,                   // tells it to buffer this many samples ahead
+                                        &mDiskThread,                 // this is the background thread to use for reading-ahead
+                                        reader->sampleRate,     // allows for sample rate correction
+                                        reader->numChannels);
+        }
+
+        updateFileStreamEncoding();
 
         return true;
     }
 
+    updateFileStreamEncoding();
+
     return false;
 }
 
+void SonobusAudioProcessor::playbackCacheReady(const File & original, const File & cached)
+{
+    ignoreUnused(cached);
+
+    if (mPlaybackPrefetcher || !mCurrTransportURL.isLocalFile() || mCurrTransportURL.getLocalFile() != original) {
+        return;
+    }
+
+    // switching the source while playing would be heard, wait for it to stop
+    if (mTransportSource.isPlaying()) {
+        mPendingPlaybackCacheSwap = true;
+    }
+    else {
+        swapToCachedPlayback();
+    }
+}
+
+void SonobusAudioProcessor::swapToCachedPlayback()
+{
+    mPendingPlaybackCacheSwap = false;
+
+    const URL url = mCurrTransportURL;
+    const double pos = mTransportSource.getCurrentPosition();
+    const bool looping = mTransportSource.isLooping();
+
+    if (loadURLIntoTransport(url)) {
+        mTransportSource.setLooping(looping);
+        mTransportSource.setPosition(pos);
+    }
+}
+
+void SonobusAudioProcessor::setStreamPlaybackDirect(bool flag)
+{
+    mStreamPlaybackDirect = flag;
+
+    updateFileStreamEncoding();
+    updateFileStreamSending();
+}
+
+void SonobusAudioProcessor::updateFileStreamEncoding()
+{
+    // only local files, and the same one isn't encoded again (e.g. when swapping to the cached copy)
+    const File file = mStreamPlaybackDirect.load() && mCurrTransportURL.isLocalFile() ? mCurrTransportURL.getLocalFile() : File();
+    if (file == mFileStreamFile) return;
+    mFileStreamFile = file;
+
+    if (mFileStreamEncodePool) {
+        mFileStreamEncodePool->removeAllJobs(true, 10000);
+    }
+
+    std::shared_ptr<SonoAudio::EncodedFileStream> oldstream;
+    int generation;
+    {
+        const ScopedLock sl (mFileStreamLock);
+        oldstream = std::move(mFileStream);
+        mFileStream.reset();
+        generation = ++mFileStreamGeneration;
+    }
+
+    updateFileStreamSending();
+
+    if (file == File()) return;
+
+    if (!mFileStreamEncodePool) {
+        mFileStreamEncodePool = std::make_unique<ThreadPool>(1);
+    }
+
+    mFileStreamEncodePool->addJob([this, file, generation] {
+        std::unique_ptr<AudioFormatReader> reader (mFormatManager.createReaderFor(file));
+        if (!reader) return;
+
+        // near transparent, there's no realtime constraint on the encoding
+        aoo_format_storage f;
+        memset(&f, 0, sizeof(f));
+        aoo_format_opus *fmt = (aoo_format_opus *)&f;
+        fmt->header.codec = AOO_CODEC_OPUS;
+        fmt->header.blocksize = 960; // 20 ms
+        fmt->header.samplerate = 48000;
+        fmt->header.nchannels = jlimit(1, 2, (int) reader->numChannels);
+        fmt->bitrate = 128000 * fmt->header.nchannels;
+        fmt->complexity = 10;
+        fmt->signal_type = OPUS_SIGNAL_MUSIC;
+        fmt->application_type = OPUS_APPLICATION_AUDIO;
+
+        std::shared_ptr<SonoAudio::EncodedFileStream> stream = SonoAudio::EncodedFileStream::encode(*reader, f, [] {
+            auto * job = ThreadPoolJob::getCurrentThreadPoolJob();
+            return job && job->shouldExit();
+        });
+        if (!stream) {
+            DBG("Couldn't encode " << file.getFullPathName() << " for streaming");
+            return;
+        }
+
+        {
+            const ScopedLock sl (mFileStreamLock);
+            if (generation != mFileStreamGeneration) return;
+            mFileStream = std::move(stream);
+            ++mFileStreamGeneration;
+        }
+
+        // the sending gets set up on the message thread
+        mTransportSource.sendChangeMessage();
+    });
+}
+
+void SonobusAudioProcessor::updateFileStreamSending()
+{
+    std::shared_ptr<SonoAudio::EncodedFileStream> stream;
+    int generation = 0;
+    {
+        const ScopedLock sl (mFileStreamLock);
+        stream = mFileStream;
+        generation = mFileStreamGeneration;
+    }
+
+    bool active = stream && mStreamPlaybackDirect.load() && mSendPlaybackAudio.get() && mTransportSource.isPlaying();
+
+    const ScopedReadLock sl (mCoreLock);
+
+    // the file isn't mixed into any send while streaming, so everyone has to be able to take it
+    for (auto * remote : mRemotePeers) {
+        if (remote->sendActive && !remote->remoteAcceptsFileStream) {
+            active = false;
+            break;
+        }
+    }
+
+    for (auto * remote : mRemotePeers) {
+        auto * source = remote->filestreamsource.get();
+        if (!source) continue;
+
+        if (active && remote->sendActive && remote->remoteSinkId != AOO_ID_NONE) {
+            if (remote->fileStreamGeneration != generation) {
+                source->setup(getSampleRate(), currSamplesPerBlock, stream->getNumChannels());
+                aoo_format_storage f = stream->getFormat();
+                source->set_format(f.header);
+                remote->fileStreamGeneration = generation;
+            }
+            if (remote->fileStreamSinkId != remote->remoteSinkId) {
+                if (remote->fileStreamSinkId != AOO_ID_NONE) {
+                    source->remove_sink(remote->endpoint, remote->fileStreamSinkId);
+                }
+                source->add_sink(remote->endpoint, remote->remoteSinkId, endpoint_send);
+                source->set_sinkoption(remote->endpoint, remote->remoteSinkId, aoo_opt_protocol_flags, &remote->remoteSinkFlags, sizeof(int32_t));
+                remote->fileStreamSinkId = remote->remoteSinkId;
+            }
+            source->start();
+        }
+        else {
+            source->stop();
+        }
+    }
+
+    mFileStreamSending = active;
+}
+
 
 #pragma Effects
 
@@ -31,7 +31,8 @@ public:
         ShowTransportMenu,
         ShowViewMenu,
         ShowConnectMenu,
-        ToggleFullInfoView
+        ToggleFullInfoView,
+        ShowDiagnostics
     };
     
 };
@@ -0,0 +1,314 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include "aoo/aoo.h"
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+namespace SonoAudio {
+
+// Network telemetry of a peer for troubleshooting dropouts offline: every frame
+// that arrived from it, every resend we asked for and every block we gave up on,
+// with the time it happened, the source's time tag when the packet carried one,
+// and how much decoded audio was waiting in the buffer at that moment. The file
+// is a header and a sequence of fixed size records as they happened.
+// analyze() turns one into a text report with jitter, delay, fill and loss
+// figures, see the --analyze-telemetry option of the standalone app.
+class TelemetryLog
+{
+    // one per event, little endian on disk
+    struct Record {
+        uint16 type;
+        uint16 framenum;
+        uint32 id;
+        uint32 sequence;
+        uint32 fillMicros;
+        uint64 arrival;
+        uint64 sent;
+    };
+    static_assert(sizeof(Record) == 32, "telemetry records are 32 bytes");
+
+public:
+    static constexpr const char * FileExtension = ".sbtel";
+
+    // writes one log, fed from the telemetry tap of a sink (the network threads),
+    // written to disk from the given background thread
+    class Writer : public TimeSliceClient
+    {
+    public:
+        // message thread
+        Writer(TimeSliceThread & diskThread, const File & destFile, const String & peerName, int ringRecords = 16384)
+        : file(destFile), thread(diskThread), fifo(ringRecords), ring((size_t) ringRecords)
+        {
+            destFile.deleteFile();
+            output = destFile.createOutputStream();
+            if (output) {
+                output->write(Magic, 4);
+                output->writeInt(Version);
+                output->writeInt64(Time::currentTimeMillis());
+                output->writeString(peerName);
+            }
+
+            thread.addTimeSliceClient(this);
+        }
+
+        ~Writer() override
+        {
+            thread.removeTimeSliceClient(this);
+            while (writePendingData() > 0) {}
+        }
+
+        bool isOpen() const { return output != nullptr; }
+        const File & getFile() const { return file; }
+        int64 getDroppedRecords() const { return droppedRecords.load(std::memory_order_relaxed); }
+
+        // network threads, one at a time, returns false if the ring was full
+        bool add(const aoo_telemetry_info & info)
+        {
+            int start1, size1, start2, size2;
+            fifo.prepareToWrite(1, start1, size1, start2, size2);
+            if (size1 + size2 < 1) {
+                droppedRecords.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+
+            auto & rec = ring[(size_t) (size1 > 0 ? start1 : start2)];
+            rec.type = ByteOrder::swapIfBigEndian((uint16) info.type);
+            rec.framenum = ByteOrder::swapIfBigEndian((uint16) (int16) info.framenum);
+            rec.id = ByteOrder::swapIfBigEndian((uint32) info.id);
+            rec.sequence = ByteOrder::swapIfBigEndian((uint32) info.sequence);
+            rec.fillMicros = ByteOrder::swapIfBigEndian((uint32) jmax(0.0f, info.fill * 1e6f));
+            rec.arrival = ByteOrder::swapIfBigEndian((uint64) info.arrival);
+            rec.sent = ByteOrder::swapIfBigEndian((uint64) info.sent);
+            fifo.finishedWrite(1);
+            return true;
+        }
+
+        int useTimeSlice() override
+        {
+            return writePendingData() > 0 ? 0 : 50;
+        }
+
+    private:
+        int writePendingData()
+        {
+            const int numready = fifo.getNumReady();
+            if (numready <= 0) return 0;
+
+            int start1, size1, start2, size2;
+            fifo.prepareToRead(numready, start1, size1, start2, size2);
+            if (output) {
+                output->write(ring.data() + start1, (size_t) size1 * sizeof(Record));
+                if (size2 > 0) output->write(ring.data() + start2, (size_t) size2 * sizeof(Record));
+            }
+            fifo.finishedRead(size1 + size2);
+            return size1 + size2;
+        }
+
+        File file;
+        TimeSliceThread & thread;
+        std::unique_ptr<FileOutputStream> output;
+
+        AbstractFifo fifo;
+        std::vector<Record> ring;
+        std::atomic<int64> droppedRecords { 0 };
+    };
+
+    // reads a log and describes it in a few lines of text, any thread
+    static bool analyze(const File & logFile, String & report, String & errorMessage)
+    {
+        auto input = logFile.createInputStream();
+        char magic[4];
+        if (!input || input->read(magic, 4) != 4 || memcmp(magic, Magic, 4) != 0 || input->readInt() != Version) {
+            errorMessage = TRANS("Not a telemetry log: ") + logFile.getFullPathName();
+            return false;
+        }
+        const int64 startMillis = input->readInt64();
+        const String peerName = input->readString();
+
+        struct Block {
+            double firstArrival = -1.0; // seconds
+            double firstOneWay = 0.0; // from the source time tag, seconds
+            bool hasOneWay = false;
+            int arrivals = 0;
+            int resends = 0;
+            bool dropped = false;
+            bool arrivedAfterResend = false;
+        };
+        std::map<int64, Block> blocks; // by source id and sequence
+        std::vector<double> fills; // ms, at each arrival
+        int64 numRecords = 0;
+        double firstTime = -1.0, lastTime = 0.0;
+
+        Record rec;
+        while (input->read(&rec, sizeof(rec)) == (int) sizeof(rec)) {
+            ++numRecords;
+            const int type = (int) ByteOrder::swapIfBigEndian(rec.type);
+            const int64 id = (int64) (int32) ByteOrder::swapIfBigEndian(rec.id);
+            const int32 seq = (int32) ByteOrder::swapIfBigEndian(rec.sequence);
+            const double when = ntpToSeconds(ByteOrder::swapIfBigEndian(rec.arrival));
+            const uint64 sent = ByteOrder::swapIfBigEndian(rec.sent);
+
+            if (firstTime < 0.0) firstTime = when;
+            lastTime = jmax(lastTime, when);
+
+            auto & block = blocks[(id << 32) | (uint32) seq];
+            if (type == AOO_TELEMETRY_ARRIVED) {
+                if (block.arrivals == 0) {
+                    block.firstArrival = when;
+                    block.arrivedAfterResend = block.resends > 0;
+                }
+                if (sent != 0 && !block.hasOneWay) {
+                    // unknown clock offset, only the variation counts
+                    block.firstOneWay = when - ntpToSeconds(sent);
+                    block.hasOneWay = true;
+                }
+                ++block.arrivals;
+                fills.push_back(ByteOrder::swapIfBigEndian(rec.fillMicros) * 1e-3);
+            }
+            else if (type == AOO_TELEMETRY_RESEND) {
+                ++block.resends;
+            }
+            else if (type == AOO_TELEMETRY_DROPPED) {
+                block.dropped = true;
+            }
+        }
+
+        if (numRecords == 0) {
+            errorMessage = TRANS("The telemetry log is empty");
+            return false;
+        }
+
+        // the arrival delays, relative to the steady pace of the stream fitted
+        // over each stretch without a gap
+        std::vector<double> delays, oneways;
+        int64 numblocks = 0, numarrived = 0, numdropped = 0, numresent = 0, numrecovered = 0, numduplicates = 0;
+        double period = 0.0;
+
+        std::vector<std::pair<double, double>> stretch; // sequence, arrival
+        auto finishStretch = [&]() {
+            if (stretch.size() >= 16) {
+                double sx = 0, sy = 0, sxx = 0, sxy = 0;
+                for (auto & p : stretch) { sx += p.first; sy += p.second; sxx += p.first * p.first; sxy += p.first * p.second; }
+                const double n = (double) stretch.size();
+                const double slope = (n * sxy - sx * sy) / jmax(1e-12, n * sxx - sx * sx);
+                const double icept = (sy - slope * sx) / n;
+                double minres = std::numeric_limits<double>::max();
+                for (auto & p : stretch) minres = jmin(minres, p.second - (icept + slope * p.first));
+                for (auto & p : stretch) delays.push_back((p.second - (icept + slope * p.first) - minres) * 1e3);
+                period = slope;
+            }
+            stretch.clear();
+        };
+
+        int64 lastkey = 0;
+        double lastarrival = 0.0;
+        for (auto & item : blocks) {
+            const auto & block = item.second;
+            ++numblocks;
+            if (block.dropped) ++numdropped;
+            if (block.resends > 0) ++numresent;
+            if (block.arrivedAfterResend) ++numrecovered;
+            if (block.arrivals > 1) numduplicates += block.arrivals - 1;
+            if (block.arrivals == 0) continue;
+            ++numarrived;
+
+            if (block.hasOneWay) oneways.push_back(block.firstOneWay);
+
+            // a new source or a gap of more than a second starts a new stretch
+            if (!stretch.empty() && ((item.first >> 32) != (lastkey >> 32) || block.firstArrival - lastarrival > 1.0)) {
+                finishStretch();
+            }
+            stretch.emplace_back((double) (int32) (item.first & 0xffffffff), block.firstArrival);
+            lastkey = item.first;
+            lastarrival = block.firstArrival;
+        }
+        finishStretch();
+
+        if (!oneways.empty()) {
+            const double minow = *std::min_element(oneways.begin(), oneways.end());
+            for (auto & ow : oneways) ow = (ow - minow) * 1e3;
+        }
+
+        report.clear();
+        report << "Peer: " << peerName << newLine;
+        report << "Started: " << Time(startMillis).toString(true, true, true, true) << newLine;
+        report << "Duration: " << String(lastTime - firstTime, 1) << " s, " << numRecords << " records" << newLine;
+        if (period > 0.0) {
+            report << "Block period: " << String(period * 1e3, 3) << " ms" << newLine;
+        }
+        report << newLine;
+
+        report << "Blocks: " << numblocks << ", arrived " << numarrived << newLine;
+        report << "Lost (concealed): " << numdropped << " (" << String(percent(numdropped, numblocks), 3) << "%)" << newLine;
+        report << "Resend requested: " << numresent << ", arrived after a resend " << numrecovered << newLine;
+        report << "Duplicate frames: " << numduplicates << newLine;
+        report << newLine;
+
+        report << describe("Arrival delay vs steady pace (ms)", delays);
+        report << describe("One-way delay variation (ms)", oneways);
+        report << describe("Buffer fill at arrival (ms)", fills);
+
+        return true;
+    }
+
+private:
+    static constexpr const char * Magic = "SBTL";
+    static constexpr int Version = 1;
+
+    static double ntpToSeconds(uint64 tt)
+    {
+        return (double) (tt >> 32) + (double) (tt & 0xffffffff) / 4294967296.0;
+    }
+
+    static double percent(int64 part, int64 total)
+    {
+        return total > 0 ? 100.0 * part / total : 0.0;
+    }
+
+    // quantiles and a coarse histogram of the values
+    static String describe(const String & title, std::vector<double> values)
+    {
+        String text;
+        text << title << ":";
+        if (values.empty()) {
+            return text + " none" + newLine + newLine;
+        }
+        std::sort(values.begin(), values.end());
+
+        auto quantile = [&values](double q) {
+            return values[(size_t) jlimit(0, (int) values.size() - 1, (int) (q * (values.size() - 1) + 0.5))];
+        };
+        text << newLine << "  min " << String(values.front(), 2)
+             << "  p1 " << String(quantile(0.01), 2)
+             << "  p50 " << String(quantile(0.5), 2)
+             << "  p90 " << String(quantile(0.9), 2)
+             << "  p99 " << String(quantile(0.99), 2)
+             << "  p99.9 " << String(quantile(0.999), 2)
+             << "  max " << String(values.back(), 2) << newLine;
+
+        // bins doubling in width, so the tail shows up without drowning the body
+        const double first = 0.5;
+        double upper = first;
+        size_t index = 0;
+        while (index < values.size()) {
+            size_t count = 0;
+            while (index < values.size() && values[index] < upper) { ++count; ++index; }
+            if (count > 0) {
+                const double lower = upper == first ? 0.0 : upper * 0.5;
+                text << "  " << String(lower, 1).paddedLeft(' ', 7) << " - " << String(upper, 1).paddedLeft(' ', 7) << ": "
+                     << String(count).paddedLeft(' ', 8) << "  " << String(percent((int64) count, (int64) values.size()), 3) << "%" << newLine;
+            }
+            upper *= 2.0;
+        }
+        return text + newLine;
+    }
+};
+
+} // namespace SonoAudio
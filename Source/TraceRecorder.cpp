@@ -0,0 +1,217 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#include "TraceRecorder.h"
+#include "RealtimeSafetyChecker.h"
+
+#include <memory>
+#include <vector>
+
+namespace SonoAudio {
+
+std::atomic<bool> TraceRecorder::active { false };
+
+// written only by its own thread, read by writeChromeTrace()
+struct TraceRecorder::ThreadRing
+{
+    static constexpr uint64 Size = 1 << 16; // power of 2
+
+    struct Event {
+        int64 ticks;
+        const char * name;
+        uint64 id;
+        char phase;
+    };
+
+    ThreadRing() : events((size_t) Size) {}
+
+    std::vector<Event> events;
+    std::atomic<uint64> written { 0 };
+    // events from before the latest start() are stale
+    std::atomic<uint32> generation { 0 };
+    int tid = 0;
+    String threadName;
+    std::atomic<const char *> nameHint { nullptr };
+};
+
+struct TraceRecorder::Registry
+{
+    CriticalSection lock;
+    // never freed, a thread may still be writing to its ring
+    std::vector<std::unique_ptr<ThreadRing>> rings;
+    std::atomic<uint32> generation { 0 };
+    std::atomic<int64> startTicks { 0 };
+};
+
+thread_local TraceRecorder::ThreadRing * TraceRecorder::threadRing = nullptr;
+
+TraceRecorder::Registry & TraceRecorder::getRegistry()
+{
+    static Registry registry;
+    return registry;
+}
+
+static void writeJsonString(OutputStream & out, const String & str)
+{
+    out << JSON::toString(var(str), true);
+}
+
+TraceRecorder::ThreadRing * TraceRecorder::getThreadRing() noexcept
+{
+    if (threadRing) return threadRing;
+
+    // once per thread
+    RealtimeSafetyChecker::ScopedAllowance allow ("trace ring");
+
+    auto & registry = getRegistry();
+    auto ring = std::make_unique<ThreadRing>();
+    if (auto * thread = Thread::getCurrentThread()) {
+        ring->threadName = thread->getThreadName();
+    }
+
+    const ScopedLock sl (registry.lock);
+    ring->tid = (int) registry.rings.size() + 1;
+    threadRing = ring.get();
+    registry.rings.push_back(std::move(ring));
+    return threadRing;
+}
+
+void TraceRecorder::start()
+{
+    auto & registry = getRegistry();
+    registry.startTicks = Time::getHighResolutionTicks();
+    // the rings start over on their next event
+    registry.generation.fetch_add(1, std::memory_order_release);
+    active = true;
+}
+
+void TraceRecorder::stop()
+{
+    active = false;
+}
+
+void TraceRecorder::record(char phase, const char * name, uint64 id) noexcept
+{
+    auto * ring = getThreadRing();
+
+    const auto generation = getRegistry().generation.load(std::memory_order_acquire);
+    if (ring->generation.load(std::memory_order_relaxed) != generation) {
+        ring->written.store(0, std::memory_order_relaxed);
+        ring->generation.store(generation, std::memory_order_release);
+    }
+
+    const auto n = ring->written.load(std::memory_order_relaxed);
+    auto & ev = ring->events[(size_t) (n & (ThreadRing::Size - 1))];
+    ev.ticks = Time::getHighResolutionTicks();
+    ev.name = name;
+    ev.id = id;
+    ev.phase = phase;
+    ring->written.store(n + 1, std::memory_order_release);
+}
+
+void TraceRecorder::begin(const char * name) noexcept
+{
+    record('B', name, 0);
+}
+
+void TraceRecorder::end(const char * name) noexcept
+{
+    record('E', name, 0);
+}
+
+void TraceRecorder::instant(const char * name) noexcept
+{
+    if (isActive()) {
+        record('i', name, 0);
+    }
+}
+
+void TraceRecorder::flow(const char * name, uint64 id, int step) noexcept
+{
+    if (isActive()) {
+        record(step == FlowStart ? 's' : step == FlowEnd ? 'f' : 't', name, id);
+    }
+}
+
+void TraceRecorder::setThreadName(const char * name) noexcept
+{
+    if (isActive()) {
+        getThreadRing()->nameHint.store(name, std::memory_order_relaxed);
+    }
+}
+
+bool TraceRecorder::writeChromeTrace(const File & file)
+{
+    auto & registry = getRegistry();
+
+    file.deleteFile();
+    FileOutputStream out (file);
+    if (!out.openedOk()) return false;
+
+    const auto generation = registry.generation.load(std::memory_order_acquire);
+    const auto startticks = registry.startTicks.load();
+    const double ticksToUs = 1e6 / (double) Time::getHighResolutionTicksPerSecond();
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    auto separate = [&] () {
+        if (!first) out << ",\n";
+        first = false;
+    };
+
+    const ScopedLock sl (registry.lock);
+
+    for (auto & ring : registry.rings) {
+        if (ring->generation.load(std::memory_order_acquire) != generation) continue;
+
+        const auto written = ring->written.load(std::memory_order_acquire);
+        if (written == 0) continue;
+
+        String threadname = ring->threadName;
+        if (auto * hint = ring->nameHint.load(std::memory_order_relaxed)) {
+            threadname = hint;
+        }
+        if (threadname.isEmpty()) {
+            threadname = "Thread " + String(ring->tid);
+        }
+
+        separate();
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << ring->tid << ",\"args\":{\"name\":";
+        writeJsonString(out, threadname);
+        out << "}}";
+
+        // the oldest ones were overwritten once the ring went around
+        const auto count = jmin(written, ThreadRing::Size);
+        for (auto n = written - count; n < written; ++n) {
+            const auto & ev = ring->events[(size_t) (n & (ThreadRing::Size - 1))];
+            if (ev.name == nullptr) continue;
+
+            separate();
+            out << "{\"name\":\"" << ev.name << "\",\"ph\":\"" << String::charToString(ev.phase)
+                << "\",\"ts\":" << String((ev.ticks - startticks) * ticksToUs, 3)
+                << ",\"pid\":1,\"tid\":" << ring->tid;
+
+            switch (ev.phase) {
+                case 's':
+                case 't':
+                    out << ",\"cat\":\"flow\",\"id\":\"0x" << String::toHexString((int64) ev.id) << "\"";
+                    break;
+                case 'f':
+                    out << ",\"cat\":\"flow\",\"id\":\"0x" << String::toHexString((int64) ev.id) << "\",\"bp\":\"e\"";
+                    break;
+                case 'i':
+                    out << ",\"s\":\"t\"";
+                    break;
+                default:
+                    break;
+            }
+            out << "}";
+        }
+    }
+
+    out << "\n]}\n";
+    out.flush();
+    return out.getStatus().wasOk();
+}
+
+}
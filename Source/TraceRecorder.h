@@ -0,0 +1,85 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include <atomic>
+
+namespace SonoAudio {
+
+// Opt-in timeline tracing across the threads, for finding out which thread held
+// up which packet when there are dropouts. While it's started the hot paths
+// record begin/end slices (a Scope each) and flow steps, which link the stages
+// of one block from the receive thread to the audio thread. Every thread writes
+// into a ring of its own without locking, holding the most recent events, so it
+// can be left running until the problem shows up. writeChromeTrace() dumps what
+// is in the rings as a Chrome JSON trace, which Perfetto (ui.perfetto.dev) and
+// chrome://tracing open.
+//
+// When it's stopped every record call is one relaxed atomic load.
+class TraceRecorder
+{
+public:
+    // marks a slice on the calling thread until it goes out of scope, name must be a static string
+    class Scope
+    {
+    public:
+        explicit Scope(const char * name_) noexcept : name(isActive() ? name_ : nullptr)
+        {
+            if (name) begin(name);
+        }
+
+        ~Scope()
+        {
+            if (name) end(name);
+        }
+
+        JUCE_DECLARE_NON_COPYABLE (Scope)
+
+    private:
+        const char * name;
+    };
+
+    enum Flow {
+        FlowStart = 0,
+        FlowStep,
+        FlowEnd
+    };
+
+    static bool isActive() noexcept { return active.load(std::memory_order_relaxed); }
+
+    // starts over with empty rings
+    static void start();
+    static void stop();
+
+    // -- any thread, realtime safe once the thread has its ring (its first event) --
+
+    static void begin(const char * name) noexcept;
+    static void end(const char * name) noexcept;
+    static void instant(const char * name) noexcept;
+    // one of Flow for the flow id, bound to the slice the thread is in
+    static void flow(const char * name, uint64 id, int step) noexcept;
+
+    // names the calling thread in the trace, for the ones that aren't juce Threads
+    // (the audio callback), name must be a static string
+    static void setThreadName(const char * name) noexcept;
+
+    // -- not from a traced hot path --
+
+    // writes the events recorded since start() (as many as the rings hold), best stopped first
+    static bool writeChromeTrace(const File & file);
+
+private:
+    struct ThreadRing;
+    struct Registry;
+    static Registry & getRegistry();
+    static ThreadRing * getThreadRing() noexcept;
+    static thread_local ThreadRing * threadRing;
+    static void record(char phase, const char * name, uint64 id) noexcept;
+
+    static std::atomic<bool> active;
+};
+
+}
@@ -0,0 +1,49 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include <atomic>
+
+namespace SonoAudio {
+
+// Hands the latest of something from one writer thread to one reader thread
+// without either ever waiting. The writer fills its buffer and publishes it,
+// the reader picks up whatever was published last, older ones it missed are
+// simply skipped. Neither side ever sees the buffer the other one is using.
+template <typename T>
+class TripleBuffer
+{
+public:
+    // writer side, the buffer to fill next, what it held from before is stale
+    T & getWriteBuffer() { return buffers[writeIndex]; }
+
+    void publish()
+    {
+        const int prev = middle.exchange(writeIndex | NewFlag, std::memory_order_acq_rel);
+        writeIndex = prev & IndexMask;
+    }
+
+    // reader side, true if something newer was published since the last call
+    bool update()
+    {
+        if ((middle.load(std::memory_order_acquire) & NewFlag) == 0) return false;
+
+        const int prev = middle.exchange(readIndex, std::memory_order_acq_rel);
+        readIndex = prev & IndexMask;
+        return true;
+    }
+
+    const T & getReadBuffer() const { return buffers[readIndex]; }
+
+private:
+    static constexpr int IndexMask = 3;
+    static constexpr int NewFlag = 4;
+
+    T buffers[3];
+    int writeIndex = 0;
+    std::atomic<int> middle { 1 };
+    int readIndex = 2;
+};
+
+} // namespace SonoAudio
@@ -0,0 +1,162 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+namespace SonoAudio {
+
+// Keeps waveform thumbnails on disk, in a small hidden file next to the audio
+// file (".<name>.sbpeaks"), so a long file only gets scanned the first time it
+// is opened. The peak file is keyed by the path and modification time of the
+// audio file, a changed file is scanned again. Recordings get theirs written
+// while recording, see RecordingTrack, so they open with the waveform there.
+class WaveformPeakCache : public AudioThumbnailCache
+{
+public:
+    explicit WaveformPeakCache(int maxThumbsInMemory) : AudioThumbnailCache(maxThumbsInMemory) {}
+
+    static constexpr const char * PeakExtension = ".sbpeaks";
+
+    static File getPeakFile(const File & audioFile)
+    {
+        return audioFile.getSiblingFile("." + audioFile.getFileName() + PeakExtension);
+    }
+
+    // the same hash a FileInputSource using the file time gives the thumbnail
+    static int64 getKey(const File & audioFile)
+    {
+        return FileInputSource(audioFile, true).hashCode();
+    }
+
+    // message thread, the local file the next thumbnail source comes from
+    void setCurrentFile(const File & audioFile)
+    {
+        const ScopedLock sl (fileLock);
+        currentFile = audioFile;
+        currentKey = audioFile != File() ? getKey(audioFile) : 0;
+    }
+
+    // writes the peaks of audioFile with numSamples in it, pending ones aren't valid
+    // until commitPendingPeaks() is called once the audio file is complete
+    static bool savePeaks(const AudioThumbnailBase & thumb, const File & audioFile, int64 numSamples, bool pending)
+    {
+        MemoryOutputStream output;
+        thumb.saveTo(output);
+        MemoryBlock thumbdata = output.getMemoryBlock();
+        if (thumbdata.getSize() < ThumbHeaderSize) return false;
+
+        // the thumbnail rounds its length up to whole thumb samples, the file is exact
+        if (numSamples > 0) {
+            auto * data = static_cast<char *>(thumbdata.getData());
+            writeLittleEndianInt64(data + ThumbTotalOffset, numSamples);
+            writeLittleEndianInt64(data + ThumbFinishedOffset, numSamples);
+        }
+
+        return writePeakFile(getPeakFile(audioFile), pending ? 0 : getKey(audioFile), thumbdata.getData(), thumbdata.getSize());
+    }
+
+    // makes the pending peaks written for pendingFor valid for the now finished finalFile
+    static bool commitPendingPeaks(const File & pendingFor, const File & finalFile)
+    {
+        const File peakfile = getPeakFile(pendingFor);
+        MemoryBlock thumbdata;
+        int64 key = -1;
+        if (!readPeakFile(peakfile, key, thumbdata) || key != 0) return false;
+
+        if (!writePeakFile(getPeakFile(finalFile), getKey(finalFile), thumbdata.getData(), thumbdata.getSize())) {
+            return false;
+        }
+        if (peakfile != getPeakFile(finalFile)) {
+            peakfile.deleteFile();
+        }
+        return true;
+    }
+
+protected:
+    bool loadNewThumb(AudioThumbnailBase & thumb, int64 hashCode) override
+    {
+        File file;
+        {
+            const ScopedLock sl (fileLock);
+            if (hashCode != currentKey || currentFile == File()) return false;
+            file = currentFile;
+        }
+
+        MemoryBlock thumbdata;
+        int64 key = 0;
+        if (!readPeakFile(getPeakFile(file), key, thumbdata) || key != hashCode) return false;
+
+        MemoryInputStream input (thumbdata, false);
+        return thumb.loadFrom(input);
+    }
+
+    // on the cache thread, when a scan finished
+    void saveNewlyFinishedThumbnail(const AudioThumbnailBase & thumb, int64 hashCode) override
+    {
+        File file;
+        {
+            const ScopedLock sl (fileLock);
+            if (hashCode != currentKey || currentFile == File()) return;
+            file = currentFile;
+        }
+
+        savePeaks(thumb, file, 0, false);
+    }
+
+private:
+    static constexpr const char * Magic = "SBPK";
+    static constexpr int Version = 1;
+    static constexpr size_t ThumbHeaderSize = 52;
+    static constexpr int ThumbTotalOffset = 8;
+    static constexpr int ThumbFinishedOffset = 16;
+
+    static void writeLittleEndianInt64(char * dest, int64 value)
+    {
+        const auto v = ByteOrder::swapIfBigEndian((uint64) value);
+        memcpy(dest, &v, sizeof(v));
+    }
+
+    static bool writePeakFile(const File & peakFile, int64 key, const void * thumbData, size_t numBytes)
+    {
+        // written aside and moved in place, never seen half done
+        const File tempfile = peakFile.getSiblingFile(peakFile.getFileName() + ".partial");
+        bool ok = false;
+        {
+            FileOutputStream output (tempfile);
+            if (!output.openedOk()) return false;
+            output.setPosition(0);
+            output.truncate();
+            output.write(Magic, 4);
+            output.writeInt(Version);
+            output.writeInt64(key);
+            ok = output.write(thumbData, numBytes);
+        }
+        if (!ok) {
+            tempfile.deleteFile();
+            return false;
+        }
+        return tempfile.moveFileTo(peakFile);
+    }
+
+    static bool readPeakFile(const File & peakFile, int64 & key, MemoryBlock & thumbData)
+    {
+        FileInputStream input (peakFile);
+        if (input.failedToOpen()) return false;
+
+        char magic[4];
+        if (input.read(magic, 4) != 4 || memcmp(magic, Magic, 4) != 0 || input.readInt() != Version) return false;
+        key = input.readInt64();
+
+        thumbData.reset();
+        input.readIntoMemoryBlock(thumbData);
+        return thumbData.getSize() >= ThumbHeaderSize;
+    }
+
+    CriticalSection fileLock;
+    File currentFile;
+    int64 currentKey = 0;
+};
+
+} // namespace SonoAudio
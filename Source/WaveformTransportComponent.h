@@ -8,6 +8,7 @@
 
 #include "SonoUtility.h"
 #include "SonobusTypes.h"
+#include "WaveformPeakCache.h"
 
 //==============================================================================
 class WaveformTransportComponent  : public Component,
@@ -83,11 +84,14 @@ public:
        #if ! JUCE_IOS
         if (url.isLocalFile())
         {
-            inputSource = new FileInputSource (url.getLocalFile());
+            // the file time is part of the key, a changed file won't get stale peaks
+            thumbnailCache.setCurrentFile (url.getLocalFile());
+            inputSource = new FileInputSource (url.getLocalFile(), true);
         }
         else
        #endif
         {
+            thumbnailCache.setCurrentFile (File());
             if (inputSource == nullptr)
                 inputSource = new URLInputSource (url);
         }
@@ -549,7 +553,7 @@ private:
     Label totLabel;
     Label nameLabel;
     
-    AudioThumbnailCache thumbnailCache  { 5 };
+    SonoAudio::WaveformPeakCache thumbnailCache  { 5 };
     AudioThumbnail thumbnail;
     Range<double> visibleRange;
     double zoomFactor = 0;
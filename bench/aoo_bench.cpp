@@ -0,0 +1,663 @@
+/* Copyright (c) 2010-Now Christof Ressi, Winfried Ritsch and others.
+ * For information on usage and redistribution, and for a DISCLAIMER OF ALL
+ * WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+// Micro benchmarks of the AoO hot paths: the codecs, the sink's block queue,
+// the source's history buffer, the resampler and the /data messages.
+//
+//   aoo_bench [--benchmark_filter=<substring>] [--benchmark_min_time=<seconds>]
+//             [--benchmark_format=console|csv]
+//
+// Every benchmark runs with more and more iterations until it takes at least
+// the minimum time and reports the time per operation and, where it makes
+// sense, the bytes of audio (or message) processed per second. Build in
+// release mode, and compare runs on the same machine only.
+
+#include "common.hpp"
+
+#include "aoo/aoo_pcm.h"
+#include "aoo/aoo_lossless.h"
+#if USE_CODEC_OPUS
+#include "aoo/aoo_opus.h"
+#endif
+
+#include "oscpack/osc/OscOutboundPacketStream.h"
+#include "oscpack/osc/OscReceivedElements.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+/*////////////////////////// harness //////////////////////////*/
+
+class state {
+public:
+    explicit state(int64_t iterations)
+        : iterations_(iterations) {}
+
+    // while (st.keep_running()) { ... }
+    bool keep_running() {
+        if (count_ == 0){
+            start_ = clock::now();
+        }
+        if (count_++ < iterations_){
+            return true;
+        }
+        stop_ = clock::now();
+        return false;
+    }
+
+    int64_t iterations() const { return iterations_; }
+
+    void set_bytes_per_op(int64_t n) { bytes_per_op_ = n; }
+
+    int64_t bytes_per_op() const { return bytes_per_op_; }
+
+    double seconds() const {
+        return std::chrono::duration<double>(stop_ - start_).count();
+    }
+
+    void skip(const char *reason) { skipped_ = reason; }
+
+    const char *skipped() const { return skipped_; }
+private:
+    using clock = std::chrono::steady_clock;
+    int64_t iterations_;
+    int64_t count_ = 0;
+    int64_t bytes_per_op_ = 0;
+    const char *skipped_ = nullptr;
+    clock::time_point start_;
+    clock::time_point stop_;
+};
+
+// keeps the compiler from throwing away what we compute
+template<typename T>
+inline void do_not_optimize(const T& value){
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void *sink;
+    sink = &value;
+#endif
+}
+
+struct benchmark {
+    std::string name;
+    std::function<void(state&)> fn;
+};
+
+std::vector<benchmark>& registry(){
+    static std::vector<benchmark> benchmarks;
+    return benchmarks;
+}
+
+void add(const std::string& name, std::function<void(state&)> fn){
+    registry().push_back({ name, std::move(fn) });
+}
+
+std::string format_rate(double bytes_per_second){
+    const char *units[] = { "B/s", "kB/s", "MB/s", "GB/s" };
+    int unit = 0;
+    while (bytes_per_second >= 1000.0 && unit < 3){
+        bytes_per_second /= 1000.0;
+        unit++;
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.2f %s", bytes_per_second, units[unit]);
+    return buf;
+}
+
+int run(const std::string& filter, double mintime, bool csv){
+    if (csv){
+        printf("name,iterations,ns_per_op,bytes_per_second\n");
+    } else {
+        printf("%-40s %14s %12s %14s\n", "Benchmark", "Time (ns/op)", "Iterations", "Throughput");
+        printf("%s\n", std::string(83, '-').c_str());
+    }
+    int count = 0;
+    for (auto& b : registry()){
+        if (!filter.empty() && b.name.find(filter) == std::string::npos){
+            continue;
+        }
+        count++;
+        // grow the iterations until the run is long enough to trust the clock
+        int64_t iterations = 1;
+        while (true){
+            state st(iterations);
+            b.fn(st);
+            if (st.skipped()){
+                if (!csv){
+                    printf("%-40s skipped: %s\n", b.name.c_str(), st.skipped());
+                }
+                break;
+            }
+            auto elapsed = st.seconds();
+            if (elapsed >= mintime || iterations >= (int64_t(1) << 40)){
+                auto nsperop = elapsed * 1e9 / iterations;
+                auto rate = st.bytes_per_op() > 0 && elapsed > 0 ?
+                            st.bytes_per_op() * (double)iterations / elapsed : 0.0;
+                if (csv){
+                    printf("%s,%lld,%.3f,%.0f\n", b.name.c_str(),
+                           (long long)iterations, nsperop, rate);
+                } else {
+                    printf("%-40s %14.1f %12lld %14s\n", b.name.c_str(), nsperop,
+                           (long long)iterations, rate > 0 ? format_rate(rate).c_str() : "");
+                }
+                fflush(stdout);
+                break;
+            }
+            // aim a bit beyond the minimum time, at most 10 times as many
+            auto factor = elapsed > 0 ? 1.4 * mintime / elapsed : 10.0;
+            iterations = (int64_t)(iterations * std::max(2.0, std::min(10.0, factor)));
+        }
+    }
+    if (count == 0){
+        fprintf(stderr, "no benchmark matches '%s'\n", filter.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+/*////////////////////////// test data //////////////////////////*/
+
+const int32_t samplerate = 48000;
+const int32_t nchannels = 2;
+
+// a bit of everything, so the codecs have something to work on
+std::vector<aoo_sample> make_signal(int32_t nframes, int32_t nchans){
+    std::vector<aoo_sample> signal(nframes * nchans);
+    uint32_t noise = 12345;
+    for (int32_t i = 0; i < nframes; ++i){
+        for (int32_t j = 0; j < nchans; ++j){
+            noise = noise * 1664525 + 1013904223;
+            auto n = ((noise >> 8) / (double)(1 << 24)) * 2.0 - 1.0;
+            signal[i * nchans + j] = (aoo_sample)(0.5 * std::sin(2.0 * 3.14159265358979 * 440.0 * (j + 1) * i / samplerate)
+                                                  + 0.05 * n);
+        }
+    }
+    return signal;
+}
+
+/*////////////////////////// codecs //////////////////////////*/
+
+struct codec_pair {
+    std::unique_ptr<aoo::encoder> encoder;
+    std::unique_ptr<aoo::decoder> decoder;
+};
+
+codec_pair make_codecs(const char *name, aoo_format& fmt){
+    auto c = aoo::find_codec(name);
+    if (!c){
+        return {};
+    }
+    codec_pair p { c->create_encoder(), c->create_decoder() };
+    // the encoder might change the format, the decoder gets what it made of it
+    if (!p.encoder->set_format(fmt) || !p.decoder->set_format(fmt)){
+        return {};
+    }
+    return p;
+}
+
+void bench_encode(state& st, const char *name, aoo_format& fmt){
+    auto codecs = make_codecs(name, fmt);
+    if (!codecs.encoder){
+        return st.skip("codec not available");
+    }
+    auto n = fmt.blocksize * fmt.nchannels;
+    auto signal = make_signal(fmt.blocksize, fmt.nchannels);
+    std::vector<char> buf(AOO_MAXPACKETSIZE * 4);
+
+    st.set_bytes_per_op(n * sizeof(aoo_sample));
+    while (st.keep_running()){
+        auto size = codecs.encoder->encode(signal.data(), n, buf.data(), (int32_t)buf.size());
+        do_not_optimize(size);
+        do_not_optimize(buf[0]);
+    }
+}
+
+void bench_decode(state& st, const char *name, aoo_format& fmt){
+    auto codecs = make_codecs(name, fmt);
+    if (!codecs.encoder){
+        return st.skip("codec not available");
+    }
+    auto n = fmt.blocksize * fmt.nchannels;
+    auto signal = make_signal(fmt.blocksize, fmt.nchannels);
+    std::vector<char> buf(AOO_MAXPACKETSIZE * 4);
+    auto size = codecs.encoder->encode(signal.data(), n, buf.data(), (int32_t)buf.size());
+    if (size <= 0){
+        return st.skip("encoding failed");
+    }
+    std::vector<aoo_sample> out(n);
+
+    st.set_bytes_per_op(n * sizeof(aoo_sample));
+    while (st.keep_running()){
+        auto result = codecs.decoder->decode(buf.data(), size, out.data(), n);
+        do_not_optimize(result);
+        do_not_optimize(out[0]);
+    }
+}
+
+aoo_format_pcm pcm_format(int32_t bitdepth){
+    aoo_format_pcm fmt;
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.header.codec = AOO_CODEC_PCM;
+    fmt.header.nchannels = nchannels;
+    fmt.header.samplerate = samplerate;
+    fmt.header.blocksize = 256;
+    fmt.bitdepth = bitdepth;
+    return fmt;
+}
+
+aoo_format_lossless lossless_format(int32_t bitdepth){
+    aoo_format_lossless fmt;
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.header.codec = AOO_CODEC_LOSSLESS;
+    fmt.header.nchannels = nchannels;
+    fmt.header.samplerate = samplerate;
+    fmt.header.blocksize = 256;
+    fmt.bitdepth = bitdepth;
+    return fmt;
+}
+
+void add_codec_benchmarks(){
+    const struct { int32_t bitdepth; const char *name; } depths[] = {
+        { AOO_PCM_INT16, "int16" },
+        { AOO_PCM_INT24, "int24" },
+        { AOO_PCM_FLOAT32, "float32" },
+        { AOO_PCM_FLOAT64, "float64" }
+    };
+    for (auto& d : depths){
+        auto bitdepth = d.bitdepth;
+        add(std::string("pcm_encode/") + d.name, [bitdepth](state& st){
+            auto fmt = pcm_format(bitdepth);
+            bench_encode(st, AOO_CODEC_PCM, fmt.header);
+        });
+        add(std::string("pcm_decode/") + d.name, [bitdepth](state& st){
+            auto fmt = pcm_format(bitdepth);
+            bench_decode(st, AOO_CODEC_PCM, fmt.header);
+        });
+    }
+    const struct { int32_t bitdepth; const char *name; } lossless_depths[] = {
+        { AOO_LOSSLESS_INT16, "int16" },
+        { AOO_LOSSLESS_INT24, "int24" }
+    };
+    for (auto& d : lossless_depths){
+        auto bitdepth = d.bitdepth;
+        add(std::string("lossless_encode/") + d.name, [bitdepth](state& st){
+            auto fmt = lossless_format(bitdepth);
+            bench_encode(st, AOO_CODEC_LOSSLESS, fmt.header);
+        });
+        add(std::string("lossless_decode/") + d.name, [bitdepth](state& st){
+            auto fmt = lossless_format(bitdepth);
+            bench_decode(st, AOO_CODEC_LOSSLESS, fmt.header);
+        });
+    }
+#if USE_CODEC_OPUS
+    // 5 ms blocks, one to many channels (the multistream encoder pairs them up)
+    for (int32_t chans : { 1, 2, 8 }){
+        auto opus_format = [chans](){
+            aoo_format_opus fmt;
+            memset(&fmt, 0, sizeof(fmt));
+            fmt.header.codec = AOO_CODEC_OPUS;
+            fmt.header.nchannels = chans;
+            fmt.header.samplerate = samplerate;
+            fmt.header.blocksize = 240;
+            fmt.application_type = OPUS_APPLICATION_RESTRICTED_LOWDELAY;
+            return fmt;
+        };
+        auto suffix = "/" + std::to_string(chans) + "ch";
+        add("opus_encode" + suffix, [opus_format](state& st){
+            auto fmt = opus_format();
+            bench_encode(st, AOO_CODEC_OPUS, fmt.header);
+        });
+        add("opus_decode" + suffix, [opus_format](state& st){
+            auto fmt = opus_format();
+            bench_decode(st, AOO_CODEC_OPUS, fmt.header);
+        });
+    }
+#endif
+}
+
+/*////////////////////////// block queue //////////////////////////*/
+
+// the order the packets arrive in, as offsets from the block's own sequence
+std::vector<int32_t> arrival_order(const std::string& pattern, int32_t n){
+    std::vector<int32_t> order(n);
+    for (int32_t i = 0; i < n; ++i){
+        order[i] = i;
+    }
+    if (pattern == "swapped"){
+        // every pair comes the wrong way round
+        for (int32_t i = 0; i + 1 < n; i += 2){
+            std::swap(order[i], order[i + 1]);
+        }
+    } else if (pattern == "late"){
+        // every 8th block comes 4 blocks late
+        for (int32_t i = 0; i + 4 < n; i += 8){
+            auto late = order[i];
+            for (int32_t j = 0; j < 4; ++j){
+                order[i + j] = order[i + j + 1];
+            }
+            order[i + 4] = late;
+        }
+    }
+    return order;
+}
+
+void add_block_queue_benchmarks(){
+    for (std::string pattern : { "inorder", "swapped", "late" }){
+        // what the sink does for every frame: look for the block and add it if
+        // it's new, then the oldest block goes out once the buffer is deep enough
+        add("block_queue_insert_find/" + pattern, [pattern](state& st){
+            const int32_t depth = 16;
+            const int32_t period = 64;
+            auto order = arrival_order(pattern, period);
+            aoo::block_queue queue;
+            queue.resize(depth * 2);
+            int32_t base = 0;
+            size_t index = 0;
+            while (st.keep_running()){
+                auto seq = base + order[index];
+                auto b = queue.find(seq);
+                if (!b){
+                    b = queue.insert(seq, samplerate, 0, 512, 1);
+                }
+                do_not_optimize(b);
+                if (queue.size() > depth){
+                    queue.pop_front();
+                }
+                if (++index == order.size()){
+                    index = 0;
+                    base += period;
+                }
+            }
+        });
+    }
+
+    add("block_queue_find/hit", [](state& st){
+        aoo::block_queue queue;
+        queue.resize(64);
+        for (int32_t i = 0; i < 64; ++i){
+            queue.insert(i, samplerate, 0, 512, 1);
+        }
+        int32_t seq = 0;
+        while (st.keep_running()){
+            do_not_optimize(queue.find(seq));
+            seq = (seq + 7) & 63;
+        }
+    });
+}
+
+/*////////////////////////// history buffer //////////////////////////*/
+
+void add_history_buffer_benchmarks(){
+    // the source looks up the blocks the sinks ask to be resent
+    add("history_buffer_find/recent", [](state& st){
+        const int32_t capacity = 256;
+        const int32_t blocksize = 1024;
+        aoo::history_buffer history;
+        history.resize(capacity, blocksize);
+        std::vector<char> data(blocksize, 1);
+        for (int32_t seq = 0; seq < capacity * 4; ++seq){
+            history.push(seq, samplerate, data.data(), blocksize, 2, blocksize / 2);
+        }
+        const int32_t newest = capacity * 4 - 1;
+        int32_t back = 0;
+        while (st.keep_running()){
+            do_not_optimize(history.find(newest - back));
+            back = (back + 13) % capacity;
+        }
+    });
+
+    add("history_buffer_find/miss", [](state& st){
+        aoo::history_buffer history;
+        history.resize(256, 1024);
+        std::vector<char> data(1024, 1);
+        for (int32_t seq = 0; seq < 1024; ++seq){
+            history.push(seq, samplerate, data.data(), 1024, 2, 512);
+        }
+        int32_t seq = 0;
+        while (st.keep_running()){
+            // gone long ago
+            do_not_optimize(history.find(seq));
+            seq = (seq + 1) & 511;
+        }
+    });
+
+    add("history_buffer_push/1024", [](state& st){
+        aoo::history_buffer history;
+        history.resize(256, 1024);
+        std::vector<char> data(1024, 1);
+        int32_t seq = 0;
+        st.set_bytes_per_op(1024);
+        while (st.keep_running()){
+            history.push(seq++, samplerate, data.data(), 1024, 2, 512);
+        }
+        do_not_optimize(history.find(seq - 1));
+    });
+}
+
+/*////////////////////////// resampler //////////////////////////*/
+
+void add_resampler_benchmarks(){
+    const struct { int32_t quality; const char *name; } qualities[] = {
+        { AOO_RESAMPLE_LINEAR, "linear" },
+        { AOO_RESAMPLE_SINC_MEDIUM, "sinc_medium" },
+        { AOO_RESAMPLE_SINC_HIGH, "sinc_high" }
+    };
+    for (auto& q : qualities){
+        for (int32_t srfrom : { 48000, 44100 }){
+            auto quality = q.quality;
+            // one block through, reading at a slightly drifting rate like the sink does
+            add(std::string("resampler_read/") + q.name + "/" + std::to_string(srfrom / 1000) + "k",
+                [quality, srfrom](state& st){
+                const int32_t blocksize = 256;
+                const int32_t n = blocksize * nchannels;
+                aoo::dynamic_resampler resampler;
+                resampler.setup(blocksize, blocksize, srfrom, samplerate, nchannels, quality);
+                resampler.update(srfrom, samplerate + 1.3);
+                auto signal = make_signal(blocksize, nchannels);
+                std::vector<aoo_sample> out(n);
+
+                st.set_bytes_per_op(n * sizeof(aoo_sample));
+                while (st.keep_running()){
+                    while (resampler.write_available() >= n && resampler.read_available() < n){
+                        resampler.write(signal.data(), n);
+                    }
+                    if (resampler.read_available() >= n){
+                        resampler.read(out.data(), n);
+                    }
+                    do_not_optimize(out[0]);
+                }
+            });
+        }
+    }
+}
+
+/*////////////////////////// OSC //////////////////////////*/
+
+// the message as endpoint::send_data() writes it
+int32_t write_data_message(char *buf, int32_t size, const aoo::data_packet& d, bool ping){
+    osc::OutboundPacketStream msg(buf, size);
+    msg << osc::BeginMessage(AOO_MSG_DOMAIN AOO_MSG_SINK "/1" AOO_MSG_DATA)
+        << (int32_t)1 << (int32_t)0x1234 << d.sequence << d.samplerate << d.channel
+        << d.totalsize << d.nframes << d.framenum
+        << osc::Blob(d.data, d.size);
+    if (ping){
+        msg << osc::TimeTag(aoo::time_tag::now().to_uint64());
+    }
+    msg << osc::EndMessage;
+    return (int32_t)msg.Size();
+}
+
+// ...and as endpoint::send_data_compact() does
+int32_t write_compact_data_message(char *buf, int32_t size, const aoo::data_packet& d){
+    osc::OutboundPacketStream msg(buf, size);
+    msg << osc::BeginMessage(AOO_MSG_COMPACT_DATA)
+        << (int32_t)0x1234 << d.sequence
+        << osc::Blob(d.data, d.size)
+        << osc::EndMessage;
+    return (int32_t)msg.Size();
+}
+
+aoo::data_packet make_packet(const std::vector<char>& payload){
+    aoo::data_packet d;
+    d.sequence = 1000;
+    d.samplerate = samplerate;
+    d.channel = 0;
+    d.totalsize = (int32_t)payload.size();
+    d.nframes = 1;
+    d.framenum = 0;
+    d.data = payload.data();
+    d.size = (int32_t)payload.size();
+    return d;
+}
+
+void add_osc_benchmarks(){
+    for (int32_t payloadsize : { 160, 1024 }){ // Opus, PCM
+        auto suffix = "/" + std::to_string(payloadsize);
+
+        add("osc_data_serialize" + suffix, [payloadsize](state& st){
+            std::vector<char> payload(payloadsize, 7);
+            auto d = make_packet(payload);
+            char buf[AOO_MAXPACKETSIZE];
+            st.set_bytes_per_op(write_data_message(buf, sizeof(buf), d, true));
+            while (st.keep_running()){
+                do_not_optimize(write_data_message(buf, sizeof(buf), d, true));
+                d.sequence++;
+            }
+        });
+
+        add("osc_compact_data_serialize" + suffix, [payloadsize](state& st){
+            std::vector<char> payload(payloadsize, 7);
+            auto d = make_packet(payload);
+            char buf[AOO_MAXPACKETSIZE];
+            st.set_bytes_per_op(write_compact_data_message(buf, sizeof(buf), d));
+            while (st.keep_running()){
+                do_not_optimize(write_compact_data_message(buf, sizeof(buf), d));
+                d.sequence++;
+            }
+        });
+
+        // the sink's fixed layout fast path, pattern parsing included
+        add("osc_data_parse" + suffix, [payloadsize](state& st){
+            std::vector<char> payload(payloadsize, 7);
+            char buf[AOO_MAXPACKETSIZE];
+            auto n = write_data_message(buf, sizeof(buf), make_packet(payload), true);
+            st.set_bytes_per_op(n);
+            while (st.keep_running()){
+                int32_t type, id, srcid, salt;
+                auto onset = aoo_parse_pattern(buf, n, &type, &id);
+                aoo::data_packet d;
+                aoo::time_tag ping;
+                auto ok = aoo::parse_data_message(buf, n, onset, srcid, salt, d, ping);
+                do_not_optimize(ok);
+                do_not_optimize(d);
+            }
+        });
+
+        add("osc_compact_data_parse" + suffix, [payloadsize](state& st){
+            std::vector<char> payload(payloadsize, 7);
+            char buf[AOO_MAXPACKETSIZE];
+            auto n = write_compact_data_message(buf, sizeof(buf), make_packet(payload));
+            st.set_bytes_per_op(n);
+            while (st.keep_running()){
+                int32_t salt;
+                aoo::data_packet d;
+                aoo::time_tag ping;
+                auto ok = aoo::parse_compact_data_message(buf, n, salt, d, ping);
+                do_not_optimize(ok);
+                do_not_optimize(d);
+            }
+        });
+
+        // the generic oscpack path, which the fast path falls back to
+        add("osc_data_parse_generic" + suffix, [payloadsize](state& st){
+            std::vector<char> payload(payloadsize, 7);
+            char buf[AOO_MAXPACKETSIZE];
+            auto n = write_data_message(buf, sizeof(buf), make_packet(payload), true);
+            st.set_bytes_per_op(n);
+            while (st.keep_running()){
+                osc::ReceivedPacket packet(buf, n);
+                osc::ReceivedMessage msg(packet);
+                auto it = msg.ArgumentsBegin();
+                aoo::data_packet d;
+                auto srcid = (it++)->AsInt32();
+                auto salt = (it++)->AsInt32();
+                d.sequence = (it++)->AsInt32();
+                d.samplerate = (it++)->AsDouble();
+                d.channel = (it++)->AsInt32();
+                d.totalsize = (it++)->AsInt32();
+                d.nframes = (it++)->AsInt32();
+                d.framenum = (it++)->AsInt32();
+                const void *blobdata;
+                osc::osc_bundle_element_size_t blobsize;
+                (it++)->AsBlob(blobdata, blobsize);
+                d.data = (const char *)blobdata;
+                d.size = blobsize;
+                auto ping = (it++)->AsTimeTag();
+                do_not_optimize(srcid + salt);
+                do_not_optimize(d);
+                do_not_optimize(ping);
+            }
+        });
+    }
+}
+
+void add_all_benchmarks(){
+    add_codec_benchmarks();
+    add_block_queue_benchmarks();
+    add_history_buffer_benchmarks();
+    add_resampler_benchmarks();
+    add_osc_benchmarks();
+}
+
+} // namespace
+
+int main(int argc, const char *argv[]){
+    std::string filter;
+    double mintime = 0.5;
+    bool csv = false;
+
+    for (int i = 1; i < argc; ++i){
+        std::string arg = argv[i];
+        auto value = [&](const char *option) -> const char * {
+            auto len = strlen(option);
+            return arg.compare(0, len, option) == 0 ? argv[i] + len : nullptr;
+        };
+        if (auto v = value("--benchmark_filter=")){
+            filter = v;
+        } else if (auto v = value("--benchmark_min_time=")){
+            mintime = std::max(0.001, atof(v));
+        } else if (auto v = value("--benchmark_format=")){
+            csv = !strcmp(v, "csv");
+        } else if (arg == "--benchmark_list_tests"){
+            add_all_benchmarks();
+            for (auto& b : registry()){
+                printf("%s\n", b.name.c_str());
+            }
+            return 0;
+        } else {
+            fprintf(stderr, "usage: %s [--benchmark_filter=<substring>] [--benchmark_min_time=<seconds>]"
+                    " [--benchmark_format=console|csv] [--benchmark_list_tests]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    aoo_initialize();
+
+    add_all_benchmarks();
+
+    auto result = run(filter, mintime, csv);
+
+    aoo_terminate();
+
+    return result;
+}
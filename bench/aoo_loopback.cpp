@@ -0,0 +1,623 @@
+/* Copyright (c) 2010-Now Christof Ressi, Winfried Ritsch and others.
+ * For information on usage and redistribution, and for a DISCLAIMER OF ALL
+ * WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+// End-to-end benchmark of the sink's jitter buffer: an AoO source streams to
+// an AoO sink in the same process, through a simulated network link with
+// delay, jitter, bursty loss (Gilbert-Elliott), reordering, duplication and
+// clock drift between the two sides. Everything runs on a virtual clock (see
+// AOO_VIRTUAL_TIME), many times faster than real time, and the same seed gives
+// the same run, so buffer, resend and FEC changes can be compared exactly.
+//
+//   aoo_loopback [--scenario=<substring>] [--duration=<s>] [--buffer=<ms>]
+//                [--blocksize=<n>] [--jitter-control] [--time-stretch] [--fec=<n>]
+//                [--resend=<0|1>] [--pack=<n>] [--rechannel=<s>] [--restart=<s>] [--seed=<n>]
+//                [--format=console|csv]
+//   aoo_loopback --delay=<ms> [--jitter=<ms>] [--dist=none|uniform|exp|pareto]
+//                [--loss=<%>] [--burst=<p>,<r>,<h>] [--reorder=<%>] [--dup=<%>]
+//                [--drift=<ppm>] ...      (one custom scenario)
+//
+// The source sends a ramp through the lossless float PCM codec, so the sink
+// output tells which input sample it is. Reported per scenario:
+// - dropouts: how often and how long the output went silent
+// - latency: from the source input to the sink output, in ms (median, 99th
+//   percentile, max), i.e. the link delay plus what the sink buffers
+// - lost/resent: the sink's block lost and block resent events
+// - resend traffic: the data requests from the sink to the source and the data
+//   sent back for them, as a percentage of the stream. With --pack the stream
+//   takes fewer packets than blocks, so this only counts what's left over.
+// - CPU: the time spent in the source and sink calls per second of audio
+//
+// --rechannel switches the source from one to two channels at that time (as
+// when a peer's send channels change), the dropouts show what the sink makes of it.
+// --restart starts the source's stream over at that time, with the same format
+// (as after a peer reconnects).
+
+#include "aoo/aoo.hpp"
+#include "aoo/aoo_pcm.h"
+
+#include "time.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <string>
+#include <vector>
+
+#if !AOO_VIRTUAL_TIME
+#error "aoo_loopback needs the AoO sources built with AOO_VIRTUAL_TIME=1"
+#endif
+
+namespace {
+
+/*////////////////////////// random numbers //////////////////////////*/
+
+// our own generator and distributions, the standard ones differ between
+// the standard libraries and we want the same run everywhere
+class random {
+public:
+    explicit random(uint64_t seed)
+        : state_(seed * 0x9E3779B97F4A7C15ULL + 1) {}
+
+    // [0, 1)
+    double uniform(){
+        // xorshift64*
+        state_ ^= state_ >> 12;
+        state_ ^= state_ << 25;
+        state_ ^= state_ >> 27;
+        return ((state_ * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    bool chance(double p){
+        return p > 0 && uniform() < p;
+    }
+
+    double exponential(double mean){
+        return -mean * std::log(1.0 - uniform());
+    }
+
+    // heavy tail with the given mean (shape 2.5)
+    double pareto(double mean){
+        const double shape = 2.5;
+        const double scale = mean * (shape - 1.0) / shape;
+        return scale / std::pow(1.0 - uniform(), 1.0 / shape) - scale;
+    }
+private:
+    uint64_t state_;
+};
+
+/*////////////////////////// link //////////////////////////*/
+
+enum class jitter_dist {
+    none,
+    uniform,
+    exponential,
+    pareto
+};
+
+struct link_config {
+    double delay_ms = 10;        // one way, fixed part
+    double jitter_ms = 0;        // scale of the variable part
+    jitter_dist dist = jitter_dist::none;
+    double loss = 0;             // random loss in the good state, 0 to 1
+    // Gilbert-Elliott bursts: good -> bad, bad -> good, loss in the bad state
+    double burst_p = 0;
+    double burst_r = 1;
+    double burst_h = 0;
+    double reorder = 0;          // chance of a packet being held back...
+    double reorder_ms = 10;      // ...for this much longer
+    double duplicate = 0;        // chance of a packet arriving twice
+};
+
+struct packet {
+    double time; // arrival
+    uint64_t order;
+    std::vector<char> data;
+    bool operator>(const packet& other) const {
+        return time > other.time || (time == other.time && order > other.order);
+    }
+};
+
+// one direction of the network path
+class link {
+public:
+    link(const link_config& config, uint64_t seed)
+        : config_(config), random_(seed) {}
+
+    void send(double now, const char *data, int32_t n){
+        sent_packets_++;
+        sent_bytes_ += n;
+
+        // bursty loss
+        if (bad_){
+            bad_ = !random_.chance(config_.burst_r);
+        } else {
+            bad_ = random_.chance(config_.burst_p);
+        }
+        if (random_.chance(bad_ ? config_.burst_h : config_.loss)){
+            lost_packets_++;
+            return;
+        }
+
+        auto delay = config_.delay_ms + jitter();
+        // a queue keeps the order, unless the packet gets held up
+        double arrival = now + delay * 0.001;
+        if (random_.chance(config_.reorder)){
+            arrival += config_.reorder_ms * 0.001;
+        } else {
+            arrival = std::max(arrival, last_arrival_);
+            last_arrival_ = arrival;
+        }
+        push(arrival, data, n);
+
+        if (random_.chance(config_.duplicate)){
+            push(arrival + jitter() * 0.001, data, n);
+        }
+    }
+
+    // the packets that arrived by 'now'
+    template<typename F>
+    void deliver(double now, F&& fn){
+        while (!queue_.empty() && queue_.top().time <= now){
+            // copy out first, the handler might send over this link again
+            auto p = queue_.top();
+            queue_.pop();
+            fn(p.data.data(), (int32_t)p.data.size());
+        }
+    }
+
+    double next_arrival() const {
+        return queue_.empty() ? HUGE_VAL : queue_.top().time;
+    }
+
+    int64_t sent_packets() const { return sent_packets_; }
+    int64_t sent_bytes() const { return sent_bytes_; }
+    int64_t lost_packets() const { return lost_packets_; }
+private:
+    double jitter(){
+        switch (config_.dist){
+        case jitter_dist::uniform:
+            return random_.uniform() * config_.jitter_ms;
+        case jitter_dist::exponential:
+            return random_.exponential(config_.jitter_ms);
+        case jitter_dist::pareto:
+            return random_.pareto(config_.jitter_ms);
+        default:
+            return 0;
+        }
+    }
+
+    void push(double arrival, const char *data, int32_t n){
+        queue_.push(packet { arrival, order_++, std::vector<char>(data, data + n) });
+    }
+
+    link_config config_;
+    random random_;
+    bool bad_ = false;
+    double last_arrival_ = 0;
+    uint64_t order_ = 0;
+    std::priority_queue<packet, std::vector<packet>, std::greater<packet>> queue_;
+    int64_t sent_packets_ = 0;
+    int64_t sent_bytes_ = 0;
+    int64_t lost_packets_ = 0;
+};
+
+int32_t link_send(void *user, const char *data, int32_t n);
+
+/*////////////////////////// simulation //////////////////////////*/
+
+struct scenario {
+    std::string name;
+    link_config link;
+    double drift_ppm = 0; // how much faster the sink's audio clock runs
+};
+
+struct settings {
+    double duration = 30;
+    int32_t buffer_ms = 40;
+    int32_t blocksize = 256;
+    bool jitter_control = false;
+    bool time_stretch = false;
+    int32_t fec = 0;
+    int32_t pack = 1;
+    double rechannel = 0; // seconds, 0: never
+    double restart = 0; // seconds, 0: never
+    bool resend = true;
+    uint64_t seed = 1;
+};
+
+struct result {
+    int32_t dropouts = 0;
+    double dropout_ms = 0;
+    double latency_p50 = 0;
+    double latency_p99 = 0;
+    double latency_max = 0;
+    int64_t blocks_lost = 0;
+    int64_t blocks_resent = 0;
+    double request_percent = 0;  // sink -> source packets per stream packet
+    double resend_percent = 0;   // extra data packets per stream packet
+    double loss_percent = 0;     // of the stream on the link
+    double cpu_us_per_s = 0;
+};
+
+const int32_t samplerate = 48000;
+const int32_t source_id = 1;
+const int32_t sink_id = 1;
+// the ramp wraps around every 2^22 samples (87 s), exactly representable as float
+const double ramp_period = 4194304.0;
+const double warmup = 2.0; // seconds left out of the latency and dropouts
+
+// sends over the link on the current virtual time
+struct endpoint {
+    link *l;
+    double *now;
+};
+
+int32_t link_send(void *user, const char *data, int32_t n){
+    auto ep = static_cast<endpoint *>(user);
+    ep->l->send(*ep->now, data, n);
+    return n;
+}
+
+int32_t handle_sink_events(void *user, const aoo_event **events, int32_t n){
+    auto r = static_cast<result *>(user);
+    for (int32_t i = 0; i < n; ++i){
+        if (events[i]->type == AOO_BLOCK_LOST_EVENT){
+            r->blocks_lost += ((const aoo_block_lost_event *)events[i])->count;
+        } else if (events[i]->type == AOO_BLOCK_RESENT_EVENT){
+            r->blocks_resent += ((const aoo_block_resent_event *)events[i])->count;
+        }
+    }
+    return 1;
+}
+
+int32_t ignore_events(void *, const aoo_event **, int32_t){
+    return 1;
+}
+
+result run(const scenario& sc, const settings& st){
+    using clock = std::chrono::steady_clock;
+    clock::duration cputime{0};
+
+    double now = 0;
+    const double start = 1000000.0; // any NTP time will do
+    auto t = [&](double secs){ return aoo::time_tag(start + secs).to_uint64(); };
+    aoo::time_tag::set_virtual_now(aoo::time_tag(start));
+
+    link uplink(sc.link, st.seed * 2);      // source -> sink
+    link downlink(sc.link, st.seed * 2 + 1); // sink -> source
+    endpoint to_sink { &uplink, &now };
+    endpoint to_source { &downlink, &now };
+
+    aoo::isource::pointer source(aoo::isource::create(source_id));
+    aoo::isink::pointer sink(aoo::isink::create(sink_id));
+
+    const int32_t bs = st.blocksize;
+    source->setup(samplerate, bs, 1);
+    aoo_format_pcm fmt;
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.header.codec = AOO_CODEC_PCM;
+    fmt.header.nchannels = 1;
+    fmt.header.samplerate = samplerate;
+    fmt.header.blocksize = bs;
+    fmt.bitdepth = AOO_PCM_FLOAT32;
+    source->set_format(fmt.header);
+    source->set_ping_interval(1000);
+    // one packet per block, so the packet counts below add up
+    source->set_packetsize(AOO_MAXPACKETSIZE);
+    source->add_sink(&to_sink, sink_id, link_send);
+    if (st.fec > 1){
+        source->set_sink_fec_group(&to_sink, sink_id, st.fec);
+    }
+    if (st.pack > 1){
+        // what the sink would tell us with its invitation or format request
+        int32_t flags = AOO_PROTOCOL_FLAG_PACK;
+        source->set_sinkoption(&to_sink, sink_id, aoo_opt_protocol_flags, &flags, sizeof(flags));
+        source->set_sink_pack_limit(&to_sink, sink_id, st.pack);
+    }
+
+    sink->setup(samplerate, bs, 1);
+    sink->set_buffersize(st.buffer_ms);
+    sink->set_jitter_control(st.jitter_control ? 1 : 0);
+    sink->set_time_stretch(st.time_stretch ? 1 : 0);
+    if (st.pack > 1){
+        int32_t flags = AOO_PROTOCOL_FLAG_PACK;
+        sink->set_option(aoo_opt_protocol_flags, &flags, sizeof(flags));
+    }
+    if (!st.resend){
+        sink->set_resend_limit(0);
+    }
+
+    source->start();
+
+    std::vector<aoo_sample> input(bs), output(bs);
+    // the second channel (after --rechannel) gets the same ramp
+    const aoo_sample *inptrs[2] = { input.data(), input.data() };
+    aoo_sample *outptr = output.data();
+    bool rechanneled = false;
+    bool restarted = false;
+
+    // the source clock is the reference, the sink's runs off by the drift
+    const double source_period = (double)bs / samplerate;
+    const double sink_period = source_period / (1.0 + sc.drift_ppm * 1e-6);
+    double next_source = 0, next_sink = 0.5 * source_period;
+    int64_t source_blocks = 0;
+
+    result r;
+    std::vector<double> latencies;
+    bool playing = false, silent = false;
+    double lastindex = 0;
+
+    auto timed = [&](auto&& fn){
+        auto t0 = clock::now();
+        fn();
+        cputime += clock::now() - t0;
+    };
+
+    while (now < st.duration){
+        // on to whatever comes next
+        now = std::min({ next_source, next_sink, uplink.next_arrival(), downlink.next_arrival() });
+        aoo::time_tag::set_virtual_now(t(now));
+
+        uplink.deliver(now, [&](const char *data, int32_t n){
+            timed([&]{ sink->handle_message(data, n, &to_source, link_send); });
+        });
+        downlink.deliver(now, [&](const char *data, int32_t n){
+            timed([&]{ source->handle_message(data, n, &to_sink, link_send); });
+        });
+
+        if (now >= next_source){
+            if (st.rechannel > 0 && !rechanneled && now >= st.rechannel){
+                timed([&]{
+                    source->setup(samplerate, bs, 2);
+                    fmt.header.nchannels = 2;
+                    source->set_format(fmt.header);
+                });
+                rechanneled = true;
+            }
+            if (st.restart > 0 && !restarted && now >= st.restart){
+                // a new salt, and the format sent again
+                timed([&]{ source->setup(samplerate, bs, fmt.header.nchannels); });
+                restarted = true;
+            }
+            auto first = source_blocks * bs;
+            for (int32_t i = 0; i < bs; ++i){
+                input[i] = (aoo_sample)(std::fmod((double)(first + i), ramp_period) / ramp_period);
+            }
+            timed([&]{ source->process(inptrs, bs, t(now)); });
+            source_blocks++;
+            next_source = source_blocks * source_period;
+        }
+
+        if (now >= next_sink){
+            std::fill(output.begin(), output.end(), 0);
+            timed([&]{ sink->process(&outptr, bs, t(now)); });
+            next_sink += sink_period;
+
+            // a few zeros at the very start are the fade in, later ones are dropouts
+            bool zero = output[bs / 2] == 0;
+            if (!playing){
+                playing = !zero && now > warmup;
+            } else if (zero){
+                if (!silent){
+                    r.dropouts++;
+                }
+                r.dropout_ms += 1000.0 * bs / samplerate;
+            } else if (output[bs - 1] - output[0] == (aoo_sample)((bs - 1) / ramp_period)){
+                // which input sample this is, unwrapped around the last one;
+                // only from blocks that came through whole, not faded in or out
+                double index = output[0] * ramp_period;
+                index += std::round((lastindex - index) / ramp_period) * ramp_period;
+                lastindex = index;
+                latencies.push_back((now - index / samplerate) * 1000.0);
+            }
+            silent = playing && zero;
+        }
+
+        timed([&]{
+            source->send();
+            sink->send();
+            source->handle_events(ignore_events, nullptr);
+            sink->handle_events(handle_sink_events, &r);
+        });
+    }
+
+    if (!latencies.empty()){
+        std::sort(latencies.begin(), latencies.end());
+        auto quantile = [&](double q){
+            return latencies[(size_t)(q * (latencies.size() - 1) + 0.5)];
+        };
+        r.latency_p50 = quantile(0.5);
+        r.latency_p99 = quantile(0.99);
+        r.latency_max = latencies.back();
+    }
+    // everything beyond one data packet per block went out for resend requests
+    // (or FEC), the requests are all that comes back apart from the pings
+    auto stream = std::max<int64_t>(1, source_blocks);
+    r.request_percent = 100.0 * downlink.sent_packets() / stream;
+    r.resend_percent = 100.0 * std::max<int64_t>(0, uplink.sent_packets() - stream) / stream;
+    r.loss_percent = 100.0 * uplink.lost_packets() / std::max<int64_t>(1, uplink.sent_packets());
+    r.cpu_us_per_s = std::chrono::duration<double, std::micro>(cputime).count() / st.duration;
+    return r;
+}
+
+/*////////////////////////// scenarios //////////////////////////*/
+
+std::vector<scenario> default_scenarios(){
+    std::vector<scenario> list;
+    auto add = [&](const char *name, double delay, double jitter, jitter_dist dist){
+        scenario sc;
+        sc.name = name;
+        sc.link.delay_ms = delay;
+        sc.link.jitter_ms = jitter;
+        sc.link.dist = dist;
+        list.push_back(sc);
+        return &list.back();
+    };
+    add("ideal", 5, 0, jitter_dist::none);
+    add("lan", 1, 1, jitter_dist::uniform);
+    add("dsl", 15, 2, jitter_dist::exponential)->link.loss = 0.002;
+    {
+        auto sc = add("wifi", 5, 6, jitter_dist::exponential);
+        sc->link.burst_p = 0.002;
+        sc->link.burst_r = 0.3;
+        sc->link.burst_h = 0.5;
+    }
+    {
+        auto sc = add("bursty-loss", 20, 2, jitter_dist::uniform);
+        sc->link.burst_p = 0.01;
+        sc->link.burst_r = 0.25;
+        sc->link.burst_h = 0.8;
+    }
+    add("congested", 30, 8, jitter_dist::pareto);
+    {
+        auto sc = add("reorder", 20, 2, jitter_dist::uniform);
+        sc->link.reorder = 0.02;
+        sc->link.reorder_ms = 8;
+    }
+    add("duplicate", 20, 2, jitter_dist::uniform)->link.duplicate = 0.05;
+    add("drift+200ppm", 10, 1, jitter_dist::uniform)->drift_ppm = 200;
+    add("drift-200ppm", 10, 1, jitter_dist::uniform)->drift_ppm = -200;
+    return list;
+}
+
+bool parse_option(const std::string& arg, const char *name, std::string& value){
+    auto len = strlen(name);
+    if (arg.compare(0, len, name) == 0 && arg.size() > len && arg[len] == '='){
+        value = arg.substr(len + 1);
+        return true;
+    }
+    return false;
+}
+
+} // namespace
+
+int main(int argc, const char *argv[]){
+    settings st;
+    std::string filter;
+    bool csv = false;
+    bool custom = false;
+    scenario mine;
+    mine.name = "custom";
+
+    for (int i = 1; i < argc; ++i){
+        std::string arg = argv[i], v;
+        if (parse_option(arg, "--scenario", v)){
+            filter = v;
+        } else if (parse_option(arg, "--duration", v)){
+            st.duration = std::max(warmup + 1.0, atof(v.c_str()));
+        } else if (parse_option(arg, "--buffer", v)){
+            st.buffer_ms = std::max(0, atoi(v.c_str()));
+        } else if (parse_option(arg, "--blocksize", v)){
+            st.blocksize = std::max(16, atoi(v.c_str()));
+        } else if (arg == "--jitter-control"){
+            st.jitter_control = true;
+        } else if (arg == "--time-stretch"){
+            st.time_stretch = true;
+        } else if (parse_option(arg, "--fec", v)){
+            st.fec = atoi(v.c_str());
+        } else if (parse_option(arg, "--pack", v)){
+            st.pack = atoi(v.c_str());
+        } else if (parse_option(arg, "--rechannel", v)){
+            st.rechannel = std::max(0.0, atof(v.c_str()));
+        } else if (parse_option(arg, "--restart", v)){
+            st.restart = std::max(0.0, atof(v.c_str()));
+        } else if (parse_option(arg, "--resend", v)){
+            st.resend = atoi(v.c_str()) != 0;
+        } else if (parse_option(arg, "--seed", v)){
+            st.seed = strtoull(v.c_str(), nullptr, 10);
+        } else if (parse_option(arg, "--format", v)){
+            csv = v == "csv";
+        } else if (parse_option(arg, "--delay", v)){
+            mine.link.delay_ms = atof(v.c_str());
+            custom = true;
+        } else if (parse_option(arg, "--jitter", v)){
+            mine.link.jitter_ms = atof(v.c_str());
+            if (mine.link.dist == jitter_dist::none){
+                mine.link.dist = jitter_dist::uniform;
+            }
+            custom = true;
+        } else if (parse_option(arg, "--dist", v)){
+            mine.link.dist = v == "uniform" ? jitter_dist::uniform
+                           : v == "exp" ? jitter_dist::exponential
+                           : v == "pareto" ? jitter_dist::pareto : jitter_dist::none;
+            custom = true;
+        } else if (parse_option(arg, "--loss", v)){
+            mine.link.loss = atof(v.c_str()) * 0.01;
+            custom = true;
+        } else if (parse_option(arg, "--burst", v)){
+            if (sscanf(v.c_str(), "%lf,%lf,%lf", &mine.link.burst_p,
+                       &mine.link.burst_r, &mine.link.burst_h) != 3){
+                fprintf(stderr, "--burst takes <p>,<r>,<h>\n");
+                return 1;
+            }
+            custom = true;
+        } else if (parse_option(arg, "--reorder", v)){
+            mine.link.reorder = atof(v.c_str()) * 0.01;
+            custom = true;
+        } else if (parse_option(arg, "--dup", v)){
+            mine.link.duplicate = atof(v.c_str()) * 0.01;
+            custom = true;
+        } else if (parse_option(arg, "--drift", v)){
+            mine.drift_ppm = atof(v.c_str());
+            custom = true;
+        } else {
+            fprintf(stderr, "unknown option %s, see the top of aoo_loopback.cpp\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    aoo_initialize();
+
+    auto scenarios = custom ? std::vector<scenario>{ mine } : default_scenarios();
+
+    if (csv){
+        printf("scenario,dropouts,dropout_ms,latency_p50_ms,latency_p99_ms,latency_max_ms,"
+               "blocks_lost,blocks_resent,link_loss_percent,requests_percent,resent_percent,cpu_us_per_s\n");
+    } else {
+        printf("%.0f s, %d ms buffer, %d samples per block%s%s%s, seed %llu\n\n",
+               st.duration, st.buffer_ms, st.blocksize,
+               st.jitter_control ? ", jitter control" : "",
+               st.time_stretch ? ", time stretch" : "",
+               st.resend ? "" : ", no resending", (unsigned long long)st.seed);
+        printf("%-16s %9s %9s %27s %7s %7s %7s %8s %8s %9s\n", "Scenario", "Dropouts", "Silent",
+               "Latency ms (p50/p99/max)", "Lost", "Resent", "Loss%", "Reqs%", "Resend%", "CPU us/s");
+        printf("%s\n", std::string(118, '-').c_str());
+    }
+
+    int count = 0;
+    for (auto& sc : scenarios){
+        if (!filter.empty() && sc.name.find(filter) == std::string::npos){
+            continue;
+        }
+        count++;
+        auto r = run(sc, st);
+        if (csv){
+            printf("%s,%d,%.1f,%.2f,%.2f,%.2f,%lld,%lld,%.3f,%.3f,%.3f,%.1f\n", sc.name.c_str(),
+                   r.dropouts, r.dropout_ms, r.latency_p50, r.latency_p99, r.latency_max,
+                   (long long)r.blocks_lost, (long long)r.blocks_resent, r.loss_percent,
+                   r.request_percent, r.resend_percent, r.cpu_us_per_s);
+        } else {
+            char latency[64];
+            snprintf(latency, sizeof(latency), "%.1f / %.1f / %.1f",
+                     r.latency_p50, r.latency_p99, r.latency_max);
+            printf("%-16s %9d %7.0fms %27s %7lld %7lld %7.2f %8.2f %8.2f %9.0f\n", sc.name.c_str(),
+                   r.dropouts, r.dropout_ms, latency, (long long)r.blocks_lost,
+                   (long long)r.blocks_resent, r.loss_percent, r.request_percent,
+                   r.resend_percent, r.cpu_us_per_s);
+        }
+        fflush(stdout);
+    }
+
+    aoo_terminate();
+
+    if (count == 0){
+        fprintf(stderr, "no scenario matches '%s'\n", filter.c_str());
+        return 1;
+    }
+    return 0;
+}
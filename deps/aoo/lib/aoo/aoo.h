@@ -18,6 +18,11 @@ extern "C"
 
 // these are bit masks to go in the least significant byte of the version
 #define AOO_PROTOCOL_FLAG_COMPACT_DATA 0x1 // supports compact data message
+#define AOO_PROTOCOL_FLAG_FEC 0x2 // sends parity messages for forward error correction
+#define AOO_PROTOCOL_FLAG_PING_DATA 0x4 // accepts ping time tags appended to data messages
+#define AOO_PROTOCOL_FLAG_SILENCE 0x8 // gets a /silence message instead of silent blocks
+#define AOO_PROTOCOL_FLAG_PACK 0x10 // accepts several blocks in a single /pack message
+#define AOO_PROTOCOL_FLAG_OPUS_COUPLED 0x20 // decodes coupled stereo streams in Opus formats
 
 #ifndef AOO_DEBUG_DLL
  #define AOO_DEBUG_DLL 0
@@ -52,6 +57,12 @@ extern "C"
  #define AOO_SINK_BUFSIZE 100
 #endif
 
+// how many stream buffers of a source can be waiting to be played out,
+// when format changes follow each other faster than that
+#ifndef AOO_SINK_MAXCARRYOVER
+ #define AOO_SINK_MAXCARRYOVER 4
+#endif
+
 // time DLL filter bandwidth
 #ifndef AOO_TIMEFILTER_BANDWIDTH
 // #define AOO_TIMEFILTER_BANDWIDTH 0.012
@@ -83,6 +94,72 @@ extern "C"
  #define AOO_SEND_REDUNDANCY 1
 #endif
 
+// max. number of network paths to a single sink, including the primary one.
+// Can't be more than 4, the path is encoded in the lowest bits of the ping time tag.
+#ifndef AOO_MAXPATHS
+ #define AOO_MAXPATHS 2
+#endif
+
+// silence suppression for sinks with AOO_PROTOCOL_FLAG_SILENCE:
+// blocks with a lower peak don't count as audio...
+#ifndef AOO_SILENCE_THRESHOLD
+ #define AOO_SILENCE_THRESHOLD 0.0000316 // -90 dBFS
+#endif
+
+// ...and after this many ms of them the source stops sending data
+#ifndef AOO_SILENCE_HANGOVER
+ #define AOO_SILENCE_HANGOVER 100
+#endif
+
+// interval in ms at which the source repeats the /silence message meanwhile
+#ifndef AOO_SILENCE_KEEPALIVE
+ #define AOO_SILENCE_KEEPALIVE 250
+#endif
+
+// max. number of data blocks covered by a single parity block (FEC)
+#ifndef AOO_FEC_MAXGROUP
+ #define AOO_FEC_MAXGROUP 16
+#endif
+
+// max. relative playback speed change of the sink jitter controller
+#ifndef AOO_JITTER_MAXSTRETCH
+ #define AOO_JITTER_MAXSTRETCH 0.005
+#endif
+
+// safety margin in ms which the jitter controller adds to the measured jitter
+#ifndef AOO_JITTER_MARGIN
+ #define AOO_JITTER_MARGIN 2
+#endif
+
+// default fraction of the packets the jitter controller makes room for, see aoo_opt_jitter_quantile
+#ifndef AOO_JITTER_QUANTILE
+ #define AOO_JITTER_QUANTILE 0.99
+#endif
+
+// pitch period range in ms the sink time stretcher looks for, see aoo_opt_time_stretch
+#ifndef AOO_STRETCH_MINPERIOD
+ #define AOO_STRETCH_MINPERIOD 2.5
+#endif
+
+#ifndef AOO_STRETCH_MAXPERIOD
+ #define AOO_STRETCH_MAXPERIOD 12
+#endif
+
+// max. ms of audio the time stretcher makes up while no new audio comes in
+#ifndef AOO_STRETCH_MAXCONCEAL
+ #define AOO_STRETCH_MAXCONCEAL 40
+#endif
+
+// ms the buffered audio may exceed the jitter target before periods are cut out
+#ifndef AOO_STRETCH_OVERFILL
+ #define AOO_STRETCH_OVERFILL 10
+#endif
+
+// number of received blocks a sink keeps around for FEC (power of 2)
+#ifndef AOO_FEC_HISTORYSIZE
+ #define AOO_FEC_HISTORYSIZE 64
+#endif
+
 // max. number of resend attempts per packet
 #ifndef AOO_RESEND_LIMIT
  #define AOO_RESEND_LIMIT 5
@@ -98,6 +175,42 @@ extern "C"
  #define AOO_RESEND_MAXNUMFRAMES 16
 #endif
 
+// fraction of the stream bitrate a source may spend on resending to a single sink,
+// and on resending to all sinks together, see aoo_opt_resend_budget
+#ifndef AOO_RESEND_BUDGET
+ #define AOO_RESEND_BUDGET 0.5
+#endif
+
+#ifndef AOO_RESEND_TOTAL_BUDGET
+ #define AOO_RESEND_TOTAL_BUDGET 0.25
+#endif
+
+// max. number of blocks in a single /pack message, see aoo_opt_pack_limit
+#ifndef AOO_PACK_MAXBLOCKS
+ #define AOO_PACK_MAXBLOCKS 8
+#endif
+
+// fraction of the round trip time which waiting for the blocks of a pack may add
+#ifndef AOO_PACK_RTT_FRACTION
+ #define AOO_PACK_RTT_FRACTION 0.1
+#endif
+
+// packet loss (percent) at which a sink gets half as many blocks per pack
+#ifndef AOO_PACK_LOSS
+ #define AOO_PACK_LOSS 5
+#endif
+
+// packet loss (percent) for each additional time the frames are sent
+// to a sink with a redundancy of its own, see aoo_opt_redundancy
+#ifndef AOO_REDUNDANCY_LOSS
+ #define AOO_REDUNDANCY_LOSS 3
+#endif
+
+// time in ms after which a sink forgets a silent source, see aoo_opt_source_timeout
+#ifndef AOO_SOURCE_TIMEOUT
+ #define AOO_SOURCE_TIMEOUT 0
+#endif
+
 // initialize AoO library - call only once!
 AOO_API void aoo_initialize(void);
 
@@ -126,6 +239,14 @@ AOO_API void aoo_terminate(void);
 #define AOO_MSG_COMPACT_DATA_LEN 2
 #define AOO_MSG_CODEC_CHANGE "/codecchange"
 #define AOO_MSG_CODEC_CHANGE_LEN 12
+#define AOO_MSG_PARITY "/parity"
+#define AOO_MSG_PARITY_LEN 7
+#define AOO_MSG_SILENCE "/silence"
+#define AOO_MSG_SILENCE_LEN 8
+#define AOO_MSG_PACK "/pack"
+#define AOO_MSG_PACK_LEN 5
+#define AOO_MSG_SUBSCRIBE "/subscribe"
+#define AOO_MSG_SUBSCRIBE_LEN 10
 
 // id: the source or sink ID
 // returns: the offset to the remaining address pattern
@@ -144,6 +265,11 @@ typedef enum aoo_type
 AOO_API int32_t aoo_parse_pattern(const char *msg, int32_t n,
                                  int32_t *type, int32_t *id);
 
+// get the salt (= stream routing key) from a compact data message (/d <salt> ...)
+// without doing a full OSC parse. returns 1 on success, 0 on fail
+AOO_API int32_t aoo_parse_compact_data_salt(const char *msg, int32_t n,
+                                           int32_t *salt);
+
 // get the current NTP time
 AOO_API uint64_t aoo_osctime_get(void);
 
@@ -156,6 +282,19 @@ AOO_API uint64_t aoo_osctime_fromseconds(double s);
 // get time difference in seconds between two NTP timestamps
 AOO_API double aoo_osctime_duration(uint64_t t1, uint64_t t2);
 
+// the memory the sinks hold for received blocks, which comes from one
+// pool for the whole process. In bytes; 'held' includes the free
+// storage the pool keeps around for reuse
+typedef struct aoo_block_pool_stats
+{
+    int64_t used;
+    int64_t held;
+    int64_t peak_used;
+    int64_t peak_held;
+} aoo_block_pool_stats;
+
+AOO_API void aoo_get_block_pool_stats(aoo_block_pool_stats *stats);
+
 /*//////////////////// AoO events /////////////////////*/
 
 #define AOO_EVENTQUEUESIZE 64
@@ -186,7 +325,9 @@ typedef enum aoo_event_type
     // sink: blocks have been resent
     AOO_BLOCK_RESENT_EVENT,
     // sink: large gap between blocks
-    AOO_BLOCK_GAP_EVENT
+    AOO_BLOCK_GAP_EVENT,
+    // source: a sink only listens to some of the channels
+    AOO_SUBSCRIBE_EVENT
 } aoo_event_type;
 
 #define AOO_ENDPOINT_EVENT  \
@@ -232,6 +373,17 @@ typedef struct _aoo_block_event aoo_block_reordered_event;
 typedef struct _aoo_block_event aoo_block_resent_event;
 typedef struct _aoo_block_event aoo_block_gap_event;
 
+// subscribe event: the sink renders channels [onset, onset + nchannels)
+// of the stream, nchannels < 0 means all of them. It's up to the application
+// to send only those, e.g. by passing just these channels to the source
+// and setting the sink's channel onset (see aoo_opt_channelonset).
+typedef struct aoo_subscribe_event
+{
+    AOO_ENDPOINT_EVENT
+    int32_t onset;
+    int32_t nchannels;
+} aoo_subscribe_event;
+
 // ping event
 typedef struct aoo_ping_event {
     AOO_ENDPOINT_EVENT
@@ -340,7 +492,12 @@ typedef enum aoo_option
     aoo_opt_resend_maxnumframes,
     // Redundancy (int32_t)
     // ---
-    // The number of times each frames is sent (default = 1)
+    // The number of times each frames is sent (default = 1).
+    // Also a sink option for sources, the max. number of times for that
+    // sink, where the actual number follows the packet loss it reports:
+    // one more for every AOO_REDUNDANCY_LOSS percent, so clean links get
+    // every frame once and lossy ones get duplicates. 0 (default) means
+    // the source's fixed number instead.
     aoo_opt_redundancy,
     // buffer fill ratio (float)
     // ---
@@ -358,12 +515,184 @@ typedef enum aoo_option
     // For sources, send an optional userformat blob along with the format messages
     // ---
     // Could be used for any purpose (channel layouts, labels, etc)
-    aoo_opt_userformat
+    aoo_opt_userformat,
+    // FEC group size (int32_t), a sink option for sources
+    // ---
+    // If >= 2, the source sends one XOR parity block after every N data blocks,
+    // so the sink can rebuild a single lost block without waiting for a resend.
+    // Only single-frame blocks are covered and the resend buffer must be enabled.
+    // 0 or 1 disables it (default). Max. value is AOO_FEC_MAXGROUP.
+    aoo_opt_fec_group,
+    // Adaptive jitter control (int32_t) 0 or 1, a sink option
+    // ---
+    // If > 0, the sink tracks the packet arrival jitter of each source
+    // and slightly speeds up or slows down playback (by at most AOO_JITTER_MAXSTRETCH)
+    // to keep the buffered audio close to the delay that is actually needed.
+    // The buffer size then only acts as the upper limit.
+    aoo_opt_jitter_control,
+    // Jitter delay in ms (float)
+    // ---
+    // This is a read-only option used for sink::get_sourceoption()
+    // giving the current target delay of the jitter controller
+    aoo_opt_jitter_delay,
+    // Resampler quality (int32_t), a sink option
+    // ---
+    // The interpolation used by the dynamic resampler, which converts
+    // between the source and sink samplerate and compensates clock drift.
+    // AOO_RESAMPLE_LINEAR (default) is cheap, but causes some high frequency
+    // loss and aliasing. The windowed-sinc tiers are transparent enough
+    // to keep dynamic resampling enabled all the time.
+    aoo_opt_resample_quality,
+    // Source ID alias (int32_t), a sink option for sources
+    // ---
+    // The source presents itself to this sink with the given ID instead of
+    // its own, and accepts messages addressed to it. This way a single source
+    // (and encoder) can serve several sinks which each expect a different
+    // source. AOO_ID_NONE (default) means the source's own ID.
+    aoo_opt_source_alias,
+    // Encoder bitrate in bits/s (int32_t)
+    // ---
+    // Changes the bitrate of the running encoder without a format change,
+    // so the sinks keep decoding without a reset (e.g. for congestion control).
+    // 0 (default) means the bitrate of the format. Only has an effect if
+    // the codec supports it (e.g. Opus).
+    aoo_opt_bitrate,
+    // Multi-path mode (int32_t), a sink option for sources
+    // ---
+    // How the data is sent if the sink has extra paths (see aoo_source_add_sink_path).
+    // AOO_PATH_DUPLICATE (default) sends every block over every path, so the stream
+    // survives as long as any of them works. AOO_PATH_SPLIT sends every block over
+    // a single path, taking turns among the paths which answer our pings.
+    aoo_opt_path_mode,
+    // Best path to a sink (int32_t), a read-only sink option for sources
+    // ---
+    // 0 is the primary path, 1 and above are the extra paths in the order they
+    // were added. The pings go out over the paths in turn, the best path is the one
+    // with the lowest round trip time among those which answer. It carries the
+    // format messages and resent data.
+    aoo_opt_best_path,
+    // Jitter quantile (float), a sink option
+    // ---
+    // The fraction of the packets (0.5 to 0.9999) which the jitter controller
+    // makes room for, e.g. 0.99 or 0.999. The arrival delays are ranked in a
+    // decaying histogram over the last half minute or so, so the occasional
+    // late packet beyond that quantile doesn't blow up the delay.
+    // Default is AOO_JITTER_QUANTILE.
+    aoo_opt_jitter_quantile,
+    // Arrival jitter in ms (float)
+    // ---
+    // This is a read-only option used for sink::get_sourceoption()
+    // giving how late the packets arrive at the jitter quantile
+    aoo_opt_arrival_jitter,
+    // Low buffer fill in ms (float)
+    // ---
+    // This is a read-only option used for sink::get_sourceoption()
+    // giving the decoded audio which stays buffered for all but the
+    // (1 - jitter quantile) of the time, i.e. how much the buffer
+    // could shrink by without running dry more often than that.
+    aoo_opt_buffer_fill_quantile,
+    // Source timeout in ms (int32_t), a sink option
+    // ---
+    // A source which hasn't sent anything for this long is forgotten, so
+    // the sources of peers which left or reconnected with a new ID don't
+    // pile up. If it comes back, it is added again like a new one (with
+    // another AOO_SOURCE_ADD_EVENT). 0 never forgets a source.
+    // Default is AOO_SOURCE_TIMEOUT.
+    aoo_opt_source_timeout,
+    // Time stretching (int32_t) 0 or 1, a sink option
+    // ---
+    // If > 0, the sink repeats pitch periods of what it just played when
+    // a source's buffer runs short, instead of going silent, and (with
+    // jitter control) cuts periods out when the buffer holds much more
+    // than the jitter target, before blocks would have to be dropped.
+    // The pitch doesn't change, so a smaller buffer gives the same
+    // perceived dropout rate.
+    aoo_opt_time_stretch,
+    // Resend budget (float), a source option
+    // ---
+    // The fraction of the stream bitrate the source may spend on resending
+    // data to a single sink. Requests beyond that are dropped (the sink asks
+    // again after the resend interval), so that resending doesn't make
+    // congestion worse. 0 means no limit. Default is AOO_RESEND_BUDGET.
+    aoo_opt_resend_budget,
+    // Total resend budget (float), a source option
+    // ---
+    // Like aoo_opt_resend_budget, but for all sinks together, as a fraction
+    // of the bitrate of all streams. Default is AOO_RESEND_TOTAL_BUDGET.
+    aoo_opt_resend_total_budget,
+    // Resend deadline in ms (int32_t), a sink option for sources
+    // ---
+    // How long after a block was sent the sink can still play it, i.e.
+    // about the size of its jitter buffer. Requests for older blocks are
+    // dropped, the resent data would only arrive after it is needed.
+    // 0 (default) means no deadline.
+    aoo_opt_resend_deadline,
+    // Pack limit (int32_t), a sink option for sources
+    // ---
+    // Max. number of consecutive blocks the source may put into a single
+    // packet for the sink, which saves the per packet overhead when the
+    // blocks are small. The actual number follows the round trip time and
+    // the packet loss, so that waiting for the blocks only adds a fraction
+    // (AOO_PACK_RTT_FRACTION) of the round trip time. Needs a resend buffer
+    // and a sink with AOO_PROTOCOL_FLAG_PACK, sinks with more than one path
+    // or with FEC never get packed blocks.
+    // 1 (default) disables it. Max. value is AOO_PACK_MAXBLOCKS.
+    aoo_opt_pack_limit,
+    // Encoder complexity (int32_t)
+    // ---
+    // Changes the complexity of the running encoder without a format change,
+    // like aoo_opt_bitrate, e.g. to save CPU when the machine is overloaded.
+    // -1 (default) means the complexity of the format. Only has an effect if
+    // the codec supports it (e.g. Opus, 0-10).
+    aoo_opt_complexity
 } aoo_option;
 
+// multi-path modes for aoo_opt_path_mode
+#define AOO_PATH_DUPLICATE 0
+#define AOO_PATH_SPLIT 1
+
+// resampler quality tiers for aoo_opt_resample_quality
+#define AOO_RESAMPLE_LINEAR 0
+#define AOO_RESAMPLE_SINC_MEDIUM 1 // 16 taps
+#define AOO_RESAMPLE_SINC_HIGH 2 // 32 taps
+
 #define AOO_ARG(x) &x, sizeof(x)
 #define AOO_ARG_NULL 0, 0
 
+/*//////////////////// AoO clock /////////////////////*/
+
+// A time DLL filter for all the sources and sinks driven by the same
+// audio callback, so it runs once per block instead of once per object
+// and all of them see the same samplerate estimate. Update it once per
+// block before processing the sources and sinks using it, with the same
+// time tag. It has to outlive them, or be removed from them first.
+
+#ifdef __cplusplus
+namespace aoo {
+    class iclock;
+}
+using aoo_clock = aoo::iclock;
+#else
+typedef struct aoo_clock aoo_clock;
+#endif
+
+// create a new AoO clock instance
+AOO_API aoo_clock * aoo_clock_new(void);
+
+// destroy the AoO clock instance
+AOO_API void aoo_clock_free(aoo_clock *clock);
+
+// setup the clock, bandwidth like aoo_opt_timefilter_bandwidth
+// (needs to be synchronized with aoo_clock_update())
+AOO_API int32_t aoo_clock_setup(aoo_clock *clock, int32_t samplerate,
+                                int32_t blocksize, float bandwidth);
+
+// update the DLL filter (audio thread)
+AOO_API void aoo_clock_update(aoo_clock *clock, uint64_t t);
+
+// get the estimated real samplerate (always threadsafe)
+AOO_API double aoo_clock_get_samplerate(const aoo_clock *clock);
+
 /*//////////////////// AoO source /////////////////////*/
 
 #ifdef __cplusplus
@@ -405,6 +734,16 @@ AOO_API int32_t aoo_source_add_sink(aoo_source *src, void *sink, int32_t id, aoo
 // remove a sink (always threadsafe)
 AOO_API int32_t aoo_source_remove_sink(aoo_source *src, void *sink, int32_t id);
 
+// add an extra network path to a sink (always threadsafe)
+// 'path' is passed to the reply function like the sink endpoint, but should reach the
+// sink over a different local interface (e.g. cellular next to Wi-Fi). The sink doesn't
+// have to be told, it recognizes the stream by its salt and drops the duplicates.
+AOO_API int32_t aoo_source_add_sink_path(aoo_source *src, void *sink, int32_t id,
+                                         void *path, aoo_replyfn fn);
+
+// remove an extra network path from a sink (always threadsafe)
+AOO_API int32_t aoo_source_remove_sink_path(aoo_source *src, void *sink, int32_t id, void *path);
+
 // remove all sinks (always threadsafe)
 AOO_API void aoo_source_remove_all(aoo_source *src);
 
@@ -415,6 +754,12 @@ AOO_API int32_t aoo_source_handle_message(aoo_source *src, const char *data, int
 // send outgoing messages - will call the reply function (threadsafe, but not reentrant)
 AOO_API int32_t aoo_source_send(aoo_source *src);
 
+// send what's ready of the audio data, without ever waiting for a lock. returns
+// like aoo_source_send(), or -1 if a lock was taken, in which case nothing was
+// sent and it's for aoo_source_send() to do. the formats, resends and pings are
+// always left to it. not at the same time as aoo_source_send().
+AOO_API int32_t aoo_source_try_send(aoo_source *src);
+
 // process audio blocks (threadsafe, but not reentrant)
 // data:        array of channel data (non-interleaved)
 // nsamples:    number of samples per channel
@@ -422,6 +767,24 @@ AOO_API int32_t aoo_source_send(aoo_source *src);
 AOO_API int32_t aoo_source_process(aoo_source *src, const aoo_sample **data,
                            int32_t nsamples, uint64_t t);
 
+// like aoo_source_process(), but the audio has been resampled to 'samplerate'
+// by the caller, e.g. to convert the same signal once for several sources.
+// If that is the samplerate of the source's format, the source doesn't
+// resample at all. The number of samples can change from call to call, the
+// timing still goes by the samplerate and blocksize given to aoo_source_setup().
+AOO_API int32_t aoo_source_process_resampled(aoo_source *src, const aoo_sample **data,
+                           int32_t nsamples, int32_t samplerate, uint64_t t);
+
+// process a tick with a block that is already encoded in the source's format,
+// instead of audio to encode (threadsafe, but not reentrant). Call it like
+// aoo_source_process(), once per DSP tick, with the next block whenever one
+// is due and with a NULL block otherwise - the timing is up to the caller.
+// data:        the encoded block or NULL
+// size:        number of bytes
+// t:           current NTP timestamp (see aoo_osctime_get)
+AOO_API int32_t aoo_source_process_encoded(aoo_source *src, const char *data,
+                           int32_t size, uint64_t t);
+
 // get number of pending events (always thread safe)
 AOO_API int32_t aoo_source_events_available(aoo_source *src);
 
@@ -429,6 +792,14 @@ AOO_API int32_t aoo_source_events_available(aoo_source *src);
 // will call the event handler function one or more times
 AOO_API int32_t aoo_source_handle_events(aoo_source *src, aoo_eventhandler fn, void *user);
 
+// set a function to be notified about pending events (always thread safe)
+// so you don't have to poll aoo_source_events_available(). NULL removes it.
+AOO_API int32_t aoo_source_set_event_notify(aoo_source *src, aoo_notifyfn fn, void *user);
+
+// use a shared clock for the samplerate estimate instead of an own time DLL,
+// NULL goes back to the own one (always threadsafe)
+AOO_API int32_t aoo_source_set_clock(aoo_source *src, aoo_clock *clock);
+
 // set/get options (always threadsafe)
 AOO_API int32_t aoo_source_set_option(aoo_source *src, int32_t opt, void *p, int32_t size);
 
@@ -515,6 +886,22 @@ static inline int32_t aoo_source_get_redundancy(aoo_source *src, int32_t *n) {
     return aoo_source_get_option(src, aoo_opt_redundancy, AOO_ARG(*n));
 }
 
+static inline int32_t aoo_source_set_bitrate(aoo_source *src, int32_t n) {
+    return aoo_source_set_option(src, aoo_opt_bitrate, AOO_ARG(n));
+}
+
+static inline int32_t aoo_source_get_bitrate(aoo_source *src, int32_t *n) {
+    return aoo_source_get_option(src, aoo_opt_bitrate, AOO_ARG(*n));
+}
+
+static inline int32_t aoo_source_set_complexity(aoo_source *src, int32_t n) {
+    return aoo_source_set_option(src, aoo_opt_complexity, AOO_ARG(n));
+}
+
+static inline int32_t aoo_source_get_complexity(aoo_source *src, int32_t *n) {
+    return aoo_source_get_option(src, aoo_opt_complexity, AOO_ARG(*n));
+}
+
 static inline int32_t aoo_source_set_sink_channelonset(aoo_source *src, void *endpoint, int32_t id, int32_t onset) {
     return aoo_source_set_sinkoption(src, endpoint, id, aoo_opt_channelonset, AOO_ARG(onset));
 }
@@ -523,6 +910,58 @@ static inline int32_t aoo_source_get_sink_channelonset(aoo_source *src, void *en
     return aoo_source_get_sinkoption(src, endpoint, id, aoo_opt_channelonset, AOO_ARG(*onset));
 }
 
+static inline int32_t aoo_source_set_sink_fec_group(aoo_source *src, void *endpoint, int32_t id, int32_t n) {
+    return aoo_source_set_sinkoption(src, endpoint, id, aoo_opt_fec_group, AOO_ARG(n));
+}
+
+static inline int32_t aoo_source_get_sink_fec_group(aoo_source *src, void *endpoint, int32_t id, int32_t *n) {
+    return aoo_source_get_sinkoption(src, endpoint, id, aoo_opt_fec_group, AOO_ARG(*n));
+}
+
+static inline int32_t aoo_source_set_sink_source_alias(aoo_source *src, void *endpoint, int32_t id, int32_t alias) {
+    return aoo_source_set_sinkoption(src, endpoint, id, aoo_opt_source_alias, AOO_ARG(alias));
+}
+
+static inline int32_t aoo_source_get_sink_source_alias(aoo_source *src, void *endpoint, int32_t id, int32_t *alias) {
+    return aoo_source_get_sinkoption(src, endpoint, id, aoo_opt_source_alias, AOO_ARG(*alias));
+}
+
+static inline int32_t aoo_source_set_sink_path_mode(aoo_source *src, void *endpoint, int32_t id, int32_t mode) {
+    return aoo_source_set_sinkoption(src, endpoint, id, aoo_opt_path_mode, AOO_ARG(mode));
+}
+
+static inline int32_t aoo_source_get_sink_path_mode(aoo_source *src, void *endpoint, int32_t id, int32_t *mode) {
+    return aoo_source_get_sinkoption(src, endpoint, id, aoo_opt_path_mode, AOO_ARG(*mode));
+}
+
+static inline int32_t aoo_source_set_sink_resend_deadline(aoo_source *src, void *endpoint, int32_t id, int32_t ms) {
+    return aoo_source_set_sinkoption(src, endpoint, id, aoo_opt_resend_deadline, AOO_ARG(ms));
+}
+
+static inline int32_t aoo_source_get_sink_resend_deadline(aoo_source *src, void *endpoint, int32_t id, int32_t *ms) {
+    return aoo_source_get_sinkoption(src, endpoint, id, aoo_opt_resend_deadline, AOO_ARG(*ms));
+}
+
+static inline int32_t aoo_source_set_sink_pack_limit(aoo_source *src, void *endpoint, int32_t id, int32_t n) {
+    return aoo_source_set_sinkoption(src, endpoint, id, aoo_opt_pack_limit, AOO_ARG(n));
+}
+
+static inline int32_t aoo_source_get_sink_pack_limit(aoo_source *src, void *endpoint, int32_t id, int32_t *n) {
+    return aoo_source_get_sinkoption(src, endpoint, id, aoo_opt_pack_limit, AOO_ARG(*n));
+}
+
+static inline int32_t aoo_source_set_sink_redundancy(aoo_source *src, void *endpoint, int32_t id, int32_t n) {
+    return aoo_source_set_sinkoption(src, endpoint, id, aoo_opt_redundancy, AOO_ARG(n));
+}
+
+static inline int32_t aoo_source_get_sink_redundancy(aoo_source *src, void *endpoint, int32_t id, int32_t *n) {
+    return aoo_source_get_sinkoption(src, endpoint, id, aoo_opt_redundancy, AOO_ARG(*n));
+}
+
+static inline int32_t aoo_source_get_sink_best_path(aoo_source *src, void *endpoint, int32_t id, int32_t *path) {
+    return aoo_source_get_sinkoption(src, endpoint, id, aoo_opt_best_path, AOO_ARG(*path));
+}
+
 /*//////////////////// AoO sink /////////////////////*/
 
 #ifdef __cplusplus
@@ -561,6 +1000,8 @@ AOO_API int32_t aoo_sink_handle_message(aoo_sink *sink, const char *data, int32_
 AOO_API int32_t aoo_sink_send(aoo_sink *sink);
 
 // process audio (threadsafe, but not reentrant)
+// returns 1 if audio was written, 0 if no source played and 2 if they only
+// played silence, in the last two cases data is left untouched
 AOO_API int32_t aoo_sink_process(aoo_sink *sink, aoo_sample **data,
                                  int32_t nsamples, uint64_t t);
 
@@ -571,6 +1012,91 @@ AOO_API int32_t aoo_sink_events_available(aoo_sink *sink);
 // will call the event handler function one or more times
 AOO_API int32_t aoo_sink_handle_events(aoo_sink *sink, aoo_eventhandler fn, void *user);
 
+// set a function to be notified about pending events (always thread safe)
+// so you don't have to poll aoo_sink_events_available(). NULL removes it.
+AOO_API int32_t aoo_sink_set_event_notify(aoo_sink *sink, aoo_notifyfn fn, void *user);
+
+// A complete encoded block of a source, as it arrived and before it gets decoded.
+// 'format' and 'settings' are what the source sent in its last /format message,
+// they change together with 'salt', 'settings' can be passed to the
+// decoder_readformat function of the codec (see aoo_find_codec()).
+typedef struct aoo_packet_tap_info
+{
+    void *endpoint;
+    int32_t id;
+    int32_t salt;
+    const aoo_format *format;
+    const char *settings;
+    int32_t settingssize;
+    int32_t sequence;
+    double samplerate; // the real samplerate of the source
+    int32_t channel;
+    const char *data;
+    int32_t size;
+} aoo_packet_tap_info;
+
+typedef void (*aoo_packettapfn)(void *user, const aoo_packet_tap_info *info);
+
+// set a function that gets every complete encoded block of the sources,
+// called on the thread calling aoo_sink_handle_message(). NULL removes it,
+// but a call may still be in progress on that thread.
+AOO_API int32_t aoo_sink_set_packet_tap(aoo_sink *sink, aoo_packettapfn fn, void *user);
+
+// use a shared clock for the samplerate estimate instead of an own time DLL,
+// NULL goes back to the own one (always threadsafe)
+AOO_API int32_t aoo_sink_set_clock(aoo_sink *sink, aoo_clock *clock);
+
+// what happened to a block, see aoo_telemetry_info
+#define AOO_TELEMETRY_ARRIVED 0 // a frame of it came in
+#define AOO_TELEMETRY_RESEND 1 // (part of) it was asked for again
+#define AOO_TELEMETRY_DROPPED 2 // given up on, it gets concealed
+
+typedef struct aoo_telemetry_info
+{
+    void *endpoint;
+    int32_t id;
+    int32_t type; // AOO_TELEMETRY_*
+    int32_t sequence;
+    int32_t framenum; // the frame that arrived or is asked for, -1 for the whole block
+    uint64_t arrival; // NTP time tag of when it happened
+    uint64_t sent; // NTP time tag the source put on the packet, 0 if none (arrivals only)
+    float fill; // decoded audio waiting in the sink's buffer, in seconds
+} aoo_telemetry_info;
+
+typedef void (*aoo_telemetryfn)(void *user, const aoo_telemetry_info *info);
+
+// set a function that is told about every frame that arrives, every resend
+// request and every dropped block, for recording the network behaviour.
+// Called on the thread calling aoo_sink_handle_message() or aoo_sink_send().
+// NULL removes it, but a call may still be in progress on those threads.
+AOO_API int32_t aoo_sink_set_telemetry_tap(aoo_sink *sink, aoo_telemetryfn fn, void *user);
+
+// where a block is on its way through the sink, see aoo_trace_info
+#define AOO_TRACE_RECEIVED 0 // a frame of it came in
+#define AOO_TRACE_QUEUED 1 // it is complete in the block queue, waiting for the ones before
+#define AOO_TRACE_DECODED 2 // it was decoded into the audio queue
+#define AOO_TRACE_PLAYED 3 // its samples went to the resampler for playout
+
+typedef struct aoo_trace_info
+{
+    void *endpoint;
+    int32_t id;
+    int32_t salt; // with the sequence it tells the blocks of all streams apart
+    int32_t stage; // AOO_TRACE_*
+    int32_t sequence;
+    int32_t framenum; // the frame that came in, -1 for the other stages
+} aoo_trace_info;
+
+typedef void (*aoo_tracefn)(void *user, const aoo_trace_info *info);
+
+// set a function that is told about every block as it passes through the
+// stages of the sink, for following a packet across threads in a timeline.
+// Called on the thread calling aoo_sink_handle_message() for the first three
+// stages and on the thread calling aoo_sink_process() for AOO_TRACE_PLAYED,
+// so it must be realtime safe. NULL removes it, but a call may still be in
+// progress on those threads.
+AOO_API int32_t aoo_sink_set_trace_tap(aoo_sink *sink, aoo_tracefn fn, void *user);
+
 // set/get options (always threadsafe)
 AOO_API int32_t aoo_sink_set_option(aoo_sink *sink, int32_t opt, void *p, int32_t size);
 
@@ -698,6 +1224,21 @@ typedef int32_t (*aoo_codec_decode)(
 
 typedef int32_t (*aoo_codec_reset)(void *) ;
 
+typedef int32_t (*aoo_codec_setpacketloss)(
+        void *,         // the encoder instance
+        int32_t         // expected packet loss in percent (0-100)
+);
+
+typedef int32_t (*aoo_codec_setbitrate)(
+        void *,         // the encoder instance
+        int32_t         // bitrate in bits/s, 0 = bitrate of the format
+);
+
+typedef int32_t (*aoo_codec_setcomplexity)(
+        void *,         // the encoder instance
+        int32_t         // codec specific complexity, -1 = complexity of the format
+);
+
 
 typedef struct aoo_codec
 {
@@ -719,11 +1260,25 @@ typedef struct aoo_codec
     aoo_codec_readformat decoder_readformat;
     aoo_codec_decode decoder_decode;
     aoo_codec_reset decoder_reset;
+    // optional, may be NULL
+    // ---
+    // hint the expected packet loss, so the encoder can add redundancy
+    aoo_codec_setpacketloss encoder_setpacketloss;
+    // decode the previous (lost) block from the redundant data
+    // contained in the given block
+    aoo_codec_decode decoder_decodefec;
+    // change the bitrate without changing the format
+    aoo_codec_setbitrate encoder_setbitrate;
+    // change the complexity without changing the format
+    aoo_codec_setcomplexity encoder_setcomplexity;
 } aoo_codec;
 
 // register an external codec plugin
 AOO_API int32_t aoo_register_codec(const char *name, const aoo_codec *codec);
 
+// look up a registered codec, e.g. for decoding tapped packets offline. NULL if not found
+AOO_API const aoo_codec * aoo_find_codec(const char *name);
+
 // The type of 'aoo_register_codec', which gets passed to codec setup functions.
 // For now, plugins are registered statically - or manually by the user.
 // Later we might want to automatically look for codec plugins.
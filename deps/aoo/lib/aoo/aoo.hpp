@@ -28,6 +28,45 @@ namespace aoo {
 //
 // If you want to be on the safe safe, use the C interface :-)
 
+/*//////////////////////// AoO clock ///////////////////////*/
+
+class iclock {
+public:
+    class deleter {
+    public:
+        void operator()(iclock *x){
+            destroy(x);
+        }
+    };
+    // smart pointer for AoO clock instance
+    using pointer = std::unique_ptr<iclock, deleter>;
+
+    // create a new AoO clock instance
+    static iclock * create();
+
+    // destroy the AoO clock instance
+    static void destroy(iclock *clock);
+
+    // setup the clock, see aoo_clock_setup()
+    virtual int32_t setup(int32_t samplerate, int32_t blocksize, float bandwidth) = 0;
+
+    // update the DLL filter once per block (audio thread)
+    virtual void update(uint64_t t) = 0;
+
+    // get the estimated real samplerate (always threadsafe)
+    virtual double get_samplerate() const = 0;
+protected:
+    ~iclock(){} // non-virtual!
+};
+
+inline iclock * iclock::create(){
+    return aoo_clock_new();
+}
+
+inline void iclock::destroy(iclock *clock){
+    aoo_clock_free(clock);
+}
+
 /*//////////////////////// AoO source ///////////////////////*/
 
 class isource {
@@ -56,6 +95,12 @@ public:
     // remova a sink (always threadsafe)
     virtual int32_t remove_sink(void *sink, int32_t id) = 0;
 
+    // add an extra network path to a sink (always threadsafe), see aoo_source_add_sink_path()
+    virtual int32_t add_sink_path(void *sink, int32_t id, void *path, aoo_replyfn fn) = 0;
+
+    // remove an extra network path from a sink (always threadsafe)
+    virtual int32_t remove_sink_path(void *sink, int32_t id, void *path) = 0;
+
     // remove all sinks (always threadsafe)
     virtual void remove_all() = 0;
 
@@ -66,6 +111,10 @@ public:
     // send outgoing messages - will call the reply function (threadsafe, but not reentrant)
     virtual int32_t send() = 0;
 
+    // only the audio data, without waiting for a lock, -1 if one was taken.
+    // see aoo_source_try_send()
+    virtual int32_t try_send() = 0;
+
     // process audio blocks (threadsafe, but not reentrant)
     // data:        array of channel data (non-interleaved)
     // nsamples:    number of samples per channel
@@ -73,6 +122,15 @@ public:
     virtual int32_t process(const aoo_sample **data,
                             int32_t nsamples, uint64_t t) = 0;
 
+    // process audio which the caller resampled to the given samplerate
+    // (threadsafe, but not reentrant), see aoo_source_process_resampled()
+    virtual int32_t process_resampled(const aoo_sample **data, int32_t nsamples,
+                                      int32_t samplerate, uint64_t t) = 0;
+
+    // process a tick with an already encoded block or none (threadsafe, but not reentrant),
+    // see aoo_source_process_encoded()
+    virtual int32_t process_encoded(const char *data, int32_t size, uint64_t t) = 0;
+
     // get number of pending events (always thread safe)
     virtual int32_t events_available() = 0;
 
@@ -80,6 +138,12 @@ public:
     // will call the event handler function one or more times
     virtual int32_t handle_events(aoo_eventhandler fn, void *user) = 0;
 
+    // set a function to be notified about pending events (always thread safe)
+    virtual int32_t set_event_notify(aoo_notifyfn fn, void *user) = 0;
+
+    // use a shared clock instead of an own time DLL, see aoo_source_set_clock()
+    virtual int32_t set_clock(iclock *clock) = 0;
+
     //---------------------- options ----------------------//
     // set/get options (always threadsafe)
 
@@ -155,6 +219,38 @@ public:
         return get_option(aoo_opt_redundancy, AOO_ARG(n));
     }
 
+    int32_t set_bitrate(int32_t n){
+        return set_option(aoo_opt_bitrate, AOO_ARG(n));
+    }
+
+    int32_t get_bitrate(int32_t& n){
+        return get_option(aoo_opt_bitrate, AOO_ARG(n));
+    }
+
+    int32_t set_complexity(int32_t n){
+        return set_option(aoo_opt_complexity, AOO_ARG(n));
+    }
+
+    int32_t get_complexity(int32_t& n){
+        return get_option(aoo_opt_complexity, AOO_ARG(n));
+    }
+
+    int32_t set_resend_budget(float f){
+        return set_option(aoo_opt_resend_budget, AOO_ARG(f));
+    }
+
+    int32_t get_resend_budget(float& f){
+        return get_option(aoo_opt_resend_budget, AOO_ARG(f));
+    }
+
+    int32_t set_resend_total_budget(float f){
+        return set_option(aoo_opt_resend_total_budget, AOO_ARG(f));
+    }
+
+    int32_t get_resend_total_budget(float& f){
+        return get_option(aoo_opt_resend_total_budget, AOO_ARG(f));
+    }
+
     int32_t set_ping_interval(int32_t n){
         return set_option(aoo_opt_ping_interval, AOO_ARG(n));
     }
@@ -186,6 +282,58 @@ public:
         return get_sinkoption(endpoint, id, aoo_opt_channelonset, AOO_ARG(onset));
     }
 
+    int32_t set_sink_fec_group(void *endpoint, int32_t id, int32_t n){
+        return set_sinkoption(endpoint, id, aoo_opt_fec_group, AOO_ARG(n));
+    }
+
+    int32_t get_sink_fec_group(void *endpoint, int32_t id, int32_t& n){
+        return get_sinkoption(endpoint, id, aoo_opt_fec_group, AOO_ARG(n));
+    }
+
+    int32_t set_sink_source_alias(void *endpoint, int32_t id, int32_t alias){
+        return set_sinkoption(endpoint, id, aoo_opt_source_alias, AOO_ARG(alias));
+    }
+
+    int32_t get_sink_source_alias(void *endpoint, int32_t id, int32_t& alias){
+        return get_sinkoption(endpoint, id, aoo_opt_source_alias, AOO_ARG(alias));
+    }
+
+    int32_t set_sink_path_mode(void *endpoint, int32_t id, int32_t mode){
+        return set_sinkoption(endpoint, id, aoo_opt_path_mode, AOO_ARG(mode));
+    }
+
+    int32_t get_sink_path_mode(void *endpoint, int32_t id, int32_t& mode){
+        return get_sinkoption(endpoint, id, aoo_opt_path_mode, AOO_ARG(mode));
+    }
+
+    int32_t set_sink_resend_deadline(void *endpoint, int32_t id, int32_t ms){
+        return set_sinkoption(endpoint, id, aoo_opt_resend_deadline, AOO_ARG(ms));
+    }
+
+    int32_t get_sink_resend_deadline(void *endpoint, int32_t id, int32_t& ms){
+        return get_sinkoption(endpoint, id, aoo_opt_resend_deadline, AOO_ARG(ms));
+    }
+
+    int32_t set_sink_pack_limit(void *endpoint, int32_t id, int32_t n){
+        return set_sinkoption(endpoint, id, aoo_opt_pack_limit, AOO_ARG(n));
+    }
+
+    int32_t get_sink_pack_limit(void *endpoint, int32_t id, int32_t& n){
+        return get_sinkoption(endpoint, id, aoo_opt_pack_limit, AOO_ARG(n));
+    }
+
+    int32_t set_sink_redundancy(void *endpoint, int32_t id, int32_t n){
+        return set_sinkoption(endpoint, id, aoo_opt_redundancy, AOO_ARG(n));
+    }
+
+    int32_t get_sink_redundancy(void *endpoint, int32_t id, int32_t& n){
+        return get_sinkoption(endpoint, id, aoo_opt_redundancy, AOO_ARG(n));
+    }
+
+    int32_t get_sink_best_path(void *endpoint, int32_t id, int32_t& path){
+        return get_sinkoption(endpoint, id, aoo_opt_best_path, AOO_ARG(path));
+    }
+
     virtual int32_t set_sinkoption(void *endpoint, int32_t id,
                                    int32_t opt, void *ptr, int32_t size) = 0;
     virtual int32_t get_sinkoption(void *endpoint, int32_t id,
@@ -241,6 +389,8 @@ public:
     virtual int32_t send() = 0;
 
     // process audio (threadsafe, but not reentrant)
+    // returns 1 if audio was written, 0 if no source played and 2 if they only
+    // played silence, in the last two cases data is left untouched
     virtual int32_t process(aoo_sample **data, int32_t nsamples, uint64_t t) = 0;
 
     // get number of pending events (always thread safe)
@@ -250,6 +400,21 @@ public:
     // will call the event handler function one or more times
     virtual int32_t handle_events(aoo_eventhandler fn, void *user) = 0;
 
+    // set a function to be notified about pending events (always thread safe)
+    virtual int32_t set_event_notify(aoo_notifyfn fn, void *user) = 0;
+
+    // get every complete encoded block before it is decoded, see aoo_sink_set_packet_tap()
+    virtual int32_t set_packet_tap(aoo_packettapfn fn, void *user) = 0;
+
+    // use a shared clock instead of an own time DLL, see aoo_sink_set_clock()
+    virtual int32_t set_clock(iclock *clock) = 0;
+
+    // arrivals, resend requests and drops of blocks, see aoo_sink_set_telemetry_tap()
+    virtual int32_t set_telemetry_tap(aoo_telemetryfn fn, void *user) = 0;
+
+    // the stages every block passes through, see aoo_sink_set_trace_tap()
+    virtual int32_t set_trace_tap(aoo_tracefn fn, void *user) = 0;
+
     //---------------------- options ----------------------//
     // set/get options (always threadsafe)
 
@@ -321,6 +486,46 @@ public:
         return get_option(aoo_opt_resend_maxnumframes, AOO_ARG(n));
     }
 
+    int32_t set_jitter_control(int32_t n){
+        return set_option(aoo_opt_jitter_control, AOO_ARG(n));
+    }
+
+    int32_t get_jitter_control(int32_t& n){
+        return get_option(aoo_opt_jitter_control, AOO_ARG(n));
+    }
+
+    int32_t set_jitter_quantile(float q){
+        return set_option(aoo_opt_jitter_quantile, AOO_ARG(q));
+    }
+
+    int32_t get_jitter_quantile(float& q){
+        return get_option(aoo_opt_jitter_quantile, AOO_ARG(q));
+    }
+
+    int32_t set_source_timeout(int32_t ms){
+        return set_option(aoo_opt_source_timeout, AOO_ARG(ms));
+    }
+
+    int32_t get_source_timeout(int32_t& ms){
+        return get_option(aoo_opt_source_timeout, AOO_ARG(ms));
+    }
+
+    int32_t set_time_stretch(int32_t n){
+        return set_option(aoo_opt_time_stretch, AOO_ARG(n));
+    }
+
+    int32_t get_time_stretch(int32_t& n){
+        return get_option(aoo_opt_time_stretch, AOO_ARG(n));
+    }
+
+    int32_t set_resample_quality(int32_t n){
+        return set_option(aoo_opt_resample_quality, AOO_ARG(n));
+    }
+
+    int32_t get_resample_quality(int32_t& n){
+        return get_option(aoo_opt_resample_quality, AOO_ARG(n));
+    }
+
     virtual int32_t set_option(int32_t opt, void *ptr, int32_t size) = 0;
     virtual int32_t get_option(int32_t opt, void *ptr, int32_t size) = 0;
 
@@ -335,7 +540,22 @@ public:
         return get_sourceoption(endpoint, id, aoo_opt_format, AOO_ARG(f));
     }
 
+    int32_t get_source_jitter_delay(void *endpoint, int32_t id, float& ms){
+        return get_sourceoption(endpoint, id, aoo_opt_jitter_delay, AOO_ARG(ms));
+    }
+
+    int32_t get_source_arrival_jitter(void *endpoint, int32_t id, float& ms){
+        return get_sourceoption(endpoint, id, aoo_opt_arrival_jitter, AOO_ARG(ms));
+    }
+
+    int32_t get_source_buffer_fill_quantile(void *endpoint, int32_t id, float& ms){
+        return get_sourceoption(endpoint, id, aoo_opt_buffer_fill_quantile, AOO_ARG(ms));
+    }
+
     virtual int32_t request_source_codec_change(void *endpoint, int32_t id, aoo_format & f) = 0;
+
+    // tell the source which channels we actually render, nchannels < 0: all (see AOO_SUBSCRIBE_EVENT)
+    virtual int32_t request_source_subscription(void *endpoint, int32_t id, int32_t onset, int32_t nchannels) = 0;
     
     virtual int32_t set_sourceoption(void *endpoint, int32_t id,
                                    int32_t opt, void *ptr, int32_t size) = 0;
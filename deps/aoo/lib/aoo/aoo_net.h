@@ -77,6 +77,18 @@ extern "C"
 #define AOONET_MSG_LEAVE "/leave"
 #define AOONET_MSG_LEAVE_LEN 6
 
+#define AOONET_MSG_RELAY "/relay"
+#define AOONET_MSG_RELAY_LEN 6
+
+#define AOONET_MSG_FORWARD "/forward"
+#define AOONET_MSG_FORWARD_LEN 8
+
+#define AOONET_MSG_ROUTE "/route"
+#define AOONET_MSG_ROUTE_LEN 6
+
+#define AOONET_MSG_NODE "/node"
+#define AOONET_MSG_NODE_LEN 5
+
 typedef enum aoonet_type
 {
     AOO_TYPE_SERVER = 1000,
@@ -88,6 +100,38 @@ typedef enum aoonet_type
 // returns 1 on success, 0 on fail
 AOO_API int32_t aoonet_parse_pattern(const char *msg, int32_t n, int32_t *type);
 
+// Peers which can't reach each other directly can talk through the server
+// (see aoonet_server_set_relay()). Relayed packets are wrapped in a
+// /aoo/relay <i:ip> <i:port> <b:packet> message with a fixed size header.
+// Towards the server the address is the receiving peer, coming from the
+// server it is the sending peer.
+#define AOONET_RELAY_HEADER_SIZE 32
+
+// write the relay header for a packet of 'size' bytes to 'buf', which must hold
+// at least AOONET_RELAY_HEADER_SIZE bytes. 'addr' is an IPv4 sockaddr and 'size'
+// must be a multiple of 4 (as for any OSC packet). returns the header size or 0.
+AOO_API int32_t aoonet_write_relay_header(char *buf, const void *addr, int32_t size);
+
+// check for a relay message. on success, 'addr' (a sockaddr_in) receives the
+// address, 'size' the size of the wrapped packet and the header size is returned.
+// returns 0 if this isn't a (valid) relay message.
+AOO_API int32_t aoonet_parse_relay(const char *msg, int32_t n, void *addr, int32_t *size);
+
+// Instead of sending the same packet to several peers, a client can send it
+// once to the server, which passes it on to every peer of a route (see
+// aoonet_client_set_forward_route()). Forwarded packets are wrapped in a
+// /aoo/forward <i:route> <b:packet> message; the peers receive them as
+// relay messages from the sender.
+#define AOONET_FORWARD_HEADER_SIZE 28
+
+// write the forward header for a packet of 'size' bytes (a multiple of 4)
+// to 'buf'. returns the header size or 0.
+AOO_API int32_t aoonet_write_forward_header(char *buf, int32_t route, int32_t size);
+
+// check for a forward message. on success, 'route' and 'size' receive the route ID
+// and the size of the wrapped packet and the header size is returned, otherwise 0.
+AOO_API int32_t aoonet_parse_forward(const char *msg, int32_t n, int32_t *route, int32_t *size);
+
 /*///////////////////////// AOO events///////////////////////////*/
 
 typedef enum aoonet_event_type
@@ -95,7 +139,7 @@ typedef enum aoonet_event_type
     // client events
     AOONET_CLIENT_ERROR_EVENT = 0,
     AOONET_CLIENT_PING_EVENT,
-    AOONET_CLIENT_CONNECT_EVENT,
+    AOONET_CLIENT_CONNECT_EVENT, // result 2: resumed the previous session (see aoonet_client_set_reconnect())
     AOONET_CLIENT_DISCONNECT_EVENT,
     AOONET_CLIENT_GROUP_JOIN_EVENT,
     AOONET_CLIENT_GROUP_LEAVE_EVENT,
@@ -143,6 +187,47 @@ typedef struct aoonet_server_group_event
     const char *user;
 } aoonet_server_group_event;
 
+// statistics about the messages sent to the clients
+typedef struct aoonet_server_send_stats
+{
+    uint64_t messages;      // messages queued for sending
+    uint64_t bytes_sent;
+    uint64_t dropped;       // messages dropped because of a full output queue
+    int32_t would_block;    // number of times a client's socket was full
+    int32_t disconnects;    // clients disconnected because of a full output queue
+    int32_t max_queued;     // largest output queue (in bytes) seen so far
+} aoonet_server_send_stats;
+
+// statistics about relayed peer traffic
+typedef struct aoonet_server_relay_stats
+{
+    uint64_t packets;       // forwarded packets
+    uint64_t bytes;         // forwarded bytes
+    uint64_t dropped;       // packets dropped by the bandwidth limit
+    uint64_t rejected;      // packets from/to unknown or unrelated peers
+    int32_t sessions;       // active peer pairs (one per direction)
+    uint64_t xdp_packets;   // of the forwarded packets, those sent by AF_XDP
+} aoonet_server_relay_stats;
+
+// general server statistics, e.g. for monitoring
+typedef struct aoonet_server_stats
+{
+    int32_t clients;        // open client connections
+    int32_t users;          // logged in users
+    int32_t groups;
+    uint64_t udp_packets;   // received UDP packets
+    uint64_t udp_bytes;     // received UDP bytes
+    uint64_t loops;         // handled batches of socket events (all I/O threads)
+    uint64_t loop_time;     // total time spent handling them (microseconds)
+    int32_t max_loop_time;  // longest batch so far (microseconds)
+    int32_t nodes;          // other servers of the cluster
+    int32_t remote_members; // group members on the other servers
+    uint64_t rejected_accepts; // connections closed by the rate limit
+    uint64_t rejected_logins;  // login attempts refused by the rate limit
+    uint64_t rejected_udp;     // UDP messages dropped by the rate limit
+    uint64_t quick_replies;    // pings and requests answered without parsing
+} aoonet_server_stats;
+
 #define aoonet_client_event aoonet_reply_event
 
 typedef struct aoonet_client_group_event
@@ -158,6 +243,9 @@ typedef struct aoonet_client_peer_event
     const char *user;
     void *address;
     int32_t length;
+    // if not NULL, the peer can only be reached through the server's
+    // relay at this address (see aoonet_write_relay_header())
+    void *relay_address;
 } aoonet_client_peer_event;
 
 
@@ -194,6 +282,70 @@ AOO_API int32_t aoonet_server_events_available(aoonet_server *server);
 AOO_API int32_t aoonet_server_handle_events(aoonet_server *server,
                                             aoo_eventhandler fn, void *user);
 
+// set a function to be notified about pending events (always thread safe)
+AOO_API int32_t aoonet_server_set_event_notify(aoonet_server *server,
+                                               aoo_notifyfn fn, void *user);
+
+// number of threads handling client connections, call before run().
+// only supported with epoll/kqueue, otherwise it stays 1.
+AOO_API int32_t aoonet_server_set_io_threads(aoonet_server *server, int32_t n);
+
+// max. number of unsent bytes per client; a client which falls further behind
+// is disconnected (default: 1 MB). always thread safe.
+AOO_API int32_t aoonet_server_set_send_queue_limit(aoonet_server *server, int32_t bytes);
+
+// get the send statistics (always thread safe)
+AOO_API int32_t aoonet_server_get_send_stats(aoonet_server *server,
+                                             aoonet_server_send_stats *stats);
+
+// relay UDP packets between peers which can't connect directly, e.g. because
+// both are behind a symmetric NAT. only logged in users are relayed, and only
+// to members of their own groups. 'bandwidth' is the max. number of bytes per
+// second for each direction of a peer pair (0 = unlimited). always thread safe.
+AOO_API int32_t aoonet_server_set_relay(aoonet_server *server, int32_t enable,
+                                        int32_t bandwidth);
+
+// get the relay statistics (always thread safe)
+AOO_API int32_t aoonet_server_get_relay_stats(aoonet_server *server,
+                                              aoonet_server_relay_stats *stats);
+
+// get the general server statistics (always thread safe)
+AOO_API int32_t aoonet_server_get_stats(aoonet_server *server,
+                                        aoonet_server_stats *stats);
+
+// limit the TCP connections, login attempts and UDP messages (other than relayed
+// packets) per source IP address and second, with bursts of twice as many.
+// whatever goes over is dropped before it is parsed, so that a misbehaving
+// client can't hold up everybody else. 0 = unlimited (default: 5, 5, 100).
+// always thread safe.
+AOO_API int32_t aoonet_server_set_rate_limits(aoonet_server *server, int32_t accepts,
+                                              int32_t logins, int32_t udp);
+
+// add another server of a cluster. the servers exchange their group members
+// over UDP, so that users who join the same group (with the same password)
+// on different servers see each other as peers. every server should list all
+// the others, connections between the nodes are not relayed. user names are
+// only unique per server. always thread safe, but 'host' is resolved in place.
+AOO_API int32_t aoonet_server_add_node(aoonet_server *server, const char *host,
+                                       int32_t port);
+
+// keep the user sessions (who is in which group) in the file at 'path', written
+// every 'interval' seconds if something has changed, and when the server quits.
+// the sessions of an existing file are loaded right away, so that clients which
+// reconnect after a restart resume theirs in a single round trip, instead of
+// logging in and joining their groups all over again. call before run().
+AOO_API int32_t aoonet_server_set_snapshot(aoonet_server *server, const char *path,
+                                           int32_t interval);
+
+// send the relayed and forwarded packets straight from the receive queues of
+// the network interface 'ifname', past the kernel's UDP stack (AF_XDP). the
+// rest, like the control messages, still goes through the sockets. 'queues'
+// is the number of receive queues to serve (<= 0: all). Linux only, needs
+// CAP_NET_ADMIN and CAP_BPF (or root). returns 0 if it's not available, in
+// which case (or with an empty 'ifname') it's all the sockets. call before run().
+AOO_API int32_t aoonet_server_set_xdp(aoonet_server *server, const char *ifname,
+                                      int32_t queues);
+
 // LATER add methods to add/remove users and groups
 // and set/get server options, group options and user options
 
@@ -210,7 +362,9 @@ using aoonet_client = aoo::net::iclient;
 typedef struct aoonet_client aoonet_client;
 #endif
 
-// create a new AOO client for the given UDP socket
+// create a new AOO client for the given UDP socket.
+// the server and peers can have IPv6 addresses, so 'fn' should handle both
+// sockaddr_in and sockaddr_in6, ideally with a dual-stack socket.
 AOO_API aoonet_client * aoonet_client_new(void *udpsocket, aoo_sendfn fn, int port);
 
 // destroy AOO client
@@ -229,7 +383,16 @@ AOO_API int32_t aoonet_client_connect(aoonet_client *client, const char *host, i
 // disconnect AOO client from AOO server (always thread safe)
 AOO_API int32_t aoonet_client_disconnect(aoonet_client *client);
 
-// join an AOO group
+// after losing the connection to the server (AOONET_CLIENT_DISCONNECT_EVENT with
+// result 0), keep trying to get it back with randomized exponential backoff and
+// resume the session: a successful AOONET_CLIENT_CONNECT_EVENT with result 2
+// is followed by AOONET_CLIENT_GROUP_JOIN_EVENTs for the groups we are back in,
+// with result 1 the groups have to be joined again. on by default, always
+// thread safe.
+AOO_API int32_t aoonet_client_set_reconnect(aoonet_client *client, int32_t enable);
+
+// join an AOO group. before the connection is up, the join is sent along
+// with the login (see aoo::net::iclient::group_join())
 AOO_API int32_t aoonet_client_group_join(aoonet_client *client, const char *group, const char *pwd);
 
 // join/create an AOO public group
@@ -241,6 +404,24 @@ AOO_API int32_t aoonet_client_group_leave(aoonet_client *client, const char *gro
 // leave an AOO group
 AOO_API int32_t aoonet_client_group_watch_public(aoonet_client *client, bool watch);
 
+// set up a forward route on the server: packets sent with the given route ID
+// (see aoonet_write_forward_header()) go to all the peers in 'addr' (IPv4 sockaddr
+// pointers). calling it again replaces the route, n = 0 removes it. the server must
+// have relaying enabled and only passes packets on to peers in a shared group.
+// (always thread safe)
+AOO_API int32_t aoonet_client_set_forward_route(aoonet_client *client, int32_t route,
+                                                const void * const *addr, int32_t n);
+
+// check if the server has accepted the (current) route (always thread safe).
+// returns 1 if accepted, 0 if still pending and -1 if refused.
+AOO_API int32_t aoonet_client_forward_route_state(aoonet_client *client, int32_t route);
+
+// tell the client that the application has sent data (e.g. an audio stream) to the
+// peer at 'addr' (sockaddr *). the client skips its keepalive pings to that peer
+// as long as it is told so at least once per ping interval. returns the number
+// of matching peers. (always thread safe)
+AOO_API int32_t aoonet_client_peer_traffic(aoonet_client *client, const void *addr);
+
 // handle messages from peers (threadsafe, but not reentrant)
 // 'addr' should be sockaddr *
 AOO_API int32_t aoonet_client_handle_message(aoonet_client *client,
@@ -257,6 +438,10 @@ AOO_API int32_t aoonet_client_events_available(aoonet_client *client);
 AOO_API int32_t aoonet_client_handle_events(aoonet_client *client,
                                             aoo_eventhandler fn, void *user);
 
+// set a function to be notified about pending events (always thread safe)
+AOO_API int32_t aoonet_client_set_event_notify(aoonet_client *client,
+                                               aoo_notifyfn fn, void *user);
+
 // LATER add API functions to set options and do additional peer communication (chat, OSC messages, etc.)
 
 #ifdef __cplusplus
@@ -61,6 +61,61 @@ public:
     // will call the event handler function one or more times
     virtual int32_t handle_events(aoo_eventhandler fn, void *user) = 0;
 
+    // set a function to be notified about pending events (always thread safe)
+    virtual int32_t set_event_notify(aoo_notifyfn fn, void *user) = 0;
+
+    // number of threads handling client connections, call before run().
+    // only supported with epoll/kqueue, otherwise it stays 1.
+    virtual int32_t set_io_threads(int32_t n) = 0;
+
+    // max. number of unsent bytes per client; a client which falls further behind
+    // is disconnected (default: 1 MB). always thread safe.
+    virtual int32_t set_send_queue_limit(int32_t bytes) = 0;
+
+    // get the send statistics (always thread safe)
+    virtual int32_t get_send_stats(aoonet_server_send_stats& stats) const = 0;
+
+    // relay UDP packets between peers which can't connect directly, e.g. because
+    // both are behind a symmetric NAT. only logged in users are relayed, and only
+    // to members of their own groups. 'bandwidth' is the max. number of bytes per
+    // second for each direction of a peer pair (0 = unlimited). always thread safe.
+    virtual int32_t set_relay(bool enable, int32_t bandwidth) = 0;
+
+    // get the relay statistics (always thread safe)
+    virtual int32_t get_relay_stats(aoonet_server_relay_stats& stats) const = 0;
+
+    // get the general server statistics (always thread safe)
+    virtual int32_t get_stats(aoonet_server_stats& stats) const = 0;
+
+    // limit the TCP connections, login attempts and UDP messages (other than relayed
+    // packets) per source IP address and second, with bursts of twice as many.
+    // whatever goes over is dropped before it is parsed, so that a misbehaving
+    // client can't hold up everybody else. 0 = unlimited (default: 5, 5, 100).
+    // always thread safe.
+    virtual int32_t set_rate_limits(int32_t accepts, int32_t logins, int32_t udp) = 0;
+
+    // add another server of a cluster. the servers exchange their group members
+    // over UDP, so that users who join the same group (with the same password)
+    // on different servers see each other as peers. every server should list all
+    // the others, connections between the nodes are not relayed. user names are
+    // only unique per server. always thread safe, but 'host' is resolved in place.
+    virtual int32_t add_node(const char *host, int32_t port) = 0;
+
+    // keep the user sessions (who is in which group) in the file at 'path', written
+    // every 'interval' seconds if something has changed, and when the server quits.
+    // the sessions of an existing file are loaded right away, so that clients which
+    // reconnect after a restart resume theirs in a single round trip, instead of
+    // logging in and joining their groups all over again. call before run().
+    virtual int32_t set_snapshot(const char *path, int32_t interval) = 0;
+
+    // send the relayed and forwarded packets straight from the receive queues of
+    // the network interface 'ifname', past the kernel's UDP stack (AF_XDP). the
+    // rest, like the control messages, still goes through the sockets. 'queues'
+    // is the number of receive queues to serve (<= 0: all). Linux only, needs
+    // CAP_NET_ADMIN and CAP_BPF (or root). returns 0 if it's not available, in
+    // which case (or with an empty 'ifname') it's all the sockets. call before run().
+    virtual int32_t set_xdp(const char *ifname, int32_t queues) = 0;
+
     // LATER add methods to add/remove users and groups
     // and set/get server options, group options and user options
     
@@ -114,15 +169,32 @@ public:
     // disconnect AOO client from AOO server (always thread safe)
     virtual int32_t disconnect() = 0;
 
-    // join an AOO group
+    // reconnect and resume the session when the connection to the server is lost,
+    // see aoonet_client_set_reconnect(). on by default, always thread safe.
+    virtual int32_t set_reconnect(bool enable) = 0;
+
+    // join an AOO group. right after connect() it goes along with the login
+    // and the server answers both at once, together with the group members.
     virtual int32_t group_join(const char *group, const char *pwd, bool is_public=false) = 0;
 
     // leave an AOO group
     virtual int32_t group_leave(const char *group) = 0;
 
-    // register interest in public groups
+    // register interest in public groups (goes along with the login, too)
     virtual int32_t group_watch_public(bool watch) = 0;
 
+    // set up a forward route on the server (always thread safe)
+    // see aoonet_client_set_forward_route()
+    virtual int32_t set_forward_route(int32_t route, const void * const *addr, int32_t n) = 0;
+
+    // check if the server has accepted the route (always thread safe)
+    // returns 1 if accepted, 0 if still pending and -1 if refused.
+    virtual int32_t forward_route_state(int32_t route) const = 0;
+
+    // the application has sent data to the peer at 'addr' (always thread safe)
+    // see aoonet_client_peer_traffic()
+    virtual int32_t peer_traffic(const void *addr) = 0;
+
     // handle messages from peers (threadsafe, but not reentrant)
     // 'addr' should be sockaddr *
     virtual int32_t handle_message(const char *data, int32_t n, void *addr) = 0;
@@ -137,6 +209,9 @@ public:
     // will call the event handler function one or more times
     virtual int32_t handle_events(aoo_eventhandler fn, void *user) = 0;
 
+    // set a function to be notified about pending events (always thread safe)
+    virtual int32_t set_event_notify(aoo_notifyfn fn, void *user) = 0;
+
     // LATER add API functions to set options and do additional peer communication (chat, OSC messages, etc.)
 protected:
     ~iclient(){} // non-virtual!
@@ -24,6 +24,10 @@ typedef struct aoo_format_opus
     int32_t complexity; // 0: default
     int32_t signal_type;
     int32_t application_type; 
+    // bit i set: channels i and i+1 are encoded together as one
+    // coupled stereo stream, 0: every channel is its own mono stream.
+    // Only for sinks with AOO_PROTOCOL_FLAG_OPUS_COUPLED!
+    int32_t coupled;
 } aoo_format_opus;
 
 AOO_API void aoo_codec_opus_setup(aoo_codec_registerfn fn);
@@ -36,7 +36,10 @@ extern "C"
 #define AOO_MSG_DOMAIN "/aoo"
 #define AOO_MSG_DOMAIN_LEN 4
 
-#define AOO_MAXPACKETSIZE 4096 // ?
+// the largest packet we send or receive, e.g. raise it for jumbo frames
+#ifndef AOO_MAXPACKETSIZE
+#define AOO_MAXPACKETSIZE 4096
+#endif
 
 #ifndef AOO_SAMPLETYPE
 #define AOO_SAMPLETYPE float
@@ -72,6 +75,13 @@ typedef int32_t (*aoo_eventhandler)(
         int32_t n           // number of events
 );
 
+// event notification
+// called whenever a new event is pending, possibly on the
+// audio or network thread, so it must not block!
+typedef void (*aoo_notifyfn)(
+        void *              // user
+);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
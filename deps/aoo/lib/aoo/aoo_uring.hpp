@@ -0,0 +1,358 @@
+/* Copyright (c) 2010-Now Christof Ressi, Winfried Ritsch and others.
+ * For information on usage and redistribution, and for a DISCLAIMER OF ALL
+ * WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+// A minimal io_uring ring for UDP sockets on Linux, straight on top of the
+// syscalls (no liburing needed): multishot recvmsg into a ring of provided
+// buffers, and batches of sendmsg submitted with a single syscall.
+//
+// AOO_HAVE_URING is 1 where the kernel headers know everything we use
+// (Linux 6.0). Even then the running kernel may not support it, or a
+// seccomp profile may forbid it (containers), so every user has to fall
+// back to the plain socket calls if init() or setup_buffers() fail.
+// A ring must only be used from one thread.
+
+#pragma once
+
+#if defined(__linux__) && !defined(AOO_NO_URING) && defined(__has_include)
+# if __has_include(<linux/io_uring.h>)
+#  include <linux/io_uring.h>
+# endif
+#endif
+
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_ASYNC_CANCEL_ANY) && defined(IORING_FEAT_EXT_ARG)
+# define AOO_HAVE_URING 1
+#else
+# define AOO_HAVE_URING 0
+#endif
+
+#if AOO_HAVE_URING
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace aoo {
+
+class uring {
+public:
+    uring() = default;
+    ~uring(){ close(); }
+
+    uring(const uring&) = delete;
+    uring& operator=(const uring&) = delete;
+
+    // entries is rounded up to a power of 2 by the kernel. the completion
+    // queue has twice as many, or cqentries; make it hold a completion for
+    // every provided buffer, so that multishot receives don't overflow it
+    bool init(unsigned entries, unsigned cqentries = 0){
+        close();
+
+        struct io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        // we are the only thread submitting, and don't need to be interrupted for completions
+        p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+        if (cqentries > 0){
+            p.flags |= IORING_SETUP_CQSIZE;
+            p.cq_entries = cqentries;
+        }
+        fd_ = (int) syscall(__NR_io_uring_setup, entries, &p);
+        if (fd_ < 0 && errno == EINVAL){
+            // older kernel, without the flags
+            memset(&p, 0, sizeof(p));
+            if (cqentries > 0){
+                p.flags = IORING_SETUP_CQSIZE;
+                p.cq_entries = cqentries;
+            }
+            fd_ = (int) syscall(__NR_io_uring_setup, entries, &p);
+        }
+        if (fd_ < 0){
+            return false;
+        }
+        if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)){
+            close();
+            return false;
+        }
+
+        ringsize_ = std::max<size_t>(p.sq_off.array + p.sq_entries * sizeof(uint32_t),
+                                     p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe));
+        ring_ = mmap(nullptr, ringsize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     fd_, IORING_OFF_SQ_RING);
+        if (ring_ == MAP_FAILED){
+            ring_ = nullptr;
+            close();
+            return false;
+        }
+        sqesize_ = p.sq_entries * sizeof(struct io_uring_sqe);
+        sqes_ = (struct io_uring_sqe *)mmap(nullptr, sqesize_, PROT_READ | PROT_WRITE,
+                                            MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if (sqes_ == MAP_FAILED){
+            sqes_ = nullptr;
+            close();
+            return false;
+        }
+
+        auto base = (char *)ring_;
+        sq_head_ = (unsigned *)(base + p.sq_off.head);
+        sq_tail_ = (unsigned *)(base + p.sq_off.tail);
+        sq_flags_ = (unsigned *)(base + p.sq_off.flags);
+        sq_mask_ = *(unsigned *)(base + p.sq_off.ring_mask);
+        sq_entries_ = p.sq_entries;
+        sq_array_ = (unsigned *)(base + p.sq_off.array);
+        cq_head_ = (unsigned *)(base + p.cq_off.head);
+        cq_tail_ = (unsigned *)(base + p.cq_off.tail);
+        cq_mask_ = *(unsigned *)(base + p.cq_off.ring_mask);
+        cqes_ = (struct io_uring_cqe *)(base + p.cq_off.cqes);
+        sqe_tail_ = *sq_tail_;
+        return true;
+    }
+
+    void close(){
+        // the kernel lets go of the buffers and rings with the fd
+        if (fd_ >= 0){
+            ::close(fd_);
+            fd_ = -1;
+        }
+        if (bufring_){
+            munmap(bufring_, bufringsize_);
+            bufring_ = nullptr;
+        }
+        delete[] buffers_;
+        buffers_ = nullptr;
+        if (sqes_){
+            munmap(sqes_, sqesize_);
+            sqes_ = nullptr;
+        }
+        if (ring_){
+            munmap(ring_, ringsize_);
+            ring_ = nullptr;
+        }
+    }
+
+    bool valid() const { return fd_ >= 0; }
+
+    // becomes readable for poll() when there are completions
+    int fd() const { return fd_; }
+
+    // provided buffers, which the multishot receives pick from.
+    // count must be a power of 2 (max. 32768)
+    bool setup_buffers(uint16_t group, unsigned count, unsigned size){
+        bufringsize_ = count * sizeof(struct io_uring_buf);
+        bufring_ = mmap(nullptr, bufringsize_, PROT_READ | PROT_WRITE,
+                        MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        if (bufring_ == MAP_FAILED){
+            bufring_ = nullptr;
+            return false;
+        }
+
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = (uint64_t)(uintptr_t)bufring_;
+        reg.ring_entries = count;
+        reg.bgid = group;
+        if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0){
+            munmap(bufring_, bufringsize_);
+            bufring_ = nullptr;
+            return false;
+        }
+
+        bufcount_ = count;
+        bufsize_ = size;
+        buffers_ = new char[(size_t)count * size];
+        // the ring tail overlays the reserved field of the first entry
+        buftail_ = &((struct io_uring_buf *)bufring_)[0].resv;
+        for (unsigned i = 0; i < count; ++i){
+            add_buffer(i, i);
+        }
+        __atomic_store_n(buftail_, (uint16_t)count, __ATOMIC_RELEASE);
+        bufadded_ = count;
+        return true;
+    }
+
+    char * buffer(unsigned id) const { return buffers_ + (size_t)id * bufsize_; }
+    unsigned buffer_size() const { return bufsize_; }
+
+    // gives a provided buffer back to the kernel once we are done with it
+    void recycle_buffer(unsigned id){
+        add_buffer(id, bufadded_);
+        bufadded_++;
+        __atomic_store_n(buftail_, (uint16_t)bufadded_, __ATOMIC_RELEASE);
+    }
+
+    // nullptr if the submission queue is full, submit() first
+    struct io_uring_sqe * get_sqe(){
+        auto head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (sqe_tail_ - head >= sq_entries_){
+            return nullptr;
+        }
+        auto index = sqe_tail_ & sq_mask_;
+        auto sqe = &sqes_[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sq_array_[index] = index;
+        sqe_tail_++;
+        return sqe;
+    }
+
+    void prep_recvmsg_multishot(struct io_uring_sqe *sqe, int fd, struct msghdr *msg,
+                                uint16_t group, uint64_t userdata){
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)msg;
+        sqe->len = 1;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = group;
+        sqe->user_data = userdata;
+    }
+
+    void prep_sendmsg(struct io_uring_sqe *sqe, int fd, const struct msghdr *msg, uint64_t userdata){
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)msg;
+        sqe->len = 1;
+        sqe->user_data = userdata;
+    }
+
+    void prep_read(struct io_uring_sqe *sqe, int fd, void *buf, unsigned size, uint64_t userdata){
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)buf;
+        sqe->len = size;
+        sqe->off = (uint64_t)-1; // current position
+        sqe->user_data = userdata;
+    }
+
+    // cancels every pending request, each of them completes with -ECANCELED
+    void prep_cancel_all(struct io_uring_sqe *sqe, uint64_t userdata){
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+        sqe->user_data = userdata;
+    }
+
+    // submits what was prepared and waits for at least waitnr completions, or
+    // until the timeout (ms, < 0 means forever). returns the number submitted,
+    // or -errno (-ETIME on timeout, -EINTR)
+    int submit(unsigned waitnr = 0, int timeoutms = -1){
+        unsigned tosubmit = sqe_tail_ - *sq_tail_;
+        __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+
+        if (tosubmit == 0 && waitnr == 0){
+            return 0;
+        }
+        if (waitnr > 0 && ready() >= waitnr){
+            waitnr = 0;
+            if (tosubmit == 0){
+                return 0;
+            }
+        }
+
+        unsigned flags = waitnr > 0 ? IORING_ENTER_GETEVENTS : 0;
+        struct __kernel_timespec ts;
+        struct io_uring_getevents_arg arg;
+        void *argp = nullptr;
+        size_t argsize = 0;
+        if (waitnr > 0 && timeoutms >= 0){
+            ts.tv_sec = timeoutms / 1000;
+            ts.tv_nsec = (long long)(timeoutms % 1000) * 1000000;
+            memset(&arg, 0, sizeof(arg));
+            arg.sigmask_sz = _NSIG / 8;
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+            flags |= IORING_ENTER_EXT_ARG;
+            argp = &arg;
+            argsize = sizeof(arg);
+        }
+
+        int result = (int) syscall(__NR_io_uring_enter, fd_, tosubmit, waitnr, flags, argp, argsize);
+        return result < 0 ? -errno : result;
+    }
+
+    // number of completions waiting
+    unsigned ready() const {
+        return __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) - *cq_head_;
+    }
+
+    // the next completion, nullptr if there is none. call seen() when done with it
+    struct io_uring_cqe * peek(){
+        auto head = *cq_head_;
+        if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)){
+            // the kernel keeps what didn't fit, until we ask for it
+            if (!(__atomic_load_n(sq_flags_, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW)
+                || syscall(__NR_io_uring_enter, fd_, 0, 0, IORING_ENTER_GETEVENTS, nullptr, 0) < 0
+                || head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)){
+                return nullptr;
+            }
+        }
+        return &cqes_[head & cq_mask_];
+    }
+
+    void seen(){
+        __atomic_store_n(cq_head_, *cq_head_ + 1, __ATOMIC_RELEASE);
+    }
+
+    // the parts of a multishot recvmsg buffer, with the name and control sizes
+    // of the msghdr the receive was armed with. false if it was truncated
+    static bool parse_recvmsg(char *buf, int32_t size, const struct msghdr& msg,
+                              struct sockaddr *& name, socklen_t& namelen,
+                              char *& control, size_t& controllen,
+                              char *& payload, int32_t& payloadlen){
+        auto out = (struct io_uring_recvmsg_out *)buf;
+        auto fixed = (int32_t)(sizeof(*out) + msg.msg_namelen + msg.msg_controllen);
+        if (size < fixed || (out->flags & MSG_TRUNC) || out->namelen > msg.msg_namelen){
+            return false;
+        }
+        name = (struct sockaddr *)(out + 1);
+        namelen = out->namelen;
+        control = (char *)(out + 1) + msg.msg_namelen;
+        controllen = out->controllen;
+        payload = control + msg.msg_controllen;
+        payloadlen = (int32_t)out->payloadlen;
+        return payloadlen <= size - fixed;
+    }
+
+private:
+    void add_buffer(unsigned id, unsigned slot){
+        auto& buf = ((struct io_uring_buf *)bufring_)[slot & (bufcount_ - 1)];
+        buf.addr = (uint64_t)(uintptr_t)buffer(id);
+        buf.len = bufsize_;
+        buf.bid = (uint16_t)id;
+    }
+
+    int fd_ = -1;
+    void *ring_ = nullptr;
+    size_t ringsize_ = 0;
+    struct io_uring_sqe *sqes_ = nullptr;
+    size_t sqesize_ = 0;
+
+    unsigned *sq_head_ = nullptr;
+    unsigned *sq_tail_ = nullptr;
+    unsigned *sq_flags_ = nullptr;
+    unsigned *sq_array_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned sqe_tail_ = 0; // prepared, but not yet submitted ones included
+
+    unsigned *cq_head_ = nullptr;
+    unsigned *cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    struct io_uring_cqe *cqes_ = nullptr;
+
+    void *bufring_ = nullptr;
+    size_t bufringsize_ = 0;
+    uint16_t *buftail_ = nullptr;
+    unsigned bufcount_ = 0;
+    unsigned bufsize_ = 0;
+    unsigned bufadded_ = 0;
+    char *buffers_ = nullptr;
+};
+
+} // aoo
+
+#endif // AOO_HAVE_URING
@@ -17,6 +17,8 @@ public:
 
     int32_t read_available() const { return balance_; }
     int32_t read_bytes(uint8_t *buffer, int32_t size);
+    // like read_bytes(), but leave the data in the buffer
+    int32_t peek_bytes(uint8_t *buffer, int32_t size) const;
 
     int32_t write_available() const { return buffer_.size() - balance_; }
     int32_t write_bytes(const uint8_t *data, int32_t size);
@@ -24,6 +26,9 @@ public:
     int32_t read_packet(uint8_t *buffer, int32_t size);
 
     bool write_packet(const uint8_t *data, int32_t size);
+
+    // append a complete SLIP packet to 'out'
+    static void encode(const uint8_t *data, int32_t size, std::vector<uint8_t>& out);
 private:
     std::vector<uint8_t> buffer_;
     int32_t rdhead_ = 0;
@@ -42,7 +47,7 @@ inline void SLIP::reset(){
     balance_ = 0;
 }
 
-inline int32_t SLIP::read_bytes(uint8_t *buffer, int32_t size){
+inline int32_t SLIP::peek_bytes(uint8_t *buffer, int32_t size) const {
     auto capacity = (int32_t)buffer_.size();
     if (size > balance_){
         size = balance_;
@@ -58,6 +63,12 @@ inline int32_t SLIP::read_bytes(uint8_t *buffer, int32_t size){
     }
     std::copy(&buffer_[rdhead_], &buffer_[rdhead_ + n1], buffer);
     std::copy(&buffer_[0], &buffer_[n2], buffer + n1);
+    return size;
+}
+
+inline int32_t SLIP::read_bytes(uint8_t *buffer, int32_t size){
+    auto capacity = (int32_t)buffer_.size();
+    size = peek_bytes(buffer, size);
     rdhead_ += size;
     if (rdhead_ >= capacity){
         rdhead_ -= capacity;
@@ -213,5 +224,28 @@ inline bool SLIP::write_packet(const uint8_t *data, int32_t size){
     }
 }
 
+inline void SLIP::encode(const uint8_t *data, int32_t size, std::vector<uint8_t>& out){
+    out.reserve(out.size() + size + 2);
+    // begin packet
+    out.push_back(uint8_t(END));
+    // write and escape bytes
+    for (int i = 0; i < size; ++i){
+        auto c = data[i];
+        switch (c){
+        case END:
+            out.push_back(uint8_t(ESC));
+            out.push_back(uint8_t(ESC_END));
+            break;
+        case ESC:
+            out.push_back(uint8_t(ESC));
+            out.push_back(uint8_t(ESC_ESC));
+            break;
+        default:
+            out.push_back(c);
+        }
+    }
+    // end packet
+    out.push_back(uint8_t(END));
+}
 
 } // aoo
@@ -39,6 +39,9 @@
 #define AOONET_MSG_SERVER_GROUP_PUBLIC \
     AOO_MSG_DOMAIN AOONET_MSG_SERVER AOONET_MSG_GROUP AOONET_MSG_PUBLIC
 
+#define AOONET_MSG_SERVER_ROUTE \
+    AOO_MSG_DOMAIN AOONET_MSG_SERVER AOONET_MSG_ROUTE
+
 
 #define AOONET_MSG_GROUP_JOIN \
     AOONET_MSG_GROUP AOONET_MSG_JOIN
@@ -81,36 +84,6 @@ std::string encrypt(const std::string& input){
     return output;
 }
 
-char * copy_string(const char * s){
-    if (s){
-        auto len = strlen(s);
-        auto result = new char[len + 1];
-        memcpy(result, s, len + 1);
-        return result;
-    } else {
-        return nullptr;
-    }
-}
-
-void * copy_sockaddr(const void * sa){
-    if (sa){
-        if (static_cast<const sockaddr *>(sa)->sa_family == AF_INET){
-            auto result = new char[sizeof(sockaddr_in)];
-            memcpy(result, sa, sizeof(sockaddr_in));
-            return result;
-        } else {
-            // LATER IPv6
-            return nullptr;
-        }
-    } else {
-        return nullptr;
-    }
-}
-
-void free_sockaddr(const void * sa){
-    delete static_cast<const sockaddr *>(sa);
-}
-
 } // net
 } // aoo
 
@@ -148,6 +121,82 @@ int32_t aoonet_parse_pattern(const char *msg, int32_t n, int32_t *type)
     }
 }
 
+// "/aoo/relay" + typetags ",iib", both padded to 4 bytes
+static const char relay_prefix[20] = {
+    '/', 'a', 'o', 'o', '/', 'r', 'e', 'l', 'a', 'y', 0, 0,
+    ',', 'i', 'i', 'b', 0, 0, 0, 0
+};
+
+int32_t aoonet_write_relay_header(char *buf, const void *addr, int32_t size)
+{
+    auto sa = static_cast<const struct sockaddr_in *>(addr);
+    if (!sa || sa->sin_family != AF_INET || (size & 3)){
+        return 0;
+    }
+    memcpy(buf, relay_prefix, sizeof(relay_prefix));
+    // sin_addr and sin_port are already big endian
+    memcpy(buf + 20, &sa->sin_addr, 4);
+    aoo::to_bytes<int32_t>(ntohs(sa->sin_port), buf + 24);
+    aoo::to_bytes<int32_t>(size, buf + 28);
+    return AOONET_RELAY_HEADER_SIZE;
+}
+
+int32_t aoonet_parse_relay(const char *msg, int32_t n, void *addr, int32_t *size)
+{
+    if (n < AOONET_RELAY_HEADER_SIZE
+        || memcmp(msg, relay_prefix, sizeof(relay_prefix)))
+    {
+        return 0;
+    }
+    auto port = aoo::from_bytes<int32_t>(msg + 24);
+    auto datasize = aoo::from_bytes<int32_t>(msg + 28);
+    if (port <= 0 || port > 65535 || datasize <= 0
+        || datasize > (n - AOONET_RELAY_HEADER_SIZE))
+    {
+        return 0;
+    }
+    auto sa = static_cast<struct sockaddr_in *>(addr);
+    memset(sa, 0, sizeof(*sa));
+    sa->sin_family = AF_INET;
+    memcpy(&sa->sin_addr, msg + 20, 4);
+    sa->sin_port = htons((uint16_t)port);
+    *size = datasize;
+    return AOONET_RELAY_HEADER_SIZE;
+}
+
+// "/aoo/forward" + typetags ",ib", both padded to 4 bytes
+static const char forward_prefix[20] = {
+    '/', 'a', 'o', 'o', '/', 'f', 'o', 'r', 'w', 'a', 'r', 'd',
+    0, 0, 0, 0, ',', 'i', 'b', 0
+};
+
+int32_t aoonet_write_forward_header(char *buf, int32_t route, int32_t size)
+{
+    if (size <= 0 || (size & 3)){
+        return 0;
+    }
+    memcpy(buf, forward_prefix, sizeof(forward_prefix));
+    aoo::to_bytes<int32_t>(route, buf + 20);
+    aoo::to_bytes<int32_t>(size, buf + 24);
+    return AOONET_FORWARD_HEADER_SIZE;
+}
+
+int32_t aoonet_parse_forward(const char *msg, int32_t n, int32_t *route, int32_t *size)
+{
+    if (n < AOONET_FORWARD_HEADER_SIZE
+        || memcmp(msg, forward_prefix, sizeof(forward_prefix)))
+    {
+        return 0;
+    }
+    auto datasize = aoo::from_bytes<int32_t>(msg + 24);
+    if (datasize <= 0 || datasize > (n - AOONET_FORWARD_HEADER_SIZE)){
+        return 0;
+    }
+    *route = aoo::from_bytes<int32_t>(msg + 20);
+    *size = datasize;
+    return AOONET_FORWARD_HEADER_SIZE;
+}
+
 /*//////////////////// AoO client /////////////////////*/
 
 aoonet_client * aoonet_client_new(void *udpsocket, aoo_sendfn fn, int port) {
@@ -175,6 +224,8 @@ aoo::net::client::client(void *udpsocket, aoo_sendfn fn, int port)
     std::default_random_engine reng(randdev());
     std::uniform_int_distribution<int64_t> uniform_dist(1); // minimum of 1, max of maxint
     token_ = uniform_dist(reng);
+
+    reconnect_rng_.seed(randdev());
 }
 
 void aoonet_client_free(aoonet_client *client){
@@ -229,8 +280,10 @@ int32_t aoo::net::client::run(){
             } else {
                 timeout = ping_interval - delta;
             }
+        } else if (state_.load() == client_state::reconnecting){
+            timeout = update_reconnect(elapsed_time);
         } else {
-            timeout = -1;
+            timeout = update_connect(elapsed_time);
         }
 
         wait_for_event(timeout);
@@ -265,7 +318,10 @@ int32_t aoo::net::client::connect(const char *host, int port,
                              const char *username, const char *pwd)
 {
     auto state = state_.load();
-    if (state != client_state::disconnected){
+    if (state == client_state::reconnecting || reconnecting_.load()){
+        // give up on the old connection and start over
+        push_command(std::make_unique<disconnect_cmd>(command_reason::none));
+    } else if (state != client_state::disconnected){
         if (state == client_state::connected){
             LOG_ERROR("aoo_client: already connected!");
         } else {
@@ -274,12 +330,9 @@ int32_t aoo::net::client::connect(const char *host, int port,
         return 0;
     }
 
-    username_ = username;
-    password_ = encrypt(pwd);
-
     state_ = client_state::connecting;
 
-    push_command(std::make_unique<connect_cmd>(host, port));
+    push_command(std::make_unique<connect_cmd>(host, port, username, encrypt(pwd)));
 
     signal();
 
@@ -292,7 +345,8 @@ int32_t aoonet_client_disconnect(aoonet_client *client){
 
 int32_t aoo::net::client::disconnect(){
     auto state = state_.load();
-    if (state != client_state::connected){
+    if (state != client_state::connected && state != client_state::reconnecting
+            && !reconnecting_.load()){
         LOG_WARNING("aoo_client: not connected");
         return 0;
     }
@@ -304,6 +358,15 @@ int32_t aoo::net::client::disconnect(){
     return 1;
 }
 
+int32_t aoonet_client_set_reconnect(aoonet_client *client, int32_t enable){
+    return client->set_reconnect(enable != 0);
+}
+
+int32_t aoo::net::client::set_reconnect(bool enable){
+    reconnect_.store(enable);
+    return 1;
+}
+
 int32_t aoonet_client_group_join(aoonet_client *client, const char *group, const char *pwd){
     return client->group_join(group, pwd);
 }
@@ -344,6 +407,74 @@ int32_t aoo::net::client::group_watch_public(bool watch) {
     return 1;
 }
 
+int32_t aoonet_client_set_forward_route(aoonet_client *client, int32_t route,
+                                        const void * const *addr, int32_t n){
+    return client->set_forward_route(route, addr, n);
+}
+
+int32_t aoo::net::client::set_forward_route(int32_t route, const void * const *addr, int32_t n){
+    std::vector<ip_address> addrs;
+    for (int i = 0; i < n; ++i){
+        // NOTE: only IPv4 peers can be forwarded to, see do_set_forward_route()
+        auto sa = static_cast<const struct sockaddr *>(addr[i]);
+        if (sa && sa->sa_family == AF_INET){
+            addrs.emplace_back(sa, sizeof(struct sockaddr_in));
+        }
+    }
+
+    int32_t serial;
+    {
+        scoped_lock<spinlock> lock(route_lock_);
+        serial = ++forward_route_serial_;
+        if (!addrs.empty()){
+            forward_routes_[route] = forward_route { serial, 0 };
+        } else {
+            forward_routes_.erase(route);
+        }
+    }
+
+    push_command(std::make_unique<forward_route_cmd>(route, serial, std::move(addrs)));
+
+    signal();
+
+    return 1;
+}
+
+int32_t aoonet_client_forward_route_state(aoonet_client *client, int32_t route){
+    return client->forward_route_state(route);
+}
+
+int32_t aoo::net::client::forward_route_state(int32_t route) const {
+    scoped_lock<spinlock> lock(route_lock_);
+    auto it = forward_routes_.find(route);
+    return it != forward_routes_.end() ? it->second.state : -1;
+}
+
+int32_t aoonet_client_peer_traffic(aoonet_client *client, const void *addr){
+    return client->peer_traffic(addr);
+}
+
+int32_t aoo::net::client::peer_traffic(const void *addr){
+    auto family = static_cast<const struct sockaddr *>(addr)->sa_family;
+    if (family != AF_INET && family != AF_INET6){
+        return 0;
+    }
+    ip_address address((const struct sockaddr *)addr, family == AF_INET6 ?
+                           sizeof(sockaddr_in6) : sizeof(sockaddr_in));
+    auto now = time_tag::now();
+    int32_t count = 0;
+
+    shared_lock lock(peerlock_);
+    for (auto& p : peers_){
+        // relayed traffic doesn't keep the peer's NAT binding alive
+        if (p->has_real_address() && !p->relayed() && p->address() == address){
+            p->note_traffic(now);
+            count++;
+        }
+    }
+    return count;
+}
+
 int32_t aoonet_client_handle_message(aoonet_client *client, const char *data,
                                      int32_t n, void *addr)
 {
@@ -351,10 +482,29 @@ int32_t aoonet_client_handle_message(aoonet_client *client, const char *data,
 }
 
 int32_t aoo::net::client::handle_message(const char *data, int32_t n, void *addr){
-    if (static_cast<struct sockaddr *>(addr)->sa_family != AF_INET){
+    auto family = static_cast<struct sockaddr *>(addr)->sa_family;
+    if (family != AF_INET && family != AF_INET6){
         return 0;
     }
     try {
+        ip_address address((struct sockaddr *)addr, family == AF_INET6 ?
+                               sizeof(sockaddr_in6) : sizeof(sockaddr_in));
+
+        // unwrap peer messages relayed by the server, they look
+        // as if they came from the sending peer directly.
+        bool relayed = false;
+        if (address == remote_addr_){
+            struct sockaddr_in sa;
+            int32_t size = 0;
+            auto offset = aoonet_parse_relay(data, n, &sa, &size);
+            if (offset > 0){
+                data += offset;
+                n = size;
+                address = ip_address((struct sockaddr *)&sa, sizeof(sa));
+                relayed = true;
+            }
+        }
+
         osc::ReceivedPacket packet(data, n);
         osc::ReceivedMessage msg(packet);
 
@@ -365,12 +515,10 @@ int32_t aoo::net::client::handle_message(const char *data, int32_t n, void *addr
             return 0;
         }
 
-        ip_address address((struct sockaddr *)addr, sizeof(sockaddr_in)); // FIXME
-
         LOG_DEBUG("aoo_client: handle UDP message " << msg.AddressPattern()
             << " from " << address.name() << ":" << address.port());
 
-        if (address == remote_addr_){
+        if (!relayed && address == remote_addr_){
             // server message
             if (type != AOO_TYPE_CLIENT){
                 LOG_WARNING("aoo_client: not a server message!");
@@ -401,7 +549,7 @@ int32_t aoo::net::client::handle_message(const char *data, int32_t n, void *addr
                         
                 for (auto& p : peers_){
                     if (p->match(address)){
-                        p->handle_message(msg, onset, address);
+                        p->handle_message(msg, onset, address, relayed);
                         success = true;
                     } else if (!p->has_real_address() && token > 0 && p->match_token(token)) {
                         // this message doesn't match one of the addresses given by the server for this peer
@@ -412,8 +560,8 @@ int32_t aoo::net::client::handle_message(const char *data, int32_t n, void *addr
                                     << p->address().name() << ":" << p->address().port() << " TO "
                                     << address.name() << ":" << address.port());
 
-                        p->set_public_address(address);
-                        p->handle_message(msg, onset, address);
+                        p->add_reflexive_candidate(address);
+                        p->handle_message(msg, onset, address, relayed);
                         success = true;
                     }
                 }
@@ -506,24 +654,29 @@ int32_t aoonet_client_handle_events(aoonet_client *client, aoo_eventhandler fn,
     return client->handle_events(fn, user);
 }
 
+int32_t aoonet_client_set_event_notify(aoonet_client *client, aoo_notifyfn fn, void *user){
+    return client->set_event_notify(fn, user);
+}
+
+int32_t aoo::net::client::set_event_notify(aoo_notifyfn fn, void *user){
+    eventnotifier_.set(fn, user);
+    return 1;
+}
+
 int32_t aoo::net::client::handle_events(aoo_eventhandler fn, void *user){
     // always thread-safe
     auto n = events_.read_available();
     if (n > 0){
-        // copy events
-        auto events = (ievent **)alloca(sizeof(ievent *) * n);
-        auto vec = (const aoo_event **)alloca(sizeof(aoo_event *) * n); // adjusted pointers
+        // the events stay in their slots until they have been handled
+        auto vec = (const aoo_event **)alloca(sizeof(aoo_event *) * n);
         for (int i = 0; i < n; ++i){
-            std::unique_ptr<ievent> ptr;
-            events_.read(ptr);
-            events[i] = ptr.release(); // get raw pointer
-            vec[i] = &events[i]->event_; // adjust pointer
+            vec[i] = &events_.read_data(i)->event_;
         }
         // send events
         fn(user, vec, n);
-        // manually free events
+        // release the slots
         for (int i = 0; i < n; ++i){
-            delete events[i];
+            events_.read_commit();
         }
     }
     return n;
@@ -532,32 +685,319 @@ int32_t aoo::net::client::handle_events(aoo_eventhandler fn, void *user){
 namespace aoo {
 namespace net {
 
-void client::do_connect(const std::string &host, int port)
+// Connecting doesn't block the client thread: the host name is resolved
+// on a helper thread, then we start a non-blocking TCP connection to every
+// address at once and take the first one that succeeds. A cluster can
+// publish all of its servers under a single host name, so this also picks
+// the nearest server. Like "Happy Eyeballs" (RFC 8305), we give IPv6 a
+// short head start: if an IPv4 address connects first, we still wait a bit
+// for IPv6, which usually means a direct path instead of a carrier NAT.
+// See also update_connect().
+#define AOONET_IPV6_HEAD_START 0.05
+
+void client::do_connect(const std::string &host, int port,
+                        const std::string& username, const std::string& pwd)
 {
-    if (tcpsocket_ >= 0){
+    if (tcpsocket_ >= 0 || resolving_ || !connecting_.empty()){
         LOG_ERROR("aoo_client: bug client::do_connect()");
         return;
     }
 
-    int err = try_connect(host, port);
+    // a new session
+    username_ = username;
+    password_ = pwd;
+    connect_host_ = host;
+    connect_port_ = port;
+    session_token_ = 0;
+    reconnecting_ = false;
+    reconnect_attempts_ = 0;
+    reconnect_denied_ = 0;
+    pending_joins_.clear();
+    pending_watch_ = -1;
+
+    state_ = client_state::connecting;
+
+    resolve_server();
+}
+
+void client::resolve_server(){
+    auto& host = connect_host_;
+    auto port = connect_port_;
+
+    connect_start_time_ = time_tag::duration(start_time_, time_tag::now());
+    connect_ipv4_time_ = 0;
+    connect_error_ = 0;
+
+    // the request outlives the client if the resolver is still busy
+    auto request = std::make_shared<resolve_request>();
+    request->owner = this;
+    resolving_ = request;
+
+    LOG_VERBOSE("aoo_client: resolving " << host);
+
+    std::thread([request, host, port](){
+        std::vector<ip_address> addrs;
+        int err = resolve_host(host, port, addrs);
+
+        std::lock_guard<std::mutex> lock(request->mutex);
+        request->addrs = std::move(addrs);
+        request->error = err;
+        request->done = true;
+        if (request->owner){
+            request->owner->signal();
+        }
+    }).detach();
+}
+
+void client::start_connect(const std::vector<ip_address>& addrs){
+    for (auto& addr : addrs){
+        int sock = socket(addr.family(), SOCK_STREAM, 0);
+        if (sock < 0){
+            connect_error_ = socket_errno();
+            LOG_WARNING("aoo_client: couldn't create socket (" << connect_error_ << ")");
+            continue;
+        }
+    #ifdef _WIN32
+        // WSAEventSelect also makes the socket non-blocking
+        WSAEventSelect(sock, sockevent_, FD_CONNECT);
+    #else
+        socket_set_nonblocking(sock, 1);
+    #endif
+        if (::connect(sock, (const struct sockaddr *)&addr.address, addr.length) < 0){
+            int err = socket_errno();
+        #ifdef _WIN32
+            if (err != WSAEWOULDBLOCK)
+        #else
+            if (err != EINPROGRESS)
+        #endif
+            {
+                LOG_VERBOSE("aoo_client: couldn't connect to " << addr.name()
+                            << " (" << err << ")");
+                connect_error_ = err;
+                socket_close(sock);
+                continue;
+            }
+        }
+        LOG_VERBOSE("aoo_client: connecting to " << addr.name() << " on port " << addr.port());
+        connecting_.push_back(connect_attempt { sock, addr, false });
+    }
+}
+
+// check the connection attempts and finish the connection if one has succeeded.
+// returns the time until we need to check again (-1: wait for an event).
+double client::update_connect(double elapsed_time){
+    if (state_.load() != client_state::connecting
+            || (!resolving_ && connecting_.empty())){
+        return -1; // not connecting or connect command still pending
+    }
+
+    // LATER make timeout configurable
+    auto remaining = AOO_NET_CLIENT_CONNECT_TIMEOUT * 0.001 - (elapsed_time - connect_start_time_);
+    if (remaining <= 0){
+    #ifdef _WIN32
+        connect_failed(connect_error_ ? connect_error_ : WSAETIMEDOUT);
+    #else
+        connect_failed(connect_error_ ? connect_error_ : ETIMEDOUT);
+    #endif
+        return -1;
+    }
+
+    if (resolving_){
+        std::vector<ip_address> addrs;
+        int err;
+        {
+            std::lock_guard<std::mutex> lock(resolving_->mutex);
+            if (!resolving_->done){
+                return remaining;
+            }
+            addrs = std::move(resolving_->addrs);
+            err = resolving_->error;
+        }
+        resolving_ = nullptr;
+
+        if (err != 0 || addrs.empty()){
+            LOG_ERROR("aoo_client: couldn't resolve host name (" << err << ")");
+        #ifdef _WIN32
+            connect_failed(WSAHOST_NOT_FOUND);
+        #else
+            connect_failed(EHOSTUNREACH);
+        #endif
+            return -1;
+        }
+
+        start_connect(addrs);
+    }
+
+    // poll the pending connections
+    for (auto it = connecting_.begin(); it != connecting_.end(); ){
+        if (!it->connected){
+        #ifdef _WIN32
+            fd_set wrset, exset;
+            FD_ZERO(&wrset);
+            FD_ZERO(&exset);
+            FD_SET(it->socket, &wrset); // connected when writable
+            FD_SET(it->socket, &exset); // connection failed
+            struct timeval tv = { 0, 0 };
+            bool ready = select(0, nullptr, &wrset, &exset, &tv) > 0;
+        #else
+            struct pollfd fd;
+            fd.fd = it->socket;
+            fd.events = POLLOUT; // connected when writable
+            fd.revents = 0;
+            bool ready = poll(&fd, 1, 0) > 0;
+        #endif
+            if (ready){
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(it->socket, SOL_SOCKET, SO_ERROR, (char *)&err, &len);
+                if (err != 0){
+                    LOG_VERBOSE("aoo_client: couldn't connect to " << it->address.name()
+                                << " (" << err << ")");
+                    connect_error_ = err;
+                    socket_close(it->socket);
+                    it = connecting_.erase(it);
+                    continue;
+                }
+                it->connected = true;
+                if (it->address.family() != AF_INET6 && connect_ipv4_time_ == 0){
+                    connect_ipv4_time_ = elapsed_time;
+                }
+            }
+        }
+        ++it;
+    }
+
+    if (connecting_.empty()){
+        connect_failed(connect_error_);
+        return -1;
+    }
+
+    // take the first connected IPv6 address, otherwise the first IPv4 address
+    // once the head start is over or no IPv6 address is pending anymore.
+    connect_attempt *winner = nullptr;
+    bool ipv6_pending = false;
+    for (auto& c : connecting_){
+        if (c.address.family() == AF_INET6){
+            if (c.connected){
+                winner = &c;
+                break;
+            } else {
+                ipv6_pending = true;
+            }
+        } else if (c.connected && !winner){
+            winner = &c;
+        }
+    }
+    if (winner && winner->address.family() != AF_INET6 && ipv6_pending){
+        auto wait = connect_ipv4_time_ + AOONET_IPV6_HEAD_START - elapsed_time;
+        if (wait > 0){
+            return std::min<double>(wait, remaining);
+        }
+    }
+    if (!winner){
+        return remaining;
+    }
+
+    int sock = winner->socket;
+    ip_address addr = winner->address;
+    for (auto& c : connecting_){
+        if (c.socket != sock){
+            socket_close(c.socket);
+        }
+    }
+    connecting_.clear();
+
+    int err = finish_connect(sock, addr);
     if (err != 0){
-        // event
-        std::string errmsg = socket_strerror(err);
+        connect_failed(err);
+        return -1;
+    }
+
+    first_udp_ping_time_ = 0;
+    state_ = client_state::handshake;
 
-        auto e = std::make_unique<event>(
-            AOONET_CLIENT_CONNECT_EVENT, 0, errmsg.c_str());
-        push_event(std::move(e));
+    return -1;
+}
 
+int client::finish_connect(int sock, const ip_address& addr){
+    remote_addr_ = addr;
+    tcpsocket_ = sock;
+
+    // set TCP_NODELAY
+    int val = 1;
+    if (setsockopt(tcpsocket_, IPPROTO_TCP, TCP_NODELAY, (char *)&val, sizeof(val)) < 0){
+        LOG_WARNING("aoo_client: couldn't set TCP_NODELAY");
+        // ignore
+    }
+
+    // get local network interface
+    ip_address tmp;
+    if (getsockname(tcpsocket_,
+                    (struct sockaddr *)&tmp.address, &tmp.length) < 0) {
+        int err = socket_errno();
+        LOG_ERROR("aoo_client: couldn't get socket name (" << err << ")");
+        return err;
+    }
+    local_addr_ = ip_address(tmp.name(), udpport_);
+
+    // the other interfaces are extra candidates for our peers
+    local_interfaces_.clear();
+    for (auto& ip : local_interface_addresses()){
+        if (ip != local_addr_.name()){
+            if (!local_interfaces_.empty()){
+                local_interfaces_ += " ";
+            }
+            local_interfaces_ += ip;
+        }
+    }
+
+#ifdef _WIN32
+    // register event with socket (replaces FD_CONNECT)
+    WSAEventSelect(tcpsocket_, sockevent_, FD_READ | FD_WRITE | FD_CLOSE);
+#endif
+    // the socket is already non-blocking, see start_connect()
+
+    LOG_VERBOSE("aoo_client: successfully connected to "
+                << remote_addr_.name() << " on port " << remote_addr_.port());
+    LOG_VERBOSE("aoo_client: local address: " << local_addr_.name());
+
+    return 0;
+}
+
+void client::connect_failed(int err){
+    if (reconnecting_.load()){
+        LOG_VERBOSE("aoo_client: couldn't reconnect (" << err << ")");
         do_disconnect();
+        schedule_reconnect();
         return;
     }
 
-    first_udp_ping_time_ = 0;
-    state_ = client_state::handshake;
+    std::string errmsg = socket_strerror(err);
+
+    push_event(AOONET_CLIENT_CONNECT_EVENT, 0, errmsg.c_str());
 
+    do_disconnect();
+}
+
+void client::cancel_connect(){
+    if (resolving_){
+        // let the resolver finish on its own
+        std::lock_guard<std::mutex> lock(resolving_->mutex);
+        resolving_->owner = nullptr;
+    }
+    resolving_ = nullptr;
+
+    for (auto& c : connecting_){
+        socket_close(c.socket);
+    }
+    connecting_.clear();
 }
 
 void client::do_disconnect(command_reason reason, int error){
+    bool was_connected = state_.load() == client_state::connected;
+
+    cancel_connect();
+
     if (tcpsocket_ >= 0){
     #ifdef _WIN32
         // unregister event from socket.
@@ -568,18 +1008,35 @@ void client::do_disconnect(command_reason reason, int error){
         tcpsocket_ = -1;
         LOG_VERBOSE("aoo_client: disconnected");
     }
+    // a new connection starts with OSC + SLIP
+    binary_ = false;
+    login_sent_ = false;
+    sendbuffer_.reset();
+    recvbuffer_.reset();
+    pending_send_data_.clear();
 
     {
         unique_lock lock(peerlock_);
         peers_.clear();
     }
 
+    {
+        // the routes are gone with the connection
+        scoped_lock<spinlock> lock(route_lock_);
+        forward_routes_.clear();
+    }
+
     // event
     if (reason != command_reason::none){
         if (reason == command_reason::user){
-            auto e = std::make_unique<event>(
-                AOONET_CLIENT_DISCONNECT_EVENT, 1);
-            push_event(std::move(e));
+            reconnecting_ = false;
+            pending_joins_.clear();
+            pending_watch_ = -1;
+            push_event(AOONET_CLIENT_DISCONNECT_EVENT, 1);
+        } else if (reconnecting_.load()){
+            // one of our attempts failed, that's not news
+            schedule_reconnect();
+            return;
         } else {
             std::string errmsg;
             if (reason == command_reason::timeout) {
@@ -591,81 +1048,52 @@ void client::do_disconnect(command_reason reason, int error){
                     errmsg = socket_strerror(error);
                 }
             }
-            auto e = std::make_unique<event>(
-                AOONET_CLIENT_DISCONNECT_EVENT, 0, errmsg.c_str());
-            push_event(std::move(e));
+            push_event(AOONET_CLIENT_DISCONNECT_EVENT, 0, errmsg.c_str());
+
+            if (was_connected && reconnect_.load()){
+                schedule_reconnect();
+                return;
+            }
         }
     }
 
     state_ = client_state::disconnected;
 }
 
-int client::try_connect(const std::string &host, int port){
-    tcpsocket_ = socket(AF_INET, SOCK_STREAM, 0);
-    if (tcpsocket_ < 0){
-        int err = socket_errno();
-        LOG_ERROR("aoo_client: couldn't create socket (" << err << ")");
-        return err;
+void client::schedule_reconnect(){
+    if (!reconnect_.load()){
+        reconnecting_ = false;
+        state_ = client_state::disconnected;
+        return;
     }
-    // resolve host name
-    struct hostent *he = gethostbyname(host.c_str());
-    if (!he){
-        int err = socket_errno();
-        LOG_ERROR("aoo_client: couldn't connect (" << err << ")");
-        return err;
+    // "full jitter": anywhere within the interval, which spreads the
+    // clients of a restarted server much better than a fixed backoff
+    auto interval = std::min<double>(AOO_NET_CLIENT_RECONNECT_MAX_INTERVAL,
+        AOO_NET_CLIENT_RECONNECT_INTERVAL * (double)(1 << reconnect_attempts_)) * 0.001;
+    std::uniform_real_distribution<double> dist(0.0, interval);
+    auto delay = std::max<double>(0.1, dist(reconnect_rng_));
+    if (reconnect_attempts_ < 16){
+        reconnect_attempts_++;
     }
 
-    // copy IP address
-    struct sockaddr_in sa;
-    memset(&sa, 0, sizeof(sa));
-    sa.sin_family = AF_INET;
-    sa.sin_port = htons(port);
-    memcpy(&sa.sin_addr, he->h_addr_list[0], he->h_length);
+    reconnect_time_ = time_tag::duration(start_time_, time_tag::now()) + delay;
+    reconnecting_ = true;
+    state_ = client_state::reconnecting;
 
-    remote_addr_ = ip_address((struct sockaddr *)&sa, sizeof(sa));
-
-    // set TCP_NODELAY
-    int val = 1;
-    if (setsockopt(tcpsocket_, IPPROTO_TCP, TCP_NODELAY, (char *)&val, sizeof(val)) < 0){
-        LOG_WARNING("aoo_client: couldn't set TCP_NODELAY");
-        // ignore
-    }
-
-    // try to connect (LATER make timeout configurable)
-    if (socket_connect(tcpsocket_, remote_addr_, 5) < 0){
-        int err = socket_errno();
-        LOG_ERROR("aoo_client: couldn't connect (" << err << ")");
-        return err;
-    }
+    LOG_VERBOSE("aoo_client: reconnecting in " << delay << " seconds");
+}
 
-    // get local network interface
-    ip_address tmp;
-    if (getsockname(tcpsocket_,
-                    (struct sockaddr *)&tmp.address, &tmp.length) < 0) {
-        int err = socket_errno();
-        LOG_ERROR("aoo_client: couldn't get socket name (" << err << ")");
-        return err;
+double client::update_reconnect(double elapsed_time){
+    auto remaining = reconnect_time_ - elapsed_time;
+    if (remaining > 0){
+        return remaining;
     }
-    local_addr_ = ip_address(tmp.name(), udpport_);
-
-#ifdef _WIN32
-    // register event with socket
-    WSAEventSelect(tcpsocket_, sockevent_, FD_READ | FD_WRITE | FD_CLOSE);
-#else
-    // set non-blocking
-    // (this is not necessary on Windows, since WSAEventSelect will do it automatically)
-    val = 1;
-    if (ioctl(tcpsocket_, FIONBIO, (char *)&val) < 0){
-        int err = socket_errno();
-        LOG_ERROR("aoo_client: couldn't set socket to non-blocking (" << err << ")");
-        return err;
+    // unless connect() or disconnect() came in between
+    auto expected = client_state::reconnecting;
+    if (state_.compare_exchange_strong(expected, client_state::connecting)){
+        LOG_VERBOSE("aoo_client: reconnecting to " << connect_host_);
+        resolve_server();
     }
-#endif
-
-    LOG_VERBOSE("aoo_client: successfully connected to "
-                << remote_addr_.name() << " on port " << remote_addr_.port());
-    LOG_VERBOSE("aoo_client: local address: " << local_addr_.name());
-
     return 0;
 }
 
@@ -676,13 +1104,48 @@ void client::do_login(){
         << username_.c_str() << password_.c_str()
         << public_addr_.name().c_str() << public_addr_.port()
         << local_addr_.name().c_str() << local_addr_.port()
-        << token_
-        << osc::EndMessage;
+        << token_ << local_interfaces_.c_str()
+        << (int32_t)AOONET_CONTROL_VERSION
+        << session_token_; // resume the session, if any
+    // what was asked for in the meantime comes along, so the server can answer
+    // all of it at once instead of one round trip after the other
+    if (!pending_joins_.empty() || pending_watch_ >= 0){
+        msg << pending_watch_;
+        for (auto& join : pending_joins_){
+            msg << join.group.c_str() << join.password.c_str() << join.is_public;
+        }
+    }
+    msg << osc::EndMessage;
 
     send_server_message_tcp(msg.Data(), (int32_t) msg.Size());
+
+    login_sent_ = true;
+}
+
+void client::finish_pending(bool handled){
+    auto joins = std::move(pending_joins_);
+    auto watch = pending_watch_;
+    pending_joins_.clear();
+    pending_watch_ = -1;
+
+    if (!handled){
+        // an older server: the usual way, the replies come in one after the other
+        if (watch >= 0){
+            do_group_watch_public(watch != 0);
+        }
+        for (auto& join : joins){
+            do_group_join(join.group, join.password, join.is_public);
+        }
+    }
 }
 
 void client::do_group_join(const std::string &group, const std::string &pwd, bool is_public){
+    auto state = state_.load();
+    if (state != client_state::connected && state != client_state::disconnected && !login_sent_){
+        pending_joins_.push_back({ group, pwd, is_public });
+        return;
+    }
+
     char buf[AOO_MAXPACKETSIZE];
     osc::OutboundPacketStream msg(buf, sizeof(buf));
     msg << osc::BeginMessage(AOONET_MSG_SERVER_GROUP_JOIN)
@@ -701,6 +1164,12 @@ void client::do_group_leave(const std::string &group){
 }
 
 void client::do_group_watch_public(bool watch){
+    auto state = state_.load();
+    if (state != client_state::connected && state != client_state::disconnected && !login_sent_){
+        pending_watch_ = watch;
+        return;
+    }
+
     char buf[AOO_MAXPACKETSIZE];
     osc::OutboundPacketStream msg(buf, sizeof(buf));
     msg << osc::BeginMessage(AOONET_MSG_SERVER_GROUP_PUBLIC)
@@ -709,16 +1178,93 @@ void client::do_group_watch_public(bool watch){
     send_server_message_tcp(msg.Data(), (int32_t) msg.Size());
 }
 
+void client::do_set_forward_route(int32_t route, int32_t serial,
+                                  const std::vector<ip_address>& addrs){
+    // the peer addresses are packed into a blob: 4 bytes IPv4 + 4 bytes port
+    std::vector<char> blob(addrs.size() * 8);
+    for (size_t i = 0; i < addrs.size(); ++i){
+        auto sa = (const struct sockaddr_in *)&addrs[i].address;
+        memcpy(&blob[i * 8], &sa->sin_addr, 4);
+        aoo::to_bytes<int32_t>(ntohs(sa->sin_port), &blob[i * 8 + 4]);
+    }
+
+    char buf[AOO_MAXPACKETSIZE];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+    msg << osc::BeginMessage(AOONET_MSG_SERVER_ROUTE) << route << serial
+        << osc::Blob(blob.data(), (osc::osc_bundle_element_size_t)blob.size())
+        << osc::EndMessage;
+
+    send_server_message_tcp(msg.Data(), (int32_t) msg.Size());
+}
+
 void client::send_message_udp(const char *data, int32_t size, const ip_address& addr)
 {
     sendfn_(udpsocket_, data, size, (void *)&addr.address);
 }
 
-void client::push_event(std::unique_ptr<ievent> e)
+void client::send_message_relay(const char *data, int32_t size, const ip_address& addr)
+{
+    char buf[AOO_MAXPACKETSIZE];
+    if (size > (int32_t)sizeof(buf) - AOONET_RELAY_HEADER_SIZE){
+        LOG_ERROR("aoo_client: message too large for relay");
+        return;
+    }
+    if (aoonet_write_relay_header(buf, &addr.address, size)){
+        memcpy(buf + AOONET_RELAY_HEADER_SIZE, data, size);
+        sendfn_(udpsocket_, buf, size + AOONET_RELAY_HEADER_SIZE,
+                (void *)&remote_addr_.address);
+    }
+}
+
+// the events are written in place, see pack_event_string()
+void client::push_event(int32_t type, int32_t result, const char *errmsg)
+{
+    scoped_lock<spinlock> lock(event_lock_);
+    if (events_.write_available()){
+        auto e = events_.write_data();
+        int32_t pos = 0;
+        e->client_event_.type = type;
+        e->client_event_.result = result;
+        e->client_event_.errormsg = pack_event_string(e->strings_, pos, errmsg);
+        events_.write_commit();
+        eventnotifier_.notify();
+    }
+}
+
+void client::push_group_event(int32_t type, const char *name,
+                              int32_t result, const char *errmsg)
+{
+    scoped_lock<spinlock> lock(event_lock_);
+    if (events_.write_available()){
+        auto e = events_.write_data();
+        int32_t pos = 0;
+        e->group_event_.type = type;
+        e->group_event_.result = result;
+        e->group_event_.name = pack_event_string(e->strings_, pos, name);
+        e->group_event_.errormsg = pack_event_string(e->strings_, pos, errmsg);
+        events_.write_commit();
+        eventnotifier_.notify();
+    }
+}
+
+void client::push_peer_event(int32_t type, const char *group, const char *user,
+                             const void *address, int32_t length,
+                             const void *relay_address)
 {
     scoped_lock<spinlock> lock(event_lock_);
     if (events_.write_available()){
-        events_.write(std::move(e));
+        auto e = events_.write_data();
+        int32_t pos = 0;
+        e->peer_event_.type = type;
+        e->peer_event_.result = 1;
+        e->peer_event_.errormsg = nullptr;
+        e->peer_event_.group = pack_event_string(e->strings_, pos, group);
+        e->peer_event_.user = pack_event_string(e->strings_, pos, user);
+        e->peer_event_.address = pack_event_sockaddr(e->address_, address);
+        e->peer_event_.length = length;
+        e->peer_event_.relay_address = pack_event_sockaddr(e->relay_address_, relay_address);
+        events_.write_commit();
+        eventnotifier_.notify();
     }
 }
 
@@ -728,7 +1274,7 @@ void client::wait_for_event(float timeout){
     HANDLE events[2];
     int numevents;
     events[0] = waitevent_;
-    if (tcpsocket_ >= 0){
+    if (tcpsocket_ >= 0 || !connecting_.empty()){
         events[1] = sockevent_;
         numevents = 2;
     } else {
@@ -741,8 +1287,9 @@ void client::wait_for_event(float timeout){
         LOG_DEBUG("aoo_server: timed out");
         return;
     }
-    // only the second event is a socket
-    if (result - WAIT_OBJECT_0 == 1){
+    // only the second event is a socket.
+    // FD_CONNECT is handled in update_connect()
+    if (result - WAIT_OBJECT_0 == 1 && tcpsocket_ >= 0){
         WSANETWORKEVENTS ne;
         memset(&ne, 0, sizeof(ne));
         WSAEnumNetworkEvents(tcpsocket_, sockevent_, &ne);
@@ -762,17 +1309,24 @@ void client::wait_for_event(float timeout){
     }
 #else
 #if 1 // poll() version
-    struct pollfd fds[2];
+    // pending connections are writable once they are done, see update_connect()
+    int numfds = 2 + (int)connecting_.size();
+    auto fds = (struct pollfd *)alloca(sizeof(struct pollfd) * numfds);
     fds[0].fd = waitpipe_[0];
     fds[0].events = POLLIN;
     fds[0].revents = 0;
     fds[1].fd = tcpsocket_;
     fds[1].events = POLLIN;
     fds[1].revents = 0;
+    for (int i = 2; i < numfds; ++i){
+        fds[i].fd = connecting_[i - 2].connected ? -1 : connecting_[i - 2].socket;
+        fds[i].events = POLLOUT;
+        fds[i].revents = 0;
+    }
 
     // round up to 1 ms! -1: block indefinitely
     // NOTE: macOS requires the negative timeout to exactly -1!
-    int result = poll(fds, 2, timeout < 0 ? -1 : timeout * 1000.0 + 0.5);
+    int result = poll(fds, numfds, timeout < 0 ? -1 : timeout * 1000.0 + 0.5);
     if (result < 0){
         int err = errno;
         if (err == EINTR){
@@ -840,9 +1394,20 @@ void client::receive_data(){
 
             // handle packets
             uint8_t buf[AOO_MAXPACKETSIZE];
-            while (true){
-                auto size = recvbuffer_.read_packet(buf, sizeof(buf));
+            while (tcpsocket_ >= 0){
+                bool binary = false;
+                auto size = control_read_packet(recvbuffer_, buf, sizeof(buf), binary);
+                if (size < 0){
+                    LOG_ERROR("aoo_client: received bad frame from server");
+                    do_disconnect(command_reason::error, 0);
+                    return;
+                }
                 if (size > 0){
+                    if (binary && !binary_){
+                        // the server supports binary frames, so we use them as well
+                        LOG_VERBOSE("aoo_client: switch to binary frames");
+                        binary_ = true;
+                    }
                     try {
                         osc::ReceivedPacket packet((char *)buf, size);
 
@@ -904,7 +1469,16 @@ void client::receive_data(){
 
 void client::send_server_message_tcp(const char *data, int32_t size){
     if (tcpsocket_ >= 0){
-        if (sendbuffer_.write_packet((const uint8_t *)data, size)){
+        bool written;
+        if (binary_){
+            std::vector<uint8_t> frame;
+            control_encode(data, size, frame);
+            written = sendbuffer_.write_available() >= (int32_t)frame.size()
+                    && sendbuffer_.write_bytes(frame.data(), (int32_t)frame.size());
+        } else {
+            written = sendbuffer_.write_packet((const uint8_t *)data, size);
+        }
+        if (written){
             // try to send as much as possible until send() would block
             while (true){
                 uint8_t buf[1024];
@@ -966,43 +1540,49 @@ void client::send_server_message_udp(const char *data, int32_t size)
 }
 
 void client::handle_server_message_tcp(const osc::ReceivedMessage& msg){
-    // first check main pattern
-    int32_t len = (int32_t) strlen(msg.AddressPattern());
-    int32_t onset = AOO_MSG_DOMAIN_LEN + AOONET_MSG_CLIENT_LEN;
-
-    if ((len < onset) ||
-        memcmp(msg.AddressPattern(), AOO_MSG_DOMAIN AOONET_MSG_CLIENT, onset))
-    {
-        LOG_ERROR("aoo_client: received bad message " << msg.AddressPattern()
-                  << " from server");
-        return;
-    }
-
-    // now compare subpattern
-    auto pattern = msg.AddressPattern() + onset;
+    // integer address patterns in binary frames, otherwise the full pattern
+    auto id = control_message_id(msg);
+    auto pattern = control_message_pattern(id);
     LOG_DEBUG("aoo_client: got message " << pattern << " from server");
 
     try {
-        if (!strcmp(pattern, AOONET_MSG_PING)){
+        switch (id){
+        case control_message::client_ping:
             LOG_DEBUG("aoo_client: got TCP ping from server");
-        } else if (!strcmp(pattern, AOONET_MSG_LOGIN)){
+            break;
+        case control_message::client_login:
             handle_login(msg);
-        } else if (!strcmp(pattern, AOONET_MSG_GROUP_JOIN)){
+            break;
+        case control_message::client_group_join:
             handle_group_join(msg);
-        } else if (!strcmp(pattern, AOONET_MSG_GROUP_LEAVE)){
+            break;
+        case control_message::client_group_leave:
             handle_group_leave(msg);
-        } else if (!strcmp(pattern, AOONET_MSG_GROUP_PUBLIC)){
-            //
-        } else if (!strcmp(pattern, AOONET_MSG_GROUP_PUBLIC_ADD)){
+            break;
+        case control_message::client_group_public:
+            break;
+        case control_message::client_group_public_add:
             handle_public_group_add(msg);
-        } else if (!strcmp(pattern, AOONET_MSG_GROUP_PUBLIC_DEL)){
+            break;
+        case control_message::client_group_public_del:
             handle_public_group_del(msg);
-        } else if (!strcmp(pattern, AOONET_MSG_PEER_JOIN)){
+            break;
+        case control_message::client_peer_join:
             handle_peer_add(msg);
-        } else if (!strcmp(pattern, AOONET_MSG_PEER_LEAVE)){
+            break;
+        case control_message::client_peer_leave:
             handle_peer_remove(msg);
-        } else {
-            LOG_ERROR("aoo_client: unknown server message " << pattern);
+            break;
+        case control_message::client_route:
+            handle_forward_route(msg);
+            break;
+        default:
+            if (msg.AddressPatternIsUInt32()){
+                LOG_ERROR("aoo_client: unknown server message " << msg.AddressPatternAsUInt32());
+            } else {
+                LOG_ERROR("aoo_client: unknown server message " << msg.AddressPattern());
+            }
+            break;
         }
     } catch (const osc::Exception& e){
         LOG_ERROR("aoo_client: exception on handling " << pattern
@@ -1015,13 +1595,36 @@ void client::handle_login(const osc::ReceivedMessage& msg){
         auto it = msg.ArgumentsBegin();
         int32_t status = (it++)->AsInt32();
         if (status > 0){
+            // newer servers send a session token, and the groups of a resumed session
+            bool resumed = false;
+            bool handled = false; // the requests that came with the login
+            std::vector<std::string> groups;
+            if (msg.ArgumentCount() > 3){
+                it++; // error message
+                session_token_ = (it++)->AsInt64();
+                resumed = (it++)->AsInt32() != 0;
+                while (it != msg.ArgumentsEnd()){
+                    if (it->IsInt32()){
+                        handled = (it++)->AsInt32() != 0;
+                    } else {
+                        groups.push_back((it++)->AsString());
+                    }
+                }
+            }
             // connected!
             state_ = client_state::connected;
-            LOG_VERBOSE("aoo_client: successfully logged in");
+            reconnecting_ = false;
+            reconnect_attempts_ = 0;
+            reconnect_denied_ = 0;
+            LOG_VERBOSE("aoo_client: successfully logged in"
+                        << (resumed ? " (resumed session)" : ""));
             // event
-            auto e = std::make_unique<event>(
-                AOONET_CLIENT_CONNECT_EVENT, 1);
-            push_event(std::move(e));
+            push_event(AOONET_CLIENT_CONNECT_EVENT, resumed ? 2 : 1);
+            for (auto& group : groups){
+                push_group_event(AOONET_CLIENT_GROUP_JOIN_EVENT, group.c_str(), 1);
+            }
+            // their replies follow in the same bundle
+            finish_pending(handled);
         } else {
             std::string errmsg;
             if (msg.ArgumentCount() > 1){
@@ -1031,10 +1634,20 @@ void client::handle_login(const osc::ReceivedMessage& msg){
             }
             LOG_WARNING("aoo_client: login failed: " << errmsg);
 
+            if (reconnecting_.load() && errmsg == "access denied" && reconnect_denied_ < 3){
+                // the server hasn't noticed yet that our old connection is dead,
+                // it drops it when it sees our session token.
+                reconnect_denied_++;
+                do_disconnect();
+                schedule_reconnect();
+                return;
+            }
+            reconnecting_ = false;
+            pending_joins_.clear();
+            pending_watch_ = -1;
+
             // event
-            auto e = std::make_unique<event>(
-                AOONET_CLIENT_CONNECT_EVENT, status, errmsg.c_str());
-            push_event(std::move(e));
+            push_event(AOONET_CLIENT_CONNECT_EVENT, status, errmsg.c_str());
 
             do_disconnect();
         }
@@ -1047,9 +1660,7 @@ void client::handle_group_join(const osc::ReceivedMessage& msg){
     int32_t status = (it++)->AsInt32();
     if (status > 0){
         LOG_VERBOSE("aoo_client: successfully joined group " << group);
-        auto e = std::make_unique<group_event>(
-            AOONET_CLIENT_GROUP_JOIN_EVENT, group.c_str(), 1);
-        push_event(std::move(e));
+        push_group_event(AOONET_CLIENT_GROUP_JOIN_EVENT, group.c_str(), 1);
     } else {
         std::string errmsg;
         if (msg.ArgumentCount() > 2){
@@ -1060,9 +1671,7 @@ void client::handle_group_join(const osc::ReceivedMessage& msg){
             errmsg = "unknown error";
         }
         // event
-        auto e = std::make_unique<group_event>(
-            AOONET_CLIENT_GROUP_JOIN_EVENT, group.c_str(), status, errmsg.c_str());
-        push_event(std::move(e));
+        push_group_event(AOONET_CLIENT_GROUP_JOIN_EVENT, group.c_str(), status, errmsg.c_str());
     }
 }
 
@@ -1079,9 +1688,7 @@ void client::handle_group_leave(const osc::ReceivedMessage& msg){
                                      [&](auto& p){ return p->group() == group; });
         peers_.erase(result, peers_.end());
 
-        auto e = std::make_unique<group_event>(
-            AOONET_CLIENT_GROUP_LEAVE_EVENT, group.c_str(), 1);
-        push_event(std::move(e));
+        push_group_event(AOONET_CLIENT_GROUP_LEAVE_EVENT, group.c_str(), 1);
     } else {
         std::string errmsg;
         if (msg.ArgumentCount() > 2){
@@ -1092,9 +1699,7 @@ void client::handle_group_leave(const osc::ReceivedMessage& msg){
             errmsg = "unknown error";
         }
         // event
-        auto e = std::make_unique<group_event>(
-            AOONET_CLIENT_GROUP_LEAVE_EVENT, group.c_str(), status, errmsg.c_str());
-        push_event(std::move(e));
+        push_group_event(AOONET_CLIENT_GROUP_LEAVE_EVENT, group.c_str(), status, errmsg.c_str());
     }
 }
 
@@ -1105,8 +1710,7 @@ void client::handle_public_group_add(const osc::ReceivedMessage& msg){
 
     LOG_VERBOSE("aoo_client: public group add/changed " << group << " users: " << usercnt);
 
-    auto e = std::make_unique<group_event>(AOONET_CLIENT_GROUP_PUBLIC_ADD_EVENT, group.c_str(), usercnt);
-    push_event(std::move(e));
+    push_group_event(AOONET_CLIENT_GROUP_PUBLIC_ADD_EVENT, group.c_str(), usercnt);
 }
 
 void client::handle_public_group_del(const osc::ReceivedMessage& msg){
@@ -1115,8 +1719,7 @@ void client::handle_public_group_del(const osc::ReceivedMessage& msg){
 
     LOG_VERBOSE("aoo_client: public group deleted " << group);
 
-    auto e = std::make_unique<group_event>(AOONET_CLIENT_GROUP_PUBLIC_DEL_EVENT, group.c_str(), 0);
-    push_event(std::move(e));
+    push_group_event(AOONET_CLIENT_GROUP_PUBLIC_DEL_EVENT, group.c_str(), 0);
 }
 
 
@@ -1129,6 +1732,15 @@ void client::handle_peer_add(const osc::ReceivedMessage& msg){
     std::string local_ip = (it++)->AsString();
     int32_t local_port = (it++)->AsInt32();
     int64_t token = msg.ArgumentCount() > 6 ? (it++)->AsInt64() : 0;
+    // the peer's other interfaces (newer servers)
+    std::vector<ip_address> interfaces;
+    if (msg.ArgumentCount() > 7){
+        std::istringstream is((it++)->AsString());
+        std::string ip;
+        while (is >> ip){
+            interfaces.emplace_back(ip, local_port);
+        }
+    }
     
     ip_address public_addr(public_ip, public_port);
     ip_address local_addr(local_ip, local_port);
@@ -1142,15 +1754,12 @@ void client::handle_peer_add(const osc::ReceivedMessage& msg){
             return;
         }
     }
-    peers_.push_back(std::make_unique<peer>(*this, group, user,
-                                            public_addr, local_addr, token));
+    peers_.push_back(std::make_unique<peer>(*this, group, user, public_addr,
+                                            local_addr, interfaces, token));
 
     // push prejoin event, real join event will be sent after handshake and real address is discovered
     
-    auto e = std::make_unique<client::peer_event>(
-                AOONET_CLIENT_PEER_PREJOIN_EVENT,
-                group.c_str(), user.c_str(), nullptr, 0);
-    push_event(std::move(e));
+    push_peer_event(AOONET_CLIENT_PEER_PREJOIN_EVENT, group.c_str(), user.c_str(), nullptr, 0);
 
     
     LOG_VERBOSE("aoo_client: new peer " << *peers_.back()
@@ -1175,14 +1784,31 @@ void client::handle_peer_remove(const osc::ReceivedMessage& msg){
 
     peers_.erase(result);
 
-    auto e = std::make_unique<peer_event>(
-                AOONET_CLIENT_PEER_LEAVE_EVENT,
-                group.c_str(), user.c_str(), &addr.address, addr.length);
-    push_event(std::move(e));
+    push_peer_event(AOONET_CLIENT_PEER_LEAVE_EVENT,
+                    group.c_str(), user.c_str(), &addr.address, addr.length);
 
     LOG_VERBOSE("aoo_client: peer " << group << "|" << user << " left");
 }
 
+void client::handle_forward_route(const osc::ReceivedMessage& msg){
+    auto it = msg.ArgumentsBegin();
+    int32_t route = (it++)->AsInt32();
+    int32_t serial = (it++)->AsInt32();
+    int32_t result = (it++)->AsInt32();
+
+    scoped_lock<spinlock> lock(route_lock_);
+    auto r = forward_routes_.find(route);
+    // ignore replies to older requests
+    if (r != forward_routes_.end() && r->second.serial == serial){
+        r->second.state = result > 0 ? 1 : -1;
+        if (result > 0){
+            LOG_VERBOSE("aoo_client: server accepted forward route " << route);
+        } else {
+            LOG_WARNING("aoo_client: server refused forward route " << route);
+        }
+    }
+}
+
 void client::handle_server_message_udp(const osc::ReceivedMessage &msg, int onset){
     auto pattern = msg.AddressPattern() + onset;
     try {
@@ -1223,68 +1849,50 @@ void client::signal(){
 }
 
 
-/*///////////////////// events ////////////////////////*/
-
-client::event::event(int32_t type, int32_t result,
-                     const char * errmsg)
-{
-    client_event_.type = type;
-    client_event_.result = result;
-    client_event_.errormsg = copy_string(errmsg);
-}
-
-client::event::~event()
-{
-    delete client_event_.errormsg;
-}
-
-client::group_event::group_event(int32_t type, const char *name,
-                                 int32_t result, const char *errmsg)
-{
-    group_event_.type = type;
-    group_event_.result = result;
-    group_event_.errormsg = copy_string(errmsg);
-    group_event_.name = copy_string(name);
-}
-
-client::group_event::~group_event()
-{
-    delete group_event_.errormsg;
-    delete group_event_.name;
-}
-
-client::peer_event::peer_event(int32_t type,
-                               const char *group, const char *user,
-                               const void *address, int32_t length)
-{
-    peer_event_.type = type;
-    peer_event_.result = 1;
-    peer_event_.errormsg = nullptr;
-    peer_event_.group = copy_string(group);
-    peer_event_.user = copy_string(user);
-    peer_event_.address = copy_sockaddr(address);
-    peer_event_.length = length;
-}
+/*///////////////////// peer //////////////////////////*/
 
-client::peer_event::~peer_event()
-{
-    delete peer_event_.user;
-    delete peer_event_.group;
-    if (peer_event_.address) {
-        free_sockaddr(peer_event_.address);
-    }
-}
+// candidate priorities, see peer::send()
+#define AOONET_PRIORITY_HOST 100
+#define AOONET_PRIORITY_INTERFACE 90
+#define AOONET_PRIORITY_PEER_REFLEXIVE 85
+#define AOONET_PRIORITY_REFLEXIVE 80
+#define AOONET_PRIORITY_PREDICTED 50
+#define AOONET_PRIORITY_RELAY 10
 
-/*///////////////////// peer //////////////////////////*/
+// how many ports after the public one we try for sequential NATs
+#define AOONET_PREDICTED_PORTS 2
 
 peer::peer(client& client,
            const std::string& group, const std::string& user,
-           const ip_address& public_addr, const ip_address& local_addr, int64_t token)
+           const ip_address& public_addr, const ip_address& local_addr,
+           const std::vector<ip_address>& interfaces, int64_t token)
     : client_(&client), group_(group), user_(user),
       public_address_(public_addr), local_address_(local_addr), token_(token)
 {
     start_time_ = time_tag::now();
 
+    add_candidate(local_address_, candidate_type::host, AOONET_PRIORITY_HOST);
+    for (auto& addr : interfaces){
+        add_candidate(addr, candidate_type::host, AOONET_PRIORITY_INTERFACE);
+    }
+    add_candidate(public_address_, candidate_type::reflexive, AOONET_PRIORITY_REFLEXIVE);
+    if (!(public_address_ == local_address_)){
+        // the peer is behind a NAT
+        for (int i = 1; i <= AOONET_PREDICTED_PORTS; ++i){
+            int port = public_address_.port() + i;
+            if (port < 65536){
+                add_candidate(ip_address(public_address_.name(), port),
+                              candidate_type::predicted, AOONET_PRIORITY_PREDICTED);
+            }
+        }
+    }
+    // the server knows the peer by its public address
+    // (the relay header only has room for IPv4)
+    if (public_address_.family() == AF_INET
+            && client_->server_address().family() == AF_INET){
+        add_candidate(public_address_, candidate_type::relay, AOONET_PRIORITY_RELAY);
+    }
+
     LOG_VERBOSE("create peer " << *this);
 }
 
@@ -1297,7 +1905,13 @@ bool peer::match(const ip_address &addr) const {
     if (real_addr){
         return *real_addr == addr;
     } else {
-        return public_address_ == addr || local_address_ == addr;
+        scoped_lock<spinlock> lock(candidate_lock_);
+        for (auto& c : candidates_){
+            if (c.type != candidate_type::relay && c.address == addr){
+                return true;
+            }
+        }
+        return public_address_ == addr; // relayed
     }
 }
 
@@ -1311,11 +1925,66 @@ bool peer::match_token(int64_t token) const
     return token_ == token;
 }
 
-void peer::set_public_address(const ip_address & addr)
+void peer::add_reflexive_candidate(const ip_address & addr)
 {
-    public_address_ = addr;
+    scoped_lock<spinlock> lock(candidate_lock_);
+    add_candidate(addr, candidate_type::reflexive, AOONET_PRIORITY_PEER_REFLEXIVE);
 }
 
+void peer::add_candidate(const ip_address& addr, candidate_type type, int priority){
+    // NOTE: called with the candidate lock held (or from the constructor)
+    for (auto& c : candidates_){
+        if (c.address == addr && (c.type == candidate_type::relay) == (type == candidate_type::relay)){
+            return; // already have it, e.g. local and public address are the same
+        }
+    }
+    auto it = std::find_if(candidates_.begin(), candidates_.end(),
+                           [&](auto& c){ return c.priority < priority; });
+    candidates_.insert(it, candidate(addr, type, priority));
+}
+
+peer::candidate * peer::find_candidate(const ip_address& addr, bool relayed){
+    for (auto& c : candidates_){
+        if ((c.type == candidate_type::relay) == relayed
+                && (relayed || c.address == addr)){
+            return &c;
+        }
+    }
+    return nullptr;
+}
+
+bool peer::plausible(const candidate& c) const {
+    if (c.type == candidate_type::host){
+        // local addresses only work if we are behind the same NAT
+        return public_address_.same_host(client_->public_address());
+    } else {
+        return true;
+    }
+}
+
+void peer::nominate(const candidate& c){
+    // NOTE: called with the candidate lock held
+    nominated_ = c.address;
+    bool relayed = c.type == candidate_type::relay;
+    relay_.store(relayed);
+    address_.store(&nominated_);
+
+    // push event
+    auto relay_addr = relayed ? &client_->server_address().address : nullptr;
+    client_->push_peer_event(AOONET_CLIENT_PEER_JOIN_EVENT,
+                             group().c_str(), user().c_str(),
+                             &nominated_.address, nominated_.length, relay_addr);
+
+    if (relayed){
+        LOG_VERBOSE("aoo_client: successfully established relayed connection with " << *this);
+    } else {
+        LOG_VERBOSE("aoo_client: successfully established connection with " << *this
+                    << " (" << nominated_.name() << ":" << nominated_.port() << ")");
+    }
+
+    // force last_pingtime_ to zero to make sure we ping them back immediately, avoiding race condition
+    last_pingtime_ = 0;
+}
 
 std::ostream& operator << (std::ostream& os, const peer& p)
 {
@@ -1329,44 +1998,70 @@ void peer::send(time_tag now){
 
     auto real_addr = address_.load();
     if (real_addr){
-        // send regular ping if it is time, or if we have never sent one (handles race condition on initial peer join)
-        if (delta >= client_->ping_interval() || last_pingtime_ <= 0){
+        // send regular ping if it is time, or if we have never sent one (handles race condition on initial peer join).
+        // skip it while the application is streaming to the peer, the stream keeps the path open anyway.
+        auto idle = elapsed_time - last_traffic_.load();
+        if ((delta >= client_->ping_interval() && idle >= client_->ping_interval())
+                || last_pingtime_ <= 0){
             char buf[64];
             osc::OutboundPacketStream msg(buf, sizeof(buf));
             msg << osc::BeginMessage(AOONET_MSG_PEER_PING) << osc::EndMessage;
 
-            client_->send_message_udp(msg.Data(), (int32_t) msg.Size(), *real_addr);
+            if (relay_.load()){
+                client_->send_message_relay(msg.Data(), (int32_t) msg.Size(), *real_addr);
+            } else {
+                client_->send_message_udp(msg.Data(), (int32_t) msg.Size(), *real_addr);
+            }
             LOG_DEBUG("send regular ping to " << *this);
 
             last_pingtime_ = elapsed_time;
         }
     } else if (!timeout_) {
-        // try to establish UDP connection with peer
-        if (elapsed_time > client_->request_timeout()){
+        if (elapsed_time > client_->request_timeout() * 2){
             // couldn't establish peer connection!
             LOG_ERROR("aoo_client: couldn't establish UDP connection to "
                       << *this << "; timed out after "
-                      << client_->request_timeout() << " seconds");
+                      << client_->request_timeout() * 2 << " seconds");
             timeout_ = true;
 
 
             // this at least lets us present to the user that a particular user@group failed to establish
-            auto e = std::make_unique<client::peer_event>(
-                        AOONET_CLIENT_PEER_JOINFAIL_EVENT,
-                        group().c_str(), user().c_str(), nullptr, 0);
-            client_->push_event(std::move(e));
+            client_->push_peer_event(AOONET_CLIENT_PEER_JOINFAIL_EVENT,
+                                     group().c_str(), user().c_str(), nullptr, 0);
            
             return;
         }
-        // send handshakes in fast succession to *both* addresses
-        // until we get a reply from one of them (see handle_message())
+
+        scoped_lock<spinlock> lock(candidate_lock_);
+
+        // the better candidates had their chance, take the best answer
+        if (nominate_time_ > 0 && elapsed_time >= nominate_time_){
+            for (auto& c : candidates_){
+                if (c.succeeded){
+                    nominate(c);
+                    return;
+                }
+            }
+        }
+
+        // send handshakes to all candidates in fast succession until
+        // we get a reply (see handle_message()). the relay costs server
+        // bandwidth, so we give direct connections a head start, but
+        // not the full timeout.
         if (delta >= client_->request_interval()){
             char buf[80];
             osc::OutboundPacketStream msg(buf, sizeof(buf));
             msg << osc::BeginMessage(AOONET_MSG_PEER_PING) << client_->get_token() << osc::EndMessage;
 
-            client_->send_message_udp(msg.Data(), (int32_t) msg.Size(), local_address_);
-            client_->send_message_udp(msg.Data(), (int32_t) msg.Size(), public_address_);
+            bool try_relay = elapsed_time >= std::min<double>(1.0, client_->request_timeout() * 0.25);
+
+            for (auto& c : candidates_){
+                if (c.type != candidate_type::relay){
+                    client_->send_message_udp(msg.Data(), (int32_t) msg.Size(), c.address);
+                } else if (try_relay){
+                    client_->send_message_relay(msg.Data(), (int32_t) msg.Size(), c.address);
+                }
+            }
 
             LOG_DEBUG("send ping to " << *this);
 
@@ -1376,33 +2071,44 @@ void peer::send(time_tag now){
 }
 
 void peer::handle_message(const osc::ReceivedMessage &msg, int onset,
-                          const ip_address& addr)
+                          const ip_address& addr, bool relayed)
 {
     auto pattern = msg.AddressPattern() + onset;
     try {
         if (!strcmp(pattern, AOONET_MSG_PING)){
             if (!address_.load()){
-                // this is the first ping!
-                if (addr == public_address_){
-                    address_.store(&public_address_);
-                } else if (addr == local_address_){
-                    address_.store(&local_address_);
-                } else {
+                scoped_lock<spinlock> lock(candidate_lock_);
+                if (address_.load()){
+                    return; // nominated in the meantime
+                }
+                auto c = find_candidate(addr, relayed);
+                if (!c){
                     LOG_ERROR("aoo_client: bug in peer::handle_message");
                     return;
                 }
+                if (!c->succeeded){
+                    LOG_DEBUG("aoo_client: " << *this << ": candidate " << addr.name()
+                              << ":" << addr.port() << (relayed ? " (relay)" : "") << " answered");
+                    c->succeeded = true;
+                }
 
-                // push event
-                auto e = std::make_unique<client::peer_event>(
-                            AOONET_CLIENT_PEER_JOIN_EVENT,
-                            group().c_str(), user().c_str(), &addr.address, addr.length);
-                client_->push_event(std::move(e));
-
-                LOG_VERBOSE("aoo_client: successfully established connection with " << *this);
-                
-                // force last_pingtime_ to zero to make sure we ping them back immediately, avoiding race condition
-                last_pingtime_ = 0;
-                
+                // nominate right away, unless a better candidate might still answer
+                bool wait = false;
+                for (auto& other : candidates_){
+                    if (&other == c){
+                        break;
+                    }
+                    if (!other.succeeded && plausible(other)){
+                        wait = true;
+                        break;
+                    }
+                }
+                if (!wait){
+                    nominate(*c);
+                } else if (nominate_time_ == 0){
+                    auto elapsed_time = time_tag::duration(start_time_, time_tag::now());
+                    nominate_time_ = elapsed_time + client_->request_interval() * 2;
+                }
             } else {
                 LOG_DEBUG("aoo_client: got ping from " << *this);
                 // maybe handle ping?
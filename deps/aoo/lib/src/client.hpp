@@ -12,13 +12,25 @@
 #include "lockfree.hpp"
 #include "net_utils.hpp"
 #include "SLIP.hpp"
+#include "control.hpp"
 
 #include "oscpack/osc/OscOutboundPacketStream.h"
 #include "oscpack/osc/OscReceivedElements.h"
 
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <random>
+
 #define AOO_NET_CLIENT_PING_INTERVAL 10000
 #define AOO_NET_CLIENT_REQUEST_INTERVAL 100
 #define AOO_NET_CLIENT_REQUEST_TIMEOUT 5000
+#define AOO_NET_CLIENT_CONNECT_TIMEOUT 5000
+// reconnect backoff: the first attempt is somewhere within the first
+// interval, each failed one doubles it up to the maximum
+#define AOO_NET_CLIENT_RECONNECT_INTERVAL 2000
+#define AOO_NET_CLIENT_RECONNECT_MAX_INTERVAL 30000
 
 namespace aoo {
 namespace net {
@@ -28,7 +40,8 @@ class client;
 class peer {
 public:
     peer(client& client, const std::string& group, const std::string& user,
-         const ip_address& public_addr, const ip_address& local_addr, int64_t token=0);
+         const ip_address& public_addr, const ip_address& local_addr,
+         const std::vector<ip_address>& interfaces, int64_t token=0);
 
     ~peer();
 
@@ -38,7 +51,9 @@ public:
 
     bool match_token(int64_t token) const;
     
-    void set_public_address(const ip_address & addr);
+    // a ping with the peer's token came from an unknown address,
+    // e.g. because the peer is behind a symmetric NAT
+    void add_reflexive_candidate(const ip_address& addr);
     
     const std::string& group() const { return group_; }
 
@@ -58,10 +73,18 @@ public:
         }
     }
 
+    // we only reach the peer through the server's relay
+    bool relayed() const { return relay_.load(); }
+
     void send(time_tag now);
 
+    // the application has sent data to the peer (see aoonet_client_peer_traffic())
+    void note_traffic(time_tag now){
+        last_traffic_ = time_tag::duration(start_time_, now);
+    }
+
     void handle_message(const osc::ReceivedMessage& msg, int onset,
-                        const ip_address& addr);
+                        const ip_address& addr, bool relayed = false);
 
     friend std::ostream& operator << (std::ostream& os, const peer& p);
 private:
@@ -74,7 +97,42 @@ private:
     std::atomic<ip_address *> address_{nullptr};
     time_tag start_time_;
     double last_pingtime_ = 0;
+    std::atomic<double> last_traffic_{-1e9};
     bool timeout_ = false;
+    std::atomic<bool> relay_{false};
+
+    // Connectivity checks: we ping all candidates in parallel (the relay
+    // after a short delay) and nominate the most preferable one that
+    // answers. Lower priority answers wait a little for better ones.
+    enum class candidate_type {
+        host,       // a local address of the peer (same LAN)
+        reflexive,  // public address, as seen by the server or by us
+        predicted,  // the next ports of a sequential NAT
+        relay       // through the server
+    };
+
+    struct candidate {
+        candidate(const ip_address& _address, candidate_type _type, int _priority)
+            : address(_address), type(_type), priority(_priority) {}
+        ip_address address;
+        candidate_type type;
+        int priority;
+        bool succeeded = false;
+    };
+
+    // sorted by priority, protected by the candidate lock
+    std::vector<candidate> candidates_;
+    mutable spinlock candidate_lock_;
+    double nominate_time_ = 0; // nominate the best answer by then (if > 0)
+    ip_address nominated_; // 'address_' points here
+
+    void add_candidate(const ip_address& addr, candidate_type type, int priority);
+
+    candidate * find_candidate(const ip_address& addr, bool relayed);
+
+    bool plausible(const candidate& c) const;
+
+    void nominate(const candidate& c);
 };
 
 enum class client_state {
@@ -82,7 +140,8 @@ enum class client_state {
     connecting,
     handshake,
     login,
-    connected
+    connected,
+    reconnecting // waiting for the next attempt, see schedule_reconnect()
 };
 
 enum class command_reason {
@@ -99,15 +158,17 @@ public:
         virtual void perform(client&) = 0;
     };
 
-    struct ievent {
-        virtual ~ievent(){}
-
+    // a slot of the event queue, see pack_event_string()
+    struct event {
         union {
             aoo_event event_;
             aoonet_client_event client_event_;
             aoonet_client_group_event group_event_;
             aoonet_client_peer_event peer_event_;
         };
+        char strings_[event_string_size];
+        sockaddr_storage address_;
+        sockaddr_storage relay_address_;
     };
 
     client(void *udpsocket, aoo_sendfn fn, int port);
@@ -122,12 +183,19 @@ public:
 
     int32_t disconnect() override;
 
+    int32_t set_reconnect(bool enable) override;
+
     int32_t group_join(const char *group, const char *pwd, bool is_public) override;
 
     int32_t group_leave(const char *group) override;
 
     int32_t group_watch_public(bool watch) override;
 
+    int32_t set_forward_route(int32_t route, const void * const *addr, int32_t n) override;
+
+    int32_t forward_route_state(int32_t route) const override;
+
+    int32_t peer_traffic(const void *addr) override;
 
     int32_t handle_message(const char *data, int32_t n, void *addr) override;
 
@@ -137,20 +205,27 @@ public:
 
     int32_t handle_events(aoo_eventhandler fn, void *user) override;
 
-    void do_connect(const std::string& host, int port);
+    int32_t set_event_notify(aoo_notifyfn fn, void *user) override;
 
-    int try_connect(const std::string& host, int port);
+    void do_connect(const std::string& host, int port, const std::string& username,
+                    const std::string& pwd);
 
     void do_disconnect(command_reason reason = command_reason::none, int error = 0);
 
     void do_login();
 
+    // once the login went through: sends what the server didn't handle along with it
+    void finish_pending(bool handled);
+
     void do_group_join(const std::string& group, const std::string& pwd, bool is_public);
 
     void do_group_leave(const std::string& group);
 
     void do_group_watch_public(bool watch);
 
+    void do_set_forward_route(int32_t route, int32_t serial,
+                              const std::vector<ip_address>& addrs);
+
     double ping_interval() const { return ping_interval_.load(); }
 
     double request_interval() const { return request_interval_.load(); }
@@ -159,7 +234,21 @@ public:
 
     void send_message_udp(const char *data, int32_t size, const ip_address& addr);
 
-    void push_event(std::unique_ptr<ievent> e);
+    // send to a peer through the server's relay
+    void send_message_relay(const char *data, int32_t size, const ip_address& addr);
+
+    const ip_address& server_address() const { return remote_addr_; }
+
+    const ip_address& public_address() const { return public_addr_; }
+
+    void push_event(int32_t type, int32_t result, const char *errmsg = nullptr);
+
+    void push_group_event(int32_t type, const char *name,
+                          int32_t result, const char *errmsg = nullptr);
+
+    void push_peer_event(int32_t type, const char *group, const char *user,
+                         const void *address, int32_t length,
+                         const void *relay_address = nullptr);
     
     int64_t get_token() const { return token_; }
 private:
@@ -170,9 +259,12 @@ private:
     ip_address remote_addr_;
     ip_address public_addr_;
     ip_address local_addr_;
+    // our other interfaces (space separated), see do_login()
+    std::string local_interfaces_;
     SLIP sendbuffer_;
     std::vector<uint8_t> pending_send_data_;
     SLIP recvbuffer_;
+    bool binary_ = false; // the server sends binary frames, see control.hpp
     shared_mutex clientlock_;
     // peers
     std::vector<std::shared_ptr<peer>> peers_;
@@ -185,6 +277,52 @@ private:
     double last_tcp_ping_time_ = 0;
     // handshake
     std::atomic<client_state> state_{client_state::disconnected};
+    // connection attempts, see do_connect()
+    struct resolve_request {
+        std::mutex mutex;
+        client *owner = nullptr; // reset if the client gives up
+        std::vector<ip_address> addrs;
+        int error = 0;
+        bool done = false;
+    };
+    struct connect_attempt {
+        int socket;
+        ip_address address;
+        bool connected;
+    };
+    std::shared_ptr<resolve_request> resolving_;
+    std::vector<connect_attempt> connecting_;
+    double connect_start_time_ = 0;
+    double connect_ipv4_time_ = 0; // first IPv4 connection, see update_connect()
+    int connect_error_ = 0; // last error of any attempt
+    // reconnecting after we lost the connection, see schedule_reconnect()
+    std::string connect_host_;
+    int connect_port_ = 0;
+    int64_t session_token_ = 0; // from the server, for resuming the session
+    // group joins and the public group watch asked for before the login went
+    // out, they go along with it, see do_login()
+    struct pending_join {
+        std::string group;
+        std::string password;
+        bool is_public;
+    };
+    std::vector<pending_join> pending_joins_;
+    int32_t pending_watch_ = -1; // -1: none
+    bool login_sent_ = false; // on this connection
+    std::atomic<bool> reconnect_{true};
+    std::atomic<bool> reconnecting_{false};
+    int reconnect_attempts_ = 0;
+    int reconnect_denied_ = 0; // "access denied" answers while reconnecting
+    double reconnect_time_ = 0;
+    std::mt19937 reconnect_rng_;
+    // forward routes
+    struct forward_route {
+        int32_t serial; // of the last request, echoed by the server
+        int32_t state;  // 1: accepted, 0: pending, -1: refused
+    };
+    std::unordered_map<int32_t, forward_route> forward_routes_;
+    int32_t forward_route_serial_ = 0;
+    mutable spinlock route_lock_;
     double last_udp_ping_time_ = 0;
     double first_udp_ping_time_ = 0;
     int64_t token_ = 0;
@@ -199,8 +337,9 @@ private:
         }
     }
     // events
-    lockfree::queue<std::unique_ptr<ievent>> events_;
+    lockfree::queue<event> events_;
     spinlock event_lock_;
+    event_notifier eventnotifier_;
     // signal
     std::atomic<bool> quit_{false};
 #ifdef _WIN32
@@ -220,6 +359,26 @@ private:
 
     void wait_for_event(float timeout);
 
+    // look up 'connect_host_', then start_connect() with its addresses
+    void resolve_server();
+
+    void start_connect(const std::vector<ip_address>& addrs);
+
+    double update_connect(double elapsed_time);
+
+    int finish_connect(int sock, const ip_address& addr);
+
+    void connect_failed(int err);
+
+    void cancel_connect();
+
+    // try again after a randomized backoff, so that a server which comes back
+    // isn't hit by all of its clients at once
+    void schedule_reconnect();
+
+    // start the next attempt when it's due, returns the time until then (or -1)
+    double update_reconnect(double elapsed_time);
+
     void receive_data();
 
     void send_server_message_tcp(const char *data, int32_t size);
@@ -245,44 +404,25 @@ private:
 
     void handle_peer_remove(const osc::ReceivedMessage& msg);
 
-    void signal();
-
-    /*////////////////////// events /////////////////////*/
-public:
-    struct event : ievent
-    {
-        event(int32_t type, int32_t result,
-              const char * errmsg = 0);
-        ~event();
-    };
-
-    struct group_event : ievent
-    {
-        group_event(int32_t type, const char *name,
-                   int32_t result, const char * errmsg = 0);
-        ~group_event();
-    };
+    void handle_forward_route(const osc::ReceivedMessage& msg);
 
-    struct peer_event : ievent
-    {
-        peer_event(int32_t type,
-                   const char *group, const char *user,
-                   const void *address, int32_t length);
-        ~peer_event();
-    };
+    void signal();
 
     /*////////////////////// commands ///////////////////*/
 private:
     struct connect_cmd : icommand
     {
-        connect_cmd(const std::string& _host, int _port)
-            : host(_host), port(_port){}
+        connect_cmd(const std::string& _host, int _port,
+                    const std::string& _username, const std::string& _pwd)
+            : host(_host), port(_port), username(_username), password(_pwd){}
 
         void perform(client &obj) override {
-            obj.do_connect(host, port);
+            obj.do_connect(host, port, username, password);
         }
         std::string host;
         int port;
+        std::string username;
+        std::string password;
     };
 
     struct disconnect_cmd : icommand
@@ -338,6 +478,19 @@ private:
         }
         bool watch;
     };
+
+    struct forward_route_cmd : icommand
+    {
+        forward_route_cmd(int32_t _route, int32_t _serial, std::vector<ip_address>&& _addrs)
+            : route(_route), serial(_serial), addrs(std::move(_addrs)){}
+
+        void perform(client &obj) override {
+            obj.do_set_forward_route(route, serial, addrs);
+        }
+        int32_t route;
+        int32_t serial;
+        std::vector<ip_address> addrs;
+    };
 };
 
 } // net
@@ -0,0 +1,912 @@
+/* Copyright (c) 2010-Now Christof Ressi, Winfried Ritsch and others.
+ * For information on usage and redistribution, and for a DISCLAIMER OF ALL
+ * WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#include "aoo/aoo_lossless.h"
+#include "aoo/aoo_utils.hpp"
+
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+// Every block is coded on its own, the way FLAC codes a frame:
+//
+// - the samples are quantized exactly like the PCM codec does it
+// - pairs of channels (0+1, 2+3, ...) can be coded as left/side, side/right
+//   or mid/side instead of left/right, whichever is predicted best
+// - each channel is a constant, verbatim samples, or the residual of one of
+//   the fixed polynomial predictors of order 0 to 4
+// - the residual is split into 2^n partitions, each with its own Rice parameter
+//
+// Verbatim samples are the fallback, so a block never gets much bigger than
+// plain PCM. The bitstream is MSB first:
+//
+//   block:    { pair mode (2 bits) } per channel pair, then the channels,
+//             padded to a whole byte
+//   channel:  type (2 bits)
+//             constant: value (width bits)
+//             verbatim: n * value (width bits)
+//             fixed:    order (3 bits), order * warmup value (width bits),
+//                       partition order (3 bits), per partition: Rice
+//                       parameter (5 bits) and the Rice codes of the residual
+//
+// 'width' is the bitdepth, plus one for a side channel.
+
+namespace {
+
+enum subframe_type {
+    subframe_constant = 0,
+    subframe_verbatim,
+    subframe_fixed
+};
+
+enum pair_mode {
+    pair_independent = 0,
+    pair_left_side,
+    pair_side_right,
+    pair_mid_side
+};
+
+const int32_t max_fixed_order = 4;
+const int32_t max_partition_order = 7;
+const int32_t rice_param_bits = 5;
+const int32_t max_rice_param = 30;
+
+int32_t bits_per_sample(int32_t bd)
+{
+    switch (bd){
+    case AOO_LOSSLESS_INT16:
+        return 16;
+    case AOO_LOSSLESS_INT24:
+        return 24;
+    default:
+        assert(false);
+        return 0;
+    }
+}
+
+// the same rounding and clamping as in codec_pcm.cpp, so that both codecs
+// decode to the very same samples
+int32_t sample_to_int16(aoo_sample in)
+{
+    float temp = in * 0x7fff + 0.5f;
+    return (temp >= INT16_MAX) ? INT16_MAX : (temp <= INT16_MIN) ? INT16_MIN : (int16_t)temp;
+}
+
+int32_t sample_to_int24(aoo_sample in)
+{
+    float temp = in * 0x7fffffff + 0.5f;
+    int32_t i = (temp >= 2147483648.f) ? INT32_MAX : (temp <= -2147483648.f) ? INT32_MIN : (int32_t)temp;
+    // the highest 3 bytes
+    return i >> 8;
+}
+
+aoo_sample int16_to_sample(int32_t in)
+{
+    return (aoo_sample)in / 32768.f;
+}
+
+aoo_sample int24_to_sample(int32_t in)
+{
+    return (aoo_sample)(int32_t)((uint32_t)in << 8) / 0x7fffffff;
+}
+
+uint32_t zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+int32_t unzigzag(uint32_t u)
+{
+    return (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+}
+
+int32_t highest_bit(uint64_t v)
+{
+    assert(v != 0);
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(v);
+#else
+    int32_t n = 0;
+    while (v >>= 1){
+        n++;
+    }
+    return n;
+#endif
+}
+
+/*//////////////////// bits //////////////////////////*/
+
+class bit_writer {
+public:
+    bit_writer(char *buf)
+        : buf_((uint8_t *)buf) {}
+
+    // n <= 32
+    void put(uint32_t v, int32_t n){
+        if (n == 0){
+            return;
+        }
+        acc_ = (acc_ << n) | (v & (0xffffffffu >> (32 - n)));
+        nbits_ += n;
+        while (nbits_ >= 8){
+            nbits_ -= 8;
+            buf_[pos_++] = (uint8_t)(acc_ >> nbits_);
+        }
+    }
+
+    // q zeros and a one
+    void put_unary(uint32_t q){
+        while (q >= 32){
+            put(0, 32);
+            q -= 32;
+        }
+        put(1, q + 1);
+    }
+
+    int32_t finish(){
+        if (nbits_ > 0){
+            buf_[pos_++] = (uint8_t)(acc_ << (8 - nbits_));
+            nbits_ = 0;
+        }
+        return pos_;
+    }
+private:
+    uint8_t *buf_;
+    int32_t pos_ = 0;
+    uint64_t acc_ = 0;
+    int32_t nbits_ = 0;
+};
+
+class bit_reader {
+public:
+    bit_reader(const char *buf, int32_t size)
+        : buf_((const uint8_t *)buf), size_(size) {}
+
+    // n <= 32
+    uint32_t get(int32_t n){
+        if (n == 0){
+            return 0;
+        }
+        while (nbits_ < n){
+            if (!fill()){
+                return 0;
+            }
+        }
+        nbits_ -= n;
+        return (uint32_t)(acc_ >> nbits_) & (0xffffffffu >> (32 - n));
+    }
+
+    int32_t get_signed(int32_t n){
+        uint32_t v = get(n);
+        // sign extend
+        return (int32_t)(v << (32 - n)) >> (32 - n);
+    }
+
+    uint32_t get_unary(){
+        uint32_t q = 0;
+        for (;;){
+            uint64_t pending = nbits_ > 0 ? acc_ & (~0ull >> (64 - nbits_)) : 0;
+            if (pending){
+                auto zeros = nbits_ - 1 - highest_bit(pending);
+                nbits_ -= zeros + 1;
+                return q + zeros;
+            }
+            q += nbits_;
+            nbits_ = 0;
+            if (!fill()){
+                return 0;
+            }
+        }
+    }
+
+    bool error() const { return error_; }
+private:
+    bool fill(){
+        if (pos_ >= size_){
+            error_ = true;
+            return false;
+        }
+        acc_ = (acc_ << 8) | buf_[pos_++];
+        nbits_ += 8;
+        return true;
+    }
+
+    const uint8_t *buf_;
+    int32_t size_;
+    int32_t pos_ = 0;
+    uint64_t acc_ = 0;
+    int32_t nbits_ = 0;
+    bool error_ = false;
+};
+
+/*//////////////////// prediction //////////////////////////*/
+
+// the residual of the fixed predictor of the given order, from x[order] on
+void fixed_residual(const int32_t *x, int32_t n, int32_t order, int32_t *r)
+{
+    switch (order){
+    case 0:
+        for (int32_t i = 0; i < n; ++i){
+            r[i] = x[i];
+        }
+        break;
+    case 1:
+        for (int32_t i = 1; i < n; ++i){
+            r[i] = x[i] - x[i-1];
+        }
+        break;
+    case 2:
+        for (int32_t i = 2; i < n; ++i){
+            r[i] = x[i] - 2 * x[i-1] + x[i-2];
+        }
+        break;
+    case 3:
+        for (int32_t i = 3; i < n; ++i){
+            r[i] = x[i] - 3 * x[i-1] + 3 * x[i-2] - x[i-3];
+        }
+        break;
+    case 4:
+        for (int32_t i = 4; i < n; ++i){
+            r[i] = x[i] - 4 * x[i-1] + 6 * x[i-2] - 4 * x[i-3] + x[i-4];
+        }
+        break;
+    default:
+        assert(false);
+    }
+}
+
+// undoes fixed_residual() in place; x[0] to x[order-1] are the warmup samples.
+// Corrupt data must not overflow, so this wraps around in unsigned arithmetic.
+void fixed_restore(int32_t *x, int32_t n, int32_t order)
+{
+    auto u = reinterpret_cast<uint32_t *>(x);
+    switch (order){
+    case 0:
+        break;
+    case 1:
+        for (int32_t i = 1; i < n; ++i){
+            u[i] += u[i-1];
+        }
+        break;
+    case 2:
+        for (int32_t i = 2; i < n; ++i){
+            u[i] += 2 * u[i-1] - u[i-2];
+        }
+        break;
+    case 3:
+        for (int32_t i = 3; i < n; ++i){
+            u[i] += 3 * u[i-1] - 3 * u[i-2] + u[i-3];
+        }
+        break;
+    case 4:
+        for (int32_t i = 4; i < n; ++i){
+            u[i] += 4 * u[i-1] - 6 * u[i-2] + 4 * u[i-3] - u[i-4];
+        }
+        break;
+    default:
+        assert(false);
+    }
+}
+
+// the predictor order with the smallest absolute residual, like FLAC does it.
+// The sums all start at the same sample, so they are comparable.
+int32_t best_fixed_order(const int32_t *x, int32_t n)
+{
+    uint64_t e[max_fixed_order + 1] = { 0 };
+    for (int32_t i = max_fixed_order; i < n; ++i){
+        int32_t e0 = x[i];
+        int32_t e1 = e0 - x[i-1];
+        int32_t e2 = e1 - (x[i-1] - x[i-2]);
+        int32_t e3 = e2 - (x[i-1] - 2 * x[i-2] + x[i-3]);
+        int32_t e4 = e3 - (x[i-1] - 3 * x[i-2] + 3 * x[i-3] - x[i-4]);
+        e[0] += (uint32_t)(e0 < 0 ? -e0 : e0);
+        e[1] += (uint32_t)(e1 < 0 ? -e1 : e1);
+        e[2] += (uint32_t)(e2 < 0 ? -e2 : e2);
+        e[3] += (uint32_t)(e3 < 0 ? -e3 : e3);
+        e[4] += (uint32_t)(e4 < 0 ? -e4 : e4);
+    }
+    int32_t order = 0;
+    for (int32_t i = 1; i <= max_fixed_order; ++i){
+        if (e[i] < e[order]){
+            order = i;
+        }
+    }
+    return order;
+}
+
+/*//////////////////// Rice coding //////////////////////////*/
+
+struct rice_plan {
+    int32_t porder;
+    int32_t params[1 << max_partition_order];
+    int64_t bits; // exact size of the partitions, in bits
+};
+
+// the Rice parameter for a partition of n values with the given sum,
+// and its estimated size
+int32_t rice_param(uint64_t sum, int32_t n, int64_t& bits)
+{
+    if (n == 0){
+        bits = rice_param_bits;
+        return 0;
+    }
+    int32_t k = sum > (uint64_t)n ? highest_bit(sum / n) : 0;
+    int32_t best = 0;
+    int64_t bestbits = INT64_MAX;
+    // the estimate is close, check the neighbours
+    for (int32_t i = (k > 0 ? k - 1 : 0); i <= k + 1 && i <= max_rice_param; ++i){
+        int64_t b = rice_param_bits + (int64_t)n * (i + 1) + (int64_t)(sum >> i);
+        if (b < bestbits){
+            bestbits = b;
+            best = i;
+        }
+    }
+    bits = bestbits;
+    return best;
+}
+
+// 'u' holds the zigzag coded residual from u[order] on.
+// The first partition leaves out the warmup samples.
+void rice_partition(const uint32_t *u, int32_t n, int32_t order, rice_plan& plan)
+{
+    // the finest partitioning that fits the block
+    int32_t pmax = 0;
+    while (pmax < max_partition_order && (n % (2 << pmax)) == 0
+           && (n >> (pmax + 1)) > order){
+        pmax++;
+    }
+
+    uint64_t sums[1 << max_partition_order];
+    int32_t len = n >> pmax;
+    for (int32_t p = 0; p < (1 << pmax); ++p){
+        uint64_t s = 0;
+        for (int32_t i = (p == 0 ? order : p * len); i < (p + 1) * len; ++i){
+            s += u[i];
+        }
+        sums[p] = s;
+    }
+
+    int64_t bestbits = INT64_MAX;
+    for (int32_t porder = pmax; porder >= 0; --porder){
+        int32_t count = 1 << porder;
+        int32_t plen = n >> porder;
+        int32_t params[1 << max_partition_order];
+        int64_t bits = 0;
+        for (int32_t p = 0; p < count; ++p){
+            int64_t b;
+            params[p] = rice_param(sums[p], p == 0 ? plen - order : plen, b);
+            bits += b;
+        }
+        if (bits < bestbits){
+            bestbits = bits;
+            plan.porder = porder;
+            memcpy(plan.params, params, count * sizeof(int32_t));
+        }
+        // merge neighbouring partitions for the next order
+        for (int32_t p = 0; p < count / 2; ++p){
+            sums[p] = sums[2 * p] + sums[2 * p + 1];
+        }
+    }
+
+    // the exact size
+    int32_t plen = n >> plan.porder;
+    int64_t bits = 0;
+    for (int32_t p = 0; p < (1 << plan.porder); ++p){
+        int32_t k = plan.params[p];
+        int32_t start = p == 0 ? order : p * plen;
+        bits += rice_param_bits + (int64_t)((p + 1) * plen - start) * (k + 1);
+        for (int32_t i = start; i < (p + 1) * plen; ++i){
+            bits += u[i] >> k;
+        }
+    }
+    plan.bits = bits;
+}
+
+/*//////////////////// codec //////////////////////////*/
+
+void print_settings(const aoo_format_lossless& f)
+{
+    LOG_VERBOSE("lossless settings: "
+                << "nchannels = " << f.header.nchannels
+                << ", blocksize = " << f.header.blocksize
+                << ", samplerate = " << f.header.samplerate
+                << ", bitdepth = " << bits_per_sample(f.bitdepth));
+}
+
+struct codec {
+    codec(){
+        memset(&format, 0, sizeof(aoo_format_lossless));
+    }
+
+    // not in the audio thread, see codec_setformat()
+    void resize(int32_t nframes, int32_t nchannels){
+        samples.resize(nframes * nchannels);
+        side.resize(nframes);
+        mid.resize(nframes);
+        residual.resize(nframes);
+        unsigned_residual.resize(nframes);
+    }
+
+    aoo_format_lossless format;
+    // per channel
+    std::vector<int32_t> samples;
+    // of the current channel pair
+    std::vector<int32_t> side;
+    std::vector<int32_t> mid;
+    std::vector<int32_t> residual;
+    std::vector<uint32_t> unsigned_residual;
+};
+
+// how one channel gets coded
+struct subframe_plan {
+    int32_t type;
+    int32_t order;
+    rice_plan rice;
+    int64_t bits;
+};
+
+void plan_subframe(codec& c, const int32_t *x, int32_t n, int32_t width,
+                   subframe_plan& plan)
+{
+    plan.type = subframe_verbatim;
+    plan.order = 0;
+    plan.bits = 2 + (int64_t)n * width;
+
+    bool constant = true;
+    for (int32_t i = 1; i < n; ++i){
+        if (x[i] != x[0]){
+            constant = false;
+            break;
+        }
+    }
+    if (constant){
+        plan.type = subframe_constant;
+        plan.bits = 2 + width;
+        return;
+    }
+
+    if (n <= max_fixed_order){
+        return;
+    }
+
+    int32_t order = best_fixed_order(x, n);
+    auto r = c.residual.data();
+    auto u = c.unsigned_residual.data();
+    fixed_residual(x, n, order, r);
+    for (int32_t i = order; i < n; ++i){
+        u[i] = zigzag(r[i]);
+    }
+    rice_partition(u, n, order, plan.rice);
+
+    int64_t bits = 2 + 3 + (int64_t)order * width + 3 + plan.rice.bits;
+    if (bits < plan.bits){
+        plan.type = subframe_fixed;
+        plan.order = order;
+        plan.bits = bits;
+    }
+}
+
+void write_subframe(codec& c, const int32_t *x, int32_t n, int32_t width,
+                    const subframe_plan& plan, bit_writer& w)
+{
+    w.put(plan.type, 2);
+    if (plan.type == subframe_constant){
+        w.put(x[0], width);
+    } else if (plan.type == subframe_verbatim){
+        for (int32_t i = 0; i < n; ++i){
+            w.put(x[i], width);
+        }
+    } else {
+        auto r = c.residual.data();
+        fixed_residual(x, n, plan.order, r);
+        w.put(plan.order, 3);
+        for (int32_t i = 0; i < plan.order; ++i){
+            w.put(x[i], width);
+        }
+        w.put(plan.rice.porder, 3);
+        int32_t plen = n >> plan.rice.porder;
+        for (int32_t p = 0; p < (1 << plan.rice.porder); ++p){
+            int32_t k = plan.rice.params[p];
+            w.put(k, rice_param_bits);
+            for (int32_t i = (p == 0 ? plan.order : p * plen); i < (p + 1) * plen; ++i){
+                uint32_t u = zigzag(r[i]);
+                w.put_unary(u >> k);
+                w.put(u, k);
+            }
+        }
+    }
+}
+
+bool read_subframe(bit_reader& r, int32_t *x, int32_t n, int32_t width)
+{
+    auto type = r.get(2);
+    if (type == subframe_constant){
+        int32_t v = r.get_signed(width);
+        for (int32_t i = 0; i < n; ++i){
+            x[i] = v;
+        }
+    } else if (type == subframe_verbatim){
+        for (int32_t i = 0; i < n; ++i){
+            x[i] = r.get_signed(width);
+        }
+    } else if (type == subframe_fixed){
+        int32_t order = r.get(3);
+        if (order > max_fixed_order || order >= n){
+            return false;
+        }
+        for (int32_t i = 0; i < order; ++i){
+            x[i] = r.get_signed(width);
+        }
+        int32_t porder = r.get(3);
+        int32_t plen = n >> porder;
+        if ((plen << porder) != n || plen <= order){
+            return false;
+        }
+        for (int32_t p = 0; p < (1 << porder); ++p){
+            int32_t k = r.get(rice_param_bits);
+            if (k > max_rice_param){
+                return false;
+            }
+            for (int32_t i = (p == 0 ? order : p * plen); i < (p + 1) * plen; ++i){
+                uint32_t q = r.get_unary();
+                x[i] = unzigzag((q << k) | r.get(k));
+            }
+            if (r.error()){
+                return false;
+            }
+        }
+        fixed_restore(x, n, order);
+    } else {
+        return false;
+    }
+    return !r.error();
+}
+
+// decodes the channels of a block into c.samples
+bool read_block(codec& c, const char *buf, int32_t size, int32_t nframes)
+{
+    auto nchannels = c.format.header.nchannels;
+    auto width = bits_per_sample(c.format.bitdepth);
+    bit_reader r(buf, size);
+    for (int32_t ch = 0; ch < nchannels; ch += 2){
+        auto left = c.samples.data() + ch * nframes;
+        if (ch + 1 == nchannels){
+            if (!read_subframe(r, left, nframes, width)){
+                return false;
+            }
+            break;
+        }
+        auto right = left + nframes;
+        auto mode = r.get(2);
+        bool ok;
+        switch (mode){
+        case pair_left_side:
+            ok = read_subframe(r, left, nframes, width)
+                    && read_subframe(r, right, nframes, width + 1);
+            for (int32_t i = 0; ok && i < nframes; ++i){
+                right[i] = (int32_t)((uint32_t)left[i] - (uint32_t)right[i]);
+            }
+            break;
+        case pair_side_right:
+            ok = read_subframe(r, left, nframes, width + 1)
+                    && read_subframe(r, right, nframes, width);
+            for (int32_t i = 0; ok && i < nframes; ++i){
+                left[i] = (int32_t)((uint32_t)left[i] + (uint32_t)right[i]);
+            }
+            break;
+        case pair_mid_side:
+            ok = read_subframe(r, left, nframes, width)
+                    && read_subframe(r, right, nframes, width + 1);
+            for (int32_t i = 0; ok && i < nframes; ++i){
+                // the lowest bit of the sum is that of the side
+                int32_t side = right[i];
+                int64_t sum = (int64_t)left[i] * 2 + (side & 1);
+                left[i] = (int32_t)((sum + side) >> 1);
+                right[i] = (int32_t)((sum - side) >> 1);
+            }
+            break;
+        default:
+            ok = read_subframe(r, left, nframes, width)
+                    && read_subframe(r, right, nframes, width);
+            break;
+        }
+        if (!ok){
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int32_t codec_setformat(void *enc, aoo_format *f)
+{
+    if (strcmp(f->codec, AOO_CODEC_LOSSLESS)){
+        return 0;
+    }
+    auto c = static_cast<codec *>(enc);
+    auto fmt = reinterpret_cast<aoo_format_lossless *>(f);
+
+    // validate blocksize
+    if (fmt->header.blocksize <= 0){
+        LOG_WARNING("lossless: bad blocksize " << fmt->header.blocksize
+                    << ", using 64 samples");
+        fmt->header.blocksize = 64;
+    }
+    // validate samplerate
+    if (fmt->header.samplerate <= 0){
+        LOG_WARNING("lossless: bad samplerate " << fmt->header.samplerate
+                    << ", using 44100");
+        fmt->header.samplerate = 44100;
+    }
+    // validate channels
+    if (fmt->header.nchannels <= 0 || fmt->header.nchannels > 255){
+        LOG_WARNING("lossless: bad channel count " << fmt->header.nchannels
+                    << ", using 1 channel");
+        fmt->header.nchannels = 1;
+    }
+    // validate bitdepth
+    if (fmt->bitdepth < 0 || fmt->bitdepth >= AOO_LOSSLESS_BITDEPTH_SIZE){
+        LOG_WARNING("lossless: bad bitdepth, using 16bit");
+        fmt->bitdepth = AOO_LOSSLESS_INT16;
+    }
+
+    // save and print settings
+    memcpy(&c->format, fmt, sizeof(aoo_format_lossless));
+    c->format.header.codec = AOO_CODEC_LOSSLESS; // !
+    c->resize(fmt->header.blocksize, fmt->header.nchannels);
+    print_settings(c->format);
+
+    return 1;
+}
+
+int32_t codec_read(codec *c, aoo_format *fmt, const char *buf, int32_t size)
+{
+    if (size >= 4){
+        if (!strcmp(fmt->codec, AOO_CODEC_LOSSLESS) && fmt->blocksize > 0
+                && fmt->samplerate > 0)
+        {
+            aoo_format_lossless f;
+            memcpy(&f.header, fmt, sizeof(aoo_format));
+            f.bitdepth = aoo::from_bytes<int32_t>(buf);
+            f.header.codec = AOO_CODEC_LOSSLESS; // !
+            if (codec_setformat(c, &f.header)){
+                // it could have been modified during validation
+                memcpy(fmt, &c->format.header, sizeof(aoo_format));
+                return 4;
+            }
+        } else {
+            LOG_ERROR("lossless: bad format!");
+        }
+    } else {
+        LOG_ERROR("lossless: couldn't read format - not enough data!");
+    }
+    return -1;
+}
+
+int32_t encoder_readformat(void *enc, aoo_format *fmt,
+                           const char *buf, int32_t size)
+{
+    return codec_read(static_cast<codec *>(enc), fmt, buf, size);
+}
+
+int32_t decoder_readformat(void *dec, aoo_format *fmt,
+                           const char *buf, int32_t size)
+{
+    return codec_read(static_cast<codec *>(dec), fmt, buf, size);
+}
+
+int32_t codec_reset(void *enc) {
+    // nothing is carried over from one block to the next
+    return enc != nullptr;
+}
+
+int32_t codec_getformat(void *x, aoo_format_storage *f)
+{
+    auto c = static_cast<codec *>(x);
+    if (c->format.header.codec){
+        memcpy(f, &c->format, sizeof(aoo_format_lossless));
+        return sizeof(aoo_format_lossless);
+    } else {
+        return 0;
+    }
+}
+
+void *encoder_new(){
+    return new codec;
+}
+
+void encoder_free(void *enc){
+    delete (codec *)enc;
+}
+
+int32_t encoder_encode(void *enc,
+                       const aoo_sample *s, int32_t n,
+                       char *buf, int32_t size)
+{
+    auto c = static_cast<codec *>(enc);
+    auto nchannels = c->format.header.nchannels;
+    if (nchannels <= 0 || (n % nchannels) != 0){
+        return 0;
+    }
+    auto nframes = n / nchannels;
+    if ((int32_t)c->samples.size() < n){
+        c->resize(nframes, nchannels); // shouldn't happen
+    }
+
+    // the worst case: all verbatim, plus the headers
+    auto width = bits_per_sample(c->format.bitdepth);
+    auto maxbits = (int64_t)nframes * (nchannels * width + nchannels / 2)
+            + nchannels * 2 + nchannels;
+    if (size < (maxbits + 7) / 8){
+        return 0;
+    }
+
+    // quantize and deinterleave
+    auto quantize = c->format.bitdepth == AOO_LOSSLESS_INT24 ?
+                sample_to_int24 : sample_to_int16;
+    for (int32_t ch = 0; ch < nchannels; ++ch){
+        auto x = c->samples.data() + ch * nframes;
+        for (int32_t i = 0; i < nframes; ++i){
+            x[i] = quantize(s[i * nchannels + ch]);
+        }
+    }
+
+    bit_writer w(buf);
+    int64_t bits = 0;
+    for (int32_t ch = 0; ch < nchannels; ch += 2){
+        auto left = c->samples.data() + ch * nframes;
+        if (ch + 1 == nchannels){
+            subframe_plan plan;
+            plan_subframe(*c, left, nframes, width, plan);
+            write_subframe(*c, left, nframes, width, plan, w);
+            bits += plan.bits;
+            break;
+        }
+        auto right = left + nframes;
+        auto side = c->side.data();
+        auto mid = c->mid.data();
+        for (int32_t i = 0; i < nframes; ++i){
+            side[i] = left[i] - right[i];
+            mid[i] = (left[i] + right[i]) >> 1;
+        }
+        // the pair mode that gives the smallest block
+        subframe_plan l, r, sd, m;
+        plan_subframe(*c, left, nframes, width, l);
+        plan_subframe(*c, right, nframes, width, r);
+        plan_subframe(*c, side, nframes, width + 1, sd);
+        plan_subframe(*c, mid, nframes, width, m);
+        const int32_t *first = left, *second = right;
+        const subframe_plan *firstplan = &l, *secondplan = &r;
+        int32_t mode = pair_independent;
+        int64_t best = l.bits + r.bits;
+        if (l.bits + sd.bits < best){
+            mode = pair_left_side;
+            best = l.bits + sd.bits;
+            second = side;
+            secondplan = &sd;
+        }
+        if (sd.bits + r.bits < best){
+            mode = pair_side_right;
+            best = sd.bits + r.bits;
+            first = side;
+            firstplan = &sd;
+            second = right;
+            secondplan = &r;
+        }
+        if (m.bits + sd.bits < best){
+            mode = pair_mid_side;
+            best = m.bits + sd.bits;
+            first = mid;
+            firstplan = &m;
+            second = side;
+            secondplan = &sd;
+        }
+
+        w.put(mode, 2);
+        write_subframe(*c, first, nframes, first == side ? width + 1 : width, *firstplan, w);
+        write_subframe(*c, second, nframes, second == side ? width + 1 : width, *secondplan, w);
+        bits += 2 + best;
+    }
+    assert(bits <= maxbits);
+
+    return w.finish();
+}
+
+int32_t encoder_writeformat(void *enc, aoo_format *fmt,
+                            char *buf, int32_t size)
+{
+    if (size >= 4){
+        aoo_format_lossless * ofmt;
+        if (enc == nullptr) {
+            ofmt = reinterpret_cast<aoo_format_lossless *>(fmt);
+        }
+        else {
+            auto c = static_cast<codec *>(enc);
+            ofmt = &c->format;
+            memcpy(fmt, &ofmt->header, sizeof(aoo_format));
+        }
+        aoo::to_bytes<int32_t>(ofmt->bitdepth, buf);
+
+        return 4;
+    } else {
+        LOG_ERROR("lossless: couldn't write settings - buffer too small!");
+        return -1;
+    }
+}
+
+void *decoder_new(){
+    return new codec;
+}
+
+void decoder_free(void *dec){
+    delete (codec *)dec;
+}
+
+int32_t decoder_decode(void *dec,
+                       const char *buf, int32_t size,
+                       aoo_sample *s, int32_t n)
+{
+    auto c = static_cast<codec *>(dec);
+    assert(c->format.header.blocksize != 0);
+
+    if (!buf){
+        // no concealment, just silence
+        for (int i = 0; i < n; ++i){
+            s[i] = 0;
+        }
+        return n;
+    }
+
+    auto nchannels = c->format.header.nchannels;
+    if (nchannels <= 0 || (n % nchannels) != 0){
+        return -1;
+    }
+    auto nframes = n / nchannels;
+    if ((int32_t)c->samples.size() < n){
+        c->resize(nframes, nchannels); // shouldn't happen
+    }
+    if (!read_block(*c, buf, size, nframes)){
+        LOG_VERBOSE("lossless: corrupt block");
+        return -1;
+    }
+
+    // interleave and convert back
+    auto convert = c->format.bitdepth == AOO_LOSSLESS_INT24 ?
+                int24_to_sample : int16_to_sample;
+    for (int32_t ch = 0; ch < nchannels; ++ch){
+        auto x = c->samples.data() + ch * nframes;
+        for (int32_t i = 0; i < nframes; ++i){
+            s[i * nchannels + ch] = convert(x[i]);
+        }
+    }
+    return n;
+}
+
+aoo_codec codec_class = {
+    AOO_CODEC_LOSSLESS,
+    encoder_new,
+    encoder_free,
+    codec_setformat,
+    codec_getformat,
+    encoder_readformat,
+    encoder_writeformat,
+    encoder_encode,
+    codec_reset,
+    decoder_new,
+    decoder_free,
+    codec_setformat,
+    codec_getformat,
+    decoder_readformat,
+    decoder_decode,
+    codec_reset,
+    nullptr, // no packet loss hint
+    nullptr, // no FEC
+    nullptr  // fixed bitrate
+};
+
+} // namespace
+
+void aoo_codec_lossless_setup(aoo_codec_registerfn fn){
+    fn(AOO_CODEC_LOSSLESS, &codec_class);
+}
@@ -5,6 +5,7 @@
 #include "aoo/aoo_opus.h"
 #include "aoo/aoo_utils.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <memory>
@@ -47,7 +48,8 @@ void print_settings(const aoo_format_opus& f){
                 << ", bitrate = " << f.bitrate
                 << ", complexity = " << f.complexity
                 << ", application = " << apptype
-                << ", signal type = " << type);
+                << ", signal type = " << type
+                << ", coupled = " << f.coupled);
 }
 
 /*/////////////////////// codec base ////////////////////////*/
@@ -59,6 +61,47 @@ struct codec {
     aoo_format_opus format;
 };
 
+// drops the pairs which overlap or don't fit into the channels
+int32_t validate_coupled(int32_t coupled, int nchannels){
+    uint32_t result = 0;
+    int i = 0;
+    while (i < nchannels - 1 && i < 32){
+        if ((uint32_t)coupled & (1u << i)){
+            result |= (1u << i);
+            i += 2;
+        } else {
+            i++;
+        }
+    }
+    return (int32_t)result;
+}
+
+// the coupled streams come first (as opus wants it), each with the two
+// channels of its pair, then one mono stream for every other channel.
+// returns the number of coupled streams.
+int make_mapping(int nchannels, int32_t coupled, unsigned char *mapping){
+    int ncoupled = 0;
+    for (int i = 0; i < nchannels - 1 && i < 32; ++i){
+        if ((uint32_t)coupled & (1u << i)){
+            ncoupled++;
+        }
+    }
+    int pair = 0;
+    int mono = ncoupled * 2;
+    for (int i = 0; i < nchannels; ++i){
+        if (i < 32 && ((uint32_t)coupled & (1u << i))){
+            mapping[i] = pair * 2;
+            mapping[i + 1] = pair * 2 + 1;
+            pair++;
+            i++;
+        } else {
+            mapping[i] = mono++;
+        }
+    }
+    memset(mapping + nchannels, 255, 256 - nchannels);
+    return ncoupled;
+}
+
 void validate_format(aoo_format_opus& f)
 {
     // validate samplerate
@@ -100,6 +143,7 @@ void validate_format(aoo_format_opus& f)
     if (f.application_type == 0) {
         f.application_type = OPUS_APPLICATION_AUDIO;
     }
+    f.coupled = validate_coupled(f.coupled, f.header.nchannels);
     // bitrate, complexity and signal type should be validated by opus
 }
 
@@ -165,16 +209,14 @@ int32_t encoder_setformat(void *enc, aoo_format *f){
         opus_multistream_encoder_destroy(c->state);
     }
     // setup channel mapping
-    // only use decoupled streams (what's the point of coupled streams?)
+    // stereo pairs get a coupled stream, so the encoder can make use of
+    // what the two channels have in common, the rest are mono streams.
     auto nchannels = fmt->header.nchannels;
     unsigned char mapping[256];
-    for (int i = 0; i < nchannels; ++i){
-        mapping[i] = i;
-    }
-    memset(mapping + nchannels, 255, 256 - nchannels);
+    int ncoupled = make_mapping(nchannels, fmt->coupled, mapping);
     // create state
     c->state = opus_multistream_encoder_create(fmt->header.samplerate,
-                                       nchannels, nchannels, 0, mapping,
+                                       nchannels, nchannels - ncoupled, ncoupled, mapping,
                                        fmt->application_type, &error);
     if (error == OPUS_OK){
         assert(c->state != nullptr);
@@ -195,6 +237,12 @@ int32_t encoder_setformat(void *enc, aoo_format *f){
         // signal type
         opus_multistream_encoder_ctl(c->state, OPUS_SET_SIGNAL(fmt->signal_type));
         opus_multistream_encoder_ctl(c->state, OPUS_GET_SIGNAL(&fmt->signal_type));
+        // in-band FEC, only takes effect with a non-zero packet loss hint
+        // (and not in CELT-only/lowdelay mode).
+        opus_multistream_encoder_ctl(c->state, OPUS_SET_INBAND_FEC(1));
+        // DTX: during silence the encoder only emits tiny comfort noise
+        // frames, so sinks without silence suppression get much less data.
+        opus_multistream_encoder_ctl(c->state, OPUS_SET_DTX(1));
     } else {
         LOG_ERROR("Opus: opus_encoder_create() failed with error code " << error);
         return 0;
@@ -212,7 +260,7 @@ int32_t encoder_setformat(void *enc, aoo_format *f){
 
 int32_t encoder_writeformat(void *enc, aoo_format *fmt,
                             char *buf, int32_t size){
-    if (size >= 16){
+    if (size >= 20){
         // if encoder is null we assume the format passed in
         // is actually a reference to an aoo_format_opus,
         // and this call is used for serialization purposes
@@ -229,7 +277,8 @@ int32_t encoder_writeformat(void *enc, aoo_format *fmt,
         aoo::to_bytes<int32_t>(ofmt->complexity, buf + 4);
         aoo::to_bytes<int32_t>(ofmt->signal_type, buf + 8);
         aoo::to_bytes<int32_t>(ofmt->application_type, buf + 12);
-        return 16;
+        aoo::to_bytes<int32_t>(ofmt->coupled, buf + 16);
+        return 20;
     } else {
         LOG_WARNING("Opus: couldn't write settings");
         return -1;
@@ -257,6 +306,13 @@ int32_t encoder_readformat(void *enc, aoo_format *fmt,
         } else {
             f.application_type = OPUS_APPLICATION_AUDIO;
         }
+        // older sources only have uncoupled streams
+        if (size >= 20) {
+            f.coupled = aoo::from_bytes<int32_t>(buf + 16);
+            retsize = 20;
+        } else {
+            f.coupled = 0;
+        }
         
         if (encoder_setformat(c, reinterpret_cast<aoo_format *>(&f))){
             // it could have been modified during validation, need to re-write the base format of 
@@ -282,6 +338,48 @@ int32_t encoder_reset(void *enc) {
     return 0;
 }
 
+int32_t encoder_setpacketloss(void *enc, int32_t percent) {
+    auto c = static_cast<encoder *>(enc);
+    if (c->state){
+        if (percent < 0){
+            percent = 0;
+        } else if (percent > 100){
+            percent = 100;
+        }
+        opus_multistream_encoder_ctl(c->state, OPUS_SET_PACKET_LOSS_PERC(percent));
+        LOG_VERBOSE("Opus: expected packet loss " << percent << "%");
+        return 1;
+    }
+    return 0;
+}
+
+int32_t encoder_setbitrate(void *enc, int32_t bitrate) {
+    auto c = static_cast<encoder *>(enc);
+    if (c->state){
+        if (bitrate <= 0){
+            bitrate = c->format.bitrate;
+        }
+        opus_multistream_encoder_ctl(c->state, OPUS_SET_BITRATE(bitrate));
+        LOG_VERBOSE("Opus: bitrate " << bitrate);
+        return 1;
+    }
+    return 0;
+}
+
+int32_t encoder_setcomplexity(void *enc, int32_t complexity) {
+    auto c = static_cast<encoder *>(enc);
+    if (c->state){
+        if (complexity < 0){
+            complexity = c->format.complexity;
+        }
+        complexity = std::min<int32_t>(10, complexity);
+        opus_multistream_encoder_ctl(c->state, OPUS_SET_COMPLEXITY(complexity));
+        LOG_VERBOSE("Opus: complexity " << complexity);
+        return 1;
+    }
+    return 0;
+}
+
 
 /*/////////////////////// decoder ///////////////////////////*/
 
@@ -321,13 +419,34 @@ int32_t decoder_decode(void *dec,
     return 0;
 }
 
+// decode the lost block *before* the given block from its LBRR data.
+// falls back to PLC if the block doesn't contain any.
+int32_t decoder_decodefec(void *dec,
+                          const char *buf, int32_t size,
+                          aoo_sample *s, int32_t n)
+{
+    auto c = static_cast<decoder *>(dec);
+    if (c->state){
+        auto framesize = n / c->format.header.nchannels;
+        auto result = opus_multistream_decode_float(
+                    c->state, (const unsigned char *)buf, size, s, framesize, 1);
+        if (result > 0){
+            return result;
+        } else if (result < 0) {
+            LOG_VERBOSE("Opus: opus_decode_float() (FEC) failed with error code " << result);
+            return result;
+        }
+    }
+    return 0;
+}
+
 bool decoder_dosetformat(decoder *c, aoo_format_opus& f){
     if (c->state){
         opus_multistream_decoder_destroy(c->state);
     }
     int error = 0;
     // setup channel mapping
-    // only use decoupled streams (what's the point of coupled streams?)
+    // the same as the encoder's, see make_mapping()
 
     // validate nchannels (we might not call validate_format())
     // the rest is validated by opus
@@ -336,14 +455,12 @@ bool decoder_dosetformat(decoder *c, aoo_format_opus& f){
         LOG_WARNING("Opus: channel count " << nchannels << " out of range");
         return false;
     }
+    f.coupled = validate_coupled(f.coupled, nchannels);
     unsigned char mapping[256];
-    for (int i = 0; i < nchannels; ++i){
-        mapping[i] = i;
-    }
-    memset(mapping + nchannels, 255, 256 - nchannels);
+    int ncoupled = make_mapping(nchannels, f.coupled, mapping);
     // create state
     c->state = opus_multistream_decoder_create(f.header.samplerate,
-                                       nchannels, nchannels, 0, mapping,
+                                       nchannels, nchannels - ncoupled, ncoupled, mapping,
                                        &error);
     if (error == OPUS_OK){
         assert(c->state != nullptr);
@@ -407,6 +524,13 @@ int32_t decoder_readformat(void *dec, aoo_format *fmt,
         } else {
             f.application_type = OPUS_APPLICATION_AUDIO;
         }
+        // older sources only have uncoupled streams
+        if (size >= 20) {
+            f.coupled = aoo::from_bytes<int32_t>(buf + 16);
+            retsize = 20;
+        } else {
+            f.coupled = 0;
+        }
         
         if (decoder_dosetformat(c, f)){
             return retsize; // number of bytes
@@ -445,7 +569,11 @@ aoo_codec codec_class = {
     decoder_getformat,
     decoder_readformat,
     decoder_decode,
-    decoder_reset
+    decoder_reset,
+    encoder_setpacketloss,
+    decoder_decodefec,
+    encoder_setbitrate,
+    encoder_setcomplexity
 };
 
 } // namespace
@@ -5,8 +5,12 @@
 #include "aoo/aoo_pcm.h"
 #include "aoo/aoo_utils.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <cstring>
+#include <type_traits>
+#include <vector>
 
 namespace {
 
@@ -40,8 +44,9 @@ int32_t bytes_per_sample(int32_t bd)
 void sample_to_int16(aoo_sample in, char *out)
 {
     convert c;
-    int32_t temp = in * 0x7fff + 0.5f;
-    c.i16 = (temp > INT16_MAX) ? INT16_MAX : (temp < INT16_MIN) ? INT16_MIN : temp;
+    // clamp before converting, so that values out of range don't overflow
+    float temp = in * 0x7fff + 0.5f;
+    c.i16 = (temp >= INT16_MAX) ? INT16_MAX : (temp <= INT16_MIN) ? INT16_MIN : (int16_t)temp;
 #if BYTE_ORDER == BIG_ENDIAN
     memcpy(out, c.b, 2); // optimized away
 #else
@@ -53,8 +58,9 @@ void sample_to_int16(aoo_sample in, char *out)
 void sample_to_int24(aoo_sample in, char *out)
 {
     convert c;
-    int32_t temp = in * 0x7fffffff + 0.5f;
-    c.i32 = (temp > INT32_MAX) ? INT32_MAX : (temp < INT32_MIN) ? INT32_MIN : temp;
+    // clamp before converting, full scale (2^31 as a float) doesn't fit into an int32_t
+    float temp = in * 0x7fffffff + 0.5f;
+    c.i32 = (temp >= 2147483648.f) ? INT32_MAX : (temp <= -2147483648.f) ? INT32_MIN : (int32_t)temp;
     // only copy the highest 3 bytes!
 #if BYTE_ORDER == BIG_ENDIAN
     out[0] = c.b[0];
@@ -116,6 +122,506 @@ aoo_sample float64_to_sample(const char *in)
     return aoo::from_bytes<double>(in);
 }
 
+/*//////////////////// block conversion //////////////////////////*/
+
+// Whole blocks are converted with SIMD on x86 (SSSE3 and AVX2, picked at
+// runtime) and ARM64 (NEON). Each kernel gives exactly the same bytes and
+// samples as the per-sample functions above, which do the rest of a block
+// and everything on other CPUs and on big endian machines. The multiply and
+// the add are kept apart (no FMA), so the results round the same as well.
+
+using encode_fn = void (*)(const aoo_sample *in, char *out, int32_t n);
+using decode_fn = void (*)(const char *in, aoo_sample *out, int32_t n);
+
+template<void (*fn)(aoo_sample, char *), int32_t size>
+void encode_scalar(const aoo_sample *in, char *out, int32_t n){
+    for (int32_t i = 0; i < n; ++i){
+        fn(in[i], out + i * size);
+    }
+}
+
+template<aoo_sample (*fn)(const char *), int32_t size>
+void decode_scalar(const char *in, aoo_sample *out, int32_t n){
+    for (int32_t i = 0; i < n; ++i){
+        out[i] = fn(in + i * size);
+    }
+}
+
+// AOO_PCM_SIMD=0 leaves out the SIMD kernels, e.g. for double samples
+#ifndef AOO_PCM_SIMD
+ #define AOO_PCM_SIMD 1
+#endif
+
+#if AOO_PCM_SIMD && BYTE_ORDER == LITTLE_ENDIAN
+ #if defined(__i386__) || defined(_M_IX86) || defined(__x86_64__) || defined(_M_X64)
+  #define PCM_SIMD_X86 1
+  #include <immintrin.h>
+  #if defined(_MSC_VER) && !defined(__clang__)
+   #include <intrin.h>
+   #define PCM_TARGET_SSSE3
+   #define PCM_TARGET_AVX2
+  #else
+   #define PCM_TARGET_SSSE3 __attribute__((target("ssse3")))
+   #define PCM_TARGET_AVX2 __attribute__((target("avx2")))
+  #endif
+ #elif defined(__aarch64__) || defined(_M_ARM64)
+  #define PCM_SIMD_NEON 1
+  #include <arm_neon.h>
+ #endif
+#endif
+
+#if PCM_SIMD_X86 || PCM_SIMD_NEON
+static_assert(std::is_same<aoo_sample, float>::value,
+              "the PCM SIMD kernels need float samples, build with AOO_PCM_SIMD=0");
+#endif
+
+// the scale factors of the per-sample functions, as floats
+const float int16_scale = 32767.f;      // 0x7fff
+const float int24_scale = 2147483648.f; // 0x7fffffff
+// the largest float below 2^31, converts to 0x7fffff80
+const float int24_max = 2147483520.f;
+
+#if PCM_SIMD_X86
+
+// byte shuffles
+#define PCM_BSWAP16 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14
+#define PCM_BSWAP32 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+#define PCM_BSWAP64 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8
+// the highest 3 bytes of 4 int32, big endian, into the lowest 12 bytes
+#define PCM_PACK24 3, 2, 1, 7, 6, 5, 11, 10, 9, 15, 14, 13, -1, -1, -1, -1
+// 4 big endian 24 bit values into the highest 3 bytes of 4 int32
+#define PCM_UNPACK24 -1, 2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9
+
+/*/// SSSE3 ///*/
+
+PCM_TARGET_SSSE3
+void encode_int16_ssse3(const aoo_sample *in, char *out, int32_t n){
+    const __m128 scale = _mm_set1_ps(int16_scale);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 lo = _mm_set1_ps(-32768.f);
+    const __m128 hi = _mm_set1_ps(32767.f);
+    const __m128i bswap = _mm_setr_epi8(PCM_BSWAP16);
+    int32_t i = 0;
+    for (; i + 8 <= n; i += 8){
+        __m128 a = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(in + i), scale), half);
+        __m128 b = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4), scale), half);
+        a = _mm_min_ps(_mm_max_ps(a, lo), hi);
+        b = _mm_min_ps(_mm_max_ps(b, lo), hi);
+        __m128i v = _mm_packs_epi32(_mm_cvttps_epi32(a), _mm_cvttps_epi32(b));
+        _mm_storeu_si128((__m128i *)(out + i * 2), _mm_shuffle_epi8(v, bswap));
+    }
+    encode_scalar<sample_to_int16, 2>(in + i, out + i * 2, n - i);
+}
+
+PCM_TARGET_SSSE3
+void encode_int24_ssse3(const aoo_sample *in, char *out, int32_t n){
+    const __m128 scale = _mm_set1_ps(int24_scale);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 lo = _mm_set1_ps(-2147483648.f);
+    const __m128 hi = _mm_set1_ps(int24_max);
+    const __m128i pack = _mm_setr_epi8(PCM_PACK24);
+    int32_t i = 0;
+    for (; i + 4 <= n; i += 4){
+        __m128 a = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(in + i), scale), half);
+        a = _mm_min_ps(_mm_max_ps(a, lo), hi);
+        __m128i v = _mm_shuffle_epi8(_mm_cvttps_epi32(a), pack);
+        // 12 bytes
+        _mm_storel_epi64((__m128i *)(out + i * 3), v);
+        int32_t last = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+        memcpy(out + i * 3 + 8, &last, 4);
+    }
+    encode_scalar<sample_to_int24, 3>(in + i, out + i * 3, n - i);
+}
+
+PCM_TARGET_SSSE3
+void encode_float32_ssse3(const aoo_sample *in, char *out, int32_t n){
+    const __m128i bswap = _mm_setr_epi8(PCM_BSWAP32);
+    int32_t i = 0;
+    for (; i + 4 <= n; i += 4){
+        __m128i v = _mm_castps_si128(_mm_loadu_ps(in + i));
+        _mm_storeu_si128((__m128i *)(out + i * 4), _mm_shuffle_epi8(v, bswap));
+    }
+    encode_scalar<sample_to_float32, 4>(in + i, out + i * 4, n - i);
+}
+
+PCM_TARGET_SSSE3
+void encode_float64_ssse3(const aoo_sample *in, char *out, int32_t n){
+    const __m128i bswap = _mm_setr_epi8(PCM_BSWAP64);
+    int32_t i = 0;
+    for (; i + 4 <= n; i += 4){
+        __m128 x = _mm_loadu_ps(in + i);
+        __m128i d0 = _mm_castpd_si128(_mm_cvtps_pd(x));
+        __m128i d1 = _mm_castpd_si128(_mm_cvtps_pd(_mm_movehl_ps(x, x)));
+        _mm_storeu_si128((__m128i *)(out + i * 8), _mm_shuffle_epi8(d0, bswap));
+        _mm_storeu_si128((__m128i *)(out + i * 8 + 16), _mm_shuffle_epi8(d1, bswap));
+    }
+    encode_scalar<sample_to_float64, 8>(in + i, out + i * 8, n - i);
+}
+
+PCM_TARGET_SSSE3
+void decode_int16_ssse3(const char *in, aoo_sample *out, int32_t n){
+    const __m128 scale = _mm_set1_ps(1.f / 32768.f);
+    const __m128i bswap = _mm_setr_epi8(PCM_BSWAP16);
+    int32_t i = 0;
+    for (; i + 8 <= n; i += 8){
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + i * 2)), bswap);
+        // sign extend to int32
+        __m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(a), scale));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(b), scale));
+    }
+    decode_scalar<int16_to_sample, 2>(in + i * 2, out + i, n - i);
+}
+
+PCM_TARGET_SSSE3
+void decode_int24_ssse3(const char *in, aoo_sample *out, int32_t n){
+    const __m128 scale = _mm_set1_ps(1.f / int24_scale);
+    const __m128i unpack = _mm_setr_epi8(PCM_UNPACK24);
+    int32_t i = 0;
+    // 4 samples at a time, but the loads take 16 bytes
+    for (; i + 6 <= n; i += 4){
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + i * 3)), unpack);
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+    }
+    decode_scalar<int24_to_sample, 3>(in + i * 3, out + i, n - i);
+}
+
+PCM_TARGET_SSSE3
+void decode_float32_ssse3(const char *in, aoo_sample *out, int32_t n){
+    const __m128i bswap = _mm_setr_epi8(PCM_BSWAP32);
+    int32_t i = 0;
+    for (; i + 4 <= n; i += 4){
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + i * 4)), bswap);
+        _mm_storeu_ps(out + i, _mm_castsi128_ps(v));
+    }
+    decode_scalar<float32_to_sample, 4>(in + i * 4, out + i, n - i);
+}
+
+PCM_TARGET_SSSE3
+void decode_float64_ssse3(const char *in, aoo_sample *out, int32_t n){
+    const __m128i bswap = _mm_setr_epi8(PCM_BSWAP64);
+    int32_t i = 0;
+    for (; i + 4 <= n; i += 4){
+        __m128i d0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + i * 8)), bswap);
+        __m128i d1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + i * 8 + 16)), bswap);
+        __m128 a = _mm_cvtpd_ps(_mm_castsi128_pd(d0));
+        __m128 b = _mm_cvtpd_ps(_mm_castsi128_pd(d1));
+        _mm_storeu_ps(out + i, _mm_movelh_ps(a, b));
+    }
+    decode_scalar<float64_to_sample, 8>(in + i * 8, out + i, n - i);
+}
+
+/*/// AVX2 ///*/
+
+// the byte shuffles work within each 128 bit lane
+
+PCM_TARGET_AVX2
+void encode_int16_avx2(const aoo_sample *in, char *out, int32_t n){
+    const __m256 scale = _mm256_set1_ps(int16_scale);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 lo = _mm256_set1_ps(-32768.f);
+    const __m256 hi = _mm256_set1_ps(32767.f);
+    const __m256i bswap = _mm256_setr_epi8(PCM_BSWAP16, PCM_BSWAP16);
+    int32_t i = 0;
+    for (; i + 16 <= n; i += 16){
+        __m256 a = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i), scale), half);
+        __m256 b = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i + 8), scale), half);
+        a = _mm256_min_ps(_mm256_max_ps(a, lo), hi);
+        b = _mm256_min_ps(_mm256_max_ps(b, lo), hi);
+        // packs works per lane: a0-3 b0-3 a4-7 b4-7 -> a0-7 b0-7
+        __m256i v = _mm256_packs_epi32(_mm256_cvttps_epi32(a), _mm256_cvttps_epi32(b));
+        v = _mm256_permute4x64_epi64(v, 0xd8);
+        _mm256_storeu_si256((__m256i *)(out + i * 2), _mm256_shuffle_epi8(v, bswap));
+    }
+    encode_int16_ssse3(in + i, out + i * 2, n - i);
+}
+
+PCM_TARGET_AVX2
+void encode_int24_avx2(const aoo_sample *in, char *out, int32_t n){
+    const __m256 scale = _mm256_set1_ps(int24_scale);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 lo = _mm256_set1_ps(-2147483648.f);
+    const __m256 hi = _mm256_set1_ps(int24_max);
+    const __m256i pack = _mm256_setr_epi8(PCM_PACK24, PCM_PACK24);
+    // the 12 bytes of each lane next to each other
+    const __m256i join = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+    int32_t i = 0;
+    for (; i + 8 <= n; i += 8){
+        __m256 a = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i), scale), half);
+        a = _mm256_min_ps(_mm256_max_ps(a, lo), hi);
+        __m256i v = _mm256_shuffle_epi8(_mm256_cvttps_epi32(a), pack);
+        v = _mm256_permutevar8x32_epi32(v, join);
+        // 24 bytes
+        _mm_storeu_si128((__m128i *)(out + i * 3), _mm256_castsi256_si128(v));
+        _mm_storel_epi64((__m128i *)(out + i * 3 + 16), _mm256_extracti128_si256(v, 1));
+    }
+    encode_int24_ssse3(in + i, out + i * 3, n - i);
+}
+
+PCM_TARGET_AVX2
+void encode_float32_avx2(const aoo_sample *in, char *out, int32_t n){
+    const __m256i bswap = _mm256_setr_epi8(PCM_BSWAP32, PCM_BSWAP32);
+    int32_t i = 0;
+    for (; i + 8 <= n; i += 8){
+        __m256i v = _mm256_castps_si256(_mm256_loadu_ps(in + i));
+        _mm256_storeu_si256((__m256i *)(out + i * 4), _mm256_shuffle_epi8(v, bswap));
+    }
+    encode_float32_ssse3(in + i, out + i * 4, n - i);
+}
+
+PCM_TARGET_AVX2
+void encode_float64_avx2(const aoo_sample *in, char *out, int32_t n){
+    const __m256i bswap = _mm256_setr_epi8(PCM_BSWAP64, PCM_BSWAP64);
+    int32_t i = 0;
+    for (; i + 8 <= n; i += 8){
+        __m256i d0 = _mm256_castpd_si256(_mm256_cvtps_pd(_mm_loadu_ps(in + i)));
+        __m256i d1 = _mm256_castpd_si256(_mm256_cvtps_pd(_mm_loadu_ps(in + i + 4)));
+        _mm256_storeu_si256((__m256i *)(out + i * 8), _mm256_shuffle_epi8(d0, bswap));
+        _mm256_storeu_si256((__m256i *)(out + i * 8 + 32), _mm256_shuffle_epi8(d1, bswap));
+    }
+    encode_float64_ssse3(in + i, out + i * 8, n - i);
+}
+
+PCM_TARGET_AVX2
+void decode_int16_avx2(const char *in, aoo_sample *out, int32_t n){
+    const __m256 scale = _mm256_set1_ps(1.f / 32768.f);
+    const __m256i bswap = _mm256_setr_epi8(PCM_BSWAP16, PCM_BSWAP16);
+    int32_t i = 0;
+    for (; i + 16 <= n; i += 16){
+        __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(in + i * 2)), bswap);
+        __m256i a = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(v));
+        __m256i b = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(a), scale));
+        _mm256_storeu_ps(out + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(b), scale));
+    }
+    decode_int16_ssse3(in + i * 2, out + i, n - i);
+}
+
+PCM_TARGET_AVX2
+void decode_int24_avx2(const char *in, aoo_sample *out, int32_t n){
+    const __m256 scale = _mm256_set1_ps(1.f / int24_scale);
+    const __m256i unpack = _mm256_setr_epi8(PCM_UNPACK24, PCM_UNPACK24);
+    // bytes 0-11 into the first lane, 12-23 into the second
+    const __m256i split = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+    int32_t i = 0;
+    // 8 samples at a time, but the loads take 32 bytes
+    for (; i + 11 <= n; i += 8){
+        __m256i v = _mm256_loadu_si256((const __m256i *)(in + i * 3));
+        v = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(v, split), unpack);
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+    decode_int24_ssse3(in + i * 3, out + i, n - i);
+}
+
+PCM_TARGET_AVX2
+void decode_float32_avx2(const char *in, aoo_sample *out, int32_t n){
+    const __m256i bswap = _mm256_setr_epi8(PCM_BSWAP32, PCM_BSWAP32);
+    int32_t i = 0;
+    for (; i + 8 <= n; i += 8){
+        __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(in + i * 4)), bswap);
+        _mm256_storeu_ps(out + i, _mm256_castsi256_ps(v));
+    }
+    decode_float32_ssse3(in + i * 4, out + i, n - i);
+}
+
+PCM_TARGET_AVX2
+void decode_float64_avx2(const char *in, aoo_sample *out, int32_t n){
+    const __m256i bswap = _mm256_setr_epi8(PCM_BSWAP64, PCM_BSWAP64);
+    int32_t i = 0;
+    for (; i + 8 <= n; i += 8){
+        __m256i d0 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(in + i * 8)), bswap);
+        __m256i d1 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(in + i * 8 + 32)), bswap);
+        _mm_storeu_ps(out + i, _mm256_cvtpd_ps(_mm256_castsi256_pd(d0)));
+        _mm_storeu_ps(out + i + 4, _mm256_cvtpd_ps(_mm256_castsi256_pd(d1)));
+    }
+    decode_float64_ssse3(in + i * 8, out + i, n - i);
+}
+
+#if defined(_MSC_VER) && !defined(__clang__)
+
+bool cpu_has_ssse3(){
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+}
+
+bool cpu_has_avx2(){
+    int info[4];
+    __cpuid(info, 0);
+    const int maxleaf = info[0];
+    __cpuid(info, 1);
+    // the OS also has to save the YMM registers
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (!osxsave || maxleaf < 7 || (_xgetbv(0) & 6) != 6){
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+}
+
+#else
+
+bool cpu_has_ssse3(){
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3");
+}
+
+bool cpu_has_avx2(){
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif
+
+#endif // PCM_SIMD_X86
+
+#if PCM_SIMD_NEON
+
+void encode_int16_neon(const aoo_sample *in, char *out, int32_t n){
+    const float32x4_t scale = vdupq_n_f32(int16_scale);
+    const float32x4_t half = vdupq_n_f32(0.5f);
+    const float32x4_t lo = vdupq_n_f32(-32768.f);
+    const float32x4_t hi = vdupq_n_f32(32767.f);
+    int32_t i = 0;
+    for (; i + 8 <= n; i += 8){
+        float32x4_t a = vaddq_f32(vmulq_f32(vld1q_f32(in + i), scale), half);
+        float32x4_t b = vaddq_f32(vmulq_f32(vld1q_f32(in + i + 4), scale), half);
+        a = vminq_f32(vmaxq_f32(a, lo), hi);
+        b = vminq_f32(vmaxq_f32(b, lo), hi);
+        // vcvtq rounds towards zero, like the cast
+        int16x8_t v = vcombine_s16(vqmovn_s32(vcvtq_s32_f32(a)), vqmovn_s32(vcvtq_s32_f32(b)));
+        vst1q_u8((uint8_t *)(out + i * 2), vrev16q_u8(vreinterpretq_u8_s16(v)));
+    }
+    encode_scalar<sample_to_int16, 2>(in + i, out + i * 2, n - i);
+}
+
+void encode_int24_neon(const aoo_sample *in, char *out, int32_t n){
+    const float32x4_t scale = vdupq_n_f32(int24_scale);
+    const float32x4_t half = vdupq_n_f32(0.5f);
+    const float32x4_t lo = vdupq_n_f32(-2147483648.f);
+    const float32x4_t hi = vdupq_n_f32(int24_max);
+    const uint8_t packbytes[16] = { 3, 2, 1, 7, 6, 5, 11, 10, 9, 15, 14, 13, 255, 255, 255, 255 };
+    const uint8x16_t pack = vld1q_u8(packbytes);
+    int32_t i = 0;
+    for (; i + 4 <= n; i += 4){
+        float32x4_t a = vaddq_f32(vmulq_f32(vld1q_f32(in + i), scale), half);
+        a = vminq_f32(vmaxq_f32(a, lo), hi);
+        uint8x16_t v = vqtbl1q_u8(vreinterpretq_u8_s32(vcvtq_s32_f32(a)), pack);
+        // 12 bytes
+        vst1_u8((uint8_t *)(out + i * 3), vget_low_u8(v));
+        vst1q_lane_u32((uint32_t *)(void *)(out + i * 3 + 8), vreinterpretq_u32_u8(v), 2);
+    }
+    encode_scalar<sample_to_int24, 3>(in + i, out + i * 3, n - i);
+}
+
+void encode_float32_neon(const aoo_sample *in, char *out, int32_t n){
+    int32_t i = 0;
+    for (; i + 4 <= n; i += 4){
+        uint8x16_t v = vreinterpretq_u8_f32(vld1q_f32(in + i));
+        vst1q_u8((uint8_t *)(out + i * 4), vrev32q_u8(v));
+    }
+    encode_scalar<sample_to_float32, 4>(in + i, out + i * 4, n - i);
+}
+
+void encode_float64_neon(const aoo_sample *in, char *out, int32_t n){
+    int32_t i = 0;
+    for (; i + 4 <= n; i += 4){
+        float32x4_t x = vld1q_f32(in + i);
+        uint8x16_t d0 = vreinterpretq_u8_f64(vcvt_f64_f32(vget_low_f32(x)));
+        uint8x16_t d1 = vreinterpretq_u8_f64(vcvt_high_f64_f32(x));
+        vst1q_u8((uint8_t *)(out + i * 8), vrev64q_u8(d0));
+        vst1q_u8((uint8_t *)(out + i * 8 + 16), vrev64q_u8(d1));
+    }
+    encode_scalar<sample_to_float64, 8>(in + i, out + i * 8, n - i);
+}
+
+void decode_int16_neon(const char *in, aoo_sample *out, int32_t n){
+    const float32x4_t scale = vdupq_n_f32(1.f / 32768.f);
+    int32_t i = 0;
+    for (; i + 8 <= n; i += 8){
+        int16x8_t v = vreinterpretq_s16_u8(vrev16q_u8(vld1q_u8((const uint8_t *)(in + i * 2))));
+        float32x4_t a = vcvtq_f32_s32(vmovl_s16(vget_low_s16(v)));
+        float32x4_t b = vcvtq_f32_s32(vmovl_high_s16(v));
+        vst1q_f32(out + i, vmulq_f32(a, scale));
+        vst1q_f32(out + i + 4, vmulq_f32(b, scale));
+    }
+    decode_scalar<int16_to_sample, 2>(in + i * 2, out + i, n - i);
+}
+
+void decode_int24_neon(const char *in, aoo_sample *out, int32_t n){
+    const float32x4_t scale = vdupq_n_f32(1.f / int24_scale);
+    // out of range indices give zero
+    const uint8_t unpackbytes[16] = { 255, 2, 1, 0, 255, 5, 4, 3, 255, 8, 7, 6, 255, 11, 10, 9 };
+    const uint8x16_t unpack = vld1q_u8(unpackbytes);
+    int32_t i = 0;
+    // 4 samples at a time, but the loads take 16 bytes
+    for (; i + 6 <= n; i += 4){
+        uint8x16_t v = vqtbl1q_u8(vld1q_u8((const uint8_t *)(in + i * 3)), unpack);
+        float32x4_t a = vcvtq_f32_s32(vreinterpretq_s32_u8(v));
+        vst1q_f32(out + i, vmulq_f32(a, scale));
+    }
+    decode_scalar<int24_to_sample, 3>(in + i * 3, out + i, n - i);
+}
+
+void decode_float32_neon(const char *in, aoo_sample *out, int32_t n){
+    int32_t i = 0;
+    for (; i + 4 <= n; i += 4){
+        uint8x16_t v = vrev32q_u8(vld1q_u8((const uint8_t *)(in + i * 4)));
+        vst1q_f32(out + i, vreinterpretq_f32_u8(v));
+    }
+    decode_scalar<float32_to_sample, 4>(in + i * 4, out + i, n - i);
+}
+
+void decode_float64_neon(const char *in, aoo_sample *out, int32_t n){
+    int32_t i = 0;
+    for (; i + 4 <= n; i += 4){
+        float64x2_t d0 = vreinterpretq_f64_u8(vrev64q_u8(vld1q_u8((const uint8_t *)(in + i * 8))));
+        float64x2_t d1 = vreinterpretq_f64_u8(vrev64q_u8(vld1q_u8((const uint8_t *)(in + i * 8 + 16))));
+        vst1q_f32(out + i, vcvt_high_f32_f64(vcvt_f32_f64(d0), d1));
+    }
+    decode_scalar<float64_to_sample, 8>(in + i * 8, out + i, n - i);
+}
+
+#endif // PCM_SIMD_NEON
+
+struct pcm_kernels {
+    encode_fn encode[AOO_PCM_BITDEPTH_SIZE];
+    decode_fn decode[AOO_PCM_BITDEPTH_SIZE];
+};
+
+pcm_kernels select_kernels(){
+#if PCM_SIMD_X86
+    if (cpu_has_avx2()){
+        LOG_VERBOSE("PCM: using AVX2 conversion");
+        return {
+            { encode_int16_avx2, encode_int24_avx2, encode_float32_avx2, encode_float64_avx2 },
+            { decode_int16_avx2, decode_int24_avx2, decode_float32_avx2, decode_float64_avx2 }
+        };
+    }
+    if (cpu_has_ssse3()){
+        LOG_VERBOSE("PCM: using SSSE3 conversion");
+        return {
+            { encode_int16_ssse3, encode_int24_ssse3, encode_float32_ssse3, encode_float64_ssse3 },
+            { decode_int16_ssse3, decode_int24_ssse3, decode_float32_ssse3, decode_float64_ssse3 }
+        };
+    }
+#elif PCM_SIMD_NEON
+    return {
+        { encode_int16_neon, encode_int24_neon, encode_float32_neon, encode_float64_neon },
+        { decode_int16_neon, decode_int24_neon, decode_float32_neon, decode_float64_neon }
+    };
+#endif
+    return {
+        { encode_scalar<sample_to_int16, 2>, encode_scalar<sample_to_int24, 3>,
+          encode_scalar<sample_to_float32, 4>, encode_scalar<sample_to_float64, 8> },
+        { decode_scalar<int16_to_sample, 2>, decode_scalar<int24_to_sample, 3>,
+          decode_scalar<float32_to_sample, 4>, decode_scalar<float64_to_sample, 8> }
+    };
+}
+
+const pcm_kernels kernels = select_kernels();
+
 void print_settings(const aoo_format_pcm& f)
 {
     LOG_VERBOSE("PCM settings: "
@@ -125,6 +631,171 @@ void print_settings(const aoo_format_pcm& f)
                 << ", bitdepth = " << bytes_per_sample(f.bitdepth));
 }
 
+/*//////////////////// concealment //////////////////////////*/
+
+// Lost blocks are filled in by repeating the last pitch period of what came
+// before (waveform substitution, much like G.711 Appendix I), at full level
+// for the first 10 ms, then fading out until it is silent after 60 ms, which
+// is about as long as it can pass for the real thing. The first block after
+// the gap is cross-faded in from where the substitution would have gone on.
+class concealer {
+public:
+    void setup(int32_t nchannels, int32_t samplerate){
+        nchannels_ = std::max<int32_t>(1, nchannels);
+        samplerate = std::max<int32_t>(1, samplerate);
+        // look for periods from 2.5 ms (400 Hz) to 20 ms (50 Hz), higher
+        // pitches just end up with a multiple of theirs
+        minperiod_ = std::max<int32_t>(1, samplerate / 400);
+        maxperiod_ = std::max<int32_t>(minperiod_ + 1, samplerate / 50);
+        window_ = maxperiod_ / 2;
+        historyframes_ = maxperiod_ + window_;
+        decimation_ = std::max<int32_t>(1, samplerate / 8000);
+        fullframes_ = samplerate / 100;
+        fadeframes_ = samplerate / 20;
+        xfadeframes_ = samplerate / 200;
+        history_.assign(historyframes_ * nchannels_, 0);
+        reset();
+    }
+
+    void reset(){
+        filled_ = 0;
+        period_ = 0;
+        phase_ = 0;
+        lost_ = 0;
+    }
+
+    // a block that came in, decoded into s
+    void add(aoo_sample *s, int32_t nframes){
+        if (history_.empty()){
+            return;
+        }
+        if (lost_ > 0){
+            if (period_ > 0){
+                const int32_t n = std::min(nframes, xfadeframes_);
+                for (int32_t i = 0; i < n; ++i){
+                    const float w = (float)(i + 1) / (float)(n + 1);
+                    const float g = level(lost_ + i) * (1.f - w);
+                    const aoo_sample *sub = substitution();
+                    for (int32_t ch = 0; ch < nchannels_; ++ch){
+                        s[i * nchannels_ + ch] = s[i * nchannels_ + ch] * w + sub[ch] * g;
+                    }
+                    phase_ = (phase_ + 1) % period_;
+                }
+            }
+            lost_ = 0;
+        }
+        // only what was received goes into the history
+        if (nframes >= historyframes_){
+            std::copy(s + (nframes - historyframes_) * nchannels_, s + nframes * nchannels_,
+                      history_.begin());
+        } else {
+            std::copy(history_.begin() + nframes * nchannels_, history_.end(), history_.begin());
+            std::copy(s, s + nframes * nchannels_, history_.end() - nframes * nchannels_);
+        }
+        filled_ = std::min(historyframes_, filled_ + nframes);
+    }
+
+    // a block that didn't, returns false if there is nothing to fill it with
+    bool conceal(aoo_sample *s, int32_t nframes){
+        if (history_.empty() || filled_ < historyframes_){
+            std::fill(s, s + nframes * nchannels_, 0);
+            return false;
+        }
+        if (lost_ == 0){
+            period_ = find_period();
+            phase_ = 0;
+        }
+        if (period_ <= 0 || lost_ >= fullframes_ + fadeframes_){
+            std::fill(s, s + nframes * nchannels_, 0);
+            lost_ += nframes;
+            return period_ > 0;
+        }
+        for (int32_t i = 0; i < nframes; ++i){
+            const float g = level(lost_ + i);
+            const aoo_sample *sub = substitution();
+            for (int32_t ch = 0; ch < nchannels_; ++ch){
+                s[i * nchannels_ + ch] = sub[ch] * g;
+            }
+            phase_ = (phase_ + 1) % period_;
+        }
+        lost_ += nframes;
+        return true;
+    }
+private:
+    float level(int32_t lost) const {
+        if (lost < fullframes_){
+            return 1.f;
+        }
+        return std::max(0.f, 1.f - (float)(lost - fullframes_) / (float)fadeframes_);
+    }
+
+    // the frame of the last period the substitution is at
+    const aoo_sample *substitution() const {
+        return history_.data() + (historyframes_ - period_ + phase_) * nchannels_;
+    }
+
+    // the period (in frames) the end of the history matches best with over
+    // all channels (a mono mix could cancel out), found decimated first and
+    // then refined around that. 0 if there is only silence
+    int32_t find_period() const {
+        const aoo_sample *end = history_.data() + historyframes_ * nchannels_;
+        const int32_t nchannels = nchannels_;
+
+        auto score = [&](int32_t period, int32_t step){
+            double corr = 0, energy = 0;
+            for (int32_t k = window_; k > 0; k -= step){
+                const aoo_sample *a = end - k * nchannels;
+                const aoo_sample *b = a - period * nchannels;
+                for (int32_t ch = 0; ch < nchannels; ++ch){
+                    corr += (double)a[ch] * b[ch];
+                    energy += (double)b[ch] * b[ch];
+                }
+            }
+            return energy > 1e-12 ? corr / std::sqrt(energy) : 0.0;
+        };
+
+        int32_t best = 0;
+        double bestscore = 0;
+        for (int32_t p = minperiod_; p <= maxperiod_; p += decimation_){
+            const double sc = score(p, decimation_);
+            if (sc > bestscore){
+                bestscore = sc;
+                best = p;
+            }
+        }
+        if (best == 0){
+            // silent, or nothing that repeats
+            return 0;
+        }
+        const int32_t lo = std::max(minperiod_, best - decimation_);
+        const int32_t hi = std::min(maxperiod_, best + decimation_);
+        bestscore = 0;
+        for (int32_t p = lo; p <= hi; ++p){
+            const double sc = score(p, 1);
+            if (sc > bestscore){
+                bestscore = sc;
+                best = p;
+            }
+        }
+        return best;
+    }
+
+    std::vector<aoo_sample> history_; // the last frames received, interleaved
+    int32_t nchannels_ = 1;
+    int32_t historyframes_ = 0;
+    int32_t filled_ = 0;
+    int32_t minperiod_ = 0;
+    int32_t maxperiod_ = 0;
+    int32_t window_ = 0;
+    int32_t decimation_ = 1;
+    int32_t fullframes_ = 0;
+    int32_t fadeframes_ = 0;
+    int32_t xfadeframes_ = 0;
+    int32_t period_ = 0;
+    int32_t phase_ = 0;
+    int32_t lost_ = 0; // frames concealed since the last block
+};
+
 /*//////////////////// codec //////////////////////////*/
 
 struct codec {
@@ -132,6 +803,7 @@ struct codec {
         memset(&format, 0, sizeof(aoo_format_pcm));
     }
     aoo_format_pcm format;
+    concealer plc; // decoder only
 };
 
 int32_t codec_setformat(void *enc, aoo_format *f)
@@ -244,30 +916,8 @@ int32_t encoder_encode(void *enc,
         return 0;
     }
 
-    auto samples_to_blob = [&](auto fn){
-        auto b = buf;
-        for (int i = 0; i < n; ++i){
-            fn(s[i], b);
-            b += samplesize;
-        }
-    };
-
-    switch (bitdepth){
-    case AOO_PCM_INT16:
-        samples_to_blob(sample_to_int16);
-        break;
-    case AOO_PCM_INT24:
-        samples_to_blob(sample_to_int24);
-        break;
-    case AOO_PCM_FLOAT32:
-        samples_to_blob(sample_to_float32);
-        break;
-    case AOO_PCM_FLOAT64:
-        samples_to_blob(sample_to_float64);
-        break;
-    default:
-        // unknown bitdepth
-        break;
+    if (bitdepth >= 0 && bitdepth < AOO_PCM_BITDEPTH_SIZE){
+        kernels.encode[bitdepth](s, buf, n);
     }
 
     return n * samplesize;
@@ -310,11 +960,10 @@ int32_t decoder_decode(void *dec,
     auto c = static_cast<codec *>(dec);
     assert(c->format.header.blocksize != 0);
 
+    const int32_t nchannels = std::max<int32_t>(1, c->format.header.nchannels);
+
     if (!buf){
-        for (int i = 0; i < n; ++i){
-            s[i] = 0;
-        }
-        return 0;
+        return c->plc.conceal(s, n / nchannels) ? n : 0;
     }
 
     auto samplesize = bytes_per_sample(c->format.bitdepth);
@@ -323,34 +972,38 @@ int32_t decoder_decode(void *dec,
         return 0;
     }
 
-    auto blob_to_samples = [&](auto convfn){
-        auto b = buf;
-        for (int i = 0; i < n; ++i, b += samplesize){
-            s[i] = convfn(b);
-        }
-    };
-
-    switch (c->format.bitdepth){
-    case AOO_PCM_INT16:
-        blob_to_samples(int16_to_sample);
-        break;
-    case AOO_PCM_INT24:
-        blob_to_samples(int24_to_sample);
-        break;
-    case AOO_PCM_FLOAT32:
-        blob_to_samples(float32_to_sample);
-        break;
-    case AOO_PCM_FLOAT64:
-        blob_to_samples(float64_to_sample);
-        break;
-    default:
+    auto bitdepth = c->format.bitdepth;
+    if (bitdepth >= 0 && bitdepth < AOO_PCM_BITDEPTH_SIZE){
+        kernels.decode[bitdepth](buf, s, n);
+    } else {
         // unknown bitdepth
         return 0;
     }
 
+    c->plc.add(s, n / nchannels);
+
     return size / samplesize;
 }
 
+int32_t decoder_setformat(void *dec, aoo_format *f)
+{
+    if (codec_setformat(dec, f)){
+        auto c = static_cast<codec *>(dec);
+        c->plc.setup(c->format.header.nchannels, c->format.header.samplerate);
+        return 1;
+    }
+    return 0;
+}
+
+int32_t decoder_reset(void *dec) {
+    auto c = static_cast<codec *>(dec);
+    if (c){
+        c->plc.reset();
+        return 1;
+    }
+    return 0;
+}
+
 int32_t decoder_readformat(void *dec, aoo_format *fmt,
                            const char *buf, int32_t size)
 {
@@ -364,7 +1017,8 @@ int32_t decoder_readformat(void *dec, aoo_format *fmt,
             c->format.bitdepth = (aoo_pcm_bitdepth)aoo::from_bytes<int32_t>(buf);
             c->format.header.codec = AOO_CODEC_PCM; // !
             print_settings(c->format);
-            
+            c->plc.setup(c->format.header.nchannels, c->format.header.samplerate);
+
             return 4;
         } else {
             LOG_ERROR("PCM: bad format!");
@@ -387,11 +1041,13 @@ aoo_codec codec_class = {
     codec_reset,
     decoder_new,
     decoder_free,
-    codec_setformat,
+    decoder_setformat,
     codec_getformat,
     decoder_readformat,
     decoder_decode,
-    codec_reset
+    decoder_reset,
+    nullptr, // no packet loss hint
+    nullptr  // no FEC
 };
 
 } // namespace
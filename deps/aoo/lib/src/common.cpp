@@ -4,6 +4,7 @@
 
 #include "aoo/aoo_utils.hpp"
 #include "aoo/aoo_pcm.h"
+#include "aoo/aoo_lossless.h"
 #if USE_CODEC_OPUS
 #include "aoo/aoo_opus.h"
 #endif
@@ -13,6 +14,7 @@
 #include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <cmath>
 
 /*/////////////// version ////////////////////*/
 
@@ -65,6 +67,11 @@ int32_t aoo_register_codec(const char *name, const aoo_codec *codec){
     return 1;
 }
 
+const aoo_codec * aoo_find_codec(const char *name){
+    auto c = aoo::find_codec(name);
+    return c ? c->get() : nullptr;
+}
+
 /*//////////////////// OSC ////////////////////////////*/
 
 int32_t aoo_parse_pattern(const char *msg, int32_t n,
@@ -115,6 +122,32 @@ int32_t aoo_parse_pattern(const char *msg, int32_t n,
     }
 }
 
+int32_t aoo_parse_compact_data_salt(const char *msg, int32_t n, int32_t *salt)
+{
+    // /d <i:salt> <i:seq> [<d:srate>] <b:data>
+    // the address pattern is padded to 4 bytes, followed by the type tag string
+    const int32_t typetagonset = 4;
+    if (n < typetagonset + 8
+        || memcmp(msg, AOO_MSG_COMPACT_DATA, AOO_MSG_COMPACT_DATA_LEN)
+        || msg[AOO_MSG_COMPACT_DATA_LEN] != '\0'
+        || msg[typetagonset] != ',' || msg[typetagonset + 1] != 'i')
+    {
+        return 0;
+    }
+    auto end = (const char *)memchr(msg + typetagonset, '\0', n - typetagonset);
+    if (!end){
+        return 0;
+    }
+    // skip type tag string including padding
+    int32_t typetagsize = (int32_t)(end - (msg + typetagonset)) + 1;
+    int32_t offset = typetagonset + ((typetagsize + 3) & ~3);
+    if (n < offset + 4){
+        return 0;
+    }
+    *salt = aoo::from_bytes<int32_t>(msg + offset);
+    return 1;
+}
+
 // OSC time stamp (NTP time)
 uint64_t aoo_osctime_get(void){
     return aoo::time_tag::now().to_uint64();
@@ -132,8 +165,142 @@ double aoo_osctime_duration(uint64_t t1, uint64_t t2){
     return aoo::time_tag::duration(t1, t2);
 }
 
+void aoo_get_block_pool_stats(aoo_block_pool_stats *stats){
+    aoo::block_pool::instance().get_stats(*stats);
+}
+
 namespace aoo {
 
+/*////////////////////////// data messages /////////////////////////////*/
+
+// type tag strings including zero padding
+#define DATA_TYPETAGS ",iiidiiiib\0\0"
+#define DATA_TYPETAGS_PING ",iiidiiiibt\0"
+#define DATA_TYPETAGS_SIZE 12
+#define DATA_ARGS_SIZE 36 // without blob and ping
+
+#define COMPACT_TYPETAGS ",iib\0\0\0\0"
+#define COMPACT_TYPETAGS_PING ",iibt\0\0\0"
+#define COMPACT_TYPETAGS_SRATE ",iidb\0\0\0"
+#define COMPACT_TYPETAGS_SRATE_PING ",iidbt\0\0"
+#define COMPACT_TYPETAGS_SIZE 8
+
+// read the blob and the optional ping at 'offset'.
+// the message must end right after them.
+static bool parse_data_tail(const char *msg, int32_t n, int32_t offset,
+                            bool hasping, data_packet& d, time_tag& ping)
+{
+    if (n < offset + 4){
+        return false;
+    }
+    auto size = from_bytes<int32_t>(msg + offset);
+    offset += 4;
+    if (size < 0 || size > n - offset){
+        return false;
+    }
+    d.data = msg + offset;
+    d.size = size;
+    offset += (size + 3) & ~3;
+    if (hasping){
+        if (n != offset + 8){
+            return false;
+        }
+        ping = time_tag(from_bytes<uint64_t>(msg + offset));
+    } else {
+        if (n != offset){
+            return false;
+        }
+        ping = time_tag{};
+    }
+    return true;
+}
+
+// /aoo/sink/<id>/data <src> <salt> <seq> <sr> <channel_onset> <totalsize> <nframes> <frame> <data> [<ping>]
+
+bool parse_data_message(const char *msg, int32_t n, int32_t onset,
+                        int32_t& id, int32_t& salt, data_packet& d, time_tag& ping)
+{
+    // the subpattern includes the terminating zero
+    if (n < onset + AOO_MSG_DATA_LEN + 1
+        || memcmp(msg + onset, AOO_MSG_DATA, AOO_MSG_DATA_LEN + 1))
+    {
+        return false;
+    }
+    int32_t offset = (onset + AOO_MSG_DATA_LEN + 4) & ~3;
+    if (n < offset + DATA_TYPETAGS_SIZE + DATA_ARGS_SIZE){
+        return false;
+    }
+    bool hasping;
+    if (!memcmp(msg + offset, DATA_TYPETAGS, DATA_TYPETAGS_SIZE)){
+        hasping = false;
+    } else if (!memcmp(msg + offset, DATA_TYPETAGS_PING, DATA_TYPETAGS_SIZE)){
+        hasping = true;
+    } else {
+        return false;
+    }
+    auto args = msg + offset + DATA_TYPETAGS_SIZE;
+    id = from_bytes<int32_t>(args);
+    salt = from_bytes<int32_t>(args + 4);
+    d.sequence = from_bytes<int32_t>(args + 8);
+    d.samplerate = from_bytes<double>(args + 12);
+    d.channel = from_bytes<int32_t>(args + 20);
+    d.totalsize = from_bytes<int32_t>(args + 24);
+    d.nframes = from_bytes<int32_t>(args + 28);
+    d.framenum = from_bytes<int32_t>(args + 32);
+    return parse_data_tail(msg, n, (int32_t)(args - msg) + DATA_ARGS_SIZE,
+                           hasping, d, ping);
+}
+
+// /d <salt> <seq> <data> [<ping>]
+// /d <salt> <seq> <srate> <data> [<ping>]
+
+bool parse_compact_data_message(const char *msg, int32_t n, int32_t& salt,
+                                data_packet& d, time_tag& ping)
+{
+    // the address pattern is padded to 4 bytes
+    const int32_t typetagonset = 4;
+    if (n < typetagonset + COMPACT_TYPETAGS_SIZE + 8
+        || memcmp(msg, AOO_MSG_COMPACT_DATA, AOO_MSG_COMPACT_DATA_LEN + 1))
+    {
+        return false;
+    }
+    auto typetags = msg + typetagonset;
+    bool hasrate, hasping;
+    if (!memcmp(typetags, COMPACT_TYPETAGS, COMPACT_TYPETAGS_SIZE)){
+        hasrate = false; hasping = false;
+    } else if (!memcmp(typetags, COMPACT_TYPETAGS_PING, COMPACT_TYPETAGS_SIZE)){
+        hasrate = false; hasping = true;
+    } else if (!memcmp(typetags, COMPACT_TYPETAGS_SRATE, COMPACT_TYPETAGS_SIZE)){
+        hasrate = true; hasping = false;
+    } else if (!memcmp(typetags, COMPACT_TYPETAGS_SRATE_PING, COMPACT_TYPETAGS_SIZE)){
+        hasrate = true; hasping = true;
+    } else {
+        return false;
+    }
+    int32_t offset = typetagonset + COMPACT_TYPETAGS_SIZE;
+    salt = from_bytes<int32_t>(msg + offset);
+    d.sequence = from_bytes<int32_t>(msg + offset + 4);
+    offset += 8;
+    if (hasrate){
+        if (n < offset + 8){
+            return false;
+        }
+        d.samplerate = from_bytes<double>(msg + offset);
+        offset += 8;
+    } else {
+        d.samplerate = 0; // marker to use last
+    }
+    if (!parse_data_tail(msg, n, offset, hasping, d, ping)){
+        return false;
+    }
+    // reconstruct the rest from prior format
+    d.channel = 0;
+    d.nframes = 1;
+    d.framenum = 0;
+    d.totalsize = d.size;
+    return true;
+}
+
 /*////////////////////////// codec /////////////////////////////*/
 
 bool encoder::set_format(aoo_format& fmt){
@@ -204,8 +371,128 @@ std::unique_ptr<decoder> codec::create_decoder() const {
     }
 }
 
+/*////////////////////////// block_pool /////////////////////////////*/
+
+block_pool& block_pool::instance(){
+    // never destroyed, a sink going away at exit still gives its blocks back
+    static block_pool *pool = new block_pool();
+    return *pool;
+}
+
+int32_t block_pool::size_class(int32_t n){
+    int32_t index = 0;
+    while (index < num_classes && (min_size << index) < n){
+        index++;
+    }
+    return index; // num_classes if it's too large for any
+}
+
+char * block_pool::allocate(int32_t n, int32_t& capacity){
+    auto index = size_class(n);
+    capacity = index < num_classes ? (min_size << index) : n;
+
+    char *data = nullptr;
+    {
+        scoped_lock<spinlock> l(lock_);
+        if (index < num_classes && !classes_[index].free.empty()){
+            data = classes_[index].free.back();
+            classes_[index].free.pop_back();
+        } else {
+            held_ += capacity;
+            peak_held_ = std::max(peak_held_, held_);
+        }
+        if (index < num_classes){
+            classes_[index].used++;
+        }
+        used_ += capacity;
+        peak_used_ = std::max(peak_used_, used_);
+    }
+    if (!data){
+        data = new char[capacity];
+    }
+    return data;
+}
+
+void block_pool::release(char *data, int32_t capacity){
+    if (!data){
+        return;
+    }
+    auto index = size_class(capacity);
+    {
+        scoped_lock<spinlock> l(lock_);
+        used_ -= capacity;
+        if (index < num_classes){
+            auto& c = classes_[index];
+            c.used--;
+            // keep enough around for the fills to go up and down again,
+            // a lot more is what a buffer that has shrunk since left behind
+            if ((int32_t)c.free.size() < std::max<int32_t>(min_free, c.used / 2)){
+                c.free.push_back(data);
+                return;
+            }
+        }
+        held_ -= capacity;
+    }
+    delete[] data;
+}
+
+void block_pool::get_stats(aoo_block_pool_stats& stats){
+    scoped_lock<spinlock> l(lock_);
+    stats.used = used_;
+    stats.held = held_;
+    stats.peak_used = peak_used_;
+    stats.peak_held = peak_held_;
+}
+
 /*////////////////////////// block /////////////////////////////*/
 
+block::~block(){
+    release();
+}
+
+block::block(block&& other)
+    : sequence(other.sequence), samplerate(other.samplerate), channel(other.channel),
+      data_(other.data_), size_(other.size_), capacity_(other.capacity_),
+      frames_(other.frames_), numframes_(other.numframes_), framesize_(other.framesize_)
+{
+    other.data_ = nullptr;
+    other.size_ = other.capacity_ = 0;
+}
+
+block& block::operator=(block&& other){
+    if (this != &other){
+        release();
+        sequence = other.sequence;
+        samplerate = other.samplerate;
+        channel = other.channel;
+        data_ = other.data_;
+        size_ = other.size_;
+        capacity_ = other.capacity_;
+        frames_ = other.frames_;
+        numframes_ = other.numframes_;
+        framesize_ = other.framesize_;
+        other.data_ = nullptr;
+        other.size_ = other.capacity_ = 0;
+    }
+    return *this;
+}
+
+void block::reserve(int32_t nbytes){
+    // the same size class is reused as it is
+    if (!data_ || nbytes > capacity_ || capacity_ > nbytes * 2){
+        block_pool::instance().release(data_, capacity_);
+        data_ = block_pool::instance().allocate(nbytes, capacity_);
+    }
+    size_ = nbytes;
+}
+
+void block::release(){
+    block_pool::instance().release(data_, capacity_);
+    data_ = nullptr;
+    size_ = capacity_ = 0;
+    sequence = -1;
+}
+
 void block::set(int32_t seq, double sr, int32_t chn,
              int32_t nbytes, int32_t nframes)
 {
@@ -215,7 +502,7 @@ void block::set(int32_t seq, double sr, int32_t chn,
     numframes_ = nframes;
     framesize_ = 0;
     assert(nbytes > 0);
-    buffer_.resize(nbytes);
+    reserve(nbytes);
     // set missing frame bits to 1
     frames_ = 0;
     for (int i = 0; i < nframes; ++i){
@@ -234,27 +521,28 @@ void block::set(int32_t seq, double sr, int32_t chn,
     numframes_ = nframes;
     framesize_ = framesize;
     frames_ = 0; // no frames missing
-    buffer_.assign(data, data + nbytes);
+    reserve(nbytes);
+    std::copy(data, data + nbytes, data_);
 }
 
 bool block::complete() const {
-    if (buffer_.data() == nullptr){
+    if (data_ == nullptr){
         LOG_ERROR("buffer is 0!");
     }
-    assert(buffer_.data() != nullptr);
+    assert(data_ != nullptr);
     assert(sequence >= 0);
     return frames_ == 0;
 }
 
 void block::add_frame(int32_t which, const char *data, int32_t n){
     assert(data != nullptr);
-    assert(buffer_.data() != nullptr);
+    assert(data_ != nullptr);
     if (which == numframes_ - 1){
         LOG_DEBUG("copy last frame with " << n << " bytes");
-        std::copy(data, data + n, buffer_.end() - n);
+        std::copy(data, data + n, data_ + size_ - n);
     } else {
         LOG_DEBUG("copy frame " << which << " with " << n << " bytes");
-        std::copy(data, data + n, buffer_.begin() + which * n);
+        std::copy(data, data + n, data_ + which * n);
         framesize_ = n; // LATER allow varying framesizes
     }
     frames_ &= ~((uint64_t)1 << which);
@@ -273,7 +561,7 @@ int32_t block::get_frame(int32_t which, char *data, int32_t n){
             } else {
                 nbytes = framesize_;
             }
-            auto ptr = buffer_.data() + onset;
+            auto ptr = data_ + onset;
             std::copy(ptr, ptr + n, data);
             return nbytes;
         } else {
@@ -302,43 +590,26 @@ bool block::has_frame(int32_t which) const {
 /*////////////////////////// block_ack /////////////////////////////*/
 
 block_ack::block_ack()
-    : sequence(EMPTY), count_(0), timestamp_(-1e009){}
-
-block_ack::block_ack(int32_t seq, int32_t limit)
-    : sequence(seq) {
-    count_ = limit;
-    timestamp_ = -1e009;
-}
-
-bool block_ack::update(double time, double interval){
-    if (count_ > 0){
-        auto diff = time - timestamp_;
-        if (diff >= interval){
-            timestamp_ = time;
-            count_--;
-            LOG_DEBUG("request block " << sequence);
-            return true;
-        } else {
-//            LOG_DEBUG("don't resend block "
-//                        << sequence << ": need to wait");
-        }
-    } else {
-//        LOG_DEBUG("don't resend block "
-//                    << sequence << ": tried too many times");
-    }
-    return false;
-}
+    : sequence(EMPTY), count_(0), stamp_(0), due_(-1e009){}
 
-/*////////////////////////// block_ack_list ///////////////////////////*/
+block_ack::block_ack(int32_t seq)
+    : sequence(seq), count_(0), stamp_(0), due_(-1e009){}
 
-#if BLOCK_ACK_LIST_HASHTABLE
+/*////////////////////////// block_ack_list ///////////////////////////*/
 
-block_ack_list::block_ack_list(){
-    static_assert(is_pow2(initial_size_), "initial size must be a power of 2!");
-    data_.resize(initial_size_);
+void block_ack_list::resize(int32_t n){
+    // same ring size as the block queue, see block_queue::resize()
+    int32_t ringsize = 1;
+    while (ringsize < n * 2){
+        ringsize <<= 1;
+    }
+    assert(is_pow2(ringsize));
+    data_.assign(ringsize, block_ack{});
+    mask_ = ringsize - 1;
     size_ = 0;
-    deleted_ = 0;
-    oldest_ = INT32_MAX;
+    // room for stale items, see push()
+    heap_.clear();
+    heap_.reserve(ringsize * 2);
 }
 
 void block_ack_list::set_limit(int32_t limit){
@@ -346,12 +617,13 @@ void block_ack_list::set_limit(int32_t limit){
 }
 
 void block_ack_list::clear(){
-    for (auto& b : data_){
-        b.sequence = block_ack::EMPTY;
+    if (size_ > 0){
+        for (auto& b : data_){
+            b.sequence = block_ack::EMPTY;
+        }
+        size_ = 0;
     }
-    size_ = 0;
-    deleted_ = 0;
-    oldest_ = INT32_MAX;
+    heap_.clear();
 }
 
 int32_t block_ack_list::size() const {
@@ -363,301 +635,190 @@ bool block_ack_list::empty() const {
 }
 
 block_ack * block_ack_list::find(int32_t seq){
-    int32_t mask = data_.size() - 1;
-    auto index = seq & mask;
-    while (data_[index].sequence != seq){
-        // terminate on empty bucket, but skip deleted buckets
-        if (data_[index].sequence == block_ack::EMPTY){
-            return nullptr;
-        }
-        index = (index + 1) & mask;
-    }
-    assert(data_[index].sequence >= 0);
-    assert(seq >= oldest_);
-    return &data_[index];
-}
-
-block_ack& block_ack_list::get(int32_t seq){
-    // try to find item
-    block_ack *deleted = nullptr;
-    int32_t mask = data_.size() - 1;
-    auto index = seq & mask;
-    while (data_[index].sequence != seq){
-        if (data_[index].sequence == block_ack::DELETED){
-            // save for reuse
-            deleted = &data_[index];
-        } else if (data_[index].sequence == block_ack::EMPTY){
-            // empty bucket -> not found -> insert item
-            // update oldest
-            if (seq < oldest_){
-                oldest_ = seq;
-            }
-            // try to reclaim deleted bucket
-            if (deleted){
-                *deleted = block_ack { seq, limit_ };
-                deleted_--;
-                size_++;
-                // load factor doesn't change, no need to rehash
-                return *deleted;
-            }
-            // put in empty bucket
-            data_[index] = block_ack { seq, limit_ };
-            size_++;
-            // rehash if the table is more than 50% full
-            if ((size_ + deleted_) > (int32_t)(data_.size() >> 1)){
-                rehash();
-                auto b = find(seq);
-                assert(b != nullptr);
-                return *b;
-            } else {
-                return data_[index];
-            }
-        }
-        index = (index + 1) & mask;
+    if (data_.empty()){
+        return nullptr;
+    }
+    auto& b = slot(seq);
+    return b.sequence == seq ? &b : nullptr;
+}
+
+void block_ack_list::add(int32_t seq){
+    if (data_.empty()){
+        return;
+    }
+    auto& b = slot(seq);
+    if (b.sequence == seq){
+        return;
+    }
+    // an older sequence in the same slot is outdated anyway
+    if (b.sequence == block_ack::EMPTY){
+        size_++;
+    }
+    b = block_ack { seq };
+    if (limit_ > 0){
+        push(b);
     }
-    // return existing item
-    assert(data_[index].sequence >= 0);
-    return data_[index];
 }
 
 bool block_ack_list::remove(int32_t seq){
-    // first find the key
     auto b = find(seq);
     if (b){
-        b->sequence = block_ack::DELETED; // mark as deleted
-        deleted_++;
+        // the heap item (if any) is discarded in next_due()
+        b->sequence = block_ack::EMPTY;
         size_--;
-        // this won't give the "true" oldest value, but a closer one
-        if (seq == oldest_){
-            oldest_++;
-        }
         return true;
     } else {
         return false;
     }
 }
 
-int32_t block_ack_list::remove_before(int32_t seq){
-    if (empty() || seq <= oldest_){
-        return 0;
-    }
-    LOG_DEBUG("block_ack_list: oldest before = " << oldest_);
-    int count = 0;
-    for (auto& d : data_){
-        if (d.sequence >= 0 && d.sequence < seq){
-            d.sequence = block_ack::DELETED; // mark as deleted
-            count++;
-            size_--;
-            deleted_++;
-        }
-    }
-    oldest_ = seq;
-    LOG_DEBUG("block_ack_list: oldest after = " << oldest_);
-    assert(size_ >= 0);
-    return count;
-}
-
-void block_ack_list::rehash(){
-    auto newsize = data_.size() << 1; // double the size
-    auto mask = newsize - 1;
-    std::vector<block_ack> temp(newsize);
-    // use this chance to find oldest item
-    oldest_ = INT32_MAX;
-    // we skip all deleted items; 'size_' stays the same
-    deleted_ = 0;
-    // reinsert items
-    for (auto& b : data_){
-        if (b.sequence >= 0){
-            auto index = b.sequence & mask;
-            // find free slot
-            while (temp[index].sequence >= 0){
-                index = (index + 1) & mask;
-            }
-            // insert item
-            temp[index] = block_ack { b.sequence, limit_ };
-            // update oldest
-            if (b.sequence < oldest_){
-                oldest_ = b.sequence;
-            }
-        }
-    }
-    data_ = std::move(temp);
-}
-
-std::ostream& operator<<(std::ostream& os, const block_ack_list& b){
-    os << "acklist (" << b.size() << " / " << b.data_.size() << "): ";
-    for (auto& d : b.data_){
-        if (d.sequence >= 0){
-            os << d.sequence << " ";
-        }
-    }
-    return os;
-}
-
-#else
-
-block_ack_list::block_ack_list(){}
-
-void block_ack_list::setup(int32_t limit){
-    limit_ = limit;
-}
-
-void block_ack_list::clear(){
-    data_.clear();
-}
-
-int32_t block_ack_list::size() const {
-    return data_.size();
+int32_t block_ack_list::remaining(int32_t seq){
+    auto b = find(seq);
+    return b ? std::max<int32_t>(limit_ - b->count_, 0) : limit_;
 }
 
-bool block_ack_list::empty() const {
-    return data_.empty();
+bool block_ack_list::valid(const heap_item& item){
+    auto& b = slot(item.sequence);
+    return b.sequence == item.sequence && b.stamp_ == item.stamp;
 }
 
-block_ack * block_ack_list::find(int32_t seq){
-#if BLOCK_ACK_LIST_SORTED
-    // binary search
-    auto it = lower_bound(seq);
-    if (it != data_.end() && it->sequence == seq){
-        return &*it;
-    }
-#else
-    // linear search
-    for (auto& b : data_){
-        if (b.sequence == seq){
-            return &b;
+block_ack * block_ack_list::next_due(double time){
+    while (!heap_.empty()){
+        auto& top = heap_.front();
+        if (!valid(top)){
+            std::pop_heap(heap_.begin(), heap_.end());
+            heap_.pop_back();
+        } else if (top.due <= time){
+            return &slot(top.sequence);
+        } else {
+            break;
         }
     }
-#endif
     return nullptr;
 }
 
-block_ack& block_ack_list::get(int32_t seq){
-#if BLOCK_ACK_LIST_SORTED
-    auto it = lower_bound(seq);
-    // insert if needed
-    if (it == data_.end() || it->sequence != seq){
-        it = data_.emplace(it, seq, limit_);
+void block_ack_list::request(block_ack& ack, double time, double interval){
+    pop();
+    ack.count_++;
+    LOG_DEBUG("request block " << ack.sequence);
+    if (ack.count_ < limit_){
+        ack.due_ = time + interval;
+        push(ack);
     }
-    return *it;
-#else
-    auto b = find(seq);
-    if (b){
-        return *b;
-    } else {
-        data_.emplace_back(seq, limit_);
-        return data_.back();
-    }
-#endif
 }
 
-bool block_ack_list::remove(int32_t seq){
-#if BLOCK_ACK_LIST_SORTED
-    auto it = lower_bound(seq);
-    if (it != data_.end() && it->sequence == seq){
-        data_.erase(it);
-        return true;
-    }
-#else
-    for (auto it = data_.begin(); it != data_.end(); ++it){
-        if (it->sequence == seq){
-            data_.erase(it);
-            return true;
-        }
-    }
-#endif
-    return false;
+void block_ack_list::pop(){
+    assert(!heap_.empty());
+    slot(heap_.front().sequence).stamp_ = 0;
+    std::pop_heap(heap_.begin(), heap_.end());
+    heap_.pop_back();
 }
 
-int32_t block_ack_list::remove_before(int32_t seq){
-    if (empty()){
-        return 0;
+void block_ack_list::schedule(block_ack& ack){
+    push(ack);
+}
+
+void block_ack_list::push(block_ack& ack){
+    if (heap_.size() == heap_.capacity()){
+        compact();
     }
-    int count = 0;
-#if BLOCK_ACK_LIST_SORTED
-    auto begin = data_.begin();
-    auto end = lower_bound(seq);
-    count = end - begin;
-    data_.erase(begin, end);
-#else
-    for (auto it = data_.begin(); it != data_.end(); ){
-        if (it->sequence < seq){
-            it = data_.erase(it);
-            count++;
-        } else {
-            ++it;
-        }
+    // a new stamp invalidates the previous item of this entry
+    if (++stamp_ == 0){
+        stamp_ = 1; // 0 means 'not on the heap'
     }
-#endif
-    return count;
+    ack.stamp_ = stamp_;
+    heap_.push_back(heap_item { ack.due_, ack.sequence, ack.stamp_ });
+    std::push_heap(heap_.begin(), heap_.end());
 }
 
-#if BLOCK_ACK_LIST_SORTED
-std::vector<block_ack>::iterator block_ack_list::lower_bound(int32_t seq){
-    return std::lower_bound(data_.begin(), data_.end(), seq, [](auto& a, auto& b){
-        return a.sequence < b;
-    });
+// drop the stale items; there is at most one valid item per entry,
+// so this always makes room.
+void block_ack_list::compact(){
+    auto end = std::remove_if(heap_.begin(), heap_.end(),
+                              [this](const heap_item& item){ return !valid(item); });
+    heap_.erase(end, heap_.end());
+    std::make_heap(heap_.begin(), heap_.end());
+    LOG_DEBUG("block_ack_list: compacted heap to " << heap_.size() << " items");
 }
-#endif
 
 std::ostream& operator<<(std::ostream& os, const block_ack_list& b){
-    os << "acklist (" << b.size() << "): ";
+    os << "acklist (" << b.size() << " / " << b.data_.size() << "): ";
     for (auto& d : b.data_){
-        os << d.sequence << " ";
+        if (d.sequence >= 0){
+            os << d.sequence << " ";
+        }
     }
     return os;
 }
 
-#endif
-
 /*////////////////////////// history_buffer ///////////////////////////*/
 
+int32_t history_buffer::item::frame_size(int32_t which) const {
+    assert(which < numframes_);
+    if (which == numframes_ - 1){ // last frame
+        return size_ - which * framesize_;
+    } else {
+        return framesize_;
+    }
+}
+
+int32_t history_buffer::item::get_frame(int32_t which, char *data, int32_t n) const {
+    assert(framesize_ > 0 && numframes_ > 0);
+    if (which >= 0 && which < numframes_){
+        auto onset = which * framesize_;
+        auto nbytes = frame_size(which);
+        if (n >= nbytes){
+            std::copy(data_ + onset, data_ + onset + nbytes, data);
+            return nbytes;
+        } else {
+            LOG_ERROR("buffer too small! got " << n << ", need " << nbytes);
+        }
+    } else {
+        LOG_ERROR("frame number " << which << " out of range!");
+    }
+    return 0;
+}
+
 void history_buffer::clear(){
-    head_ = 0;
-    oldest_ = -1;
-    for (auto& block : buffer_){
-        block.sequence = -1;
+    newest_ = -1;
+    for (auto& item : items_){
+        item.sequence = -1;
     }
 }
 
 int32_t history_buffer::capacity() const {
-    return buffer_.size();
+    return capacity_;
 }
 
-void history_buffer::resize(int32_t n){
-    buffer_.resize(n);
+void history_buffer::resize(int32_t n, int32_t maxblocksize){
+    if (n > 0){
+        int32_t ringsize = 1;
+        while (ringsize < n){
+            ringsize <<= 1;
+        }
+        assert(is_pow2(ringsize));
+        items_.resize(ringsize);
+        slab_.resize((size_t)ringsize * maxblocksize);
+        for (int32_t i = 0; i < ringsize; ++i){
+            items_[i].data_ = slab_.data() + (size_t)i * maxblocksize;
+        }
+        mask_ = ringsize - 1;
+    } else {
+        items_.clear();
+        slab_.clear();
+        mask_ = 0;
+    }
+    capacity_ = n;
+    slotsize_ = maxblocksize;
     clear();
 }
 
-block * history_buffer::find(int32_t seq){
-    if (seq >= oldest_){
-    #if 0
-        // linear search
-        for (auto& block : buffer_){
-            if (block.sequence == seq){
-                return &block;
-            }
-        }
-    #else
-        // binary search
-        // blocks are always pushed in chronological order,
-        // so the ranges [begin, head] and [head, end] will always be sorted.
-        auto dofind = [&](auto begin, auto end) -> block * {
-            auto result = std::lower_bound(begin, end, seq, [](auto& a, auto& b){
-                return a.sequence < b;
-            });
-            if (result != end && result->sequence == seq){
-                return &*result;
-            } else {
-                return nullptr;
-            }
-        };
-        auto result = dofind(buffer_.begin() + head_, buffer_.end());
-        if (!result){
-            result = dofind(buffer_.begin(), buffer_.begin() + head_);
+const history_buffer::item * history_buffer::find(int32_t seq) const {
+    if (capacity_ > 0 && seq > newest_ - capacity_){
+        auto& item = items_[seq & mask_];
+        if (item.sequence == seq){
+            return &item;
         }
-        return result;
-    #endif
     } else {
         LOG_VERBOSE("couldn't find block " << seq << " - too old");
     }
@@ -668,29 +829,66 @@ void history_buffer::push(int32_t seq, double sr,
                           const char *data, int32_t nbytes,
                           int32_t nframes, int32_t framesize)
 {
-    if (buffer_.empty()){
+    if (items_.empty()){
         return;
     }
     assert(data != nullptr && nbytes > 0);
-    // check if we're going to overwrite an existing block
-    if (buffer_[head_].sequence >= 0){
-        oldest_ = buffer_[head_].sequence;
-    }
-    buffer_[head_].set(seq, sr, 0, data, nbytes, nframes, framesize);
-    if (++head_ >= (int32_t)buffer_.size()){
-        head_ = 0;
+    auto& item = items_[seq & mask_];
+    if (nbytes > slotsize_){
+        LOG_WARNING("history buffer: block " << seq << " too large (" << nbytes << " bytes)");
+        item.sequence = -1;
+        return;
     }
+    std::copy(data, data + nbytes, item.data_);
+    item.sequence = seq;
+    item.samplerate = sr;
+    item.channel = 0;
+    item.size_ = nbytes;
+    item.numframes_ = nframes;
+    item.framesize_ = framesize;
+    newest_ = seq;
 }
 
 /*////////////////////////// block_queue /////////////////////////////*/
 
+block_queue::iterator& block_queue::iterator::operator++(){
+    // skip empty slots
+    do {
+        ++seq_;
+    } while (seq_ <= queue_->back_ && queue_->slot(seq_).sequence != seq_);
+    return *this;
+}
+
 void block_queue::clear(){
+    // only invalidate the slots inside the current window
+    if (size_ > 0){
+        for (int32_t seq = front_; seq <= back_; ++seq){
+            if (slot(seq).sequence == seq){
+                slot(seq).release();
+            }
+        }
+    }
     size_ = 0;
+    front_ = 0;
+    back_ = -1;
 }
 
 void block_queue::resize(int32_t n){
-    blocks_.resize(n);
+    // the ring must be able to hold twice the capacity, see insert()
+    int32_t ringsize = 1;
+    while (ringsize < n * 2){
+        ringsize <<= 1;
+    }
+    assert(is_pow2(ringsize));
+    blocks_.resize(ringsize);
+    for (auto& b : blocks_){
+        b.release();
+    }
+    mask_ = ringsize - 1;
+    capacity_ = n;
     size_ = 0;
+    front_ = 0;
+    back_ = -1;
 }
 
 bool block_queue::empty() const {
@@ -706,140 +904,116 @@ int32_t block_queue::size() const {
 }
 
 int32_t block_queue::capacity() const {
-    return blocks_.size();
+    return capacity_;
 }
 
 block* block_queue::insert(int32_t seq, double sr, int32_t chn,
               int32_t nbytes, int32_t nframes){
     assert(capacity() > 0);
-    // find pos to insert
-    block * it;
-    // first try the end, as it is the most likely position
-    // (blocks usually arrive in sequential order)
-    if (empty() || seq > back().sequence){
-        it = end();
-    } else {
-    #if 0
-        // linear search
-        it = begin();
-        for (; it != end(); ++it){
-            assert(it->sequence != seq);
-            if (it->sequence > seq){
-                break;
-            }
-        }
-    #else
-        // binary search
-        it = std::lower_bound(begin(), end(), seq, [](auto& a, auto& b){
-            return a.sequence < b;
-        });
-        assert(!(it != end() && it->sequence == seq));
-    #endif
-    }
-    // move items if needed
+    assert(!contains(seq));
     if (full()){
-        if (it > begin()){
-            LOG_DEBUG("insert block at pos " << (it - begin()) << " and pop old block");
-            // save first block
-            block temp = std::move(front());
-            // move blocks before 'it' to the left
-            std::move(begin() + 1, it, begin());
-            // adjust iterator and re-insert removed block
-            *(--it) = std::move(temp);
-        } else {
-            // simply replace first block
-            LOG_DEBUG("replace oldest block");
+        // replace oldest block
+        LOG_DEBUG("pop oldest block");
+        pop_front();
+    }
+    if (empty()){
+        front_ = back_ = seq;
+    } else if (seq > back_){
+        // blocks usually arrive in sequential order.
+        // make sure that the new block doesn't collide with the oldest
+        // block(s); this can't happen as long as the sink keeps the
+        // sequence window below the capacity (see check_outdated_blocks())
+        while (!empty() && (seq - front_) > mask_){
+            LOG_DEBUG("pop colliding block " << front_);
+            pop_front();
         }
-    } else {
-        if (it != end()){
-            LOG_DEBUG("insert block at pos " << (it - begin()));
-            // save block past the end
-            block temp = std::move(*end());
-            // move blocks to the right
-            std::move_backward(it, end(), end() + 1);
-            // re-insert removed block at free slot (first moved item)
-            *it = std::move(temp);
-        } else {
-            // simply replace block past the end
-            LOG_DEBUG("append block");
+        if (empty()){
+            front_ = seq;
         }
-        size_++;
+        back_ = seq;
+    } else if (seq < front_){
+        while (!empty() && (back_ - seq) > mask_){
+            LOG_DEBUG("pop colliding block " << back_);
+            pop_back();
+        }
+        if (empty()){
+            back_ = seq;
+        }
+        front_ = seq;
+    } else {
+        LOG_DEBUG("insert block " << seq << " into hole");
     }
+    size_++;
     // replace data
-    it->set(seq, sr, chn, nbytes, nframes);
-    return it;
+    auto& b = slot(seq);
+    b.set(seq, sr, chn, nbytes, nframes);
+    return &b;
 }
 
 block* block_queue::find(int32_t seq){
-    // first try the end, as we most likely have to complete the most recent block
-    if (empty()){
+    if (contains(seq)){
+        return &slot(seq);
+    } else {
         return nullptr;
-    } else if (back().sequence == seq){
-        return &back();
-    }
-#if 0
-    // linear search
-    for (int32_t i = 0; i < size_; ++i){
-        if (blocks_[i].sequence == seq){
-            return &blocks_[i];
-        }
-    }
-#else
-    // binary search
-    auto result = std::lower_bound(begin(), end(), seq, [](auto& a, auto& b){
-        return a.sequence < b;
-    });
-    if (result != end() && result->sequence == seq){
-        return result;
     }
-#endif
-    return nullptr;
 }
 
 void block_queue::pop_front(){
     assert(!empty());
-    if (size_ > 1){
-        // temporarily remove first block
-        block temp = std::move(front());
-        // move remaining blocks to the left
-        std::move(begin() + 1, end(), begin());
-        // re-insert removed block at free slot
-        back() = std::move(temp);
+    slot(front_).release();
+    if (--size_ > 0){
+        // advance to next block
+        do {
+            front_++;
+        } while (slot(front_).sequence != front_);
+        assert(front_ <= back_);
+    } else {
+        front_ = 0;
+        back_ = -1;
     }
-    size_--;
 }
 
 void block_queue::pop_back(){
     assert(!empty());
-    size_--;
+    slot(back_).release();
+    if (--size_ > 0){
+        // go back to previous block
+        do {
+            back_--;
+        } while (slot(back_).sequence != back_);
+        assert(back_ >= front_);
+    } else {
+        front_ = 0;
+        back_ = -1;
+    }
 }
 
 block& block_queue::front(){
     assert(!empty());
-    return blocks_.front();
+    return slot(front_);
 }
 
 block& block_queue::back(){
     assert(!empty());
-    return blocks_[size_ - 1];
+    return slot(back_);
 }
 
-block* block_queue::begin(){
-    return blocks_.data();
+block_queue::iterator block_queue::begin(){
+    return iterator(*this, front_);
 }
 
-block* block_queue::end(){
-    return blocks_.data() + size_;
-}
-
-block& block_queue::operator[](int32_t i){
-    return blocks_[i];
+block_queue::iterator block_queue::end(){
+    return iterator(*this, back_ + 1);
 }
 
 std::ostream& operator<<(std::ostream& os, const block_queue& b){
     os << "blockqueue (" << b.size() << " / " << b.capacity() << "): ";
-    for (int i = 0; i < b.size(); ++i){
-        os << b.blocks_[i].sequence << " ";
+    if (!b.empty()){
+        for (int32_t seq = b.front_; seq <= b.back_; ++seq){
+            if (b.contains(seq)){
+                os << seq << " ";
+            }
+        }
     }
     return os;
 }
@@ -848,19 +1022,73 @@ std::ostream& operator<<(std::ostream& os, const block_queue& b){
 
 #define AOO_RESAMPLER_SPACE 2.5 // was 3 // jlc was 8
 
-void dynamic_resampler::setup(int32_t nfrom, int32_t nto, int32_t srfrom, int32_t srto, int32_t nchannels){
+void dynamic_resampler::setup(int32_t nfrom, int32_t nto, int32_t srfrom, int32_t srto, int32_t nchannels,
+                              int32_t quality){
     nchannels_ = nchannels;
     auto blocksize = std::max<int32_t>(nfrom, nto);
+    // windowed-sinc kernel
+    double rolloff;
+    switch (quality){
+    case AOO_RESAMPLE_SINC_MEDIUM:
+        ntaps_ = 16;
+        rolloff = 0.9;
+        break;
+    case AOO_RESAMPLE_SINC_HIGH:
+        ntaps_ = 32;
+        rolloff = 0.94;
+        break;
+    default:
+        ntaps_ = 0;
+        rolloff = 1.0;
+        break;
+    }
+    if (ntaps_ > 0){
+        // lower the cutoff when downsampling
+        double ratio = (srfrom > 0 && srto > 0) ? (double)srto / (double)srfrom : 1.0;
+        make_kernel(0.5 * rolloff * std::min<double>(1.0, ratio));
+    } else {
+        kernel_.clear();
+    }
 #if 0
     // this doesn't work as expected...
     auto ratio = srfrom > srto ? (double)srfrom / (double)srto : (double)srto / (double)srfrom;
     buffer_.resize(blocksize * nchannels_ * ratio * AOO_RESAMPLER_SPACE); // extra space for fluctuations
 #else
-    buffer_.resize(blocksize * nchannels_ * AOO_RESAMPLER_SPACE); // extra space for fluctuations
+    // extra space for fluctuations (+ the sinc kernel)
+    buffer_.resize((blocksize * AOO_RESAMPLER_SPACE + ntaps_) * nchannels_);
 #endif
+    std::fill(buffer_.begin(), buffer_.end(), 0);
     clear();
 }
 
+// 'cutoff' is relative to the input samplerate (0.5 = nyquist).
+// Phase p holds the kernel for a fractional read position of p / numphases_,
+// tap k belongs to input frame 'index - ntaps_ / 2 + 1 + k'.
+void dynamic_resampler::make_kernel(double cutoff){
+    const double pi = 3.14159265358979323846;
+    const int32_t half = ntaps_ / 2;
+    kernel_.resize((numphases_ + 1) * ntaps_);
+    for (int32_t p = 0; p <= numphases_; ++p){
+        double fract = (double)p / numphases_;
+        float *k = &kernel_[p * ntaps_];
+        double sum = 0;
+        for (int32_t i = 0; i < ntaps_; ++i){
+            double x = (double)(i - half + 1) - fract;
+            // sinc
+            double t = 2.0 * cutoff * x;
+            double h = (x == 0) ? 2.0 * cutoff : std::sin(pi * t) / (pi * x);
+            // Blackman window over [-half, half]
+            double w = 0.42 + 0.5 * std::cos(pi * x / half) + 0.08 * std::cos(2.0 * pi * x / half);
+            k[i] = h * w;
+            sum += k[i];
+        }
+        // normalize to unity DC gain
+        for (int32_t i = 0; i < ntaps_; ++i){
+            k[i] /= sum;
+        }
+    }
+}
+
 void dynamic_resampler::clear(){
     ratio_ = 1;
     rdpos_ = 0;
@@ -888,7 +1116,8 @@ void dynamic_resampler::update(double srfrom, double srto){
 }
 
 int32_t dynamic_resampler::write_available(){
-    return (double)buffer_.size() - balance_; // !
+    // the sinc kernel needs some history before the read position
+    return (double)buffer_.size() - balance_ - (ntaps_ / 2) * nchannels_; // !
 }
 
 void dynamic_resampler::write(const aoo_sample *data, int32_t n){
@@ -910,14 +1139,17 @@ void dynamic_resampler::write(const aoo_sample *data, int32_t n){
 }
 
 int32_t dynamic_resampler::read_available(){
-    return balance_ * ratio_;
+    // ... and some lookahead after the read position
+    return std::max<double>(0, balance_ - (ntaps_ / 2) * nchannels_) * ratio_;
 }
 
 void dynamic_resampler::read(aoo_sample *data, int32_t n){
     auto size = (int32_t)buffer_.size();
     auto limit = size / nchannels_;
     int32_t intpos = (int32_t)rdpos_;
-    if (ratio_ != 1.0 || (rdpos_ - intpos) != 0.0){
+    if (ntaps_ > 0 && (ratio_ != 1.0 || (rdpos_ - intpos) != 0.0)){
+        read_sinc(data, n);
+    } else if (ratio_ != 1.0 || (rdpos_ - intpos) != 0.0){
         // interpolating version
         double incr = 1. / ratio_;
         assert(incr > 0);
@@ -961,11 +1193,249 @@ void dynamic_resampler::read(aoo_sample *data, int32_t n){
     }
 }
 
+// The coefficients for the current fractional position are interpolated
+// between the two nearest phases; both the coefficient and the tap loops
+// run over contiguous memory, so the compiler can vectorize them.
+void dynamic_resampler::read_sinc(aoo_sample *data, int32_t n){
+    const int32_t limit = (int32_t)buffer_.size() / nchannels_;
+    const int32_t half = ntaps_ / 2;
+    const int32_t ntaps = ntaps_;
+    const int32_t nchannels = nchannels_;
+    const double incr = 1. / ratio_;
+    assert(incr > 0);
+    auto coeffs = (float *)alloca(ntaps * sizeof(float));
+    // for kernels that wrap around the ring buffer
+    auto frames = (aoo_sample *)alloca(ntaps * nchannels * sizeof(aoo_sample));
+    // de-interleaved input for the multichannel dot product
+    auto taps = (aoo_sample *)alloca(ntaps * sizeof(aoo_sample));
+
+    for (int i = 0; i < n; i += nchannels){
+        int32_t index = (int32_t)rdpos_;
+        double phase = (rdpos_ - (double)index) * numphases_;
+        int32_t p = (int32_t)phase;
+        float w = phase - (double)p;
+        const float *k0 = &kernel_[p * ntaps];
+        const float *k1 = k0 + ntaps;
+        for (int32_t k = 0; k < ntaps; ++k){
+            coeffs[k] = k0[k] + (k1[k] - k0[k]) * w;
+        }
+
+        // first input frame of the kernel
+        int32_t start = index - half + 1;
+        if (start < 0){
+            start += limit;
+        }
+        const aoo_sample *src;
+        if (start + ntaps <= limit){
+            src = &buffer_[start * nchannels];
+        } else {
+            int32_t n1 = (limit - start) * nchannels;
+            std::copy(&buffer_[start * nchannels], &buffer_[start * nchannels] + n1, frames);
+            std::copy(&buffer_[0], &buffer_[0] + (ntaps * nchannels - n1), frames + n1);
+            src = frames;
+        }
+
+        if (nchannels == 1){
+            float sum = 0;
+            for (int32_t k = 0; k < ntaps; ++k){
+                sum += coeffs[k] * src[k];
+            }
+            data[i] = sum;
+        } else {
+            for (int32_t j = 0; j < nchannels; ++j){
+                for (int32_t k = 0; k < ntaps; ++k){
+                    taps[k] = src[k * nchannels + j];
+                }
+                float sum = 0;
+                for (int32_t k = 0; k < ntaps; ++k){
+                    sum += coeffs[k] * taps[k];
+                }
+                data[i + j] = sum;
+            }
+        }
+
+        rdpos_ += incr;
+        if (rdpos_ >= limit){
+            rdpos_ -= limit;
+        }
+    }
+    balance_ -= n * incr;
+}
+
+/*////////////////////////// time_stretcher /////////////////////////////*/
+
+// compress() leaves periods alone which don't match better than this
+#define STRETCH_MINMATCH 0.7
+// period search step of the first pass, the second one refines around the best
+#define STRETCH_COARSESTEP 4
+
+void time_stretcher::setup(int32_t nchannels, int32_t samplerate, int32_t blocksize){
+    nchannels_ = nchannels;
+    minperiod_ = std::max<int32_t>(STRETCH_COARSESTEP, samplerate * AOO_STRETCH_MINPERIOD * 0.001);
+    maxperiod_ = std::max<int32_t>(minperiod_, samplerate * AOO_STRETCH_MAXPERIOD * 0.001);
+    maxconceal_ = samplerate * AOO_STRETCH_MAXCONCEAL * 0.001;
+    // two periods to compare, before and after the read position
+    histsize_ = 2 * maxperiod_;
+    maxpending_ = 2 * blocksize + 4 * maxperiod_;
+    buffer_.resize((histsize_ + maxpending_) * nchannels_);
+    std::fill(buffer_.begin(), buffer_.end(), 0);
+    clear();
+}
+
+void time_stretcher::clear(){
+    history_ = 0;
+    pending_ = 0;
+    concealed_ = 0;
+    holdoff_ = 0;
+}
+
+void time_stretcher::write_commit(int32_t n){
+    assert(n <= write_available());
+    pending_ += n;
+    concealed_ = 0;
+}
+
+void time_stretcher::read(aoo_sample *data, int32_t n){
+    assert(n <= pending_);
+    auto nchannels = nchannels_;
+    auto pending = &buffer_[histsize_ * nchannels];
+    std::copy(pending, pending + n * nchannels, data);
+    // what was read moves into the history
+    std::memmove(buffer_.data(), buffer_.data() + n * nchannels,
+                 (histsize_ + pending_ - n) * nchannels * sizeof(aoo_sample));
+    pending_ -= n;
+    history_ = std::min(histsize_, history_ + n);
+    holdoff_ = std::max(0, holdoff_ - n);
+}
+
+// normalized cross-correlation of the channel sums of the two
+// adjacent periods starting at frame 'start' of the buffer
+double time_stretcher::match(int32_t start, int32_t period, int32_t step) const {
+    auto nchannels = nchannels_;
+    auto a = &buffer_[start * nchannels];
+    auto b = a + period * nchannels;
+    double ab = 0, aa = 0, bb = 0;
+    for (int32_t i = 0; i < period; i += step){
+        float x = 0, y = 0;
+        for (int32_t j = 0; j < nchannels; ++j){
+            x += a[i * nchannels + j];
+            y += b[i * nchannels + j];
+        }
+        ab += x * y;
+        aa += x * x;
+        bb += y * y;
+    }
+    const double eps = 1e-9;
+    if (aa < eps || bb < eps){
+        // silence goes with silence
+        return (aa < eps && bb < eps) ? 1.0 : 0.0;
+    }
+    return ab / std::sqrt(aa * bb);
+}
+
+// the two periods either end the history or start the pending frames
+int32_t time_stretcher::find_period(bool history, int32_t maxperiod, double& corr) const {
+    auto start = [&](int32_t p){ return history ? histsize_ - 2 * p : histsize_; };
+    // coarse pass on every few frames...
+    int32_t best = maxperiod;
+    corr = -1;
+    for (int32_t p = minperiod_; p <= maxperiod; p += STRETCH_COARSESTEP){
+        auto c = match(start(p), p, STRETCH_COARSESTEP);
+        if (c > corr){
+            corr = c;
+            best = p;
+        }
+    }
+    // ...then all frames around the best match
+    auto lo = std::max(minperiod_, best - STRETCH_COARSESTEP + 1);
+    auto hi = std::min(maxperiod, best + STRETCH_COARSESTEP - 1);
+    corr = -1;
+    for (int32_t p = lo, coarse = best; p <= hi; ++p){
+        auto c = match(start(p), p, 1);
+        if (c > corr || (c == corr && p == coarse)){
+            corr = c;
+            best = p;
+        }
+    }
+    return best;
+}
+
+bool time_stretcher::expand(int32_t n){
+    auto nchannels = nchannels_;
+    while (pending_ < n){
+        // the period search needs two of them in the history
+        auto maxperiod = std::min(maxperiod_, history_ / 2);
+        if (maxperiod < minperiod_){
+            return false;
+        }
+        double corr;
+        auto p = find_period(true, maxperiod, corr);
+        if (concealed_ + p > maxconceal_ || pending_ + p > maxpending_){
+            return false;
+        }
+        // make room in front of the pending frames
+        auto pending = &buffer_[histsize_ * nchannels];
+        std::memmove(pending + p * nchannels, pending, pending_ * nchannels * sizeof(aoo_sample));
+        // the last period of the history comes again, faded in over what
+        // was going to come next (which follows right after it). Towards
+        // the end of what can be concealed it fades out.
+        auto src = pending - p * nchannels;
+        auto next = pending + p * nchannels;
+        auto fade = std::min(p, pending_);
+        for (int32_t i = 0; i < p; ++i){
+            float gain = std::min(1.0, 2.0 * (1.0 - (double)(concealed_ + i) / maxconceal_));
+            float w = i < fade ? (float)(i + 1) / (fade + 1) : 1.f;
+            for (int32_t j = 0; j < nchannels; ++j){
+                auto k = i * nchannels + j;
+                auto x = src[k] * gain;
+                pending[k] = i < fade ? x * w + next[k] * (1.f - w) : x;
+            }
+        }
+        pending_ += p;
+        concealed_ += p;
+    }
+    return true;
+}
+
+int32_t time_stretcher::compress(){
+    if (holdoff_ > 0){
+        return 0;
+    }
+    auto nchannels = nchannels_;
+    auto maxperiod = std::min(maxperiod_, pending_ / 2);
+    if (maxperiod < minperiod_){
+        return 0;
+    }
+    double corr;
+    auto p = find_period(false, maxperiod, corr);
+    if (corr < STRETCH_MINMATCH){
+        // try again a little later
+        holdoff_ = minperiod_;
+        return 0;
+    }
+    // the first period fades over into the second one, which goes away
+    auto pending = &buffer_[histsize_ * nchannels];
+    auto second = pending + p * nchannels;
+    for (int32_t i = 0; i < p; ++i){
+        float w = (float)(i + 1) / (p + 1);
+        for (int32_t j = 0; j < nchannels; ++j){
+            auto k = i * nchannels + j;
+            pending[k] += (second[k] - pending[k]) * w;
+        }
+    }
+    std::memmove(second, second + p * nchannels, (pending_ - 2 * p) * nchannels * sizeof(aoo_sample));
+    pending_ -= p;
+    // at most one period in eight, so it isn't heard as a speed-up
+    holdoff_ = 8 * p;
+    return p;
+}
+
 /*//////////////////////// timer //////////////////////*/
 
 timer::timer(const timer& other){
     last_ = other.last_.load();
     elapsed_ = other.elapsed_.load();
+    reset_ = other.reset_.load();
 #if AOO_TIMEFILTER_CHECK
     static_assert(is_pow2(buffersize_), "buffer size must be power of 2!");
     delta_ = other.delta_;
@@ -978,6 +1448,7 @@ timer::timer(const timer& other){
 timer& timer::operator=(const timer& other){
     last_ = other.last_.load();
     elapsed_ = other.elapsed_.load();
+    reset_ = other.reset_.load();
 #if AOO_TIMEFILTER_CHECK
     static_assert(is_pow2(buffersize_), "buffer size must be power of 2!");
     delta_ = other.delta_;
@@ -996,15 +1467,11 @@ void timer::setup(int32_t sr, int32_t blocksize){
 }
 
 void timer::reset(){
-    scoped_lock<spinlock> l(lock_);
-    last_ = 0;
-    elapsed_ = 0;
-#if AOO_TIMEFILTER_CHECK
-    // fill ringbuffer with nominal delta
-    std::fill(buffer_.begin(), buffer_.end(), delta_);
-    sum_ = delta_ * buffer_.size(); // initial sum
-    head_ = 0;
-#endif
+    // readers see the reset right away, the filter state
+    // belongs to update() and is reset there.
+    last_.store(0, std::memory_order_relaxed);
+    elapsed_.store(0, std::memory_order_relaxed);
+    reset_.store(true, std::memory_order_release);
 }
 
 double timer::get_elapsed() const {
@@ -1016,13 +1483,26 @@ time_tag timer::get_absolute() const {
 }
 
 timer::state timer::update(time_tag t, double& error){
-    std::unique_lock<spinlock> l(lock_);
+    if (reset_.exchange(false, std::memory_order_acquire)){
+        // a reset() in between would have set the flag again,
+        // so at worst the next update starts over once more.
+        elapsed_.store(0, std::memory_order_relaxed);
+    #if AOO_TIMEFILTER_CHECK
+        // fill ringbuffer with nominal delta
+        std::fill(buffer_.begin(), buffer_.end(), delta_);
+        sum_ = delta_ * buffer_.size(); // initial sum
+        head_ = 0;
+    #endif
+        last_ = t.to_uint64();
+        return state::reset;
+    }
+
     time_tag last = last_.load();
     if (!last.empty()){
         last_ = t.to_uint64(); // first!
 
         auto delta = time_tag::duration(last, t);
-        elapsed_ = elapsed_ + delta;
+        elapsed_ = elapsed_.load(std::memory_order_relaxed) + delta;
 
     #if AOO_TIMEFILTER_CHECK
         // check delta and return error
@@ -1055,8 +1535,6 @@ timer::state timer::update(time_tag t, double& error){
         auto average_error = average - delta_;
         auto last_error = delta - delta_;
 
-        l.unlock();
-
         if (average_error > delta_ * AOO_TIMEFILTER_TOLERANCE){
             LOG_WARNING("DSP tick(s) took too long!");
             LOG_VERBOSE("last period: " << (delta * 1000.0)
@@ -1082,13 +1560,73 @@ timer::state timer::update(time_tag t, double& error){
     }
 }
 
+/*//////////////////////// shared clock //////////////////////*/
+
+int32_t shared_clock::setup(int32_t samplerate, int32_t blocksize, float bandwidth){
+    if (samplerate <= 0 || blocksize <= 0){
+        return 0;
+    }
+    samplerate_ = samplerate;
+    blocksize_ = blocksize;
+    bandwidth_ = std::max<double>(0, std::min<double>(1, bandwidth));
+    timer_.setup(samplerate, blocksize); // the next update sets up the DLL
+    samplerate_estimate_.store(samplerate, std::memory_order_relaxed);
+    return 1;
+}
+
+void shared_clock::update(uint64_t t){
+    if (samplerate_ <= 0){
+        return;
+    }
+    double error;
+    auto state = timer_.update(t, error);
+    if (state == timer::state::reset){
+        LOG_DEBUG("setup shared time DLL filter");
+        dll_.setup(samplerate_, blocksize_, bandwidth_, 0);
+    } else if (state == timer::state::error){
+        // the sources and sinks see the error with their own timers
+        timer_.reset();
+    } else {
+        dll_.update(timer_.get_elapsed());
+    #if AOO_DEBUG_DLL
+        DO_LOG("shared clock, period: " << dll_.period()
+               << ", samplerate: " << dll_.samplerate());
+    #endif
+    }
+    samplerate_estimate_.store(dll_.samplerate(), std::memory_order_relaxed);
+}
+
 } // aoo
 
+aoo_clock * aoo_clock_new(void){
+    return new aoo::shared_clock();
+}
+
+void aoo_clock_free(aoo_clock *clock){
+    // cast to correct type because base class
+    // has no virtual destructor!
+    delete static_cast<aoo::shared_clock *>(clock);
+}
+
+int32_t aoo_clock_setup(aoo_clock *clock, int32_t samplerate,
+                        int32_t blocksize, float bandwidth){
+    return clock->setup(samplerate, blocksize, bandwidth);
+}
+
+void aoo_clock_update(aoo_clock *clock, uint64_t t){
+    clock->update(t);
+}
+
+double aoo_clock_get_samplerate(const aoo_clock *clock){
+    return clock->get_samplerate();
+}
+
 void aoo_initialize(){
     static bool initialized = false;
     if (!initialized){
         // register codecs
         aoo_codec_pcm_setup(aoo_register_codec);
+        aoo_codec_lossless_setup(aoo_register_codec);
 
     #if USE_CODEC_OPUS
         aoo_codec_opus_setup(aoo_register_codec);
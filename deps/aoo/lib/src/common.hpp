@@ -5,9 +5,11 @@
 #pragma once
 
 #include "aoo/aoo.h"
+#include "aoo/aoo.hpp"
 
 #include "time.hpp"
 #include "sync.hpp"
+#include "time_dll.hpp"
 
 #include <vector>
 #include <array>
@@ -23,7 +25,8 @@ uint32_t make_version(uint8_t protocolflags = 0);
 
 class dynamic_resampler {
 public:
-    void setup(int32_t nfrom, int32_t nto, int32_t srfrom, int32_t srto, int32_t nchannels);
+    void setup(int32_t nfrom, int32_t nto, int32_t srfrom, int32_t srto, int32_t nchannels,
+               int32_t quality = AOO_RESAMPLE_LINEAR);
     void clear();
     void update(double srfrom, double srto);
     int32_t write_available();
@@ -31,6 +34,12 @@ public:
     int32_t read_available();
     void read(aoo_sample* data, int32_t n);
 private:
+    static const int32_t numphases_ = 256;
+    void make_kernel(double cutoff);
+    void read_sinc(aoo_sample* data, int32_t n);
+    // polyphase windowed-sinc kernel, (numphases_ + 1) * ntaps_ coefficients
+    std::vector<float> kernel_;
+    int32_t ntaps_ = 0; // 0 = linear interpolation
     std::vector<aoo_sample> buffer_;
     int32_t nchannels_ = 0;
     double rdpos_ = 0;
@@ -39,6 +48,43 @@ private:
     double ratio_ = 1.0;
 };
 
+// Conceals buffer underruns and works off overfills without changing the
+// pitch (WSOLA style): whole pitch periods of the recent audio are repeated
+// or cut out, where the period is the lag with the best cross-correlation
+// and the seams are cross-faded. Sits after the resampler, what has been
+// read stays around as the history to repeat from.
+class time_stretcher {
+public:
+    void setup(int32_t nchannels, int32_t samplerate, int32_t blocksize);
+    void clear();
+    // in frames
+    int32_t read_available() const { return pending_; }
+    int32_t write_available() const { return maxpending_ - pending_; }
+    aoo_sample * write_data() { return &buffer_[(histsize_ + pending_) * nchannels_]; }
+    void write_commit(int32_t n);
+    void read(aoo_sample *data, int32_t n);
+    // repeat periods until 'n' frames are available, false if that can't be done
+    bool expand(int32_t n);
+    // cut one period out of the pending frames, returns its length (0 = none)
+    int32_t compress();
+    // the pending frames compress() can pick from
+    int32_t lookahead() const { return 2 * maxperiod_; }
+private:
+    double match(int32_t start, int32_t period, int32_t step) const;
+    int32_t find_period(bool history, int32_t maxperiod, double& corr) const;
+    std::vector<aoo_sample> buffer_; // history + pending frames
+    int32_t nchannels_ = 0;
+    int32_t minperiod_ = 0;
+    int32_t maxperiod_ = 0;
+    int32_t histsize_ = 0;
+    int32_t history_ = 0; // valid frames of history
+    int32_t pending_ = 0;
+    int32_t maxpending_ = 0;
+    int32_t concealed_ = 0; // frames made up since the last write
+    int32_t maxconceal_ = 0;
+    int32_t holdoff_ = 0; // frames to read before the next compress()
+};
+
 class base_codec {
 public:
     base_codec(const aoo_codec *codec, void *obj)
@@ -82,6 +128,20 @@ public:
         return codec_->encoder_reset(obj_);
     }
 
+    int32_t set_packetloss(int32_t percent) {
+        return codec_->encoder_setpacketloss ?
+                    codec_->encoder_setpacketloss(obj_, percent) : 0;
+    }
+
+    int32_t set_bitrate(int32_t bitrate) {
+        return codec_->encoder_setbitrate ?
+                    codec_->encoder_setbitrate(obj_, bitrate) : 0;
+    }
+
+    int32_t set_complexity(int32_t complexity) {
+        return codec_->encoder_setcomplexity ?
+                    codec_->encoder_setcomplexity(obj_, complexity) : 0;
+    }
 };
 
 class decoder : public base_codec {
@@ -99,6 +159,11 @@ public:
     int32_t decode(const char *buf, int32_t size, aoo_sample *s, int32_t n){
         return codec_->decoder_decode(obj_, buf, size, s, n);
     }
+    // returns -1 if the codec doesn't support FEC
+    int32_t decode_fec(const char *buf, int32_t size, aoo_sample *s, int32_t n){
+        return codec_->decoder_decodefec ?
+                    codec_->decoder_decodefec(obj_, buf, size, s, n) : -1;
+    }
     int32_t reset() {
         return codec_->decoder_reset(obj_);
     }
@@ -111,6 +176,7 @@ public:
     const char *name() const {
         return codec_->name;
     }
+    const aoo_codec * get() const { return codec_; }
     std::unique_ptr<encoder> create_encoder() const;
     std::unique_ptr<decoder> create_decoder() const;
     
@@ -138,16 +204,68 @@ struct data_packet {
     int32_t size;
 };
 
+// Fixed layout decoders for the /data and compact data messages, which are
+// by far the most frequent messages. They read the arguments at precomputed
+// offsets instead of going through osc::ReceivedMessage and return false if
+// the message doesn't have one of the known layouts, so the caller can fall
+// back to the generic OSC parser.
+// 'onset' is the offset of the message subpattern, see aoo_parse_pattern().
+bool parse_data_message(const char *msg, int32_t n, int32_t onset,
+                        int32_t& id, int32_t& salt, data_packet& d, time_tag& ping);
+
+bool parse_compact_data_message(const char *msg, int32_t n, int32_t& salt,
+                                data_packet& d, time_tag& ping);
+
+// The storage of the received blocks of all sinks, so that the memory follows
+// how full the jitter buffers actually are instead of what each of them could
+// hold at most. A block takes a chunk while it's in a queue and gives it back
+// when it leaves. Power of two size classes, anything larger comes right from
+// the heap. Only used by the network threads, never by the audio thread.
+class block_pool {
+public:
+    static block_pool& instance();
+    // 'capacity' is set to the size actually taken, give that back to release()
+    char * allocate(int32_t n, int32_t& capacity);
+    void release(char *data, int32_t capacity);
+    void get_stats(aoo_block_pool_stats& stats);
+private:
+    static const int32_t min_size = 128;
+    static const int32_t num_classes = 14; // up to 1 MB
+    // free chunks kept per class in any case
+    static const int32_t min_free = 16;
+    static int32_t size_class(int32_t n);
+
+    struct size_class_list {
+        std::vector<char *> free;
+        int32_t used = 0;
+    };
+    size_class_list classes_[num_classes];
+    int64_t used_ = 0;
+    int64_t held_ = 0;
+    int64_t peak_used_ = 0;
+    int64_t peak_held_ = 0;
+    spinlock lock_;
+};
+
 class block {
 public:
+    block() = default;
+    ~block();
+    block(block&& other);
+    block& operator=(block&& other);
+    block(const block&) = delete;
+    block& operator=(const block&) = delete;
+
     // methods
     void set(int32_t seq, double sr, int32_t chn,
           int32_t nbytes, int32_t nframes);
     void set(int32_t seq, double sr, int32_t chn,
              const char *data, int32_t nbytes,
              int32_t nframes, int32_t framesize);
-    const char* data() const { return buffer_.data(); }
-    int32_t size() const { return buffer_.size(); }
+    // gives the storage back to the pool and empties the block
+    void release();
+    const char* data() const { return data_; }
+    int32_t size() const { return size_; }
     bool complete() const;
     void add_frame(int32_t which, const char *data, int32_t n);
     int32_t get_frame(int32_t which, char * data, int32_t n);
@@ -159,14 +277,37 @@ public:
     double samplerate = 0;
     int32_t channel = 0;
 protected:
-    std::vector<char> buffer_;
+    void reserve(int32_t nbytes);
+
+    char *data_ = nullptr; // from block_pool
+    int32_t size_ = 0;
+    int32_t capacity_ = 0;
     uint64_t frames_ = 0; // bitfield (later expand)
     int32_t numframes_ = 0;
     int32_t framesize_ = 0;
 };
 
+// The block queue is a ring buffer indexed by 'sequence & mask'.
+// Blocks are kept sorted by sequence number, but there can be holes.
+// The ring is at least twice as large as the (logical) capacity,
+// so that all blocks within the jitter window map to distinct slots.
+// insert(), find() and pop_front() are O(1); iteration skips empty slots.
 class block_queue {
 public:
+    class iterator {
+    public:
+        iterator(block_queue& q, int32_t seq)
+            : queue_(&q), seq_(seq) {}
+        block& operator*() const { return queue_->slot(seq_); }
+        block* operator->() const { return &queue_->slot(seq_); }
+        iterator& operator++();
+        bool operator==(const iterator& other) const { return seq_ == other.seq_; }
+        bool operator!=(const iterator& other) const { return seq_ != other.seq_; }
+    private:
+        block_queue *queue_;
+        int32_t seq_;
+    };
+
     void clear();
     void resize(int32_t n);
     bool empty() const;
@@ -181,84 +322,138 @@ public:
 
     block& front();
     block& back();
-    block *begin();
-    block *end();
-    block& operator[](int32_t i);
+    iterator begin();
+    iterator end();
 
     friend std::ostream& operator<<(std::ostream& os, const block_queue& b);
 private:
+    block& slot(int32_t seq) { return blocks_[seq & mask_]; }
+    const block& slot(int32_t seq) const { return blocks_[seq & mask_]; }
+    bool contains(int32_t seq) const {
+        return seq >= front_ && seq <= back_ && slot(seq).sequence == seq;
+    }
     std::vector<block> blocks_;
+    int32_t mask_ = 0;
+    int32_t capacity_ = 0;
     int32_t size_ = 0;
+    int32_t front_ = 0; // oldest sequence
+    int32_t back_ = -1; // newest sequence
 };
 
 class block_ack {
 public:
     static const int32_t EMPTY = -1;
-    static const int32_t DELETED = -2;
 
     block_ack();
-    block_ack(int32_t seq, int32_t limit);
+    block_ack(int32_t seq);
 
-    bool update(double time, double interval);
-    int32_t remaining() const { return count_; }
+    int32_t count() const { return count_; }
+    double due() const { return due_; }
     int32_t sequence;
 private:
-    int32_t count_;
-    double timestamp_;
+    friend class block_ack_list;
+    int32_t count_; // number of requests so far
+    uint32_t stamp_; // of the current heap item
+    double due_; // time of the next request
 };
 
-#define BLOCK_ACK_LIST_HASHTABLE 1
-#define BLOCK_ACK_LIST_SORTED 1
-
+// Keeps track of the blocks which are missing or incomplete, so that
+// the sink doesn't have to rescan the block queue to find them.
+// The entries live in a ring indexed by 'sequence & mask', sized like the
+// block queue, and the ones that can still be requested are kept in a
+// min-heap by their due time. Heap items of removed or rescheduled entries
+// are discarded lazily. Only resize() allocates.
 class block_ack_list {
 public:
-    block_ack_list();
-
+    void resize(int32_t n);
     void set_limit(int32_t limit);
     block_ack* find(int32_t seq);
-    block_ack& get(int32_t seq);
+    // start tracking a sequence (if needed), the first request is due immediately
+    void add(int32_t seq);
     bool remove(int32_t seq);
-    int32_t remove_before(int32_t seq);
+    // number of requests left for the sequence
+    int32_t remaining(int32_t seq);
+    // the entry which is due first, if it is due at 'time'
+    block_ack* next_due(double time);
+    // count a request for the entry returned by next_due(), schedules the next one
+    void request(block_ack& ack, double time, double interval);
+    // take the entry returned by next_due() off the heap, see schedule()
+    void pop();
+    void schedule(block_ack& ack);
     void clear();
     bool empty() const;
     int32_t size() const;
 
     friend std::ostream& operator<<(std::ostream& os, const block_ack_list& b);
 private:
-#if !BLOCK_ACK_LIST_HASHTABLE
-#if BLOCK_ACK_LIST_SORTED
-    std::vector<block_ack>::iterator lower_bound(int32_t seq);
-#endif
-#else
-    void rehash();
-
-    static const int32_t initial_size_ = 16;
+    struct heap_item {
+        double due;
+        int32_t sequence;
+        uint32_t stamp;
+        bool operator<(const heap_item& other) const {
+            // min-heap, older sequences first
+            return due > other.due || (due == other.due && sequence > other.sequence);
+        }
+    };
+    block_ack& slot(int32_t seq) { return data_[seq & mask_]; }
+    bool valid(const heap_item& item);
+    void push(block_ack& ack);
+    void compact();
 
-    int32_t size_;
-    int32_t deleted_;
-    int32_t oldest_;
-#endif
-    int32_t limit_ = 0;
     std::vector<block_ack> data_;
+    std::vector<heap_item> heap_;
+    int32_t mask_ = -1;
+    int32_t size_ = 0;
+    int32_t limit_ = 0;
+    uint32_t stamp_ = 0;
 };
 
+// The history buffer is a fixed-capacity ring indexed by 'sequence & mask'.
+// Block data lives in a single byte slab which is allocated in resize(),
+// every slot gets 'maxblocksize' bytes. find() is O(1) and push() never allocates.
 class history_buffer {
 public:
+    class item {
+    public:
+        const char* data() const { return data_; }
+        int32_t size() const { return size_; }
+        int32_t num_frames() const { return numframes_; }
+        int32_t frame_size(int32_t which) const;
+        int32_t get_frame(int32_t which, char * data, int32_t n) const;
+        // data
+        int32_t sequence = -1;
+        double samplerate = 0;
+        int32_t channel = 0;
+    private:
+        friend class history_buffer;
+        char *data_ = nullptr;
+        int32_t size_ = 0;
+        int32_t numframes_ = 0;
+        int32_t framesize_ = 0;
+    };
+
     void clear();
     int32_t capacity() const;
-    void resize(int32_t n);
-    block * find(int32_t seq);
+    void resize(int32_t n, int32_t maxblocksize);
+    const item * find(int32_t seq) const;
     void push(int32_t seq, double sr,
              const char *data, int32_t nbytes,
              int32_t nframes, int32_t framesize);
 private:
-    std::vector<block> buffer_;
-    int32_t oldest_ = 0;
-    int32_t head_ = 0;
+    std::vector<item> items_;
+    std::vector<char> slab_;
+    int32_t mask_ = 0;
+    int32_t capacity_ = 0;
+    int32_t slotsize_ = 0;
+    int32_t newest_ = -1;
 };
 
 /*//////////////////////// timer //////////////////////*/
 
+// update() is called by the audio thread only, get_elapsed() and
+// get_absolute() from any thread. reset() may come from any thread,
+// it only leaves a request that the next update() carries out, so
+// neither side ever waits for the other.
 class timer {
 public:
     enum class state {
@@ -275,8 +470,9 @@ public:
     time_tag get_absolute() const;
     state update(time_tag t, double& error);
 private:
-    std::atomic<uint64_t> last_;
+    std::atomic<uint64_t> last_{0};
     std::atomic<double> elapsed_{0};
+    std::atomic<bool> reset_{false};
 
 #if AOO_TIMEFILTER_CHECK
     // moving average filter to detect timing issues
@@ -287,8 +483,26 @@ private:
     std::array<double, buffersize_> buffer_;
     int32_t head_ = 0;
 #endif
+};
 
-    spinlock lock_;
+/*//////////////////////// shared clock //////////////////////*/
+
+// one time DLL for all sources and sinks of an audio callback, see aoo_clock_new()
+class shared_clock final : public iclock {
+public:
+    int32_t setup(int32_t samplerate, int32_t blocksize, float bandwidth) override;
+    void update(uint64_t t) override;
+    double get_samplerate() const override {
+        return samplerate_estimate_.load(std::memory_order_relaxed);
+    }
+private:
+    timer timer_;
+    time_dll dll_;
+    int32_t samplerate_ = 0;
+    int32_t blocksize_ = 0;
+    double bandwidth_ = AOO_TIMEFILTER_BANDWIDTH;
+    // 0 until set up, which makes the users fall back to the nominal rate
+    std::atomic<double> samplerate_estimate_{0};
 };
 
 } // aoo
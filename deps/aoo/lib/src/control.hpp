@@ -0,0 +1,172 @@
+#pragma once
+
+#include "aoo/aoo.h"
+#include "aoo/aoo_net.h"
+#include "aoo/aoo_utils.hpp"
+
+#include "SLIP.hpp"
+
+#include "oscpack/osc/OscReceivedElements.h"
+
+#include <vector>
+#include <cstring>
+
+// Binary framing for the TCP connection between client and server.
+//
+// By default, the control messages are OSC messages in SLIP packets, so
+// every byte has to be escaped and every address pattern has to be matched.
+// If both sides support it, they switch to length prefixed frames instead:
+//
+// <marker | version> <24 bit size (big endian)> <OSC packet>
+//
+// The OSC messages in the frames use integer address patterns (see
+// control_message), which oscpack parses without any string matching.
+// Because SLIP packets always start with END, the receiver can tell both
+// kinds of packets apart and the two sides don't need to agree on the
+// exact moment of the switch:
+// 1) the client offers AOONET_CONTROL_VERSION in the /login message.
+// 2) if the server supports it, it answers with binary frames from then on.
+// 3) when the client receives its first binary frame, it does the same.
+
+#define AOONET_CONTROL_VERSION 1
+#define AOONET_CONTROL_MARKER 0xA0
+#define AOONET_CONTROL_HEADER_SIZE 4
+
+namespace aoo {
+namespace net {
+
+// the integer address patterns. never reorder, only append!
+enum class control_message : int32_t {
+    unknown = 0,
+    // client -> server
+    server_ping,
+    server_login,
+    server_group_join,
+    server_group_leave,
+    server_group_public,
+    server_route,
+    // server -> client
+    client_ping,
+    client_login,
+    client_group_join,
+    client_group_leave,
+    client_group_public,
+    client_group_public_add,
+    client_group_public_del,
+    client_peer_join,
+    client_peer_leave,
+    client_route,
+    count_
+};
+
+inline const char *control_message_pattern(control_message id){
+    static const char *patterns[] = {
+        "",
+        AOO_MSG_DOMAIN AOONET_MSG_SERVER AOONET_MSG_PING,
+        AOO_MSG_DOMAIN AOONET_MSG_SERVER AOONET_MSG_LOGIN,
+        AOO_MSG_DOMAIN AOONET_MSG_SERVER AOONET_MSG_GROUP AOONET_MSG_JOIN,
+        AOO_MSG_DOMAIN AOONET_MSG_SERVER AOONET_MSG_GROUP AOONET_MSG_LEAVE,
+        AOO_MSG_DOMAIN AOONET_MSG_SERVER AOONET_MSG_GROUP AOONET_MSG_PUBLIC,
+        AOO_MSG_DOMAIN AOONET_MSG_SERVER AOONET_MSG_ROUTE,
+        AOO_MSG_DOMAIN AOONET_MSG_CLIENT AOONET_MSG_PING,
+        AOO_MSG_DOMAIN AOONET_MSG_CLIENT AOONET_MSG_LOGIN,
+        AOO_MSG_DOMAIN AOONET_MSG_CLIENT AOONET_MSG_GROUP AOONET_MSG_JOIN,
+        AOO_MSG_DOMAIN AOONET_MSG_CLIENT AOONET_MSG_GROUP AOONET_MSG_LEAVE,
+        AOO_MSG_DOMAIN AOONET_MSG_CLIENT AOONET_MSG_GROUP AOONET_MSG_PUBLIC,
+        AOO_MSG_DOMAIN AOONET_MSG_CLIENT AOONET_MSG_GROUP AOONET_MSG_PUBLIC AOONET_MSG_ADD,
+        AOO_MSG_DOMAIN AOONET_MSG_CLIENT AOONET_MSG_GROUP AOONET_MSG_PUBLIC AOONET_MSG_DEL,
+        AOO_MSG_DOMAIN AOONET_MSG_CLIENT AOONET_MSG_PEER AOONET_MSG_JOIN,
+        AOO_MSG_DOMAIN AOONET_MSG_CLIENT AOONET_MSG_PEER AOONET_MSG_LEAVE,
+        AOO_MSG_DOMAIN AOONET_MSG_CLIENT AOONET_MSG_ROUTE
+    };
+    static_assert(sizeof(patterns) / sizeof(patterns[0]) == (size_t)control_message::count_,
+                  "control message table out of sync");
+    auto i = (int32_t)id;
+    return (i > 0 && i < (int32_t)control_message::count_) ? patterns[i] : "";
+}
+
+inline control_message control_message_id(const char *pattern){
+    for (int32_t i = 1; i < (int32_t)control_message::count_; ++i){
+        if (!strcmp(pattern, control_message_pattern((control_message)i))){
+            return (control_message)i;
+        }
+    }
+    return control_message::unknown;
+}
+
+// works for both integer and string address patterns
+inline control_message control_message_id(const osc::ReceivedMessage& msg){
+    if (msg.AddressPatternIsUInt32()){
+        auto id = msg.AddressPatternAsUInt32();
+        return id < (uint32_t)control_message::count_ ?
+                    (control_message)id : control_message::unknown;
+    } else {
+        return control_message_id(msg.AddressPattern());
+    }
+}
+
+// append a binary frame to 'out'. known messages get an integer address
+// pattern, anything else (e.g. bundles) is passed on as is.
+inline void control_encode(const char *data, int32_t size, std::vector<uint8_t>& out){
+    auto id = control_message::unknown;
+    int32_t onset = 0;
+    if (size > 0 && data[0] == '/'){
+        auto len = (int32_t)strnlen(data, size);
+        if (len < size){
+            id = control_message_id(data);
+            onset = (len + 4) & ~3; // skip padded string
+        }
+    }
+    int32_t framesize = id != control_message::unknown ? size - onset + 4 : size;
+
+    auto pos = out.size();
+    out.resize(pos + AOONET_CONTROL_HEADER_SIZE + framesize);
+    auto buf = (char *)out.data() + pos;
+    aoo::to_bytes<int32_t>(framesize, buf);
+    buf[0] = (char)(AOONET_CONTROL_MARKER | AOONET_CONTROL_VERSION);
+    buf += AOONET_CONTROL_HEADER_SIZE;
+    if (id != control_message::unknown){
+        // integer address pattern: must start with a zero byte
+        aoo::to_bytes<int32_t>((int32_t)id, buf);
+        memcpy(buf + 4, data + onset, size - onset);
+    } else {
+        memcpy(buf, data, size);
+    }
+}
+
+// read the next packet from the stream, either a SLIP packet or a binary frame.
+// returns the packet size, 0 if there's no complete packet, -1 on bad data.
+// 'binary' tells if the packet came in a binary frame, it's only meaningful
+// if there is a packet.
+inline int32_t control_read_packet(SLIP& stream, uint8_t *buffer, int32_t size,
+                                   bool& binary){
+    binary = false;
+    uint8_t header[AOONET_CONTROL_HEADER_SIZE];
+    if (stream.peek_bytes(header, 1) < 1){
+        return 0;
+    }
+    binary = (header[0] & 0xF0) == AOONET_CONTROL_MARKER;
+    if (!binary){
+        return stream.read_packet(buffer, size);
+    }
+    if ((header[0] & 0x0F) > AOONET_CONTROL_VERSION){
+        return -1; // a later version must be negotiated first
+    }
+    if (stream.peek_bytes(header, AOONET_CONTROL_HEADER_SIZE) < AOONET_CONTROL_HEADER_SIZE){
+        return 0;
+    }
+    header[0] = 0;
+    auto framesize = aoo::from_bytes<int32_t>((const char *)header);
+    if (framesize <= 0 || framesize > size){
+        return -1;
+    }
+    if (stream.read_available() < AOONET_CONTROL_HEADER_SIZE + framesize){
+        return 0;
+    }
+    stream.read_bytes(header, AOONET_CONTROL_HEADER_SIZE);
+    stream.read_bytes(buffer, framesize);
+    return framesize;
+}
+
+} // net
+} // aoo
@@ -4,8 +4,12 @@
 
 #pragma once
 
+#include "sync.hpp"
+
 #include <stdint.h>
+#include <algorithm>
 #include <atomic>
+#include <mutex>
 #include <vector>
 #include <cassert>
 
@@ -15,7 +19,11 @@ namespace lockfree {
 /*////////////////////// queue /////////////////////////*/
 
 // a lock-free queue which supports reading/writing data
-// in fixed-sized blocks.
+// in fixed-sized blocks. There is one reader and one writer,
+// each side has its own cache line for its position, so they
+// don't invalidate each other's on every read and write.
+// The counts only ever grow, the difference between them is
+// what's available, which also works once they wrap around.
 template<typename T>
 class queue {
  public:
@@ -23,18 +31,15 @@ class queue {
     // we need a move constructor so we can
     // put it in STL containers
     queue(queue&& other)
-        : balance_(other.balance_.load()),
-          rdhead_(other.rdhead_),
-          wrhead_(other.wrhead_),
-          stride_(other.stride_),
+        : stride_(other.stride_),
           data_(std::move(other.data_))
-    {}
+    {
+        move_state(other);
+    }
     queue& operator=(queue&& other){
-        balance_ = other.balance_.load();
-        rdhead_ = other.rdhead_;
-        wrhead_ = other.wrhead_;
         stride_ = other.stride_;
         data_ = std::move(other.data_);
+        move_state(other);
         return *this;
     }
 
@@ -55,38 +60,60 @@ class queue {
     int32_t capacity() const { return data_.size(); }
 
     void reset() {
-        rdhead_ = wrhead_ = 0;
-        balance_ = 0;
+        reader_.head = writer_.head = 0;
+        reader_.count.store(0, std::memory_order_relaxed);
+        writer_.count.store(0, std::memory_order_relaxed);
+        reader_.writecount = writer_.readcount = 0;
     }
     // returns: the number of available *blocks* for reading
     int32_t read_available() const {
         if (stride_){
-            return balance_.load(std::memory_order_acquire) / stride_;
+            return balance() / stride_;
         } else {
             return 0;
         }
     }
 
     void read(T& out) {
-        out = std::move(data_[rdhead_]);
-        rdhead_ = (rdhead_ + 1) % capacity();
-        --balance_;
-        assert(balance_ >= 0);
+        out = std::move(data_[reader_.head]);
+        reader_.head = next(reader_.head, 1);
+        advance(reader_.count, 1);
+        assert(balance() >= 0);
+    }
+
+    // read up to n elements at once, returns the number read
+    int32_t read_n(T* out, int32_t n) {
+        auto count = reader_.count.load(std::memory_order_relaxed);
+        if ((int32_t)(reader_.writecount - count) < n){
+            reader_.writecount = writer_.count.load(std::memory_order_acquire);
+        }
+        n = std::min<int32_t>(n, reader_.writecount - count);
+        for (int32_t i = 0; i < n; ++i){
+            out[i] = std::move(data_[reader_.head]);
+            reader_.head = next(reader_.head, 1);
+        }
+        reader_.count.store(count + n, std::memory_order_release);
+        return n;
     }
 
     const T* read_data() const {
-        return &data_[rdhead_];
+        return &data_[reader_.head];
+    }
+
+    // the element offset places after the read head, which must be below read_available()
+    const T* read_data(int32_t offset) const {
+        return &data_[next(reader_.head, offset)];
     }
 
     void read_commit() {
-        rdhead_ = (rdhead_ + stride_) % capacity();
-        balance_ -= stride_;
-        assert(balance_ >= 0);
+        reader_.head = next(reader_.head, stride_);
+        advance(reader_.count, stride_);
+        assert(balance() >= 0);
     }
     // returns: the number of available *blocks* for writing
     int32_t write_available() const {
         if (stride_){
-            return (capacity() - balance_.load(std::memory_order_acquire)) / stride_;
+            return (capacity() - balance()) / stride_;
         } else {
             return 0;
         }
@@ -94,39 +121,93 @@ class queue {
 
     template<typename U>
     void write(U&& value) {
-        data_[wrhead_] = std::forward<U>(value);
-        wrhead_ = (wrhead_ + 1) % capacity();
-        ++balance_;
-        assert(balance_ <= capacity());
+        data_[writer_.head] = std::forward<U>(value);
+        writer_.head = next(writer_.head, 1);
+        advance(writer_.count, 1);
+        assert(balance() <= capacity());
+    }
+
+    // write up to n elements at once, returns the number written
+    int32_t write_n(const T* values, int32_t n) {
+        auto count = writer_.count.load(std::memory_order_relaxed);
+        if (capacity() - (int32_t)(count - writer_.readcount) < n){
+            writer_.readcount = reader_.count.load(std::memory_order_acquire);
+        }
+        n = std::min<int32_t>(n, capacity() - (int32_t)(count - writer_.readcount));
+        for (int32_t i = 0; i < n; ++i){
+            data_[writer_.head] = values[i];
+            writer_.head = next(writer_.head, 1);
+        }
+        writer_.count.store(count + n, std::memory_order_release);
+        return n;
     }
 
     T* write_data() {
-        return &data_[wrhead_];
+        return &data_[writer_.head];
     }
 
     void write_commit() {
-        wrhead_ = (wrhead_ + stride_) % capacity();
-        balance_ += stride_;
-        assert(balance_ <= capacity());
+        writer_.head = next(writer_.head, stride_);
+        advance(writer_.count, stride_);
+        assert(balance() <= capacity());
     }
  private:
-    std::atomic<int32_t> balance_{0};
-    int32_t rdhead_{0};
-    int32_t wrhead_{0};
+    // elements written but not read yet (any thread)
+    int32_t balance() const {
+        auto rdcount = reader_.count.load(std::memory_order_acquire);
+        return (int32_t)(writer_.count.load(std::memory_order_acquire) - rdcount);
+    }
+
+    int32_t next(int32_t head, int32_t n) const {
+        head += n;
+        return head >= capacity() ? head - capacity() : head;
+    }
+
+    // only the owning side stores its count
+    static void advance(std::atomic<uint32_t>& count, int32_t n){
+        count.store(count.load(std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+
+    void move_state(queue& other){
+        reader_.head = other.reader_.head;
+        reader_.count.store(other.reader_.count.load());
+        reader_.writecount = other.reader_.writecount;
+        writer_.head = other.writer_.head;
+        writer_.count.store(other.writer_.count.load());
+        writer_.readcount = other.writer_.readcount;
+    }
+
+    struct reader_state {
+        std::atomic<uint32_t> count{0}; // elements read so far
+        int32_t head = 0;
+        uint32_t writecount = 0; // last seen count of the writer, see read_n()
+    };
+    struct writer_state {
+        std::atomic<uint32_t> count{0}; // elements written so far
+        int32_t head = 0;
+        uint32_t readcount = 0; // last seen count of the reader, see write_n()
+    };
+    padded_class<reader_state, CACHELINE_SIZE> reader_;
+    padded_class<writer_state, CACHELINE_SIZE> writer_;
     int32_t stride_{0};
     std::vector<T> data_;
 };
 
 /*///////////////////////// list ////////////////////////*/
 
-// a lock-free singly-linked list which supports adding items and iteration.
-// clearing the list is *not* thread-safe
+// a lock-free singly-linked list which supports adding items, iteration
+// and removing items. Any thread iterating the list or holding on to an
+// item has to do so within a read_guard, which is wait-free in practice
+// (it only retries if a removal happens right as it starts).
+// Removed items are freed once no read_guard from before the removal is
+// left, see reclaim(). Removing and reclaiming may block, so don't do it
+// on the audio thread. Clearing the list is *not* thread-safe.
 
 template<typename T>
 class list {
 public:
     struct node {
-        node* next_;
+        std::atomic<node*> next_;
         T data_;
         template<typename... U>
         node(U&&... args)
@@ -146,12 +227,12 @@ public:
         T& operator*() { return node_->data_; }
         T* operator->() { return &node_->data; }
         base_iterator& operator++() {
-            node_ = node_->next_;
+            node_ = node_->next_.load(std::memory_order_acquire);
             return *this;
         }
         base_iterator operator++(int) {
             base_iterator old = *this;
-            node_ = node_->next_;
+            node_ = node_->next_.load(std::memory_order_acquire);
             return old;
         }
         bool operator==(const base_iterator& other){
@@ -164,6 +245,34 @@ public:
     using iterator = base_iterator<node>;
     using const_iterator = base_iterator<const node>;
 
+    // Epoch based: a guard counts itself in the current epoch.
+    // The epoch only moves on once nobody is left in the one before,
+    // so at most two are in use, and an item removed in an epoch can
+    // be freed once that epoch is over and empty.
+    class read_guard {
+    public:
+        read_guard(const list& l)
+            : list_(l){
+            while (true){
+                epoch_ = list_.epoch_.load();
+                list_.readers_[epoch_ & 1].fetch_add(1);
+                if (list_.epoch_.load() == epoch_){
+                    break;
+                }
+                // moved on in between, count us in the new one
+                list_.readers_[epoch_ & 1].fetch_sub(1);
+            }
+        }
+        ~read_guard(){
+            list_.readers_[epoch_ & 1].fetch_sub(1);
+        }
+        read_guard(const read_guard&) = delete;
+        read_guard& operator=(const read_guard&) = delete;
+    private:
+        const list& list_;
+        uint32_t epoch_;
+    };
+
     list()
         : head_(nullptr){}
     list(const list&) = delete;
@@ -180,17 +289,18 @@ public:
     }
 
     template<typename... U>
-    void emplace_front(U&&... args){
+    T& emplace_front(U&&... args){
         auto n = new node(std::forward<U>(args)...);
         while (true){
             auto head = head_.load(std::memory_order_acquire);
-            n->next_ = head;
+            n->next_.store(head, std::memory_order_relaxed);
             // check if the head has changed and update it atomically
             if (head_.compare_exchange_strong(head, n)){
                 break;
             }
         }
         size_++;
+        return n->data_;
     }
 
     T& front() { return *begin(); }
@@ -215,22 +325,103 @@ public:
 
     int32_t size() const { return size_.load(std::memory_order_acquire); }
 
+    // unlink all items matching the predicate, they are freed later by
+    // reclaim() (also called here). Returns the number removed.
+    template<typename Pred>
+    int32_t remove_if(Pred&& pred){
+        std::lock_guard<std::mutex> lock(remove_mutex_);
+        int32_t count = 0;
+    again:
+        auto link = &head_;
+        auto n = link->load(std::memory_order_acquire);
+        while (n){
+            auto next = n->next_.load(std::memory_order_acquire);
+            if (pred(n->data_)){
+                if (link == &head_){
+                    // emplace_front() might have put a new one before it
+                    auto expected = n;
+                    if (!head_.compare_exchange_strong(expected, next)){
+                        goto again;
+                    }
+                } else {
+                    // only we change the links after the head
+                    link->store(next, std::memory_order_release);
+                }
+                // its own link stays, for the guards still standing on it
+                retired_.push_back({ n, epoch_.load() });
+                size_--;
+                count++;
+            } else {
+                link = &n->next_;
+            }
+            n = next;
+        }
+        reclaim_locked();
+        return count;
+    }
+
+    // free the removed items no read_guard can reach anymore,
+    // returns the number still waiting.
+    int32_t reclaim(){
+        std::lock_guard<std::mutex> lock(remove_mutex_);
+        return reclaim_locked();
+    }
+
     // the deletion of nodes itself is not thread-safe!!!
     void clear(){
         size_ = 0;
         auto it = head_.exchange(nullptr);
         while (it){
-            auto next = it->next_;
+            auto next = it->next_.load();
             delete it;
             it = next;
         }
+        std::lock_guard<std::mutex> lock(remove_mutex_);
+        for (auto& r : retired_){
+            delete r.ptr;
+        }
+        retired_.clear();
     }
     ~list(){
         clear();
     }
 private:
+    int32_t reclaim_locked(){
+        if (retired_.empty()){
+            return 0;
+        }
+        auto epoch = epoch_.load();
+        // move on if nobody is left in the epoch before
+        if (readers_[(epoch + 1) & 1].load() == 0){
+            epoch_.store(++epoch);
+        }
+        // the current epoch may still have guards from before a removal,
+        // the one before only if somebody is still counted in it.
+        bool lastdone = readers_[(epoch - 1) & 1].load() == 0;
+        auto it = retired_.begin();
+        while (it != retired_.end()){
+            auto age = epoch - it->epoch;
+            if (age >= 2 || (age == 1 && lastdone)){
+                delete it->ptr;
+                it = retired_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        return (int32_t)retired_.size();
+    }
+
+    struct retired_node {
+        node *ptr;
+        uint32_t epoch;
+    };
+
     std::atomic<node *> head_{nullptr};
     std::atomic<int32_t> size_{0};
+    mutable std::atomic<uint32_t> epoch_{0};
+    mutable std::atomic<int32_t> readers_[2] = { {0}, {0} };
+    std::mutex remove_mutex_;
+    std::vector<retired_node> retired_;
 };
 
 } // lockfree
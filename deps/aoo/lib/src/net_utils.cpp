@@ -1,6 +1,12 @@
 #include "net_utils.hpp"
 
 #include <stdio.h>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <ifaddrs.h>
+#include <net/if.h>
+#endif
 
 namespace aoo {
 namespace net {
@@ -113,5 +119,117 @@ int socket_connect(int socket, const ip_address& addr, float timeout)
     return 0;
 }
 
+int socket_family(int socket){
+    ip_address addr;
+    if (getsockname(socket, (struct sockaddr *)&addr.address, &addr.length) < 0){
+        return AF_UNSPEC;
+    }
+    return addr.address.ss_family;
+}
+
+int socket_dual_stack(int type){
+    int sock = socket(AF_INET6, type, 0);
+    if (sock >= 0){
+        int val = 0;
+        if (setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, (char *)&val, sizeof(val)) == 0){
+            return sock;
+        }
+        socket_close(sock);
+    }
+    return socket(AF_INET, type, 0);
+}
+
+int socket_bind_any(int socket, int port){
+    if (socket_family(socket) == AF_INET6){
+        struct sockaddr_in6 sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sin6_family = AF_INET6;
+        sa.sin6_addr = in6addr_any;
+        sa.sin6_port = htons(port);
+        return bind(socket, (const struct sockaddr *)&sa, sizeof(sa));
+    } else {
+        struct sockaddr_in sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family = AF_INET;
+        sa.sin_addr.s_addr = INADDR_ANY;
+        sa.sin_port = htons(port);
+        return bind(socket, (const struct sockaddr *)&sa, sizeof(sa));
+    }
+}
+
+int resolve_host(const std::string& host, int port, std::vector<ip_address>& result){
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_NUMERICSERV;
+
+    struct addrinfo *info = nullptr;
+    auto portstr = std::to_string(port);
+    int err = getaddrinfo(host.c_str(), portstr.c_str(), &hints, &info);
+    if (err != 0){
+        return err;
+    }
+    for (auto ai = info; ai; ai = ai->ai_next){
+        if (ai->ai_family == AF_INET || ai->ai_family == AF_INET6){
+            ip_address addr(ai->ai_addr, (socklen_t)ai->ai_addrlen);
+            if (std::find(result.begin(), result.end(), addr) == result.end()){
+                result.push_back(addr);
+            }
+        }
+    }
+    freeaddrinfo(info);
+    return 0;
+}
+
+std::vector<std::string> local_interface_addresses(){
+    std::vector<std::string> result;
+#ifdef _WIN32
+    // the host name resolves to the addresses of all interfaces
+    char hostname[256];
+    if (gethostname(hostname, sizeof(hostname)) == 0){
+        std::vector<ip_address> addrs;
+        if (resolve_host(hostname, 0, addrs) == 0){
+            for (auto& addr : addrs){
+                if (addr.family() == AF_INET){
+                    auto sa = (const struct sockaddr_in *)&addr.address;
+                    if ((ntohl(sa->sin_addr.s_addr) >> 24) == 127){
+                        continue;
+                    }
+                } else {
+                    auto sa6 = (const struct sockaddr_in6 *)&addr.address;
+                    if (IN6_IS_ADDR_LOOPBACK(&sa6->sin6_addr)
+                            || IN6_IS_ADDR_LINKLOCAL(&sa6->sin6_addr)){
+                        continue;
+                    }
+                }
+                result.push_back(addr.name());
+            }
+        }
+    }
+#else
+    struct ifaddrs *ifaddr;
+    if (getifaddrs(&ifaddr) == 0){
+        for (auto ifa = ifaddr; ifa; ifa = ifa->ifa_next){
+            if (!ifa->ifa_addr || !(ifa->ifa_flags & IFF_UP) || (ifa->ifa_flags & IFF_LOOPBACK)){
+                continue;
+            }
+            if (ifa->ifa_addr->sa_family == AF_INET){
+                ip_address addr(ifa->ifa_addr, sizeof(struct sockaddr_in));
+                result.push_back(addr.name());
+            } else if (ifa->ifa_addr->sa_family == AF_INET6){
+                auto sa6 = (const struct sockaddr_in6 *)ifa->ifa_addr;
+                if (!IN6_IS_ADDR_LINKLOCAL(&sa6->sin6_addr)){
+                    ip_address addr(ifa->ifa_addr, sizeof(struct sockaddr_in6));
+                    result.push_back(addr.name());
+                }
+            }
+        }
+        freeifaddrs(ifaddr);
+    }
+#endif
+    return result;
+}
+
 } // net
 } // aoo
@@ -4,7 +4,7 @@
 
 #ifdef _WIN32
 #include <winsock2.h>
-typedef int socklen_t;
+#include <ws2tcpip.h>
 #else
 #include <sys/socket.h>
 #include <sys/select.h>
@@ -20,20 +20,28 @@ typedef int socklen_t;
 #include <errno.h>
 #endif
 
+#include <algorithm>
 #include <cstring>
 #include <string>
+#include <vector>
 
 namespace aoo {
 namespace net {
 
+// IPv4 or IPv6 address. IPv4-mapped IPv6 addresses, as returned by
+// dual-stack sockets, are stored as plain IPv4, so they compare equal
+// to the addresses in the protocol (see unmap() and mapped()).
 struct ip_address {
     ip_address(){
         memset(&address, 0, sizeof(address));
         length = sizeof(address);
     }
     ip_address(const struct sockaddr *sa, socklen_t len){
-        memcpy(&address, sa, len);
-        length = len;
+        // zeroed, so nothing past a shorter address is left undefined
+        memset(&address, 0, sizeof(address));
+        length = std::min<socklen_t>(len, sizeof(address));
+        memcpy(&address, sa, length);
+        unmap();
     }
     ip_address(uint32_t ipv4, int port){
         struct sockaddr_in sa;
@@ -44,14 +52,27 @@ struct ip_address {
         memcpy(&address, &sa, sizeof(sa));
         length = sizeof(sa);
     }
+    // numeric IPv4 or IPv6 address
     ip_address(const std::string& host, int port){
-        struct sockaddr_in sa;
-        memset(&sa, 0, sizeof(sa));
-        sa.sin_family = AF_INET;
-        sa.sin_addr.s_addr = inet_addr(host.c_str());
-        sa.sin_port = htons(port);
-        memcpy(&address, &sa, sizeof(sa));
-        length = sizeof(sa);
+        memset(&address, 0, sizeof(address));
+        struct sockaddr_in6 sa6;
+        memset(&sa6, 0, sizeof(sa6));
+        if (host.find(':') != std::string::npos
+                && inet_pton(AF_INET6, host.c_str(), &sa6.sin6_addr) == 1){
+            sa6.sin6_family = AF_INET6;
+            sa6.sin6_port = htons(port);
+            memcpy(&address, &sa6, sizeof(sa6));
+            length = sizeof(sa6);
+            unmap();
+        } else {
+            struct sockaddr_in sa;
+            memset(&sa, 0, sizeof(sa));
+            sa.sin_family = AF_INET;
+            sa.sin_addr.s_addr = inet_addr(host.c_str());
+            sa.sin_port = htons(port);
+            memcpy(&address, &sa, sizeof(sa));
+            length = sizeof(sa);
+        }
     }
 
     ip_address(const ip_address& other){
@@ -72,8 +93,12 @@ struct ip_address {
                 auto b = (const struct sockaddr_in *)&other.address;
                 return (a->sin_addr.s_addr == b->sin_addr.s_addr)
                         && (a->sin_port == b->sin_port);
-            } else  {
-                // IPv6 not supported yet
+            } else if (address.ss_family == AF_INET6){
+                auto a = (const struct sockaddr_in6 *)&address;
+                auto b = (const struct sockaddr_in6 *)&other.address;
+                return !memcmp(&a->sin6_addr, &b->sin6_addr, sizeof(a->sin6_addr))
+                        && (a->sin6_port == b->sin6_port);
+            } else {
                 return false;
             }
         #else
@@ -85,22 +110,92 @@ struct ip_address {
         }
     }
 
+    // compare only the IP address, not the port
+    bool same_host(const ip_address& other) const {
+        if (address.ss_family != other.address.ss_family){
+            return false;
+        } else if (address.ss_family == AF_INET){
+            return ((const struct sockaddr_in *)&address)->sin_addr.s_addr
+                    == ((const struct sockaddr_in *)&other.address)->sin_addr.s_addr;
+        } else if (address.ss_family == AF_INET6){
+            return !memcmp(&((const struct sockaddr_in6 *)&address)->sin6_addr,
+                           &((const struct sockaddr_in6 *)&other.address)->sin6_addr,
+                           sizeof(struct in6_addr));
+        } else {
+            return false;
+        }
+    }
+
     std::string name() const {
+        char buf[INET6_ADDRSTRLEN];
         if (address.ss_family == AF_INET){
-            return inet_ntoa(reinterpret_cast<const struct sockaddr_in *>(&address)->sin_addr);
-        } else {
-            return "";
+            auto sa = reinterpret_cast<const struct sockaddr_in *>(&address);
+            if (inet_ntop(AF_INET, (void *)&sa->sin_addr, buf, sizeof(buf))){
+                return buf;
+            }
+        } else if (address.ss_family == AF_INET6){
+            auto sa = reinterpret_cast<const struct sockaddr_in6 *>(&address);
+            if (inet_ntop(AF_INET6, (void *)&sa->sin6_addr, buf, sizeof(buf))){
+                return buf;
+            }
         }
+        return "";
     }
 
     int port() const {
         if (address.ss_family == AF_INET){
             return ntohs(reinterpret_cast<const struct sockaddr_in *>(&address)->sin_port);
+        } else if (address.ss_family == AF_INET6){
+            return ntohs(reinterpret_cast<const struct sockaddr_in6 *>(&address)->sin6_port);
         } else {
             return -1;
         }
     }
 
+    int family() const {
+        return address.ss_family;
+    }
+
+    // call after accept(), recvfrom(), etc. on a dual-stack socket
+    void unmap(){
+        // there has to be all of an IPv6 address to look at
+        if (address.ss_family == AF_INET6
+                && length >= (socklen_t)sizeof(struct sockaddr_in6)){
+            auto sa6 = (const struct sockaddr_in6 *)&address;
+            if (IN6_IS_ADDR_V4MAPPED(&sa6->sin6_addr)){
+                struct sockaddr_in sa;
+                memset(&sa, 0, sizeof(sa));
+                sa.sin_family = AF_INET;
+                sa.sin_port = sa6->sin6_port;
+                memcpy(&sa.sin_addr, &sa6->sin6_addr.s6_addr[12], 4);
+                memset(&address, 0, sizeof(address));
+                memcpy(&address, &sa, sizeof(sa));
+                length = sizeof(sa);
+            }
+        }
+    }
+
+    // the address for sending on a socket of the given family,
+    // i.e. IPv4 addresses are mapped for dual-stack sockets.
+    ip_address mapped(int family) const {
+        if (family == AF_INET6 && address.ss_family == AF_INET){
+            auto sa = (const struct sockaddr_in *)&address;
+            struct sockaddr_in6 sa6;
+            memset(&sa6, 0, sizeof(sa6));
+            sa6.sin6_family = AF_INET6;
+            sa6.sin6_port = sa->sin_port;
+            sa6.sin6_addr.s6_addr[10] = 0xff;
+            sa6.sin6_addr.s6_addr[11] = 0xff;
+            memcpy(&sa6.sin6_addr.s6_addr[12], &sa->sin_addr, 4);
+            ip_address result;
+            memcpy(&result.address, &sa6, sizeof(sa6));
+            result.length = sizeof(sa6);
+            return result;
+        } else {
+            return *this;
+        }
+    }
+
     struct sockaddr_storage address;
     socklen_t length;
 };
@@ -115,5 +210,61 @@ int socket_set_nonblocking(int socket, int nonblocking);
 
 int socket_connect(int socket, const ip_address& addr, float timeout);
 
+// the address family of a socket (AF_INET or AF_INET6)
+int socket_family(int socket);
+
+// create a socket which takes both IPv6 and IPv4 (as mapped addresses).
+// falls back to a plain IPv4 socket if the system has no IPv6 support.
+int socket_dual_stack(int type);
+
+// bind a socket to the 'any' address of its family
+int socket_bind_any(int socket, int port);
+
+// resolve a host name (or numeric address) to all of its IPv4 and IPv6 addresses
+int resolve_host(const std::string& host, int port, std::vector<ip_address>& result);
+
+// IP addresses of all network interfaces which are up, except for loopback
+// and (because of the scope ids) IPv6 link-local addresses
+std::vector<std::string> local_interface_addresses();
+
+// Events are written in place into the slots of a preallocated queue, so the
+// strings and addresses they point to live in the slot as well and nothing
+// gets allocated (see client::push_event() and server::push_event()).
+// The events must not be copied, or they would point into the old slot.
+// Strings beyond what fits into the slot are truncated.
+const int32_t event_string_size = 512;
+
+// copy s into buf at pos and advance pos, returns the copy
+inline const char * pack_event_string(char *buf, int32_t& pos, const char *s){
+    if (!s){
+        return nullptr;
+    }
+    int32_t avail = event_string_size - pos;
+    if (avail <= 0){
+        return buf + event_string_size - 1; // the last terminator
+    }
+    int32_t len = std::min<int32_t>((int32_t)strlen(s), avail - 1);
+    memcpy(buf + pos, s, len);
+    buf[pos + len] = '\0';
+    auto result = buf + pos;
+    pos += len + 1;
+    return result;
+}
+
+// copy an IPv4 or IPv6 address into ss, returns the copy
+inline void * pack_event_sockaddr(sockaddr_storage& ss, const void *sa){
+    if (sa){
+        auto family = static_cast<const sockaddr *>(sa)->sa_family;
+        if (family == AF_INET){
+            memcpy(&ss, sa, sizeof(sockaddr_in));
+            return &ss;
+        } else if (family == AF_INET6){
+            memcpy(&ss, sa, sizeof(sockaddr_in6));
+            return &ss;
+        }
+    }
+    return nullptr;
+}
+
 } // net
 } // aoo
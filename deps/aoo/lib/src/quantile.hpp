@@ -0,0 +1,84 @@
+/* Copyright (c) 2010-Now Christof Ressi, Winfried Ritsch and others.
+ * For information on usage and redistribution, and for a DISCLAIMER OF ALL
+ * WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace aoo {
+
+// Streaming quantiles of a non-negative value, from a histogram with fixed bins
+// whose counts decay exponentially, so that the recent past counts the most.
+// Heavy tails are ranked as they are, unlike with mean and deviation.
+// Values beyond the last bin count into it. Pushing is O(1), looking up a
+// quantile O(nbins). Not thread safe.
+class quantile_histogram {
+public:
+    // 'halflife' is in number of pushes
+    void setup(double binwidth, int32_t nbins, double halflife){
+        binwidth_ = binwidth;
+        bins_.assign(std::max<int32_t>(1, nbins), 0.0);
+        // instead of decaying all bins on every push, the newer values get
+        // an ever growing weight. It is brought back down once it gets large.
+        growth_ = std::pow(2.0, 1.0 / std::max(1.0, halflife));
+        weight_ = 1.0;
+        total_ = 0.0;
+    }
+
+    void reset(){
+        std::fill(bins_.begin(), bins_.end(), 0.0);
+        weight_ = 1.0;
+        total_ = 0.0;
+    }
+
+    void push(double value){
+        if (bins_.empty()){
+            return;
+        }
+        auto index = (int32_t)(std::max(0.0, value) / binwidth_);
+        index = std::min<int32_t>(index, (int32_t)bins_.size() - 1);
+        bins_[index] += weight_;
+        total_ += weight_;
+        weight_ *= growth_;
+        if (weight_ > 1e100){
+            for (auto& b : bins_){
+                b /= weight_;
+            }
+            total_ /= weight_;
+            weight_ = 1.0;
+        }
+    }
+
+    // the effective number of values, it levels off at about halflife / ln(2)
+    double count() const {
+        return total_ / weight_;
+    }
+
+    // the upper edge of the bin where the given fraction of the values is reached
+    double quantile(double q) const {
+        if (total_ <= 0){
+            return 0;
+        }
+        const double target = total_ * std::max(0.0, std::min(1.0, q));
+        double sum = 0;
+        for (size_t i = 0; i < bins_.size(); ++i){
+            sum += bins_[i];
+            if (sum >= target){
+                return (i + 1) * binwidth_;
+            }
+        }
+        return bins_.size() * binwidth_;
+    }
+private:
+    std::vector<double> bins_;
+    double binwidth_ = 1;
+    double growth_ = 1;
+    double weight_ = 1;
+    double total_ = 0;
+};
+
+} // aoo
@@ -7,6 +7,21 @@
 #include <functional>
 #include <algorithm>
 #include <random>
+#include <limits>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#include <sys/stat.h>
+#endif
+
+#define AOONET_MSG_SERVER_PING \
+    AOO_MSG_DOMAIN AOONET_MSG_SERVER AOONET_MSG_PING
+
+#define AOONET_MSG_SERVER_REQUEST \
+    AOO_MSG_DOMAIN AOONET_MSG_SERVER AOONET_MSG_REQUEST
 
 #define AOONET_MSG_CLIENT_PING \
     AOO_MSG_DOMAIN AOONET_MSG_CLIENT AOONET_MSG_PING
@@ -48,29 +63,34 @@
 #define AOONET_MSG_GROUP_PUBLIC \
     AOONET_MSG_GROUP AOONET_MSG_PUBLIC
 
+#define AOONET_MSG_CLIENT_ROUTE \
+    AOO_MSG_DOMAIN AOONET_MSG_CLIENT AOONET_MSG_ROUTE
 
-namespace aoo {
-namespace net {
+#define AOONET_MSG_SERVER_NODE_JOIN \
+    AOO_MSG_DOMAIN AOONET_MSG_SERVER AOONET_MSG_NODE AOONET_MSG_JOIN
 
-char * copy_string(const char * s);
+#define AOONET_MSG_SERVER_NODE_LEAVE \
+    AOO_MSG_DOMAIN AOONET_MSG_SERVER AOONET_MSG_NODE AOONET_MSG_LEAVE
 
-} // net
-} // aoo
+#define AOONET_MSG_NODE_JOIN \
+    AOONET_MSG_NODE AOONET_MSG_JOIN
+
+#define AOONET_MSG_NODE_LEAVE \
+    AOONET_MSG_NODE AOONET_MSG_LEAVE
+
+// default admission rates per IP address and second (see rate_limiter),
+// generous for people behind a shared NAT but a hard stop for floods
+#define AOONET_ACCEPT_RATE 5
+#define AOONET_LOGIN_RATE 5
+#define AOONET_UDP_RATE 100
 
 /*//////////////////// AoO server /////////////////////*/
 
 aoonet_server * aoonet_server_new(int port, int32_t *err) {
     int val = 0;
 
-    // make 'any' address
-    sockaddr_in sa;
-    memset(&sa, 0, sizeof(sa));
-    sa.sin_family = AF_INET;
-    sa.sin_addr.s_addr = INADDR_ANY;
-    sa.sin_port = htons(port);
-
-    // create and bind UDP socket
-    int udpsocket = socket(AF_INET, SOCK_DGRAM, 0);
+    // create and bind UDP socket (IPv6 and IPv4, if possible)
+    int udpsocket = aoo::net::socket_dual_stack(SOCK_DGRAM);
     if (udpsocket < 0){
         *err = aoo::net::socket_errno();
         LOG_ERROR("aoo_server: couldn't create UDP socket (" << *err << ")");
@@ -89,7 +109,7 @@ aoonet_server * aoonet_server_new(int port, int32_t *err) {
     }
 #endif
 
-    if (bind(udpsocket, (sockaddr *)&sa, sizeof(sa)) < 0){
+    if (aoo::net::socket_bind_any(udpsocket, port) < 0){
         *err = aoo::net::socket_errno();
         LOG_ERROR("aoo_server: couldn't bind UDP socket (" << *err << ")");
         aoo::net::socket_close(udpsocket);
@@ -97,7 +117,7 @@ aoonet_server * aoonet_server_new(int port, int32_t *err) {
     }
 
     // create TCP socket
-    int tcpsocket = socket(AF_INET, SOCK_STREAM, 0);
+    int tcpsocket = aoo::net::socket_dual_stack(SOCK_STREAM);
     if (tcpsocket < 0){
         *err = aoo::net::socket_errno();
         LOG_ERROR("aoo_server: couldn't create TCP socket (" << *err << ")");
@@ -117,6 +137,18 @@ aoonet_server * aoonet_server_new(int port, int32_t *err) {
         return nullptr;
     }
 
+#if AOO_SERVER_EPOLL && defined(SO_REUSEPORT)
+    // set SO_REUSEPORT, so additional I/O shards can have their own listening
+    // socket on the same port and the kernel spreads the connections
+    val = 1;
+    if (setsockopt(tcpsocket, SOL_SOCKET, SO_REUSEPORT,
+                      (char *)&val, sizeof(val)) < 0)
+    {
+        LOG_WARNING("aoo_server: couldn't set SO_REUSEPORT");
+        // ignore, accepted clients will be handed over instead
+    }
+#endif
+
     // set TCP_NODELAY
     val = 1;
     if (setsockopt(tcpsocket, IPPROTO_TCP, TCP_NODELAY, (char *)&val, sizeof(val)) < 0){
@@ -138,7 +170,7 @@ aoonet_server * aoonet_server_new(int port, int32_t *err) {
 #endif
 
     // bind TCP socket
-    if (bind(tcpsocket, (sockaddr *)&sa, sizeof(sa)) < 0){
+    if (aoo::net::socket_bind_any(tcpsocket, port) < 0){
         *err = aoo::net::socket_errno();
         LOG_ERROR("aoo_server: couldn't bind TCP socket (" << *err << ")");
         aoo::net::socket_close(tcpsocket);
@@ -158,9 +190,302 @@ aoonet_server * aoonet_server_new(int port, int32_t *err) {
     return new aoo::net::server(tcpsocket, udpsocket);
 }
 
+#if AOO_SERVER_EPOLL || AOO_SERVER_KQUEUE
+
+namespace aoo {
+namespace net {
+
+static const int maxreadyevents = 64;
+
+static int create_poll_instance(){
+#if AOO_SERVER_EPOLL
+    return epoll_create1(EPOLL_CLOEXEC);
+#else
+    return kqueue();
+#endif
+}
+
+struct poll_event {
+    void *data;
+    bool read;
+    bool write;
+};
+
+// monotonic time in microseconds, for the event loop statistics
+static uint64_t loop_clock(){
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// monotonic time in seconds
+static double relay_time(){
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// wait until some of the sockets registered with 'pollfd' are readable (or writable),
+// 'ready' receives their data pointers (see server::add_socket()).
+// 'timeout' is in milliseconds, -1 waits forever.
+static int wait_events(int pollfd, poll_event *ready, int timeout = -1){
+#if AOO_SERVER_EPOLL
+    struct epoll_event events[maxreadyevents];
+    int result = epoll_wait(pollfd, events, maxreadyevents, timeout);
+#else
+    struct kevent events[maxreadyevents];
+    struct timespec ts;
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000;
+    int result = kevent(pollfd, nullptr, 0, events, maxreadyevents,
+                        timeout >= 0 ? &ts : nullptr);
+#endif
+    if (result < 0){
+        int err = errno;
+        if (err != EINTR){
+            LOG_ERROR("aoo_server: waiting for events failed (" << err << ")");
+        }
+        return 0;
+    }
+
+    int count = 0;
+    for (int i = 0; i < result; ++i){
+    #if AOO_SERVER_EPOLL
+        auto& ev = ready[count++];
+        ev.data = events[i].data.ptr;
+        ev.read = events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR);
+        ev.write = events[i].events & EPOLLOUT;
+    #else
+        if (events[i].filter == EVFILT_READ || events[i].filter == EVFILT_WRITE){
+            auto& ev = ready[count++];
+            ev.data = (void *)events[i].udata;
+            ev.read = events[i].filter == EVFILT_READ;
+            ev.write = events[i].filter == EVFILT_WRITE;
+        }
+    #endif
+    }
+    return count;
+}
+
+// another listening socket on the same port as 'tcpsocket', for an I/O shard
+static int create_shard_listener(int tcpsocket){
+#if AOO_SERVER_EPOLL && defined(SO_REUSEPORT)
+    sockaddr_storage sa;
+    socklen_t len = sizeof(sa);
+    if (getsockname(tcpsocket, (sockaddr *)&sa, &len) < 0){
+        return -1;
+    }
+
+    int sock = socket(sa.ss_family, SOCK_STREAM, 0);
+    if (sock < 0){
+        return -1;
+    }
+
+    int val = 0;
+    if (sa.ss_family == AF_INET6){
+        // dual-stack, like the main listening socket
+        setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, (char *)&val, sizeof(val));
+    }
+    val = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char *)&val, sizeof(val)) < 0
+        || setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (char *)&val, sizeof(val)) < 0
+        || ioctl(sock, FIONBIO, (char *)&val) < 0
+        || bind(sock, (sockaddr *)&sa, len) < 0
+        || listen(sock, 32) < 0)
+    {
+        LOG_WARNING("aoo_server: couldn't create listening socket for I/O shard ("
+                    << socket_errno() << ")");
+        socket_close(sock);
+        return -1;
+    }
+    return sock;
+#else
+    (void)tcpsocket;
+    return -1;
+#endif
+}
+
+// an additional I/O thread with its own epoll/kqueue instance and set of clients.
+// on Linux it accepts connections on its own SO_REUSEPORT socket, otherwise
+// the server thread accepts and hands the new clients over.
+struct server::io_shard {
+    io_shard(server& s);
+    ~io_shard();
+
+    void start();
+    void stop();
+    void close_clients();
+
+    bool has_listener() const { return listensocket_ >= 0; }
+
+    // called on the server thread
+    void hand_over(int sock, const ip_address& addr);
+private:
+    void run();
+    void signal();
+    void accept_clients();
+
+    server& server_;
+    int pollfd_ = -1;
+    int waitpipe_[2] = { -1, -1 };
+    int listensocket_ = -1;
+    std::vector<std::unique_ptr<client_endpoint>> clients_;
+    std::vector<std::pair<int, ip_address>> handovers_;
+    spinlock handoverlock_;
+    std::thread thread_;
+};
+
+server::io_shard::io_shard(server &s)
+    : server_(s)
+{
+    pollfd_ = create_poll_instance();
+    if (pollfd_ < 0){
+        LOG_ERROR("aoo_server: couldn't create event queue (" << errno << ")");
+    }
+    if (pipe(waitpipe_) != 0){
+        LOG_ERROR("aoo_server: couldn't create pipe (" << errno << ")");
+    }
+    add_socket(pollfd_, waitpipe_[0], &waitpipe_[0]);
+
+    listensocket_ = create_shard_listener(s.tcpsocket_);
+    if (listensocket_ >= 0){
+        add_socket(pollfd_, listensocket_, &listensocket_);
+    }
+}
+
+server::io_shard::~io_shard(){
+    stop();
+    // clients deregister themselves
+    clients_.clear();
+    close_clients();
+
+    if (listensocket_ >= 0){
+        socket_close(listensocket_);
+    }
+    close(waitpipe_[0]);
+    close(waitpipe_[1]);
+    if (pollfd_ >= 0){
+        close(pollfd_);
+    }
+}
+
+void server::io_shard::start(){
+    thread_ = std::thread([this](){ run(); });
+}
+
+void server::io_shard::stop(){
+    if (thread_.joinable()){
+        signal();
+        thread_.join();
+    }
+}
+
+void server::io_shard::close_clients(){
+    // like in server::run(), don't send anything out
+    for (auto& c : clients_){
+        c->close(false);
+    }
+    scoped_lock<spinlock> lock(handoverlock_);
+    for (auto& h : handovers_){
+        socket_close(h.first);
+    }
+    handovers_.clear();
+}
+
+void server::io_shard::hand_over(int sock, const ip_address &addr){
+    {
+        scoped_lock<spinlock> lock(handoverlock_);
+        handovers_.emplace_back(sock, addr);
+    }
+    signal();
+}
+
+void server::io_shard::signal(){
+    write(waitpipe_[1], "\0", 1);
+}
+
+void server::io_shard::accept_clients(){
+    while (true){
+        ip_address addr;
+        int sock = accept(listensocket_, (struct sockaddr *)&addr.address, &addr.length);
+        if (sock >= 0){
+            addr.unmap();
+            if (!server_.admit_accept(addr)){
+                socket_close(sock);
+                continue;
+            }
+            clients_.push_back(std::make_unique<client_endpoint>(server_, sock, addr, pollfd_));
+            LOG_VERBOSE("aoo_server: accepted client (IP: "
+                        << addr.name() << ", port: " << addr.port() << ")");
+        } else {
+            int err = socket_errno();
+            if (err != EWOULDBLOCK){
+                LOG_ERROR("aoo_server: couldn't accept client (" << err << ")");
+            }
+            break;
+        }
+    }
+}
+
+void server::io_shard::run(){
+    while (!server_.quit_.load()){
+        poll_event ready[maxreadyevents];
+        int count = wait_events(pollfd_, ready);
+        auto start = loop_clock();
+
+        if (server_.quit_.load()){
+            break;
+        }
+
+        bool didclose = false;
+
+        for (int i = 0; i < count; ++i){
+            auto data = ready[i].data;
+            if (data == &waitpipe_[0]){
+                // clear pipe
+                char c;
+                read(waitpipe_[0], &c, 1);
+
+                std::vector<std::pair<int, ip_address>> handovers;
+                {
+                    scoped_lock<spinlock> lock(handoverlock_);
+                    handovers.swap(handovers_);
+                }
+                for (auto& h : handovers){
+                    clients_.push_back(std::make_unique<client_endpoint>(server_, h.first, h.second, pollfd_));
+                }
+            } else if (data == &listensocket_){
+                accept_clients();
+            } else {
+                auto client = (client_endpoint *)data;
+                if (ready[i].write && client->is_active()){
+                    client->on_writable();
+                }
+                if (ready[i].read && client->is_active() && !client->receive_data()){
+                    client->close();
+                    didclose = true;
+                }
+            }
+        }
+
+        server_.finish_batch(clients_, didclose);
+        server_.loop_done(start);
+    }
+}
+
+} // net
+} // aoo
+
+#else
+
+// only available with epoll/kqueue
+struct aoo::net::server::io_shard {};
+
+#endif // AOO_SERVER_EPOLL || AOO_SERVER_KQUEUE
+
 aoo::net::server::server(int tcpsocket, int udpsocket)
     : tcpsocket_(tcpsocket), udpsocket_(udpsocket)
 {
+    udpfamily_ = socket_family(udpsocket_);
+
 #ifdef _WIN32
     waitevent_ = CreateEvent(NULL, FALSE, FALSE, NULL);
     tcpevent_ = WSACreateEvent();
@@ -171,9 +496,24 @@ aoo::net::server::server(int tcpsocket, int udpsocket)
     if (pipe(waitpipe_) != 0){
         // TODO handle error
     }
+#endif
+#if AOO_SERVER_EPOLL || AOO_SERVER_KQUEUE
+    pollfd_ = create_poll_instance();
+    if (pollfd_ < 0){
+        LOG_ERROR("aoo_server: couldn't create event queue (" << errno << ")");
+    }
+    // our own sockets are tagged with the address of their member
+    add_socket(pollfd_, tcpsocket_, &tcpsocket_);
+    add_socket(pollfd_, udpsocket_, &udpsocket_);
+    add_socket(pollfd_, waitpipe_[0], &waitpipe_[0]);
 #endif
     commands_.resize(256, 1);
     events_.resize(256, 1);
+
+    set_rate_limits(AOONET_ACCEPT_RATE, AOONET_LOGIN_RATE, AOONET_UDP_RATE);
+
+    std::random_device randdev;
+    node_id_ = ((uint64_t)randdev() << 32) | randdev();
 }
 
 void aoonet_server_free(aoonet_server *server){
@@ -183,6 +523,7 @@ void aoonet_server_free(aoonet_server *server){
 }
 
 aoo::net::server::~server() {
+    shards_.clear();
 #ifdef _WIN32
     CloseHandle(waitevent_);
     WSACloseEvent(tcpevent_);
@@ -191,6 +532,13 @@ aoo::net::server::~server() {
     close(waitpipe_[0]);
     close(waitpipe_[1]);
 #endif
+#if AOO_SERVER_EPOLL || AOO_SERVER_KQUEUE
+    // close all clients first, they deregister themselves
+    clients_.clear();
+    if (pollfd_ >= 0){
+        close(pollfd_);
+    }
+#endif
 
     socket_close(tcpsocket_);
     socket_close(udpsocket_);
@@ -201,6 +549,20 @@ int32_t aoonet_server_run(aoonet_server *server){
 }
 
 int32_t aoo::net::server::run(){
+#if AOO_SERVER_EPOLL || AOO_SERVER_KQUEUE
+    // the server thread is the first shard
+    shards_.clear();
+    for (int i = 1; i < num_io_threads_; ++i){
+        shards_.push_back(std::make_unique<io_shard>(*this));
+    }
+    for (auto& shard : shards_){
+        shard->start();
+    }
+#endif
+#if AOO_SERVER_URING
+    start_udp_ring();
+#endif
+
     while (!quit_.load()){
         // wait for networking or other events
         wait_for_event();
@@ -213,16 +575,46 @@ int32_t aoo::net::server::run(){
         while (commands_.read_available()){
             std::unique_ptr<icommand> cmd;
             commands_.read(cmd);
+            unique_lock lock(state_mutex_);
             cmd->perform(*this);
+            flush_clients();
+        }
+
+        if (have_nodes_.load()){
+            update_nodes();
+        }
+
+        if (have_public_changes_.load()){
+            update_public_groups();
         }
+
+        update_sessions();
     }
 
+    // so that everybody who is still here can resume after a restart
+    update_sessions(true);
+
+#if AOO_SERVER_URING
+    stop_udp_ring();
+#endif
+
+#if AOO_SERVER_EPOLL || AOO_SERVER_KQUEUE
+    for (auto& shard : shards_){
+        shard->stop();
+    }
+#endif
+
     // need to close all the clients sockets without
     // having them send anything out, so that active communication
     // between connected peers can continue if the server goes down for maintainence
-    for (int i = 0; i < clients_.size(); ++i){
+    for (size_t i = 0; i < clients_.size(); ++i){
         clients_[i]->close(false);
     }
+#if AOO_SERVER_EPOLL || AOO_SERVER_KQUEUE
+    for (auto& shard : shards_){
+        shard->close_clients();
+    }
+#endif
     
     return 1;
 }
@@ -237,6 +629,218 @@ int32_t aoo::net::server::quit(){
     return 0;
 }
 
+int32_t aoonet_server_set_io_threads(aoonet_server *server, int32_t n){
+    return server->set_io_threads(n);
+}
+
+int32_t aoo::net::server::set_io_threads(int32_t n){
+#if AOO_SERVER_EPOLL || AOO_SERVER_KQUEUE
+    num_io_threads_ = std::max<int32_t>(1, n);
+    return 1;
+#else
+    if (n > 1){
+        LOG_WARNING("aoo_server: multiple I/O threads not supported on this platform");
+    }
+    return 0;
+#endif
+}
+
+int32_t aoonet_server_set_send_queue_limit(aoonet_server *server, int32_t bytes){
+    return server->set_send_queue_limit(bytes);
+}
+
+int32_t aoo::net::server::set_send_queue_limit(int32_t bytes){
+    send_queue_limit_.store(std::max<int32_t>(AOO_MAXPACKETSIZE, bytes));
+    return 1;
+}
+
+int32_t aoonet_server_get_send_stats(aoonet_server *server,
+                                     aoonet_server_send_stats *stats){
+    if (stats){
+        return server->get_send_stats(*stats);
+    } else {
+        return 0;
+    }
+}
+
+int32_t aoo::net::server::get_send_stats(aoonet_server_send_stats& stats) const {
+    stats.messages = stats_.messages.load();
+    stats.bytes_sent = stats_.bytes_sent.load();
+    stats.dropped = stats_.dropped.load();
+    stats.would_block = stats_.would_block.load();
+    stats.disconnects = stats_.disconnects.load();
+    stats.max_queued = stats_.max_queued.load();
+    return 1;
+}
+
+int32_t aoonet_server_set_relay(aoonet_server *server, int32_t enable,
+                                int32_t bandwidth){
+    return server->set_relay(enable != 0, bandwidth);
+}
+
+int32_t aoo::net::server::set_relay(bool enable, int32_t bandwidth){
+    relay_bandwidth_.store(std::max<int32_t>(0, bandwidth));
+    relay_enabled_.store(enable);
+    return 1;
+}
+
+int32_t aoonet_server_get_relay_stats(aoonet_server *server,
+                                      aoonet_server_relay_stats *stats){
+    if (stats){
+        return server->get_relay_stats(*stats);
+    } else {
+        return 0;
+    }
+}
+
+int32_t aoo::net::server::get_relay_stats(aoonet_server_relay_stats& stats) const {
+    stats.packets = relay_stats_.packets.load();
+    stats.bytes = relay_stats_.bytes.load();
+    stats.dropped = relay_stats_.dropped.load();
+    stats.rejected = relay_stats_.rejected.load();
+    stats.sessions = relay_stats_.sessions.load();
+    stats.xdp_packets = relay_stats_.xdp_packets.load();
+    return 1;
+}
+
+int32_t aoonet_server_get_stats(aoonet_server *server, aoonet_server_stats *stats){
+    if (stats){
+        return server->get_stats(*stats);
+    } else {
+        return 0;
+    }
+}
+
+int32_t aoo::net::server::get_stats(aoonet_server_stats& stats) const {
+    stats.clients = num_clients_.load();
+    {
+        shared_lock lock(state_mutex_);
+        stats.users = (int32_t) users_.size();
+        stats.groups = (int32_t) groups_.size();
+    }
+    stats.udp_packets = loop_stats_.udp_packets.load();
+    stats.udp_bytes = loop_stats_.udp_bytes.load();
+    stats.loops = loop_stats_.loops.load();
+    stats.loop_time = loop_stats_.time.load();
+    stats.max_loop_time = loop_stats_.max_time.load();
+    stats.quick_replies = loop_stats_.quick_replies.load();
+    {
+        shared_lock lock(state_mutex_);
+        stats.nodes = (int32_t) nodes_.size();
+    }
+    stats.remote_members = num_remote_members_.load();
+    stats.rejected_accepts = admission_stats_.rejected_accepts.load();
+    stats.rejected_logins = admission_stats_.rejected_logins.load();
+    stats.rejected_udp = admission_stats_.rejected_udp.load();
+    return 1;
+}
+
+int32_t aoonet_server_set_rate_limits(aoonet_server *server, int32_t accepts,
+                                      int32_t logins, int32_t udp){
+    return server->set_rate_limits(accepts, logins, udp);
+}
+
+int32_t aoo::net::server::set_rate_limits(int32_t accepts, int32_t logins, int32_t udp){
+    accept_limiter_.set_rate(std::max<int32_t>(0, accepts));
+    login_limiter_.set_rate(std::max<int32_t>(0, logins));
+    udp_limiter_.set_rate(std::max<int32_t>(0, udp));
+    return 1;
+}
+
+int32_t aoonet_server_set_snapshot(aoonet_server *server, const char *path, int32_t interval){
+    return server->set_snapshot(path, interval);
+}
+
+int32_t aoo::net::server::set_snapshot(const char *path, int32_t interval){
+    unique_lock lock(state_mutex_);
+    snapshot_path_ = path ? path : "";
+    snapshot_interval_ = std::max<int32_t>(1, interval);
+    if (!snapshot_path_.empty()){
+        // warm start
+        std::ifstream file(snapshot_path_, std::ios::binary);
+        if (file.is_open()){
+            read_snapshot(file);
+            LOG_VERBOSE("aoo_server: loaded " << sessions_.size()
+                        << " sessions from " << snapshot_path_);
+        }
+    }
+    return 1;
+}
+
+int32_t aoonet_server_set_xdp(aoonet_server *server, const char *ifname, int32_t queues){
+    return server->set_xdp(ifname, queues);
+}
+
+int32_t aoo::net::server::set_xdp(const char *ifname, int32_t queues){
+#if AOO_SERVER_XDP
+    if (xdp_){
+        for (int i = 0; i < xdp_->num_queues(); ++i){
+            remove_socket(pollfd_, xdp_->fd(i));
+        }
+        xdp_.reset();
+    }
+    if (!ifname || !*ifname){
+        return 1;
+    }
+    struct sockaddr_storage sa;
+    socklen_t len = sizeof(sa);
+    if (getsockname(udpsocket_, (struct sockaddr *)&sa, &len) != 0){
+        LOG_ERROR("aoo_server: getsockname() failed (" << socket_errno() << ")");
+        return 0;
+    }
+    ip_address local((struct sockaddr *)&sa, len);
+
+    std::unique_ptr<xdp_port> port(new xdp_port());
+    if (!port->open(ifname, local.port(), queues)){
+        LOG_ERROR("aoo_server: couldn't set up AF_XDP on " << ifname);
+        return 0;
+    }
+    xdp_ = std::move(port);
+    for (int i = 0; i < xdp_->num_queues(); ++i){
+        add_socket(pollfd_, xdp_->fd(i), xdp_->tag(i));
+    }
+    LOG_VERBOSE("aoo_server: AF_XDP on " << ifname << " with "
+                << xdp_->num_queues() << " queues");
+    return 1;
+#else
+    if (ifname && *ifname){
+        LOG_WARNING("aoo_server: AF_XDP not supported");
+    }
+    return 0;
+#endif
+}
+
+int32_t aoonet_server_add_node(aoonet_server *server, const char *host, int32_t port){
+    return server->add_node(host, port);
+}
+
+int32_t aoo::net::server::add_node(const char *host, int32_t port){
+    std::vector<ip_address> addrs;
+    if (resolve_host(host, port, addrs) != 0 || addrs.empty()){
+        LOG_ERROR("aoo_server: couldn't resolve node " << host);
+        return 0;
+    }
+    // IPv6 can only be reached on a dual-stack socket
+    auto addr = addrs.front();
+    for (auto& a : addrs){
+        if (a.family() == AF_INET || udpfamily_ == AF_INET6){
+            addr = a;
+            break;
+        }
+    }
+
+    {
+        unique_lock lock(state_mutex_);
+        if (std::find(nodes_.begin(), nodes_.end(), addr) == nodes_.end()){
+            nodes_.push_back(addr);
+        }
+        have_nodes_.store(true);
+    }
+    LOG_VERBOSE("aoo_server: added node " << addr.name() << ":" << addr.port());
+    signal(); // the server thread has to wake up regularly now
+    return 1;
+}
+
 int32_t aoonet_server_events_available(aoonet_server *server){
     return server->events_available();
 }
@@ -249,24 +853,29 @@ int32_t aoonet_server_handle_events(aoonet_server *server, aoo_eventhandler fn,
     return server->handle_events(fn, user);
 }
 
+int32_t aoonet_server_set_event_notify(aoonet_server *server, aoo_notifyfn fn, void *user){
+    return server->set_event_notify(fn, user);
+}
+
+int32_t aoo::net::server::set_event_notify(aoo_notifyfn fn, void *user){
+    eventnotifier_.set(fn, user);
+    return 1;
+}
+
 int32_t aoo::net::server::handle_events(aoo_eventhandler fn, void *user){
     // always thread-safe
     auto n = events_.read_available();
     if (n > 0){
-        // copy events
-        auto events = (ievent **)alloca(sizeof(ievent *) * n);
-        auto vec = (const aoo_event **)alloca(sizeof(aoo_event *) * n); // adjusted pointers
+        // the events stay in their slots until they have been handled
+        auto vec = (const aoo_event **)alloca(sizeof(aoo_event *) * n);
         for (int i = 0; i < n; ++i){
-            std::unique_ptr<ievent> ptr;
-            events_.read(ptr);
-            events[i] = ptr.release(); // get raw pointer
-            vec[i] = &events[i]->event_; // adjust pointer
+            vec[i] = &events_.read_data(i)->event_;
         }
         // send events
         fn(user, vec, n);
-        // manually free events
+        // release the slots
         for (int i = 0; i < n; ++i){
-            delete events[i];
+            events_.read_commit();
         }
     }
     return n;
@@ -310,7 +919,7 @@ std::shared_ptr<user> server::get_user(const std::string& name,
         // create new user (LATER add option to disallow this)
         if (true){
             usr = std::make_shared<user>(name, pwd);
-            users_.push_back(usr);
+            users_.emplace(name, usr);
             e = error::none;
             return usr;
         } else {
@@ -322,10 +931,9 @@ std::shared_ptr<user> server::get_user(const std::string& name,
 
 std::shared_ptr<user> server::find_user(const std::string& name)
 {
-    for (auto& usr : users_){
-        if (usr->name == name){
-            return usr;
-        }
+    auto it = users_.find(name);
+    if (it != users_.end()){
+        return it->second;
     }
     return nullptr;
 }
@@ -353,7 +961,7 @@ std::shared_ptr<group> server::get_group(const std::string& name,
         // create new group (LATER add option to disallow this)
         if (true){
             grp = std::make_shared<group>(name, pwd, is_public);
-            groups_.push_back(grp);
+            groups_.emplace(name, grp);
             e = error::none;
             return grp;
         } else {
@@ -365,103 +973,226 @@ std::shared_ptr<group> server::get_group(const std::string& name,
 
 std::shared_ptr<group> server::find_group(const std::string& name)
 {
-    for (auto& grp : groups_){
-        if (grp->name == name){
-            return grp;
-        }
+    auto it = groups_.find(name);
+    if (it != groups_.end()){
+        return it->second;
     }
     return nullptr;
 }
 
 int32_t server::get_group_count() const
 {
+    shared_lock lock(state_mutex_);
     return (int32_t) groups_.size();
 }
 
 int32_t server::get_user_count() const
 {
+    shared_lock lock(state_mutex_);
     return (int32_t) users_.size();    
 }
 
 void server::on_user_joined(user &usr){
-    auto e = std::make_unique<user_event>(AOONET_SERVER_USER_JOIN_EVENT,
-                                          usr.name.c_str());
-    push_event(std::move(e));
+    relay_generation_++;
+
+    push_user_event(AOONET_SERVER_USER_JOIN_EVENT, usr.name.c_str());
 }
 
 void server::on_user_left(user &usr){
-    auto e = std::make_unique<user_event>(AOONET_SERVER_USER_LEAVE_EVENT,
-                                          usr.name.c_str());
-    push_event(std::move(e));
-}
+    relay_generation_++;
 
-void server::on_user_joined_group(user& usr, group& grp){
-    // 1) send the new member to existing group members
-    // 2) send existing group members to the new member
-    for (auto& peer : grp.users()){
-        if (peer.get() != &usr){
-            char buf[AOO_MAXPACKETSIZE];
+    // the client might just have lost the connection
+    auto it = sessions_.find(usr.name);
+    if (it != sessions_.end()){
+        it->second.active = false;
+        it->second.last_seen = relay_time();
+    }
 
-            auto notify = [&](client_endpoint* dest, user& u){
-                auto e = u.endpoint;
+    push_user_event(AOONET_SERVER_USER_LEAVE_EVENT, usr.name.c_str());
+}
 
-                osc::OutboundPacketStream msg(buf, sizeof(buf));
-                msg << osc::BeginMessage(AOONET_MSG_CLIENT_PEER_JOIN)
-                    << grp.name.c_str() << u.name.c_str()
-                    << e->public_address.name().c_str() << e->public_address.port()
-                    << e->local_address.name().c_str() << e->local_address.port()
-                    << e->token
-                    << osc::EndMessage;
+// packs several OSC messages for the same client into as few
+// (immediate) OSC bundles as possible, so we don't have to send
+// a separate TCP packet for each one.
+class bundle_writer {
+public:
+    bundle_writer(client_endpoint& dest)
+        : dest_(&dest) { clear(); }
 
-                dest->send_message(msg.Data(), (int32_t) msg.Size());
-            };
+    ~bundle_writer(){ flush(); }
 
-            // notify new member
-            notify(usr.endpoint, *peer);
+    void add(const char *msg, int32_t size){
+        if (dest_->binary()){
+            // binary frames don't need to be bundled
+            dest_->queue_message(msg, size);
+            return;
+        }
+        if (size_ + 4 + size > (int32_t)sizeof(buf_)){
+            flush();
+            if (size_ + 4 + size > (int32_t)sizeof(buf_)){
+                // too large for a bundle
+                dest_->queue_message(msg, size);
+                return;
+            }
+        }
+        aoo::to_bytes<int32_t>(size, buf_ + size_);
+        memcpy(buf_ + size_ + 4, msg, size);
+        size_ += 4 + size;
+        count_++;
+    }
+
+    void flush(){
+        if (count_ > 0){
+            dest_->queue_message(buf_, size_);
+            clear();
+        }
+    }
+private:
+    client_endpoint *dest_;
+    char buf_[AOO_MAXPACKETSIZE];
+    int32_t size_ = 0;
+    int32_t count_ = 0;
+
+    void clear(){
+        // "#bundle" + time tag 1 (= immediately)
+        memcpy(buf_, "#bundle\0", 8);
+        aoo::to_bytes<uint64_t>(1, buf_ + 8);
+        size_ = 16;
+        count_ = 0;
+    }
+};
+
+static int32_t make_peer_join_message(char *buf, int32_t size,
+                                      const std::string& group, const std::string& name,
+                                      const ip_address& public_address,
+                                      const ip_address& local_address,
+                                      const std::string& local_interfaces, int64_t token)
+{
+    osc::OutboundPacketStream msg(buf, size);
+    msg << osc::BeginMessage(AOONET_MSG_CLIENT_PEER_JOIN)
+        << group.c_str() << name.c_str()
+        << public_address.name().c_str() << public_address.port()
+        << local_address.name().c_str() << local_address.port()
+        << token << local_interfaces.c_str()
+        << osc::EndMessage;
+
+    return (int32_t) msg.Size();
+}
+
+static int32_t make_peer_join_message(char *buf, int32_t size,
+                                      const group& grp, const user& usr)
+{
+    auto e = usr.endpoint;
+    return make_peer_join_message(buf, size, grp.name, usr.name, e->public_address,
+                                  e->local_address, e->local_interfaces, e->token);
+}
+
+// only keep valid IPv4 and IPv6 addresses, and not too many of them
+static std::string sanitize_interfaces(const std::string& list){
+    std::istringstream is(list);
+    std::string result, ip;
+    int count = 0;
+    while (is >> ip && count < 8){
+        struct in6_addr tmp;
+        if (inet_pton(AF_INET, ip.c_str(), &tmp) == 1
+                || inet_pton(AF_INET6, ip.c_str(), &tmp) == 1){
+            if (!result.empty()){
+                result += " ";
+            }
+            result += ip;
+            count++;
+        }
+    }
+    return result;
+}
+
+void server::on_user_joined_group(user& usr, group& grp, bundle_writer *dest){
+    relay_generation_++;
+
+    // 1) send the new member to existing group members
+    char buf[AOO_MAXPACKETSIZE];
+    auto size = make_peer_join_message(buf, sizeof(buf), grp, usr);
+    shared_message joinmsg(buf, size); // shared by all members
+
+    for (auto& peer : grp.users()){
+        if (peer.get() != &usr){
+            peer->endpoint->queue_message(joinmsg);
+        }
+    }
+
+    // 2) send existing group members to the new member, bundled
+    {
+        bundle_writer own(*usr.endpoint);
+        auto& bundle = dest ? *dest : own;
 
-            // notify existing member
-            notify(peer->endpoint, usr);
+        for (auto& peer : grp.users()){
+            if (peer.get() != &usr){
+                auto n = make_peer_join_message(buf, sizeof(buf), grp, *peer);
+                bundle.add(buf, n);
+            }
+        }
 
+        // and the members on the other nodes
+        auto it = remote_groups_.find(grp.name);
+        if (it != remote_groups_.end()){
+            for (auto& kv : it->second){
+                if (remote_visible(grp.name, kv.first, kv.second)){
+                    auto& m = kv.second;
+                    auto n = make_peer_join_message(buf, sizeof(buf), grp.name, kv.first,
+                                                    m.public_address, m.local_address,
+                                                    m.local_interfaces, m.token);
+                    bundle.add(buf, n);
+                }
+            }
         }
     }
 
+    announce_member(usr, grp, true);
+
     if (grp.is_public) {
         on_public_group_modified(grp);
     }
 
-    auto e = std::make_unique<group_event>(AOONET_SERVER_GROUP_JOIN_EVENT,
-                                          grp.name.c_str(), usr.name.c_str());
-    push_event(std::move(e));
+    push_group_event(AOONET_SERVER_GROUP_JOIN_EVENT,
+                     grp.name.c_str(), usr.name.c_str());
 }
 
 void server::on_user_left_group(user& usr, group& grp){
+    relay_generation_++;
+
     // notify group members
+    char buf[AOO_MAXPACKETSIZE];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+    msg << osc::BeginMessage(AOONET_MSG_CLIENT_PEER_LEAVE)
+          << grp.name.c_str() << usr.name.c_str()
+          << osc::EndMessage;
+    shared_message leavemsg(msg.Data(), (int32_t) msg.Size());
+
     for (auto& peer : grp.users()){
         if (peer.get() != &usr){
-            char buf[AOO_MAXPACKETSIZE];
-            osc::OutboundPacketStream msg(buf, sizeof(buf));
-            msg << osc::BeginMessage(AOONET_MSG_CLIENT_PEER_LEAVE)
-                  << grp.name.c_str() << usr.name.c_str()
-                  << osc::EndMessage;
-
-            peer->endpoint->send_message(msg.Data(), (int32_t) msg.Size());
+            peer->endpoint->queue_message(leavemsg);
         }
     }
 
+    announce_member(usr, grp, false);
+
     if (grp.is_public) {
         on_public_group_modified(grp);
 
         update(); // possibly prune empty
     }
 
-    auto e = std::make_unique<group_event>(AOONET_SERVER_GROUP_LEAVE_EVENT,
-                                           grp.name.c_str(), usr.name.c_str());
-    push_event(std::move(e));
+    push_group_event(AOONET_SERVER_GROUP_LEAVE_EVENT,
+                     grp.name.c_str(), usr.name.c_str());
 }
 
-void server::on_user_wants_public_groups(user& usr){
+void server::on_user_wants_public_groups(user& usr, bundle_writer *dest){
     // 1) send all existing public groups to the user
-    for (auto& grp : groups_){
+    bundle_writer own(*usr.endpoint);
+    auto& bundle = dest ? *dest : own;
+
+    for (auto& kv : groups_){
+        auto& grp = kv.second;
         if (!grp->is_public) continue;
 
         char buf[AOO_MAXPACKETSIZE];
@@ -472,49 +1203,94 @@ void server::on_user_wants_public_groups(user& usr){
         << (int32_t) grp->users().size()
         << osc::EndMessage;
 
-        usr.endpoint->send_message(msg.Data(), (int32_t) msg.Size());
+        bundle.add(msg.Data(), (int32_t) msg.Size());
     }
 }
 
+// how often the watchers get the public group changes
+#define AOONET_PUBLIC_GROUP_INTERVAL 0.5
+
 void server::on_public_group_modified(group& grp)
 {
-    char buf[AOO_MAXPACKETSIZE];
+    queue_public_change(grp.name);
+}
 
-    osc::OutboundPacketStream msg(buf, sizeof(buf));
-    msg << osc::BeginMessage(AOONET_MSG_CLIENT_GROUP_PUBLIC_ADD)
-    << grp.name.c_str()
-    << (int32_t) grp.users().size()
-    << osc::EndMessage;
+void server::on_public_group_removed(group& grp)
+{
+    queue_public_change(grp.name);
+}
 
-    // notify all users who care
-    for (auto & peer : users_) {
-        if (peer->watch_public_groups) {
-            peer->endpoint->send_message(msg.Data(), (int32_t) msg.Size());
-        }
+void server::queue_public_change(const std::string& name){
+    // NOTE: called with the state lock held.
+    public_changes_.insert(name);
+
+    if (!have_public_changes_.exchange(true)){
+        public_changes_due_.store(relay_time() + AOONET_PUBLIC_GROUP_INTERVAL);
+        signal(); // might be waiting without a timeout
     }
 }
 
-void server::on_public_group_removed(group& grp)
-{
-    // notify all users who care
+void server::update_public_groups(){
+    if (relay_time() < public_changes_due_.load()){
+        return;
+    }
+
+    unique_lock lock(state_mutex_);
+    have_public_changes_.store(false);
+
+    // only what differs from what the watchers were told before,
+    // a group somebody left and joined again in the meantime doesn't count.
+    std::vector<shared_message> changes;
     char buf[AOO_MAXPACKETSIZE];
+    for (auto& name : public_changes_){
+        auto sent = public_sent_.find(name);
+        osc::OutboundPacketStream msg(buf, sizeof(buf));
 
-    osc::OutboundPacketStream msg(buf, sizeof(buf));
-    msg << osc::BeginMessage(AOONET_MSG_CLIENT_GROUP_PUBLIC_DEL)
-    << grp.name.c_str()
-    << osc::EndMessage;
+        auto it = groups_.find(name);
+        if (it != groups_.end() && it->second->is_public){
+            auto count = (int32_t) it->second->users().size();
+            if (sent != public_sent_.end() && sent->second == count){
+                continue;
+            }
+            public_sent_[name] = count;
+
+            msg << osc::BeginMessage(AOONET_MSG_CLIENT_GROUP_PUBLIC_ADD)
+                << name.c_str() << count << osc::EndMessage;
+        } else {
+            if (sent == public_sent_.end()){
+                continue; // came and went
+            }
+            public_sent_.erase(sent);
+
+            msg << osc::BeginMessage(AOONET_MSG_CLIENT_GROUP_PUBLIC_DEL)
+                << name.c_str() << osc::EndMessage;
+        }
+        changes.emplace_back(msg.Data(), (int32_t) msg.Size());
+    }
+    public_changes_.clear();
 
-    // notify all users who care
-    for (auto & peer : users_) {
-        if (peer->watch_public_groups) {
-            peer->endpoint->send_message(msg.Data(), (int32_t) msg.Size());
+    if (changes.empty()){
+        return;
+    }
+
+    // notify all users who care, the flush packs them into as few packets as it can
+    for (auto & kv : users_) {
+        auto & peer = kv.second;
+        if (peer->watch_public_groups && peer->endpoint) {
+            for (auto& change : changes){
+                peer->endpoint->queue_message(change);
+            }
         }
     }
+
+    flush_clients();
 }
 
 
 void server::wait_for_event(){
     bool didclose = false;
+    uint64_t start;
+    int timeout = wait_timeout();
 #ifdef _WIN32
     // allocate three extra slots for master TCP socket, UDP socket and wait event
     int numevents = (clients_.size() + 3);
@@ -530,12 +1306,14 @@ void server::wait_for_event(){
     events[udpindex] = udpevent_;
     events[waitindex] = waitevent_;
 
-    DWORD result = WaitForMultipleObjects(numevents, events, FALSE, INFINITE);
+    DWORD result = WaitForMultipleObjects(numevents, events, FALSE,
+                                          timeout >= 0 ? timeout : INFINITE);
+    start = loop_clock();
 
     WSANETWORKEVENTS ne;
     memset(&ne, 0, sizeof(ne));
 
-    int index = result - WAIT_OBJECT_0;
+    int index = (result == WAIT_TIMEOUT) ? -1 : (int)(result - WAIT_OBJECT_0);
     if (index == tcpindex){
         WSAEnumNetworkEvents(tcpsocket_, tcpevent_, &ne);
 
@@ -545,6 +1323,11 @@ void server::wait_for_event(){
                 ip_address addr;
                 auto sock = accept(tcpsocket_, (struct sockaddr *)&addr.address, &addr.length);
                 if (sock != INVALID_SOCKET){
+                    addr.unmap();
+                    if (!admit_accept(addr)){
+                        socket_close(sock);
+                        continue;
+                    }
                     clients_.push_back(std::make_unique<client_endpoint>(*this, sock, addr));
                     LOG_VERBOSE("aoo_server: accepted client (IP: "
                                 << addr.name() << ", port: " << addr.port() << ")");
@@ -572,6 +1355,11 @@ void server::wait_for_event(){
             }
             WSAEnumNetworkEvents(clients_[i]->socket, clients_[i]->event, &ne);
 
+            if (ne.lNetworkEvents & FD_WRITE){
+                // send queued data
+                clients_[i]->on_writable();
+            }
+
             if (ne.lNetworkEvents & FD_READ){
                 // receive data from client
                 if (!clients_[i]->receive_data()){
@@ -585,11 +1373,53 @@ void server::wait_for_event(){
 
                 clients_[i]->close();
                 didclose = true;
-            } else {
-                // ignore FD_WRITE
             }
         }
     }
+#elif AOO_SERVER_EPOLL || AOO_SERVER_KQUEUE
+    poll_event ready[maxreadyevents];
+    int count = wait_events(pollfd_, ready, timeout);
+    start = loop_clock();
+
+    // clients are only removed in purge_clients(), so the data pointers
+    // stay valid for the whole batch, even if a client gets closed.
+    for (int i = 0; i < count; ++i){
+        auto data = ready[i].data;
+        if (data == &waitpipe_[0]){
+            // clear pipe
+            char c;
+            read(waitpipe_[0], &c, 1);
+        } else if (data == &tcpsocket_){
+            if (!quit_.load()){
+                accept_clients();
+            }
+        } else if (data == &udpsocket_){
+            if (!quit_.load()){
+                receive_udp();
+            }
+#if AOO_SERVER_XDP
+        } else if (xdp_ && xdp_->find_queue(data) >= 0){
+            if (!quit_.load()){
+                receive_xdp(xdp_->find_queue(data));
+            }
+#endif
+        } else {
+            auto client = (client_endpoint *)data;
+            if (ready[i].write && client->is_active()){
+                client->on_writable();
+            }
+            if (ready[i].read && client->is_active() && !client->receive_data()){
+                client->close();
+                didclose = true;
+            }
+        }
+    }
+#if AOO_SERVER_URING
+    // posting completions interrupts epoll_wait(), which then reports nothing
+    if (count == 0 && udpring_ && udpring_->ready() > 0 && !quit_.load()){
+        receive_udp();
+    }
+#endif
 #else
     // allocate three extra slots for master TCP socket, UDP socket and wait pipe
     int numfds = (int)(clients_.size() + 3);
@@ -601,6 +1431,9 @@ void server::wait_for_event(){
     int numclients = (int)clients_.size();
     for (int i = 0; i < numclients; ++i){
         fds[i].fd = clients_[i]->socket;
+        if (clients_[i]->wants_write()){
+            fds[i].events |= POLLOUT;
+        }
     }
     int tcpindex = numclients;
     int udpindex = numclients + 1;
@@ -610,7 +1443,8 @@ void server::wait_for_event(){
     fds[waitindex].fd = waitpipe_[0];
 
     // NOTE: macOS requires the negative timeout to be exactly -1!
-    int result = poll(fds, numfds, -1);
+    int result = poll(fds, numfds, timeout);
+    start = loop_clock();
     if (result < 0){
         int err = errno;
         if (err == EINTR){
@@ -633,22 +1467,7 @@ void server::wait_for_event(){
     }
     
     if (fds[tcpindex].revents & POLLIN){
-        // accept new clients
-        while (true){
-            ip_address addr;
-            int sock = accept(tcpsocket_, (struct sockaddr *)&addr.address, &addr.length);
-            if (sock >= 0){
-                clients_.push_back(std::make_unique<client_endpoint>(*this, sock, addr));
-                LOG_VERBOSE("aoo_server: accepted client (IP: "
-                            << addr.name() << ", port: " << addr.port() << ")");
-            } else {
-                int err = socket_errno();
-                if (err != EWOULDBLOCK){
-                    LOG_ERROR("aoo_server: couldn't accept client (" << err << ")");
-                }
-                break;
-            }
-        }
+        accept_clients();
     }
 
     if (fds[udpindex].revents & POLLIN){
@@ -657,6 +1476,10 @@ void server::wait_for_event(){
 
 
     for (int i = 0; i < numclients; ++i){
+        if (fds[i].revents & POLLOUT){
+            // send queued data
+            clients_[i]->on_writable();
+        }
         if (fds[i].revents & POLLIN){
             // receive data from client
             if (!clients_[i]->receive_data()){
@@ -667,20 +1490,165 @@ void server::wait_for_event(){
     }
 #endif
 
-    if (didclose){
-        update();
+    finish_batch(clients_, didclose);
+    loop_done(start);
+}
+
+void server::loop_done(uint64_t start){
+    auto elapsed = loop_clock() - start;
+    loop_stats_.loops++;
+    loop_stats_.time += elapsed;
+    if ((int64_t)elapsed > loop_stats_.max_time.load()){
+        loop_stats_.max_time.store((int32_t)std::min<uint64_t>(elapsed, std::numeric_limits<int32_t>::max()));
     }
 }
 
-void server::update(){
-    // remove closed clients
-    auto result = std::remove_if(clients_.begin(), clients_.end(),
+#ifndef _WIN32
+void server::accept_clients(){
+    while (true){
+        ip_address addr;
+        int sock = accept(tcpsocket_, (struct sockaddr *)&addr.address, &addr.length);
+        if (sock >= 0){
+            addr.unmap();
+            if (!admit_accept(addr)){
+                socket_close(sock);
+                continue;
+            }
+            LOG_VERBOSE("aoo_server: accepted client (IP: "
+                        << addr.name() << ", port: " << addr.port() << ")");
+        #if AOO_SERVER_EPOLL || AOO_SERVER_KQUEUE
+            // spread over the shards that don't accept on their own
+            int numshards = (int)shards_.size() + 1;
+            for (int i = 0; i < numshards; ++i){
+                next_shard_ = (next_shard_ + 1) % numshards;
+                if (next_shard_ == 0 || !shards_[next_shard_ - 1]->has_listener()){
+                    break;
+                }
+            }
+            if (next_shard_ > 0){
+                shards_[next_shard_ - 1]->hand_over(sock, addr);
+                continue;
+            }
+        #endif
+            clients_.push_back(std::make_unique<client_endpoint>(*this, sock, addr, pollfd_));
+        } else {
+            int err = socket_errno();
+            if (err != EWOULDBLOCK){
+                LOG_ERROR("aoo_server: couldn't accept client (" << err << ")");
+            }
+            break;
+        }
+    }
+}
+#endif
+
+void server::add_socket(int pollfd, int sock, void *data){
+#if AOO_SERVER_EPOLL
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = data;
+    if (epoll_ctl(pollfd, EPOLL_CTL_ADD, sock, &ev) != 0){
+        LOG_ERROR("aoo_server: couldn't register socket (" << errno << ")");
+    }
+#elif AOO_SERVER_KQUEUE
+    struct kevent ev;
+    EV_SET(&ev, sock, EVFILT_READ, EV_ADD, 0, 0, data);
+    if (kevent(pollfd, &ev, 1, nullptr, 0, nullptr) != 0){
+        LOG_ERROR("aoo_server: couldn't register socket (" << errno << ")");
+    }
+#else
+    // poll() and WaitForMultipleObjects() look at all the sockets anyway
+    (void)pollfd; (void)sock; (void)data;
+#endif
+}
+
+void server::remove_socket(int pollfd, int sock){
+#if AOO_SERVER_EPOLL
+    struct epoll_event ev; // must not be NULL before Linux 2.6.9
+    epoll_ctl(pollfd, EPOLL_CTL_DEL, sock, &ev);
+#elif AOO_SERVER_KQUEUE
+    // the write filter might not be registered, so delete them one by one
+    struct kevent ev;
+    EV_SET(&ev, sock, EVFILT_READ, EV_DELETE, 0, 0, nullptr);
+    kevent(pollfd, &ev, 1, nullptr, 0, nullptr);
+    EV_SET(&ev, sock, EVFILT_WRITE, EV_DELETE, 0, 0, nullptr);
+    kevent(pollfd, &ev, 1, nullptr, 0, nullptr);
+#else
+    (void)pollfd; (void)sock;
+#endif
+}
+
+void server::watch_writable(int pollfd, int sock, void *data, bool enable){
+#if AOO_SERVER_EPOLL
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = enable ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    ev.data.ptr = data;
+    if (epoll_ctl(pollfd, EPOLL_CTL_MOD, sock, &ev) != 0){
+        LOG_ERROR("aoo_server: couldn't modify socket (" << errno << ")");
+    }
+#elif AOO_SERVER_KQUEUE
+    struct kevent ev;
+    EV_SET(&ev, sock, EVFILT_WRITE, enable ? EV_ADD : EV_DELETE, 0, 0, data);
+    if (kevent(pollfd, &ev, 1, nullptr, 0, nullptr) != 0 && enable){
+        LOG_ERROR("aoo_server: couldn't modify socket (" << errno << ")");
+    }
+#else
+    // poll() checks client_endpoint::wants_write(), Windows always reports FD_WRITE
+    (void)pollfd; (void)sock; (void)data; (void)enable;
+#endif
+}
+
+void server::purge_clients(std::vector<std::unique_ptr<client_endpoint>>& clients){
+    // NOTE: called with the state lock held.
+    // remove closed clients. nobody else can reach them anymore: closing
+    // cleared their user's endpoint (with the state lock held)
+    for (auto& c : clients){
+        if (!c->is_active() && c->flush_queued()){
+            flush_list_.erase(std::remove(flush_list_.begin(), flush_list_.end(), c.get()),
+                              flush_list_.end());
+        }
+    }
+    auto result = std::remove_if(clients.begin(), clients.end(),
                                  [](auto& c){ return !c->is_active(); });
-    clients_.erase(result, clients_.end());
+    clients.erase(result, clients.end());
+}
+
+void server::finish_batch(std::vector<std::unique_ptr<client_endpoint>>& clients, bool didclose){
+    if (didclose || need_flush_.load()){
+        unique_lock lock(state_mutex_);
+        if (didclose){
+            purge_clients(clients);
+            update();
+        }
+        flush_clients();
+    }
+}
+
+void server::schedule_flush(client_endpoint &c){
+    flush_list_.push_back(&c);
+    need_flush_.store(true);
+}
+
+void server::flush_clients(){
+    // NOTE: called with the state lock held.
+    // the list only contains live clients, see purge_clients()
+    for (auto& c : flush_list_){
+        c->flush();
+    }
+    flush_list_.clear();
+    need_flush_.store(false);
+}
+
+void server::update(){
+    // NOTE: called with the state lock held.
+    // closed clients are removed by their shard (see purge_clients()).
+
     // automatically purge stale users
     // LATER add an option so that users will persist
     for (auto it = users_.begin(); it != users_.end(); ){
-        if (!(*it)->is_active()){
+        if (!it->second->is_active()){
             it = users_.erase(it);
         } else {
             ++it;
@@ -689,9 +1657,9 @@ void server::update(){
     // automatically purge empty groups
     // LATER add an option so that groups will persist
     for (auto it = groups_.begin(); it != groups_.end(); ){
-        if ((*it)->num_users() == 0){
-            if ((*it)->is_public) {
-                on_public_group_removed(*(*it));
+        if (it->second->num_users() == 0){
+            if (it->second->is_public) {
+                on_public_group_removed(*it->second);
             }
 
             it = groups_.erase(it);
@@ -705,32 +1673,91 @@ void server::receive_udp(){
     if (udpsocket_ < 0){
         return;
     }
+    // relayed packets carry an extra header
+    const int32_t bufsize = AOO_MAXPACKETSIZE + AOONET_RELAY_HEADER_SIZE;
+#if defined(__linux__)
+#if AOO_SERVER_URING
+    if (udpring_){
+        receive_udp_ring();
+        return;
+    }
+#endif
+    // receive and forward packets in batches. relayed packets are rewritten
+    // in place and sent out again straight from the receive buffers.
+    const int batchsize = udp_batch_size;
+    static_assert(bufsize % 4 == 0, "bad buffer size");
+    if (udpbuffer_.size() < (size_t)(batchsize * bufsize)){
+        udpbuffer_.resize(batchsize * bufsize);
+    }
+
+    while (true){
+        struct mmsghdr msgs[batchsize];
+        struct iovec iovecs[batchsize];
+        struct sockaddr_in6 addrs[batchsize]; // IPv4 or IPv6
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < batchsize; ++i){
+            iovecs[i].iov_base = udpbuffer_.data() + i * bufsize;
+            iovecs[i].iov_len = bufsize;
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        }
+
+        int count = recvmmsg(udpsocket_, msgs, batchsize, MSG_DONTWAIT, nullptr);
+        if (count < 0){
+            int err = errno;
+            if (err != EWOULDBLOCK && err != EINTR){
+                // TODO handle error
+                LOG_ERROR("aoo_server: recv() failed (" << err << ")");
+            }
+            return;
+        }
+
+        int32_t sizes[batchsize];
+        ip_address senders[batchsize];
+        for (int i = 0; i < count; ++i){
+            sizes[i] = (int32_t)msgs[i].msg_len;
+            senders[i] = ip_address((struct sockaddr *)&addrs[i], msgs[i].msg_hdr.msg_namelen);
+        }
+        handle_udp_batch(iovecs, sizes, senders, count);
+
+        if (count < batchsize){
+            return;
+        }
+    }
+#else
     // read as much data as possible until recv() would block
     while (true){
-        char buf[AOO_MAXPACKETSIZE];
+        char buf[bufsize];
         ip_address addr;
         int32_t result = recvfrom(udpsocket_, buf, sizeof(buf), 0,
                                (struct sockaddr *)&addr.address, &addr.length);
         if (result > 0){
-            try {
-                osc::ReceivedPacket packet(buf, result);
-                osc::ReceivedMessage msg(packet);
-
-                int32_t type;
-                auto onset = aoonet_parse_pattern(buf, result, &type);
-                if (!onset){
-                    LOG_WARNING("aoo_server: not an AOO NET message!");
-                    return;
-                }
-
-                if (type != AOO_TYPE_SERVER){
-                    LOG_WARNING("aoo_server: not a client message!");
-                    return;
+            addr.unmap();
+            loop_stats_.udp_packets++;
+            loop_stats_.udp_bytes += result;
+            ip_address dest;
+            const std::vector<ip_address> *peers = nullptr;
+            auto now = relay_enabled_.load() ? relay_time() : 0.0;
+            int32_t relay = relay_packet(buf, result, addr, dest, now);
+            if (relay > 0){
+                send_udp_message(buf, result, dest);
+            } else if (relay == 0){
+                int32_t size = forward_packet(buf, result, bufsize, addr, peers, now);
+                if (size > 0){
+                    for (auto& peer : *peers){
+                        send_udp_message(buf, size, peer);
+                    }
+                } else if (size == 0 && admit_udp(addr)){
+                    char reply[quick_reply_size];
+                    auto replysize = quick_reply(buf, result, addr, reply);
+                    if (replysize > 0){
+                        send_udp_message(reply, replysize, addr);
+                    } else {
+                        handle_udp_packet(buf, result, addr);
+                    }
                 }
-
-                handle_udp_message(msg, onset, addr);
-            } catch (const osc::Exception& e){
-                LOG_ERROR("aoo_server: exception in receive_udp: " << e.what());
             }
         } else if (result < 0){
             int err = socket_errno();
@@ -752,58 +1779,1281 @@ void server::receive_udp(){
             return;
         }
     }
+#endif
 }
 
-void server::send_udp_message(const char *msg, int32_t size,
-                              const ip_address &addr)
-{
-    auto result = ::sendto(udpsocket_, msg, size, 0,
-                          (struct sockaddr *)&addr.address, addr.length);
-    if (result < 0){
-        int err = socket_errno();
-    #ifdef _WIN32
-        if (err != WSAEWOULDBLOCK)
-    #else
-        if (err != EWOULDBLOCK)
-    #endif
-        {
-            // TODO handle error
-            LOG_ERROR("aoo_server: send() failed (" << err << ")");
+#if AOO_SERVER_URING
+namespace {
+const uint64_t udp_ring_receive = 1;
+const uint64_t udp_ring_cancel = 2;
+const unsigned udp_ring_buffers = 256;
+}
+
+void server::start_udp_ring(){
+    if (udpring_ || udpsocket_ < 0){
+        return;
+    }
+    // a buffer holds the recvmsg header, the sender and the packet, with
+    // room to rewrite it in place like the recvmmsg() buffers
+    const unsigned bufsize = sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in6)
+            + AOO_MAXPACKETSIZE + AOONET_RELAY_HEADER_SIZE;
+    auto ring = std::make_unique<uring>();
+    if (!ring->init(64, udp_ring_buffers * 2) || !ring->setup_buffers(0, udp_ring_buffers, bufsize)){
+        LOG_VERBOSE("aoo_server: io_uring not available, using recvmmsg()");
+        return;
+    }
+    udpring_ = std::move(ring);
+    memset(&udpringmsg_, 0, sizeof(udpringmsg_));
+    udpringmsg_.msg_namelen = sizeof(struct sockaddr_in6);
+
+    arm_udp_ring();
+    // the kernel tells on the spot if it can't do multishot receives
+    udpring_->submit(1, 0);
+    auto cqe = udpring_->peek();
+    if (cqe && !(cqe->flags & IORING_CQE_F_MORE) && cqe->res < 0 && cqe->res != -ENOBUFS){
+        LOG_VERBOSE("aoo_server: multishot receive not available (" << -cqe->res << "), using recvmmsg()");
+        udpring_.reset();
+        return;
+    }
+
+    // from now on the ring becomes readable instead of the socket
+    remove_socket(pollfd_, udpsocket_);
+    add_socket(pollfd_, udpring_->fd(), &udpsocket_);
+    LOG_VERBOSE("aoo_server: receiving UDP with io_uring");
+}
+
+void server::arm_udp_ring(){
+    auto sqe = udpring_->get_sqe();
+    if (sqe){
+        udpring_->prep_recvmsg_multishot(sqe, udpsocket_, &udpringmsg_, 0, udp_ring_receive);
+        udpring_->submit();
+    }
+}
+
+void server::stop_udp_ring(){
+    if (!udpring_){
+        return;
+    }
+    remove_socket(pollfd_, udpring_->fd());
+    add_socket(pollfd_, udpsocket_, &udpsocket_);
+
+    // the kernel must be done with the buffers before they go away
+    auto sqe = udpring_->get_sqe();
+    if (sqe){
+        udpring_->prep_cancel_all(sqe, udp_ring_cancel);
+    }
+    bool done = false;
+    for (int tries = 0; !done && tries < 50; ++tries){
+        udpring_->submit(1, 20);
+        while (auto cqe = udpring_->peek()){
+            if (cqe->user_data == udp_ring_receive && !(cqe->flags & IORING_CQE_F_MORE)){
+                done = true;
+            }
+            udpring_->seen();
+        }
+    }
+    udpring_.reset();
+}
+
+void server::receive_udp_ring(){
+    const int batchsize = udp_batch_size;
+    struct iovec iovecs[batchsize];
+    int32_t sizes[batchsize];
+    ip_address addrs[batchsize];
+    unsigned bufids[batchsize];
+    bool rearm = false;
+
+    while (true){
+        int count = 0;
+        while (count < batchsize){
+            auto cqe = udpring_->peek();
+            if (!cqe){
+                break;
+            }
+            auto userdata = cqe->user_data;
+            auto result = cqe->res;
+            auto flags = cqe->flags;
+            udpring_->seen();
+
+            if (userdata != udp_ring_receive){
+                continue;
+            }
+            if (!(flags & IORING_CQE_F_MORE)){
+                // out of buffers, or an error
+                if (result < 0 && result != -ENOBUFS){
+                    LOG_ERROR("aoo_server: recv() failed (" << -result << ")");
+                }
+                rearm = true;
+            }
+            if (!(flags & IORING_CQE_F_BUFFER)){
+                continue;
+            }
+
+            auto id = flags >> IORING_CQE_BUFFER_SHIFT;
+            struct sockaddr *name;
+            socklen_t namelen;
+            char *control;
+            size_t controllen;
+            char *payload;
+            int32_t payloadlen;
+            if (result > 0 && uring::parse_recvmsg(udpring_->buffer(id), result, udpringmsg_,
+                                                   name, namelen, control, controllen,
+                                                   payload, payloadlen)){
+                iovecs[count].iov_base = payload;
+                iovecs[count].iov_len = payloadlen;
+                sizes[count] = payloadlen;
+                addrs[count] = ip_address(name, namelen);
+                bufids[count] = id;
+                count++;
+            } else {
+                udpring_->recycle_buffer(id);
+            }
+        }
+
+        if (count > 0){
+            // everything has been sent on when this returns
+            handle_udp_batch(iovecs, sizes, addrs, count);
+            for (int i = 0; i < count; ++i){
+                udpring_->recycle_buffer(bufids[i]);
+            }
+        }
+
+        if (count < batchsize){
+            break;
+        }
+    }
+
+    if (rearm){
+        arm_udp_ring();
+    }
+}
+#endif
+
+#if defined(__linux__)
+// relays, forwards or handles received packets. the buffers have room for
+// AOO_MAXPACKETSIZE + AOONET_RELAY_HEADER_SIZE bytes, relayed and forwarded
+// packets are rewritten in place and sent out from there with the iovecs.
+void server::handle_udp_batch(struct iovec *iovecs, const int32_t *sizes,
+                              const ip_address *addrs, int count){
+    const int32_t bufsize = AOO_MAXPACKETSIZE + AOONET_RELAY_HEADER_SIZE;
+    auto now = relay_enabled_.load() ? relay_time() : 0.0;
+
+    uint64_t bytes = 0;
+    for (int i = 0; i < count; ++i){
+        bytes += sizes[i];
+    }
+    loop_stats_.udp_packets += count;
+    loop_stats_.udp_bytes += bytes;
+
+    // forwarded packets go out several times
+    const int maxout = udp_batch_size * 4;
+    struct mmsghdr out[maxout];
+    struct sockaddr_in6 dests[maxout];
+    int numout = 0;
+    // quick replies go out with the rest of the batch, so they
+    // need their own storage until the last flush()
+    char replies[udp_batch_size][quick_reply_size];
+    struct iovec replyvecs[udp_batch_size];
+    int numreplies = 0;
+
+    auto flush = [&](){
+        int sent = 0;
+        while (sent < numout){
+            int result = sendmmsg(udpsocket_, out + sent, numout - sent, 0);
+            if (result < 0){
+                int err = errno;
+                if (err == EINTR){
+                    continue;
+                }
+                if (err != EWOULDBLOCK){
+                    LOG_ERROR("aoo_server: send() failed (" << err << ")");
+                }
+                relay_stats_.dropped += numout - sent;
+                break;
+            }
+            sent += result;
+        }
+        numout = 0;
+    };
+
+    auto queue = [&](struct iovec *iov, const ip_address& dest){
+        if (numout == maxout){
+            flush();
+        }
+        auto addr = dest.mapped(udpfamily_);
+        memcpy(&dests[numout], &addr.address, addr.length);
+        memset(&out[numout], 0, sizeof(out[numout]));
+        out[numout].msg_hdr.msg_iov = iov;
+        out[numout].msg_hdr.msg_iovlen = 1;
+        out[numout].msg_hdr.msg_name = &dests[numout];
+        out[numout].msg_hdr.msg_namelen = addr.length;
+        numout++;
+    };
+
+    for (int i = 0; i < count; ++i){
+        auto buf = (char *)iovecs[i].iov_base;
+        auto size = sizes[i];
+        if (size <= 0){
+            continue;
+        }
+        auto& addr = addrs[i];
+        ip_address dest;
+        const std::vector<ip_address> *peers = nullptr;
+        int32_t relay = relay_packet(buf, size, addr, dest, now);
+        if (relay > 0){
+            iovecs[i].iov_len = size;
+            queue(&iovecs[i], dest);
+        } else if (relay == 0){
+            int32_t result = forward_packet(buf, size, bufsize, addr, peers, now);
+            if (result > 0){
+                iovecs[i].iov_len = result;
+                for (auto& peer : *peers){
+                    queue(&iovecs[i], peer);
+                }
+            } else if (result == 0 && admit_udp(addr)){
+                auto reply = replies[numreplies];
+                auto replysize = quick_reply(buf, size, addr, reply);
+                if (replysize > 0){
+                    replyvecs[numreplies].iov_base = reply;
+                    replyvecs[numreplies].iov_len = replysize;
+                    queue(&replyvecs[numreplies], addr);
+                    numreplies++;
+                } else {
+                    handle_udp_packet(buf, size, addr);
+                }
+            }
+        }
+    }
+
+    flush();
+}
+#endif
+
+#if AOO_SERVER_XDP
+// like handle_udp_batch(), but the packets are still in the frames of the
+// AF_XDP queue, with room in front for the headers they are sent on with.
+void server::receive_xdp(int queue){
+    const int batchsize = udp_batch_size;
+    xdp_port::packet packets[batchsize];
+
+    while (true){
+        auto now = relay_time();
+        int count = xdp_->receive(queue, packets, batchsize, now);
+
+        uint64_t bytes = 0;
+        for (int i = 0; i < count; ++i){
+            auto& p = packets[i];
+            bytes += p.size;
+            ip_address dest;
+            const std::vector<ip_address> *peers = nullptr;
+            int32_t relay = relay_packet(p.data, p.size, p.addr, dest, now);
+            if (relay > 0){
+                send_xdp(queue, p, p.size, dest, true);
+            } else if (relay == 0){
+                int32_t result = forward_packet(p.data, p.size, p.capacity,
+                                                p.addr, peers, now);
+                if (result > 0){
+                    auto n = peers->size();
+                    for (size_t j = 0; j < n; ++j){
+                        send_xdp(queue, p, result, (*peers)[j], j + 1 == n);
+                    }
+                } else if (result == 0 && admit_udp(p.addr)){
+                    char reply[quick_reply_size];
+                    auto replysize = quick_reply(p.data, p.size, p.addr, reply);
+                    if (replysize > 0){
+                        send_udp_message(reply, replysize, p.addr);
+                    } else {
+                        handle_udp_packet(p.data, p.size, p.addr);
+                    }
+                }
+            }
+            xdp_->release(queue, p);
+        }
+        loop_stats_.udp_packets += count;
+        loop_stats_.udp_bytes += bytes;
+
+        xdp_->flush(queue);
+
+        if (count < batchsize){
+            break;
+        }
+    }
+}
+
+void server::send_xdp(int queue, xdp_port::packet& p, int32_t size,
+                      const ip_address& dest, bool last){
+    if (xdp_->send(queue, p, size, dest, last)){
+        relay_stats_.xdp_packets++;
+    } else {
+        // we don't have the next hop yet, or no frame left
+        send_udp_message(p.data, size, dest);
+    }
+}
+#endif
+
+namespace {
+
+// the client pings and requests always look the same (no arguments),
+// so they are told apart from everything else by their bytes alone.
+struct quick_packets {
+    char ping[32];
+    char request[32];
+    char pong[32];
+    int32_t pingsize;
+    int32_t requestsize;
+    int32_t pongsize;
+
+    quick_packets(){
+        osc::OutboundPacketStream msg1(ping, sizeof(ping));
+        msg1 << osc::BeginMessage(AOONET_MSG_SERVER_PING) << osc::EndMessage;
+        pingsize = (int32_t) msg1.Size();
+
+        osc::OutboundPacketStream msg2(request, sizeof(request));
+        msg2 << osc::BeginMessage(AOONET_MSG_SERVER_REQUEST) << osc::EndMessage;
+        requestsize = (int32_t) msg2.Size();
+
+        osc::OutboundPacketStream msg3(pong, sizeof(pong));
+        msg3 << osc::BeginMessage(AOONET_MSG_CLIENT_PING) << osc::EndMessage;
+        pongsize = (int32_t) msg3.Size();
+    }
+
+    static const quick_packets& get(){
+        static const quick_packets packets;
+        return packets;
+    }
+};
+
+} // namespace
+
+// pings and address requests make up most of what the clients send us,
+// so they are answered right from the receive loop, without going through
+// the OSC parser. Write the reply to 'out' (quick_reply_size bytes) and
+// return its size, or return 0 if the packet has to take the normal way.
+int32_t server::quick_reply(const char *buf, int32_t size,
+                            const ip_address& addr, char *out){
+    auto& packets = quick_packets::get();
+    if (size == packets.pingsize && !memcmp(buf, packets.ping, size)){
+        memcpy(out, packets.pong, packets.pongsize);
+        loop_stats_.quick_replies++;
+        return packets.pongsize;
+    } else if (size == packets.requestsize && !memcmp(buf, packets.request, size)){
+        try {
+            osc::OutboundPacketStream reply(out, quick_reply_size);
+            reply << osc::BeginMessage(AOONET_MSG_CLIENT_REPLY)
+                  << addr.name().c_str() << addr.port() << osc::EndMessage;
+            loop_stats_.quick_replies++;
+            return (int32_t) reply.Size();
+        } catch (const osc::Exception& e){
+            LOG_ERROR("aoo_server: couldn't write reply: " << e.what());
+        }
+    }
+    return 0;
+}
+
+void server::handle_udp_packet(const char *buf, int32_t size, const ip_address& addr){
+    try {
+        osc::ReceivedPacket packet(buf, size);
+        if (packet.IsBundle()){
+            // the other nodes bundle their messages
+            osc::ReceivedBundle bundle(packet);
+            for (auto it = bundle.ElementsBegin(); it != bundle.ElementsEnd(); ++it){
+                if (it->IsMessage()){
+                    handle_udp_packet(it->Contents(), it->Size(), addr);
+                }
+            }
+            return;
+        }
+        osc::ReceivedMessage msg(packet);
+
+        int32_t type;
+        auto onset = aoonet_parse_pattern(buf, size, &type);
+        if (!onset){
+            LOG_WARNING("aoo_server: not an AOO NET message!");
+            return;
+        }
+
+        if (type != AOO_TYPE_SERVER){
+            LOG_WARNING("aoo_server: not a client message!");
+            return;
+        }
+
+        handle_udp_message(msg, onset, addr);
+    } catch (const osc::Exception& e){
+        LOG_ERROR("aoo_server: exception in receive_udp: " << e.what());
+    }
+}
+
+static uint64_t relay_address_key(const ip_address& addr){
+    auto sa = (const struct sockaddr_in *)&addr.address;
+    return ((uint64_t)sa->sin_addr.s_addr << 16) | sa->sin_port;
+}
+
+int32_t server::relay_packet(char *buf, int32_t size, const ip_address& addr,
+                             ip_address& dest, double now)
+{
+    struct sockaddr_in sa;
+    int32_t datasize = 0;
+    if (aoonet_parse_relay(buf, size, &sa, &datasize) <= 0){
+        return 0;
+    }
+    if (!relay_enabled_.load()){
+        return -1;
+    }
+    if (addr.address.ss_family != AF_INET || (datasize & 3)){
+        relay_stats_.rejected++;
+        return -1;
+    }
+    dest = ip_address((struct sockaddr *)&sa, sizeof(sa));
+
+    // look up the session (one per direction)
+    relay_key key { relay_address_key(addr), relay_address_key(dest) };
+    auto it = relay_sessions_.find(key);
+    if (it == relay_sessions_.end()){
+        it = relay_sessions_.emplace(key, relay_session{}).first;
+        it->second.last_time = now;
+        it->second.tokens = std::numeric_limits<double>::max(); // start full
+        relay_stats_.sessions.store((int32_t)(relay_sessions_.size() + forward_sessions_.size()));
+    }
+    auto& session = it->second;
+
+    // check again after any login or group change
+    auto generation = relay_generation_.load();
+    if (session.generation != generation){
+        session.allowed = check_relay(addr, dest);
+        session.generation = generation;
+    }
+    if (!session.allowed){
+        relay_stats_.rejected++;
+        return -1;
+    }
+
+    if (!take_relay_tokens(session, size, now)){
+        relay_stats_.dropped++;
+        return -1;
+    }
+
+    // now the header has to tell the receiver where the packet came from
+    aoonet_write_relay_header(buf, &addr.address, datasize);
+
+    relay_stats_.packets++;
+    relay_stats_.bytes += size;
+
+    purge_relay_sessions(now);
+
+    return 1;
+}
+
+int32_t server::forward_packet(char *buf, int32_t size, int32_t capacity, const ip_address& addr,
+                               const std::vector<ip_address> *& peers, double now)
+{
+    int32_t route = 0;
+    int32_t datasize = 0;
+    auto onset = aoonet_parse_forward(buf, size, &route, &datasize);
+    if (onset <= 0){
+        return 0;
+    }
+    if (!relay_enabled_.load()){
+        return -1;
+    }
+    if (addr.address.ss_family != AF_INET || (datasize & 3)
+        || (datasize + AOONET_RELAY_HEADER_SIZE) > capacity)
+    {
+        relay_stats_.rejected++;
+        return -1;
+    }
+
+    relay_key key { relay_address_key(addr), (uint32_t)route };
+    auto it = forward_sessions_.find(key);
+    if (it == forward_sessions_.end()){
+        it = forward_sessions_.emplace(key, forward_session{}).first;
+        it->second.last_time = now;
+        it->second.tokens = std::numeric_limits<double>::max(); // start full
+        relay_stats_.sessions.store((int32_t)(relay_sessions_.size() + forward_sessions_.size()));
+    }
+    auto& session = it->second;
+
+    // look up the route again after any login, group or route change
+    auto generation = relay_generation_.load();
+    if (session.generation != generation){
+        get_forward_route(addr, route, session.peers);
+        session.generation = generation;
+    }
+    if (session.peers.empty()){
+        relay_stats_.rejected++;
+        return -1;
+    }
+
+    // the bandwidth limit applies to all copies together
+    auto newsize = datasize + AOONET_RELAY_HEADER_SIZE;
+    auto total = (double)newsize * session.peers.size();
+    if (!take_relay_tokens(session, total, now)){
+        relay_stats_.dropped++;
+        return -1;
+    }
+
+    // the receivers get it as a relay message from the sender
+    memmove(buf + AOONET_RELAY_HEADER_SIZE, buf + onset, datasize);
+    aoonet_write_relay_header(buf, &addr.address, datasize);
+
+    relay_stats_.packets += session.peers.size();
+    relay_stats_.bytes += (uint64_t)total;
+
+    peers = &session.peers;
+
+    purge_relay_sessions(now);
+
+    return newsize;
+}
+
+bool server::take_relay_tokens(relay_session& session, double bytes, double now){
+    auto bandwidth = relay_bandwidth_.load();
+    if (bandwidth > 0){
+        // allow bursts of at least one packet
+        auto capacity = std::max<double>(bandwidth, bytes);
+        session.tokens = std::min<double>(capacity,
+            session.tokens + (now - session.last_time) * bandwidth);
+        session.last_time = now;
+        if (session.tokens < bytes){
+            return false;
+        }
+        session.tokens -= bytes;
+    } else {
+        session.tokens = std::numeric_limits<double>::max();
+        session.last_time = now;
+    }
+    return true;
+}
+
+/*//////////////////// admission control /////////////////////*/
+
+rate_limiter::rate_limiter(int32_t size){
+    // power of 2
+    int32_t n = 1;
+    while (n < size){
+        n <<= 1;
+    }
+    buckets_.resize(n);
+}
+
+uint64_t rate_limiter::address_key(const ip_address& addr){
+    uint64_t key = 0;
+    if (addr.family() == AF_INET){
+        key = ((const struct sockaddr_in *)&addr.address)->sin_addr.s_addr;
+        key |= (uint64_t)AF_INET << 32;
+    } else if (addr.family() == AF_INET6){
+        // the first 64 bits are the network, which is what a host can't easily change
+        uint64_t parts[2];
+        memcpy(parts, &((const struct sockaddr_in6 *)&addr.address)->sin6_addr, sizeof(parts));
+        key = parts[0] ^ (parts[1] * 0x9E3779B97F4A7C15ULL);
+    }
+    return key ? key : 1;
+}
+
+bool rate_limiter::allow(const ip_address& addr, double now){
+    auto rate = rate_.load(std::memory_order_relaxed);
+    if (rate <= 0){
+        return true;
+    }
+    auto capacity = rate * 2;
+    auto key = address_key(addr);
+    auto index = (key * 0x9E3779B97F4A7C15ULL) >> 32;
+
+    scoped_lock<spinlock> lock(lock_);
+    auto& b = buckets_[index & (buckets_.size() - 1)];
+    if (b.key != key){
+        // take over the slot once the previous host would have a full bucket again,
+        // otherwise share it, so that changing addresses doesn't buy new tokens
+        if (b.key == 0 || b.tokens + (now - b.last_time) * rate >= capacity){
+            b.key = key;
+            b.tokens = capacity;
+            b.last_time = now;
+        }
+    }
+    b.tokens = std::min<double>(capacity, b.tokens + (now - b.last_time) * rate);
+    b.last_time = now;
+    if (b.tokens < 1){
+        return false;
+    }
+    b.tokens -= 1;
+    return true;
+}
+
+bool server::admit_accept(const ip_address& addr){
+    if (accept_limiter_.allow(addr, relay_time())){
+        return true;
+    }
+    admission_stats_.rejected_accepts++;
+    LOG_DEBUG("aoo_server: too many connections from " << addr.name());
+    return false;
+}
+
+bool server::admit_login(const ip_address& addr){
+    if (login_limiter_.allow(addr, relay_time())){
+        return true;
+    }
+    admission_stats_.rejected_logins++;
+    LOG_DEBUG("aoo_server: too many login attempts from " << addr.name());
+    return false;
+}
+
+bool server::admit_udp(const ip_address& addr){
+    if (udp_limiter_.allow(addr, relay_time())){
+        return true;
+    }
+    admission_stats_.rejected_udp++;
+    return false;
+}
+
+void server::purge_relay_sessions(double now){
+    // forget idle sessions now and then
+    if ((now - last_relay_purge_) > 10.0){
+        for (auto s = relay_sessions_.begin(); s != relay_sessions_.end(); ){
+            if ((now - s->second.last_time) > 30.0){
+                s = relay_sessions_.erase(s);
+            } else {
+                ++s;
+            }
+        }
+        for (auto s = forward_sessions_.begin(); s != forward_sessions_.end(); ){
+            if ((now - s->second.last_time) > 30.0){
+                s = forward_sessions_.erase(s);
+            } else {
+                ++s;
+            }
+        }
+        relay_stats_.sessions.store((int32_t)(relay_sessions_.size() + forward_sessions_.size()));
+        last_relay_purge_ = now;
+    }
+}
+
+void server::get_forward_route(const ip_address& src, int32_t route,
+                               std::vector<ip_address>& result){
+    result.clear();
+
+    shared_lock lock(state_mutex_);
+    const user *from = nullptr;
+    for (auto& kv : users_){
+        auto ep = kv.second->endpoint;
+        if (ep && ep->public_address == src){
+            from = kv.second.get();
+            break;
+        }
+    }
+    if (!from){
+        return;
+    }
+    auto it = from->endpoint->forward_routes.find(route);
+    if (it == from->endpoint->forward_routes.end()){
+        return;
+    }
+    // only pass it on to users which share a group with the sender
+    for (auto& addr : it->second){
+        for (auto& kv : users_){
+            auto ep = kv.second->endpoint;
+            if (ep && ep != from->endpoint && ep->public_address == addr){
+                auto& to = *kv.second;
+                auto shared = std::any_of(from->groups().begin(), from->groups().end(),
+                    [&](auto& grp){ return grp->users().contains(to); });
+                if (shared){
+                    result.push_back(addr);
+                } else {
+                    LOG_VERBOSE("aoo_server: won't forward to " << addr.name()
+                                << ":" << addr.port() << " (no shared group)");
+                }
+                break;
+            }
+        }
+    }
+}
+
+bool server::check_relay(const ip_address& src, const ip_address& dst){
+    // both must be logged in users which share a group.
+    // NOTE: clients report the public UDP address they got from the server.
+    shared_lock lock(state_mutex_);
+    const user *from = nullptr;
+    const user *to = nullptr;
+    for (auto& kv : users_){
+        auto ep = kv.second->endpoint;
+        if (ep){
+            if (ep->public_address == src){
+                from = kv.second.get();
+            } else if (ep->public_address == dst){
+                to = kv.second.get();
+            }
+        }
+    }
+    if (from && to){
+        for (auto& grp : from->groups()){
+            if (grp->users().contains(*to)){
+                return true;
+            }
+        }
+    }
+    LOG_VERBOSE("aoo_server: reject relay from " << src.name() << ":" << src.port()
+                << " to " << dst.name() << ":" << dst.port());
+    return false;
+}
+
+void server::send_udp_message(const char *msg, int32_t size,
+                              const ip_address &addr)
+{
+    auto dest = addr.mapped(udpfamily_);
+    auto result = ::sendto(udpsocket_, msg, size, 0,
+                          (struct sockaddr *)&dest.address, dest.length);
+    if (result < 0){
+        int err = socket_errno();
+    #ifdef _WIN32
+        if (err != WSAEWOULDBLOCK)
+    #else
+        if (err != EWOULDBLOCK)
+    #endif
+        {
+            // TODO handle error
+            LOG_ERROR("aoo_server: send() failed (" << err << ")");
+        } else {
+            LOG_VERBOSE("aoo_server: send() would block");
+        }
+    }
+}
+
+void server::handle_udp_message(const osc::ReceivedMessage &msg, int onset,
+                                const ip_address& addr)
+{
+    auto pattern = msg.AddressPattern() + onset;
+    LOG_DEBUG("aoo_server: handle client UDP message " << pattern);
+
+    try {
+        if (!strcmp(pattern, AOONET_MSG_PING)){
+            // reply with /ping message
+            char buf[512];
+            osc::OutboundPacketStream reply(buf, sizeof(buf));
+            reply << osc::BeginMessage(AOONET_MSG_CLIENT_PING)
+                  << osc::EndMessage;
+
+            send_udp_message(reply.Data(), (int32_t) reply.Size(), addr);
+        } else if (!strcmp(pattern, AOONET_MSG_REQUEST)){
+            // reply with /reply message
+            char buf[512];
+            osc::OutboundPacketStream reply(buf, sizeof(buf));
+            reply << osc::BeginMessage(AOONET_MSG_CLIENT_REPLY)
+                  << addr.name().c_str() << addr.port() << osc::EndMessage;
+
+            send_udp_message(reply.Data(), (int32_t) reply.Size(), addr);
+        } else if (!strncmp(pattern, AOONET_MSG_NODE, AOONET_MSG_NODE_LEN)){
+            handle_node_message(msg, pattern, addr);
+        } else {
+            LOG_ERROR("aoo_server: unknown message " << pattern);
+        }
+    } catch (const osc::Exception& e){
+        LOG_ERROR("aoo_server: exception on handling " << pattern
+                  << " message: " << e.what());
+    }
+}
+
+/*////////////////////////// sessions ///////////////////////////*/
+
+// how long a session can be resumed after its user is gone,
+// and how often we check for that (and write the snapshot)
+#define AOONET_SESSION_TIMEOUT 120.0
+#define AOONET_SESSION_INTERVAL 5.0
+
+#define AOONET_SNAPSHOT_HEADER "aoo_server_snapshot\t1"
+
+int64_t server::login_session(const std::shared_ptr<user>& usr, int64_t token, bool& resumed,
+                              std::vector<std::shared_ptr<group>>& groups){
+    // NOTE: called with the state lock held.
+    auto& s = sessions_[usr->name];
+    resumed = token != 0 && token == s.token && !s.active
+            && s.password == usr->password;
+    if (resumed){
+        // a group might have got a different password in the meantime,
+        // and the names have to fit into the login reply.
+        std::vector<session::group_info> joined;
+        int32_t size = 0;
+        for (auto& info : s.groups){
+            size += (int32_t)info.name.size() + 8;
+            if (size > AOO_MAXPACKETSIZE / 2){
+                break;
+            }
+            error err;
+            auto grp = get_group(info.name, info.password, info.is_public, err);
+            if (grp && usr->add_group(grp)){
+                grp->add_user(usr);
+                groups.push_back(grp);
+                joined.push_back(info);
+            }
+        }
+        s.groups = std::move(joined);
+        usr->watch_public_groups = s.watch_public_groups;
+        LOG_VERBOSE("aoo_server: " << usr->name << " resumed session with "
+                    << groups.size() << " groups");
+    } else {
+        s = session();
+        s.password = usr->password;
+        // straight from the system's random source, a generator's tokens could
+        // be worked out from the ones it handed out before
+        do {
+            s.token = (int64_t)((((uint64_t)session_random_() << 32) | session_random_())
+                                & INT64_MAX);
+        } while (s.token == 0);
+    }
+    s.active = true;
+    sessions_changed_ = true;
+    return s.token;
+}
+
+void server::kick_session(const std::string& name, int64_t token){
+    // NOTE: called with the state lock held.
+    auto it = sessions_.find(name);
+    if (it != sessions_.end() && it->second.active && it->second.token == token){
+        auto usr = find_user(name);
+        if (usr && usr->endpoint){
+            LOG_VERBOSE("aoo_server: " << name << " reconnected, dropping the old connection");
+            usr->endpoint->kick();
+        }
+    }
+}
+
+void server::on_session_group_joined(const user& usr, const group& grp){
+    auto it = sessions_.find(usr.name);
+    if (it != sessions_.end()){
+        it->second.groups.push_back(session::group_info { grp.name, grp.password, grp.is_public });
+        sessions_changed_ = true;
+    }
+}
+
+void server::on_session_group_left(const user& usr, const group& grp){
+    auto it = sessions_.find(usr.name);
+    if (it != sessions_.end()){
+        auto& groups = it->second.groups;
+        groups.erase(std::remove_if(groups.begin(), groups.end(),
+                                    [&](auto& info){ return info.name == grp.name; }),
+                     groups.end());
+        sessions_changed_ = true;
+    }
+}
+
+void server::on_session_watch_public(const user& usr, bool watch){
+    auto it = sessions_.find(usr.name);
+    if (it != sessions_.end() && it->second.watch_public_groups != watch){
+        it->second.watch_public_groups = watch;
+        sessions_changed_ = true;
+    }
+}
+
+void server::update_sessions(bool force){
+    auto now = relay_time();
+    if (!force && now - last_session_update_ < AOONET_SESSION_INTERVAL){
+        return;
+    }
+    last_session_update_ = now;
+
+    std::string path, data;
+    {
+        unique_lock lock(state_mutex_);
+        for (auto it = sessions_.begin(); it != sessions_.end(); ){
+            auto& s = it->second;
+            if (!s.active && now - s.last_seen > AOONET_SESSION_TIMEOUT){
+                it = sessions_.erase(it);
+                sessions_changed_ = true;
+            } else {
+                ++it;
+            }
+        }
+        if (snapshot_path_.empty() || !sessions_changed_
+                || (!force && now - last_snapshot_ < snapshot_interval_)){
+            return;
+        }
+        path = snapshot_path_;
+        data = write_snapshot();
+        sessions_changed_ = false;
+        last_snapshot_ = now;
+    }
+
+    // written without holding up the clients, and swapped in all at
+    // once, so that a crash can't leave us with half a snapshot.
+    auto tmp = path + ".tmp";
+    {
+        std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+    #ifndef _WIN32
+        // it has the passwords and session tokens
+        chmod(tmp.c_str(), S_IRUSR | S_IWUSR);
+    #endif
+        file << data;
+        if (!file.good()){
+            LOG_ERROR("aoo_server: couldn't write snapshot " << tmp);
+            return;
+        }
+    }
+#ifdef _WIN32
+    std::remove(path.c_str()); // rename() doesn't replace existing files
+#endif
+    if (std::rename(tmp.c_str(), path.c_str()) != 0){
+        LOG_ERROR("aoo_server: couldn't replace snapshot " << path);
+    }
+}
+
+// the fields are separated by tabs, one record per line
+static void snapshot_write_field(std::ostream& os, const std::string& str){
+    os << '\t';
+    for (auto c : str){
+        if (c == '\t'){
+            os << "\\t";
+        } else if (c == '\n'){
+            os << "\\n";
+        } else if (c == '\\'){
+            os << "\\\\";
+        } else {
+            os << c;
+        }
+    }
+}
+
+static std::vector<std::string> snapshot_read_fields(const std::string& line){
+    std::vector<std::string> fields(1);
+    for (size_t i = 0; i < line.size(); ++i){
+        auto c = line[i];
+        if (c == '\t'){
+            fields.emplace_back();
+        } else if (c == '\\' && i + 1 < line.size()){
+            c = line[++i];
+            fields.back() += (c == 't') ? '\t' : (c == 'n') ? '\n' : c;
+        } else {
+            fields.back() += c;
+        }
+    }
+    return fields;
+}
+
+std::string server::write_snapshot() const {
+    // NOTE: called with the state lock held.
+    std::ostringstream os;
+    os << AOONET_SNAPSHOT_HEADER << "\n";
+    for (auto& kv : sessions_){
+        auto& s = kv.second;
+        os << "session";
+        snapshot_write_field(os, kv.first);
+        snapshot_write_field(os, s.password);
+        snapshot_write_field(os, std::to_string(s.token));
+        snapshot_write_field(os, s.watch_public_groups ? "1" : "0");
+        os << "\n";
+        for (auto& info : s.groups){
+            os << "group";
+            snapshot_write_field(os, info.name);
+            snapshot_write_field(os, info.password);
+            snapshot_write_field(os, info.is_public ? "1" : "0");
+            os << "\n";
+        }
+    }
+    return os.str();
+}
+
+void server::read_snapshot(std::istream& is){
+    // NOTE: called with the state lock held.
+    std::string line;
+    if (!std::getline(is, line) || line != AOONET_SNAPSHOT_HEADER){
+        LOG_WARNING("aoo_server: ignoring snapshot " << snapshot_path_
+                    << " with unknown format");
+        return;
+    }
+    // the sessions can be resumed for AOONET_SESSION_TIMEOUT from now
+    auto now = relay_time();
+    session *current = nullptr;
+    while (std::getline(is, line)){
+        auto fields = snapshot_read_fields(line);
+        if (fields[0] == "session" && fields.size() >= 5){
+            current = &sessions_[fields[1]];
+            *current = session();
+            current->password = fields[2];
+            current->token = strtoll(fields[3].c_str(), nullptr, 10);
+            current->watch_public_groups = fields[4] == "1";
+            current->last_seen = now;
+        } else if (fields[0] == "group" && fields.size() >= 4 && current){
+            current->groups.push_back(session::group_info { fields[1], fields[2], fields[3] == "1" });
+        }
+    }
+}
+
+/*////////////////////////// cluster ///////////////////////////*/
+
+// how often we send all our group members to the other nodes,
+// and how long we keep remote members without hearing about them
+#define AOONET_NODE_INTERVAL 1.0
+#define AOONET_NODE_TIMEOUT 5.0
+
+// packs messages for the other nodes into OSC bundles
+class node_bundle {
+public:
+    node_bundle(server& s) : server_(s) { clear(); }
+    ~node_bundle() { flush(); }
+
+    void add(const char *msg, int32_t size){
+        if (size_ + 4 + size > (int32_t)sizeof(buf_)){
+            flush();
+        }
+        aoo::to_bytes<int32_t>(size, buf_ + size_);
+        memcpy(buf_ + size_ + 4, msg, size);
+        size_ += 4 + size;
+        count_++;
+    }
+
+    void flush(){
+        if (count_ > 0){
+            server_.send_node_message(buf_, size_);
+        }
+        clear();
+    }
+private:
+    void clear(){
+        // "#bundle" + immediate time tag
+        memcpy(buf_, "#bundle\0", 8);
+        memset(buf_ + 8, 0, 8);
+        buf_[15] = 1;
+        size_ = 16;
+        count_ = 0;
+    }
+
+    server& server_;
+    char buf_[AOO_MAXPACKETSIZE];
+    int32_t size_;
+    int32_t count_;
+};
+
+static int32_t make_node_join_message(char *buf, int32_t size, uint64_t node,
+                                      const group& grp, const user& usr)
+{
+    auto e = usr.endpoint;
+
+    osc::OutboundPacketStream msg(buf, size);
+    msg << osc::BeginMessage(AOONET_MSG_SERVER_NODE_JOIN)
+        << (int64_t)node << grp.name.c_str() << grp.password.c_str() << usr.name.c_str()
+        << e->public_address.name().c_str() << e->public_address.port()
+        << e->local_address.name().c_str() << e->local_address.port()
+        << e->token << e->local_interfaces.c_str()
+        << osc::EndMessage;
+
+    return (int32_t) msg.Size();
+}
+
+void server::send_node_message(const char *msg, int32_t size){
+    // NOTE: called with the state lock held.
+    for (auto& node : nodes_){
+        send_udp_message(msg, size, node);
+    }
+}
+
+void server::announce_member(const user& usr, const group& grp, bool joined){
+    // NOTE: called with the state lock held.
+    if (nodes_.empty()){
+        return;
+    }
+
+    char buf[AOO_MAXPACKETSIZE];
+    int32_t size;
+    if (joined){
+        size = make_node_join_message(buf, sizeof(buf), node_id_, grp, usr);
+    } else {
+        osc::OutboundPacketStream msg(buf, sizeof(buf));
+        msg << osc::BeginMessage(AOONET_MSG_SERVER_NODE_LEAVE)
+            << (int64_t)node_id_ << grp.name.c_str() << usr.name.c_str()
+            << osc::EndMessage;
+        size = (int32_t) msg.Size();
+    }
+    send_node_message(buf, size);
+}
+
+int server::wait_timeout() const {
+    auto timeout = node_wait_timeout();
+    if (have_public_changes_.load()){
+        auto remaining = public_changes_due_.load() - relay_time();
+        auto ms = std::max<int>(0, (int)(remaining * 1000.0) + 1);
+        timeout = timeout < 0 ? ms : std::min<int>(timeout, ms);
+    }
+    {
+        auto remaining = last_session_update_ + AOONET_SESSION_INTERVAL - relay_time();
+        auto ms = std::max<int>(0, (int)(remaining * 1000.0) + 1);
+        timeout = timeout < 0 ? ms : std::min<int>(timeout, ms);
+    }
+    return timeout;
+}
+
+int server::node_wait_timeout() const {
+    if (!have_nodes_.load()){
+        return -1;
+    }
+    auto remaining = last_node_update_ + AOONET_NODE_INTERVAL - relay_time();
+    return std::max<int>(0, (int)(remaining * 1000.0) + 1);
+}
+
+void server::update_nodes(){
+    auto now = relay_time();
+    if (now - last_node_update_ < AOONET_NODE_INTERVAL){
+        return;
+    }
+    last_node_update_ = now;
+
+    unique_lock lock(state_mutex_);
+
+    // 1) refresh our members on the other nodes. this also makes up
+    // for lost join messages and brings restarted nodes up to date.
+    {
+        node_bundle bundle(*this);
+        char buf[AOO_MAXPACKETSIZE];
+        for (auto& kv : groups_){
+            auto& grp = *kv.second;
+            for (auto& usr : grp.users()){
+                if (usr->endpoint){
+                    auto size = make_node_join_message(buf, sizeof(buf), node_id_, grp, *usr);
+                    bundle.add(buf, size);
+                }
+            }
+        }
+    }
+
+    // 2) forget about members which haven't been refreshed,
+    // e.g. because their node has gone away.
+    for (auto git = remote_groups_.begin(); git != remote_groups_.end(); ){
+        auto& members = git->second;
+        for (auto it = members.begin(); it != members.end(); ){
+            if (now - it->second.last_seen > AOONET_NODE_TIMEOUT){
+                LOG_VERBOSE("aoo_server: remote member " << it->first << " of group "
+                            << git->first << " timed out");
+                auto m = std::move(it->second);
+                auto name = it->first;
+                it = members.erase(it);
+                num_remote_members_--;
+                on_remote_member_changed(git->first, name, m, false);
+            } else {
+                ++it;
+            }
+        }
+        if (members.empty()){
+            git = remote_groups_.erase(git);
+        } else {
+            ++git;
+        }
+    }
+
+    flush_clients();
+}
+
+void server::handle_node_message(const osc::ReceivedMessage& msg, const char *pattern,
+                                 const ip_address& addr)
+{
+    unique_lock lock(state_mutex_);
+
+    // only accept messages from our nodes
+    if (std::find(nodes_.begin(), nodes_.end(), addr) == nodes_.end()){
+        LOG_VERBOSE("aoo_server: ignoring node message from " << addr.name()
+                    << ":" << addr.port());
+        return;
+    }
+
+    auto it = msg.ArgumentsBegin();
+    auto node = (uint64_t)(it++)->AsInt64();
+    if (node == node_id_){
+        return; // we are on our own node list
+    }
+    std::string group = (it++)->AsString();
+
+    if (!strcmp(pattern, AOONET_MSG_NODE_JOIN)){
+        remote_member m;
+        m.password = (it++)->AsString();
+        std::string name = (it++)->AsString();
+        std::string public_ip = (it++)->AsString();
+        int32_t public_port = (it++)->AsInt32();
+        std::string local_ip = (it++)->AsString();
+        int32_t local_port = (it++)->AsInt32();
+        m.token = (it++)->AsInt64();
+        if (it != msg.ArgumentsEnd()){
+            m.local_interfaces = sanitize_interfaces((it++)->AsString());
+        }
+        m.public_address = ip_address(public_ip, public_port);
+        m.local_address = ip_address(local_ip, local_port);
+        m.node = node;
+        m.last_seen = relay_time();
+
+        auto& members = remote_groups_[group];
+        auto mit = members.find(name);
+        if (mit != members.end()){
+            auto& old = mit->second;
+            if (old.node == m.node && old.password == m.password && old.token == m.token
+                    && old.local_interfaces == m.local_interfaces
+                    && old.public_address == m.public_address
+                    && old.local_address == m.local_address){
+                old.last_seen = m.last_seen; // just a refresh
+                return;
+            }
+            // the member has changed (e.g. reconnected), replace it
+            auto prev = std::move(old);
+            members.erase(mit);
+            on_remote_member_changed(group, name, prev, false);
         } else {
-            LOG_VERBOSE("aoo_server: send() would block");
+            num_remote_members_++;
+        }
+        LOG_VERBOSE("aoo_server: remote member " << name << " joined group " << group);
+        auto& added = members.emplace(name, std::move(m)).first->second;
+        on_remote_member_changed(group, name, added, true);
+    } else if (!strcmp(pattern, AOONET_MSG_NODE_LEAVE)){
+        std::string name = (it++)->AsString();
+
+        auto git = remote_groups_.find(group);
+        if (git == remote_groups_.end()){
+            return;
+        }
+        auto mit = git->second.find(name);
+        if (mit == git->second.end() || mit->second.node != node){
+            return;
+        }
+        LOG_VERBOSE("aoo_server: remote member " << name << " left group " << group);
+        auto m = std::move(mit->second);
+        git->second.erase(mit);
+        num_remote_members_--;
+        if (git->second.empty()){
+            remote_groups_.erase(git);
         }
+        on_remote_member_changed(group, name, m, false);
+    } else {
+        LOG_ERROR("aoo_server: unknown node message " << pattern);
     }
 }
 
-void server::handle_udp_message(const osc::ReceivedMessage &msg, int onset,
-                                const ip_address& addr)
+bool server::remote_visible(const std::string& group, const std::string& name,
+                            const remote_member& m)
 {
-    auto pattern = msg.AddressPattern() + onset;
-    LOG_DEBUG("aoo_server: handle client UDP message " << pattern);
+    auto grp = find_group(group);
+    if (!grp || grp->password != m.password){
+        return false;
+    }
+    // a local user with the same name wins
+    auto usr = find_user(name);
+    return !(usr && grp->users().contains(*usr));
+}
 
-    try {
-        if (!strcmp(pattern, AOONET_MSG_PING)){
-            // reply with /ping message
-            char buf[512];
-            osc::OutboundPacketStream reply(buf, sizeof(buf));
-            reply << osc::BeginMessage(AOONET_MSG_CLIENT_PING)
-                  << osc::EndMessage;
+void server::on_remote_member_changed(const std::string& group, const std::string& name,
+                                      const remote_member& m, bool joined)
+{
+    // NOTE: called with the state lock held.
+    if (!remote_visible(group, name, m)){
+        return;
+    }
 
-            send_udp_message(reply.Data(), (int32_t) reply.Size(), addr);
-        } else if (!strcmp(pattern, AOONET_MSG_REQUEST)){
-            // reply with /reply message
-            char buf[512];
-            osc::OutboundPacketStream reply(buf, sizeof(buf));
-            reply << osc::BeginMessage(AOONET_MSG_CLIENT_REPLY)
-                  << addr.name().c_str() << addr.port() << osc::EndMessage;
+    char buf[AOO_MAXPACKETSIZE];
+    int32_t size;
+    if (joined){
+        size = make_peer_join_message(buf, sizeof(buf), group, name, m.public_address,
+                                      m.local_address, m.local_interfaces, m.token);
+    } else {
+        osc::OutboundPacketStream msg(buf, sizeof(buf));
+        msg << osc::BeginMessage(AOONET_MSG_CLIENT_PEER_LEAVE)
+            << group.c_str() << name.c_str() << osc::EndMessage;
+        size = (int32_t) msg.Size();
+    }
+    shared_message buffer(buf, size);
 
-            send_udp_message(reply.Data(), (int32_t) reply.Size(), addr);
-        } else {
-            LOG_ERROR("aoo_server: unknown message " << pattern);
-        }
-    } catch (const osc::Exception& e){
-        LOG_ERROR("aoo_server: exception on handling " << pattern
-                  << " message: " << e.what());
+    auto grp = find_group(group);
+    for (auto& usr : grp->users()){
+        usr->endpoint->queue_message(buffer);
     }
 }
 
@@ -832,33 +3082,17 @@ void user::on_close(server& s){
 }
 
 bool user::add_group(std::shared_ptr<group> grp){
-    auto it = std::find(groups_.begin(), groups_.end(), grp);
-    if (it == groups_.end()){
-        groups_.push_back(grp);
-        return true;
-    } else {
-        return false;
-    }
+    return groups_.add(std::move(grp));
 }
 
 bool user::remove_group(const group& grp){
-    // find by address
-    auto it = std::find_if(groups_.begin(), groups_.end(),
-                           [&](auto& g){ return g.get() == &grp; });
-    if (it != groups_.end()){
-        groups_.erase(it);
-        return true;
-    } else {
-        return false;
-    }
+    return groups_.remove(grp);
 }
 
 /*////////////////////////// group /////////////////////////*/
 
-bool group::add_user(std::shared_ptr<user> grp){
-    auto it = std::find(users_.begin(), users_.end(), grp);
-    if (it == users_.end()){
-        users_.push_back(grp);
+bool group::add_user(std::shared_ptr<user> usr){
+    if (users_.add(std::move(usr))){
         return true;
     } else {
         LOG_ERROR("group::add_user: bug");
@@ -867,11 +3101,7 @@ bool group::add_user(std::shared_ptr<user> grp){
 }
 
 bool group::remove_user(const user& usr){
-    // find by address
-    auto it = std::find_if(users_.begin(), users_.end(),
-                           [&](auto& u){ return u.get() == &usr; });
-    if (it != users_.end()){
-        users_.erase(it);
+    if (users_.remove(usr)){
         return true;
     } else {
         LOG_ERROR("group::remove_user: bug");
@@ -881,8 +3111,8 @@ bool group::remove_user(const user& usr){
 
 /*///////////////////////// client_endpoint /////////////////////////////*/
 
-client_endpoint::client_endpoint(server &s, int sock, const ip_address &addr)
-    : server_(&s), socket(sock), addr_(addr)
+client_endpoint::client_endpoint(server &s, int sock, const ip_address &addr, int pollfd)
+    : server_(&s), socket(sock), addr_(addr), pollfd_(pollfd)
 {
     int val = 0;
     // NOTE: on POSIX systems, the socket returned by accept() does *not*
@@ -908,9 +3138,14 @@ client_endpoint::client_endpoint(server &s, int sock, const ip_address &addr)
         // ignore
     }
 
-    sendbuffer_.setup(65536);
     recvbuffer_.setup(65536);
 
+    server_->client_count()++;
+
+    if (socket >= 0){
+        server::add_socket(pollfd_, socket, this);
+    }
+
     // generate random token
     //std::random_device randdev;
     //std::default_random_engine reng(randdev());
@@ -923,66 +3158,224 @@ client_endpoint::~client_endpoint(){
     WSACloseEvent(event);
 #endif
     close();
+    server_->client_count()--;
 }
 
 void client_endpoint::close(bool notify){
     if (socket >= 0){
         LOG_VERBOSE("aoo_server: close client endpoint");
-        socket_close(socket);
-        socket = -1;
+        {
+            unique_lock lock(send_mutex_);
+            server::remove_socket(pollfd_, socket);
+            socket_close(socket);
+            socket = -1;
+        }
 
         if (user_ && notify){
+            unique_lock lock(server_->state_mutex());
             user_->on_close(*server_);
         }
     }
 }
 
+void client_endpoint::kick(){
+    // like a full output queue, see push_message()
+    unique_lock lock(send_mutex_);
+    if (socket >= 0 && !overflow_){
+        overflow_ = true;
+        output_.clear();
+        output_offset_ = 0;
+        output_bytes_ = 0;
+    #ifdef _WIN32
+        shutdown(socket, SD_BOTH);
+    #else
+        shutdown(socket, SHUT_RDWR);
+    #endif
+    }
+}
+
+message_buffer make_message_buffer(const char *msg, int32_t size, bool binary){
+    auto buf = std::make_shared<std::vector<uint8_t>>();
+    if (binary){
+        control_encode(msg, size, *buf);
+    } else {
+        SLIP::encode((const uint8_t *)msg, size, *buf);
+    }
+    return buf;
+}
+
 void client_endpoint::send_message(const char *msg, int32_t size){
-    if (sendbuffer_.write_packet((const uint8_t *)msg, size)){
-        while (true){
-            uint8_t buf[1024];
-            int32_t total = 0;
-            // first try to send pending data
-            if (!pending_send_data_.empty()){
-                 std::copy(pending_send_data_.begin(), pending_send_data_.end(), buf);
-                 total = (int32_t) pending_send_data_.size();
-                 pending_send_data_.clear();
-            } else if (sendbuffer_.read_available()){
-                 total = sendbuffer_.read_bytes(buf, sizeof(buf));
-            } else {
+    auto buf = make_message_buffer(msg, size, binary());
+
+    unique_lock lock(send_mutex_);
+    if (push_message(std::move(buf))){
+        send_buffered();
+        LOG_DEBUG("aoo_server: sent " << msg << " to client");
+    }
+}
+
+void client_endpoint::queue_message(const char *msg, int32_t size){
+    queue_message(make_message_buffer(msg, size, binary()));
+}
+
+void client_endpoint::queue_message(const message_buffer& buf){
+    {
+        unique_lock lock(send_mutex_);
+        if (!push_message(buf)){
+            return;
+        }
+    }
+    if (!flush_queued_){
+        flush_queued_ = true;
+        server_->schedule_flush(*this);
+    }
+}
+
+void client_endpoint::flush(){
+    flush_queued_ = false;
+
+    unique_lock lock(send_mutex_);
+    // if the socket is full, we wait for on_writable()
+    if (!wants_write_.load()){
+        send_buffered();
+    }
+}
+
+void client_endpoint::on_writable(){
+    unique_lock lock(send_mutex_);
+    send_buffered();
+}
+
+// NOTE: called with the send mutex locked
+bool client_endpoint::push_message(message_buffer buf){
+    if (socket < 0 || overflow_){
+        return false; // closed or about to be closed
+    }
+
+    auto& stats = server_->stats();
+    auto size = buf->size();
+
+    if (output_bytes_ + size > (size_t)server_->send_queue_limit()){
+        // the client doesn't keep up. rather than silently dropping
+        // messages (and leaving the client in an inconsistent state)
+        // we disconnect it. shutting down the socket makes it readable,
+        // so the owning I/O thread will close it in receive_data().
+        LOG_WARNING("aoo_server: output queue of client full (" << output_bytes_
+                    << " bytes), disconnecting");
+        overflow_ = true;
+        output_.clear();
+        output_offset_ = 0;
+        output_bytes_ = 0;
+    #ifdef _WIN32
+        shutdown(socket, SD_BOTH);
+    #else
+        shutdown(socket, SHUT_RDWR);
+    #endif
+        stats.dropped++;
+        stats.disconnects++;
+        return false;
+    }
+
+    output_.push_back(std::move(buf));
+    output_bytes_ += size;
+
+    stats.messages++;
+    if ((int32_t)output_bytes_ > stats.max_queued.load()){
+        stats.max_queued.store((int32_t)output_bytes_);
+    }
+    return true;
+}
+
+// NOTE: called with the send mutex locked
+void client_endpoint::send_buffered(){
+    const int maxbuffers = 64;
+
+    while (!output_.empty() && socket >= 0){
+        // send as many buffers as possible in a single call
+    #ifdef _WIN32
+        WSABUF bufs[maxbuffers];
+    #else
+        struct iovec bufs[maxbuffers];
+    #endif
+        int count = 0;
+        auto offset = output_offset_;
+        for (auto& b : output_){
+            if (count == maxbuffers){
                 break;
             }
+        #ifdef _WIN32
+            bufs[count].buf = (char *)b->data() + offset;
+            bufs[count].len = (ULONG)(b->size() - offset);
+        #else
+            bufs[count].iov_base = (void *)(b->data() + offset);
+            bufs[count].iov_len = b->size() - offset;
+        #endif
+            offset = 0;
+            count++;
+        }
 
-            int32_t nbytes = 0;
-            while (nbytes < total){
-                auto res = ::send(socket, (char *)buf + nbytes, total - nbytes, 0);
-                if (res >= 0){
-                    nbytes += res;
-                #if 0
-                    LOG_VERBOSE("aoo_server: sent " << res << " bytes");
-                #endif
-                } else {
-                    auto err = socket_errno();
-                #ifdef _WIN32
-                    if (err != WSAEWOULDBLOCK)
-                #else
-                    if (err != EWOULDBLOCK)
-                #endif
-                    {
-                        // TODO handle error
-                        LOG_ERROR("aoo_server: send() failed (" << err << ")");
-                    } else {
-                        // store in pending buffer
-                        pending_send_data_.assign(buf + nbytes, buf + total);
-                        LOG_VERBOSE("aoo_server: send() would block");
-                    }
-                    return;
-                }
+    #ifdef _WIN32
+        DWORD sent = 0;
+        int res = (WSASend(socket, bufs, count, &sent, 0, nullptr, nullptr) == 0) ? (int)sent : -1;
+    #else
+        struct msghdr hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_iov = bufs;
+        hdr.msg_iovlen = count;
+    #ifdef MSG_NOSIGNAL
+        auto res = ::sendmsg(socket, &hdr, MSG_NOSIGNAL);
+    #else
+        auto res = ::sendmsg(socket, &hdr, 0);
+    #endif
+    #endif
+        if (res < 0){
+            auto err = socket_errno();
+        #ifdef _WIN32
+            if (err != WSAEWOULDBLOCK)
+        #else
+            if (err != EWOULDBLOCK)
+        #endif
+            {
+                // TODO handle error
+                LOG_ERROR("aoo_server: send() failed (" << err << ")");
+                output_.clear();
+                output_offset_ = 0;
+                output_bytes_ = 0;
+            } else if (!wants_write_.load()){
+                // try again when the socket becomes writable
+                LOG_VERBOSE("aoo_server: send() would block");
+                server_->stats().would_block++;
+                wants_write_.store(true);
+                server::watch_writable(pollfd_, socket, this, true);
+            }
+            return;
+        }
+    #if 0
+        LOG_VERBOSE("aoo_server: sent " << res << " bytes");
+    #endif
+        server_->stats().bytes_sent += res;
+        output_bytes_ -= res;
+
+        // pop all the buffers which have been sent completely
+        size_t nbytes = res;
+        while (nbytes > 0){
+            auto remaining = output_.front()->size() - output_offset_;
+            if (nbytes >= remaining){
+                nbytes -= remaining;
+                output_.pop_front();
+                output_offset_ = 0;
+            } else {
+                output_offset_ += nbytes;
+                nbytes = 0;
             }
         }
-        LOG_DEBUG("aoo_server: sent " << msg << " to client");
-    } else {
-        LOG_ERROR("aoo_server: couldn't send " << msg << " to client");
+    }
+
+    if (output_.empty() && wants_write_.load()){
+        wants_write_.store(false);
+        if (socket >= 0){
+            server::watch_writable(pollfd_, socket, this, false);
+        }
     }
 }
 
@@ -1021,7 +3414,12 @@ bool client_endpoint::receive_data(){
         // handle packets
         uint8_t buf[AOO_MAXPACKETSIZE];
         while (true){
-            auto size = recvbuffer_.read_packet(buf, sizeof(buf));
+            bool binary = false;
+            auto size = control_read_packet(recvbuffer_, buf, sizeof(buf), binary);
+            if (size < 0){
+                LOG_ERROR("client_endpoint: received bad frame");
+                return false;
+            }
             if (size > 0){
                 try {
                     osc::ReceivedPacket packet((char *)buf, size);
@@ -1063,38 +3461,59 @@ bool client_endpoint::receive_data(){
 }
 
 void client_endpoint::handle_message(const osc::ReceivedMessage &msg){
-    // first check main pattern
-    int32_t len = (int32_t) strlen(msg.AddressPattern());
-    int32_t onset = AOO_MSG_DOMAIN_LEN + AOONET_MSG_SERVER_LEN;
+    // integer address patterns in binary frames, otherwise the full pattern
+    auto id = control_message_id(msg);
+    auto pattern = control_message_pattern(id);
+    LOG_DEBUG("aoo_server: got message " << pattern);
 
-    if ((len < onset) ||
-        memcmp(msg.AddressPattern(), AOO_MSG_DOMAIN AOONET_MSG_SERVER, onset))
-    {
-        LOG_ERROR("aoo_server: received bad message " << msg.AddressPattern()
-                  << " from client");
+    // turn away login floods before they get to the state lock
+    if (id == control_message::server_login && !server_->admit_login(addr_)){
+        char buf[AOO_MAXPACKETSIZE];
+        osc::OutboundPacketStream reply(buf, sizeof(buf));
+        reply << osc::BeginMessage(AOONET_MSG_CLIENT_LOGIN)
+              << (int32_t)0 << "too many login attempts" << osc::EndMessage;
+        send_message(reply.Data(), (int32_t)reply.Size());
         return;
     }
 
-    // now compare subpattern
-    auto pattern = msg.AddressPattern() + onset;
-    LOG_DEBUG("aoo_server: got message " << pattern);
-
     try {
-        if (!strcmp(pattern, AOONET_MSG_PING)){
+        // everything but ping touches users and groups
+        unique_lock lock(server_->state_mutex(), std::defer_lock);
+        if (id != control_message::server_ping){
+            lock.lock();
+        }
+
+        switch (id){
+        case control_message::server_ping:
             handle_ping(msg);
-        } else if (!strcmp(pattern, AOONET_MSG_LOGIN)){
+            break;
+        case control_message::server_login:
             handle_login(msg);
-        } else if (!strcmp(pattern, AOONET_MSG_GROUP_JOIN)){
+            break;
+        case control_message::server_group_join:
             handle_group_join(msg);
-        } else if (!strcmp(pattern, AOONET_MSG_GROUP_LEAVE)){
+            break;
+        case control_message::server_group_leave:
             handle_group_leave(msg);
-        } else if (!strcmp(pattern, AOONET_MSG_GROUP_PUBLIC)){
+            break;
+        case control_message::server_group_public:
             handle_group_public(msg);
-        } else {
-            LOG_ERROR("aoo_server: unknown message " << msg.AddressPattern());
+            break;
+        case control_message::server_route:
+            handle_forward_route(msg);
+            break;
+        default:
+            if (msg.AddressPatternIsUInt32()){
+                LOG_ERROR("aoo_server: unknown message " << msg.AddressPatternAsUInt32()
+                          << " from client");
+            } else {
+                LOG_ERROR("aoo_server: unknown message " << msg.AddressPattern()
+                          << " from client");
+            }
+            break;
         }
     } catch (const osc::Exception& e){
-        LOG_ERROR("aoo_server: exception on handling " << msg.AddressPattern()
+        LOG_ERROR("aoo_server: exception on handling " << pattern
                   << " message: " << e.what());
     }
 }
@@ -1121,20 +3540,53 @@ void client_endpoint::handle_login(const osc::ReceivedMessage& msg)
     std::string local_ip = (it++)->AsString();
     int32_t local_port = (it++)->AsInt32();
     int64_t ctoken = msg.ArgumentCount() > 6 ? (it++)->AsInt64() : 0;
-    
+    std::string interfaces = msg.ArgumentCount() > 7 ? (it++)->AsString() : "";
+    int32_t version = msg.ArgumentCount() > 8 ? (it++)->AsInt32() : 0;
+    int64_t resume = msg.ArgumentCount() > 9 ? (it++)->AsInt64() : 0;
+
+    // the client may send the public group watch (-1: leave it alone) and any
+    // number of group joins (name, password, public) along with the login,
+    // so it doesn't have to wait for the reply before it can send them.
+    struct join_request {
+        std::string name;
+        std::string password;
+        bool is_public;
+    };
+    bool pipelined = msg.ArgumentCount() > 10;
+    int32_t watch = pipelined ? (it++)->AsInt32() : -1;
+    std::vector<join_request> joins;
+    while (pipelined && it != msg.ArgumentsEnd()){
+        join_request req;
+        req.name = (it++)->AsString();
+        req.password = (it++)->AsString();
+        req.is_public = (it++)->AsBool();
+        joins.push_back(std::move(req));
+    }
+
+    // the client understands binary frames, so we answer with them
+    if (version > 0){
+        control_version_ = std::min<int32_t>(version, AOONET_CONTROL_VERSION);
+    }
+
     if (ctoken) {
         token = ctoken;
     }
     
     server::error err;
+    int64_t session = 0;
+    bool resumed = false;
+    std::vector<std::shared_ptr<group>> groups;
     if (!user_){
         user_ = server_->get_user(username, password, err);
         if (user_){
             // success
             public_address = ip_address(public_ip, public_port);
             local_address = ip_address(local_ip, local_port);
+            local_interfaces = sanitize_interfaces(interfaces);
             user_->endpoint = this;
 
+            session = server_->login_session(user_, resume, resumed, groups);
+
             LOG_VERBOSE("aoo_server: login: "
                         << "username: " << username << ", password: " << password
                         << ", public IP: " << public_ip << ", public port: " << public_port
@@ -1144,24 +3596,126 @@ void client_endpoint::handle_login(const osc::ReceivedMessage& msg)
 
             server_->on_user_joined(*user_);
         } else {
+            if (err == server::error::access_denied && resume != 0){
+                // most likely the client's old connection, which we haven't
+                // noticed to be dead yet. it gets in on its next try.
+                server_->kick_session(username, resume);
+            }
             errmsg = server::error_to_string(err);
         }
     } else {
         errmsg = "already logged in"; // shouldn't happen
     }
 
-    // send reply
+    // send reply, for a resumed session with the groups we are back in.
+    // a trailing int tells the client that its pipelined requests have been
+    // handled, their replies follow in the same bundle.
     char buf[AOO_MAXPACKETSIZE];
     osc::OutboundPacketStream reply(buf, sizeof(buf));
     reply << osc::BeginMessage(AOONET_MSG_CLIENT_LOGIN)
-          << result << errmsg.c_str() << osc::EndMessage;
+          << result << errmsg.c_str();
+    if (result){
+        reply << session << (int32_t)resumed;
+        for (auto& grp : groups){
+            reply << grp->name.c_str();
+        }
+        if (pipelined){
+            reply << (int32_t)1;
+        }
+    }
+    reply << osc::EndMessage;
 
-    send_message(reply.Data(), (int32_t)reply.Size());
+    if (!result){
+        send_message(reply.Data(), (int32_t)reply.Size());
+        return;
+    }
+
+    // the reply, the peers, the join replies and the public groups all go
+    // out in one piece
+    bundle_writer bundle(*this);
+    bundle.add(reply.Data(), (int32_t)reply.Size());
+
+    // after the reply, because this sends the peers
+    for (auto& grp : groups){
+        server_->on_user_joined_group(*user_, *grp, &bundle);
+    }
+    if (resumed && user_->watch_public_groups){
+        server_->on_user_wants_public_groups(*user_, &bundle);
+    }
+
+    for (auto& req : joins){
+        std::string joinerr;
+        int32_t joinresult = 0;
+        auto back = std::find_if(groups.begin(), groups.end(),
+                                 [&](auto& g){ return g->name == req.name; });
+        if (back != groups.end()){
+            // the resumed session has brought us back into it already
+            joinresult = 1;
+        } else {
+            joinresult = join_group(req.name, req.password, req.is_public, joinerr, &bundle);
+        }
+
+        osc::OutboundPacketStream joinreply(buf, sizeof(buf));
+        joinreply << osc::BeginMessage(AOONET_MSG_CLIENT_GROUP_JOIN)
+                  << req.name.c_str() << joinresult << joinerr.c_str() << osc::EndMessage;
+        bundle.add(joinreply.Data(), (int32_t)joinreply.Size());
+    }
+
+    if (watch >= 0){
+        std::string watcherr;
+        int32_t watchresult = watch_public_groups(watch != 0, watcherr, &bundle);
+
+        osc::OutboundPacketStream watchreply(buf, sizeof(buf));
+        watchreply << osc::BeginMessage(AOONET_MSG_CLIENT_GROUP_PUBLIC)
+                   << (watch != 0) << watchresult << watcherr.c_str() << osc::EndMessage;
+        bundle.add(watchreply.Data(), (int32_t)watchreply.Size());
+    }
+}
+
+int32_t client_endpoint::join_group(const std::string& name, const std::string& password,
+                                    bool is_public, std::string& errmsg, bundle_writer *bundle)
+{
+    if (!user_){
+        errmsg = "not logged in";
+        return 0;
+    }
+
+    server::error err;
+    auto grp = server_->get_group(name, password, is_public, err);
+    if (!grp){
+        errmsg = server::error_to_string(err);
+        return 0;
+    }
+    if (!user_->add_group(grp)){
+        errmsg = "already a group member";
+        return 0;
+    }
+    grp->add_user(user_);
+    server_->on_user_joined_group(*user_, *grp, bundle);
+    server_->on_session_group_joined(*user_, *grp);
+    return 1;
+}
+
+int32_t client_endpoint::watch_public_groups(bool watch, std::string& errmsg, bundle_writer *bundle)
+{
+    if (!user_){
+        errmsg = "not logged in";
+        return 0;
+    }
+
+    // register interest in seeing public groups
+    user_->watch_public_groups = watch;
+    server_->on_session_watch_public(*user_, watch);
+
+    if (watch) {
+        // send current batch
+        server_->on_user_wants_public_groups(*user_, bundle);
+    }
+    return 1;
 }
 
 void client_endpoint::handle_group_join(const osc::ReceivedMessage& msg)
 {
-    int result = 0;
     std::string errmsg;
 
     auto it = msg.ArgumentsBegin();
@@ -1173,23 +3727,7 @@ void client_endpoint::handle_group_join(const osc::ReceivedMessage& msg)
         is_public = (it++)->AsBool();
     }
 
-    server::error err;
-    if (user_){
-        auto grp = server_->get_group(name, password, is_public, err);
-        if (grp){
-            if (user_->add_group(grp)){
-                grp->add_user(user_);
-                server_->on_user_joined_group(*user_, *grp);
-                result = 1;
-            } else {
-                errmsg = "already a group member";
-            }
-        } else {
-            errmsg = server::error_to_string(err);
-        }
-    } else {
-        errmsg = "not logged in";
-    }
+    int32_t result = join_group(name, password, is_public, errmsg);
 
     // send reply
     char buf[AOO_MAXPACKETSIZE];
@@ -1213,6 +3751,7 @@ void client_endpoint::handle_group_leave(const osc::ReceivedMessage& msg){
             if (user_->remove_group(*grp)){
                 grp->remove_user(*user_);
                 server_->on_user_left_group(*user_, *grp);
+                server_->on_session_group_left(*user_, *grp);
                 result = 1;
             } else {
                 errmsg = "not a group member";
@@ -1235,24 +3774,12 @@ void client_endpoint::handle_group_leave(const osc::ReceivedMessage& msg){
 
 void client_endpoint::handle_group_public(const osc::ReceivedMessage& msg)
 {
-    int result = 0;
     std::string errmsg;
 
     auto it = msg.ArgumentsBegin();
     bool shouldWatch = (it++)->AsBool();
 
-    server::error err;
-    if (user_){
-        // register interest in seeing public groups
-        user_->watch_public_groups = shouldWatch;
-
-        if (shouldWatch) {
-            // send current batch
-            server_->on_user_wants_public_groups(*user_);
-        }
-    } else {
-        errmsg = "not logged in";
-    }
+    int32_t result = watch_public_groups(shouldWatch, errmsg);
 
     // send reply
     char buf[AOO_MAXPACKETSIZE];
@@ -1263,44 +3790,56 @@ void client_endpoint::handle_group_public(const osc::ReceivedMessage& msg)
     send_message(reply.Data(), (int32_t)reply.Size());
 }
 
-/*///////////////////// events ////////////////////////*/
-
-server::event::event(int32_t type, int32_t result,
-                     const char * errmsg)
-{
-    server_event_.type = type;
-    server_event_.result = result;
-    server_event_.errormsg = copy_string(errmsg);
-}
-
-server::event::~event()
-{
-    delete server_event_.errormsg;
-}
-
-server::user_event::user_event(int32_t type, const char *name)
+void client_endpoint::handle_forward_route(const osc::ReceivedMessage& msg)
 {
-    user_event_.type = type;
-    user_event_.name = copy_string(name);
-}
-
-server::user_event::~user_event()
-{
-    delete user_event_.name;
-}
+    auto it = msg.ArgumentsBegin();
+    int32_t route = (it++)->AsInt32();
+    int32_t serial = (it++)->AsInt32();
+    const void *blobdata;
+    osc::osc_bundle_element_size_t blobsize;
+    (it++)->AsBlob(blobdata, blobsize);
+
+    // 4 bytes IPv4 + 4 bytes port per peer
+    const int32_t maxpeers = 64;
+    int32_t result = 0;
+    if (!user_){
+        LOG_WARNING("aoo_server: forward route from client which isn't logged in");
+    } else if (!server_->relay_enabled()){
+        LOG_VERBOSE("aoo_server: refused forward route (relay is disabled)");
+    } else if (public_address.family() != AF_INET){
+        // the relay header only has room for IPv4
+        LOG_VERBOSE("aoo_server: refused forward route (not IPv4)");
+    } else if ((blobsize % 8) || (blobsize / 8) > maxpeers){
+        LOG_WARNING("aoo_server: bad forward route from " << user_->name);
+    } else {
+        auto data = (const char *)blobdata;
+        std::vector<ip_address> peers;
+        for (int32_t i = 0; i < (int32_t)blobsize; i += 8){
+            uint32_t ip;
+            memcpy(&ip, data + i, 4);
+            auto port = aoo::from_bytes<int32_t>(data + i + 4);
+            if (port > 0 && port <= 65535){
+                peers.emplace_back(ntohl(ip), port);
+            }
+        }
+        if (!peers.empty()){
+            LOG_VERBOSE("aoo_server: " << user_->name << " set forward route "
+                        << route << " (" << peers.size() << " peers)");
+            forward_routes[route] = std::move(peers);
+        } else {
+            forward_routes.erase(route);
+        }
+        server_->on_forward_route_changed();
+        result = 1;
+    }
 
-server::group_event::group_event(int32_t type,
-                         const char *group, const char *user)
-{
-    group_event_.type = type;
-    group_event_.group = copy_string(group);
-    group_event_.user = copy_string(user);
-}
+    // send reply
+    char buf[AOO_MAXPACKETSIZE];
+    osc::OutboundPacketStream reply(buf, sizeof(buf));
+    reply << osc::BeginMessage(AOONET_MSG_CLIENT_ROUTE)
+          << route << serial << result << osc::EndMessage;
 
-server::group_event::~group_event()
-{
-    delete group_event_.group;
-    delete group_event_.user;
+    send_message(reply.Data(), (int32_t)reply.Size());
 }
 
 } // net
@@ -6,43 +6,212 @@
 
 #include "aoo/aoo_net.hpp"
 #include "aoo/aoo_utils.hpp"
+#include "sync.hpp"
 
 #include "lockfree.hpp"
 #include "net_utils.hpp"
 #include "SLIP.hpp"
+#include "control.hpp"
 
 #include "oscpack/osc/OscOutboundPacketStream.h"
 #include "oscpack/osc/OscReceivedElements.h"
 
 #include <memory.h>
+#include <deque>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <random>
+#include <thread>
+#include <chrono>
+
+// readiness backend for the server's sockets. with epoll/kqueue the sockets are
+// registered once and we only get told about the ready ones, instead of having
+// to poll() (and then scan) every connected client on each wakeup.
+#ifndef _WIN32
+# if defined(__linux__)
+#  define AOO_SERVER_EPOLL 1
+#  include <sys/epoll.h>
+# elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+#  define AOO_SERVER_KQUEUE 1
+#  include <sys/event.h>
+# endif
+#endif
+
+// on Linux the UDP socket is read with a multishot receive on an io_uring
+// where the kernel allows it, and with recvmmsg() otherwise.
+#if defined(__linux__)
+# include "aoo/aoo_uring.hpp"
+# include <sys/uio.h>
+# if AOO_SERVER_EPOLL && AOO_HAVE_URING
+#  define AOO_SERVER_URING 1
+# endif
+#endif
+
+// relay/forward packets can skip the kernel's UDP stack on Linux, see set_xdp()
+#include "xdp.hpp"
+#if AOO_SERVER_EPOLL && AOO_HAVE_XDP
+# define AOO_SERVER_XDP 1
+#endif
 
 namespace aoo {
 namespace net {
 
 class server;
 
+class bundle_writer;
+
+// a list of shared objects with O(1) membership test, insertion and removal.
+// removal swaps the last element into the hole, so the order is not preserved.
+template<typename T>
+class member_set {
+public:
+    using value_type = std::shared_ptr<T>;
+    using iterator = typename std::vector<value_type>::const_iterator;
+
+    bool add(value_type v){
+        if (index_.count(v.get())){
+            return false;
+        }
+        index_.emplace(v.get(), items_.size());
+        items_.push_back(std::move(v));
+        return true;
+    }
+
+    bool remove(const T& v){
+        auto it = index_.find(&v);
+        if (it == index_.end()){
+            return false;
+        }
+        auto pos = it->second;
+        index_.erase(it);
+        if (pos != items_.size() - 1){
+            items_[pos] = std::move(items_.back());
+            index_[items_[pos].get()] = pos;
+        }
+        items_.pop_back();
+        return true;
+    }
+
+    bool contains(const T& v) const { return index_.count(&v) != 0; }
+
+    void clear(){
+        items_.clear();
+        index_.clear();
+    }
+
+    size_t size() const { return items_.size(); }
+    bool empty() const { return items_.empty(); }
+
+    iterator begin() const { return items_.begin(); }
+    iterator end() const { return items_.end(); }
+private:
+    std::vector<value_type> items_;
+    std::unordered_map<const T *, size_t> index_;
+};
+
 struct user;
-using user_list = std::vector<std::shared_ptr<user>>;
+using user_list = member_set<user>;
+// users by name
+using user_map = std::unordered_map<std::string, std::shared_ptr<user>>;
 
 struct group;
-using group_list = std::vector<std::shared_ptr<group>>;
+using group_list = member_set<group>;
+// groups by name
+using group_map = std::unordered_map<std::string, std::shared_ptr<group>>;
+
+// an encoded message (SLIP packet or binary frame, see control.hpp)
+using message_buffer = std::shared_ptr<const std::vector<uint8_t>>;
+
+message_buffer make_message_buffer(const char *msg, int32_t size, bool binary);
+
+// a message shared by all the clients it is sent to. it is encoded
+// once for each framing which is actually needed.
+// NOTE: doesn't copy 'msg', so it must outlive the object.
+class shared_message {
+public:
+    shared_message(const char *msg, int32_t size)
+        : msg_(msg), size_(size) {}
+
+    const message_buffer& get(bool binary){
+        auto& buf = buffers_[binary];
+        if (!buf){
+            buf = make_message_buffer(msg_, size_, binary);
+        }
+        return buf;
+    }
+private:
+    const char *msg_;
+    int32_t size_;
+    message_buffer buffers_[2];
+};
+
+// token buckets per source IP address (the port doesn't count), for turning
+// away floods from a single host before they cost us anything. the buckets
+// live in a fixed table, so neither new addresses nor lots of them allocate;
+// addresses which land on the same slot while both are busy share a bucket.
+class rate_limiter {
+public:
+    rate_limiter(int32_t size = 4096);
 
+    // sustained rate per second, with bursts of twice as many (0 = unlimited)
+    void set_rate(double rate){ rate_.store(rate); }
+
+    // take a token, false if 'addr' ran out of them (thread safe)
+    bool allow(const ip_address& addr, double now);
+private:
+    struct bucket {
+        uint64_t key = 0; // 0 = unused
+        double tokens = 0;
+        double last_time = 0;
+    };
+    std::vector<bucket> buckets_;
+    std::atomic<double> rate_{0};
+    spinlock lock_;
+
+    static uint64_t address_key(const ip_address& addr);
+};
 
 class client_endpoint {
     server *server_;
 public:
-    client_endpoint(server &s, int sock, const ip_address& addr);
+    // 'pollfd' is the epoll/kqueue instance of the I/O shard that owns us
+    client_endpoint(server &s, int sock, const ip_address& addr, int pollfd = -1);
     ~client_endpoint();
 
     void close(bool notify=true);
 
+    // drop the connection from any thread, the owning I/O thread closes it
+    void kick();
+
     bool is_active() const { return socket >= 0; }
 
+    // send right away (together with anything that has been queued)
     void send_message(const char *msg, int32_t);
 
+    // only buffer the message; all queued data is sent in a single
+    // write at the end of the current event loop iteration.
+    // NOTE: call with the state lock held exclusively.
+    void queue_message(const char *msg, int32_t);
+
+    void queue_message(shared_message& msg){
+        queue_message(msg.get(binary()));
+    }
+
+    // the client has accepted binary frames, see control.hpp
+    bool binary() const { return control_version_.load() > 0; }
+
+    // NOTE: call with the state lock held exclusively.
+    void flush();
+
+    bool flush_queued() const { return flush_queued_; }
+
+    // called by the owning I/O thread when the socket is writable again
+    void on_writable();
+
+    // we have data that couldn't be sent because the socket would block
+    bool wants_write() const { return wants_write_.load(); }
+
     bool receive_data();
 
     int socket = -1;
@@ -51,14 +220,35 @@ public:
 #endif
     ip_address public_address;
     ip_address local_address;
+    // the client's other interface addresses (space separated, same port as
+    // 'local_address'), passed on to the peers as extra host candidates
+    std::string local_interfaces;
     int64_t token;
+    // forward routes set up by the client (route ID -> peer addresses),
+    // protected by the state lock
+    std::unordered_map<int32_t, std::vector<ip_address>> forward_routes;
 private:
     std::shared_ptr<user> user_;
     ip_address addr_;
-    
-    SLIP sendbuffer_;
+    int pollfd_;
+
+    // other I/O shards may send to us (group fan-out) while we close
+    shared_mutex send_mutex_;
     SLIP recvbuffer_;
-    std::vector<uint8_t> pending_send_data_;
+    // output queue, protected by the send mutex
+    std::deque<message_buffer> output_;
+    size_t output_offset_ = 0; // already sent bytes of the first buffer
+    size_t output_bytes_ = 0; // total unsent bytes
+    bool overflow_ = false;
+    std::atomic<bool> wants_write_{false};
+    bool flush_queued_ = false; // protected by the state lock
+    std::atomic<int32_t> control_version_{0}; // 0: OSC + SLIP
+
+    void queue_message(const message_buffer& buf);
+
+    bool push_message(message_buffer buf);
+
+    void send_buffered();
 
     void handle_message(const osc::ReceivedMessage& msg);
 
@@ -68,9 +258,18 @@ private:
 
     void handle_group_join(const osc::ReceivedMessage& msg);
 
+    // shared by the /join and /public handlers and the ones that come with
+    // the login, the peers (or public groups) go into 'bundle' if given
+    int32_t join_group(const std::string& name, const std::string& password,
+                       bool is_public, std::string& errmsg, bundle_writer *bundle = nullptr);
+
+    int32_t watch_public_groups(bool watch, std::string& errmsg, bundle_writer *bundle = nullptr);
+
     void handle_group_leave(const osc::ReceivedMessage& msg);
 
     void handle_group_public(const osc::ReceivedMessage& msg);
+
+    void handle_forward_route(const osc::ReceivedMessage& msg);
 };
 
 struct user {
@@ -93,7 +292,7 @@ struct user {
 
     int32_t num_groups() const { return (int32_t) groups_.size(); }
 
-    const group_list& groups() { return groups_; }
+    const group_list& groups() const { return groups_; }
 private:
     group_list groups_;
 };
@@ -113,7 +312,7 @@ struct group {
 
     int32_t num_users() const { return (int32_t)users_.size(); }
 
-    const user_list& users() { return users_; }
+    const user_list& users() const { return users_; }
 private:
     user_list users_;
 };
@@ -134,15 +333,15 @@ public:
         virtual void perform(server&) = 0;
     };
 
-    struct ievent {
-        virtual ~ievent(){}
-
+    // a slot of the event queue, see pack_event_string()
+    struct event {
         union {
             aoo_event event_;
             aoonet_server_event server_event_;
             aoonet_server_user_event user_event_;
             aoonet_server_group_event group_event_;
         };
+        char strings_[event_string_size];
     };
 
     server(int tcpsocket, int udpsocket);
@@ -156,6 +355,60 @@ public:
 
     int32_t handle_events(aoo_eventhandler fn, void *user) override;
 
+    int32_t set_event_notify(aoo_notifyfn fn, void *user) override;
+
+    int32_t set_io_threads(int32_t n) override;
+
+    int32_t set_send_queue_limit(int32_t bytes) override;
+
+    int32_t get_send_stats(aoonet_server_send_stats& stats) const override;
+
+    int32_t set_relay(bool enable, int32_t bandwidth) override;
+
+    int32_t get_relay_stats(aoonet_server_relay_stats& stats) const override;
+
+    int32_t get_stats(aoonet_server_stats& stats) const override;
+
+    int32_t set_rate_limits(int32_t accepts, int32_t logins, int32_t udp) override;
+
+    int32_t add_node(const char *host, int32_t port) override;
+
+    int32_t set_snapshot(const char *path, int32_t interval) override;
+
+    int32_t set_xdp(const char *ifname, int32_t queues) override;
+
+    int32_t send_queue_limit() const { return send_queue_limit_.load(); }
+
+    // admission control, see rate_limiter. a rejected accept/login/UDP
+    // message is counted and otherwise ignored by the caller.
+    bool admit_accept(const ip_address& addr);
+
+    bool admit_login(const ip_address& addr);
+
+    bool admit_udp(const ip_address& addr);
+
+    // updated by the clients
+    struct send_stats {
+        std::atomic<uint64_t> messages{0};
+        std::atomic<uint64_t> bytes_sent{0};
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<int32_t> would_block{0};
+        std::atomic<int32_t> disconnects{0};
+        std::atomic<int32_t> max_queued{0};
+    };
+
+    send_stats& stats() { return stats_; }
+
+    // open client connections, updated by the clients
+    std::atomic<int32_t>& client_count() { return num_clients_; }
+
+    // account for a batch of socket events, see loop_clock()
+    void loop_done(uint64_t start);
+
+    // protects users, groups and their membership. client messages are handled
+    // with it held, so they can come from any I/O shard.
+    shared_mutex& state_mutex() { return state_mutex_; }
+
     std::shared_ptr<user> get_user(const std::string& name,
                                    const std::string& pwd, error& e);
 
@@ -173,32 +426,77 @@ public:
 
     void on_user_left(user& usr);
 
-    void on_user_joined_group(user& usr, group& grp);
+    // the existing members go into 'bundle' if given, otherwise into one of their own
+    void on_user_joined_group(user& usr, group& grp, bundle_writer *bundle = nullptr);
 
     void on_user_left_group(user& usr, group& grp);
 
-    void on_user_wants_public_groups(user& usr);
+    void on_user_wants_public_groups(user& usr, bundle_writer *bundle = nullptr);
 
+    // these only queue the change, see update_public_groups()
     void on_public_group_modified(group& grp);
     void on_public_group_removed(group& grp);
+    void queue_public_change(const std::string& name);
+    // sends the changes of the last AOONET_PUBLIC_GROUP_INTERVAL to the watchers
+    void update_public_groups();
+
+    bool relay_enabled() const { return relay_enabled_.load(); }
+
+    // a client changed a forward route
+    void on_forward_route_changed() { relay_generation_++; }
+
+    // NOTE: call with the state lock held exclusively.
+    void schedule_flush(client_endpoint& c);
+
+    void flush_clients();
 
 
 private:
     int tcpsocket_;
     int udpsocket_;
+    int udpfamily_; // AF_INET6 if dual-stack
 #ifdef _WIN32
     HANDLE tcpevent_;
     HANDLE udpevent_;
 #endif
     std::vector<std::unique_ptr<client_endpoint>> clients_;
-    user_list users_;
-    group_list groups_;
+    user_map users_;
+    group_map groups_;
+    mutable shared_mutex state_mutex_;
+    // clients with queued messages, see client_endpoint::queue_message()
+    std::vector<client_endpoint *> flush_list_;
+    std::atomic<bool> need_flush_{false};
+    std::atomic<int32_t> send_queue_limit_{1 << 20};
+    send_stats stats_;
+    // additional I/O threads, each with their own set of clients.
+    // the server thread itself is the first shard.
+    struct io_shard;
+    std::vector<std::unique_ptr<io_shard>> shards_;
+    int32_t num_io_threads_ = 1;
+    int next_shard_ = 0; // round robin for handing over accepted clients
     // queues
     lockfree::queue<std::unique_ptr<icommand>> commands_;
-    lockfree::queue<std::unique_ptr<ievent>> events_;
-    void push_event(std::unique_ptr<ievent> e){
+    lockfree::queue<event> events_;
+    event_notifier eventnotifier_;
+    void push_user_event(int32_t type, const char *name){
         if (events_.write_available()){
-            events_.write(std::move(e));
+            auto e = events_.write_data();
+            int32_t pos = 0;
+            e->user_event_.type = type;
+            e->user_event_.name = pack_event_string(e->strings_, pos, name);
+            events_.write_commit();
+            eventnotifier_.notify();
+        }
+    }
+    void push_group_event(int32_t type, const char *group, const char *user){
+        if (events_.write_available()){
+            auto e = events_.write_data();
+            int32_t pos = 0;
+            e->group_event_.type = type;
+            e->group_event_.group = pack_event_string(e->strings_, pos, group);
+            e->group_event_.user = pack_event_string(e->strings_, pos, user);
+            events_.write_commit();
+            eventnotifier_.notify();
         }
     }
     // signal
@@ -208,6 +506,7 @@ private:
 #else
     int waitpipe_[2];
 #endif
+    int pollfd_ = -1; // epoll or kqueue instance (if available)
 
     void wait_for_event();
 
@@ -215,6 +514,41 @@ private:
 
     void receive_udp();
 
+#if defined(__linux__)
+    // max. number of datagrams received (and handled) at once
+    static const int udp_batch_size = 32;
+
+    void handle_udp_batch(struct iovec *iovecs, const int32_t *sizes,
+                          const ip_address *addrs, int count);
+#endif
+#if AOO_SERVER_URING
+    // only used by the server thread, which sets it up in run()
+    std::unique_ptr<uring> udpring_;
+    struct msghdr udpringmsg_; // what the receive is armed with
+
+    void start_udp_ring();
+    void arm_udp_ring();
+    void stop_udp_ring();
+    void receive_udp_ring();
+#endif
+#if AOO_SERVER_XDP
+    // set up by set_xdp(), the queues are registered with pollfd_
+    std::unique_ptr<xdp_port> xdp_;
+
+    void receive_xdp(int queue);
+
+    void send_xdp(int queue, xdp_port::packet& p, int32_t size,
+                  const ip_address& dest, bool last);
+#endif
+
+    // room for the quick replies (e.g. an IPv6 address with the port)
+    static const int32_t quick_reply_size = 128;
+
+    int32_t quick_reply(const char *buf, int32_t size,
+                        const ip_address& addr, char *out);
+
+    void handle_udp_packet(const char *buf, int32_t size, const ip_address& addr);
+
     void send_udp_message(const char *msg, int32_t size,
                           const ip_address& addr);
 
@@ -222,28 +556,215 @@ private:
                             const ip_address& addr);
 
     void signal();
+public:
+    // (de)register a socket with an epoll/kqueue instance, 'data' is handed back when
+    // it becomes readable (the client_endpoint, or the member for our own sockets)
+    static void add_socket(int pollfd, int sock, void *data);
+    static void remove_socket(int pollfd, int sock);
+    // (un)watch a registered socket for writability
+    static void watch_writable(int pollfd, int sock, void *data, bool enable);
+private:
+    void accept_clients();
+
+    void purge_clients(std::vector<std::unique_ptr<client_endpoint>>& clients);
 
-    /*/////////////////// events //////////////////////*/
+    /*/////////////////// relay //////////////////////*/
 
-    struct event : ievent
-    {
-        event(int32_t type, int32_t result,
-                     const char * errmsg = 0);
-        ~event();
+    // one direction of a relayed peer pair, only used on the server thread
+    struct relay_session {
+        uint64_t generation = 0; // of the group membership when checked
+        bool allowed = false;
+        double last_time = 0;
+        double tokens = 0; // bandwidth limit (token bucket)
     };
 
-    struct user_event : ievent
-    {
-        user_event(int32_t type, const char *name);
-        ~user_event();
+    // a forward route of a sender, with the peers it may actually reach
+    struct forward_session : relay_session {
+        std::vector<ip_address> peers;
     };
 
-    struct group_event : ievent
-    {
-        group_event(int32_t type,
-                    const char *group, const char *user);
-        ~group_event();
+    struct relay_key {
+        uint64_t src;
+        uint64_t dst;
+        bool operator==(const relay_key& other) const {
+            return src == other.src && dst == other.dst;
+        }
+    };
+
+    struct relay_key_hash {
+        size_t operator()(const relay_key& k) const {
+            return std::hash<uint64_t>()(k.src * 0x9E3779B97F4A7C15ULL ^ k.dst);
+        }
+    };
+
+    std::unordered_map<relay_key, relay_session, relay_key_hash> relay_sessions_;
+    // key: sender + route ID
+    std::unordered_map<relay_key, forward_session, relay_key_hash> forward_sessions_;
+    std::atomic<bool> relay_enabled_{false};
+    std::atomic<int32_t> relay_bandwidth_{0};
+    // bumped on every login/logout and group change, so that sessions get checked again
+    std::atomic<uint64_t> relay_generation_{1};
+    double last_relay_purge_ = 0;
+    std::vector<char> udpbuffer_; // batch receive/relay buffer (Linux)
+    struct relay_stats {
+        std::atomic<uint64_t> packets{0};
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<uint64_t> rejected{0};
+        std::atomic<int32_t> sessions{0};
+        std::atomic<uint64_t> xdp_packets{0};
+    } relay_stats_;
+    std::atomic<int32_t> num_clients_{0};
+    rate_limiter accept_limiter_;
+    rate_limiter login_limiter_;
+    rate_limiter udp_limiter_;
+    struct admission_stats {
+        std::atomic<uint64_t> rejected_accepts{0};
+        std::atomic<uint64_t> rejected_logins{0};
+        std::atomic<uint64_t> rejected_udp{0};
+    } admission_stats_;
+    struct loop_stats {
+        std::atomic<uint64_t> udp_packets{0};
+        std::atomic<uint64_t> udp_bytes{0};
+        std::atomic<uint64_t> loops{0};
+        std::atomic<uint64_t> time{0};
+        std::atomic<int32_t> max_time{0};
+        std::atomic<uint64_t> quick_replies{0};
+    } loop_stats_;
+
+    // check and rewrite a relay message in place: on success (1), 'dest'
+    // is the receiving peer and the header contains the sending peer.
+    // returns 0 for other packets and -1 if the packet should be dropped.
+    int32_t relay_packet(char *buf, int32_t size, const ip_address& addr,
+                         ip_address& dest, double now);
+
+    bool check_relay(const ip_address& src, const ip_address& dst);
+
+    // check a forward message and turn it into a relay message from the sender
+    // (in place, 'capacity' is the buffer size). on success, the new size is
+    // returned and 'peers' are the receivers. returns 0 for other packets
+    // and -1 if the packet should be dropped.
+    int32_t forward_packet(char *buf, int32_t size, int32_t capacity, const ip_address& addr,
+                           const std::vector<ip_address> *& peers, double now);
+
+    // the peers of a sender's route which share a group with the sender
+    void get_forward_route(const ip_address& src, int32_t route,
+                           std::vector<ip_address>& result);
+
+    bool take_relay_tokens(relay_session& session, double bytes, double now);
+
+    /*/////////////////// sessions //////////////////////*/
+public:
+    // NOTE: all with the state lock held.
+
+    // a user logged in: resume the session with 'token' (and join its groups
+    // again, they go into 'groups'), otherwise start a new one. returns the token.
+    int64_t login_session(const std::shared_ptr<user>& usr, int64_t token, bool& resumed,
+                          std::vector<std::shared_ptr<group>>& groups);
+
+    // the user is still logged in with the session 'token', i.e. the client
+    // reconnected before we noticed that the old connection is dead
+    void kick_session(const std::string& name, int64_t token);
+
+    void on_session_group_joined(const user& usr, const group& grp);
+
+    void on_session_group_left(const user& usr, const group& grp);
+
+    void on_session_watch_public(const user& usr, bool watch);
+private:
+    // what it takes to put a user back where it was, see login_session().
+    // kept for AOONET_SESSION_TIMEOUT after the user is gone and written to
+    // the snapshot file, so that clients can pick up where they left off
+    // after a restart instead of logging in and joining their groups anew.
+    struct session {
+        struct group_info {
+            std::string name;
+            std::string password;
+            bool is_public;
+        };
+        std::string password;
+        int64_t token = 0;
+        bool watch_public_groups = false;
+        std::vector<group_info> groups;
+        bool active = false; // logged in
+        double last_seen = 0; // when it stopped being active
+    };
+    // by user name, with the state lock held
+    std::unordered_map<std::string, session> sessions_;
+    std::random_device session_random_; // for the tokens
+    bool sessions_changed_ = false; // since the last snapshot
+    std::string snapshot_path_;
+    double snapshot_interval_ = 0;
+    double last_snapshot_ = 0; // server thread only
+    double last_session_update_ = 0; // server thread only
+
+    // expire old sessions and write the snapshot if something has changed
+    void update_sessions(bool force = false);
+
+    std::string write_snapshot() const;
+
+    void read_snapshot(std::istream& is);
+
+    /*/////////////////// cluster //////////////////////*/
+public:
+    // send a message to all other nodes (with the state lock held)
+    void send_node_message(const char *msg, int32_t size);
+
+    // a local user joined/left a group, tell the other nodes
+    void announce_member(const user& usr, const group& grp, bool joined);
+private:
+    // a group member on another node
+    struct remote_member {
+        std::string password; // of the group on that node
+        ip_address public_address;
+        ip_address local_address;
+        std::string local_interfaces;
+        int64_t token = 0;
+        uint64_t node = 0;
+        double last_seen = 0;
     };
+
+    // the other nodes, only modified with the state lock held
+    std::vector<ip_address> nodes_;
+    std::atomic<bool> have_nodes_{false};
+    uint64_t node_id_ = 0; // random, so that we can ignore ourselves
+    // group name -> user name -> member, with the state lock held
+    std::unordered_map<std::string,
+        std::unordered_map<std::string, remote_member>> remote_groups_;
+    std::atomic<int32_t> num_remote_members_{0};
+    double last_node_update_ = 0; // server thread only
+
+    // public groups changed since the last update_public_groups() and the user
+    // counts the watchers were told, with the state lock held
+    std::unordered_set<std::string> public_changes_;
+    std::unordered_map<std::string, int32_t> public_sent_;
+    std::atomic<bool> have_public_changes_{false};
+    std::atomic<double> public_changes_due_{0};
+
+    // refresh our members on the other nodes and expire stale remote members
+    void update_nodes();
+
+    // milliseconds until the next update_nodes() or -1
+    int node_wait_timeout() const;
+
+    // milliseconds until the next update_nodes(), update_public_groups()
+    // or update_sessions(), or -1
+    int wait_timeout() const;
+
+    void handle_node_message(const osc::ReceivedMessage& msg, const char *pattern,
+                             const ip_address& addr);
+
+    // whether a remote member should be announced to the local members of the group
+    bool remote_visible(const std::string& group, const std::string& name,
+                        const remote_member& m);
+
+    void on_remote_member_changed(const std::string& group, const std::string& name,
+                                  const remote_member& m, bool joined);
+
+    void purge_relay_sessions(double now);
+
+    // after each batch of socket events: purge closed clients and flush queued messages
+    void finish_batch(std::vector<std::unique_ptr<client_endpoint>>& clients, bool didclose);
 };
 
 } // net
@@ -7,6 +7,8 @@
 
 #include <algorithm>
 #include <cmath>
+#include <limits>
+#include <thread>
 
 /*//////////////////// aoo_sink /////////////////////*/
 
@@ -29,6 +31,14 @@ int32_t aoo::sink::setup(int32_t samplerate,
                          int32_t blocksize, int32_t nchannels){
     if (samplerate > 0 && blocksize > 0 && nchannels > 0)
     {
+        if (samplerate == samplerate_ && blocksize == blocksize_ && nchannels != nchannels_){
+            // the sources don't depend on our channel count,
+            // so they go on playing without being set up again
+            nchannels_ = nchannels;
+            buffer_.resize(blocksize_ * nchannels_);
+            return 1;
+        }
+
         nchannels_ = nchannels;
         samplerate_ = samplerate;
         blocksize_ = blocksize;
@@ -53,13 +63,14 @@ int32_t aoo_sink_invite_source(aoo_sink *sink, void *endpoint,
 }
 
 int32_t aoo::sink::invite_source(void *endpoint, int32_t id, aoo_replyfn fn){
+    source_guard guard(sources_);
     // try to find existing source
     auto src = find_source(endpoint, id);
     if (!src){
         // discard data message, add source and request format!
-        sources_.emplace_front(endpoint, fn, id, 0);
-        src = &sources_.front();
+        src = &sources_.emplace_front(endpoint, fn, id, 0);
         src->set_protocol_flags(protocol_flags_);
+        notify_event(); // for the "add" event
     }
     src->request_invite();
 
@@ -73,6 +84,7 @@ int32_t aoo_sink_uninvite_source(aoo_sink *sink, void *endpoint,
 }
 
 int32_t aoo::sink::uninvite_source(void *endpoint, int32_t id, aoo_replyfn fn){
+    source_guard guard(sources_);
     // try to find existing source
     auto src = find_source(endpoint, id);
     if (src){
@@ -88,6 +100,7 @@ int32_t aoo_sink_uninvite_all(aoo_sink *sink){
 }
 
 int32_t aoo::sink::uninvite_all(){
+    source_guard guard(sources_);
     for (auto& src : sources_){
         src.request_uninvite();
     }
@@ -96,6 +109,7 @@ int32_t aoo::sink::uninvite_all(){
 
 int32_t aoo::sink::request_source_codec_change(void *endpoint, int32_t id, aoo_format & f)
 {
+    source_guard guard(sources_);
     auto src = find_source(endpoint, id);
     if (src){
         src->request_codec_change(f);
@@ -105,6 +119,18 @@ int32_t aoo::sink::request_source_codec_change(void *endpoint, int32_t id, aoo_f
     }
 }
 
+int32_t aoo::sink::request_source_subscription(void *endpoint, int32_t id, int32_t onset, int32_t nchannels)
+{
+    source_guard guard(sources_);
+    auto src = find_source(endpoint, id);
+    if (src){
+        src->request_subscription(onset, nchannels);
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
 
 namespace aoo {
 
@@ -113,6 +139,75 @@ T& as(void *p){
     return *reinterpret_cast<T *>(p);
 }
 
+// generic (slow) argument parsing for data messages
+
+static void get_data_args(const osc::ReceivedMessage& msg, int32_t& id,
+                          int32_t& salt, data_packet& d, time_tag& ping)
+{
+    auto it = msg.ArgumentsBegin();
+
+    id = (it++)->AsInt32();
+    salt = (it++)->AsInt32();
+    d.sequence = (it++)->AsInt32();
+    d.samplerate = (it++)->AsDouble();
+    d.channel = (it++)->AsInt32();
+    d.totalsize = (it++)->AsInt32();
+    d.nframes = (it++)->AsInt32();
+    d.framenum = (it++)->AsInt32();
+    const void *blobdata;
+    osc::osc_bundle_element_size_t blobsize;
+    (it++)->AsBlob(blobdata, blobsize);
+    d.data = (const char *)blobdata;
+    d.size = blobsize;
+    // optional ping (see AOO_PROTOCOL_FLAG_PING_DATA)
+    if (it != msg.ArgumentsEnd() && it->IsTimeTag()){
+        ping = (it++)->AsTimeTag();
+    } else {
+        ping = time_tag{};
+    }
+}
+
+static void get_compact_data_args(const osc::ReceivedMessage& msg,
+                                  int32_t& salt, data_packet& d, time_tag& ping)
+{
+    // /d <i:salt> <i:seq> <b:data> [<t:ping>]
+    // /d <i:salt> <i:seq> <f:srate> <b:data> [<t:ping>]
+    auto it = msg.ArgumentsBegin();
+
+    salt = (it++)->AsInt32();
+    d.sequence = (it++)->AsInt32();
+    if (it->IsDouble()) {
+        d.samplerate = (it++)->AsDouble();
+    }
+    else {
+        d.samplerate = 0; // marker to use last
+    }
+    const void *blobdata;
+    osc::osc_bundle_element_size_t blobsize;
+    (it++)->AsBlob(blobdata, blobsize);
+    if (it != msg.ArgumentsEnd() && it->IsTimeTag()){
+        ping = (it++)->AsTimeTag();
+    } else {
+        ping = time_tag{};
+    }
+    // reconstruct the rest from prior format
+    d.channel = 0 ;
+    d.nframes = 1;
+    d.framenum = 0;
+    d.data = (const char *)blobdata;
+    d.size = blobsize;
+    d.totalsize = d.size;
+}
+
+#ifndef NDEBUG
+static bool same_data(const data_packet& a, const data_packet& b){
+    return a.sequence == b.sequence && a.samplerate == b.samplerate
+            && a.channel == b.channel && a.totalsize == b.totalsize
+            && a.nframes == b.nframes && a.framenum == b.framenum
+            && a.data == b.data && a.size == b.size;
+}
+#endif
+
 } // aoo
 
 #define CHECKARG(type) assert(size == sizeof(type))
@@ -202,6 +297,38 @@ int32_t aoo::sink::set_option(int32_t opt, void *ptr, int32_t size)
         CHECKARG(int32_t);
         protocol_flags_ = as<int32_t>(ptr) & 0xff;
         break;
+    // jitter control
+    case aoo_opt_jitter_control:
+        CHECKARG(int32_t);
+        jitter_control_ = as<int32_t>(ptr) > 0;
+        break;
+    // jitter quantile
+    case aoo_opt_jitter_quantile:
+        CHECKARG(float);
+        jitter_quantile_ = std::max(0.5f, std::min(0.9999f, as<float>(ptr)));
+        break;
+    // resampler quality
+    case aoo_opt_resample_quality:
+    {
+        CHECKARG(int32_t);
+        auto quality = std::max<int32_t>(AOO_RESAMPLE_LINEAR,
+            std::min<int32_t>(AOO_RESAMPLE_SINC_HIGH, as<int32_t>(ptr)));
+        if (quality != resample_quality_.exchange(quality)){
+            // sources need to be updated
+            update_sources();
+        }
+        break;
+    }
+    // source timeout
+    case aoo_opt_source_timeout:
+        CHECKARG(int32_t);
+        source_timeout_ = std::max<int32_t>(0, as<int32_t>(ptr)) * 0.001;
+        break;
+    // time stretching
+    case aoo_opt_time_stretch:
+        CHECKARG(int32_t);
+        time_stretch_ = as<int32_t>(ptr) > 0;
+        break;
     // unknown
     default:
         LOG_WARNING("aoo_sink: unsupported option " << opt);
@@ -256,6 +383,31 @@ int32_t aoo::sink::get_option(int32_t opt, void *ptr, int32_t size)
         CHECKARG(int32_t);
         as<int32_t>(ptr) = protocol_flags_;
         break;
+    // jitter control
+    case aoo_opt_jitter_control:
+        CHECKARG(int32_t);
+        as<int32_t>(ptr) = jitter_control_;
+        break;
+    // jitter quantile
+    case aoo_opt_jitter_quantile:
+        CHECKARG(float);
+        as<float>(ptr) = jitter_quantile_;
+        break;
+    // resampler quality
+    case aoo_opt_resample_quality:
+        CHECKARG(int32_t);
+        as<int32_t>(ptr) = resample_quality_;
+        break;
+    // source timeout
+    case aoo_opt_source_timeout:
+        CHECKARG(int32_t);
+        as<int32_t>(ptr) = source_timeout_ * 1000;
+        break;
+    // time stretching
+    case aoo_opt_time_stretch:
+        CHECKARG(int32_t);
+        as<int32_t>(ptr) = time_stretch_;
+        break;
     // unknown
     default:
         LOG_WARNING("aoo_sink: unsupported option " << opt);
@@ -273,6 +425,7 @@ int32_t aoo_sink_set_sourceoption(aoo_sink *sink, void *endpoint, int32_t id,
 int32_t aoo::sink::set_sourceoption(void *endpoint, int32_t id,
                                    int32_t opt, void *ptr, int32_t size)
 {
+    source_guard guard(sources_);
     auto src = find_source(endpoint, id);
     if (src){
         switch (opt){
@@ -300,6 +453,7 @@ int32_t aoo_sink_get_sourceoption(aoo_sink *sink, void *endpoint, int32_t id,
 int32_t aoo::sink::get_sourceoption(void *endpoint, int32_t id,
                               int32_t opt, void *p, int32_t size)
 {
+    source_guard guard(sources_);
     auto src = find_source(endpoint, id);
     if (src){
         switch (opt){
@@ -310,6 +464,15 @@ int32_t aoo::sink::get_sourceoption(void *endpoint, int32_t id,
         case aoo_opt_buffer_fill_ratio:
             CHECKARG(float);
             return src->get_buffer_fill_ratio(as<float>(p));
+        case aoo_opt_jitter_delay:
+            CHECKARG(float);
+            return src->get_jitter_delay(as<float>(p));
+        case aoo_opt_arrival_jitter:
+            CHECKARG(float);
+            return src->get_arrival_jitter(as<float>(p));
+        case aoo_opt_buffer_fill_quantile:
+            CHECKARG(float);
+            return src->get_buffer_fill_quantile(as<float>(p));
         case aoo_opt_userformat:
             return src->get_userformat(static_cast<char*>(p), size);
         // unsupported
@@ -331,13 +494,19 @@ int32_t aoo_sink_handle_message(aoo_sink *sink, const char *data, int32_t n,
 int32_t aoo::sink::handle_message(const char *data, int32_t n,
                                   void *endpoint, aoo_replyfn fn) {
     try {
-        osc::ReceivedPacket packet(data, n);
-        osc::ReceivedMessage msg(packet);
-
         if (samplerate_ == 0){
             return 0; // not setup yet
         }
 
+        // the source descs we find must stay valid until we are done
+        source_guard guard(sources_);
+
+        // aoo_parse_pattern() expects a terminated address pattern
+        if (!memchr(data, '\0', n)){
+            LOG_WARNING("not an AoO message!");
+            return 0;
+        }
+
         int32_t type, sinkid;
         auto onset = aoo_parse_pattern(data, n, &type, &sinkid);
         if (!onset){
@@ -353,23 +522,53 @@ int32_t aoo::sink::handle_message(const char *data, int32_t n,
             // special case, this is a be a compact data message
             // use the salt to see if it matches the current salt for us
             // using salt as unique token instead of dealing with a long OSC message and arguments
-            auto it = msg.ArgumentsBegin();
-            //auto id = (it++)->AsInt32();
-            auto salt = (it++)->AsInt32();
-            auto src = find_source_by_salt(endpoint, salt);
-            if (src){
+            int32_t salt;
+            aoo::data_packet d;
+            time_tag ping;
+            if (parse_compact_data_message(data, n, salt, d, ping)){
+            #ifndef NDEBUG
+                // validate the fast path
+                osc::ReceivedPacket packet(data, n);
+                osc::ReceivedMessage msg(packet);
+                int32_t salt2;
+                aoo::data_packet d2;
+                time_tag ping2;
+                get_compact_data_args(msg, salt2, d2, ping2);
+                assert(salt == salt2 && same_data(d, d2) && ping == ping2);
+            #endif
+                return handle_compact_data_message(endpoint, fn, salt, d, ping);
+            } else {
+                osc::ReceivedPacket packet(data, n);
+                osc::ReceivedMessage msg(packet);
                 return handle_compact_data_message(endpoint, fn, msg);
             }
-            else {
-                //LOG_WARNING("compact data doesn't match!");
-                return 0;
-            }
         }
         if (sinkid != id() && sinkid != AOO_ID_WILDCARD){
             LOG_WARNING("wrong sink ID!");
             return 0;
         }
 
+        // fast path for data messages
+        int32_t srcid, salt;
+        aoo::data_packet d;
+        time_tag ping;
+        if (parse_data_message(data, n, onset, srcid, salt, d, ping)){
+        #ifndef NDEBUG
+            // validate the fast path
+            osc::ReceivedPacket packet(data, n);
+            osc::ReceivedMessage msg(packet);
+            int32_t srcid2, salt2;
+            aoo::data_packet d2;
+            time_tag ping2;
+            get_data_args(msg, srcid2, salt2, d2, ping2);
+            assert(srcid == srcid2 && salt == salt2 && same_data(d, d2) && ping == ping2);
+        #endif
+            return handle_data_message(endpoint, fn, srcid, salt, d, ping);
+        }
+
+        osc::ReceivedPacket packet(data, n);
+        osc::ReceivedMessage msg(packet);
+
         auto pattern = msg.AddressPattern() + onset;
         if (!strcmp(pattern, AOO_MSG_FORMAT)){
             return handle_format_message(endpoint, fn, msg);
@@ -377,6 +576,12 @@ int32_t aoo::sink::handle_message(const char *data, int32_t n,
             return handle_data_message(endpoint, fn, msg);
         } else if (!strcmp(pattern, AOO_MSG_PING)){
             return handle_ping_message(endpoint, fn, msg);
+        } else if (!strcmp(pattern, AOO_MSG_PARITY)){
+            return handle_parity_message(endpoint, fn, msg);
+        } else if (!strcmp(pattern, AOO_MSG_SILENCE)){
+            return handle_silence_message(endpoint, fn, msg);
+        } else if (!strcmp(pattern, AOO_MSG_PACK)){
+            return handle_pack_message(endpoint, fn, msg);
         } else {
             LOG_WARNING("unknown message " << pattern);
         }
@@ -392,11 +597,16 @@ int32_t aoo_sink_send(aoo_sink *sink){
 
 int32_t aoo::sink::send(){
     bool didsomething = false;
-    for (auto& s: sources_){
-        if (s.send(*this)){
-            didsomething = true;
+    {
+        source_guard guard(sources_);
+        for (auto& s: sources_){
+            if (s.send(*this)){
+                didsomething = true;
+            }
         }
     }
+    // not within the guard, so the sources just removed can go right away
+    collect_sources();
     return didsomething;
 }
 
@@ -409,27 +619,37 @@ int32_t aoo_sink_process(aoo_sink *sink, aoo_sample **data,
 
 int32_t aoo::sink::process(aoo_sample **data, int32_t nsampframes, uint64_t t){
     // we need to respect the nframes passed in here, which may be smaller than
-    // the blocksize (the host may be splitting the processing, etc)
-    std::fill(buffer_.begin(), buffer_.end(), 0);
+    // the blocksize (the host may be splitting the processing, etc).
+    // Nothing past nsampframes is read, so only that much needs clearing.
+    for (int i = 0; i < nchannels_; ++i){
+        auto buf = &buffer_[i * blocksize_];
+        std::fill(buf, buf + std::min(nsampframes, blocksize_), 0);
+    }
 
     bool didsomething = false;
 
+    source_guard guard(sources_);
+
     // update time DLL filter
     // TODO deal with when we are called with less than the blocksize for this
     double error;
     auto state = timer_.update(t, error);
-    
-   
+    // with a shared clock the timer is still needed for the resend
+    // intervals and the error check, only the DLL is left to the clock
+    const bool owndll = !clock_.load(std::memory_order_relaxed);
+
     if (state == timer::state::reset){
-        LOG_DEBUG("setup time DLL filter for sink");
-        dll_.setup(samplerate_, blocksize_, bandwidth_, 0);
+        if (owndll){
+            LOG_DEBUG("setup time DLL filter for sink");
+            dll_.setup(samplerate_, blocksize_, bandwidth_, 0);
+        }
     } else if (state == timer::state::error){
         // recover sources
         for (auto& s : sources_){
             s.request_recover();
         }
         timer_.reset();
-    } else {
+    } else if (owndll){
         auto elapsed = timer_.get_elapsed();
         dll_.update(elapsed);
     #if AOO_DEBUG_DLL
@@ -441,7 +661,7 @@ int32_t aoo::sink::process(aoo_sample **data, int32_t nsampframes, uint64_t t){
     // if the DLL samplerate is any more than +/- 10% of our nominal, we'll ignore it
     // some shenanigans are going on
     bool ignoredll = !dynamic_resampling_.load();
-    if (!ignoredll && fabs(dll_.samplerate() - ((double)samplerate_)) > 0.1*samplerate_) {
+    if (!ignoredll && fabs(dll_samplerate() - ((double)samplerate_)) > 0.1*samplerate_) {
         ignoredll = true;
     }
     ignore_dll_ = ignoredll;
@@ -454,20 +674,34 @@ int32_t aoo::sink::process(aoo_sample **data, int32_t nsampframes, uint64_t t){
         }
     }
 
+    // sources that play but only decode silence (muted senders, the
+    // decoder's output after a stream went idle) are reported as such,
+    // so the caller can skip its own work on the block.
     if (didsomething){
-    #if AOO_CLIP_OUTPUT
-        for (auto it = buffer_.begin(); it != buffer_.end(); ++it){
-            if (*it > 1.0){
-                *it = 1.0;
-            } else if (*it < -1.0){
-                *it = -1.0;
-            }
+        bool silent = true;
+        for (int i = 0; i < nchannels_ && silent; ++i){
+            auto buf = &buffer_[i * blocksize_];
+            silent = std::all_of(buf, buf + nsampframes,
+                                 [](aoo_sample x){ return x == 0; });
         }
-    #endif
-        // copy buffers
+        if (silent){
+            return 2;
+        }
+    }
+
+    if (didsomething){
+        // copy buffers, clipped on the way if asked for, only what
+        // the caller wants of them
         for (int i = 0; i < nchannels_; ++i){
             auto buf = &buffer_[i * blocksize_];
+        #if AOO_CLIP_OUTPUT
+            auto out = data[i];
+            for (int j = 0; j < nsampframes; ++j){
+                out[j] = std::min<aoo_sample>(1.0, std::max<aoo_sample>(-1.0, buf[j]));
+            }
+        #else
             std::copy(buf, buf + nsampframes, data[i]);
+        #endif
         }
         return 1;
     } else {
@@ -479,6 +713,7 @@ int32_t aoo_sink_events_available(aoo_sink *sink){
 }
 
 int32_t aoo::sink::events_available(){
+    source_guard guard(sources_);
     for (auto& src : sources_){
         if (src.has_events()){
             return true;
@@ -494,13 +729,66 @@ int32_t aoo_sink_handle_events(aoo_sink *sink,
 
 #define EVENT_THROTTLE 1000
 
+int32_t aoo_sink_set_event_notify(aoo_sink *sink, aoo_notifyfn fn, void *user){
+    return sink->set_event_notify(fn, user);
+}
+
+int32_t aoo::sink::set_event_notify(aoo_notifyfn fn, void *user){
+    eventnotifier_.set(fn, user);
+    return 1;
+}
+
+int32_t aoo_sink_set_packet_tap(aoo_sink *sink, aoo_packettapfn fn, void *user){
+    return sink->set_packet_tap(fn, user);
+}
+
+int32_t aoo::sink::set_packet_tap(aoo_packettapfn fn, void *user){
+    packettapfn_.store(nullptr, std::memory_order_release);
+    packettapuser_.store(user, std::memory_order_relaxed);
+    packettapfn_.store(fn, std::memory_order_release);
+    return 1;
+}
+
+int32_t aoo_sink_set_clock(aoo_sink *sink, aoo_clock *clock){
+    return sink->set_clock(clock);
+}
+
+int32_t aoo::sink::set_clock(iclock *clock){
+    if (clock_.exchange(clock) && !clock){
+        timer_.reset(); // sets up our own DLL again
+    }
+    return 1;
+}
+
+int32_t aoo_sink_set_telemetry_tap(aoo_sink *sink, aoo_telemetryfn fn, void *user){
+    return sink->set_telemetry_tap(fn, user);
+}
+
+int32_t aoo::sink::set_telemetry_tap(aoo_telemetryfn fn, void *user){
+    telemetryfn_.store(nullptr, std::memory_order_release);
+    telemetryuser_.store(user, std::memory_order_relaxed);
+    telemetryfn_.store(fn, std::memory_order_release);
+    return 1;
+}
+
+int32_t aoo_sink_set_trace_tap(aoo_sink *sink, aoo_tracefn fn, void *user){
+    return sink->set_trace_tap(fn, user);
+}
+
+int32_t aoo::sink::set_trace_tap(aoo_tracefn fn, void *user){
+    tracefn_.store(nullptr, std::memory_order_release);
+    traceuser_.store(user, std::memory_order_relaxed);
+    tracefn_.store(fn, std::memory_order_release);
+    return 1;
+}
+
 int32_t aoo::sink::handle_events(aoo_eventhandler fn, void *user){
     if (!fn){
         return 0;
     }
     int total = 0;
     // handle_events() and the source list itself are both lock-free!
-    // NOTE: the source descs are never freed, so they are always valid
+    source_guard guard(sources_);
     for (auto& src : sources_){
         total += src.handle_events(fn, user);
         if (total > EVENT_THROTTLE){
@@ -530,12 +818,66 @@ aoo::source_desc * sink::find_source_by_salt(void *endpoint, int32_t salt){
     return nullptr;
 }
 
+// a multi-path source sends the same stream from other addresses as well.
+// A path we know is found by the endpoint...
+aoo::source_desc * sink::find_source_path(void *endpoint, int32_t id, int32_t& path){
+    for (auto& src : sources_){
+        if (src.id() == id){
+            auto i = src.find_path(endpoint);
+            if (i > 0){
+                path = i;
+                return &src;
+            }
+        }
+    }
+    return nullptr;
+}
+
+// ...and a new one by the current salt, which is random for every stream.
+// 'id' may be AOO_ID_NONE for compact data messages.
+aoo::source_desc * sink::add_source_path(void *endpoint, aoo_replyfn fn, int32_t id,
+                                         int32_t salt, int32_t& path){
+    for (auto& src : sources_){
+        if ((src.endpoint() != endpoint) && (src.get_current_salt() == salt)
+            && (id == AOO_ID_NONE || src.id() == id)){
+            auto i = src.add_path(endpoint, fn);
+            if (i > 0){
+                path = i;
+                return &src;
+            }
+        }
+    }
+    return nullptr;
+}
+
 void sink::update_sources(){
+    source_guard guard(sources_);
     for (auto& src : sources_){
         src.update(*this);
     }
 }
 
+// forget the sources which went silent, see aoo_opt_source_timeout
+void sink::collect_sources(){
+    auto now = elapsed_time();
+    if (std::fabs(now - lastcollect_) < 1.0){
+        return; // once a second is plenty
+    }
+    lastcollect_ = now;
+
+    auto timeout = source_timeout_.load(std::memory_order_relaxed);
+    if (timeout > 0){
+        auto count = sources_.remove_if([&](source_desc& src){
+            return src.idle_time(now) > timeout;
+        });
+        if (count > 0){
+            LOG_VERBOSE("aoo_sink: forgot " << count << " idle source(s)");
+        }
+    } else {
+        sources_.reclaim(); // anything left from before
+    }
+}
+
 int32_t sink::handle_format_message(void *endpoint, aoo_replyfn fn,
                                     const osc::ReceivedMessage& msg)
 {
@@ -573,13 +915,21 @@ int32_t sink::handle_format_message(void *endpoint, aoo_replyfn fn,
         return 0;
     }
     // try to find existing source
+    int32_t path = 0;
     auto src = find_source(endpoint, id);
+    if (!src){
+        src = find_source_path(endpoint, id, path);
+    }
+    if (!src){
+        // the format of a multi-path source comes over every path
+        src = add_source_path(endpoint, fn, id, salt, path);
+    }
 
     if (!src){
         // not found - add new source
-        sources_.emplace_front(endpoint, fn, id, salt);
-        src = &sources_.front();
+        src = &sources_.emplace_front(endpoint, fn, id, salt);
         src->set_protocol_flags(protocol_flags_);
+        notify_event(); // for the "add" event
     }
 
     return src->handle_format(*this, salt, f, (const char *)settings, size, version, (const char *) userfmt, ufsize);
@@ -588,36 +938,40 @@ int32_t sink::handle_format_message(void *endpoint, aoo_replyfn fn,
 int32_t sink::handle_data_message(void *endpoint, aoo_replyfn fn,
                                   const osc::ReceivedMessage& msg)
 {
-    auto it = msg.ArgumentsBegin();
-
-    auto id = (it++)->AsInt32();
-    auto salt = (it++)->AsInt32();
+    int32_t id, salt;
     aoo::data_packet d;
-    d.sequence = (it++)->AsInt32();
-    d.samplerate = (it++)->AsDouble();
-    d.channel = (it++)->AsInt32();
-    d.totalsize = (it++)->AsInt32();
-    d.nframes = (it++)->AsInt32();
-    d.framenum = (it++)->AsInt32();
-    const void *blobdata;
-    osc::osc_bundle_element_size_t blobsize;
-    (it++)->AsBlob(blobdata, blobsize);
-    d.data = (const char *)blobdata;
-    d.size = blobsize;
+    time_tag ping;
+    get_data_args(msg, id, salt, d, ping);
+    return handle_data_message(endpoint, fn, id, salt, d, ping);
+}
 
+int32_t sink::handle_data_message(void *endpoint, aoo_replyfn fn, int32_t id,
+                                  int32_t salt, const aoo::data_packet& d, time_tag ping)
+{
     if (id < 0){
         LOG_WARNING("bad ID for " << AOO_MSG_DATA << " message");
         return 0;
     }
     // try to find existing source
+    int32_t path = 0;
     auto src = find_source(endpoint, id);
+    if (!src){
+        src = find_source_path(endpoint, id, path);
+    }
+    if (!src){
+        src = add_source_path(endpoint, fn, id, salt, path);
+    }
     if (src){
-        return src->handle_data(*this, salt, d);
+        auto result = src->handle_data(*this, salt, d, path, ping);
+        if (!ping.empty()){
+            src->handle_ping(*this, ping, path);
+        }
+        return result;
     } else {
         // discard data message, add source and request format!
-        sources_.emplace_front(endpoint, fn, id, salt);
-        src = &sources_.front();
+        src = &sources_.emplace_front(endpoint, fn, id, salt);
         src->set_protocol_flags(protocol_flags_);
+        notify_event(); // for the "add" event
         src->request_format();
         return 0;
     }
@@ -626,35 +980,28 @@ int32_t sink::handle_data_message(void *endpoint, aoo_replyfn fn,
 int32_t sink::handle_compact_data_message(void *endpoint, aoo_replyfn fn,
                                           const osc::ReceivedMessage& msg)
 {
-    // /d <i:salt> <i:seq> <b:data>
-    // /d <i:salt> <i:seq> <f:srate> <b:data>
-    auto it = msg.ArgumentsBegin();
-
+    int32_t salt;
     aoo::data_packet d;
+    time_tag ping;
+    get_compact_data_args(msg, salt, d, ping);
+    return handle_compact_data_message(endpoint, fn, salt, d, ping);
+}
 
-    auto salt = (it++)->AsInt32();
-    d.sequence = (it++)->AsInt32();
-    if (msg.ArgumentCount() == 4) {
-        d.samplerate = (it++)->AsDouble();
-    }
-    else {
-        d.samplerate = 0; // marker to use last
-    }
-    const void *blobdata;
-    osc::osc_bundle_element_size_t blobsize;
-    (it++)->AsBlob(blobdata, blobsize);
-    // reconstruct the rest from prior format
-    d.channel = 0 ;
-    d.nframes = 1;
-    d.framenum = 0;
-    d.data = (const char *)blobdata;
-    d.size = blobsize;
-    d.totalsize = d.size;
-
+int32_t sink::handle_compact_data_message(void *endpoint, aoo_replyfn fn, int32_t salt,
+                                          const aoo::data_packet& d, time_tag ping)
+{
     // try to find existing source by salt
+    int32_t path = 0;
     auto src = find_source_by_salt(endpoint, salt);
+    if (!src){
+        src = add_source_path(endpoint, fn, AOO_ID_NONE, salt, path);
+    }
     if (src){
-        return src->handle_data(*this, salt, d);
+        auto result = src->handle_data(*this, salt, d, path, ping);
+        if (!ping.empty()){
+            src->handle_ping(*this, ping, path);
+        }
+        return result;
     } else {
         // discard data message
         return 0;
@@ -674,15 +1021,113 @@ int32_t sink::handle_ping_message(void *endpoint, aoo_replyfn fn,
         return 0;
     }
     // try to find existing source
+    int32_t path = 0;
     auto src = find_source(endpoint, id);
+    if (!src){
+        src = find_source_path(endpoint, id, path);
+    }
     if (src){
-        return src->handle_ping(*this, tt);
+        return src->handle_ping(*this, tt, path);
     } else {
         LOG_WARNING("couldn't find source " << id << " for " << AOO_MSG_PING << " message");
         return 0;
     }
 }
 
+int32_t sink::handle_parity_message(void *endpoint, aoo_replyfn fn,
+                                    const osc::ReceivedMessage& msg)
+{
+    auto it = msg.ArgumentsBegin();
+
+    auto id = (it++)->AsInt32();
+    auto salt = (it++)->AsInt32();
+    auto firstseq = (it++)->AsInt32();
+    auto count = (it++)->AsInt32();
+    auto sizexor = (it++)->AsInt32();
+    const void *blobdata;
+    osc::osc_bundle_element_size_t blobsize;
+    (it++)->AsBlob(blobdata, blobsize);
+
+    if (id < 0){
+        LOG_WARNING("bad ID for " << AOO_MSG_PARITY << " message");
+        return 0;
+    }
+    // try to find existing source
+    int32_t path = 0;
+    auto src = find_source(endpoint, id);
+    if (!src){
+        src = find_source_path(endpoint, id, path);
+    }
+    if (src){
+        return src->handle_parity(*this, salt, firstseq, count, sizexor,
+                                  (const char *)blobdata, blobsize);
+    } else {
+        // ignore, the next data message will add the source
+        return 0;
+    }
+}
+
+int32_t sink::handle_silence_message(void *endpoint, aoo_replyfn fn,
+                                     const osc::ReceivedMessage& msg)
+{
+    auto it = msg.ArgumentsBegin();
+
+    auto id = (it++)->AsInt32();
+    auto salt = (it++)->AsInt32();
+    auto seq = (it++)->AsInt32();
+
+    if (id < 0){
+        LOG_WARNING("bad ID for " << AOO_MSG_SILENCE << " message");
+        return 0;
+    }
+    // try to find existing source
+    int32_t path = 0;
+    auto src = find_source(endpoint, id);
+    if (!src){
+        src = find_source_path(endpoint, id, path);
+    }
+    if (src){
+        return src->handle_silence(*this, salt, seq);
+    } else {
+        // ignore, the next data message will add the source
+        return 0;
+    }
+}
+
+// the blocks of a /pack message are handled as if they came one by one
+int32_t sink::handle_pack_message(void *endpoint, aoo_replyfn fn,
+                                  const osc::ReceivedMessage& msg)
+{
+    auto it = msg.ArgumentsBegin();
+
+    auto id = (it++)->AsInt32();
+    auto salt = (it++)->AsInt32();
+    auto firstseq = (it++)->AsInt32();
+    auto samplerate = (it++)->AsDouble();
+    auto channel = (it++)->AsInt32();
+    auto count = (it++)->AsInt32();
+
+    int32_t result = 0;
+    for (int32_t i = 0; i < count && it != msg.ArgumentsEnd(); ++i){
+        const void *blobdata;
+        osc::osc_bundle_element_size_t blobsize;
+        (it++)->AsBlob(blobdata, blobsize);
+
+        aoo::data_packet d;
+        d.sequence = firstseq + i;
+        d.samplerate = samplerate;
+        d.channel = channel;
+        d.totalsize = blobsize;
+        d.nframes = 1;
+        d.framenum = 0;
+        d.data = (const char *)blobdata;
+        d.size = blobsize;
+
+        result = handle_data_message(endpoint, fn, id, salt, d, time_tag{});
+    }
+    return result;
+}
+
 /*////////////////////////// source_desc /////////////////////////////*/
 
 source_desc::source_desc(void *endpoint, aoo_replyfn fn, int32_t id, int32_t salt)
@@ -699,6 +1144,41 @@ source_desc::source_desc(void *endpoint, aoo_replyfn fn, int32_t id, int32_t sal
     resendqueue_.resize(256, 1);
 }
 
+source_desc::~source_desc(){
+    // the sources are only freed when nobody works on them anymore
+    delete buffer_.load();
+}
+
+int32_t source_desc::find_path(void *endpoint) const {
+    if (endpoint == endpoint_){
+        return 0;
+    }
+    auto n = numpaths_.load();
+    for (int32_t i = 1; i < n; ++i){
+        if (paths_[i - 1].endpoint.load() == endpoint){
+            return i;
+        }
+    }
+    return -1;
+}
+
+// returns the path index, or -1 if there's no room
+int32_t source_desc::add_path(void *endpoint, aoo_replyfn fn){
+    auto i = find_path(endpoint);
+    if (i >= 0){
+        return i;
+    }
+    i = numpaths_.load();
+    if (i >= AOO_MAXPATHS){
+        return -1;
+    }
+    paths_[i - 1].endpoint = endpoint;
+    paths_[i - 1].fn = fn;
+    numpaths_ = i + 1; // publish
+    LOG_VERBOSE("aoo_sink: source " << id_ << " now has " << (i + 1) << " paths");
+    return i;
+}
+
 int32_t source_desc::get_format(aoo_format_storage &format){
     // synchronize with handle_format() and update()!
     shared_lock lock(mutex_);
@@ -722,15 +1202,40 @@ void source_desc::request_codec_change(aoo_format & f)
     }
 }
 
+void source_desc::request_subscription(int32_t onset, int32_t nchannels)
+{
+    subonset_ = nchannels > 0 ? std::max<int32_t>(0, onset) : 0;
+    subchannels_ = nchannels > 0 ? nchannels : -1;
+    streamstate_.request_subscription();
+}
+
 int32_t source_desc::get_buffer_fill_ratio(float &ratio){
-    if (audioqueue_.capacity() > 0) {
-        ratio = (audioqueue_.read_available() * audioqueue_.blocksize()) / (float)audioqueue_.capacity();
+    // synchronize with handle_format() and update()!
+    shared_lock lock(mutex_);
+    auto b = buffer_.load(std::memory_order_relaxed);
+    if (b && b->audioqueue.capacity() > 0) {
+        ratio = (b->audioqueue.read_available() * b->audioqueue.blocksize()) / (float)b->audioqueue.capacity();
     } else {
         ratio = 0.0f;
     }
     return 1;
 }
 
+int32_t source_desc::get_jitter_delay(float &ms){
+    ms = jittertarget_.load() * 1000.f;
+    return 1;
+}
+
+int32_t source_desc::get_arrival_jitter(float &ms){
+    ms = arrivaljitter_.load() * 1000.f;
+    return 1;
+}
+
+int32_t source_desc::get_buffer_fill_quantile(float &ms){
+    ms = fillquantile_.load() * 1000.f;
+    return 1;
+}
+
 int32_t source_desc::get_userformat(char *buf, int32_t size){
     shared_lock lock(mutex_);
     if (userformat_.empty()) return 0;
@@ -745,113 +1250,328 @@ int32_t source_desc::get_userformat(char *buf, int32_t size){
 
 
 void source_desc::update(const sink &s){
-    // take writer lock!
-    unique_lock lock(mutex_);
-    do_update(s);
-}
-
-void source_desc::do_update(const sink &s){
-    // resize audio ring buffer
-    if (decoder_ && decoder_->blocksize() > 0 && decoder_->samplerate() > 0){
-        // recalculate buffersize from ms to samples
-        double bufsize = (double)s.buffersize() * decoder_->samplerate() * 0.001;
-        bufsize = std::max(bufsize, (double)s.blocksize()); // needs to be at least one processing blocksize worth!
-        auto d = div(bufsize, decoder_->blocksize());
-        int32_t nbuffers = d.quot + (d.rem != 0); // round up
-        nbuffers = std::max<int32_t>(1, nbuffers); // e.g. if buffersize_ is 0
-        // resize audio buffer and initially fill with zeros.
-        auto nsamples = decoder_->nchannels() * decoder_->blocksize();
-        audioqueue_.resize(nbuffers * nsamples, nsamples);
-        infoqueue_.resize(nbuffers, 1);
-        int count = 0;
-        while (audioqueue_.write_available() && infoqueue_.write_available()){
-            audioqueue_.write_commit();
-            // push nominal samplerate + default channel (0)
-            block_info i;
-            i.sr = decoder_->samplerate();
-            i.channel = 0;
-            infoqueue_.write(i);
-            count++;
-        };
-        LOG_VERBOSE("reset source queues to " << nbuffers << " buffers");
-    #if 0
-        // don't touch the event queue once constructed
-        eventqueue_.reset();
-    #endif
-        // setup resampler
-        resampler_.setup(decoder_->blocksize(), s.blocksize(),
-                            decoder_->samplerate(), s.samplerate(), decoder_->nchannels());
-        // resize block queue
-        blockqueue_.resize(nbuffers + 8); // (32) extra capacity for network jitter (allows lower buffersizes) (should be option?)
-        newest_ = 0;
-        next_ = -1;
-        nextneedsfadein_ = 0;
-        channel_ = 0;
-        samplerate_ = decoder_->samplerate();
-        streamstate_.reset();
-        ack_list_.set_limit(s.resend_limit());
-        ack_list_.clear();
+    int32_t nchannels, blocksize, samplerate, flags;
+    {
+        shared_lock lock(mutex_);
+        if (!decoder_){
+            return;
+        }
+        nchannels = decoder_->nchannels();
+        blocksize = decoder_->blocksize();
+        samplerate = decoder_->samplerate();
+        flags = protocol_flags_;
+    }
+    // set up the new buffers without holding the lock
+    stream_setup setup;
+    if (!make_stream(s, nchannels, blocksize, samplerate, flags, setup)){
+        return;
+    }
+    stream_buffer *old;
+    {
+        // take writer lock!
+        unique_lock lock(mutex_);
+        if (!decoder_ || decoder_->nchannels() != nchannels || decoder_->blocksize() != blocksize
+            || decoder_->samplerate() != samplerate || protocol_flags_ != flags){
+            // handle_format() came in between with its own
+            return;
+        }
+        old = install_stream(s, setup);
+    }
+    retire_buffer(old);
+}
+
+// Sets up everything that depends on the format and the sink settings.
+// Allocates, so call without holding the lock.
+bool source_desc::make_stream(const sink &s, int32_t nchannels, int32_t blocksize,
+                              int32_t samplerate, int32_t flags, stream_setup &setup){
+    if (blocksize <= 0 || samplerate <= 0 || nchannels <= 0){
+        return false;
+    }
+    // recalculate buffersize from ms to samples
+    double bufsize = (double)s.buffersize() * samplerate * 0.001;
+    bufsize = std::max(bufsize, (double)s.blocksize()); // needs to be at least one processing blocksize worth!
+    auto d = div(bufsize, blocksize);
+    int32_t nbuffers = d.quot + (d.rem != 0); // round up
+    nbuffers = std::max<int32_t>(1, nbuffers); // e.g. if buffersize_ is 0
+
+    auto b = std::make_unique<stream_buffer>();
+    b->nchannels = nchannels;
+    b->blocksize = blocksize;
+    b->samplerate = samplerate;
+    // audio buffer, initially filled with zeros.
+    auto nsamples = nchannels * blocksize;
+    b->audioqueue.resize(nbuffers * nsamples, nsamples);
+    b->infoqueue.resize(nbuffers, 1);
+    int count = 0;
+    const int32_t maxfill = max_fill_blocks(blocksize, samplerate);
+    while (b->audioqueue.write_available() && b->infoqueue.write_available() && count < maxfill){
+        b->audioqueue.write_commit();
+        // push nominal samplerate + default channel (0)
+        block_info i;
+        i.sr = samplerate;
+        i.channel = 0;
+        b->infoqueue.write(i);
+        count++;
+    };
+    // setup resampler
+    b->resampler.setup(blocksize, s.blocksize(), samplerate, s.samplerate(), nchannels,
+                       s.resample_quality());
+    // always there, so the sink option can be switched on the fly
+    b->stretcher.setup(nchannels, s.samplerate(), std::max<int32_t>(blocksize, s.blocksize()));
+    setup.buffer = std::move(b);
+    // block queue
+    setup.blockqueue.resize(nbuffers + 8); // (32) extra capacity for network jitter (allows lower buffersizes) (should be option?)
+    setup.acklist.resize(setup.blockqueue.capacity());
+    // FEC history if the source sends parity blocks
+    if (flags & AOO_PROTOCOL_FLAG_FEC){
+        setup.fechistory.resize(AOO_FEC_HISTORYSIZE);
+        for (auto& e : setup.fechistory){
+            e.data.reserve(s.packetsize());
+        }
+    }
+
+    LOG_DEBUG("update source " << id_ << ": sr = " << samplerate
+                << ", blocksize = " << blocksize << ", nchannels = "
+                << nchannels << ", bufsize = " << nbuffers * nsamples);
+    return true;
+}
+
+// call with writer lock! Only swaps what make_stream() has set up, the old
+// decoder and queues are left in 'setup' to be freed after unlocking.
+source_desc::stream_buffer * source_desc::install_stream(const sink &s, stream_setup &setup, bool carry){
+    if (setup.decoder){
+        decoder_.swap(setup.decoder);
+    }
+    if (!setup.buffer){
+        // bad format, there is nothing to play
+        return buffer_.exchange(nullptr);
+    }
+    // e.g. only the channel count changed. A source often sends a couple of
+    // formats in a row for one change, so a few can pile up before the first
+    // has been played out.
+    auto current = buffer_.load(std::memory_order_relaxed);
+    carryover_ = carry && current && current->blocksize == setup.buffer->blocksize
+            && current->samplerate == setup.buffer->samplerate;
+    stream_buffer *retired = nullptr;
+    if (carryover_ && current->previous && !current->drained.load(std::memory_order_acquire)){
+        int depth = 1;
+        for (auto b = current->previous.get(); b->previous; b = b->previous.get()){
+            depth++;
+        }
+        carryover_ = depth < AOO_SINK_MAXCARRYOVER;
+    }
+    if (carryover_){
+        // starts out empty instead of with silence, the audio thread gets to
+        // it once the current buffer has run out
+        setup.buffer->audioqueue.reset();
+        setup.buffer->infoqueue.reset();
+        if (current->drained.load(std::memory_order_acquire)){
+            // the audio thread is done with the ones before the current buffer
+            retired = current->previous.release();
+        }
+        setup.buffer->previous.reset(current);
+        LOG_VERBOSE("carry on from the current stream");
+    }
+    std::swap(blockqueue_, setup.blockqueue);
+    std::swap(ack_list_, setup.acklist);
+    std::swap(fechistory_, setup.fechistory);
+    if (!fechistory_.empty()){
+        fecbuffer_.reserve(s.packetsize());
+    }
+    // the audio thread resets its part of the state when it sees a new generation
+    setup.buffer->generation = ++generation_;
+    auto old = buffer_.exchange(setup.buffer.release());
+    if (carryover_){
+        // owned by the new buffer now
+        old = retired;
+    }
+    LOG_VERBOSE("reset source queues");
+
+    // reset jitter tracking, but keep the measured jitter
+    jitterseq0_ = -1;
+    jitterseq_ = -1;
+    jitterbase_ = 0;
+    newest_ = 0;
+    next_ = -1;
+    nextneedsfadein_ = 0;
+    silent_ = false;
+    streamstate_.reset();
+    ack_list_.set_limit(s.resend_limit());
+    ack_list_.clear();
+
+    // start in a need recovery state so the buffer is re-filled when we get the first data
+    streamstate_.request_recover();
+
+    return old;
+}
 
-        // start in a need recovery state so the buffer is re-filled when we get the first data
-        streamstate_.request_recover();
+// call with writer lock! Starts the stream over in place, for a new stream
+// with the format we have: the decoder and queues are kept (and emptied), and
+// the audio thread goes on with the current buffer.
+void source_desc::restart_stream(const sink &s){
+    decoder_->reset();
+    blockqueue_.clear();
+    ack_list_.set_limit(s.resend_limit());
+    ack_list_.clear();
+    // the old stream's sequence numbers mean nothing now
+    for (auto& e : fechistory_){
+        e.sequence = -1;
+    }
+
+    jitterseq0_ = -1;
+    jitterseq_ = -1;
+    jitterbase_ = 0;
+    newest_ = 0;
+    next_ = -1;
+    nextneedsfadein_ = 0;
+    silent_ = false;
+    streamstate_.reset();
+
+    // what is still queued for the audio thread covers for the first block of
+    // the new stream, like a buffer carrying on from the previous one. Only
+    // an empty one is filled up to the latency again
+    auto& b = buffer();
+    carryover_ = b.audioqueue.read_available() > 0
+            || (b.previous && !b.drained.load(std::memory_order_acquire));
+    streamstate_.request_recover();
+}
+
+// frees a buffer replaced by install_stream(), call without the lock
+void source_desc::retire_buffer(stream_buffer *b){
+    if (!b){
+        return;
+    }
+    // the audio thread might still be reading from it, but not for longer
+    // than one process() call
+    while (playing_.load() == b){
+        std::this_thread::yield();
+    }
+    delete b;
+}
+
+// /aoo/sink/<id>/format <src> <salt> <numchannels> <samplerate> <blocksize> <codec> <settings...>
 
-        LOG_DEBUG("update source " << id_ << ": sr = " << decoder_->samplerate()
-                    << ", blocksize = " << decoder_->blocksize() << ", nchannels = "
-                    << decoder_->nchannels() << ", bufsize = " << nbuffers * nsamples);
+int32_t source_desc::handle_format(const sink& s, int32_t salt, const aoo_format& f,
+                                   const char *settings, int32_t size, int32_t version,
+                                   const char *userformat, int32_t ufsize){
+    mark_active(s.elapsed_time());
+
+    // see what protocol flags are in the LSB of the version
+    const int32_t flags = 0xFF & version;
+
+    {
+        shared_lock lock(mutex_);
+        // a multi-path source sends the format over every path, don't reset the stream for the copies
+        if (numpaths_.load() > 1 && salt == salt_ && decoder_ && !strcmp(decoder_->name(), f.codec)
+            && decoder_->nchannels() == f.nchannels && decoder_->samplerate() == f.samplerate
+            && decoder_->blocksize() == f.blocksize && protocol_flags_ == flags){
+            LOG_DEBUG("ignore duplicate format");
+            return 0;
+        }
+    }
+
+    // the source restarted its stream (or sent its format again) without
+    // changing it, e.g. after a short network outage: start over with what
+    // we have, so the stream resumes with the next block
+    bool restarted = false;
+    {
+        // take writer lock!
+        unique_lock lock(mutex_);
+        if (decoder_ && buffer_.load(std::memory_order_relaxed)
+            && !strcmp(decoder_->name(), f.codec) && decoder_->nchannels() == f.nchannels
+            && decoder_->samplerate() == f.samplerate && decoder_->blocksize() == f.blocksize
+            && protocol_flags_ == flags && size == (int32_t)tapsettings_.size()
+            && std::equal(settings, settings + size, tapsettings_.begin())){
+            salt_ = salt;
+            if (userformat) {
+                userformat_.assign(userformat, userformat + ufsize);
+            }
+            restart_stream(s);
+            restarted = true;
+        }
+    }
+    if (restarted){
+        LOG_DEBUG("restart stream with the same format");
+        format_changed(s, f.nchannels);
+        return 1;
+    }
+
+    // Create the new decoder and buffers before taking the lock. This can
+    // take a while (e.g. Opus) and the other threads don't have to wait.
+    auto c = aoo::find_codec(f.codec);
+    if (!c){
+        LOG_ERROR("codec '" << f.codec << "' not supported!");
+        return 0;
+    }
+    stream_setup setup;
+    setup.decoder = c->create_decoder();
+    if (!setup.decoder){
+        LOG_ERROR("couldn't create decoder!");
+        return 0;
+    }
+    // read format
+    setup.decoder->read_format(f, settings, size);
+    make_stream(s, setup.decoder->nchannels(), setup.decoder->blocksize(),
+                setup.decoder->samplerate(), flags, setup);
+
+    // keep it as it came for the packet tap
+    std::string tapcodec = f.codec;
+    std::vector<char> tapsettings(settings, settings + size);
+    std::vector<char> uf;
+    if (userformat) {
+        uf.assign(userformat, userformat + ufsize);
     }
-}
 
-// /aoo/sink/<id>/format <src> <salt> <numchannels> <samplerate> <blocksize> <codec> <settings...>
+    stream_buffer *old;
+    {
+        // take writer lock!
+        unique_lock lock(mutex_);
 
-int32_t source_desc::handle_format(const sink& s, int32_t salt, const aoo_format& f,
-                                   const char *settings, int32_t size, int32_t version,
-                                   const char *userformat, int32_t ufsize){
-    // take writer lock!
-    unique_lock lock(mutex_);
+        salt_ = salt;
+        protocol_flags_ = flags;
 
-    salt_ = salt;
+        tapcodec_.swap(tapcodec);
+        tapformat_ = f;
+        tapformat_.codec = tapcodec_.c_str();
+        tapsettings_.swap(tapsettings);
 
-    // create/change decoder if needed
-    if (!decoder_ || strcmp(decoder_->name(), f.codec)){
-        auto c = aoo::find_codec(f.codec);
-        if (c){
-            decoder_ = c->create_decoder();
-        } else {
-            LOG_ERROR("codec '" << f.codec << "' not supported!");
-            return 0;
-        }
-        if (!decoder_){
-            LOG_ERROR("couldn't create decoder!");
-            return 0;
+        // user format
+        if (userformat) {
+            userformat_.swap(uf);
         }
+
+        old = install_stream(s, setup, true);
     }
+    // the old decoder and queues go with 'setup'
+    retire_buffer(old);
 
-    // see what protocol flags are in the LSB of the version
-    protocol_flags_ = (0xFF & version);
-    
-    // read format
-    decoder_->read_format(f, settings, size);
+    format_changed(s, f.nchannels);
 
-    // user format
-    if (userformat) {
-        userformat_.assign(userformat, userformat+ufsize);
-    }
+    return 1;
+}
 
-    do_update(s);
+void source_desc::format_changed(const sink& s, int32_t nchannels){
+    // the subscription request might have been lost (or the source predates it),
+    // so ask again with every format which doesn't match it
+    auto subchannels = subchannels_.load();
+    if (subchannels > 0 && nchannels != subchannels){
+        streamstate_.request_subscription();
+    }
 
     // push event
     event e;
     e.type = AOO_SOURCE_FORMAT_EVENT;
     e.source.endpoint = endpoint_;
     e.source.id = id_;
-    push_event(e);
-
-    return 1;
+    push_event(s, e);
 }
 
 // /aoo/sink/<id>/data <src> <salt> <seq> <sr> <channel_onset> <totalsize> <numpackets> <packetnum> <data>
 
-int32_t source_desc::handle_data(const sink& s, int32_t salt, const aoo::data_packet& d){
+int32_t source_desc::handle_data(const sink& s, int32_t salt, const aoo::data_packet& d,
+                                 int32_t path, time_tag sent){
+    mark_active(s.elapsed_time());
+
     // synchronize with update()!
     shared_lock lock(mutex_);
 
@@ -863,13 +1583,43 @@ int32_t source_desc::handle_data(const sink& s, int32_t salt, const aoo::data_pa
     }
 
 #if 1
-    if (!decoder_){
+    if (!decoder_ || !buffer_.load(std::memory_order_relaxed)){
         LOG_DEBUG("ignore data message");
         return 0;
     }
 #else
     assert(decoder_ != nullptr);
 #endif
+
+    if (numpaths_.load() > 1){
+        // the first copy wins, the others must not show up as reordered or resent blocks
+        if (is_duplicate(d)){
+            return 0;
+        }
+        replypath_ = path;
+    }
+
+    tap_telemetry(s, AOO_TELEMETRY_ARRIVED, d.sequence, d.framenum, sent);
+    tap_trace(s, AOO_TRACE_RECEIVED, d.sequence, d.framenum);
+
+    // track packet arrival times
+    jitterenabled_ = s.jitter_control();
+    if (jitterenabled_ && d.sequence > jitterseq_){
+        update_jitter(s, d.sequence);
+    }
+
+    // remember single-frame blocks for rebuilding lost blocks from parity
+    if (!fechistory_.empty() && d.nframes == 1 && d.totalsize > 0){
+        auto& e = fechistory_[d.sequence & (AOO_FEC_HISTORYSIZE - 1)];
+        e.sequence = d.sequence;
+        e.data.assign(d.data, d.data + d.size);
+    }
+
+    return do_handle_data(s, d);
+}
+
+// call with (shared) lock!
+int32_t source_desc::do_handle_data(const sink& s, const aoo::data_packet& d){
     LOG_DEBUG("got block: seq = " << d.sequence << ", sr = " << d.samplerate
               << ", chn = " << d.channel << ", totalsize = " << d.totalsize
               << ", nframes = " << d.nframes << ", frame = " << d.framenum << ", size " << d.size);
@@ -884,13 +1634,32 @@ int32_t source_desc::handle_data(const sink& s, int32_t salt, const aoo::data_pa
         return 0;
     }
 
+    // fast path: a single-frame block which is expected next can be
+    // decoded straight from the packet buffer, skipping the block queue
+    if (d.nframes == 1 && d.sequence == next_ && blockqueue_.empty()
+        && buffer().audioqueue.write_available() && buffer().infoqueue.write_available())
+    {
+        LOG_DEBUG("decode block " << d.sequence << " in place");
+        block_info i;
+        i.sr = d.samplerate > 0 ? d.samplerate : samplerate_;
+        i.channel = d.channel >= 0 ? d.channel : channel_;
+        i.sequence = d.sequence;
+        tap_block(s, d.sequence, i.sr, i.channel, d.data, d.size);
+        decode_block(d.data, d.size, i, d.sequence == nextneedsfadein_);
+        tap_trace(s, AOO_TRACE_DECODED, d.sequence);
+        next_++;
+        ack_list_.remove(d.sequence);
+        check_missing_blocks(s);
+        return 1;
+    }
+
     // add data packet
-    if (!add_packet(d)){
+    if (!add_packet(s, d)){
         return 0;
     }
 
     // process blocks and send audio
-    process_blocks();
+    process_blocks(s);
 
 #if 1
     check_outdated_blocks();
@@ -906,9 +1675,84 @@ int32_t source_desc::handle_data(const sink& s, int32_t salt, const aoo::data_pa
     return 1;
 }
 
+// /aoo/sink/<id>/parity <src> <salt> <firstseq> <count> <sizexor> <data>
+
+int32_t source_desc::handle_parity(const sink& s, int32_t salt, int32_t firstseq, int32_t count,
+                                   int32_t sizexor, const char *data, int32_t size){
+    mark_active(s.elapsed_time());
+
+    // synchronize with update()!
+    shared_lock lock(mutex_);
+
+    if (salt != salt_ || !decoder_ || !buffer_.load(std::memory_order_relaxed)
+            || fechistory_.empty()){
+        return 0;
+    }
+    if (count < 2 || count > AOO_FEC_MAXGROUP || size <= 0){
+        LOG_WARNING("bad parity message");
+        return 0;
+    }
+    if (firstseq + count <= next_){
+        // all blocks have already been played
+        return 0;
+    }
+
+    // we can only rebuild a single missing block
+    int32_t missing = -1;
+    for (int32_t i = 0; i < count; ++i){
+        auto seq = firstseq + i;
+        if (fechistory_[seq & (AOO_FEC_HISTORYSIZE - 1)].sequence != seq){
+            if (missing >= 0){
+                return 0;
+            }
+            missing = seq;
+        }
+    }
+    if (missing < 0 || missing < next_){
+        // nothing missing or too late
+        return 0;
+    }
+
+    // XOR the parity with all the other blocks
+    fecbuffer_.assign(data, data + size);
+    int32_t nbytes = sizexor;
+    for (int32_t i = 0; i < count; ++i){
+        auto seq = firstseq + i;
+        if (seq != missing){
+            auto& e = fechistory_[seq & (AOO_FEC_HISTORYSIZE - 1)];
+            auto n = std::min<int32_t>(e.data.size(), size);
+            for (int32_t j = 0; j < n; ++j){
+                fecbuffer_[j] ^= e.data[j];
+            }
+            nbytes ^= (int32_t)e.data.size();
+        }
+    }
+    if (nbytes <= 0 || nbytes > size){
+        LOG_WARNING("couldn't rebuild block " << missing << " from parity");
+        return 0;
+    }
+
+    LOG_VERBOSE("rebuilt block " << missing << " from parity");
+
+    aoo::data_packet d;
+    d.sequence = missing;
+    d.samplerate = 0; // use last
+    d.channel = -1; // use last
+    d.totalsize = nbytes;
+    d.nframes = 1;
+    d.framenum = 0;
+    d.data = fecbuffer_.data();
+    d.size = nbytes;
+
+    return do_handle_data(s, d);
+}
+
 // /aoo/sink/<id>/ping <src> <time>
+// or appended to a data message
+
+int32_t source_desc::handle_ping(const sink &s, time_tag tt, int32_t path){
+    mark_active(s.elapsed_time());
 
-int32_t source_desc::handle_ping(const sink &s, time_tag tt){
 #if 1
     if (streamstate_.get_state() != AOO_SOURCE_STATE_PLAY){
         return 0;
@@ -921,6 +1765,7 @@ int32_t source_desc::handle_ping(const sink &s, time_tag tt){
     time_tag tt2 = aoo_osctime_get(); // use real system time
 #endif
 
+    pingpath_ = path;
     streamstate_.set_ping(tt, tt2);
 
     // push "ping" event
@@ -931,11 +1776,44 @@ int32_t source_desc::handle_ping(const sink &s, time_tag tt){
     e.ping.tt1 = tt.to_uint64();
     e.ping.tt2 = tt2.to_uint64();
     e.ping.tt3 = 0;
-    push_event(e);
+    push_event(s, e);
+
+    return 1;
+}
+
+// /aoo/sink/<id>/silence <src> <salt> <seq>
+
+int32_t source_desc::handle_silence(const sink &s, int32_t salt, int32_t seq){
+    mark_active(s.elapsed_time());
+
+    // synchronize with update()!
+    shared_lock lock(mutex_);
 
+    if (salt != salt_ || !decoder_ || !buffer_.load(std::memory_order_relaxed)){
+        return 0;
+    }
+    if (seq <= newest_){
+        // late or repeated message, the source is talking again
+        return 0;
+    }
+    silentseq_ = seq;
+    silencetime_ = s.elapsed_time();
+    if (!silent_.exchange(true)){
+        LOG_VERBOSE("source " << id_ << " is silent from block " << seq << " on");
+    }
     return 1;
 }
 
+double source_desc::idle_time(double now){
+    auto last = lastactive_.load(std::memory_order_relaxed);
+    // not seen yet or the sink's timer was reset: count from now
+    if (last < 0 || last > now){
+        lastactive_.compare_exchange_strong(last, now);
+        return 0;
+    }
+    return now - last;
+}
+
 bool source_desc::send(const sink& s){
     bool didsomething = false;
 
@@ -945,25 +1823,126 @@ bool source_desc::send(const sink& s){
     if (send_codec_change_request(s)){
         didsomething = true;
     }
+    if (send_subscription_request(s)){
+        didsomething = true;
+    }
     if (send_data_request(s)){
         didsomething = true;
     }
     if (send_notifications(s)){
         didsomething = true;
     }
+    // the source repeats the /silence message, so if it doesn't
+    // the stream is gone and running out of blocks is an underrun again.
+    if (silent_.load(std::memory_order_relaxed)
+            && (s.elapsed_time() - silencetime_.load()) > (4 * AOO_SILENCE_KEEPALIVE * 0.001)){
+        LOG_VERBOSE("source " << id_ << " silence timed out");
+        silent_ = false;
+    }
     return didsomething;
 }
 
 bool source_desc::process(const sink& s, aoo_sample *buffer, int32_t stride, int32_t numsampleframes){
-    // synchronize with handle_format() and update()!
-    // the mutex should be uncontended most of the time.
-    // NOTE: We could use try_lock() and skip the block if we couldn't aquire the lock.
-    shared_lock lock(mutex_);
+    // No lock: handle_format() and update() install a new buffer and only
+    // free the old one once we're done with it, see retire_buffer().
+    // Check buffer_ again after announcing it, so we never pick up one
+    // that is retired in between.
+    stream_buffer *b;
+    do {
+        b = buffer_.load();
+        playing_.store(b);
+    } while (b != buffer_.load());
+
+    bool result = false;
+    if (b){
+        if (b->generation != playgeneration_){
+            // new format or sink settings -> reset the audio thread state
+            jitterfill_ = -1;
+            jitterstretch_ = 0;
+            fillhist_.reset();
+            fillhistcount_ = 0;
+            fillquantile_ = 0;
+            channel_ = 0;
+            samplerate_ = b->samplerate;
+            playgeneration_ = b->generation;
+        }
+        // play out what was left of the streams before, as long as it lasts
+        auto play = b;
+        if (b->previous && !b->drained.load(std::memory_order_relaxed)){
+            if (auto p = find_playable(s, *b->previous, numsampleframes)){
+                play = p;
+            } else {
+                LOG_DEBUG("played out previous stream");
+                b->drained.store(true, std::memory_order_release);
+            }
+        }
+        result = do_process(s, *play, buffer, stride, numsampleframes);
+    }
 
-    if (!decoder_){
-        return false;
+    playing_.store(nullptr);
+
+    return result;
+}
+
+// the oldest one of b and the buffers it carries on from which has enough
+// left to play, the others are marked as drained. Null if there is none.
+source_desc::stream_buffer * source_desc::find_playable(const sink& s, stream_buffer& b,
+                                                        int32_t numsampleframes){
+    if (b.previous && !b.drained.load(std::memory_order_relaxed)){
+        if (auto p = find_playable(s, *b.previous, numsampleframes)){
+            return p;
+        }
+        b.drained.store(true, std::memory_order_release);
+    }
+    return can_play(s, b, numsampleframes) ? &b : nullptr;
+}
+
+// enough for the next process() call, with a block to spare for the resampler
+bool source_desc::can_play(const sink& s, stream_buffer& b, int32_t numsampleframes) const {
+    auto nsamples = b.audioqueue.blocksize();
+    auto available = (b.resampler.read_available() + b.audioqueue.read_available() * nsamples) / b.nchannels;
+    if (s.time_stretch()){
+        available += b.stretcher.read_available();
+    }
+    return available >= numsampleframes + nsamples / b.nchannels;
+}
+
+// sums n interleaved frames of nchannels into the non-interleaved channels
+// of out, starting at channel offset, out of bound channels are left out.
+// Mono and stereo (what nearly every source sends) get a loop of their own,
+// which the compiler turns into straight vector adds and a single load+shuffle
+// per stereo pair, instead of a strided pass over the block for every channel.
+static void deinterleave_add(const aoo_sample *in, int32_t nchannels,
+                             aoo_sample *out, int32_t stride, int32_t offset,
+                             int32_t maxchannels, int32_t n){
+    const int32_t count = std::min(nchannels, maxchannels - offset);
+    if (count <= 0){
+        return;
+    }
+    out += stride * offset;
+    if (nchannels == 1){
+        for (int32_t j = 0; j < n; ++j){
+            out[j] += in[j];
+        }
+    } else if (nchannels == 2 && count == 2){
+        auto out0 = out;
+        auto out1 = out + stride;
+        for (int32_t j = 0; j < n; ++j){
+            out0[j] += in[j * 2];
+            out1[j] += in[j * 2 + 1];
+        }
+    } else {
+        for (int32_t i = 0; i < count; ++i){
+            auto o = out + stride * i;
+            for (int32_t j = 0; j < n; ++j){
+                o[j] += in[j * nchannels + i];
+            }
+        }
     }
+}
 
+bool source_desc::do_process(const sink& s, stream_buffer& b, aoo_sample *buffer,
+                             int32_t stride, int32_t numsampleframes){
     // record stream state
     int32_t lost = streamstate_.get_lost();
     int32_t reordered = streamstate_.get_reordered();
@@ -977,87 +1956,140 @@ bool source_desc::process(const sink& s, aoo_sample *buffer, int32_t stride, int
         // push packet loss event
         e.type = AOO_BLOCK_LOST_EVENT;
         e.block_loss.count = lost;
-        push_event(e);
+        push_event(s, e);
     }
     if (reordered > 0){
         // push packet reorder event
         e.type = AOO_BLOCK_REORDERED_EVENT;
         e.block_reorder.count = reordered;
-        push_event(e);
+        push_event(s, e);
     }
     if (resent > 0){
         // push packet resend event
         e.type = AOO_BLOCK_RESENT_EVENT;
         e.block_resend.count = resent;
-        push_event(e);
+        push_event(s, e);
     }
     if (gap > 0){
         // push packet gap event
         e.type = AOO_BLOCK_GAP_EVENT;
         e.block_gap.count = gap;
-        push_event(e);
+        push_event(s, e);
     }
 
     // don't process anything until the first few blocks are recv'd into the blockqueue
     // after a reset to keep the jitter buffer as full as possible at the start
-    //if (streamstate_.get_blocks_recvd() <  std::min(infoqueue_.capacity()/2, 10)) {
+    //if (streamstate_.get_blocks_recvd() <  std::min(b.infoqueue.capacity()/2, 10)) {
     //    LOG_VERBOSE("waiting for some blocks: " << streamstate_.get_blocks_recvd());
     //    return false;
     //}
     
-    int32_t nsamples = audioqueue_.blocksize();
+    // NOTE: no decoding happens here, process_blocks() and decode_block()
+    // run in handle_data(). We only move decoded audio into the resampler.
+    int32_t nsamples = b.audioqueue.blocksize();
 
     // read samples from resampler
-    auto nchannels = decoder_->nchannels();
+    auto nchannels = b.nchannels;
     // we need to respect the sample frame size passed in this method
     // because it may be less than the sink blocksize
     auto readsamples = numsampleframes * nchannels;
 
 #if 0
-    auto capacity = audioqueue_.capacity() / audioqueue_.blocksize();
-    DO_LOG("audioqueue: " << audioqueue_.read_available() << " / " << capacity);
+    auto capacity = b.audioqueue.capacity() / b.audioqueue.blocksize();
+    DO_LOG("audioqueue: " << b.audioqueue.read_available() << " / " << capacity);
 #endif
 
-    while (audioqueue_.read_available() && infoqueue_.read_available()
-           && readsamples > resampler_.read_available() && resampler_.write_available() >= nsamples){
-
-        // get block info and set current channel + samplerate
-        block_info info;
-        infoqueue_.read(info);
-        channel_ = info.channel;
-        samplerate_ = info.sr;
-
-        // write audio into resampler
-        resampler_.write(audioqueue_.read_data(), nsamples);
-
-        audioqueue_.read_commit();
+    // with time stretching, what the stretcher holds comes first. If the
+    // buffer holds too much, it needs a few periods more to pick from.
+    const bool stretch = s.time_stretch();
+    const double target = jittertarget_.load();
+    const bool overfill = stretch && s.jitter_control() && target > 0
+            && std::min(fill_, jitterfill_) > target + AOO_STRETCH_OVERFILL * 0.001;
+    int32_t wanted = readsamples;
+    int32_t held = 0;
+    if (stretch){
+        held = b.stretcher.read_available() * nchannels;
+        if (overfill){
+            wanted += b.stretcher.lookahead() * nchannels;
+        }
+    } else if (b.stretcher.read_available() > 0){
+        // just switched off
+        b.stretcher.clear();
+    }
+
+    auto fill_resampler = [&](){
+        while (b.audioqueue.read_available() && b.infoqueue.read_available()
+               && wanted > held + b.resampler.read_available() && b.resampler.write_available() >= nsamples){
+
+            // get block info and set current channel + samplerate
+            block_info info;
+            b.infoqueue.read(info);
+            channel_ = info.channel;
+            samplerate_ = info.sr;
+            if (info.sequence >= 0){
+                tap_trace(s, AOO_TRACE_PLAYED, info.sequence);
+            }
 
+            // write audio into resampler
+            b.resampler.write(b.audioqueue.read_data(), nsamples);
 
+            b.audioqueue.read_commit();
+        }
+    };
+    fill_resampler();
+    update_fill(s, b);
+    // update resampler. The jitter controller nudges the playback speed
+    // to move the buffered audio towards the target delay.
+    b.resampler.update(samplerate_ * update_stretch(s, b), s.real_samplerate());
+    // a slower ratio than the last one can leave it a few samples short,
+    // e.g. on the first period of a stream buffer
+    fill_resampler();
+
+    if (stretch){
+        // move the resampled audio over, as much as fits
+        auto n = std::min(b.resampler.read_available() / nchannels, b.stretcher.write_available());
+        if (n > 0){
+            b.resampler.read(b.stretcher.write_data(), n * nchannels);
+            b.stretcher.write_commit(n);
+        }
+        if (overfill){
+        #if LOGLEVEL >= 3
+            if (auto removed = b.stretcher.compress()){
+                LOG_DEBUG("aoo_sink: cut out " << removed << " frames (buffer overfill)");
+            }
+        #else
+            b.stretcher.compress();
+        #endif
+        }
+        if (b.stretcher.read_available() < numsampleframes && !silent_.load(std::memory_order_relaxed)){
+            // rather repeat what we just played than run dry
+        #if LOGLEVEL >= 3
+            auto avail = b.stretcher.read_available();
+            if (b.stretcher.expand(numsampleframes)){
+                LOG_DEBUG("aoo_sink: made up " << (b.stretcher.read_available() - avail) << " frames (buffer underrun)");
+            }
+        #else
+            b.stretcher.expand(numsampleframes);
+        #endif
+        }
     }
-    // update resampler
-    resampler_.update(samplerate_, s.real_samplerate());
     // read samples from resampler
     
-    //LOG_VERBOSE("s.blocksize: " << s.blocksize() << "  size: " << numsampleframes << "  stride: " << stride << " readsamp: " << readsamples << " ravail: " << resampler_.read_available() << " wavail: " << resampler_.write_available());
+    //LOG_VERBOSE("s.blocksize: " << s.blocksize() << "  size: " << numsampleframes << "  stride: " << stride << " readsamp: " << readsamples << " ravail: " << b.resampler.read_available() << " wavail: " << b.resampler.write_available());
     
-    if (resampler_.read_available() >= readsamples){
+    if (stretch ? b.stretcher.read_available() >= numsampleframes
+                : b.resampler.read_available() >= readsamples){
         auto buf = (aoo_sample *)alloca(readsamples * sizeof(aoo_sample));
-        resampler_.read(buf, readsamples);
+        if (stretch){
+            b.stretcher.read(buf, numsampleframes);
+        } else {
+            b.resampler.read(buf, readsamples);
+        }
 
         // sum source into sink (interleaved -> non-interleaved),
         // starting at the desired sink channel offset.
-        // out of bound source channels are silently ignored.
-        for (int i = 0; i < nchannels; ++i){
-            auto chn = i + channel_;
-            // ignore out-of-bound source channels!
-            if (chn < s.nchannels()){
-                auto n = numsampleframes;
-                auto out = buffer + stride * chn;
-                for (int j = 0; j < n; ++j){
-                    out[j] += buf[j * nchannels + i];
-                }
-            }
-        }
+        deinterleave_add(buf, nchannels, buffer, stride, channel_,
+                         s.nchannels(), numsampleframes);
 
         // LOG_DEBUG("read samples from source " << id_);
 
@@ -1068,10 +2100,13 @@ bool source_desc::process(const sink& s, aoo_sample *buffer, int32_t stride, int
             e.source_state.endpoint = endpoint_;
             e.source_state.id = id_;
             e.source_state.state = AOO_SOURCE_STATE_PLAY;
-            push_event(e);
+            push_event(s, e);
         }
 
         return true;
+    } else if (silent_.load(std::memory_order_relaxed)){
+        // the source doesn't send anything, so there is nothing to play
+        return false;
     } else {
         // buffer ran out -> push "stop" event
         if (streamstate_.update_state(AOO_SOURCE_STATE_STOP)){
@@ -1080,9 +2115,9 @@ bool source_desc::process(const sink& s, aoo_sample *buffer, int32_t stride, int
             e.source_state.endpoint = endpoint_;
             e.source_state.id = id_;
             e.source_state.state = AOO_SOURCE_STATE_STOP;
-            push_event(e);
+            push_event(s, e);
 
-            LOG_VERBOSE("UNDERRUN resampler avail " << resampler_.read_available() << "  readsamp: " << readsamples);
+            LOG_VERBOSE("UNDERRUN resampler avail " << b.resampler.read_available() << "  readsamp: " << readsamples);
 
             // this doesn't do anything if the stream simply stopped
             streamstate_.set_underrun();
@@ -1092,14 +2127,20 @@ bool source_desc::process(const sink& s, aoo_sample *buffer, int32_t stride, int
     }
 }
 
+void source_desc::push_event(const sink& s, const event& e){
+    scoped_lock<spinlock> l(eventqueuelock_);
+    if (eventqueue_.write_available()){
+        eventqueue_.write(e);
+        s.notify_event();
+    }
+}
+
 int32_t source_desc::handle_events(aoo_eventhandler fn, void *user){
     // copy events - always lockfree! (the eventqueue is never resized)
     auto n = eventqueue_.read_available();
     if (n > 0){
         auto events = (event *)alloca(sizeof(event) * n);
-        for (int i = 0; i < n; ++i){
-            eventqueue_.read(events[i]);
-        }
+        eventqueue_.read_n(events, n);
         auto vec = (const aoo_event **)alloca(sizeof(aoo_event *) * n);
         for (int i = 0; i < n; ++i){
             vec[i] = (aoo_event *)&events[i];
@@ -1109,6 +2150,15 @@ int32_t source_desc::handle_events(aoo_eventhandler fn, void *user){
     return n;
 }
 
+// already received (or played) over another path? call with (shared) lock!
+bool source_desc::is_duplicate(const data_packet &d){
+    if (next_ >= 0 && d.sequence < next_){
+        return true;
+    }
+    auto block = blockqueue_.find(d.sequence);
+    return block && block->has_frame(d.framenum);
+}
+
 bool source_desc::check_packet(const data_packet &d){
     if (d.sequence < next_){
         // block too old, discard!
@@ -1130,10 +2180,14 @@ bool source_desc::check_packet(const data_packet &d){
     // check for buffer underrun
     bool underrun = streamstate_.have_underrun();
 
+    // check for the end of a silence (see handle_silence())
+    bool resume = silent_.load(std::memory_order_relaxed) && d.sequence >= silentseq_.load();
+
     // check and update newest sequence number
     if (diff < 0){
         // TODO the following distinction doesn't seem to work reliably.
-        if (ack_list_.find(d.sequence)){
+        auto ack = ack_list_.find(d.sequence);
+        if (ack && ack->count() > 0){
             LOG_DEBUG("resent block " << d.sequence);
             streamstate_.add_resent(1);
         } else {
@@ -1141,18 +2195,18 @@ bool source_desc::check_packet(const data_packet &d){
             streamstate_.add_reordered(1);
         }
     } else {
-        if (newest_ > 0 && diff > 1){
+        if (newest_ > 0 && diff > 1 && !resume){
             LOG_VERBOSE("skipped " << (diff - 1) << " blocks");
         }
         // update newest sequence number
         newest_ = d.sequence;
     }
 
-    if (large_gap || recover || dropped || underrun){
+    if (large_gap || recover || dropped || underrun || resume){
         // record dropped blocks
         streamstate_.add_lost(blockqueue_.size());
-        if (diff > 1){
-            // record gap (measured in blocks)
+        if (diff > 1 && !resume){
+            // record gap (measured in blocks), suppressed blocks aren't lost
             streamstate_.add_gap(diff - 1);
         }
         // clear the block queue and fill audio buffer with zeros.
@@ -1160,34 +2214,44 @@ bool source_desc::check_packet(const data_packet &d){
         ack_list_.clear();
         next_ = d.sequence;
         // push empty blocks to keep the buffer full, but leave room for one block!
+        // (with jitter control only up to the target delay). A buffer which carries
+        // on from the previous one gets none, that one is still playing.
         int count = 0;
-        auto nsamples = audioqueue_.blocksize();
-        while (audioqueue_.write_available() > 1 && infoqueue_.write_available() > 1){
-            auto ptr = audioqueue_.write_data();
+        const int32_t maxfill = carryover_ ? 0 : max_fill_blocks(decoder_->blocksize(), decoder_->samplerate());
+        carryover_ = false;
+        auto nsamples = buffer().audioqueue.blocksize();
+        while (buffer().audioqueue.write_available() > 1 && buffer().infoqueue.write_available() > 1 && count < maxfill){
+            auto ptr = buffer().audioqueue.write_data();
             if (!decoder_->decode(nullptr, 0, ptr, nsamples)) {
-                LOG_WARNING("decode failed nsamples: " << nsamples << " audioqavail: " << audioqueue_.write_available());
+                LOG_WARNING("decode failed nsamples: " << nsamples << " audioqavail: " << buffer().audioqueue.write_available());
             }
-            audioqueue_.write_commit();
+            buffer().audioqueue.write_commit();
             // push nominal samplerate + current channel
             block_info i;
             i.sr = decoder_->samplerate();
             i.channel = channel_;
-            infoqueue_.write(i);
+            buffer().infoqueue.write(i);
 
             count++;
         }
 
         if (count > 0){
-            auto reason = large_gap ? "transmission gap"
+        #if LOGLEVEL >= 2
+            auto reason = resume ? "end of silence"
+                          : large_gap ? "transmission gap"
                           : recover ? "sink xrun"
                           : dropped ? "source xrun"
                           : underrun ? "buffer underrun"
                           : "?";
             LOG_VERBOSE("wrote " << count << " empty blocks for " << reason);
+        #endif
             //if (large_gap > 0) {
             nextneedsfadein_ = next_;
             //}
         }
+        if (resume){
+            silent_ = false;
+        }
 
         if (dropped){
             next_++;
@@ -1198,9 +2262,69 @@ bool source_desc::check_packet(const data_packet &d){
     return true;
 }
 
-bool source_desc::add_packet(const data_packet& d){
+void source_desc::tap_block(const sink& s, int32_t sequence, double sr, int32_t channel,
+                            const char *data, int32_t size) const {
+    if (!s.has_packet_tap()){
+        return;
+    }
+    aoo_packet_tap_info info;
+    info.endpoint = endpoint_;
+    info.id = id_;
+    info.salt = salt_;
+    info.format = &tapformat_;
+    info.settings = tapsettings_.data();
+    info.settingssize = (int32_t)tapsettings_.size();
+    info.sequence = sequence;
+    info.samplerate = sr;
+    info.channel = channel;
+    info.data = data;
+    info.size = size;
+    s.tap_packet(info);
+}
+
+void source_desc::tap_trace(const sink& s, int32_t stage, int32_t sequence, int32_t framenum) const {
+    if (!s.has_trace_tap()){
+        return;
+    }
+    aoo_trace_info info;
+    info.endpoint = endpoint_;
+    info.id = id_;
+    info.salt = salt_;
+    info.stage = stage;
+    info.sequence = sequence;
+    info.framenum = framenum;
+    s.tap_trace(info);
+}
+
+void source_desc::tap_telemetry(const sink& s, int32_t type, int32_t sequence,
+                                int32_t framenum, time_tag sent) const {
+    if (!s.has_telemetry_tap()){
+        return;
+    }
+    aoo_telemetry_info info;
+    info.endpoint = endpoint_;
+    info.id = id_;
+    info.type = type;
+    info.sequence = sequence;
+    info.framenum = framenum;
+    info.arrival = time_tag::now().to_uint64();
+    info.sent = sent.to_uint64();
+    // only what's in the audio queue, the resampler belongs to the audio thread
+    if (decoder_ && buffer_.load(std::memory_order_relaxed)
+            && decoder_->nchannels() > 0 && decoder_->samplerate() > 0){
+        info.fill = (double)buffer().audioqueue.read_available() * buffer().audioqueue.blocksize()
+                / decoder_->nchannels() / decoder_->samplerate();
+    } else {
+        info.fill = 0;
+    }
+    s.tap_telemetry(info);
+}
+
+bool source_desc::add_packet(const sink& s, const data_packet& d){
     auto block = blockqueue_.find(d.sequence);
     if (!block){
+        // everything between the newest block and this one is missing
+        int32_t missing = blockqueue_.empty() ? next_ : blockqueue_.back().sequence + 1;
         if (blockqueue_.full()){
             // if the queue is full, we have to drop a block;
             // in this case we send a block of zeros to the audio buffer.
@@ -1208,21 +2332,27 @@ bool source_desc::add_packet(const data_packet& d){
             // first we check if the first (complete) block is about to be read next,
             // which means that we have a buffer overflow (the source is too fast)
             if (old == next_ && blockqueue_.front().complete()){
+                if (s.has_telemetry_tap()){
+                    for (auto& b : blockqueue_){
+                        tap_telemetry(s, AOO_TELEMETRY_DROPPED, b.sequence, -1);
+                    }
+                }
                 // clear the block queue and fill audio buffer with zeros.
                 blockqueue_.clear();
                 ack_list_.clear();
                 // push empty blocks to keep the buffer full, but leave room for one block!
                 int count = 0;
-                auto nsamples = audioqueue_.blocksize();
-                while (audioqueue_.write_available() > 1 && infoqueue_.write_available() > 1){
-                    auto ptr = audioqueue_.write_data();
+                const int32_t maxfill = max_fill_blocks(decoder_->blocksize(), decoder_->samplerate());
+                auto nsamples = buffer().audioqueue.blocksize();
+                while (buffer().audioqueue.write_available() > 1 && buffer().infoqueue.write_available() > 1 && count < maxfill){
+                    auto ptr = buffer().audioqueue.write_data();
                     decoder_->decode(nullptr, 0, ptr, nsamples);
-                    audioqueue_.write_commit();
+                    buffer().audioqueue.write_commit();
                     // push nominal samplerate + current channel
                     block_info i;
                     i.sr = decoder_->samplerate();
                     i.channel = channel_;
-                    infoqueue_.write(i);
+                    buffer().infoqueue.write(i);
 
                     count++;
                 }
@@ -1232,18 +2362,19 @@ bool source_desc::add_packet(const data_packet& d){
                 next_ = d.sequence;
                 LOG_VERBOSE("dropped " << count << " blocks to handle buffer overrun");
             } else {
-                if (audioqueue_.write_available() && infoqueue_.write_available()){
-                    auto ptr = audioqueue_.write_data();
-                    auto nsamples = audioqueue_.blocksize();
+                if (buffer().audioqueue.write_available() && buffer().infoqueue.write_available()){
+                    auto ptr = buffer().audioqueue.write_data();
+                    auto nsamples = buffer().audioqueue.blocksize();
                     decoder_->decode(nullptr, 0, ptr, nsamples);
-                    audioqueue_.write_commit();
+                    buffer().audioqueue.write_commit();
                     // push nominal samplerate + current channel
                     block_info i;
                     i.sr = decoder_->samplerate();
                     i.channel = channel_;
-                    infoqueue_.write(i);
+                    buffer().infoqueue.write(i);
                 }
                 // record dropped block
+                tap_telemetry(s, AOO_TELEMETRY_DROPPED, old, -1);
                 streamstate_.add_lost(1);
                 // remove block from acklist
                 ack_list_.remove(old);
@@ -1259,6 +2390,12 @@ bool source_desc::add_packet(const data_packet& d){
         int chan = d.channel >= 0 ? d.channel : channel_;
         block = blockqueue_.insert(d.sequence, srate,
                                    chan, d.totalsize, d.nframes);
+        // (the holes before 'next' have been dropped)
+        missing = std::max<int32_t>(std::max<int32_t>(missing, next_),
+                                    d.sequence - blockqueue_.capacity());
+        for (auto seq = missing; seq < d.sequence; ++seq){
+            ack_list_.add(seq);
+        }
     } else if (block->has_frame(d.framenum)){
         LOG_VERBOSE("frame " << d.framenum << " of block " << d.sequence << " already received!");
         return false;
@@ -1267,16 +2404,19 @@ bool source_desc::add_packet(const data_packet& d){
     // add frame to block
     block->add_frame(d.framenum, (const char *)d.data, d.size);
 
-#if 0
     if (block->complete()){
+        tap_trace(s, AOO_TRACE_QUEUED, block->sequence);
+        tap_block(s, block->sequence, block->samplerate, block->channel,
+                  block->data(), block->size());
         // remove block from acklist as early as possible
         ack_list_.remove(block->sequence);
+    } else {
+        ack_list_.add(block->sequence);
     }
-#endif
     return true;
 }
 
-void source_desc::process_blocks(){
+void source_desc::process_blocks(const sink& s){
     // Transfer all consecutive complete blocks as long as
     // no previous (expected) blocks are missing.
     if (blockqueue_.empty()){
@@ -1284,12 +2424,14 @@ void source_desc::process_blocks(){
     }
 
     auto b = blockqueue_.begin();
+    int32_t count = 0; // number of processed blocks
     int32_t next = next_;
-    while (b != blockqueue_.end() && audioqueue_.write_available())
+    while (b != blockqueue_.end() && buffer().audioqueue.write_available())
     {
         const char *data;
         int32_t size;
         block_info i;
+        bool fec = false;
         const bool dofadein = b->sequence == nextneedsfadein_;
         
         if (b->sequence == next && b->complete()){
@@ -1300,8 +2442,9 @@ void source_desc::process_blocks(){
             i.sr = b->samplerate;
             i.channel = b->channel;
 
-            b++;
-        } else if (!ack_list_.get(next).remaining()){
+            ++b;
+            count++;
+        } else if (!ack_list_.remaining(next)){
             // block won't be resent, just drop it
             data = nullptr;
             size = 0;
@@ -1309,51 +2452,33 @@ void source_desc::process_blocks(){
             i.channel = channel_;
 
             if (b->sequence == next){
-                b++;
+                ++b;
+                count++;
+            } else if (b->sequence == next + 1 && b->complete()){
+                // the following block might carry redundant (FEC) data
+                // for the missing one, otherwise the decoder does PLC.
+                data = b->data();
+                size = b->size();
+                fec = true;
             }
 
             LOG_VERBOSE("dropped block " << next);
+            ack_list_.remove(next);
+            tap_telemetry(s, AOO_TELEMETRY_DROPPED, next, -1);
             streamstate_.add_lost(1);
         } else {
             // wait for block
             break;
         }
 
+        i.sequence = next;
         next++;
 
-        // decode data and push samples
-        auto ptr = audioqueue_.write_data();
-        auto nsamples = audioqueue_.blocksize();
-        // decode audio data
-        if (decoder_->decode(data, size, ptr, nsamples) < 0){
-            LOG_WARNING("aoo_sink: couldn't decode block!");
-            // decoder failed - fill with zeros
-            std::fill(ptr, ptr + nsamples, 0);
-        }
-        else if (dofadein) {
-            // fade the samples in
-            LOG_VERBOSE("fading in block");
-            auto nchannels = decoder_->nchannels();
-            const int sframes = nsamples/nchannels;
-            for (int i = 0; i < nchannels; ++i){
-                float gain = 0.0f;
-                const float gaindelta = 1.0f / sframes;
-                for (int j = 0; j < sframes; ++j){
-                    ptr[j*nchannels+i] *= gain;
-                    gain += gaindelta;
-                }
-            }                   
-            
-            nextneedsfadein_ = -1;
-        }
-        audioqueue_.write_commit();
-
-        // push info
-        infoqueue_.write(i);
+        decode_block(data, size, i, dofadein, fec);
+        tap_trace(s, AOO_TRACE_DECODED, i.sequence);
     }
     next_ = next;
     // pop blocks
-    auto count = b - blockqueue_.begin();
     while (count--){
     #if 1
         // remove block from acklist
@@ -1366,6 +2491,206 @@ void source_desc::process_blocks(){
     LOG_DEBUG("next: " << next_);
 }
 
+void source_desc::decode_block(const char *data, int32_t size,
+                               const block_info& info, bool fadein, bool fec){
+    // decode data and push samples
+    auto ptr = buffer().audioqueue.write_data();
+    auto nsamples = buffer().audioqueue.blocksize();
+    // decode audio data. A missing block is first recovered from the
+    // FEC data of the following block (if any), otherwise the decoder
+    // does packet loss concealment.
+    int32_t result = 0;
+    if (fec){
+        result = decoder_->decode_fec(data, size, ptr, nsamples);
+        if (result > 0){
+            LOG_VERBOSE("recovered block from FEC data");
+        }
+    }
+    if (result <= 0){
+        result = fec ? decoder_->decode(nullptr, 0, ptr, nsamples)
+                     : decoder_->decode(data, size, ptr, nsamples);
+    }
+    if (result < 0){
+        LOG_WARNING("aoo_sink: couldn't decode block!");
+        // decoder failed - fill with zeros
+        std::fill(ptr, ptr + nsamples, 0);
+    }
+    else if (fadein) {
+        // fade the samples in
+        LOG_VERBOSE("fading in block");
+        auto nchannels = decoder_->nchannels();
+        const int sframes = nsamples/nchannels;
+        for (int i = 0; i < nchannels; ++i){
+            float gain = 0.0f;
+            const float gaindelta = 1.0f / sframes;
+            for (int j = 0; j < sframes; ++j){
+                ptr[j*nchannels+i] *= gain;
+                gain += gaindelta;
+            }
+        }
+
+        nextneedsfadein_ = -1;
+    }
+    buffer().audioqueue.write_commit();
+
+    // push info
+    buffer().infoqueue.write(info);
+}
+
+// Estimate the arrival jitter from the arrival time of each block relative
+// to its nominal time. 'jitterbase_' follows the earliest arrivals and
+// slowly rises, so clock drift between source and sink doesn't accumulate.
+// The peak deviation from the base decays with a half-life of a few seconds.
+// call with (shared) lock!
+// the arrival delays and buffer fills are ranked in 0.5 ms steps up to 0.5 s,
+// decaying with a half-life of 30 s (but at least a few thousand values)
+#define AOO_QUANTILE_BINWIDTH 0.0005
+#define AOO_QUANTILE_NUMBINS 1000
+#define AOO_QUANTILE_HALFLIFE 30.0
+#define AOO_QUANTILE_MINHALFLIFE 4000.0
+// how many values have to be beyond the quantile before it is used
+#define AOO_QUANTILE_MINTAIL 5.0
+// number of values between quantile lookups
+#define AOO_QUANTILE_LOOKUP_INTERVAL 32
+
+void source_desc::update_jitter(const sink& s, int32_t seq){
+    auto sr = decoder_->samplerate();
+    auto blocksize = decoder_->blocksize();
+    if (sr <= 0 || blocksize <= 0){
+        return;
+    }
+    const double period = (double)blocksize / sr;
+    auto now = time_tag::now();
+
+    if (period != jitterhistperiod_){
+        jitterhist_.setup(AOO_QUANTILE_BINWIDTH, AOO_QUANTILE_NUMBINS,
+                          std::max(AOO_QUANTILE_HALFLIFE / period, AOO_QUANTILE_MINHALFLIFE));
+        jitterhistperiod_ = period;
+        jitterhistcount_ = 0;
+        arrivaljitter_ = 0;
+    }
+    const double q = s.jitter_quantile();
+    // worth going by once there are a few values beyond the quantile
+    const bool ranked = jitterhist_.count() * (1.0 - q) >= AOO_QUANTILE_MINTAIL;
+
+    if (jitterseq0_ < 0 || (seq - jitterseq_) * period > 1.0){
+        // (re)start after a reset or a transmission gap
+        jitterstart_ = now;
+        jitterseq0_ = seq;
+        jitterbase_ = 0;
+    } else {
+        // arrival time relative to the nominal time of the block
+        double delta = time_tag::duration(jitterstart_, now)
+                - (double)(seq - jitterseq0_) * period;
+        if (delta < jitterbase_){
+            jitterbase_ = delta;
+        } else {
+            jitterbase_ += (delta - jitterbase_) * 0.0001;
+        }
+        double dev = delta - jitterbase_;
+        jitterhist_.push(dev);
+        // the peak reacts to a sudden rise right away. Once the quantile is
+        // known it only has to bridge the time until the histogram catches up.
+        if (dev > jitterpeak_){
+            jitterpeak_ = dev;
+        } else {
+            const double halflife = ranked ? 1.0 : 4.0; // seconds
+            jitterpeak_ *= std::pow(0.5, period / halflife);
+        }
+        if (++jitterhistcount_ >= AOO_QUANTILE_LOOKUP_INTERVAL){
+            arrivaljitter_ = ranked ? jitterhist_.quantile(q) : 0;
+            jitterhistcount_ = 0;
+        }
+    }
+    jitterseq_ = seq;
+
+    // the target delay has to cover the jitter, a whole block
+    // (blocks arrive at once) and the sink processing blocksize.
+    double jitter = ranked ? std::max<double>(arrivaljitter_.load(), jitterpeak_) : jitterpeak_;
+    double target = jitter + AOO_JITTER_MARGIN * 0.001 + period
+            + (double)s.blocksize() / s.samplerate();
+    // ...but can't exceed the buffer (leave room for one block)
+    auto& b = buffer();
+    double maxdelay = (double)(b.audioqueue.capacity() / b.audioqueue.blocksize() - 1) * period;
+    jittertarget_ = std::max(period, std::min(target, maxdelay));
+}
+
+// audio thread, see process()
+void source_desc::update_fill(const sink& s, stream_buffer& b){
+    if (b.samplerate <= 0 || b.nchannels <= 0){
+        fill_ = 0;
+        return;
+    }
+    // audio which is already decoded, in seconds
+    fill_ = ((double)b.audioqueue.read_available() * b.audioqueue.blocksize()
+             + b.resampler.read_available() + b.stretcher.read_available() * b.nchannels)
+            / b.nchannels / b.samplerate;
+
+    const double period = (double)s.blocksize() / s.samplerate();
+    if (period != fillhistperiod_){
+        fillhist_.setup(AOO_QUANTILE_BINWIDTH, AOO_QUANTILE_NUMBINS,
+                        std::max(AOO_QUANTILE_HALFLIFE / period, AOO_QUANTILE_MINHALFLIFE));
+        fillhistperiod_ = period;
+        fillhistcount_ = 0;
+        fillquantile_ = 0;
+    }
+    fillhist_.push(fill_);
+
+    if (++fillhistcount_ >= AOO_QUANTILE_LOOKUP_INTERVAL){
+        // the fill we stay above, so the bin below the one where it's reached
+        const double q = 1.0 - s.jitter_quantile();
+        if (fillhist_.count() * q >= AOO_QUANTILE_MINTAIL){
+            fillquantile_ = std::max(0.0, fillhist_.quantile(q) - AOO_QUANTILE_BINWIDTH);
+        } else {
+            fillquantile_ = 0;
+        }
+        fillhistcount_ = 0;
+    }
+}
+
+// returns the factor to apply to the source samplerate.
+// audio thread, see process()
+double source_desc::update_stretch(const sink& s, const stream_buffer& b){
+    auto target = jittertarget_.load();
+    if (!s.jitter_control() || target <= 0 || b.samplerate <= 0){
+        jitterstretch_ = 0;
+        jitterfill_ = -1;
+        return 1.0;
+    }
+    // see update_fill()
+    const double fill = fill_;
+    if (jitterfill_ < 0){
+        jitterfill_ = fill;
+    } else {
+        // blocks arrive in bursts, so smooth a lot
+        jitterfill_ += (fill - jitterfill_) * 0.02;
+    }
+    // ignore errors within half a block
+    const double period = (double)b.blocksize / b.samplerate;
+    double error = jitterfill_ - target;
+    if (error > 0){
+        error = std::max(0.0, error - period * 0.5);
+    } else {
+        error = std::min(0.0, error + period * 0.5);
+    }
+    // full speed change for an error of 10 ms
+    double stretch = std::max(-AOO_JITTER_MAXSTRETCH,
+                              std::min(AOO_JITTER_MAXSTRETCH, error * AOO_JITTER_MAXSTRETCH * 100.0));
+    jitterstretch_ += (stretch - jitterstretch_) * 0.05;
+    return 1.0 + jitterstretch_;
+}
+
+// number of blocks to prefill the audio buffer with
+int32_t source_desc::max_fill_blocks(int32_t blocksize, int32_t samplerate) const {
+    auto target = jittertarget_.load();
+    if (jitterenabled_ && target > 0 && samplerate > 0){
+        const double period = (double)blocksize / samplerate;
+        return std::max<int32_t>(1, std::ceil(target / period));
+    } else {
+        return std::numeric_limits<int32_t>::max();
+    }
+}
+
 void source_desc::check_outdated_blocks(){
     // pop outdated blocks (shouldn't really happen...)
     while (!blockqueue_.empty() &&
@@ -1388,11 +2713,12 @@ void source_desc::check_outdated_blocks(){
 
 #define AOO_BLOCKQUEUE_CHECK_THRESHOLD 3
 
-// deal with "holes" in block queue
+// deal with "holes" in block queue. The missing and incomplete blocks
+// are tracked by add_packet(), so we only look at the ones which are due.
 void source_desc::check_missing_blocks(const sink& s){
     if (blockqueue_.empty()){
+        // nothing can be missing
         if (!ack_list_.empty()){
-            LOG_WARNING("bug: acklist not empty");
             ack_list_.clear();
         }
         return;
@@ -1404,74 +2730,60 @@ void source_desc::check_missing_blocks(const sink& s){
         return;
     }
 #if LOGLEVEL >= 4
-    std::cerr << queue << std::endl;
+    std::cerr << ack_list_ << std::endl;
 #endif
+    const auto now = s.elapsed_time();
+    const auto interval = s.resend_interval();
+    const auto maxnumframes = s.resend_maxnumframes();
+    auto& last = blockqueue_.back();
+    block_ack *deferred = nullptr;
     int32_t numframes = 0;
 
-    // resend incomplete blocks except for the last block
-    LOG_DEBUG("resend incomplete blocks");
-    for (auto it = blockqueue_.begin(); it != (blockqueue_.end() - 1); ++it){
-        if (!it->complete() && resendqueue_.write_available()){
-            // insert ack (if needed)
-            auto& ack = ack_list_.get(it->sequence);
-            if (ack.update(s.elapsed_time(), s.resend_interval())){
-                for (int i = 0; i < it->num_frames(); ++i){
-                    if (!it->has_frame(i)){
-                        if (numframes < s.resend_maxnumframes()){
-                            resendqueue_.write(data_request { it->sequence, i });
-                            numframes++;
-                        } else {
-                            goto resend_incomplete_done;
-                        }
-                    }
-                }
-            }
+    block_ack *ack;
+    while (numframes < maxnumframes && resendqueue_.write_available()
+           && (ack = ack_list_.next_due(now)))
+    {
+        auto seq = ack->sequence;
+        if (seq < next_){
+            // already dropped
+            ack_list_.remove(seq);
+            continue;
         }
-    }
-resend_incomplete_done:
-
-    // resend missing blocks before any (half)completed blocks
-    LOG_DEBUG("resend missing blocks");
-    int32_t next = next_;
-    for (auto it = blockqueue_.begin(); it != blockqueue_.end(); ++it){
-        auto missing = it->sequence - next;
-        if (missing > 0){
-            for (int i = 0; i < missing && resendqueue_.write_available(); ++i){
-                // insert ack (if necessary)
-                auto& ack = ack_list_.get(next + i);
-                if (ack.update(s.elapsed_time(), s.resend_interval())){
-                    if (numframes + it->num_frames() <= s.resend_maxnumframes()){
-                        resendqueue_.write(data_request { next + i, -1 }); // whole block
-                        numframes += it->num_frames();
-                    } else {
-                        goto resend_missing_done;
-                    }
+        auto b = blockqueue_.find(seq);
+        if (b){
+            // resend incomplete blocks except for the last block
+            if (b == &last){
+                ack_list_.pop();
+                deferred = ack;
+                continue;
+            }
+            ack_list_.request(*ack, now, interval);
+            for (int i = 0; i < b->num_frames() && numframes < maxnumframes; ++i){
+                if (!b->has_frame(i)){
+                    resendqueue_.write(data_request { seq, i });
+                    tap_telemetry(s, AOO_TELEMETRY_RESEND, seq, i);
+                    numframes++;
                 }
             }
-        } else if (missing < 0){
-            LOG_VERBOSE("bug: sequence = " << it->sequence << ", next = " << next);
-            assert(false);
+        } else {
+            // resend missing block (we assume it has as many frames as the last one)
+            if (numframes + last.num_frames() > maxnumframes){
+                break;
+            }
+            ack_list_.request(*ack, now, interval);
+            resendqueue_.write(data_request { seq, -1 }); // whole block
+            tap_telemetry(s, AOO_TELEMETRY_RESEND, seq, -1);
+            numframes += last.num_frames();
         }
-        next = it->sequence + 1;
     }
-resend_missing_done:
+    if (deferred){
+        ack_list_.schedule(*deferred);
+    }
 
-    assert(numframes <= s.resend_maxnumframes());
+    assert(numframes <= maxnumframes);
     if (numframes > 0){
         LOG_DEBUG("requested " << numframes << " frames");
     }
-
-#if 1
-    // clean ack list
-    auto removed = ack_list_.remove_before(next_);
-    if (removed > 0){
-        LOG_DEBUG("block_ack_list: removed " << removed << " outdated items");
-    }
-#endif
-
-#if LOGLEVEL >= 4
-    std::cerr << acklist << std::endl;
-#endif
 }
 
 // /aoo/src/<id>/format <version> <sink>
@@ -1530,6 +2842,35 @@ bool source_desc::send_codec_change_request(const sink& s) {
     }
 }
 
+// /aoo/src/<id>/subscribe <sink> <onset> <nchannels>
+
+bool source_desc::send_subscription_request(const sink& s) {
+    if (streamstate_.need_subscription()){
+        auto onset = subonset_.load();
+        auto nchannels = subchannels_.load();
+        LOG_VERBOSE("subscribe to channels " << onset << " - " << (onset + nchannels - 1)
+                    << " of source " << id_);
+        char buf[AOO_MAXPACKETSIZE];
+        osc::OutboundPacketStream msg(buf, sizeof(buf));
+
+        // make OSC address pattern
+        const int32_t max_addr_size = AOO_MSG_DOMAIN_LEN +
+                AOO_MSG_SOURCE_LEN + 16 + AOO_MSG_SUBSCRIBE_LEN;
+        char address[max_addr_size];
+        snprintf(address, sizeof(address), "%s%s/%d%s",
+                 AOO_MSG_DOMAIN, AOO_MSG_SOURCE, id_, AOO_MSG_SUBSCRIBE);
+
+        msg << osc::BeginMessage(address) << s.id() << onset << nchannels
+            << osc::EndMessage;
+
+        dosend(msg.Data(), (int32_t)msg.Size());
+
+        return true;
+    } else {
+        return false;
+    }
+}
+
 // /aoo/src/<id>/data <sink> <salt> <seq0> <frame0> <seq1> <frame1> ...
 
 int32_t source_desc::send_data_request(const sink &s){
@@ -1556,11 +2897,11 @@ int32_t source_desc::send_data_request(const sink &s){
         auto d = div(numrequests, maxrequests);
 
         auto dorequest = [&](int32_t n){
+            data_request requests[AOO_MAXPACKETSIZE / 10];
+            n = resendqueue_.read_n(requests, std::min<int32_t>(n, AOO_MAXPACKETSIZE / 10));
             msg << osc::BeginMessage(address) << s.id() << salt;
-            while (n--){
-                data_request request;
-                resendqueue_.read(request);
-                msg << request.sequence << request.frame;
+            for (int32_t i = 0; i < n; ++i){
+                msg << requests[i].sequence << requests[i].frame;
             }
             msg << osc::EndMessage;
 
@@ -1610,7 +2951,8 @@ bool source_desc::send_notifications(const sink& s){
                 << lost_blocks
                 << osc::EndMessage;
 
-            dosend(msg.Data(), (int32_t)msg.Size());
+            // back over the path the ping came from, which also tells the source if it works
+            dosend(msg.Data(), (int32_t)msg.Size(), pingpath_.load());
 
             LOG_DEBUG("send /ping to source " << id_);
             didsomething = true;
@@ -12,6 +12,7 @@
 #include "common.hpp"
 #include "lockfree.hpp"
 #include "time_dll.hpp"
+#include "quantile.hpp"
 
 #include "oscpack/osc/OscOutboundPacketStream.h"
 #include "oscpack/osc/OscReceivedElements.h"
@@ -36,6 +37,7 @@ struct stream_state {
         pingtime1_ = 0;
         pingtime2_ = 0;
         codecchange_ = false;
+        subscribe_ = false;
     }
 
     void add_lost(int32_t n) { lost_ += n; lost_since_ping_ += n; }
@@ -94,6 +96,9 @@ struct stream_state {
     bool need_codec_change() { return codecchange_.exchange(false); }
 
     aoo_format_storage &  get_codec_change_format(int32_t & datasize) { datasize = codecchange_datasize_; return codecchange_format_; }
+
+    void request_subscription() { subscribe_ = true; }
+    bool need_subscription() { return subscribe_.exchange(false); }
     
     enum invitation_state {
         NONE = 0,
@@ -115,6 +120,7 @@ private:
     std::atomic<bool> recover_{false};
     std::atomic<bool> format_{false};
     std::atomic<bool> codecchange_{false};
+    std::atomic<bool> subscribe_{false};
     std::atomic<uint64_t> pingtime1_;
     std::atomic<uint64_t> pingtime2_;
     
@@ -125,6 +131,7 @@ private:
 struct block_info {
     double sr;
     int32_t channel;
+    int32_t sequence = -1; // for the trace tap, -1 for filler blocks
 };
 
 class sink;
@@ -144,6 +151,7 @@ public:
     } event;
 
     source_desc(void *endpoint, aoo_replyfn fn, int32_t id, int32_t salt);
+    ~source_desc();
     source_desc(const source_desc& other) = delete;
     source_desc& operator=(const source_desc& other) = delete;
 
@@ -158,11 +166,23 @@ public:
     
     int32_t get_buffer_fill_ratio(float &ratio);
 
+    int32_t get_jitter_delay(float &ms);
+
+    int32_t get_arrival_jitter(float &ms);
+
+    int32_t get_buffer_fill_quantile(float &ms);
+
     int32_t get_userformat(char * buf, int32_t size);
 
     int32_t get_current_salt() const { return salt_; }
     
     void set_protocol_flags(int32_t flags) { protocol_flags_ = flags; }
+
+    // extra network paths of a multi-path source, see aoo_source_add_sink_path().
+    // 0 is the primary path (our endpoint), -1 means not found.
+    int32_t find_path(void *endpoint) const;
+
+    int32_t add_path(void *endpoint, aoo_replyfn fn);
     
     // methods
     void update(const sink& s);
@@ -170,10 +190,16 @@ public:
     int32_t handle_format(const sink& s, int32_t salt, const aoo_format& f,
                           const char *settings, int32_t size, int32_t version, const char *userformat=nullptr, int32_t ufsize=0);
 
-    int32_t handle_data(const sink& s, int32_t salt,
-                                     const aoo::data_packet& d);
+    // 'sent' is the source's time tag if the packet carried one
+    int32_t handle_data(const sink& s, int32_t salt, const aoo::data_packet& d,
+                        int32_t path = 0, time_tag sent = time_tag{});
+
+    int32_t handle_parity(const sink& s, int32_t salt, int32_t firstseq, int32_t count,
+                          int32_t sizexor, const char *data, int32_t size);
 
-    int32_t handle_ping(const sink& s, time_tag tt);
+    int32_t handle_ping(const sink& s, time_tag tt, int32_t path = 0);
+
+    int32_t handle_silence(const sink& s, int32_t salt, int32_t seq);
 
     int32_t handle_events(aoo_eventhandler fn, void *user);
 
@@ -187,39 +213,138 @@ public:
 
     void request_codec_change(aoo_format & f);
 
-    void request_invite(){ streamstate_.request_invitation(stream_state::INVITE); }
+    void request_subscription(int32_t onset, int32_t nchannels);
+
+    void request_invite(){
+        lastactive_.store(-1, std::memory_order_relaxed); // a new grace period
+        streamstate_.request_invitation(stream_state::INVITE);
+    }
 
     void request_uninvite(){ streamstate_.request_invitation(stream_state::UNINVITE); }
+
+    // any message from the source, 'now' is the sink's elapsed time
+    void mark_active(double now){ lastactive_.store(now, std::memory_order_relaxed); }
+
+    // send thread
+    double idle_time(double now);
 private:
     struct data_request {
         int32_t sequence;
         int32_t frame;
     };
-    void do_update(const sink& s);
+    struct fec_entry {
+        int32_t sequence = -1;
+        std::vector<char> data;
+    };
+    // The decoded audio and the format it has, which is all that
+    // process() needs. A new format or new sink settings get a new one.
+    struct stream_buffer {
+        int32_t nchannels = 0;
+        int32_t blocksize = 0;
+        int32_t samplerate = 0;
+        uint32_t generation = 0;
+        lockfree::queue<aoo_sample> audioqueue;
+        lockfree::queue<block_info> infoqueue;
+        dynamic_resampler resampler;
+        time_stretcher stretcher;
+        // A new format with the same blocksize and samplerate carries on from
+        // the buffer it replaces: that one is played out first, while this one
+        // fills up with the new stream, so the change doesn't leave a gap.
+        std::unique_ptr<stream_buffer> previous;
+        std::atomic<bool> drained{false}; // of 'previous', set by the audio thread
+    };
+    // what a new format or new sink settings replace, set up without the lock
+    struct stream_setup {
+        std::unique_ptr<aoo::decoder> decoder;
+        std::unique_ptr<stream_buffer> buffer;
+        block_queue blockqueue;
+        block_ack_list acklist;
+        std::vector<fec_entry> fechistory;
+    };
+    bool make_stream(const sink& s, int32_t nchannels, int32_t blocksize,
+                     int32_t samplerate, int32_t flags, stream_setup& setup);
+    // call with writer lock! returns the buffer to retire after unlocking.
+    // With 'carry' the new buffer can carry on from the current one (see stream_buffer).
+    stream_buffer * install_stream(const sink& s, stream_setup& setup, bool carry = false);
+    void restart_stream(const sink& s);
+    void format_changed(const sink& s, int32_t nchannels);
+    // audio thread
+    stream_buffer * find_playable(const sink& s, stream_buffer& b, int32_t numsampleframes);
+    bool can_play(const sink& s, stream_buffer& b, int32_t numsampleframes) const;
+    void retire_buffer(stream_buffer *b);
+    // call with (shared) lock!
+    stream_buffer& buffer() const { return *buffer_.load(std::memory_order_relaxed); }
+    // audio thread
+    bool do_process(const sink& s, stream_buffer& b, aoo_sample *buffer,
+                    int32_t stride, int32_t numsampleframes);
     // handle messages
+    int32_t do_handle_data(const sink& s, const aoo::data_packet& d);
+
     bool check_packet(const data_packet& d);
 
-    bool add_packet(const data_packet& d);
+    bool is_duplicate(const data_packet& d);
+
+    bool add_packet(const sink& s, const data_packet& d);
 
-    void process_blocks();
+    void tap_block(const sink& s, int32_t sequence, double sr, int32_t channel,
+                   const char *data, int32_t size) const;
+
+    void process_blocks(const sink& s);
+
+    void decode_block(const char *data, int32_t size,
+                      const block_info& info, bool fadein, bool fec = false);
 
     void check_outdated_blocks();
 
     void check_missing_blocks(const sink& s);
+
+    void tap_telemetry(const sink& s, int32_t type, int32_t sequence,
+                       int32_t framenum, time_tag sent = time_tag{}) const;
+
+    void tap_trace(const sink& s, int32_t stage, int32_t sequence, int32_t framenum = -1) const;
+
+    void update_jitter(const sink& s, int32_t seq);
+
+    void update_fill(const sink& s, stream_buffer& b);
+
+    double update_stretch(const sink& s, const stream_buffer& b);
+
+    int32_t max_fill_blocks(int32_t blocksize, int32_t samplerate) const;
     // send messages
     bool send_format_request(const sink& s);
     bool send_codec_change_request(const sink& s);
 
+    bool send_subscription_request(const sink& s);
+
     int32_t send_data_request(const sink& s);
 
     bool send_notifications(const sink& s);
 
+    // replies go out over the path which brought the newest data
     void dosend(const char *data, int32_t n){
-        fn_(endpoint_, data, n);
+        dosend(data, n, replypath_.load());
+    }
+
+    void dosend(const char *data, int32_t n, int32_t path){
+        if (path > 0 && path < numpaths_.load()){
+            paths_[path - 1].fn.load()(paths_[path - 1].endpoint.load(), data, n);
+        } else {
+            fn_(endpoint_, data, n);
+        }
     }
     // data
     void * const endpoint_;
     const aoo_replyfn fn_;
+    // extra paths, only added by the network thread
+    struct source_path {
+        std::atomic<void *> endpoint{nullptr};
+        std::atomic<aoo_replyfn> fn{nullptr};
+    };
+    source_path paths_[AOO_MAXPATHS - 1];
+    std::atomic<int32_t> numpaths_{1};
+    std::atomic<int32_t> replypath_{0};
+    std::atomic<int32_t> pingpath_{0}; // the path of the last ping, which gets the reply
+    std::atomic<double> lastactive_{-1}; // -1 until the send thread first sees it
     const int32_t id_;
     int32_t salt_;
     // audio decoder
@@ -231,23 +356,64 @@ private:
     int32_t channel_ = 0; // recent channel onset
     double samplerate_ = 0; // recent samplerate
     int32_t protocol_flags_ = 0; // protocol flags sent from the remote source
+    // the buffer carries on from the previous one, so the first data mustn't write silence
+    bool carryover_ = false;
+    // the source stopped sending because it is silent (see AOO_PROTOCOL_FLAG_SILENCE),
+    // so running out of blocks is no underrun until data from 'silentseq_' on arrives.
+    std::atomic<bool> silent_{false};
+    std::atomic<int32_t> silentseq_{0};
+    std::atomic<double> silencetime_{0}; // of the last /silence message
+    // the channels we asked the source for, see request_subscription()
+    std::atomic<int32_t> subonset_{0};
+    std::atomic<int32_t> subchannels_{-1}; // < 0: all
     stream_state streamstate_;
     std::vector<char> userformat_;
+    // the last format as received, for the packet tap
+    aoo_format tapformat_;
+    std::string tapcodec_;
+    std::vector<char> tapsettings_;
     // queues and buffers
     block_queue blockqueue_;
     block_ack_list ack_list_;
-    lockfree::queue<aoo_sample> audioqueue_;
-    lockfree::queue<block_info> infoqueue_;
+    // Decoded audio goes to buffer_ (see below). Blocks are decoded as soon
+    // as they are complete, i.e. on the thread that calls handle_message()
+    // (normally the network receive thread), and the audio thread only reads
+    // PCM from the queues there.
     lockfree::queue<data_request> resendqueue_;
     lockfree::queue<event> eventqueue_;
+    // recently received single-frame blocks for FEC, indexed by 'sequence & mask'
+    std::vector<fec_entry> fechistory_;
+    std::vector<char> fecbuffer_;
+    // Only swapped with the writer lock held, so the other threads can use
+    // it like the rest under the (shared) lock, see buffer(). The audio
+    // thread doesn't take the lock: it announces the buffer it works on in
+    // 'playing_', and a replaced buffer is only freed once it is not in there.
+    std::atomic<stream_buffer *> buffer_{nullptr};
+    std::atomic<stream_buffer *> playing_{nullptr};
+    uint32_t generation_ = 0; // of the last buffer made, under the writer lock
+    uint32_t playgeneration_ = 0; // of the buffer process() saw last
     spinlock eventqueuelock_;
-    void push_event(const event& e){
-        scoped_lock<spinlock> l(eventqueuelock_);
-        if (eventqueue_.write_available()){
-            eventqueue_.write(e);
-        }
-    }
-    dynamic_resampler resampler_;
+    void push_event(const sink& s, const event& e);
+    // jitter controller
+    time_tag jitterstart_; // arrival time of 'jitterseq0_'
+    int32_t jitterseq0_ = -1;
+    int32_t jitterseq_ = -1; // most recent sequence
+    double jitterbase_ = 0; // (slowly rising) min. relative arrival time
+    double jitterpeak_ = 0; // decaying peak of the arrival delay
+    double jitterfill_ = -1; // smoothed buffer fill in seconds
+    double jitterstretch_ = 0; // current playback speed deviation
+    std::atomic<float> jittertarget_{0}; // target delay in seconds
+    std::atomic<bool> jitterenabled_{false};
+    // ranked arrival delays and decoded fill, only looked up every so often
+    quantile_histogram jitterhist_; // network thread
+    double jitterhistperiod_ = 0; // block period 'jitterhist_' is set up for
+    int32_t jitterhistcount_ = 0;
+    std::atomic<float> arrivaljitter_{0}; // seconds, 0 until enough are ranked
+    quantile_histogram fillhist_; // audio thread
+    double fillhistperiod_ = 0;
+    int32_t fillhistcount_ = 0;
+    double fill_ = 0; // seconds, as of the last process()
+    std::atomic<float> fillquantile_{0}; // seconds, 0 until enough are ranked
     // thread synchronization
     aoo::shared_mutex mutex_; // LATER replace with a spinlock?
 };
@@ -278,6 +444,16 @@ public:
 
     int32_t handle_events(aoo_eventhandler fn, void *user) override;
 
+    int32_t set_event_notify(aoo_notifyfn fn, void *user) override;
+
+    int32_t set_packet_tap(aoo_packettapfn fn, void *user) override;
+
+    int32_t set_clock(iclock *clock) override;
+
+    int32_t set_telemetry_tap(aoo_telemetryfn fn, void *user) override;
+
+    int32_t set_trace_tap(aoo_tracefn fn, void *user) override;
+
     int32_t set_option(int32_t opt, void *ptr, int32_t size) override;
 
     int32_t get_option(int32_t opt, void *ptr, int32_t size) override;
@@ -289,6 +465,8 @@ public:
                              int32_t opt, void *ptr, int32_t size) override;
                              
     int32_t request_source_codec_change(void *endpoint, int32_t id, aoo_format & f) override;
+
+    int32_t request_source_subscription(void *endpoint, int32_t id, int32_t onset, int32_t nchannels) override;
                              
 
     // getters
@@ -298,7 +476,7 @@ public:
 
     int32_t samplerate() const { return samplerate_; }
 
-    double real_samplerate() const { return ignore_dll_ ? samplerate_ : dll_.samplerate(); }
+    double real_samplerate() const { return ignore_dll_ ? samplerate_ : dll_samplerate(); }
 
     int32_t blocksize() const { return blocksize_; }
 
@@ -318,6 +496,43 @@ public:
 
     int32_t protocol_flags() const { return protocol_flags_; }
 
+    bool jitter_control() const { return jitter_control_.load(std::memory_order_relaxed); }
+
+    double jitter_quantile() const { return jitter_quantile_.load(std::memory_order_relaxed); }
+
+    int32_t resample_quality() const { return resample_quality_.load(std::memory_order_relaxed); }
+
+    bool time_stretch() const { return time_stretch_.load(std::memory_order_relaxed); }
+
+    void notify_event() const { eventnotifier_.notify(); }
+
+    bool has_packet_tap() const { return packettapfn_.load(std::memory_order_acquire) != nullptr; }
+
+    void tap_packet(const aoo_packet_tap_info& info) const {
+        auto fn = packettapfn_.load(std::memory_order_acquire);
+        if (fn){
+            fn(packettapuser_.load(std::memory_order_relaxed), &info);
+        }
+    }
+
+    bool has_telemetry_tap() const { return telemetryfn_.load(std::memory_order_acquire) != nullptr; }
+
+    void tap_telemetry(const aoo_telemetry_info& info) const {
+        auto fn = telemetryfn_.load(std::memory_order_acquire);
+        if (fn){
+            fn(telemetryuser_.load(std::memory_order_relaxed), &info);
+        }
+    }
+
+    bool has_trace_tap() const { return tracefn_.load(std::memory_order_acquire) != nullptr; }
+
+    void tap_trace(const aoo_trace_info& info) const {
+        auto fn = tracefn_.load(std::memory_order_acquire);
+        if (fn){
+            fn(traceuser_.load(std::memory_order_relaxed), &info);
+        }
+    }
+
 private:
     // settings
     std::atomic<int32_t> id_;
@@ -333,31 +548,70 @@ private:
     std::atomic<float> resend_interval_{ AOO_RESEND_INTERVAL * 0.001 };
     std::atomic<int32_t> resend_maxnumframes_{ AOO_RESEND_MAXNUMFRAMES };
     std::atomic<int32_t> protocol_flags_{ 0 };
-    // the sources
+    std::atomic<bool> jitter_control_{ false };
+    std::atomic<float> jitter_quantile_{ AOO_JITTER_QUANTILE };
+    std::atomic<int32_t> resample_quality_{ AOO_RESAMPLE_LINEAR };
+    std::atomic<float> source_timeout_{ AOO_SOURCE_TIMEOUT * 0.001 };
+    std::atomic<bool> time_stretch_{ false };
+    event_notifier eventnotifier_;
+    std::atomic<aoo_packettapfn> packettapfn_{nullptr};
+    std::atomic<void *> packettapuser_{nullptr};
+    std::atomic<aoo_telemetryfn> telemetryfn_{nullptr};
+    std::atomic<void *> telemetryuser_{nullptr};
+    std::atomic<aoo_tracefn> tracefn_{nullptr};
+    std::atomic<void *> traceuser_{nullptr};
+    // the sources, only look at them within a source_guard
     lockfree::list<source_desc> sources_;
+    using source_guard = lockfree::list<source_desc>::read_guard;
+    double lastcollect_ = 0; // send thread
     // timing
     std::atomic<int32_t> dynamic_resampling_{ 1 };
     std::atomic<float> bandwidth_{ AOO_TIMEFILTER_BANDWIDTH };
     time_dll dll_;
     bool ignore_dll_ = false;
     timer timer_;
+    std::atomic<iclock *> clock_{nullptr}; // shared instead of dll_
+    double dll_samplerate() const {
+        auto c = clock_.load(std::memory_order_acquire);
+        return c ? c->get_samplerate() : dll_.samplerate();
+    }
     // helper methods
     source_desc *find_source(void *endpoint, int32_t id);
     source_desc *find_source_by_salt(void *endpoint, int32_t salt);
+    source_desc *find_source_path(void *endpoint, int32_t id, int32_t& path);
+    source_desc *add_source_path(void *endpoint, aoo_replyfn fn, int32_t id,
+                                 int32_t salt, int32_t& path);
 
     void update_sources();
 
+    void collect_sources();
+
     int32_t handle_format_message(void *endpoint, aoo_replyfn fn,
                                   const osc::ReceivedMessage& msg);
 
     int32_t handle_data_message(void *endpoint, aoo_replyfn fn,
                                 const osc::ReceivedMessage& msg);
 
+    int32_t handle_data_message(void *endpoint, aoo_replyfn fn, int32_t id,
+                                int32_t salt, const aoo::data_packet& d, time_tag ping);
+
     int32_t handle_compact_data_message(void *endpoint, aoo_replyfn fn,
                                         const osc::ReceivedMessage& msg);
 
+    int32_t handle_compact_data_message(void *endpoint, aoo_replyfn fn, int32_t salt,
+                                        const aoo::data_packet& d, time_tag ping);
+
     int32_t handle_ping_message(void *endpoint, aoo_replyfn fn,
                                 const osc::ReceivedMessage& msg);
+
+    int32_t handle_parity_message(void *endpoint, aoo_replyfn fn,
+                                  const osc::ReceivedMessage& msg);
+
+    int32_t handle_silence_message(void *endpoint, aoo_replyfn fn,
+                                   const osc::ReceivedMessage& msg);
+
+    int32_t handle_pack_message(void *endpoint, aoo_replyfn fn,
+                                const osc::ReceivedMessage& msg);
 };
 
 } // aoo
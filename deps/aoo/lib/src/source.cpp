@@ -9,13 +9,19 @@
 #include <algorithm>
 #include <random>
 #include <cmath>
+#include <thread>
 
 /*//////////////////// AoO source /////////////////////*/
 
-#define AOO_DATA_HEADERSIZE 80
+#define AOO_DATA_HEADERSIZE 88
 // address pattern string: max 32 bytes
 // typetag string: max. 12 bytes
 // args (without blob data): 36 bytes
+// optional ping time tag: 8 bytes
+
+#define AOO_PACK_BLOCKOVERHEAD 8
+// for every block of a /pack message (on top of AOO_DATA_HEADERSIZE):
+// typetag: 1 byte, blob size: 4 bytes, blob padding: max. 3 bytes
 
 aoo_source * aoo_source_new(int32_t id) {
     return new aoo::source(id);
@@ -37,7 +43,9 @@ void aoo_source_free(aoo_source *src){
     delete static_cast<aoo::source *>(src);
 }
 
-aoo::source::~source() {}
+aoo::source::~source() {
+    delete buffer_.load();
+}
 
 template<typename T>
 T& as(void *p){
@@ -59,7 +67,6 @@ int32_t aoo::source::set_option(int32_t opt, void *ptr, int32_t size)
     {
         auto newid = as<int32_t>(ptr);
         if (id_.exchange(newid) != newid){
-            unique_lock lock(update_mutex_); // writer lock!
             update();
         }
         break;
@@ -70,12 +77,9 @@ int32_t aoo::source::set_option(int32_t opt, void *ptr, int32_t size)
         break;
     // resume
     case aoo_opt_start:
-    {
-        unique_lock lock(update_mutex_); // writer lock!
         update();
         play_ = true;
         break;
-    }
     // format
     case aoo_opt_format:
         CHECKARG(aoo_format);
@@ -87,7 +91,6 @@ int32_t aoo::source::set_option(int32_t opt, void *ptr, int32_t size)
         auto bufsize = std::max<int32_t>(as<int32_t>(ptr), 0);
         if (bufsize != buffersize_){
             buffersize_ = bufsize;
-            unique_lock lock(update_mutex_); // writer lock!
             update();
         }
         break;
@@ -145,10 +148,29 @@ int32_t aoo::source::set_option(int32_t opt, void *ptr, int32_t size)
         // limit it somehow, 16 times is already very high
         redundancy_ = std::max<int32_t>(1, std::min<int32_t>(16, as<int32_t>(ptr)));
         break;
+    // bitrate
+    case aoo_opt_bitrate:
+        CHECKARG(int32_t);
+        bitrate_ = std::max<int32_t>(0, as<int32_t>(ptr));
+        break;
+    // complexity
+    case aoo_opt_complexity:
+        CHECKARG(int32_t);
+        complexity_ = std::max<int32_t>(-1, as<int32_t>(ptr));
+        break;
     case aoo_opt_respect_codec_change_requests:
         CHECKARG(int32_t);
         respect_codec_change_req_ = as<int32_t>(ptr);
         break;
+    // resend budget
+    case aoo_opt_resend_budget:
+        CHECKARG(float);
+        resend_budget_ = std::max<float>(0, as<float>(ptr));
+        break;
+    case aoo_opt_resend_total_budget:
+        CHECKARG(float);
+        resend_total_budget_ = std::max<float>(0, as<float>(ptr));
+        break;
     // format
     case aoo_opt_userformat:
         return set_userformat(ptr, size);
@@ -175,14 +197,16 @@ int32_t aoo::source::get_option(int32_t opt, void *ptr, int32_t size)
         break;
     // format
     case aoo_opt_format:
+    {
         CHECKARG(aoo_format_storage);
+        shared_lock lock(update_mutex_); // read lock!
         if (encoder_){
-            shared_lock lock(update_mutex_); // read lock!
             return encoder_->get_format(as<aoo_format_storage>(ptr));
         } else {
             return 0;
         }
         break;
+    }
     // buffer size
     case aoo_opt_buffersize:
         CHECKARG(int32_t);
@@ -213,6 +237,25 @@ int32_t aoo::source::get_option(int32_t opt, void *ptr, int32_t size)
         CHECKARG(int32_t);
         as<int32_t>(ptr) = redundancy_;
         break;
+    // bitrate
+    case aoo_opt_bitrate:
+        CHECKARG(int32_t);
+        as<int32_t>(ptr) = bitrate_;
+        break;
+    // complexity
+    case aoo_opt_complexity:
+        CHECKARG(int32_t);
+        as<int32_t>(ptr) = complexity_;
+        break;
+    // resend budget
+    case aoo_opt_resend_budget:
+        CHECKARG(float);
+        as<float>(ptr) = resend_budget_;
+        break;
+    case aoo_opt_resend_total_budget:
+        CHECKARG(float);
+        as<float>(ptr) = resend_total_budget_;
+        break;
     // unknown
     default:
         LOG_WARNING("aoo_source: unsupported option " << opt);
@@ -230,6 +273,30 @@ int32_t aoo_source_set_sinkoption(aoo_source *src, void *endpoint, int32_t id,
 int32_t aoo::source::set_sinkoption(void *endpoint, int32_t id,
                                    int32_t opt, void *ptr, int32_t size)
 {
+    if (opt == aoo_opt_source_alias){
+        // writer lock, because the alias is copied along with the sink descriptor
+        CHECKARG(int32_t);
+        if (id == AOO_ID_WILDCARD){
+            LOG_ERROR("aoo_source: can't use wildcard to set source alias");
+            return 0;
+        }
+        unique_lock lock(sink_mutex_);
+        auto sink = find_sink(endpoint, id);
+        if (sink){
+            sink->alias = as<int32_t>(ptr);
+            // the sink should get the format with the new source ID
+            sink->format_changed = true;
+            format_changed_ = true;
+            LOG_VERBOSE("aoo_source: source alias " << sink->alias
+                        << " for sink " << sink->id);
+            return 1;
+        } else {
+            LOG_ERROR("aoo_source: couldn't set sink option "
+                      << opt << " - sink not found!");
+            return 0;
+        }
+    }
+
     if (id == AOO_ID_WILDCARD){
         // set option on all sinks on the given endpoint
         switch (opt){
@@ -247,6 +314,39 @@ int32_t aoo::source::set_sinkoption(void *endpoint, int32_t id,
             LOG_VERBOSE("aoo_source: send to all sinks on channel " << chn);
             break;
         }
+        // FEC group size
+        case aoo_opt_fec_group:
+        {
+            CHECKARG(int32_t);
+            auto n = as<int32_t>(ptr);
+            n = n >= 2 ? std::min<int32_t>(n, AOO_FEC_MAXGROUP) : 0;
+            shared_lock lock(sink_mutex_); // reader lock!
+            for (auto& sink : sinks_){
+                if (sink.user == endpoint){
+                    sink.fec_group = n;
+                    // the sink needs to know about it
+                    sink.format_changed = true;
+                }
+            }
+            format_changed_ = true;
+            LOG_VERBOSE("aoo_source: FEC group size " << n << " for all sinks");
+            break;
+        }
+        // redundancy
+        case aoo_opt_redundancy:
+        {
+            CHECKARG(int32_t);
+            auto n = std::max<int32_t>(0, std::min<int32_t>(16, as<int32_t>(ptr)));
+            shared_lock lock(sink_mutex_); // reader lock!
+            for (auto& sink : sinks_){
+                if (sink.user == endpoint){
+                    sink.redundancy = n;
+                    sink.update_redundancy();
+                }
+            }
+            LOG_VERBOSE("aoo_source: redundancy " << n << " for all sinks");
+            break;
+        }
         // unknown
         default:
             LOG_WARNING("aoo_source: unsupported sink option " << opt);
@@ -283,6 +383,57 @@ int32_t aoo::source::set_sinkoption(void *endpoint, int32_t id,
                             << " flags " << flags);
                 break;
             }
+            // FEC group size
+            case aoo_opt_fec_group:
+            {
+                CHECKARG(int32_t);
+                auto n = as<int32_t>(ptr);
+                n = n >= 2 ? std::min<int32_t>(n, AOO_FEC_MAXGROUP) : 0;
+                if (sink->fec_group.exchange(n) != n){
+                    // the sink needs to know about it
+                    sink->format_changed = true;
+                    format_changed_ = true;
+                }
+                LOG_VERBOSE("aoo_source: FEC group size " << n << " for sink " << sink->id);
+                break;
+            }
+            // multi-path mode
+            case aoo_opt_path_mode:
+            {
+                CHECKARG(int32_t);
+                auto mode = as<int32_t>(ptr) == AOO_PATH_SPLIT ? AOO_PATH_SPLIT : AOO_PATH_DUPLICATE;
+                sink->path_mode = mode;
+                LOG_VERBOSE("aoo_source: path mode " << mode << " for sink " << sink->id);
+                break;
+            }
+            // resend deadline
+            case aoo_opt_resend_deadline:
+            {
+                CHECKARG(int32_t);
+                auto ms = std::max<int32_t>(0, as<int32_t>(ptr));
+                sink->resend_deadline = ms;
+                LOG_VERBOSE("aoo_source: resend deadline " << ms << " ms for sink " << sink->id);
+                break;
+            }
+            // pack limit
+            case aoo_opt_pack_limit:
+            {
+                CHECKARG(int32_t);
+                auto n = std::max<int32_t>(1, std::min<int32_t>(as<int32_t>(ptr), AOO_PACK_MAXBLOCKS));
+                sink->pack_limit = n;
+                LOG_VERBOSE("aoo_source: pack limit " << n << " for sink " << sink->id);
+                break;
+            }
+            // redundancy
+            case aoo_opt_redundancy:
+            {
+                CHECKARG(int32_t);
+                auto n = std::max<int32_t>(0, std::min<int32_t>(16, as<int32_t>(ptr)));
+                sink->redundancy = n;
+                sink->update_redundancy();
+                LOG_VERBOSE("aoo_source: redundancy " << n << " for sink " << sink->id);
+                break;
+            }
             // unknown
             default:
                 LOG_WARNING("aoo_source: unknown sink option " << opt);
@@ -320,6 +471,41 @@ int32_t aoo::source::get_sinkoption(void *endpoint, int32_t id,
             CHECKARG(int32_t);
             as<int32_t>(p) = sink->channel;
             break;
+        // FEC group size
+        case aoo_opt_fec_group:
+            CHECKARG(int32_t);
+            as<int32_t>(p) = sink->fec_group;
+            break;
+        // source alias
+        case aoo_opt_source_alias:
+            CHECKARG(int32_t);
+            as<int32_t>(p) = sink->alias;
+            break;
+        // multi-path mode
+        case aoo_opt_path_mode:
+            CHECKARG(int32_t);
+            as<int32_t>(p) = sink->path_mode;
+            break;
+        // best path
+        case aoo_opt_best_path:
+            CHECKARG(int32_t);
+            as<int32_t>(p) = sink->best_path;
+            break;
+        // resend deadline
+        case aoo_opt_resend_deadline:
+            CHECKARG(int32_t);
+            as<int32_t>(p) = sink->resend_deadline;
+            break;
+        // pack limit
+        case aoo_opt_pack_limit:
+            CHECKARG(int32_t);
+            as<int32_t>(p) = sink->pack_limit;
+            break;
+        // redundancy
+        case aoo_opt_redundancy:
+            CHECKARG(int32_t);
+            as<int32_t>(p) = sink->redundancy;
+            break;
         // unknown
         default:
             LOG_WARNING("aoo_source: unsupported sink option " << opt);
@@ -340,15 +526,19 @@ int32_t aoo_source_setup(aoo_source *src, int32_t samplerate,
 
 int32_t aoo::source::setup(int32_t samplerate,
                            int32_t blocksize, int32_t nchannels){
-    unique_lock lock(update_mutex_); // writer lock!
     if (samplerate > 0 && blocksize > 0 && nchannels > 0)
     {
-        nchannels_ = nchannels;
-        samplerate_ = samplerate;
-        blocksize_ = blocksize;
-
-        // reset timer + time DLL filter
-        timer_.setup(samplerate_, blocksize_);
+        {
+            unique_lock lock(update_mutex_); // writer lock!
+            nchannels_ = nchannels;
+            samplerate_ = samplerate;
+            blocksize_ = blocksize;
+            // the current buffers are outdated, see update()
+            ++generation_;
+
+            // reset timer + time DLL filter
+            timer_.setup(samplerate_, blocksize_);
+        }
 
         update();
 
@@ -422,6 +612,66 @@ int32_t aoo::source::remove_sink(void *endpoint, int32_t id){
     }
 }
 
+int32_t aoo_source_add_sink_path(aoo_source *src, void *sink, int32_t id,
+                                 void *path, aoo_replyfn fn) {
+    return src->add_sink_path(sink, id, path, fn);
+}
+
+int32_t aoo::source::add_sink_path(void *endpoint, int32_t id, void *path, aoo_replyfn fn){
+    unique_lock lock(sink_mutex_); // writer lock!
+    auto sink = find_sink(endpoint, id);
+    if (!sink || sink->id == AOO_ID_WILDCARD){
+        LOG_WARNING("aoo_source: can't add path - sink not found!");
+        return 0;
+    }
+    for (int32_t i = 1; i < sink->num_paths; ++i){
+        if (sink->extra_paths[i - 1].user == path){
+            return 0; // already added
+        }
+    }
+    if (path == endpoint || sink->num_paths >= AOO_MAXPATHS){
+        LOG_WARNING("aoo_source: can't add another path to sink " << id);
+        return 0;
+    }
+    auto i = sink->num_paths++;
+    sink->extra_paths[i - 1] = sink_path { path, fn };
+    sink->path_rtt[i] = -1.f;
+    sink->path_reply[i] = 0;
+    LOG_VERBOSE("aoo_source: added path " << i << " to sink " << id);
+    return 1;
+}
+
+int32_t aoo_source_remove_sink_path(aoo_source *src, void *sink, int32_t id, void *path) {
+    return src->remove_sink_path(sink, id, path);
+}
+
+int32_t aoo::source::remove_sink_path(void *endpoint, int32_t id, void *path){
+    unique_lock lock(sink_mutex_); // writer lock!
+    auto sink = find_sink(endpoint, id);
+    if (!sink){
+        return 0;
+    }
+    // never more than there is room for, so the shifts below stay in bounds
+    const int32_t num_paths = std::min<int32_t>(sink->num_paths, AOO_MAXPATHS);
+    for (int32_t i = 1; i < num_paths; ++i){
+        if (sink->extra_paths[i - 1].user == path){
+            // move the later paths down: extra_paths[i .. num_paths - 2]
+            // go to [i - 1 .. num_paths - 3], the path stats with them
+            std::copy(sink->extra_paths + i, sink->extra_paths + (num_paths - 1),
+                      sink->extra_paths + (i - 1));
+            for (int32_t j = i; j + 1 < num_paths; ++j){
+                sink->path_rtt[j] = sink->path_rtt[j + 1].load();
+                sink->path_reply[j] = sink->path_reply[j + 1].load();
+            }
+            sink->num_paths = num_paths - 1;
+            sink->best_path = 0; // until the next ping replies
+            LOG_VERBOSE("aoo_source: removed path " << i << " from sink " << id);
+            return 1;
+        }
+    }
+    return 0;
+}
+
 void aoo_source_remove_all(aoo_source *src) {
     src->remove_all();
 }
@@ -456,7 +706,7 @@ int32_t aoo::source::handle_message(const char *data, int32_t n, void *endpoint,
             LOG_WARNING("aoo_source: can't handle wildcard messages (yet)!");
             return 0;
         }
-        if (src != id()){
+        if (src != id() && !has_alias(src)){
             LOG_WARNING("aoo_source: wrong source ID!");
             return 0;
         }
@@ -480,6 +730,9 @@ int32_t aoo::source::handle_message(const char *data, int32_t n, void *endpoint,
         } else if (!strcmp(pattern, AOO_MSG_CODEC_CHANGE)){
             handle_codec_change(endpoint, fn, msg);
             return 1;
+        } else if (!strcmp(pattern, AOO_MSG_SUBSCRIBE)){
+            handle_subscribe(endpoint, fn, msg);
+            return 1;
         } else {
             LOG_WARNING("unknown message " << pattern);
         }
@@ -493,6 +746,10 @@ int32_t aoo_source_send(aoo_source *src) {
     return src->send();
 }
 
+int32_t aoo_source_try_send(aoo_source *src) {
+    return src->try_send();
+}
+
 // This method reads audio samples from the ringbuffer,
 // encodes them and sends them to all sinks.
 // We have to aquire both the update lock and the sink list lock
@@ -511,7 +768,7 @@ int32_t aoo::source::send(){
         didsomething = true;
     }
 
-    if (send_data()){
+    if (send_data() > 0){
         didsomething = true;
     }
 
@@ -526,6 +783,13 @@ int32_t aoo::source::send(){
     return didsomething;
 }
 
+int32_t aoo::source::try_send(){
+    if (!play_.load() && !activeplay_.load()){
+        return false;
+    }
+    return send_data(true);
+}
+
 int32_t aoo_source_process(aoo_source *src, const aoo_sample **data, int32_t n, uint64_t t) {
     return src->process(data, n, t);
 }
@@ -535,49 +799,57 @@ int32_t aoo::source::process(const aoo_sample **data, int32_t n, uint64_t t){
         return 0; // pausing
     }
 
-    // update time DLL filter
-    double error;
-    auto state = timer_.update(t, error);
-    if (state == timer::state::reset){
-        LOG_DEBUG("setup time DLL filter for source");
-        dll_.setup(samplerate_, blocksize_, bandwidth_, 0);
-    } else if (state == timer::state::error){
-        // skip blocks
-        double period = (double)blocksize_ / (double)samplerate_;
-        int nblocks = error / period + 0.5;
-        LOG_VERBOSE("skip " << nblocks << " blocks");
-        dropped_ += nblocks;
-        timer_.reset();
-    } else {
-        auto elapsed = timer_.get_elapsed();
-        dll_.update(elapsed);
-    #if AOO_DEBUG_DLL
-        DO_LOG("time elapsed: " << elapsed << ", period: " << dll_.period()
-               << ", samplerate: " << dll_.samplerate());
-    #endif
+    update_timer(t);
+
+    // No lock: set_format() and update() install a new buffer and only
+    // free the old one once we're done with it, see retire_buffer().
+    auto b = acquire_buffer();
+    int32_t result = 0;
+    if (b){
+        result = do_process(*b, data, n, 0);
+    }
+    release_buffer();
+
+    return result;
+}
+
+int32_t aoo_source_process_resampled(aoo_source *src, const aoo_sample **data, int32_t n,
+                                     int32_t samplerate, uint64_t t) {
+    return src->process_resampled(data, n, samplerate, t);
+}
+
+int32_t aoo::source::process_resampled(const aoo_sample **data, int32_t n,
+                                       int32_t samplerate, uint64_t t){
+    if (!play_ && !activeplay_){
+        return 0; // pausing
+    }
+
+    update_timer(t);
+
+    // no lock, see process()
+    auto b = acquire_buffer();
+    int32_t result = 0;
+    if (b){
+        result = do_process(*b, data, n, samplerate > 0 ? samplerate : 0);
     }
+    release_buffer();
 
+    return result;
+}
+
+int32_t aoo::source::do_process(stream_buffer& b, const aoo_sample **data, int32_t n, int32_t samplerate){
     // if the DLL samplerate is any more than +/- 10% of our nominal, we'll ignore it
     // some shenanigans are going on
     bool ignoredll = !dynamic_resampling_.load();;
-    if (fabs(dll_.samplerate() - (double)samplerate_) > 0.1*samplerate_) {
+    if (fabs(dll_samplerate() - (double)samplerate_) > 0.1*samplerate_) {
         ignoredll = true;
     }
-    
-    
-    // the mutex should be uncontended most of the time.
-    // NOTE: We could use try_lock() and skip the block if we couldn't aquire the lock.
-    shared_lock lock(update_mutex_);
-
-    if (!encoder_){
-        return 0;
-    }
 
      bool dofadein = play_ && !lastplay_;
      bool dofadeout = !play_ && lastplay_;
      
      if (dofadeout) {
-         pushing_silent_frames_ = 4 * encoder_->blocksize();
+         pushing_silent_frames_ = 4 * b.blocksize;
          LOG_VERBOSE("do play fadeout, pushing silent: " << pushing_silent_frames_);
      }
      if (dofadein) {
@@ -607,24 +879,25 @@ int32_t aoo::source::process(const aoo_sample **data, int32_t n, uint64_t t){
     
     // non-interleaved -> interleaved
     //auto insamples = blocksize_ * nchannels_;
-    auto insamples = n * nchannels_;
-    auto outsamples = audioqueue_.blocksize(); // encoder_->blocksize() * nchannels_;
+    auto nchannels = b.nchannels;
+    auto insamples = n * nchannels;
+    auto outsamples = b.audioqueue.blocksize(); // b.blocksize * nchannels
     auto *buf = (aoo_sample *)alloca(insamples * sizeof(aoo_sample));
 
     if (n > 0 && (dofadein || dofadeout || pushingSilence)) {
         const float fadedelta = dofadeout ? (-1.0f / n) : pushingSilence ? 0.0f : (1.0f / n);
         
-        for (int i = 0; i < nchannels_; ++i){
+        for (int i = 0; i < nchannels; ++i){
             float gain = dofadeout ? 1.0f : 0.0f;
             for (int j = 0; j < n; ++j){
-                buf[j * nchannels_ + i] = data[i][j] * gain;
+                buf[j * nchannels + i] = data[i][j] * gain;
                 gain += fadedelta;
             }
         }
     } else {
-        for (int i = 0; i < nchannels_; ++i){
+        for (int i = 0; i < nchannels; ++i){
             for (int j = 0; j < n; ++j){
-                buf[j * nchannels_ + i] = data[i][j];
+                buf[j * nchannels + i] = data[i][j];
             }
         }
     }
@@ -635,49 +908,56 @@ int32_t aoo::source::process(const aoo_sample **data, int32_t n, uint64_t t){
     // back calling with fewer samples. More importantly, this allows us to better decouple 
     // the audio process blocksize from the audioqueue blocksize (which matches the codec blocksize).
 
-    //if (encoder_->blocksize() != blocksize_ || encoder_->samplerate() != samplerate_)
+    // the caller can switch between resampled and plain input
+    // from one call to the next, the buffered audio just goes on.
+    if (samplerate != b.insamplerate){
+        b.resampler.update(samplerate > 0 ? samplerate : samplerate_, b.samplerate);
+        b.insamplerate = samplerate;
+    }
+
+    //if (b.blocksize != blocksize_ || b.samplerate != samplerate_)
     {
         // go through resampler
         auto samplesleft = insamples;
         auto * pbuf = buf;
 
-        auto availsamples = resampler_.write_available();
+        auto availsamples = b.resampler.write_available();
         
         while (samplesleft > 0) {
             auto usesamples = std::min(samplesleft, availsamples);
             
-            resampler_.write(pbuf, usesamples);
+            b.resampler.write(pbuf, usesamples);
 
             samplesleft -= usesamples;
             pbuf += usesamples;
             
             bool didconsume = false;
             
-            while (resampler_.read_available() >= outsamples
-                   && audioqueue_.write_available()
-                   && srqueue_.write_available())
+            while (b.resampler.read_available() >= outsamples
+                   && b.audioqueue.write_available()
+                   && b.srqueue.write_available())
             {
                 // copy audio samples
-                resampler_.read(audioqueue_.write_data(), outsamples);
-                audioqueue_.write_commit();
+                b.resampler.read(b.audioqueue.write_data(), outsamples);
+                b.audioqueue.write_commit();
                 
                 // push samplerate
                 if (!ignoredll) {
-                    auto ratio = (double)encoder_->samplerate() / (double)samplerate_;
-                    srqueue_.write(dll_.samplerate() * ratio);
+                    auto ratio = (double)b.samplerate / (double)samplerate_;
+                    b.srqueue.write(dll_samplerate() * ratio);
                 } else {
-                    srqueue_.write(encoder_->samplerate());
+                    b.srqueue.write(b.samplerate);
                 }
 
                 didconsume = true;
             }
 
             // now update after any processing
-            availsamples = resampler_.write_available();
+            availsamples = b.resampler.write_available();
             
             if (!didconsume && samplesleft > availsamples) {
                 // didn't consume any, and we can't fit any more
-                //LOG_WARNING("resampler could not handle all input samples, " << samplesleft << " unprocessed, avail " << availsamples << " audioqu_wravail: " << audioqueue_.write_available()  << " audqbs: " << audioqueue_.blocksize() << " encbs: " << encoder_->blocksize());
+                //LOG_WARNING("resampler could not handle all input samples, " << samplesleft << " unprocessed, avail " << availsamples << " audioqu_wravail: " << b.audioqueue.write_available()  << " audqbs: " << b.audioqueue.blocksize() << " encbs: " << b.blocksize);
                 break;
             }
         }
@@ -685,13 +965,13 @@ int32_t aoo::source::process(const aoo_sample **data, int32_t n, uint64_t t){
 #if 0
     else {
         // bypass resampler
-        if (audioqueue_.write_available() && srqueue_.write_available()){
+        if (b.audioqueue.write_available() && b.srqueue.write_available()){
             // copy audio samples
-            std::copy(buf, buf + outsamples, audioqueue_.write_data());
-            audioqueue_.write_commit();
+            std::copy(buf, buf + outsamples, b.audioqueue.write_data());
+            b.audioqueue.write_commit();
 
             // push samplerate
-            srqueue_.write(dll_.samplerate());
+            b.srqueue.write(dll_samplerate());
         } else {
             // LOG_DEBUG("couldn't process");
         }
@@ -705,6 +985,53 @@ int32_t aoo::source::process(const aoo_sample **data, int32_t n, uint64_t t){
     return 1;
 }
 
+int32_t aoo_source_process_encoded(aoo_source *src, const char *data, int32_t size, uint64_t t) {
+    return src->process_encoded(data, size, t);
+}
+
+// The block is sent as it is, so it has to be encoded with the current format.
+// There is no fading, the caller has to take care of starting and stopping.
+int32_t aoo::source::process_encoded(const char *data, int32_t size, uint64_t t){
+    if (!play_ && !activeplay_){
+        return 0; // pausing
+    }
+
+    update_timer(t);
+
+    // no lock, see process()
+    auto b = acquire_buffer();
+    if (!b){
+        release_buffer();
+        return 0;
+    }
+
+    int32_t result = 1;
+    lastplay_ = play_;
+    if (play_) {
+        activeplay_ = true;
+        if (data && size > 0){
+            auto maxsize = b->encodedqueue.blocksize() - (int32_t)sizeof(int32_t);
+            if (size <= maxsize && b->encodedqueue.write_available()){
+                auto slot = b->encodedqueue.write_data();
+                memcpy(slot, &size, sizeof(int32_t));
+                memcpy(slot + sizeof(int32_t), data, size);
+                b->encodedqueue.write_commit();
+            } else {
+                LOG_VERBOSE("aoo_source: couldn't queue encoded block");
+                result = 0;
+            }
+        } // else: no block due
+    } else {
+        // activeplay_ will be set to false in the sending when it runs out of data
+        flushingout_ = 1;
+        result = 0;
+    }
+
+    release_buffer();
+
+    return result;
+}
+
 int32_t aoo_source_events_available(aoo_source *src){
     return src->events_available();
 }
@@ -724,9 +1051,7 @@ int32_t aoo::source::handle_events(aoo_eventhandler fn, void *user){
     if (n > 0){
         // copy events
         auto events = (event *)alloca(sizeof(event) * n);
-        for (int i = 0; i < n; ++i){
-            eventqueue_.read(events[i]);
-        }
+        eventqueue_.read_n(events, n);
         auto vec = (const aoo_event **)alloca(sizeof(aoo_event *) * n);
         for (int i = 0; i < n; ++i){
             vec[i] = (aoo_event *)&events[i];
@@ -737,13 +1062,34 @@ int32_t aoo::source::handle_events(aoo_eventhandler fn, void *user){
     return n;
 }
 
+int32_t aoo_source_set_event_notify(aoo_source *src, aoo_notifyfn fn, void *user){
+    return src->set_event_notify(fn, user);
+}
+
+int32_t aoo::source::set_event_notify(aoo_notifyfn fn, void *user){
+    eventnotifier_.set(fn, user);
+    return 1;
+}
+
+int32_t aoo_source_set_clock(aoo_source *src, aoo_clock *clock){
+    return src->set_clock(clock);
+}
+
+int32_t aoo::source::set_clock(iclock *clock){
+    if (clock_.exchange(clock) && !clock){
+        timer_.reset(); // sets up our own DLL again
+    }
+    return 1;
+}
+
 namespace aoo {
 
 /*//////////////////////////////// endpoint /////////////////////////////////////*/
 
-// /aoo/sink/<id>/data <src> <salt> <seq> <sr> <channel_onset> <totalsize> <nframes> <frame> <data>
+// /aoo/sink/<id>/data <src> <salt> <seq> <sr> <channel_onset> <totalsize> <nframes> <frame> <data> [<ping>]
 
-void endpoint::send_data(int32_t src, int32_t salt, const aoo::data_packet& d) const{
+void endpoint::send_data(int32_t src, int32_t salt, const aoo::data_packet& d,
+                         time_tag ping) const{
     // call without lock!
 
     char buf[AOO_MAXPACKETSIZE];
@@ -761,9 +1107,13 @@ void endpoint::send_data(int32_t src, int32_t salt, const aoo::data_packet& d) c
         msg << osc::BeginMessage(AOO_MSG_DOMAIN AOO_MSG_SINK AOO_MSG_WILDCARD AOO_MSG_DATA);
     }
 
-    msg << src << salt << d.sequence << d.samplerate << d.channel
+    msg << source_id(src) << salt << d.sequence << d.samplerate << d.channel
         << d.totalsize << d.nframes << d.framenum
-        << osc::Blob(d.data, d.size) << osc::EndMessage;
+        << osc::Blob(d.data, d.size);
+    if (!ping.empty()){
+        msg << osc::TimeTag(ping.to_uint64());
+    }
+    msg << osc::EndMessage;
 
     LOG_DEBUG("send block: seq = " << d.sequence << ", sr = " << d.samplerate
               << ", chn = " << d.channel << ", totalsize = " << d.totalsize
@@ -773,10 +1123,11 @@ void endpoint::send_data(int32_t src, int32_t salt, const aoo::data_packet& d) c
     send(msg.Data(), (int32_t)msg.Size());
 }
 
-// /d <salt> <seq> <data>
-// /d <salt> <seq> <srate> <data>
+// /d <salt> <seq> <data> [<ping>]
+// /d <salt> <seq> <srate> <data> [<ping>]
 
-void endpoint::send_data_compact(int32_t src, int32_t salt, const aoo::data_packet& d, bool sendrate) {
+void endpoint::send_data_compact(int32_t src, int32_t salt, const aoo::data_packet& d, bool sendrate,
+                                 time_tag ping) {
     // call without lock!
 
     char buf[AOO_MAXPACKETSIZE];
@@ -793,7 +1144,13 @@ void endpoint::send_data_compact(int32_t src, int32_t salt, const aoo::data_pack
         msg << d.samplerate;
     }
     
-    msg << osc::Blob(d.data, d.size) << osc::EndMessage;
+    msg << osc::Blob(d.data, d.size);
+
+    if (!ping.empty()){
+        msg << osc::TimeTag(ping.to_uint64());
+    }
+
+    msg << osc::EndMessage;
 
     LOG_DEBUG("send compact block: seq = " << d.sequence << ", sr = " << d.samplerate
               << ", chn = " << d.channel << ", totalsize = " << d.totalsize
@@ -806,7 +1163,8 @@ void endpoint::send_data_compact(int32_t src, int32_t salt, const aoo::data_pack
 // /aoo/sink/<id>/format <src> <version> <salt> <numchannels> <samplerate> <blocksize> <codec> <options...> [<userformat..>]
 
 void endpoint::send_format(int32_t src, int32_t salt, const aoo_format& f,
-                            const char *options, int32_t size, const char * userformat, int32_t ufsize) const {
+                            const char *options, int32_t size, const char * userformat, int32_t ufsize,
+                            int32_t flags) const {
     // call without lock!
     LOG_DEBUG("send format to " << id << " (salt = " << salt << ")");
 
@@ -825,7 +1183,7 @@ void endpoint::send_format(int32_t src, int32_t salt, const aoo_format& f,
         msg << osc::BeginMessage(AOO_MSG_DOMAIN AOO_MSG_SINK AOO_MSG_WILDCARD AOO_MSG_FORMAT);
     }
 
-    msg << src << (int32_t)make_version(AOO_PROTOCOL_FLAG_COMPACT_DATA) << salt << f.nchannels << f.samplerate << f.blocksize
+    msg << source_id(src) << (int32_t)make_version(flags) << salt << f.nchannels << f.samplerate << f.blocksize
     << f.codec << osc::Blob(options, size);
 
     if (userformat && ufsize > 0) {
@@ -837,6 +1195,36 @@ void endpoint::send_format(int32_t src, int32_t salt, const aoo_format& f,
     send(msg.Data(), (int32_t)msg.Size());
 }
 
+// /aoo/sink/<id>/parity <src> <salt> <firstseq> <count> <sizexor> <data>
+
+void endpoint::send_parity(int32_t src, int32_t salt, int32_t firstseq, int32_t count,
+                           int32_t sizexor, const char *data, int32_t size) const {
+    // call without lock!
+
+    char buf[AOO_MAXPACKETSIZE];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+
+    if (id != AOO_ID_WILDCARD){
+        const int32_t max_addr_size = AOO_MSG_DOMAIN_LEN
+                + AOO_MSG_SINK_LEN + 16 + AOO_MSG_PARITY_LEN;
+        char address[max_addr_size];
+        snprintf(address, sizeof(address), "%s%s/%d%s",
+                 AOO_MSG_DOMAIN, AOO_MSG_SINK, id, AOO_MSG_PARITY);
+
+        msg << osc::BeginMessage(address);
+    } else {
+        msg << osc::BeginMessage(AOO_MSG_DOMAIN AOO_MSG_SINK AOO_MSG_WILDCARD AOO_MSG_PARITY);
+    }
+
+    msg << source_id(src) << salt << firstseq << count << sizexor
+        << osc::Blob(data, size) << osc::EndMessage;
+
+    LOG_DEBUG("send parity: seq = " << firstseq << " - " << (firstseq + count - 1)
+              << ", size = " << size);
+
+    send(msg.Data(), (int32_t)msg.Size());
+}
+
 // /aoo/sink/<id>/ping <src> <time>
 
 void endpoint::send_ping(int32_t src, time_tag t) const {
@@ -858,44 +1246,111 @@ void endpoint::send_ping(int32_t src, time_tag t) const {
         msg << osc::BeginMessage(AOO_MSG_DOMAIN AOO_MSG_SINK AOO_MSG_WILDCARD AOO_MSG_PING);
     }
 
-    msg << src << osc::TimeTag(t.to_uint64()) << osc::EndMessage;
+    msg << source_id(src) << osc::TimeTag(t.to_uint64()) << osc::EndMessage;
 
     send(msg.Data(), (int32_t)msg.Size());
 }
 
-/*///////////////////////// source ////////////////////////////////*/
+// /aoo/sink/<id>/silence <src> <salt> <seq>
 
-sink_desc * source::find_sink(void *endpoint, int32_t id){
-    for (auto& sink : sinks_){
-        if ((sink.user == endpoint) &&
-            (sink.id == AOO_ID_WILDCARD || sink.id == id))
-        {
-            return &sink;
-        }
-    }
-    return nullptr;
-}
+void endpoint::send_silence(int32_t src, int32_t salt, int32_t seq) const {
+    // call without lock!
+    LOG_DEBUG("send silence to " << id << ": seq = " << seq);
 
-int32_t source::set_format(aoo_format &f){
-    unique_lock lock(update_mutex_); // writer lock!
-    if (!encoder_ || strcmp(encoder_->name(), f.codec)){
-        auto codec = aoo::find_codec(f.codec);
-        if (codec){
-            encoder_ = codec->create_encoder();
-        } else {
-            LOG_ERROR("codec '" << f.codec << "' not supported!");
-            return 0;
-        }
-        if (!encoder_){
-            LOG_ERROR("couldn't create encoder!");
-            return 0;
-        }
+    char buf[AOO_MAXPACKETSIZE];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+
+    if (id != AOO_ID_WILDCARD){
+        const int32_t max_addr_size = AOO_MSG_DOMAIN_LEN
+                + AOO_MSG_SINK_LEN + 16 + AOO_MSG_SILENCE_LEN;
+        char address[max_addr_size];
+        snprintf(address, sizeof(address), "%s%s/%d%s",
+                 AOO_MSG_DOMAIN, AOO_MSG_SINK, id, AOO_MSG_SILENCE);
+
+        msg << osc::BeginMessage(address);
+    } else {
+        msg << osc::BeginMessage(AOO_MSG_DOMAIN AOO_MSG_SINK AOO_MSG_WILDCARD AOO_MSG_SILENCE);
     }
-    encoder_->set_format(f);
 
-    update();
+    msg << source_id(src) << salt << seq << osc::EndMessage;
 
-    return 1;
+    send(msg.Data(), (int32_t)msg.Size());
+}
+
+// /aoo/sink/<id>/pack <src> <salt> <seq> <sr> <channel_onset> <count> <data>...
+
+void endpoint::send_pack(int32_t src, int32_t salt, int32_t firstseq, double samplerate,
+                         int32_t channel, int32_t count, const int32_t *sizes, const char *data) const {
+    // call without lock!
+    LOG_DEBUG("send pack to " << id << ": seq = " << firstseq << " - " << (firstseq + count - 1));
+
+    char buf[AOO_MAXPACKETSIZE];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+
+    if (id != AOO_ID_WILDCARD){
+        const int32_t max_addr_size = AOO_MSG_DOMAIN_LEN
+                + AOO_MSG_SINK_LEN + 16 + AOO_MSG_PACK_LEN;
+        char address[max_addr_size];
+        snprintf(address, sizeof(address), "%s%s/%d%s",
+                 AOO_MSG_DOMAIN, AOO_MSG_SINK, id, AOO_MSG_PACK);
+
+        msg << osc::BeginMessage(address);
+    } else {
+        msg << osc::BeginMessage(AOO_MSG_DOMAIN AOO_MSG_SINK AOO_MSG_WILDCARD AOO_MSG_PACK);
+    }
+
+    msg << source_id(src) << salt << firstseq << samplerate << channel << count;
+    for (int32_t i = 0; i < count; ++i){
+        msg << osc::Blob(data, sizes[i]);
+        data += sizes[i];
+    }
+    msg << osc::EndMessage;
+
+    send(msg.Data(), (int32_t)msg.Size());
+}
+
+/*///////////////////////// source ////////////////////////////////*/
+
+bool source::has_alias(int32_t id){
+    shared_lock lock(sink_mutex_); // reader lock!
+    for (auto& sink : sinks_){
+        if (sink.alias != AOO_ID_NONE && sink.alias == id){
+            return true;
+        }
+    }
+    return false;
+}
+
+sink_desc * source::find_sink(void *endpoint, int32_t id){
+    for (auto& sink : sinks_){
+        if ((sink.user == endpoint) &&
+            (sink.id == AOO_ID_WILDCARD || sink.id == id))
+        {
+            return &sink;
+        }
+    }
+    return nullptr;
+}
+
+int32_t source::set_format(aoo_format &f){
+    // Always make a new encoder, without holding the lock. This can take
+    // a while (e.g. Opus) and the send thread doesn't have to wait.
+    auto codec = aoo::find_codec(f.codec);
+    if (!codec){
+        LOG_ERROR("codec '" << f.codec << "' not supported!");
+        return 0;
+    }
+    stream_setup setup;
+    setup.encoder = codec->create_encoder();
+    if (!setup.encoder){
+        LOG_ERROR("couldn't create encoder!");
+        return 0;
+    }
+    setup.encoder->set_format(f);
+
+    update(setup);
+
+    return 1;
 }
 
 int32_t source::make_salt(){
@@ -906,78 +1361,221 @@ int32_t source::make_salt(){
 }
 
 int32_t source::set_userformat(void * ptr, int32_t size){
-    unique_lock lock(update_mutex_); // writer lock!
+    {
+        unique_lock lock(update_mutex_); // writer lock!
 
-    if (size <= 0) {
-        // clear any user format
-        userformat_.clear();
-    }
-    else {
-        auto cptr = static_cast<char*>(ptr);
-        userformat_.assign(cptr, cptr+size);
+        if (size <= 0) {
+            // clear any user format
+            userformat_.clear();
+        }
+        else {
+            auto cptr = static_cast<char*>(ptr);
+            userformat_.assign(cptr, cptr+size);
+        }
     }
     update(); // to force format change message
 
     return 1;
 }
 
-
-// always called with update_mutex_ locked!
+// call without the lock!
 void source::update(){
-    if (!encoder_){
+    stream_setup setup;
+    update(setup);
+}
+
+// Sets up new buffers for the current settings and switches to them.
+// A new encoder in 'setup' replaces the current one. The allocations
+// happen without the lock, the audio thread never waits for us and
+// the send thread only for the swap. Call without the lock!
+void source::update(stream_setup& setup){
+    for (;;){
+        uint32_t generation;
+        int32_t nchannels, samplerate, blocksize, codecnchannels, codecsr, codecblocksize;
+        {
+            shared_lock lock(update_mutex_); // reader lock!
+            auto enc = setup.encoder ? setup.encoder.get() : encoder_.get();
+            if (!enc){
+                return;
+            }
+            assert(enc->blocksize() > 0 && enc->samplerate() > 0);
+            generation = generation_;
+            nchannels = nchannels_;
+            samplerate = samplerate_;
+            blocksize = blocksize_;
+            codecnchannels = enc->nchannels();
+            codecsr = enc->samplerate();
+            codecblocksize = enc->blocksize();
+        }
+
+        if (blocksize > 0){
+            setup.buffer = make_stream(nchannels, samplerate, blocksize, codecnchannels,
+                                       codecsr, codecblocksize, buffersize_.load());
+        } else {
+            setup.buffer = nullptr; // not set up yet
+        }
+
+        stream_buffer *old;
+        {
+            unique_lock lock(update_mutex_); // writer lock!
+            if (generation_ != generation){
+                // setup() or another update() came in between, start over
+                continue;
+            }
+            old = install_stream(setup);
+        }
+        retire_buffer(old);
+        // the old encoder (if any) goes with 'setup'
         return;
     }
-    assert(encoder_->blocksize() > 0 && encoder_->samplerate() > 0);
+}
 
-    if (blocksize_ > 0){
-        assert(samplerate_ > 0 && nchannels_ > 0);
-        // setup audio buffer
-        auto nsamples = encoder_->blocksize() * nchannels_;
-        double bufsize = (double)buffersize_ * encoder_->samplerate() * 0.001;
-        bufsize = std::max(bufsize, (double)blocksize_); // needs to be at least one processing blocksize_ worth!
-        auto d = div(bufsize, encoder_->blocksize());
-        int32_t nbuffers = d.quot + (d.rem != 0); // round up
-        nbuffers = std::max<int32_t>(nbuffers, 1); // need at least 1 buffer!
-        audioqueue_.resize(nbuffers * nsamples, nsamples);
-        srqueue_.resize(nbuffers, 1);
-        LOG_DEBUG("aoo::source::update: id: " << id_ << " nbuffers = " << nbuffers << " dquot: " << d.quot << " drem: " << d.rem <<  " bufsize: " << bufsize << " bs: " << encoder_->blocksize() << " reqbufms: " << buffersize_);
-
-        // resampler
-       // if (blocksize_ != encoder_->blocksize() || samplerate_ != encoder_->samplerate()){
-            resampler_.setup(blocksize_, encoder_->blocksize(),
-                             samplerate_, encoder_->samplerate(), nchannels_);
-            resampler_.update(samplerate_, encoder_->samplerate());
-        //} else {
-        //    resampler_.clear();
-        //}
-
-        // history buffer
-        update_historybuffer();
-        
-        // reset encoder state to avoid old garbage
-        encoder_->reset();
-        
-        // reset time DLL to be on the safe side
-        timer_.reset();
-        lastpingtime_ = -1000; // force first ping
+std::unique_ptr<source::stream_buffer> source::make_stream(int32_t nchannels, int32_t samplerate,
+                                                           int32_t blocksize, int32_t codecnchannels,
+                                                           int32_t codecsr, int32_t codecblocksize,
+                                                           int32_t buffersize){
+    assert(samplerate > 0 && nchannels > 0);
+    auto b = std::make_unique<stream_buffer>();
+    b->nchannels = nchannels;
+    b->samplerate = codecsr;
+    b->blocksize = codecblocksize;
+    // setup audio buffer
+    auto nsamples = codecblocksize * nchannels;
+    double bufsize = (double)buffersize * codecsr * 0.001;
+    bufsize = std::max(bufsize, (double)blocksize); // needs to be at least one processing blocksize_ worth!
+    auto d = div(bufsize, codecblocksize);
+    int32_t nbuffers = d.quot + (d.rem != 0); // round up
+    nbuffers = std::max<int32_t>(nbuffers, 1); // need at least 1 buffer!
+    b->audioqueue.resize(nbuffers * nsamples, nsamples);
+    b->srqueue.resize(nbuffers, 1);
+    // an encoded block never exceeds the (overallocated) send buffer, see send_data()
+    auto encodedsize = (int32_t)(sizeof(int32_t) + sizeof(double) * codecnchannels * codecblocksize);
+    b->encodedqueue.resize(nbuffers * encodedsize, encodedsize);
+    LOG_DEBUG("aoo::source::update: id: " << id_ << " nbuffers = " << nbuffers << " dquot: " << d.quot << " drem: " << d.rem <<  " bufsize: " << bufsize << " bs: " << codecblocksize << " reqbufms: " << buffersize);
+
+    // resampler
+   // if (blocksize != codecblocksize || samplerate != codecsr){
+        b->resampler.setup(blocksize, codecblocksize,
+                           samplerate, codecsr, nchannels);
+        b->resampler.update(samplerate, codecsr);
+    //} else {
+    //    b->resampler.clear();
+    //}
+    return b;
+}
+
+// call with writer lock! Returns the buffer to retire after unlocking.
+source::stream_buffer * source::install_stream(stream_setup& setup){
+    if (setup.encoder){
+        encoder_.swap(setup.encoder);
+    }
+    ++generation_;
+    if (!setup.buffer){
+        return nullptr;
+    }
+    // process() starts the new stream with a fade in,
+    // the rest of the old one is gone with its buffer.
+    setup.buffer->generation = generation_;
+    auto old = buffer_.exchange(setup.buffer.release());
+
+    // history buffer
+    update_historybuffer();
+
+    // reset encoder state to avoid old garbage
+    encoder_->reset();
+    packetloss_ = -1; // pass packet loss hint to new encoder state
+    encoder_bitrate_ = -1; // same for the bitrate
+    encoder_complexity_ = -1; // and the complexity
+
+    // reset time DLL to be on the safe side
+    timer_.reset();
+    lastpingtime_ = -1000; // force first ping
+
+    // Start new sequence and resend format.
+    // We naturally want to do this when setting the format,
+    // but it's good to also do it in setup() to eliminate
+    // any timing gaps.
+    salt_ = make_salt();
+    sequence_ = 0;
+    dropped_ = 0;
+    silentframes_ = 0;
+    silentseq_ = -1;
+    {
+        shared_lock lock2(sink_mutex_);
+        for (auto& sink : sinks_){
+            sink.format_changed = true;
+        }
+        // notify send_format()
+        format_changed_ = true;
+    }
+
+    return old;
+}
+
+// frees a buffer replaced by install_stream(), call without the lock
+void source::retire_buffer(stream_buffer *b){
+    if (!b){
+        return;
+    }
+    // the audio thread might still be writing to it, but not for longer
+    // than one process() call
+    while (playing_.load() == b){
+        std::this_thread::yield();
+    }
+    delete b;
+}
+
+// audio thread, always followed by release_buffer()
+source::stream_buffer * source::acquire_buffer(){
+    // check buffer_ again after announcing it,
+    // so we never pick up one that is retired in between.
+    stream_buffer *b;
+    do {
+        b = buffer_.load();
+        playing_.store(b);
+    } while (b != buffer_.load());
+
+    if (b && b->generation != playgeneration_){
+        // new stream -> fade in
         lastplay_ = false;
-        
-        // Start new sequence and resend format.
-        // We naturally want to do this when setting the format,
-        // but it's good to also do it in setup() to eliminate
-        // any timing gaps.
-        salt_ = make_salt();
-        sequence_ = 0;
-        dropped_ = 0;
-        {
-            shared_lock lock2(sink_mutex_);
-            for (auto& sink : sinks_){
-                sink.format_changed = true;
-            }
-            // notify send_format()
-            format_changed_ = true;
+        playgeneration_ = b->generation;
+    }
+    return b;
+}
+
+void source::release_buffer(){
+    playing_.store(nullptr);
+}
+
+bool source::update_timer(uint64_t t){
+    // update time DLL filter
+    double error;
+    auto state = timer_.update(t, error);
+    // with a shared clock the timer is still needed for the stream time
+    // and the error check, only the DLL is left to the clock
+    const bool owndll = !clock_.load(std::memory_order_relaxed);
+    if (state == timer::state::reset){
+        if (owndll){
+            LOG_DEBUG("setup time DLL filter for source");
+            dll_.setup(samplerate_, blocksize_, bandwidth_, 0);
         }
+    } else if (state == timer::state::error){
+        // skip blocks
+        double period = (double)blocksize_ / (double)samplerate_;
+        int nblocks = error / period + 0.5;
+        LOG_VERBOSE("skip " << nblocks << " blocks");
+        dropped_ += nblocks;
+        timer_.reset();
+        return false;
+    } else if (owndll){
+        auto elapsed = timer_.get_elapsed();
+        dll_.update(elapsed);
+    #if AOO_DEBUG_DLL
+        DO_LOG("time elapsed: " << elapsed << ", period: " << dll_.period()
+               << ", samplerate: " << dll_.samplerate());
+    #endif
     }
+    return true;
 }
 
 void source::update_historybuffer(){
@@ -985,7 +1583,8 @@ void source::update_historybuffer(){
         double bufsize = (double)resend_buffersize_ * 0.001 * samplerate_;
         auto d = div(bufsize, encoder_->blocksize());
         int32_t nbuffers = d.quot + (d.rem != 0); // round up
-        history_.resize(nbuffers);
+        // the encoder output never exceeds the (overallocated) send buffer, see send_data()
+        history_.resize(nbuffers, sizeof(double) * encoder_->nchannels() * encoder_->blocksize());
     }
 }
 
@@ -1020,20 +1619,27 @@ bool source::send_format(){
 
     if (format_changed){
         // only copy sinks which require a format update!
+        // the format goes out over every path, any of them might be down
         shared_lock sinklock(sink_mutex_);
-        auto sinks = (aoo::sink_desc *)alloca((sinks_.size() + 1) * sizeof(aoo::endpoint)); // avoid alloca(0)
+        auto maxsinks = sinks_.size() * AOO_MAXPATHS;
+        auto sinks = (aoo::endpoint *)alloca((maxsinks + 1) * sizeof(aoo::endpoint)); // avoid alloca(0)
+        auto flags = (int32_t *)alloca((maxsinks + 1) * sizeof(int32_t));
         int numsinks = 0;
         for (auto& sink : sinks_){
             if (sink.format_changed.exchange(false)){
-                new (sinks + numsinks) aoo::endpoint (sink.user, sink.fn, sink.id);
-                numsinks++;
+                for (int32_t i = 0; i < sink.num_paths; ++i){
+                    new (sinks + numsinks) aoo::endpoint (sink.path(i));
+                    flags[numsinks] = AOO_PROTOCOL_FLAG_COMPACT_DATA
+                            | (sink.fec_group >= 2 ? AOO_PROTOCOL_FLAG_FEC : 0);
+                    numsinks++;
+                }
             }
         }
         sinklock.unlock();
         // now we don't hold any lock!
 
         for (int i = 0; i < numsinks; ++i){
-            sinks[i].send_format(id(), salt, fmt, settings, size, userfmt, userfmtsize);
+            sinks[i].send_format(id(), salt, fmt, settings, size, userfmt, userfmtsize, flags[i]);
         }
     }
 
@@ -1041,19 +1647,57 @@ bool source::send_format(){
         while (formatrequestqueue_.read_available()){
             endpoint ep;
             formatrequestqueue_.read(ep);
-            ep.send_format(id(), salt, fmt, settings, size, userfmt, userfmtsize);
+            int32_t flags = AOO_PROTOCOL_FLAG_COMPACT_DATA;
+            aoo::endpoint paths[AOO_MAXPATHS];
+            int32_t numpaths = 1;
+            paths[0] = ep;
+            {
+                shared_lock sinklock(sink_mutex_);
+                auto sink = find_sink(ep.user, ep.id);
+                if (sink && sink->fec_group >= 2){
+                    flags |= AOO_PROTOCOL_FLAG_FEC;
+                }
+                if (sink){
+                    // the request might have come over any of them
+                    for (int32_t i = 1; i < sink->num_paths; ++i){
+                        paths[i] = sink->path(i);
+                        paths[i].id = ep.id;
+                        paths[i].alias = ep.alias;
+                    }
+                    numpaths = sink->num_paths;
+                }
+            }
+            for (int32_t i = 0; i < numpaths; ++i){
+                paths[i].send_format(id(), salt, fmt, settings, size, userfmt, userfmtsize, flags);
+            }
         }
     }
 
     return true;
 }
 
+// burst size of the resend budget in seconds
+#define AOO_RESEND_BURST 0.25
+
 bool source::resend_data(){
     shared_lock updatelock(update_mutex_); // reader lock!
-    if (!history_.capacity()){
+    if (!history_.capacity() || !encoder_){
         return false;
     }
 
+    // the budgets are fractions of the (average) stream bitrate
+    double blockrate = encoder_->blocksize() > 0 ?
+        (double)encoder_->samplerate() / encoder_->blocksize() : 0;
+    double streamrate = avg_blocksize_ * blockrate; // bytes/s
+    double rate = resend_budget_.load() * streamrate;
+    double totalrate = resend_total_budget_.load() * streamrate;
+    // at least a single packet must fit into the bucket
+    auto burst = [this](double r){
+        return std::max<double>(r * AOO_RESEND_BURST, packetsize_.load());
+    };
+    auto now = timer_.get_elapsed();
+    auto lastseq = sequence_ - 1;
+
     bool didsomething = false;
 
     while (datarequestqueue_.read_available()){
@@ -1068,6 +1712,40 @@ bool source::resend_data(){
 
         auto block = history_.find(request.sequence);
         if (block){
+            int32_t nbytes;
+            if (request.frame < 0){
+                nbytes = block->size();
+            } else if (request.frame < block->num_frames()){
+                nbytes = block->frame_size(request.frame);
+            } else {
+                LOG_ERROR("frame number " << request.frame << " out of range!");
+                continue;
+            }
+
+            shared_lock listlock(sink_mutex_); // reader lock!
+            auto sink = find_sink(request.sink, request.id);
+            if (!sink){
+                LOG_VERBOSE("couldn't find sink " << request.id << " for resend request");
+                continue;
+            }
+            // is it too late for the sink to play the block?
+            auto deadline = sink->resend_deadline.load();
+            if (deadline > 0 && blockrate > 0
+                    && (lastseq - request.sequence) * 1000.0 / blockrate > deadline){
+                LOG_DEBUG("block " << request.sequence << " is past the deadline, don't resend");
+                continue;
+            }
+            // is there enough budget left? (the buckets are only touched by the send thread)
+            auto totalsinkrate = totalrate * sinks_.size();
+            if (!sink->resend.allow(now, rate, burst(rate), nbytes)
+                    || !resend_.allow(now, totalsinkrate, burst(totalsinkrate), nbytes)){
+                LOG_DEBUG("resend budget exhausted, drop request for block " << request.sequence);
+                continue;
+            }
+            sink->resend.take(nbytes);
+            resend_.take(nbytes);
+            listlock.unlock();
+
             aoo::data_packet d;
             d.sequence = block->sequence;
             d.samplerate = block->samplerate;
@@ -1134,11 +1812,32 @@ bool source::resend_data(){
     return didsomething;
 }
 
-bool source::send_data(){
-    shared_lock updatelock(update_mutex_); // reader lock!
-    if (!encoder_){
+// locks, or only tries to with trylock
+template<typename T>
+static bool acquire(T& lock, bool trylock){
+    if (trylock){
+        return lock.try_lock();
+    }
+    lock.lock();
+    return true;
+}
+
+int32_t source::send_data(bool trylock){
+    // with trylock every lock is tried before anything changes, if one
+    // is taken the rest is left as it was, for the next send()
+    shared_lock updatelock(update_mutex_, std::defer_lock); // reader lock!
+    if (!acquire(updatelock, trylock)){
+        return -1;
+    }
+    if (!encoder_ || !buffer_.load(std::memory_order_relaxed)){
         return 0;
     }
+    auto& b = buffer();
+
+    // the salt reset at the end needs the writer lock
+    if (trylock && sequence_ == INT32_MAX){
+        return -1;
+    }
 
     data_packet d;
     int32_t salt = salt_;
@@ -1146,6 +1845,11 @@ bool source::send_data(){
     // *first* check for dropped blocks
     // NOTE: there's no ABA problem because the variable will only be decremented in this method.
     if (dropped_ > 0){
+        shared_lock listlock(sink_mutex_, std::defer_lock);
+        if (!acquire(listlock, trylock)){
+            return -1;
+        }
+
         // send empty block
         d.sequence = sequence_++;
         d.samplerate = encoder_->samplerate(); // use nominal samplerate
@@ -1158,7 +1862,6 @@ bool source::send_data(){
         updatelock.unlock();
 
         // make local copy of sink descriptors
-        shared_lock listlock(sink_mutex_);
         int32_t numsinks = (int32_t) sinks_.size();
         auto sinks = (sink_desc *)alloca((numsinks + 1) * sizeof(sink_desc)); // avoid alloca(0)
         std::copy(sinks_.begin(), sinks_.end(), sinks);
@@ -1167,13 +1870,26 @@ bool source::send_data(){
         listlock.unlock();
 
         // send block to sinks
+        auto now = time_tag(aoo_osctime_get()).to_double();
+        auto timeout = path_timeout();
         for (int i = 0; i < numsinks; ++i){
-            sinks[i].send_data(id(), salt, d);            
+            for (int32_t k = 0; k < sinks[i].num_paths; ++k){
+                if (sinks[i].sends_on_path(k, d.sequence, now, timeout)){
+                    sinks[i].path(k).send_data(id(), salt, d);
+                }
+            }
         }
         --dropped_;
-    } else if (audioqueue_.read_available() && srqueue_.read_available()){
+    } else if ((b.audioqueue.read_available() && b.srqueue.read_available())
+               || b.encodedqueue.read_available()){
+        // blocks from process_encoded() don't go through the encoder
+        bool encoded = b.encodedqueue.read_available() > 0;
+
         // make local copy of sink descriptors
-        shared_lock listlock(sink_mutex_);
+        shared_lock listlock(sink_mutex_, std::defer_lock);
+        if (!acquire(listlock, trylock)){
+            return -1;
+        }
         int32_t numsinks = (int32_t) sinks_.size();
         auto sinks = (sink_desc *)alloca((numsinks + 1) * sizeof(sink_desc)); // avoid alloca(0)
         std::copy(sinks_.begin(), sinks_.end(), sinks);
@@ -1181,8 +1897,47 @@ bool source::send_data(){
         // unlock before sending!
         listlock.unlock();
 
+        // packing takes the sink lock again once the block is encoded
+        if (trylock){
+            for (int i = 0; i < numsinks; ++i){
+                if (sinks[i].pack_limit > 1 || sinks[i].pack.count > 0){
+                    return -1;
+                }
+            }
+        }
+
+        // tell the encoder about the worst packet loss among the sinks,
+        // so it can add the right amount of redundancy (e.g. Opus in-band FEC)
+        float maxloss = 0;
+        for (int i = 0; i < numsinks; ++i){
+            maxloss = std::max<float>(maxloss, sinks[i].packetloss);
+        }
+        int32_t packetloss = std::min<int32_t>(100, std::ceil(maxloss));
+        if (packetloss != packetloss_){
+            encoder_->set_packetloss(packetloss);
+            packetloss_ = packetloss;
+        }
+        auto bitrate = bitrate_.load();
+        if (bitrate != encoder_bitrate_){
+            // the new encoder state starts with the bitrate of the format
+            if (bitrate > 0 || encoder_bitrate_ > 0){
+                encoder_->set_bitrate(bitrate);
+            }
+            encoder_bitrate_ = bitrate;
+        }
+        auto complexity = complexity_.load();
+        if (complexity != encoder_complexity_){
+            // same, it starts with the complexity of the format
+            encoder_->set_complexity(complexity);
+            encoder_complexity_ = complexity;
+        }
+
         d.sequence = sequence_++;
-        srqueue_.read(d.samplerate); // always read samplerate from ringbuffer
+        if (encoded){
+            d.samplerate = encoder_->samplerate(); // use nominal samplerate
+        } else {
+            b.srqueue.read(d.samplerate); // always read samplerate from ringbuffer
+        }
 
         // for compact data sending purposes... only send rate when necessary
         bool sendrate = false;
@@ -1190,16 +1945,57 @@ bool source::send_data(){
             sendrate = true;
             prev_sent_samplerate_ = d.samplerate;
         }
-        
-        if (numsinks){
+
+        // sinks with AOO_PROTOCOL_FLAG_SILENCE don't get silent blocks
+        // after the hangover time, only a /silence message now and then.
+        // Blocks from process_encoded() are opaque, so they are always sent.
+        int32_t numsilent = 0;
+        for (int i = 0; i < numsinks; ++i){
+            if (sinks[i].protocol_flags & AOO_PROTOCOL_FLAG_SILENCE){
+                numsilent++;
+            }
+        }
+        bool suppress = false;
+        bool marker = false;
+        if (numsilent > 0 && !encoded){
+            suppress = update_silence(b, d.sequence, marker);
+        } else {
+            silentseq_ = -1;
+            silentframes_ = 0;
+        }
+        auto suppressed = [&](const sink_desc& sink){
+            return suppress && (sink.protocol_flags & AOO_PROTOCOL_FLAG_SILENCE);
+        };
+
+        if (suppress && numsilent == numsinks){
+            // nobody needs the block, so we don't even encode it.
+            // The sinks still get pinged by send_ping().
+            b.audioqueue.read_commit();
+            updatelock.unlock();
+
+            if (marker){
+                for (int i = 0; i < numsinks; ++i){
+                    sinks[i].path(sinks[i].best_path).send_silence(id(), salt, silentseq_);
+                }
+            }
+        } else if (numsinks){
             // copy and convert audio samples to blob data
             auto nchannels = encoder_->nchannels();
             auto blocksize = encoder_->blocksize();
             sendbuffer_.resize(sizeof(double) * nchannels * blocksize); // overallocate
 
-            d.totalsize = encoder_->encode(audioqueue_.read_data(), audioqueue_.blocksize(),
-                                           sendbuffer_.data(), (int32_t) sendbuffer_.size());
-            audioqueue_.read_commit();
+            if (encoded){
+                auto slot = b.encodedqueue.read_data();
+                int32_t size;
+                memcpy(&size, slot, sizeof(int32_t));
+                std::copy(slot + sizeof(int32_t), slot + sizeof(int32_t) + size, sendbuffer_.data());
+                d.totalsize = size;
+                b.encodedqueue.read_commit();
+            } else {
+                d.totalsize = encoder_->encode(b.audioqueue.read_data(), b.audioqueue.blocksize(),
+                                               sendbuffer_.data(), (int32_t) sendbuffer_.size());
+                b.audioqueue.read_commit();
+            }
 
             if (d.totalsize > 0){
                 // calculate number of frames
@@ -1210,31 +2006,106 @@ bool source::send_data(){
                 // save block
                 history_.push(d.sequence, d.samplerate, sendbuffer_.data(),
                               d.totalsize, d.nframes, maxpacketsize);
+                // for the resend budget
+                avg_blocksize_ = avg_blocksize_ > 0 ?
+                    avg_blocksize_ + (d.totalsize - avg_blocksize_) * 0.05 : d.totalsize;
+
+                // compute XOR parity for sinks whose FEC group ends with this block.
+                // paritysize is indexed by group size, -1 = not needed, 0 = not available.
+                int32_t paritysize[AOO_FEC_MAXGROUP + 1];
+                int32_t sizexor[AOO_FEC_MAXGROUP + 1];
+                std::fill(std::begin(paritysize), std::end(paritysize), -1);
+                bool needparity = false;
+                for (int i = 0; i < numsinks; ++i){
+                    int32_t k = sinks[i].fec_group;
+                    if (k >= 2 && (d.sequence % k) == (k - 1) && paritysize[k] < 0 && !suppressed(sinks[i])){
+                        paritysize[k] = make_parity(d.sequence, k, sizexor[k]);
+                        needparity |= paritysize[k] > 0;
+                    }
+                }
+
+                // sinks which get several blocks per packet (see aoo_opt_pack_limit),
+                // the state of the pack lives in the actual sink descriptor.
+                auto packed = (bool *)alloca(numsinks + 1);
+                bool anypacked = false;
+                for (int i = 0; i < numsinks; ++i){
+                    packed[i] = false;
+                    anypacked |= sinks[i].pack_limit > 1 || sinks[i].pack.count > 0;
+                }
+                if (anypacked){
+                    auto blockdur = (double)encoder_->blocksize() / encoder_->samplerate();
+                    shared_lock listlock(sink_mutex_);
+                    for (int i = 0; i < numsinks; ++i){
+                        if (sinks[i].pack_limit > 1 || sinks[i].pack.count > 0){
+                            if (auto sink = find_sink(sinks[i].user, sinks[i].id)){
+                                packed[i] = pack_block(*sink, d, salt, pack_factor(*sink, blockdur),
+                                                       suppressed(*sink));
+                            }
+                        }
+                    }
+                }
 
                 // unlock before sending!
                 updatelock.unlock();
 
                 // from here on we don't hold any lock!
 
-                // send a single frame to all sinks
+                if (anypacked){
+                    send_packs();
+                }
+
+                // if a ping is due, append it to the first frame for sinks which
+                // support it, so they don't need a separate ping message.
+                auto elapsed = timer_.get_elapsed();
+                auto interval = ping_interval_.load(); // 0: no ping
+                bool pingdue = interval > 0 && (elapsed - lastpingtime_.load()) >= interval;
+                time_tag ping;
+                if (pingdue){
+                    ping = aoo_osctime_get(); // use real system time
+                    ++pingcount_;
+                }
+                auto now = time_tag(aoo_osctime_get()).to_double();
+                auto timeout = path_timeout();
+
+                // each sink gets the frames as many times as its redundancy asks for
+                auto fixed = redundancy_.load();
+                int32_t ntimes = 0;
+                for (int i = 0; i < numsinks; ++i){
+                    ntimes = std::max<int32_t>(ntimes, sinks[i].num_sends(fixed));
+                }
+                int32_t copy = 0;
+
+                // send a single frame to all sinks (over the paths which carry this block)
                 // /AoO/<sink>/data <src> <salt> <seq> <sr> <channel_onset> <totalsize> <numpackets> <packetnum> <data>
                 auto dosend = [&](int32_t frame, const char* data, auto n){
                     d.framenum = frame;
                     d.data = data;
                     d.size = n;
                     for (int i = 0; i < numsinks; ++i){
+                        if (suppressed(sinks[i]) || packed[i] || copy >= sinks[i].num_sends(fixed)){
+                            continue;
+                        }
                         d.channel = sinks[i].channel;
-                        // if the protocol_flags allow using the compact data message, use it if appropriate
-                        if (d.nframes == 1 && d.channel == 0 && sinks[i].protocol_flags & AOO_PROTOCOL_FLAG_COMPACT_DATA) {
-                            sinks[i].send_data_compact(id(), salt, d, sendrate);                
-                        } else {
-                            sinks[i].send_data(id(), salt, d);
+                        auto pingpath = pingcount_ % sinks[i].num_paths;
+                        for (int32_t k = 0; k < sinks[i].num_paths; ++k){
+                            if (!sinks[i].sends_on_path(k, d.sequence, now, timeout)){
+                                continue;
+                            }
+                            auto tt = (k == pingpath && (sinks[i].protocol_flags & AOO_PROTOCOL_FLAG_PING_DATA)) ?
+                                        path_ping(ping, k) : time_tag{};
+                            auto ep = sinks[i].path(k);
+                            // if the protocol_flags allow using the compact data message, use it if appropriate
+                            if (d.nframes == 1 && d.channel == 0 && sinks[i].protocol_flags & AOO_PROTOCOL_FLAG_COMPACT_DATA) {
+                                ep.send_data_compact(id(), salt, d, sendrate, tt);
+                            } else {
+                                ep.send_data(id(), salt, d, tt);
+                            }
                         }
                     }
+                    ping.clear(); // only once
                 };
 
-                auto ntimes = redundancy_.load();
-                for (auto i = 0; i < ntimes; ++i){
+                for (copy = 0; copy < ntimes; ++copy){
                     auto ptr = sendbuffer_.data();
                     // send large frames (might be 0)
                     for (int32_t j = 0; j < dv.quot; ++j, ptr += maxpacketsize){
@@ -1245,16 +2116,69 @@ bool source::send_data(){
                         dosend(dv.quot, ptr, dv.rem);
                     }
                 }
+
+                // send parity after the data, so it can't arrive before the last block
+                if (needparity){
+                    for (int i = 0; i < numsinks; ++i){
+                        int32_t k = sinks[i].fec_group;
+                        if (k >= 2 && paritysize[k] > 0 && !suppressed(sinks[i])){
+                            sinks[i].path(sinks[i].best_path).send_parity(id(), salt, d.sequence - k + 1, k, sizexor[k],
+                                                                          paritybuffer_[k].data(), paritysize[k]);
+                        }
+                    }
+                }
+
+                if (marker){
+                    for (int i = 0; i < numsinks; ++i){
+                        if (suppressed(sinks[i])){
+                            sinks[i].path(sinks[i].best_path).send_silence(id(), salt, silentseq_);
+                        }
+                    }
+                }
+
+                // older sinks still need a separate ping, and so does
+                // a ping path which didn't carry this block (split mode)
+                // or a sink which didn't get it at all (silence suppression)
+                // or not yet (packing)
+                if (pingdue){
+                    time_tag tt = aoo_osctime_get();
+                    for (int i = 0; i < numsinks; ++i){
+                        auto pingpath = pingcount_ % sinks[i].num_paths;
+                        if (!(sinks[i].protocol_flags & AOO_PROTOCOL_FLAG_PING_DATA)
+                            || !sinks[i].sends_on_path(pingpath, d.sequence, now, timeout)
+                            || suppressed(sinks[i]) || packed[i]){
+                            sinks[i].path(pingpath).send_ping(id(), path_ping(tt, pingpath));
+                        }
+                    }
+                    lastpingtime_ = elapsed;
+                }
             } else {
                 LOG_WARNING("aoo_source: couldn't encode audio data!");
             }
         } else {
             // drain buffer anyway
-            audioqueue_.read_commit();
+            if (encoded){
+                b.encodedqueue.read_commit();
+            } else {
+                b.audioqueue.read_commit();
+            }
         }
     } else {
         // LOG_DEBUG("couldn't send");       
         if (!play_.load() && flushingout_.load() ) {
+            if (trylock){
+                return -1;
+            }
+            // the last blocks mustn't wait for a pack that doesn't fill up anymore
+            {
+                shared_lock listlock(sink_mutex_);
+                for (auto& sink : sinks_){
+                    flush_pack(sink, salt);
+                }
+            }
+            updatelock.unlock();
+            send_packs();
+
             LOG_VERBOSE("finished flushing out");
             activeplay_ = 0;
             flushingout_ = 0;
@@ -1272,12 +2196,205 @@ bool source::send_data(){
     return 1;
 }
 
+// a path is considered down if it misses a couple of pings in a row.
+// Each path only gets every n'th ping!
+double source::path_timeout() const {
+    return 2.5 * AOO_MAXPATHS * std::max<double>(ping_interval_.load(), 0.1);
+}
+
+// the live path with the lowest round trip time, the primary path if none is alive.
+// Call with sink lock!
+void source::update_best_path(sink_desc& sink, double now){
+    auto timeout = path_timeout();
+    int32_t best = 0;
+    float bestrtt = -1;
+    for (int32_t i = 0; i < sink.num_paths; ++i){
+        auto rtt = sink.path_rtt[i].load();
+        if (sink.path_alive(i, now, timeout) && rtt >= 0 && (bestrtt < 0 || rtt < bestrtt)){
+            best = i;
+            bestrtt = rtt;
+        }
+    }
+    if (sink.best_path.exchange(best) != best){
+        LOG_VERBOSE("aoo_source: best path to sink " << sink.id << " is now " << best
+                    << " (rtt " << (bestrtt * 1000.0) << " ms)");
+    }
+}
+
+// XOR the last 'count' blocks (ending with 'lastseq') from the history buffer
+// into paritybuffer_[count]. Shorter blocks are zero padded, the sizes are
+// XOR'ed as well so the sink can recover the original size.
+// Returns the parity size or 0 if any block is missing or has more than one frame.
+// Call with update lock!
+int32_t source::make_parity(int32_t lastseq, int32_t count, int32_t& sizexor){
+    if (!history_.capacity() || count > history_.capacity()){
+        return 0;
+    }
+
+    const history_buffer::item *blocks[AOO_FEC_MAXGROUP];
+    int32_t maxsize = 0;
+    for (int32_t i = 0; i < count; ++i){
+        auto b = history_.find(lastseq - count + 1 + i);
+        if (!b || b->num_frames() != 1){
+            return 0;
+        }
+        blocks[i] = b;
+        maxsize = std::max<int32_t>(maxsize, b->size());
+    }
+    if (maxsize > packetsize_ - AOO_DATA_HEADERSIZE){
+        return 0;
+    }
+
+    auto& buf = paritybuffer_[count];
+    buf.assign(maxsize, 0);
+    sizexor = 0;
+    for (int32_t i = 0; i < count; ++i){
+        auto data = blocks[i]->data();
+        auto n = blocks[i]->size();
+        for (int32_t j = 0; j < n; ++j){
+            buf[j] ^= data[j];
+        }
+        sizexor ^= n;
+    }
+    return maxsize;
+}
+
+// Does the next block of the audio queue continue a silence which is longer
+// than the hangover time? 'marker' tells if the (first or repeated) /silence
+// message is due. Call with update lock, on the send thread!
+bool source::update_silence(stream_buffer& b, int32_t seq, bool& marker){
+    marker = false;
+    auto data = b.audioqueue.read_data();
+    auto n = b.audioqueue.blocksize();
+    for (int32_t i = 0; i < n; ++i){
+        if (std::abs(data[i]) > (aoo_sample)AOO_SILENCE_THRESHOLD){
+            silentframes_ = 0;
+            silentseq_ = -1;
+            return false;
+        }
+    }
+    silentframes_ += b.blocksize;
+    if (silentframes_ <= (int64_t)(AOO_SILENCE_HANGOVER * 0.001 * b.samplerate)){
+        return false;
+    }
+    if (silentseq_ < 0){
+        silentseq_ = seq;
+        marker = true;
+    } else {
+        marker = (silentframes_ - silencemarker_)
+                >= (int64_t)(AOO_SILENCE_KEEPALIVE * 0.001 * b.samplerate);
+    }
+    if (marker){
+        silencemarker_ = silentframes_;
+    }
+    return true;
+}
+
+// how many blocks go into a packet for the sink (see aoo_opt_pack_limit),
+// 1 if it doesn't get packed blocks. Call with (shared) update lock!
+int32_t source::pack_factor(const sink_desc& sink, double blockdur) const {
+    auto limit = sink.pack_limit.load();
+    auto rtt = sink.path_rtt[0].load();
+    if (limit <= 1 || rtt <= 0 || blockdur <= 0 || sink.num_paths > 1
+            || sink.fec_group.load() >= 2 || !history_.capacity()
+            || !(sink.protocol_flags.load() & AOO_PROTOCOL_FLAG_PACK)){
+        return 1;
+    }
+    // waiting for the other blocks only adds a small fraction of the round trip...
+    auto n = 1 + (int32_t)(rtt * AOO_PACK_RTT_FRACTION / blockdur);
+    // ...and a lost packet takes all its blocks with it, so pack fewer with more loss
+    n = (int32_t)(n / (1.0 + sink.packetloss.load() / AOO_PACK_LOSS));
+    return std::max<int32_t>(1, std::min<int32_t>(n, limit));
+}
+
+// adds the block (which must already be in the history buffer) to the pack of
+// the sink, and flushes it when it's full or the block can't join it.
+// Returns true if the block goes out with the pack. Call with both (shared) locks!
+bool source::pack_block(sink_desc& sink, const data_packet& d, int32_t salt,
+                        int32_t factor, bool suppressed){
+    auto& p = sink.pack;
+    auto need = AOO_DATA_HEADERSIZE + (p.count + 1) * AOO_PACK_BLOCKOVERHEAD + p.size + d.totalsize;
+    bool packable = factor > 1 && !suppressed && d.nframes == 1 && d.totalsize > 0
+            && AOO_DATA_HEADERSIZE + AOO_PACK_BLOCKOVERHEAD + d.totalsize <= packetsize_.load();
+    // the blocks of a pack are consecutive
+    if (p.count > 0 && (!packable || p.salt != salt || p.first + p.count != d.sequence
+                        || need > packetsize_.load())){
+        flush_pack(sink, salt);
+    }
+    if (!packable){
+        return false;
+    }
+    if (p.count == 0){
+        p.salt = salt;
+        p.first = d.sequence;
+        p.size = 0;
+    }
+    p.count++;
+    p.size += d.totalsize;
+    if (p.count >= factor){
+        flush_pack(sink, salt);
+    }
+    return true;
+}
+
+// copies the blocks of the pack from the history buffer into a /pack message
+// for send_packs(). Call with both (shared) locks!
+void source::flush_pack(sink_desc& sink, int32_t salt){
+    auto& p = sink.pack;
+    if (p.count > 0 && p.salt == salt){
+        pack_send s;
+        s.ep = sink.path(0);
+        s.salt = salt;
+        s.first = p.first;
+        s.channel = sink.channel;
+        s.onset = (int32_t)packbuffer_.size();
+        s.ntimes = sink.num_sends(redundancy_.load());
+        for (int32_t i = 0; i < p.count && i < AOO_PACK_MAXBLOCKS; ++i){
+            auto block = history_.find(p.first + i);
+            if (!block || block->num_frames() != 1){
+                break; // can't happen
+            }
+            if (i == 0){
+                s.samplerate = block->samplerate;
+            }
+            packbuffer_.insert(packbuffer_.end(), block->data(), block->data() + block->size());
+            s.sizes[s.count++] = block->size();
+        }
+        if (s.count > 0){
+            packsends_.push_back(s);
+        }
+    }
+    p.count = 0;
+    p.size = 0;
+}
+
+// sends what flush_pack() has put together. Call without lock!
+void source::send_packs(){
+    for (auto& s : packsends_){
+        for (int32_t i = 0; i < s.ntimes; ++i){
+            s.ep.send_pack(id(), s.salt, s.first, s.samplerate, s.channel,
+                           s.count, s.sizes, packbuffer_.data() + s.onset);
+        }
+    }
+    packsends_.clear();
+    packbuffer_.clear();
+}
+
+// normally the ping goes out with the data (see send_data()), so we only
+// send a separate ping if the stream is idle.
 bool source::send_ping(){
     // if stream is stopped, the timer won't increment anyway
     auto elapsed = timer_.get_elapsed();
     auto pingtime = lastpingtime_.load();
     auto interval = ping_interval_.load(); // 0: no ping
     if (interval > 0 && (elapsed - pingtime) >= interval){
+        {
+            shared_lock updatelock(update_mutex_); // reader lock!
+            auto b = buffer_.load(std::memory_order_relaxed);
+            if (b && (b->audioqueue.read_available() || b->encodedqueue.read_available())){
+                return false; // the next data message will carry the ping
+            }
+        }
         // only copy sinks which require a format update!
         shared_lock sinklock(sink_mutex_);
         int32_t numsinks = (int32_t) sinks_.size();
@@ -1285,10 +2402,16 @@ bool source::send_ping(){
         std::copy(sinks_.begin(), sinks_.end(), sinks);
         sinklock.unlock();
 
-        auto tt = timer_.get_absolute();
+#if 0
+        auto tt = timer_.get_absolute(); // use stream time
+#else
+        time_tag tt = aoo_osctime_get(); // use real system time
+#endif
 
+        ++pingcount_;
         for (int i = 0; i < numsinks; ++i){
-            sinks[i].send_ping(id(), tt);
+            auto pingpath = pingcount_ % sinks[i].num_paths;
+            sinks[i].path(pingpath).send_ping(id(), path_ping(tt, pingpath));
         }
 
         lastpingtime_ = elapsed;
@@ -1317,12 +2440,15 @@ void source::handle_format_request(void *endpoint, aoo_replyfn fn,
     // check if sink exists (not strictly necessary, but might help catch errors)
     shared_lock lock(sink_mutex_); // reader lock!
     auto sink = find_sink(endpoint, id);
+    int32_t alias = sink ? sink->alias : AOO_ID_NONE;
     lock.unlock();
 
     if (sink){
         sink->protocol_flags = version & 0xFF;
         if (formatrequestqueue_.write_available()){
-            formatrequestqueue_.write(aoo::endpoint { endpoint, fn, id });
+            aoo::endpoint ep { endpoint, fn, id };
+            ep.alias = alias;
+            formatrequestqueue_.write(ep);
         }
     } else {
         LOG_WARNING("ignoring '" << AOO_MSG_FORMAT << "' message: sink not found");
@@ -1341,6 +2467,22 @@ void source::handle_data_request(void *endpoint, aoo_replyfn fn,
     // check if sink exists (not strictly necessary, but might help catch errors)
     shared_lock lock(sink_mutex_); // reader lock!
     auto sink = find_sink(endpoint, id);
+    int32_t alias = sink ? sink->alias : AOO_ID_NONE;
+    // in split mode, resend over the path after the one which lost the block,
+    // otherwise over the best path
+    aoo::endpoint paths[AOO_MAXPATHS];
+    int32_t numpaths = 1;
+    bool split = false;
+    int32_t best = 0;
+    paths[0] = aoo::endpoint(endpoint, fn, id);
+    if (sink){
+        numpaths = sink->num_paths;
+        for (int32_t i = 1; i < numpaths; ++i){
+            paths[i] = sink->path(i);
+        }
+        split = sink->path_mode == AOO_PATH_SPLIT;
+        best = sink->best_path;
+    }
     lock.unlock();
 
     if (sink){
@@ -1350,7 +2492,11 @@ void source::handle_data_request(void *endpoint, aoo_replyfn fn,
             auto seq = (it++)->AsInt32();
             auto frame = (it++)->AsInt32();
             if (datarequestqueue_.write_available()){
-                datarequestqueue_.write(data_request{ endpoint, fn, id, salt, seq, frame });
+                auto& path = paths[split ? (seq + 1) % numpaths : best];
+                data_request request{ path.user, path.fn, id, salt, seq, frame };
+                request.alias = alias;
+                request.sink = endpoint;
+                datarequestqueue_.write(request);
             }
         }
     } else {
@@ -1382,6 +2528,7 @@ void source::handle_invite(void *endpoint, aoo_replyfn fn,
             e.sink.id = id;
             e.sink.flags = flags;
             eventqueue_.write(e);
+            eventnotifier_.notify();
         }
     } else {
         LOG_VERBOSE("ignoring '" << AOO_MSG_INVITE << "' message: sink already added");
@@ -1409,6 +2556,7 @@ void source::handle_uninvite(void *endpoint, aoo_replyfn fn,
             // Use 'id' because we want the individual sink! ('sink.id' might be a wildcard)
             e.sink.id = id;
             eventqueue_.write(e);
+            eventnotifier_.notify();
         }
     } else {
         LOG_VERBOSE("ignoring '" << AOO_MSG_UNINVITE << "' message: sink not found");
@@ -1426,9 +2574,42 @@ void source::handle_ping(void *endpoint, aoo_replyfn fn,
 
     LOG_DEBUG("handle ping");
 
+    // number of blocks sent in a ping interval, to convert
+    // the lost blocks into a packet loss percentage
+    double nblocks = 0;
+    shared_lock updatelock(update_mutex_); // reader lock!
+    if (encoder_ && encoder_->blocksize() > 0){
+        nblocks = ping_interval_.load() * encoder_->samplerate() / encoder_->blocksize();
+    }
+    updatelock.unlock();
+
     // check if sink exists (not strictly necessary, but might help catch errors)
     shared_lock lock(sink_mutex_); // reader lock!
     auto sink = find_sink(endpoint, id);
+    if (sink && nblocks > 0){
+        // rise fast, decay slowly
+        float loss = std::min<double>(100.0, 100.0 * lost_blocks / nblocks);
+        float last = sink->packetloss.load();
+        sink->packetloss = loss > last ? loss : last + (loss - last) * 0.25f;
+        sink->update_redundancy();
+    }
+    if (sink){
+        // the ping went out over the path in the lowest bits of its time tag.
+        // With a single path we still want the round trip time, see pack_factor().
+        auto k = (int32_t)(tt1.low & 3);
+        if (k < sink->num_paths){
+            time_tag now = aoo_osctime_get();
+            auto rtt = (float)time_tag::duration(tt1, now);
+            if (rtt >= 0){
+                auto last = sink->path_rtt[k].load();
+                sink->path_rtt[k] = last < 0 ? rtt : last + (rtt - last) * 0.25f;
+                sink->path_reply[k] = now.to_double();
+                if (sink->num_paths > 1){
+                    update_best_path(*sink, now.to_double());
+                }
+            }
+        }
+    }
     lock.unlock();
 
     if (sink){
@@ -1448,6 +2629,7 @@ void source::handle_ping(void *endpoint, aoo_replyfn fn,
             e.ping.tt3 = aoo_osctime_get(); // use real system time
         #endif
             eventqueue_.write(e);
+            eventnotifier_.notify();
         }
     } else {
         LOG_VERBOSE("ignoring '" << AOO_MSG_PING << "' message: sink not found");
@@ -1471,13 +2653,18 @@ void source::handle_codec_change(void *endpoint, aoo_replyfn fn,
     // get requested codec and format options from arguments
     // use our existing format for the other params
     aoo_format f;
-    auto chans = (it++)->AsInt32();
-    auto srate = (it++)->AsInt32();
+    // channels and samplerate, ours stay (still checked for their type)
+    (it++)->AsInt32();
+    (it++)->AsInt32();
     auto bsize = (it++)->AsInt32();
     f.codec = (it++)->AsString();
 
     f.nchannels = nchannels_; // use existing for now
-    f.samplerate = samplerate_; // use existing for now
+    {
+        // the stream's rate, which needn't be the one we run at
+        shared_lock updatelock(update_mutex_); // reader lock!
+        f.samplerate = encoder_ ? encoder_->samplerate() : samplerate_;
+    }
     f.blocksize = bsize;
     const void *settings;
     osc::osc_bundle_element_size_t size;
@@ -1497,24 +2684,20 @@ void source::handle_codec_change(void *endpoint, aoo_replyfn fn,
     if (sink){
         { // only if the requesting sink exists we will respect this request
             LOG_DEBUG("handle codec change");
-            unique_lock lock(update_mutex_); // writer lock!
-            
-            if (!encoder_ || strcmp(encoder_->name(), f.codec)){
-                auto codec = aoo::find_codec(f.codec);
-                if (codec){
-                    encoder_ = codec->create_encoder();
-                } else {
-                    LOG_ERROR("codec '" << f.codec << "' not supported!");
-                    return;
-                }
-                if (!encoder_){
-                    LOG_ERROR("couldn't create encoder!");
-                    return;
-                }
+            // a new encoder, made without the lock (see set_format())
+            auto codec = aoo::find_codec(f.codec);
+            if (!codec){
+                LOG_ERROR("codec '" << f.codec << "' not supported!");
+                return;
             }
-        
-            encoder_->read_format(f, (const char *)settings, size);
-            update();
+            stream_setup setup;
+            setup.encoder = codec->create_encoder();
+            if (!setup.encoder){
+                LOG_ERROR("couldn't create encoder!");
+                return;
+            }
+            setup.encoder->read_format(f, (const char *)settings, size);
+            update(setup);
         }
                
         
@@ -1526,12 +2709,57 @@ void source::handle_codec_change(void *endpoint, aoo_replyfn fn,
             // Use 'id' because we want the individual sink! ('sink.id' might be a wildcard)
             e.sink.id = id;
             eventqueue_.write(e);
+            eventnotifier_.notify();
         }
     } else {
         LOG_VERBOSE("ignoring '" << AOO_CHANGECODEC_EVENT << "' message: sink not found");
     }
 }
 
+// /aoo/src/<id>/subscribe <sink> <onset> <nchannels>
+
+void source::handle_subscribe(void *endpoint, aoo_replyfn fn,
+                              const osc::ReceivedMessage& msg)
+{
+    auto it = msg.ArgumentsBegin();
+
+    auto id = (it++)->AsInt32();
+    auto onset = (it++)->AsInt32();
+    auto nchannels = (it++)->AsInt32();
+
+    if (id < 0){
+        LOG_WARNING("bad ID for " << AOO_MSG_SUBSCRIBE << " message");
+        return;
+    }
+    if (nchannels > 0 && onset < 0){
+        LOG_WARNING("bad channel onset for " << AOO_MSG_SUBSCRIBE << " message");
+        return;
+    }
+
+    // check if sink exists (not strictly necessary, but might help catch errors)
+    shared_lock lock(sink_mutex_); // reader lock!
+    auto sink = find_sink(endpoint, id);
+    lock.unlock();
+
+    if (sink){
+        LOG_DEBUG("handle subscribe: onset = " << onset << ", nchannels = " << nchannels);
+        // the source doesn't own the channels, the application has to apply this
+        if (eventqueue_.write_available()){
+            event e;
+            e.type = AOO_SUBSCRIBE_EVENT;
+            e.subscribe.endpoint = endpoint;
+            // Use 'id' because we want the individual sink! ('sink.id' might be a wildcard)
+            e.subscribe.id = id;
+            e.subscribe.onset = nchannels > 0 ? onset : 0;
+            e.subscribe.nchannels = nchannels > 0 ? nchannels : -1;
+            eventqueue_.write(e);
+            eventnotifier_.notify();
+        }
+    } else {
+        LOG_VERBOSE("ignoring '" << AOO_MSG_SUBSCRIBE << "' message: sink not found");
+    }
+}
+
 
 
 } // aoo
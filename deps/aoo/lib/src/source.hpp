@@ -26,16 +26,36 @@ struct endpoint {
     void *user = nullptr;
     aoo_replyfn fn = nullptr;
     int32_t id = 0;
+    int32_t alias = AOO_ID_NONE; // source ID as seen by this sink
+
+    int32_t source_id(int32_t src) const {
+        return alias != AOO_ID_NONE ? alias : src;
+    }
     
     // methods
-    void send_data(int32_t src, int32_t salt, const data_packet& data) const;
-    void send_data_compact(int32_t src, int32_t salt, const data_packet& data, bool sendrate=false);
+    // a non-empty 'ping' time tag is appended to the message (see AOO_PROTOCOL_FLAG_PING_DATA)
+    void send_data(int32_t src, int32_t salt, const data_packet& data,
+                   time_tag ping = time_tag{}) const;
+    void send_data_compact(int32_t src, int32_t salt, const data_packet& data, bool sendrate=false,
+                           time_tag ping = time_tag{});
 
     void send_format(int32_t src, int32_t salt, const aoo_format& f,
-                     const char *options, int32_t size, const char * userformat = nullptr, int32_t ufsize=0) const;
+                     const char *options, int32_t size, const char * userformat = nullptr, int32_t ufsize=0,
+                     int32_t flags = AOO_PROTOCOL_FLAG_COMPACT_DATA) const;
+
+    void send_parity(int32_t src, int32_t salt, int32_t firstseq, int32_t count,
+                     int32_t sizexor, const char *data, int32_t size) const;
 
     void send_ping(int32_t src, time_tag t) const;
 
+    // 'seq' is the first block which isn't sent (see AOO_PROTOCOL_FLAG_SILENCE)
+    void send_silence(int32_t src, int32_t salt, int32_t seq) const;
+
+    // 'count' consecutive single-frame blocks starting at 'firstseq', which
+    // follow each other in 'data' (see AOO_PROTOCOL_FLAG_PACK)
+    void send_pack(int32_t src, int32_t salt, int32_t firstseq, double samplerate,
+                   int32_t channel, int32_t count, const int32_t *sizes, const char *data) const;
+
     void send(const char *data, int32_t n) const {
         fn(user, data, n);
     }
@@ -52,6 +72,7 @@ struct data_request : endpoint {
     int32_t salt = 0;
     int32_t sequence = 0;
     int32_t frame = 0;
+    void *sink = nullptr; // the sink's own endpoint, 'user' might be an extra path
 };
 
 struct invite_request : endpoint {
@@ -66,29 +87,199 @@ struct invite_request : endpoint {
     int32_t type = 0;
 };
 
+// an extra network path to a sink
+struct sink_path {
+    void *user = nullptr;
+    aoo_replyfn fn = nullptr;
+};
+
+// token bucket (in bytes) for resent data, only used by the send thread
+struct resend_bucket {
+    // refill with 'rate' bytes/s up to 'burst' bytes, then check for 'n' bytes
+    bool allow(double now, double rate, double burst, int32_t n){
+        if (rate <= 0){
+            return true; // no limit
+        }
+        if (time < 0){
+            tokens = burst;
+        } else {
+            tokens = std::min<double>(burst, tokens + (now - time) * rate);
+        }
+        time = now;
+        return tokens >= n;
+    }
+    void take(int32_t n){
+        if (time >= 0){
+            tokens -= n;
+        }
+    }
+    double tokens = 0;
+    double time = -1;
+};
+
+// the blocks which wait to go out together in a /pack message,
+// only used by the send thread
+struct block_pack {
+    int32_t salt = 0;
+    int32_t first = 0; // sequence of the first block
+    int32_t count = 0;
+    int32_t size = 0; // bytes
+};
+
+// a /pack message which is ready to be sent, see source::flush_pack()
+struct pack_send {
+    endpoint ep;
+    int32_t salt = 0;
+    int32_t first = 0;
+    double samplerate = 0;
+    int32_t channel = 0;
+    int32_t count = 0;
+    int32_t sizes[AOO_PACK_MAXBLOCKS];
+    int32_t onset = 0; // in source::packbuffer_
+    int32_t ntimes = 1; // see sink_desc::num_sends()
+};
+
+// the ping for the given path, which is encoded in the lowest bits
+// of the time tag, so the sink doesn't need to know about paths.
+inline time_tag path_ping(time_tag tt, int32_t path){
+    if (!tt.empty()){
+        tt.low = (tt.low & ~3u) | (uint32_t)path;
+    }
+    return tt;
+}
+
 struct sink_desc : endpoint {
     sink_desc(void *_user, aoo_replyfn _fn, int32_t _id)
-        : endpoint(_user, _fn, _id), channel(0), format_changed(true), protocol_flags(0) {}
+        : endpoint(_user, _fn, _id), channel(0), format_changed(true), protocol_flags(0), fec_group(0), packetloss(0),
+          path_mode(AOO_PATH_DUPLICATE), best_path(0), resend_deadline(0), pack_limit(1),
+          redundancy(0), redundancy_level(1) { reset_paths(); }
     sink_desc(const sink_desc& other)
         : endpoint(other.user, other.fn, other.id),
           channel(other.channel.load()),
           format_changed(other.format_changed.load()),
-          protocol_flags(other.protocol_flags.load()){}
+          protocol_flags(other.protocol_flags.load()),
+          fec_group(other.fec_group.load()),
+          packetloss(other.packetloss.load()),
+          path_mode(other.path_mode.load()),
+          best_path(other.best_path.load()),
+          resend_deadline(other.resend_deadline.load()),
+          resend(other.resend),
+          pack_limit(other.pack_limit.load()),
+          pack(other.pack),
+          redundancy(other.redundancy.load()),
+          redundancy_level(other.redundancy_level.load()){ alias = other.alias; copy_paths(other); }
     sink_desc& operator=(const sink_desc& other){
         user = other.user;
         fn = other.fn;
         id = other.id;
+        alias = other.alias;
         channel = other.channel.load();
         format_changed = other.format_changed.load();
         protocol_flags = other.protocol_flags.load();
+        fec_group = other.fec_group.load();
+        packetloss = other.packetloss.load();
+        path_mode = other.path_mode.load();
+        best_path = other.best_path.load();
+        resend_deadline = other.resend_deadline.load();
+        resend = other.resend;
+        pack_limit = other.pack_limit.load();
+        pack = other.pack;
+        redundancy = other.redundancy.load();
+        redundancy_level = other.redundancy_level.load();
+        copy_paths(other);
         return *this;
     }
 
+    // path 0 is the sink endpoint itself
+    endpoint path(int32_t i) const {
+        endpoint ep(*this);
+        if (i > 0 && i < num_paths){
+            ep.user = extra_paths[i - 1].user;
+            ep.fn = extra_paths[i - 1].fn;
+        }
+        return ep;
+    }
+
+    // the path which carries the given block in split mode:
+    // take turns among the live paths, the best path fills in for the others
+    int32_t split_path(int32_t sequence, double now, double timeout) const {
+        auto i = sequence % num_paths;
+        return path_alive(i, now, timeout) ? i : best_path.load();
+    }
+
+    // a path is alive if it has answered one of the last few pings sent over it
+    bool path_alive(int32_t i, double now, double timeout) const {
+        auto t = path_reply[i].load();
+        return t > 0 && (now - t) < timeout;
+    }
+
+    // does the given path carry the block?
+    bool sends_on_path(int32_t i, int32_t sequence, double now, double timeout) const {
+        if (num_paths > 1 && path_mode.load() == AOO_PATH_SPLIT){
+            return i == split_path(sequence, now, timeout);
+        } else {
+            return i < num_paths;
+        }
+    }
+
     // data
     std::atomic<int16_t> channel;
     std::atomic<bool> format_changed;
     std::atomic<int8_t> protocol_flags;
+    std::atomic<int8_t> fec_group; // 0 = no FEC
+    std::atomic<float> packetloss; // smoothed packet loss (percent) reported by the sink
+    // multi-path sending, the paths only change with the writer lock
+    static_assert(AOO_MAXPATHS >= 2, "AOO_MAXPATHS has to leave room for an extra path");
+    sink_path extra_paths[AOO_MAXPATHS - 1];
+    int32_t num_paths = 1;
+    std::atomic<int8_t> path_mode;
+    std::atomic<int8_t> best_path;
+    std::atomic<float> path_rtt[AOO_MAXPATHS]; // smoothed round trip time in seconds, < 0: unknown
+    std::atomic<double> path_reply[AOO_MAXPATHS]; // system time (seconds) of the last ping reply
+    std::atomic<int32_t> resend_deadline; // ms, 0 = none
+    resend_bucket resend;
+    std::atomic<int8_t> pack_limit; // max. blocks per packet, 1 = no packing
+    block_pack pack;
+    // max. times each frame is sent, 0 = the source's aoo_opt_redundancy for every frame
+    std::atomic<int8_t> redundancy;
+    std::atomic<int8_t> redundancy_level; // what the packet loss asks for, 1 to redundancy
+
+    // how many times each frame goes to the sink
+    int32_t num_sends(int32_t fixed) const {
+        return redundancy.load() > 0 ? redundancy_level.load() : fixed;
+    }
+
+    // one more time for every AOO_REDUNDANCY_LOSS percent of packet loss, but one
+    // less only once the loss is below half of that step, so it doesn't flap
+    void update_redundancy(){
+        int32_t max = redundancy.load();
+        if (max <= 0){
+            return;
+        }
+        auto loss = packetloss.load();
+        int32_t level = redundancy_level.load();
+        while (level < max && loss >= level * AOO_REDUNDANCY_LOSS){
+            ++level;
+        }
+        while (level > 1 && loss < (level - 1) * AOO_REDUNDANCY_LOSS * 0.5f){
+            --level;
+        }
+        redundancy_level = std::max<int32_t>(1, std::min<int32_t>(level, max));
+    }
 
+    void reset_paths(){
+        for (auto& rtt : path_rtt) rtt = -1.f;
+        for (auto& t : path_reply) t = 0;
+    }
+private:
+    void copy_paths(const sink_desc& other){
+        std::copy(std::begin(other.extra_paths), std::end(other.extra_paths), extra_paths);
+        num_paths = other.num_paths;
+        for (int i = 0; i < AOO_MAXPATHS; ++i){
+            path_rtt[i] = other.path_rtt[i].load();
+            path_reply[i] = other.path_reply[i].load();
+        }
+    }
 };
 
 class source final : public isource {
@@ -98,6 +289,7 @@ class source final : public isource {
         aoo_event_type type;
         aoo_sink_event sink;
         aoo_ping_event ping;
+        aoo_subscribe_event subscribe;
     } event;
 
     source(int32_t id);
@@ -111,18 +303,33 @@ class source final : public isource {
 
     int32_t remove_sink(void *sink, int32_t id) override;
 
+    int32_t add_sink_path(void *sink, int32_t id, void *path, aoo_replyfn fn) override;
+
+    int32_t remove_sink_path(void *sink, int32_t id, void *path) override;
+
     void remove_all() override;
 
     int32_t handle_message(const char *data, int32_t n, void *endpoint, aoo_replyfn fn) override;
 
     int32_t send() override;
 
+    int32_t try_send() override;
+
     int32_t process(const aoo_sample **data, int32_t n, uint64_t t) override;
 
+    int32_t process_resampled(const aoo_sample **data, int32_t n,
+                              int32_t samplerate, uint64_t t) override;
+
+    int32_t process_encoded(const char *data, int32_t size, uint64_t t) override;
+
     int32_t events_available() override;
 
     int32_t handle_events(aoo_eventhandler fn, void *user) override;
 
+    int32_t set_event_notify(aoo_notifyfn fn, void *user) override;
+
+    int32_t set_clock(iclock *clock) override;
+
     int32_t set_option(int32_t opt, void *ptr, int32_t size) override;
 
     int32_t get_option(int32_t opt, void *ptr, int32_t size) override;
@@ -149,20 +356,56 @@ class source final : public isource {
     int32_t sequence_ = 0;
     std::atomic<int32_t> dropped_{0};
     std::atomic<float> lastpingtime_{0};
+    int32_t pingcount_ = 0; // the extra paths are pinged in turn
+    // silence suppression, only used by the send thread (see update_silence())
+    int64_t silentframes_ = 0; // number of silent frames in a row
+    int64_t silencemarker_ = 0; // 'silentframes_' at the last /silence message
+    int32_t silentseq_ = -1; // first suppressed block, -1: not suppressing
     std::atomic<bool> format_changed_{false};
     std::atomic<bool> play_{false};
     // timing
     time_dll dll_;
     timer timer_;
+    std::atomic<iclock *> clock_{nullptr}; // shared instead of dll_
+    double dll_samplerate() const {
+        auto c = clock_.load(std::memory_order_acquire);
+        return c ? c->get_samplerate() : dll_.samplerate();
+    }
     // buffers and queues
     std::vector<char> sendbuffer_;
-    dynamic_resampler resampler_;
-    lockfree::queue<aoo_sample> audioqueue_;
-    lockfree::queue<double> srqueue_;
+    // What process() and process_encoded() write to, with the format it is
+    // made for. A new format or new settings get a new one, see update().
+    struct stream_buffer {
+        int32_t nchannels = 0;
+        int32_t samplerate = 0; // of the encoder
+        int32_t blocksize = 0; // of the encoder
+        uint32_t generation = 0;
+        dynamic_resampler resampler;
+        int32_t insamplerate = 0; // of the input, 0 = the setup() samplerate
+        lockfree::queue<aoo_sample> audioqueue;
+        lockfree::queue<double> srqueue;
+        // blocks from process_encoded(), each slot is the size followed by the data
+        lockfree::queue<char> encodedqueue;
+    };
+    // what a new format or new settings replace, set up without the lock
+    struct stream_setup {
+        std::unique_ptr<aoo::encoder> encoder;
+        std::unique_ptr<stream_buffer> buffer;
+    };
+    // Only swapped with the writer lock held, so the send thread can use it
+    // under the reader lock, see buffer(). The audio thread doesn't take the
+    // lock: it announces the buffer it works on in 'playing_', and a
+    // replaced buffer is only freed once it is not in there.
+    std::atomic<stream_buffer *> buffer_{nullptr};
+    std::atomic<stream_buffer *> playing_{nullptr};
+    uint32_t generation_ = 0; // bumped with every change, under the writer lock
+    uint32_t playgeneration_ = 0; // of the buffer process() saw last
     lockfree::queue<event> eventqueue_;
+    event_notifier eventnotifier_;
     lockfree::queue<endpoint> formatrequestqueue_;
     lockfree::queue<data_request> datarequestqueue_;
     history_buffer history_;
+    std::vector<char> paritybuffer_[AOO_FEC_MAXGROUP + 1]; // indexed by group size
     // sinks
     std::vector<sink_desc> sinks_;
     // thread synchronization
@@ -173,11 +416,15 @@ class source final : public isource {
     std::atomic<int32_t> packetsize_{ AOO_PACKETSIZE };
     std::atomic<int32_t> resend_buffersize_{ AOO_RESEND_BUFSIZE };
     std::atomic<int32_t> redundancy_{ AOO_SEND_REDUNDANCY };
+    std::atomic<int32_t> bitrate_{ 0 };
+    std::atomic<int32_t> complexity_{ -1 };
     std::atomic<int32_t> dynamic_resampling_{ 1 };
     std::atomic<float> bandwidth_{ AOO_TIMEFILTER_BANDWIDTH };
     std::atomic<float> ping_interval_{ AOO_PING_INTERVAL * 0.001 };
     std::atomic<int32_t> protocol_flags_{ 0 };
     std::atomic<int32_t> respect_codec_change_req_{ 0 };
+    std::atomic<float> resend_budget_{ AOO_RESEND_BUDGET };
+    std::atomic<float> resend_total_budget_{ AOO_RESEND_TOTAL_BUDGET };
     std::vector<char> userformat_;
     // runtime
     double prev_sent_samplerate_ = 0.0;
@@ -185,10 +432,20 @@ class source final : public isource {
     std::atomic<int32_t> flushingout_ { 0 };
     bool lastplay_ = false;
     int32_t pushing_silent_frames_ = 0;
+    int32_t packetloss_ = -1; // packet loss hint passed to the encoder
+    int32_t encoder_bitrate_ = -1; // bitrate passed to the encoder
+    int32_t encoder_complexity_ = -1; // complexity passed to the encoder
+    double avg_blocksize_ = 0; // bytes, for the resend budget
+    resend_bucket resend_;
+    // the finished /pack messages of a block, only used by the send thread
+    std::vector<pack_send> packsends_;
+    std::vector<char> packbuffer_;
     
     // helper methods
     sink_desc * find_sink(void *endpoint, int32_t id);
 
+    bool has_alias(int32_t id);
+
     int32_t set_format(aoo_format& f);
     int32_t set_userformat(void * ptr, int32_t size);
 
@@ -196,16 +453,56 @@ class source final : public isource {
 
     void update();
 
+    void update(stream_setup& setup);
+
+    std::unique_ptr<stream_buffer> make_stream(int32_t nchannels, int32_t samplerate,
+                                               int32_t blocksize, int32_t codecnchannels,
+                                               int32_t codecsr, int32_t codecblocksize,
+                                               int32_t buffersize);
+
+    stream_buffer * install_stream(stream_setup& setup);
+
+    void retire_buffer(stream_buffer *b);
+
+    stream_buffer * acquire_buffer();
+
+    void release_buffer();
+
+    // call with (shared) lock!
+    stream_buffer& buffer() const { return *buffer_.load(std::memory_order_relaxed); }
+
+    int32_t do_process(stream_buffer& b, const aoo_sample **data, int32_t n, int32_t samplerate);
+
     void update_historybuffer();
 
+    bool update_timer(uint64_t t);
+
     bool send_format();
 
-    bool send_data();
+    // with trylock, -1 if a lock was taken before anything was done
+    int32_t send_data(bool trylock = false);
+
+    int32_t make_parity(int32_t lastseq, int32_t count, int32_t& sizexor);
 
     bool resend_data();
 
     bool send_ping();
 
+    bool update_silence(stream_buffer& b, int32_t seq, bool& marker);
+
+    int32_t pack_factor(const sink_desc& sink, double blockdur) const;
+
+    bool pack_block(sink_desc& sink, const data_packet& d, int32_t salt,
+                    int32_t factor, bool suppressed);
+
+    void flush_pack(sink_desc& sink, int32_t salt);
+
+    void send_packs();
+
+    double path_timeout() const;
+
+    void update_best_path(sink_desc& sink, double now);
+
     void handle_format_request(void *endpoint, aoo_replyfn fn,
                                const osc::ReceivedMessage& msg);
 
@@ -223,6 +520,9 @@ class source final : public isource {
     
     void handle_codec_change(void *endpoint, aoo_replyfn fn,
                                const osc::ReceivedMessage& msg);
+
+    void handle_subscribe(void *endpoint, aoo_replyfn fn,
+                          const osc::ReceivedMessage& msg);
 };
 
 } // aoo
@@ -13,6 +13,32 @@
 
 namespace aoo {
 
+/*////////////////// event notifier ////////////////////*/
+
+// calls the user's notification function after an event has been pushed.
+// can be set at any time. 'fn' is published after 'user', so a caller
+// never sees a function without its argument.
+class event_notifier {
+public:
+    typedef void (*function)(void *);
+
+    void set(function fn, void *user){
+        fn_.store(nullptr, std::memory_order_release);
+        user_.store(user, std::memory_order_relaxed);
+        fn_.store(fn, std::memory_order_release);
+    }
+
+    void notify() const {
+        auto fn = fn_.load(std::memory_order_acquire);
+        if (fn){
+            fn(user_.load(std::memory_order_relaxed));
+        }
+    }
+private:
+    std::atomic<function> fn_{nullptr};
+    std::atomic<void *> user_{nullptr};
+};
+
 /*////////////////// simple spin lock ////////////////////*/
 
 class spinlock {
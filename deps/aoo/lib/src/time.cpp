@@ -6,9 +6,12 @@
 
 #include "aoo/aoo_utils.hpp"
 
+#include <atomic>
 #include <chrono>
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <cstdlib>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -45,8 +48,18 @@ system_time_fn get_system_time = [](){
 
 #endif
 
-// OSC time stamp (NTP time)
-time_tag time_tag::now(){
+#if AOO_VIRTUAL_TIME
+
+static std::atomic<uint64_t> virtual_now{0};
+
+void time_tag::set_virtual_now(time_tag t){
+    virtual_now.store(t.to_uint64(), std::memory_order_relaxed);
+}
+
+#endif
+
+// the wall clock as OSC time stamp (NTP time)
+static time_tag system_now(){
 #if 1
 #if defined(_WIN32)
     // make sure to get the highest precision
@@ -87,6 +100,125 @@ time_tag time_tag::now(){
     return time_tag(high, low);
 }
 
+#ifndef AOO_MONOTONIC_TIME
+#define AOO_MONOTONIC_TIME 1
+#endif
+
+#if AOO_MONOTONIC_TIME
+
+// The wall clock jumps whenever it gets set, and the timers take every jump
+// for a glitch of the audio clock (see timer::update()). So time tags come from
+// the monotonic clock (CLOCK_MONOTONIC, mach_absolute_time() or QPC, through
+// std::chrono::steady_clock), plus an offset to the wall clock learned at the
+// first call. Once a second the offset is compared to the wall clock again and
+// slewed towards it over the next second by at most MAX_SLEW, so the two
+// clocks don't drift apart, but a step is never followed and the time tags
+// never go backwards.
+namespace {
+
+const int64_t ONE_SECOND = 1000000000;
+const int64_t MAX_SLEW = 50000; // 50 us a second = 50 ppm
+const int64_t MAX_ERROR = ONE_SECOND; // beyond that it's a step
+
+int64_t monotonic_ns(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t to_ns(time_tag t){
+    return (int64_t)t.high * ONE_SECOND
+        + (int64_t)(((uint64_t)t.low * (uint64_t)ONE_SECOND) >> 32);
+}
+
+time_tag from_ns(int64_t ns){
+    auto d = lldiv(ns, ONE_SECOND);
+    return time_tag((uint32_t)d.quot, (uint32_t)(((uint64_t)d.rem << 32) / ONE_SECOND));
+}
+
+// wall clock minus monotonic clock, in nanoseconds
+int64_t measure_offset(){
+    // the tightest of a few tries, in case we get preempted in between
+    int64_t best = 0;
+    int64_t best_width = INT64_MAX;
+    for (int i = 0; i < 4; ++i){
+        auto t1 = monotonic_ns();
+        auto wall = to_ns(system_now());
+        auto t2 = monotonic_ns();
+        if (t2 - t1 < best_width){
+            best_width = t2 - t1;
+            best = wall - (t1 + (t2 - t1) / 2);
+        }
+    }
+    return best;
+}
+
+class monotonic_clock {
+public:
+    monotonic_clock(){
+        auto mono = monotonic_ns();
+        base_.store(mono, std::memory_order_relaxed);
+        offset_.store(measure_offset(), std::memory_order_relaxed);
+        next_check_.store(mono + ONE_SECOND, std::memory_order_relaxed);
+    }
+
+    time_tag now(){
+        auto mono = monotonic_ns();
+        auto check = next_check_.load(std::memory_order_relaxed);
+        if (mono >= check && next_check_.compare_exchange_strong(check, mono + ONE_SECOND)){
+            // only one thread at a time gets here
+            auto current = offset_at(mono);
+            auto error = measure_offset() - current;
+            auto slew = (error > -MAX_ERROR && error < MAX_ERROR) ?
+                std::max<int64_t>(-MAX_SLEW, std::min<int64_t>(MAX_SLEW, error)) : 0;
+            // seqlock: the readers try again if they catch us in between
+            seq_.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            base_.store(mono, std::memory_order_relaxed);
+            offset_.store(current, std::memory_order_relaxed);
+            slew_.store(slew, std::memory_order_relaxed);
+            seq_.fetch_add(1, std::memory_order_release);
+        }
+        return from_ns(mono + offset_at(mono));
+    }
+private:
+    std::atomic<uint32_t> seq_{0};
+    std::atomic<int64_t> base_{0}; // where the current slew starts
+    std::atomic<int64_t> offset_{0}; // the offset at that point
+    std::atomic<int64_t> slew_{0}; // what it changes over the next second
+    std::atomic<int64_t> next_check_{0};
+
+    int64_t offset_at(int64_t mono) const {
+        int64_t base, offset, slew;
+        uint32_t seq;
+        do {
+            seq = seq_.load(std::memory_order_acquire);
+            base = base_.load(std::memory_order_relaxed);
+            offset = offset_.load(std::memory_order_relaxed);
+            slew = slew_.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while ((seq & 1) || seq != seq_.load(std::memory_order_relaxed));
+
+        auto elapsed = std::max<int64_t>(0, std::min<int64_t>(ONE_SECOND, mono - base));
+        return offset + slew * elapsed / ONE_SECOND;
+    }
+};
+
+} // namespace
+
+#endif // AOO_MONOTONIC_TIME
+
+// OSC time stamp (NTP time)
+time_tag time_tag::now(){
+#if AOO_VIRTUAL_TIME
+    return time_tag(virtual_now.load(std::memory_order_relaxed));
+#elif AOO_MONOTONIC_TIME
+    static monotonic_clock mono_clock;
+    return mono_clock.now();
+#else
+    return system_now();
+#endif
+}
+
 double time_tag::duration(time_tag t1, time_tag t2){
     if (t2 >= t1){
         return (t2 - t1).to_double();
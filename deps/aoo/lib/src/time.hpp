@@ -14,6 +14,12 @@ namespace aoo {
 struct time_tag {
     static time_tag now();
 
+#if AOO_VIRTUAL_TIME
+    // simulations run the clock themselves, faster than real time,
+    // and now() returns whatever they set last (see bench/aoo_loopback.cpp)
+    static void set_virtual_now(time_tag t);
+#endif
+
     static double duration(time_tag t1, time_tag t2);
 
     time_tag() = default;
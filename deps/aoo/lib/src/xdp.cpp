@@ -0,0 +1,615 @@
+/* Copyright (c) 2010-Now Christof Ressi, Winfried Ritsch and others.
+ * For information on usage and redistribution, and for a DISCLAIMER OF ALL
+ * WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#include "xdp.hpp"
+
+#if AOO_HAVE_XDP
+
+#include "aoo/aoo_utils.hpp"
+
+#include <linux/ethtool.h>
+#include <linux/if_link.h>
+#include <linux/sockios.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifndef XDP_FLAGS_SKB_MODE
+# define XDP_FLAGS_SKB_MODE (1U << 1)
+#endif
+#ifndef XDP_FLAGS_DRV_MODE
+# define XDP_FLAGS_DRV_MODE (1U << 2)
+#endif
+
+namespace aoo {
+namespace net {
+
+namespace {
+
+const uint32_t num_frames = 4096;
+const uint32_t ring_size = 2048;
+// frames kept back from the fill ring for the copies of forwarded packets
+const size_t copy_reserve = 512;
+// neighbours we haven't heard from in a while go through the kernel again
+const double neighbour_timeout = 30.0;
+
+int bpf(int cmd, union bpf_attr& attr){
+    return (int)syscall(__NR_bpf, cmd, &attr, sizeof(attr));
+}
+
+// a tiny assembler for the XDP program
+struct program {
+    std::vector<struct bpf_insn> insns;
+    std::vector<size_t> passjumps; // to be patched to the 'pass' label
+
+    void emit(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm){
+        struct bpf_insn insn;
+        memset(&insn, 0, sizeof(insn));
+        insn.code = code;
+        insn.dst_reg = dst;
+        insn.src_reg = src;
+        insn.off = off;
+        insn.imm = imm;
+        insns.push_back(insn);
+    }
+    void load(uint8_t size, uint8_t dst, uint8_t src, int16_t off){
+        emit(BPF_LDX | BPF_MEM | size, dst, src, off, 0);
+    }
+    // to 'pass' unless (dst op imm)
+    void pass_unless(uint8_t op, uint8_t dst, int32_t imm){
+        passjumps.push_back(insns.size());
+        emit(BPF_JMP | op | BPF_K, dst, 0, 0, imm);
+    }
+    void pass_here(){
+        for (auto i : passjumps){
+            insns[i].off = (int16_t)(insns.size() - i - 1);
+        }
+    }
+};
+
+// little endian loads of the packet bytes, as the BPF program sees them
+uint32_t le32(const char *s){
+    return (uint32_t)(uint8_t)s[0] | ((uint32_t)(uint8_t)s[1] << 8)
+            | ((uint32_t)(uint8_t)s[2] << 16) | ((uint32_t)(uint8_t)s[3] << 24);
+}
+
+// passes IPv4/UDP packets for 'port' which start with "/aoo/rel" (relay) or
+// "/aoo/for" (forward) to the AF_XDP socket of their queue, the rest to the kernel
+std::vector<struct bpf_insn> make_program(int mapfd, uint16_t port){
+    static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "the program is written for little endian");
+    const int payload = xdp_port::header_size;
+    program p;
+    // r2 = data, r3 = data_end
+    p.load(BPF_W, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, data));
+    p.load(BPF_W, BPF_REG_3, BPF_REG_1, offsetof(struct xdp_md, data_end));
+    // the headers and the first 8 bytes of the payload must be there
+    p.emit(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0);
+    p.emit(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, payload + 8);
+    p.passjumps.push_back(p.insns.size());
+    p.emit(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 0, 0);
+    // ethertype IPv4
+    p.load(BPF_H, BPF_REG_5, BPF_REG_2, 12);
+    p.pass_unless(BPF_JNE, BPF_REG_5, 0x0008);
+    // no IP options
+    p.load(BPF_B, BPF_REG_5, BPF_REG_2, 14);
+    p.pass_unless(BPF_JNE, BPF_REG_5, 0x45);
+    // UDP
+    p.load(BPF_B, BPF_REG_5, BPF_REG_2, 23);
+    p.pass_unless(BPF_JNE, BPF_REG_5, 17);
+    // not a fragment (MF flag and offset)
+    p.load(BPF_H, BPF_REG_5, BPF_REG_2, 20);
+    p.emit(BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_5, 0, 0, 0xff3f);
+    p.pass_unless(BPF_JNE, BPF_REG_5, 0);
+    // our port
+    p.load(BPF_H, BPF_REG_5, BPF_REG_2, 36);
+    p.pass_unless(BPF_JNE, BPF_REG_5, port); // already network order
+    // "/aoo/rel" or "/aoo/for"
+    p.load(BPF_W, BPF_REG_5, BPF_REG_2, payload);
+    p.pass_unless(BPF_JNE, BPF_REG_5, (int32_t)le32("/aoo"));
+    p.load(BPF_W, BPF_REG_5, BPF_REG_2, payload + 4);
+    p.emit(BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_5, 0, 1, (int32_t)le32("/rel"));
+    p.pass_unless(BPF_JNE, BPF_REG_5, (int32_t)le32("/for"));
+    // bpf_redirect_map(&map, ctx->rx_queue_index, XDP_PASS), the kernel gets what has no socket
+    p.load(BPF_W, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, rx_queue_index));
+    p.emit(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, mapfd);
+    p.emit(0, 0, 0, 0, 0);
+    p.emit(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS);
+    p.emit(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map);
+    p.emit(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+    p.pass_here();
+    p.emit(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS);
+    p.emit(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+    return std::move(p.insns);
+}
+
+// one's complement sum of 16 bit words, in whatever byte order (RFC 1071)
+uint32_t checksum_add(uint32_t sum, const void *data, size_t len){
+    auto p = (const char *)data;
+    for (; len > 1; p += 2, len -= 2){
+        uint16_t w;
+        memcpy(&w, p, 2);
+        sum += w;
+    }
+    if (len > 0){
+        uint16_t w = 0;
+        memcpy(&w, p, 1);
+        sum += w;
+    }
+    return sum;
+}
+
+uint16_t checksum_fold(uint32_t sum){
+    while (sum >> 16){
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+template<typename T>
+T xdp_option(int fd, int name, T value){
+    setsockopt(fd, SOL_XDP, name, &value, sizeof(value));
+    return value;
+}
+
+bool map_ring(int fd, uint64_t pgoff, const struct xdp_ring_offset& off,
+              uint32_t size, size_t descsize, void *& map, size_t& mapsize,
+              uint32_t *& producer, uint32_t *& consumer, uint32_t *& flags, void *& descs){
+    mapsize = off.desc + size * descsize;
+    map = mmap(nullptr, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+    if (map == MAP_FAILED){
+        map = nullptr;
+        return false;
+    }
+    auto base = (char *)map;
+    producer = (uint32_t *)(base + off.producer);
+    consumer = (uint32_t *)(base + off.consumer);
+    flags = (uint32_t *)(base + off.flags);
+    descs = base + off.desc;
+    return true;
+}
+
+} // namespace
+
+bool xdp_port::open(const char *ifname, int port, int queues){
+    close();
+
+    auto ifindex = if_nametoindex(ifname);
+    if (ifindex == 0){
+        LOG_ERROR("aoo_server: no network interface " << ifname);
+        return false;
+    }
+    port_ = htons((uint16_t)port);
+
+    // our link layer address, the MTU and the number of queues
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+    if (sock < 0 || ioctl(sock, SIOCGIFHWADDR, &ifr) != 0){
+        LOG_ERROR("aoo_server: couldn't get the address of " << ifname << " (" << errno << ")");
+        if (sock >= 0){
+            ::close(sock);
+        }
+        return false;
+    }
+    memcpy(mac_, ifr.ifr_hwaddr.sa_data, 6);
+    if (ioctl(sock, SIOCGIFMTU, &ifr) == 0){
+        mtu_ = ifr.ifr_mtu;
+    }
+    if (queues <= 0){
+        struct ethtool_channels channels;
+        memset(&channels, 0, sizeof(channels));
+        channels.cmd = ETHTOOL_GCHANNELS;
+        ifr.ifr_data = (char *)&channels;
+        if (ioctl(sock, SIOCETHTOOL, &ifr) == 0){
+            queues = std::max<int>(channels.combined_count, channels.rx_count);
+        }
+        queues = std::max(queues, 1);
+    }
+    ::close(sock);
+
+    // the sockets, by receive queue
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(int);
+    attr.value_size = sizeof(int);
+    attr.max_entries = queues;
+    mapfd_ = bpf(BPF_MAP_CREATE, attr);
+    if (mapfd_ < 0){
+        LOG_ERROR("aoo_server: couldn't create the XDP socket map (" << errno << ")");
+        close();
+        return false;
+    }
+
+    auto insns = make_program(mapfd_, port_);
+    const char license[] = "GPL";
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uint64_t)(uintptr_t)insns.data();
+    attr.insn_cnt = (uint32_t)insns.size();
+    attr.license = (uint64_t)(uintptr_t)license;
+    progfd_ = bpf(BPF_PROG_LOAD, attr);
+    if (progfd_ < 0){
+        int err = errno;
+        // again, for the verifier to tell why
+        std::vector<char> log(65536);
+        attr.log_buf = (uint64_t)(uintptr_t)log.data();
+        attr.log_size = (uint32_t)log.size();
+        attr.log_level = 1;
+        bpf(BPF_PROG_LOAD, attr);
+        LOG_ERROR("aoo_server: couldn't load the XDP program (" << err << "): " << log.data());
+        close();
+        return false;
+    }
+
+    for (int i = 0; i < queues; ++i){
+        auto q = std::make_unique<queue>();
+        if (!open_queue(*q, ifindex, i)){
+            LOG_ERROR("aoo_server: couldn't open an XDP socket for queue " << i
+                      << " of " << ifname << " (" << errno << ")");
+            close_queue(*q);
+            close();
+            return false;
+        }
+        memset(&attr, 0, sizeof(attr));
+        attr.map_fd = mapfd_;
+        attr.key = (uint64_t)(uintptr_t)&q->id;
+        attr.value = (uint64_t)(uintptr_t)&q->fd;
+        if (bpf(BPF_MAP_UPDATE_ELEM, attr) != 0){
+            LOG_ERROR("aoo_server: couldn't add the XDP socket (" << errno << ")");
+            close_queue(*q);
+            close();
+            return false;
+        }
+        queues_.push_back(std::move(q));
+    }
+
+    // in the driver if it can, generic otherwise. the program goes away with the link
+    for (auto mode : { XDP_FLAGS_DRV_MODE, XDP_FLAGS_SKB_MODE }){
+        memset(&attr, 0, sizeof(attr));
+        attr.link_create.prog_fd = progfd_;
+        attr.link_create.target_ifindex = ifindex;
+        attr.link_create.attach_type = BPF_XDP;
+        attr.link_create.flags = mode;
+        linkfd_ = bpf(BPF_LINK_CREATE, attr);
+        if (linkfd_ >= 0){
+            LOG_VERBOSE("aoo_server: XDP fast path on " << ifname << " with " << queues
+                        << (queues > 1 ? " queues" : " queue")
+                        << (mode == XDP_FLAGS_DRV_MODE ? " (native)" : " (generic)"));
+            return true;
+        }
+    }
+    LOG_ERROR("aoo_server: couldn't attach the XDP program to " << ifname << " (" << errno << ")");
+    close();
+    return false;
+}
+
+bool xdp_port::open_queue(queue& q, int ifindex, int id){
+    q.id = id;
+    q.fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+    if (q.fd < 0){
+        return false;
+    }
+
+    q.umemsize = (size_t)num_frames * frame_size;
+    auto umem = mmap(nullptr, q.umemsize, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (umem == MAP_FAILED){
+        return false;
+    }
+    q.umem = (char *)umem;
+
+    struct xdp_umem_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.addr = (uint64_t)(uintptr_t)q.umem;
+    reg.len = q.umemsize;
+    reg.chunk_size = frame_size;
+    reg.headroom = 0;
+    if (setsockopt(q.fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) != 0){
+        return false;
+    }
+    q.fill.size = xdp_option(q.fd, XDP_UMEM_FILL_RING, ring_size);
+    q.completion.size = xdp_option(q.fd, XDP_UMEM_COMPLETION_RING, ring_size);
+    q.rx.size = xdp_option(q.fd, XDP_RX_RING, ring_size);
+    q.tx.size = xdp_option(q.fd, XDP_TX_RING, ring_size);
+
+    struct xdp_mmap_offsets off;
+    socklen_t optlen = sizeof(off);
+    if (getsockopt(q.fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) != 0){
+        return false;
+    }
+    for (auto r : { &q.fill, &q.completion, &q.rx, &q.tx }){
+        r->mask = r->size - 1;
+    }
+    if (!map_ring(q.fd, XDP_UMEM_PGOFF_FILL_RING, off.fr, q.fill.size, sizeof(uint64_t), q.fill.map,
+                  q.fill.mapsize, q.fill.producer, q.fill.consumer, q.fill.flags, q.fill.descs)
+        || !map_ring(q.fd, XDP_UMEM_PGOFF_COMPLETION_RING, off.cr, q.completion.size, sizeof(uint64_t),
+                     q.completion.map, q.completion.mapsize, q.completion.producer,
+                     q.completion.consumer, q.completion.flags, q.completion.descs)
+        || !map_ring(q.fd, XDP_PGOFF_RX_RING, off.rx, q.rx.size, sizeof(struct xdp_desc), q.rx.map,
+                     q.rx.mapsize, q.rx.producer, q.rx.consumer, q.rx.flags, q.rx.descs)
+        || !map_ring(q.fd, XDP_PGOFF_TX_RING, off.tx, q.tx.size, sizeof(struct xdp_desc), q.tx.map,
+                     q.tx.mapsize, q.tx.producer, q.tx.consumer, q.tx.flags, q.tx.descs))
+    {
+        return false;
+    }
+
+    q.free.reserve(num_frames);
+    for (uint32_t i = 0; i < num_frames; ++i){
+        q.free.push_back((uint64_t)i * frame_size);
+    }
+    refill(q);
+
+    // zero copy where the driver supports it
+    struct sockaddr_xdp sxdp;
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = ifindex;
+    sxdp.sxdp_queue_id = id;
+    sxdp.sxdp_flags = XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP;
+    if (bind(q.fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) != 0){
+        sxdp.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+        if (bind(q.fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) != 0){
+            return false;
+        }
+    }
+    return true;
+}
+
+void xdp_port::close_queue(queue& q){
+    // the socket first, then the memory the kernel was using
+    if (q.fd >= 0){
+        ::close(q.fd);
+        q.fd = -1;
+    }
+    for (auto r : { &q.fill, &q.completion, &q.rx, &q.tx }){
+        if (r->map){
+            munmap(r->map, r->mapsize);
+            r->map = nullptr;
+        }
+    }
+    if (q.umem){
+        munmap(q.umem, q.umemsize);
+        q.umem = nullptr;
+    }
+}
+
+void xdp_port::close(){
+    // detaches the program, the packets go to the kernel again
+    if (linkfd_ >= 0){
+        ::close(linkfd_);
+        linkfd_ = -1;
+    }
+    for (auto& q : queues_){
+        close_queue(*q);
+    }
+    queues_.clear();
+    if (progfd_ >= 0){
+        ::close(progfd_);
+        progfd_ = -1;
+    }
+    if (mapfd_ >= 0){
+        ::close(mapfd_);
+        mapfd_ = -1;
+    }
+    neighbours_.clear();
+}
+
+int xdp_port::find_queue(void *tag) const {
+    for (int i = 0; i < (int)queues_.size(); ++i){
+        if (queues_[i].get() == tag){
+            return i;
+        }
+    }
+    return -1;
+}
+
+void xdp_port::refill(queue& q){
+    auto& r = q.fill;
+    auto producer = *r.producer;
+    auto room = r.size - (producer - __atomic_load_n(r.consumer, __ATOMIC_ACQUIRE));
+    auto addrs = (uint64_t *)r.descs;
+    uint32_t n = 0;
+    while (n < room && q.free.size() > copy_reserve){
+        addrs[(producer + n) & r.mask] = q.free.back();
+        q.free.pop_back();
+        n++;
+    }
+    if (n > 0){
+        __atomic_store_n(r.producer, producer + n, __ATOMIC_RELEASE);
+    }
+}
+
+int xdp_port::receive(int queue, packet *packets, int max, double now){
+    auto& q = *queues_[queue];
+    auto& r = q.rx;
+    auto consumer = *r.consumer;
+    auto available = __atomic_load_n(r.producer, __ATOMIC_ACQUIRE) - consumer;
+    auto n = std::min<uint32_t>(available, max);
+    auto descs = (struct xdp_desc *)r.descs;
+    int count = 0;
+
+    for (uint32_t i = 0; i < n; ++i){
+        auto& desc = descs[(consumer + i) & r.mask];
+        auto frame = q.umem + desc.addr;
+        // the program has checked most of it
+        uint16_t ethertype, udplen;
+        memcpy(&ethertype, frame + 12, 2);
+        memcpy(&udplen, frame + 38, 2);
+        udplen = ntohs(udplen);
+        if (desc.len < (uint32_t)header_size || ethertype != htons(0x0800)
+            || (uint8_t)frame[14] != 0x45 || frame[23] != 17
+            || udplen < 8 || udplen - 8 > (int32_t)desc.len - header_size)
+        {
+            q.free.push_back(desc.addr & ~(uint64_t)(frame_size - 1));
+            continue;
+        }
+
+        uint32_t srcaddr;
+        uint16_t srcport;
+        memcpy(&srcaddr, frame + 26, 4);
+        memcpy(&srcport, frame + 34, 2);
+
+        // wherever it came from is where the packets for the sender go
+        auto& nb = neighbours_[srcaddr];
+        memcpy(nb.mac, frame + 6, 6);
+        nb.time = now;
+
+        auto& p = packets[count++];
+        p.data = frame + header_size;
+        p.size = udplen - 8;
+        p.capacity = frame_size - (int32_t)(desc.addr & (frame_size - 1)) - header_size;
+        p.addr = ip_address(ntohl(srcaddr), ntohs(srcport));
+        p.frame = desc.addr;
+        memcpy(&p.local, frame + 30, 4);
+        p.tos = (uint8_t)frame[15];
+        p.taken = false;
+    }
+    __atomic_store_n(r.consumer, consumer + n, __ATOMIC_RELEASE);
+
+    if (now - last_purge_ > neighbour_timeout){
+        for (auto it = neighbours_.begin(); it != neighbours_.end(); ){
+            if (now - it->second.time > neighbour_timeout){
+                it = neighbours_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        last_purge_ = now;
+    }
+    return count;
+}
+
+void xdp_port::write_headers(char *frame, const packet& p, const neighbour& n,
+                             const struct sockaddr_in& dest, int32_t size){
+    auto ip = frame + 14;
+    auto udp = ip + 20;
+
+    memcpy(frame, n.mac, 6);
+    memcpy(frame + 6, mac_, 6);
+    uint16_t ethertype = htons(0x0800);
+    memcpy(frame + 12, &ethertype, 2);
+
+    uint16_t iplen = htons((uint16_t)(20 + 8 + size));
+    uint16_t fragoff = htons(0x4000); // don't fragment
+    memset(ip, 0, 20);
+    ip[0] = 0x45;
+    ip[1] = (char)p.tos;
+    memcpy(ip + 2, &iplen, 2);
+    memcpy(ip + 6, &fragoff, 2);
+    ip[8] = 64; // TTL
+    ip[9] = 17; // UDP
+    memcpy(ip + 12, &p.local, 4);
+    memcpy(ip + 16, &dest.sin_addr, 4);
+    auto ipsum = checksum_fold(checksum_add(0, ip, 20));
+    memcpy(ip + 10, &ipsum, 2);
+
+    uint16_t udplen = htons((uint16_t)(8 + size));
+    memcpy(udp, &port_, 2);
+    memcpy(udp + 2, &dest.sin_port, 2);
+    memcpy(udp + 4, &udplen, 2);
+    memset(udp + 6, 0, 2);
+    // the pseudo header: addresses, protocol and length
+    char pseudo[12];
+    memcpy(pseudo, ip + 12, 8);
+    pseudo[8] = 0;
+    pseudo[9] = 17;
+    memcpy(pseudo + 10, &udplen, 2);
+    auto udpsum = checksum_fold(checksum_add(checksum_add(0, pseudo, 12), udp, 8 + size));
+    if (udpsum == 0){
+        udpsum = 0xffff; // 0 would mean 'no checksum'
+    }
+    memcpy(udp + 6, &udpsum, 2);
+}
+
+bool xdp_port::send(int queue, packet& p, int32_t size, const ip_address& dest, bool last){
+    if (dest.address.ss_family != AF_INET || size + header_size > mtu_ + 14){
+        return false;
+    }
+    struct sockaddr_in sa;
+    memcpy(&sa, &dest.address, sizeof(sa));
+    auto it = neighbours_.find(sa.sin_addr.s_addr);
+    if (it == neighbours_.end()){
+        return false;
+    }
+
+    auto& q = *queues_[queue];
+    auto& r = q.tx;
+    auto producer = *r.producer;
+    if (producer - __atomic_load_n(r.consumer, __ATOMIC_ACQUIRE) >= r.size){
+        flush(queue);
+        if (producer - __atomic_load_n(r.consumer, __ATOMIC_ACQUIRE) >= r.size){
+            return false;
+        }
+    }
+
+    uint64_t addr;
+    if (last && !p.taken && p.data + size <= q.umem + p.frame + header_size + p.capacity){
+        // the payload is where it was received, only the headers change
+        addr = p.frame;
+        p.taken = true;
+    } else {
+        if (q.free.empty()){
+            flush(queue);
+            if (q.free.empty()){
+                return false;
+            }
+        }
+        addr = q.free.back();
+        q.free.pop_back();
+        memcpy(q.umem + addr + header_size, p.data, size);
+    }
+    write_headers(q.umem + addr, p, it->second, sa, size);
+
+    auto& desc = ((struct xdp_desc *)r.descs)[producer & r.mask];
+    desc.addr = addr;
+    desc.len = header_size + size;
+    desc.options = 0;
+    __atomic_store_n(r.producer, producer + 1, __ATOMIC_RELEASE);
+    q.txpending++;
+    sent_++;
+    return true;
+}
+
+void xdp_port::release(int queue, packet& p){
+    if (!p.taken){
+        queues_[queue]->free.push_back(p.frame & ~(uint64_t)(frame_size - 1));
+        p.taken = true;
+    }
+}
+
+void xdp_port::flush(int queue){
+    auto& q = *queues_[queue];
+
+    if (q.txpending > 0 && (__atomic_load_n(q.tx.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP)){
+        if (sendto(q.fd, nullptr, 0, MSG_DONTWAIT, nullptr, 0) < 0){
+            int err = errno;
+            if (err != EAGAIN && err != EBUSY && err != ENOBUFS && err != ENETDOWN){
+                LOG_ERROR("aoo_server: XDP send failed (" << err << ")");
+            }
+        }
+    }
+    q.txpending = 0;
+
+    // the frames of what has been sent
+    auto& c = q.completion;
+    auto consumer = *c.consumer;
+    auto n = __atomic_load_n(c.producer, __ATOMIC_ACQUIRE) - consumer;
+    auto addrs = (uint64_t *)c.descs;
+    for (uint32_t i = 0; i < n; ++i){
+        q.free.push_back(addrs[(consumer + i) & c.mask] & ~(uint64_t)(frame_size - 1));
+    }
+    __atomic_store_n(c.consumer, consumer + n, __ATOMIC_RELEASE);
+
+    refill(q);
+    if (__atomic_load_n(q.fill.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP){
+        recvfrom(q.fd, nullptr, 0, MSG_DONTWAIT, nullptr, nullptr);
+    }
+}
+
+} // net
+} // aoo
+
+#endif // AOO_HAVE_XDP
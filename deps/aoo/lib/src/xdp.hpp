@@ -0,0 +1,146 @@
+/* Copyright (c) 2010-Now Christof Ressi, Winfried Ritsch and others.
+ * For information on usage and redistribution, and for a DISCLAIMER OF ALL
+ * WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+// AF_XDP fast path for the relay (see server::set_xdp()). An XDP program on
+// the network interface steers the relay and forward packets for the server's
+// UDP port to an AF_XDP socket per receive queue, past the kernel's UDP stack.
+// The server rewrites them in their frames and sends them straight back out
+// on the same queue. Everything else, and what arrives on a queue without a
+// socket, goes on to the kernel as usual, which is where the control plane
+// stays. IPv4 only, like the relay.
+//
+// Straight on top of the syscalls, no libbpf/libxdp needed. Needs Linux 5.9
+// (bpf links for XDP) and CAP_NET_ADMIN + CAP_BPF (or root).
+
+#pragma once
+
+#if defined(__linux__) && !defined(AOO_NO_XDP) && defined(__has_include)
+# if __has_include(<linux/if_xdp.h>) && __has_include(<linux/bpf.h>)
+#  include <linux/if_xdp.h>
+#  include <linux/bpf.h>
+# endif
+#endif
+
+// BPF_F_SLEEPABLE only tells that the headers are from Linux 5.10 or later,
+// with XDP bpf links (the enums can't be checked)
+#if defined(XDP_USE_NEED_WAKEUP) && defined(BPF_F_SLEEPABLE)
+# define AOO_HAVE_XDP 1
+#else
+# define AOO_HAVE_XDP 0
+#endif
+
+#if AOO_HAVE_XDP
+
+#include "net_utils.hpp"
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace aoo {
+namespace net {
+
+class xdp_port {
+public:
+    // ethernet + IPv4 (without options) + UDP
+    static const int32_t header_size = 14 + 20 + 8;
+    static const int32_t frame_size = 2048;
+
+    // a received packet, still in its frame
+    struct packet {
+        char *data;         // the UDP payload
+        int32_t size;
+        int32_t capacity;   // room for the payload in the frame
+        ip_address addr;    // sender
+        uint64_t frame;     // offset in the UMEM
+        uint32_t local;     // our address it was sent to (network order)
+        uint8_t tos;        // kept for what is sent on, for the DSCP
+        bool taken;         // sent on in place, see send()
+    };
+
+    xdp_port() = default;
+    ~xdp_port(){ close(); }
+
+    xdp_port(const xdp_port&) = delete;
+    xdp_port& operator=(const xdp_port&) = delete;
+
+    // 'queues' <= 0 means all of the interface's receive queues
+    bool open(const char *ifname, int port, int queues);
+    void close();
+
+    int num_queues() const { return (int)queues_.size(); }
+    // poll()able for received packets
+    int fd(int queue) const { return queues_[queue]->fd; }
+    // tag of the queue for an epoll/kqueue registration
+    void * tag(int queue) const { return queues_[queue].get(); }
+    // the queue for a tag, -1 if it isn't one of ours
+    int find_queue(void *tag) const;
+
+    // up to 'max' packets, 'now' (in seconds) refreshes the neighbour of the sender.
+    // every one has to be handed to release() before the next call
+    int receive(int queue, packet *packets, int max, double now);
+    // sends 'size' bytes from the payload of 'p' to 'dest', on p's queue.
+    // in place if 'last' (nothing else is sent from it afterwards), a copy
+    // otherwise. false if it has to go through the kernel instead, because
+    // we don't know dest's link layer address, or there's no frame left.
+    bool send(int queue, packet& p, int32_t size, const ip_address& dest, bool last);
+    // gives the frame back for receiving, unless it was sent in place
+    void release(int queue, packet& p);
+    // kicks off the sends, takes back the frames of the finished ones
+    void flush(int queue);
+
+    uint64_t packets_sent() const { return sent_; }
+private:
+    struct ring {
+        uint32_t *producer = nullptr;
+        uint32_t *consumer = nullptr;
+        uint32_t *flags = nullptr;
+        void *descs = nullptr;
+        uint32_t mask = 0;
+        uint32_t size = 0;
+        void *map = nullptr;
+        size_t mapsize = 0;
+    };
+    struct queue {
+        int fd = -1;
+        int id = 0;
+        char *umem = nullptr;
+        size_t umemsize = 0;
+        ring fill;
+        ring completion;
+        ring rx;
+        ring tx;
+        // frames for copies, and for the fill ring
+        std::vector<uint64_t> free;
+        uint32_t txpending = 0;
+    };
+
+    struct neighbour {
+        unsigned char mac[6];
+        double time;
+    };
+
+    bool open_queue(queue& q, int ifindex, int id);
+    void close_queue(queue& q);
+    void refill(queue& q);
+    void write_headers(char *frame, const packet& p, const neighbour& n,
+                       const struct sockaddr_in& dest, int32_t size);
+
+    std::vector<std::unique_ptr<queue>> queues_;
+    // link layer address per IPv4 sender, the next hop we learned from its packets
+    std::unordered_map<uint32_t, neighbour> neighbours_;
+    double last_purge_ = 0;
+    unsigned char mac_[6];
+    int mtu_ = 1500;
+    uint16_t port_ = 0; // network order
+    int mapfd_ = -1;
+    int progfd_ = -1;
+    int linkfd_ = -1;
+    uint64_t sent_ = 0;
+};
+
+} // net
+} // aoo
+
+#endif // AOO_HAVE_XDP
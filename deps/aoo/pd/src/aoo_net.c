@@ -2,6 +2,10 @@
  * For information on usage and redistribution, and for a DISCLAIMER OF ALL
  * WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // recvmmsg()
+#endif
+
 #include "aoo_net.h"
 
 #ifdef _WIN32
@@ -16,6 +20,9 @@ typedef int socklen_t;
 #include <arpa/inet.h>
 #include <errno.h>
 #endif
+#ifdef __linux__
+#include <sys/uio.h>
+#endif
 
 #include <stdio.h>
 #include <string.h>
@@ -238,6 +245,43 @@ int sockaddr_to_atoms(const struct sockaddr *sa, socklen_t len, t_atom *a)
     return 1;
 }
 
+int socket_receive_batch(int socket, char *bufs, int size, int count,
+                         struct sockaddr_storage *sa, socklen_t *lens,
+                         int *sizes)
+{
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+    // one system call for everything that has piled up
+    struct mmsghdr msgs[SOCKET_MAXBATCH];
+    struct iovec iovecs[SOCKET_MAXBATCH];
+    if (count > SOCKET_MAXBATCH){
+        count = SOCKET_MAXBATCH;
+    }
+    memset(msgs, 0, sizeof(struct mmsghdr) * count);
+    for (int i = 0; i < count; ++i){
+        iovecs[i].iov_base = bufs + i * size;
+        iovecs[i].iov_len = size;
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &sa[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+    }
+    int result = recvmmsg(socket, msgs, count, MSG_WAITFORONE, 0);
+    for (int i = 0; i < result; ++i){
+        lens[i] = msgs[i].msg_hdr.msg_namelen;
+        sizes[i] = msgs[i].msg_len;
+    }
+    return result;
+#else
+    (void)count;
+    int result = socket_receive(socket, bufs, size, sa, lens, 0);
+    if (result < 0){
+        return result;
+    }
+    sizes[0] = result;
+    return 1;
+#endif
+}
+
 /*//////////////////// endpoint ///////////////////////*/
 
 t_endpoint * endpoint_new(void *owner, const struct sockaddr_storage *sa, socklen_t len)
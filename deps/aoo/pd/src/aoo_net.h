@@ -25,6 +25,17 @@ int socket_receive(int socket, char *buf, int size,
                    struct sockaddr_storage *sa, socklen_t *len,
                    int nonblocking);
 
+// max. number of packets for socket_receive_batch()
+#define SOCKET_MAXBATCH 32
+
+// blocks until there is at least one packet, then takes up to 'count' of them
+// at once (with recvmmsg() on Linux, elsewhere one at a time). 'bufs' holds
+// 'count' buffers of 'size' bytes, 'sizes' gets the number of bytes of each.
+// returns the number of packets or -1 on error.
+int socket_receive_batch(int socket, char *bufs, int size, int count,
+                         struct sockaddr_storage *sa, socklen_t *lens,
+                         int *sizes);
+
 int socket_setsendbufsize(int socket, int bufsize);
 
 int socket_setrecvbufsize(int socket, int bufsize);
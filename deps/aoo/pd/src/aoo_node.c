@@ -9,6 +9,18 @@
 #include <string.h>
 #include <pthread.h>
 #include <errno.h>
+#include <stdatomic.h>
+#ifdef _WIN32
+ #include <windows.h>
+#else
+ #include <sched.h>
+ #include <netinet/in.h>
+#endif
+
+// number of packets taken from the socket at once
+#ifndef AOO_NODE_RECV_BATCH
+ #define AOO_NODE_RECV_BATCH 16
+#endif
 
 #ifndef AOO_NODE_POLL
  #define AOO_NODE_POLL 0
@@ -79,6 +91,35 @@ typedef struct _client
     int32_t c_id;
 } t_client;
 
+// open addressing table of the endpoints by address. it only grows, and then
+// is replaced as a whole, so the receive thread can look up the senders without
+// locking. the old tables are kept until the node goes away (they add up to less
+// than the current one).
+typedef struct _endpoint_table
+{
+    struct _endpoint_table *t_prev;
+    _Atomic(t_endpoint *) *t_slots;
+    int t_size; // power of 2
+    int t_count;
+} t_endpoint_table;
+
+// who gets the messages of each type, indexed by ID. rebuilt whenever a client
+// comes or goes and swapped in, so the receive thread can dispatch without
+// locking (see aoo_node_update_dispatch()).
+typedef struct _dispatch
+{
+    t_client *d_receivers;
+    t_client *d_senders;
+    // IDs -> receivers/senders, open addressing
+    t_client **d_receivermap;
+    t_client **d_sendermap;
+    t_pd *d_client;
+    int d_numreceivers;
+    int d_numsenders;
+    int d_mapsize; // power of 2
+    size_t d_nbytes;
+} t_dispatch;
+
 typedef struct _peer
 {
     t_symbol *group;
@@ -101,7 +142,13 @@ typedef struct _aoo_node
     int x_socket;
     int x_port;
     t_endpoint *x_endpoints;
+    _Atomic(t_endpoint_table *) x_endpointtable;
     pthread_mutex_t x_endpointlock;
+    // receive path
+    _Atomic(t_dispatch *) x_dispatch;
+    // odd while the receive thread is dispatching
+    atomic_uint x_dispatchepoch;
+    char *x_recvbuf;
     // threading
 #if AOO_NODE_POLL
     pthread_t x_thread;
@@ -110,25 +157,215 @@ typedef struct _aoo_node
     pthread_t x_receivethread;
     pthread_mutex_t x_mutex;
     pthread_cond_t x_condition;
+    // set by aoo_node_notify(), cleared when the send thread gets going
+    atomic_int x_notified;
 #endif
     int x_quit; // should be atomic, but works anyway
 } t_aoo_node;
 
+static uint32_t endpoint_hash(const struct sockaddr_storage *sa)
+{
+    if (sa->ss_family == AF_INET){
+        const struct sockaddr_in *a = (const struct sockaddr_in *)sa;
+        uint32_t h = (uint32_t)a->sin_addr.s_addr * 2654435761u;
+        h ^= (uint32_t)a->sin_port * 2246822519u;
+        return h ^ (h >> 16);
+    } else {
+        return 0;
+    }
+}
+
+static t_endpoint_table * endpoint_table_new(int size)
+{
+    t_endpoint_table *t = (t_endpoint_table *)getbytes(sizeof(t_endpoint_table));
+    t->t_prev = 0;
+    t->t_slots = (_Atomic(t_endpoint *) *)getbytes(size * sizeof(*t->t_slots));
+    for (int i = 0; i < size; ++i){
+        atomic_init(&t->t_slots[i], 0);
+    }
+    t->t_size = size;
+    t->t_count = 0;
+    return t;
+}
+
+static void endpoint_table_free(t_endpoint_table *t)
+{
+    while (t){
+        t_endpoint_table *prev = t->t_prev;
+        freebytes(t->t_slots, t->t_size * sizeof(*t->t_slots));
+        freebytes(t, sizeof(t_endpoint_table));
+        t = prev;
+    }
+}
+
+// lock free, as long as there is at least one free slot
+static t_endpoint * endpoint_table_find(t_endpoint_table *t,
+                                        const struct sockaddr_storage *sa)
+{
+    uint32_t mask = t->t_size - 1;
+    for (uint32_t i = endpoint_hash(sa) & mask; ; i = (i + 1) & mask){
+        t_endpoint *e = atomic_load_explicit(&t->t_slots[i], memory_order_acquire);
+        if (!e){
+            return 0;
+        } else if (endpoint_match(e, sa)){
+            return e;
+        }
+    }
+}
+
+static void endpoint_table_insert(t_endpoint_table *t, t_endpoint *e)
+{
+    uint32_t mask = t->t_size - 1;
+    uint32_t i = endpoint_hash(&e->addr) & mask;
+    while (atomic_load_explicit(&t->t_slots[i], memory_order_relaxed)){
+        i = (i + 1) & mask;
+    }
+    // publishes the endpoint
+    atomic_store_explicit(&t->t_slots[i], e, memory_order_release);
+    t->t_count++;
+}
+
 t_endpoint * aoo_node_endpoint(t_aoo_node *x,
                                const struct sockaddr_storage *sa, socklen_t len)
 {
+    t_endpoint *ep = endpoint_table_find(
+        atomic_load_explicit(&x->x_endpointtable, memory_order_acquire), sa);
+    if (ep){
+        return ep;
+    }
+
     pthread_mutex_lock(&x->x_endpointlock);
-    t_endpoint *ep = endpoint_find(x->x_endpoints, sa);
+    t_endpoint_table *t = atomic_load_explicit(&x->x_endpointtable, memory_order_relaxed);
+    ep = endpoint_table_find(t, sa);
     if (!ep){
         // add endpoint
         ep = endpoint_new(&x->x_socket, sa, len);
         ep->next = x->x_endpoints;
         x->x_endpoints = ep;
+        // keep at least half of the slots free
+        if ((t->t_count + 1) * 2 > t->t_size){
+            t_endpoint_table *grown = endpoint_table_new(t->t_size * 2);
+            for (t_endpoint *e = x->x_endpoints->next; e; e = e->next){
+                endpoint_table_insert(grown, e);
+            }
+            grown->t_prev = t;
+            atomic_store_explicit(&x->x_endpointtable, grown, memory_order_release);
+            t = grown;
+        }
+        endpoint_table_insert(t, ep);
     }
     pthread_mutex_unlock(&x->x_endpointlock);
     return ep;
 }
 
+/*////////////////// dispatch //////////////////*/
+
+static uint32_t dispatch_hash(int32_t id)
+{
+    uint32_t h = (uint32_t)id * 2654435761u;
+    return h ^ (h >> 16);
+}
+
+static t_client * dispatch_map_find(t_client **map, int size, int32_t id)
+{
+    uint32_t mask = size - 1;
+    for (uint32_t i = dispatch_hash(id) & mask; map[i]; i = (i + 1) & mask){
+        if (map[i]->c_id == id){
+            return map[i];
+        }
+    }
+    return 0;
+}
+
+static void dispatch_map_insert(t_client **map, int size, t_client *c)
+{
+    uint32_t mask = size - 1;
+    uint32_t i = dispatch_hash(c->c_id) & mask;
+    while (map[i]){
+        i = (i + 1) & mask;
+    }
+    map[i] = c;
+}
+
+// from the current clients, in a single block
+static t_dispatch * dispatch_new(const t_client *clients, int numclients)
+{
+    int mapsize = 2;
+    while (mapsize < numclients * 2){
+        mapsize *= 2;
+    }
+    size_t nbytes = sizeof(t_dispatch) + numclients * sizeof(t_client)
+            + 2 * mapsize * sizeof(t_client *);
+    t_dispatch *d = (t_dispatch *)getbytes(nbytes);
+    d->d_nbytes = nbytes;
+    d->d_mapsize = mapsize;
+    d->d_client = 0;
+    d->d_numreceivers = 0;
+    d->d_numsenders = 0;
+    for (int i = 0; i < numclients; ++i){
+        t_class *c = pd_class(clients[i].c_obj);
+        if (c == aoo_receive_class){
+            d->d_numreceivers++;
+        } else if (c == aoo_send_class){
+            d->d_numsenders++;
+        } else if (c == aoo_client_class && !d->d_client){
+            d->d_client = clients[i].c_obj;
+        }
+    }
+    d->d_receivers = (t_client *)(d + 1);
+    d->d_senders = d->d_receivers + d->d_numreceivers;
+    d->d_receivermap = (t_client **)(d->d_receivers + numclients);
+    d->d_sendermap = d->d_receivermap + mapsize;
+    // getbytes() returns zeroed memory
+    int nrcv = 0, nsnd = 0;
+    for (int i = 0; i < numclients; ++i){
+        t_class *c = pd_class(clients[i].c_obj);
+        if (c == aoo_receive_class){
+            d->d_receivers[nrcv] = clients[i];
+            dispatch_map_insert(d->d_receivermap, mapsize, &d->d_receivers[nrcv]);
+            nrcv++;
+        } else if (c == aoo_send_class){
+            d->d_senders[nsnd] = clients[i];
+            dispatch_map_insert(d->d_sendermap, mapsize, &d->d_senders[nsnd]);
+            nsnd++;
+        }
+    }
+    return d;
+}
+
+static void dispatch_free(t_dispatch *d)
+{
+    if (d){
+        freebytes(d, d->d_nbytes);
+    }
+}
+
+static void aoo_node_wait_dispatch(t_aoo_node *x)
+{
+    unsigned int epoch = atomic_load(&x->x_dispatchepoch);
+    if (epoch & 1){
+        // the receive thread might still use the old table, wait for it to
+        // finish the current batch (it doesn't matter if it starts the next one)
+        while (atomic_load(&x->x_dispatchepoch) == epoch){
+        #ifdef _WIN32
+            Sleep(0);
+        #else
+            sched_yield();
+        #endif
+        }
+    }
+}
+
+// call with the client lock held. afterwards the removed clients
+// won't get any more messages from the receive thread.
+static void aoo_node_update_dispatch(t_aoo_node *x)
+{
+    t_dispatch *d = dispatch_new(x->x_clients, x->x_numclients);
+    t_dispatch *old = atomic_exchange(&x->x_dispatch, d);
+    aoo_node_wait_dispatch(x);
+    dispatch_free(old);
+}
+
 static t_peer * aoo_node_dofind_peer(t_aoo_node *x, t_symbol *group, t_symbol *user)
 {
     for (int i = 0; i < x->x_numpeers; ++i){
@@ -235,7 +472,16 @@ int aoo_node_port(t_aoo_node *x)
 void aoo_node_notify(t_aoo_node *x)
 {
 #if !AOO_NODE_POLL
-    pthread_cond_signal(&x->x_condition);
+    // only the first notification wakes up the send thread, the others until
+    // it gets going (e.g. from all the objects in the same DSP tick) are free.
+    if (!atomic_exchange(&x->x_notified, 1)){
+        // don't block the audio thread: if the send thread holds the mutex,
+        // it isn't waiting and sees the flag before it waits again.
+        if (pthread_mutex_trylock(&x->x_mutex) == 0){
+            pthread_cond_signal(&x->x_condition);
+            pthread_mutex_unlock(&x->x_mutex);
+        }
+    }
 #endif
 }
 
@@ -267,83 +513,82 @@ void aoo_node_dosend(t_aoo_node *x)
     aoo_lock_unlock_shared(&x->x_clientlock);
 }
 
-void aoo_node_doreceive(t_aoo_node *x)
+static void aoo_node_dispatch(const t_dispatch *d, const char *buf, int nbytes, t_endpoint *ep)
 {
-    struct sockaddr_storage sa;
-    socklen_t len;
-    char buf[AOO_MAXPACKETSIZE];
-    int nbytes = socket_receive(x->x_socket, buf, AOO_MAXPACKETSIZE, &sa, &len, 0);
-    if (nbytes > 0){
-        // try to find endpoint
-        pthread_mutex_lock(&x->x_endpointlock);
-        t_endpoint *ep = endpoint_find(x->x_endpoints, &sa);
-        if (!ep){
-            // add endpoint
-            ep = endpoint_new(&x->x_socket, &sa, len);
-            ep->next = x->x_endpoints;
-            x->x_endpoints = ep;
-        }
-        pthread_mutex_unlock(&x->x_endpointlock);
-        // get sink ID
-        int32_t type, id;
-        if ((aoo_parse_pattern(buf, nbytes, &type, &id) > 0)
-            || (aoonet_parse_pattern(buf, nbytes, &type) > 0))
-        {
-            aoo_lock_lock_shared(&x->x_clientlock);
-            if (type == AOO_TYPE_SINK){
-                // forward OSC packet to matching receiver(s)
-                for (int i = 0; i < x->x_numclients; ++i){
-                    if ((pd_class(x->x_clients[i].c_obj) == aoo_receive_class) &&
-                        ((id == AOO_ID_WILDCARD) || (id == x->x_clients[i].c_id)))
-                    {
-                        t_aoo_receive *rcv = (t_aoo_receive *)x->x_clients[i].c_obj;
-                        aoo_receive_handle_message(rcv, buf, nbytes,
-                            ep, (aoo_replyfn)endpoint_send);
-                        if (id != AOO_ID_WILDCARD)
-                            break;
-                    }
+    // get sink ID
+    int32_t type, id;
+    if ((aoo_parse_pattern(buf, nbytes, &type, &id) > 0)
+        || (aoonet_parse_pattern(buf, nbytes, &type) > 0))
+    {
+        if (type == AOO_TYPE_SINK){
+            // forward OSC packet to matching receiver(s)
+            if (id == AOO_ID_WILDCARD){
+                for (int i = 0; i < d->d_numreceivers; ++i){
+                    aoo_receive_handle_message((t_aoo_receive *)d->d_receivers[i].c_obj,
+                        buf, nbytes, ep, (aoo_replyfn)endpoint_send);
                 }
-            } else if (type == AOO_TYPE_SOURCE){
-                // forward OSC packet to matching senders(s)
-                for (int i = 0; i < x->x_numclients; ++i){
-                    if ((pd_class(x->x_clients[i].c_obj) == aoo_send_class) &&
-                        ((id == AOO_ID_WILDCARD) || (id == x->x_clients[i].c_id)))
-                    {
-                        t_aoo_send *snd = (t_aoo_send *)x->x_clients[i].c_obj;
-                        aoo_send_handle_message(snd, buf, nbytes,
-                            ep, (aoo_replyfn)endpoint_send);
-                        if (id != AOO_ID_WILDCARD)
-                            break;
-                    }
+            } else {
+                t_client *c = dispatch_map_find(d->d_receivermap, d->d_mapsize, id);
+                if (c){
+                    aoo_receive_handle_message((t_aoo_receive *)c->c_obj,
+                        buf, nbytes, ep, (aoo_replyfn)endpoint_send);
                 }
-            } else if (type == AOO_TYPE_CLIENT || type == AOO_TYPE_PEER){
-                // forward OSC packet to matching client
-                for (int i = 0; i < x->x_numclients; ++i){
-                    if (pd_class(x->x_clients[i].c_obj) == aoo_client_class)
-                    {
-                        t_aoo_client *c = (t_aoo_client *)x->x_clients[i].c_obj;
-                        aoo_client_handle_message(c, buf, nbytes,
-                            ep, (aoo_replyfn)endpoint_send);
-                        break;
-                    }
+            }
+        } else if (type == AOO_TYPE_SOURCE){
+            // forward OSC packet to matching senders(s)
+            if (id == AOO_ID_WILDCARD){
+                for (int i = 0; i < d->d_numsenders; ++i){
+                    aoo_send_handle_message((t_aoo_send *)d->d_senders[i].c_obj,
+                        buf, nbytes, ep, (aoo_replyfn)endpoint_send);
                 }
-            } else if (type == AOO_TYPE_SERVER){
-                // ignore
             } else {
-                fprintf(stderr, "bug: unknown aoo type\n");
-                fflush(stderr);
+                t_client *c = dispatch_map_find(d->d_sendermap, d->d_mapsize, id);
+                if (c){
+                    aoo_send_handle_message((t_aoo_send *)c->c_obj,
+                        buf, nbytes, ep, (aoo_replyfn)endpoint_send);
+                }
             }
-            aoo_lock_unlock_shared(&x->x_clientlock);
-        #if !AOO_NODE_POLL
-            // notify send thread
-            pthread_cond_signal(&x->x_condition);
-        #endif
+        } else if (type == AOO_TYPE_CLIENT || type == AOO_TYPE_PEER){
+            // forward OSC packet to matching client
+            if (d->d_client){
+                aoo_client_handle_message((t_aoo_client *)d->d_client,
+                    buf, nbytes, ep, (aoo_replyfn)endpoint_send);
+            }
+        } else if (type == AOO_TYPE_SERVER){
+            // ignore
         } else {
-            // not a valid AoO OSC message
-            fprintf(stderr, "aoo_node: not a valid AOO message!\n");
+            fprintf(stderr, "bug: unknown aoo type\n");
             fflush(stderr);
         }
-    } else if (nbytes < 0){
+    } else {
+        // not a valid AoO OSC message
+        fprintf(stderr, "aoo_node: not a valid AOO message!\n");
+        fflush(stderr);
+    }
+}
+
+void aoo_node_doreceive(t_aoo_node *x)
+{
+    struct sockaddr_storage sa[AOO_NODE_RECV_BATCH];
+    socklen_t len[AOO_NODE_RECV_BATCH];
+    int sizes[AOO_NODE_RECV_BATCH];
+    int count = socket_receive_batch(x->x_socket, x->x_recvbuf, AOO_MAXPACKETSIZE,
+                                     AOO_NODE_RECV_BATCH, sa, len, sizes);
+    if (count > 0){
+        // no locks from here on, see aoo_node_update_dispatch()
+        atomic_fetch_add(&x->x_dispatchepoch, 1);
+        const t_dispatch *d = atomic_load(&x->x_dispatch);
+        for (int i = 0; i < count; ++i){
+            if (sizes[i] > 0){
+                t_endpoint *ep = aoo_node_endpoint(x, &sa[i], len[i]);
+                aoo_node_dispatch(d, x->x_recvbuf + i * AOO_MAXPACKETSIZE,
+                                  sizes[i], ep);
+            }
+        }
+        atomic_fetch_add(&x->x_dispatchepoch, 1);
+        // notify send thread
+        aoo_node_notify(x);
+    } else if (count < 0){
         // ignore errors when quitting
         if (!x->x_quit){
             socket_error_print("recv");
@@ -389,7 +634,10 @@ static void* aoo_node_send(void *y)
 
     pthread_mutex_lock(&x->x_mutex);
     while (!x->x_quit){
-        pthread_cond_wait(&x->x_condition, &x->x_mutex);
+        while (!atomic_load(&x->x_notified) && !x->x_quit){
+            pthread_cond_wait(&x->x_condition, &x->x_mutex);
+        }
+        atomic_store(&x->x_notified, 0);
 
         aoo_node_dosend(x);
     }
@@ -448,6 +696,7 @@ t_aoo_node* aoo_node_add(int port, t_pd *obj, int32_t id)
                                                 sizeof(t_client) * (x->x_numclients + 1));
         x->x_clients[x->x_numclients] = client;
         x->x_numclients++;
+        aoo_node_update_dispatch(x);
         aoo_lock_unlock(&x->x_clientlock);
     } else {
         // make new aoo node
@@ -488,6 +737,12 @@ t_aoo_node* aoo_node_add(int port, t_pd *obj, int32_t id)
         x->x_socket = sock;
         x->x_port = port;
         x->x_endpoints = 0;
+        atomic_init(&x->x_endpointtable, endpoint_table_new(16));
+        pthread_mutex_init(&x->x_endpointlock, 0);
+
+        atomic_init(&x->x_dispatch, dispatch_new(x->x_clients, x->x_numclients));
+        atomic_init(&x->x_dispatchepoch, 0);
+        x->x_recvbuf = (char *)getbytes(AOO_NODE_RECV_BATCH * AOO_MAXPACKETSIZE);
 
         // start threads
         x->x_quit = 0;
@@ -497,6 +752,7 @@ t_aoo_node* aoo_node_add(int port, t_pd *obj, int32_t id)
     #else
         pthread_mutex_init(&x->x_mutex, 0);
         pthread_cond_init(&x->x_condition, 0);
+        atomic_init(&x->x_notified, 0);
 
         pthread_create(&x->x_sendthread, 0, aoo_node_send, x);
         pthread_create(&x->x_receivethread, 0, aoo_node_receive, x);
@@ -524,6 +780,7 @@ void aoo_node_release(t_aoo_node *x, t_pd *obj, int32_t id)
                 x->x_clients = (t_client *)resizebytes(x->x_clients, n * sizeof(t_client),
                                                         (n - 1) * sizeof(t_client));
                 x->x_numclients--;
+                aoo_node_update_dispatch(x);
                 aoo_lock_unlock(&x->x_clientlock);
                 return;
             }
@@ -576,6 +833,10 @@ void aoo_node_release(t_aoo_node *x, t_pd *obj, int32_t id)
             endpoint_free(e);
             e = next;
         }
+        endpoint_table_free(atomic_load(&x->x_endpointtable));
+        pthread_mutex_destroy(&x->x_endpointlock);
+        dispatch_free(atomic_load(&x->x_dispatch));
+        freebytes(x->x_recvbuf, AOO_NODE_RECV_BATCH * AOO_MAXPACKETSIZE);
         if (x->x_clients)
             freebytes(x->x_clients, sizeof(t_client) * x->x_numclients);
         if (x->x_peers)
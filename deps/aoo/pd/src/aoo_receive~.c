@@ -33,6 +33,12 @@ typedef struct _aoo_receive
     int32_t x_port;
     int32_t x_id;
     t_sample **x_vec;
+    // accumulation (see aoo_receive_blocksize())
+    t_sample **x_accum;
+    t_sample *x_accumbuf;
+    int32_t x_accumsize; // requested block size, 0 = off
+    int32_t x_accumalloc; // samples per channel in x_accumbuf
+    int32_t x_accumpos;
     // sinks
     t_source *x_sources;
     int x_numsources;
@@ -160,6 +166,41 @@ static void aoo_receive_packetsize(t_aoo_receive *x, t_floatarg f)
     aoo_sink_set_packetsize(x->x_aoo_sink, f);
 }
 
+// get the signal from the sink in blocks of (at least) 'f' samples, e.g.
+// the block size of the codec, instead of every DSP tick. saves overhead with
+// many objects, at the cost of up to 'f' samples of extra latency.
+// 0 = Pd's block size (default). takes effect with the next DSP update.
+static void aoo_receive_blocksize(t_aoo_receive *x, t_floatarg f)
+{
+    int size = f;
+    if (size < 0){
+        pd_error(x, "%s: bad blocksize %d", classname(x), size);
+        return;
+    }
+    if (size != x->x_accumsize){
+        x->x_accumsize = size;
+        canvas_update_dsp();
+    }
+}
+
+static void aoo_receive_setaccum(t_aoo_receive *x, int32_t size)
+{
+    if (size == x->x_accumalloc){
+        return;
+    }
+    if (x->x_accumbuf){
+        freebytes(x->x_accumbuf, x->x_accumalloc * x->x_nchannels * sizeof(t_sample));
+        x->x_accumbuf = 0;
+    }
+    if (size > 0){
+        x->x_accumbuf = (t_sample *)getbytes(size * x->x_nchannels * sizeof(t_sample));
+    }
+    for (int i = 0; i < x->x_nchannels; ++i){
+        x->x_accum[i] = x->x_accumbuf ? x->x_accumbuf + i * size : 0;
+    }
+    x->x_accumalloc = size;
+}
+
 static void aoo_receive_reset(t_aoo_receive *x, t_symbol *s, int argc, t_atom *argv)
 {
     if (argc){
@@ -340,16 +381,13 @@ static void aoo_receive_tick(t_aoo_receive *x)
     aoo_sink_handle_events(x->x_aoo_sink, (aoo_eventhandler)aoo_receive_handle_events, x);
 }
 
-static t_int * aoo_receive_perform(t_int *w)
+static void aoo_receive_process(t_aoo_receive *x, t_sample **vec, int n)
 {
-    t_aoo_receive *x = (t_aoo_receive *)(w[1]);
-    int n = (int)(w[2]);
-
     uint64_t t = aoo_osctime_get();
-    if (aoo_sink_process(x->x_aoo_sink, x->x_vec, n, t) <= 0){
+    if (aoo_sink_process(x->x_aoo_sink, vec, n, t) <= 0){
         // output zeros
         for (int i = 0; i < x->x_nchannels; ++i){
-            memset(x->x_vec[i], 0, sizeof(t_float) * n);
+            memset(vec[i], 0, sizeof(t_float) * n);
         }
     }
 
@@ -357,18 +395,51 @@ static t_int * aoo_receive_perform(t_int *w)
     if (aoo_sink_events_available(x->x_aoo_sink) > 0){
         clock_delay(x->x_clock, 0);
     }
+}
+
+static t_int * aoo_receive_perform(t_int *w)
+{
+    t_aoo_receive *x = (t_aoo_receive *)(w[1]);
+    int n = (int)(w[2]);
+
+    if (x->x_accumalloc > 0){
+        // hand out the current block, get a new one when it's used up
+        int32_t blocksize = x->x_accumalloc;
+        int done = 0;
+        while (done < n){
+            if (x->x_accumpos == blocksize){
+                aoo_receive_process(x, x->x_accum, blocksize);
+                x->x_accumpos = 0;
+            }
+            int count = n - done;
+            if (count > blocksize - x->x_accumpos){
+                count = blocksize - x->x_accumpos;
+            }
+            for (int i = 0; i < x->x_nchannels; ++i){
+                memcpy(x->x_vec[i] + done, x->x_accum[i] + x->x_accumpos,
+                       count * sizeof(t_sample));
+            }
+            x->x_accumpos += count;
+            done += count;
+        }
+    } else {
+        aoo_receive_process(x, x->x_vec, n);
+    }
 
     return w + 3;
 }
 
 static void aoo_receive_dsp(t_aoo_receive *x, t_signal **sp)
 {
-    int32_t blocksize = sp[0]->s_n;
+    int32_t n = sp[0]->s_n;
+    int32_t blocksize = x->x_accumsize > n ? x->x_accumsize : n;
     int32_t samplerate = sp[0]->s_sr;
 
     for (int i = 0; i < x->x_nchannels; ++i){
         x->x_vec[i] = sp[i]->s_vec;
     }
+    aoo_receive_setaccum(x, blocksize > n ? blocksize : 0);
+    x->x_accumpos = x->x_accumalloc; // empty
 
     // synchronize with network threads!
     aoo_lock_lock(&x->x_lock); // writer lock!
@@ -381,7 +452,7 @@ static void aoo_receive_dsp(t_aoo_receive *x, t_signal **sp)
 
     aoo_lock_unlock(&x->x_lock);
 
-    dsp_add(aoo_receive_perform, 2, (t_int)x, (t_int)x->x_blocksize);
+    dsp_add(aoo_receive_perform, 2, (t_int)x, (t_int)n);
 }
 
 static void aoo_receive_port(t_aoo_receive *x, t_floatarg f)
@@ -435,6 +506,10 @@ static void * aoo_receive_new(t_symbol *s, int argc, t_atom *argv)
     x->x_numsources = 0;
     x->x_blocksize = 0;
     x->x_samplerate = 0;
+    x->x_accumbuf = 0;
+    x->x_accumsize = 0;
+    x->x_accumalloc = 0;
+    x->x_accumpos = 0;
     x->x_node = 0;
     x->x_clock = clock_new(x, (t_method)aoo_receive_tick);
 
@@ -466,6 +541,7 @@ static void * aoo_receive_new(t_symbol *s, int argc, t_atom *argv)
         outlet_new(&x->x_obj, &s_signal);
     }
     x->x_vec = (t_sample **)getbytes(sizeof(t_sample *) * nchannels);
+    x->x_accum = (t_sample **)getbytes(sizeof(t_sample *) * nchannels);
 
     // event outlet
     x->x_msgout = outlet_new(&x->x_obj, 0);
@@ -492,6 +568,8 @@ static void aoo_receive_free(t_aoo_receive *x)
     aoo_lock_destroy(&x->x_lock);
 
     freebytes(x->x_vec, sizeof(t_sample *) * x->x_nchannels);
+    aoo_receive_setaccum(x, 0);
+    freebytes(x->x_accum, sizeof(t_sample *) * x->x_nchannels);
     if (x->x_sources){
         freebytes(x->x_sources, x->x_numsources * sizeof(t_source));
     }
@@ -517,6 +595,8 @@ void aoo_receive_tilde_setup(void)
                     gensym("bufsize"), A_FLOAT, A_NULL);
     class_addmethod(aoo_receive_class, (t_method)aoo_receive_timefilter,
                     gensym("timefilter"), A_FLOAT, A_NULL);
+    class_addmethod(aoo_receive_class, (t_method)aoo_receive_blocksize,
+                    gensym("blocksize"), A_FLOAT, A_NULL);
     class_addmethod(aoo_receive_class, (t_method)aoo_receive_packetsize,
                     gensym("packetsize"), A_FLOAT, A_NULL);
     class_addmethod(aoo_receive_class, (t_method)aoo_receive_resend,
@@ -43,6 +43,12 @@ typedef struct _aoo_send
     int32_t x_port;
     int32_t x_id;
     t_float **x_vec;
+    // accumulation (see aoo_send_blocksize())
+    t_sample **x_accum;
+    t_sample *x_accumbuf;
+    int32_t x_accumsize; // requested block size, 0 = off
+    int32_t x_accumalloc; // samples per channel in x_accumbuf
+    int32_t x_accumpos;
     // sinks
     t_sink *x_sinks;
     int x_numsinks;
@@ -353,6 +359,41 @@ static void aoo_send_packetsize(t_aoo_send *x, t_floatarg f)
     aoo_source_set_packetsize(x->x_aoo_source, f);
 }
 
+// hand the signal to the source in blocks of (at least) 'f' samples, e.g.
+// the block size of the codec, instead of every DSP tick. saves overhead with
+// many objects, at the cost of up to 'f' samples of extra latency.
+// 0 = Pd's block size (default). takes effect with the next DSP update.
+static void aoo_send_blocksize(t_aoo_send *x, t_floatarg f)
+{
+    int size = f;
+    if (size < 0){
+        pd_error(x, "%s: bad blocksize %d", classname(x), size);
+        return;
+    }
+    if (size != x->x_accumsize){
+        x->x_accumsize = size;
+        canvas_update_dsp();
+    }
+}
+
+static void aoo_send_setaccum(t_aoo_send *x, int32_t size)
+{
+    if (size == x->x_accumalloc){
+        return;
+    }
+    if (x->x_accumbuf){
+        freebytes(x->x_accumbuf, x->x_accumalloc * x->x_nchannels * sizeof(t_sample));
+        x->x_accumbuf = 0;
+    }
+    if (size > 0){
+        x->x_accumbuf = (t_sample *)getbytes(size * x->x_nchannels * sizeof(t_sample));
+    }
+    for (int i = 0; i < x->x_nchannels; ++i){
+        x->x_accum[i] = x->x_accumbuf ? x->x_accumbuf + i * size : 0;
+    }
+    x->x_accumalloc = size;
+}
+
 static void aoo_send_ping(t_aoo_send *x, t_floatarg f)
 {
     aoo_source_set_ping_interval(x->x_aoo_source, f);
@@ -526,15 +567,10 @@ static void aoo_send_listsinks(t_aoo_send *x)
     }
 }
 
-static t_int * aoo_send_perform(t_int *w)
+static void aoo_send_process(t_aoo_send *x, t_sample **vec, int n)
 {
-    t_aoo_send *x = (t_aoo_send *)(w[1]);
-    int n = (int)(w[2]);
-
-    assert(sizeof(t_sample) == sizeof(aoo_sample));
-
     uint64_t t = aoo_osctime_get();
-    if (aoo_source_process(x->x_aoo_source, (const aoo_sample **)x->x_vec, n, t) > 0){
+    if (aoo_source_process(x->x_aoo_source, (const aoo_sample **)vec, n, t) > 0){
         if (x->x_node){
             aoo_node_notify(x->x_node);
         }
@@ -542,18 +578,53 @@ static t_int * aoo_send_perform(t_int *w)
     if (aoo_source_events_available(x->x_aoo_source) > 0){
         clock_set(x->x_clock, 0);
     }
+}
+
+static t_int * aoo_send_perform(t_int *w)
+{
+    t_aoo_send *x = (t_aoo_send *)(w[1]);
+    int n = (int)(w[2]);
+
+    assert(sizeof(t_sample) == sizeof(aoo_sample));
+
+    if (x->x_accumalloc > 0){
+        // collect the inputs until we have a whole block
+        int32_t blocksize = x->x_accumalloc;
+        int done = 0;
+        while (done < n){
+            int count = n - done;
+            if (count > blocksize - x->x_accumpos){
+                count = blocksize - x->x_accumpos;
+            }
+            for (int i = 0; i < x->x_nchannels; ++i){
+                memcpy(x->x_accum[i] + x->x_accumpos, x->x_vec[i] + done,
+                       count * sizeof(t_sample));
+            }
+            x->x_accumpos += count;
+            done += count;
+            if (x->x_accumpos == blocksize){
+                aoo_send_process(x, x->x_accum, blocksize);
+                x->x_accumpos = 0;
+            }
+        }
+    } else {
+        aoo_send_process(x, x->x_vec, n);
+    }
 
     return w + 3;
 }
 
 static void aoo_send_dsp(t_aoo_send *x, t_signal **sp)
 {
-    int32_t blocksize = sp[0]->s_n;
+    int32_t n = sp[0]->s_n;
+    int32_t blocksize = x->x_accumsize > n ? x->x_accumsize : n;
     int32_t samplerate = sp[0]->s_sr;
 
     for (int i = 0; i < x->x_nchannels; ++i){
         x->x_vec[i] = sp[i]->s_vec;
     }
+    aoo_send_setaccum(x, blocksize > n ? blocksize : 0);
+    x->x_accumpos = 0;
 
     // synchronize with network threads!
     aoo_lock_lock(&x->x_lock); // writer lock!
@@ -566,7 +637,7 @@ static void aoo_send_dsp(t_aoo_send *x, t_signal **sp)
 
     aoo_lock_unlock(&x->x_lock);
 
-    dsp_add(aoo_send_perform, 2, (t_int)x, (t_int)x->x_blocksize);
+    dsp_add(aoo_send_perform, 2, (t_int)x, (t_int)n);
 }
 
 static void aoo_send_port(t_aoo_send *x, t_floatarg f)
@@ -622,6 +693,10 @@ static void * aoo_send_new(t_symbol *s, int argc, t_atom *argv)
     x->x_node = 0;
     x->x_blocksize = 0;
     x->x_samplerate = 0;
+    x->x_accumbuf = 0;
+    x->x_accumsize = 0;
+    x->x_accumalloc = 0;
+    x->x_accumpos = 0;
 
     aoo_lock_init(&x->x_lock);
 
@@ -651,6 +726,7 @@ static void * aoo_send_new(t_symbol *s, int argc, t_atom *argv)
         }
     }
     x->x_vec = (t_sample **)getbytes(sizeof(t_sample *) * nchannels);
+    x->x_accum = (t_sample **)getbytes(sizeof(t_sample *) * nchannels);
 
     // make event outlet
     x->x_msgout = outlet_new(&x->x_obj, 0);
@@ -682,6 +758,8 @@ static void aoo_send_free(t_aoo_send *x)
     aoo_lock_destroy(&x->x_lock);
 
     freebytes(x->x_vec, sizeof(t_sample *) * x->x_nchannels);
+    aoo_send_setaccum(x, 0);
+    freebytes(x->x_accum, sizeof(t_sample *) * x->x_nchannels);
     if (x->x_sinks){
         freebytes(x->x_sinks, x->x_numsinks * sizeof(t_sink));
     }
@@ -716,6 +794,8 @@ void aoo_send_tilde_setup(void)
                     gensym("channel"), A_GIMME, A_NULL);
     class_addmethod(aoo_send_class, (t_method)aoo_send_packetsize,
                     gensym("packetsize"), A_FLOAT, A_NULL);
+    class_addmethod(aoo_send_class, (t_method)aoo_send_blocksize,
+                    gensym("blocksize"), A_FLOAT, A_NULL);
     class_addmethod(aoo_send_class, (t_method)aoo_send_ping,
                     gensym("ping"), A_FLOAT, A_NULL);
     class_addmethod(aoo_send_class, (t_method)aoo_send_resend,
@@ -37,6 +37,41 @@
 namespace foleys
 {
 
+// One timer for all the meters, at a fixed frame rate. A meter with a lower
+// refresh rate gets every few frames, and the meters with the same rate are
+// due on the same frames, so their repaints go out in one paint pass.
+class LevelMeter::RefreshScheduler : private juce::Timer
+{
+public:
+    static constexpr int frameRateHz = 30;
+
+    void add (LevelMeter* meter)
+    {
+        meters.addIfNotAlreadyThere (meter);
+        if (! isTimerRunning())
+            startTimerHz (frameRateHz);
+    }
+
+    void remove (LevelMeter* meter)
+    {
+        meters.removeFirstMatchingValue (meter);
+        if (meters.isEmpty())
+            stopTimer();
+    }
+
+private:
+    void timerCallback() override
+    {
+        ++frame;
+        for (auto* meter : meters)
+            if (frame % meter->framesPerRefresh == 0)
+                meter->refresh();
+    }
+
+    juce::Array<LevelMeter*> meters;
+    juce::uint32 frame = 0;
+};
+
 LevelMeter::LevelMeter (MeterFlags type)
   : meterType       (type)
 {
@@ -56,12 +91,12 @@ LevelMeter::LevelMeter (MeterFlags type)
         meter.clearClipIndicator();
     };
 
-    startTimerHz (refreshRate);
+    setRefreshRateHz (refreshRate);
 }
 
 LevelMeter::~LevelMeter()
 {
-    stopTimer();
+    refreshScheduler->remove (this);
 }
 
 void LevelMeter::setMeterFlags (MeterFlags type)
@@ -88,7 +123,15 @@ void LevelMeter::setFixedNumChannels (int numChannels)
 void LevelMeter::setRefreshRateHz (int newRefreshRate)
 {
     refreshRate = newRefreshRate;
-    startTimerHz (refreshRate);
+    if (refreshRate > 0)
+    {
+        framesPerRefresh = juce::jmax (1, juce::roundToInt ((double) RefreshScheduler::frameRateHz / refreshRate));
+        refreshScheduler->add (this);
+    }
+    else
+    {
+        refreshScheduler->remove (this);
+    }
 }
 
 void LevelMeter::paint (juce::Graphics& g)
@@ -136,7 +179,7 @@ void LevelMeter::visibilityChanged ()
     backgroundNeedsRepaint = true;
 }
 
-void LevelMeter::timerCallback ()
+void LevelMeter::refresh ()
 {
     if ((source && source->checkNewDataFlag()) || backgroundNeedsRepaint)
     {
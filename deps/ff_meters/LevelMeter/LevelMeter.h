@@ -51,7 +51,7 @@ class LevelMeterLookAndFeel;
  This class is used to display a level reading. It supports max and RMS levels.
  You can also set a reduction value to display, the definition of that value is up to you.
 */
-class LevelMeter    : public juce::Component, private juce::Timer
+class LevelMeter    : public juce::Component
 {
 public:
 
@@ -239,7 +239,11 @@ public:
 
     void visibilityChanged () override;
 
-    void timerCallback () override;
+    /**
+     Repaints the meter if its source has new data. All meters get called from one
+     shared timer, the ones due in the same frame repaint together.
+     */
+    void refresh ();
 
     /**
      Set a LevelMeterSource to display. This separation is used, so the source can work in the processing and the 
@@ -340,6 +344,10 @@ private:
     int                                   fixedNumChannels = -1;
     MeterFlags                            meterType = HasBorder;
     int                                   refreshRate = 30;
+    int                                   framesPerRefresh = 1;
+
+    class RefreshScheduler;
+    juce::SharedResourcePointer<RefreshScheduler> refreshScheduler;
     bool                                  useBackgroundImage = false;
     juce::Image                           backgroundImage;
     bool                                  backgroundNeedsRepaint = true;
@@ -64,7 +64,8 @@ private:
         hold (0),
         rmsHistory ((size_t) rmsWindow, 0.0),
         rmsSum (0.0),
-        rmsPtr (0)
+        rmsPtr (0),
+        avgRms (0.0f)
         {}
 
         ChannelData (const ChannelData& other) :
@@ -75,7 +76,8 @@ private:
         hold      (other.hold.load()),
         rmsHistory (8, 0.0),
         rmsSum    (0.0),
-        rmsPtr    (0)
+        rmsPtr    (0),
+        avgRms    (0.0f)
         {}
 
         ChannelData& operator=(const ChannelData& other)
@@ -88,6 +90,7 @@ private:
             rmsHistory.resize (other.rmsHistory.size(), 0.0);
             rmsSum = 0.0;
             rmsPtr = 0;
+            avgRms = 0.0f;
             return (*this);
         }
 
@@ -96,13 +99,10 @@ private:
         std::atomic<bool>        clip;
         std::atomic<float>       reduction;
 
+        // published by the measuring thread, so the GUI never looks at the history
         float getAvgRMS () const
         {
-            if (rmsHistory.size() > 0) {
-                return std::sqrt(std::accumulate (rmsHistory.begin(), rmsHistory.end(), 0.0f) / static_cast<float>(rmsHistory.size()));
-            }
-                
-            return float (std::sqrt (rmsSum));
+            return avgRms.load (std::memory_order_relaxed);
         }
 
         void setLevels (const juce::int64 time, const float newMax, const float newRms, const juce::int64 newHoldMSecs)
@@ -127,6 +127,7 @@ private:
         {
             rmsHistory.assign (numBlocks, 0.0);
             rmsSum  = 0.0;
+            avgRms  = 0.0f;
             if (numBlocks > 1)
                 rmsPtr %= rmsHistory.size();
             else
@@ -139,12 +140,19 @@ private:
 
             if (rmsHistory.size() > 0)
             {
+                // a running sum, recomputed once per round so it can't drift
+                double sum = rmsSum + squaredRMS - rmsHistory [(size_t) rmsPtr];
                 rmsHistory [(size_t) rmsPtr] = squaredRMS;
                 rmsPtr = (rmsPtr + 1) % rmsHistory.size();
+                if (rmsPtr == 0)
+                    sum = std::accumulate (rmsHistory.begin(), rmsHistory.end(), 0.0);
+                rmsSum = sum;
+                avgRms.store (float (std::sqrt (std::max (0.0, sum) / static_cast<double>(rmsHistory.size()))), std::memory_order_relaxed);
             }
             else
             {
                 rmsSum = squaredRMS;
+                avgRms.store (float (std::sqrt (squaredRMS)), std::memory_order_relaxed);
             }
         }
 
@@ -152,8 +160,50 @@ private:
         std::vector<double>      rmsHistory;
         std::atomic<double>      rmsSum;
         size_t                   rmsPtr;
+        std::atomic<float>       avgRms;
     };
 
+    /**
+     Peak magnitude and RMS of one channel in a single pass. The eight separate
+     accumulators let the compiler keep them in vector registers.
+     */
+    template<typename FloatType>
+    static void measureChannel (const FloatType* data, const int numSamples, float& peak, float& rms)
+    {
+        constexpr int lanes = 8;
+        FloatType sums[lanes] = {};
+        FloatType peaks[lanes] = {};
+
+        int i = 0;
+        for (; i + lanes <= numSamples; i += lanes)
+        {
+            for (int k = 0; k < lanes; ++k)
+            {
+                const FloatType x = data[i + k];
+                const FloatType a = std::abs (x);
+                sums[k] += x * x;
+                peaks[k] = a > peaks[k] ? a : peaks[k];
+            }
+        }
+
+        FloatType sum = 0;
+        FloatType maxval = 0;
+        for (int k = 0; k < lanes; ++k)
+        {
+            sum += sums[k];
+            maxval = std::max (maxval, peaks[k]);
+        }
+        for (; i < numSamples; ++i)
+        {
+            sum += data[i] * data[i];
+            maxval = std::max (maxval, std::abs (data[i]));
+        }
+
+        peak = float (maxval);
+
+        rms = numSamples > 0 ? float (std::sqrt (sum / FloatType (numSamples))) : 0.0f;
+    }
+
 public:
     LevelMeterSource () :
     holdMSecs       (500),
@@ -203,10 +253,25 @@ JUCE_COMPILER_WARNING("The use of levels.resize() is not realtime safe. Please c
 #endif
 
             for (int channel=0; channel < std::min (numChannels, int (levels.size())); ++channel) {
-                levels [size_t (channel)].setLevels (lastMeasurement,
-                                                     buffer.getMagnitude (channel, startSample, numSamples),
-                                                     buffer.getRMSLevel  (channel, startSample, numSamples),
-                                                     holdMSecs);
+                float peak, rms;
+                measureChannel (buffer.getReadPointer (channel, startSample), numSamples, peak, rms);
+                levels [size_t (channel)].setLevels (lastMeasurement, peak, rms, holdMSecs);
+            }
+        }
+
+        newDataFlag = true;
+    }
+
+    /**
+     Same as measureBlock() with a block that is known to be silent, without looking at it.
+     */
+    void measureSilence()
+    {
+        lastMeasurement = juce::Time::currentTimeMillis();
+        if (! suspended)
+        {
+            for (size_t channel=0; channel < levels.size(); ++channel) {
+                levels [channel].setLevels (lastMeasurement, 0.0f, 0.0f, holdMSecs);
             }
         }
 
@@ -362,6 +427,11 @@ JUCE_COMPILER_WARNING("The use of levels.resize() is not realtime safe. Please c
         suspended = shouldBeSuspended;
     }
 
+    bool isSuspended () const
+    {
+        return suspended;
+    }
+
     bool checkNewDataFlag() const
     {
         return newDataFlag;
@@ -387,7 +457,7 @@ private:
 
     bool newDataFlag = true;
 
-    bool suspended;
+    std::atomic<bool> suspended;
 };
 
 /*@}*/
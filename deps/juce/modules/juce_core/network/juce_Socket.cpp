@@ -158,20 +158,82 @@ namespace SocketHelpers
         return ::bind (handle, (struct sockaddr*) &addr, sizeof (addr)) >= 0;
     }
 
+    static void mapToIPv6 (const struct sockaddr_in& addr, struct sockaddr_in6& result) noexcept
+    {
+        zerostruct (result);
+        result.sin6_family = AF_INET6;
+        result.sin6_port = addr.sin_port;
+        result.sin6_addr.s6_addr[10] = 0xff;
+        result.sin6_addr.s6_addr[11] = 0xff;
+        memcpy (&result.sin6_addr.s6_addr[12], &addr.sin_addr, 4);
+    }
+
+    static bool bindSocketIPv6 (SocketHandle handle, int port, const String& address) noexcept
+    {
+        if (handle == invalidSocket || ! isValidPortNumber (port))
+            return false;
+
+        struct sockaddr_in6 addr;
+        zerostruct (addr);
+
+        addr.sin6_family = AF_INET6;
+        addr.sin6_port = htons ((uint16) port);
+        addr.sin6_addr = in6addr_any;
+
+        if (address.containsChar (':'))
+        {
+            if (inet_pton (AF_INET6, address.toRawUTF8(), &addr.sin6_addr) != 1)
+                return false;
+        }
+        else if (address.isNotEmpty())
+        {
+            struct sockaddr_in addr4;
+            zerostruct (addr4);
+            addr4.sin_family = AF_INET;
+            addr4.sin_port = addr.sin6_port;
+            addr4.sin_addr.s_addr = ::inet_addr (address.toRawUTF8());
+            mapToIPv6 (addr4, addr);
+        }
+
+        return ::bind (handle, (struct sockaddr*) &addr, sizeof (addr)) >= 0;
+    }
+
     static int getBoundPort (SocketHandle handle) noexcept
     {
         if (handle != invalidSocket)
         {
-            struct sockaddr_in addr;
+            struct sockaddr_storage addr;
             socklen_t len = sizeof (addr);
 
             if (getsockname (handle, (struct sockaddr*) &addr, &len) == 0)
-                return ntohs (addr.sin_port);
+            {
+                if (addr.ss_family == AF_INET6)
+                    return ntohs (((struct sockaddr_in6*) &addr)->sin6_port);
+
+                return ntohs (((struct sockaddr_in*) &addr)->sin_port);
+            }
         }
 
         return -1;
     }
 
+    // sends to an IPv4 address on a dual-stack socket have to use the mapped address
+    static int sendTo (SocketHandle handle, bool dualStack, const void* sourceBuffer, int numBytesToWrite,
+                       const struct sockaddr* addr, juce_socklen_t addrlen) noexcept
+    {
+        struct sockaddr_in6 mapped;
+
+        if (dualStack && addr->sa_family == AF_INET)
+        {
+            mapToIPv6 (*(const struct sockaddr_in*) addr, mapped);
+            addr = (const struct sockaddr*) &mapped;
+            addrlen = (juce_socklen_t) sizeof (mapped);
+        }
+
+        return (int) ::sendto (handle, (const char*) sourceBuffer,
+                               (juce_recvsend_size_t) numBytesToWrite, 0, addr, addrlen);
+    }
+
     static String getConnectedAddress (SocketHandle handle) noexcept
     {
         struct sockaddr_in addr;
@@ -243,13 +305,30 @@ namespace SocketHelpers
                     }
                     else
                     {
-                        sockaddr_in client;
-                        socklen_t clientLen = sizeof (sockaddr);
+                        sockaddr_storage client;
+                        socklen_t clientLen = sizeof (client);
 
                         bytesThisTime = ::recvfrom (handle, buffer, numToRead, 0, (sockaddr*) &client, &clientLen);
 
-                        *senderIP = String::fromUTF8 (inet_ntoa (client.sin_addr), 16);
-                        *senderPort = ntohs (client.sin_port);
+                        if (client.ss_family == AF_INET6)
+                        {
+                            auto client6 = (const sockaddr_in6*) &client;
+                            char ipbuf[INET6_ADDRSTRLEN] = {};
+
+                            if (IN6_IS_ADDR_V4MAPPED (&client6->sin6_addr))
+                                inet_ntop (AF_INET, (void*) &client6->sin6_addr.s6_addr[12], ipbuf, sizeof (ipbuf));
+                            else
+                                inet_ntop (AF_INET6, (void*) &client6->sin6_addr, ipbuf, sizeof (ipbuf));
+
+                            *senderIP = String::fromUTF8 (ipbuf);
+                            *senderPort = ntohs (client6->sin6_port);
+                        }
+                        else
+                        {
+                            auto client4 = (const sockaddr_in*) &client;
+                            *senderIP = String::fromUTF8 (inet_ntoa (client4->sin_addr), 16);
+                            *senderPort = ntohs (client4->sin_port);
+                        }
                     }
                 }
             }
@@ -644,11 +723,34 @@ bool StreamingSocket::setSendBufferSize (int bufsize)
 
 //==============================================================================
 //==============================================================================
-DatagramSocket::DatagramSocket (bool canBroadcast)
+DatagramSocket::DatagramSocket (bool canBroadcast, bool enableDualStack)
 {
     SocketHelpers::initSockets();
 
-    handle = (int) socket (AF_INET, SOCK_DGRAM, 0);
+    if (enableDualStack)
+    {
+        auto h = (SocketHandle) socket (AF_INET6, SOCK_DGRAM, 0);
+
+        if (h != invalidSocket)
+        {
+            if (SocketHelpers::setOption<int> (h, IPPROTO_IPV6, IPV6_V6ONLY, 0))
+            {
+                handle = (int) h;
+                dualStack = true;
+            }
+            else
+            {
+               #if JUCE_WINDOWS
+                closesocket (h);
+               #else
+                ::close (h);
+               #endif
+            }
+        }
+    }
+
+    if (! dualStack)
+        handle = (int) socket (AF_INET, SOCK_DGRAM, 0);
 
     if (handle >= 0)
     {
@@ -688,7 +790,8 @@ bool DatagramSocket::bindToPort (int port, const String& addr)
     if (handle < 0)
         return false;
 
-    if (SocketHelpers::bindSocket ((SocketHandle) handle.load(), port, addr))
+    if (dualStack ? SocketHelpers::bindSocketIPv6 ((SocketHandle) handle.load(), port, addr)
+                  : SocketHelpers::bindSocket ((SocketHandle) handle.load(), port, addr))
     {
         isBound = true;
         lastBindAddress = addr;
@@ -748,9 +851,11 @@ int DatagramSocket::write (const String& remoteHostname, int remotePortNumber,
 
     struct addrinfo* info = reinterpret_cast<struct addrinfo*> (lastRemotePeer->getAddrInfo());        
 
-    return (int) ::sendto (handle, (const char*) sourceBuffer,
-                           (juce_recvsend_size_t) numBytesToWrite, 0,
-                           info->ai_addr, (socklen_t) info->ai_addrlen);
+    if (info == nullptr)
+        return -1;
+
+    return SocketHelpers::sendTo ((SocketHandle) handle.load(), dualStack, sourceBuffer, numBytesToWrite,
+                                  info->ai_addr, (juce_socklen_t) info->ai_addrlen);
 }
 
 int DatagramSocket::write (DatagramSocket::RemoteAddrInfo & remotePeerToken,
@@ -765,9 +870,8 @@ int DatagramSocket::write (DatagramSocket::RemoteAddrInfo & remotePeerToken,
         return -1;
     }
 
-    return (int) ::sendto ((SocketHandle) handle.load(), (const char*) sourceBuffer,
-                           (juce_recvsend_size_t) numBytesToWrite, 0,
-                           info->ai_addr, (socklen_t) info->ai_addrlen);
+    return SocketHelpers::sendTo ((SocketHandle) handle.load(), dualStack, sourceBuffer, numBytesToWrite,
+                                  info->ai_addr, (juce_socklen_t) info->ai_addrlen);
 }
 
 
@@ -221,8 +221,13 @@ public:
 
         If enableBroadcasting is true, the socket will be allowed to send broadcast messages
         (may require extra privileges on linux)
+
+        If enableDualStack is true, an IPv6 socket is created which also takes IPv4 traffic
+        (as IPv4-mapped addresses), so that it can talk to both IPv4 and IPv6 hosts. If the
+        system has no IPv6 support, it falls back to an IPv4 socket. Multicast needs an
+        IPv4 socket.
     */
-    DatagramSocket (bool enableBroadcasting = false);
+    DatagramSocket (bool enableBroadcasting = false, bool enableDualStack = false);
 
 
     /** Destructor. */
@@ -264,6 +269,10 @@ public:
     /** Returns the OS's socket handle that's currently open. */
     int getRawSocketHandle() const noexcept                     { return handle; }
 
+    /** Returns true if this is a dual-stack IPv6 socket, i.e. raw IPv4 addresses
+        have to be mapped to IPv6 before sending to them. */
+    bool isDualStack() const noexcept                           { return dualStack; }
+
     //==============================================================================
     /** Waits until the socket is ready for reading or writing.
 
@@ -416,6 +425,7 @@ private:
     //==============================================================================
     std::atomic<int> handle { -1 };
     bool isBound = false;
+    bool dualStack = false;
     String lastBindAddress, lastServerHost;
     int lastServerPort = -1;
     std::unique_ptr<RemoteAddrInfo> lastRemotePeer;
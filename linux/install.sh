@@ -39,5 +39,11 @@ if [ -d ${INSTBUILDDIR}/VST3/SonoBusInstrument.vst3 ] ; then
   echo "SonoBus VST3i plugin installed"
 fi
 
+if [ -f ../build/server/sonobus-server ] ; then
+  cp ../build/server/sonobus-server ${PREFIX}/bin/sonobus-server
+
+  echo "sonobus-server installed"
+fi
+
 echo "SonoBus application installed"
 
@@ -0,0 +1,568 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+// sonobus-loadtest: how many peers one machine handles.
+//
+// One SonobusAudioProcessor (the one under test) runs headless and connects
+// through connectRemotePeer() to a growing number of synthetic peers on
+// localhost. The peers are SonobusAudioProcessor instances too, each with its
+// own socket and threads, looping a sine into their input, so the one under
+// test sees exactly the traffic of a real session. One thread drives all of
+// their audio callbacks in real time.
+//
+// For every peer count it reports
+// - the processBlock() time of the processor under test (median, 99th and
+//   99.9th percentile, max) and how many blocks missed their deadline
+// - the CPU of the network threads of the processor under test (Linux only)
+//   and of the whole process, the synthetic peers included
+// - the memory each additional peer takes (Linux only), split into what a
+//   peer instance costs on its own and what connecting it adds on both ends
+// - the packets and bytes per second the processor under test sends and gets
+//
+//   sonobus-loadtest [--peers=1,2,4,8,16,32 | --max-peers=<n>] [--seconds=<s>]
+//                    [--warmup=<s>] [--samplerate=<hz>] [--blocksize=<n>]
+//                    [--format=<index>] [--csv]
+
+#include "JuceHeader.h"
+
+#include "SonobusPluginProcessor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <set>
+#include <vector>
+
+#if JUCE_LINUX
+#include <unistd.h>
+#endif
+
+namespace {
+
+struct Options
+{
+    Array<int> peerCounts { 1, 2, 4, 8, 16, 32 };
+    double seconds = 10.0;
+    double warmup = 3.0;
+    double sampleRate = 48000.0;
+    int blockSize = 256;
+    int formatIndex = -1; // the processor default
+    bool csv = false;
+};
+
+// calls fn on the message thread and waits for it
+template<typename F>
+void callOnMessageThread(F && fn)
+{
+    MessageManager::getInstance()->callFunctionOnMessageThread([](void * arg) -> void * {
+        (*static_cast<typename std::remove_reference<F>::type *>(arg))();
+        return nullptr;
+    }, &fn);
+}
+
+std::unique_ptr<SonobusAudioProcessor> createProcessor(const Options & opts)
+{
+    auto proc = std::make_unique<SonobusAudioProcessor>();
+    if (opts.formatIndex >= 0 && opts.formatIndex < proc->getNumberAudioCodecFormats()) {
+        proc->setDefaultAudioCodecFormat(opts.formatIndex);
+    }
+    proc->setRateAndBufferSizeDetails(opts.sampleRate, opts.blockSize);
+    proc->prepareToPlay(opts.sampleRate, opts.blockSize);
+    return proc;
+}
+
+// one processor, fed with a sine in all its inputs
+struct AudioEndpoint
+{
+    AudioEndpoint(std::unique_ptr<SonobusAudioProcessor> proc, double freq, const Options & opts)
+    : processor(std::move(proc))
+    {
+        const int chans = jmax(processor->getTotalNumInputChannels(), processor->getTotalNumOutputChannels());
+        buffer.setSize(chans, opts.blockSize);
+        phaseInc = MathConstants<double>::twoPi * freq / opts.sampleRate;
+    }
+
+    void process()
+    {
+        const int ins = processor->getTotalNumInputChannels();
+        for (int i = 0; i < buffer.getNumSamples(); ++i) {
+            const float s = 0.25f * (float) std::sin(phase);
+            for (int ch = 0; ch < ins; ++ch) {
+                buffer.setSample(ch, i, s);
+            }
+            phase += phaseInc;
+        }
+        phase = std::fmod(phase, MathConstants<double>::twoPi);
+        for (int ch = ins; ch < buffer.getNumChannels(); ++ch) {
+            buffer.clear(ch, 0, buffer.getNumSamples());
+        }
+        midi.clear();
+        processor->processBlock(buffer, midi);
+    }
+
+    std::unique_ptr<SonobusAudioProcessor> processor;
+    AudioBuffer<float> buffer;
+    MidiBuffer midi;
+    double phase = 0.0;
+    double phaseInc = 0.0;
+};
+
+// stands in for the audio device: runs the processor under test and then
+// all the synthetic peers, once every block period
+class AudioDriver : public Thread
+{
+public:
+    AudioDriver(AudioEndpoint & dut, const Options & opts)
+    : Thread("loadtest audio"), dut(dut), periodMs(1000.0 * opts.blockSize / opts.sampleRate)
+    {
+        timings.reserve((size_t) (opts.seconds * 1000.0 / periodMs) + 1024);
+    }
+
+    void addPeer(AudioEndpoint * peer)
+    {
+        const ScopedLock sl (peersLock);
+        peers.push_back(peer);
+    }
+
+    void startRecording()
+    {
+        const ScopedLock sl (peersLock);
+        timings.clear();
+        lateBlocks = 0;
+        recording = true;
+    }
+
+    // the processBlock times in ms since startRecording()
+    std::vector<double> stopRecording(int & retLateBlocks)
+    {
+        const ScopedLock sl (peersLock);
+        recording = false;
+        retLateBlocks = lateBlocks;
+        return timings;
+    }
+
+    void run() override
+    {
+        double next = Time::getMillisecondCounterHiRes();
+
+        while (!threadShouldExit()) {
+            // sleep most of the way, then spin for the rest
+            double now = Time::getMillisecondCounterHiRes();
+            if (next - now > 2.0) {
+                Thread::sleep((int) (next - now - 1.0));
+                continue;
+            }
+            while (Time::getMillisecondCounterHiRes() < next) {}
+
+            const ScopedLock sl (peersLock);
+
+            const auto t0 = Time::getHighResolutionTicks();
+            dut.process();
+            const auto t1 = Time::getHighResolutionTicks();
+
+            for (auto * peer : peers) {
+                peer->process();
+            }
+
+            if (recording && timings.size() < timings.capacity()) {
+                timings.push_back(1000.0 * Time::highResolutionTicksToSeconds(t1 - t0));
+            }
+
+            next += periodMs;
+            now = Time::getMillisecondCounterHiRes();
+            if (now > next + periodMs) {
+                // fell behind by more than a block, like a device would drop out
+                if (recording) ++lateBlocks;
+                next = now;
+            }
+        }
+    }
+
+private:
+    AudioEndpoint & dut;
+    const double periodMs;
+
+    CriticalSection peersLock;
+    std::vector<AudioEndpoint *> peers;
+    std::vector<double> timings;
+    int lateBlocks = 0;
+    bool recording = false;
+};
+
+/*////////////////////////// process info //////////////////////////*/
+
+#if JUCE_LINUX
+
+std::set<String> getThreadIds()
+{
+    std::set<String> ids;
+    for (const auto & dir : File("/proc/self/task").findChildFiles(File::findDirectories, false)) {
+        ids.insert(dir.getFileName());
+    }
+    return ids;
+}
+
+// user + system time of a thread in seconds, -1 if it is gone
+double getThreadCpuSeconds(const String & tid)
+{
+    const auto stat = File("/proc/self/task/" + tid + "/stat").loadFileAsString();
+    const int paren = stat.lastIndexOfChar(')');
+    if (paren < 0) return -1.0;
+    // fields after the name start with the state, utime and stime are the 12th and 13th of them
+    auto fields = StringArray::fromTokens(stat.substring(paren + 1), " ", "");
+    fields.removeEmptyStrings();
+    if (fields.size() < 13) return -1.0;
+    return (fields[11].getLargeIntValue() + fields[12].getLargeIntValue()) / (double) sysconf(_SC_CLK_TCK);
+}
+
+String getTaskName(const String & tid)
+{
+    return File("/proc/self/task/" + tid + "/comm").loadFileAsString().trim();
+}
+
+double getProcessCpuSeconds()
+{
+    const auto stat = File("/proc/self/stat").loadFileAsString();
+    const int paren = stat.lastIndexOfChar(')');
+    auto fields = StringArray::fromTokens(stat.substring(paren + 1), " ", "");
+    fields.removeEmptyStrings();
+    if (paren < 0 || fields.size() < 13) return -1.0;
+    return (fields[11].getLargeIntValue() + fields[12].getLargeIntValue()) / (double) sysconf(_SC_CLK_TCK);
+}
+
+double getResidentMB()
+{
+    auto fields = StringArray::fromTokens(File("/proc/self/statm").loadFileAsString(), " ", "");
+    if (fields.size() < 2) return -1.0;
+    return fields[1].getLargeIntValue() * (double) sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+}
+
+#else
+
+std::set<String> getThreadIds() { return {}; }
+double getThreadCpuSeconds(const String &) { return -1.0; }
+String getTaskName(const String &) { return {}; }
+double getProcessCpuSeconds() { return -1.0; }
+double getResidentMB() { return -1.0; }
+
+#endif
+
+/*////////////////////////// the test //////////////////////////*/
+
+struct StepResult
+{
+    int peers = 0;
+    int connected = 0;
+    double p50 = 0, p99 = 0, p999 = 0, max = 0;
+    int missed = 0;     // blocks where processBlock took longer than the period
+    int late = 0;       // blocks the driver fell behind on
+    int blocks = 0;
+    double netCpu = -1; // percent of one core
+    double totalCpu = -1;
+    double instanceMB = -1; // per peer
+    double connectionMB = -1;
+    double packetsOut = 0, packetsIn = 0; // per second
+    double kBytesOut = 0, kBytesIn = 0;
+};
+
+class LoadTest : public Thread
+{
+public:
+    explicit LoadTest(const Options & opts) : Thread("loadtest"), opts(opts) {}
+
+    int getExitCode() const { return exitCode; }
+
+    void run() override
+    {
+        exitCode = runTest();
+        MessageManager::getInstance()->stopDispatchLoop();
+    }
+
+private:
+    int runTest()
+    {
+        // whatever threads show up while making the processor under test are its own
+        const auto before = getThreadIds();
+        callOnMessageThread([this] {
+            dut = std::make_unique<AudioEndpoint>(createProcessor(opts), 440.0, opts);
+        });
+        Thread::sleep(500);
+        for (const auto & tid : getThreadIds()) {
+            if (before.count(tid) == 0) dutThreads.insert(tid);
+        }
+
+        if (dut->processor->getUdpLocalPort() <= 0) {
+            fprintf(stderr, "the processor under test couldn't bind a UDP port\n");
+            return 1;
+        }
+
+        printHeader();
+
+        driver = std::make_unique<AudioDriver>(*dut, opts);
+        driver->startThread(Thread::realtimeAudioPriority);
+
+        int exitcode = 0;
+        for (int count : opts.peerCounts) {
+            if (threadShouldExit()) break;
+            auto result = runStep(count);
+            printResult(result);
+            if (result.connected < result.peers) {
+                exitcode = 1;
+            }
+        }
+
+        driver->stopThread(2000);
+        driver.reset();
+
+        callOnMessageThread([this] {
+            dut->processor->removeAllRemotePeers();
+            peers.clear();
+            dut.reset();
+        });
+
+        return exitcode;
+    }
+
+    StepResult runStep(int count)
+    {
+        StepResult r;
+        r.peers = count;
+
+        // make the new peers...
+        const int added = count - (int) peers.size();
+        const double mb0 = getResidentMB();
+        callOnMessageThread([this, count] {
+            while ((int) peers.size() < count) {
+                // each peer on its own pitch
+                const double freq = 220.0 * std::pow(2.0, (peers.size() % 24) / 12.0);
+                peers.push_back(std::make_unique<AudioEndpoint>(createProcessor(opts), freq, opts));
+            }
+        });
+        const double mb1 = getResidentMB();
+
+        // ...and connect to them
+        for (int i = (int) peers.size() - added; i < (int) peers.size(); ++i) {
+            driver->addPeer(peers[(size_t) i].get());
+            dut->processor->connectRemotePeer("127.0.0.1", peers[(size_t) i]->processor->getUdpLocalPort());
+        }
+
+        // both directions up, or give up after a while
+        const double connectDeadline = Time::getMillisecondCounterHiRes() + 5000.0 + 100.0 * added;
+        while (Time::getMillisecondCounterHiRes() < connectDeadline && !threadShouldExit()) {
+            if (countConnected() >= count) break;
+            Thread::sleep(100);
+        }
+        r.connected = countConnected();
+
+        Thread::sleep((int) (opts.warmup * 1000.0));
+        const double mb2 = getResidentMB();
+
+        if (added > 0 && mb0 >= 0.0) {
+            r.instanceMB = (mb1 - mb0) / added;
+            r.connectionMB = (mb2 - mb1) / added;
+        }
+
+        // measure
+        std::map<String, double> threadCpu0;
+        for (const auto & tid : dutThreads) threadCpu0[tid] = getThreadCpuSeconds(tid);
+        const double cpu0 = getProcessCpuSeconds();
+        const auto counters0 = getCounters();
+        const double t0 = Time::getMillisecondCounterHiRes();
+        driver->startRecording();
+
+        Thread::sleep((int) (opts.seconds * 1000.0));
+
+        auto timings = driver->stopRecording(r.late);
+        const double elapsed = (Time::getMillisecondCounterHiRes() - t0) * 0.001;
+        const auto counters1 = getCounters();
+        const double cpu1 = getProcessCpuSeconds();
+
+        double netcpu = 0.0;
+        bool havecpu = false;
+        for (const auto & tid : dutThreads) {
+            const double c = getThreadCpuSeconds(tid);
+            if (c >= 0.0 && threadCpu0[tid] >= 0.0) {
+                netcpu += c - threadCpu0[tid];
+                havecpu = true;
+            }
+        }
+        if (havecpu) r.netCpu = 100.0 * netcpu / elapsed;
+        if (cpu0 >= 0.0) r.totalCpu = 100.0 * (cpu1 - cpu0) / elapsed;
+
+        r.packetsOut = (counters1.packetsOut - counters0.packetsOut) / elapsed;
+        r.packetsIn = (counters1.packetsIn - counters0.packetsIn) / elapsed;
+        r.kBytesOut = (counters1.bytesOut - counters0.bytesOut) / elapsed / 1024.0;
+        r.kBytesIn = (counters1.bytesIn - counters0.bytesIn) / elapsed / 1024.0;
+
+        r.blocks = (int) timings.size();
+        if (!timings.empty()) {
+            const double period = 1000.0 * opts.blockSize / opts.sampleRate;
+            r.missed = (int) std::count_if(timings.begin(), timings.end(), [period](double t) { return t > period; });
+            std::sort(timings.begin(), timings.end());
+            auto quantile = [&timings](double q) {
+                return timings[(size_t) (q * (timings.size() - 1) + 0.5)];
+            };
+            r.p50 = quantile(0.5);
+            r.p99 = quantile(0.99);
+            r.p999 = quantile(0.999);
+            r.max = timings.back();
+        }
+        return r;
+    }
+
+    int countConnected() const
+    {
+        int connected = 0;
+        for (int i = 0; i < dut->processor->getNumberRemotePeers(); ++i) {
+            SonobusAudioProcessor::PeerStatus status;
+            if (dut->processor->getRemotePeerStatus(i, status)
+                && status.connected && status.sendActive && status.recvChannels > 0) {
+                ++connected;
+            }
+        }
+        return connected;
+    }
+
+    struct Counters
+    {
+        int64 packetsOut = 0, packetsIn = 0, bytesOut = 0, bytesIn = 0;
+    };
+
+    Counters getCounters() const
+    {
+        Counters c;
+        for (int i = 0; i < dut->processor->getNumberRemotePeers(); ++i) {
+            c.packetsOut += dut->processor->getRemotePeerPacketsSent(i);
+            c.packetsIn += dut->processor->getRemotePeerPacketsReceived(i);
+            c.bytesOut += dut->processor->getRemotePeerBytesSent(i);
+            c.bytesIn += dut->processor->getRemotePeerBytesReceived(i);
+        }
+        return c;
+    }
+
+    void printHeader()
+    {
+        const auto formatIndex = dut->processor->getDefaultAudioCodecFormat();
+        if (opts.csv) {
+            printf("peers,connected,process_p50_ms,process_p99_ms,process_p999_ms,process_max_ms,"
+                   "missed_blocks,late_blocks,blocks,net_cpu_percent,total_cpu_percent,"
+                   "instance_mb_per_peer,connection_mb_per_peer,packets_out_per_s,packets_in_per_s,"
+                   "kbytes_out_per_s,kbytes_in_per_s\n");
+        }
+        else {
+            StringArray names;
+            for (const auto & tid : dutThreads) names.add(getTaskName(tid));
+            printf("%.0f Hz, %d samples per block (%.2f ms), %s, %.0f s per step\n",
+                   opts.sampleRate, opts.blockSize, 1000.0 * opts.blockSize / opts.sampleRate,
+                   dut->processor->getAudioCodeFormatName(formatIndex).toRawUTF8(), opts.seconds);
+            if (!names.isEmpty()) {
+                printf("network threads of the processor under test: %s\n", names.joinIntoString(", ").toRawUTF8());
+            }
+            printf("\n%6s %10s %30s %8s %6s %8s %8s %15s %15s %15s\n", "Peers", "Connected",
+                   "processBlock ms (p50/p99/p999/max)", "Missed", "Late",
+                   "Net CPU%", "All CPU%", "MB/peer (inst/conn)", "Packets/s (out/in)", "kB/s (out/in)");
+            printf("%s\n", String::repeatedString("-", 138).toRawUTF8());
+        }
+        fflush(stdout);
+    }
+
+    void printResult(const StepResult & r)
+    {
+        auto orNone = [](double v, const char * fmt) {
+            return v < 0.0 ? String("-") : String::formatted(fmt, v);
+        };
+
+        if (opts.csv) {
+            printf("%d,%d,%.3f,%.3f,%.3f,%.3f,%d,%d,%d,%s,%s,%s,%s,%.1f,%.1f,%.1f,%.1f\n",
+                   r.peers, r.connected, r.p50, r.p99, r.p999, r.max, r.missed, r.late, r.blocks,
+                   orNone(r.netCpu, "%.1f").toRawUTF8(), orNone(r.totalCpu, "%.1f").toRawUTF8(),
+                   orNone(r.instanceMB, "%.2f").toRawUTF8(), orNone(r.connectionMB, "%.2f").toRawUTF8(),
+                   r.packetsOut, r.packetsIn, r.kBytesOut, r.kBytesIn);
+        }
+        else {
+            const auto process = String::formatted("%.3f / %.3f / %.3f / %.3f", r.p50, r.p99, r.p999, r.max);
+            const auto memory = orNone(r.instanceMB, "%.2f") + " / " + orNone(r.connectionMB, "%.2f");
+            const auto packets = String::formatted("%.0f / %.0f", r.packetsOut, r.packetsIn);
+            const auto bytes = String::formatted("%.0f / %.0f", r.kBytesOut, r.kBytesIn);
+            printf("%6d %10d %30s %8d %6d %8s %8s %15s %15s %15s\n", r.peers, r.connected,
+                   process.toRawUTF8(), r.missed, r.late,
+                   orNone(r.netCpu, "%.1f").toRawUTF8(), orNone(r.totalCpu, "%.1f").toRawUTF8(),
+                   memory.toRawUTF8(), packets.toRawUTF8(), bytes.toRawUTF8());
+        }
+        fflush(stdout);
+    }
+
+    const Options opts;
+    int exitCode = 0;
+
+    std::unique_ptr<AudioEndpoint> dut;
+    std::vector<std::unique_ptr<AudioEndpoint>> peers;
+    std::unique_ptr<AudioDriver> driver;
+    std::set<String> dutThreads;
+};
+
+bool parseOption(const String & arg, const char * name, String & value)
+{
+    const String prefix = String(name) + "=";
+    if (arg.startsWith(prefix)) {
+        value = arg.substring(prefix.length());
+        return true;
+    }
+    return false;
+}
+
+} // namespace
+
+int main(int argc, char * argv[])
+{
+    Options opts;
+
+    for (int i = 1; i < argc; ++i) {
+        const String arg = CharPointer_UTF8(argv[i]);
+        String v;
+        if (parseOption(arg, "--peers", v)) {
+            opts.peerCounts.clear();
+            for (const auto & n : StringArray::fromTokens(v, ",", "")) {
+                if (n.getIntValue() > 0) opts.peerCounts.add(n.getIntValue());
+            }
+        } else if (parseOption(arg, "--max-peers", v)) {
+            opts.peerCounts.clear();
+            for (int n = 1; n < v.getIntValue(); n *= 2) opts.peerCounts.add(n);
+            opts.peerCounts.add(jmax(1, v.getIntValue()));
+        } else if (parseOption(arg, "--seconds", v)) {
+            opts.seconds = jmax(1.0, v.getDoubleValue());
+        } else if (parseOption(arg, "--warmup", v)) {
+            opts.warmup = jmax(0.0, v.getDoubleValue());
+        } else if (parseOption(arg, "--samplerate", v)) {
+            opts.sampleRate = jmax(8000.0, v.getDoubleValue());
+        } else if (parseOption(arg, "--blocksize", v)) {
+            opts.blockSize = jmax(16, v.getIntValue());
+        } else if (parseOption(arg, "--format", v)) {
+            opts.formatIndex = v.getIntValue();
+        } else if (arg == "--csv") {
+            opts.csv = true;
+        } else {
+            fprintf(stderr, "unknown option %s, see the top of sonobus-loadtest.cpp\n", arg.toRawUTF8());
+            return 1;
+        }
+    }
+
+    // peer counts only ever grow, peers are added and never taken away between steps
+    std::sort(opts.peerCounts.begin(), opts.peerCounts.end());
+    if (opts.peerCounts.isEmpty()) {
+        fprintf(stderr, "no peer counts to run\n");
+        return 1;
+    }
+
+    ScopedJuceInitialiser_GUI juceInit;
+
+    LoadTest test(opts);
+    test.startThread();
+
+    // the processors need a message thread, this is it until the test is done
+    MessageManager::getInstance()->runDispatchLoop();
+
+    test.stopThread(5000);
+    return test.getExitCode();
+}
@@ -0,0 +1,478 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+// sonobus-roomhost: many rooms in one process.
+//
+// A hosted rehearsal service used to run the headless app once per room, each
+// with its threads, its allocator and its audio device, mostly sitting idle.
+// Here every room is a SonobusAudioProcessor of its own (its own socket, aoo
+// client and group, so peers and the connection server see it like any other
+// instance), but they run side by side in one process:
+//
+// - the network side is the processors' shared NetworkEngine already, one send,
+//   receive and event thread for all of them however many rooms there are
+// - there is no audio device. Each room has a virtual audio clock, a block
+//   period that starts at its own offset so the rooms don't all come due at
+//   the same moment, and a small pool of DSP workers runs them: every worker
+//   has its own share of the rooms, and once none of those is due it takes
+//   due ones from the others' shares, so a busy share doesn't hold up its
+//   rooms while other workers sleep
+//
+// What's left per room are its aoo client thread and the idle lookup thread.
+// The rooms get silence in and what they mix goes nowhere; what they are there
+// for (recording, a broadcast, the backing tracks, ...) comes from their
+// settings file.
+//
+//   sonobus-roomhost --server=<host[:port]> [--rooms=<file>] [--room=<group[:password]>]...
+//                    [--user=<name>] [--workers=<n>] [--samplerate=<hz>] [--blocksize=<n>]
+//                    [--setup=<settings file>] [--status=<s>] [--realtime]
+//
+// The rooms file has a room on each line, "group [password]", # starts a comment.
+// SIGTERM/SIGINT stop it.
+
+#include "JuceHeader.h"
+
+#include "SonobusPluginProcessor.h"
+
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+struct RoomSpec
+{
+    String group;
+    String password;
+};
+
+struct Options
+{
+    String serverHost;
+    int serverPort = DEFAULT_SERVER_PORT;
+    String userName = "room";
+    Array<RoomSpec> rooms;
+    String setupFile;
+    int workers = 0; // one per core, leaving one for the network threads
+    double sampleRate = 48000.0;
+    int blockSize = 256;
+    double statusSeconds = 30.0;
+    bool realtime = false;
+};
+
+std::atomic<bool> stopRequested { false };
+
+void requestStop(int)
+{
+    stopRequested = true;
+}
+
+// calls fn on the message thread and waits for it
+template<typename F>
+void callOnMessageThread(F && fn)
+{
+    MessageManager::getInstance()->callFunctionOnMessageThread([](void * arg) -> void * {
+        (*static_cast<typename std::remove_reference<F>::type *>(arg))();
+        return nullptr;
+    }, &fn);
+}
+
+// one session engine with its virtual audio clock
+struct Room
+{
+    Room(const RoomSpec & spec, const Options & opts, double startMs)
+    : spec(spec), periodMs(1000.0 * opts.blockSize / opts.sampleRate), nextDueMs(startMs)
+    {
+        processor = std::make_unique<SonobusAudioProcessor>();
+        processor->setRateAndBufferSizeDetails(opts.sampleRate, opts.blockSize);
+        processor->prepareToPlay(opts.sampleRate, opts.blockSize);
+
+        // nothing shows them here
+        processor->setMetersActive(false);
+        processor->setKeepChatHistory(false);
+
+        const int chans = jmax(processor->getTotalNumInputChannels(), processor->getTotalNumOutputChannels());
+        buffer.setSize(chans, opts.blockSize);
+    }
+
+    // on a worker, only ever one at a time per room (see RoomScheduler::tryRun)
+    void process()
+    {
+        buffer.clear();
+        midi.clear();
+        processor->processBlock(buffer, midi);
+    }
+
+    const RoomSpec spec;
+    const double periodMs;
+    std::unique_ptr<SonobusAudioProcessor> processor;
+    AudioBuffer<float> buffer;
+    MidiBuffer midi;
+
+    std::atomic<double> nextDueMs;
+    std::atomic<bool> busy { false };
+    std::atomic<int64> blocks { 0 };
+    // blocks the clock had to skip, like a device would drop out
+    std::atomic<int64> lateBlocks { 0 };
+    std::atomic<int64> stolenBlocks { 0 };
+    int64 reportedLate = 0; // host thread only
+};
+
+// the DSP workers, the rooms are split into one share per worker
+class RoomScheduler
+{
+public:
+    RoomScheduler(const std::vector<std::unique_ptr<Room>> & rooms, int numWorkers, bool realtime)
+    : rooms(rooms)
+    {
+        numWorkers = jlimit(1, jmax(1, (int) rooms.size()), numWorkers);
+        for (int i = 0; i < numWorkers; ++i) {
+            auto * worker = workers.add(new Worker(*this, i));
+            worker->startThread(realtime ? Thread::realtimeAudioPriority : 8);
+        }
+    }
+
+    ~RoomScheduler()
+    {
+        for (auto * worker : workers) {
+            worker->signalThreadShouldExit();
+        }
+        for (auto * worker : workers) {
+            worker->stopThread(2000);
+        }
+    }
+
+    int getNumWorkers() const { return workers.size(); }
+
+private:
+    class Worker : public Thread
+    {
+    public:
+        Worker(RoomScheduler & scheduler, int index)
+        : Thread("SonoBusRoomDSP" + String(index)), scheduler(scheduler), index(index) {}
+
+        void run() override { scheduler.runWorker(*this); }
+
+        RoomScheduler & scheduler;
+        const int index;
+    };
+
+    // rooms [begin, end) are the worker's own
+    void getShare(int worker, size_t & begin, size_t & end) const
+    {
+        const size_t num = rooms.size();
+        const size_t count = (size_t) workers.size();
+        begin = num * (size_t) worker / count;
+        end = num * (size_t) (worker + 1) / count;
+    }
+
+    // runs the room's block if it's due and nobody else has it, earliest
+    // is lowered to when it's due next either way
+    bool tryRun(Room & room, double now, double & earliest, bool stolen)
+    {
+        double due = room.nextDueMs.load(std::memory_order_acquire);
+        if (due > now) {
+            earliest = jmin(earliest, due);
+            return false;
+        }
+
+        bool expected = false;
+        if (!room.busy.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+            return false;
+        }
+
+        // someone else may have just run it
+        due = room.nextDueMs.load(std::memory_order_acquire);
+        if (due > now) {
+            room.busy.store(false, std::memory_order_release);
+            earliest = jmin(earliest, due);
+            return false;
+        }
+
+        room.process();
+        room.blocks.fetch_add(1, std::memory_order_relaxed);
+        if (stolen) room.stolenBlocks.fetch_add(1, std::memory_order_relaxed);
+
+        double next = due + room.periodMs;
+        const double after = Time::getMillisecondCounterHiRes();
+        if (after > next + room.periodMs) {
+            // fell behind by more than a block, start over from now
+            room.lateBlocks.fetch_add(1, std::memory_order_relaxed);
+            next = after;
+        }
+        room.nextDueMs.store(next, std::memory_order_release);
+        room.busy.store(false, std::memory_order_release);
+
+        earliest = jmin(earliest, next);
+        return true;
+    }
+
+    void runWorker(Worker & worker)
+    {
+        size_t begin, end;
+        getShare(worker.index, begin, end);
+        const size_t num = rooms.size();
+
+        ScopedNoDenormals noDenormals;
+
+        while (!worker.threadShouldExit()) {
+            double now = Time::getMillisecondCounterHiRes();
+            double earliest = now + 1000.0;
+            bool ran = false;
+
+            // our own first
+            for (size_t i = begin; i < end; ++i) {
+                ran = tryRun(*rooms[i], now, earliest, false) || ran;
+            }
+
+            if (!ran) {
+                // then whatever is due in the other shares, starting after ours
+                for (size_t n = 0; n < num - (end - begin); ++n) {
+                    const size_t i = (end + n) % num;
+                    if (tryRun(*rooms[i], now, earliest, true)) {
+                        ran = true;
+                        break; // and back to ours
+                    }
+                }
+            }
+
+            if (ran) continue;
+
+            // sleep most of the way, then spin for the rest, like a device callback
+            now = Time::getMillisecondCounterHiRes();
+            if (earliest - now > 2.0) {
+                Thread::sleep(jmin(100, (int) (earliest - now - 1.0)));
+            }
+            else if (earliest > now) {
+                Thread::yield();
+            }
+        }
+    }
+
+    const std::vector<std::unique_ptr<Room>> & rooms;
+    OwnedArray<Worker> workers;
+};
+
+class RoomHost : public Thread
+{
+public:
+    explicit RoomHost(const Options & opts) : Thread("roomhost"), opts(opts) {}
+
+    int getExitCode() const { return exitCode; }
+
+    void run() override
+    {
+        exitCode = runHost();
+        MessageManager::getInstance()->stopDispatchLoop();
+    }
+
+private:
+    int runHost()
+    {
+        const double periodMs = 1000.0 * opts.blockSize / opts.sampleRate;
+        const double start = Time::getMillisecondCounterHiRes() + 500.0;
+
+        callOnMessageThread([this, periodMs, start] {
+            for (int i = 0; i < opts.rooms.size(); ++i) {
+                // spread over a block period
+                const double offset = periodMs * i / opts.rooms.size();
+                rooms.push_back(std::make_unique<Room>(opts.rooms.getReference(i), opts, start + offset));
+            }
+        });
+
+        if (opts.setupFile.isNotEmpty()) {
+            const File setup = File::getCurrentWorkingDirectory().getChildFile(opts.setupFile);
+            MemoryBlock data;
+            if (!setup.loadFileAsData(data)) {
+                fprintf(stderr, "couldn't read the settings file %s\n", setup.getFullPathName().toRawUTF8());
+                return 1;
+            }
+            callOnMessageThread([this, &data] {
+                for (auto & room : rooms) {
+                    room->processor->setStateInformation(data.getData(), (int) data.getSize());
+                }
+            });
+        }
+
+        const int numworkers = opts.workers > 0 ? opts.workers : jmax(1, SystemStats::getNumCpus() - 1);
+        scheduler = std::make_unique<RoomScheduler>(rooms, numworkers, opts.realtime);
+
+        printf("%d rooms on %s:%d, %d DSP workers, %.0f Hz, %d samples per block (%.2f ms)\n",
+               (int) rooms.size(), opts.serverHost.toRawUTF8(), opts.serverPort, scheduler->getNumWorkers(),
+               opts.sampleRate, opts.blockSize, periodMs);
+        fflush(stdout);
+
+        int index = 0;
+        for (auto & room : rooms) {
+            auto & proc = *room->processor;
+            const String username = rooms.size() > 1 ? opts.userName + String(++index) : opts.userName;
+            proc.connectToServer(opts.serverHost, opts.serverPort, username);
+            // no need to wait for the connection, the join goes along with the login
+            proc.setWatchPublicGroups(false);
+            proc.joinServerGroup(room->spec.group, room->spec.password);
+        }
+
+        double nextStatus = Time::getMillisecondCounterHiRes() + opts.statusSeconds * 1000.0;
+        while (!threadShouldExit() && !stopRequested.load()) {
+            Thread::sleep(200);
+            if (opts.statusSeconds > 0.0 && Time::getMillisecondCounterHiRes() > nextStatus) {
+                nextStatus += opts.statusSeconds * 1000.0;
+                printStatus();
+            }
+        }
+
+        printf("stopping\n");
+        fflush(stdout);
+
+        for (auto & room : rooms) {
+            room->processor->disconnectFromServer();
+        }
+
+        scheduler.reset();
+
+        callOnMessageThread([this] {
+            for (auto & room : rooms) {
+                room->processor->removeAllRemotePeers();
+            }
+            rooms.clear();
+        });
+
+        return 0;
+    }
+
+    void printStatus()
+    {
+        int64 blocks = 0, late = 0, stolen = 0;
+        int connected = 0, peers = 0;
+
+        for (auto & room : rooms) {
+            blocks += room->blocks.load();
+            late += room->lateBlocks.load();
+            stolen += room->stolenBlocks.load();
+            const bool conn = room->processor->isConnectedToServer();
+            connected += conn ? 1 : 0;
+            peers += room->processor->getNumberRemotePeers();
+
+            const int64 roomlate = room->lateBlocks.load();
+            if (!conn || roomlate != room->reportedLate) {
+                printf("  %s: %s, %d peers, %lld late blocks\n", room->spec.group.toRawUTF8(),
+                       conn ? "connected" : "not connected", room->processor->getNumberRemotePeers(), (long long) roomlate);
+                room->reportedLate = roomlate;
+            }
+        }
+
+        printf("%d/%d rooms connected, %d peers, %lld blocks, %lld late, %lld taken by another worker\n",
+               connected, (int) rooms.size(), peers, (long long) blocks, (long long) late, (long long) stolen);
+        fflush(stdout);
+    }
+
+    const Options opts;
+    int exitCode = 0;
+
+    std::vector<std::unique_ptr<Room>> rooms;
+    std::unique_ptr<RoomScheduler> scheduler;
+};
+
+bool parseOption(const String & arg, const char * name, String & value)
+{
+    const String prefix = String(name) + "=";
+    if (arg.startsWith(prefix)) {
+        value = arg.substring(prefix.length());
+        return true;
+    }
+    return false;
+}
+
+bool loadRooms(const File & file, Array<RoomSpec> & rooms)
+{
+    if (!file.existsAsFile()) return false;
+
+    StringArray lines;
+    file.readLines(lines);
+    for (auto line : lines) {
+        line = line.upToFirstOccurrenceOf("#", false, false).trim();
+        if (line.isEmpty()) continue;
+        auto fields = StringArray::fromTokens(line, " \t", "\"");
+        fields.removeEmptyStrings();
+        fields.trim();
+        RoomSpec spec;
+        spec.group = fields[0].unquoted();
+        spec.password = fields[1].unquoted();
+        rooms.add(spec);
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char * argv[])
+{
+    Options opts;
+
+    for (int i = 1; i < argc; ++i) {
+        const String arg = CharPointer_UTF8(argv[i]);
+        String v;
+        if (parseOption(arg, "--server", v)) {
+            opts.serverHost = v.upToLastOccurrenceOf(":", false, false);
+            if (v.containsChar(':')) {
+                opts.serverPort = v.fromLastOccurrenceOf(":", false, false).getIntValue();
+            } else {
+                opts.serverHost = v;
+            }
+        } else if (parseOption(arg, "--rooms", v)) {
+            if (!loadRooms(File::getCurrentWorkingDirectory().getChildFile(v), opts.rooms)) {
+                fprintf(stderr, "couldn't read the rooms file %s\n", v.toRawUTF8());
+                return 1;
+            }
+        } else if (parseOption(arg, "--room", v)) {
+            RoomSpec spec;
+            spec.group = v.upToFirstOccurrenceOf(":", false, false);
+            spec.password = v.fromFirstOccurrenceOf(":", false, false);
+            opts.rooms.add(spec);
+        } else if (parseOption(arg, "--user", v)) {
+            opts.userName = v;
+        } else if (parseOption(arg, "--workers", v)) {
+            opts.workers = jmax(1, v.getIntValue());
+        } else if (parseOption(arg, "--samplerate", v)) {
+            opts.sampleRate = jmax(8000.0, v.getDoubleValue());
+        } else if (parseOption(arg, "--blocksize", v)) {
+            opts.blockSize = jmax(16, v.getIntValue());
+        } else if (parseOption(arg, "--setup", v)) {
+            opts.setupFile = v;
+        } else if (parseOption(arg, "--status", v)) {
+            opts.statusSeconds = jmax(0.0, v.getDoubleValue());
+        } else if (arg == "--realtime") {
+            opts.realtime = true;
+        } else {
+            fprintf(stderr, "unknown option %s, see the top of sonobus-roomhost.cpp\n", arg.toRawUTF8());
+            return 1;
+        }
+    }
+
+    if (opts.serverHost.isEmpty() || opts.serverPort <= 0) {
+        fprintf(stderr, "no connection server given, --server=<host[:port]>\n");
+        return 1;
+    }
+    for (int i = opts.rooms.size(); --i >= 0; ) {
+        if (opts.rooms.getReference(i).group.isEmpty()) opts.rooms.remove(i);
+    }
+    if (opts.rooms.isEmpty()) {
+        fprintf(stderr, "no rooms to host, --rooms=<file> or --room=<group>\n");
+        return 1;
+    }
+
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+
+    ScopedJuceInitialiser_GUI juceInit;
+
+    RoomHost host(opts);
+    host.startThread();
+
+    // the processors need a message thread, this is it until the host stops
+    MessageManager::getInstance()->runDispatchLoop();
+
+    host.stopThread(10000);
+    return host.getExitCode();
+}
@@ -1,6 +1,8 @@
 #!/bin/bash
 
-OPTS=-inpl
+# scalar in-place code by default, other faust code generation can be tried with
+# e.g. FAUST_OPTS="-inpl -vec -vs 32" or FAUST_OPTS="-inpl -double"
+OPTS=${FAUST_OPTS:--inpl}
 
 #mkdir -p faustComp
 #faust -a arch.cpp -i -O faustComp -o faustComp.h -scn faustdsp -cn faustComp  compressor.dsp
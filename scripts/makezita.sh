@@ -1,5 +1,7 @@
 #!/bin/bash
 
-OPTS=-inpl
+# scalar in-place code by default, other faust code generation can be tried with
+# e.g. FAUST_OPTS="-inpl -vec -vs 32" or FAUST_OPTS="-inpl -double"
+OPTS=${FAUST_OPTS:--inpl}
 
 faust $OPTS -a arch.cpp -i -O ../Source -o zitaRev.h -scn faustdsp -cn zitaRev  zitaRev.dsp 
@@ -0,0 +1,612 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+// Headless SonoBus connection server.
+//
+// Runs the same AOO server the app can embed, without any GUI or audio.
+// Settings come from a simple key = value file (see sonobus-server.conf),
+// command line options override them. Log lines go to stderr, with sd-daemon
+// priority prefixes when stderr is connected to the journal. Optionally the
+// server statistics are served in the Prometheus text format on /metrics.
+
+#include "aoo/aoo_net.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#ifndef SONOBUS_BUILD_VERSION
+#define SONOBUS_BUILD_VERSION "unknown"
+#endif
+
+#define DEFAULT_SERVER_PORT 10998
+
+namespace {
+
+/*////////////////////////// logging //////////////////////////*/
+
+// syslog priorities, as understood by journald
+enum LogPriority {
+    LogError = 3,
+    LogWarning = 4,
+    LogInfo = 6,
+    LogDebug = 7
+};
+
+bool logToJournal = false;
+
+void logMessage(LogPriority priority, const std::string & msg)
+{
+    if (logToJournal) {
+        // journald adds its own timestamps
+        fprintf(stderr, "<%d>%s\n", (int) priority, msg.c_str());
+    }
+    else {
+        char timestr[32];
+        time_t now = time(nullptr);
+        struct tm tmnow;
+        localtime_r(&now, &tmnow);
+        strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", &tmnow);
+        fprintf(stderr, "%s %s\n", timestr, msg.c_str());
+    }
+    fflush(stderr);
+}
+
+#define SLOG(prio, x) do { std::ostringstream slog_os; slog_os << x; logMessage(prio, slog_os.str()); } while (false)
+
+
+/*////////////////////////// config //////////////////////////*/
+
+struct Config {
+    int port = DEFAULT_SERVER_PORT;
+    int ioThreads = 1;
+    bool relay = true;
+    int relayBandwidth = 0;     // bytes per second and direction, 0 = unlimited
+    int sendQueueLimit = 0;     // bytes per client, 0 = library default
+    int acceptRate = 5;         // per IP address and second, 0 = unlimited
+    int loginRate = 5;
+    int udpRate = 100;
+    std::string snapshot;       // sessions file for warm restarts, empty = off
+    int snapshotInterval = 10;  // seconds
+    std::string xdpInterface;   // AF_XDP for relayed packets, empty = off
+    int xdpQueues = 0;          // 0 = all
+    std::string metricsAddress = "127.0.0.1";
+    int metricsPort = 0;        // 0 = disabled
+    std::vector<std::pair<std::string, int>> nodes; // other servers of the cluster
+};
+
+std::string trim(const std::string & str)
+{
+    const char * space = " \t\r\n";
+    auto start = str.find_first_not_of(space);
+    if (start == std::string::npos) return std::string();
+    auto end = str.find_last_not_of(space);
+    return str.substr(start, end - start + 1);
+}
+
+bool parseInt(const std::string & str, int minval, int & retval)
+{
+    char * end = nullptr;
+    errno = 0;
+    long val = strtol(str.c_str(), &end, 10);
+    if (str.empty() || *end != '\0' || errno != 0 || val < minval || val > INT32_MAX) {
+        return false;
+    }
+    retval = (int) val;
+    return true;
+}
+
+bool parseBool(const std::string & str, bool & retval)
+{
+    if (str == "1" || str == "true" || str == "yes" || str == "on") {
+        retval = true;
+    }
+    else if (str == "0" || str == "false" || str == "no" || str == "off") {
+        retval = false;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+bool applyOption(Config & config, const std::string & key, const std::string & value)
+{
+    if (key == "port") {
+        return parseInt(value, 1, config.port) && config.port <= 65535;
+    }
+    else if (key == "io_threads") {
+        return parseInt(value, 1, config.ioThreads);
+    }
+    else if (key == "relay") {
+        return parseBool(value, config.relay);
+    }
+    else if (key == "relay_bandwidth") {
+        return parseInt(value, 0, config.relayBandwidth);
+    }
+    else if (key == "send_queue_limit") {
+        return parseInt(value, 0, config.sendQueueLimit);
+    }
+    else if (key == "accept_rate") {
+        return parseInt(value, 0, config.acceptRate);
+    }
+    else if (key == "login_rate") {
+        return parseInt(value, 0, config.loginRate);
+    }
+    else if (key == "udp_rate") {
+        return parseInt(value, 0, config.udpRate);
+    }
+    else if (key == "snapshot") {
+        config.snapshot = value;
+        return true;
+    }
+    else if (key == "snapshot_interval") {
+        return parseInt(value, 1, config.snapshotInterval);
+    }
+    else if (key == "xdp_interface") {
+        config.xdpInterface = value;
+        return true;
+    }
+    else if (key == "xdp_queues") {
+        return parseInt(value, 0, config.xdpQueues);
+    }
+    else if (key == "metrics_address") {
+        config.metricsAddress = value;
+        return !value.empty();
+    }
+    else if (key == "metrics_port") {
+        return parseInt(value, 0, config.metricsPort) && config.metricsPort <= 65535;
+    }
+    else if (key == "node") {
+        // host:port, may be given several times
+        auto colon = value.rfind(':');
+        int port = DEFAULT_SERVER_PORT;
+        if (colon != std::string::npos && !parseInt(value.substr(colon + 1), 1, port)) {
+            return false;
+        }
+        auto host = value.substr(0, colon);
+        if (host.empty() || port > 65535) {
+            return false;
+        }
+        config.nodes.emplace_back(host, port);
+        return true;
+    }
+
+    SLOG(LogError, "unknown option '" << key << "'");
+    return false;
+}
+
+bool loadConfig(const std::string & path, Config & config)
+{
+    std::ifstream file(path);
+    if (!file) {
+        SLOG(LogError, "couldn't open config file " << path << ": " << strerror(errno));
+        return false;
+    }
+
+    std::string line;
+    int lineno = 0;
+    bool ok = true;
+
+    while (std::getline(file, line)) {
+        ++lineno;
+        auto comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.erase(comment);
+        }
+        line = trim(line);
+        if (line.empty()) continue;
+
+        auto eq = line.find('=');
+        if (eq == std::string::npos) {
+            SLOG(LogError, path << ":" << lineno << ": expected 'key = value'");
+            ok = false;
+            continue;
+        }
+
+        auto key = trim(line.substr(0, eq));
+        auto value = trim(line.substr(eq + 1));
+        if (!applyOption(config, key, value)) {
+            SLOG(LogError, path << ":" << lineno << ": bad value '" << value << "' for " << key);
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+
+/*////////////////////////// metrics //////////////////////////*/
+
+// Minimal HTTP responder for scraping, one request per connection.
+class MetricsServer
+{
+public:
+    MetricsServer(aoo::net::iserver & server) : aooServer(server) {}
+
+    ~MetricsServer() { stop(); }
+
+    bool start(const std::string & address, int port)
+    {
+        struct sockaddr_in sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons(port);
+        if (inet_pton(AF_INET, address.c_str(), &sa.sin_addr) != 1) {
+            SLOG(LogError, "bad metrics address " << address);
+            return false;
+        }
+
+        listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+        if (listenSocket < 0) {
+            SLOG(LogError, "couldn't create metrics socket: " << strerror(errno));
+            return false;
+        }
+
+        int val = 1;
+        setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+
+        if (bind(listenSocket, (struct sockaddr *) &sa, sizeof(sa)) < 0 || listen(listenSocket, 16) < 0) {
+            SLOG(LogError, "couldn't listen for metrics on " << address << ":" << port << ": " << strerror(errno));
+            close(listenSocket);
+            listenSocket = -1;
+            return false;
+        }
+
+        if (pipe(wakePipe) != 0) {
+            SLOG(LogError, "couldn't create pipe: " << strerror(errno));
+            close(listenSocket);
+            listenSocket = -1;
+            return false;
+        }
+
+        thread = std::thread([this]() { run(); });
+
+        SLOG(LogInfo, "serving metrics on http://" << address << ":" << port << "/metrics");
+        return true;
+    }
+
+    void stop()
+    {
+        if (thread.joinable()) {
+            char c = 0;
+            if (write(wakePipe[1], &c, 1) < 0) {
+                // the thread would still block forever, nothing better to do
+            }
+            thread.join();
+            close(wakePipe[0]);
+            close(wakePipe[1]);
+        }
+        if (listenSocket >= 0) {
+            close(listenSocket);
+            listenSocket = -1;
+        }
+    }
+
+private:
+
+    void run()
+    {
+        while (true) {
+            struct pollfd fds[2];
+            fds[0].fd = listenSocket;
+            fds[0].events = POLLIN;
+            fds[0].revents = 0;
+            fds[1].fd = wakePipe[0];
+            fds[1].events = POLLIN;
+            fds[1].revents = 0;
+
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) continue;
+                SLOG(LogError, "metrics poll failed: " << strerror(errno));
+                return;
+            }
+
+            if (fds[1].revents) {
+                return;
+            }
+
+            if (fds[0].revents & POLLIN) {
+                int sock = accept(listenSocket, nullptr, nullptr);
+                if (sock >= 0) {
+                    handleClient(sock);
+                    close(sock);
+                }
+            }
+        }
+    }
+
+    void handleClient(int sock)
+    {
+        // don't let a stuck scraper hold up the thread
+        struct timeval tv;
+        tv.tv_sec = 2;
+        tv.tv_usec = 0;
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+        std::string request;
+        char buf[1024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+            auto n = recv(sock, buf, sizeof(buf), 0);
+            if (n <= 0) break;
+            request.append(buf, (size_t) n);
+        }
+
+        auto lineEnd = request.find("\r\n");
+        std::istringstream reqline(request.substr(0, lineEnd));
+        std::string method, target;
+        reqline >> method >> target;
+
+        auto query = target.find('?');
+        if (query != std::string::npos) {
+            target.erase(query);
+        }
+
+        if (method != "GET" && method != "HEAD") {
+            sendResponse(sock, "405 Method Not Allowed", "text/plain", "method not allowed\n", true);
+        }
+        else if (target == "/metrics") {
+            sendResponse(sock, "200 OK", "text/plain; version=0.0.4", renderMetrics(), method == "GET");
+        }
+        else {
+            sendResponse(sock, "404 Not Found", "text/plain", "not found, try /metrics\n", method == "GET");
+        }
+    }
+
+    void sendResponse(int sock, const char * status, const char * contentType, const std::string & body, bool withBody)
+    {
+        std::ostringstream os;
+        os << "HTTP/1.0 " << status << "\r\n"
+           << "Content-Type: " << contentType << "\r\n"
+           << "Content-Length: " << body.size() << "\r\n"
+           << "Connection: close\r\n\r\n";
+        if (withBody) {
+            os << body;
+        }
+
+        auto response = os.str();
+        size_t sent = 0;
+        while (sent < response.size()) {
+            auto n = send(sock, response.data() + sent, response.size() - sent, 0);
+            if (n <= 0) break;
+            sent += (size_t) n;
+        }
+    }
+
+    template <typename T>
+    static void addMetric(std::ostringstream & os, const char * name, const char * type, const char * help, T value)
+    {
+        os << "# HELP " << name << " " << help << "\n"
+           << "# TYPE " << name << " " << type << "\n"
+           << name << " " << value << "\n";
+    }
+
+    std::string renderMetrics()
+    {
+        aoonet_server_stats stats;
+        aoonet_server_send_stats sendstats;
+        aoonet_server_relay_stats relaystats;
+        memset(&stats, 0, sizeof(stats));
+        memset(&sendstats, 0, sizeof(sendstats));
+        memset(&relaystats, 0, sizeof(relaystats));
+        aooServer.get_stats(stats);
+        aooServer.get_send_stats(sendstats);
+        aooServer.get_relay_stats(relaystats);
+
+        // rates (e.g. UDP packets per second) are left to rate() on the scraper side
+        std::ostringstream os;
+        addMetric(os, "sonobus_server_connections", "gauge", "Open client connections.", stats.clients);
+        addMetric(os, "sonobus_server_users", "gauge", "Logged in users.", stats.users);
+        addMetric(os, "sonobus_server_groups", "gauge", "Active groups.", stats.groups);
+        addMetric(os, "sonobus_server_cluster_nodes", "gauge", "Other servers of the cluster.", stats.nodes);
+        addMetric(os, "sonobus_server_cluster_remote_members", "gauge", "Group members on the other servers.", stats.remote_members);
+        addMetric(os, "sonobus_server_udp_received_packets_total", "counter", "Received UDP packets.", stats.udp_packets);
+        addMetric(os, "sonobus_server_udp_received_bytes_total", "counter", "Received UDP bytes.", stats.udp_bytes);
+        addMetric(os, "sonobus_server_udp_quick_replies_total", "counter", "Client pings and requests answered without parsing.", stats.quick_replies);
+        addMetric(os, "sonobus_server_tcp_sent_messages_total", "counter", "Messages queued for the clients.", sendstats.messages);
+        addMetric(os, "sonobus_server_tcp_sent_bytes_total", "counter", "Bytes sent to the clients.", sendstats.bytes_sent);
+        addMetric(os, "sonobus_server_tcp_dropped_messages_total", "counter", "Messages dropped because of a full output queue.", sendstats.dropped);
+        addMetric(os, "sonobus_server_tcp_would_block_total", "counter", "Times a client socket was full.", sendstats.would_block);
+        addMetric(os, "sonobus_server_tcp_slow_disconnects_total", "counter", "Clients disconnected because of a full output queue.", sendstats.disconnects);
+        addMetric(os, "sonobus_server_tcp_max_queued_bytes", "gauge", "Largest client output queue seen so far.", sendstats.max_queued);
+        addMetric(os, "sonobus_server_relay_packets_total", "counter", "Relayed or forwarded UDP packets.", relaystats.packets);
+        addMetric(os, "sonobus_server_relay_bytes_total", "counter", "Relayed or forwarded UDP bytes.", relaystats.bytes);
+        addMetric(os, "sonobus_server_relay_dropped_packets_total", "counter", "Relay packets dropped by the bandwidth limit.", relaystats.dropped);
+        addMetric(os, "sonobus_server_relay_rejected_packets_total", "counter", "Relay packets from or to unrelated peers.", relaystats.rejected);
+        addMetric(os, "sonobus_server_relay_sessions", "gauge", "Active relay sessions (one per direction).", relaystats.sessions);
+        addMetric(os, "sonobus_server_rejected_connections_total", "counter", "Connections closed by the per address rate limit.", stats.rejected_accepts);
+        addMetric(os, "sonobus_server_rejected_logins_total", "counter", "Login attempts refused by the per address rate limit.", stats.rejected_logins);
+        addMetric(os, "sonobus_server_rejected_udp_messages_total", "counter", "UDP messages dropped by the per address rate limit.", stats.rejected_udp);
+        addMetric(os, "sonobus_server_loop_iterations_total", "counter", "Handled batches of socket events.", stats.loops);
+        addMetric(os, "sonobus_server_loop_seconds_total", "counter", "Time spent handling socket events.", stats.loop_time * 1e-6);
+        addMetric(os, "sonobus_server_loop_max_seconds", "gauge", "Longest batch of socket events so far.", stats.max_loop_time * 1e-6);
+        return os.str();
+    }
+
+    aoo::net::iserver & aooServer;
+    int listenSocket = -1;
+    int wakePipe[2] = { -1, -1 };
+    std::thread thread;
+};
+
+
+void logStats(aoo::net::iserver & server)
+{
+    aoonet_server_stats stats;
+    aoonet_server_relay_stats relaystats;
+    memset(&stats, 0, sizeof(stats));
+    memset(&relaystats, 0, sizeof(relaystats));
+    server.get_stats(stats);
+    server.get_relay_stats(relaystats);
+
+    SLOG(LogInfo, "connections " << stats.clients << ", users " << stats.users << ", groups " << stats.groups
+         << ", remote members " << stats.remote_members
+         << ", UDP packets " << stats.udp_packets << " (" << stats.udp_bytes << " bytes)"
+         << ", relayed " << relaystats.packets
+         << ", rejected connections/logins/UDP " << stats.rejected_accepts << "/" << stats.rejected_logins << "/" << stats.rejected_udp
+         << ", loop max " << stats.max_loop_time << " us");
+}
+
+void printUsage(const char * name)
+{
+    printf("usage: %s [options]\n"
+           "  -c, --config FILE         read settings from FILE (key = value)\n"
+           "  -p, --port PORT           TCP and UDP port (default %d)\n"
+           "  -t, --io-threads N        threads for the client connections\n"
+           "  -m, --metrics-port PORT   serve Prometheus metrics on PORT (0 = off)\n"
+           "  -a, --metrics-address IP  address for the metrics (default 127.0.0.1)\n"
+           "  -n, --node HOST[:PORT]    another server of the cluster (repeatable)\n"
+           "  -V, --version             print the version\n"
+           "  -h, --help                show this help\n"
+           "\n"
+           "SIGTERM/SIGINT stop the server, SIGHUP logs the current counters.\n",
+           name, DEFAULT_SERVER_PORT);
+}
+
+} // namespace
+
+
+int main(int argc, char ** argv)
+{
+    logToJournal = getenv("JOURNAL_STREAM") != nullptr;
+
+    static const struct option longopts[] = {
+        { "config", required_argument, nullptr, 'c' },
+        { "port", required_argument, nullptr, 'p' },
+        { "io-threads", required_argument, nullptr, 't' },
+        { "metrics-port", required_argument, nullptr, 'm' },
+        { "metrics-address", required_argument, nullptr, 'a' },
+        { "node", required_argument, nullptr, 'n' },
+        { "version", no_argument, nullptr, 'V' },
+        { "help", no_argument, nullptr, 'h' },
+        { nullptr, 0, nullptr, 0 }
+    };
+
+    std::string configPath;
+    // command line options override the config file, whatever their order
+    std::vector<std::pair<std::string, std::string>> overrides;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "c:p:t:m:a:n:Vh", longopts, nullptr)) != -1) {
+        switch (opt) {
+            case 'c': configPath = optarg; break;
+            case 'p': overrides.emplace_back("port", optarg); break;
+            case 't': overrides.emplace_back("io_threads", optarg); break;
+            case 'm': overrides.emplace_back("metrics_port", optarg); break;
+            case 'a': overrides.emplace_back("metrics_address", optarg); break;
+            case 'n': overrides.emplace_back("node", optarg); break;
+            case 'V': printf("sonobus-server %s\n", SONOBUS_BUILD_VERSION); return 0;
+            case 'h': printUsage(argv[0]); return 0;
+            default: printUsage(argv[0]); return 2;
+        }
+    }
+
+    Config config;
+    if (!configPath.empty() && !loadConfig(configPath, config)) {
+        return 2;
+    }
+    for (auto & kv : overrides) {
+        if (!applyOption(config, kv.first, kv.second)) {
+            SLOG(LogError, "bad value '" << kv.second << "' for " << kv.first);
+            return 2;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    // block the signals in all threads, they are picked up with sigwait() below
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+
+    int32_t err = 0;
+    auto server = aoo::net::iserver::create(config.port, &err);
+    if (!server) {
+        SLOG(LogError, "couldn't start server on port " << config.port << ": " << strerror(err));
+        return 1;
+    }
+
+    server->set_io_threads(config.ioThreads);
+    server->set_relay(config.relay, config.relayBandwidth);
+    if (config.sendQueueLimit > 0) {
+        server->set_send_queue_limit(config.sendQueueLimit);
+    }
+    server->set_rate_limits(config.acceptRate, config.loginRate, config.udpRate);
+    if (!config.snapshot.empty()) {
+        server->set_snapshot(config.snapshot.c_str(), config.snapshotInterval);
+        SLOG(LogInfo, "sessions snapshot " << config.snapshot);
+    }
+    if (!config.xdpInterface.empty()) {
+        if (server->set_xdp(config.xdpInterface.c_str(), config.xdpQueues)) {
+            SLOG(LogInfo, "relaying with AF_XDP on " << config.xdpInterface);
+        }
+        else {
+            SLOG(LogWarning, "AF_XDP not available on " << config.xdpInterface << ", relaying through the sockets");
+        }
+    }
+    for (auto & node : config.nodes) {
+        if (server->add_node(node.first.c_str(), node.second)) {
+            SLOG(LogInfo, "cluster node " << node.first << ":" << node.second);
+        }
+        else {
+            SLOG(LogWarning, "couldn't resolve cluster node " << node.first);
+        }
+    }
+
+    MetricsServer metrics(*server);
+    if (config.metricsPort > 0 && !metrics.start(config.metricsAddress, config.metricsPort)) {
+        aoo::net::iserver::destroy(server);
+        return 1;
+    }
+
+    std::thread serverThread([server]() { server->run(); });
+
+    SLOG(LogInfo, "sonobus-server " << SONOBUS_BUILD_VERSION << " listening on port " << config.port
+         << " (" << config.ioThreads << " I/O threads, relay " << (config.relay ? "on" : "off") << ")");
+
+    while (true) {
+        int sig = 0;
+        if (sigwait(&sigs, &sig) != 0) continue;
+
+        if (sig == SIGHUP) {
+            logStats(*server);
+            continue;
+        }
+
+        SLOG(LogInfo, "got signal " << sig << ", shutting down");
+        break;
+    }
+
+    server->quit();
+    serverThread.join();
+    metrics.stop();
+
+    logStats(*server);
+    aoo::net::iserver::destroy(server);
+
+    return 0;
+}